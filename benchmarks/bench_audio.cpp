@@ -0,0 +1,187 @@
+/**
+ * @file benchmarks/bench_audio.cpp
+ * @brief Benchmark the audio path of src/audio.* and src/stream.* without a client.
+ * @details A synthetic tone is captured at the pace of a real device, encoded by the shared
+ *          pipeline and sent by the audio broadcast thread, with FEC and encryption, to a
+ *          loopback socket. Every stream configuration reports the per-packet encode and
+ *          encryption times, the per-block FEC time and the percentiles of the end-to-end
+ *          latency, from the frame being handed to the encoder to the packet being received.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+#include "src/audio.h"
+#include "src/globals.h"
+#include "src/metrics.h"
+#include "src/rtsp.h"
+#include "src/stream.h"
+
+using namespace std::literals;
+using udp = boost::asio::ip::udp;
+
+namespace stream {
+  void audioBroadcastThread(udp::socket &sock);
+}  // namespace stream
+
+namespace {
+  constexpr int packet_duration = 5;
+  constexpr int packet_count = 200;
+
+  /**
+   * @brief Samples recorded by a histogram since an earlier snapshot.
+   * @param name The histogram.
+   * @param before The earlier snapshot.
+   * @return The difference.
+   */
+  metrics::snapshot_t since(std::string_view name, const metrics::snapshot_t &before) {
+    auto after = metrics::histogram(name).snapshot();
+    for (std::size_t x = 0; x < after.buckets.size(); ++x) {
+      after.buckets[x] -= before.buckets[x];
+    }
+    after.count -= before.count;
+    after.sum_us -= before.sum_us;
+    return after;
+  }
+
+  /**
+   * @brief Percentile of latencies in microseconds.
+   * @param latencies The latencies.
+   * @param quantile The quantile, between 0 and 1.
+   * @return The percentile, 0 without latencies.
+   */
+  double percentile_us(std::vector<std::chrono::steady_clock::duration> latencies, double quantile) {
+    if (latencies.empty()) {
+      return 0;
+    }
+
+    auto nth = std::begin(latencies) + (std::size_t) (quantile * (latencies.size() - 1));
+    std::nth_element(std::begin(latencies), nth, std::end(latencies));
+    return (double) std::chrono::duration_cast<std::chrono::microseconds>(*nth).count();
+  }
+
+  /**
+   * @brief Stream packet_count packets of the stream configuration given as argument to a loopback socket.
+   * @details Packets lost on loopback are reported in `lost_packets` rather than failing the run.
+   */
+  void BM_AudioEncodeFecEncryptSend(benchmark::State &state) {
+    auto &stream_config = audio::stream_configs[state.range(0)];
+    state.SetLabel(std::to_string(stream_config.channelCount) + "ch_" + std::to_string(stream_config.bitrate / 1000) + "kbps");
+
+    audio::use_synthetic_capture(true);
+
+    std::vector<std::chrono::steady_clock::duration> latencies;
+    int data_packets = 0;
+    int fec_packets = 0;
+
+    auto before_encode = metrics::histogram("audio_encode"sv).snapshot();
+    auto before_encrypt = metrics::histogram("audio_encrypt"sv).snapshot();
+    auto before_fec = metrics::histogram("audio_fec"sv).snapshot();
+
+    for (auto _ : state) {
+      audio::take_synthetic_capture_times();
+
+      boost::asio::io_context io;
+      udp::socket sender {io, udp::endpoint {boost::asio::ip::address_v4::loopback(), 0}};
+      udp::socket receiver {io, udp::endpoint {boost::asio::ip::address_v4::loopback(), 0}};
+
+      stream::config_t config {};
+      config.audio.packetDuration = packet_duration;
+      config.audio.channels = stream_config.channelCount;
+      config.audio.mask = stream_config.channelCount == 2 ? 0x3 : stream_config.channelCount == 6 ? 0x3F : 0x63F;
+      config.audio.flags[audio::config_t::HIGH_QUALITY] = state.range(0) % 2;
+      config.encryptionFlagsEnabled = SS_ENC_AUDIO;
+
+      rtsp_stream::launch_session_t launch_session {};
+      launch_session.gcm_key = crypto::aes_t(16, 0x42);
+      launch_session.iv = crypto::aes_t(16, 0x24);
+
+      auto session = stream::session::alloc(config, launch_session);
+      session->audio.peer = receiver.local_endpoint();
+      session->localAddress = boost::asio::ip::address_v4::loopback();
+
+      // Receive the data packets on their own thread, so receiving doesn't delay sending
+      std::vector<std::chrono::steady_clock::time_point> received(packet_count);
+      int run_data_packets = 0;
+      std::thread receive_thread {[&]() {
+        std::array<char, 2048> buf;
+        udp::endpoint from;
+        std::function<void(const boost::system::error_code &, std::size_t)> on_receive = [&](const boost::system::error_code &ec, std::size_t bytes) {
+          auto now = std::chrono::steady_clock::now();
+          if (ec || bytes < sizeof(RTP_PACKET)) {
+            return;
+          }
+
+          auto rtp = (PRTP_PACKET) buf.data();
+          if (rtp->packetType == 97) {
+            auto sequence_number = util::endian::big(rtp->sequenceNumber);
+            if (sequence_number < packet_count) {
+              received[sequence_number] = now;
+            }
+            ++run_data_packets;
+          } else {
+            ++fec_packets;
+          }
+
+          if (run_data_packets < packet_count) {
+            receiver.async_receive_from(boost::asio::buffer(buf), from, on_receive);
+          }
+        };
+
+        receiver.async_receive_from(boost::asio::buffer(buf), from, on_receive);
+        io.run_for(std::chrono::milliseconds {packet_count * packet_duration} + 5s);
+      }};
+
+      std::thread broadcast_thread {stream::audioBroadcastThread, std::ref(sender)};
+      std::thread capture_thread {[&]() {
+        audio::capture(session->mail, session->config.audio, session.get());
+      }};
+
+      receive_thread.join();
+      session->shutdown_event->raise(true);
+      capture_thread.join();
+
+      mail::man->queue(mail::audio_packets)->stop();
+      broadcast_thread.join();
+
+      auto captured = audio::take_synthetic_capture_times();
+      for (std::size_t x = 0; x < std::min(captured.size(), received.size()); ++x) {
+        if (received[x] != std::chrono::steady_clock::time_point {}) {
+          latencies.push_back(received[x] - captured[x]);
+        }
+      }
+      data_packets += run_data_packets;
+    }
+
+    audio::use_synthetic_capture(false);
+
+    auto encode = since("audio_encode"sv, before_encode);
+    auto encrypt = since("audio_encrypt"sv, before_encrypt);
+    auto fec = since("audio_fec"sv, before_fec);
+
+    state.counters["lost_packets"] = (double) (state.iterations() * packet_count - data_packets);
+    state.counters["fec_packets"] = (double) fec_packets;
+    state.counters["encode_p99_us"] = (double) encode.percentile(0.99);
+    state.counters["encrypt_p99_us"] = (double) encrypt.percentile(0.99);
+    state.counters["fec_p99_us"] = (double) fec.percentile(0.99);
+    state.counters["latency_p50_us"] = percentile_us(latencies, 0.5);
+    state.counters["latency_p99_us"] = percentile_us(latencies, 0.99);
+    state.counters["latency_p999_us"] = percentile_us(latencies, 0.999);
+  }
+
+  BENCHMARK(BM_AudioEncodeFecEncryptSend)
+    ->ArgName("stream_config")
+    ->DenseRange(0, (int) audio::MAX_STREAM_CONFIG - 1)
+    ->Iterations(1)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+}  // namespace
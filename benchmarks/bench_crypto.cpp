@@ -0,0 +1,86 @@
+/**
+ * @file benchmarks/bench_crypto.cpp
+ * @brief Benchmark the packet encryption of src/crypto.*.
+ */
+// standard includes
+#include <string>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+#include "src/crypto.h"
+
+namespace {
+  crypto::aes_t random_bytes(std::size_t size) {
+    auto bytes = crypto::rand(size);
+    return {std::begin(bytes), std::end(bytes)};
+  }
+
+  /**
+   * @brief Encrypt a single packet of the size given as argument with AES GCM, as for video and control packets.
+   */
+  void BM_GcmEncrypt(benchmark::State &state) {
+    auto size = (std::size_t) state.range(0);
+
+    crypto::cipher::gcm_t cipher {random_bytes(16), false};
+    auto iv = random_bytes(12);
+    auto plaintext = crypto::rand(size);
+    std::vector<std::uint8_t> tagged_cipher(crypto::cipher::tag_size + size);
+
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(cipher.encrypt(plaintext, tagged_cipher.data(), &iv));
+    }
+
+    state.SetBytesProcessed(state.iterations() * size);
+  }
+
+  /**
+   * @brief Encrypt the packets of a FEC block in place with a single cipher setup, as for video shards.
+   */
+  void BM_GcmEncryptInPlace(benchmark::State &state) {
+    constexpr std::size_t count = 64;
+    auto size = (std::size_t) state.range(0);
+
+    crypto::cipher::gcm_t cipher {random_bytes(16), false};
+    std::vector<std::uint8_t> data(count * size);
+    std::vector<std::uint8_t> tags(count * crypto::cipher::tag_size);
+    auto ivs = random_bytes(count * 12);
+
+    std::vector<crypto::cipher::gcm_t::in_place_entry_t> entries;
+    for (std::size_t x = 0; x < count; ++x) {
+      entries.push_back({data.data() + x * size, tags.data() + x * crypto::cipher::tag_size, ivs.data() + x * 12});
+    }
+
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(cipher.encrypt_in_place(entries.data(), count, size, 12));
+      benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * count * size);
+    state.SetItemsProcessed(state.iterations() * count);
+  }
+
+  /**
+   * @brief Encrypt a single packet of the size given as argument with AES CBC, as for audio packets.
+   */
+  void BM_CbcEncrypt(benchmark::State &state) {
+    auto size = (std::size_t) state.range(0);
+
+    crypto::cipher::cbc_t cipher {random_bytes(16), true};
+    auto iv = random_bytes(16);
+    auto plaintext = crypto::rand(size);
+    std::vector<std::uint8_t> cipher_text(crypto::cipher::round_to_pkcs7_padded(size));
+
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(cipher.encrypt(plaintext, cipher_text.data(), &iv));
+    }
+
+    state.SetBytesProcessed(state.iterations() * size);
+  }
+
+  BENCHMARK(BM_GcmEncrypt)->RangeMultiplier(2)->Range(64, 2048);
+  BENCHMARK(BM_GcmEncryptInPlace)->Arg(1040)->Arg(1424);
+  BENCHMARK(BM_CbcEncrypt)->RangeMultiplier(2)->Range(64, 2048);
+}  // namespace
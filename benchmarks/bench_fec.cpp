@@ -0,0 +1,54 @@
+/**
+ * @file benchmarks/bench_fec.cpp
+ * @brief Benchmark the Reed-Solomon encoding behind the video FEC blocks.
+ * @details fec::encode() only adds the shard layout around reed_solomon_encode(),
+ *          so the kernel is measured directly for the shard geometries of a stream.
+ */
+// standard includes
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include "src/rswrapper.h"
+}
+
+namespace {
+  /**
+   * @brief Encode a FEC block of data shards and FEC percentage given as arguments.
+   */
+  void BM_ReedSolomonEncode(benchmark::State &state) {
+    constexpr int blocksize = 1040;  // Packet size of 1024 plus the RTP and video headers
+
+    auto data_shards = (int) state.range(0);
+    auto parity_shards = (data_shards * (int) state.range(1) + 99) / 100;
+
+    reed_solomon_init();
+    auto rs = reed_solomon_new(data_shards, parity_shards);
+
+    auto nr_shards = data_shards + parity_shards;
+    std::vector<std::uint8_t> shards((std::size_t) nr_shards * blocksize);
+    for (std::size_t x = 0; x < shards.size(); ++x) {
+      shards[x] = (std::uint8_t) (x * 31);
+    }
+
+    std::vector<std::uint8_t *> shards_p(nr_shards);
+    for (int x = 0; x < nr_shards; ++x) {
+      shards_p[x] = shards.data() + x * blocksize;
+    }
+
+    for (auto _ : state) {
+      reed_solomon_encode(rs, shards_p.data(), nr_shards, blocksize);
+      benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * data_shards * blocksize);
+
+    reed_solomon_release(rs);
+  }
+
+  BENCHMARK(BM_ReedSolomonEncode)
+    ->ArgNames({"data", "fec%"})
+    ->ArgsProduct({{4, 32, 128, 200}, {20, 50}});
+}  // namespace
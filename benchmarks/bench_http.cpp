@@ -0,0 +1,311 @@
+/**
+ * @file benchmarks/bench_http.cpp
+ * @brief Load test src/nvhttp.* and src/confighttp.* with concurrent clients over loopback.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+#include <Simple-Web-Server/client_https.hpp>
+
+// local includes
+#include "src/config.h"
+#include "src/confighttp.h"
+#include "src/crypto.h"
+#include "src/globals.h"
+#include "src/httpcommon.h"
+#include "src/nvhttp.h"
+#include "src/uuid.h"
+
+using namespace std::literals;
+namespace fs = std::filesystem;
+
+namespace {
+  constexpr std::uint16_t base_port = 48989;  ///< Away from the ports of a host running on the same machine
+
+  /**
+   * @brief Write a file, replacing what it contained.
+   * @param path The path.
+   * @param content The content.
+   */
+  void write_file(const fs::path &path, const std::string &content) {
+    std::ofstream out {path, std::ios::binary | std::ios::trunc};
+    out << content;
+  }
+
+  /**
+   * @brief A host with one paired client and a web UI account, serving on loopback until the benchmarks end.
+   */
+  class host_t {
+  public:
+    host_t() {
+      dir = fs::temp_directory_path() / ("apollo-bench-http-"s + uuid_util::uuid_t::generate().string());
+      fs::create_directories(dir);
+
+      auto host_creds = crypto::gen_creds("Sunshine Gamestream Host"sv, 2048);
+      auto client_creds = crypto::gen_creds("Bench Client"sv, 2048);
+      write_file(dir / "cacert.pem", host_creds.x509);
+      write_file(dir / "cakey.pem", host_creds.pkey);
+      write_file(dir / "client.pem", client_creds.x509);
+      write_file(dir / "client_key.pem", client_creds.pkey);
+
+      client_uuid = uuid_util::uuid_t::generate().string();
+      nlohmann::json state;
+      state["root"]["uniqueid"] = uuid_util::uuid_t::generate().string();
+      state["root"]["named_devices"] = nlohmann::json::array({{
+        {"name", "bench"},
+        {"cert", client_creds.x509},
+        {"uuid", client_uuid},
+      }});
+      write_file(dir / "sunshine_state.json", state.dump());
+
+      config::nvhttp.cert = (dir / "cacert.pem").string();
+      config::nvhttp.pkey = (dir / "cakey.pem").string();
+      config::nvhttp.file_state = (dir / "sunshine_state.json").string();
+      config::sunshine.port = base_port;
+      config::sunshine.address_family = "ipv4";
+
+      config::sunshine.username = "bench";
+      config::sunshine.salt = "bench";
+      config::sunshine.password = util::hex(crypto::hash("bench"s + config::sunshine.salt)).to_string();
+      http::origin_web_ui_allowed = net::PC;
+
+      shutdown_event = mail::man->event(mail::shutdown);
+      nvhttp_thread = std::thread {nvhttp::start};
+      confighttp_thread = std::thread {confighttp::start};
+
+      // The servers are up once the web UI accepts the login
+      for (int x = 0; x < 100 && cookie.empty(); ++x) {
+        std::this_thread::sleep_for(50ms);
+        login();
+      }
+    }
+
+    ~host_t() {
+      shutdown_event->raise(true);
+      nvhttp_thread.join();
+      confighttp_thread.join();
+
+      std::error_code ec;
+      fs::remove_all(dir, ec);
+    }
+
+    /**
+     * @brief Create a client of the HTTPS port of nvhttp with the certificate of the paired client.
+     * @return The client.
+     */
+    std::unique_ptr<SimpleWeb::Client<SimpleWeb::HTTPS>> paired_client() const {
+      return std::make_unique<SimpleWeb::Client<SimpleWeb::HTTPS>>(
+        "127.0.0.1:"s + std::to_string(net::map_port(nvhttp::PORT_HTTPS)),
+        false,
+        (dir / "client.pem").string(),
+        (dir / "client_key.pem").string()
+      );
+    }
+
+    /**
+     * @brief Create a client of the web UI.
+     * @return The client.
+     */
+    std::unique_ptr<SimpleWeb::Client<SimpleWeb::HTTPS>> web_client() const {
+      return std::make_unique<SimpleWeb::Client<SimpleWeb::HTTPS>>("127.0.0.1:"s + std::to_string(net::map_port(confighttp::PORT_HTTPS)), false);
+    }
+
+    fs::path dir;
+    std::string client_uuid;
+    std::string cookie;  ///< Sent by the admin clients
+
+  private:
+    void login() {
+      try {
+        auto client = web_client();
+        SimpleWeb::CaseInsensitiveMultimap headers {{"Content-Type", "application/json"}};
+        auto response = client->request("POST", "/api/login", R"({"username":"bench","password":"bench"})", headers);
+
+        auto set_cookie = response->header.find("Set-Cookie");
+        if (set_cookie != std::end(response->header)) {
+          cookie = set_cookie->second.substr(0, set_cookie->second.find(';'));
+        }
+      } catch (const std::exception &) {
+        // Not listening yet
+      }
+    }
+
+    std::shared_ptr<safe::event_t<bool>> shutdown_event;
+    std::thread nvhttp_thread;
+    std::thread confighttp_thread;
+  };
+
+  host_t &host() {
+    static host_t host;
+    return host;
+  }
+
+  /**
+   * @brief Wakes up every millisecond like the pacing of the video send thread, and records how late it wakes up.
+   * @details The lateness while the clients hammer the host is the impact of the HTTP servers on streaming.
+   */
+  class pacing_probe_t {
+  public:
+    pacing_probe_t():
+        thread {[this]() {
+          auto next = std::chrono::steady_clock::now();
+          while (running) {
+            next += 1ms;
+            std::this_thread::sleep_until(next);
+
+            auto late = std::chrono::steady_clock::now() - next;
+            std::lock_guard lg {mutex};
+            lateness.emplace_back(std::chrono::duration<double, std::micro>(late).count());
+          }
+        }} {
+    }
+
+    /**
+     * @brief Stop the probe.
+     * @param quantile The quantile of the lateness to return.
+     * @return The lateness at the quantile in microseconds.
+     */
+    double stop(double quantile) {
+      running = false;
+      thread.join();
+
+      if (lateness.empty()) {
+        return 0.0;
+      }
+      auto nth = std::begin(lateness) + (std::size_t) (quantile * (lateness.size() - 1));
+      std::nth_element(std::begin(lateness), nth, std::end(lateness));
+      return *nth;
+    }
+
+  private:
+    std::atomic_bool running {true};
+    std::mutex mutex;
+    std::vector<double> lateness;
+    std::thread thread;
+  };
+
+  std::unique_ptr<pacing_probe_t> pacing_probe;  ///< Owned by the first thread of the running benchmark
+
+  /**
+   * @brief Send one kind of request from every benchmark thread, a thread is one client.
+   * @details HTTPS connections are closed after every response, like nvhttp does for Moonlight,
+   *          so every request of a paired client includes a TLS handshake.
+   * @param state The benchmark state.
+   * @param make_client Creates the client of a thread.
+   * @param method The request method.
+   * @param path The request path and query.
+   * @param headers The request headers.
+   */
+  template<class FN>
+  void run_requests(benchmark::State &state, FN &&make_client, const std::string &method, const std::string &path, const SimpleWeb::CaseInsensitiveMultimap &headers = {}) {
+    auto client = make_client();
+
+    if (state.thread_index() == 0) {
+      pacing_probe = std::make_unique<pacing_probe_t>();
+    }
+
+    std::vector<double> latencies;
+    std::size_t failures = 0;
+    for (auto _ : state) {
+      auto begin = std::chrono::steady_clock::now();
+      try {
+        auto response = client->request(method, path, "", headers);
+        auto content = response->content.string();
+        benchmark::DoNotOptimize(content.data());
+        if (response->status_code.compare(0, 3, "200") != 0) {
+          ++failures;
+        }
+      } catch (const std::exception &) {
+        ++failures;
+      }
+      latencies.emplace_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+    }
+
+    std::sort(std::begin(latencies), std::end(latencies));
+    auto percentile = [&latencies](double quantile) {
+      return latencies.empty() ? 0.0 : latencies[(std::size_t) (quantile * (latencies.size() - 1))];
+    };
+
+    state.counters["requests_per_second"] = benchmark::Counter((double) state.iterations(), benchmark::Counter::kIsRate);
+    state.counters["latency_p50_ms"] = benchmark::Counter(percentile(0.5), benchmark::Counter::kAvgThreads);
+    state.counters["latency_p99_ms"] = benchmark::Counter(percentile(0.99), benchmark::Counter::kAvgThreads);
+    state.counters["failures"] = (double) failures;
+
+    if (state.thread_index() == 0) {
+      state.counters["pacing_late_p99_us"] = pacing_probe->stop(0.99);
+      pacing_probe.reset();
+    }
+  }
+
+  /**
+   * @brief Unpaired clients polling serverinfo over plain HTTP, as during discovery.
+   */
+  void BM_HttpServerinfo(benchmark::State &state) {
+    auto &h = host();
+    run_requests(state, []() {
+      return std::make_unique<SimpleWeb::Client<SimpleWeb::HTTP>>("127.0.0.1:"s + std::to_string(net::map_port(nvhttp::PORT_HTTP)));
+    }, "GET", "/serverinfo?uniqueid="s + h.client_uuid);
+  }
+
+  /**
+   * @brief Paired clients polling serverinfo over HTTPS, as the computer list of Moonlight does.
+   */
+  void BM_HttpsServerinfo(benchmark::State &state) {
+    auto &h = host();
+    run_requests(state, [&h]() {
+      return h.paired_client();
+    }, "GET", "/serverinfo?uniqueid="s + h.client_uuid);
+  }
+
+  /**
+   * @brief Paired clients fetching the app list.
+   */
+  void BM_HttpsApplist(benchmark::State &state) {
+    auto &h = host();
+    run_requests(state, [&h]() {
+      return h.paired_client();
+    }, "GET", "/applist?uniqueid="s + h.client_uuid);
+  }
+
+  /**
+   * @brief Paired clients downloading the cover of an app, the default one as the host has no apps.
+   */
+  void BM_HttpsAppasset(benchmark::State &state) {
+    auto &h = host();
+    run_requests(state, [&h]() {
+      return h.paired_client();
+    }, "GET", "/appasset?uniqueid="s + h.client_uuid + "&appid=0&AssetType=2&AssetIdx=0");
+  }
+
+  /**
+   * @brief Admins polling the metrics of the web UI dashboard.
+   */
+  void BM_WebMetrics(benchmark::State &state) {
+    auto &h = host();
+    if (h.cookie.empty()) {
+      state.SkipWithError("Couldn't log in to the web UI");
+      return;
+    }
+
+    run_requests(state, [&h]() {
+      return h.web_client();
+    }, "GET", "/api/metrics", {{"Cookie", h.cookie}});
+  }
+
+  BENCHMARK(BM_HttpServerinfo)->ThreadRange(1, 32)->UseRealTime();
+  BENCHMARK(BM_HttpsServerinfo)->ThreadRange(1, 32)->UseRealTime();
+  BENCHMARK(BM_HttpsApplist)->ThreadRange(1, 32)->UseRealTime();
+  BENCHMARK(BM_HttpsAppasset)->ThreadRange(1, 32)->UseRealTime();
+  BENCHMARK(BM_WebMetrics)->ThreadRange(1, 8)->UseRealTime();
+}  // namespace
@@ -0,0 +1,339 @@
+/**
+ * @file benchmarks/bench_input.cpp
+ * @brief Benchmark the batching of queued input packets in src/input.*.
+ * @details The replays send input captures through the input thread of a session to the
+ *          null input backend, and report the batching ratio and the injection latency
+ *          percentiles. Set APOLLO_INPUT_CAPTURE to the path of a recorded capture to
+ *          replay it as well. A capture is a sequence of records, each made of a
+ *          little-endian uint32 offset in microseconds from the start of the capture,
+ *          a little-endian uint32 payload size and the decrypted control stream input
+ *          payload, starting with its NV_INPUT_HEADER. It is replayed as fast as possible
+ *          and at the recorded pace.
+ */
+// standard includes
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+#include <boost/endian/conversion.hpp>
+
+extern "C" {
+#include <moonlight-common-c/src/Input.h>
+#include <moonlight-common-c/src/Limelight.h>
+}
+
+// local includes
+#include "src/config.h"
+#include "src/input.h"
+#include "src/metrics.h"
+#include "src/utility.h"
+
+using namespace std::literals;
+
+namespace input {
+  enum class batch_result_e;
+  batch_result_e batch(PNV_INPUT_HEADER dest, PNV_INPUT_HEADER src);
+}  // namespace input
+
+namespace {
+  template<class T>
+  T make_packet(std::uint32_t magic) {
+    T packet {};
+    packet.header.size = util::endian::big<std::uint32_t>(sizeof(T) - sizeof(packet.header.size));
+    packet.header.magic = util::endian::little(magic);
+    return packet;
+  }
+
+  /**
+   * @brief Batch a later packet into a queued one of the same type.
+   * @details The queued packet is restored before every attempt,
+   *          so the relative ones never reach their overflow check.
+   */
+  template<class T>
+  void BM_InputBatch(benchmark::State &state, std::uint32_t magic, void (*prepare)(T &)) {
+    auto queued = make_packet<T>(magic);
+    prepare(queued);
+    auto later = queued;
+
+    T dest;
+    for (auto _ : state) {
+      std::memcpy(&dest, &queued, sizeof(T));
+      benchmark::DoNotOptimize(input::batch(&dest.header, &later.header));
+      benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  void rel_mouse(NV_REL_MOUSE_MOVE_PACKET &packet) {
+    packet.deltaX = util::endian::big<std::int16_t>(3);
+    packet.deltaY = util::endian::big<std::int16_t>(-2);
+  }
+
+  void abs_mouse(NV_ABS_MOUSE_MOVE_PACKET &packet) {
+    packet.x = util::endian::big<std::int16_t>(960);
+    packet.y = util::endian::big<std::int16_t>(540);
+    packet.width = util::endian::big<std::int16_t>(1920);
+    packet.height = util::endian::big<std::int16_t>(1080);
+  }
+
+  void scroll(NV_SCROLL_PACKET &packet) {
+    packet.scrollAmt1 = util::endian::big<std::int16_t>(120);
+    packet.scrollAmt2 = packet.scrollAmt1;
+  }
+
+  void hscroll(SS_HSCROLL_PACKET &packet) {
+    packet.scrollAmount = util::endian::big<std::int16_t>(120);
+  }
+
+  void controller(NV_MULTI_CONTROLLER_PACKET &packet) {
+    packet.activeGamepadMask = util::endian::little<std::int16_t>(1);
+    packet.leftStickX = util::endian::little<std::int16_t>(12000);
+  }
+
+  void touch(SS_TOUCH_PACKET &packet) {
+    packet.eventType = LI_TOUCH_EVENT_MOVE;
+  }
+
+  void pen(SS_PEN_PACKET &packet) {
+    packet.eventType = LI_TOUCH_EVENT_MOVE;
+    packet.toolType = LI_TOOL_TYPE_PEN;
+  }
+
+  void controller_touch(SS_CONTROLLER_TOUCH_PACKET &packet) {
+    packet.eventType = LI_TOUCH_EVENT_MOVE;
+  }
+
+  void controller_motion(SS_CONTROLLER_MOTION_PACKET &packet) {
+    packet.motionType = LI_MOTION_TYPE_GYRO;
+  }
+
+  BENCHMARK_CAPTURE(BM_InputBatch<NV_REL_MOUSE_MOVE_PACKET>, rel_mouse, MOUSE_MOVE_REL_MAGIC_GEN5, rel_mouse);
+  BENCHMARK_CAPTURE(BM_InputBatch<NV_ABS_MOUSE_MOVE_PACKET>, abs_mouse, MOUSE_MOVE_ABS_MAGIC, abs_mouse);
+  BENCHMARK_CAPTURE(BM_InputBatch<NV_SCROLL_PACKET>, scroll, SCROLL_MAGIC_GEN5, scroll);
+  BENCHMARK_CAPTURE(BM_InputBatch<SS_HSCROLL_PACKET>, hscroll, SS_HSCROLL_MAGIC, hscroll);
+  BENCHMARK_CAPTURE(BM_InputBatch<NV_MULTI_CONTROLLER_PACKET>, controller, MULTI_CONTROLLER_MAGIC_GEN5, controller);
+  BENCHMARK_CAPTURE(BM_InputBatch<SS_TOUCH_PACKET>, touch, SS_TOUCH_MAGIC, touch);
+  BENCHMARK_CAPTURE(BM_InputBatch<SS_PEN_PACKET>, pen, SS_PEN_MAGIC, pen);
+  BENCHMARK_CAPTURE(BM_InputBatch<SS_CONTROLLER_TOUCH_PACKET>, controller_touch, SS_CONTROLLER_TOUCH_MAGIC, controller_touch);
+  BENCHMARK_CAPTURE(BM_InputBatch<SS_CONTROLLER_MOTION_PACKET>, controller_motion, SS_CONTROLLER_MOTION_MAGIC, controller_motion);
+
+  /**
+   * @brief A control stream input payload and when it was received.
+   */
+  struct record_t {
+    std::chrono::microseconds offset;
+    std::vector<std::uint8_t> payload;
+  };
+
+  using capture_t = std::vector<record_t>;
+
+  template<class T>
+  void add_packet(capture_t &capture, std::chrono::microseconds offset, const T &packet) {
+    auto data = (const std::uint8_t *) &packet;
+    capture.push_back({offset, {data, data + sizeof(T)}});
+  }
+
+  void to_netfloat(netfloat &f, float value) {
+    boost::endian::endian_store<float, sizeof(float), boost::endian::order::little>(f, value);
+  }
+
+  capture_t mouse_capture() {
+    capture_t capture;
+    for (int x = 0; x < 1000; ++x) {
+      auto offset = std::chrono::microseconds {x * 1000};
+      if (x % 50 == 0) {
+        auto button = make_packet<NV_MOUSE_BUTTON_PACKET>(x % 100 ? MOUSE_BUTTON_UP_EVENT_MAGIC_GEN5 : MOUSE_BUTTON_DOWN_EVENT_MAGIC_GEN5);
+        button.button = BUTTON_LEFT;
+        add_packet(capture, offset, button);
+      } else if (x % 25 == 0) {
+        auto packet = make_packet<NV_SCROLL_PACKET>(SCROLL_MAGIC_GEN5);
+        scroll(packet);
+        add_packet(capture, offset, packet);
+      } else {
+        auto move = make_packet<NV_REL_MOUSE_MOVE_PACKET>(MOUSE_MOVE_REL_MAGIC_GEN5);
+        move.deltaX = util::endian::big<std::int16_t>(x % 7 - 3);
+        move.deltaY = util::endian::big<std::int16_t>(x % 5 - 2);
+        add_packet(capture, offset, move);
+      }
+    }
+    return capture;
+  }
+
+  capture_t keyboard_capture() {
+    capture_t capture;
+    for (int x = 0; x < 200; ++x) {
+      auto key = make_packet<NV_KEYBOARD_PACKET>(x % 2 ? KEY_UP_EVENT_MAGIC : KEY_DOWN_EVENT_MAGIC);
+      key.keyCode = 0x41 + (x / 2) % 26;
+      add_packet(capture, std::chrono::microseconds {x * 5000}, key);
+    }
+    return capture;
+  }
+
+  capture_t controller_capture() {
+    constexpr int controllers = 4;
+
+    capture_t capture;
+    for (int x = 0; x < 1000; ++x) {
+      auto state = make_packet<NV_MULTI_CONTROLLER_PACKET>(MULTI_CONTROLLER_MAGIC_GEN5);
+      state.controllerNumber = x % controllers;
+      state.activeGamepadMask = (1 << controllers) - 1;
+      state.buttonFlags = (x / controllers) % 16 == 0 ? A_FLAG : 0;
+      state.leftStickX = (short) ((x * 997) % 65536 - 32768);
+      state.rightTrigger = (unsigned char) x;
+      add_packet(capture, std::chrono::microseconds {x * 1000 / controllers}, state);
+    }
+    return capture;
+  }
+
+  capture_t touch_capture() {
+    capture_t capture;
+    for (int x = 0; x < 512; ++x) {
+      auto touch = make_packet<SS_TOUCH_PACKET>(SS_TOUCH_MAGIC);
+      touch.eventType = x % 32 == 0 ? LI_TOUCH_EVENT_DOWN : x % 32 == 31 ? LI_TOUCH_EVENT_UP : LI_TOUCH_EVENT_MOVE;
+      touch.rotation = util::endian::little<std::uint16_t>(LI_ROT_UNKNOWN);
+      touch.pointerId = util::endian::little<std::uint32_t>(x / 32);
+      to_netfloat(touch.x, (x % 32) / 32.0f);
+      to_netfloat(touch.y, 0.5f);
+      to_netfloat(touch.pressureOrDistance, 1.0f);
+      add_packet(capture, std::chrono::microseconds {x * 4000}, touch);
+    }
+    return capture;
+  }
+
+  capture_t pen_capture() {
+    capture_t capture;
+    for (int x = 0; x < 512; ++x) {
+      auto pen = make_packet<SS_PEN_PACKET>(SS_PEN_MAGIC);
+      pen.eventType = x % 16 == 0 ? LI_TOUCH_EVENT_HOVER : LI_TOUCH_EVENT_MOVE;
+      pen.toolType = LI_TOOL_TYPE_PEN;
+      pen.rotation = util::endian::little<std::uint16_t>(LI_ROT_UNKNOWN);
+      pen.tilt = LI_TILT_UNKNOWN;
+      to_netfloat(pen.x, 0.5f);
+      to_netfloat(pen.y, (x % 64) / 64.0f);
+      to_netfloat(pen.pressureOrDistance, 0.5f);
+      add_packet(capture, std::chrono::microseconds {x * 4000}, pen);
+    }
+    return capture;
+  }
+
+  /**
+   * @brief Read the recorded capture APOLLO_INPUT_CAPTURE points to, see the file comment for the format.
+   */
+  capture_t recorded_capture() {
+    auto path = std::getenv("APOLLO_INPUT_CAPTURE");
+    if (!path) {
+      return {};
+    }
+
+    std::ifstream in {path, std::ios::binary};
+
+    capture_t capture;
+    std::uint32_t fields[2];
+    while (in.read((char *) fields, sizeof(fields))) {
+      record_t record {
+        std::chrono::microseconds {boost::endian::little_to_native(fields[0])},
+        std::vector<std::uint8_t>(boost::endian::little_to_native(fields[1]))
+      };
+      if (!in.read((char *) record.payload.data(), record.payload.size())) {
+        break;
+      }
+      capture.push_back(std::move(record));
+    }
+    return capture;
+  }
+
+  /**
+   * @brief Injection latency samples recorded since an earlier snapshot.
+   */
+  metrics::snapshot_t since(const metrics::snapshot_t &before) {
+    auto after = metrics::histogram("input_injection"sv).snapshot();
+    for (std::size_t x = 0; x < after.buckets.size(); ++x) {
+      after.buckets[x] -= before.buckets[x];
+    }
+    after.count -= before.count;
+    after.sum_us -= before.sum_us;
+    return after;
+  }
+
+  /**
+   * @brief Replay a capture through the input thread of a session into the null input backend.
+   * @details The iteration time runs from the first packet being passed through to the last backend call.
+   *          The input thread batches with the coalescing delay of a session.
+   */
+  void BM_InputReplay(benchmark::State &state, capture_t (*make_capture)(), bool paced) {
+    auto capture = make_capture();
+    if (capture.empty()) {
+      state.SkipWithError("APOLLO_INPUT_CAPTURE is not set or empty");
+      return;
+    }
+
+    auto saved_input_config = config::input;
+    config::input.latency_tracing = true;
+    input::use_null_backend(true);
+
+    auto mail = std::make_shared<safe::mail_raw_t>();
+    auto session_input = input::alloc(mail);
+
+    input::touch_port_t touch_port {};
+    touch_port.width = touch_port.env_width = 1920;
+    touch_port.height = touch_port.env_height = 1080;
+    touch_port.scalar_inv = 1.0f;
+    mail->event(mail::touch_port)->raise(touch_port);
+
+    auto before = input::null_backend_stats();
+    auto latency_before = metrics::histogram("input_injection"sv).snapshot();
+
+    for (auto _ : state) {
+      auto iteration_before = input::null_backend_stats().calls;
+      auto start = std::chrono::steady_clock::now();
+      for (auto &record : capture) {
+        if (paced) {
+          std::this_thread::sleep_until(start + record.offset);
+        }
+        auto payload = record.payload;
+        input::passthrough(session_input, std::move(payload), crypto::PERM::_all_inputs);
+      }
+
+      // Wait for the input thread to go idle
+      auto calls = input::null_backend_stats().calls;
+      for (auto deadline = std::chrono::steady_clock::now() + 5s; std::chrono::steady_clock::now() < deadline;) {
+        std::this_thread::sleep_for(20ms);
+        auto count = input::null_backend_stats().calls;
+        if (count == calls && count > iteration_before) {
+          break;
+        }
+        calls = count;
+      }
+
+      state.SetIterationTime(std::chrono::duration<double>(input::null_backend_stats().last_call - start).count());
+    }
+
+    auto calls = input::null_backend_stats().calls - before.calls;
+    auto latency = since(latency_before);
+
+    session_input.reset();
+    input::use_null_backend(false);
+    config::input = saved_input_config;
+
+    state.SetItemsProcessed(state.iterations() * capture.size());
+    state.counters["backend_calls"] = benchmark::Counter((double) calls, benchmark::Counter::kAvgIterations);
+    state.counters["packets_per_call"] = calls ? (double) (state.iterations() * capture.size()) / calls : 0.0;
+    state.counters["latency_p50_us"] = (double) latency.percentile(0.5);
+    state.counters["latency_p99_us"] = (double) latency.percentile(0.99);
+    state.counters["latency_p999_us"] = (double) latency.percentile(0.999);
+  }
+
+  BENCHMARK_CAPTURE(BM_InputReplay, mouse, mouse_capture, false)->UseManualTime()->Unit(benchmark::kMillisecond);
+  BENCHMARK_CAPTURE(BM_InputReplay, keyboard, keyboard_capture, false)->UseManualTime()->Unit(benchmark::kMillisecond);
+  BENCHMARK_CAPTURE(BM_InputReplay, controller, controller_capture, false)->UseManualTime()->Unit(benchmark::kMillisecond);
+  BENCHMARK_CAPTURE(BM_InputReplay, touch, touch_capture, false)->UseManualTime()->Unit(benchmark::kMillisecond);
+  BENCHMARK_CAPTURE(BM_InputReplay, pen, pen_capture, false)->UseManualTime()->Unit(benchmark::kMillisecond);
+  BENCHMARK_CAPTURE(BM_InputReplay, recorded, recorded_capture, false)->UseManualTime()->Unit(benchmark::kMillisecond);
+  BENCHMARK_CAPTURE(BM_InputReplay, recorded_paced, recorded_capture, true)->UseManualTime()->Iterations(1)->Unit(benchmark::kMillisecond);
+}  // namespace
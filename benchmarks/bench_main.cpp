@@ -0,0 +1,26 @@
+/**
+ * @file benchmarks/bench_main.cpp
+ * @brief Entry point definition for the micro-benchmarks.
+ */
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+#include "src/globals.h"
+#include "src/logging.h"
+
+int main(int argc, char **argv) {
+  mail::man = std::make_shared<safe::mail_raw_t>();
+
+  // Only warnings and errors, logging from the kernels would be measured along with them
+  auto deinit_log = logging::init(3, "bench_sunshine.log");
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+/**
+ * @file benchmarks/bench_stream.cpp
+ * @brief Benchmark the per-frame payload processing of src/stream.*.
+ */
+// standard includes
+#include <string>
+#include <string_view>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+using namespace std::literals;
+
+namespace stream {
+  void replace(std::vector<std::string_view> &segments, const std::string_view &old, const std::string_view &_new, const char *hint = nullptr);
+}  // namespace stream
+
+namespace {
+  constexpr auto old_sps = "\x00\x00\x00\x01\x67\x64\x00\x2a\xac\xd9\x40\x78"sv;
+  constexpr auto new_sps = "\x00\x00\x00\x01\x67\x64\x00\x2a\xac\xd9\x40\x78\x02\x27\xe5\x9a"sv;
+
+  /**
+   * @brief Replace the parameter sets at the end of a payload of the size given as argument.
+   * @details The second argument passes the location of the parameter sets as a hint,
+   *          as the encoder reports it, instead of searching the payload for them.
+   */
+  void BM_StreamReplace(benchmark::State &state) {
+    auto size = (std::size_t) state.range(0);
+    auto use_hint = state.range(1) != 0;
+
+    std::string payload(size, '\x5a');
+    payload.replace(size - old_sps.size(), old_sps.size(), old_sps);
+    auto hint = payload.data() + size - old_sps.size();
+
+    std::vector<std::string_view> segments;
+    segments.reserve(3);
+    for (auto _ : state) {
+      segments.assign(1, payload);
+      stream::replace(segments, old_sps, new_sps, use_hint ? hint : nullptr);
+      benchmark::DoNotOptimize(segments.data());
+    }
+
+    state.SetBytesProcessed(state.iterations() * size);
+  }
+
+  BENCHMARK(BM_StreamReplace)
+    ->ArgNames({"bytes", "hint"})
+    ->ArgsProduct({benchmark::CreateRange(1 << 10, 1 << 20, 8), {0, 1}});
+}  // namespace
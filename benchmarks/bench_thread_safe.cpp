@@ -0,0 +1,61 @@
+/**
+ * @file benchmarks/bench_thread_safe.cpp
+ * @brief Benchmark the handoff between pipeline threads through src/thread_safe.*.
+ */
+// standard includes
+#include <thread>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+#include "src/thread_safe.h"
+
+namespace {
+  /**
+   * @brief Hand an element to another thread and wait for it to come back.
+   * @details Every iteration is a round trip through two queues, i.e. two handoffs,
+   *          each one waking up a thread blocked in pop() as the pipeline stages do.
+   */
+  void BM_QueueHandoff(benchmark::State &state) {
+    safe::queue_t<int> ping;
+    safe::queue_t<int> pong;
+
+    std::thread echo {[&]() {
+      while (auto value = ping.pop()) {
+        pong.raise(*value);
+      }
+    }};
+
+    int value = 0;
+    for (auto _ : state) {
+      ping.raise(value);
+      benchmark::DoNotOptimize(value = *pong.pop());
+      ++value;
+    }
+
+    ping.stop();
+    echo.join();
+
+    state.SetItemsProcessed(state.iterations() * 2);
+  }
+
+  /**
+   * @brief Raise and pop on the same thread, the cost of the queue without the wakeup.
+   */
+  void BM_QueueUncontended(benchmark::State &state) {
+    safe::queue_t<int> queue;
+
+    int value = 0;
+    for (auto _ : state) {
+      queue.raise(value);
+      benchmark::DoNotOptimize(value = *queue.pop());
+      ++value;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  BENCHMARK(BM_QueueHandoff)->UseRealTime();
+  BENCHMARK(BM_QueueUncontended);
+}  // namespace
@@ -0,0 +1,117 @@
+/**
+ * @file benchmarks/bench_video_convert.cpp
+ * @brief Benchmark the conversion of captured frames for the software encoders.
+ */
+// standard includes
+#include <array>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+// local includes
+#include "src/video_colorspace.h"
+#include "src/video_convert.h"
+
+using video::yuv_layout_e;
+
+namespace {
+  constexpr int width = 1920;
+  constexpr int height = 1080;
+
+  constexpr std::array layouts {
+    yuv_layout_e::nv12,
+    yuv_layout_e::p010,
+    yuv_layout_e::yuv420p,
+    yuv_layout_e::yuv420p10,
+    yuv_layout_e::yuv444p,
+    yuv_layout_e::yuv444p10,
+  };
+
+  std::vector<std::uint8_t> bgrx_image(int image_width, int image_height) {
+    std::vector<std::uint8_t> image((std::size_t) image_width * image_height * 4);
+    for (std::size_t x = 0; x < image.size(); ++x) {
+      image[x] = (std::uint8_t) (x * 7 + x / 4093);
+    }
+    return image;
+  }
+
+  /**
+   * @brief Convert a 1080p frame into the layout given as first argument, with the SIMD kernels unless the second one is 0.
+   */
+  void BM_BgrxToYuv(benchmark::State &state) {
+    auto layout = layouts[state.range(0)];
+    auto allow_simd = state.range(1) != 0;
+
+    auto high_depth = video::bit_depth_from_yuv_layout(layout) > 8;
+    auto color_vectors = video::new_color_vectors_from_colorspace({video::colorspace_e::rec709, false, high_depth ? 10u : 8u});
+    video::bgrx_to_yuv_t converter {layout, *color_vectors, allow_simd};
+
+    // Planes of 4:4:4 at 16 bits per sample are enough for every layout
+    std::vector<std::uint8_t> planes[3];
+    std::uint8_t *data[3];
+    int pitch[3];
+    for (int x = 0; x < 3; ++x) {
+      pitch[x] = width * 4;
+      planes[x].resize((std::size_t) pitch[x] * height);
+      data[x] = planes[x].data();
+    }
+
+    auto image = bgrx_image(width, height);
+    for (auto _ : state) {
+      converter.convert(image.data(), width * 4, width, height, data, pitch);
+      benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * image.size());
+    state.SetLabel(converter.kernel_name());
+  }
+
+  /**
+   * @brief Convert a frame of the height given as argument into a 1080p NV12 frame with libswscale,
+   *        as the software encoders do for the formats the converters don't handle and when scaling.
+   */
+  void BM_SwscaleToNv12(benchmark::State &state) {
+    auto in_height = (int) state.range(0);
+    auto in_width = in_height * 16 / 9;
+
+    auto sws = sws_getContext(in_width, in_height, AV_PIX_FMT_BGR0, width, height, AV_PIX_FMT_NV12, SWS_LANCZOS | SWS_ACCURATE_RND, nullptr, nullptr, nullptr);
+    if (!sws) {
+      state.SkipWithError("Failed to initialize SWS");
+      return;
+    }
+
+    auto frame = av_frame_alloc();
+    frame->width = width;
+    frame->height = height;
+    frame->format = AV_PIX_FMT_NV12;
+    av_frame_get_buffer(frame, 0);
+
+    auto image = bgrx_image(in_width, in_height);
+    const std::uint8_t *src[] {image.data()};
+    int src_pitch[] {in_width * 4};
+
+    for (auto _ : state) {
+      sws_scale(sws, src, src_pitch, 0, in_height, frame->data, frame->linesize);
+      benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * image.size());
+
+    av_frame_free(&frame);
+    sws_freeContext(sws);
+  }
+
+  BENCHMARK(BM_BgrxToYuv)
+    ->ArgNames({"layout", "simd"})
+    ->ArgsProduct({benchmark::CreateDenseRange(0, layouts.size() - 1, 1), {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+  BENCHMARK(BM_SwscaleToNv12)->Arg(1080)->Arg(1440)->Unit(benchmark::kMicrosecond);
+}  // namespace
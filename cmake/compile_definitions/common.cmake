@@ -63,6 +63,14 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/cbs.cpp"
         "${CMAKE_SOURCE_DIR}/src/utility.h"
         "${CMAKE_SOURCE_DIR}/src/uuid.h"
+        "${CMAKE_SOURCE_DIR}/src/admission.cpp"
+        "${CMAKE_SOURCE_DIR}/src/admission.h"
+        "${CMAKE_SOURCE_DIR}/src/asset_cache.cpp"
+        "${CMAKE_SOURCE_DIR}/src/asset_cache.h"
+        "${CMAKE_SOURCE_DIR}/src/calibration.cpp"
+        "${CMAKE_SOURCE_DIR}/src/calibration.h"
+        "${CMAKE_SOURCE_DIR}/src/clipboard.cpp"
+        "${CMAKE_SOURCE_DIR}/src/clipboard.h"
         "${CMAKE_SOURCE_DIR}/src/config.h"
         "${CMAKE_SOURCE_DIR}/src/config.cpp"
         "${CMAKE_SOURCE_DIR}/src/display_device.h"
@@ -71,20 +79,44 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/entry_handler.h"
         "${CMAKE_SOURCE_DIR}/src/file_handler.cpp"
         "${CMAKE_SOURCE_DIR}/src/file_handler.h"
+        "${CMAKE_SOURCE_DIR}/src/fleet.cpp"
+        "${CMAKE_SOURCE_DIR}/src/fleet.h"
         "${CMAKE_SOURCE_DIR}/src/globals.cpp"
         "${CMAKE_SOURCE_DIR}/src/globals.h"
+        "${CMAKE_SOURCE_DIR}/src/gpu_placement.cpp"
+        "${CMAKE_SOURCE_DIR}/src/gpu_placement.h"
+        "${CMAKE_SOURCE_DIR}/src/gpu_stats.cpp"
+        "${CMAKE_SOURCE_DIR}/src/gpu_stats.h"
+        "${CMAKE_SOURCE_DIR}/src/hot_log.cpp"
+        "${CMAKE_SOURCE_DIR}/src/hot_log.h"
         "${CMAKE_SOURCE_DIR}/src/logging.cpp"
         "${CMAKE_SOURCE_DIR}/src/logging.h"
+        "${CMAKE_SOURCE_DIR}/src/log_rotation.cpp"
+        "${CMAKE_SOURCE_DIR}/src/log_rotation.h"
+        "${CMAKE_SOURCE_DIR}/src/log_view.cpp"
+        "${CMAKE_SOURCE_DIR}/src/log_view.h"
+        "${CMAKE_SOURCE_DIR}/src/live_events.cpp"
+        "${CMAKE_SOURCE_DIR}/src/live_events.h"
         "${CMAKE_SOURCE_DIR}/src/main.cpp"
         "${CMAKE_SOURCE_DIR}/src/main.h"
+        "${CMAKE_SOURCE_DIR}/src/metrics.cpp"
+        "${CMAKE_SOURCE_DIR}/src/metrics.h"
+        "${CMAKE_SOURCE_DIR}/src/pipeline_trace.cpp"
+        "${CMAKE_SOURCE_DIR}/src/pipeline_trace.h"
         "${CMAKE_SOURCE_DIR}/src/crypto.cpp"
         "${CMAKE_SOURCE_DIR}/src/crypto.h"
         "${CMAKE_SOURCE_DIR}/src/nvhttp.cpp"
         "${CMAKE_SOURCE_DIR}/src/nvhttp.h"
+        "${CMAKE_SOURCE_DIR}/src/xml_writer.cpp"
+        "${CMAKE_SOURCE_DIR}/src/xml_writer.h"
         "${CMAKE_SOURCE_DIR}/src/httpcommon.cpp"
         "${CMAKE_SOURCE_DIR}/src/httpcommon.h"
         "${CMAKE_SOURCE_DIR}/src/confighttp.cpp"
         "${CMAKE_SOURCE_DIR}/src/confighttp.h"
+        "${CMAKE_SOURCE_DIR}/src/recording.cpp"
+        "${CMAKE_SOURCE_DIR}/src/recording.h"
+        "${CMAKE_SOURCE_DIR}/src/roi.cpp"
+        "${CMAKE_SOURCE_DIR}/src/roi.h"
         "${CMAKE_SOURCE_DIR}/src/rtsp.cpp"
         "${CMAKE_SOURCE_DIR}/src/rtsp.h"
         "${CMAKE_SOURCE_DIR}/src/stream.cpp"
@@ -93,19 +125,29 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/video.h"
         "${CMAKE_SOURCE_DIR}/src/video_colorspace.cpp"
         "${CMAKE_SOURCE_DIR}/src/video_colorspace.h"
+        "${CMAKE_SOURCE_DIR}/src/video_convert.cpp"
+        "${CMAKE_SOURCE_DIR}/src/video_convert.h"
         "${CMAKE_SOURCE_DIR}/src/input.cpp"
         "${CMAKE_SOURCE_DIR}/src/input.h"
         "${CMAKE_SOURCE_DIR}/src/audio.cpp"
         "${CMAKE_SOURCE_DIR}/src/audio.h"
+        "${CMAKE_SOURCE_DIR}/src/audio_convert.cpp"
+        "${CMAKE_SOURCE_DIR}/src/audio_convert.h"
+        "${CMAKE_SOURCE_DIR}/src/bench.cpp"
+        "${CMAKE_SOURCE_DIR}/src/bench.h"
         "${CMAKE_SOURCE_DIR}/src/platform/common.h"
         "${CMAKE_SOURCE_DIR}/src/process.cpp"
         "${CMAKE_SOURCE_DIR}/src/process.h"
         "${CMAKE_SOURCE_DIR}/src/network.cpp"
         "${CMAKE_SOURCE_DIR}/src/network.h"
+        "${CMAKE_SOURCE_DIR}/src/overload.cpp"
+        "${CMAKE_SOURCE_DIR}/src/overload.h"
         "${CMAKE_SOURCE_DIR}/src/move_by_copy.h"
         "${CMAKE_SOURCE_DIR}/src/system_tray.cpp"
         "${CMAKE_SOURCE_DIR}/src/system_tray.h"
         "${CMAKE_SOURCE_DIR}/src/task_pool.h"
+        "${CMAKE_SOURCE_DIR}/src/thread_placement.cpp"
+        "${CMAKE_SOURCE_DIR}/src/thread_placement.h"
         "${CMAKE_SOURCE_DIR}/src/thread_pool.h"
         "${CMAKE_SOURCE_DIR}/src/thread_safe.h"
         "${CMAKE_SOURCE_DIR}/src/sync.h"
@@ -125,6 +167,8 @@ list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_ASSETS_DIR="${SUNSHINE_ASSETS_DIR_DEF}
 
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_TRAY=${SUNSHINE_TRAY})
 
+list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_HOT_LOG_MIN_LEVEL=${SUNSHINE_HOT_LOG_MIN_LEVEL})
+
 # Publisher metadata
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_PUBLISHER_NAME="${SUNSHINE_PUBLISHER_NAME}")
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_PUBLISHER_WEBSITE="${SUNSHINE_PUBLISHER_WEBSITE}")
@@ -153,4 +197,11 @@ list(APPEND SUNSHINE_EXTERNAL_LIBRARIES
         ${FFMPEG_LIBRARIES}
         ${Boost_LIBRARIES}
         ${OPENSSL_LIBRARIES}
+        ZLIB::ZLIB
         ${PLATFORM_LIBRARIES})
+
+if(BROTLI_FOUND)
+    list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_BROTLI=1)
+    include_directories(SYSTEM ${BROTLI_INCLUDE_DIRS})
+    list(APPEND SUNSHINE_EXTERNAL_LIBRARIES ${BROTLI_LIBRARIES})
+endif()
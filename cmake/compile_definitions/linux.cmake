@@ -164,6 +164,27 @@ if(X11_FOUND)
             "${CMAKE_SOURCE_DIR}/src/platform/linux/x11grab.cpp")
 endif()
 
+# xdg desktop portal
+if(${SUNSHINE_ENABLE_PORTAL} AND ${WAYLAND_FOUND})
+    pkg_check_modules(PIPEWIRE libpipewire-0.3)
+    pkg_check_modules(GIO gio-unix-2.0)
+endif()
+if(PIPEWIRE_FOUND AND GIO_FOUND)
+    add_compile_definitions(SUNSHINE_BUILD_PORTAL)
+    include_directories(SYSTEM ${PIPEWIRE_INCLUDE_DIRS} ${GIO_INCLUDE_DIRS})
+    list(APPEND PLATFORM_LIBRARIES ${PIPEWIRE_LIBRARIES} ${GIO_LIBRARIES})
+    list(APPEND PLATFORM_TARGET_FILES
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/portalgrab.cpp")
+endif()
+
+# io_uring
+if(${SUNSHINE_ENABLE_IO_URING})
+    pkg_check_modules(LIBURING liburing>=2.3 REQUIRED)
+    add_compile_definitions(SUNSHINE_BUILD_IO_URING)
+    include_directories(SYSTEM ${LIBURING_INCLUDE_DIRS})
+    list(APPEND PLATFORM_LIBRARIES ${LIBURING_LIBRARIES})
+endif()
+
 if(NOT ${CUDA_FOUND}
         AND NOT ${WAYLAND_FOUND}
         AND NOT ${X11_FOUND}
@@ -238,7 +259,11 @@ list(APPEND PLATFORM_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/platform/linux/graphics.cpp"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/misc.h"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/misc.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/virtual_output.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/virtual_output.cpp"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/audio.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/nvml.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/nvml.cpp"
         "${CMAKE_SOURCE_DIR}/third-party/glad/src/egl.c"
         "${CMAKE_SOURCE_DIR}/third-party/glad/src/gl.c"
         "${CMAKE_SOURCE_DIR}/third-party/glad/include/EGL/eglplatform.h"
@@ -248,8 +273,7 @@ list(APPEND PLATFORM_TARGET_FILES
 
 list(APPEND PLATFORM_LIBRARIES
         dl
-        pulse
-        pulse-simple)
+        pulse)
 
 include_directories(
         SYSTEM
@@ -42,10 +42,22 @@ set(PLATFORM_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/platform/macos/nv12_zero_device.cpp"
         "${CMAKE_SOURCE_DIR}/src/platform/macos/nv12_zero_device.h"
         "${CMAKE_SOURCE_DIR}/src/platform/macos/publish.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/macos/vt_encoder.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/macos/vt_encoder.h"
         "${CMAKE_SOURCE_DIR}/third-party/TPCircularBuffer/TPCircularBuffer.c"
         "${CMAKE_SOURCE_DIR}/third-party/TPCircularBuffer/TPCircularBuffer.h"
         ${APPLE_PLIST_FILE})
 
+if(SUNSHINE_ENABLE_SCREENCAPTUREKIT)
+    add_compile_definitions(SUNSHINE_BUILD_SCREENCAPTUREKIT)
+    # ScreenCaptureKit is only used when present at runtime, so older macOS versions can still start
+    list(APPEND SUNSHINE_EXTERNAL_LIBRARIES
+            "-weak_framework ScreenCaptureKit")
+    list(APPEND PLATFORM_TARGET_FILES
+            "${CMAKE_SOURCE_DIR}/src/platform/macos/sc_video.h"
+            "${CMAKE_SOURCE_DIR}/src/platform/macos/sc_video.m")
+endif()
+
 if(SUNSHINE_ENABLE_TRAY)
     list(APPEND SUNSHINE_EXTERNAL_LIBRARIES
             ${COCOA})
@@ -21,6 +21,10 @@ find_package(OpenSSL REQUIRED)
 find_package(PkgConfig REQUIRED)
 find_package(Threads REQUIRED)
 pkg_check_modules(CURL REQUIRED libcurl)
+find_package(ZLIB REQUIRED)
+
+# brotli is optional, the web ui is then only precompressed with gzip
+pkg_check_modules(BROTLI libbrotlienc)
 
 # miniupnp
 pkg_check_modules(MINIUPNP miniupnpc REQUIRED)
@@ -9,10 +9,14 @@ set(SUNSHINE_PUBLISHER_ISSUE_URL "https://github.com/ClassicOldSong/Apollo/issue
 
 option(BUILD_DOCS "Build documentation" OFF)
 option(BUILD_TESTS "Build tests" OFF)
+option(BUILD_BENCHMARKS "Build the sunshine_bench micro-benchmarks, requires Google Benchmark." OFF)
 option(NPM_OFFLINE "Use offline npm packages. You must ensure packages are in your npm cache." OFF)
 
 option(BUILD_WERROR "Enable -Werror flag." OFF)
 
+set(SUNSHINE_HOT_LOG_MIN_LEVEL 0
+        CACHE STRING "Lowest level of per-packet log messages that are compiled in, 0 (verbose) to 5 (fatal).")
+
 # if this option is set, the build will exit after configuring special package configuration files
 option(SUNSHINE_CONFIGURE_ONLY "Configure special files only, then exit." OFF)
 
@@ -31,6 +35,11 @@ option(CUDA_INHERIT_COMPILE_OPTIONS
         "When building CUDA code, inherit compile options from the the main project. You may want to disable this if
         your IDE throws errors about unknown flags after running cmake." ON)
 
+if(WIN32)
+    option(SUNSHINE_ENABLE_WGC_DIRTY_REGIONS
+            "Use the dirty regions reported by Windows.Graphics.Capture. Requires WinRT headers from Windows SDK 10.0.26100 or newer." OFF)
+endif()
+
 if(UNIX)
     option(SUNSHINE_BUILD_HOMEBREW
             "Enable a Homebrew build." OFF)
@@ -39,6 +48,8 @@ if(UNIX)
 endif()
 
 if(APPLE)
+    option(SUNSHINE_ENABLE_SCREENCAPTUREKIT
+            "Build the ScreenCaptureKit capture backend. Requires the macOS 12.3 SDK or newer." ON)
     option(SUNSHINE_CONFIGURE_PORTFILE
             "Configure macOS Portfile. Recommended to use with SUNSHINE_CONFIGURE_ONLY" OFF)
     option(SUNSHINE_PACKAGE_MACOS
@@ -64,4 +75,10 @@ elseif(UNIX)  # Linux
             "Enable building wayland specific code." ON)
     option(SUNSHINE_ENABLE_X11
             "Enable X11 grab if available." ON)
+    option(SUNSHINE_ENABLE_PORTAL
+            "Enable XDG desktop portal (PipeWire) grab if available." ON)
+
+    # Linux networking
+    option(SUNSHINE_ENABLE_IO_URING
+            "Enable io_uring for batched video sends." OFF)
 endif()
@@ -181,6 +181,7 @@ function add_arch_deps() {
     'libevdev'
     'libmfx'
     'libnotify'
+    'libpipewire'
     'libpulse'
     'libva'
     'libx11'
@@ -235,10 +236,12 @@ function add_debian_based_deps() {
     "libnotify-dev"
     "libnuma-dev"
     "libopus-dev"
+    "libpipewire-0.3-dev"  # XDG portal
     "libpulse-dev"
     "libssl-dev"
     "libwayland-dev"  # Wayland
     "libx11-dev"  # X11
+    "libxcb-damage0-dev"  # X11
     "libxcb-shm0-dev"  # X11
     "libxcb-xfixes0-dev"  # X11
     "libxcb1-dev"  # X11
@@ -315,6 +318,7 @@ function add_fedora_deps() {
     "numactl-devel"
     "openssl-devel"
     "opus-devel"
+    "pipewire-devel"  # XDG portal
     "pulseaudio-libs-devel"
     "rpm-build"  # if you want to build an RPM binary package
     "wget"  # necessary for cuda install with `run` file
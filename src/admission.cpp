@@ -0,0 +1,184 @@
+/**
+ * @file src/admission.cpp
+ * @brief Definitions for admitting new sessions within the capacity of the encoder.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <functional>
+#include <vector>
+
+// local includes
+#include "admission.h"
+#include "calibration.h"
+#include "config.h"
+#include "logging.h"
+#include "metrics.h"
+
+using namespace std::literals;
+
+namespace admission {
+  namespace {
+    class lease_t: public platf::deinit_t {
+    public:
+      lease_t(std::function<void()> &&release):
+          _release {std::move(release)} {
+      }
+
+      ~lease_t() override {
+        _release();
+      }
+
+    private:
+      std::function<void()> _release;
+    };
+
+    std::string describe(const stream_t &stream) {
+      return std::format("{}x{} at {} fps", stream.width, stream.height, stream.fps);
+    }
+
+    /**
+     * @brief Get the time the encoders have spent converting and encoding frames so far.
+     */
+    std::uint64_t busy_time_us() {
+      static auto &convert_histogram = metrics::histogram("convert"sv);
+      static auto &encode_histogram = metrics::histogram("encode"sv);
+
+      return convert_histogram.snapshot().sum_us + encode_histogram.snapshot().sum_us;
+    }
+  }  // namespace
+
+  decision_t decide(const stream_t &requested, double load, double capacity, bool downgrade) {
+    if (load <= 0 || capacity <= 0) {
+      return {verdict_e::admit, requested, {}};
+    }
+
+    auto usable = capacity / calibration::headroom;
+    auto fits = [&](const stream_t &stream) {
+      return load + stream.pixel_rate() <= usable;
+    };
+
+    if (fits(requested)) {
+      return {verdict_e::admit, requested, {}};
+    }
+
+    if (downgrade) {
+      std::vector<int> framerates {requested.fps};
+      for (auto fps : {60, 30}) {
+        if (fps < framerates.back()) {
+          framerates.emplace_back(fps);
+        }
+      }
+
+      std::vector<int> heights {requested.height};
+      for (auto height : {1440, 1080, 720}) {
+        if (height < heights.back()) {
+          heights.emplace_back(height);
+        }
+      }
+
+      for (auto fps : framerates) {
+        for (auto height : heights) {
+          // Keep the aspect ratio, with an even width for the chroma subsampling
+          stream_t stream {(int) ((std::int64_t) requested.width * height / requested.height) & ~1, height, fps};
+          if ((fps == requested.fps && height == requested.height) || !fits(stream)) {
+            continue;
+          }
+
+          return {
+            verdict_e::downgrade,
+            stream,
+            std::format("Lowered from {} to {} to fit the capacity of the host's encoder", describe(requested), describe(stream)),
+          };
+        }
+      }
+    }
+
+    auto in_use = (int) std::round(load * 100 / usable);
+    return {
+      verdict_e::reject,
+      requested,
+      std::format("The host's encoder is at capacity ({}% in use), try again once another session ends", in_use),
+    };
+  }
+
+  decision_t controller_t::evaluate(const stream_t &requested) {
+    auto &mode = config::video.session_admission;
+    if (mode == "disabled"sv) {
+      return {verdict_e::admit, requested, {}};
+    }
+
+    auto capacity = calibration::pixel_rate().value_or(0);
+
+    std::lock_guard lg {mutex};
+    auto load = measure(capacity);
+
+    auto decision = decide(requested, load, capacity, mode == "downgrade"sv);
+    if (decision.verdict != verdict_e::admit) {
+      BOOST_LOG(info) << "Session admission for "sv << describe(requested) << " with "sv << sessions << " active: "sv << decision.reason;
+    }
+    return decision;
+  }
+
+  std::optional<double> controller_t::headroom() {
+    auto capacity = calibration::pixel_rate().value_or(0);
+
+    std::lock_guard lg {mutex};
+    auto load = measure(capacity);
+    if (capacity <= 0) {
+      return std::nullopt;
+    }
+    return std::clamp(1.0 - load / capacity, 0.0, 1.0);
+  }
+
+  std::unique_ptr<platf::deinit_t> controller_t::reserve(const stream_t &stream) {
+    std::lock_guard lg {mutex};
+    ++sessions;
+    reserved += stream.pixel_rate();
+    reset_baseline();
+
+    return std::make_unique<lease_t>([this, stream]() {
+      release(stream);
+    });
+  }
+
+  void controller_t::release(const stream_t &stream) {
+    std::lock_guard lg {mutex};
+    --sessions;
+    reserved = sessions ? std::max(0.0, reserved - stream.pixel_rate()) : 0;
+    reset_baseline();
+  }
+
+  double controller_t::measure(double &capacity) {
+    auto load = reserved;
+    if (auto utilization = live_utilization(); utilization && *utilization > 0) {
+      if (capacity > 0) {
+        load = std::max(load, *utilization * capacity);
+      } else {
+        capacity = reserved / *utilization;
+      }
+    }
+    return load;
+  }
+
+  void controller_t::reset_baseline() {
+    baseline_time = std::chrono::steady_clock::now();
+    baseline_busy_us = busy_time_us();
+  }
+
+  std::optional<double> controller_t::live_utilization() {
+    auto elapsed = std::chrono::steady_clock::now() - baseline_time;
+    if (!sessions || elapsed < min_live_window) {
+      return std::nullopt;
+    }
+
+    auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    return (double) (busy_time_us() - baseline_busy_us) / elapsed_us;
+  }
+
+  controller_t &controller() {
+    static controller_t controller;
+    return controller;
+  }
+}  // namespace admission
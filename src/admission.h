@@ -0,0 +1,118 @@
+/**
+ * @file src/admission.h
+ * @brief Declarations for admitting new sessions within the capacity of the encoder.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+// local includes
+#include "platform/common.h"
+
+namespace admission {
+  constexpr auto min_live_window = std::chrono::seconds {2};  ///< Shortest time the active sessions are measured for before it counts
+
+  /**
+   * @brief The video a session encodes.
+   */
+  struct stream_t {
+    int width;
+    int height;
+    int fps;
+
+    /**
+     * @brief Get the pixels the encoder spends on the stream each second.
+     */
+    double pixel_rate() const {
+      return (double) width * height * fps;
+    }
+  };
+
+  enum class verdict_e {
+    admit,  ///< The session fits as requested
+    downgrade,  ///< The session fits at a lower resolution or framerate
+    reject,  ///< The session doesn't fit
+  };
+
+  /**
+   * @brief What to do with a new session.
+   */
+  struct decision_t {
+    verdict_e verdict;
+    stream_t stream;  ///< The video to encode, lower than requested when downgraded
+    std::string reason;  ///< Why the session was downgraded or rejected, empty if admitted
+  };
+
+  /**
+   * @brief Decide over a new session.
+   * @details A session fits if the load with it stays below the capacity, less the headroom the
+   *          calibration keeps. When the host has no active session, or its capacity is unknown,
+   *          every session is admitted. A downgrade first lowers the resolution to 1440p, 1080p
+   *          and 720p at the requested framerate, then repeats that at 60 and 30 fps.
+   * @param requested The video the client asked for.
+   * @param load The pixels per second the active sessions keep the encoder busy with.
+   * @param capacity The pixels per second the encoder sustains, 0 if unknown.
+   * @param downgrade Whether to try a lower resolution and framerate before rejecting.
+   * @return The decision.
+   */
+  decision_t decide(const stream_t &requested, double load, double capacity, bool downgrade);
+
+  /**
+   * @brief Tracks the share of the encoder capacity taken by the active sessions.
+   * @details The capacity comes from the calibration of the settings in use. The load is the
+   *          larger of what the active sessions reserved and of the time the encoder has actually
+   *          spent converting and encoding since they started, which also covers content that's
+   *          harder to encode than the calibration workload. Without a calibration, the capacity
+   *          is estimated from how busy the active sessions keep the encoder.
+   */
+  class controller_t {
+  public:
+    /**
+     * @brief Decide over a new session according to the `session_admission` option.
+     * @param requested The video the client asked for.
+     * @return The decision, always an admission when the option is disabled.
+     */
+    decision_t evaluate(const stream_t &requested);
+
+    /**
+     * @brief Get the share of the encoder capacity left to new sessions.
+     * @return The share between 0 and 1, empty while the capacity is unknown.
+     */
+    std::optional<double> headroom();
+
+    /**
+     * @brief Reserve the capacity for an admitted session.
+     * @param stream The video the session encodes.
+     * @return The reservation, which is released once it is destroyed.
+     */
+    std::unique_ptr<platf::deinit_t> reserve(const stream_t &stream);
+
+  private:
+    /**
+     * @brief Measure the load of the active sessions, the mutex must be held.
+     * @param capacity The capacity from the calibration, estimated in place if it's 0.
+     * @return The pixels per second the active sessions keep the encoder busy with.
+     */
+    double measure(double &capacity);
+    void release(const stream_t &stream);
+    void reset_baseline();
+    std::optional<double> live_utilization();
+
+    std::mutex mutex;
+    int sessions = 0;  ///< Sessions holding a reservation
+    double reserved = 0;  ///< Sum of the pixel rates of the reservations
+    std::chrono::steady_clock::time_point baseline_time;  ///< When the set of sessions last changed
+    std::uint64_t baseline_busy_us = 0;  ///< Time spent converting and encoding until then
+  };
+
+  /**
+   * @brief Get the controller shared by all sessions.
+   */
+  controller_t &controller();
+}  // namespace admission
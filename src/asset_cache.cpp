@@ -0,0 +1,287 @@
+/**
+ * @file src/asset_cache.cpp
+ * @brief Definitions for the in-memory caches of static files.
+ */
+// standard includes
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <vector>
+
+// lib includes
+#include <boost/algorithm/string.hpp>
+#include <zlib.h>
+#ifdef SUNSHINE_BROTLI
+  #include <brotli/encode.h>
+#endif
+
+// local includes
+#include "asset_cache.h"
+#include "crypto.h"
+#include "logging.h"
+#include "utility.h"
+
+using namespace std::literals;
+
+namespace asset_cache {
+  namespace {
+#ifdef SUNSHINE_BROTLI
+    std::string compress_brotli(std::string_view content) {
+      std::string compressed(BrotliEncoderMaxCompressedSize(content.size()), '\0');
+      auto size = compressed.size();
+      if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, content.size(), (const std::uint8_t *) content.data(), &size, (std::uint8_t *) compressed.data())) {
+        return {};
+      }
+      compressed.resize(size);
+      return compressed;
+    }
+#endif
+
+    /**
+     * @brief Keep a compressed variant only when it saves bytes.
+     * @param compressed The compressed content.
+     * @param identity The uncompressed content.
+     * @return The compressed content, or an empty string.
+     */
+    std::string if_smaller(std::string compressed, const std::string &identity) {
+      return compressed.size() < identity.size() ? std::move(compressed) : std::string {};
+    }
+
+    /**
+     * @brief Read a file and tag it with its hash.
+     * @param path The path of the file.
+     * @return The file, or an empty value if it can't be read.
+     */
+    std::optional<asset_t> read_asset(const std::filesystem::path &path) {
+      std::ifstream in {path, std::ios::binary};
+      asset_t asset;
+      asset.identity.assign(std::istreambuf_iterator<char> {in}, std::istreambuf_iterator<char> {});
+      if (!in.is_open() || (!in && !in.eof())) {
+        return std::nullopt;
+      }
+
+      auto hash = crypto::hash(asset.identity);
+      asset.etag = '"' + util::hex_vec(std::begin(hash), std::begin(hash) + 16, true) + '"';
+      return asset;
+    }
+  }  // namespace
+
+  const std::string &asset_t::body(encoding_e encoding) const {
+    switch (encoding) {
+      case encoding_e::gzip:
+        return gzip;
+      case encoding_e::brotli:
+        return brotli;
+      default:
+        return identity;
+    }
+  }
+
+  std::string asset_t::etag_for(encoding_e encoding) const {
+    if (encoding == encoding_e::identity) {
+      return etag;
+    }
+
+    // "hash" -> "hash-gzip"
+    return etag.substr(0, etag.size() - 1) + '-' + std::string {to_string(encoding)} + '"';
+  }
+
+  std::string_view to_string(encoding_e encoding) {
+    switch (encoding) {
+      case encoding_e::gzip:
+        return "gzip"sv;
+      case encoding_e::brotli:
+        return "br"sv;
+      default:
+        return "identity"sv;
+    }
+  }
+
+  double quality(std::string_view accept_encoding, std::string_view name) {
+    std::vector<std::string> codings;
+    boost::split(codings, accept_encoding, boost::is_any_of(","));
+
+    double wildcard = 0.0;
+    for (auto &coding : codings) {
+      auto semicolon = coding.find(';');
+      auto coding_name = boost::trim_copy(coding.substr(0, semicolon));
+
+      double q = 1.0;
+      if (semicolon != std::string::npos) {
+        auto param = boost::trim_copy(coding.substr(semicolon + 1));
+        if (boost::istarts_with(param, "q="sv)) {
+          try {
+            q = std::stod(param.substr(2));
+          } catch (const std::exception &) {
+            q = 0.0;
+          }
+        }
+      }
+
+      if (boost::iequals(coding_name, name)) {
+        return q;
+      }
+      if (coding_name == "*"sv) {
+        wildcard = q;
+      }
+    }
+    return wildcard;
+  }
+
+  encoding_e negotiate(std::string_view accept_encoding, const asset_t &asset) {
+    auto encoding = encoding_e::identity;
+    auto size = asset.identity.size();
+
+    for (auto candidate : {encoding_e::gzip, encoding_e::brotli}) {
+      auto &body = asset.body(candidate);
+      if (!body.empty() && body.size() < size && quality(accept_encoding, to_string(candidate)) > 0.0) {
+        encoding = candidate;
+        size = body.size();
+      }
+    }
+    return encoding;
+  }
+
+  bool not_modified(std::string_view if_none_match, const asset_t &asset) {
+    std::vector<std::string> tags;
+    boost::split(tags, if_none_match, boost::is_any_of(","));
+
+    for (auto &tag : tags) {
+      boost::trim(tag);
+      if (tag == "*"sv) {
+        return true;
+      }
+      if (tag.starts_with("W/"sv)) {
+        tag.erase(0, 2);
+      }
+
+      for (auto encoding : {encoding_e::identity, encoding_e::gzip, encoding_e::brotli}) {
+        if ((encoding == encoding_e::identity || !asset.body(encoding).empty()) && tag == asset.etag_for(encoding)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  std::string compress_gzip(std::string_view content) {
+    z_stream stream {};
+    // 15 window bits, +16 for a gzip header instead of a zlib one
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return {};
+    }
+    auto fg = util::fail_guard([&stream]() {
+      deflateEnd(&stream);
+    });
+
+    std::string compressed(deflateBound(&stream, (uLong) content.size()), '\0');
+    stream.next_in = (Bytef *) content.data();
+    stream.avail_in = (uInt) content.size();
+    stream.next_out = (Bytef *) compressed.data();
+    stream.avail_out = (uInt) compressed.size();
+
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+      return {};
+    }
+    compressed.resize(stream.total_out);
+    return compressed;
+  }
+
+  std::size_t cache_t::load(const std::filesystem::path &directory) {
+    _assets.clear();
+
+    std::error_code ec;
+    std::uintmax_t identity_size = 0;
+    std::uintmax_t compressed_size = 0;
+    for (auto it = std::filesystem::recursive_directory_iterator {directory, ec}; !ec && it != std::filesystem::recursive_directory_iterator {}; it.increment(ec)) {
+      if (!it->is_regular_file(ec) || it->file_size(ec) > max_file_size) {
+        continue;
+      }
+
+      auto asset = read_asset(it->path());
+      if (!asset) {
+        BOOST_LOG(warning) << "Couldn't cache "sv << it->path().string();
+        continue;
+      }
+
+      asset->gzip = if_smaller(compress_gzip(asset->identity), asset->identity);
+#ifdef SUNSHINE_BROTLI
+      asset->brotli = if_smaller(compress_brotli(asset->identity), asset->identity);
+#endif
+
+      identity_size += asset->identity.size();
+      compressed_size += asset->body(negotiate("gzip, br"sv, *asset)).size();
+      _assets.emplace(std::filesystem::relative(it->path(), directory).generic_string(), std::move(*asset));
+    }
+
+    BOOST_LOG(info) << "Cached "sv << _assets.size() << " Web UI files, "sv << identity_size / 1024 << " KiB, "sv << compressed_size / 1024 << " KiB compressed"sv;
+    return _assets.size();
+  }
+
+  const asset_t *cache_t::find(std::string_view path) const {
+    auto it = _assets.find(std::string {path});
+    return it == std::end(_assets) ? nullptr : &it->second;
+  }
+
+  file_cache_t::file_cache_t(std::size_t max_bytes):
+      _max_bytes {max_bytes} {
+  }
+
+  std::shared_ptr<const asset_t> file_cache_t::get(const std::filesystem::path &path) {
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    auto size = ec ? 0 : std::filesystem::file_size(path, ec);
+    if (ec) {
+      return nullptr;
+    }
+
+    auto key = path.string();
+    {
+      std::lock_guard lg {_mutex};
+
+      auto it = _entries.find(key);
+      if (it != std::end(_entries)) {
+        if (it->second.mtime == mtime && it->second.size == size) {
+          _lru.splice(std::begin(_lru), _lru, it->second.lru);
+          return it->second.asset;
+        }
+
+        _bytes -= it->second.asset->identity.size();
+        _lru.erase(it->second.lru);
+        _entries.erase(it);
+      }
+    }
+
+    // Read without holding the lock, a slow disk shouldn't hold up the cached files
+    auto asset = read_asset(path);
+    if (!asset) {
+      return nullptr;
+    }
+    auto shared = std::make_shared<const asset_t>(std::move(*asset));
+    if (shared->identity.size() > _max_bytes) {
+      return shared;
+    }
+
+    std::lock_guard lg {_mutex};
+
+    // Another request may have read it in the meantime
+    if (auto it = _entries.find(key); it != std::end(_entries)) {
+      _bytes -= it->second.asset->identity.size();
+      _lru.erase(it->second.lru);
+      _entries.erase(it);
+    }
+
+    while (_bytes + shared->identity.size() > _max_bytes && !_lru.empty()) {
+      auto oldest = _entries.find(_lru.back());
+      _bytes -= oldest->second.asset->identity.size();
+      _entries.erase(oldest);
+      _lru.pop_back();
+    }
+
+    _lru.push_front(key);
+    _entries.emplace(key, entry_t {mtime, size, shared, std::begin(_lru)});
+    _bytes += shared->identity.size();
+
+    return shared;
+  }
+}  // namespace asset_cache
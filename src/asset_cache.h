@@ -0,0 +1,152 @@
+/**
+ * @file src/asset_cache.h
+ * @brief Declarations for the in-memory caches of static files.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * @brief Static files kept in memory, with their compressed variants, so they are served without reading the disk.
+ */
+namespace asset_cache {
+  constexpr std::uintmax_t max_file_size = 16 * 1024 * 1024;  ///< Larger files are left on disk
+
+  /**
+   * @brief Content encodings of a cached file.
+   */
+  enum class encoding_e {
+    identity,  ///< Uncompressed
+    gzip,  ///< gzip
+    brotli,  ///< Brotli, when built with it
+  };
+
+  /**
+   * @brief A cached file.
+   */
+  struct asset_t {
+    std::string etag;  ///< Quoted hash of the uncompressed content
+    std::string identity;  ///< Uncompressed content
+    std::string gzip;  ///< gzip content, empty when it isn't smaller
+    std::string brotli;  ///< Brotli content, empty when it isn't smaller or unsupported
+
+    /**
+     * @brief Get the content in an encoding.
+     * @param encoding The encoding.
+     * @return The content.
+     */
+    const std::string &body(encoding_e encoding) const;
+
+    /**
+     * @brief Get the entity tag of the content in an encoding.
+     * @details Each encoding is a different representation, so it gets its own tag.
+     * @param encoding The encoding.
+     * @return The quoted tag.
+     */
+    std::string etag_for(encoding_e encoding) const;
+  };
+
+  /**
+   * @brief Get the name of an encoding as used by `Content-Encoding`.
+   * @param encoding The encoding.
+   * @return The name.
+   */
+  std::string_view to_string(encoding_e encoding);
+
+  /**
+   * @brief Get the quality value of an encoding in an `Accept-Encoding` header.
+   * @param accept_encoding The header.
+   * @param name The name of the encoding.
+   * @return The quality, 0 if it isn't accepted.
+   */
+  double quality(std::string_view accept_encoding, std::string_view name);
+
+  /**
+   * @brief Pick the smallest encoding of a file that the client accepts.
+   * @param accept_encoding The `Accept-Encoding` header of the request.
+   * @param asset The file.
+   * @return The encoding.
+   */
+  encoding_e negotiate(std::string_view accept_encoding, const asset_t &asset);
+
+  /**
+   * @brief Check if an `If-None-Match` header matches a file, using the weak comparison.
+   * @param if_none_match The header.
+   * @param asset The file.
+   * @return `true` if the client already has a representation of the file.
+   */
+  bool not_modified(std::string_view if_none_match, const asset_t &asset);
+
+  /**
+   * @brief Compress content with gzip.
+   * @param content The content.
+   * @return The compressed content, or an empty string on failure.
+   */
+  std::string compress_gzip(std::string_view content);
+
+  /**
+   * @brief Files of a directory, read once.
+   */
+  class cache_t {
+  public:
+    /**
+     * @brief Read and compress all the files of a directory, replacing the cached files.
+     * @param directory The directory.
+     * @return The number of cached files.
+     */
+    std::size_t load(const std::filesystem::path &directory);
+
+    /**
+     * @brief Find a cached file.
+     * @param path The path of the file, relative to the directory and separated by `/`.
+     * @return The file, or `nullptr` if it isn't cached.
+     */
+    const asset_t *find(std::string_view path) const;
+
+  private:
+    std::unordered_map<std::string, asset_t> _assets;
+  };
+
+  /**
+   * @brief Files read on first use and kept until they change on disk, e.g. the app covers.
+   * @details The least recently used files are dropped to stay under the size limit. The files
+   *          aren't compressed, this is meant for images which already are.
+   */
+  class file_cache_t {
+  public:
+    /**
+     * @brief Create a cache.
+     * @param max_bytes The most bytes of content to keep.
+     */
+    explicit file_cache_t(std::size_t max_bytes);
+
+    /**
+     * @brief Get a file, reading it again if its size or modification time changed.
+     * @param path The path of the file.
+     * @return The file, or `nullptr` if it can't be read.
+     */
+    std::shared_ptr<const asset_t> get(const std::filesystem::path &path);
+
+  private:
+    struct entry_t {
+      std::filesystem::file_time_type mtime;
+      std::uintmax_t size;
+      std::shared_ptr<const asset_t> asset;
+      std::list<std::string>::iterator lru;  ///< Position in _lru
+    };
+
+    std::mutex _mutex;
+    std::size_t _max_bytes;
+    std::size_t _bytes = 0;
+    std::list<std::string> _lru;  ///< Paths, the most recently used first
+    std::unordered_map<std::string, entry_t> _entries;
+  };
+}  // namespace asset_cache
@@ -3,7 +3,14 @@
  * @brief Definitions for audio capture and encoding.
  */
 // standard includes
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <numbers>
 #include <thread>
+#include <utility>
+#include <vector>
 
 // lib includes
 #include <opus/opus_multistream.h>
@@ -13,7 +20,9 @@
 #include "config.h"
 #include "globals.h"
 #include "logging.h"
+#include "metrics.h"
 #include "platform/common.h"
+#include "thread_placement.h"
 #include "thread_safe.h"
 #include "utility.h"
 
@@ -26,12 +35,20 @@ namespace audio {
    */
   using opus_t = util::safe_ptr<OpusMSEncoder, opus_multistream_encoder_destroy>;
 
+  /**
+   * @brief Captured audio frame.
+   */
+  struct sample_t {
+    std::vector<float> samples;  ///< Interleaved samples
+    std::chrono::steady_clock::time_point timestamp;  ///< Capture time of the first sample
+  };
+
   /**
    * @brief Audio sample queue type.
    * 
    * Thread-safe queue for passing audio samples between capture and encoding threads.
    */
-  using sample_queue_t = std::shared_ptr<safe::queue_t<std::vector<float>>>;
+  using sample_queue_t = std::shared_ptr<safe::spsc_queue_t<sample_t>>;
 
   static int start_audio_control(audio_ctx_t &ctx);
   static void stop_audio_control(audio_ctx_t &);
@@ -109,25 +126,230 @@ namespace audio {
     },
   };
 
+  /**
+   * @brief Capture and encode pipeline shared by the sessions streaming the same audio.
+   * @details Every encoded packet is queued once per subscribed session, which then
+   *          encrypts it with its own key in the audio broadcast thread.
+   */
+  struct pipeline_t {
+    config_t config;  ///< Audio configuration of the first subscriber
+    safe::event_t<bool> shutdown;  ///< Raised once the last session unsubscribed
+    std::atomic_bool failed {false};  ///< Capture couldn't be initialized or stopped on an error
+
+    /**
+     * @brief A session receiving the packets of the pipeline.
+     */
+    struct subscriber_t {
+      void *channel_data;  ///< Queued with each packet of this session
+      safe::mail_raw_t::event_t<encoder_params_t> encoder_params;  ///< Encoder parameters requested for this session
+      encoder_params_t requested;  ///< Last encoder parameters requested for this session
+    };
+
+    std::mutex subscribers_lock;
+    std::vector<subscriber_t> subscribers;
+
+    std::thread thread;
+  };
+
+  static std::mutex pipelines_lock;
+  static std::vector<std::shared_ptr<pipeline_t>> pipelines;
+
+  /**
+   * @brief Maximum size of an encoded audio packet.
+   */
+  constexpr std::size_t MAX_PACKET_SIZE = 1400;
+
+  /**
+   * @brief Maximum number of idle packet buffers kept for reuse.
+   */
+  constexpr std::size_t MAX_POOLED_BUFFERS = 64;
+
+  static std::mutex buffer_pool_lock;
+  static std::vector<buffer_t> buffer_pool;
+
+  buffer_t acquire_buffer() {
+    {
+      std::lock_guard lg {buffer_pool_lock};
+      if (!buffer_pool.empty()) {
+        auto buffer = std::move(buffer_pool.back());
+        buffer_pool.pop_back();
+        return buffer;
+      }
+    }
+
+    return buffer_t {MAX_PACKET_SIZE};
+  }
+
+  void release_buffer(buffer_t &&buffer) {
+    if (!buffer.begin()) {
+      return;
+    }
+
+    // Encoding shrinks the reported size, the allocation is always the maximum size
+    buffer.fake_resize(MAX_PACKET_SIZE);
+
+    std::lock_guard lg {buffer_pool_lock};
+    if (buffer_pool.size() < MAX_POOLED_BUFFERS) {
+      buffer_pool.push_back(std::move(buffer));
+    }
+  }
+
+  /**
+   * @brief Check if a session can subscribe to the pipeline of another one.
+   * @param a The audio configuration of one session.
+   * @param b The audio configuration of the other session.
+   * @return `true` if both sessions would capture and encode the same audio.
+   */
+  bool shareable(const config_t &a, const config_t &b) {
+    // Custom surround parameters are negotiated per client
+    if (a.flags[config_t::CUSTOM_SURROUND_PARAMS] || b.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
+      return false;
+    }
+
+    return a.channels == b.channels &&
+           a.packetDuration == b.packetDuration &&
+           a.flags[config_t::HIGH_QUALITY] == b.flags[config_t::HIGH_QUALITY] &&
+           a.flags[config_t::HOST_AUDIO] == b.flags[config_t::HOST_AUDIO];
+  }
+
+  /**
+   * @brief Pick encoder parameters that suit every session subscribed to a pipeline.
+   * @details The most constrained session wins, as all of them receive the same packets.
+   * @param pipeline The pipeline, its subscribers must be locked.
+   * @return The encoder parameters.
+   */
+  encoder_params_t encoder_params(pipeline_t *pipeline) {
+    encoder_params_t params {100, 0};
+    for (auto &subscriber : pipeline->subscribers) {
+      while (subscriber.encoder_params->peek()) {
+        if (auto requested = subscriber.encoder_params->pop(0ms)) {
+          subscriber.requested = *requested;
+        }
+      }
+
+      params.bitrate_percent = std::min(params.bitrate_percent, subscriber.requested.bitrate_percent);
+      params.packet_loss_percent = std::max(params.packet_loss_percent, subscriber.requested.packet_loss_percent);
+    }
+    return params;
+  }
+
+  /**
+   * @brief Most captured frames waiting for the next tick of the encoder.
+   * @details One frame can be ahead of the schedule when a backend delivers in bursts,
+   *          anything older is dropped to keep the latency bounded.
+   */
+  constexpr std::size_t MAX_BACKLOG_FRAMES = 2;
+
+  static auto &padded_frames = metrics::counter("audio_padded_frames"sv);  ///< Silent frames sent in place of late ones.
+  static auto &dropped_frames = metrics::counter("audio_dropped_frames"sv);  ///< Frames dropped to bound the latency.
+
+  /**
+   * @brief Paces the frames of any capture backend to one frame per packet duration.
+   * @details The first frame starts the schedule, which then ticks on a high precision timer.
+   *          A tick takes the oldest frame received since the last one. When there is none,
+   *          the frame gets half a packet duration to arrive, moving the schedule to its
+   *          arrival, before silence is sent in its place. This keeps the packet cadence the
+   *          same whether a backend wakes per frame, per fragment or on its own buffer size.
+   */
+  class capture_scheduler_t {
+  public:
+    capture_scheduler_t(sample_queue_t samples, std::chrono::milliseconds packet_duration, std::size_t samples_per_frame):
+        _samples {std::move(samples)},
+        _packet_duration {packet_duration},
+        _samples_per_frame {samples_per_frame},
+        _timer {platf::create_high_precision_timer()} {
+    }
+
+    /**
+     * @brief Wait for the next tick.
+     * @return The frame to encode, or an empty value once capture stopped.
+     */
+    std::optional<sample_t> next() {
+      if (!_due) {
+        auto sample = _samples->pop();
+        if (!sample) {
+          return std::nullopt;
+        }
+
+        _due = std::chrono::steady_clock::now();
+        _backlog.push_back(std::move(*sample));
+      } else {
+        auto now = std::chrono::steady_clock::now();
+        if (*_due > now) {
+          if (_timer && *_timer) {
+            _timer->sleep_for(*_due - now);
+          } else {
+            std::this_thread::sleep_until(*_due);
+          }
+        }
+
+        while (_samples->peek()) {
+          _backlog.push_back(std::move(*_samples->pop()));
+        }
+
+        if (_backlog.empty()) {
+          if (auto sample = _samples->pop(_packet_duration / 2)) {
+            // The backend runs late, tick after its frames from now on
+            _due = std::chrono::steady_clock::now();
+            _backlog.push_back(std::move(*sample));
+          } else if (!_samples->running()) {
+            return std::nullopt;
+          }
+        }
+      }
+
+      while (_backlog.size() > MAX_BACKLOG_FRAMES) {
+        _backlog.pop_front();
+        dropped_frames.add();
+      }
+
+      sample_t frame;
+      if (_backlog.empty()) {
+        frame.samples.resize(_samples_per_frame);
+        frame.timestamp = _last_timestamp + _packet_duration;
+        padded_frames.add();
+      } else {
+        frame = std::move(_backlog.front());
+        _backlog.pop_front();
+      }
+      _last_timestamp = frame.timestamp;
+
+      // Restart the schedule after a stall instead of catching up in a burst
+      *_due += _packet_duration;
+      if (auto now = std::chrono::steady_clock::now(); *_due < now - _packet_duration) {
+        _due = now;
+      }
+
+      return frame;
+    }
+
+  private:
+    sample_queue_t _samples;
+    std::chrono::nanoseconds _packet_duration;
+    std::size_t _samples_per_frame;
+    std::unique_ptr<platf::high_precision_timer> _timer;
+
+    std::optional<std::chrono::steady_clock::time_point> _due;  ///< Time of the next tick, set by the first frame
+    std::deque<sample_t> _backlog;
+    std::chrono::steady_clock::time_point _last_timestamp;
+  };
+
   /**
    * @brief Audio encoding thread function.
    * 
    * Encodes audio samples from the queue using Opus multistream encoder
-   * and sends encoded packets through the mail system.
+   * and sends encoded packets through the mail system, paced by a capture_scheduler_t.
    * 
    * @param samples Thread-safe queue of audio sample buffers to encode.
-   * @param config Audio configuration for encoding parameters.
-   * @param channel_data Channel-specific data pointer to include with packets.
+   * @param pipeline The pipeline whose subscribers receive the packets.
    */
-  void encodeThread(sample_queue_t samples, config_t config, void *channel_data) {
-    auto packets = mail::man->queue<packet_t>(mail::audio_packets);
-    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
-    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
-      apply_surround_params(stream, config.customStreamParams);
-    }
+  void encodeThread(sample_queue_t samples, pipeline_t *pipeline) {
+    auto &config = pipeline->config;
+    auto packets = mail::man->queue(mail::audio_packets);
+    auto stream = stream_config(config);
 
     // Encoding takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_placement::apply(config::thread_stage_e::audio, platf::thread_priority_e::high);
 
     opus_t opus {opus_multistream_encoder_create(
       stream.sampleRate,
@@ -146,65 +368,139 @@ namespace audio {
                     << stream.channelCount << " channels, "sv
                     << stream.bitrate / 1000 << " kbps (total), LOWDELAY"sv;
 
+    encoder_params_t applied {100, 0};
+
+    auto &encode_histogram = metrics::histogram("audio_encode"sv);
+
     auto frame_size = config.packetDuration * stream.sampleRate / 1000;
-    while (auto sample = samples->pop()) {
-      buffer_t packet {1400};
+    capture_scheduler_t scheduler {samples, std::chrono::milliseconds {config.packetDuration}, (std::size_t) frame_size * stream.channelCount};
+    while (auto sample = scheduler.next()) {
+      encoder_params_t params;
+      {
+        std::lock_guard lg {pipeline->subscribers_lock};
+        params = encoder_params(pipeline);
+      }
 
-      int bytes = opus_multistream_encode_float(opus.get(), sample->data(), frame_size, std::begin(packet), packet.size());
+      if (params != applied) {
+        auto bitrate = (int) ((std::int64_t) stream.bitrate * params.bitrate_percent / 100);
+        opus_multistream_encoder_ctl(opus.get(), OPUS_SET_BITRATE(bitrate));
+        opus_multistream_encoder_ctl(opus.get(), OPUS_SET_PACKET_LOSS_PERC(params.packet_loss_percent));
+        applied = params;
+
+        BOOST_LOG(info) << "Opus adjusted: "sv << bitrate / 1000 << " kbps (total), "sv << params.packet_loss_percent << "% expected loss"sv;
+      }
+
+      auto packet = acquire_buffer();
+
+      auto encode_start = std::chrono::steady_clock::now();
+      int bytes = opus_multistream_encode_float(opus.get(), sample->samples.data(), frame_size, std::begin(packet), packet.size());
+      encode_histogram.record(std::chrono::steady_clock::now() - encode_start);
       if (bytes < 0) {
         BOOST_LOG(error) << "Couldn't encode audio: "sv << opus_strerror(bytes);
+        release_buffer(std::move(packet));
         packets->stop();
 
         return;
       }
 
       packet.fake_resize(bytes);
-      packets->raise(channel_data, std::move(packet));
+
+      std::lock_guard lg {pipeline->subscribers_lock};
+      for (std::size_t x = 1; x < pipeline->subscribers.size(); ++x) {
+        auto copy = acquire_buffer();
+        std::copy_n(std::begin(packet), packet.size(), std::begin(copy));
+        copy.fake_resize(packet.size());
+        packets->raise(pipeline->subscribers[x].channel_data, std::move(copy), sample->timestamp);
+      }
+      if (!pipeline->subscribers.empty()) {
+        packets->raise(pipeline->subscribers.front().channel_data, std::move(packet), sample->timestamp);
+      }
     }
   }
 
-  void capture(safe::mail_t mail, config_t config, void *channel_data) {
-    auto shutdown_event = mail->event<bool>(mail::shutdown);
-    if (!config::audio.stream || config.input_only) {
-      shutdown_event->view();
-      return;
-    }
-    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
-    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
-      apply_surround_params(stream, config.customStreamParams);
+  static std::atomic_bool synthetic_capture_enabled {false};
+  static std::mutex synthetic_capture_lock;
+  static std::vector<std::chrono::steady_clock::time_point> synthetic_capture_times;
+
+  /**
+   * @brief Microphone playing a tone in every channel, at the pace of a real device.
+   */
+  class synthetic_mic_t: public platf::mic_t {
+  public:
+    synthetic_mic_t(int channels, std::uint32_t sample_rate, std::uint32_t frame_size):
+        _channels {channels},
+        _sample_rate {sample_rate},
+        _frame_size {frame_size},
+        _frame_duration {std::chrono::nanoseconds {1s} * frame_size / sample_rate},
+        _next {std::chrono::steady_clock::now() + _frame_duration} {
     }
 
-    auto ref = get_audio_ctx_ref();
-    if (!ref) {
-      return;
+    platf::capture_e sample(std::vector<float> &sample_buf) override {
+      std::this_thread::sleep_until(_next);
+      _next += _frame_duration;
+
+      for (std::uint32_t x = 0; x < _frame_size; ++x) {
+        auto t = (double) (_position + x) / _sample_rate;
+        for (int c = 0; c < _channels; ++c) {
+          sample_buf[x * _channels + c] = (float) (0.25 * std::sin(2.0 * std::numbers::pi * (440.0 + 110.0 * c) * t));
+        }
+      }
+      _position += _frame_size;
+
+      auto now = std::chrono::steady_clock::now();
+      frame_timestamp = now - _frame_duration;
+
+      std::lock_guard lg {synthetic_capture_lock};
+      synthetic_capture_times.push_back(now);
+      return platf::capture_e::ok;
     }
 
-    auto init_failure_fg = util::fail_guard([&shutdown_event]() {
-      BOOST_LOG(error) << "Unable to initialize audio capture. The stream will not have audio."sv;
+  private:
+    int _channels;
+    std::uint32_t _sample_rate;
+    std::uint32_t _frame_size;
+    std::chrono::nanoseconds _frame_duration;
+    std::chrono::steady_clock::time_point _next;
+    std::uint64_t _position = 0;
+  };
 
-      // Wait for shutdown to be signalled if we fail init.
-      // This allows streaming to continue without audio.
-      shutdown_event->view();
-      return;
-    });
+  void use_synthetic_capture(bool enabled) {
+    synthetic_capture_enabled = enabled;
+  }
 
-    auto &control = ref->control;
+  std::vector<std::chrono::steady_clock::time_point> take_synthetic_capture_times() {
+    std::lock_guard lg {synthetic_capture_lock};
+    return std::exchange(synthetic_capture_times, {});
+  }
+
+  /**
+   * @brief Open the microphone of a pipeline, switching the default sink if needed.
+   * @param pipeline The pipeline.
+   * @param ctx The audio context.
+   * @param stream The stream configuration to capture.
+   * @param frame_size Samples per channel of each frame.
+   * @return The microphone, or `nullptr` on failure.
+   */
+  std::unique_ptr<platf::mic_t> open_microphone(pipeline_t *pipeline, audio_ctx_t &ctx, const opus_stream_config_t &stream, std::uint32_t frame_size) {
+    auto &config = pipeline->config;
+
+    auto &control = ctx.control;
     if (!control) {
-      return;
+      return nullptr;
     }
 
     // Order of priority:
     // 1. Virtual sink
     // 2. Audio sink
     // 3. Host
-    std::string *sink = &ref->sink.host;
+    std::string *sink = &ctx.sink.host;
     if (!config::audio.sink.empty()) {
       sink = &config::audio.sink;
     }
 
     // Prefer the virtual sink if host playback is disabled or there's no other sink
-    if (ref->sink.null && (!config.flags[config_t::HOST_AUDIO] || sink->empty())) {
-      auto &null = *ref->sink.null;
+    if (ctx.sink.null && (!config.flags[config_t::HOST_AUDIO] || sink->empty())) {
+      auto &null = *ctx.sink.null;
       switch (stream.channelCount) {
         case 2:
           sink = &null.stereo;
@@ -221,39 +517,73 @@ namespace audio {
     BOOST_LOG(info) << "Selected audio sink: "sv << *sink;
 
     // Only the first to start a session may change the default sink
-    if (!ref->sink_flag->exchange(true, std::memory_order_acquire)) {
+    if (!ctx.sink_flag->exchange(true, std::memory_order_acquire)) {
       // If the selected sink is different than the current one, change sinks.
-      ref->restore_sink = ref->sink.host != *sink;
-      if (ref->restore_sink) {
+      ctx.restore_sink = ctx.sink.host != *sink;
+      if (ctx.restore_sink) {
         if (control->set_sink(*sink)) {
-          return;
+          return nullptr;
         }
       }
     }
 
+    return control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
+  }
+
+  /**
+   * @brief Capture audio for a pipeline until its last session unsubscribes.
+   * @param pipeline The pipeline.
+   */
+  void capture_loop(pipeline_t *pipeline) {
+    auto &config = pipeline->config;
+    auto shutdown_event = &pipeline->shutdown;
+    auto stream = stream_config(config);
+
     auto frame_size = config.packetDuration * stream.sampleRate / 1000;
-    auto mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
+
+    audio_ctx_ref_t ref;
+    std::unique_ptr<platf::mic_t> mic;
+    if (synthetic_capture_enabled) {
+      mic = std::make_unique<synthetic_mic_t>(stream.channelCount, stream.sampleRate, frame_size);
+    }
+
     if (!mic) {
-      return;
+      ref = get_audio_ctx_ref();
+      if (!ref) {
+        pipeline->failed = true;
+        return;
+      }
+
+      mic = open_microphone(pipeline, *ref, stream, frame_size);
     }
 
-    // Audio is initialized, so we don't want to print the failure message
-    init_failure_fg.disable();
+    if (!mic) {
+      BOOST_LOG(error) << "Unable to initialize audio capture. The stream will not have audio."sv;
+      pipeline->failed = true;
+
+      // Wait for shutdown to be signalled if we fail init.
+      // This allows streaming to continue without audio.
+      shutdown_event->view();
+      return;
+    }
 
     // Capture takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    thread_placement::apply(config::thread_stage_e::audio, platf::thread_priority_e::critical);
 
     auto samples = std::make_shared<sample_queue_t::element_type>(30);
-    std::thread thread {encodeThread, samples, config, channel_data};
+    std::thread thread {encodeThread, samples, pipeline};
 
     auto fg = util::fail_guard([&]() {
       samples->stop();
       thread.join();
 
+      // Sessions subscribing from now on need a new pipeline
+      pipeline->failed = true;
       shutdown_event->view();
     });
 
     int samples_per_frame = frame_size * stream.channelCount;
+    auto frame_duration = std::chrono::milliseconds {config.packetDuration};
 
     while (!shutdown_event->peek()) {
       std::vector<float> sample_buffer;
@@ -270,7 +600,7 @@ namespace audio {
             BOOST_LOG(info) << "Reinitializing audio capture"sv;
             mic.reset();
             do {
-              mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
+              mic = ref->control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
               if (!mic) {
                 BOOST_LOG(warning) << "Couldn't re-initialize audio input"sv;
               }
@@ -282,8 +612,238 @@ namespace audio {
           return;
       }
 
-      samples->raise(std::move(sample_buffer));
+      // Without a timestamp from the backend, the last sample of the frame was just captured
+      auto timestamp = mic->frame_timestamp.value_or(std::chrono::steady_clock::now() - frame_duration);
+      samples->raise(sample_t {std::move(sample_buffer), timestamp});
+    }
+  }
+
+  /**
+   * @brief Subscribe a session to the pipeline for its audio configuration, starting one if needed.
+   * @param mail The mail of the session.
+   * @param config The audio configuration of the session.
+   * @param channel_data The channel data to queue the encoded packets with.
+   * @return The pipeline.
+   */
+  std::shared_ptr<pipeline_t> subscribe(safe::mail_t &mail, const config_t &config, void *channel_data) {
+    pipeline_t::subscriber_t subscriber {
+      channel_data,
+      mail->event(mail::audio_encoder_params),
+      {100, 0},
+    };
+
+    std::lock_guard lg {pipelines_lock};
+
+    for (auto &pipeline : pipelines) {
+      if (!pipeline->failed && shareable(pipeline->config, config)) {
+        std::lock_guard lg_subscribers {pipeline->subscribers_lock};
+        pipeline->subscribers.push_back(std::move(subscriber));
+
+        BOOST_LOG(info) << "Sharing audio capture with "sv << pipeline->subscribers.size() - 1 << " other session(s)"sv;
+        return pipeline;
+      }
+    }
+
+    auto pipeline = std::make_shared<pipeline_t>();
+    pipeline->config = config;
+    pipeline->subscribers.push_back(std::move(subscriber));
+    pipeline->thread = std::thread {capture_loop, pipeline.get()};
+    pipelines.push_back(pipeline);
+
+    return pipeline;
+  }
+
+  /**
+   * @brief Unsubscribe a session, stopping the pipeline after its last session.
+   * @param pipeline The pipeline.
+   * @param channel_data The channel data of the session.
+   */
+  void unsubscribe(const std::shared_ptr<pipeline_t> &pipeline, void *channel_data) {
+    {
+      std::lock_guard lg {pipelines_lock};
+      std::lock_guard lg_subscribers {pipeline->subscribers_lock};
+
+      std::erase_if(pipeline->subscribers, [channel_data](const auto &subscriber) {
+        return subscriber.channel_data == channel_data;
+      });
+      if (!pipeline->subscribers.empty()) {
+        return;
+      }
+
+      std::erase(pipelines, pipeline);
+    }
+
+    pipeline->shutdown.raise(true);
+    pipeline->thread.join();
+  }
+
+  void capture(safe::mail_t mail, config_t config, void *channel_data) {
+    auto shutdown_event = mail->event(mail::shutdown);
+    if (!config::audio.stream || config.input_only) {
+      shutdown_event->view();
+      return;
+    }
+
+    // Sessions with the same audio configuration share a single capture and encoder
+    auto pipeline = subscribe(mail, config, channel_data);
+    shutdown_event->view();
+    unsubscribe(pipeline, channel_data);
+  }
+
+  jitter_buffer_t::jitter_buffer_t(std::chrono::nanoseconds packet_duration):
+      _packet_duration {packet_duration} {
+  }
+
+  void jitter_buffer_t::set_packet_duration(std::chrono::nanoseconds packet_duration) {
+    _packet_duration = packet_duration;
+  }
+
+  void jitter_buffer_t::push(std::uint16_t sequence_number, std::vector<std::uint8_t> &&payload, std::chrono::steady_clock::time_point arrival) {
+    // Extend the sequence number past its 16 bits relative to the highest one received
+    auto sequence = _highest ? *_highest + (std::int16_t) (sequence_number - (std::uint16_t) *_highest) : (std::int64_t) sequence_number;
+
+    if (!_highest || sequence > *_highest) {
+      if (_highest) {
+        // RFC 3550 interarrival jitter, over the packets received in order
+        auto transit = (arrival - _last_arrival) - _packet_duration * (sequence - *_highest);
+        _jitter_ns += (std::abs((double) transit.count()) - _jitter_ns) / 16.0;
+      }
+      _highest = sequence;
+      _last_arrival = arrival;
+    }
+
+    if ((_playing && sequence < _next) || _packets.count(sequence)) {
+      // Too late or a duplicate
+      return;
+    }
+
+    _packets.emplace(sequence, std::move(payload));
+    while (_packets.size() > max_depth * 2) {
+      _packets.erase(std::begin(_packets));
+    }
+  }
+
+  jitter_buffer_t::slot_t jitter_buffer_t::pop() {
+    // Underruns stop counting after about 10 seconds of smooth playback
+    if (_underrun_depth && ++_slots_since_underrun > 500) {
+      --_underrun_depth;
+      _slots_since_underrun = 0;
+    }
+
+    if (!_playing) {
+      if (_packets.empty() || (int) _packets.size() < target_depth()) {
+        return {slot_e::idle, {}};
+      }
+
+      _playing = true;
+      _next = std::begin(_packets)->first;
+    }
+
+    if (_packets.empty()) {
+      BOOST_LOG(debug) << "Microphone jitter buffer underrun"sv;
+      _playing = false;
+      _underrun_depth = std::min(_underrun_depth + 1, max_depth);
+      _slots_since_underrun = 0;
+      return {slot_e::conceal, {}};
+    }
+
+    // Trim the depth that built up while the network was worse
+    while ((int) _packets.size() > target_depth() + 1) {
+      _next = std::begin(_packets)->first + 1;
+      _packets.erase(std::begin(_packets));
+    }
+
+    auto it = std::begin(_packets);
+    if (it->first <= _next) {
+      slot_t slot {slot_e::packet, std::move(it->second)};
+      _next = it->first + 1;
+      _packets.erase(it);
+      return slot;
+    }
+
+    // The packet is missing, the next one may carry it as FEC
+    slot_t slot {slot_e::conceal, {}};
+    if (it->first == _next + 1) {
+      slot.payload = it->second;
+    }
+    ++_next;
+    return slot;
+  }
+
+  std::size_t jitter_buffer_t::depth() const {
+    return _packets.size();
+  }
+
+  int jitter_buffer_t::target_depth() const {
+    auto jitter_depth = (int) std::ceil(3.0 * _jitter_ns / std::max<double>(1.0, (double) _packet_duration.count()));
+    return std::clamp(1 + jitter_depth + _underrun_depth, 1, max_depth);
+  }
+
+  int mic_playback_t::init() {
+    _ctx = get_audio_ctx_ref();
+    if (!_ctx->control) {
+      return -1;
+    }
+
+    _sink = _ctx->control->virtual_microphone(channels, sample_rate);
+    if (!_sink) {
+      BOOST_LOG(warning) << "There is no virtual microphone to play the client microphone into"sv;
+      return -1;
+    }
+
+    int status;
+    _decoder.reset(opus_decoder_create(sample_rate, channels, &status));
+    if (status != OPUS_OK) {
+      BOOST_LOG(error) << "Couldn't create the microphone decoder: "sv << opus_strerror(status);
+      return -1;
     }
+
+    // Room for the longest Opus packet
+    _pcm.resize(sample_rate * 120 / 1000 * channels);
+    return 0;
+  }
+
+  void mic_playback_t::push(std::uint16_t sequence_number, std::vector<std::uint8_t> &&payload) {
+    _jitter.push(sequence_number, std::move(payload), std::chrono::steady_clock::now());
+  }
+
+  int mic_playback_t::tick() {
+    auto slot = _jitter.pop();
+
+    int frames = 0;
+    switch (slot.type) {
+      case jitter_buffer_t::slot_e::idle:
+        return 0;
+      case jitter_buffer_t::slot_e::packet:
+        frames = opus_decode_float(_decoder.get(), slot.payload.data(), slot.payload.size(), _pcm.data(), _pcm.size() / channels, 0);
+        if (frames > 0 && frames != _frame_size) {
+          _frame_size = frames;
+          _jitter.set_packet_duration(packet_duration());
+        }
+        break;
+      case jitter_buffer_t::slot_e::conceal:
+        // Without the next packet the decoder extrapolates from the previous ones
+        frames = opus_decode_float(
+          _decoder.get(),
+          slot.payload.empty() ? nullptr : slot.payload.data(),
+          slot.payload.size(),
+          _pcm.data(),
+          _frame_size,
+          slot.payload.empty() ? 0 : 1
+        );
+        break;
+    }
+
+    if (frames < 0) {
+      BOOST_LOG(warning) << "Couldn't decode microphone packet: "sv << opus_strerror(frames);
+      return 0;
+    }
+
+    return _sink->write(_pcm.data(), frames);
+  }
+
+  std::chrono::nanoseconds mic_playback_t::packet_duration() const {
+    return std::chrono::nanoseconds {1s} * _frame_size / sample_rate;
   }
 
   audio_ctx_ref_t get_audio_ctx_ref() {
@@ -291,6 +851,20 @@ namespace audio {
     return control_shared.ref();
   }
 
+  void prewarm(std::chrono::seconds duration) {
+    // Switching the sink can take a while, don't hold up the caller
+    task_pool.push([duration]() {
+      auto ref = get_audio_ctx_ref();
+      if (!ref) {
+        return;
+      }
+
+      task_pool.pushDelayed([ref = std::move(ref)]() mutable {
+        ref.reset();
+      }, duration);
+    });
+  }
+
   bool is_audio_ctx_sink_available(const audio_ctx_t &ctx) {
     if (!ctx.control) {
       return false;
@@ -358,6 +932,14 @@ namespace audio {
     }
   }
 
+  opus_stream_config_t stream_config(const config_t &config) {
+    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
+    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
+      apply_surround_params(stream, config.customStreamParams);
+    }
+    return stream;
+  }
+
   void apply_surround_params(opus_stream_config_t &stream, const stream_params_t &params) {
     stream.channelCount = params.channelCount;
     stream.streams = params.streams;
@@ -10,6 +10,14 @@
 #include "utility.h"
 
 #include <bitset>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+// lib includes
+#include <opus/opus.h>
 
 namespace audio {
   /**
@@ -75,6 +83,16 @@ namespace audio {
     bool input_only;  ///< Whether this is input-only mode
   };
 
+  /**
+   * @brief Opus encoder parameters requested by the automatic bitrate controller.
+   */
+  struct encoder_params_t {
+    int bitrate_percent;  ///< Share of the stream configuration bitrate to encode at
+    int packet_loss_percent;  ///< Expected packet loss passed to OPUS_SET_PACKET_LOSS_PERC
+
+    friend bool operator==(const encoder_params_t &, const encoder_params_t &) = default;
+  };
+
   /**
    * @brief Audio context structure.
    */
@@ -95,9 +113,24 @@ namespace audio {
   /**
    * @brief Audio packet type.
    * 
-   * Pair of channel data pointer and audio buffer containing encoded audio data.
+   * Channel data pointer, audio buffer containing encoded audio data and the
+   * capture time of its first sample.
    */
-  using packet_t = std::pair<void *, buffer_t>;
+  using packet_t = std::tuple<void *, buffer_t, std::chrono::steady_clock::time_point>;
+
+  /**
+   * @brief Get a buffer for an encoded audio packet.
+   * @details Buffers returned by release_buffer() are reused, so the audio path doesn't allocate
+   *          in steady state.
+   * @return A buffer of the maximum audio packet size.
+   */
+  buffer_t acquire_buffer();
+
+  /**
+   * @brief Return an audio packet buffer once its packet was sent.
+   * @param buffer A buffer from acquire_buffer().
+   */
+  void release_buffer(buffer_t &&buffer);
 
   /**
    * @brief Audio context reference type.
@@ -118,6 +151,135 @@ namespace audio {
    */
   void capture(safe::mail_t mail, config_t config, void *channel_data);
 
+  /**
+   * @brief Get the Opus stream configuration a session is encoded with.
+   * @param config The audio configuration of the session.
+   * @return The configuration, its mapping may point into @p config.
+   */
+  opus_stream_config_t stream_config(const config_t &config);
+
+  /**
+   * @brief Adaptive jitter buffer for the Opus packets of the client microphone.
+   * @details One slot is released per packet duration. Playback starts once the target depth
+   *          is buffered. The target follows the interarrival jitter of RFC 3550 and grows after
+   *          each underrun, depth past it is trimmed so the latency comes back down.
+   */
+  class jitter_buffer_t {
+  public:
+    static constexpr int max_depth = 8;  ///< Deepest target, in packets
+
+    /**
+     * @brief What to play for a slot.
+     */
+    enum class slot_e {
+      packet,  ///< Decode the payload
+      conceal,  ///< The packet is missing, recover it from the payload with FEC or conceal it if empty
+      idle,  ///< Buffering, nothing to play
+    };
+
+    /**
+     * @brief A slot released by pop().
+     */
+    struct slot_t {
+      slot_e type;
+      std::vector<std::uint8_t> payload;
+    };
+
+    /**
+     * @brief Create a jitter buffer.
+     * @param packet_duration Expected duration of the packets.
+     */
+    explicit jitter_buffer_t(std::chrono::nanoseconds packet_duration);
+
+    /**
+     * @brief Update the duration of the packets, once it's known from a decoded packet.
+     * @param packet_duration Duration of the packets.
+     */
+    void set_packet_duration(std::chrono::nanoseconds packet_duration);
+
+    /**
+     * @brief Buffer a received packet.
+     * @param sequence_number RTP sequence number of the packet.
+     * @param payload The Opus packet.
+     * @param arrival When the packet was received.
+     */
+    void push(std::uint16_t sequence_number, std::vector<std::uint8_t> &&payload, std::chrono::steady_clock::time_point arrival);
+
+    /**
+     * @brief Release the next slot, called once per packet duration.
+     * @return The slot.
+     */
+    slot_t pop();
+
+    /**
+     * @brief Get the number of buffered packets.
+     * @return The depth.
+     */
+    std::size_t depth() const;
+
+    /**
+     * @brief Get the depth playback starts at and is trimmed to.
+     * @return The target depth, in packets.
+     */
+    int target_depth() const;
+
+  private:
+    std::map<std::int64_t, std::vector<std::uint8_t>> _packets;  ///< Packets by extended sequence number
+    std::chrono::nanoseconds _packet_duration;
+
+    bool _playing = false;
+    std::int64_t _next = 0;  ///< Extended sequence number of the next slot
+    std::optional<std::int64_t> _highest;  ///< Highest extended sequence number received
+
+    std::chrono::steady_clock::time_point _last_arrival;
+    double _jitter_ns = 0;  ///< Interarrival jitter estimate
+    int _underrun_depth = 0;  ///< Extra depth added by underruns, decays over time
+    int _slots_since_underrun = 0;
+  };
+
+  /**
+   * @brief Plays the microphone of the client into the virtual microphone of the host.
+   * @details The owner pushes packets as they arrive and calls tick() once per packet_duration().
+   */
+  class mic_playback_t {
+  public:
+    static constexpr std::uint32_t sample_rate = 48000;
+    static constexpr int channels = 1;
+
+    /**
+     * @brief Open the Opus decoder and the virtual microphone.
+     * @return 0 on success, -1 if there is no virtual microphone to play into.
+     */
+    int init();
+
+    /**
+     * @brief Buffer a received packet.
+     * @param sequence_number RTP sequence number of the packet.
+     * @param payload The decrypted Opus packet.
+     */
+    void push(std::uint16_t sequence_number, std::vector<std::uint8_t> &&payload);
+
+    /**
+     * @brief Decode and play the next slot of the jitter buffer.
+     * @return 0 on success, -1 if the virtual microphone is gone.
+     */
+    int tick();
+
+    /**
+     * @brief Get the duration of the packets of the client.
+     * @return The packet duration.
+     */
+    std::chrono::nanoseconds packet_duration() const;
+
+  private:
+    audio_ctx_ref_t _ctx;
+    std::unique_ptr<platf::virtual_mic_t> _sink;
+    util::safe_ptr<OpusDecoder, opus_decoder_destroy> _decoder;
+    jitter_buffer_t _jitter {20ms};
+    std::vector<float> _pcm;
+    int _frame_size = sample_rate / 50;  ///< Samples per channel of the last decoded packet
+  };
+
   /**
    * @brief Get the reference to the audio context.
    * @returns A shared pointer reference to audio context.
@@ -145,4 +307,23 @@ namespace audio {
    * @examples_end
    */
   bool is_audio_ctx_sink_available(const audio_ctx_t &ctx);
+
+  /**
+   * @brief Set up the audio context in the background and keep it for a while.
+   * @details Lets a stream that was just launched find the sink already switched when it starts capturing.
+   * @param duration How long to keep the audio context.
+   */
+  void prewarm(std::chrono::seconds duration);
+
+  /**
+   * @brief Capture a synthetic tone at the pace of a real device instead of the audio sink.
+   * @param enabled Whether pipelines started from now on use the synthetic capture.
+   */
+  void use_synthetic_capture(bool enabled);
+
+  /**
+   * @brief Get the times the synthetic capture handed frames to the encoder since the last call.
+   * @return One time per frame, in capture order.
+   */
+  std::vector<std::chrono::steady_clock::time_point> take_synthetic_capture_times();
 }  // namespace audio
@@ -0,0 +1,429 @@
+/**
+ * @file src/audio_convert.cpp
+ * @brief Definitions for the SIMD sample conversion, channel remapping and resampling of captured audio.
+ */
+// this include
+#include "audio_convert.h"
+
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <numeric>
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  #define AUDIO_CONVERT_AVX2
+  #include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  #define AUDIO_CONVERT_NEON
+  #include <arm_neon.h>
+#endif
+
+namespace audio {
+  using params_t = remixer_t::params_t;
+
+  namespace {
+    constexpr float minus_3db = 0.70710678f;
+
+    // Larger reduced ratios would need an unreasonably large coefficient table
+    constexpr int max_phases = 1024;
+
+    /**
+     * @brief Get the speaker of each interleaved channel.
+     */
+    std::vector<std::uint32_t> channel_speakers(int channels, std::uint32_t mask) {
+      std::vector<std::uint32_t> speakers;
+      for (std::uint32_t bit = 1; bit && (int) speakers.size() < channels; bit <<= 1) {
+        if (mask & bit) {
+          speakers.push_back(bit);
+        }
+      }
+      speakers.resize(channels, 0);
+      return speakers;
+    }
+
+    /**
+     * @brief Add an input speaker to the output channels, folding it into the nearest ones if it's missing.
+     * @param speaker The input speaker.
+     * @param gain The gain to add it with.
+     * @param out_speakers The speaker of each output channel.
+     * @param column The gains of the input channel in each output channel.
+     */
+    void route(std::uint32_t speaker, float gain, const std::vector<std::uint32_t> &out_speakers, float (&column)[remixer_t::max_out_channels]) {
+      auto has = [&](std::uint32_t s) {
+        return std::find(std::begin(out_speakers), std::end(out_speakers), s) != std::end(out_speakers);
+      };
+      auto add = [&](std::uint32_t s, float g) {
+        for (std::size_t x = 0; x < out_speakers.size(); ++x) {
+          if (out_speakers[x] == s) {
+            column[x] += g;
+          }
+        }
+      };
+
+      if (has(speaker)) {
+        add(speaker, gain);
+        return;
+      }
+
+      using namespace speaker;
+      switch (speaker) {
+        case front_left:
+        case front_right:
+          // Mono output
+          add(front_center, gain * minus_3db);
+          break;
+        case front_center:
+          if (has(front_left) && has(front_right)) {
+            add(front_left, gain * minus_3db);
+            add(front_right, gain * minus_3db);
+          }
+          break;
+        case back_left:
+          has(side_left) ? add(side_left, gain) : route(front_left, gain * minus_3db, out_speakers, column);
+          break;
+        case back_right:
+          has(side_right) ? add(side_right, gain) : route(front_right, gain * minus_3db, out_speakers, column);
+          break;
+        case side_left:
+          has(back_left) ? add(back_left, gain) : route(front_left, gain * minus_3db, out_speakers, column);
+          break;
+        case side_right:
+          has(back_right) ? add(back_right, gain) : route(front_right, gain * minus_3db, out_speakers, column);
+          break;
+        case front_left_of_center:
+          route(front_left, gain, out_speakers, column);
+          break;
+        case front_right_of_center:
+          route(front_right, gain, out_speakers, column);
+          break;
+        case back_center:
+          if (has(back_left) && has(back_right)) {
+            add(back_left, gain * minus_3db);
+            add(back_right, gain * minus_3db);
+          } else if (has(side_left) && has(side_right)) {
+            add(side_left, gain * minus_3db);
+            add(side_right, gain * minus_3db);
+          } else {
+            route(front_left, gain * 0.5f, out_speakers, column);
+            route(front_right, gain * 0.5f, out_speakers, column);
+          }
+          break;
+        case top_center:
+          route(front_left, gain * 0.5f, out_speakers, column);
+          route(front_right, gain * 0.5f, out_speakers, column);
+          break;
+        case top_front_left:
+          route(front_left, gain * minus_3db, out_speakers, column);
+          break;
+        case top_front_center:
+          route(front_center, gain * minus_3db, out_speakers, column);
+          break;
+        case top_front_right:
+          route(front_right, gain * minus_3db, out_speakers, column);
+          break;
+        case top_back_left:
+          route(back_left, gain * minus_3db, out_speakers, column);
+          break;
+        case top_back_center:
+          route(back_center, gain * minus_3db, out_speakers, column);
+          break;
+        case top_back_right:
+          route(back_right, gain * minus_3db, out_speakers, column);
+          break;
+        default:
+          // The low frequency channel and channels without a speaker are dropped
+          break;
+      }
+    }
+
+    template<pcm_format_e format>
+    inline void load_frame(const void *src, std::size_t offset, int channels, float *in) {
+      if constexpr (format == pcm_format_e::f32) {
+        std::copy_n((const float *) src + offset, channels, in);
+      } else if constexpr (format == pcm_format_e::s32) {
+        auto samples = (const std::int32_t *) src + offset;
+        for (int x = 0; x < channels; ++x) {
+          in[x] = (float) samples[x] * (1.0f / 2147483648.0f);
+        }
+      } else {
+        auto samples = (const std::int16_t *) src + offset;
+        for (int x = 0; x < channels; ++x) {
+          in[x] = (float) samples[x] * (1.0f / 32768.0f);
+        }
+      }
+    }
+
+    void copy_f32(const void *src, std::size_t frames, float *dst, const params_t &params) {
+      std::copy_n((const float *) src, frames * params.in_channels, dst);
+    }
+
+    template<pcm_format_e format>
+    void remix_scalar(const void *src, std::size_t frames, float *dst, const params_t &params) {
+      float in[remixer_t::max_in_channels];
+      for (std::size_t f = 0; f < frames; ++f) {
+        load_frame<format>(src, f * params.in_channels, params.in_channels, in);
+
+        auto out = dst + f * params.out_channels;
+        for (int o = 0; o < params.out_channels; ++o) {
+          float sum = 0.0f;
+          for (int i = 0; i < params.in_channels; ++i) {
+            sum += in[i] * params.matrix[i][o];
+          }
+          out[o] = sum;
+        }
+      }
+    }
+
+#ifdef AUDIO_CONVERT_AVX2
+  #define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+    // All 8 output channels fit one register, each input channel adds its broadcast sample times its column
+    template<pcm_format_e format>
+    AVX2_TARGET void remix_avx2(const void *src, std::size_t frames, float *dst, const params_t &params) {
+      __m256 columns[remixer_t::max_in_channels];
+      for (int i = 0; i < params.in_channels; ++i) {
+        columns[i] = _mm256_loadu_ps(params.matrix[i]);
+      }
+      auto mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(params.out_channels), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+      float in[remixer_t::max_in_channels];
+      for (std::size_t f = 0; f < frames; ++f) {
+        load_frame<format>(src, f * params.in_channels, params.in_channels, in);
+
+        auto sum = _mm256_setzero_ps();
+        for (int i = 0; i < params.in_channels; ++i) {
+          sum = _mm256_fmadd_ps(_mm256_broadcast_ss(in + i), columns[i], sum);
+        }
+        _mm256_maskstore_ps(dst + f * params.out_channels, mask, sum);
+      }
+    }
+#endif
+
+#ifdef AUDIO_CONVERT_NEON
+    template<pcm_format_e format>
+    void remix_neon(const void *src, std::size_t frames, float *dst, const params_t &params) {
+      float32x4_t low[remixer_t::max_in_channels];
+      float32x4_t high[remixer_t::max_in_channels];
+      for (int i = 0; i < params.in_channels; ++i) {
+        low[i] = vld1q_f32(params.matrix[i]);
+        high[i] = vld1q_f32(params.matrix[i] + 4);
+      }
+
+      float in[remixer_t::max_in_channels];
+      float out[remixer_t::max_out_channels];
+      for (std::size_t f = 0; f < frames; ++f) {
+        load_frame<format>(src, f * params.in_channels, params.in_channels, in);
+
+        auto sum_low = vdupq_n_f32(0.0f);
+        auto sum_high = vdupq_n_f32(0.0f);
+        for (int i = 0; i < params.in_channels; ++i) {
+          sum_low = vfmaq_n_f32(sum_low, low[i], in[i]);
+          sum_high = vfmaq_n_f32(sum_high, high[i], in[i]);
+        }
+        vst1q_f32(out, sum_low);
+        vst1q_f32(out + 4, sum_high);
+        std::copy_n(out, params.out_channels, dst + f * params.out_channels);
+      }
+    }
+#endif
+
+    /**
+     * @brief Remix kernels of one instruction set for every sample format.
+     */
+    struct kernel_set_t {
+      const char *name;
+      remixer_t::kernel_t f32, s32, s16;
+    };
+
+    constexpr kernel_set_t scalar_kernels {
+      "scalar",
+      remix_scalar<pcm_format_e::f32>,
+      remix_scalar<pcm_format_e::s32>,
+      remix_scalar<pcm_format_e::s16>,
+    };
+
+#ifdef AUDIO_CONVERT_AVX2
+    constexpr kernel_set_t avx2_kernels {
+      "avx2",
+      remix_avx2<pcm_format_e::f32>,
+      remix_avx2<pcm_format_e::s32>,
+      remix_avx2<pcm_format_e::s16>,
+    };
+#endif
+
+#ifdef AUDIO_CONVERT_NEON
+    constexpr kernel_set_t neon_kernels {
+      "neon",
+      remix_neon<pcm_format_e::f32>,
+      remix_neon<pcm_format_e::s32>,
+      remix_neon<pcm_format_e::s16>,
+    };
+#endif
+
+    const kernel_set_t &best_kernels(bool allow_simd) {
+      if (allow_simd) {
+#if defined(AUDIO_CONVERT_AVX2)
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+          return avx2_kernels;
+        }
+#elif defined(AUDIO_CONVERT_NEON)
+        return neon_kernels;
+#endif
+      }
+
+      return scalar_kernels;
+    }
+
+    /**
+     * @brief Zeroth order modified Bessel function of the first kind, for the Kaiser window.
+     */
+    double bessel_i0(double x) {
+      double sum = 1.0;
+      double term = 1.0;
+      for (int k = 1; k < 32; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+      }
+      return sum;
+    }
+  }  // namespace
+
+  remixer_t::remixer_t(pcm_format_e format, int in_channels, std::uint32_t in_mask, int out_channels, std::uint32_t out_mask, bool allow_simd) {
+    _params.format = format;
+    _params.in_channels = std::clamp(in_channels, 1, max_in_channels);
+    _params.out_channels = std::clamp(out_channels, 1, max_out_channels);
+    std::fill_n(&_params.matrix[0][0], max_in_channels * max_out_channels, 0.0f);
+
+    auto in_speakers = channel_speakers(_params.in_channels, in_mask);
+    auto out_speakers = channel_speakers(_params.out_channels, out_mask);
+    for (int i = 0; i < _params.in_channels; ++i) {
+      if (in_speakers[i]) {
+        route(in_speakers[i], 1.0f, out_speakers, _params.matrix[i]);
+      }
+    }
+
+    auto identity = format == pcm_format_e::f32 && _params.in_channels == _params.out_channels;
+    for (int i = 0; identity && i < _params.in_channels; ++i) {
+      for (int o = 0; o < _params.out_channels; ++o) {
+        if (_params.matrix[i][o] != (i == o ? 1.0f : 0.0f)) {
+          identity = false;
+          break;
+        }
+      }
+    }
+
+    if (identity) {
+      _kernel_name = "copy";
+      _kernel = copy_f32;
+      return;
+    }
+
+    auto &kernels = best_kernels(allow_simd);
+    _kernel_name = kernels.name;
+
+    switch (format) {
+      case pcm_format_e::f32:
+        _kernel = kernels.f32;
+        break;
+      case pcm_format_e::s32:
+        _kernel = kernels.s32;
+        break;
+      case pcm_format_e::s16:
+        _kernel = kernels.s16;
+        break;
+    }
+  }
+
+  void remixer_t::convert(const void *src, std::size_t frames, float *dst) const {
+    _kernel(src, frames, dst, _params);
+  }
+
+  float remixer_t::gain(int out, int in) const {
+    return _params.matrix[in][out];
+  }
+
+  const char *remixer_t::kernel_name() const {
+    return _kernel_name;
+  }
+
+  bool resampler_t::is_supported(int in_rate, int out_rate) {
+    if (in_rate <= 0 || out_rate <= 0) {
+      return false;
+    }
+
+    auto divisor = std::gcd(in_rate, out_rate);
+    return out_rate / divisor <= max_phases && in_rate / divisor <= max_phases;
+  }
+
+  resampler_t::resampler_t(int channels, int in_rate, int out_rate, int taps):
+      _channels {std::clamp(channels, 1, remixer_t::max_out_channels)},
+      _in_rate {in_rate} {
+    auto divisor = std::gcd(in_rate, out_rate);
+    _up = out_rate / divisor;
+    _down = in_rate / divisor;
+
+    // Keep the transition band as narrow when decimating by widening the filter
+    _taps = taps * std::max(1, (_down + _up - 1) / _up);
+
+    auto length = _up * _taps;
+    auto center = (length - 1) / 2.0;
+    auto cutoff = 0.5 / _up * std::min(1.0, (double) _up / _down) * 0.95;
+
+    constexpr double beta = 8.0;
+    auto window_scale = 1.0 / bessel_i0(beta);
+
+    _filters.resize(length);
+    for (int n = 0; n < length; ++n) {
+      auto t = n - center;
+      auto sinc = t == 0 ? 1.0 : std::sin(2.0 * std::numbers::pi * cutoff * t) / (2.0 * std::numbers::pi * cutoff * t);
+      auto ratio = t / center;
+      auto window = bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - ratio * ratio))) * window_scale;
+
+      // Coefficient n of the filter belongs to phase n % up and tap n / up, taps are stored oldest first
+      auto phase = n % _up;
+      auto tap = n / _up;
+      _filters[phase * _taps + (_taps - 1 - tap)] = (float) (2.0 * cutoff * sinc * window * _up);
+    }
+
+    _history.assign((std::size_t) (_taps - 1) * _channels, 0.0f);
+    _position = (std::uint64_t) (_taps - 1) * _up;
+  }
+
+  std::chrono::nanoseconds resampler_t::process(const float *src, std::size_t frames, std::vector<float> &dst) {
+    auto buffered = _history.size() / _channels;
+    auto first = _position;
+
+    _history.insert(std::end(_history), src, src + frames * _channels);
+    auto total = _history.size() / _channels;
+
+    dst.reserve(dst.size() + (frames * _up / _down + 2) * _channels);
+    float sum[remixer_t::max_out_channels];
+    for (; _position / _up < total; _position += _down) {
+      auto base = _position / _up;
+      auto filter = _filters.data() + (_position % _up) * _taps;
+      auto frame = _history.data() + (base + 1 - _taps) * _channels;
+
+      std::fill_n(sum, _channels, 0.0f);
+      for (int k = 0; k < _taps; ++k) {
+        for (int c = 0; c < _channels; ++c) {
+          sum[c] += filter[k] * frame[k * _channels + c];
+        }
+      }
+      dst.insert(std::end(dst), sum, sum + _channels);
+    }
+
+    // Only the last taps - 1 frames before the next output are still needed
+    auto drop = _position / _up + 1 - _taps;
+    _history.erase(std::begin(_history), std::begin(_history) + drop * _channels);
+    _position -= drop * _up;
+
+    auto offset = (double) first / _up - (double) buffered;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(offset / _in_rate)) - delay();
+  }
+
+  std::chrono::nanoseconds resampler_t::delay() const {
+    auto center = (_up * _taps - 1) / 2.0;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(center / _up / _in_rate));
+  }
+}  // namespace audio
@@ -0,0 +1,168 @@
+/**
+ * @file src/audio_convert.h
+ * @brief Declarations for the SIMD sample conversion, channel remapping and resampling of captured audio.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace audio {
+
+  /**
+   * @brief Interleaved sample formats the remixer accepts.
+   */
+  enum class pcm_format_e {
+    f32,  ///< 32-bit float
+    s32,  ///< 32-bit signed integer, also used for 24-bit samples in the high bits of 32
+    s16,  ///< 16-bit signed integer
+  };
+
+  /**
+   * @brief Speaker positions, with the bit values of WAVEFORMATEXTENSIBLE channel masks.
+   * @details Interleaved channels appear in the order of their speaker bits, lowest first.
+   */
+  namespace speaker {
+    constexpr std::uint32_t front_left = 0x1;
+    constexpr std::uint32_t front_right = 0x2;
+    constexpr std::uint32_t front_center = 0x4;
+    constexpr std::uint32_t low_frequency = 0x8;
+    constexpr std::uint32_t back_left = 0x10;
+    constexpr std::uint32_t back_right = 0x20;
+    constexpr std::uint32_t front_left_of_center = 0x40;
+    constexpr std::uint32_t front_right_of_center = 0x80;
+    constexpr std::uint32_t back_center = 0x100;
+    constexpr std::uint32_t side_left = 0x200;
+    constexpr std::uint32_t side_right = 0x400;
+    constexpr std::uint32_t top_center = 0x800;
+    constexpr std::uint32_t top_front_left = 0x1000;
+    constexpr std::uint32_t top_front_center = 0x2000;
+    constexpr std::uint32_t top_front_right = 0x4000;
+    constexpr std::uint32_t top_back_left = 0x8000;
+    constexpr std::uint32_t top_back_center = 0x10000;
+    constexpr std::uint32_t top_back_right = 0x20000;
+
+    constexpr std::uint32_t stereo = front_left | front_right;
+    constexpr std::uint32_t surround51 = stereo | front_center | low_frequency | back_left | back_right;
+    constexpr std::uint32_t surround71 = surround51 | side_left | side_right;
+  }  // namespace speaker
+
+  /**
+   * @brief Converter from the interleaved samples of a device to the float channel layout of the encoder.
+   * @details Every output channel is a weighted sum of the input channels. Speakers missing from
+   *          the output are folded into the nearest ones with the ITU-R BS.775 downmix gains,
+   *          the low frequency channel is dropped when the output has none. Input channels
+   *          without a speaker bit are dropped.
+   */
+  class remixer_t {
+  public:
+    static constexpr int max_in_channels = 16;
+    static constexpr int max_out_channels = 8;
+
+    /**
+     * @brief Create a remixer.
+     * @param format The format of the input samples.
+     * @param in_channels The number of input channels, up to `max_in_channels`.
+     * @param in_mask The speaker mask of the input channels.
+     * @param out_channels The number of output channels, up to `max_out_channels`.
+     * @param out_mask The speaker mask of the output channels.
+     * @param allow_simd Whether vector kernels may be used, `false` forces the scalar reference.
+     */
+    remixer_t(pcm_format_e format, int in_channels, std::uint32_t in_mask, int out_channels, std::uint32_t out_mask, bool allow_simd = true);
+
+    /**
+     * @brief Convert interleaved frames.
+     * @param src The input frames.
+     * @param frames The number of frames.
+     * @param dst Room for `frames * out_channels` float samples.
+     */
+    void convert(const void *src, std::size_t frames, float *dst) const;
+
+    /**
+     * @brief Get the gain of an input channel in an output channel.
+     * @param out The output channel.
+     * @param in The input channel.
+     * @return The gain.
+     */
+    float gain(int out, int in) const;
+
+    /**
+     * @brief Get the name of the selected kernel.
+     * @return "copy", "avx2", "neon" or "scalar".
+     */
+    const char *kernel_name() const;
+
+    /**
+     * @brief Conversion state shared with the kernels.
+     */
+    struct params_t {
+      pcm_format_e format;
+      int in_channels;
+      int out_channels;
+      float matrix[max_in_channels][max_out_channels];  ///< Gains of each input channel, unused outputs are 0
+    };
+
+    using kernel_t = void (*)(const void *src, std::size_t frames, float *dst, const params_t &params);
+
+  private:
+    params_t _params;
+    const char *_kernel_name;
+    kernel_t _kernel;
+  };
+
+  /**
+   * @brief Polyphase windowed sinc resampler for interleaved float frames.
+   * @details The filter is a Kaiser windowed sinc with its cutoff just below the lower of the
+   *          two Nyquist frequencies. One set of coefficients is kept per output phase, so the
+   *          ratio of the two rates must reduce to a small fraction.
+   */
+  class resampler_t {
+  public:
+    /**
+     * @brief Check whether a conversion can be handled.
+     * @param in_rate The input sample rate.
+     * @param out_rate The output sample rate.
+     * @return `true` if the reduced ratio keeps the coefficient table small.
+     */
+    static bool is_supported(int in_rate, int out_rate);
+
+    /**
+     * @brief Create a resampler.
+     * @param channels The number of interleaved channels.
+     * @param in_rate The input sample rate.
+     * @param out_rate The output sample rate.
+     * @param taps The number of input frames each output frame is computed from.
+     */
+    resampler_t(int channels, int in_rate, int out_rate, int taps = 32);
+
+    /**
+     * @brief Resample the next input frames.
+     * @param src The input frames.
+     * @param frames The number of input frames.
+     * @param dst Output frames are appended to it.
+     * @return The capture time of the first appended frame relative to the first input frame,
+     *         taking the delay of the filter into account.
+     */
+    std::chrono::nanoseconds process(const float *src, std::size_t frames, std::vector<float> &dst);
+
+    /**
+     * @brief Get the delay the filter adds.
+     * @return The group delay.
+     */
+    std::chrono::nanoseconds delay() const;
+
+  private:
+    int _channels;
+    int _in_rate;
+    int _up;  ///< Interpolation factor of the reduced ratio
+    int _down;  ///< Decimation factor of the reduced ratio
+    int _taps;
+
+    std::vector<float> _filters;  ///< `_taps` reversed coefficients for each of the `_up` phases
+    std::vector<float> _history;  ///< The input frames still needed by the filter
+    std::uint64_t _position;  ///< Position of the next output frame in the history, in 1/`_up` frames
+  };
+}  // namespace audio
@@ -3,13 +3,117 @@
  * @brief Definitions for automatic bitrate adjustment controller.
  */
 
+// standard includes
+#include <algorithm>
+#include <cmath>
+
 // local includes
 #include "auto_bitrate.h"
 #include "config.h"
 #include "logging.h"
 #include "stream.h"
 
+using namespace std::literals;
+
 namespace stream {
+  namespace {
+    /**
+     * @brief How long the lowest RTT of a window is kept as the base RTT.
+     * @details The base is the lowest of the current and the previous window, so a route
+     *          change that raises the RTT for good stops looking like queuing after two windows.
+     */
+    constexpr auto rtt_window = 10s;
+
+    /**
+     * @brief Minimum span to measure the delay gradient over.
+     * @details ENet only refreshes its RTT estimate as acknowledgements arrive, shorter
+     *          spans would mostly measure no change.
+     */
+    constexpr auto gradient_interval = 250ms;
+
+    constexpr int fec_step_pct = 5;  ///< FEC percentage change per adjustment
+    constexpr int fec_min_pct = 5;  ///< Lowest FEC percentage adaptive FEC goes down to
+    constexpr int fec_max_pct = 50;  ///< Highest FEC percentage adaptive FEC goes up to
+
+    /**
+     * @brief Scale a video bitrate so the total bitrate stays the same with another FEC percentage.
+     * @details Mirrors the FEC adjustment rtsp.cpp applies to the configured bitrate, above 80% the
+     *          parity doesn't come out of the video bitrate.
+     * @param bitrate The video bitrate in Kbps.
+     * @param from_fec The FEC percentage the bitrate was computed for.
+     * @param to_fec The FEC percentage to compute the bitrate for.
+     * @return The scaled bitrate in Kbps.
+     */
+    int scale_for_fec(int bitrate, int from_fec, int to_fec) {
+      if (from_fec == to_fec || from_fec > 80 || to_fec > 80) {
+        return bitrate;
+      }
+
+      return static_cast<int>(static_cast<std::int64_t>(bitrate) * (100 - to_fec) / (100 - from_fec));
+    }
+
+    /**
+     * @brief Heights of the resolution ladder, the rungs are the ones below the requested height.
+     */
+    constexpr std::array<int, 5> ladder_heights {2160, 1440, 1080, 720, 540};
+
+    /**
+     * @brief Bits per pixel below which a rung turns into blocks.
+     * @details Stepping back up needs twice that on the rung above, so the ladder doesn't oscillate.
+     */
+    constexpr double ladder_min_bpp = 0.03;
+
+    /**
+     * @brief Build the resolution ladder of a session.
+     * @param monitor The format the client requested.
+     * @param halve_fps Whether the last rung also halves the framerate.
+     * @return The rungs, starting with the requested format.
+     */
+    std::vector<video::ladder_step_t> build_ladder(const video::config_t &monitor, bool halve_fps) {
+      std::vector<video::ladder_step_t> ladder {{monitor.width, monitor.height, monitor.framerate, monitor.encodingFramerate}};
+      for (auto height : ladder_heights) {
+        if (height >= monitor.height) {
+          continue;
+        }
+
+        // Keep the aspect ratio, with an even width for chroma subsampling
+        auto width = static_cast<int>(static_cast<std::int64_t>(monitor.width) * height / monitor.height) & ~1;
+        ladder.push_back({width, height, monitor.framerate, monitor.encodingFramerate});
+      }
+
+      // Framerate may be in fps (if <= 1000) or millifps (if > 1000)
+      auto fps = monitor.framerate > 1000 ? monitor.framerate / 1000 : monitor.framerate;
+      if (halve_fps && fps >= 50) {
+        auto step = ladder.back();
+        step.framerate /= 2;
+        step.encodingFramerate /= 2;
+        ladder.push_back(step);
+      }
+
+      return ladder;
+    }
+
+    /**
+     * @brief Bits per pixel a bitrate gives a rung of the resolution ladder.
+     * @param bitrate_kbps The bitrate in Kbps.
+     * @param step The rung.
+     * @return The bits per pixel.
+     */
+    double bits_per_pixel(int bitrate_kbps, const video::ladder_step_t &step) {
+      double fps = step.framerate > 1000 ? step.framerate / 1000.0 : step.framerate;
+      auto pixel_rate = static_cast<double>(step.width) * step.height * fps;
+      return pixel_rate > 0.0 ? bitrate_kbps * 1000.0 / pixel_rate : 0.0;
+    }
+
+    /**
+     * @brief Remember the loss of a report for adaptive FEC.
+     * @param state The controller state.
+     */
+    void record_loss(auto_bitrate_state_t &state) {
+      state.loss_history[state.loss_reports % state.loss_history.size()] = state.loss_percentage;
+      ++state.loss_reports;
+    }
+  }  // namespace
 
   /**
    * @brief Constructs an auto bitrate controller.
@@ -18,6 +122,10 @@ namespace stream {
   auto_bitrate_controller_t::auto_bitrate_controller_t() {
   }
 
+  auto_bitrate_controller_t::auto_bitrate_controller_t(clock_fn_t clock):
+      _clock {std::move(clock)} {
+  }
+
   void auto_bitrate_controller_t::process_loss_stats(session_t *session, 
                                                       uint64_t lastGoodFrame,
                                                       std::chrono::milliseconds time_interval) {
@@ -26,12 +134,15 @@ namespace stream {
     }
 
     auto &state = get_or_create_state(session);
-    auto now = std::chrono::steady_clock::now();
+    auto now = current_time();
 
     // Compute loss percentage
     state.loss_percentage = compute_loss_percentage(session, lastGoodFrame, time_interval);
     state.last_reported_good_frame = lastGoodFrame;
     state.last_loss_stats_time = now;
+    record_loss(state);
+    publish(session, state);
+    session->stats.loss_reports.fetch_add(1, std::memory_order_relaxed);
 
     // Note: current_bitrate_kbps is initialized in get_or_create_state() and
     // updated in calculate_new_bitrate() when adjustments are made.
@@ -47,11 +158,53 @@ namespace stream {
     }
 
     auto &state = get_or_create_state(session);
-    auto now = std::chrono::steady_clock::now();
+    auto now = current_time();
 
     state.loss_percentage = loss_percentage_loss_pct;
     state.last_reported_good_frame = lastGoodFrame;
     state.last_loss_stats_time = now;
+    record_loss(state);
+    publish(session, state);
+    session->stats.loss_reports.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void auto_bitrate_controller_t::process_rtt(session_t *session, uint32_t rtt_ms) {
+    if (!session || !session->auto_bitrate_enabled || rtt_ms == 0) {
+      return;
+    }
+
+    auto &state = get_or_create_state(session);
+    auto now = current_time();
+
+    if (state.window_min_rtt_ms == 0 || now - state.rtt_window_start >= rtt_window) {
+      state.previous_window_min_rtt_ms = state.window_min_rtt_ms;
+      state.window_min_rtt_ms = rtt_ms;
+      state.rtt_window_start = now;
+    } else {
+      state.window_min_rtt_ms = std::min(state.window_min_rtt_ms, rtt_ms);
+    }
+
+    auto base_rtt_ms = state.window_min_rtt_ms;
+    if (state.previous_window_min_rtt_ms > 0) {
+      base_rtt_ms = std::min(base_rtt_ms, state.previous_window_min_rtt_ms);
+    }
+    state.queuing_delay_ms = static_cast<double>(rtt_ms - base_rtt_ms);
+
+    if (state.last_gradient_time == std::chrono::steady_clock::time_point {}) {
+      state.last_gradient_time = now;
+      state.last_gradient_queuing_delay_ms = state.queuing_delay_ms;
+      return;
+    }
+
+    auto elapsed = std::chrono::duration<double>(now - state.last_gradient_time).count();
+    if (now - state.last_gradient_time < gradient_interval || elapsed <= 0.0) {
+      return;
+    }
+
+    auto gradient = (state.queuing_delay_ms - state.last_gradient_queuing_delay_ms) / elapsed;
+    state.delay_gradient = state.delay_gradient * 0.5 + gradient * 0.5;
+    state.last_gradient_time = now;
+    state.last_gradient_queuing_delay_ms = state.queuing_delay_ms;
   }
 
   void auto_bitrate_controller_t::process_connection_status(session_t *session,
@@ -69,14 +222,13 @@ namespace stream {
       return false;
     }
 
-    auto it = session_states.find(session);
-    if (it == session_states.end()) {
+    const auto &state = session->auto_bitrate_state;
+    if (!state.initialized) {
       return false;
     }
 
-    const auto &state = it->second;
-    const auto settings = config::get_auto_bitrate_settings();
-    auto now = std::chrono::steady_clock::now();
+    const auto &settings = config::get_auto_bitrate_settings();
+    auto now = current_time();
     auto time_since_last_adjustment = std::chrono::duration_cast<std::chrono::milliseconds>(
         now - state.last_adjustment_time).count();
 
@@ -114,87 +266,184 @@ namespace stream {
       return session->config.monitor.bitrate;
     }
 
-    auto it = session_states.find(session);
-    if (it == session_states.end()) {
+    const auto &state = session->auto_bitrate_state;
+    if (!state.initialized) {
       return session->config.monitor.bitrate;
     }
 
-    const auto &state = it->second;
-    const auto settings = config::get_auto_bitrate_settings();
-    auto now = std::chrono::steady_clock::now();
+    const auto &settings = config::get_auto_bitrate_settings();
+    auto now = current_time();
     
     double adjustment_factor = get_adjustment_factor(state, now, settings);
     int new_bitrate = static_cast<int>(state.current_bitrate_kbps * adjustment_factor);
 
-    // Get min/max bounds
-    // Start with client-provided values (if set)
-    int client_min = session->auto_bitrate_min_kbps > 0 ? session->auto_bitrate_min_kbps : 0;
-    int client_max = session->auto_bitrate_max_kbps > 0 ? session->auto_bitrate_max_kbps : 0;
-    
-    // Get server config bounds
-    int server_min = settings.min_kbps;
-    if (server_min <= 0) {
-      server_min = 1;  // Default minimum (changed from 500 to 1 Kbps)
+    auto [min_bitrate, max_bitrate] = bitrate_bounds(session, state.fec_percentage, settings);
+    new_bitrate = clamp_bitrate(new_bitrate, min_bitrate, max_bitrate);
+
+    // Note: State is NOT updated here. It will be updated in confirm_bitrate_change()
+    // after the encoder successfully applies the change. This prevents the state from
+    // reflecting a bitrate that the encoder never actually used.
+
+    return new_bitrate;
+  }
+
+  audio::encoder_params_t auto_bitrate_controller_t::calculate_audio_params(session_t *session, int new_bitrate_kbps) const {
+    audio::encoder_params_t params {100, 0};
+    if (!session || !session->auto_bitrate_enabled || session->config.monitor.bitrate <= 0) {
+      return params;
     }
-    
-    int server_max = settings.max_kbps;
-    if (server_max <= 0) {
-      // Use config max_bitrate cap if set, otherwise no server limit
-      server_max = settings.max_bitrate_cap > 0 ? settings.max_bitrate_cap : 0;
-    } else {
-      // Server max is set, apply cap if configured
-      if (settings.max_bitrate_cap > 0 && settings.max_bitrate_cap < server_max) {
-        server_max = settings.max_bitrate_cap;
-      }
+
+    // Follow the video bitrate down, audio is tiny compared to video so it only gives way under real congestion
+    auto percent = static_cast<std::int64_t>(new_bitrate_kbps) * 100 / session->config.monitor.bitrate;
+    params.bitrate_percent = static_cast<int>(std::clamp<std::int64_t>(percent, 50, 100));
+
+    params.packet_loss_percent = static_cast<int>(std::clamp(std::lround(session->auto_bitrate_state.loss_percentage), 0L, 100L));
+
+    return params;
+  }
+
+  int auto_bitrate_controller_t::calculate_new_fec(session_t *session) const {
+    const auto &settings = config::get_auto_bitrate_settings();
+    if (!session || !session->auto_bitrate_enabled) {
+      return settings.fec_percentage;
     }
-    
-    // Calculate final bounds: use client values as base, clamp by server config
-    int min_bitrate = client_min > 0 ? client_min : server_min;
-    // Apply server minimum clamp (server min is absolute minimum)
-    if (server_min > 0 && min_bitrate < server_min) {
-      min_bitrate = server_min;
+
+    const auto &state = session->auto_bitrate_state;
+    if (!state.initialized || state.pending_fec_percentage >= 0 || state.fec_percentage > 80) {
+      return state.fec_percentage;
     }
-    
-    int max_bitrate;
-    if (client_max > 0) {
-      max_bitrate = client_max;
-      // Apply server maximum clamp (server max is absolute maximum if set)
-      if (server_max > 0 && max_bitrate > server_max) {
-        max_bitrate = server_max;
-      }
-    } else {
-      // No client max provided, use server max or configured bitrate
-      if (server_max > 0) {
-        max_bitrate = server_max;
-      } else {
-        max_bitrate = session->config.monitor.bitrate;
-        // Ensure max is at least 1 Kbps (safety check)
-        if (max_bitrate < 1) {
-          max_bitrate = 1000;  // Fallback to 1 Mbps if configured bitrate is invalid
-        }
-      }
+
+    // Follow a FEC percentage saved while streaming, the rebalanced bitrate keeps the total the same
+    if (!settings.adaptive_fec) {
+      return settings.fec_percentage <= 80 ? settings.fec_percentage : state.fec_percentage;
     }
-    
-    // Ensure min <= max
-    if (min_bitrate > max_bitrate) {
-      min_bitrate = max_bitrate;
+
+    // Judge a full history measured at the current FEC percentage
+    if (state.loss_reports < state.loss_history.size()) {
+      return state.fec_percentage;
     }
-    
-    // Final safety check: ensure both are at least 1 Kbps
-    if (min_bitrate < 1) {
-      min_bitrate = 1;
+
+    auto now = current_time();
+    auto since_adjustment = std::chrono::duration_cast<std::chrono::milliseconds>(now - state.last_adjustment_time).count();
+    if (since_adjustment < std::max(settings.adjustment_interval_ms, 1000)) {
+      return state.fec_percentage;
     }
-    if (max_bitrate < 1) {
-      max_bitrate = 1;
+
+    std::size_t lossy_reports = 0;
+    double peak_loss = 0.0;
+    for (auto loss : state.loss_history) {
+      lossy_reports += loss > 0.0;
+      peak_loss = std::max(peak_loss, loss);
     }
 
-    new_bitrate = clamp_bitrate(new_bitrate, min_bitrate, max_bitrate);
+    // Keep the configured percentage inside the range FEC adapts over
+    auto base_fec = settings.fec_percentage;
+    if (lossy_reports >= state.loss_history.size() / 2 && peak_loss <= std::max(0, settings.loss_moderate_pct)) {
+      return std::min(state.fec_percentage + fec_step_pct, std::max(fec_max_pct, base_fec));
+    }
 
-    // Note: State is NOT updated here. It will be updated in confirm_bitrate_change()
-    // after the encoder successfully applies the change. This prevents the state from
-    // reflecting a bitrate that the encoder never actually used.
+    auto since_fec_change = std::chrono::duration_cast<std::chrono::milliseconds>(now - state.last_fec_change_time).count();
+    if (lossy_reports == 0 && since_adjustment >= settings.good_stability_ms && since_fec_change >= settings.good_stability_ms) {
+      return std::max(state.fec_percentage - fec_step_pct, std::min(fec_min_pct, base_fec));
+    }
 
-    return new_bitrate;
+    return state.fec_percentage;
+  }
+
+  int auto_bitrate_controller_t::calculate_fec_rebalanced_bitrate(session_t *session, int new_fec_percentage) const {
+    const auto &state = session->auto_bitrate_state;
+    const auto &settings = config::get_auto_bitrate_settings();
+
+    auto new_bitrate = scale_for_fec(state.current_bitrate_kbps, state.fec_percentage, new_fec_percentage);
+    auto [min_bitrate, max_bitrate] = bitrate_bounds(session, new_fec_percentage, settings);
+    return clamp_bitrate(new_bitrate, min_bitrate, max_bitrate);
+  }
+
+  void auto_bitrate_controller_t::request_fec_change(session_t *session, int new_fec_percentage, int new_bitrate_kbps) {
+    if (!session || !session->auto_bitrate_enabled) {
+      return;
+    }
+
+    auto &state = get_or_create_state(session);
+    state.pending_fec_percentage = new_fec_percentage;
+    state.pending_fec_bitrate_kbps = new_bitrate_kbps;
+  }
+
+  int auto_bitrate_controller_t::calculate_new_ladder_rung(session_t *session) const {
+    if (!session || !session->auto_bitrate_enabled) {
+      return 0;
+    }
+
+    const auto &state = session->auto_bitrate_state;
+    const auto &settings = config::get_auto_bitrate_settings();
+    if (!state.initialized || !settings.ladder || state.pending_ladder_rung >= 0) {
+      return state.ladder_rung;
+    }
+
+    auto ladder = build_ladder(session->config.monitor, settings.ladder_halve_fps);
+    auto rung = std::min(state.ladder_rung, static_cast<int>(ladder.size()) - 1);
+
+    auto adjustment_factor = get_adjustment_factor(state, current_time(), settings);
+    auto new_bitrate = calculate_new_bitrate(session);
+    auto min_bitrate = bitrate_bounds(session, state.fec_percentage, settings).first;
+
+    // Near the minimum the bitrate can't fall any further, only fewer pixels help
+    bool near_min = new_bitrate <= min_bitrate * 3 / 2;
+    if (adjustment_factor < 1.0 && rung + 1 < static_cast<int>(ladder.size()) &&
+        (near_min || bits_per_pixel(new_bitrate, ladder[rung]) < ladder_min_bpp)) {
+      return rung + 1;
+    }
+
+    if (adjustment_factor > 1.0 && rung > 0 && !near_min &&
+        bits_per_pixel(new_bitrate, ladder[rung - 1]) >= ladder_min_bpp * 2) {
+      return rung - 1;
+    }
+
+    return rung;
+  }
+
+  video::ladder_step_t auto_bitrate_controller_t::ladder_step(session_t *session, int rung) const {
+    auto ladder = build_ladder(session->config.monitor, config::get_auto_bitrate_settings().ladder_halve_fps);
+    return ladder[std::clamp(rung, 0, static_cast<int>(ladder.size()) - 1)];
+  }
+
+  void auto_bitrate_controller_t::request_ladder_change(session_t *session, int rung) {
+    if (!session || !session->auto_bitrate_enabled) {
+      return;
+    }
+
+    auto &state = get_or_create_state(session);
+    state.pending_ladder_rung = rung;
+  }
+
+  void auto_bitrate_controller_t::confirm_ladder_change(session_t *session, bool success) {
+    if (!session || !session->auto_bitrate_enabled) {
+      return;
+    }
+
+    auto &state = get_or_create_state(session);
+    if (success && state.pending_ladder_rung >= 0) {
+      state.ladder_rung = state.pending_ladder_rung;
+    }
+    state.pending_ladder_rung = -1;
+  }
+
+  auto_bitrate_adjustment_t auto_bitrate_controller_t::next_adjustment(session_t *session) {
+    auto_bitrate_adjustment_t adjustment;
+
+    if (auto new_fec = calculate_new_fec(session); new_fec != session->video.fec_percentage.load(std::memory_order_relaxed)) {
+      adjustment.bitrate_kbps = calculate_fec_rebalanced_bitrate(session, new_fec);
+      adjustment.fec_percentage = new_fec;
+      request_fec_change(session, new_fec, adjustment.bitrate_kbps);
+    } else if (should_adjust_bitrate(session)) {
+      adjustment.bitrate_kbps = calculate_new_bitrate(session);
+      if (auto rung = calculate_new_ladder_rung(session); rung != session->auto_bitrate_state.ladder_rung) {
+        adjustment.ladder_step = ladder_step(session, rung);
+        request_ladder_change(session, rung);
+      }
+    }
+
+    return adjustment;
   }
 
   void auto_bitrate_controller_t::confirm_bitrate_change(session_t *session, int new_bitrate_kbps, bool success) {
@@ -203,7 +452,7 @@ namespace stream {
     }
 
     auto &state = get_or_create_state(session);
-    auto now = std::chrono::steady_clock::now();
+    auto now = current_time();
 
     // Always update last_adjustment_time to prevent immediate retries, even on failure.
     // This ensures should_adjust_bitrate() respects the configured backoff interval
@@ -217,8 +466,19 @@ namespace stream {
         state.adjustment_count++;
         state.current_bitrate_kbps = new_bitrate_kbps;
         state.last_successful_adjustment_time = now;
+        publish(session, state);
+      }
+
+      if (state.pending_fec_percentage >= 0 && new_bitrate_kbps == state.pending_fec_bitrate_kbps) {
+        BOOST_LOG(info) << "AutoBitrate: FEC percentage changed from " << state.fec_percentage << "% to " << state.pending_fec_percentage << '%';
+        state.fec_percentage = state.pending_fec_percentage;
+        state.last_fec_change_time = now;
+        state.loss_reports = 0;
+        session->video.fec_percentage.store(state.fec_percentage, std::memory_order_relaxed);
       }
     }
+    state.pending_fec_percentage = -1;
+
     // If success is false, we don't update current_bitrate_kbps or adjustment_count
     // since the encoder didn't apply the change, so the state should continue to
     // reflect the previous (still active) bitrate.
@@ -226,7 +486,7 @@ namespace stream {
 
   void auto_bitrate_controller_t::reset(session_t *session) {
     if (session) {
-      session_states.erase(session);
+      session->auto_bitrate_state = {};
     }
   }
 
@@ -251,13 +511,8 @@ namespace stream {
   double auto_bitrate_controller_t::compute_loss_percentage(session_t *session, 
                                                              uint64_t lastGoodFrame,
                                                              std::chrono::milliseconds time_interval) const {
-    auto it = session_states.find(session);
-    if (it == session_states.end()) {
-      return 0.0;
-    }
+    const auto &state = session->auto_bitrate_state;
 
-    const auto &state = it->second;
-    
     // First report from client - no baseline to compare against yet
     if (state.last_reported_good_frame == 0) {
       return 0.0;
@@ -291,7 +546,7 @@ namespace stream {
     return loss_percentage;
   }
 
-  double auto_bitrate_controller_t::get_adjustment_factor(const session_state_t &state, 
+  double auto_bitrate_controller_t::get_adjustment_factor(const auto_bitrate_state_t &state, 
                                                           std::chrono::steady_clock::time_point now,
                                                           const config::auto_bitrate_settings_t &settings) const {
     double adjustment_factor = 1.0;
@@ -306,8 +561,32 @@ namespace stream {
     auto increase_pct = std::max(0, settings.increase_good_pct);
     auto poor_status_cap_pct = std::max(0, settings.poor_status_cap_pct);
 
-    // Determine base adjustment factor from loss
-    if (state.loss_percentage > severe_threshold) {
+    auto stable_for_increase = [&]() {
+      auto time_since_last_adjustment = std::chrono::duration_cast<std::chrono::milliseconds>(
+          now - state.last_adjustment_time).count();
+
+      // Require configured duration of good conditions for increase
+      return time_since_last_adjustment >= settings.good_stability_ms && state.connection_status == 0;
+    };
+
+    if (settings.mode == 1 && state.loss_percentage <= severe_threshold) {
+      // Delay gradient: back off while the queue in front of the bottleneck grows, before it overflows into loss
+      auto delay_threshold = static_cast<double>(std::max(1, settings.delay_threshold_ms));
+      if (state.queuing_delay_ms > delay_threshold && state.delay_gradient >= 0.0) {
+        // The further the queue built up, the harder the cut, between the mild and severe steps
+        auto reduction_pct = std::clamp(mild_reduction_pct * state.queuing_delay_ms / delay_threshold,
+                                        static_cast<double>(mild_reduction_pct),
+                                        static_cast<double>(std::max(mild_reduction_pct, severe_reduction_pct)));
+        adjustment_factor = 1.0 - (reduction_pct / 100.0);
+      } else if (state.queuing_delay_ms > delay_threshold / 2.0 || state.loss_percentage > mild_threshold) {
+        // Queue still draining, or loss without queuing which a lower bitrate wouldn't fix
+        return 1.0;
+      } else if (stable_for_increase()) {
+        adjustment_factor = 1.0 + (increase_pct / 100.0);
+      } else {
+        return 1.0;
+      }
+    } else if (state.loss_percentage > severe_threshold) {
       adjustment_factor = 1.0 - (severe_reduction_pct / 100.0);
     } else if (state.loss_percentage > moderate_threshold) {
       adjustment_factor = 1.0 - (moderate_reduction_pct / 100.0);
@@ -315,11 +594,7 @@ namespace stream {
       adjustment_factor = 1.0 - (mild_reduction_pct / 100.0);
     } else {
       // Consider increase only if stable
-      auto time_since_last_adjustment = std::chrono::duration_cast<std::chrono::milliseconds>(
-          now - state.last_adjustment_time).count();
-      
-      // Require configured duration of good conditions for increase
-      if (time_since_last_adjustment >= settings.good_stability_ms && state.connection_status == 0) {
+      if (stable_for_increase()) {
         adjustment_factor = 1.0 + (increase_pct / 100.0);
       } else {
         return 1.0;  // No change - return multiplier factor, not absolute bitrate
@@ -342,6 +617,81 @@ namespace stream {
     return adjustment_factor;
   }
 
+  std::pair<int, int> auto_bitrate_controller_t::bitrate_bounds(session_t *session,
+                                                               int fec_percentage,
+                                                               const config::auto_bitrate_settings_t &settings) const {
+    // Start with client-provided values (if set)
+    int client_min = session->auto_bitrate_min_kbps > 0 ? session->auto_bitrate_min_kbps : 0;
+    int client_max = session->auto_bitrate_max_kbps > 0 ? session->auto_bitrate_max_kbps : 0;
+    
+    // Get server config bounds
+    int server_min = settings.min_kbps;
+    if (server_min <= 0) {
+      server_min = 1;  // Default minimum (changed from 500 to 1 Kbps)
+    }
+    
+    int server_max = settings.max_kbps;
+    if (server_max <= 0) {
+      // Use config max_bitrate cap if set, otherwise no server limit
+      server_max = settings.max_bitrate_cap > 0 ? settings.max_bitrate_cap : 0;
+    } else {
+      // Server max is set, apply cap if configured
+      if (settings.max_bitrate_cap > 0 && settings.max_bitrate_cap < server_max) {
+        server_max = settings.max_bitrate_cap;
+      }
+    }
+    
+    // Calculate final bounds: use client values as base, clamp by server config
+    int min_bitrate = client_min > 0 ? client_min : server_min;
+    // Apply server minimum clamp (server min is absolute minimum)
+    if (server_min > 0 && min_bitrate < server_min) {
+      min_bitrate = server_min;
+    }
+    
+    int max_bitrate;
+    if (client_max > 0) {
+      max_bitrate = client_max;
+      // Apply server maximum clamp (server max is absolute maximum if set)
+      if (server_max > 0 && max_bitrate > server_max) {
+        max_bitrate = server_max;
+      }
+    } else {
+      // No client max provided, use server max or configured bitrate
+      if (server_max > 0) {
+        max_bitrate = server_max;
+      } else {
+        max_bitrate = session->config.monitor.bitrate;
+        // Ensure max is at least 1 Kbps (safety check)
+        if (max_bitrate < 1) {
+          max_bitrate = 1000;  // Fallback to 1 Mbps if configured bitrate is invalid
+        }
+      }
+    }
+    
+    // The budget adaptive FEC takes from or gives to the parity moves the ceiling along with it
+    max_bitrate = scale_for_fec(max_bitrate, settings.fec_percentage, fec_percentage);
+
+    // Ensure min <= max
+    if (min_bitrate > max_bitrate) {
+      min_bitrate = max_bitrate;
+    }
+    
+    // Final safety check: ensure both are at least 1 Kbps
+    if (min_bitrate < 1) {
+      min_bitrate = 1;
+    }
+    if (max_bitrate < 1) {
+      max_bitrate = 1;
+    }
+
+
+    return {min_bitrate, max_bitrate};
+  }
+
+  std::chrono::steady_clock::time_point auto_bitrate_controller_t::current_time() const {
+    return _clock ? _clock() : std::chrono::steady_clock::now();
+  }
+
   int auto_bitrate_controller_t::clamp_bitrate(int bitrate, int min_bitrate, int max_bitrate) const {
     if (bitrate < min_bitrate) {
       return min_bitrate;
@@ -352,20 +702,34 @@ namespace stream {
     return bitrate;
   }
 
-  auto_bitrate_controller_t::session_state_t &auto_bitrate_controller_t::get_or_create_state(session_t *session) {
-    auto it = session_states.find(session);
-    if (it == session_states.end()) {
-      session_state_t new_state;
-      new_state.current_bitrate_kbps = session->config.monitor.bitrate;
-      auto now = std::chrono::steady_clock::now();
-      new_state.session_start_time = now;
-      new_state.last_adjustment_time = now;
-      new_state.last_successful_adjustment_time = now;
-      new_state.last_loss_stats_time = now;
-      new_state.adjustment_count = 0;
-      it = session_states.emplace(session, new_state).first;
-    }
-    return it->second;
+  auto_bitrate_state_t &auto_bitrate_controller_t::get_or_create_state(session_t *session) {
+    auto &state = session->auto_bitrate_state;
+    if (!state.initialized) {
+      state.initialized = true;
+      state.current_bitrate_kbps = session->config.monitor.bitrate;
+      auto now = current_time();
+      state.session_start_time = now;
+      state.last_adjustment_time = now;
+      state.last_successful_adjustment_time = now;
+      state.last_loss_stats_time = now;
+      state.adjustment_count = 0;
+      state.fec_percentage = session->video.fec_percentage.load(std::memory_order_relaxed);
+      state.last_fec_change_time = now;
+    }
+    return state;
+  }
+
+  void auto_bitrate_controller_t::publish(session_t *session, const auto_bitrate_state_t &state) {
+    auto &stats = session->stats;
+    stats.bitrate_kbps.store(state.current_bitrate_kbps, std::memory_order_relaxed);
+    stats.bitrate_adjustments.store(state.adjustment_count, std::memory_order_relaxed);
+    stats.loss_percentage.store(static_cast<float>(state.loss_percentage), std::memory_order_relaxed);
+
+    // Milliseconds since session start, 0 if never adjusted
+    auto adjustment_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        state.last_successful_adjustment_time - state.session_start_time).count();
+    std::uint64_t last_adjustment_ms = state.adjustment_count > 0 && adjustment_duration >= 0 ? adjustment_duration : 0;
+    stats.last_bitrate_adjustment_ms.store(last_adjustment_ms, std::memory_order_relaxed);
   }
 
   bool auto_bitrate_controller_t::get_stats(session_t *session,
@@ -377,26 +741,11 @@ namespace stream {
       return false;
     }
 
-    auto it = session_states.find(session);
-    if (it == session_states.end()) {
-      return false;
-    }
-
-    const auto &state = it->second;
-    current_bitrate_kbps = state.current_bitrate_kbps;
-    adjustment_count = state.adjustment_count;
-    loss_percentage = static_cast<float>(state.loss_percentage);
-
-    // Calculate milliseconds since session start
-    auto now = std::chrono::steady_clock::now();
-    auto adjustment_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-        state.last_successful_adjustment_time - state.session_start_time).count();
-    
-    if (state.adjustment_count > 0 && adjustment_duration >= 0) {
-      last_adjustment_time_ms = static_cast<uint64_t>(adjustment_duration);
-    } else {
-      last_adjustment_time_ms = 0;  // Never adjusted
-    }
+    const auto &stats = session->stats;
+    current_bitrate_kbps = stats.bitrate_kbps.load(std::memory_order_relaxed);
+    last_adjustment_time_ms = stats.last_bitrate_adjustment_ms.load(std::memory_order_relaxed);
+    adjustment_count = stats.bitrate_adjustments.load(std::memory_order_relaxed);
+    loss_percentage = stats.loss_percentage.load(std::memory_order_relaxed);
 
     return true;
   }
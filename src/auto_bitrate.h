@@ -5,8 +5,17 @@
 #pragma once
 
 // standard includes
+#include <array>
 #include <chrono>
-#include <unordered_map>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// local includes
+#include "audio.h"
+#include "video.h"
 
 namespace config {
   struct auto_bitrate_settings_t;
@@ -15,13 +24,70 @@ namespace config {
 namespace stream {
   struct session_t;
 
+  /**
+   * @brief Auto bitrate controller state of one session.
+   * @details Owned by the session and only touched by the control thread, the values
+   *          other threads need are published to the session stats.
+   */
+  struct auto_bitrate_state_t {
+    bool initialized = false;  ///< Set once the state was seeded from the session config
+    uint64_t last_reported_good_frame = 0;  ///< Last good frame the client reported
+    std::chrono::steady_clock::time_point last_loss_stats_time;  ///< When the last loss stats arrived
+    std::chrono::steady_clock::time_point last_adjustment_time;  ///< When the last adjustment was attempted
+    std::chrono::steady_clock::time_point last_successful_adjustment_time;  ///< When the encoder last accepted a change
+    std::chrono::steady_clock::time_point session_start_time;  ///< When the state was seeded
+    double loss_percentage = 0.0;  ///< Frame loss reported by the client
+    int connection_status = 0;  ///< 0 = OKAY, 1 = POOR
+    int current_bitrate_kbps = 0;  ///< Bitrate the encoder runs at
+    uint32_t adjustment_count = 0;  ///< Successful adjustments
+
+    // Delay gradient controller
+    uint32_t window_min_rtt_ms = 0;  ///< Lowest RTT of the current window
+    uint32_t previous_window_min_rtt_ms = 0;  ///< Lowest RTT of the previous window
+    std::chrono::steady_clock::time_point rtt_window_start;  ///< When the current RTT window started
+    std::chrono::steady_clock::time_point last_gradient_time;  ///< When the delay gradient was last measured
+    double queuing_delay_ms = 0.0;  ///< RTT rise above the base RTT
+    double last_gradient_queuing_delay_ms = 0.0;  ///< Queuing delay when the gradient was last measured
+    double delay_gradient = 0.0;  ///< Smoothed change of the queuing delay in ms per second
+
+    // Adaptive FEC
+    int fec_percentage = 0;  ///< FEC percentage the video stream runs at
+    int pending_fec_percentage = -1;  ///< FEC percentage to switch to once the encoder confirms the matching bitrate, -1 if none
+    int pending_fec_bitrate_kbps = 0;  ///< Bitrate that keeps the total bitrate with the pending FEC percentage
+    std::array<double, 8> loss_history {};  ///< Loss of the most recent reports
+    uint64_t loss_reports = 0;  ///< Reports recorded since the FEC percentage last changed
+    std::chrono::steady_clock::time_point last_fec_change_time;  ///< When the FEC percentage last changed
+
+    // Resolution ladder
+    int ladder_rung = 0;  ///< Rung of the resolution ladder the encoder runs at, 0 = the requested format
+    int pending_ladder_rung = -1;  ///< Rung to switch to once the encoder confirms it, -1 if none
+  };
+
+  /**
+   * @brief The changes to request from the encoders after the latest network reports.
+   */
+  struct auto_bitrate_adjustment_t {
+    int bitrate_kbps = 0;  ///< Video bitrate to request, 0 if it stays
+    int fec_percentage = -1;  ///< FEC percentage the bitrate was rebalanced for, -1 if it stays
+    std::optional<video::ladder_step_t> ladder_step;  ///< Output format to switch to, if it changes
+  };
+
   /**
    * @brief Automatic bitrate adjustment controller.
    *        Adaptively adjusts encoder bitrate based on network quality metrics.
    */
   class auto_bitrate_controller_t {
   public:
+    using clock_fn_t = std::function<std::chrono::steady_clock::time_point()>;  ///< Source of the current time
+
     auto_bitrate_controller_t();
+
+    /**
+     * @brief Constructs a controller that reads the time from another clock.
+     * @details Lets simulations replay network traces faster than real time.
+     * @param clock The clock.
+     */
+    explicit auto_bitrate_controller_t(clock_fn_t clock);
     
     /**
      * @brief Process loss statistics from client.
@@ -44,6 +110,15 @@ namespace stream {
                                    uint64_t lastGoodFrame,
                                    std::chrono::milliseconds time_interval);
     
+    /**
+     * @brief Process a round trip time sample of the control stream.
+     * @details Feeds the delay gradient controller, the queuing delay is how far the RTT
+     *          rose above the lowest RTT seen recently.
+     * @param session The streaming session.
+     * @param rtt_ms Smoothed round trip time in milliseconds, 0 if unknown.
+     */
+    void process_rtt(session_t *session, uint32_t rtt_ms);
+
     /**
      * @brief Process connection status change.
      * @param session The streaming session.
@@ -66,6 +141,84 @@ namespace stream {
      */
     int calculate_new_bitrate(session_t *session) const;
     
+    /**
+     * @brief Calculate the Opus encoder parameters following a video bitrate change.
+     * @details Audio is scaled down along with the video bitrate, but never below half or
+     *          above the bitrate negotiated for the audio stream.
+     * @param session The streaming session.
+     * @param new_bitrate_kbps The new video bitrate in Kbps.
+     * @return The audio encoder parameters.
+     */
+    audio::encoder_params_t calculate_audio_params(session_t *session, int new_bitrate_kbps) const;
+
+    /**
+     * @brief Pick the FEC percentage from the pattern of recent loss.
+     * @details Loss spread over most reports is what parity can recover, so it raises the FEC
+     *          percentage. A long run without loss lowers it again. Bursts are left to the
+     *          bitrate controller, more parity per frame doesn't help against them.
+     * @param session The streaming session.
+     * @return The new FEC percentage, or the current one if it should stay.
+     */
+    int calculate_new_fec(session_t *session) const;
+
+    /**
+     * @brief Calculate the encoder bitrate that keeps the total bitrate with another FEC percentage.
+     * @param session The streaming session.
+     * @param new_fec_percentage The FEC percentage to switch to.
+     * @return New bitrate in Kbps.
+     */
+    int calculate_fec_rebalanced_bitrate(session_t *session, int new_fec_percentage) const;
+
+    /**
+     * @brief Switch the FEC percentage once the encoder confirms the matching bitrate.
+     * @param session The streaming session.
+     * @param new_fec_percentage The FEC percentage to switch to.
+     * @param new_bitrate_kbps The bitrate requested from the encoder along with it.
+     */
+    void request_fec_change(session_t *session, int new_fec_percentage, int new_bitrate_kbps);
+
+    /**
+     * @brief Pick the rung of the resolution ladder for the next bitrate change.
+     * @details Steps down when the bitrate falls too low for the pixel rate of the current rung,
+     *          and back up once the bitrate comfortably covers the rung above.
+     * @param session The streaming session.
+     * @return The new rung, or the current one if it should stay.
+     */
+    int calculate_new_ladder_rung(session_t *session) const;
+
+    /**
+     * @brief Get the output format of a rung of the resolution ladder.
+     * @param session The streaming session.
+     * @param rung The rung, 0 is the format the client requested.
+     * @return The output format.
+     */
+    video::ladder_step_t ladder_step(session_t *session, int rung) const;
+
+    /**
+     * @brief Switch to a rung of the resolution ladder once the encoder confirms it.
+     * @param session The streaming session.
+     * @param rung The rung requested from the encoder.
+     */
+    void request_ladder_change(session_t *session, int rung);
+
+    /**
+     * @brief Confirm that a resolution ladder change was applied by the encoder.
+     * @param session The streaming session.
+     * @param success true if the encoder switched to the requested format.
+     */
+    void confirm_ladder_change(session_t *session, bool success);
+
+    /**
+     * @brief Decide what to change after the latest network reports.
+     * @details Rebalancing FEC against the bitrate goes first, it keeps the total bitrate the
+     *          same. Otherwise the bitrate follows the reports, and the resolution ladder along
+     *          with it. The requested FEC percentage and rung are recorded as pending until the
+     *          encoder confirms them.
+     * @param session The streaming session.
+     * @return The changes to request from the encoders.
+     */
+    auto_bitrate_adjustment_t next_adjustment(session_t *session);
+
     /**
      * @brief Confirm that a bitrate change was successfully applied by the encoder.
      *        Updates the controller state only after encoder confirmation.
@@ -83,12 +236,13 @@ namespace stream {
     
     /**
      * @brief Get bitrate statistics for a session.
+     * @details Reads the snapshot published to the session stats, safe to call from any thread.
      * @param session The streaming session.
      * @param current_bitrate_kbps Output: Current encoder bitrate in Kbps.
      * @param last_adjustment_time_ms Output: Milliseconds since session start when last successful adjustment occurred (0 if never).
      * @param adjustment_count Output: Total number of successful adjustments made.
      * @param loss_percentage Output: Current frame loss percentage.
-     * @return true if stats are available, false otherwise.
+     * @return true if auto bitrate is enabled for the session, false otherwise.
      */
     bool get_stats(session_t *session,
                    uint32_t &current_bitrate_kbps,
@@ -97,28 +251,21 @@ namespace stream {
                    float &loss_percentage) const;
     
   private:
-    struct session_state_t {
-      uint64_t last_reported_good_frame = 0;
-      std::chrono::steady_clock::time_point last_loss_stats_time;
-      std::chrono::steady_clock::time_point last_adjustment_time;
-      std::chrono::steady_clock::time_point last_successful_adjustment_time;
-      std::chrono::steady_clock::time_point session_start_time;
-      double loss_percentage = 0.0;
-      int connection_status = 0;  // 0 = OKAY, 1 = POOR
-      int current_bitrate_kbps = 0;
-      uint32_t adjustment_count = 0;
-    };
-    
-    std::unordered_map<session_t*, session_state_t> session_states;
-    
     // Helper methods
     double compute_loss_percentage(session_t *session, 
                                    uint64_t lastGoodFrame,
                                    std::chrono::milliseconds time_interval) const;
-    double get_adjustment_factor(const session_state_t &state, 
+    double get_adjustment_factor(const auto_bitrate_state_t &state, 
                                   std::chrono::steady_clock::time_point now,
                                   const config::auto_bitrate_settings_t &settings) const;
+    std::pair<int, int> bitrate_bounds(session_t *session,
+                                       int fec_percentage,
+                                       const config::auto_bitrate_settings_t &settings) const;
     int clamp_bitrate(int bitrate, int min_bitrate, int max_bitrate) const;
-    session_state_t &get_or_create_state(session_t *session);
+    auto_bitrate_state_t &get_or_create_state(session_t *session);
+    void publish(session_t *session, const auto_bitrate_state_t &state);
+    std::chrono::steady_clock::time_point current_time() const;
+
+    clock_fn_t _clock;
   };
 }
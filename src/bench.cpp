@@ -0,0 +1,296 @@
+/**
+ * @file src/bench.cpp
+ * @brief Definitions for benchmarking the streaming pipeline without a client.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <boost/format.hpp>
+
+// local includes
+#include "audio.h"
+#include "bench.h"
+#include "config.h"
+#include "globals.h"
+#include "logging.h"
+#include "metrics.h"
+#include "platform/common.h"
+#include "rswrapper.h"
+#include "rtsp.h"
+#include "stream.h"
+#include "video.h"
+
+using namespace std::literals;
+
+namespace stream {
+  void videoBroadcastThread(udp::socket &sock, std::shared_ptr<safe::queue_t<video::packet_t>> packets);
+  void audioBroadcastThread(udp::socket &sock);
+}  // namespace stream
+
+namespace bench {
+  namespace {
+    /**
+     * @brief A stage of the pipeline, timed by one of the latency histograms.
+     */
+    struct stage_t {
+      std::string_view name;  ///< Name printed in the report
+      std::string_view histogram;  ///< Histogram timing the stage
+    };
+
+    constexpr std::array stages {
+      stage_t {"video capture"sv, "capture"sv},
+      stage_t {"video convert"sv, "convert"sv},
+      stage_t {"video GPU convert"sv, "gpu_convert"sv},
+      stage_t {"video GPU cursor"sv, "gpu_cursor"sv},
+      stage_t {"video encode"sv, "encode"sv},
+      stage_t {"video capture to send"sv, "frame_processing_latency"sv},
+      stage_t {"video FEC"sv, "fec"sv},
+      stage_t {"video encrypt"sv, "encrypt"sv},
+      stage_t {"video send batch"sv, "send_batch"sv},
+      stage_t {"video send frame"sv, "network"sv},
+      stage_t {"audio encode"sv, "audio_encode"sv},
+      stage_t {"audio encrypt"sv, "audio_encrypt"sv},
+      stage_t {"audio FEC"sv, "audio_fec"sv},
+    };
+
+    constexpr int audio_packet_duration = 5;
+
+    /**
+     * @brief Samples a histogram recorded since an earlier snapshot.
+     */
+    metrics::snapshot_t since(std::string_view name, const metrics::snapshot_t &before) {
+      auto after = metrics::histogram(name).snapshot();
+      for (std::size_t x = 0; x < after.buckets.size(); ++x) {
+        after.buckets[x] -= before.buckets[x];
+      }
+      after.count -= before.count;
+      after.sum_us -= before.sum_us;
+      return after;
+    }
+
+    std::uint64_t percentile_us(std::vector<std::chrono::steady_clock::duration> latencies, double quantile) {
+      if (latencies.empty()) {
+        return 0;
+      }
+
+      auto nth = std::begin(latencies) + (std::size_t) (quantile * (latencies.size() - 1));
+      std::nth_element(std::begin(latencies), nth, std::end(latencies));
+      return std::chrono::duration_cast<std::chrono::microseconds>(*nth).count();
+    }
+
+    /**
+     * @brief Packets arriving at the loopback client.
+     */
+    struct receiver_t {
+      explicit receiver_t(boost::asio::io_context &io):
+          video {io, stream::udp::endpoint {boost::asio::ip::address_v4::loopback(), 0}},
+          audio {io, stream::udp::endpoint {boost::asio::ip::address_v4::loopback(), 0}} {
+      }
+
+      void start() {
+        receive_video();
+        receive_audio();
+      }
+
+      stream::udp::socket video;
+      stream::udp::socket audio;
+
+      std::uint64_t video_packets = 0;
+      std::uint64_t video_bytes = 0;
+      std::uint64_t video_frames = 0;
+      std::uint64_t audio_packets = 0;
+      std::vector<std::chrono::steady_clock::time_point> audio_received;  ///< Arrival of each audio data packet by sequence number
+
+    private:
+      void receive_video() {
+        video.async_receive_from(boost::asio::buffer(video_buf), from, [this](const boost::system::error_code &ec, std::size_t bytes) {
+          if (ec) {
+            return;
+          }
+
+          // The frame number precedes the encrypted payload, a new one is the first packet of a frame
+          std::uint32_t frame_number;
+          if (bytes >= 16) {
+            std::memcpy(&frame_number, video_buf.data() + 12, sizeof(frame_number));
+            if (!video_frames || frame_number != last_frame_number) {
+              ++video_frames;
+              last_frame_number = frame_number;
+            }
+          }
+
+          ++video_packets;
+          video_bytes += bytes;
+          receive_video();
+        });
+      }
+
+      void receive_audio() {
+        audio.async_receive_from(boost::asio::buffer(audio_buf), from, [this](const boost::system::error_code &ec, std::size_t bytes) {
+          auto now = std::chrono::steady_clock::now();
+          if (ec) {
+            return;
+          }
+
+          auto rtp = (PRTP_PACKET) audio_buf.data();
+          if (bytes >= sizeof(RTP_PACKET) && rtp->packetType == 97) {
+            auto sequence_number = util::endian::big(rtp->sequenceNumber);
+            if (sequence_number >= audio_received.size()) {
+              audio_received.resize(sequence_number + 1);
+            }
+            audio_received[sequence_number] = now;
+          }
+
+          ++audio_packets;
+          receive_audio();
+        });
+      }
+
+      std::array<char, 2048> video_buf;
+      std::array<char, 2048> audio_buf;
+      stream::udp::endpoint from;
+      std::uint32_t last_frame_number = 0;
+    };
+  }  // namespace
+
+  int run(const char *name, int argc, char *argv[]) {
+    int seconds = 10;
+    int width = 1920;
+    int height = 1080;
+    int framerate = 60;
+    int bitrate = 20000;
+    int dirty_percent = 100;
+
+    if ((argc > 0 && std::sscanf(argv[0], "%d", &seconds) != 1) ||
+        (argc > 1 && std::sscanf(argv[1], "%dx%d@%d", &width, &height, &framerate) != 3) ||
+        (argc > 2 && std::sscanf(argv[2], "%d", &bitrate) != 1) ||
+        (argc > 3 && std::sscanf(argv[3], "%d", &dirty_percent) != 1) ||
+        seconds <= 0 || width <= 0 || height <= 0 || framerate <= 0 || bitrate <= 0 || dirty_percent < 0 || dirty_percent > 100) {
+      std::cout << "Usage: "sv << name << " --bench [seconds] [WIDTHxHEIGHT@FPS] [bitrate in Kbps] [dirty percent]"sv << std::endl;
+      return 2;
+    }
+
+    // Benchmark the synthetic display unless a real capture method was asked for
+    if (config::video.capture.empty()) {
+      config::video.capture = "null"s;
+    }
+    video::set_synthetic_dirty_percent(dirty_percent);
+    audio::use_synthetic_capture(true);
+
+    task_pool.start(1);
+
+    auto platf_deinit_guard = platf::init();
+    if (!platf_deinit_guard) {
+      BOOST_LOG(error) << "Platform failed to initialize"sv;
+    }
+
+    reed_solomon_init();
+    if (video::probe_encoders()) {
+      BOOST_LOG(fatal) << "No encoder works with capture method ["sv << config::video.capture << ']';
+      return 1;
+    }
+
+    boost::asio::io_context io;
+    receiver_t receiver {io};
+    stream::udp::socket video_sock {io, stream::udp::endpoint {boost::asio::ip::address_v4::loopback(), 0}};
+    stream::udp::socket audio_sock {io, stream::udp::endpoint {boost::asio::ip::address_v4::loopback(), 0}};
+
+    stream::config_t config {};
+    config.monitor.width = width;
+    config.monitor.height = height;
+    config.monitor.framerate = framerate;
+    config.monitor.encodingFramerate = framerate;
+    config.monitor.bitrate = bitrate;
+    config.monitor.slicesPerFrame = 1;
+    config.monitor.numRefFrames = 1;
+    config.monitor.encoderCscMode = 1 << 1;  // BT.709, limited range
+    config.packetsize = 1024;
+    config.minRequiredFecPackets = 2;
+    config.audio.packetDuration = audio_packet_duration;
+    config.audio.channels = 2;
+    config.audio.mask = 0x3;
+    config.encryptionFlagsEnabled = SS_ENC_VIDEO | SS_ENC_AUDIO;
+
+    rtsp_stream::launch_session_t launch_session {};
+    auto key = crypto::rand(16);
+    auto iv = crypto::rand(16);
+    launch_session.gcm_key.assign(std::begin(key), std::end(key));
+    launch_session.iv.assign(std::begin(iv), std::end(iv));
+
+    auto session = stream::session::alloc(config, launch_session);
+    session->video.peer = receiver.video.local_endpoint();
+    session->audio.peer = receiver.audio.local_endpoint();
+    session->localAddress = boost::asio::ip::address_v4::loopback();
+
+    std::vector<metrics::snapshot_t> before;
+    for (auto &stage : stages) {
+      before.emplace_back(metrics::histogram(stage.histogram).snapshot());
+    }
+    audio::take_synthetic_capture_times();
+
+    BOOST_LOG(info) << "Benchmarking "sv << width << 'x' << height << '@' << framerate << " at "sv << bitrate << " Kbps for "sv << seconds << " seconds"sv;
+
+    receiver.start();
+    std::thread receive_thread {[&io]() {
+      io.run();
+    }};
+
+    auto video_packets = mail::man->queue(mail::video_packets);
+    std::thread video_broadcast_thread {stream::videoBroadcastThread, std::ref(video_sock), video_packets};
+    std::thread audio_broadcast_thread {stream::audioBroadcastThread, std::ref(audio_sock)};
+    std::thread video_thread {[&]() {
+      video::capture(session->mail, session->config.monitor, session.get(), session->video.bitrate_target);
+    }};
+    std::thread audio_thread {[&]() {
+      audio::capture(session->mail, session->config.audio, session.get());
+    }};
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds {seconds});
+
+    session->shutdown_event->raise(true);
+    video_thread.join();
+    audio_thread.join();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    video_packets->stop();
+    mail::man->queue(mail::audio_packets)->stop();
+    video_broadcast_thread.join();
+    audio_broadcast_thread.join();
+
+    // Let the last packets arrive
+    std::this_thread::sleep_for(100ms);
+    io.stop();
+    receive_thread.join();
+
+    auto captured = audio::take_synthetic_capture_times();
+    std::vector<std::chrono::steady_clock::duration> audio_latencies;
+    for (std::size_t x = 0; x < std::min(captured.size(), receiver.audio_received.size()); ++x) {
+      if (receiver.audio_received[x] != std::chrono::steady_clock::time_point {}) {
+        audio_latencies.push_back(receiver.audio_received[x] - captured[x]);
+      }
+    }
+
+    std::cout << boost::format("%-24s %10s %10s %10s %10s %10s\n") % "stage" % "samples" % "per sec" % "mean us" % "p50 us" % "p99 us";
+    for (std::size_t x = 0; x < stages.size(); ++x) {
+      auto samples = since(stages[x].histogram, before[x]);
+      std::cout << boost::format("%-24s %10u %10.1f %10u %10u %10u\n") % stages[x].name % samples.count % (samples.count / elapsed) %
+                     (samples.count ? samples.sum_us / samples.count : 0) % samples.percentile(0.5) % samples.percentile(0.99);
+    }
+    std::cout << boost::format("%-24s %10u %10.1f %10s %10u %10u\n") % "audio end-to-end" % audio_latencies.size() % (audio_latencies.size() / elapsed) % "" %
+                   percentile_us(audio_latencies, 0.5) % percentile_us(audio_latencies, 0.99);
+
+    std::cout << boost::format("\nvideo received: %u frames (%.1f fps), %u packets, %.1f Mbps\n") % receiver.video_frames % (receiver.video_frames / elapsed) %
+                   receiver.video_packets % (receiver.video_bytes * 8 / elapsed / 1000000);
+    std::cout << boost::format("audio received: %u packets\n") % receiver.audio_packets;
+
+    return receiver.video_frames ? 0 : 1;
+  }
+}  // namespace bench
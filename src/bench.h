@@ -0,0 +1,23 @@
+/**
+ * @file src/bench.h
+ * @brief Declarations for benchmarking the streaming pipeline without a client.
+ */
+#pragma once
+
+namespace bench {
+  /**
+   * @brief Stream video and audio to a loopback receiver and report the throughput and latency of each stage.
+   * @details Video runs through capture, conversion, encoding, FEC, encryption and sending, audio through
+   *          encoding, encryption and FEC. Unless another capture method is configured, video comes from the
+   *          synthetic display of `capture = null` and is encoded in software, audio is a synthetic tone.
+   *          Nothing is bound to the streaming ports, so a running instance isn't disturbed.
+   * @param name The name of the program.
+   * @param argc The number of arguments.
+   * @param argv The arguments: `[seconds] [WIDTHxHEIGHT@FPS] [bitrate in Kbps] [dirty percent]`.
+   * @return 0 on success, 1 if the pipeline didn't deliver any frames, 2 on invalid arguments.
+   * @examples
+   * run("sunshine", 3, {"30", "3840x2160@60", "80000"});
+   * @examples_end
+   */
+  int run(const char *name, int argc, char *argv[]);
+}  // namespace bench
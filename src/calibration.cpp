@@ -0,0 +1,431 @@
+/**
+ * @file src/calibration.cpp
+ * @brief Definitions for calibrating the encoder settings to the host.
+ */
+// standard includes
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+// local includes
+#include "calibration.h"
+#include "config.h"
+#include "file_handler.h"
+#include "globals.h"
+#include "logging.h"
+#include "platform/common.h"
+#include "rtsp.h"
+#include "video.h"
+
+using namespace std::literals;
+
+namespace calibration {
+  namespace {
+    struct state_t {
+      std::mutex lock;
+      bool running = false;
+      nlohmann::json last;  ///< Status of the latest calibration, null if there was none
+    };
+
+    state_t &state() {
+      static state_t state;
+      return state;
+    }
+
+    std::filesystem::path result_path() {
+      return platf::appdata() / "encoder_calibration.json";
+    }
+
+    /**
+     * @brief Describe what the calibration was measured on, it's repeated when this changes.
+     */
+    std::string identity() {
+      return platf::gpu_identity() + std::string {video::chosen_encoder_name()};
+    }
+
+    /**
+     * @brief Get the settings in use as a candidate, to restore them afterwards.
+     */
+    candidate_t current_settings(std::string_view encoder_name) {
+      candidate_t current;
+      if (encoder_name == "software"sv) {
+        current.vars["sw_preset"] = config::video.sw.sw_preset;
+        current.vars["min_threads"] = std::to_string(config::video.min_threads);
+      } else if (encoder_name == "nvenc"sv) {
+        auto two_pass = config::video.nv.two_pass;
+        current.vars["nvenc_preset"] = std::to_string(config::video.nv.quality_preset);
+        current.vars["nvenc_twopass"] = two_pass == nvenc::nvenc_two_pass::disabled          ? "disabled"s :
+                                        two_pass == nvenc::nvenc_two_pass::full_resolution ? "full_res"s :
+                                                                                             "quarter_res"s;
+      }
+      return current;
+    }
+
+    /**
+     * @brief Get the encoder settings of a candidate, measured without changing the settings in use.
+     */
+    video::encoder_settings_t encoder_settings(const candidate_t &candidate) {
+      video::encoder_settings_t settings;
+      for (auto &[name, value] : candidate.vars) {
+        if (name == "sw_preset"sv) {
+          settings.sw_preset = value;
+        } else if (name == "min_threads"sv) {
+          settings.min_threads = std::stoi(value);
+        } else if (name == "nvenc_preset"sv) {
+          settings.nvenc_preset = std::stoi(value);
+        } else if (name == "nvenc_twopass"sv) {
+          settings.nvenc_two_pass = config::nv::twopass_from_view(value);
+        }
+      }
+      return settings;
+    }
+
+    /**
+     * @brief Change the settings in use, the same way saving them from the web UI does.
+     */
+    void apply(const candidate_t &candidate) {
+      auto vars = candidate.vars;
+      config::apply_config(std::move(vars));
+    }
+
+    /**
+     * @brief Write the settings to the config file, replacing the lines setting them and keeping the rest.
+     * @return 0 on success.
+     */
+    int save(const candidate_t &candidate) {
+      auto remaining = candidate.vars;
+
+      std::stringstream in {file_handler::read_file(config::sunshine.config_file.c_str())};
+      std::string out;
+      for (std::string line; std::getline(in, line);) {
+        auto equals = line.find('=');
+        if (equals != std::string::npos) {
+          auto name = line.substr(0, equals);
+          name.erase(std::find_if(name.rbegin(), name.rend(), [](unsigned char ch) {
+                       return !std::isspace(ch);
+                     }).base(),
+                     std::end(name));
+          name.erase(std::begin(name), std::find_if(std::begin(name), std::end(name), [](unsigned char ch) {
+                       return !std::isspace(ch);
+                     }));
+
+          auto it = remaining.find(name);
+          if (it != std::end(remaining)) {
+            line = it->first + " = " + it->second;
+            remaining.erase(it);
+          }
+        }
+        out += line;
+        out += '\n';
+      }
+      for (auto &[name, value] : remaining) {
+        out += name + " = " + value + '\n';
+      }
+
+      return file_handler::write_file(config::sunshine.config_file.c_str(), out);
+    }
+
+    bool interrupted() {
+      return rtsp_stream::session_count() > 0 || mail::man->event(mail::shutdown)->peek();
+    }
+
+    nlohmann::json to_json(const trial_t &trial, int target_fps) {
+      nlohmann::json measurements = nlohmann::json::array();
+      for (auto &measurement : trial.measurements) {
+        measurements.push_back({
+          {"width", measurement.resolution.width},
+          {"height", measurement.resolution.height},
+          {"fps", measurement.fps},
+          {"latency_p50_ms", measurement.latency_p50_ms},
+          {"latency_p99_ms", measurement.latency_p99_ms},
+        });
+      }
+
+      return {
+        {"settings", trial.candidate.vars},
+        {"measurements", std::move(measurements)},
+        {"meets_target", meets_target(trial, target_fps)},
+      };
+    }
+
+    /**
+     * @brief Measure a candidate at every resolution, stopping at the first one it doesn't keep up at.
+     */
+    trial_t measure(const candidate_t &candidate, int target_fps) {
+      trial_t trial {candidate};
+      auto settings = encoder_settings(candidate);
+
+      for (auto &resolution : resolutions) {
+        // A stream that started leaves the encoder to itself
+        if (interrupted()) {
+          break;
+        }
+
+        // Scale the bitrate with the area, from 20 Mbps at 1080p
+        auto bitrate = (int) (20000LL * resolution.width * resolution.height / (1920 * 1080));
+
+        video::config_t config {resolution.width, resolution.height, target_fps, bitrate, 1, 1, 1, 0, 0, 0, 0, target_fps};
+        auto result = video::benchmark_encoder(config, settings, frames_per_trial, std::chrono::nanoseconds {1s} * frames_per_trial / target_fps);
+        if (!result) {
+          // The encoder may not support the resolution at all, that doesn't count against the settings
+          BOOST_LOG(debug) << "Calibration: couldn't encode at "sv << resolution.width << 'x' << resolution.height;
+          continue;
+        }
+
+        trial.measurements.push_back({
+          resolution,
+          result->fps,
+          result->latency_p50.count() / 1000.0,
+          result->latency_p99.count() / 1000.0,
+        });
+        BOOST_LOG(info) << "Calibration: "sv << resolution.width << 'x' << resolution.height << " at "sv << result->fps << " fps, "sv
+                        << trial.measurements.back().latency_p50_ms << " ms per frame"sv;
+
+        if (result->fps < target_fps * headroom) {
+          break;
+        }
+      }
+
+      return trial;
+    }
+
+    void run(int target_fps, bool apply_recommendation) {
+      auto encoder_name = std::string {video::chosen_encoder_name()};
+      auto original = current_settings(encoder_name);
+      auto candidates = calibration::candidates(encoder_name, (int) std::thread::hardware_concurrency());
+
+      // Without settings to vary, the ones in use are still worth measuring
+      if (candidates.empty()) {
+        candidates.emplace_back(original);
+      }
+
+      BOOST_LOG(info) << "Calibrating encoder ["sv << encoder_name << "] for "sv << target_fps << " fps"sv;
+
+      std::vector<trial_t> trials;
+      bool aborted = false;
+      for (auto &candidate : candidates) {
+        if (interrupted()) {
+          aborted = true;
+          break;
+        }
+
+        for (auto &[name, value] : candidate.vars) {
+          BOOST_LOG(info) << "Calibration: trying "sv << name << " = "sv << value;
+        }
+
+        trials.emplace_back(measure(candidate, target_fps));
+        if (interrupted()) {
+          // The trial was cut short, its measurements don't count
+          trials.pop_back();
+          aborted = true;
+          break;
+        }
+        if (meets_target(trials.back(), target_fps)) {
+          break;
+        }
+      }
+
+      auto recommended = recommend(trials, target_fps);
+      bool applied = false;
+      if (recommended && apply_recommendation && !aborted && !trials[*recommended].candidate.vars.empty()) {
+        auto &settings = trials[*recommended].candidate;
+        apply(settings);
+        applied = !save(settings);
+        if (!applied) {
+          BOOST_LOG(warning) << "Calibration: couldn't save the settings to "sv << config::sunshine.config_file;
+        }
+      }
+
+      nlohmann::json result;
+      result["running"] = false;
+      result["encoder"] = encoder_name;
+      result["target_fps"] = target_fps;
+      result["headroom"] = headroom;
+      result["aborted"] = aborted;
+      result["applied"] = applied;
+      result["trials"] = nlohmann::json::array();
+      for (auto &trial : trials) {
+        result["trials"].push_back(to_json(trial, target_fps));
+      }
+      result["recommended"] = recommended ? nlohmann::json(trials[*recommended].candidate.vars) : nlohmann::json();
+      result["meets_target"] = recommended && meets_target(trials[*recommended], target_fps);
+
+      if (aborted) {
+        BOOST_LOG(info) << "Calibration was interrupted by a stream or shutdown"sv;
+      } else if (!recommended) {
+        BOOST_LOG(warning) << "Calibration: the encoder couldn't be set up for any candidate"sv;
+      } else {
+        std::string settings;
+        for (auto &[name, value] : trials[*recommended].candidate.vars) {
+          settings += ' ' + name + " = " + value;
+        }
+        BOOST_LOG(info) << "Calibration "sv << (result["meets_target"].get<bool>() ? "recommends"sv : "couldn't meet the target, the fastest is"sv) << settings
+                        << (applied ? ", applied"sv : ""sv);
+      }
+
+      // Only a complete calibration counts for the hardware, an interrupted one is repeated on the next start
+      if (!aborted && recommended) {
+        nlohmann::json saved;
+        saved["identity"] = identity();
+        saved["result"] = result;
+        if (file_handler::replace_file(result_path().string().c_str(), saved.dump(2))) {
+          BOOST_LOG(warning) << "Couldn't save the calibration to "sv << result_path().string();
+        }
+      }
+
+      auto &state = calibration::state();
+      std::lock_guard lg {state.lock};
+      state.last = std::move(result);
+      state.running = false;
+    }
+  }  // namespace
+
+  std::vector<candidate_t> candidates(std::string_view encoder_name, int hardware_threads) {
+    std::vector<candidate_t> candidates;
+
+    if (encoder_name == "software"sv) {
+      // Fewer threads first, every thread adds a slice, which costs compression, and takes a core from the game
+      std::vector<int> threads;
+      for (int count = 2; count <= hardware_threads; count *= 2) {
+        threads.emplace_back(count);
+      }
+      if (threads.empty()) {
+        threads.emplace_back(1);
+      }
+
+      for (auto preset : {"medium"sv, "fast"sv, "faster"sv, "veryfast"sv, "superfast"sv, "ultrafast"sv}) {
+        for (auto count : threads) {
+          candidates.push_back({{{"sw_preset", std::string {preset}}, {"min_threads", std::to_string(count)}}});
+        }
+      }
+    } else if (encoder_name == "nvenc"sv) {
+      for (int preset = 7; preset >= 1; --preset) {
+        for (auto two_pass : {"full_res"sv, "quarter_res"sv, "disabled"sv}) {
+          candidates.push_back({{{"nvenc_preset", std::to_string(preset)}, {"nvenc_twopass", std::string {two_pass}}}});
+        }
+      }
+    }
+
+    return candidates;
+  }
+
+  bool meets_target(const trial_t &trial, int target_fps) {
+    return !trial.measurements.empty() && std::all_of(std::begin(trial.measurements), std::end(trial.measurements), [target_fps](const measurement_t &measurement) {
+      return measurement.fps >= target_fps * headroom;
+    });
+  }
+
+  std::optional<std::size_t> recommend(const std::vector<trial_t> &trials, int target_fps) {
+    std::optional<std::size_t> fastest;
+    double fastest_fps = 0;
+
+    for (std::size_t x = 0; x < trials.size(); ++x) {
+      auto &measurements = trials[x].measurements;
+      if (measurements.empty()) {
+        continue;
+      }
+      if (meets_target(trials[x], target_fps)) {
+        return x;
+      }
+
+      auto slowest = std::min_element(std::begin(measurements), std::end(measurements), [](const measurement_t &a, const measurement_t &b) {
+                       return a.fps < b.fps;
+                     })->fps;
+      if (!fastest || slowest > fastest_fps) {
+        fastest = x;
+        fastest_fps = slowest;
+      }
+    }
+
+    return fastest;
+  }
+
+  bool start(int target_fps, bool apply) {
+    if (video::chosen_encoder_name().empty() || rtsp_stream::session_count() > 0) {
+      return false;
+    }
+
+    {
+      auto &state = calibration::state();
+      std::lock_guard lg {state.lock};
+      if (state.running) {
+        return false;
+      }
+      state.running = true;
+    }
+
+    // Detached like the async encoder teardown, it checks for shutdown between candidates
+    std::thread {run, target_fps, apply}.detach();
+    return true;
+  }
+
+  void start_if_new_hardware() {
+    auto mode = config::video.encoder_calibration;
+    if (mode == "disabled"sv || video::chosen_encoder_name().empty()) {
+      return;
+    }
+
+    std::ifstream in {result_path()};
+    if (in) {
+      try {
+        auto saved = nlohmann::json::parse(in);
+        if (saved["identity"] == identity()) {
+          auto &state = calibration::state();
+          std::lock_guard lg {state.lock};
+          state.last = std::move(saved["result"]);
+          return;
+        }
+      } catch (const std::exception &e) {
+        BOOST_LOG(warning) << "Couldn't read "sv << result_path().string() << ": "sv << e.what();
+      }
+    }
+
+    BOOST_LOG(info) << "Calibrating the encoder settings for this hardware in the background"sv;
+    start(default_target_fps, mode == "apply"sv);
+  }
+
+  nlohmann::json status() {
+    auto &state = calibration::state();
+    std::lock_guard lg {state.lock};
+
+    auto result = state.last.is_null() ? nlohmann::json::object() : state.last;
+    result["running"] = state.running;
+    return result;
+  }
+
+  std::optional<double> pixel_rate() {
+    nlohmann::json last;
+    {
+      auto &state = calibration::state();
+      std::lock_guard lg {state.lock};
+      last = state.last;
+    }
+
+    auto encoder_name = std::string {video::chosen_encoder_name()};
+    if (!last.is_object() || last.value("encoder", ""s) != encoder_name || !last.contains("trials")) {
+      return std::nullopt;
+    }
+
+    nlohmann::json settings = current_settings(encoder_name).vars;
+    for (auto &trial : last["trials"]) {
+      if (trial["settings"] != settings || trial["measurements"].empty()) {
+        continue;
+      }
+
+      std::optional<double> slowest;
+      for (auto &measurement : trial["measurements"]) {
+        auto rate = measurement["width"].get<double>() * measurement["height"].get<double>() * measurement["fps"].get<double>();
+        if (!slowest || rate < *slowest) {
+          slowest = rate;
+        }
+      }
+      return slowest;
+    }
+
+    return std::nullopt;
+  }
+}  // namespace calibration
@@ -0,0 +1,122 @@
+/**
+ * @file src/calibration.h
+ * @brief Declarations for calibrating the encoder settings to the host.
+ */
+#pragma once
+
+// standard includes
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+namespace calibration {
+  constexpr double headroom = 1.25;  ///< Factor by which the measured framerate must exceed the target
+  constexpr int default_target_fps = 60;  ///< Target framerate of the calibration on first start
+  constexpr int frames_per_trial = 120;  ///< Frames encoded per setting and resolution
+
+  /**
+   * @brief A resolution the settings are measured at.
+   */
+  struct resolution_t {
+    int width;
+    int height;
+  };
+
+  /**
+   * @brief The resolutions clients commonly stream at, largest first so a setting fails early.
+   */
+  constexpr resolution_t resolutions[] {
+    {3840, 2160},
+    {2560, 1440},
+    {1920, 1080},
+  };
+
+  /**
+   * @brief Encoder settings tried by the calibration.
+   */
+  struct candidate_t {
+    std::unordered_map<std::string, std::string> vars;  ///< The settings as config options, e.g. `sw_preset = fast`
+  };
+
+  /**
+   * @brief What a candidate achieved at one resolution.
+   */
+  struct measurement_t {
+    resolution_t resolution;
+    double fps;  ///< Frames converted and encoded per second, back to back
+    double latency_p50_ms;  ///< Median time to convert and encode a frame
+    double latency_p99_ms;  ///< 99th percentile of the same
+  };
+
+  /**
+   * @brief The measurements of a candidate.
+   */
+  struct trial_t {
+    candidate_t candidate;
+    std::vector<measurement_t> measurements;  ///< Empty if the encoder couldn't be set up with it
+  };
+
+  /**
+   * @brief Get the settings worth trying for an encoder, from the best quality to the fastest.
+   * @details Software encoding varies `sw_preset` and `min_threads`, NVENC varies `nvenc_preset`
+   *          and `nvenc_twopass`. The other encoders have no settings trading quality for speed here.
+   * @param encoder_name The name of the encoder, e.g. "nvenc" or "software".
+   * @param hardware_threads The number of CPU threads of the host.
+   * @return The candidates, empty if the encoder has nothing to calibrate.
+   */
+  std::vector<candidate_t> candidates(std::string_view encoder_name, int hardware_threads);
+
+  /**
+   * @brief Check whether a trial sustains the target framerate with headroom at every resolution.
+   * @param trial The trial.
+   * @param target_fps The framerate streams need.
+   * @return `true` if it does.
+   */
+  bool meets_target(const trial_t &trial, int target_fps);
+
+  /**
+   * @brief Pick the settings to use from the trials, in the order of `candidates()`.
+   * @details The first trial meeting the target wins. If none does, the one with the highest
+   *          framerate at its slowest resolution is the closest the host gets.
+   * @param trials The trials.
+   * @param target_fps The framerate streams need.
+   * @return The index of the trial, or `std::nullopt` if no trial could be measured.
+   */
+  std::optional<std::size_t> recommend(const std::vector<trial_t> &trials, int target_fps);
+
+  /**
+   * @brief Start calibrating in the background, unless it's already running.
+   * @details Every candidate is measured with `video::benchmark_encoder()`, which takes the candidate
+   *          settings for its own encoder only, the settings in use never change while it runs.
+   *          Once it's complete, the recommendation may be applied, which also saves it to the config
+   *          file. The calibration stops before the next resolution when a client starts streaming.
+   * @param target_fps The framerate streams need.
+   * @param apply Whether to apply the recommendation.
+   * @return `false` if a calibration is running or a client is streaming.
+   */
+  bool start(int target_fps, bool apply);
+
+  /**
+   * @brief Calibrate in the background on the first start, and after the GPUs or the encoder changed.
+   * @details Controlled by the `encoder_calibration` option, called once the encoders are probed.
+   */
+  void start_if_new_hardware();
+
+  /**
+   * @brief Get the state of the calibration.
+   * @return `running`, the target, the trials and the recommendation of the latest calibration.
+   */
+  nlohmann::json status();
+
+  /**
+   * @brief Get how many pixels per second the encoder sustains with the settings in use.
+   * @details Taken from the slowest resolution of the latest calibration's trial of these settings.
+   * @return The pixel rate, or `std::nullopt` if the settings weren't calibrated.
+   */
+  std::optional<double> pixel_rate();
+}  // namespace calibration
@@ -0,0 +1,104 @@
+/**
+ * @file src/clipboard.cpp
+ * @brief Definitions for moving the clipboard between the clients and the host.
+ */
+// standard includes
+#include <algorithm>
+
+// lib includes
+#include <zlib.h>
+
+// local includes
+#include "clipboard.h"
+#include "utility.h"
+
+namespace clipboard {
+  namespace {
+    /**
+     * @brief Compress content with gzip at the fastest level.
+     * @param content The content.
+     * @return The compressed content, or an empty string on failure.
+     */
+    std::string gzip(std::string_view content) {
+      z_stream stream {};
+      // 15 window bits, +16 for a gzip header instead of a zlib one
+      if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return {};
+      }
+      auto fg = util::fail_guard([&stream]() {
+        deflateEnd(&stream);
+      });
+
+      std::string compressed(deflateBound(&stream, (uLong) content.size()), '\0');
+      stream.next_in = (Bytef *) content.data();
+      stream.avail_in = (uInt) content.size();
+      stream.next_out = (Bytef *) compressed.data();
+      stream.avail_out = (uInt) compressed.size();
+
+      if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        return {};
+      }
+      compressed.resize(stream.total_out);
+      return compressed;
+    }
+  }  // namespace
+
+  std::optional<std::string> compress(std::string_view content) {
+    if (content.size() < min_compressed_size) {
+      return std::nullopt;
+    }
+
+    if (content.size() > sample_size) {
+      auto sample = gzip(content.substr(0, sample_size));
+      if (sample.empty() || sample.size() > sample_size * (1.0 - min_saving)) {
+        return std::nullopt;
+      }
+    }
+
+    auto compressed = gzip(content);
+    if (compressed.empty() || compressed.size() > content.size() * (1.0 - min_saving)) {
+      return std::nullopt;
+    }
+    return compressed;
+  }
+
+  std::optional<std::string> decompress(std::string_view content, std::size_t limit) {
+    z_stream stream {};
+    // 15 window bits, +32 to detect a gzip or a zlib header
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+      return std::nullopt;
+    }
+    auto fg = util::fail_guard([&stream]() {
+      inflateEnd(&stream);
+    });
+
+    stream.next_in = (Bytef *) content.data();
+    stream.avail_in = (uInt) content.size();
+
+    std::string decompressed;
+    while (true) {
+      // Grow one chunk at a time, a small body may expand to far more than the limit
+      auto offset = decompressed.size();
+      if (offset >= limit + 1) {
+        return std::nullopt;
+      }
+      decompressed.resize(std::min(offset + chunk_size, limit + 1));
+      stream.next_out = (Bytef *) decompressed.data() + offset;
+      stream.avail_out = (uInt) (decompressed.size() - offset);
+
+      auto status = inflate(&stream, Z_NO_FLUSH);
+      decompressed.resize(stream.total_out);
+      if (status == Z_STREAM_END) {
+        break;
+      }
+      if (status != Z_OK) {
+        return std::nullopt;
+      }
+    }
+
+    if (decompressed.size() > limit) {
+      return std::nullopt;
+    }
+    return decompressed;
+  }
+}  // namespace clipboard
@@ -0,0 +1,39 @@
+/**
+ * @file src/clipboard.h
+ * @brief Declarations for moving the clipboard between the clients and the host.
+ */
+#pragma once
+
+// standard includes
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Size limits and compression of the clipboard contents sent over nvhttp.
+ */
+namespace clipboard {
+  constexpr std::size_t max_size = 16 * 1024 * 1024;  ///< Largest clipboard content, in either direction and before compression
+  constexpr std::size_t chunk_size = 64 * 1024;  ///< Bytes handed to the socket at a time, so a large response isn't copied whole
+  constexpr std::size_t min_compressed_size = 4 * 1024;  ///< Smaller contents aren't worth the time of compressing them
+  constexpr std::size_t sample_size = 64 * 1024;  ///< Bytes compressed first to tell whether the content compresses
+  constexpr double min_saving = 0.1;  ///< Share of the sample compression must save to compress the whole content
+
+  /**
+   * @brief Compress content with gzip if it's large enough and compresses well.
+   * @details A sample of the content is compressed first at the fastest level, content that is
+   *          already compressed, like most images, is sent as it is.
+   * @param content The content.
+   * @return The compressed content, or `std::nullopt` if it should be sent as it is.
+   */
+  std::optional<std::string> compress(std::string_view content);
+
+  /**
+   * @brief Decompress gzip or zlib content.
+   * @param content The compressed content.
+   * @param limit The largest decompressed size accepted.
+   * @return The decompressed content, or `std::nullopt` if it's invalid or larger than the limit.
+   */
+  std::optional<std::string> decompress(std::string_view content, std::size_t limit = max_size);
+}  // namespace clipboard
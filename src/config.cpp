@@ -8,11 +8,13 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <atomic>
+#include <memory>
 #include <mutex>
-#include <shared_mutex>
 #include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 // lib includes
 #include <boost/asio.hpp>
@@ -28,6 +30,7 @@
 #include "nvhttp.h"
 #include "platform/common.h"
 #include "rtsp.h"
+#include "thread_placement.h"
 #include "video.h"
 #include "utility.h"
 
@@ -70,7 +73,37 @@ using namespace std::literals;
 
 namespace config {
   namespace {
-    std::shared_mutex auto_bitrate_mutex;
+    /**
+     * @brief Latest published auto bitrate settings, read without locks by the stream threads.
+     */
+    std::atomic<const auto_bitrate_settings_t *> auto_bitrate_snapshot {nullptr};
+
+    /**
+     * @brief Every snapshot ever published. A reader may still hold an old one,
+     *        so they are only freed at exit, one small struct per config save.
+     */
+    std::vector<std::unique_ptr<const auto_bitrate_settings_t>> auto_bitrate_snapshots;
+    std::mutex auto_bitrate_publish_mutex;
+
+    /**
+     * @brief Convert string view to auto bitrate controller mode.
+     *
+     * @param mode String representation ("loss" or "delay").
+     * @return 1 for the delay gradient controller, 0 for the frame loss controller.
+     */
+    int auto_bitrate_mode_from_view(const ::std::string_view &mode) {
+      return mode == "delay" ? 1 : 0;
+    }
+
+    /**
+     * @brief Convert string view to QoS profile.
+     *
+     * @param profile String representation ("default" or "wmm").
+     * @return The QOS_PROFILE_* value.
+     */
+    int qos_profile_from_view(const ::std::string_view &profile) {
+      return profile == "wmm" ? QOS_PROFILE_WMM : QOS_PROFILE_DEFAULT;
+    }
   }  // namespace
 
   namespace nv {
@@ -655,19 +688,20 @@ namespace config {
   namespace sw {
     /**
      * @brief Convert string view to SVT-AV1 preset value.
+     * @details Presets below 8 can't encode in real time, so the slower x264 presets all map to 8.
      * 
      * @param preset String representation of preset.
-     * @return Preset value (1-12), defaults to 11 (superfast) if not found.
+     * @return Preset value (8-12), defaults to 11 (superfast) if not found.
      */
     int svtav1_preset_from_view(const ::std::string_view &preset) {
 #define _CONVERT_(x, y) \
   if (preset == #x##sv) \
   return y
-      _CONVERT_(veryslow, 1);
-      _CONVERT_(slower, 2);
-      _CONVERT_(slow, 4);
-      _CONVERT_(medium, 5);
-      _CONVERT_(fast, 7);
+      _CONVERT_(veryslow, 8);
+      _CONVERT_(slower, 8);
+      _CONVERT_(slow, 8);
+      _CONVERT_(medium, 8);
+      _CONVERT_(fast, 9);
       _CONVERT_(faster, 9);
       _CONVERT_(veryfast, 10);
       _CONVERT_(superfast, 11);
@@ -800,14 +834,17 @@ namespace config {
     0,  // av1_mode
 
     2,  // min_threads
+    0,  // min_slices_per_frame
     {
       "superfast"s,  // preset
       "zerolatency"s,  // tune
       11,  // superfast
+      false,  // sw_low_latency
     },  // software
 
     {},  // nv
     true,  // nv_realtime_hags
+    false,  // nv_realtime_hags_on_contention
     true,  // nv_opengl_vulkan_on_dxgi
     true,  // nv_sunshine_high_power_mode
     {},  // nv_legacy
@@ -843,11 +880,19 @@ namespace config {
 
     {
       false,  // strict_rc_buffer
+      false,  // direct_import
     },  // vaapi
 
     {},  // capture
+    5,  // capture_queue_depth
+    false,  // capture_variable_framerate
+    false,  // capture_vblank_sync
+    false,  // capture_helper
+    false,  // capture_staging_ring
     {},  // encoder
     {},  // adapter_name
+    false,  // adapter_balancing
+    false,  // cross_adapter_encode
     {},  // output_name
 
     {
@@ -865,6 +910,16 @@ namespace config {
 
     0,  // max_bitrate
     0,  // minimum_fps_target (0 = framerate)
+    0,  // static_content_fps (0 = disabled)
+    false,  // encode_sharing
+    1,  // encode_sharing_layers
+    0s,  // capture_standby
+    60s,  // idle_memory_trim
+    false,  // stream_prewarm
+    0,  // first_frame_bitrate
+    false,  // hdr_tone_mapping
+    200,  // hdr_tone_mapping_white
+    0,  // hdr_tone_mapping_peak (0 = display peak)
 
     1,  // auto_bitrate_min_kbps
     0,    // auto_bitrate_max_kbps (0 = use client max)
@@ -880,10 +935,20 @@ namespace config {
     5000, // auto_bitrate_good_stability_ms
     3000, // auto_bitrate_increase_min_interval_ms
     25,   // auto_bitrate_poor_status_cap_pct
+    0,    // auto_bitrate_mode (loss)
+    15,   // auto_bitrate_delay_threshold_ms
+    false,  // auto_bitrate_adaptive_fec
+    false,  // auto_bitrate_resolution_ladder
+    false,  // auto_bitrate_ladder_halve_fps
 
     "1920x1080x60",  // fallback_mode
     false, // isolated Display
     false, // ignore_encoder_probe_failure
+    "recommend",  // encoder_calibration
+    "disabled",  // session_admission
+    false,  // overload_shedding
+    "disabled",  // roi_mode
+    5,  // roi_strength
   };
 
   audio_t audio {
@@ -893,6 +958,7 @@ namespace config {
     true,  // install_steam_drivers
     true, // keep_sink_default
     true, // auto_capture
+    false,  // stream_mic
   };
 
   stream_t stream {
@@ -901,9 +967,22 @@ namespace config {
     APPS_JSON_PATH,
 
     20,  // fecPercentage
+    0,  // fec_spread
 
     ENCRYPTION_MODE_NEVER,  // lan_encryption_mode
     ENCRYPTION_MODE_OPPORTUNISTIC,  // wan_encryption_mode
+    false,  // lan_large_packets
+    false,  // txtime_send
+    false,  // registered_io_send
+    1,  // video_send_threads
+    false,  // video_reuseport
+    0,  // video_max_queued_frames
+    0,  // video_max_queued_mb
+    QOS_PROFILE_DEFAULT,  // qos_profile
+    false,  // thread_placement_auto
+    {},  // thread_placement
+    false,  // performance_power_profile
+    false,  // pipeline_trace
   };
 
   nvhttp_t nvhttp {
@@ -933,17 +1012,21 @@ namespace config {
     },  // Default gamepad
     true,  // back as touchpad click enabled (manual DS4 only)
     true,  // client gamepads with motion events are emulated as DS4
+    0,  // motion_report_rate
     true,  // client gamepads with touchpads are emulated as DS4
     true,  // ds5_inputtino_randomize_mac
 
     true,  // keyboard enabled
     true,  // mouse enabled
+    0,  // mouse_smoothing_rate
     true,  // controller enabled
     true,  // always send scancodes
     true,  // high resolution scrolling
     true,  // native pen/touch support
     false, // enable input only mode
     true, // forward_rumble
+    0us,  // input_coalesce_delay
+    false,  // input_latency_tracing
   };
 
   sunshine_t sunshine {
@@ -963,12 +1046,18 @@ namespace config {
     47989,  // Base port number
     "ipv4",  // Address family
     platf::appdata().string() + "/sunshine.log",  // log file
+    10,  // log rotate size
+    24h,  // log rotate age
+    100,  // log keep size
     false,  // notify_pre_releases
     false,  // legacy_ordering
     true,  // system_tray
     {},  // prep commands
     {},  // state commands
     {},  // server commands
+    platf::appdata().string() + "/recordings",  // recording path
+    {},  // fleet broker
+    10s,  // fleet report interval
   };
 
   /**
@@ -1416,6 +1505,32 @@ namespace config {
     input = to_bool(tmp);
   }
 
+  /**
+   * @brief Parse the thread placement of a pipeline stage from configuration.
+   *
+   * Invalid placements are logged and ignored.
+   *
+   * @param vars Configuration variables map.
+   * @param name Name of the configuration option.
+   * @param input Output parameter to store the parsed value.
+   */
+  void thread_placement_f(std::unordered_map<std::string, std::string> &vars, const std::string &name, thread_placement_t &input) {
+    std::string tmp;
+    string_f(vars, name, tmp);
+
+    if (tmp.empty()) {
+      return;
+    }
+
+    auto placement = thread_placement::parse(tmp);
+    if (!placement) {
+      BOOST_LOG(warning) << "config: ["sv << name << "] is not a valid thread placement: "sv << tmp;
+      return;
+    }
+
+    input = std::move(*placement);
+  }
+
   /**
    * @brief Parse double field from configuration.
    * 
@@ -1542,8 +1657,10 @@ namespace config {
       auto do_cmd = prep_cmd.get_optional<std::string>("do"s);
       auto undo_cmd = prep_cmd.get_optional<std::string>("undo"s);
       auto elevated = prep_cmd.get_optional<bool>("elevated"s);
+      auto parallel = prep_cmd.get_optional<bool>("parallel"s);
 
       input.emplace_back(do_cmd.value_or(""), undo_cmd.value_or(""), elevated.value_or(false));
+      input.back().parallel = parallel.value_or(false);
     }
   }
 
@@ -1713,6 +1830,18 @@ namespace config {
    * 
    * @param vars Map of configuration option names to values (moved).
    */
+  void update_nv_legacy() {
+#if !defined(__ANDROID__) && !defined(__APPLE__)
+    video.nv_legacy.preset = video.nv.quality_preset + 11;
+    video.nv_legacy.multipass = video.nv.two_pass == nvenc::nvenc_two_pass::quarter_resolution ? NV_ENC_TWO_PASS_QUARTER_RESOLUTION :
+                                video.nv.two_pass == nvenc::nvenc_two_pass::full_resolution    ? NV_ENC_TWO_PASS_FULL_RESOLUTION :
+                                                                                                 NV_ENC_MULTI_PASS_DISABLED;
+    video.nv_legacy.h264_coder = video.nv.h264_cavlc ? NV_ENC_H264_ENTROPY_CODING_MODE_CAVLC : NV_ENC_H264_ENTROPY_CODING_MODE_CABAC;
+    video.nv_legacy.aq = video.nv.adaptive_quantization;
+    video.nv_legacy.vbv_percentage_increase = video.nv.vbv_percentage_increase;
+#endif
+  }
+
   void apply_config(std::unordered_map<std::string, std::string> &&vars) {
 #ifndef __ANDROID__
     // TODO: Android can possibly support this
@@ -1737,32 +1866,32 @@ namespace config {
     int_between_f(vars, "hevc_mode", video.hevc_mode, {0, 3});
     int_between_f(vars, "av1_mode", video.av1_mode, {0, 3});
     int_f(vars, "min_threads", video.min_threads);
+    int_between_f(vars, "min_slices_per_frame", video.min_slices_per_frame, {0, 16});
     string_f(vars, "sw_preset", video.sw.sw_preset);
     if (!video.sw.sw_preset.empty()) {
       video.sw.svtav1_preset = sw::svtav1_preset_from_view(video.sw.sw_preset);
     }
     string_f(vars, "sw_tune", video.sw.sw_tune);
+    bool_f(vars, "sw_low_latency", video.sw.sw_low_latency);
 
     int_between_f(vars, "nvenc_preset", video.nv.quality_preset, {1, 7});
     int_between_f(vars, "nvenc_vbv_increase", video.nv.vbv_percentage_increase, {0, 400});
+    int_between_f(vars, "nvenc_async_depth", video.nv.async_depth, {1, 4});
+    int_between_f(vars, "nvenc_temporal_layers", video.nv.temporal_layers, {1, 3});
     bool_f(vars, "nvenc_spatial_aq", video.nv.adaptive_quantization);
     generic_f(vars, "nvenc_twopass", video.nv.two_pass, nv::twopass_from_view);
     bool_f(vars, "nvenc_h264_cavlc", video.nv.h264_cavlc);
     bool_f(vars, "nvenc_intra_refresh", video.nv.intra_refresh);
+    int_between_f(vars, "nvenc_intra_refresh_period", video.nv.intra_refresh_period, {0, 3600});
+    int_between_f(vars, "nvenc_intra_refresh_wave", video.nv.intra_refresh_wave, {0, 3600});
+    bool_f(vars, "nvenc_intra_refresh_restart", video.nv.intra_refresh_restart_on_loss);
     bool_f(vars, "nvenc_vbr", video.nv.vbr_rate_control);
     bool_f(vars, "nvenc_realtime_hags", video.nv_realtime_hags);
+    bool_f(vars, "nvenc_realtime_hags_on_contention", video.nv_realtime_hags_on_contention);
     bool_f(vars, "nvenc_opengl_vulkan_on_dxgi", video.nv_opengl_vulkan_on_dxgi);
     bool_f(vars, "nvenc_latency_over_power", video.nv_sunshine_high_power_mode);
 
-#if !defined(__ANDROID__) && !defined(__APPLE__)
-    video.nv_legacy.preset = video.nv.quality_preset + 11;
-    video.nv_legacy.multipass = video.nv.two_pass == nvenc::nvenc_two_pass::quarter_resolution ? NV_ENC_TWO_PASS_QUARTER_RESOLUTION :
-                                video.nv.two_pass == nvenc::nvenc_two_pass::full_resolution    ? NV_ENC_TWO_PASS_FULL_RESOLUTION :
-                                                                                                 NV_ENC_MULTI_PASS_DISABLED;
-    video.nv_legacy.h264_coder = video.nv.h264_cavlc ? NV_ENC_H264_ENTROPY_CODING_MODE_CAVLC : NV_ENC_H264_ENTROPY_CODING_MODE_CABAC;
-    video.nv_legacy.aq = video.nv.adaptive_quantization;
-    video.nv_legacy.vbv_percentage_increase = video.nv.vbv_percentage_increase;
-#endif
+    update_nv_legacy();
 
     int_f(vars, "qsv_preset", video.qsv.qsv_preset, qsv::preset_from_view);
     int_f(vars, "qsv_coder", video.qsv.qsv_cavlc, qsv::coder_from_view);
@@ -1803,10 +1932,18 @@ namespace config {
     int_f(vars, "vt_realtime", video.vt.vt_realtime, vt::rt_from_view);
 
     bool_f(vars, "vaapi_strict_rc_buffer", video.vaapi.strict_rc_buffer);
+    bool_f(vars, "vaapi_direct_import", video.vaapi.direct_import);
 
     string_f(vars, "capture", video.capture);
+    int_between_f(vars, "capture_queue_depth", video.capture_queue_depth, {3, 8});
+    bool_f(vars, "capture_variable_framerate", video.capture_variable_framerate);
+    bool_f(vars, "capture_vblank_sync", video.capture_vblank_sync);
+    bool_f(vars, "capture_helper", video.capture_helper);
+    bool_f(vars, "capture_staging_ring", video.capture_staging_ring);
     string_f(vars, "encoder", video.encoder);
     string_f(vars, "adapter_name", video.adapter_name);
+    bool_f(vars, "adapter_balancing", video.adapter_balancing);
+    bool_f(vars, "cross_adapter_encode", video.cross_adapter_encode);
     string_f(vars, "output_name", video.output_name);
 
     generic_f(vars, "dd_configuration_option", video.dd.configuration_option, dd::config_option_from_view);
@@ -1815,6 +1952,9 @@ namespace config {
     generic_f(vars, "dd_refresh_rate_option", video.dd.refresh_rate_option, dd::refresh_rate_option_from_view);
     string_f(vars, "dd_manual_refresh_rate", video.dd.manual_refresh_rate);
     generic_f(vars, "dd_hdr_option", video.dd.hdr_option, dd::hdr_option_from_view);
+    bool_f(vars, "hdr_tone_mapping", video.hdr_tone_mapping);
+    int_between_f(vars, "hdr_tone_mapping_white", video.hdr_tone_mapping_white, {80, 480});
+    int_between_f(vars, "hdr_tone_mapping_peak", video.hdr_tone_mapping_peak, {0, 10000});
     {
       int value = -1;
       int_between_f(vars, "dd_config_revert_delay", value, {0, std::numeric_limits<int>::max()});
@@ -1831,9 +1971,23 @@ namespace config {
     }
 
     double_between_f(vars, "minimum_fps_target", video.minimum_fps_target, {0.0, 1000.0});
+    double_between_f(vars, "static_content_fps", video.static_content_fps, {0.0, 1000.0});
+    bool_f(vars, "encode_sharing", video.encode_sharing);
+    int_between_f(vars, "encode_sharing_layers", video.encode_sharing_layers, {1, 3});
+    {
+      int value = 0;
+      int_between_f(vars, "capture_standby", value, {0, 600});
+      video.capture_standby = std::chrono::seconds {value};
+    }
+    {
+      int value = 60;
+      int_between_f(vars, "idle_memory_trim", value, {0, 3600});
+      video.idle_memory_trim = std::chrono::seconds {value};
+    }
+    bool_f(vars, "stream_prewarm", video.stream_prewarm);
+    int_between_f(vars, "first_frame_bitrate", video.first_frame_bitrate, {0, 100});
 
     {
-      std::unique_lock<std::shared_mutex> lock(auto_bitrate_mutex);
       int_f(vars, "max_bitrate", video.max_bitrate);
 
       // Note: auto_bitrate_enabled is NOT a host config option - it's controlled by client checkbox
@@ -1851,16 +2005,34 @@ namespace config {
       int_f(vars, "auto_bitrate_good_stability_ms", video.auto_bitrate_good_stability_ms);
       int_f(vars, "auto_bitrate_increase_min_interval_ms", video.auto_bitrate_increase_min_interval_ms);
       int_f(vars, "auto_bitrate_poor_status_cap_pct", video.auto_bitrate_poor_status_cap_pct);
+      int_f(vars, "auto_bitrate_mode", video.auto_bitrate_mode, auto_bitrate_mode_from_view);
+      int_between_f(vars, "auto_bitrate_delay_threshold_ms", video.auto_bitrate_delay_threshold_ms, {1, 1000});
+      bool_f(vars, "auto_bitrate_adaptive_fec", video.auto_bitrate_adaptive_fec);
+      bool_f(vars, "auto_bitrate_resolution_ladder", video.auto_bitrate_resolution_ladder);
+      bool_f(vars, "auto_bitrate_ladder_halve_fps", video.auto_bitrate_ladder_halve_fps);
     }
 
     string_f(vars, "fallback_mode", video.fallback_mode);
     bool_f(vars, "isolated_virtual_display_option", video.isolated_virtual_display_option);
     bool_f(vars, "ignore_encoder_probe_failure", video.ignore_encoder_probe_failure);
+    string_restricted_f(vars, "encoder_calibration", video.encoder_calibration, {"disabled"sv, "recommend"sv, "apply"sv});
+    string_restricted_f(vars, "session_admission", video.session_admission, {"disabled"sv, "reject"sv, "downgrade"sv});
+    bool_f(vars, "overload_shedding", video.overload_shedding);
+    string_restricted_f(vars, "roi_mode", video.roi_mode, {"disabled"sv, "changes"sv, "focus"sv});
+    int_between_f(vars, "roi_strength", video.roi_strength, {1, 25});
 
     path_f(vars, "pkey", nvhttp.pkey);
     path_f(vars, "cert", nvhttp.cert);
     string_f(vars, "sunshine_name", nvhttp.sunshine_name);
     path_f(vars, "log_path", config::sunshine.log_file);
+    int_between_f(vars, "log_rotate_size", config::sunshine.log_rotate_size, {0, 1024});
+    {
+      int value = 24;
+      int_between_f(vars, "log_rotate_age", value, {0, 720});
+      config::sunshine.log_rotate_age = std::chrono::hours {value};
+    }
+    int_between_f(vars, "log_keep_size", config::sunshine.log_keep_size, {1, 10240});
+    path_f(vars, "recording_path", config::sunshine.recording_path);
     path_f(vars, "file_state", nvhttp.file_state);
 
     // Must be run after "file_state"
@@ -1868,6 +2040,12 @@ namespace config {
     path_f(vars, "credentials_file", config::sunshine.credentials_file);
 
     string_f(vars, "external_ip", nvhttp.external_ip);
+    string_f(vars, "fleet_broker", config::sunshine.fleet_broker);
+    {
+      int value = 10;
+      int_between_f(vars, "fleet_report_interval", value, {1, 3600});
+      config::sunshine.fleet_report_interval = std::chrono::seconds {value};
+    }
     list_prep_cmd_f(vars, "global_prep_cmd", config::sunshine.prep_cmds);
     list_prep_cmd_f(vars, "global_state_cmd", config::sunshine.state_cmds);
     list_server_cmd_f(vars, "server_cmd", config::sunshine.server_cmds);
@@ -1875,6 +2053,7 @@ namespace config {
     string_f(vars, "audio_sink", audio.sink);
     string_f(vars, "virtual_sink", audio.virtual_sink);
     bool_f(vars, "stream_audio", audio.stream);
+    bool_f(vars, "stream_mic", audio.stream_mic);
     bool_f(vars, "install_steam_audio_drivers", audio.install_steam_drivers);
     bool_f(vars, "keep_sink_default", audio.keep_default);
     bool_f(vars, "auto_capture_sink", audio.auto_capture);
@@ -1889,9 +2068,24 @@ namespace config {
 
     int_between_f(vars, "lan_encryption_mode", stream.lan_encryption_mode, {0, 2});
     int_between_f(vars, "wan_encryption_mode", stream.wan_encryption_mode, {0, 2});
+    bool_f(vars, "lan_large_packets", stream.lan_large_packets);
+    bool_f(vars, "txtime_send", stream.txtime_send);
+    bool_f(vars, "registered_io_send", stream.registered_io_send);
 
     path_f(vars, "file_apps", stream.file_apps);
     int_between_f(vars, "fec_percentage", stream.fec_percentage, {1, 255});
+    int_between_f(vars, "fec_spread", stream.fec_spread, {0, 50});
+    int_between_f(vars, "video_send_threads", stream.video_send_threads, {1, 16});
+    bool_f(vars, "video_reuseport", stream.video_reuseport);
+    int_between_f(vars, "video_max_queued_frames", stream.video_max_queued_frames, {0, 30});
+    int_between_f(vars, "video_max_queued_mb", stream.video_max_queued_mb, {0, 1024});
+    int_f(vars, "qos_profile", stream.qos_profile, qos_profile_from_view);
+    bool_f(vars, "thread_placement_auto", stream.thread_placement_auto);
+    for (int x = 0; x < (int) thread_stage_e::count; ++x) {
+      thread_placement_f(vars, "thread_placement_"s + std::string {thread_placement::stage_name((thread_stage_e) x)}, stream.thread_placement[x]);
+    }
+    bool_f(vars, "performance_power_profile", stream.performance_power_profile);
+    bool_f(vars, "pipeline_trace", stream.pipeline_trace);
 
     map_int_int_f(vars, "keybindings"s, input.keybindings);
 
@@ -1927,10 +2121,12 @@ namespace config {
     string_restricted_f(vars, "gamepad"s, input.gamepad, get_supported_gamepad_options());
     bool_f(vars, "ds4_back_as_touchpad_click", input.ds4_back_as_touchpad_click);
     bool_f(vars, "motion_as_ds4", input.motion_as_ds4);
+    int_between_f(vars, "motion_report_rate", input.motion_report_rate, {0, 1000});
     bool_f(vars, "touchpad_as_ds4", input.touchpad_as_ds4);
     bool_f(vars, "ds5_inputtino_randomize_mac", input.ds5_inputtino_randomize_mac);
 
     bool_f(vars, "mouse", input.mouse);
+    int_between_f(vars, "mouse_smoothing_rate", input.mouse_smoothing_rate, {0, 1000});
     bool_f(vars, "keyboard", input.keyboard);
     bool_f(vars, "controller", input.controller);
 
@@ -1949,6 +2145,13 @@ namespace config {
     bool_f(vars, "legacy_ordering", sunshine.legacy_ordering);
     bool_f(vars, "forward_rumble", input.forward_rumble);
 
+    to = -1;
+    int_between_f(vars, "input_coalesce_delay", to, {0, 1000});
+    if (to >= 0) {
+      input.coalesce_delay = std::chrono::microseconds {to};
+    }
+    bool_f(vars, "input_latency_tracing", input.latency_tracing);
+
     int port = sunshine.port;
     int_between_f(vars, "port"s, port, {1024 + nvhttp::PORT_HTTPS, 65535 - rtsp_stream::RTSP_SETUP_PORT});
     sunshine.port = (std::uint16_t) port;
@@ -2029,6 +2232,9 @@ namespace config {
 
     ::video::active_hevc_mode = video.hevc_mode;
     ::video::active_av1_mode = video.av1_mode;
+
+    // Running sessions pick these up with their next adjustment, the rest needs a restart
+    publish_auto_bitrate_settings();
   }
 
   /**
@@ -2194,16 +2400,8 @@ namespace config {
     return 0;
   }
 
-  /**
-   * @brief Get current auto bitrate adjustment settings.
-   * 
-   * Returns a thread-safe copy of the current auto bitrate settings.
-   * 
-   * @return Auto bitrate settings structure with current values.
-   */
-  auto_bitrate_settings_t get_auto_bitrate_settings() {
-    std::shared_lock<std::shared_mutex> lock(auto_bitrate_mutex);
-    return {
+  void publish_auto_bitrate_settings() {
+    auto settings = std::make_unique<const auto_bitrate_settings_t>(auto_bitrate_settings_t {
       video.auto_bitrate_min_kbps,
       video.auto_bitrate_max_kbps,
       video.auto_bitrate_adjustment_interval_ms,
@@ -2218,7 +2416,34 @@ namespace config {
       video.auto_bitrate_good_stability_ms,
       video.auto_bitrate_increase_min_interval_ms,
       video.auto_bitrate_poor_status_cap_pct,
+      video.auto_bitrate_mode,
+      video.auto_bitrate_delay_threshold_ms,
+      video.auto_bitrate_adaptive_fec,
+      video.auto_bitrate_resolution_ladder,
+      video.auto_bitrate_ladder_halve_fps,
       video.max_bitrate,
-    };
+      stream.fec_percentage,
+    });
+
+    std::lock_guard lock(auto_bitrate_publish_mutex);
+    auto_bitrate_snapshot.store(settings.get(), std::memory_order_release);
+    auto_bitrate_snapshots.push_back(std::move(settings));
+  }
+
+  /**
+   * @brief Get current auto bitrate adjustment settings.
+   * 
+   * Returns the latest published snapshot, without taking a lock.
+   * 
+   * @return Auto bitrate settings, valid until exit.
+   */
+  const auto_bitrate_settings_t &get_auto_bitrate_settings() {
+    if (auto settings = auto_bitrate_snapshot.load(std::memory_order_acquire)) {
+      return *settings;
+    }
+
+    // Nothing was published yet, e.g. in tests that don't apply a config
+    publish_auto_bitrate_settings();
+    return *auto_bitrate_snapshot.load(std::memory_order_acquire);
   }
 }  // namespace config
@@ -5,10 +5,12 @@
 #pragma once
 
 // standard includes
+#include <array>
 #include <bitset>
 #include <chrono>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -42,6 +44,7 @@ namespace config {
     int av1_mode;  ///< AV1 encoding mode (0 = disabled, 1 = enabled).
 
     int min_threads;  ///< Minimum number of threads/slices for CPU encoding.
+    int min_slices_per_frame;  ///< Fewest slices (tiles with AV1) frames are split into for the decoder of the client, 0 = as the client requests.
 
     /**
      * @brief Software encoder settings.
@@ -50,10 +53,12 @@ namespace config {
       std::string sw_preset;  ///< Software encoder preset (e.g., "superfast", "veryfast").
       std::string sw_tune;  ///< Software encoder tune (e.g., "zerolatency").
       std::optional<int> svtav1_preset;  ///< SVT-AV1 preset value (1-12).
+      bool sw_low_latency;  ///< Keep x264 and x265 from holding frames back, whatever the preset and tune.
     } sw;
 
     nvenc::nvenc_config nv;  ///< NVIDIA NVENC encoder configuration.
     bool nv_realtime_hags;  ///< Enable NVIDIA realtime HAGS (Hardware Accelerated GPU Scheduling).
+    bool nv_realtime_hags_on_contention;  ///< Use realtime HAGS priority while the GPU is saturated, if it is disabled otherwise.
     bool nv_opengl_vulkan_on_dxgi;  ///< Allow OpenGL/Vulkan on DXGI adapter.
     bool nv_sunshine_high_power_mode;  ///< Enable Sunshine high power mode for NVIDIA GPUs.
 
@@ -111,11 +116,19 @@ namespace config {
      */
     struct {
       bool strict_rc_buffer;  ///< Use strict rate control buffer management.
+      bool direct_import;  ///< Convert KMS framebuffers with VA-API video processing instead of EGL.
     } vaapi;
 
     std::string capture;  ///< Capture method name (e.g., "gdi", "x11", "wayland").
+    int capture_queue_depth;  ///< Frames ScreenCaptureKit renders ahead on macOS.
+    bool capture_variable_framerate;  ///< Capture each frame when the source presents it, up to the client framerate, instead of at a fixed rate.
+    bool capture_vblank_sync;  ///< Time KMS captures right after the display flips instead of with a frame timer.
+    bool capture_helper;  ///< Duplicate the output in a helper process that follows switches to the secure desktop.
+    bool capture_staging_ring;  ///< Read back RAM captures on Windows through a ring of staging textures without waiting on the GPU.
     std::string encoder;  ///< Encoder name (e.g., "nvenc", "qsv", "software").
     std::string adapter_name;  ///< Graphics adapter name to use for capture/encoding.
+    bool adapter_balancing;  ///< Spread the encoders of concurrent sessions over the GPUs able to run them.
+    bool cross_adapter_encode;  ///< Encode on a discrete GPU when the display is on an integrated one.
     std::string output_name;  ///< Display output name to capture from.
 
     /**
@@ -192,6 +205,8 @@ namespace config {
         std::string requested_fps;  ///< Client-requested framerate (e.g., "60").
         std::string final_resolution;  ///< Final resolution to use (e.g., "2560x1440").
         std::string final_refresh_rate;  ///< Final refresh rate to use (e.g., "120").
+
+        bool operator==(const mode_remapping_entry_t &) const = default;
       };
 
       /**
@@ -220,6 +235,16 @@ namespace config {
 
     int max_bitrate;  ///< Maximum bitrate ceiling in kbps for bitrate requested from client.
     double minimum_fps_target;  ///< Lowest framerate that will be used when streaming. Range 0-1000, 0 = half of client's requested framerate.
+    double static_content_fps;  ///< Keepalive framerate while the captured content is unchanged. Range 0-1000, 0 = encode unchanged frames.
+    bool encode_sharing;  ///< Let sessions with identical video configs share one encoder.
+    int encode_sharing_layers;  ///< Shared encoders sessions that only differ in bitrate spread over, 1 = identical configs only.
+    std::chrono::seconds capture_standby;  ///< How long the display keeps capturing after the last stream ends, 0 = stop right away.
+    std::chrono::seconds idle_memory_trim;  ///< How long streaming has to be idle before the host memory is trimmed, 0 = never.
+    bool stream_prewarm;  ///< Start the capture and audio when a stream is launched or resumed, before the client sets it up.
+    int first_frame_bitrate;  ///< Percent of the bitrate the first IDR frame of a stream is encoded at, 0 = the full bitrate.
+    bool hdr_tone_mapping;  ///< Tone map HDR captures for SDR streams instead of turning HDR off on the display (Windows).
+    int hdr_tone_mapping_white;  ///< Brightness of SDR white on the HDR display, in nits.
+    int hdr_tone_mapping_peak;  ///< Brightest highlight kept by the tone mapping in nits, 0 = the peak of the display.
 
     // Auto bitrate adjustment settings (only used when client enables it)
     // Note: Feature is controlled by client checkbox, these are host-side tuning parameters
@@ -237,10 +262,20 @@ namespace config {
     int auto_bitrate_good_stability_ms = 5000;  ///< Good-network duration required before increases in milliseconds.
     int auto_bitrate_increase_min_interval_ms = 3000;  ///< Minimum interval between increases in milliseconds.
     int auto_bitrate_poor_status_cap_pct = 25;  ///< Cap reduction percent when network status is POOR.
+    int auto_bitrate_mode = 0;  ///< Controller that picks the bitrate, 0 = frame loss, 1 = delay gradient.
+    int auto_bitrate_delay_threshold_ms = 15;  ///< Queuing delay in milliseconds above which the delay controller backs off.
+    bool auto_bitrate_adaptive_fec = false;  ///< Trade FEC percentage against encoder bitrate based on the pattern of loss.
+    bool auto_bitrate_resolution_ladder = false;  ///< Lower the encoded resolution when the bitrate gets too low for it.
+    bool auto_bitrate_ladder_halve_fps = false;  ///< Add a last rung to the resolution ladder that halves the framerate.
 
     std::string fallback_mode;  ///< Fallback display mode if primary mode fails (format: "WIDTHxHEIGHTxFPS").
     bool isolated_virtual_display_option;  ///< Use isolated virtual display option.
     bool ignore_encoder_probe_failure;  ///< Ignore encoder probe failures and continue anyway.
+    std::string encoder_calibration;  ///< Calibrate the encoder settings on the first start on new hardware: "disabled", "recommend" or "apply".
+    std::string session_admission;  ///< What to do with new sessions the encoder has no capacity left for: "disabled", "reject" or "downgrade".
+    bool overload_shedding;  ///< Lower the framerate of lower priority sessions while the host falls behind.
+    std::string roi_mode;  ///< Regions encoded at a better quality than the rest of the frame: "disabled", "changes" or "focus".
+    int roi_strength;  ///< QP delta given to the regions of interest.
   };
 
   /**
@@ -253,6 +288,7 @@ namespace config {
     bool install_steam_drivers;  ///< Whether to install Steam audio drivers
     bool keep_default;  ///< Whether to keep default audio sink
     bool auto_capture;  ///< Whether to auto-capture audio
+    bool stream_mic;  ///< Whether to play the client microphone into a virtual microphone
   };
 
   /**
@@ -273,6 +309,41 @@ namespace config {
    */
   constexpr int ENCRYPTION_MODE_MANDATORY = 2;
 
+  /**
+   * @def QOS_PROFILE_DEFAULT
+   * @brief QoS profile: mark video with CS5 and audio with CS6, like Windows does, and leave the control stream to ENet.
+   */
+  constexpr int QOS_PROFILE_DEFAULT = 0;
+
+  /**
+   * @def QOS_PROFILE_WMM
+   * @brief QoS profile: mark traffic with the RFC 8325 classes of the WMM video and voice access categories.
+   */
+  constexpr int QOS_PROFILE_WMM = 1;
+
+  /**
+   * @brief Stages of the streaming pipeline whose threads can be placed on specific cores.
+   */
+  enum class thread_stage_e : int {
+    capture,  ///< Video capture
+    encode,  ///< Video encoding
+    video_send,  ///< Video broadcast
+    audio,  ///< Audio capture, encoding and broadcast
+    control,  ///< Control stream
+    input,  ///< Input injection
+    count  ///< Number of stages
+  };
+
+  /**
+   * @brief Placement of the threads of one pipeline stage.
+   */
+  struct thread_placement_t {
+    std::vector<int> cores;  ///< Logical processors the threads may run on, empty to not restrict them
+    int numa_node = -1;  ///< Only run on the logical processors of this NUMA node, -1 for any node
+    std::optional<int> priority;  ///< Thread priority (platf::thread_priority_e) replacing the default of the stage
+    std::string mmcss_task;  ///< MMCSS task the threads join on Windows, empty for none
+  };
+
   /**
    * @brief Streaming configuration structure.
    */
@@ -280,8 +351,21 @@ namespace config {
     std::chrono::milliseconds ping_timeout;  ///< Ping timeout duration
     std::string file_apps;  ///< Applications configuration file path
     int fec_percentage;  ///< Forward Error Correction percentage
+    int fec_spread;  ///< Milliseconds the packets of each video frame are spread over, 0 to send them at the pacing rate
     int lan_encryption_mode;  ///< Video encryption mode for LAN streams (ENCRYPTION_MODE_*)
     int wan_encryption_mode;  ///< Video encryption mode for WAN streams (ENCRYPTION_MODE_*)
+    bool lan_large_packets;  ///< Offer LAN clients video packets as large as the path MTU allows
+    bool txtime_send;  ///< Pace video packets with SO_TXTIME launch times instead of sleeping (Linux)
+    bool registered_io_send;  ///< Send batched video packets through Registered I/O buffers (Windows)
+    int video_send_threads;  ///< Number of video broadcast workers sessions are spread across
+    bool video_reuseport;  ///< Give each video broadcast worker its own socket on the video port with SO_REUSEPORT
+    int video_max_queued_frames;  ///< Frames a session may have waiting to be sent before its backlog is dropped (0 = unbounded)
+    int video_max_queued_mb;  ///< Megabytes of encoded video a session may have waiting to be sent before its backlog is dropped (0 = unbounded)
+    int qos_profile;  ///< DSCP classes video, audio and control traffic is marked with (QOS_PROFILE_*)
+    bool thread_placement_auto;  ///< Place stages without a placement on the least busy cores of the GPU's NUMA node
+    std::array<thread_placement_t, (int) thread_stage_e::count> thread_placement;  ///< Placement of each pipeline stage
+    bool performance_power_profile;  ///< Switch the host to its performance power settings while streaming (Windows, Linux)
+    bool pipeline_trace;  ///< Record per-frame spans of the pipeline stages for the trace endpoint
   };
 
   /**
@@ -307,16 +391,20 @@ namespace config {
     std::string gamepad;  ///< Gamepad configuration
     bool ds4_back_as_touchpad_click;  ///< Use DS4 back button as touchpad click
     bool motion_as_ds4;  ///< Use motion controls as DS4
+    int motion_report_rate;  ///< Rate in Hz at which motion samples are averaged into reports, 0 sends every sample
     bool touchpad_as_ds4;  ///< Use touchpad as DS4
     bool ds5_inputtino_randomize_mac;  ///< Randomize DS5 MAC address with inputtino
     bool keyboard;  ///< Enable keyboard input
     bool mouse;  ///< Enable mouse input
+    int mouse_smoothing_rate;  ///< Rate in Hz at which relative mouse movement is spread out, 0 injects it as it arrives
     bool controller;  ///< Enable controller input
     bool always_send_scancodes;  ///< Always send scancodes
     bool high_resolution_scrolling;  ///< Enable high-resolution scrolling
     bool native_pen_touch;  ///< Enable native pen/touch input
     bool enable_input_only_mode;  ///< Enable input-only mode
     bool forward_rumble;  ///< Forward rumble/haptic feedback
+    std::chrono::microseconds coalesce_delay;  ///< Time the input thread waits to batch input before injecting it
+    bool latency_tracing;  ///< Trace input through the video pipeline into the input_to_* histograms
   };
 
   namespace flag {
@@ -364,6 +452,7 @@ namespace config {
     std::string do_cmd;  ///< Command to execute
     std::string undo_cmd;  ///< Command to undo (optional)
     bool elevated;  ///< Whether to run with elevated privileges
+    bool parallel = false;  ///< Start together with the neighbouring parallel commands instead of after the previous one
   };
 
   /**
@@ -418,12 +507,18 @@ namespace config {
     std::uint16_t port;  ///< Server port
     std::string address_family;  ///< Address family (IPv4/IPv6)
     std::string log_file;  ///< Log file path
+    int log_rotate_size;  ///< MiB after which the log file is rotated, 0 to not rotate by size
+    std::chrono::hours log_rotate_age;  ///< Age after which the log file is rotated, 0 to not rotate by age
+    int log_keep_size;  ///< MiB of rotated log segments kept
     bool notify_pre_releases;  ///< Notify about pre-releases
     bool legacy_ordering;  ///< Use legacy ordering
     bool system_tray;  ///< Enable system tray
     std::vector<prep_cmd_t> prep_cmds;  ///< Pre-application commands
     std::vector<prep_cmd_t> state_cmds;  ///< State management commands
     std::vector<server_cmd_t> server_cmds;  ///< Server commands
+    std::string recording_path;  ///< Directory session recordings are written to
+    std::string fleet_broker;  ///< URL the load of the host is posted to, empty to disable
+    std::chrono::seconds fleet_report_interval;  ///< Time between two load reports
   };
 
   /**
@@ -444,7 +539,13 @@ namespace config {
     int good_stability_ms;  ///< Duration of good network required before increases
     int increase_min_interval_ms;  ///< Minimum interval between increases
     int poor_status_cap_pct;  ///< Cap reduction percentage when status is poor
+    int mode;  ///< Controller that picks the bitrate, 0 = frame loss, 1 = delay gradient
+    int delay_threshold_ms;  ///< Queuing delay that makes the delay controller back off
+    bool adaptive_fec;  ///< Trade FEC percentage against encoder bitrate
+    bool ladder;  ///< Lower the encoded resolution when the bitrate gets too low for it
+    bool ladder_halve_fps;  ///< Halve the framerate on the last rung of the resolution ladder
     int max_bitrate_cap;  ///< Maximum bitrate cap
+    int fec_percentage;  ///< FEC percentage sessions start with
   };
 
   /**
@@ -477,8 +578,43 @@ namespace config {
    */
   extern sunshine_t sunshine;
 
+  namespace nv {
+    /**
+     * @brief Parse an `nvenc_twopass` value.
+     * @param preset "disabled", "quarter_res" or "full_res".
+     * @return The two-pass mode, quarter resolution if the value is unknown.
+     */
+    nvenc::nvenc_two_pass twopass_from_view(const std::string_view &preset);
+  }  // namespace nv
+
+  namespace sw {
+    /**
+     * @brief Get the SVT-AV1 preset closest to a `sw_preset` value.
+     * @param preset The x264 preset name, e.g. "superfast".
+     * @return The preset, 8 to 12.
+     */
+    int svtav1_preset_from_view(const std::string_view &preset);
+  }  // namespace sw
+
   int parse(int argc, char *argv[]);
   std::unordered_map<std::string, std::string> parse_config(const std::string_view &file_content);
   void apply_config(std::unordered_map<std::string, std::string> &&vars);
-  auto_bitrate_settings_t get_auto_bitrate_settings();
+
+  /**
+   * @brief Derive the settings of the FFmpeg NVENC encoder from the NVENC settings in `video.nv`.
+   *        Called by `apply_config()`, and by anything else changing `video.nv` at runtime.
+   */
+  void update_nv_legacy();
+
+  /**
+   * @brief Publish the current bitrate limits, auto bitrate and FEC settings as a new immutable snapshot.
+   *        Called by `apply_config()`, so saving them from the web UI takes effect without a restart.
+   */
+  void publish_auto_bitrate_settings();
+
+  /**
+   * @brief Get the latest published snapshot, safe to call from any thread without locking.
+   * @return The settings, the reference stays valid until exit.
+   */
+  const auto_bitrate_settings_t &get_auto_bitrate_settings();
 }  // namespace config
@@ -10,6 +10,7 @@
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <limits>
 #include <set>
 #include <sstream>
 #include <thread>
@@ -18,6 +19,7 @@
 
 // lib includes
 #include <boost/algorithm/string.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/ssl/context.hpp>
 #include <boost/filesystem.hpp>
 #include <nlohmann/json.hpp>
@@ -25,18 +27,29 @@
 #include <Simple-Web-Server/server_https.hpp>
 
 // local includes
+#include "asset_cache.h"
+#include "calibration.h"
 #include "config.h"
 #include "confighttp.h"
 #include "crypto.h"
 #include "display_device.h"
 #include "file_handler.h"
 #include "globals.h"
+#include "gpu_stats.h"
 #include "httpcommon.h"
+#include "live_events.h"
+#include "log_view.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
 #include "nvhttp.h"
+#include "pipeline_trace.h"
+#include "recording.h"
 #include "platform/common.h"
 #include "process.h"
+#include "rtsp.h"
+#include "stream.h"
+#include "upnp.h"
 #include "utility.h"
 #include "uuid.h"
 
@@ -287,6 +300,51 @@ namespace confighttp {
     return true;
   }
 
+  /**
+   * @brief The static Web UI files, cached when the server starts.
+   */
+  asset_cache::cache_t web_assets;
+
+  /**
+   * @brief Send a static Web UI file, from the cache when it is cached.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @param path The path of the file, relative to the web directory.
+   * @param headers The headers of the response, the content and caching headers are added.
+   */
+  void send_asset(resp_https_t response, req_https_t request, const std::string &path, SimpleWeb::CaseInsensitiveMultimap headers) {
+    // Always revalidate, the cache answers with 304 when nothing changed
+    headers.emplace("Cache-Control", "no-cache");
+
+    auto asset = web_assets.find(path);
+    if (!asset) {
+      // Larger than the cache allows or added after the server started
+      std::ifstream in(WEB_DIR + path, std::ios::binary);
+      if (!in) {
+        not_found(response, request);
+        return;
+      }
+      response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+      return;
+    }
+
+    auto accept_encoding = request->header.find("Accept-Encoding");
+    auto encoding = asset_cache::negotiate(accept_encoding == std::end(request->header) ? ""sv : accept_encoding->second, *asset);
+    headers.emplace("ETag", asset->etag_for(encoding));
+    headers.emplace("Vary", "Accept-Encoding");
+
+    auto if_none_match = request->header.find("If-None-Match");
+    if (if_none_match != std::end(request->header) && asset_cache::not_modified(if_none_match->second, *asset)) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+      return;
+    }
+
+    if (encoding != asset_cache::encoding_e::identity) {
+      headers.emplace("Content-Encoding", std::string {asset_cache::to_string(encoding)});
+    }
+    response->write(SimpleWeb::StatusCode::success_ok, asset->body(encoding), headers);
+  }
+
   /**
    * @brief Get the index page.
    * @param response The HTTP response object.
@@ -299,12 +357,11 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "index.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/html; charset=utf-8");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_asset(response, request, "index.html", headers);
   }
 
   /**
@@ -319,12 +376,11 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "pin.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/html; charset=utf-8");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_asset(response, request, "pin.html", headers);
   }
 
   /**
@@ -339,13 +395,12 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "apps.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/html; charset=utf-8");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
     headers.emplace("Access-Control-Allow-Origin", "https://images.igdb.com/");
-    response->write(content, headers);
+    send_asset(response, request, "apps.html", headers);
   }
 
   /**
@@ -360,12 +415,11 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "clients.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/html; charset=utf-8");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_asset(response, request, "clients.html", headers);
   }
 
   /**
@@ -380,12 +434,11 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "config.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/html; charset=utf-8");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_asset(response, request, "config.html", headers);
   }
 
   /**
@@ -400,12 +453,11 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "password.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/html; charset=utf-8");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_asset(response, request, "password.html", headers);
   }
 
   /**
@@ -425,12 +477,11 @@ namespace confighttp {
       return;
     }
 
-    std::string content = file_handler::read_file(WEB_DIR "login.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/html; charset=utf-8");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_asset(response, request, "login.html", headers);
   }
 
   /**
@@ -446,12 +497,11 @@ namespace confighttp {
       return;
     }
 
-    std::string content = file_handler::read_file(WEB_DIR "welcome.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/html; charset=utf-8");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_asset(response, request, "welcome.html", headers);
   }
 
   /**
@@ -466,12 +516,11 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "troubleshooting.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/html; charset=utf-8");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_asset(response, request, "troubleshooting.html", headers);
   }
 
   /**
@@ -482,12 +531,11 @@ namespace confighttp {
   void getFaviconImage(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    std::ifstream in(WEB_DIR "images/apollo.ico", std::ios::binary);
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "image/x-icon");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_asset(response, request, "images/apollo.ico", headers);
   }
 
   /**
@@ -501,12 +549,11 @@ namespace confighttp {
   void getApolloLogoImage(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    std::ifstream in(WEB_DIR "images/logo-apollo-45.png", std::ios::binary);
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "image/png");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_asset(response, request, "images/logo-apollo-45.png", headers);
   }
 
   /**
@@ -528,6 +575,20 @@ namespace confighttp {
   void getNodeModules(resp_https_t response, req_https_t request) {
     print_req(request);
 
+    // Cached files are known to be in the web directory, so they can be served without checking the disk
+    auto cachedPath = fs::path(request->path).relative_path().lexically_normal().generic_string();
+    if (cachedPath.starts_with("assets/") && fs::path(cachedPath).has_extension() && web_assets.find(cachedPath)) {
+      auto mimeType = mime_types.find(fs::path(cachedPath).extension().string().substr(1));
+      if (mimeType != mime_types.end()) {
+        SimpleWeb::CaseInsensitiveMultimap headers;
+        headers.emplace("Content-Type", mimeType->second);
+        headers.emplace("X-Frame-Options", "DENY");
+        headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+        send_asset(response, request, cachedPath, headers);
+        return;
+      }
+    }
+
     fs::path webDirPath(WEB_DIR);
     fs::path nodeModulesPath(webDirPath / "assets");
 
@@ -558,8 +619,7 @@ namespace confighttp {
     headers.emplace("Content-Type", mimeType->second);
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    std::ifstream in(filePath.string(), std::ios::binary);
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_asset(response, request, relPath.generic_string(), headers);
   }
 
   /**
@@ -1085,6 +1145,7 @@ namespace confighttp {
       
       // Update in-memory config values immediately so algorithm uses new values
       config::apply_config(std::move(config_vars));
+      nvhttp::invalidate_cached_responses();
       
       // Write to config file for persistence
       file_handler::write_file(config::sunshine.config_file.c_str(), config_stream.str());
@@ -1146,12 +1207,178 @@ namespace confighttp {
     }
   }
 
+  namespace {
+    /**
+     * @brief The running server, its io_service drives the timers of followed logs.
+     */
+    https_server_t *running_server = nullptr;
+
+    /**
+     * @brief State of a log followed with Server-Sent Events.
+     */
+    struct log_follower_t {
+      resp_https_t response;
+      int min_level;
+      log_view::file_view_t view;
+      log_view::level_filter_t filter;
+      std::uint64_t offset;  ///< End of the lines sent so far
+      std::uint64_t generation;  ///< Rotations of the log file when it was opened
+      boost::asio::steady_timer timer;
+      std::chrono::steady_clock::time_point last_send;  ///< When the last event or keep-alive was sent
+    };
+
+    /**
+     * @brief Get the headers shared by the log responses.
+     * @param content_type The content type of the response.
+     * @return The headers.
+     */
+    SimpleWeb::CaseInsensitiveMultimap log_headers(std::string content_type) {
+  #ifdef _WIN32
+      content_type += "; charset=";
+      content_type += currentCodePageToCharset();
+  #endif
+      SimpleWeb::CaseInsensitiveMultimap headers;
+      headers.emplace("Content-Type", content_type);
+      headers.emplace("Accept-Ranges", "bytes");
+      headers.emplace("X-Frame-Options", "DENY");
+      headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+      return headers;
+    }
+
+    /**
+     * @brief Send part of the log file one chunk at a time, the next chunk is read once the last one is sent.
+     * @param response The HTTP response object, its headers already written.
+     * @param view The log file.
+     * @param offset The first byte to send.
+     * @param end One past the last byte to send.
+     */
+    void send_log_chunks(resp_https_t response, std::shared_ptr<log_view::file_view_t> view, std::uint64_t offset, std::uint64_t end) {
+      if (offset >= end) {
+        return;
+      }
+
+      auto chunk = view->read(offset, (std::size_t) std::min<std::uint64_t>(log_view::chunk_size, end - offset));
+      if (chunk.empty()) {
+        // The file was truncated, the response can't be completed
+        response->close_connection_after_response = true;
+        return;
+      }
+
+      *response << chunk;
+      response->send([response, view, offset = offset + chunk.size(), end](const SimpleWeb::error_code &ec) {
+        if (!ec) {
+          send_log_chunks(response, view, offset, end);
+        }
+      });
+    }
+
+    /**
+     * @brief Format lines as a Server-Sent Event.
+     * @param lines The lines, each ending with a line break.
+     * @param offset The offset following the lines, the client can resume from it.
+     * @return The event.
+     */
+    std::string log_event(std::string_view lines, std::uint64_t offset) {
+      std::string event = "id: " + std::to_string(offset) + "\n";
+      while (!lines.empty()) {
+        auto line_break = lines.find('\n');
+        auto line = lines.substr(0, line_break);
+        if (line.ends_with('\r')) {
+          line.remove_suffix(1);
+        }
+
+        event += "data: ";
+        event += line;
+        event += '\n';
+
+        lines.remove_prefix(line_break == std::string_view::npos ? lines.size() : line_break + 1);
+      }
+      event += '\n';
+      return event;
+    }
+
+    /**
+     * @brief Wait for new lines in a followed log and send them.
+     * @param follower The followed log, it stops on the first failed send.
+     */
+    void follow_log(std::shared_ptr<log_follower_t> follower) {
+      follower->timer.expires_after(500ms);
+      follower->timer.async_wait([follower](const boost::system::error_code &ec) {
+        if (ec) {
+          return;
+        }
+
+        std::string event;
+        if (auto generation = logging::log_generation(); generation != follower->generation) {
+          // The log was rotated, the view still reads the segment, start over with the new file below
+          follower->generation = generation;
+          follower->view = log_view::file_view_t {config::sunshine.log_file};
+          follower->offset = std::numeric_limits<std::uint64_t>::max();
+        }
+
+        auto size = follower->view.size();
+        if (size < follower->offset) {
+          // The log was replaced, start over
+          follower->offset = 0;
+          follower->filter = log_view::level_filter_t {follower->min_level};
+          event = "event: reset\ndata:\n\n";
+        }
+
+        auto end = std::min<std::uint64_t>(size, follower->offset + log_view::max_response_size);
+        auto lines = follower->view.read_lines(follower->offset, end);
+        if (lines.empty() && end - follower->offset == log_view::max_response_size) {
+          // A single line longer than any response
+          lines = follower->view.read(follower->offset, log_view::max_response_size);
+        }
+        follower->offset += lines.size();
+
+        auto now = std::chrono::steady_clock::now();
+        if (auto kept = follower->filter(lines); !kept.empty()) {
+          event += log_event(kept, follower->offset);
+        } else if (event.empty() && now - follower->last_send >= 15s) {
+          event = ": keep-alive\n\n";
+        }
+
+        if (event.empty()) {
+          follow_log(follower);
+          return;
+        }
+
+        follower->last_send = now;
+        *follower->response << event;
+        follower->response->send([follower](const SimpleWeb::error_code &ec) {
+          if (!ec) {
+            follow_log(follower);
+          }
+        });
+      });
+    }
+  }  // namespace
+
   /**
    * @brief Get the logs from the log file.
    * @param response The HTTP response object.
    * @param request The HTTP request object.
    *
+   * The log file is read in chunks, it is never loaded whole. The response depends on the request:
+   * - A `Range` header returns those bytes, as a `206 Partial Content` response.
+   * - `offset=<byte>` returns the complete lines written since that offset, for incremental polling.
+   *   `X-Log-Reset` is set when the log is shorter than the offset, the lines are then from the start.
+   * - `tail=<lines>` returns the last lines, `level=<name|number>` keeps only the entries at or above that level.
+   * - `follow=1` returns the last lines and keeps sending the new ones as Server-Sent Events.
+   *   A `reset` event is sent when the log is rotated, the lines that follow are from the new log file.
+   * - Without any of them the whole file is returned.
+   *
+   * `X-Log-Offset` is the offset following the returned lines, to pass as `offset` on the next request.
+   * `X-Log-Generation` counts the rotations of the log file. When it's passed back as `generation` along
+   * with `offset`, the lines are returned from the start of the new log file if it was rotated since.
+   *
+   * `segment=<name>` reads a rotated segment listed by @ref getLogSegments instead of the log file.
+   * Compressed segments are returned as they are, as `application/gzip`, whole or by `Range`.
+   *
    * @api_examples{/api/logs| GET| null}
+   * @api_examples{/api/logs?tail=1000&level=warning| GET| null}
+   * @api_examples{/api/logs?segment=sunshine-20240101-120000.log.gz| GET| null}
    */
   void getLogs(resp_https_t response, req_https_t request) {
     if (!authenticate(response, request)) {
@@ -1159,17 +1386,476 @@ namespace confighttp {
     }
 
     print_req(request);
-    std::string content = file_handler::read_file(config::sunshine.log_file.c_str());
+
+    auto args = request->parse_query_string();
+    auto arg = [&args](const std::string &name) -> std::optional<std::string> {
+      auto it = args.find(name);
+      return it == std::end(args) ? std::nullopt : std::optional {it->second};
+    };
+
+    // Sample the generation first, a rotation while the file is opened is then caught on the next request
+    auto generation = logging::log_generation();
+    std::string path = config::sunshine.log_file;
+    std::optional<log_rotation::segment_t> segment;
+    if (auto name = arg("segment")) {
+      for (auto &candidate : logging::log_segments()) {
+        if (candidate.name == *name) {
+          segment = candidate;
+        }
+      }
+      if (!segment) {
+        not_found(response, request);
+        return;
+      }
+      path = (std::filesystem::path {config::sunshine.log_file}.parent_path() / segment->name).string();
+    }
+
+    auto view = std::make_shared<log_view::file_view_t>(path);
+    if (!view->is_open()) {
+      not_found(response, request);
+      return;
+    }
+    auto size = view->size();
+
+    auto headers = log_headers(segment && segment->compressed ? "application/gzip" : "text/plain");
+    if (!segment) {
+      headers.emplace("X-Log-Generation", std::to_string(generation));
+    }
+
+    if (auto range_header = request->header.find("Range"); range_header != std::end(request->header)) {
+      auto range = log_view::parse_range(range_header->second, size);
+      if (!range) {
+        headers.emplace("Content-Range", "bytes */" + std::to_string(size));
+        response->write(SimpleWeb::StatusCode::client_error_range_not_satisfiable, headers);
+        return;
+      }
+
+      headers.emplace("Content-Range", "bytes " + std::to_string(range->begin) + '-' + std::to_string(range->end - 1) + '/' + std::to_string(size));
+      headers.emplace("Content-Length", std::to_string(range->end - range->begin));
+      response->write(SimpleWeb::StatusCode::success_partial_content, headers);
+      send_log_chunks(response, view, range->begin, range->end);
+      return;
+    }
+
+    if (segment && segment->compressed && (arg("level") || arg("tail") || arg("follow") || arg("offset"))) {
+      bad_request(response, request, "Compressed segments can only be downloaded");
+      return;
+    }
+    if (segment && arg("follow")) {
+      bad_request(response, request, "Only the log file can be followed");
+      return;
+    }
+
+    int min_level = 0;
+    if (auto level = arg("level")) {
+      auto parsed = log_view::level_from_string(*level);
+      if (!parsed) {
+        bad_request(response, request, "Invalid log level");
+        return;
+      }
+      min_level = *parsed;
+    }
+
+    std::optional<std::size_t> tail;
+    try {
+      if (auto lines = arg("tail")) {
+        tail = std::stoul(*lines);
+      }
+    } catch (const std::exception &) {
+      bad_request(response, request, "Invalid tail");
+      return;
+    }
+
+    if (arg("follow") == "1"sv) {
+      headers.erase("Content-Type");
+      headers.emplace("Content-Type", "text/event-stream");
+      headers.emplace("Cache-Control", "no-cache");
+
+      auto end = view->lines_end(size);
+      auto follower = std::make_shared<log_follower_t>(log_follower_t {
+        response,
+        min_level,
+        log_view::file_view_t {config::sunshine.log_file},
+        log_view::level_filter_t {min_level},
+        end,
+        generation,
+        boost::asio::steady_timer {*running_server->io_service},
+        std::chrono::steady_clock::now(),
+      });
+
+      // The stream only ends when the connection does
+      response->close_connection_after_response = true;
+      response->write(SimpleWeb::StatusCode::success_ok, headers);
+      *response << log_event(view->tail(tail.value_or(1000), min_level, end), end);
+      response->send([follower](const SimpleWeb::error_code &ec) {
+        if (!ec) {
+          follow_log(follower);
+        }
+      });
+      return;
+    }
+
+    std::string content;
+    std::uint64_t end = size;
+    if (auto offset_arg = arg("offset")) {
+      std::uint64_t offset;
+      try {
+        offset = std::stoull(*offset_arg);
+      } catch (const std::exception &) {
+        bad_request(response, request, "Invalid offset");
+        return;
+      }
+
+      auto rotated = !segment && arg("generation") && *arg("generation") != std::to_string(generation);
+      if (offset > size || rotated) {
+        headers.emplace("X-Log-Reset", "1");
+        offset = 0;
+      }
+
+      content = view->read_lines(offset, std::min<std::uint64_t>(size, offset + log_view::max_response_size));
+      end = offset + content.size();
+      content = log_view::level_filter_t {min_level}(content);
+    } else if (tail || min_level > 0) {
+      end = view->lines_end(size);
+      content = view->tail(tail.value_or(std::numeric_limits<std::size_t>::max()), min_level, end);
+    } else {
+      headers.emplace("X-Log-Offset", std::to_string(size));
+      headers.emplace("Content-Length", std::to_string(size));
+      response->write(SimpleWeb::StatusCode::success_ok, headers);
+      send_log_chunks(response, view, 0, size);
+      return;
+    }
+
+    headers.emplace("X-Log-Offset", std::to_string(end));
+    response->write(SimpleWeb::StatusCode::success_ok, content, headers);
+  }
+
+  /**
+   * @brief Get the rotated segments of the log file.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * Each segment lists its name, to pass as `segment` to @ref getLogs, the times of its first and last
+   * entries in milliseconds since the epoch, its size and whether it's compressed yet. The oldest come first,
+   * the log file itself follows the last one.
+   *
+   * @api_examples{/api/logs/segments| GET| null}
+   */
+  void getLogSegments(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto segments = nlohmann::json::array();
+    for (auto &segment : logging::log_segments()) {
+      segments.push_back({
+        {"name", segment.name},
+        {"begin", std::chrono::duration_cast<std::chrono::milliseconds>(segment.begin.time_since_epoch()).count()},
+        {"end", std::chrono::duration_cast<std::chrono::milliseconds>(segment.end.time_since_epoch()).count()},
+        {"size", segment.size},
+        {"compressed", segment.compressed},
+      });
+    }
+
+    nlohmann::json output_tree;
+    output_tree["segments"] = std::move(segments);
+    output_tree["generation"] = logging::log_generation();
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Get the latency histograms and event counters of the streaming pipeline.
+   * @return The metrics, as returned by @ref getMetrics and pushed by @ref getEvents.
+   */
+  nlohmann::json metrics_tree() {
+    nlohmann::json output_tree;
+
+    nlohmann::json histograms = nlohmann::json::object();
+    for (auto histogram : metrics::histograms()) {
+      auto snapshot = histogram->snapshot();
+
+      nlohmann::json entry;
+      entry["count"] = snapshot.count;
+      entry["avg_us"] = snapshot.count ? snapshot.sum_us / snapshot.count : 0;
+      entry["p50_us"] = snapshot.percentile(0.5);
+      entry["p90_us"] = snapshot.percentile(0.9);
+      entry["p99_us"] = snapshot.percentile(0.99);
+      entry["p999_us"] = snapshot.percentile(0.999);
+      entry["max_us"] = snapshot.percentile(1.0);
+      histograms[histogram->name()] = std::move(entry);
+    }
+    output_tree["histograms"] = std::move(histograms);
+
+    nlohmann::json counters = nlohmann::json::object();
+    for (auto counter : metrics::counters()) {
+      counters[counter->name()] = counter->value();
+    }
+    output_tree["counters"] = std::move(counters);
+
+    // Empty while not streaming or if the driver doesn't report the value
+    auto utilization = gpu_stats::latest();
+    nlohmann::json gpu;
+    gpu["encoder_utilization"] = utilization.encoder ? nlohmann::json(*utilization.encoder) : nlohmann::json();
+    gpu["render_utilization"] = utilization.render ? nlohmann::json(*utilization.render) : nlohmann::json();
+    gpu["clock_mhz"] = utilization.clock_mhz ? nlohmann::json(*utilization.clock_mhz) : nlohmann::json();
+    gpu["contended"] = gpu_stats::contended();
+    output_tree["gpu"] = std::move(gpu);
+
+    auto usage = platf::memory_usage();
+    nlohmann::json memory;
+    memory["resident_bytes"] = usage.resident ? nlohmann::json(*usage.resident) : nlohmann::json();
+    memory["video_bytes"] = usage.video ? nlohmann::json(*usage.video) : nlohmann::json();
+    output_tree["memory"] = std::move(memory);
+
+    output_tree["upnp_mapped_ports"] = upnp::mapped_ports();
+    return output_tree;
+  }
+
+  /**
+   * @brief Get the latency histograms and event counters of the streaming pipeline.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * All values are in microseconds and cover every sample since Sunshine started.
+   * Percentiles are the upper bound of their histogram bucket. The latest GPU utilization in
+   * percent, sampled every second while streaming, is reported under `gpu`.
+   *
+   * @api_examples{/api/metrics| GET| null}
+   */
+  void getMetrics(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto output_tree = metrics_tree();
+    output_tree["status"] = true;
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Escape a label value for the OpenMetrics text format.
+   * @param value The raw label value.
+   * @return The escaped label value.
+   */
+  std::string escape_label(const std::string_view &value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (auto ch : value) {
+      switch (ch) {
+        case '\\':
+          escaped += "\\\\";
+          break;
+        case '"':
+          escaped += "\\\"";
+          break;
+        case '\n':
+          escaped += "\\n";
+          break;
+        default:
+          escaped += ch;
+      }
+    }
+    return escaped;
+  }
+
+  /**
+   * @brief Get the streaming statistics in the OpenMetrics text format.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * Per-session counters and gauges are labeled with the client's UUID. The latency
+   * histograms from @ref getMetrics are exported as summaries and its event counters
+   * as a single counter family.
+   *
+   * @api_examples{/api/metrics/openmetrics| GET| null}
+   */
+  void getOpenMetrics(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    std::vector<std::pair<std::string, std::shared_ptr<stream::session_t>>> sessions;
+    for (auto &uuid : rtsp_stream::get_all_session_uuids()) {
+      if (auto session = rtsp_stream::find_session(uuid)) {
+        sessions.emplace_back("{uuid=\"" + escape_label(uuid) + "\",device=\"" + escape_label(session->device_name) + "\"}", std::move(session));
+      }
+    }
+
+    std::ostringstream out;
+    auto family = [&](std::string_view name, std::string_view type, std::string_view help, std::string_view unit = {}) {
+      out << "# TYPE apollo_"sv << name << ' ' << type << '\n';
+      if (!unit.empty()) {
+        out << "# UNIT apollo_"sv << name << ' ' << unit << '\n';
+      }
+      out << "# HELP apollo_"sv << name << ' ' << help << '\n';
+    };
+    auto per_session = [&](std::string_view name, std::string_view suffix, auto get) {
+      for (auto &[labels, session] : sessions) {
+        out << "apollo_"sv << name << suffix << labels << ' ' << get(session->stats) << '\n';
+      }
+    };
+
+    family("session_frames_sent"sv, "counter"sv, "Video frames sent."sv);
+    per_session("session_frames_sent"sv, "_total"sv, [](auto &stats) {
+      return stats.frames_sent.load(std::memory_order_relaxed);
+    });
+    family("session_packets_sent"sv, "counter"sv, "Video packets sent, including FEC packets."sv);
+    per_session("session_packets_sent"sv, "_total"sv, [](auto &stats) {
+      return stats.packets_sent.load(std::memory_order_relaxed);
+    });
+    family("session_fec_packets_sent"sv, "counter"sv, "Video FEC packets sent."sv);
+    per_session("session_fec_packets_sent"sv, "_total"sv, [](auto &stats) {
+      return stats.fec_packets_sent.load(std::memory_order_relaxed);
+    });
+    family("session_packets_retransmitted"sv, "counter"sv, "Video packets sent again on request of the client."sv);
+    per_session("session_packets_retransmitted"sv, "_total"sv, [](auto &stats) {
+      return stats.packets_retransmitted.load(std::memory_order_relaxed);
+    });
+    family("session_sent_bytes"sv, "counter"sv, "Video bytes sent, including packet headers."sv, "bytes"sv);
+    per_session("session_sent_bytes"sv, "_total"sv, [](auto &stats) {
+      return stats.bytes_sent.load(std::memory_order_relaxed);
+    });
+    family("session_frame_latency_seconds"sv, "gauge"sv, "Host processing latency of the last frame sent."sv, "seconds"sv);
+    per_session("session_frame_latency_seconds"sv, ""sv, [](auto &stats) {
+      return stats.frame_latency_us.load(std::memory_order_relaxed) / 1e6;
+    });
+    family("session_audio_latency_seconds"sv, "gauge"sv, "Host latency from capture to send of the last audio packet."sv, "seconds"sv);
+    per_session("session_audio_latency_seconds"sv, ""sv, [](auto &stats) {
+      return stats.audio_latency_us.load(std::memory_order_relaxed) / 1e6;
+    });
+    family("session_av_skew_seconds"sv, "gauge"sv, "Audio host latency minus video host latency, positive when audio lags behind."sv, "seconds"sv);
+    per_session("session_av_skew_seconds"sv, ""sv, [](auto &stats) {
+      return stats.av_skew_us.load(std::memory_order_relaxed) / 1e6;
+    });
+    family("session_bitrate_kbps"sv, "gauge"sv, "Current encoder bitrate in kilobits per second."sv);
+    per_session("session_bitrate_kbps"sv, ""sv, [](auto &stats) {
+      return stats.bitrate_kbps.load(std::memory_order_relaxed);
+    });
+    family("session_bitrate_adjustments"sv, "counter"sv, "Successful automatic bitrate adjustments."sv);
+    per_session("session_bitrate_adjustments"sv, "_total"sv, [](auto &stats) {
+      return stats.bitrate_adjustments.load(std::memory_order_relaxed);
+    });
+    family("session_loss_ratio"sv, "gauge"sv, "Frame loss reported by the client."sv, "ratio"sv);
+    per_session("session_loss_ratio"sv, ""sv, [](auto &stats) {
+      return stats.loss_percentage.load(std::memory_order_relaxed) / 100.0;
+    });
+    family("session_video_dscp"sv, "gauge"sv, "DSCP value the OS marks video traffic with, 0 if unmarked."sv);
+    per_session("session_video_dscp"sv, ""sv, [](auto &stats) {
+      return stats.video_dscp.load(std::memory_order_relaxed);
+    });
+    family("session_audio_dscp"sv, "gauge"sv, "DSCP value the OS marks audio traffic with, 0 if unmarked."sv);
+    per_session("session_audio_dscp"sv, ""sv, [](auto &stats) {
+      return stats.audio_dscp.load(std::memory_order_relaxed);
+    });
+    family("session_control_dscp"sv, "gauge"sv, "DSCP value the OS marks control stream traffic with, 0 if unmarked or left to ENet."sv);
+    per_session("session_control_dscp"sv, ""sv, [](auto &stats) {
+      return stats.control_dscp.load(std::memory_order_relaxed);
+    });
+    family("session_queued_video_bytes"sv, "gauge"sv, "Encoded video waiting to be sent, 0 while the video queue is unbounded."sv, "bytes"sv);
+    per_session("session_queued_video_bytes"sv, ""sv, [](auto &stats) {
+      return stats.queued_video_bytes.load(std::memory_order_relaxed);
+    });
+    family("session_retransmit_buffer_bytes"sv, "gauge"sv, "Memory taken by the video packets kept for retransmission."sv, "bytes"sv);
+    for (auto &[labels, session] : sessions) {
+      out << "apollo_session_retransmit_buffer_bytes"sv << labels << ' ' << session->video.retransmit.bytes() << '\n';
+    }
+    family("session_budget_drops"sv, "counter"sv, "Video backlogs cut down for exceeding the memory budget of the session."sv);
+    per_session("session_budget_drops"sv, "_total"sv, [](auto &stats) {
+      return stats.budget_drops.load(std::memory_order_relaxed);
+    });
+
+    family("stage_latency_seconds"sv, "summary"sv, "Latency of each stage of the streaming pipeline."sv, "seconds"sv);
+    for (auto histogram : metrics::histograms()) {
+      auto snapshot = histogram->snapshot();
+      auto labels = "stage=\"" + escape_label(histogram->name()) + '"';
+      for (auto quantile : {0.5, 0.9, 0.99, 0.999}) {
+        out << "apollo_stage_latency_seconds{"sv << labels << ",quantile=\""sv << quantile << "\"} "sv << snapshot.percentile(quantile) / 1e6 << '\n';
+      }
+      out << "apollo_stage_latency_seconds_count{"sv << labels << "} "sv << snapshot.count << '\n';
+      out << "apollo_stage_latency_seconds_sum{"sv << labels << "} "sv << snapshot.sum_us / 1e6 << '\n';
+    }
+
+    family("events"sv, "counter"sv, "Host events counted since startup."sv);
+    for (auto counter : metrics::counters()) {
+      out << "apollo_events_total{event=\""sv << escape_label(counter->name()) << "\"} "sv << counter->value() << '\n';
+    }
+
+    auto utilization = gpu_stats::latest();
+    family("gpu_encoder_utilization_ratio"sv, "gauge"sv, "Utilization of the video encode engine of the GPU while streaming."sv, "ratio"sv);
+    if (utilization.encoder) {
+      out << "apollo_gpu_encoder_utilization_ratio "sv << *utilization.encoder / 100.0 << '\n';
+    }
+    family("gpu_3d_utilization_ratio"sv, "gauge"sv, "Utilization of the 3D engine of the GPU while streaming."sv, "ratio"sv);
+    if (utilization.render) {
+      out << "apollo_gpu_3d_utilization_ratio "sv << *utilization.render / 100.0 << '\n';
+    }
+    family("gpu_clock_hertz"sv, "gauge"sv, "Graphics clock of the GPU while streaming."sv, "hertz"sv);
+    if (utilization.clock_mhz) {
+      out << "apollo_gpu_clock_hertz "sv << *utilization.clock_mhz * 1000000.0 << '\n';
+    }
+    family("gpu_contended"sv, "gauge"sv, "1 while the 3D engine saturates the GPU, 0 otherwise."sv);
+    out << "apollo_gpu_contended "sv << (gpu_stats::contended() ? 1 : 0) << '\n';
+
+    auto usage = platf::memory_usage();
+    family("resident_memory_bytes"sv, "gauge"sv, "Physical memory used by the host process."sv, "bytes"sv);
+    if (usage.resident) {
+      out << "apollo_resident_memory_bytes "sv << *usage.resident << '\n';
+    }
+    family("video_memory_bytes"sv, "gauge"sv, "Dedicated video memory used by the host process."sv, "bytes"sv);
+    if (usage.video) {
+      out << "apollo_video_memory_bytes "sv << *usage.video << '\n';
+    }
+
+    family("upnp_mapped_ports"sv, "gauge"sv, "Ports currently mapped on the router through UPnP."sv);
+    out << "apollo_upnp_mapped_ports "sv << upnp::mapped_ports() << '\n';
+
+    out << "# EOF\n"sv;
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "application/openmetrics-text; version=1.0.0; charset=utf-8");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(SimpleWeb::StatusCode::success_ok, out.str(), headers);
+  }
+
+  /**
+   * @brief Get the per-frame spans of the streaming pipeline recorded with `pipeline_trace` enabled.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * The trace holds the latest spans of every pipeline thread: capture, convert, encode, FEC,
+   * encryption and each send batch of the video frames, and the injection of input. It is a
+   * Chrome trace JSON, or a Perfetto protobuf with `format=perfetto`; both open in ui.perfetto.dev.
+   *
+   * @api_examples{/api/trace?format=perfetto| GET| null}
+   */
+  void getTrace(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto args = request->parse_query_string();
+    auto format = args.find("format");
+    auto perfetto = format != std::end(args) && format->second == "perfetto"sv;
+    if (format != std::end(args) && !perfetto && format->second != "chrome"sv) {
+      bad_request(response, request, "Invalid trace format");
+      return;
+    }
+
     SimpleWeb::CaseInsensitiveMultimap headers;
-    std::string contentType = "text/plain";
-  #ifdef _WIN32
-    contentType += "; charset=";
-    contentType += currentCodePageToCharset();
-  #endif
-    headers.emplace("Content-Type", contentType);
+    headers.emplace("Content-Type", perfetto ? "application/octet-stream" : "application/json");
+    headers.emplace("Content-Disposition", perfetto ? "attachment; filename=\"apollo.perfetto-trace\"" : "attachment; filename=\"apollo-trace.json\"");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, content, headers);
+    response->write(SimpleWeb::StatusCode::success_ok, perfetto ? pipeline_trace::perfetto_proto() : pipeline_trace::chrome_json(), headers);
   }
 
   /**
@@ -1316,6 +2002,324 @@ namespace confighttp {
     }
   }
 
+  /**
+   * @brief Get the progress of the app launches and resumes of the clients.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * Launches run one at a time, `queued` counts the waiting ones along with the running one.
+   *
+   * @api_examples{/api/launch-progress| GET| null}
+   */
+  void getLaunchProgress(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    send_response(response, nvhttp::launch_progress());
+  }
+
+  namespace {
+    /**
+     * @brief Sends the events of a dashboard subscriber on its response.
+     */
+    class response_sink_t: public live_events::sink_t {
+    public:
+      explicit response_sink_t(resp_https_t response):
+          response {std::move(response)} {
+      }
+
+      void send(std::string &&events, std::function<void(bool)> &&done) override {
+        *response << events;
+        response->send([done = std::move(done)](const SimpleWeb::error_code &ec) {
+          done(!ec);
+        });
+      }
+
+    private:
+      resp_https_t response;
+    };
+
+    live_events::hub_t dashboard;
+    std::unique_ptr<boost::asio::steady_timer> dashboard_timer;  ///< Runs while the dashboard has subscribers
+
+    /**
+     * @brief Get the active streaming sessions and their statistics.
+     * @return The sessions.
+     */
+    nlohmann::json sessions_tree() {
+      nlohmann::json sessions = nlohmann::json::array();
+      for (auto &uuid : rtsp_stream::get_all_session_uuids()) {
+        auto session = rtsp_stream::find_session(uuid);
+        if (!session) {
+          continue;
+        }
+
+        auto &stats = session->stats;
+        nlohmann::json entry;
+        entry["uuid"] = uuid;
+        entry["name"] = session->device_name;
+        entry["frames_sent"] = stats.frames_sent.load(std::memory_order_relaxed);
+        entry["bytes_sent"] = stats.bytes_sent.load(std::memory_order_relaxed);
+        entry["packets_retransmitted"] = stats.packets_retransmitted.load(std::memory_order_relaxed);
+        entry["frame_latency_us"] = stats.frame_latency_us.load(std::memory_order_relaxed);
+        entry["audio_latency_us"] = stats.audio_latency_us.load(std::memory_order_relaxed);
+        entry["bitrate_kbps"] = stats.bitrate_kbps.load(std::memory_order_relaxed);
+        entry["loss_percentage"] = stats.loss_percentage.load(std::memory_order_relaxed);
+        entry["rtt_ms"] = session->control.rtt.load(std::memory_order_relaxed);
+        entry["memory_bytes"] = stats.queued_video_bytes.load(std::memory_order_relaxed) + session->video.retransmit.bytes();
+        sessions.push_back(std::move(entry));
+      }
+      return sessions;
+    }
+
+    /**
+     * @brief Refresh the sections of the dashboard and send their changes, every tick while anyone subscribes.
+     */
+    void tick_dashboard() {
+      if (!dashboard.subscribers()) {
+        dashboard_timer.reset();
+        return;
+      }
+
+      dashboard.publish("sessions"sv, sessions_tree().dump());
+      dashboard.publish("clients"sv, nvhttp::get_all_clients().dump());
+      dashboard.publish("metrics"sv, metrics_tree().dump());
+      dashboard.publish("launch"sv, nvhttp::launch_progress().dump());
+      dashboard.publish("calibration"sv, calibration::status().dump());
+      dashboard.flush(std::chrono::steady_clock::now());
+
+      dashboard_timer->expires_after(live_events::tick_interval);
+      dashboard_timer->async_wait([](const boost::system::error_code &ec) {
+        if (!ec) {
+          tick_dashboard();
+        }
+      });
+    }
+  }  // namespace
+
+  /**
+   * @brief Follow the dashboard with Server-Sent Events instead of polling.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * Every section is sent when subscribing, after that only the sections that changed, as an event
+   * named after the section holding the same JSON as its polled endpoint:
+   * - `sessions`: the active streaming sessions and their statistics.
+   * - `clients`: the paired clients, as `named_certs` of `GET /api/clients/list`.
+   * - `metrics`: as `GET /api/metrics`.
+   * - `launch`: as `GET /api/launch-progress`.
+   * - `calibration`: as `GET /api/calibration`.
+   *
+   * The sections are refreshed every second, `interval=<seconds>` (1 to 60, default 1) sends the
+   * changes less often. The log is followed separately with `GET /api/logs?follow=1`.
+   *
+   * @api_examples{/api/events?interval=5| GET| null}
+   */
+  void getEvents(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto args = request->parse_query_string();
+    std::chrono::seconds interval = live_events::min_interval;
+    if (auto it = args.find("interval"); it != std::end(args)) {
+      try {
+        interval = std::chrono::seconds {std::stoi(it->second)};
+      } catch (const std::exception &) {
+        bad_request(response, request, "Invalid interval");
+        return;
+      }
+    }
+
+    if (!dashboard.subscribe(std::make_shared<response_sink_t>(response), interval)) {
+      response->write(SimpleWeb::StatusCode::server_error_service_unavailable, "Too many dashboard subscribers");
+      return;
+    }
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "text/event-stream");
+    headers.emplace("Cache-Control", "no-cache");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+
+    // The stream only ends when the connection does, the headers go out with the first events
+    response->close_connection_after_response = true;
+    response->write(SimpleWeb::StatusCode::success_ok, headers);
+
+    if (!dashboard_timer) {
+      dashboard_timer = std::make_unique<boost::asio::steady_timer>(*running_server->io_service);
+      tick_dashboard();
+    }
+  }
+
+  /**
+   * @brief Get the state of the encoder calibration and the results of the latest one.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * Each trial lists the settings it tried, and the framerate and per-frame latency it reached
+   * at each resolution. `recommended` holds the settings to use, `meets_target` tells whether
+   * they reach the target framerate with headroom.
+   *
+   * @api_examples{/api/calibration| GET| null}
+   */
+  void getCalibration(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    send_response(response, calibration::status());
+  }
+
+  /**
+   * @brief Start calibrating the encoder settings in the background.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * The body for the post request should be JSON serialized in the following format:
+   * @code{.json}
+   * {
+   *   "fps": 60,
+   *   "apply": false
+   * }
+   * @endcode
+   *
+   * Both fields are optional. With `apply`, the recommended settings are applied and saved to the config file.
+   * The calibration can't start while a client is streaming, the progress is reported by `GET /api/calibration`.
+   *
+   * @api_examples{/api/calibration| POST| {"fps":120,"apply":true}}
+   */
+  void startCalibration(resp_https_t response, req_https_t request) {
+    if (!validateContentType(response, request, "application/json") || !authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    std::stringstream ss;
+    ss << request->content.rdbuf();
+    try {
+      auto input_tree = ss.str().empty() ? nlohmann::json::object() : nlohmann::json::parse(ss);
+      auto fps = input_tree.value("fps", calibration::default_target_fps);
+      if (fps < 1 || fps > 1000) {
+        bad_request(response, request, "Invalid target framerate");
+        return;
+      }
+
+      nlohmann::json output_tree;
+      output_tree["status"] = calibration::start(fps, input_tree.value("apply", false));
+      send_response(response, output_tree);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "StartCalibration: "sv << e.what();
+      bad_request(response, request, e.what());
+    }
+  }
+
+  /**
+   * @brief Get the sessions being recorded.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * Each recording lists the client's UUID and device name, the file, and how many frames were written
+   * and dropped. Frames are dropped rather than delaying the stream when the disk can't keep up.
+   *
+   * @api_examples{/api/recording| GET| null}
+   */
+  void getRecordings(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    nlohmann::json output_tree;
+    output_tree["recordings"] = recording::status();
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Start recording a session to a file in the `recording_path` directory.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * The body for the post request should be JSON serialized in the following format:
+   * @code{.json}
+   * {
+   *   "uuid": "<uuid>"
+   * }
+   * @endcode
+   *
+   * The stream is written as sent, without encoding it again. The recording starts with a keyframe
+   * requested from the encoder and stops with the session.
+   *
+   * @api_examples{/api/recording/start| POST| {"uuid":"1234"}}
+   */
+  void startRecording(resp_https_t response, req_https_t request) {
+    if (!validateContentType(response, request, "application/json") || !authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    std::stringstream ss;
+    ss << request->content.rdbuf();
+    try {
+      nlohmann::json input_tree = nlohmann::json::parse(ss.str());
+      auto recording = recording::start(input_tree.value("uuid", ""));
+
+      nlohmann::json output_tree;
+      output_tree["status"] = !recording.is_null();
+      if (!recording.is_null()) {
+        output_tree["recording"] = std::move(recording);
+      }
+      send_response(response, output_tree);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "StartRecording: "sv << e.what();
+      bad_request(response, request, e.what());
+    }
+  }
+
+  /**
+   * @brief Stop recording a session.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * The body for the post request should be JSON serialized in the following format:
+   * @code{.json}
+   * {
+   *   "uuid": "<uuid>"
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/recording/stop| POST| {"uuid":"1234"}}
+   */
+  void stopRecording(resp_https_t response, req_https_t request) {
+    if (!validateContentType(response, request, "application/json") || !authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    std::stringstream ss;
+    ss << request->content.rdbuf();
+    try {
+      nlohmann::json input_tree = nlohmann::json::parse(ss.str());
+      nlohmann::json output_tree;
+      output_tree["status"] = recording::stop(input_tree.value("uuid", ""));
+      send_response(response, output_tree);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "StopRecording: "sv << e.what();
+      bad_request(response, request, e.what());
+    }
+  }
+
   /**
    * @brief Reset the display device persistence.
    * @param response The HTTP response object.
@@ -1523,10 +2527,12 @@ namespace confighttp {
    * @brief Start the HTTPS server.
    */
   void start() {
-    auto shutdown_event = mail::man->event<bool>(mail::shutdown);
+    auto shutdown_event = mail::man->event(mail::shutdown);
     auto port_https = net::map_port(PORT_HTTPS);
     auto address_family = net::af_from_enum_string(config::sunshine.address_family);
     https_server_t server { config::nvhttp.cert, config::nvhttp.pkey };
+    running_server = &server;
+    web_assets.load(WEB_DIR);
     server.default_resource["DELETE"] = [](resp_https_t response, req_https_t request) {
       bad_request(response, request);
     };
@@ -1558,6 +2564,17 @@ namespace confighttp {
     server.resource["^/api/apps/launch$"]["POST"] = launchApp;
     server.resource["^/api/apps/close$"]["POST"] = closeApp;
     server.resource["^/api/logs$"]["GET"] = getLogs;
+    server.resource["^/api/logs/segments$"]["GET"] = getLogSegments;
+    server.resource["^/api/metrics$"]["GET"] = getMetrics;
+    server.resource["^/api/metrics/openmetrics$"]["GET"] = getOpenMetrics;
+    server.resource["^/api/trace$"]["GET"] = getTrace;
+    server.resource["^/api/launch-progress$"]["GET"] = getLaunchProgress;
+    server.resource["^/api/events$"]["GET"] = getEvents;
+    server.resource["^/api/calibration$"]["GET"] = getCalibration;
+    server.resource["^/api/calibration$"]["POST"] = startCalibration;
+    server.resource["^/api/recording$"]["GET"] = getRecordings;
+    server.resource["^/api/recording/start$"]["POST"] = startRecording;
+    server.resource["^/api/recording/stop$"]["POST"] = stopRecording;
     server.resource["^/api/config$"]["GET"] = getConfig;
     server.resource["^/api/config$"]["POST"] = saveConfig;
     server.resource["^/api/configLocale$"]["GET"] = getLocale;
@@ -1600,5 +2617,8 @@ namespace confighttp {
     server.stop();
 
     tcp.join();
+    dashboard_timer.reset();
+    dashboard = live_events::hub_t {};
+    running_server = nullptr;
   }
 }  // namespace confighttp
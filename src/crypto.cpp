@@ -12,18 +12,39 @@
 namespace crypto {
   using asn1_string_t = util::safe_ptr<ASN1_STRING, ASN1_STRING_free>;
 
+  /**
+   * @brief Get the fingerprint of a certificate.
+   * @param cert The certificate.
+   * @return The SHA-256 of its DER encoding, or an empty string on failure.
+   */
+  static std::string fingerprint(x509_t::element_type *cert) {
+    sha256_t digest;
+    unsigned int size = 0;
+    if (!cert || X509_digest(cert, EVP_sha256(), digest.data(), &size) != 1) {
+      return {};
+    }
+    return std::string {(const char *) digest.data(), size};
+  }
+
   cert_chain_t::cert_chain_t():
       _certs {}, _cert_ctx { X509_STORE_CTX_new() } {
   }
   void cert_chain_t::add(p_named_cert_t& named_cert_p) {
     x509_store_t x509_store { X509_STORE_new() };
 
-    X509_STORE_add_cert(x509_store.get(), x509(named_cert_p->cert).get());
+    auto cert = x509(named_cert_p->cert);
+    X509_STORE_add_cert(x509_store.get(), cert.get());
+
+    // Keep the first of duplicate certificates, like the scan through the whole chain does
+    if (auto key = fingerprint(cert.get()); !key.empty()) {
+      _index.emplace(std::move(key), _certs.size());
+    }
     _certs.emplace_back(std::make_pair(named_cert_p, std::move(x509_store)));
   }
 
   void cert_chain_t::clear() {
     _certs.clear();
+    _index.clear();
   }
 
   static int openssl_verify_cb(int ok, X509_STORE_CTX *ctx) {
@@ -44,6 +65,25 @@ namespace crypto {
     }
   }
 
+  int cert_chain_t::verify(x509_t::element_type *cert, x509_store_t::element_type *x509_store) {
+    auto fg = util::fail_guard([this]() {
+      X509_STORE_CTX_cleanup(_cert_ctx.get());
+    });
+
+    X509_STORE_CTX_init(_cert_ctx.get(), x509_store, cert, nullptr);
+    X509_STORE_CTX_set_verify_cb(_cert_ctx.get(), openssl_verify_cb);
+
+    // We don't care to validate the entire chain for the purposes of client auth.
+    // Some versions of clients forked from Moonlight Embedded produce client certs
+    // that OpenSSL doesn't detect as self-signed due to some X509v3 extensions.
+    X509_STORE_CTX_set_flags(_cert_ctx.get(), X509_V_FLAG_PARTIAL_CHAIN);
+
+    if (X509_verify_cert(_cert_ctx.get()) == 1) {
+      return X509_V_OK;
+    }
+    return X509_STORE_CTX_get_error(_cert_ctx.get());
+  }
+
   /**
    * @brief Verify the certificate chain.
    * When certificates from two or more instances of Moonlight have been added to x509_store_t,
@@ -51,33 +91,29 @@ namespace crypto {
    * Moonlight to be able to use Sunshine
    *
    * To circumvent this, x509_store_t instance will be created for each instance of the certificates.
+   * A client presenting the exact certificate it paired with is looked up by fingerprint, only
+   * other certificates go through every store.
    * @param cert The certificate to verify.
    * @return nullptr if the certificate is valid, otherwise an error string.
    */
   const char * cert_chain_t::verify(x509_t::element_type *cert, p_named_cert_t& named_cert_out) {
+    if (auto it = _index.find(fingerprint(cert)); it != std::end(_index)) {
+      auto &[named_cert_p, x509_store] = _certs[it->second];
+      if (verify(cert, x509_store.get()) == X509_V_OK) {
+        named_cert_out = named_cert_p;
+        return nullptr;
+      }
+    }
+
     int err_code = 0;
     for (auto &[named_cert_p, x509_store] : _certs) {
-      auto fg = util::fail_guard([this]() {
-        X509_STORE_CTX_cleanup(_cert_ctx.get());
-      });
-
-      X509_STORE_CTX_init(_cert_ctx.get(), x509_store.get(), cert, nullptr);
-      X509_STORE_CTX_set_verify_cb(_cert_ctx.get(), openssl_verify_cb);
-
-      // We don't care to validate the entire chain for the purposes of client auth.
-      // Some versions of clients forked from Moonlight Embedded produce client certs
-      // that OpenSSL doesn't detect as self-signed due to some X509v3 extensions.
-      X509_STORE_CTX_set_flags(_cert_ctx.get(), X509_V_FLAG_PARTIAL_CHAIN);
-
-      auto err = X509_verify_cert(_cert_ctx.get());
+      err_code = verify(cert, x509_store.get());
 
-      if (err == 1) {
+      if (err_code == X509_V_OK) {
         named_cert_out = named_cert_p;
         return nullptr;
       }
 
-      err_code = X509_STORE_CTX_get_error(_cert_ctx.get());
-
       if (err_code != X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT && err_code != X509_V_ERR_INVALID_CA) {
         return X509_verify_cert_error_string(err_code);
       }
@@ -144,7 +180,39 @@ namespace crypto {
       return 0;
     }
 
+    static int init_decrypt_cbc(cipher_ctx_t &ctx, aes_t *key, aes_t *iv, bool padding) {
+      ctx.reset(EVP_CIPHER_CTX_new());
+
+      if (EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_cbc(), nullptr, key->data(), iv->data()) != 1) {
+        return -1;
+      }
+
+      EVP_CIPHER_CTX_set_padding(ctx.get(), padding);
+
+      return 0;
+    }
+
     int gcm_t::decrypt(const std::string_view &tagged_cipher, std::vector<std::uint8_t> &plaintext, aes_t *iv) {
+      if (tagged_cipher.size() < tag_size) {
+        return -1;
+      }
+
+      plaintext.resize(round_to_pkcs7_padded(tagged_cipher.size() - tag_size));
+
+      auto bytes = decrypt(tagged_cipher, plaintext.data(), iv);
+      if (bytes < 0) {
+        return -1;
+      }
+
+      plaintext.resize(bytes);
+      return 0;
+    }
+
+    int gcm_t::decrypt(const std::string_view &tagged_cipher, std::uint8_t *plaintext, aes_t *iv) {
+      if (tagged_cipher.size() < tag_size) {
+        return -1;
+      }
+
       if (!decrypt_ctx && init_decrypt_gcm(decrypt_ctx, &key, iv, padding)) {
         return -1;
       }
@@ -152,17 +220,16 @@ namespace crypto {
       // Calling with cipher == nullptr results in a parameter change
       // without requiring a reallocation of the internal cipher ctx.
       if (EVP_DecryptInit_ex(decrypt_ctx.get(), nullptr, nullptr, nullptr, iv->data()) != 1) {
-        return false;
+        return -1;
       }
 
       auto cipher = tagged_cipher.substr(tag_size);
       auto tag = tagged_cipher.substr(0, tag_size);
 
-      plaintext.resize(round_to_pkcs7_padded(cipher.size()));
-
       int update_outlen, final_outlen;
 
-      if (EVP_DecryptUpdate(decrypt_ctx.get(), plaintext.data(), &update_outlen, (const std::uint8_t *) cipher.data(), cipher.size()) != 1) {
+      // GCM is a stream mode, so OpenSSL allows the output to overlap the input exactly
+      if (EVP_DecryptUpdate(decrypt_ctx.get(), plaintext, &update_outlen, (const std::uint8_t *) cipher.data(), cipher.size()) != 1) {
         return -1;
       }
 
@@ -170,12 +237,11 @@ namespace crypto {
         return -1;
       }
 
-      if (EVP_DecryptFinal_ex(decrypt_ctx.get(), plaintext.data() + update_outlen, &final_outlen) != 1) {
+      if (EVP_DecryptFinal_ex(decrypt_ctx.get(), plaintext + update_outlen, &final_outlen) != 1) {
         return -1;
       }
 
-      plaintext.resize(update_outlen + final_outlen);
-      return 0;
+      return update_outlen + final_outlen;
     }
 
     /**
@@ -218,6 +284,44 @@ namespace crypto {
       return encrypt(plaintext, tagged_cipher, tagged_cipher + tag_size, iv);
     }
 
+    int gcm_t::encrypt_in_place(const in_place_entry_t *entries, std::size_t count, std::size_t size, std::size_t iv_size) {
+      if (count == 0) {
+        return 0;
+      }
+
+      if (!encrypt_ctx) {
+        aes_t iv {entries[0].iv, entries[0].iv + iv_size};
+        if (init_encrypt_gcm(encrypt_ctx, &key, &iv, padding)) {
+          return -1;
+        }
+      }
+
+      auto ctx = encrypt_ctx.get();
+      for (std::size_t x = 0; x < count; ++x) {
+        auto &entry = entries[x];
+
+        // Only the IV changes between buffers
+        if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, entry.iv) != 1) {
+          return -1;
+        }
+
+        int update_outlen, final_outlen;
+        if (EVP_EncryptUpdate(ctx, entry.data, &update_outlen, entry.data, size) != 1) {
+          return -1;
+        }
+
+        if (EVP_EncryptFinal_ex(ctx, entry.data + update_outlen, &final_outlen) != 1) {
+          return -1;
+        }
+
+        if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, tag_size, entry.tag) != 1) {
+          return -1;
+        }
+      }
+
+      return 0;
+    }
+
     int ecb_t::decrypt(const std::string_view &cipher, std::vector<std::uint8_t> &plaintext) {
       auto fg = util::fail_guard([this]() {
         EVP_CIPHER_CTX_reset(decrypt_ctx.get());
@@ -303,6 +407,33 @@ namespace crypto {
       return update_outlen + final_outlen;
     }
 
+    int cbc_t::decrypt(const std::string_view &cipher, std::vector<std::uint8_t> &plaintext, aes_t *iv) {
+      if (!decrypt_ctx && init_decrypt_cbc(decrypt_ctx, &key, iv, padding)) {
+        return -1;
+      }
+
+      // Calling with cipher == nullptr results in a parameter change
+      // without requiring a reallocation of the internal cipher ctx.
+      if (EVP_DecryptInit_ex(decrypt_ctx.get(), nullptr, nullptr, nullptr, iv->data()) != 1) {
+        return -1;
+      }
+
+      plaintext.resize(round_to_pkcs7_padded(cipher.size()));
+
+      int update_outlen, final_outlen;
+
+      if (EVP_DecryptUpdate(decrypt_ctx.get(), plaintext.data(), &update_outlen, (const std::uint8_t *) cipher.data(), cipher.size()) != 1) {
+        return -1;
+      }
+
+      if (EVP_DecryptFinal_ex(decrypt_ctx.get(), plaintext.data() + update_outlen, &final_outlen) != 1) {
+        return -1;
+      }
+
+      plaintext.resize(update_outlen + final_outlen);
+      return 0;
+    }
+
     ecb_t::ecb_t(const aes_t &key, bool padding):
         cipher_t {EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_new(), key, padding} {
     }
@@ -6,6 +6,8 @@
 
 // standard includes
 #include <array>
+#include <string>
+#include <unordered_map>
 
 // lib includes
 #include <list>
@@ -231,6 +233,8 @@ namespace crypto {
 
   /**
    * @brief Certificate chain for client certificate verification.
+   * @details Certificates are indexed by the SHA-256 of their DER encoding, so a client presenting
+   *          the certificate it paired with is verified against that certificate only.
    */
   class cert_chain_t {
   public:
@@ -256,7 +260,16 @@ namespace crypto {
     const char *verify(x509_t::element_type *cert, p_named_cert_t& named_cert_out);
 
   private:
+    /**
+     * @brief Verify a certificate against a single store.
+     * @param cert The certificate to verify.
+     * @param x509_store The store.
+     * @return `X509_V_OK` if the certificate is valid, otherwise the error code.
+     */
+    int verify(x509_t::element_type *cert, x509_store_t::element_type *x509_store);
+
     std::vector<std::pair<p_named_cert_t, x509_store_t>> _certs;  ///< Certificate store pairs
+    std::unordered_map<std::string, std::size_t> _index;  ///< Fingerprint of each certificate to its position in _certs
     x509_store_ctx_t _cert_ctx;  ///< Certificate verification context
   };
 
@@ -352,7 +365,39 @@ namespace crypto {
        */
       int encrypt(const std::string_view &plaintext, std::uint8_t *tagged_cipher, aes_t *iv);
 
+      /**
+       * @brief A buffer to encrypt in place with `encrypt_in_place()`.
+       */
+      struct in_place_entry_t {
+        std::uint8_t *data;  ///< Buffer to be encrypted in place
+        std::uint8_t *tag;  ///< Buffer where the GCM tag will be written
+        const std::uint8_t *iv;  ///< Initialization vector of iv_size bytes
+      };
+
+      /**
+       * @brief Encrypts equally sized buffers in place using AES GCM mode, one after the other.
+       * @details Each buffer is its own GCM operation on the same context, like `encrypt()`,
+       *          only the IV changes between them.
+       * @param entries The buffers to encrypt along with their tags and IVs.
+       * @param count The number of entries.
+       * @param size The size of each buffer in bytes.
+       * @param iv_size The size of each IV in bytes.
+       * @return 0 on success. Returns -1 in case of an error.
+       */
+      int encrypt_in_place(const in_place_entry_t *entries, std::size_t count, std::size_t size, std::size_t iv_size);
+
       int decrypt(const std::string_view &cipher, std::vector<std::uint8_t> &plaintext, aes_t *iv);
+
+      /**
+       * @brief Decrypts a tagged cipher using AES GCM mode into a caller provided buffer.
+       * @details The plaintext may be written over the cipher text, `tagged_cipher.data() + tag_size`,
+       *          to decrypt a received packet in place.
+       * @param tagged_cipher The GCM tag followed by the cipher text.
+       * @param plaintext The buffer where the plaintext will be written, at least as large as the cipher text.
+       * @param iv The initialization vector to be used for the decryption.
+       * @return The length of the plaintext. Returns -1 in case of an error.
+       */
+      int decrypt(const std::string_view &tagged_cipher, std::uint8_t *plaintext, aes_t *iv);
     };
 
     /**
@@ -380,6 +425,15 @@ namespace crypto {
        * @return The total length of the ciphertext written into cipher. Returns -1 in case of an error.
        */
       int encrypt(const std::string_view &plaintext, std::uint8_t *cipher, aes_t *iv);
+
+      /**
+       * @brief Decrypts the ciphertext using AES CBC mode.
+       * @param cipher The ciphertext data to be decrypted.
+       * @param plaintext The buffer where the resulting plaintext will be written.
+       * @param iv The initialization vector to be used for the decryption.
+       * @return 0 on success, -1 on error.
+       */
+      int decrypt(const std::string_view &cipher, std::vector<std::uint8_t> &plaintext, aes_t *iv);
     };
   }  // namespace cipher
 }  // namespace crypto
@@ -38,6 +38,7 @@ namespace display_device {
       std::mutex mutex {};
       std::chrono::milliseconds config_revert_delay {0};
       std::unique_ptr<RetryScheduler<SettingsManagerInterface>> sm_instance {nullptr};
+      std::optional<SingleDisplayConfiguration> applied_config {};  ///< Last configuration applied successfully, only accessed from the scheduler callbacks.
     } DD_DATA;
 
     /**
@@ -413,6 +414,10 @@ namespace display_device {
 
       switch (video_config.dd.hdr_option) {
         case hdr_option_e::automatic:
+          // SDR streams of an HDR display are tone mapped, so the display can stay as it is
+          if (!session.enable_hdr && video_config.hdr_tone_mapping) {
+            break;
+          }
           return session.enable_hdr ? HdrState::Enabled : HdrState::Disabled;
         case hdr_option_e::disabled:
           break;
@@ -505,6 +510,40 @@ namespace display_device {
       return result;
     }
 
+    /**
+     * @brief Entries of a remapping list parsed into the internal structure, `std::nullopt` for entries that failed to parse.
+     */
+    using parsed_remapping_list_t = std::vector<std::optional<parsed_remapping_entry_t>>;
+
+    /**
+     * @brief Parse a remapping list, reusing the result for as long as the config list stays the same.
+     * @param list Entries from the config.
+     * @param type Specify which entry fields should be parsed.
+     * @returns The parsed entries in the same order.
+     */
+    std::shared_ptr<const parsed_remapping_list_t> parse_remapping_list(const std::vector<config::video_t::dd_t::mode_remapping_entry_t> &list, const remapping_type_e type) {
+      static std::mutex mutex;
+      static remapping_type_e cached_type;
+      static std::vector<config::video_t::dd_t::mode_remapping_entry_t> cached_list;
+      static std::shared_ptr<const parsed_remapping_list_t> cached_result;
+
+      std::lock_guard lock {mutex};
+      if (cached_result && cached_type == type && cached_list == list) {
+        return cached_result;
+      }
+
+      auto result {std::make_shared<parsed_remapping_list_t>()};
+      result->reserve(list.size());
+      for (const auto &entry : list) {
+        result->push_back(parse_remapping_entry(entry, type));
+      }
+
+      cached_type = type;
+      cached_list = list;
+      cached_result = std::move(result);
+      return cached_result;
+    }
+
     /**
      * @brief Remap the the requested display mode based on the config.
      * @param video_config User's video related configuration.
@@ -558,8 +597,10 @@ namespace display_device {
         // clang-format on
       }};
 
-      for (const auto &entry : remapping_list) {
-        const auto parsed_entry {parse_remapping_entry(entry, *remapping_type)};
+      const auto parsed_list {parse_remapping_list(remapping_list, *remapping_type)};
+      for (std::size_t i = 0; i < remapping_list.size(); ++i) {
+        const auto &entry {remapping_list[i]};
+        const auto &parsed_entry {(*parsed_list)[i]};
         if (!parsed_entry) {
           BOOST_LOG(error) << "Failed to parse remapping entry from:\n"
                            << entry_to_string(entry);
@@ -656,6 +697,9 @@ namespace display_device {
       }
 
       DD_DATA.sm_instance->schedule([try_once = (option == revert_option_e::try_once), tried_out_devices = std::set<std::string> {}](auto &settings_iface, auto &stop_token) mutable {
+        // Even a failed revert might have changed some of the settings
+        DD_DATA.applied_config = std::nullopt;
+
         if (try_once) {
           std::ignore = settings_iface.revertSettings();
           stop_token.requestStop();
@@ -713,6 +757,7 @@ namespace display_device {
     }
     DD_DATA.config_revert_delay = video_config.dd.config_revert_delay;
     DD_DATA.sm_instance = nullptr;
+    DD_DATA.applied_config = std::nullopt;
 
     // If we fail to create settings manager, this means platform is not supported, and
     // we will need to provided error-free pass-trough in other methods
@@ -804,9 +849,25 @@ namespace display_device {
     }
 
     DD_DATA.sm_instance->schedule([config](auto &settings_iface, auto &stop_token) {
+      // Resuming a stream asks for the same configuration again. Applying it anyway would set the
+      // same mode, which still blanks the display and makes the capture reinitialize.
+      // Scheduling this still cancels a pending delayed revert.
+      if (DD_DATA.applied_config == config) {
+        BOOST_LOG(info) << "Display device configuration is already applied.";
+        stop_token.requestStop();
+        return;
+      }
+
+      const auto result {settings_iface.applySettings(config)};
+      if (result == SettingsManagerInterface::ApplyResult::Ok) {
+        DD_DATA.applied_config = config;
+      } else {
+        DD_DATA.applied_config = std::nullopt;
+      }
+
       // We only want to keep retrying in case of a transient errors.
       // In other cases, when we either fail or succeed we just want to stop...
-      if (settings_iface.applySettings(config) != SettingsManagerInterface::ApplyResult::ApiTemporarilyUnavailable) {
+      if (result != SettingsManagerInterface::ApplyResult::ApiTemporarilyUnavailable) {
         stop_token.requestStop();
       }
     },
@@ -829,6 +890,7 @@ namespace display_device {
       // Whatever the outcome is we want to stop interfering with the user,
       // so any schedulers need to be stopped.
       stop_token.requestStop();
+      DD_DATA.applied_config = std::nullopt;
       return settings_iface.resetPersistence();
     });
   }
@@ -11,6 +11,8 @@
 #include "file_handler.h"
 #include "logging.h"
 
+using namespace std::literals;
+
 namespace file_handler {
   std::string get_parent_directory(const std::string &path) {
     // remove any trailing path separators
@@ -53,4 +55,31 @@ namespace file_handler {
 
     return 0;
   }
+
+  int replace_file(const char *path, const std::string_view &contents) {
+    std::string temp_path = std::string {path} + ".tmp";
+    {
+      std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+      if (!out.is_open()) {
+        return -1;
+      }
+
+      out << contents;
+      out.flush();
+      if (!out) {
+        BOOST_LOG(error) << "Couldn't write "sv << temp_path;
+        return -1;
+      }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+      BOOST_LOG(error) << "Couldn't replace "sv << path << ": "sv << ec.message();
+      std::filesystem::remove(temp_path, ec);
+      return -1;
+    }
+
+    return 0;
+  }
 }  // namespace file_handler
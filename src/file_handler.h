@@ -51,4 +51,16 @@ namespace file_handler {
    * @examples_end
    */
   int write_file(const char *path, const std::string_view &contents);
+
+  /**
+   * @brief Replace a file atomically, readers see either the old or the new contents.
+   * @details The contents are written to a temporary file next to it, which is then renamed over it.
+   * @param path The path of the file.
+   * @param contents The contents to write.
+   * @return ``0`` on success, ``-1`` on failure.
+   * @examples
+   * int write_status = replace_file("path/to/file", "file contents");
+   * @examples_end
+   */
+  int replace_file(const char *path, const std::string_view &contents);
 }  // namespace file_handler
@@ -0,0 +1,119 @@
+/**
+ * @file src/fleet.cpp
+ * @brief Definitions for reporting the load of the host to the broker of a fleet of hosts.
+ */
+// standard includes
+#include <thread>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "admission.h"
+#include "config.h"
+#include "fleet.h"
+#include "globals.h"
+#include "gpu_stats.h"
+#include "httpcommon.h"
+#include "logging.h"
+#include "metrics.h"
+#include "network.h"
+#include "nvhttp.h"
+#include "process.h"
+#include "rtsp.h"
+
+#ifdef __linux__
+  #include "platform/linux/virtual_output.h"
+#endif
+
+using namespace std::literals;
+
+namespace fleet {
+  namespace {
+    constexpr auto report_timeout = 5s;  ///< A broker that is slower than this misses the report
+
+    template<class T>
+    nlohmann::json or_null(const std::optional<T> &value) {
+      return value ? nlohmann::json(*value) : nlohmann::json();
+    }
+
+    class deinit_t: public platf::deinit_t {
+    public:
+      deinit_t():
+          report_thread {&deinit_t::report_thread_proc} {
+      }
+
+      ~deinit_t() override {
+        report_thread.join();
+      }
+
+    private:
+      static void report_thread_proc() {
+        static auto &failed_reports = metrics::counter("fleet_reports_failed"sv);  ///< Reports the broker didn't accept.
+
+        auto shutdown_event = mail::man->event(mail::shutdown);
+        auto &url = config::sunshine.fleet_broker;
+        BOOST_LOG(info) << "Reporting the load of the host to ["sv << url << ']';
+
+        bool reachable = true;
+        do {
+          if (http::post_json(url, report(current_load()), report_timeout)) {
+            if (!reachable) {
+              BOOST_LOG(info) << "The fleet broker accepts reports again"sv;
+            }
+            reachable = true;
+          } else {
+            failed_reports.add();
+
+            // Only log the first failure of a run of them
+            if (reachable) {
+              BOOST_LOG(warning) << "The fleet broker ["sv << url << "] didn't accept the load report"sv;
+            }
+            reachable = false;
+          }
+        } while (!shutdown_event->view(config::sunshine.fleet_report_interval));
+      }
+
+      std::thread report_thread;
+    };
+  }  // namespace
+
+  load_t current_load() {
+    load_t load {};
+    load.sessions = rtsp_stream::session_count();
+    load.encoder_utilization = gpu_stats::latest().encoder;
+    load.headroom = admission::controller().headroom();
+#ifdef _WIN32
+    load.virtual_display = proc::vDisplayDriverStatus == VDISPLAY::DRIVER_STATUS::OK;
+#elif defined(__linux__)
+    load.virtual_display = platf::virtual_output::available();
+#endif
+    return load;
+  }
+
+  std::string report(const load_t &load) {
+    nlohmann::json tree;
+    tree["hostname"] = config::nvhttp.sunshine_name;
+    tree["uniqueid"] = http::unique_id;
+    tree["version"] = PROJECT_VERSION;
+    tree["address"] = config::nvhttp.external_ip;
+    tree["ports"] = {
+      {"http", net::map_port(nvhttp::PORT_HTTP)},
+      {"https", net::map_port(nvhttp::PORT_HTTPS)},
+      {"rtsp", net::map_port(rtsp_stream::RTSP_SETUP_PORT)},
+    };
+    tree["sessions"] = load.sessions;
+    tree["encoder_utilization"] = or_null(load.encoder_utilization);
+    tree["headroom"] = or_null(load.headroom);
+    tree["virtual_display"] = load.virtual_display;
+    return tree.dump();
+  }
+
+  std::unique_ptr<platf::deinit_t> start() {
+    if (config::sunshine.fleet_broker.empty()) {
+      return nullptr;
+    }
+
+    return std::make_unique<deinit_t>();
+  }
+}  // namespace fleet
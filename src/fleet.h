@@ -0,0 +1,50 @@
+/**
+ * @file src/fleet.h
+ * @brief Declarations for reporting the load of the host to the broker of a fleet of hosts.
+ */
+#pragma once
+
+// standard includes
+#include <memory>
+#include <optional>
+#include <string>
+
+// local includes
+#include "platform/common.h"
+
+/**
+ * @brief Reports the capacity and load of the host to a broker, which spreads the clients over a fleet of hosts.
+ * @details The broker only guides users to a host. Moonlight pairs with every host and pins its certificate,
+ *          and the state of a launch lives on the host that launched the app, so a session can't be redirected
+ *          to another host behind the back of the client.
+ */
+namespace fleet {
+  /**
+   * @brief The load of the host.
+   */
+  struct load_t {
+    int sessions;  ///< Active streaming sessions
+    std::optional<int> encoder_utilization;  ///< Video encode engine utilization in percent
+    std::optional<double> headroom;  ///< Share of the encoder capacity left to new sessions, between 0 and 1
+    bool virtual_display;  ///< Whether sessions can stream from a virtual display
+  };
+
+  /**
+   * @brief Measure the load of the host.
+   * @return The load.
+   */
+  load_t current_load();
+
+  /**
+   * @brief Build the report posted to the broker.
+   * @param load The load of the host.
+   * @return The report as a JSON object, with `null` for the load the host can't measure.
+   */
+  std::string report(const load_t &load);
+
+  /**
+   * @brief Start reporting to the broker of the `fleet_broker` option.
+   * @return The reporting, which stops once it is destroyed, `nullptr` if the option is empty.
+   */
+  std::unique_ptr<platf::deinit_t> start();
+}  // namespace fleet
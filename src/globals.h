@@ -5,8 +5,11 @@
 #pragma once
 
 // local includes
+#include "audio.h"
 #include "entry_handler.h"
+#include "input.h"
 #include "thread_pool.h"
+#include "video.h"
 
 /**
  * @brief A thread pool for processing tasks.
@@ -32,8 +35,13 @@ extern nvprefs::nvprefs_interface nvprefs_instance;
  * @brief Handles process-wide communication.
  */
 namespace mail {
-#define MAIL(x) \
-  constexpr auto x = std::string_view { \
+#define MAIL_EVENT(x, ...) \
+  constexpr auto x = safe::event_id_t<__VA_ARGS__> { \
+    #x \
+  }
+
+#define MAIL_QUEUE(x, ...) \
+  constexpr auto x = safe::queue_id_t<__VA_ARGS__> { \
     #x \
   }
 
@@ -43,20 +51,23 @@ namespace mail {
   extern safe::mail_t man;
 
   // Global mail
-  MAIL(shutdown);
-  MAIL(broadcast_shutdown);
-  MAIL(video_packets);
-  MAIL(audio_packets);
-  MAIL(switch_display);
+  MAIL_EVENT(shutdown, bool);
+  MAIL_EVENT(broadcast_shutdown, bool);
+  MAIL_QUEUE(video_packets, video::packet_t);
+  MAIL_QUEUE(audio_packets, audio::packet_t);
+  MAIL_EVENT(switch_display, int);
 
   // Local mail
-  MAIL(touch_port);
-  MAIL(idr);
-  MAIL(invalidate_ref_frames);
-  MAIL(gamepad_feedback);
-  MAIL(hdr);
-  MAIL(bitrate_change);
-  MAIL(bitrate_change_confirmation);
-#undef MAIL
+  MAIL_EVENT(touch_port, input::touch_port_t);
+  MAIL_EVENT(idr, bool);
+  MAIL_EVENT(invalidate_ref_frames, std::pair<int64_t, int64_t>);
+  MAIL_QUEUE(gamepad_feedback, platf::gamepad_feedback_msg_t);
+  MAIL_EVENT(hdr, video::hdr_info_t);
+  MAIL_EVENT(audio_encoder_params, audio::encoder_params_t);
+  MAIL_EVENT(ladder_change, video::ladder_step_t);
+  MAIL_EVENT(ladder_change_confirmation, bool);
+  MAIL_EVENT(fps_divisor, int);
+#undef MAIL_EVENT
+#undef MAIL_QUEUE
 
 }  // namespace mail
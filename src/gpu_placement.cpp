@@ -0,0 +1,87 @@
+/**
+ * @file src/gpu_placement.cpp
+ * @brief Definitions for spreading the encoders of concurrent sessions over the GPUs.
+ */
+// standard includes
+#include <algorithm>
+#include <functional>
+
+// local includes
+#include "gpu_placement.h"
+#include "logging.h"
+
+using namespace std::literals;
+
+namespace gpu_placement {
+  namespace {
+    class lease_t: public platf::deinit_t {
+    public:
+      lease_t(std::function<void()> &&release):
+          _release {std::move(release)} {
+      }
+
+      ~lease_t() override {
+        _release();
+      }
+
+    private:
+      std::function<void()> _release;
+    };
+  }  // namespace
+
+  std::optional<placement_t> balancer_t::acquire(const std::vector<std::string> &adapters, std::uint64_t load) {
+    if (adapters.empty()) {
+      return std::nullopt;
+    }
+
+    std::lock_guard lg {mutex};
+    auto load_of = [&](const std::string &adapter) {
+      auto it = loads.find(adapter);
+      return it == std::end(loads) ? 0 : it->second;
+    };
+
+    std::size_t index = 0;
+    for (std::size_t x = 1; x < adapters.size(); ++x) {
+      if (load_of(adapters[x]) < load_of(adapters[index])) {
+        index = x;
+      }
+    }
+
+    auto &adapter = adapters[index];
+    loads[adapter] += load;
+    BOOST_LOG(debug) << "Placing encoder on "sv << adapter << ", "sv << loads[adapter] << " pixels encoded per frame on it"sv;
+
+    return placement_t {
+      index,
+      std::make_unique<lease_t>([this, adapter, load]() {
+        release(adapter, load);
+      }),
+    };
+  }
+
+  std::uint64_t balancer_t::load(const std::string &adapter) {
+    std::lock_guard lg {mutex};
+
+    auto it = loads.find(adapter);
+    return it == std::end(loads) ? 0 : it->second;
+  }
+
+  void balancer_t::release(const std::string &adapter, std::uint64_t load) {
+    std::lock_guard lg {mutex};
+
+    auto it = loads.find(adapter);
+    if (it == std::end(loads)) {
+      return;
+    }
+
+    it->second -= std::min(it->second, load);
+    if (!it->second) {
+      loads.erase(it);
+    }
+  }
+
+  balancer_t &balancer() {
+    static balancer_t balancer;
+    return balancer;
+  }
+}  // namespace gpu_placement
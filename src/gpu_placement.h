@@ -0,0 +1,61 @@
+/**
+ * @file src/gpu_placement.h
+ * @brief Declarations for spreading the encoders of concurrent sessions over the GPUs.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// local includes
+#include "platform/common.h"
+
+namespace gpu_placement {
+  /**
+   * @brief An adapter picked for an encoder.
+   */
+  struct placement_t {
+    std::size_t index;  ///< Index of the adapter in the candidates
+    std::unique_ptr<platf::deinit_t> lease;  ///< Releases the load of the encoder once it is destroyed
+  };
+
+  /**
+   * @brief Tracks the encoding load of each adapter.
+   * @details The load of an encoder is the number of pixels in its frames, so a 4K session
+   *          weighs as much as four 1080p ones.
+   */
+  class balancer_t {
+  public:
+    /**
+     * @brief Pick the adapter with the least load for an encoder.
+     * @param adapters The adapters able to run the encoder, in order of preference when loads are equal.
+     * @param load The load of the encoder.
+     * @return The adapter, or nothing if there is no candidate.
+     */
+    std::optional<placement_t> acquire(const std::vector<std::string> &adapters, std::uint64_t load);
+
+    /**
+     * @brief Get the load of an adapter.
+     * @param adapter The adapter.
+     * @return The sum of the loads of its encoders.
+     */
+    std::uint64_t load(const std::string &adapter);
+
+  private:
+    void release(const std::string &adapter, std::uint64_t load);
+
+    std::mutex mutex;
+    std::map<std::string, std::uint64_t> loads;  ///< Load per adapter with encoders
+  };
+
+  /**
+   * @brief Get the balancer shared by all sessions.
+   */
+  balancer_t &balancer();
+}  // namespace gpu_placement
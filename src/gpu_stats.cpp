@@ -0,0 +1,146 @@
+/**
+ * @file src/gpu_stats.cpp
+ * @brief Definitions for sampling the GPU utilization while streaming.
+ */
+// standard includes
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// local includes
+#include "config.h"
+#include "gpu_stats.h"
+#include "logging.h"
+#include "metrics.h"
+#include "thread_safe.h"
+
+using namespace std::literals;
+
+namespace gpu_stats {
+  namespace {
+    struct sampler_ctx_t {
+      std::thread thread;
+      std::mutex lock;
+      std::condition_variable cv;
+      bool stop = false;  ///< Guarded by lock
+    };
+
+    struct state_t {
+      std::mutex lock;
+      platf::gpu_utilization_t latest;
+      bool contended = false;
+    };
+
+    state_t &state() {
+      static state_t state;
+      return state;
+    }
+
+    void sample_loop(sampler_ctx_t &ctx) {
+      auto monitor = platf::make_gpu_monitor();
+      if (!monitor) {
+        BOOST_LOG(info) << "GPU utilization can't be sampled on this system"sv;
+        return;
+      }
+
+      auto &contention_counter = metrics::counter("gpu_contention"sv);
+
+      contention_detector_t detector;
+      bool boosted = false;
+
+      std::unique_lock ul {ctx.lock};
+      while (!ctx.cv.wait_for(ul, sample_interval, [&]() {
+        return ctx.stop;
+      })) {
+        ul.unlock();
+
+        auto utilization = monitor->sample();
+        auto was_contended = detector.contended();
+        auto contended = utilization.render ? detector.update(*utilization.render) : was_contended;
+
+        if (contended != was_contended) {
+          if (contended) {
+            contention_counter.add();
+            BOOST_LOG(info) << "GPU is saturated, the 3D engine is at "sv << *utilization.render << "%, capture and conversion may be starved"sv;
+          } else {
+            BOOST_LOG(info) << "GPU is no longer saturated"sv;
+          }
+        }
+
+        if (config::video.nv_realtime_hags_on_contention && contended != boosted && platf::boost_gpu_priority(contended)) {
+          boosted = contended;
+          BOOST_LOG(info) << "Using "sv << (boosted ? "realtime"sv : "the default"sv) << " GPU priority"sv;
+        }
+
+        {
+          auto &state = gpu_stats::state();
+          std::lock_guard lg {state.lock};
+          state.latest = utilization;
+          state.contended = contended;
+        }
+
+        ul.lock();
+      }
+
+      if (boosted) {
+        platf::boost_gpu_priority(false);
+      }
+
+      auto &state = gpu_stats::state();
+      std::lock_guard lg {state.lock};
+      state.latest = {};
+      state.contended = false;
+    }
+
+    int start_sampler(sampler_ctx_t &ctx) {
+      ctx.stop = false;
+      ctx.thread = std::thread {sample_loop, std::ref(ctx)};
+      return 0;
+    }
+
+    void end_sampler(sampler_ctx_t &ctx) {
+      {
+        std::lock_guard lg {ctx.lock};
+        ctx.stop = true;
+      }
+      ctx.cv.notify_all();
+
+      ctx.thread.join();
+    }
+
+    auto sampler = safe::make_shared<sampler_ctx_t>(start_sampler, end_sampler);
+
+    class guard_t: public platf::deinit_t {
+    public:
+      safe::shared_t<sampler_ctx_t>::ptr_t ref = sampler.ref();
+    };
+  }  // namespace
+
+  bool contention_detector_t::update(int render_percent) {
+    auto crossed = _contended ? render_percent < contention_exit_percent : render_percent >= contention_enter_percent;
+    streak = crossed ? streak + 1 : 0;
+
+    if (streak >= contention_samples) {
+      _contended = !_contended;
+      streak = 0;
+    }
+
+    return _contended;
+  }
+
+  std::unique_ptr<platf::deinit_t> start() {
+    return std::make_unique<guard_t>();
+  }
+
+  platf::gpu_utilization_t latest() {
+    auto &state = gpu_stats::state();
+    std::lock_guard lg {state.lock};
+    return state.latest;
+  }
+
+  bool contended() {
+    auto &state = gpu_stats::state();
+    std::lock_guard lg {state.lock};
+    return state.contended;
+  }
+}  // namespace gpu_stats
@@ -0,0 +1,62 @@
+/**
+ * @file src/gpu_stats.h
+ * @brief Declarations for sampling the GPU utilization while streaming.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <memory>
+
+// local includes
+#include "platform/common.h"
+
+namespace gpu_stats {
+  constexpr std::chrono::seconds sample_interval {1};  ///< Time between two samples
+  constexpr int contention_enter_percent = 90;  ///< 3D engine utilization from which the GPU counts as saturated
+  constexpr int contention_exit_percent = 75;  ///< 3D engine utilization below which it no longer does
+  constexpr int contention_samples = 3;  ///< Consecutive samples needed to enter or leave contention
+
+  /**
+   * @brief Tells from the 3D engine utilization whether a game saturates the GPU.
+   * @details The hysteresis and the required streak of samples keep loading screens and
+   *          short spikes from flipping the state back and forth.
+   */
+  class contention_detector_t {
+  public:
+    /**
+     * @brief Feed a sample.
+     * @param render_percent The utilization of the 3D engine in percent.
+     * @return Whether the GPU counts as saturated after the sample.
+     */
+    bool update(int render_percent);
+
+    bool contended() const {
+      return _contended;
+    }
+
+  private:
+    int streak = 0;  ///< Consecutive samples on the other side of the threshold
+    bool _contended = false;
+  };
+
+  /**
+   * @brief Sample the GPU utilization for a stream.
+   * @details All streams share a single sampling thread, it stops once the last guard is released.
+   *          If enabled, the GPU priority is raised while the GPU is saturated.
+   * @return The guard.
+   */
+  [[nodiscard]] std::unique_ptr<platf::deinit_t> start();
+
+  /**
+   * @brief Get the latest sample.
+   * @return The utilization, with empty fields if the GPU isn't sampled.
+   */
+  platf::gpu_utilization_t latest();
+
+  /**
+   * @brief Whether the GPU is saturated according to the latest samples.
+   * @return `true` while contended.
+   */
+  bool contended();
+}  // namespace gpu_stats
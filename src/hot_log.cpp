@@ -0,0 +1,212 @@
+/**
+ * @file src/hot_log.cpp
+ * @brief Definitions for logging from hot loops without going through Boost.Log per message.
+ */
+// standard includes
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "hot_log.h"
+#include "logging.h"
+
+using namespace std::literals;
+
+/**
+ * @brief Format a copied argument with the spec of its replacement field.
+ * @details The type of the argument is only known when it's formatted, so the spec is kept
+ *          and handed to the formatter of the stored type then.
+ */
+template<>
+struct std::formatter<logging::hot::arg_t> {
+  std::string_view spec;
+
+  constexpr auto parse(std::format_parse_context &ctx) {
+    auto it = ctx.begin();
+    while (it != ctx.end() && *it != '}') {
+      ++it;
+    }
+    spec = std::string_view {ctx.begin(), it};
+    return it;
+  }
+
+  auto format(const logging::hot::arg_t &arg, std::format_context &ctx) const {
+    using type_e = logging::hot::arg_t::type_e;
+
+    switch (arg.type) {
+      case type_e::boolean:
+        return format_as(arg.b, ctx);
+      case type_e::signed_int:
+        return format_as(arg.i, ctx);
+      case type_e::unsigned_int:
+        return format_as(arg.u, ctx);
+      case type_e::floating:
+        return format_as(arg.d, ctx);
+      case type_e::string:
+        return format_as(std::string_view {arg.s}, ctx);
+      default:
+        return ctx.out();
+    }
+  }
+
+  template<typename T>
+  auto format_as(const T &value, std::format_context &ctx) const {
+    std::formatter<T> formatter;
+    std::format_parse_context parse_ctx {spec};
+    parse_ctx.advance_to(formatter.parse(parse_ctx));
+    return formatter.format(value, ctx);
+  }
+};
+
+namespace logging::hot {
+  std::atomic<int> min_level {std::numeric_limits<int>::max()};
+
+  namespace {
+    constexpr auto drain_interval = 10ms;
+
+    std::mutex rings_mutex;
+    std::vector<std::shared_ptr<ring_t>> rings;
+
+    // The rings have a single consumer, the hot log thread or whoever flushes the log
+    std::mutex drain_mutex;
+    std::atomic<std::uint64_t> dropped {0};
+
+    std::mutex thread_mutex;
+    std::condition_variable thread_cv;
+    bool stopping = false;
+    std::thread thread;
+
+    /**
+     * @brief Retire the ring of a thread when the thread exits.
+     */
+    struct ring_owner_t {
+      std::shared_ptr<ring_t> ring;
+
+      ~ring_owner_t() {
+        ring->retired = true;
+      }
+    };
+
+    std::string format_record(const record_t &record) {
+      auto &a = record.args;
+      try {
+        return std::vformat(record.format, std::make_format_args(a[0], a[1], a[2], a[3], a[4], a[5]));
+      } catch (const std::format_error &e) {
+        return "Invalid hot log format ["s + std::string {record.format} + "]: "s + e.what();
+      }
+    }
+
+    void emit(int level, const std::string &message) {
+      switch (level) {
+        case level_verbose:
+          BOOST_LOG(verbose) << message;
+          break;
+        case level_debug:
+          BOOST_LOG(debug) << message;
+          break;
+        case level_info:
+          BOOST_LOG(info) << message;
+          break;
+        case level_warning:
+          BOOST_LOG(warning) << message;
+          break;
+        case level_error:
+          BOOST_LOG(error) << message;
+          break;
+        default:
+          BOOST_LOG(fatal) << message;
+          break;
+      }
+    }
+  }  // namespace
+
+  ring_t &thread_ring() {
+    thread_local ring_owner_t owner = []() {
+      auto ring = std::make_shared<ring_t>();
+
+      std::lock_guard lg {rings_mutex};
+      rings.push_back(ring);
+      return ring_owner_t {std::move(ring)};
+    }();
+
+    return *owner.ring;
+  }
+
+  void start(int min_log_level) {
+    stop();
+
+    {
+      std::lock_guard lg {thread_mutex};
+      stopping = false;
+    }
+    min_level = min_log_level;
+
+    thread = std::thread {[]() {
+      std::unique_lock ul {thread_mutex};
+      while (!thread_cv.wait_for(ul, drain_interval, []() {
+        return stopping;
+      })) {
+        ul.unlock();
+        drain();
+        ul.lock();
+      }
+    }};
+  }
+
+  void stop() {
+    min_level = std::numeric_limits<int>::max();
+
+    if (thread.joinable()) {
+      {
+        std::lock_guard lg {thread_mutex};
+        stopping = true;
+      }
+      thread_cv.notify_one();
+      thread.join();
+    }
+
+    drain();
+  }
+
+  void drain() {
+    std::lock_guard lg {drain_mutex};
+
+    std::vector<std::shared_ptr<ring_t>> snapshot;
+    {
+      std::lock_guard lg_rings {rings_mutex};
+      snapshot = rings;
+    }
+
+    std::uint64_t newly_dropped = 0;
+    for (auto &ring : snapshot) {
+      auto head = ring->head.load(std::memory_order_acquire);
+      for (auto tail = ring->tail.load(std::memory_order_relaxed); tail != head; ++tail) {
+        auto &record = ring->records[tail % ring_size];
+        emit(record.level, format_record(record));
+
+        // Hand the slot back before the next one is formatted
+        ring->tail.store(tail + 1, std::memory_order_release);
+      }
+
+      newly_dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    if (newly_dropped) {
+      dropped += newly_dropped;
+      BOOST_LOG(warning) << "Dropped "sv << newly_dropped << " hot path log messages, the log can't keep up"sv;
+    }
+
+    std::lock_guard lg_rings {rings_mutex};
+    std::erase_if(rings, [](const auto &ring) {
+      return ring->retired && ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+    });
+  }
+
+  std::uint64_t dropped_total() {
+    return dropped;
+  }
+}  // namespace logging::hot
@@ -0,0 +1,191 @@
+/**
+ * @file src/hot_log.h
+ * @brief Declarations for logging from hot loops without going through Boost.Log per message.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <format>
+#include <string_view>
+#include <type_traits>
+
+#ifndef SUNSHINE_HOT_LOG_MIN_LEVEL
+  /**
+   * @brief Lowest level of HOT_LOG() calls that are compiled in, 0 (verbose) keeps all of them.
+   */
+  #define SUNSHINE_HOT_LOG_MIN_LEVEL 0
+#endif
+
+/**
+ * @brief Log from a hot loop, e.g. once per packet.
+ * @details The arguments are copied into a ring of the calling thread and formatted by the hot log
+ *          thread, so a call costs a level check when the level is disabled and a few stores when
+ *          it isn't. Calls below SUNSHINE_HOT_LOG_MIN_LEVEL are removed at compile time. Messages
+ *          are dropped and counted when the ring is full.
+ * @param level One of verbose, debug, info, warning, error or fatal.
+ * @param ... A std::format string followed by up to 6 arithmetic or string literal arguments.
+ * @examples
+ * HOT_LOG(verbose, "Audio [seq {}, pts {}] ::  send...", sequenceNumber, timestamp);
+ * @examples_end
+ */
+#define HOT_LOG(level, ...) \
+  do { \
+    if constexpr (logging::hot::level_##level >= SUNSHINE_HOT_LOG_MIN_LEVEL) { \
+      if (logging::hot::enabled(logging::hot::level_##level)) { \
+        logging::hot::write(logging::hot::level_##level, __VA_ARGS__); \
+      } \
+    } \
+  } while (0)
+
+namespace logging::hot {
+  constexpr int level_verbose = 0;
+  constexpr int level_debug = 1;
+  constexpr int level_info = 2;
+  constexpr int level_warning = 3;
+  constexpr int level_error = 4;
+  constexpr int level_fatal = 5;
+
+  constexpr std::size_t max_args = 6;  ///< Arguments a single message can carry
+  constexpr std::size_t ring_size = 1024;  ///< Messages each thread can queue before they're dropped
+
+  /**
+   * @brief A copied argument of a message.
+   */
+  struct arg_t {
+    enum class type_e : std::uint8_t {
+      none,
+      boolean,
+      signed_int,
+      unsigned_int,
+      floating,
+      string,  ///< A string with static storage, like a literal
+    };
+
+    type_e type = type_e::none;
+
+    union {
+      bool b;
+      std::int64_t i;
+      std::uint64_t u;
+      double d;
+      const char *s;
+    };
+
+    arg_t():
+        u {0} {
+    }
+
+    template<typename T>
+    explicit arg_t(T value) {
+      if constexpr (std::is_same_v<T, bool>) {
+        type = type_e::boolean;
+        b = value;
+      } else if constexpr (std::is_enum_v<T>) {
+        type = type_e::signed_int;
+        i = static_cast<std::int64_t>(value);
+      } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        type = type_e::signed_int;
+        i = value;
+      } else if constexpr (std::is_integral_v<T>) {
+        type = type_e::unsigned_int;
+        u = value;
+      } else if constexpr (std::is_floating_point_v<T>) {
+        type = type_e::floating;
+        d = value;
+      } else {
+        static_assert(std::is_same_v<T, const char *>, "HOT_LOG() only takes arithmetic values and string literals");
+        type = type_e::string;
+        s = value;
+      }
+    }
+  };
+
+  /**
+   * @brief A message waiting in a ring to be formatted.
+   */
+  struct record_t {
+    int level;
+    std::string_view format;  ///< Points into the format string literal
+    std::array<arg_t, max_args> args;
+  };
+
+  /**
+   * @brief Single producer, single consumer queue of one thread's messages.
+   */
+  struct ring_t {
+    std::array<record_t, ring_size> records;
+    std::atomic<std::size_t> head {0};  ///< Next record to write, owned by the producer
+    std::atomic<std::size_t> tail {0};  ///< Next record to read, owned by the consumer
+    std::atomic<std::uint64_t> dropped {0};  ///< Messages lost to a full ring since the last report
+    std::atomic<bool> retired {false};  ///< The thread exited, the ring goes away once it's drained
+  };
+
+  /**
+   * @brief The minimum level that is logged, set when the hot log thread starts.
+   */
+  extern std::atomic<int> min_level;
+
+  /**
+   * @brief Check whether messages of a level are logged.
+   * @param level The level.
+   * @return `true` if it's logged.
+   */
+  inline bool enabled(int level) {
+    return level >= min_level.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Get the ring of the calling thread, registering it with the hot log thread on first use.
+   * @return The ring.
+   */
+  ring_t &thread_ring();
+
+  /**
+   * @brief Queue a message, use HOT_LOG() instead.
+   * @param level The level of the message.
+   * @param format The format of the message.
+   * @param args The arguments.
+   */
+  template<typename... Args>
+  void write(int level, std::format_string<std::decay_t<Args>...> format, Args &&...args) {
+    static_assert(sizeof...(Args) <= max_args, "HOT_LOG() takes at most 6 arguments");
+
+    auto &ring = thread_ring();
+    auto head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= ring_size) {
+      ring.dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    auto &record = ring.records[head % ring_size];
+    record.level = level;
+    record.format = format.get();
+    record.args = {arg_t {static_cast<std::decay_t<Args>>(args)}...};
+    ring.head.store(head + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Start the thread that formats the queued messages.
+   * @param min_log_level The minimum level to log.
+   */
+  void start(int min_log_level);
+
+  /**
+   * @brief Format what's left and stop the hot log thread.
+   */
+  void stop();
+
+  /**
+   * @brief Format all queued messages right away.
+   */
+  void drain();
+
+  /**
+   * @brief Get the number of messages dropped because a ring was full.
+   * @return The number of messages dropped since the start.
+   */
+  std::uint64_t dropped_total();
+}  // namespace logging::hot
@@ -215,6 +215,41 @@ namespace http {
     return result == CURLE_OK;
   }
 
+  bool post_json(const std::string &url, const std::string &body, std::chrono::milliseconds timeout) {
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+      BOOST_LOG(error) << "Couldn't create CURL instance";
+      return false;
+    }
+
+    curl_slist *headers = curl_slist_append(nullptr, "Content-Type: application/json");
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) body.size());
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long) timeout.count());
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1_2);
+#ifdef _WIN32
+    curl_easy_setopt(curl, CURLOPT_SSL_OPTIONS, CURLSSLOPT_NATIVE_CA);
+#endif
+    // The response body isn't needed, only its status
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, +[](char *, size_t size, size_t nmemb, void *) {
+      return size * nmemb;
+    });
+
+    CURLcode result = curl_easy_perform(curl);
+    long status = 0;
+    if (result == CURLE_OK) {
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    } else {
+      BOOST_LOG(debug) << "Couldn't post to ["sv << url << ", code:" << result << ']';
+    }
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+    return result == CURLE_OK && status >= 200 && status < 300;
+  }
+
   std::string url_escape(const std::string &url) {
     char *string = curl_easy_escape(nullptr, url.c_str(), static_cast<int>(url.length()));
     std::string result(string);
@@ -4,6 +4,9 @@
  */
 #pragma once
 
+// standard includes
+#include <chrono>
+
 // lib includes
 #include <curl/curl.h>
 
@@ -59,6 +62,15 @@ namespace http {
    */
   bool download_file(const std::string &url, const std::string &file, long ssl_version = CURL_SSLVERSION_TLSv1_2);
 
+  /**
+   * @brief Post a JSON body to a URL.
+   * @param url The URL to post to.
+   * @param body The JSON body.
+   * @param timeout How long the whole request may take.
+   * @return `true` if the server answered with a 2xx status, `false` on error.
+   */
+  bool post_json(const std::string &url, const std::string &body, std::chrono::milliseconds timeout);
+
   /**
    * @brief URL-escape a string.
    * @param url The string to escape.
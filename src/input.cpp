@@ -9,10 +9,15 @@ extern "C" {
 }
 
 // standard includes
+#include <array>
+#include <atomic>
 #include <bitset>
 #include <chrono>
 #include <cmath>
-#include <list>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <optional>
 #include <thread>
 #include <unordered_map>
 
@@ -24,7 +29,10 @@ extern "C" {
 #include "globals.h"
 #include "input.h"
 #include "logging.h"
+#include "metrics.h"
+#include "pipeline_trace.h"
 #include "platform/common.h"
+#include "thread_placement.h"
 #include "thread_pool.h"
 #include "utility.h"
 
@@ -137,9 +145,196 @@ namespace input {
   static platf::input_t platf_input;
   static std::bitset<platf::MAX_GAMEPADS> gamepadMask {};
 
+  /**
+   * @brief Serializes injection into platf_input.
+   *
+   * Every session injects from its own input thread, while delayed input tasks
+   * such as key repeat and button emulation still run on the task pool.
+   */
+  static std::mutex injection_lock;
+
+  static auto &gamepad_updates_sent = metrics::counter("gamepad_updates_sent"sv);  ///< Controller states sent to the OS.
+  static auto &gamepad_updates_dropped = metrics::counter("gamepad_updates_dropped"sv);  ///< Controller packets matching the state already sent.
+  static auto &gamepad_updates_merged = metrics::counter("gamepad_updates_merged"sv);  ///< Controller packets batched into a later state.
+
+#if defined(SUNSHINE_TESTS) || defined(SUNSHINE_BENCHMARKS)
+  static std::atomic<bool> null_backend_enabled {false};
+  static std::mutex null_backend_lock;
+  static null_backend_stats_t null_backend;
+
+  void use_null_backend(bool enabled) {
+    null_backend_enabled = enabled;
+  }
+
+  null_backend_stats_t null_backend_stats() {
+    std::lock_guard lg {null_backend_lock};
+    return null_backend;
+  }
+
+  /**
+   * @brief Injection entry points, which test builds can route to a null backend.
+   * @details The null backend only records the calls, so the input replay tests check and
+   *          the input replay benchmarks measure the pipeline itself without an OS to inject into.
+   */
+  namespace inject {
+    /**
+     * @brief Record a call if the null backend is enabled.
+     * @param record Records what the call injects into the null backend stats.
+     * @return `true` if the call must not reach the platform backend.
+     */
+    template<class F>
+    bool null_call(F &&record) {
+      if (!null_backend_enabled.load(std::memory_order_relaxed)) {
+        return false;
+      }
+
+      std::lock_guard lg {null_backend_lock};
+      ++null_backend.calls;
+      null_backend.last_call = std::chrono::steady_clock::now();
+      record(null_backend);
+      return true;
+    }
+
+    bool null_call() {
+      return null_call([](null_backend_stats_t &) {});
+    }
+
+    void move_mouse(platf::input_t &input, int deltaX, int deltaY) {
+      if (!null_call([&](null_backend_stats_t &stats) {
+            ++stats.mouse_moves;
+            stats.mouse_x += deltaX;
+            stats.mouse_y += deltaY;
+          })) {
+        platf::move_mouse(input, deltaX, deltaY);
+      }
+    }
+
+    void abs_mouse(platf::input_t &input, const platf::touch_port_t &touch_port, float x, float y) {
+      if (!null_call()) {
+        platf::abs_mouse(input, touch_port, x, y);
+      }
+    }
+
+    void button_mouse(platf::input_t &input, int button, bool release) {
+      if (!null_call([](null_backend_stats_t &stats) {
+            ++stats.mouse_buttons;
+          })) {
+        platf::button_mouse(input, button, release);
+      }
+    }
+
+    void scroll(platf::input_t &input, int distance) {
+      if (!null_call([&](null_backend_stats_t &stats) {
+            stats.scroll_distance += distance;
+          })) {
+        platf::scroll(input, distance);
+      }
+    }
+
+    void hscroll(platf::input_t &input, int distance) {
+      if (!null_call()) {
+        platf::hscroll(input, distance);
+      }
+    }
+
+    void keyboard_update(platf::input_t &input, uint16_t modcode, bool release, uint8_t flags) {
+      if (!null_call([&](null_backend_stats_t &stats) {
+            ++(release ? stats.key_releases : stats.key_presses);
+          })) {
+        platf::keyboard_update(input, modcode, release, flags);
+      }
+    }
+
+    void gamepad_update(platf::input_t &input, int nr, const platf::gamepad_state_t &gamepad_state) {
+      if (!null_call([&](null_backend_stats_t &stats) {
+            ++stats.gamepad_updates;
+            stats.gamepads[nr] = gamepad_state;
+          })) {
+        platf::gamepad_update(input, nr, gamepad_state);
+      }
+    }
+
+    void unicode(platf::input_t &input, char *utf8, int size) {
+      if (!null_call()) {
+        platf::unicode(input, utf8, size);
+      }
+    }
+
+    void begin_input_batch(platf::input_t &input) {
+      if (!null_backend_enabled) {
+        platf::begin_input_batch(input);
+      }
+    }
+
+    void end_input_batch(platf::input_t &input) {
+      if (!null_backend_enabled) {
+        platf::end_input_batch(input);
+      }
+    }
+
+    std::unique_ptr<platf::client_input_t> allocate_client_input_context(platf::input_t &input) {
+      if (null_backend_enabled) {
+        return nullptr;
+      }
+      return platf::allocate_client_input_context(input);
+    }
+
+    void touch_update(platf::client_input_t *input, const platf::touch_port_t &touch_port, const platf::touch_input_t &touch) {
+      if (!null_call([&](null_backend_stats_t &stats) {
+            ++stats.touch_updates;
+            stats.last_touch = touch;
+          })) {
+        platf::touch_update(input, touch_port, touch);
+      }
+    }
+
+    void pen_update(platf::client_input_t *input, const platf::touch_port_t &touch_port, const platf::pen_input_t &pen) {
+      if (!null_call([&](null_backend_stats_t &stats) {
+            ++stats.pen_updates;
+            stats.last_pen = pen;
+          })) {
+        platf::pen_update(input, touch_port, pen);
+      }
+    }
+
+    void gamepad_touch(platf::input_t &input, const platf::gamepad_touch_t &touch) {
+      if (!null_call()) {
+        platf::gamepad_touch(input, touch);
+      }
+    }
+
+    void gamepad_motion(platf::input_t &input, const platf::gamepad_motion_t &motion) {
+      if (!null_call()) {
+        platf::gamepad_motion(input, motion);
+      }
+    }
+
+    void gamepad_battery(platf::input_t &input, const platf::gamepad_battery_t &battery) {
+      if (!null_call()) {
+        platf::gamepad_battery(input, battery);
+      }
+    }
+
+    int alloc_gamepad(platf::input_t &input, const platf::gamepad_id_t &id, const platf::gamepad_arrival_t &metadata, platf::feedback_queue_t feedback_queue) {
+      if (null_call()) {
+        return 0;
+      }
+      return platf::alloc_gamepad(input, id, metadata, std::move(feedback_queue));
+    }
+
+    void free_gamepad(platf::input_t &input, int nr) {
+      if (!null_call()) {
+        platf::free_gamepad(input, nr);
+      }
+    }
+  }  // namespace inject
+#else
+  namespace inject = platf;
+#endif
+
   void free_gamepad(platf::input_t &platf_input, int id) {
-    platf::gamepad_update(platf_input, id, platf::gamepad_state_t {});
-    platf::free_gamepad(platf_input, id);
+    inject::gamepad_update(platf_input, id, platf::gamepad_state_t {});
+    inject::free_gamepad(platf_input, id);
 
     free_id(gamepadMask, id);
   }
@@ -156,12 +351,14 @@ namespace input {
         gamepad_state {},
         back_timeout_id {},
         id {-1},
-        back_button_state {button_state_e::NONE} {
+        back_button_state {button_state_e::NONE},
+        motion_samples {} {
     }
 
     ~gamepad_t() {
       if (id >= 0) {
         task_pool.push([id = this->id]() {
+          std::lock_guard<std::mutex> lg(injection_lock);
           free_gamepad(platf_input, id);
         });
       }
@@ -179,6 +376,153 @@ namespace input {
     // Sunshine forces the button to be in a specific state until the gamepad state matches that of
     // Moonlight once more.
     button_state_e back_button_state;  ///< Forced state for back button during HOME button emulation.
+
+    /**
+     * @brief Motion samples of one sensor received since the last motion report.
+     */
+    struct motion_samples_t {
+      float x;  ///< Sum of the X axis samples.
+      float y;  ///< Sum of the Y axis samples.
+      float z;  ///< Sum of the Z axis samples.
+      int count;  ///< Number of samples summed up.
+    };
+
+    std::array<motion_samples_t, 2> motion_samples;  ///< Accelerometer and gyro samples waiting for the next motion report.
+  };
+
+  enum class batch_result_e {
+    batched,  ///< This entry was batched with the source entry
+    not_batchable,  ///< Not eligible to batch but continue attempts to batch
+    terminate_batch,  ///< Stop trying to batch with this entry
+  };
+
+  /**
+   * @brief Preallocated ring of input packets between the control stream and the input thread.
+   *
+   * The control stream thread is the only producer and the session input thread is the only
+   * consumer, so the indices are handed over with acquire/release ordering instead of a lock.
+   * Slots between head and tail belong to the consumer, which batches later packets into the
+   * one it is about to send and marks them as consumed in place.
+   */
+  class input_ring_t {
+  public:
+    static constexpr std::size_t capacity = 1024;  ///< Number of slots, must be a power of two.
+    static constexpr std::size_t max_packet_size = 256;  ///< Largest input packet a slot can hold.
+
+    /**
+     * @brief A single preallocated packet slot.
+     */
+    struct slot_t {
+      std::uint16_t size;  ///< Number of valid bytes in data.
+      bool batched;  ///< Set once the packet was merged into an earlier one.
+      std::chrono::steady_clock::time_point arrival;  ///< When the control stream queued the packet.
+      alignas(8) std::uint8_t data[max_packet_size];  ///< Raw packet starting with NV_INPUT_HEADER.
+    };
+
+    /**
+     * @brief Packet popped off the ring, owned by the consumer.
+     */
+    struct packet_t {
+      alignas(8) std::array<std::uint8_t, max_packet_size> data;  ///< Raw packet bytes.
+      std::uint16_t size;  ///< Number of valid bytes in data.
+      std::chrono::steady_clock::time_point arrival;  ///< When the oldest packet batched into it was queued.
+    };
+
+    input_ring_t():
+        slots {std::make_unique<slot_t[]>(capacity)} {
+    }
+
+    /**
+     * @brief Copy a packet into the next free slot.
+     * @note Only called from the control stream thread.
+     * @param data The packet.
+     * @param size The packet size in bytes.
+     * @return `false` if the packet doesn't fit into a slot.
+     */
+    bool push(const std::uint8_t *data, std::size_t size) {
+      if (size < sizeof(NV_INPUT_HEADER) || size > max_packet_size) {
+        return false;
+      }
+
+      auto tail_index = tail.load(std::memory_order_relaxed);
+
+      // The input thread drains the ring far faster than clients send, so a full ring only
+      // happens while the OS stalls input injection. Wait instead of dropping the packet.
+      while (tail_index - head.load(std::memory_order_acquire) >= capacity) {
+        std::this_thread::yield();
+      }
+
+      auto &slot = slots[tail_index & (capacity - 1)];
+      std::memcpy(slot.data, data, size);
+      slot.size = (std::uint16_t) size;
+      slot.batched = false;
+      slot.arrival = std::chrono::steady_clock::now();
+
+      tail.store(tail_index + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief Pop the oldest packet and batch later compatible packets into it.
+     * @note Only called from the session input thread.
+     * @param packet Receives the packet to send.
+     * @param batch_f Callback batching its second argument into its first.
+     * @return `false` if the ring is empty.
+     */
+    template<class F>
+    bool pop(packet_t &packet, F &&batch_f) {
+      auto head_index = head.load(std::memory_order_relaxed);
+      auto tail_index = tail.load(std::memory_order_acquire);
+
+      // Skip packets that were already merged into an earlier one
+      while (head_index != tail_index && slots[head_index & (capacity - 1)].batched) {
+        ++head_index;
+      }
+
+      if (head_index == tail_index) {
+        head.store(head_index, std::memory_order_release);
+        return false;
+      }
+
+      auto &first = slots[head_index & (capacity - 1)];
+      std::memcpy(packet.data.data(), first.data, first.size);
+      packet.size = first.size;
+      packet.arrival = first.arrival;
+
+      for (auto x = head_index + 1; x != tail_index; ++x) {
+        auto &slot = slots[x & (capacity - 1)];
+        if (slot.batched) {
+          continue;
+        }
+
+        auto result = batch_f((PNV_INPUT_HEADER) packet.data.data(), (PNV_INPUT_HEADER) slot.data);
+        if (result == batch_result_e::terminate_batch) {
+          break;
+        } else if (result == batch_result_e::batched) {
+          slot.batched = true;
+        }
+      }
+
+      head.store(head_index + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+    std::unique_ptr<slot_t[]> slots;
+    std::atomic<std::size_t> head {0};  ///< Next slot to consume, written by the input thread.
+    std::atomic<std::size_t> tail {0};  ///< Next slot to fill, written by the control stream thread.
+  };
+
+  /**
+   * @brief Wakes a session's input thread.
+   *
+   * Shared with the input thread so it stays valid after the input context is destroyed.
+   */
+  struct input_signal_t {
+    std::mutex lock;  ///< Protects the flags below.
+    std::condition_variable cv;  ///< Notified when a flag is set.
+    bool pending {false};  ///< Packets were queued since the input thread last drained the ring.
+    bool stopped {false};  ///< The input context was destroyed.
   };
 
   /**
@@ -213,13 +557,32 @@ namespace input {
     ):
         shortcutFlags {},
         gamepads(MAX_GAMEPADS),
-        client_context {platf::allocate_client_input_context(platf_input)},
+        client_context {inject::allocate_client_input_context(platf_input)},
         touch_port_event {std::move(touch_port_event)},
         feedback_queue {std::move(feedback_queue)},
         mouse_left_button_timeout {},
         touch_port {{0, 0, 0, 0}, 0, 0, 1.0f},
+        touch_transform {},
         accumulated_vscroll_delta {},
-        accumulated_hscroll_delta {} {
+        accumulated_hscroll_delta {},
+        motion_pending {},
+        mouse_motion {},
+        input_signal {std::make_shared<input_signal_t>()} {
+    }
+
+    ~input_t() {
+      {
+        std::lock_guard<std::mutex> lg(input_signal->lock);
+        input_signal->stopped = true;
+      }
+      input_signal->cv.notify_one();
+
+      // The input thread may be the one releasing the last reference
+      if (input_thread.get_id() == std::this_thread::get_id()) {
+        input_thread.detach();
+      } else if (input_thread.joinable()) {
+        input_thread.join();
+      }
     }
 
     int shortcutFlags;  ///< Bitmask tracking alt+ctrl+shift key combination state.
@@ -230,15 +593,51 @@ namespace input {
     safe::mail_raw_t::event_t<input::touch_port_t> touch_port_event;  ///< Event for touch port coordinate updates.
     platf::feedback_queue_t feedback_queue;  ///< Queue for sending gamepad feedback (rumble, triggers, etc.).
 
-    std::list<std::vector<uint8_t>> input_queue;  ///< Queue of input packets waiting to be processed.
-    std::mutex input_queue_lock;  ///< Mutex protecting the input queue.
+    input_ring_t input_ring;  ///< Input packets waiting to be processed by the input thread.
 
     thread_pool_util::ThreadPool::task_id_t mouse_left_button_timeout;  ///< Task ID for mouse left button timeout handling.
 
     input::touch_port_t touch_port;  ///< Current touch port coordinates and scaling.
 
+    /**
+     * @brief Affine map from normalized client coordinates to normalized host coordinates.
+     *
+     * Index 0 is the X axis and index 1 the Y axis. Recomputed whenever touch_port changes.
+     */
+    struct touch_transform_t {
+      std::array<float, 2> min;  ///< Lower clamp bound in client coordinates.
+      std::array<float, 2> max;  ///< Upper clamp bound in client coordinates.
+      std::array<float, 2> scale;  ///< Scale applied after clamping.
+      std::array<float, 2> offset;  ///< Offset applied after scaling.
+    };
+
+    touch_transform_t touch_transform;  ///< Transform for touch and pen contacts derived from touch_port.
+
     int32_t accumulated_vscroll_delta;  ///< Accumulated vertical scroll delta for high-resolution scrolling.
     int32_t accumulated_hscroll_delta;  ///< Accumulated horizontal scroll delta for high-resolution scrolling.
+
+    bool motion_pending;  ///< Motion samples are waiting for the next motion report, only used on input_thread.
+
+    /**
+     * @brief Relative mouse movement received but not injected yet.
+     */
+    struct mouse_motion_t {
+      float pending_x;  ///< Horizontal movement left to inject.
+      float pending_y;  ///< Vertical movement left to inject.
+      float step_x;  ///< Horizontal movement injected per smoothing step.
+      float step_y;  ///< Vertical movement injected per smoothing step.
+      float fraction_x;  ///< Horizontal sub-pixel movement carried over to the next step.
+      float fraction_y;  ///< Vertical sub-pixel movement carried over to the next step.
+
+      bool moving() const {
+        return pending_x != 0 || pending_y != 0;
+      }
+    };
+
+    mouse_motion_t mouse_motion;  ///< Movement spread out by mouse smoothing, only used on input_thread.
+
+    std::shared_ptr<input_signal_t> input_signal;  ///< Wakes input_thread when packets are queued.
+    std::thread input_thread;  ///< Session input thread draining input_ring.
   };
 
   /**
@@ -253,7 +652,7 @@ namespace input {
     BOOST_LOG(debug) << "Apply Shortcut: 0x"sv << util::hex((std::uint8_t) keyCode).to_string_view();
 
     if (keyCode >= VK_F1 && keyCode <= VK_F13) {
-      mail::man->event<int>(mail::switch_display)->raise(keyCode - VK_F1);
+      mail::man->event(mail::switch_display)->raise(keyCode - VK_F1);
       return 1;
     }
 
@@ -487,13 +886,55 @@ namespace input {
     }
   }
 
+  /**
+   * @brief Number of smoothing steps a burst of relative mouse movement is spread over.
+   */
+  constexpr auto MOUSE_SMOOTHING_STEPS = 4;
+
+  /**
+   * @brief Inject the next step of the relative mouse movement spread out by mouse smoothing.
+   * @param input The input context pointer.
+   * @param flush Inject all of the remaining movement at once.
+   */
+  void send_mouse_movement(std::shared_ptr<input_t> &input, bool flush) {
+    auto take = [flush](float &pending, float step, float &fraction) {
+      auto amount = flush || std::abs(step) >= std::abs(pending) ? pending : step;
+      pending -= amount;
+
+      // Carry sub-pixel movement over, and round it away once the movement is complete
+      auto total = fraction + amount;
+      auto move = pending == 0 ? std::round(total) : std::trunc(total);
+      fraction = pending == 0 ? 0 : total - move;
+
+      return (int) move;
+    };
+
+    auto &motion = input->mouse_motion;
+    auto deltaX = take(motion.pending_x, motion.step_x, motion.fraction_x);
+    auto deltaY = take(motion.pending_y, motion.step_y, motion.fraction_y);
+    if (deltaX || deltaY) {
+      inject::move_mouse(platf_input, deltaX, deltaY);
+    }
+  }
+
   void passthrough(std::shared_ptr<input_t> &input, PNV_REL_MOUSE_MOVE_PACKET packet) {
     if (!config::input.mouse) {
       return;
     }
 
     input->mouse_left_button_timeout = DISABLE_LEFT_BUTTON_DELAY;
-    platf::move_mouse(platf_input, util::endian::big(packet->deltaX), util::endian::big(packet->deltaY));
+
+    // Spread the movement over a few steps at the smoothing rate, see input_thread_main()
+    if (config::input.mouse_smoothing_rate > 0) {
+      auto &motion = input->mouse_motion;
+      motion.pending_x += util::endian::big(packet->deltaX);
+      motion.pending_y += util::endian::big(packet->deltaY);
+      motion.step_x = motion.pending_x / MOUSE_SMOOTHING_STEPS;
+      motion.step_y = motion.pending_y / MOUSE_SMOOTHING_STEPS;
+      return;
+    }
+
+    inject::move_mouse(platf_input, util::endian::big(packet->deltaX), util::endian::big(packet->deltaY));
   }
 
   /**
@@ -503,17 +944,67 @@ namespace input {
    * @param size The size of the client's surface containing the value.
    * @return The host-relative coordinate pair if a touchport is available.
    */
-  std::optional<std::pair<float, float>> client_to_touchport(std::shared_ptr<input_t> &input, const std::pair<float, float> &val, const std::pair<float, float> &size) {
+  /**
+   * @brief Pick up touch port changes and precompute the touch contact transform.
+   * @param input The input context.
+   * @return `false` if there is no touch port yet.
+   */
+  bool update_touch_port(std::shared_ptr<input_t> &input) {
     auto &touch_port_event = input->touch_port_event;
     auto &touch_port = input->touch_port;
     if (touch_port_event->peek()) {
       touch_port = *touch_port_event->pop();
+
+      if (touch_port) {
+        // Same math as client_to_touchport() followed by renormalizing to the environment,
+        // folded into a clamp and a multiply-add per axis
+        auto &transform = input->touch_transform;
+        std::array<float, 2> port_size {(float) touch_port.width, (float) touch_port.height};
+        std::array<float, 2> client_offset {touch_port.client_offsetX, touch_port.client_offsetY};
+        std::array<float, 2> env_size {(float) touch_port.env_width, (float) touch_port.env_height};
+        for (int axis = 0; axis < 2; ++axis) {
+          transform.min[axis] = client_offset[axis] / port_size[axis];
+          transform.max[axis] = 1.0f - transform.min[axis];
+          transform.scale[axis] = port_size[axis] * touch_port.scalar_inv / env_size[axis];
+          transform.offset[axis] = -client_offset[axis] * touch_port.scalar_inv / env_size[axis];
+        }
+      }
     }
     if (!touch_port) {
       BOOST_LOG(verbose) << "Ignoring early absolute input without a touch port"sv;
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Converts normalized client coordinates into coordinates normalized to the touch environment.
+   * @param input The input context.
+   * @param x The normalized client X coordinate.
+   * @param y The normalized client Y coordinate.
+   * @return The normalized host coordinate pair if a touchport is available.
+   */
+  std::optional<std::pair<float, float>> client_to_normalized_touchport(std::shared_ptr<input_t> &input, float x, float y) {
+    if (!update_touch_port(input)) {
       return std::nullopt;
     }
 
+    auto &transform = input->touch_transform;
+    std::array<float, 2> coords {x, y};
+    for (int axis = 0; axis < 2; ++axis) {
+      coords[axis] = std::clamp(coords[axis], transform.min[axis], transform.max[axis]) * transform.scale[axis] + transform.offset[axis];
+    }
+
+    return std::pair {coords[0], coords[1]};
+  }
+
+  std::optional<std::pair<float, float>> client_to_touchport(std::shared_ptr<input_t> &input, const std::pair<float, float> &val, const std::pair<float, float> &size) {
+    if (!update_touch_port(input)) {
+      return std::nullopt;
+    }
+    auto &touch_port = input->touch_port;
+
     auto scalarX = touch_port.width / size.first;
     auto scalarY = touch_port.height / size.second;
 
@@ -532,34 +1023,33 @@ namespace input {
   /**
    * @brief Multiply a polar coordinate pair by a cartesian scaling factor.
    * @param r The radial coordinate.
-   * @param angle The angular coordinate (radians).
+   * @param cos_angle The cosine of the angular coordinate.
+   * @param sin_angle The sine of the angular coordinate.
    * @param scalar The scalar cartesian coordinate pair.
    * @return The scaled radial coordinate.
    */
-  float multiply_polar_by_cartesian_scalar(float r, float angle, const std::pair<float, float> &scalar) {
-    // Convert polar to cartesian coordinates
-    float x = r * std::cos(angle);
-    float y = r * std::sin(angle);
-
-    // Scale the values
-    x *= scalar.first;
-    y *= scalar.second;
+  float multiply_polar_by_cartesian_scalar(float r, float cos_angle, float sin_angle, const std::pair<float, float> &scalar) {
+    // Convert polar to cartesian coordinates and scale the values
+    float x = r * cos_angle * scalar.first;
+    float y = r * sin_angle * scalar.second;
 
     // Convert the result back to a polar radial coordinate
-    return std::sqrt(std::pow(x, 2) + std::pow(y, 2));
+    return std::sqrt(x * x + y * y);
   }
 
   std::pair<float, float> scale_client_contact_area(const std::pair<float, float> &val, uint16_t rotation, const std::pair<float, float> &scalar) {
     // If the rotation is unknown, we'll just scale both axes equally by using
     // a 45-degree angle for our scaling calculations
     float angle = rotation == LI_ROT_UNKNOWN ? (M_PI / 4) : (rotation * (M_PI / 180));
+    float cos_angle = std::cos(angle);
+    float sin_angle = std::sin(angle);
 
     // If we have a major but not a minor axis, treat the touch as circular
     float major = val.first;
     float minor = val.second != 0.0f ? val.second : val.first;
 
-    // The minor axis is perpendicular to major axis so the angle must be rotated by 90 degrees
-    return {multiply_polar_by_cartesian_scalar(major, angle, scalar), multiply_polar_by_cartesian_scalar(minor, angle + (M_PI / 2), scalar)};
+    // The minor axis is perpendicular to major axis, rotating by 90 degrees turns (cos, sin) into (-sin, cos)
+    return {multiply_polar_by_cartesian_scalar(major, cos_angle, sin_angle, scalar), multiply_polar_by_cartesian_scalar(minor, -sin_angle, cos_angle, scalar)};
   }
 
   void passthrough(std::shared_ptr<input_t> &input, PNV_ABS_MOUSE_MOVE_PACKET packet) {
@@ -567,6 +1057,10 @@ namespace input {
       return;
     }
 
+    if (input->mouse_motion.moving()) {
+      send_mouse_movement(input, true);
+    }
+
     if (input->mouse_left_button_timeout == DISABLE_LEFT_BUTTON_DELAY) {
       input->mouse_left_button_timeout = ENABLE_LEFT_BUTTON_DELAY;
     }
@@ -598,7 +1092,7 @@ namespace input {
       touch_port.env_height
     };
 
-    platf::abs_mouse(platf_input, abs_port, tpcoords->first, tpcoords->second);
+    inject::abs_mouse(platf_input, abs_port, tpcoords->first, tpcoords->second);
   }
 
   void passthrough(std::shared_ptr<input_t> &input, PNV_MOUSE_BUTTON_PACKET packet) {
@@ -606,6 +1100,11 @@ namespace input {
       return;
     }
 
+    // Clicks must land where the movement before them ends
+    if (input->mouse_motion.moving()) {
+      send_mouse_movement(input, true);
+    }
+
     auto release = util::endian::little(packet->header.magic) == MOUSE_BUTTON_UP_EVENT_MAGIC_GEN5;
     auto button = util::endian::big(packet->button);
     if (button > 0 && button < mouse_press.size()) {
@@ -632,12 +1131,14 @@ namespace input {
      */
     if (button == BUTTON_LEFT && release && !input->mouse_left_button_timeout) {
       auto f = [=]() {
+        std::lock_guard<std::mutex> lg(injection_lock);
+
         auto left_released = mouse_press[BUTTON_LEFT];
         if (left_released) {
           // Already released left button
           return;
         }
-        platf::button_mouse(platf_input, BUTTON_LEFT, release);
+        inject::button_mouse(platf_input, BUTTON_LEFT, release);
 
         mouse_press[BUTTON_LEFT] = false;
         input->mouse_left_button_timeout = nullptr;
@@ -651,15 +1152,15 @@ namespace input {
       button == BUTTON_RIGHT && !release &&
       input->mouse_left_button_timeout > DISABLE_LEFT_BUTTON_DELAY
     ) {
-      platf::button_mouse(platf_input, BUTTON_RIGHT, false);
-      platf::button_mouse(platf_input, BUTTON_RIGHT, true);
+      inject::button_mouse(platf_input, BUTTON_RIGHT, false);
+      inject::button_mouse(platf_input, BUTTON_RIGHT, true);
 
       mouse_press[BUTTON_RIGHT] = false;
 
       return;
     }
 
-    platf::button_mouse(platf_input, button, release);
+    inject::button_mouse(platf_input, button, release);
   }
 
   short map_keycode(short keycode) {
@@ -727,33 +1228,35 @@ namespace input {
     if (!release) {
       // Press any synthetic modifiers required for this key
       if (synthetic_modifiers & MODIFIER_SHIFT) {
-        platf::keyboard_update(platf_input, VKEY_SHIFT, false, flags);
+        inject::keyboard_update(platf_input, VKEY_SHIFT, false, flags);
       }
       if (synthetic_modifiers & MODIFIER_CTRL) {
-        platf::keyboard_update(platf_input, VKEY_CONTROL, false, flags);
+        inject::keyboard_update(platf_input, VKEY_CONTROL, false, flags);
       }
       if (synthetic_modifiers & MODIFIER_ALT) {
-        platf::keyboard_update(platf_input, VKEY_MENU, false, flags);
+        inject::keyboard_update(platf_input, VKEY_MENU, false, flags);
       }
     }
 
-    platf::keyboard_update(platf_input, map_keycode(key_code), release, flags);
+    inject::keyboard_update(platf_input, map_keycode(key_code), release, flags);
 
     if (!release) {
       // Raise any synthetic modifier keys we pressed
       if (synthetic_modifiers & MODIFIER_SHIFT) {
-        platf::keyboard_update(platf_input, VKEY_SHIFT, true, flags);
+        inject::keyboard_update(platf_input, VKEY_SHIFT, true, flags);
       }
       if (synthetic_modifiers & MODIFIER_CTRL) {
-        platf::keyboard_update(platf_input, VKEY_CONTROL, true, flags);
+        inject::keyboard_update(platf_input, VKEY_CONTROL, true, flags);
       }
       if (synthetic_modifiers & MODIFIER_ALT) {
-        platf::keyboard_update(platf_input, VKEY_MENU, true, flags);
+        inject::keyboard_update(platf_input, VKEY_MENU, true, flags);
       }
     }
   }
 
   void repeat_key(uint16_t key_code, uint8_t flags, uint8_t synthetic_modifiers) {
+    std::lock_guard<std::mutex> lg(injection_lock);
+
     // If key no longer pressed, stop repeating
     if (!key_press[make_kpid(key_code, flags)]) {
       key_press_repeat_id = nullptr;
@@ -831,13 +1334,13 @@ namespace input {
     }
 
     if (config::input.high_resolution_scrolling) {
-      platf::scroll(platf_input, util::endian::big(packet->scrollAmt1));
+      inject::scroll(platf_input, util::endian::big(packet->scrollAmt1));
     } else {
       input->accumulated_vscroll_delta += util::endian::big(packet->scrollAmt1);
       auto full_ticks = input->accumulated_vscroll_delta / WHEEL_DELTA;
       if (full_ticks) {
         // Send any full ticks that have accumulated and store the rest
-        platf::scroll(platf_input, full_ticks * WHEEL_DELTA);
+        inject::scroll(platf_input, full_ticks * WHEEL_DELTA);
         input->accumulated_vscroll_delta -= full_ticks * WHEEL_DELTA;
       }
     }
@@ -854,13 +1357,13 @@ namespace input {
     }
 
     if (config::input.high_resolution_scrolling) {
-      platf::hscroll(platf_input, util::endian::big(packet->scrollAmount));
+      inject::hscroll(platf_input, util::endian::big(packet->scrollAmount));
     } else {
       input->accumulated_hscroll_delta += util::endian::big(packet->scrollAmount);
       auto full_ticks = input->accumulated_hscroll_delta / WHEEL_DELTA;
       if (full_ticks) {
         // Send any full ticks that have accumulated and store the rest
-        platf::hscroll(platf_input, full_ticks * WHEEL_DELTA);
+        inject::hscroll(platf_input, full_ticks * WHEEL_DELTA);
         input->accumulated_hscroll_delta -= full_ticks * WHEEL_DELTA;
       }
     }
@@ -872,7 +1375,7 @@ namespace input {
     }
 
     auto size = util::endian::big(packet->header.size) - sizeof(packet->header.magic);
-    platf::unicode(platf_input, packet->text, size);
+    inject::unicode(platf_input, packet->text, size);
   }
 
   /**
@@ -907,12 +1410,16 @@ namespace input {
     }
 
     // Allocate a new gamepad
-    if (platf::alloc_gamepad(platf_input, {id, packet->controllerNumber}, arrival, input->feedback_queue)) {
+    if (inject::alloc_gamepad(platf_input, {id, packet->controllerNumber}, arrival, input->feedback_queue)) {
       free_id(gamepadMask, id);
       return;
     }
 
     input->gamepads[packet->controllerNumber].id = id;
+
+    // A new virtual gamepad starts out neutral, so must the state cache
+    input->gamepads[packet->controllerNumber].gamepad_state = {};
+    input->gamepads[packet->controllerNumber].motion_samples = {};
   }
 
   /**
@@ -925,8 +1432,8 @@ namespace input {
       return;
     }
 
-    // Convert the client normalized coordinates to touchport coordinates
-    auto coords = client_to_touchport(input, {from_clamped_netfloat(packet->x, 0.0f, 1.0f) * 65535.f, from_clamped_netfloat(packet->y, 0.0f, 1.0f) * 65535.f}, {65535.f, 65535.f});
+    // Convert the client normalized coordinates to normalized touchport coordinates
+    auto coords = client_to_normalized_touchport(input, from_clamped_netfloat(packet->x, 0.0f, 1.0f), from_clamped_netfloat(packet->y, 0.0f, 1.0f));
     if (!coords) {
       return;
     }
@@ -939,10 +1446,6 @@ namespace input {
       touch_port.env_height
     };
 
-    // Renormalize the coordinates
-    coords->first /= abs_port.width;
-    coords->second /= abs_port.height;
-
     // Normalize rotation value to 0-359 degree range
     auto rotation = util::endian::little(packet->rotation);
     if (rotation != LI_ROT_UNKNOWN) {
@@ -968,7 +1471,7 @@ namespace input {
       contact_area.second,
     };
 
-    platf::touch_update(input->client_context.get(), abs_port, touch);
+    inject::touch_update(input->client_context.get(), abs_port, touch);
   }
 
   /**
@@ -981,8 +1484,8 @@ namespace input {
       return;
     }
 
-    // Convert the client normalized coordinates to touchport coordinates
-    auto coords = client_to_touchport(input, {from_clamped_netfloat(packet->x, 0.0f, 1.0f) * 65535.f, from_clamped_netfloat(packet->y, 0.0f, 1.0f) * 65535.f}, {65535.f, 65535.f});
+    // Convert the client normalized coordinates to normalized touchport coordinates
+    auto coords = client_to_normalized_touchport(input, from_clamped_netfloat(packet->x, 0.0f, 1.0f), from_clamped_netfloat(packet->y, 0.0f, 1.0f));
     if (!coords) {
       return;
     }
@@ -995,10 +1498,6 @@ namespace input {
       touch_port.env_height
     };
 
-    // Renormalize the coordinates
-    coords->first /= abs_port.width;
-    coords->second /= abs_port.height;
-
     // Normalize rotation value to 0-359 degree range
     auto rotation = util::endian::little(packet->rotation);
     if (rotation != LI_ROT_UNKNOWN) {
@@ -1026,7 +1525,7 @@ namespace input {
       contact_area.second,
     };
 
-    platf::pen_update(input->client_context.get(), abs_port, pen);
+    inject::pen_update(input->client_context.get(), abs_port, pen);
   }
 
   /**
@@ -1059,7 +1558,7 @@ namespace input {
       from_clamped_netfloat(packet->pressure, 0.0f, 1.0f),
     };
 
-    platf::gamepad_touch(platf_input, touch);
+    inject::gamepad_touch(platf_input, touch);
   }
 
   /**
@@ -1091,7 +1590,55 @@ namespace input {
       from_netfloat(packet->z),
     };
 
-    platf::gamepad_motion(platf_input, motion);
+    // Average the samples into reports at the emulated controller's rate,
+    // see send_motion_reports()
+    if (config::input.motion_report_rate > 0 &&
+        (motion.motionType == LI_MOTION_TYPE_ACCEL || motion.motionType == LI_MOTION_TYPE_GYRO)) {
+      auto &samples = gamepad.motion_samples[motion.motionType - LI_MOTION_TYPE_ACCEL];
+      samples.x += motion.x;
+      samples.y += motion.y;
+      samples.z += motion.z;
+      ++samples.count;
+
+      input->motion_pending = true;
+      return;
+    }
+
+    inject::gamepad_motion(platf_input, motion);
+  }
+
+  /**
+   * @brief Send the average of the motion samples received since the last report.
+   * @param input The input context pointer.
+   *
+   * Gyro samples are angular rates, so their mean over the report interval preserves
+   * the rotation the client measured while smoothing out packets bunched up by the network.
+   */
+  void send_motion_reports(std::shared_ptr<input_t> &input) {
+    input->motion_pending = false;
+
+    for (std::size_t controller = 0; controller < input->gamepads.size(); ++controller) {
+      auto &gamepad = input->gamepads[controller];
+
+      for (std::size_t sensor = 0; sensor < gamepad.motion_samples.size(); ++sensor) {
+        auto &samples = gamepad.motion_samples[sensor];
+        if (!samples.count || gamepad.id < 0) {
+          samples = {};
+          continue;
+        }
+
+        platf::gamepad_motion_t motion {
+          {gamepad.id, (std::uint8_t) controller},
+          (std::uint8_t) (LI_MOTION_TYPE_ACCEL + sensor),
+          samples.x / samples.count,
+          samples.y / samples.count,
+          samples.z / samples.count,
+        };
+        samples = {};
+
+        inject::gamepad_motion(platf_input, motion);
+      }
+    }
   }
 
   /**
@@ -1121,7 +1668,7 @@ namespace input {
       packet->batteryPercentage
     };
 
-    platf::gamepad_battery(platf_input, battery);
+    inject::gamepad_battery(platf_input, battery);
   }
 
   void passthrough(std::shared_ptr<input_t> &input, PNV_MULTI_CONTROLLER_PACKET packet) {
@@ -1145,12 +1692,14 @@ namespace input {
         return;
       }
 
-      if (platf::alloc_gamepad(platf_input, {id, (uint8_t) packet->controllerNumber}, {}, input->feedback_queue)) {
+      if (inject::alloc_gamepad(platf_input, {id, (uint8_t) packet->controllerNumber}, {}, input->feedback_queue)) {
         free_id(gamepadMask, id);
         return;
       }
 
       gamepad.id = id;
+      gamepad.gamepad_state = {};
+      gamepad.motion_samples = {};
     } else if (!(packet->activeGamepadMask & (1 << packet->controllerNumber)) && gamepad.id >= 0) {
       // If this is the final event for a gamepad being removed, free the gamepad and return.
       free_gamepad(platf_input, gamepad.id);
@@ -1207,21 +1756,28 @@ namespace input {
 
             auto &state = gamepad.gamepad_state;
 
-            // Force the back button up
-            gamepad.back_button_state = button_state_e::UP;
-            state.buttonFlags &= ~platf::BACK;
-            platf::gamepad_update(platf_input, gamepad.id, state);
+            {
+              std::lock_guard<std::mutex> lg(injection_lock);
 
-            // Press Home button
-            state.buttonFlags |= platf::HOME;
-            platf::gamepad_update(platf_input, gamepad.id, state);
+              // Force the back button up
+              gamepad.back_button_state = button_state_e::UP;
+              state.buttonFlags &= ~platf::BACK;
+              inject::gamepad_update(platf_input, gamepad.id, state);
 
-            // Sleep for a short time to allow the input to be detected
+              // Press Home button
+              state.buttonFlags |= platf::HOME;
+              inject::gamepad_update(platf_input, gamepad.id, state);
+            }
+
+            // Sleep for a short time to allow the input to be detected,
+            // without holding up the input thread
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
+            std::lock_guard<std::mutex> lg(injection_lock);
+
             // Release Home button
             state.buttonFlags &= ~platf::HOME;
-            platf::gamepad_update(platf_input, gamepad.id, state);
+            inject::gamepad_update(platf_input, gamepad.id, state);
 
             gamepad.back_timeout_id = nullptr;
           };
@@ -1234,17 +1790,19 @@ namespace input {
       }
     }
 
-    platf::gamepad_update(platf_input, gamepad.id, gamepad_state);
+    // Clients resend the controller state at a fixed rate even when nothing changed,
+    // and injecting into ViGEm or uinput is comparatively expensive
+    if (gamepad_state == gamepad.gamepad_state) {
+      gamepad_updates_dropped.add();
+      return;
+    }
+
+    inject::gamepad_update(platf_input, gamepad.id, gamepad_state);
+    gamepad_updates_sent.add();
 
     gamepad.gamepad_state = gamepad_state;
   }
 
-  enum class batch_result_e {
-    batched,  ///< This entry was batched with the source entry
-    not_batchable,  ///< Not eligible to batch but continue attempts to batch
-    terminate_batch,  ///< Stop trying to batch with this entry
-  };
-
   /**
    * @brief Batch two relative mouse messages.
    * @param dest The original packet to batch into.
@@ -1255,10 +1813,10 @@ namespace input {
     short deltaX, deltaY;
 
     // Batching is safe as long as the result doesn't overflow a 16-bit integer
-    if (!__builtin_add_overflow(util::endian::big(dest->deltaX), util::endian::big(src->deltaX), &deltaX)) {
+    if (__builtin_add_overflow(util::endian::big(dest->deltaX), util::endian::big(src->deltaX), &deltaX)) {
       return batch_result_e::terminate_batch;
     }
-    if (!__builtin_add_overflow(util::endian::big(dest->deltaY), util::endian::big(src->deltaY), &deltaY)) {
+    if (__builtin_add_overflow(util::endian::big(dest->deltaY), util::endian::big(src->deltaY), &deltaY)) {
       return batch_result_e::terminate_batch;
     }
 
@@ -1349,6 +1907,7 @@ namespace input {
 
     // Take the latest state
     *dest = *src;
+    gamepad_updates_merged.add();
     return batch_result_e::batched;
   }
 
@@ -1521,53 +2080,28 @@ namespace input {
   }
 
   /**
-   * @brief Called on a thread pool thread to process an input message.
+   * @brief Called on the session input thread to process an input message.
    * @param input The input context pointer.
+   * @return The arrival time of the message, or nothing if there was no input message left to process.
    */
-  void passthrough_next_message(std::shared_ptr<input_t> input) {
-    // 'entry' backs the 'payload' pointer, so they must remain in scope together
-    std::vector<uint8_t> entry;
-    PNV_INPUT_HEADER payload;
-
-    // Lock the input queue while batching, but release it before sending
-    // the input to the OS. This avoids potentially lengthy lock contention
-    // in the control stream thread while input is being processed by the OS.
-    {
-      std::lock_guard<std::mutex> lg(input->input_queue_lock);
-
+  std::optional<std::chrono::steady_clock::time_point> passthrough_next_message(std::shared_ptr<input_t> &input) {
+    // The ring is never locked, so the control stream thread keeps queueing
+    // while the batched input is being processed by the OS.
+    input_ring_t::packet_t entry;
+    if (!input->input_ring.pop(entry, [](PNV_INPUT_HEADER dest, PNV_INPUT_HEADER src) {
+          return batch(dest, src);
+        })) {
       // If all entries have already been processed, nothing to do
-      if (input->input_queue.empty()) {
-        return;
-      }
-
-      // Pop off the first entry, which we will send
-      entry = input->input_queue.front();
-      payload = (PNV_INPUT_HEADER) entry.data();
-      input->input_queue.pop_front();
-
-      // Try to batch with remaining items on the queue
-      auto i = input->input_queue.begin();
-      while (i != input->input_queue.end()) {
-        auto batchable_entry = *i;
-        auto batchable_payload = (PNV_INPUT_HEADER) batchable_entry.data();
-
-        auto batch_result = batch(payload, batchable_payload);
-        if (batch_result == batch_result_e::terminate_batch) {
-          // Stop batching
-          break;
-        } else if (batch_result == batch_result_e::batched) {
-          // Erase this entry since it was batched
-          i = input->input_queue.erase(i);
-        } else {
-          // We couldn't batch this entry, but try to batch later entries.
-          i++;
-        }
-      }
+      return std::nullopt;
     }
 
+    auto payload = (PNV_INPUT_HEADER) entry.data.data();
+
     // Print the final input packet
     input::print((void *) payload);
 
+    std::lock_guard<std::mutex> lg(injection_lock);
+
     // Send the batched input to the OS
     switch (util::endian::little(payload->magic)) {
       case MOUSE_MOVE_REL_MAGIC_GEN5:
@@ -1615,6 +2149,126 @@ namespace input {
         passthrough(input, (PSS_CONTROLLER_BATTERY_PACKET) payload);
         break;
     }
+
+    return entry.arrival;
+  }
+
+  /**
+   * @brief Session input thread, injects input as soon as the control stream queues it.
+   * @param weak_input The input context, only locked while draining so the session can release it.
+   * @param signal Wakes the thread when input is queued or the input context is destroyed.
+   */
+  void input_thread_main(std::weak_ptr<input_t> weak_input, std::shared_ptr<input_signal_t> signal) {
+    thread_placement::apply(config::thread_stage_e::input, platf::thread_priority_e::high);
+
+    // Next motion report while motion samples are pending
+    std::optional<std::chrono::steady_clock::time_point> motion_report;
+    // Next mouse smoothing step while relative mouse movement is pending
+    std::optional<std::chrono::steady_clock::time_point> mouse_step;
+
+    while (true) {
+      {
+        std::unique_lock<std::mutex> ul(signal->lock);
+        auto woken = [&]() {
+          return signal->pending || signal->stopped;
+        };
+        auto deadline = motion_report;
+        if (mouse_step && (!deadline || *mouse_step < *deadline)) {
+          deadline = mouse_step;
+        }
+
+        if (deadline) {
+          signal->cv.wait_until(ul, *deadline, woken);
+        } else {
+          signal->cv.wait(ul, woken);
+        }
+
+        // Give following packets a chance to arrive and be batched into the first one
+        auto coalesce_delay = config::input.coalesce_delay;
+        if (coalesce_delay > 0us && signal->pending) {
+          signal->cv.wait_for(ul, coalesce_delay, [&]() {
+            return signal->stopped;
+          });
+        }
+
+        if (signal->stopped) {
+          return;
+        }
+        signal->pending = false;
+      }
+
+      auto input = weak_input.lock();
+      if (!input) {
+        return;
+      }
+
+      // The keyboard and mouse events of every queued message are injected at once
+      {
+        std::lock_guard<std::mutex> lg(injection_lock);
+        inject::begin_input_batch(platf_input);
+      }
+
+      std::vector<std::chrono::steady_clock::time_point> arrivals;
+      while (auto arrival = passthrough_next_message(input)) {
+        arrivals.push_back(*arrival);
+      }
+
+      {
+        std::lock_guard<std::mutex> lg(injection_lock);
+        inject::end_input_batch(platf_input);
+      }
+
+      auto injected = std::chrono::steady_clock::now();
+      for (auto arrival : arrivals) {
+        if (config::input.latency_tracing) {
+          metrics::input_trace::injected(arrival, injected);
+        }
+        pipeline_trace::span("input", arrival, injected);
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      auto interval = [](int rate) {
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(1s) / std::max(rate, 1);
+      };
+
+      // Keep a fixed cadence, unless the thread fell behind by more than an interval
+      auto advance = [&now](std::chrono::steady_clock::time_point &deadline, std::chrono::steady_clock::duration interval) {
+        deadline += interval;
+        if (deadline <= now) {
+          deadline = now + interval;
+        }
+      };
+
+      if (!input->motion_pending) {
+        motion_report.reset();
+      } else if (!motion_report) {
+        motion_report = now + interval(config::input.motion_report_rate);
+      } else if (now >= *motion_report) {
+        {
+          std::lock_guard<std::mutex> lg(injection_lock);
+          send_motion_reports(input);
+        }
+        advance(*motion_report, interval(config::input.motion_report_rate));
+      }
+
+      // The first step of new movement is injected right away, the rest follow at the smoothing rate
+      if (!input->mouse_motion.moving()) {
+        mouse_step.reset();
+      } else if (!mouse_step || now >= *mouse_step) {
+        {
+          std::lock_guard<std::mutex> lg(injection_lock);
+          send_mouse_movement(input, config::input.mouse_smoothing_rate <= 0);
+        }
+
+        if (!input->mouse_motion.moving()) {
+          mouse_step.reset();
+        } else if (!mouse_step) {
+          mouse_step = now + interval(config::input.mouse_smoothing_rate);
+        } else {
+          advance(*mouse_step, interval(config::input.mouse_smoothing_rate));
+        }
+      }
+    }
   }
 
   /**
@@ -1623,6 +2277,10 @@ namespace input {
    * @param input_data The input message.
    */
   void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data, const crypto::PERM& permission) {
+    passthrough(input, std::span<const std::uint8_t> {input_data}, permission);
+  }
+
+  void passthrough(std::shared_ptr<input_t> &input, std::span<const std::uint8_t> input_data, const crypto::PERM& permission) {
     // No input permissions at all
     if (!(permission & crypto::PERM::_all_inputs)) {
       return;
@@ -1682,22 +2340,32 @@ namespace input {
       }
     }
 
+    if (!input->input_ring.push(input_data.data(), input_data.size())) {
+      BOOST_LOG(warning) << "Dropping input packet of unexpected size: "sv << input_data.size();
+      return;
+    }
+
     {
-      std::lock_guard<std::mutex> lg(input->input_queue_lock);
-      input->input_queue.push_back(std::move(input_data));
+      std::lock_guard<std::mutex> lg(input->input_signal->lock);
+      input->input_signal->pending = true;
     }
-    task_pool.push(passthrough_next_message, input);
+    input->input_signal->cv.notify_one();
   }
 
   void reset(std::shared_ptr<input_t> &input) {
-    task_pool.cancel(key_press_repeat_id);
-    task_pool.cancel(input->mouse_left_button_timeout);
+    {
+      std::lock_guard<std::mutex> lg(injection_lock);
+      task_pool.cancel(key_press_repeat_id);
+      task_pool.cancel(input->mouse_left_button_timeout);
+    }
 
     // Ensure input is synchronous, by using the task_pool
     task_pool.push([]() {
+      std::lock_guard<std::mutex> lg(injection_lock);
+
       for (int x = 0; x < mouse_press.size(); ++x) {
         if (mouse_press[x]) {
-          platf::button_mouse(platf_input, x, true);
+          inject::button_mouse(platf_input, x, true);
           mouse_press[x] = false;
         }
       }
@@ -1707,7 +2375,7 @@ namespace input {
           // already released
           continue;
         }
-        platf::keyboard_update(platf_input, vk_from_kpid(kp.first) & 0x00FF, true, flags_from_kpid(kp.first));
+        inject::keyboard_update(platf_input, vk_from_kpid(kp.first) & 0x00FF, true, flags_from_kpid(kp.first));
         key_press[kp.first] = false;
       }
     });
@@ -1745,14 +2413,16 @@ namespace input {
 
   std::shared_ptr<input_t> alloc(safe::mail_t mail) {
     auto input = std::make_shared<input_t>(
-      mail->event<input::touch_port_t>(mail::touch_port),
-      mail->queue<platf::gamepad_feedback_msg_t>(mail::gamepad_feedback)
+      mail->event(mail::touch_port),
+      mail->queue(mail::gamepad_feedback)
     );
+    input->input_thread = std::thread {input_thread_main, std::weak_ptr<input_t> {input}, input->input_signal};
 
     // Workaround to ensure new frames will be captured when a client connects
     task_pool.pushDelayed([]() {
-      platf::move_mouse(platf_input, 1, 1);
-      platf::move_mouse(platf_input, -1, -1);
+      std::lock_guard<std::mutex> lg(injection_lock);
+      inject::move_mouse(platf_input, 1, 1);
+      inject::move_mouse(platf_input, -1, -1);
     },
                           100ms);
 
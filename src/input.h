@@ -5,7 +5,11 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <span>
 
 // local includes
 #include "platform/common.h"
@@ -35,6 +39,15 @@ namespace input {
    */
   void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data, const crypto::PERM& permission);
 
+  /**
+   * @brief Pass through input data to the system without taking ownership of it.
+   * @details The data is copied into the input ring, so it may point into a received packet.
+   * @param input Shared pointer to input device.
+   * @param input_data The input data to process.
+   * @param permission The permissions for this input operation.
+   */
+  void passthrough(std::shared_ptr<input_t> &input, std::span<const std::uint8_t> input_data, const crypto::PERM& permission);
+
   /**
    * @brief Initialize the input subsystem.
    * @return Unique pointer to deinitialization object.
@@ -81,4 +94,39 @@ namespace input {
    * @return The major and minor axis pair.
    */
   std::pair<float, float> scale_client_contact_area(const std::pair<float, float> &val, uint16_t rotation, const std::pair<float, float> &scalar);
+
+#if defined(SUNSHINE_TESTS) || defined(SUNSHINE_BENCHMARKS)
+  /**
+   * @brief Calls that reached the null input backend and what they injected.
+   */
+  struct null_backend_stats_t {
+    std::uint64_t calls = 0;  ///< Number of injection calls
+    std::chrono::steady_clock::time_point last_call;  ///< Time of the latest injection call
+    std::uint64_t mouse_moves = 0;  ///< Number of relative mouse moves
+    int mouse_x = 0;  ///< Sum of the relative mouse moves on the X axis
+    int mouse_y = 0;  ///< Sum of the relative mouse moves on the Y axis
+    std::uint64_t mouse_buttons = 0;  ///< Number of mouse button presses and releases
+    int scroll_distance = 0;  ///< Sum of the vertical scroll distances
+    std::uint64_t key_presses = 0;  ///< Number of keys pressed
+    std::uint64_t key_releases = 0;  ///< Number of keys released
+    std::uint64_t gamepad_updates = 0;  ///< Number of controller states
+    std::array<platf::gamepad_state_t, platf::MAX_GAMEPADS> gamepads {};  ///< Latest state of every gamepad
+    std::uint64_t touch_updates = 0;  ///< Number of touch events
+    platf::touch_input_t last_touch {};  ///< Latest touch event
+    std::uint64_t pen_updates = 0;  ///< Number of pen events
+    platf::pen_input_t last_pen {};  ///< Latest pen event
+  };
+
+  /**
+   * @brief Route injection to a null backend that only records the calls instead of the OS.
+   * @param enabled Whether to use the null backend.
+   */
+  void use_null_backend(bool enabled);
+
+  /**
+   * @brief Get the calls recorded by the null input backend so far.
+   * @return The null backend stats.
+   */
+  null_backend_stats_t null_backend_stats();
+#endif
 }  // namespace input
@@ -0,0 +1,78 @@
+/**
+ * @file src/live_events.cpp
+ * @brief Definitions for pushing the changes of the dashboard to the web UI.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "live_events.h"
+
+namespace live_events {
+  bool hub_t::subscribe(std::shared_ptr<sink_t> sink, std::chrono::milliseconds interval) {
+    if (subscribers_.size() >= max_subscribers) {
+      return false;
+    }
+
+    auto subscriber = std::make_shared<subscriber_t>();
+    subscriber->sink = std::move(sink);
+    subscriber->interval = std::clamp<std::chrono::milliseconds>(interval, min_interval, max_interval);
+    subscriber->last_send = std::chrono::steady_clock::now();
+    subscribers_.emplace_back(std::move(subscriber));
+    return true;
+  }
+
+  std::size_t hub_t::subscribers() const {
+    return subscribers_.size();
+  }
+
+  void hub_t::publish(std::string_view section, std::string &&data) {
+    auto it = sections.find(section);
+    if (it == std::end(sections)) {
+      sections.emplace(std::string {section}, section_t {std::move(data), ++generation});
+      return;
+    }
+
+    if (it->second.data != data) {
+      it->second = section_t {std::move(data), ++generation};
+    }
+  }
+
+  void hub_t::flush(std::chrono::steady_clock::time_point now) {
+    std::erase_if(subscribers_, [](const auto &subscriber) {
+      return subscriber->gone;
+    });
+
+    for (auto &subscriber : subscribers_) {
+      if (subscriber->busy || now < subscriber->next_event) {
+        continue;
+      }
+
+      std::string events;
+      for (auto &[name, section] : sections) {
+        if (section.generation > subscriber->generation) {
+          events += "event: " + name + "\ndata: " + section.data + "\n\n";
+        }
+      }
+
+      if (events.empty()) {
+        if (now - subscriber->last_send < keep_alive_interval) {
+          continue;
+        }
+        events = ": keep-alive\n\n";
+      } else {
+        subscriber->generation = generation;
+        subscriber->next_event = now + subscriber->interval;
+      }
+
+      subscriber->busy = true;
+      subscriber->last_send = now;
+      subscriber->sink->send(std::move(events), [weak = std::weak_ptr {subscriber}](bool sent) {
+        if (auto subscriber = weak.lock()) {
+          subscriber->busy = false;
+          subscriber->gone = !sent;
+        }
+      });
+    }
+  }
+}  // namespace live_events
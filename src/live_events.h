@@ -0,0 +1,99 @@
+/**
+ * @file src/live_events.h
+ * @brief Declarations for pushing the changes of the dashboard to the web UI.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Server-Sent Events carrying the sections of the dashboard that changed.
+ * @details The sections are serialized once per tick however many subscribers there are, and only
+ *          while there are any. Each subscriber gets the sections that changed since its last event,
+ *          at most once per its own interval and never while its last event is still being sent.
+ *          The hub isn't thread safe, the HTTPS server uses it from its own thread only.
+ */
+namespace live_events {
+  constexpr auto tick_interval = std::chrono::seconds {1};  ///< How often the sections are refreshed
+  constexpr auto min_interval = std::chrono::seconds {1};  ///< Shortest interval a subscriber may ask for
+  constexpr auto max_interval = std::chrono::seconds {60};  ///< Longest interval a subscriber may ask for
+  constexpr auto keep_alive_interval = std::chrono::seconds {15};  ///< Silence after which a comment is sent, to notice closed connections
+  constexpr std::size_t max_subscribers = 16;  ///< Subscribers at once
+
+  /**
+   * @brief Where the events of a subscriber are sent to.
+   */
+  class sink_t {
+  public:
+    virtual ~sink_t() = default;
+
+    /**
+     * @brief Send events.
+     * @param events The events, in the `text/event-stream` format.
+     * @param done Called once the events were sent, with `false` if the connection is gone.
+     */
+    virtual void send(std::string &&events, std::function<void(bool)> &&done) = 0;
+  };
+
+  /**
+   * @brief Keeps the latest sections and sends their changes to the subscribers.
+   */
+  class hub_t {
+  public:
+    /**
+     * @brief Add a subscriber, it gets every section on the next flush.
+     * @param sink Where to send its events.
+     * @param interval Shortest time between its events, clamped to `min_interval` and `max_interval`.
+     * @return `false` if there are `max_subscribers` already.
+     */
+    bool subscribe(std::shared_ptr<sink_t> sink, std::chrono::milliseconds interval);
+
+    /**
+     * @brief Get the number of subscribers.
+     * @return The number, including the ones whose connection closed since the last flush.
+     */
+    std::size_t subscribers() const;
+
+    /**
+     * @brief Set the content of a section.
+     * @param section The name of the section, used as the event type.
+     * @param data The content, a single line of JSON. Only a different content counts as a change.
+     */
+    void publish(std::string_view section, std::string &&data);
+
+    /**
+     * @brief Send the changes to every subscriber that is due, and drop the closed ones.
+     * @param now The current time.
+     */
+    void flush(std::chrono::steady_clock::time_point now);
+
+  private:
+    struct section_t {
+      std::string data;
+      std::uint64_t generation;  ///< Generation of the hub when the data last changed
+    };
+
+    struct subscriber_t {
+      std::shared_ptr<sink_t> sink;
+      std::chrono::milliseconds interval;
+      std::chrono::steady_clock::time_point next_event;  ///< Earliest time of its next event
+      std::chrono::steady_clock::time_point last_send;  ///< When its last event or keep-alive was sent
+      std::uint64_t generation = 0;  ///< Generation of the hub it has seen the sections of
+      bool busy = false;  ///< A send is pending
+      bool gone = false;  ///< The connection closed
+    };
+
+    std::uint64_t generation = 0;
+    std::map<std::string, section_t, std::less<>> sections;
+    std::vector<std::shared_ptr<subscriber_t>> subscribers_;
+  };
+}  // namespace live_events
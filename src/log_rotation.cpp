@@ -0,0 +1,380 @@
+/**
+ * @file src/log_rotation.cpp
+ * @brief Definitions for rotating the log file by size and age and compressing the rotated segments.
+ */
+// standard includes
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+
+// lib includes
+#include <nlohmann/json.hpp>
+#include <zlib.h>
+
+// local includes
+#include "log_rotation.h"
+#include "log_view.h"
+#include "utility.h"
+
+using namespace std::literals;
+namespace fs = std::filesystem;
+
+namespace log_rotation {
+  namespace {
+    constexpr auto rotation_retry_interval = 1min;  ///< Between attempts when the log file can't be rotated
+    constexpr auto compress_pause = 5ms;  ///< Between two chunks, at most ~13 MB/s are read for compression
+
+    std::int64_t to_ms(std::chrono::system_clock::time_point time) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+    }
+
+    std::chrono::system_clock::time_point from_ms(std::int64_t ms) {
+      return std::chrono::system_clock::time_point {std::chrono::milliseconds {ms}};
+    }
+
+    fs::path index_path(const fs::path &log_file) {
+      return fs::path {log_file}.concat(".segments.json");
+    }
+
+    /**
+     * @brief Get the time of the first entry of a log file.
+     * @param path The log file.
+     * @return The time, or an empty value if the file doesn't start with an entry.
+     */
+    std::optional<std::chrono::system_clock::time_point> first_entry_time(const fs::path &path) {
+      std::ifstream in {path};
+      std::string line;
+      if (!std::getline(in, line) || !log_view::parse_level(line)) {
+        return std::nullopt;
+      }
+
+      // [YYYY-MM-DD HH:MM:SS.mmm], in local time as written by logging::formatter()
+      std::tm tm {};
+      std::istringstream stream {line.substr(1, 19)};
+      stream >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
+      if (stream.fail()) {
+        return std::nullopt;
+      }
+      tm.tm_isdst = -1;
+      return std::chrono::system_clock::from_time_t(std::mktime(&tm));
+    }
+
+    /**
+     * @brief Compress a file with gzip one chunk at a time.
+     * @param from The file.
+     * @param to The compressed file, replaced if it exists.
+     * @param stopping Aborts the compression when set.
+     * @return `true` on success.
+     */
+    bool gzip_file(const fs::path &from, const fs::path &to, const std::atomic_bool &stopping) {
+      std::ifstream in {from, std::ios::binary};
+      std::ofstream out {to, std::ios::binary | std::ios::trunc};
+      if (!in || !out) {
+        return false;
+      }
+
+      z_stream stream {};
+      // 15 window bits, +16 for a gzip header instead of a zlib one
+      if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+      }
+      auto fg = util::fail_guard([&stream]() {
+        deflateEnd(&stream);
+      });
+
+      std::string input(log_view::chunk_size, '\0');
+      std::string output(log_view::chunk_size, '\0');
+      int flush;
+      do {
+        if (stopping) {
+          return false;
+        }
+
+        in.read(input.data(), (std::streamsize) input.size());
+        if (in.bad()) {
+          return false;
+        }
+        stream.next_in = (Bytef *) input.data();
+        stream.avail_in = (uInt) in.gcount();
+        flush = in.eof() ? Z_FINISH : Z_NO_FLUSH;
+
+        do {
+          stream.next_out = (Bytef *) output.data();
+          stream.avail_out = (uInt) output.size();
+          if (deflate(&stream, flush) == Z_STREAM_ERROR) {
+            return false;
+          }
+          out.write(output.data(), (std::streamsize) (output.size() - stream.avail_out));
+        } while (stream.avail_out == 0);
+
+        std::this_thread::sleep_for(compress_pause);
+      } while (flush != Z_FINISH);
+
+      out.flush();
+      return out.good();
+    }
+  }  // namespace
+
+  std::string segment_name(const fs::path &log_file, std::chrono::system_clock::time_point begin) {
+    auto t = std::chrono::system_clock::to_time_t(begin);
+    auto lt = *std::localtime(&t);
+
+    std::ostringstream name;
+    name << log_file.stem().string() << '-' << std::put_time(&lt, "%Y%m%d-%H%M%S")
+         << (log_file.has_extension() ? log_file.extension().string() : ".log"s);
+    return name.str();
+  }
+
+  backend_t::backend_t(fs::path log_file, const options_t &options):
+      _log_file {std::move(log_file)},
+      _options {options} {
+    load_index();
+
+    // The log of the previous run becomes the newest segment
+    std::error_code ec;
+    if (auto size = fs::file_size(_log_file, ec); !ec && size > 0) {
+      auto modified = fs::last_write_time(_log_file, ec);
+      auto now = std::chrono::system_clock::now();
+      _end = ec ? now : now + std::chrono::duration_cast<std::chrono::system_clock::duration>(modified - fs::file_time_type::clock::now());
+      _begin = first_entry_time(_log_file).value_or(_end);
+      _size = size;
+      rotate(now);
+    }
+
+    if (!_file.is_open()) {
+      _file.open(_log_file, std::ios::out | std::ios::trunc);
+      _size = 0;
+    }
+
+    _compressor = std::thread {&backend_t::compress_thread, this};
+  }
+
+  backend_t::~backend_t() {
+    {
+      std::lock_guard lg {_mutex};
+      _stopping = true;
+    }
+    _cv.notify_all();
+    _compressor.join();
+  }
+
+  void backend_t::consume(const boost::log::record_view &, const string_type &message) {
+    auto now = std::chrono::system_clock::now();
+    if (_size > 0 && now >= _retry_after &&
+        ((_options.max_size && _size + message.size() + 1 > _options.max_size) ||
+         (_options.max_age.count() && now - _begin >= _options.max_age))) {
+      rotate(now);
+    }
+
+    if (_size == 0) {
+      _begin = now;
+    }
+    _end = now;
+
+    _file.write(message.data(), (std::streamsize) message.size());
+    _file.put('\n');
+    _size += message.size() + 1;
+
+    // Flush after each log record to ensure log file contents on disk isn't stale.
+    // This is particularly important when running from a Windows service.
+    _file.flush();
+  }
+
+  void backend_t::flush() {
+    _file.flush();
+  }
+
+  std::vector<segment_t> backend_t::segments() {
+    std::lock_guard lg {_mutex};
+    return _segments;
+  }
+
+  std::uint64_t backend_t::generation() const {
+    return _generation.load();
+  }
+
+  void backend_t::wait_compressed() {
+    std::unique_lock ul {_mutex};
+    _cv.wait(ul, [this]() {
+      return _pending.empty() || _stopping;
+    });
+  }
+
+  void backend_t::rotate(std::chrono::system_clock::time_point now) {
+    auto dir = _log_file.parent_path();
+    auto name = segment_name(_log_file, _begin);
+
+    // Rotated twice within a second
+    std::error_code ec;
+    for (int x = 1; fs::exists(dir / name, ec) || fs::exists(dir / (name + ".gz"), ec); ++x) {
+      fs::path base = segment_name(_log_file, _begin);
+      name = base.stem().string() + '-' + std::to_string(x) + base.extension().string();
+    }
+
+    _file.close();
+    fs::rename(_log_file, dir / name, ec);
+    if (ec) {
+      // The log is open in a process that doesn't share deletion, e.g. a reader on Windows,
+      // copy it instead and truncate it when it's reopened
+      fs::copy_file(_log_file, dir / name, fs::copy_options::overwrite_existing, ec);
+    }
+    if (ec) {
+      _file.open(_log_file, std::ios::out | std::ios::app);
+      _retry_after = now + rotation_retry_interval;
+      return;
+    }
+    _file.open(_log_file, std::ios::out | std::ios::trunc);
+
+    add_segment({name, _begin, _end, fs::file_size(dir / name, ec), false});
+    _size = 0;
+    ++_generation;
+  }
+
+  void backend_t::add_segment(segment_t segment) {
+    {
+      std::lock_guard lg {_mutex};
+      _pending.push_back(segment.name);
+      _segments.push_back(std::move(segment));
+      save_index();
+    }
+    _cv.notify_all();
+  }
+
+  void backend_t::save_index() {
+    auto index = nlohmann::json::array();
+    for (auto &segment : _segments) {
+      index.push_back({
+        {"name", segment.name},
+        {"begin", to_ms(segment.begin)},
+        {"end", to_ms(segment.end)},
+        {"compressed", segment.compressed},
+      });
+    }
+
+    // Replaced at once, readers never see a partial index
+    auto path = index_path(_log_file);
+    auto temp = fs::path {path}.concat(".tmp");
+    {
+      std::ofstream out {temp, std::ios::trunc};
+      out << index.dump(2);
+      if (!out) {
+        return;
+      }
+    }
+    std::error_code ec;
+    fs::rename(temp, path, ec);
+  }
+
+  void backend_t::load_index() {
+    std::ifstream in {index_path(_log_file)};
+    if (!in) {
+      return;
+    }
+
+    auto index = nlohmann::json::parse(in, nullptr, false);
+    if (!index.is_array()) {
+      return;
+    }
+
+    auto dir = _log_file.parent_path();
+    for (auto &entry : index) {
+      if (!entry.is_object()) {
+        continue;
+      }
+
+      segment_t segment {
+        entry.value("name", ""s),
+        from_ms(entry.value("begin", (std::int64_t) 0)),
+        from_ms(entry.value("end", (std::int64_t) 0)),
+        0,
+        entry.value("compressed", false),
+      };
+      if (segment.name.empty() || fs::path {segment.name}.filename() != segment.name) {
+        continue;
+      }
+
+      // Segments removed by hand are dropped from the index
+      std::error_code ec;
+      segment.size = fs::file_size(dir / segment.name, ec);
+      if (ec) {
+        continue;
+      }
+
+      // Compression was interrupted by the previous shutdown
+      if (!segment.compressed) {
+        _pending.push_back(segment.name);
+      }
+      _segments.push_back(std::move(segment));
+    }
+  }
+
+  void backend_t::trim() {
+    std::uint64_t total = 0;
+    for (auto &segment : _segments) {
+      total += segment.size;
+    }
+
+    bool changed = false;
+    for (auto it = std::begin(_segments); it != std::end(_segments) && total > _options.keep_size;) {
+      if (std::find(std::begin(_pending), std::end(_pending), it->name) != std::end(_pending)) {
+        ++it;
+        continue;
+      }
+
+      std::error_code ec;
+      fs::remove(_log_file.parent_path() / it->name, ec);
+      total -= it->size;
+      it = _segments.erase(it);
+      changed = true;
+    }
+
+    if (changed) {
+      save_index();
+    }
+  }
+
+  void backend_t::compress_thread() {
+    auto dir = _log_file.parent_path();
+
+    std::unique_lock ul {_mutex};
+    while (true) {
+      trim();
+      _cv.notify_all();
+
+      _cv.wait(ul, [this]() {
+        return _stopping || !_pending.empty();
+      });
+      if (_stopping) {
+        return;
+      }
+
+      auto name = _pending.front();
+      auto compressed_name = name + ".gz";
+      ul.unlock();
+      auto compressed = gzip_file(dir / name, dir / compressed_name, _stopping);
+      ul.lock();
+
+      std::error_code ec;
+      if (compressed) {
+        auto segment = std::find_if(std::begin(_segments), std::end(_segments), [&name](const segment_t &segment) {
+          return segment.name == name;
+        });
+        if (segment != std::end(_segments)) {
+          segment->name = compressed_name;
+          segment->size = fs::file_size(dir / compressed_name, ec);
+          segment->compressed = true;
+          save_index();
+        }
+        fs::remove(dir / name, ec);
+      } else {
+        fs::remove(dir / compressed_name, ec);
+        if (_stopping) {
+          return;
+        }
+      }
+      _pending.pop_front();
+    }
+  }
+}  // namespace log_rotation
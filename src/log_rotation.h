@@ -0,0 +1,117 @@
+/**
+ * @file src/log_rotation.h
+ * @brief Declarations for rotating the log file by size and age and compressing the rotated segments.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <boost/log/sinks.hpp>
+
+/**
+ * @brief Rotation of the log file into segments next to it.
+ * @details A segment is named after the time of its first entry, e.g. `sunshine-20240101-120000.log`,
+ *          and becomes `sunshine-20240101-120000.log.gz` once compressed. The index of the segments
+ *          and their time ranges is kept in `<log file>.segments.json`.
+ */
+namespace log_rotation {
+  /**
+   * @brief A rotated part of the log.
+   */
+  struct segment_t {
+    std::string name;  ///< File name, in the directory of the log file
+    std::chrono::system_clock::time_point begin;  ///< Time of the first entry
+    std::chrono::system_clock::time_point end;  ///< Time of the last entry
+    std::uint64_t size;  ///< Size of the file
+    bool compressed;  ///< Gzip compressed, `false` while it waits for the compression thread
+  };
+
+  struct options_t {
+    std::uint64_t max_size;  ///< Bytes after which the log is rotated, 0 to not rotate by size
+    std::chrono::seconds max_age;  ///< Age of the first entry after which the log is rotated, 0 to not rotate by age
+    std::uint64_t keep_size;  ///< Bytes of segments kept, the oldest are removed beyond it
+  };
+
+  /**
+   * @brief Get the segment name for a log file and the time of its first entry.
+   * @param log_file The log file.
+   * @param begin The time of the first entry.
+   * @return The name, e.g. `sunshine-20240101-120000.log`.
+   */
+  std::string segment_name(const std::filesystem::path &log_file, std::chrono::system_clock::time_point begin);
+
+  /**
+   * @brief Sink backend writing the formatted records to the log file, rotating it between records.
+   * @details The backend runs on the feeding thread of an asynchronous sink, so threads that log
+   *          never wait for a rotation. Rotated segments are compressed by a background thread
+   *          that reads and writes them one chunk at a time, paced so it doesn't compete with the
+   *          disk I/O of games.
+   */
+  class backend_t: public boost::log::sinks::basic_formatted_sink_backend<char, boost::log::sinks::combine_requirements<boost::log::sinks::synchronized_feeding, boost::log::sinks::flushing>::type> {
+  public:
+    /**
+     * @brief Open the log file, a log left by a previous run becomes a segment.
+     * @param log_file The log file.
+     * @param options The rotation options.
+     */
+    backend_t(std::filesystem::path log_file, const options_t &options);
+    ~backend_t();
+
+    void consume(const boost::log::record_view &rec, const string_type &message);
+    void flush();
+
+    /**
+     * @brief Get the rotated segments.
+     * @return The segments, the oldest first.
+     */
+    std::vector<segment_t> segments();
+
+    /**
+     * @brief Get the number of rotations so far.
+     * @details Readers that keep the log file open reopen it when this changes.
+     * @return The number of rotations.
+     */
+    std::uint64_t generation() const;
+
+    /**
+     * @brief Wait until every rotated segment is compressed.
+     */
+    void wait_compressed();
+
+  private:
+    void rotate(std::chrono::system_clock::time_point now);
+    void add_segment(segment_t segment);
+    void save_index();
+    void load_index();
+    void trim();
+    void compress_thread();
+
+    std::filesystem::path _log_file;
+    options_t _options;
+    std::ofstream _file;
+    std::uint64_t _size = 0;
+    std::chrono::system_clock::time_point _begin;  ///< Time of the first entry of the log file
+    std::chrono::system_clock::time_point _end;  ///< Time of the last entry of the log file
+    std::chrono::system_clock::time_point _retry_after;  ///< Rotation failed, keep writing until then
+    std::atomic<std::uint64_t> _generation {0};
+
+    std::mutex _mutex;  ///< Guards the segments and the compression queue
+    std::condition_variable _cv;
+    std::vector<segment_t> _segments;
+    std::deque<std::string> _pending;  ///< Names of the segments to compress
+    std::atomic_bool _stopping {false};
+    std::thread _compressor;
+  };
+}  // namespace log_rotation
@@ -0,0 +1,288 @@
+/**
+ * @file src/log_view.cpp
+ * @brief Definitions for reading and filtering parts of the log file without loading all of it.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <vector>
+
+// local includes
+#include "log_view.h"
+
+using namespace std::literals;
+
+namespace log_view {
+  namespace {
+    /**
+     * @brief Level names as written by logging::formatter(), by level.
+     */
+    constexpr std::array level_names {"Verbose"sv, "Debug"sv, "Info"sv, "Warning"sv, "Error"sv, "Fatal"sv};
+
+    /**
+     * @brief Length of the `[YYYY-MM-DD HH:MM:SS.mmm]: ` prefix of an entry.
+     */
+    constexpr std::size_t prefix_size = 27;
+
+    bool is_digit(char c) {
+      return c >= '0' && c <= '9';
+    }
+
+    std::optional<std::uint64_t> to_number(std::string_view text) {
+      std::uint64_t value;
+      auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+      if (ec != std::errc {} || ptr != text.data() + text.size() || text.empty()) {
+        return std::nullopt;
+      }
+      return value;
+    }
+
+    /**
+     * @brief Keep the last lines of a text.
+     * @param text The text.
+     * @param lines The number of lines to keep.
+     * @return The offset of the first kept line.
+     */
+    std::size_t last_lines(std::string_view text, std::size_t lines) {
+      if (!lines) {
+        return text.size();
+      }
+
+      // A trailing line break doesn't start another line
+      auto x = text.size();
+      if (x && text[x - 1] == '\n') {
+        --x;
+      }
+
+      std::size_t count = 0;
+      while (x > 0) {
+        auto line_break = text.rfind('\n', x - 1);
+        if (line_break == std::string_view::npos) {
+          return 0;
+        }
+        if (++count == lines) {
+          return line_break + 1;
+        }
+        x = line_break;
+      }
+      return 0;
+    }
+  }  // namespace
+
+  std::optional<int> parse_level(std::string_view line) {
+    if (line.size() < prefix_size || line[0] != '[' || line[24] != ']' || line[25] != ':' || line[26] != ' ') {
+      return std::nullopt;
+    }
+
+    // [YYYY-MM-DD HH:MM:SS.mmm]
+    constexpr std::string_view pattern = "[0000-00-00 00:00:00.000]"sv;
+    for (std::size_t x = 1; x < pattern.size() - 1; ++x) {
+      if (pattern[x] == '0' ? !is_digit(line[x]) : line[x] != pattern[x]) {
+        return std::nullopt;
+      }
+    }
+
+    auto rest = line.substr(prefix_size);
+    for (std::size_t level = 0; level < level_names.size(); ++level) {
+      auto &name = level_names[level];
+      if (rest.size() > name.size() && rest.starts_with(name) && rest[name.size()] == ':') {
+        return (int) level;
+      }
+    }
+    return std::nullopt;
+  }
+
+  std::optional<int> level_from_string(std::string_view name) {
+    if (auto number = to_number(name)) {
+      return *number <= 6 ? std::optional<int> {(int) *number} : std::nullopt;
+    }
+
+    for (std::size_t level = 0; level < level_names.size(); ++level) {
+      if (std::ranges::equal(name, level_names[level], [](char a, char b) {
+            return std::tolower((unsigned char) a) == std::tolower((unsigned char) b);
+          })) {
+        return (int) level;
+      }
+    }
+    if (name == "none"sv) {
+      return 6;
+    }
+    return std::nullopt;
+  }
+
+  std::optional<range_t> parse_range(std::string_view header, std::uint64_t size) {
+    if (!header.starts_with("bytes="sv)) {
+      return std::nullopt;
+    }
+    header.remove_prefix(6);
+
+    auto dash = header.find('-');
+    if (dash == std::string_view::npos || header.find(',') != std::string_view::npos) {
+      return std::nullopt;
+    }
+
+    auto first = header.substr(0, dash);
+    auto last = header.substr(dash + 1);
+    if (first.empty()) {
+      // The last bytes of the file
+      auto suffix = to_number(last);
+      if (!suffix || !*suffix || !size) {
+        return std::nullopt;
+      }
+      return range_t {size - std::min(*suffix, size), size};
+    }
+
+    auto begin = to_number(first);
+    if (!begin || *begin >= size) {
+      return std::nullopt;
+    }
+    if (last.empty()) {
+      return range_t {*begin, size};
+    }
+
+    auto end = to_number(last);
+    if (!end || *end < *begin) {
+      return std::nullopt;
+    }
+    return range_t {*begin, std::min(*end + 1, size)};
+  }
+
+  level_filter_t::level_filter_t(int min_level):
+      _min_level {min_level} {
+  }
+
+  std::string level_filter_t::operator()(std::string_view text) {
+    std::string kept;
+    for (std::size_t x = 0; x < text.size();) {
+      auto line_break = text.find('\n', x);
+      auto next = line_break == std::string_view::npos ? text.size() : line_break + 1;
+      auto line = text.substr(x, next - x);
+
+      if (auto level = parse_level(line)) {
+        _level = level;
+      }
+
+      // Lines of an entry that started before the text are only kept if everything is
+      if (_level ? *_level >= _min_level : _min_level <= 0) {
+        kept.append(line);
+      }
+
+      x = next;
+    }
+    return kept;
+  }
+
+  file_view_t::file_view_t(const std::string &path):
+      _file {path, std::ios::binary} {
+  }
+
+  bool file_view_t::is_open() const {
+    return _file.is_open();
+  }
+
+  std::uint64_t file_view_t::size() {
+    _file.clear();
+    _file.seekg(0, std::ios::end);
+    auto size = _file.tellg();
+    return size < 0 ? 0 : (std::uint64_t) size;
+  }
+
+  std::string file_view_t::read(std::uint64_t offset, std::size_t length) {
+    std::string data(length, '\0');
+
+    _file.clear();
+    _file.seekg((std::streamoff) offset);
+    _file.read(data.data(), (std::streamsize) length);
+    data.resize(_file.gcount());
+
+    return data;
+  }
+
+  std::string file_view_t::read_lines(std::uint64_t offset, std::uint64_t end) {
+    if (end <= offset) {
+      return {};
+    }
+
+    auto data = read(offset, (std::size_t) (end - offset));
+    auto line_break = data.rfind('\n');
+    data.resize(line_break == std::string::npos ? 0 : line_break + 1);
+    return data;
+  }
+
+  std::uint64_t file_view_t::lines_end(std::uint64_t end) {
+    while (end > 0) {
+      auto length = (std::size_t) std::min<std::uint64_t>(chunk_size, end);
+      auto data = read(end - length, length);
+      if (data.size() < length) {
+        // The file shrank
+        return 0;
+      }
+
+      auto line_break = data.rfind('\n');
+      if (line_break != std::string::npos) {
+        return end - length + line_break + 1;
+      }
+      end -= length;
+    }
+    return 0;
+  }
+
+  std::string file_view_t::tail(std::size_t lines, int min_level, std::uint64_t end) {
+    std::vector<std::string> kept;  // Filtered chunks, the newest first
+    std::size_t kept_lines = 0;
+    std::size_t kept_size = 0;
+
+    // Lines before the first entry of a chunk may belong to an entry in the chunk before it
+    std::string carry;
+
+    auto offset = end;
+    while (offset > 0 && kept_lines < lines && kept_size < max_response_size) {
+      auto length = (std::size_t) std::min<std::uint64_t>(chunk_size, offset);
+      offset -= length;
+
+      auto text = read(offset, length) + carry;
+      carry.clear();
+
+      std::size_t start = 0;
+      if (offset > 0) {
+        start = std::string::npos;
+        for (auto x = text.find('\n'); x != std::string::npos && x + 1 < text.size(); x = text.find('\n', x + 1)) {
+          if (parse_level(std::string_view {text}.substr(x + 1))) {
+            start = x + 1;
+            break;
+          }
+        }
+
+        if (start == std::string::npos) {
+          if (text.size() < max_response_size) {
+            carry = std::move(text);
+            continue;
+          }
+
+          // The entry is too long to find where it starts, keep what can be filtered
+          start = text.find('\n');
+          start = start == std::string::npos ? text.size() : start + 1;
+        }
+
+        carry = text.substr(0, start);
+      }
+
+      level_filter_t filter {min_level};
+      auto filtered = filter(std::string_view {text}.substr(start));
+      kept_lines += std::count(std::begin(filtered), std::end(filtered), '\n');
+      kept_size += filtered.size();
+      kept.push_back(std::move(filtered));
+    }
+
+    std::string result;
+    result.reserve(kept_size);
+    for (auto it = std::rbegin(kept); it != std::rend(kept); ++it) {
+      result += *it;
+    }
+
+    result.erase(0, last_lines(result, lines));
+    return result;
+  }
+}  // namespace log_view
@@ -0,0 +1,138 @@
+/**
+ * @file src/log_view.h
+ * @brief Declarations for reading and filtering parts of the log file without loading all of it.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Seek-based views of the log file.
+ * @details Log entries start with `[YYYY-MM-DD HH:MM:SS.mmm]: Level: `, the lines that
+ *          follow without a timestamp belong to the same entry.
+ */
+namespace log_view {
+  constexpr std::size_t chunk_size = 64 * 1024;  ///< Bytes read from the file at a time
+  constexpr std::size_t max_response_size = 4 * 1024 * 1024;  ///< Most bytes filtered for a single response
+
+  /**
+   * @brief Get the level of the entry a line starts.
+   * @param line The line.
+   * @return The level, from 0 (verbose) to 5 (fatal), or an empty value for continuation lines.
+   */
+  std::optional<int> parse_level(std::string_view line);
+
+  /**
+   * @brief Parse a level name or number, as accepted by the `min_log_level` option.
+   * @param name The level, e.g. `warning` or `3`.
+   * @return The level, or an empty value if it isn't one.
+   */
+  std::optional<int> level_from_string(std::string_view name);
+
+  /**
+   * @brief A byte range of the file.
+   */
+  struct range_t {
+    std::uint64_t begin;  ///< First byte
+    std::uint64_t end;  ///< One past the last byte
+  };
+
+  /**
+   * @brief Parse the HTTP Range header of a request.
+   * @param header The header value, e.g. `bytes=0-1023`, `bytes=1024-` or `bytes=-1024`.
+   * @param size The size of the file.
+   * @return The range, clamped to the file, or an empty value if it can't be satisfied.
+   */
+  std::optional<range_t> parse_range(std::string_view header, std::uint64_t size);
+
+  /**
+   * @brief Keeps the log entries at or above a level.
+   * @details Entries can span several calls, the level of the last entry is remembered
+   *          for the continuation lines of the next call.
+   */
+  class level_filter_t {
+  public:
+    /**
+     * @brief Create a filter.
+     * @param min_level The lowest level to keep, 0 keeps everything.
+     */
+    explicit level_filter_t(int min_level);
+
+    /**
+     * @brief Filter complete lines.
+     * @param text The lines, ending with a line break unless it is the end of the file.
+     * @return The lines of the kept entries.
+     */
+    std::string operator()(std::string_view text);
+
+  private:
+    int _min_level;
+    std::optional<int> _level;  ///< Level of the entry the last line belonged to
+  };
+
+  /**
+   * @brief Read-only view of a file that grows while it is read.
+   */
+  class file_view_t {
+  public:
+    /**
+     * @brief Open a file.
+     * @param path The path of the file.
+     */
+    explicit file_view_t(const std::string &path);
+
+    /**
+     * @brief Check whether the file could be opened.
+     * @return `true` if it is open.
+     */
+    bool is_open() const;
+
+    /**
+     * @brief Get the current size of the file.
+     * @return The size in bytes.
+     */
+    std::uint64_t size();
+
+    /**
+     * @brief Read part of the file.
+     * @param offset The first byte.
+     * @param length The number of bytes, fewer are returned at the end of the file.
+     * @return The bytes.
+     */
+    std::string read(std::uint64_t offset, std::size_t length);
+
+    /**
+     * @brief Read the complete lines of a part of the file.
+     * @param offset The first byte, at the start of a line.
+     * @param end One past the last byte to consider.
+     * @return The lines, up to the last line break, so a line still being written is left out.
+     */
+    std::string read_lines(std::uint64_t offset, std::uint64_t end);
+
+    /**
+     * @brief Find the end of the last complete line.
+     * @param end One past the last byte to consider.
+     * @return One past the last line break before `end`, or 0 if there is none.
+     */
+    std::uint64_t lines_end(std::uint64_t end);
+
+    /**
+     * @brief Get the last lines of the entries at or above a level.
+     * @details The file is read backwards one chunk at a time, so only the kept lines
+     *          and one chunk are held in memory.
+     * @param lines The number of lines.
+     * @param min_level The lowest level to keep.
+     * @param end One past the last byte to consider.
+     * @return The lines.
+     */
+    std::string tail(std::size_t lines, int min_level, std::uint64_t end);
+
+  private:
+    std::ifstream _file;
+  };
+}  // namespace log_view
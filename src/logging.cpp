@@ -18,6 +18,8 @@
 #include <boost/log/sources/severity_logger.hpp>
 
 // local includes
+#include "hot_log.h"
+#include "log_rotation.h"
 #include "logging.h"
 
 // conditional includes
@@ -36,6 +38,8 @@ using namespace std::literals;
 namespace bl = boost::log;
 
 boost::shared_ptr<boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>> sink;
+boost::shared_ptr<boost::log::sinks::asynchronous_sink<log_rotation::backend_t>> file_sink;
+boost::shared_ptr<log_rotation::backend_t> file_backend;  ///< Of file_sink, queried without locking the sink
 
 bl::sources::severity_logger<int> verbose(0);  // Dominating output
 bl::sources::severity_logger<int> debug(1);  // Follow what is happening
@@ -55,9 +59,13 @@ namespace logging {
   }
 
   void deinit() {
+    hot::stop();
     log_flush();
     bl::core::get()->remove_sink(sink);
     sink.reset();
+    bl::core::get()->remove_sink(file_sink);
+    file_sink.reset();
+    boost::atomic_store(&file_backend, boost::shared_ptr<log_rotation::backend_t> {});
   }
 
   void formatter(const boost::log::record_view &view, boost::log::formatting_ostream &os) {
@@ -153,9 +161,15 @@ namespace logging {
       deinit();
     }
 
-    // Check if the log file exists and handle backup
+    log_rotation::options_t rotation {
+      (std::uint64_t) config::sunshine.log_rotate_size * 1024 * 1024,
+      config::sunshine.log_rotate_age,
+      (std::uint64_t) config::sunshine.log_keep_size * 1024 * 1024,
+    };
+
+    // Without rotation, only the log of the previous run is kept as a backup
     std::string backup_log_file = log_file + ".backup";
-    if (std::filesystem::exists(log_file)) {
+    if (!rotation.max_size && !rotation.max_age.count() && std::filesystem::exists(log_file)) {
       try {
         // If the backup file exists, remove it
         if (std::filesystem::exists(backup_log_file)) {
@@ -180,20 +194,25 @@ namespace logging {
     sink->locked_backend()->add_stream(stream);
 #endif
 
-    sink->locked_backend()->add_stream(boost::make_shared<std::ofstream>(log_file));
     sink->set_filter(severity >= min_log_level);
     sink->set_formatter(&formatter);
-
-    // Flush after each log record to ensure log file contents on disk isn't stale.
-    // This is particularly important when running from a Windows service.
     sink->locked_backend()->auto_flush(true);
-
     bl::core::get()->add_sink(sink);
 
+    // The log file has its own sink, it's rotated on the thread of that sink
+    auto backend = boost::make_shared<log_rotation::backend_t>(log_file, rotation);
+    file_sink = boost::make_shared<bl::sinks::asynchronous_sink<log_rotation::backend_t>>(backend);
+    file_sink->set_filter(severity >= min_log_level);
+    file_sink->set_formatter(&formatter);
+    bl::core::get()->add_sink(file_sink);
+    boost::atomic_store(&file_backend, backend);
+
 #ifdef __ANDROID__
     auto android_sink = boost::make_shared<sinks::synchronous_sink<android_sink_backend>>();
     bl::core::get()->add_sink(android_sink);
 #endif
+
+    hot::start(min_log_level);
     return std::make_unique<deinit_t>();
   }
 
@@ -259,10 +278,22 @@ namespace logging {
 
   void log_flush() {
     if (sink) {
+      hot::drain();
       sink->flush();
+      file_sink->flush();
     }
   }
 
+  std::vector<log_rotation::segment_t> log_segments() {
+    auto backend = boost::atomic_load(&file_backend);
+    return backend ? backend->segments() : std::vector<log_rotation::segment_t> {};
+  }
+
+  std::uint64_t log_generation() {
+    auto backend = boost::atomic_load(&file_backend);
+    return backend ? backend->generation() : 0;
+  }
+
   void print_help(const char *name) {
     std::cout
       << "Usage: "sv << name << " [options] [/path/to/configuration_file] [--cmd]"sv << std::endl
@@ -273,6 +304,8 @@ namespace logging {
       << "    --help                    | print help"sv << std::endl
       << "    --creds username password | set user credentials for the Web manager"sv << std::endl
       << "    --version                 | print the version of sunshine"sv << std::endl
+      << "    --bench [seconds] [WIDTHxHEIGHT@FPS] [bitrate] [dirty percent]"sv << std::endl
+      << "                              | stream synthetic video and audio to a loopback client and report per-stage timings"sv << std::endl
       << std::endl
       << "    flags"sv << std::endl
       << "        -0 | Read PIN from stdin"sv << std::endl
@@ -21,6 +21,7 @@ extern boost::log::sources::severity_logger<int> tests;
 #endif
 
 #include "config.h"
+#include "log_rotation.h"
 #include "stat_trackers.h"
 
 /**
@@ -81,6 +82,19 @@ namespace logging {
    */
   void log_flush();
 
+  /**
+   * @brief Get the rotated segments of the log file.
+   * @return The segments, the oldest first.
+   */
+  std::vector<log_rotation::segment_t> log_segments();
+
+  /**
+   * @brief Get the number of times the log file was rotated.
+   * @details Changes when the log file is replaced by a new one.
+   * @return The number of rotations.
+   */
+  std::uint64_t log_generation();
+
   /**
    * @brief Print help to stdout.
    * @param name The name of the program.
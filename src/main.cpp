@@ -6,18 +6,25 @@
 #include <codecvt>
 #include <csignal>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 
 // local includes
+#include "bench.h"
+#include "calibration.h"
 #include "confighttp.h"
 #include "display_device.h"
 #include "entry_handler.h"
+#include "fleet.h"
 #include "globals.h"
 #include "httpcommon.h"
 #include "logging.h"
 #include "main.h"
 #include "nvhttp.h"
 #include "process.h"
+#include "stream.h"
 #include "system_tray.h"
 #include "upnp.h"
 #include "uuid.h"
@@ -50,6 +57,9 @@ void on_signal(int sig, FN &&fn) {
 }
 
 std::map<std::string_view, std::function<int(const char *name, int argc, char **argv)>> cmd_to_func {
+  {"bench"sv, [](const char *name, int argc, char **argv) {
+     return bench::run(name, argc, argv);
+   }},
   {"creds"sv, [](const char *name, int argc, char **argv) {
      return args::creds(name, argc, argv);
    }},
@@ -75,6 +85,9 @@ LRESULT CALLBACK SessionMonitorWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, L
     case WM_DESTROY:
       PostQuitMessage(0);
       return 0;
+    case WM_DISPLAYCHANGE:
+      platf::display_topology_changed();
+      return 0;
     case WM_ENDSESSION:
       {
         // Terminate ourselves with a blocking exit call
@@ -102,6 +115,49 @@ constexpr bool tray_is_enabled = true;
 constexpr bool tray_is_enabled = false;
 #endif
 
+/**
+ * @brief Durations of the startup steps, logged together once the host accepts streams.
+ */
+class startup_steps_t {
+public:
+  /**
+   * @brief Run a startup step and record how long it took.
+   * @param step The name of the step, it has to outlive the startup.
+   * @param fn The step.
+   * @return What the step returns.
+   */
+  template<class FN>
+  auto run(std::string_view step, FN &&fn) {
+    auto begin = std::chrono::steady_clock::now();
+    auto record = util::fail_guard([&]() {
+      std::lock_guard lg {mutex};
+      steps.emplace_back(step, std::chrono::steady_clock::now() - begin);
+    });
+
+    return fn();
+  }
+
+  /**
+   * @brief Log the time since startup began and the duration of each step.
+   */
+  void log() const {
+    std::lock_guard lg {mutex};
+
+    std::stringstream breakdown;
+    for (auto &[step, duration] : steps) {
+      breakdown << ' ' << step << '=' << std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() << "ms"sv;
+    }
+
+    auto total = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+    BOOST_LOG(info) << "Startup took "sv << total.count() << "ms:"sv << breakdown.str();
+  }
+
+private:
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  mutable std::mutex mutex;
+  std::vector<std::pair<std::string_view, std::chrono::steady_clock::duration>> steps;
+};
+
 void mainThreadLoop(const std::shared_ptr<safe::event_t<bool>> &shutdown_event) {
   bool run_loop = false;
 
@@ -135,6 +191,57 @@ void mainThreadLoop(const std::shared_ptr<safe::event_t<bool>> &shutdown_event)
   }
 }
 
+/**
+ * @brief Probe the encoders, on Windows again on a temporary virtual display if that fails.
+ */
+void probe_encoders_at_startup() {
+  if (!video::probe_encoders()) {
+    return;
+  }
+
+#ifdef _WIN32
+  bool allow_probing = video::allow_encoder_probing();
+  // Create a temporary virtual display for encoder capability probing
+  if (proc::vDisplayDriverStatus == VDISPLAY::DRIVER_STATUS::OK) {
+    std::string probe_uuid_str = PROBE_DISPLAY_UUID;
+    auto probe_uuid = uuid_util::uuid_t::parse(probe_uuid_str);
+    auto* probe_guid = (GUID*)(void*)&probe_uuid;
+
+    BOOST_LOG(info) << "Creating a temporary virtual display to probe for encoders..."sv;
+
+    if (!config::video.adapter_name.empty()) {
+      VDISPLAY::setRenderAdapterByName(platf::from_utf8(config::video.adapter_name));
+    }
+
+    VDISPLAY::createVirtualDisplay(
+      probe_uuid_str.c_str(),
+      "Probe",
+      800,
+      600,
+      60,
+      *probe_guid
+    );
+
+    std::this_thread::sleep_for(500ms);
+
+    // Probe again anyways
+    if (video::probe_encoders()) {
+      if (allow_probing) {
+        BOOST_LOG(error) << "Video failed to find working encoder: allow probing but failed"sv;
+      } else {
+        BOOST_LOG(error) << "Video failed to find working encoder even after attempted with a virtual display"sv;
+      }
+    }
+
+    VDISPLAY::removeVirtualDisplay(*probe_guid);
+  } else if (!allow_probing) {
+    BOOST_LOG(error) << "Video failed to find working encoder: probe failed and virtual display driver isn't initialized"sv;
+  }
+#else
+  BOOST_LOG(error) << "Video failed to find working encoder: probing failed."sv;
+#endif
+}
+
 int main(int argc, char *argv[]) {
   lifetime::argv = argv;
 
@@ -158,8 +265,13 @@ int main(int argc, char *argv[]) {
 
   mail::man = std::make_shared<safe::mail_raw_t>();
 
+  // Steps that don't depend on each other run concurrently, the web UI comes up while the encoders are probed
+  startup_steps_t startup;
+
   // parse config file
-  if (config::parse(argc, argv)) {
+  if (startup.run("config"sv, [&]() {
+        return config::parse(argc, argv);
+      })) {
     return 0;
   }
 
@@ -201,7 +313,9 @@ int main(int argc, char *argv[]) {
   // Adding guard here first as it also performs recovery after crash,
   // otherwise people could theoretically end up without display output.
   // It also should be destroyed before forced shutdown to expedite the cleanup.
-  auto display_device_deinit_guard = display_device::init(platf::appdata() / "display_device.state", config::video);
+  auto display_device_deinit_guard = startup.run("display_device"sv, []() {
+    return display_device::init(platf::appdata() / "display_device.state", config::video);
+  });
   if (!display_device_deinit_guard) {
     BOOST_LOG(error) << "Display device session failed to initialize"sv;
   }
@@ -296,7 +410,7 @@ int main(int argc, char *argv[]) {
   task_pool.start(1);
 
   // Create signal handler after logging has been initialized
-  auto shutdown_event = mail::man->event<bool>(mail::shutdown);
+  auto shutdown_event = mail::man->event(mail::shutdown);
   on_signal(SIGINT, [&force_shutdown, &display_device_deinit_guard, shutdown_event]() {
     BOOST_LOG(info) << "Interrupt handler called"sv;
 
@@ -333,104 +447,88 @@ int main(int argc, char *argv[]) {
   SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
 #endif
 
-  proc::refresh(config::stream.file_apps);
+  startup.run("apps"sv, []() {
+    proc::refresh(config::stream.file_apps);
+  });
 
   // If any of the following fail, we log an error and continue event though sunshine will not function correctly.
   // This allows access to the UI to fix configuration problems or view the logs.
 
-  auto platf_deinit_guard = platf::init();
+  auto platf_deinit_guard = startup.run("platform"sv, platf::init);
   if (!platf_deinit_guard) {
     BOOST_LOG(error) << "Platform failed to initialize"sv;
   }
 
-  auto proc_deinit_guard = proc::init();
+  auto proc_deinit_guard = startup.run("proc"sv, proc::init);
   if (!proc_deinit_guard) {
     BOOST_LOG(error) << "Proc failed to initialize"sv;
   }
 
-  reed_solomon_init();
-  auto input_deinit_guard = input::init();
+  if (startup.run("http"sv, http::init)) {
+    BOOST_LOG(fatal) << "HTTP interface failed to initialize"sv;
+
+#ifdef _WIN32
+    BOOST_LOG(fatal) << "To relaunch Apollo successfully, use the shortcut in the Start Menu. Do not run sunshine.exe manually."sv;
+    std::this_thread::sleep_for(10s);
+#endif
 
-  if (input::probe_gamepads()) {
-    BOOST_LOG(warning) << "No gamepad input is available"sv;
+    return -1;
   }
 
-  if (video::probe_encoders()) {
-#ifdef _WIN32
-    bool allow_probing = video::allow_encoder_probing();
-    // Create a temporary virtual display for encoder capability probing
-    if (proc::vDisplayDriverStatus == VDISPLAY::DRIVER_STATUS::OK) {
-      std::string probe_uuid_str = PROBE_DISPLAY_UUID;
-      auto probe_uuid = uuid_util::uuid_t::parse(probe_uuid_str);
-      auto* probe_guid = (GUID*)(void*)&probe_uuid;
+  // FIXME: Temporary workaround: Simple-Web_server needs to be updated or replaced
+  if (shutdown_event->peek()) {
+    return lifetime::desired_exit_code;
+  }
 
-      BOOST_LOG(info) << "Creating a temporary virtual display to probe for encoders..."sv;
+  // The web UI and the port mappings don't need the encoders
+  std::thread configThread {confighttp::start};
 
-      if (!config::video.adapter_name.empty()) {
-        VDISPLAY::setRenderAdapterByName(platf::from_utf8(config::video.adapter_name));
-      }
+  std::unique_ptr<platf::deinit_t> upnp_unmap;
+  auto sync_upnp = std::async(std::launch::async, [&startup, &upnp_unmap]() {
+    upnp_unmap = startup.run("upnp"sv, upnp::start);
+  });
 
-      VDISPLAY::createVirtualDisplay(
-        probe_uuid_str.c_str(),
-        "Probe",
-        800,
-        600,
-        60,
-        *probe_guid
-      );
-
-      std::this_thread::sleep_for(500ms);
-
-      // Probe again anyways
-      if (video::probe_encoders()) {
-        if (allow_probing) {
-          BOOST_LOG(error) << "Video failed to find working encoder: allow probing but failed"sv;
-        } else {
-          BOOST_LOG(error) << "Video failed to find working encoder even after attempted with a virtual display"sv;
-        }
-      }
+  reed_solomon_init();
+  auto input_deinit_guard = startup.run("input"sv, input::init);
 
-      VDISPLAY::removeVirtualDisplay(*probe_guid);
-    } else if (!allow_probing) {
-      BOOST_LOG(error) << "Video failed to find working encoder: probe failed and virtual display driver isn't initialized"sv;
+  auto sync_gamepads = std::async(std::launch::async, [&startup]() {
+    if (startup.run("gamepads"sv, input::probe_gamepads)) {
+      BOOST_LOG(warning) << "No gamepad input is available"sv;
     }
-#else
-    BOOST_LOG(error) << "Video failed to find working encoder: probing failed."sv;
-#endif
-  }
+  });
 
-  if (http::init()) {
-    BOOST_LOG(fatal) << "HTTP interface failed to initialize"sv;
+  startup.run("encoders"sv, probe_encoders_at_startup);
+  sync_gamepads.wait();
 
-#ifdef _WIN32
-    BOOST_LOG(fatal) << "To relaunch Apollo successfully, use the shortcut in the Start Menu. Do not run sunshine.exe manually."sv;
-    std::this_thread::sleep_for(10s);
-#endif
-
-    return -1;
-  }
+  // Probing leaves the encoders' allocations behind until the first stream
+  stream::session::schedule_idle_trim();
 
   std::unique_ptr<platf::deinit_t> mDNS;
-  auto sync_mDNS = std::async(std::launch::async, [&mDNS]() {
+  auto sync_mDNS = std::async(std::launch::async, [&startup, &mDNS]() {
     if (config::sunshine.enable_discovery) {
-      mDNS = platf::publish::start();
+      mDNS = startup.run("mdns"sv, platf::publish::start);
     }
   });
 
-  std::unique_ptr<platf::deinit_t> upnp_unmap;
-  auto sync_upnp = std::async(std::launch::async, [&upnp_unmap]() {
-    upnp_unmap = upnp::start();
-  });
-
-  // FIXME: Temporary workaround: Simple-Web_server needs to be updated or replaced
   if (shutdown_event->peek()) {
+    configThread.join();
     return lifetime::desired_exit_code;
   }
 
+  // Clients can only pair and stream once the encoders are known
   std::thread httpThread {nvhttp::start};
-  std::thread configThread {confighttp::start};
   std::thread rtspThread {rtsp_stream::start};
 
+  sync_mDNS.wait();
+  sync_upnp.wait();
+  startup.log();
+
+  // Only report to the broker once clients can connect
+  auto fleet_reporting = fleet::start();
+
+  // Measures the encoder in the background, it gives way as soon as a client starts streaming
+  calibration::start_if_new_hardware();
+
 #ifdef _WIN32
   // If we're using the default port and GameStream is enabled, warn the user
   if (config::sunshine.port == 47989 && is_gamestream_enabled()) {
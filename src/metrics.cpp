@@ -0,0 +1,284 @@
+/**
+ * @file src/metrics.cpp
+ * @brief Definitions for hot-path latency histograms and event counters.
+ */
+// standard includes
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <deque>
+#include <optional>
+
+// local includes
+#include "metrics.h"
+
+using namespace std::literals;
+
+namespace metrics {
+  namespace {
+    /**
+     * @brief The shards created by the current thread, indexed by histogram id.
+     */
+    struct local_shards_t {
+      std::vector<std::pair<histogram_t *, histogram_t::shard_t *>> shards;
+
+      ~local_shards_t() {
+        for (auto &[histogram, shard] : shards) {
+          if (histogram) {
+            histogram->retire(shard);
+          }
+        }
+      }
+    };
+
+    thread_local local_shards_t local_shards;
+
+    struct registry_t {
+      std::mutex lock;
+      std::deque<histogram_t> histograms;
+      std::deque<counter_t> counters;
+    };
+
+    registry_t &registry() {
+      // Intentionally leaked so histograms outlive thread_local shards during shutdown
+      static auto *registry = new registry_t;
+      return *registry;
+    }
+
+    /**
+     * @brief The input currently being followed through the video pipeline.
+     */
+    struct input_trace_t {
+      std::mutex lock;
+      std::optional<std::pair<input_trace::time_point, input_trace::time_point>> pending;  ///< Arrival and injection time of an input without a frame yet.
+      std::deque<std::pair<std::int64_t, input_trace::time_point>> in_flight;  ///< Frame number and input arrival of encoded frames not sent yet.
+    };
+
+    input_trace_t &trace() {
+      static auto *trace = new input_trace_t;
+      return *trace;
+    }
+  }  // namespace
+
+  std::uint64_t snapshot_t::percentile(double quantile) const {
+    if (count == 0) {
+      return 0;
+    }
+
+    auto target = std::max<std::uint64_t>(1, (std::uint64_t) std::ceil(quantile * count));
+
+    std::uint64_t seen = 0;
+    for (std::size_t x = 0; x < buckets.size(); ++x) {
+      seen += buckets[x];
+      if (seen >= target) {
+        return histogram_t::bucket_upper_bound(x);
+      }
+    }
+
+    return histogram_t::bucket_upper_bound(buckets.size() - 1);
+  }
+
+  counter_t::counter_t(std::string name):
+      _name {std::move(name)} {
+  }
+
+  histogram_t::histogram_t(std::string name, std::size_t id):
+      _name {std::move(name)},
+      _id {id} {
+  }
+
+  std::size_t histogram_t::bucket_index(std::uint64_t value_us) {
+    if (value_us < sub_bucket_count) {
+      return value_us;
+    }
+
+    // The leading bit selects the octave, the next sub_bucket_bits the linear sub-bucket
+    int shift = std::bit_width(value_us) - 1 - sub_bucket_bits;
+    if (shift > max_shift) {
+      return bucket_count - 1;
+    }
+
+    return (shift + 1) * sub_bucket_count + (value_us >> shift) - sub_bucket_count;
+  }
+
+  std::uint64_t histogram_t::bucket_upper_bound(std::size_t index) {
+    if (index < sub_bucket_count) {
+      return index;
+    }
+
+    auto shift = index / sub_bucket_count - 1;
+    auto sub_bucket = index % sub_bucket_count + sub_bucket_count;
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+
+  histogram_t::shard_t &histogram_t::local_shard() {
+    auto &shards = local_shards.shards;
+    if (_id < shards.size() && shards[_id].second) {
+      return *shards[_id].second;
+    }
+
+    auto shard = std::make_unique<shard_t>();
+    auto shard_p = shard.get();
+    {
+      std::lock_guard lg {_lock};
+      _shards.emplace_back(std::move(shard));
+    }
+
+    if (shards.size() <= _id) {
+      shards.resize(_id + 1);
+    }
+    shards[_id] = {this, shard_p};
+
+    return *shard_p;
+  }
+
+  void histogram_t::record_us(std::uint64_t value_us) {
+    auto &shard = local_shard();
+
+    // This thread is the only writer, so there's no need for a locked read-modify-write
+    auto &bucket = shard.buckets[bucket_index(value_us)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    shard.sum_us.store(shard.sum_us.load(std::memory_order_relaxed) + value_us, std::memory_order_relaxed);
+  }
+
+  void histogram_t::retire(shard_t *shard) {
+    std::lock_guard lg {_lock};
+
+    auto it = std::find_if(std::begin(_shards), std::end(_shards), [shard](const auto &owned) {
+      return owned.get() == shard;
+    });
+    if (it == std::end(_shards)) {
+      return;
+    }
+
+    for (std::size_t x = 0; x < bucket_count; ++x) {
+      _retired[x] += shard->buckets[x].load(std::memory_order_relaxed);
+    }
+    _retired_sum_us += shard->sum_us.load(std::memory_order_relaxed);
+
+    _shards.erase(it);
+  }
+
+  snapshot_t histogram_t::snapshot() const {
+    snapshot_t snapshot;
+
+    std::lock_guard lg {_lock};
+
+    snapshot.buckets.assign(std::begin(_retired), std::end(_retired));
+    snapshot.sum_us = _retired_sum_us;
+    for (const auto &shard : _shards) {
+      for (std::size_t x = 0; x < bucket_count; ++x) {
+        snapshot.buckets[x] += shard->buckets[x].load(std::memory_order_relaxed);
+      }
+      snapshot.sum_us += shard->sum_us.load(std::memory_order_relaxed);
+    }
+
+    for (auto bucket : snapshot.buckets) {
+      snapshot.count += bucket;
+    }
+
+    return snapshot;
+  }
+
+  histogram_t &histogram(std::string_view name) {
+    auto &reg = registry();
+    std::lock_guard lg {reg.lock};
+
+    for (auto &histogram : reg.histograms) {
+      if (histogram.name() == name) {
+        return histogram;
+      }
+    }
+
+    return reg.histograms.emplace_back(std::string {name}, reg.histograms.size());
+  }
+
+  std::vector<histogram_t *> histograms() {
+    auto &reg = registry();
+    std::lock_guard lg {reg.lock};
+
+    std::vector<histogram_t *> result;
+    for (auto &histogram : reg.histograms) {
+      result.emplace_back(&histogram);
+    }
+
+    return result;
+  }
+
+  counter_t &counter(std::string_view name) {
+    auto &reg = registry();
+    std::lock_guard lg {reg.lock};
+
+    for (auto &counter : reg.counters) {
+      if (counter.name() == name) {
+        return counter;
+      }
+    }
+
+    return reg.counters.emplace_back(std::string {name});
+  }
+
+  std::vector<counter_t *> counters() {
+    auto &reg = registry();
+    std::lock_guard lg {reg.lock};
+
+    std::vector<counter_t *> result;
+    for (auto &counter : reg.counters) {
+      result.emplace_back(&counter);
+    }
+
+    return result;
+  }
+
+  namespace input_trace {
+    void injected(time_point arrival, time_point injected) {
+      static auto &injection_histogram = histogram("input_injection"sv);
+      injection_histogram.record(injected - arrival);
+
+      auto &state = trace();
+      std::lock_guard lg {state.lock};
+      if (!state.pending) {
+        state.pending.emplace(arrival, injected);
+      }
+    }
+
+    void encoded(std::int64_t frame_index, time_point frame_timestamp, time_point encoded) {
+      static auto &capture_histogram = histogram("input_to_capture"sv);
+      static auto &encode_histogram = histogram("input_to_encode"sv);
+
+      auto &state = trace();
+      std::lock_guard lg {state.lock};
+
+      // Frames captured before the injection can't show its effect
+      if (!state.pending || frame_timestamp < state.pending->second) {
+        return;
+      }
+
+      auto arrival = state.pending->first;
+      state.pending.reset();
+
+      capture_histogram.record(frame_timestamp - arrival);
+      encode_histogram.record(encoded - arrival);
+
+      // Bound the frames tracked in case the network thread drops some
+      if (state.in_flight.size() >= 16) {
+        state.in_flight.pop_front();
+      }
+      state.in_flight.emplace_back(frame_index, arrival);
+    }
+
+    void sent(std::int64_t frame_index, time_point sent) {
+      static auto &send_histogram = histogram("input_to_send"sv);
+
+      auto &state = trace();
+      std::lock_guard lg {state.lock};
+
+      while (!state.in_flight.empty() && state.in_flight.front().first <= frame_index) {
+        if (state.in_flight.front().first == frame_index) {
+          send_histogram.record(sent - state.in_flight.front().second);
+        }
+        state.in_flight.pop_front();
+      }
+    }
+  }  // namespace input_trace
+}  // namespace metrics
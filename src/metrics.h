@@ -0,0 +1,220 @@
+/**
+ * @file src/metrics.h
+ * @brief Declarations for hot-path latency histograms and event counters.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace metrics {
+
+  /**
+   * @brief Merged view of a histogram at one point in time.
+   */
+  struct snapshot_t {
+    std::vector<std::uint64_t> buckets;  ///< Sample count per bucket
+    std::uint64_t count = 0;  ///< Total number of samples
+    std::uint64_t sum_us = 0;  ///< Sum of all samples in microseconds
+
+    /**
+     * @brief Get the value below which the given fraction of samples fall.
+     * @param quantile The quantile between 0 and 1, e.g. 0.99 for p99.
+     * @return The upper bound of the matching bucket in microseconds, or 0 without samples.
+     */
+    std::uint64_t percentile(double quantile) const;
+  };
+
+  /**
+   * @brief Fixed-bucket latency histogram with a relative error of about 6%.
+   * @details Values are microseconds. Each thread records into its own shard, so recording
+   *          is a couple of relaxed atomic stores without any locking or contention. Shards
+   *          are merged when a snapshot is taken. Histograms are never destroyed, which keeps
+   *          the thread-local shard pointers valid until the threads exit.
+   */
+  class histogram_t {
+  public:
+    static constexpr int sub_bucket_bits = 4;  ///< 16 linear sub-buckets per power of two
+    static constexpr int max_shift = 26;  ///< Largest tracked magnitude, about 2^31us (35 minutes)
+    static constexpr std::size_t sub_bucket_count = 1 << sub_bucket_bits;
+    static constexpr std::size_t bucket_count = (max_shift + 2) * sub_bucket_count;
+
+    histogram_t(std::string name, std::size_t id);
+
+    histogram_t(const histogram_t &) = delete;
+    histogram_t &operator=(const histogram_t &) = delete;
+
+    /**
+     * @brief Record a sample.
+     * @param value_us The value in microseconds.
+     */
+    void record_us(std::uint64_t value_us);
+
+    /**
+     * @brief Record a duration sample.
+     * @param duration The duration.
+     */
+    template<class Rep, class Period>
+    void record(std::chrono::duration<Rep, Period> duration) {
+      auto value_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+      record_us(value_us > 0 ? value_us : 0);
+    }
+
+    /**
+     * @brief Merge all per-thread shards.
+     * @return The merged counts.
+     */
+    snapshot_t snapshot() const;
+
+    const std::string &name() const {
+      return _name;
+    }
+
+    /**
+     * @brief Get the bucket a value falls into.
+     * @param value_us The value in microseconds.
+     * @return The bucket index.
+     */
+    static std::size_t bucket_index(std::uint64_t value_us);
+
+    /**
+     * @brief Get the largest value that falls into a bucket.
+     * @param index The bucket index.
+     * @return The upper bound in microseconds.
+     */
+    static std::uint64_t bucket_upper_bound(std::size_t index);
+
+    /**
+     * @brief Per-thread sample counts. Only the owning thread writes to it.
+     */
+    struct shard_t {
+      std::array<std::atomic<std::uint64_t>, bucket_count> buckets {};
+      std::atomic<std::uint64_t> sum_us {};
+    };
+
+    /**
+     * @brief Fold the counts of a shard whose thread is exiting into the histogram.
+     * @param shard The shard to release.
+     */
+    void retire(shard_t *shard);
+
+  private:
+    shard_t &local_shard();
+
+    std::string _name;
+    std::size_t _id;
+
+    mutable std::mutex _lock;
+    std::vector<std::unique_ptr<shard_t>> _shards;
+    std::array<std::uint64_t, bucket_count> _retired {};
+    std::uint64_t _retired_sum_us = 0;
+  };
+
+  /**
+   * @brief Monotonic event counter, e.g. for work that a fast path skipped.
+   * @details Incrementing is a single relaxed atomic add. Like histograms,
+   *          counters are never destroyed.
+   */
+  class counter_t {
+  public:
+    explicit counter_t(std::string name);
+
+    counter_t(const counter_t &) = delete;
+    counter_t &operator=(const counter_t &) = delete;
+
+    /**
+     * @brief Count events.
+     * @param count The number of events.
+     */
+    void add(std::uint64_t count = 1) {
+      _value.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Get the number of events counted so far.
+     * @return The count.
+     */
+    std::uint64_t value() const {
+      return _value.load(std::memory_order_relaxed);
+    }
+
+    const std::string &name() const {
+      return _name;
+    }
+
+  private:
+    std::string _name;
+    std::atomic<std::uint64_t> _value {0};
+  };
+
+  /**
+   * @brief Get or create the histogram with the given name.
+   * @details The returned reference stays valid for the lifetime of the process,
+   *          so hot paths should look it up once and keep it.
+   * @param name The histogram name.
+   * @return The histogram.
+   */
+  histogram_t &histogram(std::string_view name);
+
+  /**
+   * @brief Get all registered histograms in registration order.
+   * @return The histograms.
+   */
+  std::vector<histogram_t *> histograms();
+
+  /**
+   * @brief Get or create the counter with the given name.
+   * @details The returned reference stays valid for the lifetime of the process.
+   * @param name The counter name.
+   * @return The counter.
+   */
+  counter_t &counter(std::string_view name);
+
+  /**
+   * @brief Get all registered counters in registration order.
+   * @return The counters.
+   */
+  std::vector<counter_t *> counters();
+
+  /**
+   * @brief Input-to-photon tracing.
+   * @details An injected input is attributed to the first frame captured after its injection,
+   *          which is then followed by its frame number until it is sent. Inputs injected while
+   *          an earlier one is still waiting for its frame share that frame, so only the oldest
+   *          is traced. The stages are recorded into the input_injection, input_to_capture,
+   *          input_to_encode and input_to_send histograms, all relative to input arrival.
+   */
+  namespace input_trace {
+    using time_point = std::chrono::steady_clock::time_point;
+
+    /**
+     * @brief Record that an input was injected into the OS.
+     * @param arrival When the input packet arrived from the client.
+     * @param injected When injection completed.
+     */
+    void injected(time_point arrival, time_point injected);
+
+    /**
+     * @brief Record that the encoder delivered a frame to the network thread.
+     * @param frame_index The frame number.
+     * @param frame_timestamp When the frame was captured.
+     * @param encoded When the encoded frame was received.
+     */
+    void encoded(std::int64_t frame_index, time_point frame_timestamp, time_point encoded);
+
+    /**
+     * @brief Record that all packets of a frame were sent.
+     * @param frame_index The frame number.
+     * @param sent When the last packet was sent.
+     */
+    void sent(std::int64_t frame_index, time_point sent);
+  }  // namespace input_trace
+}  // namespace metrics
@@ -6,6 +6,7 @@
 #include "nvenc_base.h"
 
 // standard includes
+#include <algorithm>
 #include <format>
 
 // local includes
@@ -89,6 +90,27 @@ namespace {
     return config.vbr_rate_control ? NV_ENC_PARAMS_RC_VBR : NV_ENC_PARAMS_RC_CBR;
   }
 
+  /**
+   * @brief Enable periodic intra refresh in a codec config.
+   * @param format_config The H.264, HEVC or AV1 config.
+   * @param period Frames between the start of two waves, 0 to leave intra refresh disabled.
+   * @param cnt Frames each wave is spread over.
+   * @param single_slice Whether to encode each refresh frame as a single slice.
+   */
+  template<typename T>
+  void set_intra_refresh(T &format_config, uint32_t period, uint32_t cnt, bool single_slice) {
+    if (!period) {
+      return;
+    }
+
+    format_config.enableIntraRefresh = 1;
+    format_config.intraRefreshPeriod = period;
+    format_config.intraRefreshCnt = cnt;
+    if constexpr (requires { format_config.singleSliceIntraRefresh; }) {
+      format_config.singleSliceIntraRefresh = single_slice ? 1 : 0;
+    }
+  }
+
 }  // namespace
 
 namespace nvenc {
@@ -123,6 +145,8 @@ namespace nvenc {
 
     encoder_params.width = client_config.width;
     encoder_params.height = client_config.height;
+    encoder_params.max_width = client_config.width;
+    encoder_params.max_height = client_config.height;
     encoder_params.buffer_format = buffer_format;
     encoder_params.rfi = true;
 
@@ -221,6 +245,38 @@ namespace nvenc {
 
     encoder_params.rfi = get_encoder_cap(NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION);
 
+    encoder_params.intra_refresh_period = 0;
+    encoder_params.intra_refresh_cnt = 0;
+    encoder_params.intra_refresh_restart = false;
+    encoder_params.single_slice_intra_refresh = false;
+    if (config.intra_refresh || client_config.enableIntraRefresh == 1) {
+      if (get_encoder_cap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
+        // The wave has to be shorter than the period
+        auto period = std::max(2, config.intra_refresh_period > 0 ? config.intra_refresh_period : 300);
+        auto cnt = config.intra_refresh_wave > 0 ? config.intra_refresh_wave : client_config.framerate / 4;
+        encoder_params.intra_refresh_period = period;
+        encoder_params.intra_refresh_cnt = std::clamp(cnt, 1, period - 1);
+        encoder_params.intra_refresh_restart = config.intra_refresh_restart_on_loss;
+        encoder_params.single_slice_intra_refresh = get_encoder_cap(NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH);
+        if (!encoder_params.single_slice_intra_refresh) {
+          BOOST_LOG(warning) << "NvEnc: Single Slice Intra Refresh not supported";
+        }
+      } else {
+        BOOST_LOG(error) << "NvEnc: intra-refresh was requested but the encoder does not support intra-refresh";
+      }
+    }
+
+    encoder_params.temporal_layers = 1;
+    if (config.temporal_layers > 1) {
+      if (client_config.videoFormat != 0) {
+        BOOST_LOG(info) << "NvEnc: temporal layers are only available for H.264 with this NVENC SDK";
+      } else if (!get_encoder_cap(NV_ENC_CAPS_SUPPORT_TEMPORAL_SVC)) {
+        BOOST_LOG(warning) << "NvEnc: gpu doesn't support temporal layers";
+      } else {
+        encoder_params.temporal_layers = (uint32_t) std::clamp(config.temporal_layers, 1, std::max(1, get_encoder_cap(NV_ENC_CAPS_NUM_MAX_TEMPORAL_LAYERS)));
+      }
+    }
+
     init_params.presetGUID = quality_preset_guid_from_number(config.quality_preset);
     init_params.tuningInfo = NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY;
     init_params.enablePTD = 1;
@@ -231,9 +287,20 @@ namespace nvenc {
     init_params.darWidth = encoder_params.width;
     init_params.encodeHeight = encoder_params.height;
     init_params.darHeight = encoder_params.height;
+    init_params.maxEncodeWidth = encoder_params.max_width;
+    init_params.maxEncodeHeight = encoder_params.max_height;
     init_params.frameRateNum = client_config.framerate;
     init_params.frameRateDen = 1;
 
+    {
+      // Roughly what one encoder engine sustains, splitting frames across engines needs SDK 12.1
+      constexpr uint64_t single_engine_pixel_rate = 3840ull * 2160 * 144;
+      if ((uint64_t) encoder_params.width * encoder_params.height * client_config.framerate > single_engine_pixel_rate) {
+        BOOST_LOG(warning) << "NvEnc: " << encoder_params.width << "x" << encoder_params.height << "x" << client_config.framerate
+                           << " may exceed what a single encoder engine sustains, split-frame encoding isn't available with this NVENC SDK";
+      }
+    }
+
     NV_ENC_PRESET_CONFIG preset_config = {min_struct_version(NV_ENC_PRESET_CONFIG_VER), {min_struct_version(NV_ENC_CONFIG_VER, 7, 8)}};
     if (nvenc_failed(nvenc->nvEncGetEncodePresetConfigEx(encoder, init_params.encodeGUID, init_params.presetGUID, init_params.tuningInfo, &preset_config))) {
       BOOST_LOG(error) << "NvEnc: NvEncGetEncodePresetConfigEx() failed: " << last_nvenc_error_string;
@@ -253,6 +320,9 @@ namespace nvenc {
                                                                                             NV_ENC_MULTI_PASS_DISABLED;
 
     enc_config.rcParams.enableAQ = config.adaptive_quantization;
+    if (config.qp_delta_map) {
+      enc_config.rcParams.qpMapMode = NV_ENC_QP_MAP_DELTA;
+    }
     enc_config.rcParams.averageBitRate = client_config.bitrate * 1000;
 
     if (get_encoder_cap(NV_ENC_CAPS_SUPPORT_CUSTOM_VBV_BUF_SIZE)) {
@@ -324,6 +394,8 @@ namespace nvenc {
           set_ref_frames(format_config.maxNumRefFrames, format_config.numRefL0, 5);
           set_minqp_if_enabled(config.min_qp_h264);
           fill_h264_hevc_vui(format_config.h264VUIParameters);
+          set_intra_refresh(format_config, encoder_params.intra_refresh_period, encoder_params.intra_refresh_cnt, encoder_params.single_slice_intra_refresh);
+          set_temporal_layers(format_config);
           break;
         }
 
@@ -338,20 +410,7 @@ namespace nvenc {
           set_ref_frames(format_config.maxNumRefFramesInDPB, format_config.numRefL0, 5);
           set_minqp_if_enabled(config.min_qp_hevc);
           fill_h264_hevc_vui(format_config.hevcVUIParameters);
-          if (client_config.enableIntraRefresh == 1) {
-            if (get_encoder_cap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
-              format_config.enableIntraRefresh = 1;
-              format_config.intraRefreshPeriod = 300;
-              format_config.intraRefreshCnt = 299;
-              if (get_encoder_cap(NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH)) {
-                format_config.singleSliceIntraRefresh = 1;
-              } else {
-                BOOST_LOG(warning) << "NvEnc: Single Slice Intra Refresh not supported";
-              }
-            } else {
-              BOOST_LOG(error) << "NvEnc: Client asked for intra-refresh but the encoder does not support intra-refresh";
-            }
-          }
+          set_intra_refresh(format_config, encoder_params.intra_refresh_period, encoder_params.intra_refresh_cnt, encoder_params.single_slice_intra_refresh);
           break;
         }
 
@@ -376,6 +435,7 @@ namespace nvenc {
           format_config.chromaSamplePosition = buffer_is_yuv444() ? 0 : 1;
           set_ref_frames(format_config.maxNumRefFramesInDPB, format_config.numFwdRefs, 8);
           set_minqp_if_enabled(config.min_qp_av1);
+          set_intra_refresh(format_config, encoder_params.intra_refresh_period, encoder_params.intra_refresh_cnt, encoder_params.single_slice_intra_refresh);
 
           if (client_config.slicesPerFrame > 1) {
             // NVENC only supports slice counts that are powers of two, so we'll pick powers of two
@@ -414,6 +474,36 @@ namespace nvenc {
       return false;
     }
 
+    if (config.async_depth > 1) {
+      pipeline.slots.resize(config.async_depth);
+      for (auto &slot : pipeline.slots) {
+        if (!(slot.input = create_and_register_pipeline_input())) {
+          BOOST_LOG(info) << "NvEnc: pipelined encoding isn't supported with this input, encoding frames one at a time";
+          break;
+        }
+
+        NV_ENC_CREATE_BITSTREAM_BUFFER create_slot_bitstream_buffer = {min_struct_version(NV_ENC_CREATE_BITSTREAM_BUFFER_VER)};
+        if (nvenc_failed(nvenc->nvEncCreateBitstreamBuffer(encoder, &create_slot_bitstream_buffer))) {
+          BOOST_LOG(error) << "NvEnc: NvEncCreateBitstreamBuffer() failed: " << last_nvenc_error_string;
+          return false;
+        }
+        slot.output = create_slot_bitstream_buffer.bitstreamBuffer;
+      }
+
+      if (!pipeline.slots.back().output) {
+        // Release whatever was created before the derived class gave up
+        for (auto &slot : pipeline.slots) {
+          if (slot.input && nvenc_failed(nvenc->nvEncUnregisterResource(encoder, slot.input))) {
+            BOOST_LOG(error) << "NvEnc: NvEncUnregisterResource() failed: " << last_nvenc_error_string;
+          }
+          if (slot.output && nvenc_failed(nvenc->nvEncDestroyBitstreamBuffer(encoder, slot.output))) {
+            BOOST_LOG(error) << "NvEnc: NvEncDestroyBitstreamBuffer() failed: " << last_nvenc_error_string;
+          }
+        }
+        pipeline.slots.clear();
+      }
+    }
+
     {
       auto f = stat_trackers::two_digits_after_decimal();
       BOOST_LOG(debug) << "NvEnc: requested encoded frame size " << f % (client_config.bitrate / 8. / client_config.framerate) << " kB";
@@ -443,6 +533,9 @@ namespace nvenc {
       if (encoder_params.rfi) {
         extra += " rfi";
       }
+      if (encoder_params.intra_refresh_period) {
+        extra += std::format(" intra-refresh={}/{}", encoder_params.intra_refresh_cnt, encoder_params.intra_refresh_period);
+      }
       if (init_params.enableWeightedPrediction) {
         extra += " weighted-prediction";
       }
@@ -455,6 +548,15 @@ namespace nvenc {
       if (config.insert_filler_data) {
         extra += " filler-data";
       }
+      if (config.qp_delta_map) {
+        extra += " qp-delta-map";
+      }
+      if (encoder_params.temporal_layers > 1) {
+        extra += std::format(" temporal-layers={}", encoder_params.temporal_layers);
+      }
+      if (!pipeline.slots.empty()) {
+        extra += std::format(" pipeline={}", pipeline.slots.size());
+      }
 
       BOOST_LOG(info) << "NvEnc: created encoder " << video_format_string << quality_preset_string_from_guid(init_params.presetGUID) << extra;
     }
@@ -465,6 +567,23 @@ namespace nvenc {
   }
 
   void nvenc_base::destroy_encoder() {
+    stop_pipeline();
+    for (auto &slot : pipeline.slots) {
+      if (slot.mapped_input && nvenc_failed(nvenc->nvEncUnmapInputResource(encoder, slot.mapped_input))) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnmapInputResource() failed: " << last_nvenc_error_string;
+      }
+      if (slot.output && nvenc_failed(nvenc->nvEncDestroyBitstreamBuffer(encoder, slot.output))) {
+        BOOST_LOG(error) << "NvEnc: NvEncDestroyBitstreamBuffer() failed: " << last_nvenc_error_string;
+      }
+      if (slot.input && nvenc_failed(nvenc->nvEncUnregisterResource(encoder, slot.input))) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnregisterResource() failed: " << last_nvenc_error_string;
+      }
+    }
+    pipeline.slots.clear();
+    pipeline.submitted = 0;
+    pipeline.retrieved = 0;
+    pipeline.failed = false;
+
     if (output_bitstream) {
       if (nvenc_failed(nvenc->nvEncDestroyBitstreamBuffer(encoder, output_bitstream))) {
         BOOST_LOG(error) << "NvEnc: NvEncDestroyBitstreamBuffer() failed: " << last_nvenc_error_string;
@@ -495,7 +614,7 @@ namespace nvenc {
     encoder_params = {};
   }
 
-  nvenc_encoded_frame nvenc_base::encode_frame(uint64_t frame_index, bool force_idr) {
+  nvenc_encoded_frame nvenc_base::encode_frame(uint64_t frame_index, bool force_idr, std::span<const int8_t> qp_delta_map) {
     if (!encoder) {
       return {};
     }
@@ -525,12 +644,14 @@ namespace nvenc {
     pic_params.inputWidth = encoder_params.width;
     pic_params.inputHeight = encoder_params.height;
     pic_params.encodePicFlags = force_idr ? NV_ENC_PIC_FLAG_FORCEIDR : 0;
+    restart_intra_refresh_wave(pic_params, force_idr);
     pic_params.inputTimeStamp = frame_index;
     pic_params.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
     pic_params.inputBuffer = mapped_input_buffer.mappedResource;
     pic_params.bufferFmt = mapped_input_buffer.mappedBufferFmt;
     pic_params.outputBitstream = output_bitstream;
     pic_params.completionEvent = async_event_handle;
+    set_qp_delta_map(pic_params, qp_delta_map);
 
     if (nvenc_failed(nvenc->nvEncEncodePicture(encoder, &pic_params))) {
       BOOST_LOG(error) << "NvEnc: NvEncEncodePicture() failed: " << last_nvenc_error_string;
@@ -553,11 +674,13 @@ namespace nvenc {
 
     auto data_pointer = (uint8_t *) lock_bitstream.bitstreamBufferPtr;
     nvenc_encoded_frame encoded_frame {
-      {data_pointer, data_pointer + lock_bitstream.bitstreamSizeInBytes},
+      next_buffer(),
       lock_bitstream.outputTimeStamp,
       lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
       encoder_state.rfi_needs_confirmation,
     };
+    encoded_frame.data.assign(data_pointer, data_pointer + lock_bitstream.bitstreamSizeInBytes);
+    set_temporal_layer(encoded_frame, lock_bitstream.temporalId);
 
     if (encoder_state.rfi_needs_confirmation) {
       // Invalidation request has been fulfilled, and video network packet will be marked as such
@@ -579,11 +702,187 @@ namespace nvenc {
     return encoded_frame;
   }
 
+  void nvenc_base::set_buffer_source(buffer_source_t source) {
+    buffer_source = std::move(source);
+  }
+
+  std::vector<uint8_t> nvenc_base::next_buffer() {
+    return buffer_source ? buffer_source() : std::vector<uint8_t> {};
+  }
+
+  bool nvenc_base::start_pipeline(frame_callback_t callback) {
+    if (!encoder || pipeline.slots.empty()) {
+      return false;
+    }
+
+    stop_pipeline();
+
+    pipeline.callback = std::move(callback);
+    pipeline.running = true;
+    pipeline.thread = std::thread {&nvenc_base::retrieve_frames, this};
+
+    return true;
+  }
+
+  bool nvenc_base::submit_frame(uint64_t frame_index, bool force_idr, std::span<const int8_t> qp_delta_map) {
+    std::unique_lock ul {pipeline.lock};
+    pipeline.cv.wait(ul, [this] {
+      return !pipeline.running || pipeline.failed || pipeline.submitted - pipeline.retrieved < pipeline.slots.size();
+    });
+    if (!pipeline.running || pipeline.failed) {
+      return false;
+    }
+    auto slot_index = pipeline.submitted % pipeline.slots.size();
+    ul.unlock();
+
+    // The retrieval thread is done with this slot, only its input is still mapped
+    auto &slot = pipeline.slots[slot_index];
+    if (slot.mapped_input) {
+      if (nvenc_failed(nvenc->nvEncUnmapInputResource(encoder, slot.mapped_input))) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnmapInputResource() failed: " << last_nvenc_error_string;
+      }
+      slot.mapped_input = nullptr;
+    }
+
+    if (!synchronize_input_buffer() || !copy_to_pipeline_input(slot_index)) {
+      BOOST_LOG(error) << "NvEnc: failed to synchronize input buffer";
+      return false;
+    }
+
+    NV_ENC_MAP_INPUT_RESOURCE mapped_input_buffer = {min_struct_version(NV_ENC_MAP_INPUT_RESOURCE_VER)};
+    mapped_input_buffer.registeredResource = slot.input;
+
+    if (nvenc_failed(nvenc->nvEncMapInputResource(encoder, &mapped_input_buffer))) {
+      BOOST_LOG(error) << "NvEnc: NvEncMapInputResource() failed: " << last_nvenc_error_string;
+      return false;
+    }
+    slot.mapped_input = mapped_input_buffer.mappedResource;
+
+    NV_ENC_PIC_PARAMS pic_params = {min_struct_version(NV_ENC_PIC_PARAMS_VER, 4, 6)};
+    pic_params.inputWidth = encoder_params.width;
+    pic_params.inputHeight = encoder_params.height;
+    pic_params.encodePicFlags = force_idr ? NV_ENC_PIC_FLAG_FORCEIDR : 0;
+    restart_intra_refresh_wave(pic_params, force_idr);
+    pic_params.inputTimeStamp = frame_index;
+    pic_params.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+    pic_params.inputBuffer = mapped_input_buffer.mappedResource;
+    pic_params.bufferFmt = mapped_input_buffer.mappedBufferFmt;
+    pic_params.outputBitstream = slot.output;
+    pic_params.completionEvent = async_event_handle;
+    slot.qp_delta_map.assign(std::begin(qp_delta_map), std::end(qp_delta_map));
+    set_qp_delta_map(pic_params, slot.qp_delta_map);
+
+    if (nvenc_failed(nvenc->nvEncEncodePicture(encoder, &pic_params))) {
+      BOOST_LOG(error) << "NvEnc: NvEncEncodePicture() failed: " << last_nvenc_error_string;
+      return false;
+    }
+
+    slot.after_ref_frame_invalidation = encoder_state.rfi_needs_confirmation;
+    encoder_state.rfi_needs_confirmation = false;
+    encoder_state.last_encoded_frame_index = frame_index;
+
+    ul.lock();
+    pipeline.submitted++;
+    ul.unlock();
+    pipeline.cv.notify_all();
+
+    return true;
+  }
+
+  void nvenc_base::retrieve_frames() {
+    std::unique_lock ul {pipeline.lock};
+
+    while (true) {
+      pipeline.cv.wait(ul, [this] {
+        return !pipeline.running || pipeline.retrieved < pipeline.submitted;
+      });
+      if (pipeline.retrieved == pipeline.submitted) {
+        // Stopped with nothing left in flight
+        return;
+      }
+      auto &slot = pipeline.slots[pipeline.retrieved % pipeline.slots.size()];
+      ul.unlock();
+
+      NV_ENC_LOCK_BITSTREAM lock_bitstream = {min_struct_version(NV_ENC_LOCK_BITSTREAM_VER, 1, 2)};
+      lock_bitstream.outputBitstream = slot.output;
+      lock_bitstream.doNotWait = async_event_handle ? 1 : 0;
+
+      // Completions of several in-flight frames may coalesce into a single event signal,
+      // so a frame can already be done without its own signal
+      auto status = nvenc->nvEncLockBitstream(encoder, &lock_bitstream);
+      while (status == NV_ENC_ERR_LOCK_BUSY && wait_for_async_event(100)) {
+        status = nvenc->nvEncLockBitstream(encoder, &lock_bitstream);
+      }
+
+      // nvenc_failed() isn't used here because last_nvenc_error_string belongs to the submitting thread
+      if (status != NV_ENC_SUCCESS) {
+        BOOST_LOG(error) << "NvEnc: NvEncLockBitstream() failed with status " << status;
+        pipeline.callback({});
+
+        ul.lock();
+        pipeline.failed = true;
+        pipeline.cv.notify_all();
+        return;
+      }
+
+      auto data_pointer = (uint8_t *) lock_bitstream.bitstreamBufferPtr;
+      nvenc_encoded_frame encoded_frame {
+        next_buffer(),
+        lock_bitstream.outputTimeStamp,
+        lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
+        slot.after_ref_frame_invalidation,
+      };
+      encoded_frame.data.assign(data_pointer, data_pointer + lock_bitstream.bitstreamSizeInBytes);
+      set_temporal_layer(encoded_frame, lock_bitstream.temporalId);
+
+      if (encoded_frame.idr) {
+        BOOST_LOG(debug) << "NvEnc: idr frame " << encoded_frame.frame_index;
+      }
+
+      if (auto unlock_status = nvenc->nvEncUnlockBitstream(encoder, lock_bitstream.outputBitstream); unlock_status != NV_ENC_SUCCESS) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnlockBitstream() failed with status " << unlock_status;
+      }
+
+      encoder_state.frame_size_logger.collect_and_log(encoded_frame.data.size() / 1000.);
+
+      pipeline.callback(std::move(encoded_frame));
+
+      ul.lock();
+      pipeline.retrieved++;
+      pipeline.cv.notify_all();
+    }
+  }
+
+  void nvenc_base::wait_for_pipeline_idle() {
+    std::unique_lock ul {pipeline.lock};
+    pipeline.cv.wait(ul, [this] {
+      return !pipeline.running || pipeline.failed || pipeline.retrieved == pipeline.submitted;
+    });
+  }
+
+  void nvenc_base::stop_pipeline() {
+    {
+      std::lock_guard lg {pipeline.lock};
+      pipeline.running = false;
+    }
+    pipeline.cv.notify_all();
+
+    // The retrieval thread drains the frames still in flight before it exits
+    if (pipeline.thread.joinable()) {
+      pipeline.thread.join();
+    }
+    pipeline.callback = nullptr;
+  }
+
   bool nvenc_base::invalidate_ref_frames(uint64_t first_frame, uint64_t last_frame) {
-    if (!encoder || !encoder_params.rfi) {
+    if (!encoder) {
       return false;
     }
 
+    if (!encoder_params.rfi) {
+      return request_intra_refresh_wave();
+    }
+
     if (first_frame >= encoder_state.last_rfi_range.first &&
         last_frame <= encoder_state.last_rfi_range.second) {
       BOOST_LOG(debug) << "NvEnc: rfi request " << first_frame << "-" << last_frame << " already done";
@@ -593,8 +892,8 @@ namespace nvenc {
     encoder_state.rfi_needs_confirmation = true;
 
     if (last_frame < first_frame) {
-      BOOST_LOG(error) << "NvEnc: invaid rfi request " << first_frame << "-" << last_frame << ", generating IDR";
-      return false;
+      BOOST_LOG(error) << "NvEnc: invaid rfi request " << first_frame << "-" << last_frame;
+      return request_intra_refresh_wave();
     }
 
     BOOST_LOG(debug) << "NvEnc: rfi request " << first_frame << "-" << last_frame << " expanding to last encoded frame " << encoder_state.last_encoded_frame_index;
@@ -603,20 +902,84 @@ namespace nvenc {
     encoder_state.last_rfi_range = {first_frame, last_frame};
 
     if (last_frame - first_frame + 1 >= encoder_params.ref_frames_in_dpb) {
-      BOOST_LOG(debug) << "NvEnc: rfi request too large, generating IDR";
-      return false;
+      BOOST_LOG(debug) << "NvEnc: rfi request too large";
+      return request_intra_refresh_wave();
     }
 
     for (auto i = first_frame; i <= last_frame; i++) {
       if (nvenc_failed(nvenc->nvEncInvalidateRefFrames(encoder, i))) {
         BOOST_LOG(error) << "NvEnc: NvEncInvalidateRefFrames() " << i << " failed: " << last_nvenc_error_string;
-        return false;
+        return request_intra_refresh_wave();
       }
     }
 
     return true;
   }
 
+  bool nvenc_base::request_intra_refresh_wave() {
+    if (!encoder_params.intra_refresh_restart) {
+      BOOST_LOG(debug) << "NvEnc: generating IDR";
+      return false;
+    }
+
+    BOOST_LOG(debug) << "NvEnc: restarting intra-refresh over " << encoder_params.intra_refresh_cnt << " frames instead of generating IDR";
+
+    // The first frame of the wave is marked as recovering from the invalidation,
+    // so the client resumes decoding while the wave repairs the rest of the picture
+    encoder_state.intra_refresh_wave_pending = true;
+    encoder_state.rfi_needs_confirmation = true;
+    return true;
+  }
+
+  void nvenc_base::restart_intra_refresh_wave(NV_ENC_PIC_PARAMS &pic_params, bool force_idr) {
+    if (!encoder_state.intra_refresh_wave_pending) {
+      return;
+    }
+    encoder_state.intra_refresh_wave_pending = false;
+
+    // An IDR frame repairs everything at once
+    if (force_idr) {
+      return;
+    }
+
+    switch (client_config.videoFormat) {
+      case 0:
+        pic_params.codecPicParams.h264PicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_cnt;
+        break;
+      case 1:
+        pic_params.codecPicParams.hevcPicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_cnt;
+        break;
+      case 2:
+        pic_params.codecPicParams.av1PicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_cnt;
+        break;
+    }
+  }
+
+  void nvenc_base::set_qp_delta_map(NV_ENC_PIC_PARAMS &pic_params, std::span<const int8_t> qp_delta_map) {
+    if (!config.qp_delta_map || qp_delta_map.empty()) {
+      return;
+    }
+
+    // NVENC only reads the map
+    pic_params.qpDeltaMap = const_cast<int8_t *>(qp_delta_map.data());
+    pic_params.qpDeltaMapSize = (uint32_t) qp_delta_map.size();
+  }
+
+  void nvenc_base::set_temporal_layers(NV_ENC_CONFIG_H264 &format_config) {
+    if (encoder_params.temporal_layers < 2) {
+      return;
+    }
+
+    // Hierarchical P, the frames of each layer only reference frames of lower layers
+    format_config.enableTemporalSVC = 1;
+    format_config.numTemporalLayers = encoder_params.temporal_layers;
+  }
+
+  void nvenc_base::set_temporal_layer(nvenc_encoded_frame &encoded_frame, uint32_t temporal_id) {
+    encoded_frame.temporal_layer = temporal_id;
+    encoded_frame.droppable = encoder_params.temporal_layers > 1 && !encoded_frame.idr && temporal_id + 1 == encoder_params.temporal_layers;
+  }
+
   bool nvenc_base::nvenc_failed(NVENCSTATUS status) {
     auto status_string = [](NVENCSTATUS status) -> std::string {
       switch (status) {
@@ -693,6 +1056,58 @@ namespace nvenc {
       return false;
     }
 
+    if (!reconfigure_encoder(new_bitrate_kbps, false)) {
+      return false;
+    }
+
+    // Update stored client config
+    client_config.bitrate = new_bitrate_kbps;
+
+    BOOST_LOG(info) << "NvEnc: Bitrate reconfigured to " << new_bitrate_kbps << " Kbps";
+    return true;
+  }
+
+  bool nvenc_base::reconfigure_resolution(uint32_t width, uint32_t height, uint32_t framerate) {
+    if (!encoder) {
+      BOOST_LOG(error) << "NvEnc: Cannot reconfigure - encoder not initialized";
+      return false;
+    }
+
+    if (width > encoder_params.max_width || height > encoder_params.max_height || !supports_smaller_frames()) {
+      return false;
+    }
+
+    // The intra refresh period was chosen for the framerate
+    if (encoder_params.intra_refresh_period && framerate != (uint32_t) client_config.framerate) {
+      return false;
+    }
+
+    auto previous_params = encoder_params;
+    auto previous_client_config = client_config;
+    encoder_params.width = width;
+    encoder_params.height = height;
+    client_config.width = width;
+    client_config.height = height;
+    client_config.framerate = framerate;
+
+    if (!reconfigure_encoder(client_config.bitrate, true)) {
+      encoder_params = previous_params;
+      client_config = previous_client_config;
+      return false;
+    }
+
+    // The encoder starts over from an IDR frame, nothing before it can be referenced
+    encoder_state.rfi_needs_confirmation = false;
+    encoder_state.intra_refresh_wave_pending = false;
+
+    BOOST_LOG(info) << "NvEnc: Resolution reconfigured to " << width << 'x' << height << 'x' << framerate;
+    return true;
+  }
+
+  bool nvenc_base::reconfigure_encoder(uint32_t bitrate_kbps, bool reset) {
+    // Don't reconfigure while the retrieval thread is locking bitstreams
+    wait_for_pipeline_idle();
+
     NV_ENC_INITIALIZE_PARAMS init_params = {min_struct_version(NV_ENC_INITIALIZE_PARAMS_VER)};
     
     // Determine codec GUID
@@ -721,8 +1136,9 @@ namespace nvenc {
 
     // Prepare reconfigure parameters
     NV_ENC_RECONFIGURE_PARAMS reconfigure_params = {min_struct_version(NV_ENC_RECONFIGURE_PARAMS_VER)};
-    reconfigure_params.forceIDR = 0;  // Don't force IDR on bitrate change
-    reconfigure_params.resetEncoder = 0;
+    // A bitrate change continues the stream, a new frame size starts it over
+    reconfigure_params.forceIDR = reset ? 1 : 0;
+    reconfigure_params.resetEncoder = reset ? 1 : 0;
 
     // Re-apply all encoder settings from create_encoder to preserve low-latency configuration
     // Start from preset config and apply all custom settings, not just bitrate
@@ -740,7 +1156,10 @@ namespace nvenc {
                                     config.two_pass == nvenc_two_pass::full_resolution    ? NV_ENC_TWO_PASS_FULL_RESOLUTION :
                                                                                             NV_ENC_MULTI_PASS_DISABLED;
     enc_config.rcParams.enableAQ = config.adaptive_quantization;
-    enc_config.rcParams.averageBitRate = new_bitrate_kbps * 1000;  // Convert to bps
+    if (config.qp_delta_map) {
+      enc_config.rcParams.qpMapMode = NV_ENC_QP_MAP_DELTA;
+    }
+    enc_config.rcParams.averageBitRate = bitrate_kbps * 1000;  // Convert to bps
 
     // Helper lambdas for buffer format checks
     auto buffer_is_10bit = [&]() {
@@ -764,7 +1183,7 @@ namespace nvenc {
       if (framerate > 1000) {
         framerate = framerate / 1000.0f;  // Convert from millifps to fps
       }
-      enc_config.rcParams.vbvBufferSize = new_bitrate_kbps * 1000 / static_cast<uint32_t>(framerate);
+      enc_config.rcParams.vbvBufferSize = bitrate_kbps * 1000 / static_cast<uint32_t>(framerate);
       if (config.vbv_percentage_increase > 0) {
         enc_config.rcParams.vbvBufferSize += enc_config.rcParams.vbvBufferSize * config.vbv_percentage_increase / 100;
       }
@@ -833,6 +1252,8 @@ namespace nvenc {
           set_ref_frames(format_config.maxNumRefFrames, format_config.numRefL0, 5);
           set_minqp_if_enabled(config.min_qp_h264);
           fill_h264_hevc_vui(format_config.h264VUIParameters);
+          set_intra_refresh(format_config, encoder_params.intra_refresh_period, encoder_params.intra_refresh_cnt, encoder_params.single_slice_intra_refresh);
+          set_temporal_layers(format_config);
           break;
         }
 
@@ -847,20 +1268,7 @@ namespace nvenc {
           set_ref_frames(format_config.maxNumRefFramesInDPB, format_config.numRefL0, 5);
           set_minqp_if_enabled(config.min_qp_hevc);
           fill_h264_hevc_vui(format_config.hevcVUIParameters);
-          if (client_config.enableIntraRefresh == 1) {
-            if (get_encoder_cap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
-              format_config.enableIntraRefresh = 1;
-              format_config.intraRefreshPeriod = 300;
-              format_config.intraRefreshCnt = 299;
-              if (get_encoder_cap(NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH)) {
-                format_config.singleSliceIntraRefresh = 1;
-              } else {
-                BOOST_LOG(warning) << "NvEnc: Single Slice Intra Refresh not supported";
-              }
-            } else {
-              BOOST_LOG(error) << "NvEnc: Client asked for intra-refresh but the encoder does not support intra-refresh";
-            }
-          }
+          set_intra_refresh(format_config, encoder_params.intra_refresh_period, encoder_params.intra_refresh_cnt, encoder_params.single_slice_intra_refresh);
           break;
         }
 
@@ -885,6 +1293,7 @@ namespace nvenc {
           format_config.chromaSamplePosition = buffer_is_yuv444() ? 0 : 1;
           set_ref_frames(format_config.maxNumRefFramesInDPB, format_config.numFwdRefs, 8);
           set_minqp_if_enabled(config.min_qp_av1);
+          set_intra_refresh(format_config, encoder_params.intra_refresh_period, encoder_params.intra_refresh_cnt, encoder_params.single_slice_intra_refresh);
 
           if (client_config.slicesPerFrame > 1) {
             // NVENC only supports slice counts that are powers of two, so we'll pick powers of two
@@ -907,8 +1316,8 @@ namespace nvenc {
     init_params.darWidth = encoder_params.width;
     init_params.encodeHeight = encoder_params.height;
     init_params.darHeight = encoder_params.height;
-    init_params.maxEncodeWidth = encoder_params.width;
-    init_params.maxEncodeHeight = encoder_params.height;
+    init_params.maxEncodeWidth = encoder_params.max_width;
+    init_params.maxEncodeHeight = encoder_params.max_height;
     init_params.frameRateNum = client_config.framerate;
     init_params.frameRateDen = 1;
 
@@ -921,10 +1330,6 @@ namespace nvenc {
       return false;
     }
 
-    // Update stored client config
-    client_config.bitrate = new_bitrate_kbps;
-
-    BOOST_LOG(info) << "NvEnc: Bitrate reconfigured to " << new_bitrate_kbps << " Kbps";
     return true;
   }
 }  // namespace nvenc
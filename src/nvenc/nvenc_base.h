@@ -4,6 +4,14 @@
  */
 #pragma once
 
+// standard includes
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
 // lib includes
 #include <ffnvcodec/nvEncodeAPI.h>
 
@@ -56,9 +64,46 @@ namespace nvenc {
      *        Afterwards serves as parameter for `invalidate_ref_frames()`.
      *        No restrictions on the first frame index, but later frame indexes must be subsequent.
      * @param force_idr Whether to encode frame as forced IDR.
+     * @param qp_delta_map QP delta per block in raster scan order, see `roi::build_map()`.
+     *        Ignored unless `nvenc_config::qp_delta_map` is set, empty to encode every block alike.
      * @return Encoded frame.
      */
-    nvenc_encoded_frame encode_frame(uint64_t frame_index, bool force_idr);
+    nvenc_encoded_frame encode_frame(uint64_t frame_index, bool force_idr, std::span<const int8_t> qp_delta_map = {});
+
+    /**
+     * @brief Supplies empty buffers for encoded frames to be written into.
+     */
+    using buffer_source_t = std::function<std::vector<uint8_t>()>;
+
+    /**
+     * @brief Write encoded frames into buffers from a source instead of allocating one per frame.
+     *        Must be set before `start_pipeline()`.
+     * @param source Called for each encoded frame, from the thread that retrieves it.
+     */
+    void set_buffer_source(buffer_source_t source);
+
+    /**
+     * @brief Receives frames completed by the pipeline, or an empty frame on error.
+     */
+    using frame_callback_t = std::function<void(nvenc_encoded_frame &&)>;
+
+    /**
+     * @brief Start pipelined encoding, where `submit_frame()` doesn't wait for the frame to be encoded.
+     *        Requires `nvenc_config::async_depth` above 1 and a derived class that supports pipeline input surfaces.
+     * @param callback Called with each completed frame in submission order, from a separate retrieval thread.
+     * @return `true` on success, `false` if frames must be encoded with `encode_frame()`.
+     */
+    bool start_pipeline(frame_callback_t callback);
+
+    /**
+     * @brief Submit the next frame to the pipeline.
+     *        Only waits if all in-flight surfaces are still being encoded.
+     * @param frame_index Frame index that uniquely identifies the frame, same rules as for `encode_frame()`.
+     * @param force_idr Whether to encode frame as forced IDR.
+     * @param qp_delta_map QP delta per block, same as for `encode_frame()`. Copied, the caller may reuse it.
+     * @return `true` on success, `false` on error.
+     */
+    bool submit_frame(uint64_t frame_index, bool force_idr, std::span<const int8_t> qp_delta_map = {});
 
     /**
      * @brief Perform reference frame invalidation (RFI) procedure.
@@ -66,6 +111,8 @@ namespace nvenc {
      * @param last_frame Last frame index of the invalidation range.
      * @return `true` on success, `false` on error.
      *         After error next frame must be encoded with `force_idr = true`.
+     *         With intra refresh restarts enabled, invalidations that can't be done
+     *         start a new intra refresh wave instead of failing.
      */
     bool invalidate_ref_frames(uint64_t first_frame, uint64_t last_frame);
 
@@ -76,6 +123,18 @@ namespace nvenc {
      */
     bool reconfigure_bitrate(uint32_t new_bitrate_kbps);
 
+    /**
+     * @brief Change the frame size and framerate during active session, without recreating the encoder.
+     * @details The encoder is reset and restarts with an IDR frame, the input and bitstream buffers are kept.
+     *          The frames are taken from the top left corner of the input buffers.
+     * @param width New frame width, no larger than the width the encoder was created for.
+     * @param height New frame height, no larger than the height the encoder was created for.
+     * @param framerate New framerate, it can't change with intra refresh.
+     * @return `true` on success, `false` on error or unsupported.
+     *         On error the encoder keeps the frame size it had.
+     */
+    bool reconfigure_resolution(uint32_t width, uint32_t height, uint32_t framerate);
+
   protected:
     /**
      * @brief Required. Used for loading NvEnc library and setting `nvenc` variable with `NvEncodeAPICreateInstance()`.
@@ -101,6 +160,37 @@ namespace nvenc {
       return true;
     }
 
+    /**
+     * @brief Optional. Override to support pipelined encoding.
+     *        Create an additional input surface of the same size and format as the outside-facing one
+     *        and register it with `nvenc->nvEncRegisterResource()`. The base class unregisters it.
+     *        Called during `create_encoder()` once per in-flight frame.
+     * @return Registered surface, or `nullptr` if not supported.
+     */
+    virtual NV_ENC_REGISTERED_PTR create_and_register_pipeline_input() {
+      return nullptr;
+    }
+
+    /**
+     * @brief Optional. Override to support pipelined encoding.
+     *        Copy the outside-facing input surface into a surface created by `create_and_register_pipeline_input()`.
+     * @param index Index of the pipeline input surface in creation order.
+     * @return `true` on success, `false` on error
+     */
+    virtual bool copy_to_pipeline_input(size_t index) {
+      return false;
+    }
+
+    /**
+     * @brief Optional. Override to support `reconfigure_resolution()`.
+     *        Whether the input surfaces can hold a frame smaller than their size in their top left corner,
+     *        which doesn't hold for surfaces with their planes stacked at offsets from the frame size.
+     * @return `true` if smaller frames can be encoded from the input surfaces.
+     */
+    virtual bool supports_smaller_frames() {
+      return false;
+    }
+
     /**
      * @brief Optional. Override if you want to create encoder in async mode.
      *        In this case must also set `async_event_handle` variable.
@@ -130,9 +220,16 @@ namespace nvenc {
     struct {
       uint32_t width = 0;
       uint32_t height = 0;
+      uint32_t max_width = 0;  ///< Size the encoder and its buffers were created for
+      uint32_t max_height = 0;
       NV_ENC_BUFFER_FORMAT buffer_format = NV_ENC_BUFFER_FORMAT_UNDEFINED;
       uint32_t ref_frames_in_dpb = 0;
       bool rfi = false;
+      uint32_t intra_refresh_period = 0;  ///< 0 if intra refresh is disabled
+      uint32_t intra_refresh_cnt = 0;
+      bool intra_refresh_restart = false;
+      bool single_slice_intra_refresh = false;
+      uint32_t temporal_layers = 1;  ///< 1 if temporal layers are disabled
     } encoder_params;
 
     std::string last_nvenc_error_string;
@@ -153,12 +250,88 @@ namespace nvenc {
                                          ///< Can be set in constructor or `init_library()`, must override `wait_for_async_event()`.
 
   private:
+    /**
+     * @brief Input and output surfaces of one in-flight frame.
+     */
+    struct pipeline_slot_t {
+      NV_ENC_REGISTERED_PTR input = nullptr;
+      NV_ENC_INPUT_PTR mapped_input = nullptr;
+      NV_ENC_OUTPUT_PTR output = nullptr;
+      bool after_ref_frame_invalidation = false;
+      std::vector<int8_t> qp_delta_map;  ///< Must stay valid until the frame is encoded
+    };
+
+    void retrieve_frames();
+    void wait_for_pipeline_idle();
+
+    /**
+     * @brief Reinitialize the encoder from the stored configs.
+     * @param bitrate_kbps Bitrate in Kbps.
+     * @param reset Whether to reset the encoder and start with an IDR frame, needed for a new frame size.
+     * @return `true` on success, `false` on error.
+     */
+    bool reconfigure_encoder(uint32_t bitrate_kbps, bool reset);
+    void stop_pipeline();
+
+    /**
+     * @brief Recover from a failed invalidation with an intra refresh wave, if enabled.
+     * @return `true` if the next frame starts a wave, `false` if it must be an IDR frame.
+     */
+    bool request_intra_refresh_wave();
+
+    /**
+     * @brief Start the intra refresh wave requested by `request_intra_refresh_wave()`.
+     * @param pic_params Parameters of the next frame.
+     * @param force_idr Whether the next frame is an IDR frame anyway.
+     */
+    void restart_intra_refresh_wave(NV_ENC_PIC_PARAMS &pic_params, bool force_idr);
+
+    /**
+     * @brief Attach a QP delta map to the next frame, if the encoder was created to take one.
+     * @param pic_params Parameters of the next frame.
+     * @param qp_delta_map The map, must stay valid until the frame is encoded.
+     */
+    void set_qp_delta_map(NV_ENC_PIC_PARAMS &pic_params, std::span<const int8_t> qp_delta_map);
+
+    /**
+     * @brief Enable the temporal layers chosen by `create_encoder()`, if any.
+     * @param format_config H.264 configuration of the encoder.
+     */
+    void set_temporal_layers(NV_ENC_CONFIG_H264 &format_config);
+
+    /**
+     * @brief Tag an encoded frame with its temporal layer.
+     * @param encoded_frame The frame.
+     * @param temporal_id `NV_ENC_LOCK_BITSTREAM::temporalId` of the frame.
+     */
+    void set_temporal_layer(nvenc_encoded_frame &encoded_frame, uint32_t temporal_id);
+
+    /**
+     * @brief Get an empty buffer for the next encoded frame.
+     * @return A buffer from the buffer source, or a new one without a source.
+     */
+    std::vector<uint8_t> next_buffer();
+
     NV_ENC_OUTPUT_PTR output_bitstream = nullptr;
     uint32_t minimum_api_version = 0;
+    buffer_source_t buffer_source;
+
+    struct {
+      std::vector<pipeline_slot_t> slots;
+      uint64_t submitted = 0;  ///< Frames submitted so far, the next one goes to `slots[submitted % slots.size()]`
+      uint64_t retrieved = 0;  ///< Frames handed to the callback so far
+      bool running = false;
+      bool failed = false;
+      frame_callback_t callback;
+      std::mutex lock;
+      std::condition_variable cv;
+      std::thread thread;
+    } pipeline;
 
     struct {
       uint64_t last_encoded_frame_index = 0;
       bool rfi_needs_confirmation = false;
+      bool intra_refresh_wave_pending = false;
       std::pair<uint64_t, uint64_t> last_rfi_range;
       logging::min_max_avg_periodic_logger<double> frame_size_logger = {debug, "NvEnc: encoded frame sizes in kB", ""};
     } encoder_state;
@@ -49,11 +49,29 @@ namespace nvenc {
     // Add filler data to encoded frames to stay at target bitrate, mainly for testing
     bool insert_filler_data = false;
 
-    // Intra refresh for clients that doesn't request keyframe correctly
+    // Intra refresh for all clients, also used for clients that doesn't request keyframe correctly
     bool intra_refresh = false;
 
+    // Frames between the start of two intra refresh waves, 0 for the default of 300
+    int intra_refresh_period = 0;
+
+    // Frames each intra refresh wave is spread over, 0 for a quarter second
+    int intra_refresh_wave = 0;
+
+    // Recover from loss that reference frame invalidation can't repair with an intra refresh wave instead of an IDR frame
+    bool intra_refresh_restart_on_loss = true;
+
     // Use NVENC variable bitrate rate control instead of constant bitrate
     bool vbr_rate_control = false;
+
+    // Frames that may be encoded while the next one is captured, 1 encodes each frame before capturing the next
+    int async_depth = 1;
+
+    // Take a QP delta per block with each frame, for region-of-interest encoding
+    bool qp_delta_map = false;
+
+    // Temporal layers of H.264 streams, frames of the top layer aren't referenced and may be dropped under congestion
+    int temporal_layers = 1;
   };
 
 }  // namespace nvenc
@@ -0,0 +1,251 @@
+/**
+ * @file src/nvenc/nvenc_cuda.cpp
+ * @brief Definitions for CUDA NVENC encoder with CUDA input surfaces.
+ */
+#if defined(SUNSHINE_BUILD_CUDA) && !defined(_WIN32)
+  // this include
+  #include "nvenc_cuda.h"
+
+namespace nvenc {
+
+  nvenc_cuda::nvenc_cuda(CUstream stream):
+      nvenc_base(NV_ENC_DEVICE_TYPE_CUDA),
+      stream(stream) {
+  }
+
+  nvenc_cuda::~nvenc_cuda() {
+    if (encoder) {
+      destroy_encoder();
+    }
+
+    if (cuda_context) {
+      {
+        auto autopop_context = push_context();
+
+        for (auto surface : pipeline_surfaces) {
+          if (cuda_failed(cuda_functions->cuMemFree(surface))) {
+            BOOST_LOG(error) << "NvEnc: cuMemFree() failed: error " << last_cuda_error;
+          }
+        }
+        pipeline_surfaces.clear();
+
+        if (cuda_surface) {
+          if (cuda_failed(cuda_functions->cuMemFree(cuda_surface))) {
+            BOOST_LOG(error) << "NvEnc: cuMemFree() failed: error " << last_cuda_error;
+          }
+          cuda_surface = 0;
+        }
+      }
+
+      if (cuda_failed(cuda_functions->cuDevicePrimaryCtxRelease(cuda_device))) {
+        BOOST_LOG(error) << "NvEnc: cuDevicePrimaryCtxRelease() failed: error " << last_cuda_error;
+      }
+      cuda_context = nullptr;
+    }
+
+    if (cuda_functions) {
+      cuda_free_functions(&cuda_functions);
+    }
+    if (nvenc_functions) {
+      nvenc_free_functions(&nvenc_functions);
+    }
+  }
+
+  CUdeviceptr nvenc_cuda::get_input_surface() const {
+    return cuda_surface;
+  }
+
+  size_t nvenc_cuda::get_input_pitch() const {
+    return cuda_surface_pitch;
+  }
+
+  bool nvenc_cuda::init_library() {
+    if (!nvenc_functions && nvenc_load_functions(&nvenc_functions, nullptr)) {
+      BOOST_LOG(debug) << "NvEnc: couldn't load NvEnc library";
+      return false;
+    }
+
+    if (!cuda_functions && cuda_load_functions(&cuda_functions, nullptr)) {
+      BOOST_LOG(debug) << "NvEnc: couldn't load CUDA library";
+      return false;
+    }
+
+    // The CUDA runtime converts into the input surface, so the encoder shares its primary context
+    if (!cuda_context) {
+      if (cuda_failed(cuda_functions->cuInit(0)) ||
+          cuda_failed(cuda_functions->cuDeviceGet(&cuda_device, 0)) ||
+          cuda_failed(cuda_functions->cuDevicePrimaryCtxRetain(&cuda_context, cuda_device))) {
+        BOOST_LOG(error) << "NvEnc: couldn't retain the primary CUDA context: error " << last_cuda_error;
+        cuda_context = nullptr;
+        return false;
+      }
+    }
+
+    auto new_nvenc = std::make_unique<NV_ENCODE_API_FUNCTION_LIST>();
+    new_nvenc->version = min_struct_version(NV_ENCODE_API_FUNCTION_LIST_VER);
+    if (nvenc_failed(nvenc_functions->NvEncodeAPICreateInstance(new_nvenc.get()))) {
+      BOOST_LOG(error) << "NvEnc: NvEncodeAPICreateInstance() failed: " << last_nvenc_error_string;
+      return false;
+    }
+
+    nvenc = std::move(new_nvenc);
+    device = cuda_context;
+    return true;
+  }
+
+  bool nvenc_cuda::create_and_register_input_buffer() {
+    if (encoder_params.buffer_format != NV_ENC_BUFFER_FORMAT_NV12) {
+      BOOST_LOG(error) << "NvEnc: CUDA input surfaces are only supported for 8-bit 4:2:0 encoding";
+      return false;
+    }
+
+    {
+      auto autopop_context = push_context();
+      if (!autopop_context) {
+        return false;
+      }
+
+      // The base class unregistered the pipeline surfaces of the previous encoder
+      for (auto surface : pipeline_surfaces) {
+        cuda_functions->cuMemFree(surface);
+      }
+      pipeline_surfaces.clear();
+    }
+
+    if (!registered_input_buffer) {
+      if (cuda_surface) {
+        auto autopop_context = push_context();
+        cuda_functions->cuMemFree(cuda_surface);
+        cuda_surface = 0;
+      }
+
+      if (!(registered_input_buffer = allocate_and_register_surface(cuda_surface))) {
+        return false;
+      }
+    }
+
+    if (stream) {
+      // Reading the input waits for the conversion queued on the stream instead of the whole device
+      auto io_stream = (NV_ENC_CUSTREAM_PTR) &stream;
+      if (nvenc_failed(nvenc->nvEncSetIOCudaStreams(encoder, io_stream, io_stream))) {
+        BOOST_LOG(error) << "NvEnc: NvEncSetIOCudaStreams() failed: " << last_nvenc_error_string;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  NV_ENC_REGISTERED_PTR nvenc_cuda::create_and_register_pipeline_input() {
+    CUdeviceptr surface = 0;
+    auto registered = allocate_and_register_surface(surface);
+    if (surface) {
+      pipeline_surfaces.push_back(surface);
+    }
+
+    return registered;
+  }
+
+  bool nvenc_cuda::copy_to_pipeline_input(size_t index) {
+    if (index >= pipeline_surfaces.size()) {
+      return false;
+    }
+
+    auto autopop_context = push_context();
+    if (!autopop_context) {
+      return false;
+    }
+
+    CUDA_MEMCPY2D copy_params = {};
+    copy_params.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+    copy_params.srcDevice = cuda_surface;
+    copy_params.srcPitch = cuda_surface_pitch;
+    copy_params.dstMemoryType = CU_MEMORYTYPE_DEVICE;
+    copy_params.dstDevice = pipeline_surfaces[index];
+    copy_params.dstPitch = cuda_surface_pitch;
+    // NV12, the chroma plane is half the height of the luma plane
+    copy_params.WidthInBytes = encoder_params.width;
+    copy_params.Height = encoder_params.height * 3 / 2;
+
+    // Stays ordered with the conversion and the encoder reading the surface
+    if (cuda_failed(cuda_functions->cuMemcpy2DAsync(&copy_params, stream))) {
+      BOOST_LOG(error) << "NvEnc: cuMemcpy2DAsync() failed: error " << last_cuda_error;
+      return false;
+    }
+
+    return true;
+  }
+
+  NV_ENC_REGISTERED_PTR nvenc_cuda::allocate_and_register_surface(CUdeviceptr &surface) {
+    {
+      auto autopop_context = push_context();
+      if (!autopop_context) {
+        return nullptr;
+      }
+
+      size_t pitch;
+      if (cuda_failed(cuda_functions->cuMemAllocPitch(
+            &surface,
+            &pitch,
+            // NV12, the chroma plane follows the luma plane
+            encoder_params.width,
+            encoder_params.height * 3 / 2,
+            16
+          ))) {
+        BOOST_LOG(error) << "NvEnc: cuMemAllocPitch() failed: error " << last_cuda_error;
+        surface = 0;
+        return nullptr;
+      }
+
+      // Surfaces of the same size get the same pitch
+      cuda_surface_pitch = pitch;
+    }
+
+    NV_ENC_REGISTER_RESOURCE register_resource = {min_struct_version(NV_ENC_REGISTER_RESOURCE_VER, 3, 4)};
+    register_resource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_CUDADEVICEPTR;
+    register_resource.width = encoder_params.width;
+    register_resource.height = encoder_params.height;
+    register_resource.pitch = cuda_surface_pitch;
+    register_resource.resourceToRegister = (void *) surface;
+    register_resource.bufferFormat = encoder_params.buffer_format;
+    register_resource.bufferUsage = NV_ENC_INPUT_IMAGE;
+
+    if (nvenc_failed(nvenc->nvEncRegisterResource(encoder, &register_resource))) {
+      BOOST_LOG(error) << "NvEnc: NvEncRegisterResource() failed: " << last_nvenc_error_string;
+      return nullptr;
+    }
+
+    return register_resource.registeredResource;
+  }
+
+  bool nvenc_cuda::cuda_succeeded(CUresult result) {
+    last_cuda_error = result;
+    return result == CUDA_SUCCESS;
+  }
+
+  bool nvenc_cuda::cuda_failed(CUresult result) {
+    last_cuda_error = result;
+    return result != CUDA_SUCCESS;
+  }
+
+  nvenc_cuda::autopop_context::~autopop_context() {
+    if (pushed_context) {
+      CUcontext popped_context;
+      if (parent.cuda_failed(parent.cuda_functions->cuCtxPopCurrent(&popped_context))) {
+        BOOST_LOG(error) << "NvEnc: cuCtxPopCurrent() failed: error " << parent.last_cuda_error;
+      }
+    }
+  }
+
+  nvenc_cuda::autopop_context nvenc_cuda::push_context() {
+    if (cuda_context &&
+        cuda_succeeded(cuda_functions->cuCtxPushCurrent(cuda_context))) {
+      return {*this, cuda_context};
+    } else {
+      BOOST_LOG(error) << "NvEnc: cuCtxPushCurrent() failed: error " << last_cuda_error;
+      return {*this, nullptr};
+    }
+  }
+
+}  // namespace nvenc
+#endif
@@ -0,0 +1,95 @@
+/**
+ * @file src/nvenc/nvenc_cuda.h
+ * @brief Declarations for CUDA NVENC encoder with CUDA input surfaces.
+ */
+#pragma once
+#if defined(SUNSHINE_BUILD_CUDA) && !defined(_WIN32)
+  // standard includes
+  #include <vector>
+
+  // lib includes
+  #include <ffnvcodec/dynlink_loader.h>
+
+  // local includes
+  #include "nvenc_base.h"
+
+namespace nvenc {
+
+  /**
+   * @brief Native CUDA NVENC encoder.
+   *        Input surface is CUDA device memory in the primary context of the first CUDA device,
+   *        the same memory the CUDA runtime conversion kernels write into.
+   */
+  class nvenc_cuda final: public nvenc_base {
+  public:
+    /**
+     * @param stream CUDA stream the input surface is written on.
+     *               NVENC waits for the work queued on it before reading the surface.
+     */
+    explicit nvenc_cuda(CUstream stream);
+    ~nvenc_cuda();
+
+    /**
+     * @brief Get the input surface, valid after `create_encoder()`.
+     * @return Device pointer to the luma plane, the chroma plane follows `get_input_pitch() * height` bytes later.
+     */
+    CUdeviceptr get_input_surface() const;
+
+    /**
+     * @brief Get the pitch of the input surface.
+     * @return Size of a row in bytes.
+     */
+    size_t get_input_pitch() const;
+
+  private:
+    bool init_library() override;
+
+    bool create_and_register_input_buffer() override;
+
+    NV_ENC_REGISTERED_PTR create_and_register_pipeline_input() override;
+
+    bool copy_to_pipeline_input(size_t index) override;
+
+    /**
+     * @brief Allocate a surface of the input format and register it with NVENC.
+     * @param surface Receives the device pointer.
+     * @return Registered surface, or `nullptr` on error.
+     */
+    NV_ENC_REGISTERED_PTR allocate_and_register_surface(CUdeviceptr &surface);
+
+    bool cuda_succeeded(CUresult result);
+
+    bool cuda_failed(CUresult result);
+
+    struct autopop_context {
+      autopop_context(nvenc_cuda &parent, CUcontext pushed_context):
+          parent(parent),
+          pushed_context(pushed_context) {
+      }
+
+      ~autopop_context();
+
+      explicit operator bool() const {
+        return pushed_context != nullptr;
+      }
+
+      nvenc_cuda &parent;
+      CUcontext pushed_context = nullptr;
+    };
+
+    autopop_context push_context();
+
+    CudaFunctions *cuda_functions = nullptr;
+    NvencFunctions *nvenc_functions = nullptr;
+
+    CUresult last_cuda_error = CUDA_SUCCESS;
+    CUdevice cuda_device = 0;
+    CUcontext cuda_context = nullptr;
+    CUstream stream;
+    CUdeviceptr cuda_surface = 0;
+    size_t cuda_surface_pitch = 0;
+    std::vector<CUdeviceptr> pipeline_surfaces;  ///< Registered by `create_and_register_pipeline_input()`, unregistered by the base class
+  };
+
+}  // namespace nvenc
+#endif
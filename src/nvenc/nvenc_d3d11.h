@@ -15,6 +15,7 @@
 namespace nvenc {
 
   _COM_SMARTPTR_TYPEDEF(ID3D11Device, IID_ID3D11Device);
+  _COM_SMARTPTR_TYPEDEF(ID3D11DeviceContext, IID_ID3D11DeviceContext);
   _COM_SMARTPTR_TYPEDEF(ID3D11Texture2D, IID_ID3D11Texture2D);
   _COM_SMARTPTR_TYPEDEF(IDXGIDevice, IID_IDXGIDevice);
   _COM_SMARTPTR_TYPEDEF(IDXGIAdapter, IID_IDXGIAdapter);
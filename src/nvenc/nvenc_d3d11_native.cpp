@@ -15,6 +15,7 @@ namespace nvenc {
       nvenc_d3d11(NV_ENC_DEVICE_TYPE_DIRECTX),
       d3d_device(d3d_device) {
     device = d3d_device;
+    d3d_device->GetImmediateContext(&d3d_context);
   }
 
   nvenc_d3d11_native::~nvenc_d3d11_native() {
@@ -44,6 +45,15 @@ namespace nvenc {
       desc.SampleDesc.Count = 1;
       desc.Usage = D3D11_USAGE_DEFAULT;
       desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+
+      // Lets the conversion write both planes of NV12/P010 from a compute shader
+      UINT format_support = 0;
+      if ((desc.Format == DXGI_FORMAT_NV12 || desc.Format == DXGI_FORMAT_P010) &&
+          SUCCEEDED(d3d_device->CheckFormatSupport(desc.Format, &format_support)) &&
+          (format_support & D3D11_FORMAT_SUPPORT_TYPED_UNORDERED_ACCESS_VIEW)) {
+        desc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
+      }
+
       if (d3d_device->CreateTexture2D(&desc, nullptr, &d3d_input_texture) != S_OK) {
         BOOST_LOG(error) << "NvEnc: couldn't create input texture";
         return false;
@@ -51,24 +61,64 @@ namespace nvenc {
     }
 
     if (!registered_input_buffer) {
-      NV_ENC_REGISTER_RESOURCE register_resource = {min_struct_version(NV_ENC_REGISTER_RESOURCE_VER, 3, 4)};
-      register_resource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX;
-      register_resource.width = encoder_params.width;
-      register_resource.height = encoder_params.height;
-      register_resource.resourceToRegister = d3d_input_texture.GetInterfacePtr();
-      register_resource.bufferFormat = encoder_params.buffer_format;
-      register_resource.bufferUsage = NV_ENC_INPUT_IMAGE;
-
-      if (nvenc_failed(nvenc->nvEncRegisterResource(encoder, &register_resource))) {
-        BOOST_LOG(error) << "NvEnc: NvEncRegisterResource() failed: " << last_nvenc_error_string;
+      registered_input_buffer = register_texture(d3d_input_texture.GetInterfacePtr());
+      if (!registered_input_buffer) {
         return false;
       }
+    }
+
+    return true;
+  }
+
+  NV_ENC_REGISTERED_PTR nvenc_d3d11_native::create_and_register_pipeline_input() {
+    D3D11_TEXTURE2D_DESC desc;
+    d3d_input_texture->GetDesc(&desc);
+
+    // The encoder reads from these copies, so conversion can render the next frame meanwhile
+    ID3D11Texture2DPtr texture;
+    desc.BindFlags = 0;
+    if (d3d_device->CreateTexture2D(&desc, nullptr, &texture) != S_OK) {
+      BOOST_LOG(error) << "NvEnc: couldn't create pipeline input texture";
+      return nullptr;
+    }
+
+    auto registered = register_texture(texture.GetInterfacePtr());
+    if (registered) {
+      d3d_pipeline_textures.emplace_back(std::move(texture));
+    }
+    return registered;
+  }
 
-      registered_input_buffer = register_resource.registeredResource;
+  bool nvenc_d3d11_native::copy_to_pipeline_input(size_t index) {
+    if (index >= d3d_pipeline_textures.size()) {
+      return false;
     }
 
+    d3d_context->CopyResource(d3d_pipeline_textures[index].GetInterfacePtr(), d3d_input_texture.GetInterfacePtr());
+    return true;
+  }
+
+  bool nvenc_d3d11_native::supports_smaller_frames() {
+    // The chroma plane of NV12/P010 follows the luma plane of the whole texture, the packed formats have no other plane
     return true;
   }
 
+  NV_ENC_REGISTERED_PTR nvenc_d3d11_native::register_texture(ID3D11Texture2D *texture) {
+    NV_ENC_REGISTER_RESOURCE register_resource = {min_struct_version(NV_ENC_REGISTER_RESOURCE_VER, 3, 4)};
+    register_resource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX;
+    register_resource.width = encoder_params.width;
+    register_resource.height = encoder_params.height;
+    register_resource.resourceToRegister = texture;
+    register_resource.bufferFormat = encoder_params.buffer_format;
+    register_resource.bufferUsage = NV_ENC_INPUT_IMAGE;
+
+    if (nvenc_failed(nvenc->nvEncRegisterResource(encoder, &register_resource))) {
+      BOOST_LOG(error) << "NvEnc: NvEncRegisterResource() failed: " << last_nvenc_error_string;
+      return nullptr;
+    }
+
+    return register_resource.registeredResource;
+  }
+
 }  // namespace nvenc
 #endif
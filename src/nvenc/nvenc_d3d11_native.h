@@ -7,6 +7,7 @@
   // standard includes
   #include <comdef.h>
   #include <d3d11.h>
+  #include <vector>
 
   // local includes
   #include "nvenc_d3d11.h"
@@ -28,9 +29,16 @@ namespace nvenc {
 
   private:
     bool create_and_register_input_buffer() override;
+    NV_ENC_REGISTERED_PTR create_and_register_pipeline_input() override;
+    bool copy_to_pipeline_input(size_t index) override;
+    bool supports_smaller_frames() override;
+
+    NV_ENC_REGISTERED_PTR register_texture(ID3D11Texture2D *texture);
 
     const ID3D11DevicePtr d3d_device;
+    ID3D11DeviceContextPtr d3d_context;
     ID3D11Texture2DPtr d3d_input_texture;
+    std::vector<ID3D11Texture2DPtr> d3d_pipeline_textures;
   };
 
 }  // namespace nvenc
@@ -18,6 +18,8 @@ namespace nvenc {
     uint64_t frame_index = 0;
     bool idr = false;
     bool after_ref_frame_invalidation = false;
+    uint32_t temporal_layer = 0;  ///< 0 for the base layer
+    bool droppable = false;  ///< Frame of the top temporal layer, no other frame references it
   };
 
 }  // namespace nvenc
@@ -6,27 +6,35 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <cmath>
+#include <condition_variable>
 #include <filesystem>
 #include <format>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
 #include <utility>
 #include <string>
 
 // lib includes
+#include <boost/algorithm/string.hpp>
 #include <boost/asio/ssl/context.hpp>
 #include <boost/asio/ssl/context_base.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/xml_parser.hpp>
 #include <Simple-Web-Server/server_http.hpp>
 
 // local includes
+#include "admission.h"
+#include "asset_cache.h"
+#include "audio.h"
+#include "clipboard.h"
 #include "config.h"
 #include "display_device.h"
 #include "file_handler.h"
 #include "globals.h"
 #include "httpcommon.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
 #include "nvhttp.h"
 #include "platform/common.h"
@@ -34,9 +42,11 @@
 #include "rtsp.h"
 #include "stream.h"
 #include "system_tray.h"
+#include "thread_pool.h"
 #include "utility.h"
 #include "uuid.h"
 #include "video.h"
+#include "xml_writer.h"
 #include "zwpad.h"
 
 #ifdef _WIN32
@@ -48,7 +58,6 @@ using namespace std::literals;
 namespace nvhttp {
 
   namespace fs = std::filesystem;
-  namespace pt = boost::property_tree;
 
   using p_named_cert_t = crypto::p_named_cert_t;
   using PERM = crypto::PERM;
@@ -92,6 +101,32 @@ namespace nvhttp {
    */
   static std::chrono::time_point<std::chrono::steady_clock> otp_creation_time;
 
+  static auto &resumed_handshakes = metrics::counter("nvhttp_tls_resumed_handshakes"sv);  ///< HTTPS connections that resumed an earlier TLS session.
+
+  /**
+   * @brief Runs the launches and resumes one at a time, off the HTTPS server thread.
+   * @details Setting up the display and starting the app can take seconds, meanwhile the server
+   *          keeps answering the other clients. A response is sent once the task releases it.
+   */
+  static thread_pool_util::ThreadPool launch_executor;
+
+  /**
+   * @brief Reads and writes the clipboard and compresses its content, off the HTTPS server thread.
+   * @details Large contents take a while to convert and compress, meanwhile the server keeps answering.
+   */
+  static thread_pool_util::ThreadPool clipboard_executor;
+
+  /**
+   * @brief Progress of the launches, reported by `launch_progress()`.
+   */
+  static struct {
+    std::mutex lock;
+    int queued = 0;  ///< Launches and resumes waiting for the executor or running on it
+    std::string client;  ///< Name of the client of the running launch, empty if none is running
+    std::string stage;  ///< What the running launch is doing
+    std::chrono::steady_clock::time_point started;  ///< When the running launch started
+  } launch_state;
+
   /**
    * @brief HTTPS server for GameStream protocol.
    * 
@@ -108,6 +143,16 @@ namespace nvhttp {
       context.set_options(boost::asio::ssl::context::no_tlsv1_1);
       context.use_certificate_chain_file(certification_file);
       context.use_private_key_file(private_key_file, boost::asio::ssl::context::pem);
+
+      // Moonlight opens a new connection for every request, resuming the session skips the key exchange.
+      // Sessions can only be resumed with client certificates once they have an id context.
+      // Resumed sessions keep the certificate of the client, which verify() still checks against the paired clients.
+      static constexpr std::string_view session_id_context = "nvhttp"sv;
+      auto ctx = context.native_handle();
+      SSL_CTX_set_session_id_context(ctx, (const unsigned char *) session_id_context.data(), session_id_context.size());
+      SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+      SSL_CTX_sess_set_cache_size(ctx, 1024);
+      SSL_CTX_set_timeout(ctx, 2 * 60 * 60);
     }
 
     /**
@@ -178,6 +223,10 @@ namespace nvhttp {
               return;
             }
             if (!ec) {
+              if (SSL_session_reused(session->connection->socket->native_handle())) {
+                resumed_handshakes.add();
+              }
+
               if (verify && !verify(session->request, session->connection->socket->native_handle())) {
                 this->write(session, on_verify_failed);
               } else {
@@ -229,6 +278,76 @@ namespace nvhttp {
    */
   std::atomic<uint32_t> session_id_counter;
 
+  /**
+   * @brief Serialized serverinfo and applist responses, so polling clients don't rebuild them.
+   * @details Responses are keyed by the client and the state that changes often, like the running app.
+   *          The state that changes rarely, like the apps, the paired clients and the config, clears the cache instead.
+   */
+  class response_cache_t {
+  public:
+    static constexpr std::size_t max_size = 256;  ///< Responses kept before starting over
+
+    /**
+     * @brief Get the current generation, to pass to insert() once the response is built.
+     * @return The generation.
+     */
+    std::uint64_t generation() const {
+      return _generation;
+    }
+
+    /**
+     * @brief Find a cached response.
+     * @param key The key of the response.
+     * @return The response, or an empty value if it isn't cached.
+     */
+    std::optional<std::string> find(const std::string &key) {
+      std::lock_guard lg {_mutex};
+
+      auto it = _responses.find(key);
+      if (it == std::end(_responses)) {
+        return std::nullopt;
+      }
+      return it->second;
+    }
+
+    /**
+     * @brief Cache a response, unless the cache was cleared while it was built.
+     * @param key The key of the response.
+     * @param response The response.
+     * @param generation The generation from before the response was built.
+     */
+    void insert(const std::string &key, const std::string &response, std::uint64_t generation) {
+      std::lock_guard lg {_mutex};
+
+      if (generation != _generation) {
+        return;
+      }
+      if (_responses.size() >= max_size) {
+        _responses.clear();
+      }
+      _responses.insert_or_assign(key, response);
+    }
+
+    /**
+     * @brief Drop all the cached responses.
+     */
+    void clear() {
+      std::lock_guard lg {_mutex};
+
+      ++_generation;
+      _responses.clear();
+    }
+
+  private:
+    std::mutex _mutex;
+    std::atomic<std::uint64_t> _generation {0};
+    std::unordered_map<std::string, std::string> _responses;
+  } response_cache;
+
+  static auto &cached_responses = metrics::counter("nvhttp_cached_responses"sv);  ///< serverinfo and applist requests answered from the cache.
+
+  asset_cache::file_cache_t app_images {64 * 1024 * 1024};  ///< Covers sent on every scroll through the app list
+
   /**
    * @brief HTTPS response type alias.
    */
@@ -305,29 +424,120 @@ namespace nvhttp {
   }
 
   /**
-   * @brief Save server state to file.
-   * 
-   * Saves client pairing information, unique ID, and configuration to JSON file.
+   * @brief Writes the state file in the background.
+   * @details Changes made within `delay` of the first one are written together, so pairing or
+   *          managing several clients doesn't rewrite the file for each of them, and requests
+   *          never wait for the disk.
    */
-  void save_state() {
-    nlohmann::json root = nlohmann::json::object();
-    // If the state file exists, try to read it.
-    if (fs::exists(config::nvhttp.file_state)) {
-      try {
-        std::ifstream in(config::nvhttp.file_state);
-        in >> root;
-      } catch (std::exception &e) {
-        BOOST_LOG(error) << "Couldn't read "sv << config::nvhttp.file_state << ": "sv << e.what();
-        return;
+  class state_writer_t {
+  public:
+    static constexpr auto delay = 1s;  ///< How long changes are collected before writing them
+
+    ~state_writer_t() {
+      stop();
+    }
+
+    /**
+     * @brief Queue the "root" node of the state file, replacing any node not written yet.
+     * @param root The node.
+     */
+    void schedule(nlohmann::json root) {
+      std::lock_guard lg {_mutex};
+
+      if (!_pending) {
+        _deadline = std::chrono::steady_clock::now() + delay;
+      }
+      _pending = std::move(root);
+
+      if (!_thread.joinable()) {
+        _thread = std::thread {&state_writer_t::run, this};
       }
+      _cv.notify_one();
     }
 
-    // Erase any previous "root" key.
-    root.erase("root");
+    /**
+     * @brief Stop the background thread and write the queued node, if any.
+     */
+    void stop() {
+      {
+        std::lock_guard lg {_mutex};
+        _stopping = true;
+        _cv.notify_one();
+      }
+      if (_thread.joinable()) {
+        _thread.join();
+      }
 
-    // Create a new "root" object and set the unique id.
-    root["root"] = nlohmann::json::object();
-    root["root"]["uniqueid"] = http::unique_id;
+      std::lock_guard lg {_mutex};
+      _stopping = false;
+      if (_pending) {
+        write(*_pending);
+        _pending.reset();
+      }
+    }
+
+  private:
+    void run() {
+      std::unique_lock ul {_mutex};
+      while (!_stopping) {
+        if (!_pending) {
+          _cv.wait(ul);
+          continue;
+        }
+        if (std::chrono::steady_clock::now() < _deadline) {
+          _cv.wait_until(ul, _deadline);
+          continue;
+        }
+
+        auto root = std::move(*_pending);
+        _pending.reset();
+
+        ul.unlock();
+        write(root);
+        ul.lock();
+      }
+    }
+
+    /**
+     * @brief Replace the "root" node of the state file, keeping the credentials stored next to it.
+     * @param root The node.
+     */
+    static void write(const nlohmann::json &root) {
+      nlohmann::json tree = nlohmann::json::object();
+      if (fs::exists(config::nvhttp.file_state)) {
+        try {
+          std::ifstream in(config::nvhttp.file_state);
+          in >> tree;
+        } catch (std::exception &e) {
+          BOOST_LOG(error) << "Couldn't read "sv << config::nvhttp.file_state << ": "sv << e.what();
+          return;
+        }
+      }
+
+      tree["root"] = root;
+      if (file_handler::replace_file(config::nvhttp.file_state.c_str(), tree.dump(4))) {  // Pretty-print with an indent of 4 spaces.
+        BOOST_LOG(error) << "Couldn't write "sv << config::nvhttp.file_state;
+      }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::optional<nlohmann::json> _pending;
+    std::chrono::steady_clock::time_point _deadline;
+    bool _stopping = false;
+    std::thread _thread;
+  } state_writer;
+
+  /**
+   * @brief Build the "root" node of the state file from the paired clients.
+   *
+   * Duplicate client names get a " (2)", " (3)", ... suffix.
+   *
+   * @return The node.
+   */
+  nlohmann::json state_root() {
+    nlohmann::json root = nlohmann::json::object();
+    root["uniqueid"] = http::unique_id;
 
     client_t &client = client_root;
     nlohmann::json named_cert_nodes = nlohmann::json::array();
@@ -381,51 +591,15 @@ namespace nvhttp {
       }
     }
 
-    root["root"]["named_devices"] = named_cert_nodes;
-
-    try {
-      std::ofstream out(config::nvhttp.file_state);
-      out << root.dump(4);  // Pretty-print with an indent of 4 spaces.
-    } catch (std::exception &e) {
-      BOOST_LOG(error) << "Couldn't write "sv << config::nvhttp.file_state << ": "sv << e.what();
-      return;
-    }
+    root["named_devices"] = named_cert_nodes;
+    return root;
   }
 
   /**
-   * @brief Load server state from file.
-   * 
-   * Loads client pairing information, unique ID, and configuration from JSON file.
-   * Generates new unique ID if file doesn't exist or is invalid.
+   * @brief Replace the paired clients with the ones of a "root" node of the state file.
+   * @param root The node.
    */
-  void load_state() {
-    if (!fs::exists(config::nvhttp.file_state)) {
-      BOOST_LOG(info) << "File "sv << config::nvhttp.file_state << " doesn't exist"sv;
-      http::unique_id = uuid_util::uuid_t::generate().string();
-      return;
-    }
-
-    nlohmann::json tree;
-    try {
-      std::ifstream in(config::nvhttp.file_state);
-      in >> tree;
-    } catch (std::exception &e) {
-      BOOST_LOG(error) << "Couldn't read "sv << config::nvhttp.file_state << ": "sv << e.what();
-      return;
-    }
-
-    // Check that the file contains a "root.uniqueid" value.
-    if (!tree.contains("root") || !tree["root"].contains("uniqueid")) {
-      http::uuid = uuid_util::uuid_t::generate();
-      http::unique_id = http::uuid.string();
-      return;
-    }
-
-    std::string uid = tree["root"]["uniqueid"];
-    http::uuid = uuid_util::uuid_t::parse(uid);
-    http::unique_id = uid;
-
-    nlohmann::json root = tree["root"];
+  void load_clients(const nlohmann::json &root) {
     client_t client;  // Local client to load into
 
     // Import from the old format if available.
@@ -477,6 +651,62 @@ namespace nvhttp {
     client_root = client;
   }
 
+  /**
+   * @brief Save server state to file.
+   * 
+   * Saves client pairing information, unique ID, and configuration to JSON file.
+   * The file is written in the background, the clients in memory are what requests see.
+   *
+   * @param reload Whether to also load the saved clients back, which renames duplicate names and rebuilds the certificate chain.
+   */
+  void save_state(bool reload = false) {
+    invalidate_cached_responses();
+
+    auto root = state_root();
+    if (reload) {
+      load_clients(root);
+    }
+    state_writer.schedule(std::move(root));
+  }
+
+  /**
+   * @brief Load server state from file.
+   * 
+   * Loads client pairing information, unique ID, and configuration from JSON file.
+   * Generates new unique ID if file doesn't exist or is invalid.
+   */
+  void load_state() {
+    invalidate_cached_responses();
+
+    if (!fs::exists(config::nvhttp.file_state)) {
+      BOOST_LOG(info) << "File "sv << config::nvhttp.file_state << " doesn't exist"sv;
+      http::unique_id = uuid_util::uuid_t::generate().string();
+      return;
+    }
+
+    nlohmann::json tree;
+    try {
+      std::ifstream in(config::nvhttp.file_state);
+      in >> tree;
+    } catch (std::exception &e) {
+      BOOST_LOG(error) << "Couldn't read "sv << config::nvhttp.file_state << ": "sv << e.what();
+      return;
+    }
+
+    // Check that the file contains a "root.uniqueid" value.
+    if (!tree.contains("root") || !tree["root"].contains("uniqueid")) {
+      http::uuid = uuid_util::uuid_t::generate();
+      http::unique_id = http::uuid.string();
+      return;
+    }
+
+    std::string uid = tree["root"]["uniqueid"];
+    http::uuid = uuid_util::uuid_t::parse(uid);
+    http::unique_id = uid;
+
+    load_clients(tree["root"]);
+  }
+
   /**
    * @brief Add an authorized client to the pairing list.
    * 
@@ -491,8 +721,7 @@ namespace nvhttp {
 #endif
 
     if (!config::sunshine.flags[config::flag::FRESH_STATE]) {
-      save_state();
-      load_state();
+      save_state(true);
     }
   }
 
@@ -611,18 +840,18 @@ namespace nvhttp {
    * Sets pairing status to failed in the response tree.
    * 
    * @param sess Pairing session.
-   * @param tree Response property tree.
+   * @param tree Response document.
    * @param status_msg Status message to include.
    */
-  void fail_pair(pair_session_t &sess, pt::ptree &tree, const std::string status_msg) {
-    tree.put("root.paired", 0);
-    tree.put("root.<xmlattr>.status_code", 400);
-    tree.put("root.<xmlattr>.status_message", status_msg);
+  void fail_pair(pair_session_t &sess, xml::response_t &tree, const std::string status_msg) {
+    tree.put("paired", 0);
+    tree.attribute("status_code", 400);
+    tree.attribute("status_message", status_msg);
     remove_session(sess);  // Security measure, delete the session when something went wrong and force a re-pair
     BOOST_LOG(warning) << "Pair attempt failed due to " << status_msg;
   }
 
-  void getservercert(pair_session_t &sess, pt::ptree &tree, const std::string &pin) {
+  void getservercert(pair_session_t &sess, xml::response_t &tree, const std::string &pin) {
     if (sess.last_phase != PAIR_PHASE::NONE) {
       fail_pair(sess, tree, "Out of order call to getservercert");
       return;
@@ -641,12 +870,12 @@ namespace nvhttp {
     auto key = crypto::gen_aes_key(salt, pin);
     sess.cipher_key = std::make_unique<crypto::aes_t>(key);
 
-    tree.put("root.paired", 1);
-    tree.put("root.plaincert", util::hex_vec(conf_intern.servercert, true));
-    tree.put("root.<xmlattr>.status_code", 200);
+    tree.put("paired", 1);
+    tree.put("plaincert", util::hex_vec(conf_intern.servercert, true));
+    tree.attribute("status_code", 200);
   }
 
-  void clientchallenge(pair_session_t &sess, pt::ptree &tree, const std::string &challenge) {
+  void clientchallenge(pair_session_t &sess, xml::response_t &tree, const std::string &challenge) {
     if (sess.last_phase != PAIR_PHASE::GETSERVERCERT) {
       fail_pair(sess, tree, "Out of order call to clientchallenge");
       return;
@@ -684,12 +913,12 @@ namespace nvhttp {
     sess.serversecret = std::move(serversecret);
     sess.serverchallenge = std::move(serverchallenge);
 
-    tree.put("root.paired", 1);
-    tree.put("root.challengeresponse", util::hex_vec(encrypted, true));
-    tree.put("root.<xmlattr>.status_code", 200);
+    tree.put("paired", 1);
+    tree.put("challengeresponse", util::hex_vec(encrypted, true));
+    tree.attribute("status_code", 200);
   }
 
-  void serverchallengeresp(pair_session_t &sess, pt::ptree &tree, const std::string &encrypted_response) {
+  void serverchallengeresp(pair_session_t &sess, xml::response_t &tree, const std::string &encrypted_response) {
     if (sess.last_phase != PAIR_PHASE::CLIENTCHALLENGE) {
       fail_pair(sess, tree, "Out of order call to serverchallengeresp");
       return;
@@ -713,12 +942,12 @@ namespace nvhttp {
 
     serversecret.insert(std::end(serversecret), std::begin(sign), std::end(sign));
 
-    tree.put("root.pairingsecret", util::hex_vec(serversecret, true));
-    tree.put("root.paired", 1);
-    tree.put("root.<xmlattr>.status_code", 200);
+    tree.put("pairingsecret", util::hex_vec(serversecret, true));
+    tree.put("paired", 1);
+    tree.attribute("status_code", 200);
   }
 
-  void clientpairingsecret(pair_session_t &sess, pt::ptree &tree, const std::string &client_pairing_secret) {
+  void clientpairingsecret(pair_session_t &sess, xml::response_t &tree, const std::string &client_pairing_secret) {
     if (sess.last_phase != PAIR_PHASE::SERVERCHALLENGERESP) {
       fail_pair(sess, tree, "Out of order call to clientpairingsecret");
       return;
@@ -755,7 +984,7 @@ namespace nvhttp {
     bool same_hash = hash.size() == sess.clienthash.size() && std::equal(hash.begin(), hash.end(), sess.clienthash.begin());
     auto verify = crypto::verify256(crypto::x509(client.cert), secret, sign);
     if (same_hash && verify) {
-      tree.put("root.paired", 1);
+      tree.put("paired", 1);
 
       auto named_cert_p = std::make_shared<crypto::named_cert_t>();
       named_cert_p->name = client.name;
@@ -781,12 +1010,12 @@ namespace nvhttp {
 
       add_authorized_client(named_cert_p);
     } else {
-      tree.put("root.paired", 0);
+      tree.put("paired", 0);
       BOOST_LOG(warning) << "Pair attempt failed due to same_hash: " << same_hash << ", verify: " << verify;
     }
 
     remove_session(sess);
-    tree.put("root.<xmlattr>.status_code", 200);
+    tree.attribute("status_code", 200);
   }
 
   /**
@@ -844,13 +1073,10 @@ namespace nvhttp {
   void not_found(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Response> response, std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request) {
     print_req<T>(request);
 
-    pt::ptree tree;
-    tree.put("root.<xmlattr>.status_code", 404);
-
-    std::ostringstream data;
+    xml::response_t tree;
+    tree.attribute("status_code", 404);
 
-    pt::write_xml(data, tree);
-    response->write(SimpleWeb::StatusCode::client_error_not_found, data.str());
+    response->write(SimpleWeb::StatusCode::client_error_not_found, tree.str());
     response->close_connection_after_response = true;
   }
 
@@ -858,27 +1084,24 @@ namespace nvhttp {
   void pair(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Response> response, std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request) {
     print_req<T>(request);
 
-    pt::ptree tree;
+    xml::response_t tree;
 
     auto fg = util::fail_guard([&]() {
-      std::ostringstream data;
-
-      pt::write_xml(data, tree);
-      response->write(data.str());
+      response->write(tree.str());
       response->close_connection_after_response = true;
     });
 
     if (!config::sunshine.enable_pairing) {
-      tree.put("root.<xmlattr>.status_code", 403);
-      tree.put("root.<xmlattr>.status_message", "Pairing is disabled for this instance");
+      tree.attribute("status_code", 403);
+      tree.attribute("status_message", "Pairing is disabled for this instance");
 
       return;
     }
 
     auto args = request->parse_query_string();
     if (args.find("uniqueid"s) == std::end(args)) {
-      tree.put("root.<xmlattr>.status_code", 400);
-      tree.put("root.<xmlattr>.status_message", "Missing uniqueid parameter");
+      tree.attribute("status_code", 400);
+      tree.attribute("status_message", "Missing uniqueid parameter");
 
       return;
     }
@@ -911,8 +1134,8 @@ namespace nvhttp {
             one_time_pin.clear();
             otp_passphrase.clear();
             otp_device_name.clear();
-            tree.put("root.<xmlattr>.status_code", 503);
-            tree.put("root.<xmlattr>.status_message", "OTP auth not available.");
+            tree.attribute("status_code", 503);
+            tree.attribute("status_message", "OTP auth not available.");
           } else {
             auto hash = util::hex(crypto::hash(one_time_pin + ptr->second.async_insert_pin.salt + otp_passphrase), true);
 
@@ -953,16 +1176,16 @@ namespace nvhttp {
           return;
         }
       } else if (it->second == "pairchallenge"sv) {
-        tree.put("root.paired", 1);
-        tree.put("root.<xmlattr>.status_code", 200);
+        tree.put("paired", 1);
+        tree.attribute("status_code", 200);
         return;
       }
     }
 
     auto sess_it = map_id_sess.find(uniqID);
     if (sess_it == std::end(map_id_sess)) {
-      tree.put("root.<xmlattr>.status_code", 400);
-      tree.put("root.<xmlattr>.status_message", "Invalid uniqueid");
+      tree.attribute("status_code", 400);
+      tree.attribute("status_message", "Invalid uniqueid");
 
       return;
     }
@@ -977,23 +1200,22 @@ namespace nvhttp {
       auto pairingsecret = util::from_hex_vec(it->second, true);
       clientpairingsecret(sess_it->second, tree, pairingsecret);
     } else {
-      tree.put("root.<xmlattr>.status_code", 404);
-      tree.put("root.<xmlattr>.status_message", "Invalid pairing request");
+      tree.attribute("status_code", 404);
+      tree.attribute("status_message", "Invalid pairing request");
     }
   }
 
   bool pin(std::string pin, std::string name) {
-    pt::ptree tree;
+    xml::response_t tree;
     if (map_id_sess.empty()) {
       return false;
     }
 
     // ensure pin is 4 digits
     if (pin.size() != 4) {
-      tree.put("root.paired", 0);
-      tree.put("root.<xmlattr>.status_code", 400);
-      tree.put(
-        "root.<xmlattr>.status_message",
+      tree.put("paired", 0);
+      tree.attribute("status_code", 400);
+      tree.attribute("status_message",
         std::format("Pin must be 4 digits, {} provided", pin.size())
       );
       return false;
@@ -1001,9 +1223,9 @@ namespace nvhttp {
 
     // ensure all pin characters are numeric
     if (!std::all_of(pin.begin(), pin.end(), ::isdigit)) {
-      tree.put("root.paired", 0);
-      tree.put("root.<xmlattr>.status_code", 400);
-      tree.put("root.<xmlattr>.status_message", "Pin must be numeric");
+      tree.put("paired", 0);
+      tree.attribute("status_code", 400);
+      tree.attribute("status_message", "Pin must be numeric");
       return false;
     }
 
@@ -1015,14 +1237,11 @@ namespace nvhttp {
     }
 
     // response to the request for pin
-    std::ostringstream data;
-    pt::write_xml(data, tree);
-
     auto &async_response = sess.async_insert_pin.response;
     if (async_response.has_left() && async_response.left()) {
-      async_response.left()->write(data.str());
+      async_response.left()->write(tree.str());
     } else if (async_response.has_right() && async_response.right()) {
-      async_response.right()->write(data.str());
+      async_response.right()->write(tree.str());
     } else {
       return false;
     }
@@ -1033,6 +1252,43 @@ namespace nvhttp {
     return true;
   }
 
+  /**
+   * @brief Get the codecs supported by the encoder, as reported in `ServerCodecModeSupport`.
+   * @return The `SCM_*` flags.
+   */
+  uint32_t server_codec_mode_support() {
+    uint32_t codec_mode_flags = SCM_H264;
+    if (video::last_encoder_probe_supported_yuv444_for_codec[0]) {
+      codec_mode_flags |= SCM_H264_HIGH8_444;
+    }
+    if (video::active_hevc_mode >= 2) {
+      codec_mode_flags |= SCM_HEVC;
+      if (video::last_encoder_probe_supported_yuv444_for_codec[1]) {
+        codec_mode_flags |= SCM_HEVC_REXT8_444;
+      }
+    }
+    if (video::active_hevc_mode >= 3) {
+      codec_mode_flags |= SCM_HEVC_MAIN10;
+      if (video::last_encoder_probe_supported_yuv444_for_codec[1]) {
+        codec_mode_flags |= SCM_HEVC_REXT10_444;
+      }
+    }
+    if (video::active_av1_mode >= 2) {
+      codec_mode_flags |= SCM_AV1_MAIN8;
+      if (video::last_encoder_probe_supported_yuv444_for_codec[2]) {
+        codec_mode_flags |= SCM_AV1_HIGH8_444;
+      }
+    }
+    if (video::active_av1_mode >= 3) {
+      codec_mode_flags |= SCM_AV1_MAIN10;
+      if (video::last_encoder_probe_supported_yuv444_for_codec[2]) {
+        codec_mode_flags |= SCM_AV1_HIGH10_444;
+      }
+    }
+
+    return codec_mode_flags;
+  }
+
   template<class T>
   void serverinfo(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Response> response, std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request) {
     print_req<T>(request);
@@ -1048,53 +1304,71 @@ namespace nvhttp {
     }
 
     auto local_endpoint = request->local_endpoint();
+    auto local_address = net::addr_to_normalized_string(local_endpoint.address());
+    auto codec_mode_flags = server_codec_mode_support();
 
-    pt::ptree tree;
+    // Read once, so the cached response matches its key
+    int running_appid = 0;
+    std::string running_app_uuid;
+    std::string cache_key {tunnel<T>::to_string};
+    if constexpr (std::is_same_v<SunshineHTTPS, T>) {
+      running_appid = proc::proc.running();
+      running_app_uuid = proc::proc.get_running_app_uuid();
+      cache_key += '/' + get_verified_cert(request)->uuid;
+    }
+    cache_key += '/' + local_address + '/' + std::to_string(pair_status) + '/' + std::to_string(running_appid) + '/' + running_app_uuid + '/' + std::to_string(codec_mode_flags);
+  #ifdef _WIN32
+    cache_key += '/' + std::to_string((int) proc::vDisplayDriverStatus);
+  #endif
+
+    if (auto cached = response_cache.find(cache_key)) {
+      cached_responses.add();
+      response->write(*cached);
+      response->close_connection_after_response = true;
+      return;
+    }
+    auto generation = response_cache.generation();
 
-    tree.put("root.<xmlattr>.status_code", 200);
-    tree.put("root.hostname", config::nvhttp.sunshine_name);
+    xml::response_t tree;
 
-    tree.put("root.appversion", VERSION);
-    tree.put("root.GfeVersion", GFE_VERSION);
-    tree.put("root.uniqueid", http::unique_id);
-    tree.put("root.HttpsPort", net::map_port(PORT_HTTPS));
-    tree.put("root.ExternalPort", net::map_port(PORT_HTTP));
-    tree.put("root.MaxLumaPixelsHEVC", video::active_hevc_mode > 1 ? "1869449984" : "0");
+    tree.attribute("status_code", 200);
+    tree.put("hostname", config::nvhttp.sunshine_name);
+
+    tree.put("appversion", VERSION);
+    tree.put("GfeVersion", GFE_VERSION);
+    tree.put("uniqueid", http::unique_id);
+    tree.put("HttpsPort", net::map_port(PORT_HTTPS));
+    tree.put("ExternalPort", net::map_port(PORT_HTTP));
+    tree.put("MaxLumaPixelsHEVC", video::active_hevc_mode > 1 ? "1869449984" : "0");
 
     // Only include the MAC address for requests sent from paired clients over HTTPS.
     // For HTTP requests, use a placeholder MAC address that Moonlight knows to ignore.
     if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      tree.put("root.mac", platf::get_mac_address(net::addr_to_normalized_string(local_endpoint.address())));
+      tree.put("mac", platf::get_mac_address(local_address));
 
       auto named_cert_p = get_verified_cert(request);
       if (!!(named_cert_p->perm & PERM::server_cmd)) {
-        pt::ptree& root_node = tree.get_child("root");
-
-        if (config::sunshine.server_cmds.size() > 0) {
-          // Broadcast server_cmds
-          for (const auto& cmd : config::sunshine.server_cmds) {
-            pt::ptree cmd_node;
-            cmd_node.put_value(cmd.cmd_name);
-            root_node.push_back(std::make_pair("ServerCommand", cmd_node));
-          }
+        // Broadcast server_cmds
+        for (const auto& cmd : config::sunshine.server_cmds) {
+          tree.add("ServerCommand", cmd.cmd_name);
         }
       } else {
         BOOST_LOG(debug) << "Permission Get ServerCommand denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
       }
 
-      tree.put("root.Permission", std::to_string((uint32_t)named_cert_p->perm));
+      tree.put("Permission", std::to_string((uint32_t)named_cert_p->perm));
 
     #ifdef _WIN32
-      tree.put("root.VirtualDisplayCapable", true);
+      tree.put("VirtualDisplayCapable", true);
       if (!!(named_cert_p->perm & PERM::_all_actions)) {
-        tree.put("root.VirtualDisplayDriverReady", proc::vDisplayDriverStatus == VDISPLAY::DRIVER_STATUS::OK);
+        tree.put("VirtualDisplayDriverReady", proc::vDisplayDriverStatus == VDISPLAY::DRIVER_STATUS::OK);
       } else {
-        tree.put("root.VirtualDisplayDriverReady", true);
+        tree.put("VirtualDisplayDriverReady", true);
       }
     #endif
     } else {
-      tree.put("root.mac", "00:00:00:00:00:00");
-      tree.put("root.Permission", "0");
+      tree.put("mac", "00:00:00:00:00:00");
+      tree.put("Permission", "0");
     }
 
     // Moonlight clients track LAN IPv6 addresses separately from LocalIP which is expected to
@@ -1107,62 +1381,33 @@ namespace nvhttp {
     // which returns 127.0.0.1 as LocalIP for IPv6 connections. Moonlight clients with IPv6
     // support know to ignore this bogus address.
     if (local_endpoint.address().is_v6() && !local_endpoint.address().to_v6().is_v4_mapped()) {
-      tree.put("root.LocalIP", "127.0.0.1");
+      tree.put("LocalIP", "127.0.0.1");
     } else {
-      tree.put("root.LocalIP", net::addr_to_normalized_string(local_endpoint.address()));
+      tree.put("LocalIP", local_address);
     }
 
-    uint32_t codec_mode_flags = SCM_H264;
-    if (video::last_encoder_probe_supported_yuv444_for_codec[0]) {
-      codec_mode_flags |= SCM_H264_HIGH8_444;
-    }
-    if (video::active_hevc_mode >= 2) {
-      codec_mode_flags |= SCM_HEVC;
-      if (video::last_encoder_probe_supported_yuv444_for_codec[1]) {
-        codec_mode_flags |= SCM_HEVC_REXT8_444;
-      }
-    }
-    if (video::active_hevc_mode >= 3) {
-      codec_mode_flags |= SCM_HEVC_MAIN10;
-      if (video::last_encoder_probe_supported_yuv444_for_codec[1]) {
-        codec_mode_flags |= SCM_HEVC_REXT10_444;
-      }
-    }
-    if (video::active_av1_mode >= 2) {
-      codec_mode_flags |= SCM_AV1_MAIN8;
-      if (video::last_encoder_probe_supported_yuv444_for_codec[2]) {
-        codec_mode_flags |= SCM_AV1_HIGH8_444;
-      }
-    }
-    if (video::active_av1_mode >= 3) {
-      codec_mode_flags |= SCM_AV1_MAIN10;
-      if (video::last_encoder_probe_supported_yuv444_for_codec[2]) {
-        codec_mode_flags |= SCM_AV1_HIGH10_444;
-      }
-    }
-    tree.put("root.ServerCodecModeSupport", codec_mode_flags);
+    tree.put("ServerCodecModeSupport", codec_mode_flags);
 
-    tree.put("root.PairStatus", pair_status);
+    tree.put("PairStatus", pair_status);
 
     if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      int current_appid = proc::proc.running();
+      int current_appid = running_appid;
       // When input only mode is enabled, the only resume method should be launching the same app again.
       if (config::input.enable_input_only_mode && current_appid != proc::input_only_app_id) {
         current_appid = 0;
       }
-      tree.put("root.currentgame", current_appid);
-      tree.put("root.currentgameuuid", proc::proc.get_running_app_uuid());
-      tree.put("root.state", current_appid > 0 ? "SUNSHINE_SERVER_BUSY" : "SUNSHINE_SERVER_FREE");
+      tree.put("currentgame", current_appid);
+      tree.put("currentgameuuid", running_app_uuid);
+      tree.put("state", current_appid > 0 ? "SUNSHINE_SERVER_BUSY" : "SUNSHINE_SERVER_FREE");
     } else {
-      tree.put("root.currentgame", 0);
-      tree.put("root.currentgameuuid", "");
-      tree.put("root.state", "SUNSHINE_SERVER_FREE");
+      tree.put("currentgame", 0);
+      tree.put("currentgameuuid", "");
+      tree.put("state", "SUNSHINE_SERVER_FREE");
     }
 
-    std::ostringstream data;
-
-    pt::write_xml(data, tree);
-    response->write(data.str());
+    auto data = tree.str();
+    response_cache.insert(cache_key, std::string {data}, generation);
+    response->write(data);
     response->close_connection_after_response = true;
   }
 
@@ -1223,23 +1468,31 @@ namespace nvhttp {
   void applist(resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
-    pt::ptree tree;
+    auto named_cert_p = get_verified_cert(request);
 
-    auto g = util::fail_guard([&]() {
-      std::ostringstream data;
+    // Read once, so the cached response matches its key
+    auto current_appid = proc::proc.running();
+    auto cache_key = "applist/" + named_cert_p->uuid + '/' + std::to_string(current_appid) + '/' + std::to_string(video::active_hevc_mode);
+    if (auto cached = response_cache.find(cache_key)) {
+      cached_responses.add();
+      response->write(*cached);
+      response->close_connection_after_response = true;
+      return;
+    }
+    auto generation = response_cache.generation();
 
-      pt::write_xml(data, tree);
-      response->write(data.str());
+    xml::response_t tree;
+
+    auto g = util::fail_guard([&]() {
+      auto data = tree.str();
+      response_cache.insert(cache_key, std::string {data}, generation);
+      response->write(data);
       response->close_connection_after_response = true;
     });
 
-    auto &apps = tree.add_child("root", pt::ptree {});
+    tree.attribute("status_code", 200);
 
-    apps.put("<xmlattr>.status_code", 200);
-
-    auto named_cert_p = get_verified_cert(request);
     if (!!(named_cert_p->perm & PERM::_all_actions)) {
-      auto current_appid = proc::proc.running();
       auto should_hide_inactive_apps = config::input.enable_input_only_mode && current_appid > 0 && current_appid != proc::input_only_app_id;
 
       auto app_list = proc::proc.get_apps();
@@ -1274,43 +1527,141 @@ namespace nvhttp {
           app_name = app.name;
         }
 
-        pt::ptree app_node;
+        xml::element_t app_node;
 
-        app_node.put("IsHdrSupported"s, video::active_hevc_mode == 3 ? 1 : 0);
-        app_node.put("AppTitle"s, app_name);
-        app_node.put("UUID", app.uuid);
-        app_node.put("IDX", app.idx);
-        app_node.put("ID", app.id);
+        app_node.add("IsHdrSupported", video::active_hevc_mode == 3 ? 1 : 0);
+        app_node.add("AppTitle", app_name);
+        app_node.add("UUID", app.uuid);
+        app_node.add("IDX", app.idx);
+        app_node.add("ID", app.id);
 
-        apps.push_back(std::make_pair("App", std::move(app_node)));
+        tree.add("App", app_node);
       }
     } else {
       BOOST_LOG(debug) << "Permission ListApp denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
 
-      pt::ptree app_node;
+      xml::element_t app_node;
+
+      app_node.add("IsHdrSupported", 0);
+      app_node.add("AppTitle", "Permission Denied");
+      app_node.add("UUID", "");
+      app_node.add("IDX", "0");
+      app_node.add("ID", "114514");
+
+      tree.add("App", app_node);
+
+      return;
+    }
 
-      app_node.put("IsHdrSupported"s, 0);
-      app_node.put("AppTitle"s, "Permission Denied");
-      app_node.put("UUID", "");
-      app_node.put("IDX", "0");
-      app_node.put("ID", "114514");
+  }
 
-      apps.push_back(std::make_pair("App", std::move(app_node)));
+  /**
+   * @brief Start the capture and the audio for a launched session while the client sets up the stream.
+   * @param launch_session The session the client is about to set up.
+   */
+  void prewarm_stream(const rtsp_stream::launch_session_t &launch_session) {
+    // Cover the time between the launch and the client's ANNOUNCE
+    constexpr auto prewarm_duration = 20s;
 
+    if (!config::video.stream_prewarm || launch_session.input_only) {
       return;
     }
 
+    // Mirror what the ANNOUNCE will most likely ask for, a mismatch just starts a new capture
+    video::config_t config {};
+    config.width = launch_session.width;
+    config.height = launch_session.height;
+    config.framerate = static_cast<int>(std::round(launch_session.fps / 1000.0));
+    config.encodingFramerate = config::video.limit_framerate ? launch_session.fps : config.framerate * 1000;
+    config.dynamicRange = launch_session.enable_hdr ? 1 : 0;
+
+    video::prewarm_capture(config);
+    if (config::audio.stream) {
+      audio::prewarm(prewarm_duration);
+    }
+  }
+
+  /**
+   * @brief Check that the encoder has capacity left for a launched session.
+   * @param launch_session The session the client is about to set up.
+   * @return Why the session is rejected, or `std::nullopt` if it's admitted.
+   */
+  std::optional<std::string> admission_rejection(const rtsp_stream::launch_session_t &launch_session) {
+    if (launch_session.input_only) {
+      return std::nullopt;
+    }
+
+    // A downgrade is only applied once the client sets up the stream
+    auto decision = admission::controller().evaluate({
+      launch_session.width,
+      launch_session.height,
+      static_cast<int>(std::round(launch_session.fps / 1000.0)),
+    });
+    if (decision.verdict == admission::verdict_e::reject) {
+      return std::move(decision.reason);
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Report what the running launch is doing.
+   * @param stage The stage.
+   */
+  void launch_stage(std::string_view stage) {
+    std::lock_guard lg {launch_state.lock};
+    launch_state.stage = stage;
+  }
+
+  /**
+   * @brief Run a launch or a resume on the launch executor.
+   * @param response The response, sent once the handler is done with it.
+   * @param request The request.
+   * @param handler The handler, called with the response and the request.
+   */
+  template<class F>
+  void run_launch(resp_https_t response, req_https_t request, F &&handler) {
+    {
+      std::lock_guard lg {launch_state.lock};
+      ++launch_state.queued;
+    }
+
+    launch_executor.push([response = std::move(response), request = std::move(request), handler = std::forward<F>(handler)]() mutable {
+      {
+        std::lock_guard lg {launch_state.lock};
+        launch_state.client = get_verified_cert(request)->name;
+        launch_state.stage = "Starting"sv;
+        launch_state.started = std::chrono::steady_clock::now();
+      }
+
+      handler(std::move(response), std::move(request));
+
+      std::lock_guard lg {launch_state.lock};
+      --launch_state.queued;
+      launch_state.client.clear();
+      launch_state.stage.clear();
+    });
+  }
+
+  nlohmann::json launch_progress() {
+    std::lock_guard lg {launch_state.lock};
+
+    nlohmann::json progress;
+    progress["queued"] = launch_state.queued;
+    progress["running"] = !launch_state.client.empty();
+    if (!launch_state.client.empty()) {
+      progress["client"] = launch_state.client;
+      progress["stage"] = launch_state.stage;
+      progress["elapsed_ms"] = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - launch_state.started).count();
+    }
+    return progress;
   }
 
   void launch(bool &host_audio, resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
-    pt::ptree tree;
+    xml::response_t tree;
     auto g = util::fail_guard([&]() {
-      std::ostringstream data;
-
-      pt::write_xml(data, tree);
-      response->write(data.str());
+      response->write(tree.str());
       response->close_connection_after_response = true;
     });
 
@@ -1341,9 +1692,9 @@ namespace nvhttp {
     if (!(named_cert_p->perm & perm)) {
       BOOST_LOG(debug) << "Permission LaunchApp denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
 
-      tree.put("root.resume", 0);
-      tree.put("root.<xmlattr>.status_code", 403);
-      tree.put("root.<xmlattr>.status_message", "Permission denied");
+      tree.put("resume", 0);
+      tree.attribute("status_code", 403);
+      tree.attribute("status_message", "Permission denied");
 
       return;
     }
@@ -1353,9 +1704,9 @@ namespace nvhttp {
       args.find("localAudioPlayMode"s) == std::end(args) ||
       (args.find("appid"s) == std::end(args) && args.find("appuuid"s) == std::end(args))
     ) {
-      tree.put("root.resume", 0);
-      tree.put("root.<xmlattr>.status_code", 400);
-      tree.put("root.<xmlattr>.status_message", "Missing a required launch parameter");
+      tree.put("resume", 0);
+      tree.attribute("status_code", 400);
+      tree.attribute("status_message", "Missing a required launch parameter");
 
       return;
     }
@@ -1368,9 +1719,9 @@ namespace nvhttp {
       ) {
         proc::proc.terminate();
 
-        tree.put("root.resume", 0);
-        tree.put("root.<xmlattr>.status_code", 410);
-        tree.put("root.<xmlattr>.status_message", "App terminated.");
+        tree.put("resume", 0);
+        tree.attribute("status_code", 410);
+        tree.attribute("status_message", "App terminated.");
 
         return;
       }
@@ -1383,9 +1734,9 @@ namespace nvhttp {
           || (!appuuid_str.empty() && appuuid_str != current_app_uuid)
         )
       ) {
-        tree.put("root.resume", 0);
-        tree.put("root.<xmlattr>.status_code", 400);
-        tree.put("root.<xmlattr>.status_message", "An app is already running on this host");
+        tree.put("resume", 0);
+        tree.attribute("status_code", 400);
+        tree.attribute("status_message", "An app is already running on this host");
 
         return;
       }
@@ -1398,9 +1749,17 @@ namespace nvhttp {
     if (!launch_session->rtsp_cipher && encryption_mode == config::ENCRYPTION_MODE_MANDATORY) {
       BOOST_LOG(error) << "Rejecting client that cannot comply with mandatory encryption requirement"sv;
 
-      tree.put("root.<xmlattr>.status_code", 403);
-      tree.put("root.<xmlattr>.status_message", "Encryption is mandatory for this host but unsupported by the client");
-      tree.put("root.gamesession", 0);
+      tree.attribute("status_code", 403);
+      tree.attribute("status_message", "Encryption is mandatory for this host but unsupported by the client");
+      tree.put("gamesession", 0);
+
+      return;
+    }
+
+    if (auto reason = admission_rejection(*launch_session)) {
+      tree.attribute("status_code", 503);
+      tree.attribute("status_message", *reason);
+      tree.put("gamesession", 0);
 
       return;
     }
@@ -1437,11 +1796,13 @@ namespace nvhttp {
         }
 
         if (no_active_sessions && !proc::proc.virtual_display) {
+          launch_stage("Configuring the display"sv);
           display_device::configure_display(config::video, *launch_session);
+          launch_stage("Probing the encoders"sv);
           if (video::probe_encoders()) {
-            tree.put("root.resume", 0);
-            tree.put("root.<xmlattr>.status_code", 503);
-            tree.put("root.<xmlattr>.status_message", "Failed to initialize video capture/encoding. Is a display connected and turned on?");
+            tree.put("resume", 0);
+            tree.attribute("status_code", 503);
+            tree.attribute("status_message", "Failed to initialize video capture/encoding. Is a display connected and turned on?");
 
             return;
           }
@@ -1454,9 +1815,9 @@ namespace nvhttp {
 
         if (app_iter == apps.end()) {
           BOOST_LOG(error) << "Couldn't find app with ID ["sv << appid_str << "] or UUID ["sv << appuuid_str << ']';
-          tree.put("root.<xmlattr>.status_code", 404);
-          tree.put("root.<xmlattr>.status_message", "Cannot find requested application");
-          tree.put("root.gamesession", 0);
+          tree.attribute("status_code", 404);
+          tree.attribute("status_message", "Cannot find requested application");
+          tree.put("gamesession", 0);
           return;
         }
 
@@ -1465,28 +1826,28 @@ namespace nvhttp {
           launch_session->client_undo_cmds.clear();
         }
 
+        launch_stage("Starting the app"sv);
         auto err = proc::proc.execute(*app_iter, launch_session);
         if (err) {
-          tree.put("root.<xmlattr>.status_code", err);
-          tree.put(
-            "root.<xmlattr>.status_message",
+          tree.attribute("status_code", err);
+          tree.attribute("status_message",
             err == 503
             ? "Failed to initialize video capture/encoding. Is a display connected and turned on?"
             : "Failed to start the specified application");
-          tree.put("root.gamesession", 0);
+          tree.put("gamesession", 0);
 
           return;
         }
       }
     } else {
-      tree.put("root.<xmlattr>.status_code", 403);
-      tree.put("root.<xmlattr>.status_message", "How did you get here?");
-      tree.put("root.gamesession", 0);
+      tree.attribute("status_code", 403);
+      tree.attribute("status_message", "How did you get here?");
+      tree.put("gamesession", 0);
     }
 
-    tree.put("root.<xmlattr>.status_code", 200);
+    tree.attribute("status_code", 200);
     tree.put(
-      "root.sessionUrl0",
+      "sessionUrl0",
       std::format(
         "{}{}:{}",
         launch_session->rtsp_url_scheme,
@@ -1494,20 +1855,22 @@ namespace nvhttp {
         static_cast<int>(net::map_port(rtsp_stream::RTSP_SETUP_PORT))
       )
     );
-    tree.put("root.gamesession", 1);
+    tree.put("gamesession", 1);
 
+    launch_session->encoder_profile = proc::proc.encoder_profile;
+    launch_session->content_type = proc::proc.content_type;
+    if (no_active_sessions) {
+      prewarm_stream(*launch_session);
+    }
     rtsp_stream::launch_session_raise(launch_session);
   }
 
   void resume(bool &host_audio, resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
-    pt::ptree tree;
+    xml::response_t tree;
     auto g = util::fail_guard([&]() {
-      std::ostringstream data;
-
-      pt::write_xml(data, tree);
-      response->write(data.str());
+      response->write(tree.str());
       response->close_connection_after_response = true;
     });
 
@@ -1515,18 +1878,18 @@ namespace nvhttp {
     if (!(named_cert_p->perm & PERM::_allow_view)) {
       BOOST_LOG(debug) << "Permission ViewApp denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
 
-      tree.put("root.resume", 0);
-      tree.put("root.<xmlattr>.status_code", 403);
-      tree.put("root.<xmlattr>.status_message", "Permission denied");
+      tree.put("resume", 0);
+      tree.attribute("status_code", 403);
+      tree.attribute("status_message", "Permission denied");
 
       return;
     }
 
     auto current_appid = proc::proc.running();
     if (current_appid == 0) {
-      tree.put("root.resume", 0);
-      tree.put("root.<xmlattr>.status_code", 503);
-      tree.put("root.<xmlattr>.status_message", "No running app to resume");
+      tree.put("resume", 0);
+      tree.attribute("status_code", 503);
+      tree.attribute("status_message", "No running app to resume");
 
       return;
     }
@@ -1536,9 +1899,9 @@ namespace nvhttp {
       args.find("rikey"s) == std::end(args) ||
       args.find("rikeyid"s) == std::end(args)
     ) {
-      tree.put("root.resume", 0);
-      tree.put("root.<xmlattr>.status_code", 400);
-      tree.put("root.<xmlattr>.status_message", "Missing a required resume parameter");
+      tree.put("resume", 0);
+      tree.attribute("status_code", 400);
+      tree.attribute("status_message", "Missing a required resume parameter");
 
       return;
     }
@@ -1561,20 +1924,30 @@ namespace nvhttp {
       launch_session->input_only = true;
     }
 
+    if (auto reason = admission_rejection(*launch_session)) {
+      tree.put("resume", 0);
+      tree.attribute("status_code", 503);
+      tree.attribute("status_message", *reason);
+
+      return;
+    }
+
     if (no_active_sessions && !proc::proc.virtual_display) {
       // We want to prepare display only if there are no active sessions
       // and the current session isn't virtual display at the moment.
       // This should be done before probing encoders as it could change the active displays.
+      launch_stage("Configuring the display"sv);
       display_device::configure_display(config::video, *launch_session);
+      launch_stage("Probing the encoders"sv);
 
       // Probe encoders again before streaming to ensure our chosen
       // encoder matches the active GPU (which could have changed
       // due to hotplugging, driver crash, primary monitor change,
       // or any number of other factors).
       if (video::probe_encoders()) {
-        tree.put("root.resume", 0);
-        tree.put("root.<xmlattr>.status_code", 503);
-        tree.put("root.<xmlattr>.status_message", "Failed to initialize video capture/encoding. Is a display connected and turned on?");
+        tree.put("resume", 0);
+        tree.attribute("status_code", 503);
+        tree.attribute("status_message", "Failed to initialize video capture/encoding. Is a display connected and turned on?");
 
         return;
       }
@@ -1584,16 +1957,16 @@ namespace nvhttp {
     if (!launch_session->rtsp_cipher && encryption_mode == config::ENCRYPTION_MODE_MANDATORY) {
       BOOST_LOG(error) << "Rejecting client that cannot comply with mandatory encryption requirement"sv;
 
-      tree.put("root.<xmlattr>.status_code", 403);
-      tree.put("root.<xmlattr>.status_message", "Encryption is mandatory for this host but unsupported by the client");
-      tree.put("root.gamesession", 0);
+      tree.attribute("status_code", 403);
+      tree.attribute("status_message", "Encryption is mandatory for this host but unsupported by the client");
+      tree.put("gamesession", 0);
 
       return;
     }
 
-    tree.put("root.<xmlattr>.status_code", 200);
+    tree.attribute("status_code", 200);
     tree.put(
-      "root.sessionUrl0",
+      "sessionUrl0",
       std::format(
         "{}{}:{}",
         launch_session->rtsp_url_scheme,
@@ -1601,8 +1974,13 @@ namespace nvhttp {
         static_cast<int>(net::map_port(rtsp_stream::RTSP_SETUP_PORT))
       )
     );
-    tree.put("root.resume", 1);
+    tree.put("resume", 1);
 
+    launch_session->encoder_profile = proc::proc.encoder_profile;
+    launch_session->content_type = proc::proc.content_type;
+    if (no_active_sessions) {
+      prewarm_stream(*launch_session);
+    }
     rtsp_stream::launch_session_raise(launch_session);
 
 #if defined SUNSHINE_TRAY && SUNSHINE_TRAY >= 1
@@ -1613,12 +1991,9 @@ namespace nvhttp {
   void cancel(resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
-    pt::ptree tree;
+    xml::response_t tree;
     auto g = util::fail_guard([&]() {
-      std::ostringstream data;
-
-      pt::write_xml(data, tree);
-      response->write(data.str());
+      response->write(tree.str());
       response->close_connection_after_response = true;
     });
 
@@ -1626,15 +2001,15 @@ namespace nvhttp {
     if (!(named_cert_p->perm & PERM::launch)) {
       BOOST_LOG(debug) << "Permission CancelApp denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
 
-      tree.put("root.resume", 0);
-      tree.put("root.<xmlattr>.status_code", 403);
-      tree.put("root.<xmlattr>.status_message", "Permission denied");
+      tree.put("resume", 0);
+      tree.attribute("status_code", 403);
+      tree.attribute("status_message", "Permission denied");
 
       return;
     }
 
-    tree.put("root.cancel", 1);
-    tree.put("root.<xmlattr>.status_code", 200);
+    tree.put("cancel", 1);
+    tree.attribute("status_code", 200);
 
     rtsp_stream::terminate_sessions();
 
@@ -1670,13 +2045,49 @@ namespace nvhttp {
 
     fg.disable();
 
-    std::ifstream in(app_image, std::ios::binary);
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "image/png");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+
+    auto image = app_images.get(app_image);
+    if (!image) {
+      std::ifstream in(app_image, std::ios::binary);
+      response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+      response->close_connection_after_response = true;
+      return;
+    }
+
+    headers.emplace("Cache-Control", "no-cache");
+    headers.emplace("ETag", image->etag);
+
+    auto if_none_match = request->header.find("If-None-Match");
+    if (if_none_match != std::end(request->header) && asset_cache::not_modified(if_none_match->second, *image)) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+    } else {
+      response->write(SimpleWeb::StatusCode::success_ok, image->identity, headers);
+    }
     response->close_connection_after_response = true;
   }
 
+  /**
+   * @brief Send a clipboard content one chunk at a time, the next chunk is written once the last one is sent.
+   * @param response The HTTP response object, its headers already written.
+   * @param content The content.
+   * @param offset The first byte to send.
+   */
+  void send_clipboard_chunks(resp_https_t response, std::shared_ptr<std::string> content, std::size_t offset) {
+    if (offset >= content->size()) {
+      return;
+    }
+
+    auto size = std::min(clipboard::chunk_size, content->size() - offset);
+    response->write(content->data() + offset, size);
+    response->send([response, content = std::move(content), offset = offset + size](const SimpleWeb::error_code &ec) {
+      if (!ec) {
+        send_clipboard_chunks(response, content, offset);
+      }
+    });
+  }
+
   void getClipboard(resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
@@ -1719,9 +2130,31 @@ namespace nvhttp {
       return;
     }
 
-    std::string content = platf::get_clipboard();
-    response->write(content);
-    return;
+    auto accept_encoding = request->header.find("Accept-Encoding");
+    auto gzip = accept_encoding != std::end(request->header) && asset_cache::quality(accept_encoding->second, "gzip"sv) > 0.0;
+
+    clipboard_executor.push([response = std::move(response), gzip]() {
+      auto content = std::make_shared<std::string>(platf::get_clipboard());
+      if (content->size() > clipboard::max_size) {
+        BOOST_LOG(debug) << "Clipboard content of "sv << content->size() << " bytes is larger than the limit"sv;
+
+        response->write(SimpleWeb::StatusCode::client_error_payload_too_large);
+        response->close_connection_after_response = true;
+        return;
+      }
+
+      SimpleWeb::CaseInsensitiveMultimap headers;
+      headers.emplace("Content-Type", "text/plain; charset=utf-8");
+      headers.emplace("Vary", "Accept-Encoding");
+      if (auto compressed = gzip ? clipboard::compress(*content) : std::nullopt) {
+        headers.emplace("Content-Encoding", "gzip");
+        *content = std::move(*compressed);
+      }
+      headers.emplace("Content-Length", std::to_string(content->size()));
+
+      response->write(SimpleWeb::StatusCode::success_ok, headers);
+      send_clipboard_chunks(response, std::move(content), 0);
+    });
   }
 
   void
@@ -1767,19 +2200,40 @@ namespace nvhttp {
       return;
     }
 
-    std::string content = request->content.string();
+    clipboard_executor.push([response = std::move(response), request = std::move(request)]() {
+      std::string content = request->content.string();
 
-    bool success = platf::set_clipboard(content);
+      auto content_encoding = request->header.find("Content-Encoding");
+      if (content_encoding != std::end(request->header) && !boost::iequals(content_encoding->second, "identity"sv)) {
+        if (!boost::iequals(content_encoding->second, "gzip"sv) && !boost::iequals(content_encoding->second, "deflate"sv)) {
+          BOOST_LOG(debug) << "Clipboard encoding [" << content_encoding->second << "] is not supported!";
 
-    if (!success) {
-      BOOST_LOG(debug) << "Setting clipboard failed!";
+          response->write(SimpleWeb::StatusCode::client_error_unsupported_media_type);
+          response->close_connection_after_response = true;
+          return;
+        }
 
-      response->write(SimpleWeb::StatusCode::server_error_internal_server_error);
-      response->close_connection_after_response = true;
-    }
+        auto decompressed = clipboard::decompress(content);
+        if (!decompressed) {
+          BOOST_LOG(debug) << "Clipboard content is invalid or larger than the limit"sv;
 
-    response->write();
-    return;
+          response->write(SimpleWeb::StatusCode::client_error_payload_too_large);
+          response->close_connection_after_response = true;
+          return;
+        }
+        content = std::move(*decompressed);
+      }
+
+      if (!platf::set_clipboard(content)) {
+        BOOST_LOG(debug) << "Setting clipboard failed!";
+
+        response->write(SimpleWeb::StatusCode::server_error_internal_server_error);
+        response->close_connection_after_response = true;
+        return;
+      }
+
+      response->write();
+    });
   }
 
   void setup(const std::string &pkey, const std::string &cert) {
@@ -1788,7 +2242,7 @@ namespace nvhttp {
   }
 
   void start() {
-    auto shutdown_event = mail::man->event<bool>(mail::shutdown);
+    auto shutdown_event = mail::man->event(mail::shutdown);
 
     auto port_http = net::map_port(PORT_HTTP);
     auto port_https = net::map_port(PORT_HTTPS);
@@ -1854,18 +2308,15 @@ namespace nvhttp {
     };
 
     https_server.on_verify_failed = [](resp_https_t resp, req_https_t req) {
-      pt::ptree tree;
+      xml::response_t tree;
       auto g = util::fail_guard([&]() {
-        std::ostringstream data;
-
-        pt::write_xml(data, tree);
-        resp->write(data.str());
+        resp->write(tree.str());
         resp->close_connection_after_response = true;
       });
 
-      tree.put("root.<xmlattr>.status_code"s, 401);
-      tree.put("root.<xmlattr>.query"s, req->path);
-      tree.put("root.<xmlattr>.status_message"s, "The client is not authorized. Certificate verification failed."s);
+      tree.attribute("status_code", 401);
+      tree.attribute("query", req->path);
+      tree.attribute("status_message", "The client is not authorized. Certificate verification failed."s);
     };
 
     https_server.default_resource["GET"] = not_found<SunshineHTTPS>;
@@ -1874,10 +2325,14 @@ namespace nvhttp {
     https_server.resource["^/applist$"]["GET"] = applist;
     https_server.resource["^/appasset$"]["GET"] = appasset;
     https_server.resource["^/launch$"]["GET"] = [&host_audio](auto resp, auto req) {
-      launch(host_audio, resp, req);
+      run_launch(std::move(resp), std::move(req), [&host_audio](auto resp, auto req) {
+        launch(host_audio, resp, req);
+      });
     };
     https_server.resource["^/resume$"]["GET"] = [&host_audio](auto resp, auto req) {
-      resume(host_audio, resp, req);
+      run_launch(std::move(resp), std::move(req), [&host_audio](auto resp, auto req) {
+        resume(host_audio, resp, req);
+      });
     };
     https_server.resource["^/cancel$"]["GET"] = cancel;
     https_server.resource["^/actions/clipboard$"]["GET"] = getClipboard;
@@ -1886,6 +2341,8 @@ namespace nvhttp {
     https_server.config.reuse_address = true;
     https_server.config.address = net::af_to_any_address_string(address_family);
     https_server.config.port = port_https;
+    // Room for the largest clipboard content along with the request headers
+    https_server.config.max_request_streambuf_size = clipboard::max_size + 64 * 1024;
 
     http_server.default_resource["GET"] = not_found<SimpleWeb::HTTP>;
     http_server.resource["^/serverinfo$"]["GET"] = serverinfo<SimpleWeb::HTTP>;
@@ -1909,6 +2366,8 @@ namespace nvhttp {
         return;
       }
     };
+    launch_executor.start(1);
+    clipboard_executor.start(1);
     std::thread ssl {accept_and_run, &https_server};
     std::thread tcp {accept_and_run, &http_server};
 
@@ -1922,6 +2381,14 @@ namespace nvhttp {
 
     ssl.join();
     tcp.join();
+
+    // Pending launches still answer their clients, host_audio outlives them
+    launch_executor.stop();
+    launch_executor.join();
+    clipboard_executor.stop();
+    clipboard_executor.join();
+
+    state_writer.stop();
   }
 
   std::string request_otp(const std::string& passphrase, const std::string& deviceName) {
@@ -1942,8 +2409,11 @@ namespace nvhttp {
     client_t client;
     client_root = client;
     cert_chain.clear();
-    save_state();
-    load_state();
+    save_state(true);
+  }
+
+  void invalidate_cached_responses() {
+  response_cache.clear();
   }
 
   void stop_session(stream::session_t& session, bool graceful) {
@@ -2022,8 +2492,7 @@ namespace nvhttp {
       }
     }
 
-    save_state();
-    load_state();
+    save_state(true);
 
     if (removed) {
       auto session = rtsp_stream::find_session(uuid);
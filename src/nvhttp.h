@@ -11,7 +11,6 @@
 #include <list>
 
 // lib includes
-#include <boost/property_tree/ptree.hpp>
 #include <nlohmann/json.hpp>
 #include <Simple-Web-Server/server_https.hpp>
 
@@ -19,6 +18,7 @@
 #include "crypto.h"
 #include "rtsp.h"
 #include "thread_safe.h"
+#include "xml_writer.h"
 
 using namespace std::chrono_literals;
 
@@ -172,7 +172,7 @@ namespace nvhttp {
    *
    * At this stage we only have to send back our public certificate.
    */
-  void getservercert(pair_session_t &sess, boost::property_tree::ptree &tree, const std::string &pin);
+  void getservercert(pair_session_t &sess, xml::response_t &tree, const std::string &pin);
 
   /**
    * @brief Pair, phase 2
@@ -186,7 +186,7 @@ namespace nvhttp {
    *
    * The hash + server_challenge will then be AES encrypted and sent as the `challengeresponse` in the returned XML
    */
-  void clientchallenge(pair_session_t &sess, boost::property_tree::ptree &tree, const std::string &challenge);
+  void clientchallenge(pair_session_t &sess, xml::response_t &tree, const std::string &challenge);
 
   /**
    * @brief Pair, phase 3
@@ -195,7 +195,7 @@ namespace nvhttp {
    * we have to send back the `pairingsecret`:
    * using our private key we have to sign the certificate_signature + server_secret (generated in phase 2)
    */
-  void serverchallengeresp(pair_session_t &sess, boost::property_tree::ptree &tree, const std::string &encrypted_response);
+  void serverchallengeresp(pair_session_t &sess, xml::response_t &tree, const std::string &encrypted_response);
 
   /**
    * @brief Pair, phase 4 (final)
@@ -211,7 +211,7 @@ namespace nvhttp {
    * Then using the client certificate public key we should be able to verify that
    * the client secret has been signed by Moonlight
    */
-  void clientpairingsecret(pair_session_t &sess, boost::property_tree::ptree &tree, const std::string &client_pairing_secret);
+  void clientpairingsecret(pair_session_t &sess, xml::response_t &tree, const std::string &client_pairing_secret);
 
   /**
    * @brief Compare the user supplied pin to the Moonlight pin.
@@ -258,6 +258,23 @@ namespace nvhttp {
    */
   void erase_all_clients();
 
+  /**
+   * @brief Drop the cached serverinfo and applist responses.
+   * @details Call it whenever something they show changes, other than the running app and the encoder capabilities.
+   * @examples
+   * nvhttp::invalidate_cached_responses();
+   * @examples_end
+   */
+  void invalidate_cached_responses();
+
+  /**
+   * @brief Get the progress of the launches and resumes.
+   * @details They run one at a time off the HTTPS server thread.
+   * @return `queued`, the launches waiting or running, `running`, and for the running one the
+   *         `client`, its `stage` and the `elapsed_ms` since it started.
+   */
+  nlohmann::json launch_progress();
+
   /**
    * @brief      Stops a session.
    *
@@ -0,0 +1,123 @@
+/**
+ * @file src/overload.cpp
+ * @brief Definitions for shedding the load of lower priority sessions when the host falls behind.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "overload.h"
+
+using namespace std::literals;
+
+namespace overload {
+  int priority(crypto::PERM permission) {
+    if (!!(permission & crypto::PERM::launch)) {
+      return 2;
+    }
+    return !!(permission & crypto::PERM::_all_inputs) ? 1 : 0;
+  }
+
+  std::optional<step_t> shed(const std::vector<member_t> &members) {
+    if (members.empty()) {
+      return std::nullopt;
+    }
+
+    auto top = std::max_element(std::begin(members), std::end(members), [](const member_t &a, const member_t &b) {
+      return a.priority < b.priority;
+    })->priority;
+
+    std::optional<std::size_t> pick;
+    for (std::size_t x = 0; x < members.size(); ++x) {
+      auto &member = members[x];
+      if (member.priority == top || member.level >= max_level) {
+        continue;
+      }
+
+      if (!pick || member.priority < members[*pick].priority || (member.priority == members[*pick].priority && member.level < members[*pick].level)) {
+        pick = x;
+      }
+    }
+
+    if (!pick) {
+      return std::nullopt;
+    }
+    return step_t {*pick, members[*pick].level + 1};
+  }
+
+  std::optional<step_t> restore(const std::vector<member_t> &members) {
+    std::optional<std::size_t> pick;
+    for (std::size_t x = 0; x < members.size(); ++x) {
+      auto &member = members[x];
+      if (!member.level) {
+        continue;
+      }
+
+      if (!pick || member.priority > members[*pick].priority || (member.priority == members[*pick].priority && member.level > members[*pick].level)) {
+        pick = x;
+      }
+    }
+
+    if (!pick) {
+      return std::nullopt;
+    }
+    return step_t {*pick, members[*pick].level - 1};
+  }
+
+  std::optional<step_t> controller_t::update(const std::vector<member_t> &members, std::size_t packet_backlog) {
+    if (behind(members, packet_backlog)) {
+      recovered_for = 0;
+      if (++overloaded_for < overloaded_ticks) {
+        return std::nullopt;
+      }
+
+      overloaded_for = 0;
+      return shed(members);
+    }
+
+    overloaded_for = 0;
+    if (++recovered_for < recovered_ticks) {
+      return std::nullopt;
+    }
+
+    recovered_for = 0;
+    return restore(members);
+  }
+
+  bool controller_t::behind(const std::vector<member_t> &members, std::size_t packet_backlog) {
+    static auto &latency_histogram = metrics::histogram("frame_processing_latency"sv);
+
+    auto latency = latency_histogram.snapshot();
+    auto previous = std::move(last_latency);
+    last_latency = latency;
+
+    if (members.empty()) {
+      return false;
+    }
+
+    if (packet_backlog >= packet_backlog_per_session * members.size()) {
+      return true;
+    }
+
+    // Only the frames processed since the previous tick count
+    if (previous.buckets.size() == latency.buckets.size()) {
+      for (std::size_t x = 0; x < latency.buckets.size(); ++x) {
+        latency.buckets[x] -= std::min(latency.buckets[x], previous.buckets[x]);
+      }
+      latency.count -= std::min(latency.count, previous.count);
+    }
+
+    auto top = std::max_element(std::begin(members), std::end(members), [](const member_t &a, const member_t &b) {
+      return a.priority < b.priority;
+    })->priority;
+
+    int fps = 0;
+    for (auto &member : members) {
+      if (member.priority == top) {
+        fps = std::max(fps, member.fps >> member.level);
+      }
+    }
+
+    return fps > 0 && latency.count > 0 && latency.percentile(latency_quantile) > 1000000 / (std::uint64_t) fps;
+  }
+}  // namespace overload
@@ -0,0 +1,89 @@
+/**
+ * @file src/overload.h
+ * @brief Declarations for shedding the load of lower priority sessions when the host falls behind.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+// local includes
+#include "crypto.h"
+#include "metrics.h"
+
+namespace overload {
+  constexpr int max_level = 2;  ///< Deepest shedding, each level halves the framerate of a session
+  constexpr auto tick_interval = std::chrono::seconds {1};  ///< How often the load of the host is sampled
+  constexpr int overloaded_ticks = 2;  ///< Ticks in a row the host must be behind before a session is shed
+  constexpr int recovered_ticks = 10;  ///< Ticks in a row the host must keep up before a session is restored
+  constexpr std::size_t packet_backlog_per_session = 2;  ///< Encoded frames per session waiting to be sent that count as falling behind
+  constexpr double latency_quantile = 0.9;  ///< Share of the frames that must be processed within the frame interval
+
+  /**
+   * @brief Get the priority of a session from the permissions of its client.
+   * @param permission The permissions.
+   * @return 2 for clients that may launch apps, 1 for clients with input, 0 for spectators.
+   */
+  int priority(crypto::PERM permission);
+
+  /**
+   * @brief A session as seen by the controller.
+   */
+  struct member_t {
+    int priority;  ///< Priority of the session, the highest one present is never shed
+    int level;  ///< Shedding level of the session, 0 if it runs at its full framerate
+    int fps;  ///< Framerate the session was set up with
+  };
+
+  /**
+   * @brief A change of the shedding level of one session.
+   */
+  struct step_t {
+    std::size_t index;  ///< Index of the session in the members
+    int level;  ///< The new level
+  };
+
+  /**
+   * @brief Pick the session to shed next.
+   * @details The lowest priority goes first, and within a priority the least shed session,
+   *          so the degradation is spread evenly.
+   * @param members The sessions.
+   * @return The step, or `std::nullopt` if every session below the highest priority is fully shed.
+   */
+  std::optional<step_t> shed(const std::vector<member_t> &members);
+
+  /**
+   * @brief Pick the session to restore next, the reverse order of `shed()`.
+   * @param members The sessions.
+   * @return The step, or `std::nullopt` if no session is shed.
+   */
+  std::optional<step_t> restore(const std::vector<member_t> &members);
+
+  /**
+   * @brief Detects when the host falls behind and picks the sessions to degrade.
+   * @details The host is behind when encoded frames pile up in the video packet queue, or when
+   *          more than 10% of the frames since the last tick took longer to capture and encode than
+   *          the frame interval of the fastest highest priority session. Only one session changes
+   *          per tick, the rest waits for the effect to show in the next samples.
+   */
+  class controller_t {
+  public:
+    /**
+     * @brief Sample the load of the host, called every `tick_interval` by the control thread.
+     * @param members The active sessions.
+     * @param packet_backlog The encoded frames waiting to be sent.
+     * @return A session to shed or restore, if any.
+     */
+    std::optional<step_t> update(const std::vector<member_t> &members, std::size_t packet_backlog);
+
+  private:
+    bool behind(const std::vector<member_t> &members, std::size_t packet_backlog);
+
+    metrics::snapshot_t last_latency;  ///< Frame processing latency at the previous tick
+    int overloaded_for = 0;  ///< Ticks in a row the host was behind
+    int recovered_for = 0;  ///< Ticks in a row the host kept up
+  };
+}  // namespace overload
@@ -0,0 +1,344 @@
+/**
+ * @file src/pipeline_trace.cpp
+ * @brief Definitions for recording per-frame spans of the streaming pipeline as a trace.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "config.h"
+#include "pipeline_trace.h"
+
+using namespace std::literals;
+
+namespace pipeline_trace {
+  namespace {
+    /**
+     * @brief A span in a ring. Only the owning thread writes to it, the fields are atomic so a dump may read them concurrently.
+     */
+    struct event_t {
+      std::atomic<const char *> name;
+      std::atomic<std::int64_t> begin_ns;
+      std::atomic<std::int64_t> end_ns;
+      std::atomic<std::int64_t> frame;
+    };
+
+    /**
+     * @brief The spans recorded by one thread.
+     */
+    struct ring_t {
+      std::array<event_t, events_per_thread> events;
+      std::atomic<std::uint64_t> head {0};  ///< Number of spans recorded, the next one goes to head % events_per_thread
+      std::string name;  ///< Name of the track, guarded by the registry lock
+      bool in_use = true;  ///< Whether a thread owns the ring, guarded by the registry lock
+    };
+
+    struct registry_t {
+      std::mutex lock;
+      std::vector<std::unique_ptr<ring_t>> rings;
+    };
+
+    registry_t &registry() {
+      // Intentionally leaked so the rings outlive thread_local owners during shutdown
+      static auto *registry = new registry_t;
+      return *registry;
+    }
+
+    /**
+     * @brief Hands the ring of an exiting thread over to later threads.
+     */
+    struct local_ring_t {
+      ring_t *ring = nullptr;
+
+      ~local_ring_t() {
+        if (ring) {
+          std::lock_guard lg {registry().lock};
+          ring->in_use = false;
+        }
+      }
+    };
+
+    thread_local local_ring_t local_ring;
+
+    ring_t &local() {
+      if (local_ring.ring) {
+        return *local_ring.ring;
+      }
+
+      auto &registry = pipeline_trace::registry();
+      std::lock_guard lg {registry.lock};
+
+      auto it = std::find_if(std::begin(registry.rings), std::end(registry.rings), [](auto &ring) {
+        return !ring->in_use;
+      });
+
+      // The spans of the thread that owned the ring before are dropped, a dump holds the lock while reading
+      ring_t *ring;
+      if (it == std::end(registry.rings)) {
+        ring = registry.rings.emplace_back(std::make_unique<ring_t>()).get();
+        it = std::end(registry.rings) - 1;
+      } else {
+        ring = it->get();
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->in_use = true;
+      }
+      ring->name = "thread "s + std::to_string(std::distance(std::begin(registry.rings), it));
+
+      local_ring.ring = ring;
+      return *ring;
+    }
+
+    std::int64_t to_ns(time_point time) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    struct span_t {
+      const char *name;
+      std::int64_t begin_ns;
+      std::int64_t end_ns;
+      std::int64_t frame;
+    };
+
+    struct track_t {
+      std::uint64_t id;
+      std::string name;
+      std::vector<span_t> spans;  ///< Sorted by begin
+    };
+
+    /**
+     * @brief Copy the spans of all rings.
+     * @return A track per ring.
+     */
+    std::vector<track_t> collect() {
+      auto &registry = pipeline_trace::registry();
+      std::lock_guard lg {registry.lock};
+
+      std::vector<track_t> tracks;
+      for (std::size_t x = 0; x < registry.rings.size(); ++x) {
+        auto &ring = *registry.rings[x];
+
+        auto head = ring.head.load(std::memory_order_acquire);
+        auto first = head > events_per_thread ? head - events_per_thread : 0;
+
+        track_t track {x + 1, ring.name};
+        for (auto index = first; index < head; ++index) {
+          auto &event = ring.events[index % events_per_thread];
+          track.spans.push_back({
+            event.name.load(std::memory_order_relaxed),
+            event.begin_ns.load(std::memory_order_relaxed),
+            event.end_ns.load(std::memory_order_relaxed),
+            event.frame.load(std::memory_order_relaxed),
+          });
+        }
+
+        // Drop the oldest spans if the thread overwrote them while they were copied, including the one it may be writing
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto valid_from = ring.head.load(std::memory_order_relaxed) + 1;
+        if (valid_from > first + events_per_thread) {
+          auto overwritten = std::min<std::uint64_t>(valid_from - events_per_thread - first, track.spans.size());
+          track.spans.erase(std::begin(track.spans), std::begin(track.spans) + overwritten);
+        }
+
+        if (track.spans.empty()) {
+          continue;
+        }
+
+        // Enclosing spans are recorded after the ones they contain, longer spans go first on ties
+        std::stable_sort(std::begin(track.spans), std::end(track.spans), [](const span_t &a, const span_t &b) {
+          return a.begin_ns < b.begin_ns || (a.begin_ns == b.begin_ns && a.end_ns > b.end_ns);
+        });
+        tracks.emplace_back(std::move(track));
+      }
+
+      return tracks;
+    }
+
+    /**
+     * @brief Minimal protobuf encoder for the few Perfetto messages we write.
+     */
+    namespace proto {
+      void put_varint(std::string &out, std::uint64_t value) {
+        while (value >= 0x80) {
+          out += (char) (value | 0x80);
+          value >>= 7;
+        }
+        out += (char) value;
+      }
+
+      void put_uint(std::string &out, int field, std::uint64_t value) {
+        put_varint(out, (std::uint64_t) field << 3);
+        put_varint(out, value);
+      }
+
+      void put_bytes(std::string &out, int field, std::string_view value) {
+        put_varint(out, (std::uint64_t) field << 3 | 2);
+        put_varint(out, value.size());
+        out += value;
+      }
+    }  // namespace proto
+
+    // Field numbers of perfetto/protos/perfetto/trace/trace_packet.proto and the messages it contains
+    constexpr int trace_packet = 1;
+    constexpr int packet_timestamp = 8;
+    constexpr int packet_sequence_id = 10;
+    constexpr int packet_track_event = 11;
+    constexpr int packet_sequence_flags = 13;
+    constexpr int packet_track_descriptor = 60;
+    constexpr int track_uuid = 1;
+    constexpr int track_name = 2;
+    constexpr int track_thread = 4;
+    constexpr int thread_pid = 1;
+    constexpr int thread_tid = 2;
+    constexpr int thread_name = 5;
+    constexpr int event_debug_annotations = 4;
+    constexpr int event_type = 9;
+    constexpr int event_track_uuid = 11;
+    constexpr int event_name = 23;
+    constexpr int annotation_int_value = 4;
+    constexpr int annotation_name = 10;
+    constexpr int type_slice_begin = 1;
+    constexpr int type_slice_end = 2;
+    constexpr int seq_incremental_state_cleared = 1;
+    constexpr int sequence_id = 1;
+
+    void put_packet(std::string &out, const std::string &packet) {
+      proto::put_bytes(out, trace_packet, packet);
+    }
+
+    void put_slice(std::string &out, std::uint64_t track, int type, std::int64_t timestamp_ns, const span_t *span) {
+      std::string event;
+      proto::put_uint(event, event_type, type);
+      proto::put_uint(event, event_track_uuid, track);
+      if (span) {
+        proto::put_bytes(event, event_name, span->name);
+        if (span->frame >= 0) {
+          std::string annotation;
+          proto::put_bytes(annotation, annotation_name, "frame"sv);
+          proto::put_uint(annotation, annotation_int_value, span->frame);
+          proto::put_bytes(event, event_debug_annotations, annotation);
+        }
+      }
+
+      std::string packet;
+      proto::put_uint(packet, packet_timestamp, timestamp_ns);
+      proto::put_uint(packet, packet_sequence_id, sequence_id);
+      proto::put_bytes(packet, packet_track_event, event);
+      put_packet(out, packet);
+    }
+  }  // namespace
+
+  void span(const char *name, time_point begin, time_point end, std::int64_t frame) {
+    if (!config::stream.pipeline_trace) {
+      return;
+    }
+
+    auto &ring = local();
+    auto head = ring.head.load(std::memory_order_relaxed);
+
+    auto &event = ring.events[head % events_per_thread];
+    event.name.store(name, std::memory_order_relaxed);
+    event.begin_ns.store(to_ns(begin), std::memory_order_relaxed);
+    event.end_ns.store(to_ns(end), std::memory_order_relaxed);
+    event.frame.store(frame, std::memory_order_relaxed);
+
+    ring.head.store(head + 1, std::memory_order_release);
+  }
+
+  void name_thread(std::string_view name) {
+    if (!config::stream.pipeline_trace) {
+      return;
+    }
+
+    auto &ring = local();
+    std::lock_guard lg {registry().lock};
+    ring.name = name;
+  }
+
+  std::string chrome_json() {
+    nlohmann::json events = nlohmann::json::array();
+    for (auto &track : collect()) {
+      events.push_back({
+        {"ph", "M"},
+        {"name", "thread_name"},
+        {"pid", 1},
+        {"tid", track.id},
+        {"args", {{"name", track.name}}},
+      });
+
+      for (auto &span : track.spans) {
+        nlohmann::json event {
+          {"ph", "X"},
+          {"cat", "pipeline"},
+          {"name", span.name},
+          {"pid", 1},
+          {"tid", track.id},
+          {"ts", span.begin_ns / 1000.0},
+          {"dur", (span.end_ns - span.begin_ns) / 1000.0},
+        };
+        if (span.frame >= 0) {
+          event["args"] = {{"frame", span.frame}};
+        }
+        events.push_back(std::move(event));
+      }
+    }
+
+    nlohmann::json trace;
+    trace["displayTimeUnit"] = "ms";
+    trace["traceEvents"] = std::move(events);
+    return trace.dump();
+  }
+
+  std::string perfetto_proto() {
+    std::string out;
+
+    // Nothing is interned, but the first packet of a sequence must still mark its state as cleared
+    std::string flags;
+    proto::put_uint(flags, packet_sequence_id, sequence_id);
+    proto::put_uint(flags, packet_sequence_flags, seq_incremental_state_cleared);
+    put_packet(out, flags);
+
+    for (auto &track : collect()) {
+      std::string thread;
+      proto::put_uint(thread, thread_pid, 1);
+      proto::put_uint(thread, thread_tid, track.id);
+      proto::put_bytes(thread, thread_name, track.name);
+
+      std::string descriptor;
+      proto::put_uint(descriptor, track_uuid, track.id);
+      proto::put_bytes(descriptor, track_name, track.name);
+      proto::put_bytes(descriptor, track_thread, thread);
+
+      std::string packet;
+      proto::put_uint(packet, packet_sequence_id, sequence_id);
+      proto::put_bytes(packet, packet_track_descriptor, descriptor);
+      put_packet(out, packet);
+
+      // Slices of a track must nest, the end of a span overlapping the next enclosing one is cut short
+      std::vector<std::int64_t> open_ends;
+      for (auto &span : track.spans) {
+        while (!open_ends.empty() && open_ends.back() <= span.begin_ns) {
+          put_slice(out, track.id, type_slice_end, open_ends.back(), nullptr);
+          open_ends.pop_back();
+        }
+
+        put_slice(out, track.id, type_slice_begin, span.begin_ns, &span);
+        open_ends.push_back(open_ends.empty() ? span.end_ns : std::min(span.end_ns, open_ends.back()));
+      }
+      while (!open_ends.empty()) {
+        put_slice(out, track.id, type_slice_end, open_ends.back(), nullptr);
+        open_ends.pop_back();
+      }
+    }
+
+    return out;
+  }
+}  // namespace pipeline_trace
@@ -0,0 +1,46 @@
+/**
+ * @file src/pipeline_trace.h
+ * @brief Declarations for recording per-frame spans of the streaming pipeline as a trace.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace pipeline_trace {
+  using time_point = std::chrono::steady_clock::time_point;
+
+  constexpr std::size_t events_per_thread = 32768;  ///< Spans kept per thread, older ones are overwritten
+
+  /**
+   * @brief Record a span of the current thread if `pipeline_trace` is enabled.
+   * @details Every thread records into its own ring buffer, without locking. The rings of exited
+   *          threads are kept until a new thread takes them over.
+   * @param name The name of the span, it must be a string literal.
+   * @param begin When the span started.
+   * @param end When the span ended.
+   * @param frame The frame number the span belongs to, -1 if there is none.
+   */
+  void span(const char *name, time_point begin, time_point end, std::int64_t frame = -1);
+
+  /**
+   * @brief Name the track of the current thread in the trace.
+   * @param name The name of the thread.
+   */
+  void name_thread(std::string_view name);
+
+  /**
+   * @brief Get the recorded spans in the Chrome trace event format.
+   * @return The JSON document, which can be opened in Perfetto or `chrome://tracing`.
+   */
+  std::string chrome_json();
+
+  /**
+   * @brief Get the recorded spans as a Perfetto trace.
+   * @return The serialized `perfetto.protos.Trace` protobuf.
+   */
+  std::string perfetto_proto();
+}  // namespace pipeline_trace
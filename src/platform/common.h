@@ -6,10 +6,13 @@
 
 // standard includes
 #include <bitset>
+#include <chrono>
 #include <filesystem>
 #include <functional>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <vector>
 
 // lib includes
 #include <boost/core/noncopyable.hpp>
@@ -290,6 +293,8 @@ namespace platf {
     std::int16_t lsY;
     std::int16_t rsX;
     std::int16_t rsY;
+
+    bool operator==(const gamepad_state_t &) const = default;
   };
 
   struct gamepad_id_t {
@@ -364,6 +369,16 @@ namespace platf {
     virtual ~deinit_t() = default;
   };
 
+  /**
+   * @brief A rectangle in image pixels, the right and bottom edges are exclusive.
+   */
+  struct rect_t {
+    std::int32_t left;
+    std::int32_t top;
+    std::int32_t right;
+    std::int32_t bottom;
+  };
+
   struct img_t: std::enable_shared_from_this<img_t> {
   public:
     img_t() = default;
@@ -381,6 +396,18 @@ namespace platf {
 
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
 
+    // Sequence number of the content of this image, 0 if the capture backend doesn't track it.
+    // Images with equal numbers hold the same content, content that immediately follows has the next number.
+    std::uint64_t frame_index = 0;
+
+    // Regions that changed since the previous image, for region-of-interest encoding.
+    // Only meaningful if damage_valid is set, otherwise the changes are unknown.
+    std::vector<rect_t> damage;
+    bool damage_valid = false;
+
+    // Where the cursor is blended onto the image, if the capture backend draws it
+    std::optional<rect_t> cursor;
+
     virtual ~img_t() = default;
   };
 
@@ -404,6 +431,14 @@ namespace platf {
 
     virtual int convert(platf::img_t &img) = 0;
 
+    /**
+     * @brief Forget the state kept about the images of the display the device was made for.
+     * @details Called before the device converts the images of another display with the same
+     *          binding, see `display_t::encoder_binding()`.
+     */
+    virtual void rebind() {
+    }
+
     video::sunshine_colorspace_t colorspace;
   };
 
@@ -451,6 +486,16 @@ namespace platf {
   struct nvenc_encode_device_t: encode_device_t {
     virtual bool init_encoder(const video::config_t &client_config, const video::sunshine_colorspace_t &colorspace) = 0;
 
+    /**
+     * @brief Change the frame size and framerate of the encoder in place, see `nvenc::nvenc_base::reconfigure_resolution()`.
+     * @details The conversion then renders the images at the new size into the same surface.
+     * @param client_config The stream configuration with the new size.
+     * @return `true` on success, `false` if the encoder must be recreated instead.
+     */
+    virtual bool reconfigure_resolution(const video::config_t &client_config) {
+      return false;
+    }
+
     nvenc::nvenc_base *nvenc = nullptr;
   };
 
@@ -532,6 +577,17 @@ namespace platf {
       return true;
     }
 
+    /**
+     * @brief Describe what the encode devices made for this display depend on.
+     * @details An encoder made for one display keeps working with the images of any display with
+     *          the same binding, so a capture reinitialization that ends up with the same binding
+     *          only rebuilds the capture. The size and dynamic range are compared separately.
+     * @return The binding, or `std::nullopt` if the encode devices depend on the display itself.
+     */
+    virtual std::optional<std::string> encoder_binding() {
+      return std::nullopt;
+    }
+
     virtual ~display_t() = default;
 
     // Offsets for when streaming a specific monitor. By default, they are 0.
@@ -550,6 +606,29 @@ namespace platf {
     virtual capture_e sample(std::vector<float> &frame_buffer) = 0;
 
     virtual ~mic_t() = default;
+
+    /**
+     * @brief Capture time of the first sample of the frame last returned by sample().
+     * @details Left empty by backends that can't tell, the frame is then assumed to have just been captured.
+     */
+    std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+  };
+
+  /**
+   * @brief Virtual microphone of the host, played into with the microphone audio of the client.
+   */
+  class virtual_mic_t {
+  public:
+    /**
+     * @brief Queue decoded samples for playback.
+     * @details Samples that don't fit the buffer of the device are dropped, the caller paces the writes.
+     * @param samples Interleaved samples.
+     * @param frames The number of frames.
+     * @return 0 on success, -1 if the device is gone.
+     */
+    virtual int write(const float *samples, std::size_t frames) = 0;
+
+    virtual ~virtual_mic_t() = default;
   };
 
   class audio_control_t {
@@ -558,6 +637,16 @@ namespace platf {
 
     virtual std::unique_ptr<mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size) = 0;
 
+    /**
+     * @brief Open the virtual microphone the client microphone is played into.
+     * @param channels The number of channels.
+     * @param sample_rate The sample rate.
+     * @return The virtual microphone, or `nullptr` if the platform has none.
+     */
+    virtual std::unique_ptr<virtual_mic_t> virtual_microphone(int channels, std::uint32_t sample_rate) {
+      return nullptr;
+    }
+
     /**
      * @brief Check if the audio sink is available in the system.
      * @param sink Sink to be checked.
@@ -578,6 +667,13 @@ namespace platf {
 
   std::string get_mac_address(const std::string_view &address);
 
+  /**
+   * @brief Get the link speed of the network interface with the given address.
+   * @param address The local IP address of the interface.
+   * @return The link speed in bits per second, or 0 if it is unknown.
+   */
+  std::uint64_t get_link_speed(const std::string_view &address);
+
   std::string get_local_ip_for_gateway();
 
   std::string from_sockaddr(const sockaddr *const);
@@ -604,6 +700,21 @@ namespace platf {
    */
   bool needs_encoder_reenumeration();
 
+  /**
+   * @brief Describe the GPUs, drivers and outputs that encoders are probed on.
+   * @return A description that changes when any of them changes, or an empty string if they aren't tracked.
+   */
+  std::string gpu_identity();
+
+  /**
+   * @brief Get the number of display topology changes seen so far.
+   * @details Changes are displays being connected, disconnected or changing mode, as reported by the
+   *          platform while they happen. Capture compares the count to reinitialize right away instead
+   *          of waiting for the capture backend to fail or time out.
+   * @return The number of changes, it stays 0 if changes aren't watched on this platform.
+   */
+  std::uint64_t display_topology_generation();
+
   boost::process::v1::child run_command(bool elevated, bool interactive, const std::string &cmd, boost::filesystem::path &working_dir, const boost::process::v1::environment &env, FILE *file, std::error_code &ec, boost::process::v1::group *group);
 
   enum class thread_priority_e : int {
@@ -614,6 +725,66 @@ namespace platf {
   };
   void adjust_thread_priority(thread_priority_e priority);
 
+  /**
+   * @brief Restrict the calling thread to a set of logical processors.
+   * @param cores The logical processors.
+   * @return `true` on success, `false` if the platform doesn't support it or refused.
+   */
+  bool set_thread_affinity(const std::vector<int> &cores);
+
+  /**
+   * @brief Have the calling thread join an MMCSS task on Windows, e.g. "Games" or "Capture".
+   * @details The thread leaves the task when it exits. Does nothing on other platforms.
+   * @param task The task name.
+   */
+  void set_thread_mmcss_task(const std::string &task);
+
+  /**
+   * @brief Get the logical processors of a NUMA node.
+   * @param node The NUMA node.
+   * @return The logical processors, empty if unknown.
+   */
+  std::vector<int> numa_node_cores(int node);
+
+  /**
+   * @brief Get the logical processors grouped by the last level cache they share, e.g. the CCDs of a Ryzen CPU.
+   * @return The groups, empty if unknown.
+   */
+  std::vector<std::vector<int>> cpu_cache_domains();
+
+  /**
+   * @brief Measure how busy each logical processor is.
+   * @param interval How long to measure for, the calling thread sleeps meanwhile.
+   * @return The busy fraction between 0 and 1, indexed by logical processor. Empty if unknown.
+   */
+  std::vector<double> cpu_core_load(std::chrono::milliseconds interval);
+
+  /**
+   * @brief Get the NUMA node of the GPU used for capture and encoding.
+   * @return The node, or -1 if unknown.
+   */
+  int gpu_numa_node();
+
+  /**
+   * @brief Memory used by the host process.
+   */
+  struct memory_usage_t {
+    std::optional<std::uint64_t> resident;  ///< Bytes in physical memory, if known.
+    std::optional<std::uint64_t> video;  ///< Bytes of dedicated video memory used on the GPUs, if known.
+  };
+
+  /**
+   * @brief Get how much memory the host process uses.
+   * @return The memory usage.
+   */
+  memory_usage_t memory_usage();
+
+  /**
+   * @brief Return the memory the allocators keep for reuse, and the working set, to the system.
+   * @details Meant for when nothing streams, the memory is faulted back in as it's used again.
+   */
+  void trim_memory();
+
   // Allow OS-specific actions to be taken to prepare for streaming
   void streaming_will_start();
   void streaming_will_stop();
@@ -674,6 +845,11 @@ namespace platf {
     uint16_t target_port;
     boost::asio::ip::address &source_address;
 
+    // Optional launch time of the first block if the socket supports it, see enable_send_txtime().
+    // The following blocks are launched txtime_interval apart.
+    std::optional<std::chrono::steady_clock::time_point> txtime;
+    std::chrono::nanoseconds txtime_interval;
+
     /**
      * @brief Returns a payload buffer descriptor for the given payload offset.
      * @param offset The offset in the total payload data (bytes).
@@ -696,6 +872,24 @@ namespace platf {
 
   bool send_batch(batched_send_info_t &send_info);
 
+  /**
+   * @brief Let the kernel release batched packets at their launch time instead of pacing them with sleeps.
+   * @details Packets are only held back if the egress qdisc supports launch times, e.g. `fq`.
+   *          Other qdiscs send them right away.
+   * @param native_socket The socket.
+   * @return `true` if `batched_send_info_t::txtime` is honored for this socket.
+   */
+  bool enable_send_txtime(std::uintptr_t native_socket);
+
+  /**
+   * @brief Open a UDP socket whose batched sends go through buffers registered with the network stack.
+   * @details The socket isn't bound. Batches that don't fit the registered buffers are sent normally.
+   * @param v6 `true` for a dual-stack IPv6 socket, `false` for an IPv4 socket.
+   * @param native_socket Receives the socket on success.
+   * @return The registered resources, to be released before the socket is closed, or `nullptr` if unsupported.
+   */
+  std::unique_ptr<deinit_t> open_registered_io_socket(bool v6, std::uintptr_t &native_socket);
+
   struct send_info_t {
     const char *header;
     size_t header_size;
@@ -712,9 +906,43 @@ namespace platf {
 
   enum class qos_data_type_e : int {
     audio,  ///< Audio
-    video  ///< Video
+    video,  ///< Video, including FEC and retransmitted packets sent on the same socket
+    control  ///< Control stream, carries input
   };
 
+  /**
+   * @brief Get the DSCP value the configured QoS profile assigns to a type of traffic.
+   * @param data_type The type of traffic.
+   * @return The DSCP value, 0 if the traffic stays unmarked.
+   */
+  inline int qos_dscp(qos_data_type_e data_type) {
+    if (config::stream.qos_profile == config::QOS_PROFILE_WMM) {
+      // RFC 8325 classes, which Wi-Fi access points map to the WMM voice and video access categories
+      switch (data_type) {
+        case qos_data_type_e::video:
+          return 32;  // CS4, AC_VI
+        case qos_data_type_e::audio:
+          return 46;  // EF, AC_VO
+        case qos_data_type_e::control:
+          return 44;  // VOICE-ADMIT, AC_VO
+      }
+    } else {
+      // The specific DSCP values here are chosen to be consistent with Windows,
+      // except that we use CS6 instead of CS7 for audio traffic. The control
+      // stream is left to the opportunistic tagging of ENet.
+      switch (data_type) {
+        case qos_data_type_e::video:
+          return 40;  // CS5
+        case qos_data_type_e::audio:
+          return 48;  // CS6
+        case qos_data_type_e::control:
+          return 0;
+      }
+    }
+
+    return 0;
+  }
+
   /**
    * @brief Enable QoS on the given socket for traffic to the specified destination.
    * @param native_socket The native socket handle.
@@ -722,8 +950,18 @@ namespace platf {
    * @param port The destination port for traffic sent on this socket.
    * @param data_type The type of traffic sent on this socket.
    * @param dscp_tagging Specifies whether to enable DSCP tagging on outgoing traffic.
+   * @param dscp_marked Receives the DSCP value the OS reports it marks the traffic with, 0 if it isn't marked.
    */
-  std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging);
+  std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging, int &dscp_marked);
+
+  /**
+   * @brief Get the MTU of the route to an address.
+   * @details This is the MTU the host knows of for the path, from its interface or from a
+   *          previous path MTU discovery, nothing is sent to the address.
+   * @param address The destination address.
+   * @return The MTU in bytes, or `std::nullopt` if unknown.
+   */
+  std::optional<int> path_mtu(const boost::asio::ip::address &address);
 
   /**
    * @brief Open a url in the default web browser.
@@ -745,6 +983,15 @@ namespace platf {
    */
   bool process_group_running(std::uintptr_t native_handle);
 
+  /**
+   * @brief Get notified when an app exits instead of polling for it.
+   * @param child The process that was launched.
+   * @param group The process group of the app if it only exits once every process in it did, else `nullptr`.
+   * @param on_exit Called once from a separate thread when the app exited.
+   * @return Stops watching when destroyed, or `nullptr` if the exit has to be polled.
+   */
+  std::unique_ptr<deinit_t> watch_app_exit(boost::process::v1::child &child, boost::process::v1::group *group, std::function<void()> on_exit);
+
   input_t input();
   /**
    * @brief Get the current mouse position on screen
@@ -764,6 +1011,20 @@ namespace platf {
   void gamepad_update(input_t &input, int nr, const gamepad_state_t &gamepad_state);
   void unicode(input_t &input, char *utf8, int size);
 
+  /**
+   * @brief Queue the keyboard and mouse events until `end_input_batch()`.
+   * @details Backends able to inject several events at once send the queued events together,
+   *          the others keep injecting each event right away.
+   * @param input The global input context.
+   */
+  void begin_input_batch(input_t &input);
+
+  /**
+   * @brief Inject the keyboard and mouse events queued since `begin_input_batch()`.
+   * @param input The global input context.
+   */
+  void end_input_batch(input_t &input);
+
   typedef deinit_t client_input_t;
 
   /**
@@ -872,6 +1133,42 @@ namespace platf {
    */
   std::unique_ptr<high_precision_timer> create_high_precision_timer();
 
+  /**
+   * @brief Utilization of the GPU, a field is empty if the driver doesn't report it.
+   */
+  struct gpu_utilization_t {
+    std::optional<int> encoder;  ///< Video encode engine utilization in percent
+    std::optional<int> render;  ///< 3D engine utilization in percent
+    std::optional<int> clock_mhz;  ///< Current graphics clock
+  };
+
+  class gpu_monitor_t {
+  public:
+    virtual ~gpu_monitor_t() = default;
+
+    /**
+     * @brief Sample the utilization of the GPU.
+     * @details Utilization is averaged by the driver over roughly the last second, or over
+     *          the time since the previous sample.
+     * @return The utilization.
+     */
+    virtual gpu_utilization_t sample() = 0;
+  };
+
+  /**
+   * @brief Create a monitor for the utilization of the GPU.
+   * @details NVML is used on NVIDIA GPUs, the Windows performance counters or the amdgpu sysfs otherwise.
+   * @return The monitor, or nullptr if the utilization can't be sampled.
+   */
+  std::unique_ptr<gpu_monitor_t> make_gpu_monitor();
+
+  /**
+   * @brief Raise the GPU scheduling priority of the process above the one picked at capture start, or restore it.
+   * @param boost `true` to raise the priority.
+   * @return `true` if the priority was changed.
+   */
+  bool boost_gpu_priority(bool boost);
+
   std::string
   get_clipboard();
 
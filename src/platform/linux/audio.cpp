@@ -4,6 +4,9 @@
  */
 // standard includes
 #include <bitset>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <sstream>
 #include <thread>
 
@@ -11,7 +14,6 @@
 #include <boost/regex.hpp>
 #include <pulse/error.h>
 #include <pulse/pulseaudio.h>
-#include <pulse/simple.h>
 
 // local includes
 #include "src/config.h"
@@ -50,26 +52,190 @@ namespace platf {
     return result;
   }
 
+  /**
+   * @brief Asynchronous PulseAudio record stream.
+   * @details Fragments are delivered on a PulseAudio threaded main loop and copied straight
+   *          into whole frames, so the capture thread only wakes once per frame. Each frame is
+   *          timestamped with the capture time of its first sample.
+   */
   struct mic_attr_t: public mic_t {
-    util::safe_ptr<pa_simple, pa_simple_free> mic;
+    /**
+     * @brief Captured frame waiting for the capture thread.
+     */
+    struct frame_t {
+      std::vector<float> samples;  ///< Interleaved samples
+      std::chrono::steady_clock::time_point timestamp;  ///< Capture time of the first sample
+    };
 
-    capture_e sample(std::vector<float> &sample_buf) override {
-      auto sample_size = sample_buf.size();
+    static constexpr std::size_t max_frames = 8;  ///< Frames kept before the oldest one is dropped
+
+    util::safe_ptr<pa_threaded_mainloop, pa_threaded_mainloop_free> loop;
+    util::safe_ptr<pa_context, pa_context_unref> ctx;
+    util::safe_ptr<pa_stream, pa_stream_unref> stream;
+
+    std::size_t samples_per_frame;
+    std::size_t channels;
+    std::chrono::nanoseconds sample_period;  ///< Duration of one sample of each channel
+
+    std::mutex frames_lock;
+    std::condition_variable frames_cv;
+    std::deque<frame_t> frames;
+    frame_t partial;  ///< Frame being filled by the read callback
+    bool failed = false;
+
+    logging::time_delta_periodic_logger capture_latency_logger = {debug, "Audio capture latency"};
+
+    ~mic_attr_t() override {
+      if (!loop) {
+        return;
+      }
 
-      auto buf = sample_buf.data();
-      int status;
-      if (pa_simple_read(mic.get(), buf, sample_size * sizeof(float), &status)) {
-        BOOST_LOG(error) << "pa_simple_read() failed: "sv << pa_strerror(status);
+      pa_threaded_mainloop_lock(loop.get());
+      if (stream) {
+        pa_stream_disconnect(stream.get());
+      }
+      if (ctx) {
+        pa_context_disconnect(ctx.get());
+      }
+      pa_threaded_mainloop_unlock(loop.get());
 
+      pa_threaded_mainloop_stop(loop.get());
+    }
+
+    capture_e sample(std::vector<float> &sample_buf) override {
+      std::unique_lock ul {frames_lock};
+      if (!frames_cv.wait_for(ul, 1s, [this]() {
+            return !frames.empty() || failed;
+          })) {
+        return capture_e::timeout;
+      }
+
+      if (frames.empty()) {
         return capture_e::error;
       }
 
+      auto frame = std::move(frames.front());
+      frames.pop_front();
+      ul.unlock();
+
+      frame_timestamp = frame.timestamp;
+      capture_latency_logger.first_point(frame.timestamp);
+      capture_latency_logger.second_point_now_and_log();
+
+      sample_buf.swap(frame.samples);
       return capture_e::ok;
     }
+
+    /**
+     * @brief Append a fragment to the frames, called on the PulseAudio thread.
+     * @param data The samples, or `nullptr` for a hole in the stream.
+     * @param count The number of samples.
+     * @param timestamp The capture time of the first sample.
+     */
+    void write(const float *data, std::size_t count, std::chrono::steady_clock::time_point timestamp) {
+      std::lock_guard lg {frames_lock};
+
+      std::size_t offset = 0;
+      while (offset < count) {
+        if (partial.samples.empty()) {
+          partial.samples.reserve(samples_per_frame);
+          partial.timestamp = timestamp + sample_period * (offset / channels);
+        }
+
+        auto n = std::min(count - offset, samples_per_frame - partial.samples.size());
+        if (data) {
+          partial.samples.insert(partial.samples.end(), data + offset, data + offset + n);
+        } else {
+          partial.samples.resize(partial.samples.size() + n, 0.0f);
+        }
+        offset += n;
+
+        if (partial.samples.size() == samples_per_frame) {
+          if (frames.size() == max_frames) {
+            frames.pop_front();
+          }
+          frames.push_back(std::move(partial));
+          partial = {};
+          frames_cv.notify_one();
+        }
+      }
+    }
+
+    void fail() {
+      {
+        std::lock_guard lg {frames_lock};
+        failed = true;
+      }
+      frames_cv.notify_one();
+    }
+
+    static void context_state_cb(pa_context *ctx, void *userdata) {
+      auto mic = (mic_attr_t *) userdata;
+
+      switch (pa_context_get_state(ctx)) {
+        case PA_CONTEXT_FAILED:
+        case PA_CONTEXT_TERMINATED:
+          mic->fail();
+          [[fallthrough]];
+        case PA_CONTEXT_READY:
+          pa_threaded_mainloop_signal(mic->loop.get(), 0);
+          break;
+        default:
+          break;
+      }
+    }
+
+    static void stream_state_cb(pa_stream *stream, void *userdata) {
+      auto mic = (mic_attr_t *) userdata;
+
+      switch (pa_stream_get_state(stream)) {
+        case PA_STREAM_FAILED:
+        case PA_STREAM_TERMINATED:
+          mic->fail();
+          [[fallthrough]];
+        case PA_STREAM_READY:
+          pa_threaded_mainloop_signal(mic->loop.get(), 0);
+          break;
+        default:
+          break;
+      }
+    }
+
+    static void stream_read_cb(pa_stream *stream, std::size_t, void *userdata) {
+      auto mic = (mic_attr_t *) userdata;
+
+      const void *data;
+      std::size_t bytes;
+      while (pa_stream_readable_size(stream) > 0) {
+        if (pa_stream_peek(stream, &data, &bytes) < 0) {
+          BOOST_LOG(error) << "pa_stream_peek() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+          mic->fail();
+          return;
+        }
+
+        if (!bytes) {
+          break;
+        }
+
+        // The latency covers everything still buffered, including this fragment
+        pa_usec_t latency = 0;
+        int negative = 0;
+        auto timestamp = std::chrono::steady_clock::now();
+        if (!pa_stream_get_latency(stream, &latency, &negative) && !negative) {
+          timestamp -= std::chrono::microseconds {latency};
+        }
+
+        mic->write((const float *) data, bytes / sizeof(float), timestamp);
+        pa_stream_drop(stream);
+      }
+    }
   };
 
   std::unique_ptr<mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, std::string source_name) {
     auto mic = std::make_unique<mic_attr_t>();
+    mic->samples_per_frame = frame_size * channels;
+    mic->channels = channels;
+    mic->sample_period = std::chrono::nanoseconds {1s} / sample_rate;
 
     pa_sample_spec ss {PA_SAMPLE_FLOAT32, sample_rate, (std::uint8_t) channels};
     pa_channel_map pa_map;
@@ -79,26 +245,201 @@ namespace platf {
       channel = position_mapping[*mapping++];
     });
 
+    // Deliver one frame per fragment and never let the server buffer more than a few
+    auto frame_bytes = uint32_t(frame_size * channels * sizeof(float));
     pa_buffer_attr pa_attr = {
-      .maxlength = uint32_t(-1),
+      .maxlength = frame_bytes * 4,
       .tlength = uint32_t(-1),
       .prebuf = uint32_t(-1),
       .minreq = uint32_t(-1),
-      .fragsize = uint32_t(frame_size * channels * sizeof(float))
+      .fragsize = frame_bytes
+    };
+
+    mic->loop.reset(pa_threaded_mainloop_new());
+    mic->ctx.reset(pa_context_new(pa_threaded_mainloop_get_api(mic->loop.get()), "sunshine"));
+    pa_context_set_state_callback(mic->ctx.get(), mic_attr_t::context_state_cb, mic.get());
+
+    if (pa_context_connect(mic->ctx.get(), nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0) {
+      BOOST_LOG(error) << "pa_context_connect() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+      return nullptr;
+    }
+
+    pa_threaded_mainloop_lock(mic->loop.get());
+    auto unlock = util::fail_guard([&]() {
+      pa_threaded_mainloop_unlock(mic->loop.get());
+    });
+
+    if (pa_threaded_mainloop_start(mic->loop.get()) < 0) {
+      BOOST_LOG(error) << "pa_threaded_mainloop_start() failed"sv;
+      return nullptr;
+    }
+
+    while (pa_context_get_state(mic->ctx.get()) != PA_CONTEXT_READY) {
+      if (!PA_CONTEXT_IS_GOOD(pa_context_get_state(mic->ctx.get()))) {
+        BOOST_LOG(error) << "Couldn't connect to pulseaudio: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+        return nullptr;
+      }
+      pa_threaded_mainloop_wait(mic->loop.get());
+    }
+
+    mic->stream.reset(pa_stream_new(mic->ctx.get(), "sunshine-record", &ss, &pa_map));
+    if (!mic->stream) {
+      BOOST_LOG(error) << "pa_stream_new() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+      return nullptr;
+    }
+
+    pa_stream_set_state_callback(mic->stream.get(), mic_attr_t::stream_state_cb, mic.get());
+    pa_stream_set_read_callback(mic->stream.get(), mic_attr_t::stream_read_cb, mic.get());
+
+    auto flags = (pa_stream_flags_t) (PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE);
+    if (pa_stream_connect_record(mic->stream.get(), source_name.empty() ? nullptr : source_name.c_str(), &pa_attr, flags) < 0) {
+      BOOST_LOG(error) << "pa_stream_connect_record() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+      return nullptr;
+    }
+
+    while (pa_stream_get_state(mic->stream.get()) != PA_STREAM_READY) {
+      if (!PA_STREAM_IS_GOOD(pa_stream_get_state(mic->stream.get()))) {
+        BOOST_LOG(error) << "Couldn't connect the record stream: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+        return nullptr;
+      }
+      pa_threaded_mainloop_wait(mic->loop.get());
+    }
+
+    return mic;
+  }
+
+  /**
+   * @brief Asynchronous PulseAudio playback stream into the null sink behind the virtual microphone.
+   */
+  struct virtual_mic_pa_t: public virtual_mic_t {
+    util::safe_ptr<pa_threaded_mainloop, pa_threaded_mainloop_free> loop;
+    util::safe_ptr<pa_context, pa_context_unref> ctx;
+    util::safe_ptr<pa_stream, pa_stream_unref> stream;
+
+    std::size_t channels;
+
+    ~virtual_mic_pa_t() override {
+      if (!loop) {
+        return;
+      }
+
+      pa_threaded_mainloop_lock(loop.get());
+      if (stream) {
+        pa_stream_disconnect(stream.get());
+      }
+      if (ctx) {
+        pa_context_disconnect(ctx.get());
+      }
+      pa_threaded_mainloop_unlock(loop.get());
+
+      pa_threaded_mainloop_stop(loop.get());
+    }
+
+    int write(const float *samples, std::size_t frames) override {
+      pa_threaded_mainloop_lock(loop.get());
+      auto unlock = util::fail_guard([&]() {
+        pa_threaded_mainloop_unlock(loop.get());
+      });
+
+      if (!PA_STREAM_IS_GOOD(pa_stream_get_state(stream.get()))) {
+        return -1;
+      }
+
+      auto bytes = frames * channels * sizeof(float);
+      auto writable = pa_stream_writable_size(stream.get());
+      if (writable == (std::size_t) -1) {
+        return -1;
+      }
+      if (bytes > writable) {
+        BOOST_LOG(debug) << "Virtual microphone buffer is full, dropping "sv << (bytes - writable) / (channels * sizeof(float)) << " frames"sv;
+        bytes = writable / (channels * sizeof(float)) * (channels * sizeof(float));
+      }
+      if (!bytes) {
+        return 0;
+      }
+
+      if (pa_stream_write(stream.get(), samples, bytes, nullptr, 0, PA_SEEK_RELATIVE) < 0) {
+        BOOST_LOG(error) << "pa_stream_write() failed: "sv << pa_strerror(pa_context_errno(ctx.get()));
+        return -1;
+      }
+
+      return 0;
+    }
+
+    static void state_cb(pa_context *, void *userdata) {
+      pa_threaded_mainloop_signal(((virtual_mic_pa_t *) userdata)->loop.get(), 0);
+    }
+
+    static void stream_state_cb(pa_stream *, void *userdata) {
+      pa_threaded_mainloop_signal(((virtual_mic_pa_t *) userdata)->loop.get(), 0);
+    }
+  };
+
+  std::unique_ptr<virtual_mic_t> virtual_microphone(int channels, std::uint32_t sample_rate, const char *sink_name) {
+    auto mic = std::make_unique<virtual_mic_pa_t>();
+    mic->channels = channels;
+
+    pa_sample_spec ss {PA_SAMPLE_FLOAT32, sample_rate, (std::uint8_t) channels};
+
+    // Keep no more than 20ms queued in the server, the jitter buffer of the caller absorbs the rest
+    auto target_bytes = uint32_t(sample_rate / 50 * channels * sizeof(float));
+    pa_buffer_attr pa_attr = {
+      .maxlength = target_bytes * 4,
+      .tlength = target_bytes,
+      .prebuf = 0,
+      .minreq = uint32_t(-1),
+      .fragsize = uint32_t(-1)
     };
 
-    int status;
+    mic->loop.reset(pa_threaded_mainloop_new());
+    mic->ctx.reset(pa_context_new(pa_threaded_mainloop_get_api(mic->loop.get()), "sunshine"));
+    pa_context_set_state_callback(mic->ctx.get(), virtual_mic_pa_t::state_cb, mic.get());
 
-    mic->mic.reset(
-      pa_simple_new(nullptr, "sunshine", pa_stream_direction_t::PA_STREAM_RECORD, source_name.c_str(), "sunshine-record", &ss, &pa_map, &pa_attr, &status)
-    );
+    if (pa_context_connect(mic->ctx.get(), nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0) {
+      BOOST_LOG(error) << "pa_context_connect() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+      return nullptr;
+    }
+
+    pa_threaded_mainloop_lock(mic->loop.get());
+    auto unlock = util::fail_guard([&]() {
+      pa_threaded_mainloop_unlock(mic->loop.get());
+    });
 
-    if (!mic->mic) {
-      auto err_str = pa_strerror(status);
-      BOOST_LOG(error) << "pa_simple_new() failed: "sv << err_str;
+    if (pa_threaded_mainloop_start(mic->loop.get()) < 0) {
+      BOOST_LOG(error) << "pa_threaded_mainloop_start() failed"sv;
       return nullptr;
     }
 
+    while (pa_context_get_state(mic->ctx.get()) != PA_CONTEXT_READY) {
+      if (!PA_CONTEXT_IS_GOOD(pa_context_get_state(mic->ctx.get()))) {
+        BOOST_LOG(error) << "Couldn't connect to pulseaudio: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+        return nullptr;
+      }
+      pa_threaded_mainloop_wait(mic->loop.get());
+    }
+
+    mic->stream.reset(pa_stream_new(mic->ctx.get(), "sunshine-microphone", &ss, nullptr));
+    if (!mic->stream) {
+      BOOST_LOG(error) << "pa_stream_new() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+      return nullptr;
+    }
+
+    pa_stream_set_state_callback(mic->stream.get(), virtual_mic_pa_t::stream_state_cb, mic.get());
+
+    auto flags = (pa_stream_flags_t) (PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE);
+    if (pa_stream_connect_playback(mic->stream.get(), sink_name, &pa_attr, flags, nullptr, nullptr) < 0) {
+      BOOST_LOG(error) << "pa_stream_connect_playback() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+      return nullptr;
+    }
+
+    while (pa_stream_get_state(mic->stream.get()) != PA_STREAM_READY) {
+      if (!PA_STREAM_IS_GOOD(pa_stream_get_state(mic->stream.get()))) {
+        BOOST_LOG(error) << "Couldn't connect the playback stream: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+        return nullptr;
+      }
+      pa_threaded_mainloop_wait(mic->loop.get());
+    }
+
     return mic;
   }
 
@@ -191,6 +532,8 @@ namespace platf {
         std::uint32_t stereo = PA_INVALID_INDEX;
         std::uint32_t surround51 = PA_INVALID_INDEX;
         std::uint32_t surround71 = PA_INVALID_INDEX;
+        std::uint32_t mic_sink = PA_INVALID_INDEX;
+        std::uint32_t mic_source = PA_INVALID_INDEX;
       } index;
 
       std::unique_ptr<safe::event_t<ctx_event_e>> events;
@@ -254,14 +597,14 @@ namespace platf {
         return 0;
       }
 
-      int load_null(const char *name, const std::uint8_t *channel_mapping, int channels) {
+      int load_module(const char *name, const std::string &args) {
         auto alarm = safe::make_alarm<int>();
 
         op_t op {
           pa_context_load_module(
             ctx.get(),
-            "module-null-sink",
-            to_string(name, channel_mapping, channels).c_str(),
+            name,
+            args.c_str(),
             cb_i,
             alarm.get()
           ),
@@ -271,6 +614,10 @@ namespace platf {
         return *alarm->status();
       }
 
+      int load_null(const char *name, const std::uint8_t *channel_mapping, int channels) {
+        return load_module("module-null-sink", to_string(name, channel_mapping, channels));
+      }
+
       int unload_null(std::uint32_t i) {
         if (i == PA_INVALID_INDEX) {
           return 0;
@@ -459,6 +806,42 @@ namespace platf {
         return ::platf::microphone(mapping, channels, sample_rate, frame_size, get_monitor_name(sink_name));
       }
 
+      std::unique_ptr<virtual_mic_t> virtual_microphone(int channels, std::uint32_t sample_rate) override {
+        constexpr auto mic_sink = "sink-sunshine-mic";
+        constexpr auto mic_source = "source-sunshine-mic";
+
+        // Applications record the client microphone from a source remapped from the monitor of a null sink
+        if (index.mic_sink == PA_INVALID_INDEX) {
+          std::stringstream ss;
+          ss << "rate="sv << sample_rate << " sink_name="sv << mic_sink << " format=float channels="sv << channels
+             << " sink_properties=device.description=Sunshine-Microphone-Sink"sv;
+
+          index.mic_sink = load_module("module-null-sink", ss.str());
+          if (index.mic_sink == PA_INVALID_INDEX) {
+            BOOST_LOG(warning) << "Couldn't create the virtual microphone sink: "sv << pa_strerror(pa_context_errno(ctx.get()));
+            return nullptr;
+          }
+        }
+
+        if (index.mic_source == PA_INVALID_INDEX) {
+          std::stringstream ss;
+          ss << "master="sv << mic_sink << ".monitor source_name="sv << mic_source
+             << " source_properties=device.description=Sunshine-Microphone"sv;
+
+          index.mic_source = load_module("module-remap-source", ss.str());
+          if (index.mic_source == PA_INVALID_INDEX) {
+            BOOST_LOG(warning) << "Couldn't create the virtual microphone source: "sv << pa_strerror(pa_context_errno(ctx.get()));
+            return nullptr;
+          }
+        }
+
+        auto mic = ::platf::virtual_microphone(channels, sample_rate, mic_sink);
+        if (mic) {
+          BOOST_LOG(info) << "Playing the client microphone into ["sv << mic_source << ']';
+        }
+        return mic;
+      }
+
       bool is_sink_available(const std::string &sink) override {
         BOOST_LOG(warning) << "audio_control_t::is_sink_available() unimplemented: "sv << sink;
         return true;
@@ -498,6 +881,8 @@ namespace platf {
         unload_null(index.stereo);
         unload_null(index.surround51);
         unload_null(index.surround71);
+        unload_null(index.mic_source);
+        unload_null(index.mic_sink);
 
         if (worker.joinable()) {
           pa_context_disconnect(ctx.get());
@@ -3,6 +3,7 @@
  * @brief Definitions for CUDA encoding.
  */
 // standard includes
+#include <array>
 #include <bitset>
 #include <fcntl.h>
 #include <filesystem>
@@ -21,7 +22,11 @@ extern "C" {
 // local includes
 #include "cuda.h"
 #include "graphics.h"
+#include "src/config.h"
 #include "src/logging.h"
+#include "src/metrics.h"
+#include "src/nvenc/nvenc_cuda.h"
+#include "src/nvenc/nvenc_utils.h"
 #include "src/utility.h"
 #include "src/video.h"
 #include "wayland.h"
@@ -99,6 +104,11 @@ namespace cuda {
     return 0;
   }
 
+  void record_gpu_convert_time(std::uint64_t time_us) {
+    static auto &histogram = metrics::histogram("gpu_convert"sv);
+    histogram.record_us(time_us);
+  }
+
   class cuda_t: public platf::avcodec_encode_device_t {
   public:
     int init(int in_width, int in_height) {
@@ -116,8 +126,9 @@ namespace cuda {
     }
 
     int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx) override {
-      this->hwframe.reset(frame);
+      this->hwframes[0].reset(frame);
       this->frame = frame;
+      current_frame = 0;
 
       auto hwframe_ctx = (AVHWFramesContext *) hw_frames_ctx->data;
       if (hwframe_ctx->sw_format != AV_PIX_FMT_NV12) {
@@ -125,13 +136,27 @@ namespace cuda {
         return -1;
       }
 
-      if (!frame->buf[0]) {
-        if (av_hwframe_get_buffer(hw_frames_ctx, frame, 0)) {
-          BOOST_LOG(error) << "Couldn't get hwframe for NVENC"sv;
+      // The next frame is converted while NVENC still reads the previous one
+      for (std::size_t x = 1; x < hwframes.size(); ++x) {
+        hwframes[x].reset(av_frame_alloc());
+        hwframes[x]->format = frame->format;
+        hwframes[x]->width = frame->width;
+        hwframes[x]->height = frame->height;
+        if (av_frame_copy_props(hwframes[x].get(), frame) < 0) {
+          BOOST_LOG(error) << "Couldn't copy the properties of the NVENC hwframe"sv;
           return -1;
         }
       }
 
+      for (auto &hwframe : hwframes) {
+        if (!hwframe->buf[0]) {
+          if (av_hwframe_get_buffer(hw_frames_ctx, hwframe.get(), 0)) {
+            BOOST_LOG(error) << "Couldn't get hwframe for NVENC"sv;
+            return -1;
+          }
+        }
+      }
+
       auto cuda_ctx = (AVCUDADeviceContext *) hwframe_ctx->device_ctx->hwctx;
 
       stream = make_stream();
@@ -178,15 +203,33 @@ namespace cuda {
         return;
       }
 
-      sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex->texture.linear, stream.get(), {frame->width, frame->height, 0, 0});
+      for (auto &hwframe : hwframes) {
+        sws.convert(hwframe->data[0], hwframe->data[1], hwframe->linesize[0], hwframe->linesize[1], tex->texture.linear, stream.get(), {hwframe->width, hwframe->height, 0, 0});
+      }
     }
 
     cudaTextureObject_t tex_obj(const tex_t &tex) const {
       return linear_interpolation ? tex.texture.linear : tex.texture.point;
     }
 
+    /**
+     * @brief Move on to the other hardware frame before converting into it.
+     */
+    void advance_frame() {
+      auto previous = hwframes[current_frame].get();
+      current_frame = (current_frame + 1) % hwframes.size();
+      auto next = hwframes[current_frame].get();
+
+      // A keyframe may have been requested before the frame was converted
+      next->pict_type = previous->pict_type;
+      next->flags = (next->flags & ~AV_FRAME_FLAG_KEY) | (previous->flags & AV_FRAME_FLAG_KEY);
+
+      frame = next;
+    }
+
     stream_t stream;
-    frame_t hwframe;
+    std::array<frame_t, 2> hwframes;
+    std::size_t current_frame = 0;
 
     int width, height;
 
@@ -199,6 +242,8 @@ namespace cuda {
   class cuda_ram_t: public cuda_t {
   public:
     int convert(platf::img_t &img) override {
+      advance_frame();
+
       return sws.load_ram(img, tex.array) || sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(tex), stream.get());
     }
 
@@ -223,10 +268,137 @@ namespace cuda {
   class cuda_vram_t: public cuda_t {
   public:
     int convert(platf::img_t &img) override {
+      advance_frame();
+
       return sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(((img_t *) &img)->tex), stream.get());
     }
   };
 
+  /**
+   * @brief Converts into the input surface of a native NVENC encoder, without going through libavcodec.
+   */
+  class nvenc_t: public platf::nvenc_encode_device_t {
+  public:
+    int init(int in_width, int in_height, bool in_vram) {
+      if (!cdf) {
+        BOOST_LOG(warning) << "cuda not initialized"sv;
+        return -1;
+      }
+
+      width = in_width;
+      height = in_height;
+      vram = in_vram;
+
+      if (!vram) {
+        auto tex_opt = tex_t::make(height, width * 4);
+        if (!tex_opt) {
+          return -1;
+        }
+
+        tex = std::move(*tex_opt);
+      }
+
+      stream = make_stream();
+      if (!stream) {
+        return -1;
+      }
+
+      return 0;
+    }
+
+    bool init_encoder(const ::video::config_t &client_config, const ::video::sunshine_colorspace_t &colorspace) override {
+      if (colorspace.bit_depth != 8 || client_config.chromaSamplingType != 0) {
+        BOOST_LOG(error) << "cuda::nvenc_t doesn't support any format other than NV12"sv;
+        return false;
+      }
+
+      nvenc_cuda = std::make_unique<nvenc::nvenc_cuda>(stream.get());
+
+      auto nvenc_colorspace = nvenc::nvenc_colorspace_from_sunshine_colorspace(colorspace);
+      if (!nvenc_cuda->create_encoder(::video::nvenc_config_for_profile(config::video.nv, client_config), client_config, nvenc_colorspace, NV_ENC_BUFFER_FORMAT_NV12)) {
+        return false;
+      }
+      nvenc = nvenc_cuda.get();
+
+      out_width = client_config.width;
+      out_height = client_config.height;
+
+      auto sws_opt = sws_t::make(width, height, out_width, out_height, width * 4);
+      if (!sws_opt) {
+        return false;
+      }
+
+      sws = std::move(*sws_opt);
+      sws.apply_colorspace(colorspace);
+
+      linear_interpolation = width != out_width || height != out_height;
+
+      // The default green color is ugly.
+      // Update the background color
+      auto blank_tex = tex_t::make(height, width * 4);
+      if (!blank_tex) {
+        return false;
+      }
+
+      platf::img_t img;
+      img.width = width;
+      img.height = height;
+      img.pixel_pitch = 4;
+      img.row_pitch = img.width * img.pixel_pitch;
+
+      std::vector<std::uint8_t> image_data;
+      image_data.resize(img.row_pitch * img.height);
+
+      img.data = image_data.data();
+
+      if (sws.load_ram(img, blank_tex->array)) {
+        return false;
+      }
+
+      return sws.convert(Y(), UV(), pitch(), pitch(), blank_tex->texture.linear, stream.get(), {out_width, out_height, 0, 0}) == 0;
+    }
+
+    int convert(platf::img_t &img) override {
+      if (vram) {
+        return sws.convert(Y(), UV(), pitch(), pitch(), tex_obj(((img_t *) &img)->tex), stream.get());
+      }
+
+      return sws.load_ram(img, tex.array) || sws.convert(Y(), UV(), pitch(), pitch(), tex_obj(tex), stream.get());
+    }
+
+  private:
+    std::uint8_t *Y() const {
+      return (std::uint8_t *) nvenc_cuda->get_input_surface();
+    }
+
+    std::uint8_t *UV() const {
+      // NV12, the chroma plane directly follows the luma plane
+      return Y() + pitch() * out_height;
+    }
+
+    std::uint32_t pitch() const {
+      return nvenc_cuda->get_input_pitch();
+    }
+
+    cudaTextureObject_t tex_obj(const tex_t &tex) const {
+      return linear_interpolation ? tex.texture.linear : tex.texture.point;
+    }
+
+    // Declared before the encoder, NVENC has to be done with the stream before it's destroyed
+    stream_t stream;
+    std::unique_ptr<nvenc::nvenc_cuda> nvenc_cuda;
+
+    int width, height;
+    int out_width, out_height;
+    bool vram;
+
+    // When height and width don't change, it's not necessary to use linear interpolation
+    bool linear_interpolation;
+
+    tex_t tex;
+    sws_t sws;
+  };
+
   /**
    * @brief Opens the DRM device associated with the CUDA device index.
    * @param index CUDA device index to open.
@@ -372,6 +544,13 @@ namespace cuda {
       return 0;
     }
 
+    void rebind() override {
+      // The images of the new display are numbered from the start again
+      sequence = 0;
+      rgb = nullptr;
+      imports.clear();
+    }
+
     /**
      * @brief Convert the captured image into the target CUDA frame.
      * @param img Captured screen image.
@@ -382,23 +561,19 @@ namespace cuda {
 
       if (descriptor.sequence == 0) {
         // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
-        rgb = egl::create_blank(img);
+        blank = egl::create_blank(img);
+        rgb = &blank;
       } else if (descriptor.sequence > sequence) {
         sequence = descriptor.sequence;
 
-        rgb = egl::rgb_t {};
-
-        auto rgb_opt = egl::import_source(display.get(), descriptor.sd);
-
-        if (!rgb_opt) {
+        rgb = imports.import(display.get(), descriptor.sd);
+        if (!rgb) {
           return -1;
         }
-
-        rgb = std::move(*rgb_opt);
       }
 
       // Perform the color conversion and scaling in GL
-      sws.load_vram(descriptor, offset_x, offset_y, rgb->tex[0]);
+      sws.load_vram(descriptor, offset_x, offset_y, (*rgb)->tex[0]);
       sws.convert(nv12->buf);
 
       auto fmt_desc = av_pix_fmt_desc_get(sw_format);
@@ -450,7 +625,9 @@ namespace cuda {
     int width, height;
 
     std::uint64_t sequence;
-    egl::rgb_t rgb;
+    egl::rgb_t blank;
+    egl::import_cache_t imports;
+    const egl::rgb_t *rgb = nullptr;  ///< Either the blank texture or an import
 
     registered_resource_t y_res;
     registered_resource_t uv_res;
@@ -478,6 +655,19 @@ namespace cuda {
     return cuda;
   }
 
+  std::unique_ptr<platf::nvenc_encode_device_t> make_nvenc_encode_device(int width, int height, bool vram) {
+    if (init()) {
+      return nullptr;
+    }
+
+    auto nvenc = std::make_unique<nvenc_t>();
+    if (nvenc->init(width, height, vram)) {
+      return nullptr;
+    }
+
+    return nvenc;
+  }
+
   /**
    * @brief Create a GL->CUDA encoding device for consuming captured dmabufs.
    * @param width Width of captured frames.
@@ -933,6 +1123,14 @@ namespace cuda {
         return ::cuda::make_avcodec_encode_device(width, height, true);
       }
 
+      std::unique_ptr<platf::nvenc_encode_device_t> make_nvenc_encode_device(platf::pix_fmt_e pix_fmt) override {
+        if (pix_fmt != platf::pix_fmt_e::nv12) {
+          return nullptr;
+        }
+
+        return ::cuda::make_nvenc_encode_device(width, height, true);
+      }
+
       std::shared_ptr<platf::img_t> alloc_img() override {
         auto img = std::make_shared<cuda::img_t>();
 
@@ -3,6 +3,7 @@
  * @brief CUDA implementation for Linux.
  */
 // standard includes
+#include <algorithm>
 #include <chrono>
 #include <limits>
 #include <memory>
@@ -116,6 +117,82 @@ namespace cuda {
     CU_CHECK_IGNORE(cudaStreamDestroy(ptr), "Couldn't free cuda stream");
   }
 
+  void freeCudaGraph_t::operator()(cudaGraph_t ptr) {
+    CU_CHECK_IGNORE(cudaGraphDestroy(ptr), "Couldn't free cuda graph");
+  }
+
+  void freeCudaGraphExec_t::operator()(cudaGraphExec_t ptr) {
+    CU_CHECK_IGNORE(cudaGraphExecDestroy(ptr), "Couldn't free cuda graph exec");
+  }
+
+  void freeCudaEvent_t::operator()(cudaEvent_t ptr) {
+    CU_CHECK_IGNORE(cudaEventDestroy(ptr), "Couldn't free cuda event");
+  }
+
+  gpu_timer_t gpu_timer_t::make(void (*record)(std::uint64_t time_us)) {
+    gpu_timer_t timer;
+
+    for (auto &slot : timer.slots) {
+      cudaEvent_t begin, end;
+      if (CU_CHECK_IGNORE(cudaEventCreate(&begin), "Couldn't create cuda event")) {
+        return {};
+      }
+      slot.begin.reset(begin);
+
+      if (CU_CHECK_IGNORE(cudaEventCreate(&end), "Couldn't create cuda event")) {
+        return {};
+      }
+      slot.end.reset(end);
+    }
+
+    timer.record = record;
+    return timer;
+  }
+
+  void gpu_timer_t::begin(stream_t::pointer stream) {
+    if (!record) {
+      return;
+    }
+
+    collect();
+
+    auto &slot = slots[next_slot];
+    if (slot.pending) {
+      return;
+    }
+
+    measuring = !CU_CHECK_IGNORE(cudaEventRecord(slot.begin.get(), stream), "Couldn't record cuda event");
+  }
+
+  void gpu_timer_t::end(stream_t::pointer stream) {
+    if (!measuring) {
+      return;
+    }
+    measuring = false;
+
+    auto &slot = slots[next_slot];
+    if (CU_CHECK_IGNORE(cudaEventRecord(slot.end.get(), stream), "Couldn't record cuda event")) {
+      return;
+    }
+
+    slot.pending = true;
+    next_slot = (next_slot + 1) % slots.size();
+  }
+
+  void gpu_timer_t::collect() {
+    for (auto &slot : slots) {
+      if (!slot.pending || cudaEventQuery(slot.end.get()) != cudaSuccess) {
+        continue;
+      }
+      slot.pending = false;
+
+      float time_ms;
+      if (!CU_CHECK_IGNORE(cudaEventElapsedTime(&time_ms, slot.begin.get(), slot.end.get()), "Couldn't get elapsed time of cuda events")) {
+        record((std::uint64_t) (time_ms * 1000.0f));
+      }
+    }
+  }
+
   stream_t make_stream(int flags) {
     cudaStream_t stream;
 
@@ -297,6 +374,8 @@ namespace cuda {
     viewport.offsetY = offsetY_f;
 
     scale = 1.0f / scalar;
+
+    convert_timer = gpu_timer_t::make(record_gpu_convert_time);
   }
 
   std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, int pitch) {
@@ -318,15 +397,110 @@ namespace cuda {
   }
 
   int sws_t::convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport) {
+    convert_timer.begin(stream);
+
+    int status;
+    if (auto graph = graph_for(Y, UV, pitchY, pitchUV, texture, viewport)) {
+      status = CU_CHECK_IGNORE(cudaGraphLaunch(graph->exec.get(), stream), "Couldn't launch RGBA_to_NV12 graph");
+    } else {
+      int threadsX = viewport.width / 2;
+      int threadsY = viewport.height / 2;
+
+      dim3 block(threadsPerBlock);
+      dim3 grid(div_align(threadsX, threadsPerBlock), threadsY);
+
+      RGBA_to_NV12<<<grid, block, 0, stream>>>(texture, Y, UV, pitchY, pitchUV, scale, viewport, (cuda_color_t *) color_matrix.get());
+
+      status = CU_CHECK_IGNORE(cudaGetLastError(), "RGBA_to_NV12 failed");
+    }
+
+    convert_timer.end(stream);
+
+    return status;
+  }
+
+  conversion_graph_t *sws_t::graph_for(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, const viewport_t &viewport) {
+    // Enough for double buffered output frames and the blank frame of apply_colorspace()
+    constexpr std::size_t max_graphs = 4;
+
+    if (graphs_failed) {
+      return nullptr;
+    }
+
+    auto same_args = [&](const conversion_graph_t &graph) {
+      return graph.Y == Y && graph.UV == UV && graph.pitchY == pitchY && graph.pitchUV == pitchUV && graph.texture == texture &&
+             graph.viewport.width == viewport.width && graph.viewport.height == viewport.height &&
+             graph.viewport.offsetX == viewport.offsetX && graph.viewport.offsetY == viewport.offsetY;
+    };
+
+    auto it = std::find_if(std::begin(graphs), std::end(graphs), same_args);
+    if (it != std::end(graphs)) {
+      // Keep the most recently used graph last, so the least recently used one is updated first
+      std::rotate(it, it + 1, std::end(graphs));
+      return &graphs.back();
+    }
+
     int threadsX = viewport.width / 2;
     int threadsY = viewport.height / 2;
 
-    dim3 block(threadsPerBlock);
-    dim3 grid(div_align(threadsX, threadsPerBlock), threadsY);
+    // Kernel arguments are copied when the node is added or updated
+    float scale = this->scale;
+    auto color = (const cuda_color_t *) color_matrix.get();
+    auto viewport_arg = viewport;
+    void *args[] {&texture, &Y, &UV, &pitchY, &pitchUV, &scale, &viewport_arg, &color};
+
+    cudaKernelNodeParams params {};
+    params.func = (void *) RGBA_to_NV12;
+    params.gridDim = dim3(div_align(threadsX, threadsPerBlock), threadsY);
+    params.blockDim = dim3(threadsPerBlock);
+    params.kernelParams = args;
+
+    // The error is logged already, the kernel is launched directly from now on
+    auto fail = [this]() -> conversion_graph_t * {
+      graphs.clear();
+      graphs_failed = true;
+      return nullptr;
+    };
+
+    if (graphs.size() >= max_graphs) {
+      // Point the least recently used graph at the new frame instead of instantiating another one
+      auto &graph = graphs.front();
+      if (CU_CHECK_IGNORE(cudaGraphExecKernelNodeSetParams(graph.exec.get(), graph.node, &params), "Couldn't update RGBA_to_NV12 graph")) {
+        return fail();
+      }
+
+      std::rotate(std::begin(graphs), std::begin(graphs) + 1, std::end(graphs));
+    } else {
+      conversion_graph_t graph {};
+
+      cudaGraph_t raw_graph;
+      if (CU_CHECK_IGNORE(cudaGraphCreate(&raw_graph, 0), "Couldn't create RGBA_to_NV12 graph")) {
+        return fail();
+      }
+      graph.graph.reset(raw_graph);
+
+      if (CU_CHECK_IGNORE(cudaGraphAddKernelNode(&graph.node, raw_graph, nullptr, 0, &params), "Couldn't add RGBA_to_NV12 to graph")) {
+        return fail();
+      }
+
+      cudaGraphExec_t exec;
+      if (CU_CHECK_IGNORE(cudaGraphInstantiateWithFlags(&exec, raw_graph, 0), "Couldn't instantiate RGBA_to_NV12 graph")) {
+        return fail();
+      }
+      graph.exec.reset(exec);
+
+      graphs.push_back(std::move(graph));
+    }
 
-    RGBA_to_NV12<<<grid, block, 0, stream>>>(texture, Y, UV, pitchY, pitchUV, scale, viewport, (cuda_color_t *) color_matrix.get());
+    auto &graph = graphs.back();
+    graph.Y = Y;
+    graph.UV = UV;
+    graph.pitchY = pitchY;
+    graph.pitchUV = pitchUV;
+    graph.texture = texture;
+    graph.viewport = viewport;
 
-    return CU_CHECK_IGNORE(cudaGetLastError(), "RGBA_to_NV12 failed");
+    return &graph;
   }
 
   void sws_t::apply_colorspace(const video::sunshine_colorspace_t &colorspace) {
@@ -6,6 +6,7 @@
 
 #if defined(SUNSHINE_BUILD_CUDA)
   // standard includes
+  #include <array>
   #include <cstdint>
   #include <memory>
   #include <optional>
@@ -18,6 +19,7 @@
 namespace platf {
   struct avcodec_encode_device_t;
   struct img_t;
+  struct nvenc_encode_device_t;
 }  // namespace platf
 
 namespace cuda {
@@ -28,6 +30,15 @@ namespace cuda {
 
   std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, bool vram);
 
+  /**
+   * @brief Create a CUDA encoding device that feeds NVENC directly instead of going through FFmpeg.
+   * @param width Width of captured frames.
+   * @param height Height of captured frames.
+   * @param vram `true` if captured frames are already CUDA textures, `false` for frames in system memory.
+   * @return Native NVENC encoding device.
+   */
+  std::unique_ptr<platf::nvenc_encode_device_t> make_nvenc_encode_device(int width, int height, bool vram);
+
   /**
    * @brief Create a GL->CUDA encoding device for consuming captured dmabufs.
    * @param in_width Width of captured frames.
@@ -39,9 +50,20 @@ namespace cuda {
   std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_gl_encode_device(int width, int height, int offset_x, int offset_y);
 
   int init();
+
+  /**
+   * @brief Record the GPU time of a frame conversion.
+   * @details Defined outside of the CUDA sources, which stay clear of the metrics registry.
+   * @param time_us The GPU time in microseconds.
+   */
+  void record_gpu_convert_time(std::uint64_t time_us);
 }  // namespace cuda
 
 typedef struct cudaArray *cudaArray_t;
+typedef struct CUgraph_st *cudaGraph_t;
+typedef struct CUgraphNode_st *cudaGraphNode_t;
+typedef struct CUgraphExec_st *cudaGraphExec_t;
+typedef struct CUevent_st *cudaEvent_t;
 
   #if !defined(__CUDACC__)
 typedef struct CUstream_st *cudaStream_t;
@@ -63,8 +85,26 @@ namespace cuda {
     void operator()(cudaStream_t ptr);
   };
 
+  class freeCudaGraph_t {
+  public:
+    void operator()(cudaGraph_t ptr);
+  };
+
+  class freeCudaGraphExec_t {
+  public:
+    void operator()(cudaGraphExec_t ptr);
+  };
+
+  class freeCudaEvent_t {
+  public:
+    void operator()(cudaEvent_t ptr);
+  };
+
   using ptr_t = std::unique_ptr<void, freeCudaPtr_t>;
   using stream_t = std::unique_ptr<CUstream_st, freeCudaStream_t>;
+  using graph_t = std::unique_ptr<CUgraph_st, freeCudaGraph_t>;
+  using graph_exec_t = std::unique_ptr<CUgraphExec_st, freeCudaGraphExec_t>;
+  using event_t = std::unique_ptr<CUevent_st, freeCudaEvent_t>;
 
   stream_t make_stream(int flags = 0);
 
@@ -73,6 +113,22 @@ namespace cuda {
     int offsetX, offsetY;
   };
 
+  /**
+   * @brief A conversion kernel instantiated as a CUDA graph, replayed as long as its arguments stay the same.
+   */
+  struct conversion_graph_t {
+    graph_t graph;
+    graph_exec_t exec;
+    cudaGraphNode_t node;
+
+    std::uint8_t *Y;
+    std::uint8_t *UV;
+    std::uint32_t pitchY;
+    std::uint32_t pitchUV;
+    cudaTextureObject_t texture;
+    viewport_t viewport;
+  };
+
   class tex_t {
   public:
     static std::optional<tex_t> make(int height, int pitch);
@@ -94,6 +150,41 @@ namespace cuda {
     } texture;
   };
 
+  /**
+   * @brief Measures the GPU time of the work queued on a stream between begin() and end() with events.
+   * @details The results are read back a few frames later without synchronizing the stream.
+   *          A frame is not measured while all event slots are still pending.
+   */
+  class gpu_timer_t {
+  public:
+    /**
+     * @brief Create the events.
+     * @param record Called with the GPU time in microseconds of every finished measurement.
+     * @return The timer, it stays disabled if the events couldn't be created.
+     */
+    static gpu_timer_t make(void (*record)(std::uint64_t time_us));
+
+    void begin(stream_t::pointer stream);
+    void end(stream_t::pointer stream);
+
+  private:
+    /**
+     * @brief Report the measurements the GPU has finished.
+     */
+    void collect();
+
+    struct slot_t {
+      event_t begin;
+      event_t end;
+      bool pending = false;  ///< Whether the result has not been read yet
+    };
+
+    std::array<slot_t, 4> slots;
+    std::size_t next_slot = 0;
+    bool measuring = false;
+    void (*record)(std::uint64_t time_us) = nullptr;  ///< nullptr while disabled
+  };
+
   class sws_t {
   public:
     sws_t() = default;
@@ -122,6 +213,18 @@ namespace cuda {
     viewport_t viewport;
 
     float scale;
+
+    gpu_timer_t convert_timer;
+
+  private:
+    /**
+     * @brief Get the graph that converts into an output frame, recording it on first use.
+     * @return The graph, or nullptr if the kernel has to be launched directly.
+     */
+    conversion_graph_t *graph_for(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, const viewport_t &viewport);
+
+    std::vector<conversion_graph_t> graphs;  ///< One per output frame, most recently used last
+    bool graphs_failed = false;  ///< The driver can't run graphs, launch the kernel directly
   };
 }  // namespace cuda
 
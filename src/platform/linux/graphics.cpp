@@ -3,7 +3,9 @@
  * @brief Definitions for graphics related functions.
  */
 // standard includes
+#include <cstring>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 // local includes
 #include "graphics.h"
@@ -85,6 +87,86 @@ namespace gl {
     gl::ctx.CopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, offset_x, offset_y, width, height);
   }
 
+  query_t::~query_t() {
+    if (size() != 0) {
+      ctx.DeleteQueries(size(), begin());
+    }
+  }
+
+  query_t query_t::make(std::size_t count) {
+    query_t queries {count};
+
+    ctx.GenQueries(queries.size(), queries.begin());
+
+    return queries;
+  }
+
+  gpu_timer_t gpu_timer_t::make(std::string_view histogram_name) {
+    gpu_timer_t timer;
+
+    // Timer queries are core since OpenGL 3.3
+    if (!ctx.QueryCounter || !ctx.GetQueryObjectui64v) {
+      BOOST_LOG(warning) << "Timer queries are not supported, GPU time won't be recorded into "sv << histogram_name;
+      return timer;
+    }
+
+    timer.queries = query_t::make(slot_count * 2);
+    timer.histogram = &metrics::histogram(histogram_name);
+
+    return timer;
+  }
+
+  void gpu_timer_t::begin() {
+    if (!histogram) {
+      return;
+    }
+
+    collect();
+
+    if (pending[next_slot]) {
+      return;
+    }
+
+    // Restarting a measurement that never ended simply overwrites its begin timestamp
+    ctx.QueryCounter(queries[next_slot * 2], GL_TIMESTAMP);
+    measuring = true;
+  }
+
+  void gpu_timer_t::end() {
+    if (!measuring) {
+      return;
+    }
+
+    ctx.QueryCounter(queries[next_slot * 2 + 1], GL_TIMESTAMP);
+
+    pending[next_slot] = true;
+    next_slot = (next_slot + 1) % slot_count;
+    measuring = false;
+  }
+
+  void gpu_timer_t::collect() {
+    for (std::size_t x = 0; x < slot_count; ++x) {
+      if (!pending[x]) {
+        continue;
+      }
+
+      // The end timestamp is written last
+      GLint available = GL_FALSE;
+      ctx.GetQueryObjectiv(queries[x * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available) {
+        continue;
+      }
+      pending[x] = false;
+
+      GLuint64 begin_ns, end_ns;
+      ctx.GetQueryObjectui64v(queries[x * 2], GL_QUERY_RESULT, &begin_ns);
+      ctx.GetQueryObjectui64v(queries[x * 2 + 1], GL_QUERY_RESULT, &end_ns);
+      if (end_ns >= begin_ns) {
+        histogram->record_us((end_ns - begin_ns) / 1000);
+      }
+    }
+  }
+
   std::string shader_t::err_str() {
     int length;
     ctx.GetShaderiv(handle(), GL_INFO_LOG_LENGTH, &length);
@@ -559,6 +641,51 @@ namespace egl {
     return rgb;
   }
 
+  const rgb_t *import_cache_t::import(display_t::pointer egl_display, const surface_descriptor_t &xrgb) {
+    std::array<ino_t, 4> inodes {};
+    for (auto x = 0; x < 4; ++x) {
+      struct stat st;
+      if (xrgb.fds[x] >= 0 && !fstat(xrgb.fds[x], &st)) {
+        inodes[x] = st.st_ino;
+      }
+    }
+
+    auto same_layout = [&](const surface_descriptor_t &sd) {
+      return sd.width == xrgb.width && sd.height == xrgb.height &&
+             sd.fourcc == xrgb.fourcc && sd.modifier == xrgb.modifier &&
+             !std::memcmp(sd.pitches, xrgb.pitches, sizeof(sd.pitches)) &&
+             !std::memcmp(sd.offsets, xrgb.offsets, sizeof(sd.offsets));
+    };
+
+    // Without a readable inode the buffer can't be recognized
+    if (inodes[0]) {
+      for (auto it = std::begin(entries); it != std::end(entries); ++it) {
+        if (it->inodes == inodes && same_layout(it->sd)) {
+          entries.splice(std::begin(entries), entries, it);
+          return &entries.front().rgb;
+        }
+      }
+    }
+
+    auto rgb_opt = import_source(egl_display, xrgb);
+    if (!rgb_opt) {
+      return nullptr;
+    }
+
+    if (!inodes[0]) {
+      entries.clear();
+    } else if (entries.size() >= max_imports) {
+      entries.pop_back();
+    }
+
+    entries.emplace_front(entry_t {inodes, xrgb, std::move(*rgb_opt)});
+    return &entries.front().rgb;
+  }
+
+  void import_cache_t::clear() {
+    entries.clear();
+  }
+
   /**
    * @brief Create a black RGB texture of the specified image size.
    * @param img The image to use for texture sizing.
@@ -835,6 +962,9 @@ namespace egl {
     sws.program[0].bind(sws.color_matrix);
     sws.program[1].bind(sws.color_matrix);
 
+    sws.convert_timer = gl::gpu_timer_t::make("gpu_convert"sv);
+    sws.cursor_timer = gl::gpu_timer_t::make("gpu_cursor"sv);
+
     gl::ctx.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     gl_drain_errors;
@@ -911,6 +1041,8 @@ namespace egl {
     }
 
     if (img.data) {
+      cursor_timer.begin();
+
       GLenum attachment = GL_COLOR_ATTACHMENT0;
 
       gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, cursor_framebuffer[0]);
@@ -953,10 +1085,14 @@ namespace egl {
 
       gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
       gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+      cursor_timer.end();
     }
   }
 
   int sws_t::convert(gl::frame_buf_t &fb) {
+    convert_timer.begin();
+
     gl::ctx.BindTexture(GL_TEXTURE_2D, loaded_texture);
 
     GLenum attachments[] {
@@ -983,6 +1119,8 @@ namespace egl {
 
     gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
 
+    convert_timer.end();
+
     gl::ctx.Flush();
 
     return 0;
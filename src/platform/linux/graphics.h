@@ -5,9 +5,14 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <list>
 #include <optional>
 #include <string_view>
 
+// platform includes
+#include <sys/types.h>
+
 // lib includes
 #include <glad/egl.h>
 #include <glad/gl.h>
@@ -15,6 +20,7 @@
 // local includes
 #include "misc.h"
 #include "src/logging.h"
+#include "src/metrics.h"
 #include "src/platform/common.h"
 #include "src/utility.h"
 #include "src/video_colorspace.h"
@@ -97,6 +103,50 @@ namespace gl {
     void copy(int id, int texture, int offset_x, int offset_y, int width, int height);
   };
 
+  class query_t: public util::buffer_t<GLuint> {
+    using util::buffer_t<GLuint>::buffer_t;
+
+  public:
+    query_t(query_t &&) = default;
+    query_t &operator=(query_t &&) = default;
+
+    ~query_t();
+
+    static query_t make(std::size_t count);
+  };
+
+  /**
+   * @brief Measures the GPU time of the commands between begin() and end() with timestamp queries.
+   * @details The results are read back a few frames later without stalling the pipeline.
+   *          A frame is not measured while all query slots are still pending.
+   */
+  class gpu_timer_t {
+  public:
+    /**
+     * @brief Create the queries in the current context.
+     * @param histogram_name The histogram the GPU time is recorded into.
+     * @return The timer, it stays disabled if the context lacks timer queries.
+     */
+    static gpu_timer_t make(std::string_view histogram_name);
+
+    void begin();
+    void end();
+
+  private:
+    /**
+     * @brief Record the results of the queries the GPU has finished.
+     */
+    void collect();
+
+    static constexpr std::size_t slot_count = 4;
+
+    query_t queries;  ///< The begin and end timestamp of each slot
+    std::array<bool, slot_count> pending {};  ///< Whether the results of a slot have not been read yet
+    std::size_t next_slot = 0;
+    bool measuring = false;
+    metrics::histogram_t *histogram = nullptr;  ///< nullptr while disabled
+  };
+
   class shader_t {
     KITTY_USING_MOVE_T(shader_internal_t, GLuint, std::numeric_limits<GLuint>::max(), {
       if (el != std::numeric_limits<GLuint>::max()) {
@@ -248,6 +298,40 @@ namespace egl {
 
   rgb_t create_blank(platf::img_t &img);
 
+  /**
+   * @brief Keeps the imports of recently captured DMA-BUFs.
+   * @details Compositors flip between two or three framebuffers, so most captured frames are a buffer
+   *          that was already imported. Buffers are recognized by the inodes of their DMA-BUFs, which
+   *          are the same for every fd exported from a buffer. The imports hold a reference on their
+   *          buffers, so an inode can't be reused by a new buffer while it is cached.
+   */
+  class import_cache_t {
+  public:
+    static constexpr std::size_t max_imports = 4;
+
+    /**
+     * @brief Get the texture of a DMA-BUF, importing it if it isn't cached.
+     * @param egl_display The EGL display.
+     * @param xrgb The DMA-BUF, its fds are not kept.
+     * @return The texture, valid until `max_imports` other buffers were imported, or `nullptr` on failure.
+     */
+    const rgb_t *import(display_t::pointer egl_display, const surface_descriptor_t &xrgb);
+
+    /**
+     * @brief Release all imports.
+     */
+    void clear();
+
+  private:
+    struct entry_t {
+      std::array<ino_t, 4> inodes;
+      surface_descriptor_t sd;  ///< Layout of the buffer when imported, the fds are stale
+      rgb_t rgb;
+    };
+
+    std::list<entry_t> entries;  ///< Most recently used first
+  };
+
   std::optional<nv12_t> import_target(
     display_t::pointer egl_display,
     std::array<file_t, nv12_img_t::num_fds> &&fds,
@@ -334,6 +418,9 @@ namespace egl {
 
     // Store latest cursor for load_vram
     std::uint64_t serial;
+
+    gl::gpu_timer_t convert_timer;
+    gl::gpu_timer_t cursor_timer;
   };
 
   bool fail();
@@ -69,6 +69,19 @@ namespace platf {
     platf::keyboard::unicode(raw, utf8, size);
   }
 
+  void begin_input_batch(input_t &input) {
+    auto raw = (input_raw_t *) input.get();
+    raw->batching = true;
+  }
+
+  void end_input_batch(input_t &input) {
+    auto raw = (input_raw_t *) input.get();
+    raw->batching = false;
+
+    platf::mouse::flush(raw);
+    platf::gamepad::flush(raw);
+  }
+
   void touch_update(client_input_t *input, const touch_port_t &touch_port, const touch_input_t &touch) {
     auto raw = (client_input_raw_t *) input;
     platf::touch::update(raw, touch_port, touch);
@@ -4,6 +4,9 @@
  */
 #pragma once
 
+// standard includes
+#include <optional>
+
 // lib includes
 #include <boost/locale.hpp>
 #include <inputtino/input.hpp>
@@ -25,6 +28,9 @@ namespace platf {
     std::unique_ptr<joypads_t> joypad;
     gamepad_feedback_msg_t last_rumble;
     gamepad_feedback_msg_t last_rgb_led;
+
+    std::optional<gamepad_state_t> applied;  ///< State last written to the device
+    std::optional<gamepad_state_t> pending;  ///< State queued during an input batch
   };
 
   struct input_raw_t {
@@ -56,6 +62,15 @@ namespace platf {
     inputtino::Result<inputtino::Mouse> mouse;
     inputtino::Result<inputtino::Keyboard> keyboard;
 
+    /**
+     * Set between begin_input_batch() and end_input_batch().
+     * inputtino ends each call with its own SYN_REPORT, so a batch merges the relative mouse
+     * motion and the axis changes of each gamepad into as few calls as possible.
+     */
+    bool batching = false;
+    int pending_dx = 0;  ///< Relative mouse motion queued during the batch
+    int pending_dy = 0;  ///< Relative mouse motion queued during the batch
+
     /**
      * A list of gamepads that are currently connected.
      * The pointer is shared because that state will be shared with background threads that deal with rumble and LED
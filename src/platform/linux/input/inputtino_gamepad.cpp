@@ -185,19 +185,58 @@ namespace platf::gamepad {
     raw->gamepads[nr].reset();
   }
 
+  /**
+   * @brief Write the parts of a state that changed since the last one written.
+   * @details Each inputtino call is reported on its own, so games would otherwise
+   *          see a report per part even when only a stick moved.
+   */
+  void apply(joypad_state &gamepad, const gamepad_state_t &gamepad_state) {
+    auto &applied = gamepad.applied;
+
+    std::visit([&](inputtino::Joypad &gc) {
+      if (!applied || applied->buttonFlags != gamepad_state.buttonFlags) {
+        gc.set_pressed_buttons(gamepad_state.buttonFlags);
+      }
+      if (!applied || applied->lsX != gamepad_state.lsX || applied->lsY != gamepad_state.lsY) {
+        gc.set_stick(inputtino::Joypad::LS, gamepad_state.lsX, gamepad_state.lsY);
+      }
+      if (!applied || applied->rsX != gamepad_state.rsX || applied->rsY != gamepad_state.rsY) {
+        gc.set_stick(inputtino::Joypad::RS, gamepad_state.rsX, gamepad_state.rsY);
+      }
+      if (!applied || applied->lt != gamepad_state.lt || applied->rt != gamepad_state.rt) {
+        gc.set_triggers(gamepad_state.lt, gamepad_state.rt);
+      }
+    },
+               *gamepad.joypad);
+
+    applied = gamepad_state;
+  }
+
   void update(input_raw_t *raw, int nr, const gamepad_state_t &gamepad_state) {
     auto gamepad = raw->gamepads[nr];
     if (!gamepad) {
       return;
     }
 
-    std::visit([gamepad_state](inputtino::Joypad &gc) {
-      gc.set_pressed_buttons(gamepad_state.buttonFlags);
-      gc.set_stick(inputtino::Joypad::LS, gamepad_state.lsX, gamepad_state.lsY);
-      gc.set_stick(inputtino::Joypad::RS, gamepad_state.rsX, gamepad_state.rsY);
-      gc.set_triggers(gamepad_state.lt, gamepad_state.rt);
-    },
-               *gamepad->joypad);
+    if (!raw->batching) {
+      apply(*gamepad, gamepad_state);
+      return;
+    }
+
+    // Only axis changes are merged, so presses shorter than a batch still reach the games
+    if (gamepad->pending && gamepad->pending->buttonFlags != gamepad_state.buttonFlags) {
+      apply(*gamepad, *gamepad->pending);
+    }
+    gamepad->pending = gamepad_state;
+  }
+
+  void flush(input_raw_t *raw) {
+    for (auto &gamepad : raw->gamepads) {
+      if (gamepad && gamepad->pending) {
+        apply(*gamepad, *gamepad->pending);
+        gamepad->pending.reset();
+      }
+    }
   }
 
   void touch(input_raw_t *raw, const gamepad_touch_t &touch) {
@@ -29,6 +29,12 @@ namespace platf::gamepad {
 
   void update(input_raw_t *raw, int nr, const gamepad_state_t &gamepad_state);
 
+  /**
+   * @brief Write the gamepad states queued during an input batch.
+   * @param raw The global input context.
+   */
+  void flush(input_raw_t *raw);
+
   void touch(input_raw_t *raw, const gamepad_touch_t &touch);
 
   void motion(input_raw_t *raw, const gamepad_motion_t &motion);
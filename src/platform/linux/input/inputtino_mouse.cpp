@@ -20,18 +20,32 @@ using namespace std::literals;
 namespace platf::mouse {
 
   void move(input_raw_t *raw, int deltaX, int deltaY) {
-    if (raw->mouse) {
+    if (raw->batching) {
+      raw->pending_dx += deltaX;
+      raw->pending_dy += deltaY;
+    } else if (raw->mouse) {
       (*raw->mouse).move(deltaX, deltaY);
     }
   }
 
+  void flush(input_raw_t *raw) {
+    if (raw->mouse && (raw->pending_dx || raw->pending_dy)) {
+      (*raw->mouse).move(raw->pending_dx, raw->pending_dy);
+    }
+    raw->pending_dx = 0;
+    raw->pending_dy = 0;
+  }
+
   void move_abs(input_raw_t *raw, const touch_port_t &touch_port, float x, float y) {
+    flush(raw);
     if (raw->mouse) {
       (*raw->mouse).move_abs(x, y, touch_port.width, touch_port.height);
     }
   }
 
   void button(input_raw_t *raw, int button, bool release) {
+    // Clicks land where the motion before them led
+    flush(raw);
     if (raw->mouse) {
       inputtino::Mouse::MOUSE_BUTTON btn_type;
       switch (button) {
@@ -63,12 +77,14 @@ namespace platf::mouse {
   }
 
   void scroll(input_raw_t *raw, int high_res_distance) {
+    flush(raw);
     if (raw->mouse) {
       (*raw->mouse).vertical_scroll(high_res_distance);
     }
   }
 
   void hscroll(input_raw_t *raw, int high_res_distance) {
+    flush(raw);
     if (raw->mouse) {
       (*raw->mouse).horizontal_scroll(high_res_distance);
     }
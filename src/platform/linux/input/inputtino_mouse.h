@@ -17,6 +17,12 @@ using namespace std::literals;
 namespace platf::mouse {
   void move(input_raw_t *raw, int deltaX, int deltaY);
 
+  /**
+   * @brief Write the relative motion queued during an input batch.
+   * @param raw The global input context.
+   */
+  void flush(input_raw_t *raw);
+
   void move_abs(input_raw_t *raw, const touch_port_t &touch_port, float x, float y);
 
   void button(input_raw_t *raw, int button, bool release);
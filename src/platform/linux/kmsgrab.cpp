@@ -3,10 +3,12 @@
  * @brief Definitions for KMS screen capture.
  */
 // standard includes
+#include <array>
 #include <errno.h>
 #include <fcntl.h>
 #include <filesystem>
 #include <thread>
+#include <tuple>
 #include <unistd.h>
 
 // platform includes
@@ -408,6 +410,36 @@ namespace platf {
         return std::nullopt;
       }
 
+      std::optional<std::uint32_t> prop_id_by_name(const std::vector<std::pair<prop_t, std::uint64_t>> &props, std::string_view name) {
+        for (auto &[prop, val] : props) {
+          if (prop->name == name) {
+            return prop->prop_id;
+          }
+        }
+        return std::nullopt;
+      }
+
+      /**
+       * @brief Read a single property with one ioctl, instead of also fetching the metadata of every property.
+       * @param id The object ID.
+       * @param type The object type.
+       * @param prop_id The property ID.
+       * @return The value, or `std::nullopt` if the object doesn't have the property.
+       */
+      std::optional<std::uint64_t> prop_value(std::uint32_t id, std::uint32_t type, std::uint32_t prop_id) {
+        obj_prop_t obj_prop = drmModeObjectGetProperties(fd.el, id, type);
+        if (!obj_prop) {
+          return std::nullopt;
+        }
+
+        for (auto x = 0; x < obj_prop->count_props; ++x) {
+          if (obj_prop->props[x] == prop_id) {
+            return obj_prop->prop_values[x];
+          }
+        }
+        return std::nullopt;
+      }
+
       std::uint32_t get_panel_orientation(std::uint32_t plane_id) {
         auto props = plane_props(plane_id);
         auto value = prop_value_by_name(props, "rotation"sv);
@@ -588,6 +620,8 @@ namespace platf {
 
       int init(const std::string &display_name, const ::video::config_t &config) {
         delay = std::chrono::nanoseconds {1s} / config.framerate;
+        vblank_sync = config::video.capture_vblank_sync;
+        variable_framerate = config::video.capture_variable_framerate;
 
         int monitor_index = util::from_view(display_name);
         int monitor = 0;
@@ -733,9 +767,11 @@ namespace platf {
 
                 auto connector_props = card.connector_props(*connector_id);
                 hdr_metadata_blob_id = card.prop_value_by_name(connector_props, "HDR_OUTPUT_METADATA"sv);
+                hdr_metadata_prop_id = card.prop_id_by_name(connector_props, "HDR_OUTPUT_METADATA"sv);
               }
             }
 
+            card_path = entry.path().string();
             this->card = std::move(card);
             goto break_loop;
           }
@@ -1036,11 +1072,72 @@ namespace platf {
         }
       }
 
+      /**
+       * @brief Block until the next vblank of the captured CRTC.
+       * @return `false` if the CRTC doesn't report vblanks, e.g. while it is off.
+       */
+      bool wait_for_vblank() {
+        std::uint32_t type = DRM_VBLANK_RELATIVE;
+        if (crtc_index > 1) {
+          type |= (crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+        } else if (crtc_index == 1) {
+          type |= DRM_VBLANK_SECONDARY;
+        }
+
+        drmVBlank vblank {};
+        vblank.request.type = (drmVBlankSeqType) type;
+        vblank.request.sequence = 1;
+        return !drmWaitVBlank(card.fd.el, &vblank);
+      }
+
+      /**
+       * @brief Wait until the next frame is due.
+       * @details With vblank sync the frame is captured right after the first vblank close to its deadline,
+       *          so it is the framebuffer that was just flipped rather than one about to be replaced.
+       * @param next_frame When the next frame is due, advanced by one frame interval.
+       */
+      void wait_for_frame(std::chrono::steady_clock::time_point &next_frame) {
+        auto now = std::chrono::steady_clock::now();
+
+        // Vblanks jitter around the deadline when the display refreshes at the stream framerate,
+        // an early one still counts or every other flip would be skipped
+        while (vblank_sync && now < next_frame - delay / 4) {
+          if (!wait_for_vblank()) {
+            BOOST_LOG(warning) << "Couldn't wait for vblank, pacing capture with a timer instead: "sv << strerror(errno);
+            vblank_sync = false;
+          }
+          now = std::chrono::steady_clock::now();
+        }
+
+        if (!vblank_sync && next_frame > now) {
+          std::this_thread::sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+      }
+
+      /**
+       * @brief Wait a little before looking for a page flip again, after a capture found none.
+       * @details With vblank sync this waits for the next vblank, which a flip lands on.
+       * @param next_frame Set so the next frame is captured as soon as the wait is over.
+       */
+      void wait_for_flip(std::chrono::steady_clock::time_point &next_frame) {
+        if (!vblank_sync || !wait_for_vblank()) {
+          std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(delay / 4, 2ms));
+        }
+
+        next_frame = std::chrono::steady_clock::now();
+      }
+
       inline capture_e refresh(file_t *file, egl::surface_descriptor_t *sd, std::optional<std::chrono::steady_clock::time_point> &frame_timestamp) {
-        // Check for a change in HDR metadata
-        if (connector_id) {
-          auto connector_props = card.connector_props(*connector_id);
-          if (hdr_metadata_blob_id != card.prop_value_by_name(connector_props, "HDR_OUTPUT_METADATA"sv)) {
+        // Check for a change in HDR metadata, the kernel doesn't send an event for it
+        if (connector_id && hdr_metadata_prop_id) {
+          if (hdr_metadata_blob_id != card.prop_value(*connector_id, DRM_MODE_OBJECT_CONNECTOR, *hdr_metadata_prop_id)) {
             BOOST_LOG(info) << "Reinitializing capture after HDR metadata change"sv;
             return capture_e::reinit;
           }
@@ -1049,6 +1146,19 @@ namespace platf {
         plane_t plane = drmModeGetPlane(card.fd.el, plane_id);
         frame_timestamp = std::chrono::steady_clock::now();
 
+        // With a variable framerate, only a page flip or a change of the cursor is a new frame
+        if (variable_framerate) {
+          auto cursor_state = [this]() {
+            return std::tuple {captured_cursor.visible, captured_cursor.x, captured_cursor.y, captured_cursor.serial};
+          };
+
+          auto last_cursor_state = cursor_state();
+          update_cursor();
+          if (plane->fb_id == last_fb_id && cursor_state() == last_cursor_state) {
+            return capture_e::timeout;
+          }
+        }
+
         auto fb = card.fb(plane.get());
         if (!fb) {
           // This can happen if the display is being reconfigured while streaming
@@ -1095,14 +1205,26 @@ namespace platf {
           return capture_e::reinit;
         }
 
-        update_cursor();
+        if (!variable_framerate) {
+          update_cursor();
+        }
+        last_fb_id = plane->fb_id;
 
         return capture_e::ok;
       }
 
+      std::optional<std::string> encoder_binding() override {
+        // The encode devices only use the render node of the card and where the monitor is in the framebuffer
+        return card_path + ':' + std::to_string((int) mem_type) + ':' + std::to_string(img_offset_x) + ',' + std::to_string(img_offset_y);
+      }
+
       mem_type_e mem_type;
+      std::string card_path;  ///< Device node of the card the monitor is on
 
       std::chrono::nanoseconds delay;
+      bool vblank_sync;  ///< Capture after vblanks instead of with a frame timer
+      bool variable_framerate;  ///< Capture the page flips of the source, no sooner than a frame interval apart
+      std::uint32_t last_fb_id = 0;  ///< Framebuffer of the last captured frame
 
       int img_width, img_height;
       int img_offset_x, img_offset_y;
@@ -1113,6 +1235,7 @@ namespace platf {
 
       std::optional<uint32_t> connector_id;
       std::optional<uint64_t> hdr_metadata_blob_id;
+      std::optional<uint32_t> hdr_metadata_prop_id;  ///< Polled without looking up every connector property each frame
 
       int cursor_plane_id;
       cursor_t captured_cursor {};
@@ -1126,6 +1249,17 @@ namespace platf {
           display_t(mem_type) {
       }
 
+      ~display_ram_t() override {
+        for (auto &readback : readbacks) {
+          if (readback.fence) {
+            gl::ctx.DeleteSync(readback.fence);
+          }
+          if (readback.buffer) {
+            gl::ctx.DeleteBuffers(1, &readback.buffer);
+          }
+        }
+      }
+
       int init(const std::string &display_name, const ::video::config_t &config) {
         if (!gbm::create_device) {
           BOOST_LOG(warning) << "libgbm not initialized"sv;
@@ -1163,18 +1297,7 @@ namespace platf {
         sleep_overshoot_logger.reset();
 
         while (true) {
-          auto now = std::chrono::steady_clock::now();
-
-          if (next_frame > now) {
-            std::this_thread::sleep_for(next_frame - now);
-            sleep_overshoot_logger.first_point(next_frame);
-            sleep_overshoot_logger.second_point_now_and_log();
-          }
-
-          next_frame += delay;
-          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
-            next_frame = now + delay;
-          }
+          wait_for_frame(next_frame);
 
           std::shared_ptr<platf::img_t> img_out;
           auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
@@ -1187,6 +1310,11 @@ namespace platf {
               if (!push_captured_image_cb(std::move(img_out), false)) {
                 return platf::capture_e::ok;
               }
+
+              // Capture the next flip as soon as it happens, the frame interval only caps how soon it may come
+              if (variable_framerate) {
+                wait_for_flip(next_frame);
+              }
               break;
             case platf::capture_e::ok:
               if (!push_captured_image_cb(std::move(img_out), true)) {
@@ -1218,6 +1346,16 @@ namespace platf {
         return std::make_unique<avcodec_encode_device_t>();
       }
 
+      std::unique_ptr<nvenc_encode_device_t> make_nvenc_encode_device(pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_CUDA
+        if (mem_type == mem_type_e::cuda && pix_fmt == pix_fmt_e::nv12) {
+          return cuda::make_nvenc_encode_device(width, height, false);
+        }
+#endif
+
+        return nullptr;
+      }
+
       void blend_cursor(img_t &img) {
         // TODO: Cursor scaling is not supported in this codepath.
         // We always draw the cursor at the source size.
@@ -1273,19 +1411,29 @@ namespace platf {
 
         std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
         auto status = refresh(fb_fd, &sd, frame_timestamp);
+        if (status == capture_e::timeout && variable_framerate) {
+          // No new frame, so hand out the one still being read back instead of holding it until the next flip
+          auto &in_flight = readbacks[(readback_index + 1) % readbacks.size()];
+          if (!in_flight.fence) {
+            return status;
+          }
+
+          status = collect_readback(in_flight, pull_free_image_cb, img_out, timeout);
+          if (status == capture_e::ok && cursor && captured_cursor.visible) {
+            blend_cursor(*img_out);
+          }
+          return status;
+        }
         if (status != capture_e::ok) {
           return status;
         }
 
-        auto rgb_opt = egl::import_source(display.get(), sd);
-
-        if (!rgb_opt) {
+        auto rgb = imports.import(display.get(), sd);
+        if (!rgb) {
           return capture_e::error;
         }
 
-        auto &rgb = *rgb_opt;
-
-        gl::ctx.BindTexture(GL_TEXTURE_2D, rgb->tex[0]);
+        gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb)->tex[0]);
 
         // Don't remove these lines, see https://github.com/LizardByte/Sunshine/issues/453
         int w, h;
@@ -1293,13 +1441,23 @@ namespace platf {
         gl::ctx.GetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
         BOOST_LOG(debug) << "width and height: w "sv << w << " h "sv << h;
 
-        if (!pull_free_image_cb(img_out)) {
-          return platf::capture_e::interrupted;
-        }
+        // Queue the readback of this frame, then collect the one queued by the previous call.
+        // The GPU copy of the current frame overlaps with the CPU copy of the previous one,
+        // so the capture thread only waits for copies that had a whole frame interval to finish.
+        auto &queued = readbacks[readback_index];
+        queue_readback(queued, (*rgb)->tex[0], frame_timestamp);
 
-        gl::ctx.GetTextureSubImage(rgb->tex[0], 0, img_offset_x, img_offset_y, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+        readback_index = (readback_index + 1) % readbacks.size();
+        auto *ready = &readbacks[readback_index];
+        if (!ready->fence) {
+          // Nothing is in flight before the first frame, so collect the one just queued
+          ready = &queued;
+        }
 
-        img_out->frame_timestamp = frame_timestamp;
+        status = collect_readback(*ready, pull_free_image_cb, img_out, timeout);
+        if (status != capture_e::ok) {
+          return status;
+        }
 
         if (cursor && captured_cursor.visible) {
           blend_cursor(*img_out);
@@ -1326,6 +1484,89 @@ namespace platf {
       gbm::gbm_t gbm;
       egl::display_t display;
       egl::ctx_t ctx;
+      egl::import_cache_t imports;
+
+    private:
+      /**
+       * @brief Pixel pack buffer a frame is read back into asynchronously.
+       */
+      struct readback_t {
+        GLuint buffer = 0;  ///< Pixel pack buffer holding a tightly packed BGRA frame
+        GLsync fence = nullptr;  ///< Signaled when the copy into the buffer is complete, `nullptr` when idle
+        std::optional<std::chrono::steady_clock::time_point> frame_timestamp;  ///< Capture time of that frame
+      };
+
+      /**
+       * @brief Start copying the captured region of a texture into a readback buffer.
+       * @param readback The idle readback buffer.
+       * @param texture The imported framebuffer.
+       * @param frame_timestamp Capture time of the framebuffer.
+       */
+      void queue_readback(readback_t &readback, GLuint texture, const std::optional<std::chrono::steady_clock::time_point> &frame_timestamp) {
+        auto size = (GLsizeiptr) width * height * 4;
+
+        if (!readback.buffer) {
+          gl::ctx.GenBuffers(1, &readback.buffer);
+          gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+          gl::ctx.BufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        } else {
+          gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        }
+
+        // With a pack buffer bound, the pointer argument is an offset into it and the call returns immediately
+        gl::ctx.GetTextureSubImage(texture, 0, img_offset_x, img_offset_y, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, size, nullptr);
+        gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        readback.fence = gl::ctx.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readback.frame_timestamp = frame_timestamp;
+
+        // Submit the copy now instead of when the next frame is queued
+        gl::ctx.Flush();
+      }
+
+      /**
+       * @brief Wait for a queued readback and copy it into a free image.
+       * @param readback The readback buffer with a pending copy.
+       * @param pull_free_image_cb Callback providing the image to fill.
+       * @param img_out The filled image.
+       * @param timeout How long to wait for the GPU.
+       * @return The capture status.
+       */
+      capture_e collect_readback(readback_t &readback, const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout) {
+        auto result = gl::ctx.ClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+        gl::ctx.DeleteSync(readback.fence);
+        readback.fence = nullptr;
+
+        if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED) {
+          BOOST_LOG(error) << "Timed out reading back the framebuffer"sv;
+          return capture_e::error;
+        }
+
+        if (!pull_free_image_cb(img_out)) {
+          return platf::capture_e::interrupted;
+        }
+
+        gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        auto data = gl::ctx.MapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr) width * height * 4, GL_MAP_READ_BIT);
+        if (!data) {
+          gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+          BOOST_LOG(error) << "Couldn't map the framebuffer readback buffer"sv;
+          return capture_e::error;
+        }
+
+        std::copy_n((const std::uint8_t *) data, img_out->height * img_out->row_pitch, img_out->data);
+
+        gl::ctx.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        img_out->frame_timestamp = readback.frame_timestamp;
+
+        return capture_e::ok;
+      }
+
+      // Destroyed before the EGL context they were created in
+      std::array<readback_t, 2> readbacks;
+      std::size_t readback_index = 0;
     };
 
     class display_vram_t: public display_t {
@@ -1377,18 +1618,7 @@ namespace platf {
         sleep_overshoot_logger.reset();
 
         while (true) {
-          auto now = std::chrono::steady_clock::now();
-
-          if (next_frame > now) {
-            std::this_thread::sleep_for(next_frame - now);
-            sleep_overshoot_logger.first_point(next_frame);
-            sleep_overshoot_logger.second_point_now_and_log();
-          }
-
-          next_frame += delay;
-          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
-            next_frame = now + delay;
-          }
+          wait_for_frame(next_frame);
 
           std::shared_ptr<platf::img_t> img_out;
           auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
@@ -1401,6 +1631,11 @@ namespace platf {
               if (!push_captured_image_cb(std::move(img_out), false)) {
                 return platf::capture_e::ok;
               }
+
+              // Capture the next flip as soon as it happens, the frame interval only caps how soon it may come
+              if (variable_framerate) {
+                wait_for_flip(next_frame);
+              }
               break;
             case platf::capture_e::ok:
               if (!push_captured_image_cb(std::move(img_out), true)) {
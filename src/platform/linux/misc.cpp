@@ -9,19 +9,29 @@
 #endif
 
 // standard includes
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <thread>
 
 // platform includes
 #include <arpa/inet.h>
 #include <dlfcn.h>
 #include <ifaddrs.h>
+#include <malloc.h>
+#include <linux/net_tstamp.h>
 #include <netinet/udp.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
 
 // lib includes
 #include <boost/asio/ip/address.hpp>
 #include <boost/asio/ip/host_name.hpp>
+#include <boost/asio/ip/udp.hpp>
 #include <boost/process/v1/group.hpp>
 #include <boost/process/v1/child.hpp>
 #include <boost/process/v1/env.hpp>
@@ -31,8 +41,15 @@
 #include <boost/process/v1/io.hpp>
 #include <boost/process/v1/start_dir.hpp>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#ifdef SUNSHINE_BUILD_IO_URING
+  #include <liburing.h>
+#endif
+
 // local includes
 #include "graphics.h"
 #include "misc.h"
@@ -40,6 +57,8 @@
 #include "src/entry_handler.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
+#include "src/platform/nvml.h"
+#include "src/thread_placement.h"
 #include "vaapi.h"
 
 #include <linux/rtnetlink.h>
@@ -238,6 +257,23 @@ namespace platf {
     return "00:00:00:00:00:00"s;
   }
 
+  std::uint64_t get_link_speed(const std::string_view &address) {
+    auto ifaddrs = get_ifaddrs();
+    for (auto pos = ifaddrs.get(); pos != nullptr; pos = pos->ifa_next) {
+      if (pos->ifa_addr && address == from_sockaddr(pos->ifa_addr)) {
+        // Wireless and virtual interfaces fail to read or report -1
+        std::ifstream speed_file("/sys/class/net/"s + pos->ifa_name + "/speed");
+        long long speed_mbps = 0;
+        if (speed_file >> speed_mbps && speed_mbps > 0) {
+          return (std::uint64_t) speed_mbps * std::mega::num;
+        }
+        break;
+      }
+    }
+
+    return 0;
+  }
+
 std::string get_local_ip_for_gateway() {
   int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
   if (fd < 0) {
@@ -363,12 +399,178 @@ std::string get_local_ip_for_gateway() {
     // Unimplemented
   }
 
+  /**
+   * @brief Read the first line of a sysfs or procfs file.
+   * @param path The file.
+   * @return The line, empty if the file can't be read.
+   */
+  static std::string read_sysfs_line(const std::string &path) {
+    std::ifstream file {path};
+    std::string line;
+    std::getline(file, line);
+    return line;
+  }
+
+  static bool write_sysfs_line(const std::string &path, std::string_view line) {
+    std::ofstream file {path};
+    file << line << std::flush;
+    return (bool) file;
+  }
+
+  /**
+   * @brief The cpufreq files changed for streaming and what they contained before.
+   */
+  static std::vector<std::pair<std::string, std::string>> previous_cpufreq;
+
+  bool set_thread_affinity(const std::vector<int> &cores) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto core : cores) {
+      if (core < CPU_SETSIZE) {
+        CPU_SET(core, &set);
+      }
+    }
+
+    auto err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) {
+      BOOST_LOG(warning) << "pthread_setaffinity_np() failed: "sv << err;
+      return false;
+    }
+
+    return true;
+  }
+
+  void set_thread_mmcss_task(const std::string &task) {
+    // MMCSS only exists on Windows
+  }
+
+  std::vector<int> numa_node_cores(int node) {
+    return thread_placement::parse_cpu_list(read_sysfs_line("/sys/devices/system/node/node"s + std::to_string(node) + "/cpulist"));
+  }
+
+  std::vector<std::vector<int>> cpu_cache_domains() {
+    std::vector<std::vector<int>> domains;
+    for (auto core : thread_placement::parse_cpu_list(read_sysfs_line("/sys/devices/system/cpu/online"))) {
+      // index3 is the L3 cache, shared by a CCX/CCD on AMD and by all cores of a socket on Intel
+      auto shared = thread_placement::parse_cpu_list(read_sysfs_line("/sys/devices/system/cpu/cpu"s + std::to_string(core) + "/cache/index3/shared_cpu_list"));
+      if (shared.empty()) {
+        return {};
+      }
+
+      if (std::find(std::begin(domains), std::end(domains), shared) == std::end(domains)) {
+        domains.emplace_back(std::move(shared));
+      }
+    }
+
+    return domains;
+  }
+
+  std::vector<double> cpu_core_load(std::chrono::milliseconds interval) {
+    // Busy and total jiffies of each core from /proc/stat
+    auto sample = []() {
+      std::vector<std::pair<std::uint64_t, std::uint64_t>> times;
+
+      std::ifstream stat {"/proc/stat"};
+      std::string line;
+      while (std::getline(stat, line)) {
+        // Skip the aggregate "cpu " line, the per-core lines start with "cpuN"
+        if (line.size() < 4 || line.compare(0, 3, "cpu") || !std::isdigit((unsigned char) line[3])) {
+          continue;
+        }
+
+        std::istringstream fields {line.substr(3)};
+        std::size_t core;
+        std::uint64_t user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+        fields >> core >> user >> nice >> system >> idle >> iowait >> irq >> softirq >> steal;
+
+        if (core >= times.size()) {
+          times.resize(core + 1);
+        }
+        auto busy = user + nice + system + irq + softirq + steal;
+        times[core] = {busy, busy + idle + iowait};
+      }
+
+      return times;
+    };
+
+    auto before = sample();
+    std::this_thread::sleep_for(interval);
+    auto after = sample();
+
+    std::vector<double> load(std::min(before.size(), after.size()));
+    for (std::size_t x = 0; x < load.size(); ++x) {
+      auto total = after[x].second - before[x].second;
+      load[x] = total ? (double) (after[x].first - before[x].first) / total : 0.0;
+    }
+
+    return load;
+  }
+
+  int gpu_numa_node() {
+    auto render_device = fs::path {config::video.adapter_name.empty() ? "/dev/dri/renderD128" : config::video.adapter_name};
+
+    // Single node systems report -1
+    auto node = read_sysfs_line("/sys/class/drm/"s + render_device.filename().string() + "/device/numa_node");
+    return node.empty() ? -1 : std::atoi(node.c_str());
+  }
+
+  memory_usage_t memory_usage() {
+    memory_usage_t usage;
+
+    // The second field is the resident size in pages
+    std::ifstream statm {"/proc/self/statm"};
+    std::uint64_t size;
+    std::uint64_t resident;
+    if (statm >> size >> resident) {
+      usage.resident = resident * (std::uint64_t) sysconf(_SC_PAGESIZE);
+    }
+
+    return usage;
+  }
+
+  void trim_memory() {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+  }
+
   void streaming_will_start() {
-    // Nothing to do
+    if (!config::stream.performance_power_profile || !previous_cpufreq.empty()) {
+      return;
+    }
+
+    std::error_code ec;
+    bool denied = false;
+    for (auto &policy : fs::directory_iterator {"/sys/devices/system/cpu/cpufreq", ec}) {
+      // The performance governor also sets the energy performance preference of amd-pstate and intel_pstate
+      for (auto file : {"scaling_governor"sv, "energy_performance_preference"sv}) {
+        auto path = (policy.path() / file).string();
+        auto previous = read_sysfs_line(path);
+        if (previous.empty() || previous == "performance"sv) {
+          continue;
+        }
+
+        if (write_sysfs_line(path, "performance"sv)) {
+          previous_cpufreq.emplace_back(std::move(path), std::move(previous));
+          break;
+        }
+        denied = true;
+      }
+    }
+
+    if (!previous_cpufreq.empty()) {
+      BOOST_LOG(info) << "Switched "sv << previous_cpufreq.size() << " CPU frequency policies to performance"sv;
+    } else if (denied) {
+      BOOST_LOG(warning) << "Unable to switch the CPU frequency policies to performance, writing to /sys/devices/system/cpu/cpufreq needs root"sv;
+    }
   }
 
   void streaming_will_stop() {
-    // Nothing to do
+    // Restore the policies in the order they were changed
+    for (auto &[path, previous] : previous_cpufreq) {
+      write_sysfs_line(path, previous);
+    }
+    previous_cpufreq.clear();
   }
 
   void restart_on_exit() {
@@ -421,6 +623,67 @@ std::string get_local_ip_for_gateway() {
     return waitpid(-((pid_t) native_handle), nullptr, WNOHANG) >= 0;
   }
 
+  /**
+   * @brief Waits on a pidfd, which becomes readable once the process exited. It doesn't reap the process.
+   */
+  class app_exit_watcher_t: public deinit_t {
+  public:
+    app_exit_watcher_t(int pidfd, int stop_fd, std::function<void()> on_exit):
+        pidfd(pidfd),
+        stop_fd(stop_fd),
+        thread([this, on_exit = std::move(on_exit)]() {
+          pollfd fds[] {{this->pidfd, POLLIN, 0}, {this->stop_fd, POLLIN, 0}};
+          while (poll(fds, 2, -1) < 0 && errno == EINTR);
+
+          if (!(fds[1].revents & POLLIN)) {
+            on_exit();
+          }
+        }) {
+    }
+
+    ~app_exit_watcher_t() override {
+      std::uint64_t value = 1;
+      if (write(stop_fd, &value, sizeof(value)) < 0) {
+        BOOST_LOG(warning) << "Couldn't stop the app exit watcher: "sv << errno;
+      }
+      thread.join();
+
+      close(pidfd);
+      close(stop_fd);
+    }
+
+  private:
+    int pidfd;
+    int stop_fd;
+    std::thread thread;
+  };
+
+  std::unique_ptr<deinit_t> watch_app_exit(bp::child &child, bp::group *group, std::function<void()> on_exit) {
+    // A process group has no exit notification, so it keeps being polled
+    if (group) {
+      return nullptr;
+    }
+
+#ifdef SYS_pidfd_open
+    int pidfd = (int) syscall(SYS_pidfd_open, child.id(), 0);
+    if (pidfd < 0) {
+      // Linux 5.3 and later
+      BOOST_LOG(debug) << "pidfd_open() failed, polling for the app exit: "sv << errno;
+      return nullptr;
+    }
+
+    int stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd < 0) {
+      close(pidfd);
+      return nullptr;
+    }
+
+    return std::make_unique<app_exit_watcher_t>(pidfd, stop_fd, std::move(on_exit));
+#else
+    return nullptr;
+#endif
+  }
+
   struct sockaddr_in to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     struct sockaddr_in saddr_v4 = {};
 
@@ -446,6 +709,123 @@ std::string get_local_ip_for_gateway() {
     return saddr_v6;
   }
 
+#if defined(SUNSHINE_BUILD_IO_URING) && defined(UDP_SEGMENT)
+  namespace uring {
+    /**
+     * @brief Per-thread io_uring used to submit all GSO messages of a batch at once.
+     */
+    class ring_t {
+    public:
+      static constexpr unsigned queue_depth = 64;
+
+      ring_t() {
+        if (auto err = io_uring_queue_init(queue_depth, &ring, 0); err < 0) {
+          BOOST_LOG(info) << "io_uring is unavailable, using sendmsg() for batched sends: "sv << -err;
+          return;
+        }
+        initialized = true;
+
+        BOOST_LOG(debug) << "Using io_uring for batched sends"sv;
+      }
+
+      ~ring_t() {
+        if (initialized) {
+          io_uring_queue_exit(&ring);
+        }
+      }
+
+      ring_t(const ring_t &) = delete;
+      ring_t &operator=(const ring_t &) = delete;
+
+      /**
+       * @brief Submit messages and wait until they were sent.
+       * @details The messages of a batch are linked, so the kernel sends them in order and
+       *          cancels the remaining ones after the first failure.
+       * @param sockfd The socket to send on.
+       * @param msgs The messages to send.
+       * @return The number of messages sent before the first failure, or -errno if the first one failed.
+       */
+      int send(int sockfd, std::vector<struct msghdr> &msgs) {
+        size_t sent = 0;
+        while (sent < msgs.size()) {
+          auto count = std::min<size_t>(queue_depth, msgs.size() - sent);
+          for (size_t x = 0; x < count; ++x) {
+            auto sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_sendmsg(sqe, sockfd, &msgs[sent + x], 0);
+            io_uring_sqe_set_data64(sqe, x);
+
+            // The last message ends the chain
+            if (x + 1 < count) {
+              sqe->flags |= IOSQE_IO_LINK;
+            }
+          }
+
+          if (auto err = io_uring_submit_and_wait(&ring, count); err < 0) {
+            return sent ? (int) sent : err;
+          }
+
+          // A send is done once its CQE is posted, after which the caller may reuse the buffers
+          size_t outstanding = count;
+          size_t completed = count;
+          int first_error = 0;
+          while (outstanding > 0) {
+            struct io_uring_cqe *cqe;
+            if (auto err = io_uring_wait_cqe(&ring, &cqe); err < 0) {
+              if (err == -EINTR) {
+                continue;
+              }
+              return sent ? (int) sent : err;
+            }
+
+            // Messages after the failed one complete with -ECANCELED
+            if (cqe->res < 0 && cqe->user_data < completed) {
+              completed = cqe->user_data;
+              first_error = cqe->res;
+            }
+
+            --outstanding;
+            io_uring_cqe_seen(&ring, cqe);
+          }
+
+          sent += completed;
+          if (first_error) {
+            return sent ? (int) sent : first_error;
+          }
+        }
+
+        return sent;
+      }
+
+      bool initialized = false;
+
+      std::vector<struct iovec> iovs;
+      std::vector<struct msghdr> msgs;
+
+    private:
+      struct io_uring ring;
+    };
+  }  // namespace uring
+#endif
+
+  bool enable_send_txtime(std::uintptr_t native_socket) {
+#ifdef SO_TXTIME
+    // fq schedules by CLOCK_MONOTONIC, which is what std::chrono::steady_clock uses
+    struct sock_txtime txtime = {CLOCK_MONOTONIC, 0};
+    if (setsockopt((int) native_socket, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime))) {
+      BOOST_LOG(warning) << "Unable to enable SO_TXTIME: "sv << errno;
+      return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  std::unique_ptr<deinit_t> open_registered_io_socket(bool v6, std::uintptr_t &native_socket) {
+    return nullptr;
+  }
+
   bool send_batch(batched_send_info_t &send_info) {
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
@@ -466,7 +846,7 @@ std::string get_local_ip_for_gateway() {
     }
 
     union {
-      char buf[CMSG_SPACE(sizeof(uint16_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
+      char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
       struct cmsghdr alignment;
     } cmbuf = {};  // Must be zeroed for CMSG_NXTHDR()
 
@@ -508,6 +888,87 @@ std::string get_local_ip_for_gateway() {
 
     auto const max_iovs_per_msg = send_info.payload_buffers.size() + (send_info.headers ? 1 : 0);
 
+    // Appends the launch time of a block after the last control message, msg_controllen must already include it
+    auto append_txtime = [&](struct cmsghdr *last_cm, size_t block_index) {
+#ifdef SO_TXTIME
+      auto launch_time = *send_info.txtime + send_info.txtime_interval * block_index;
+      uint64_t launch_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(launch_time.time_since_epoch()).count();
+
+      auto cm = CMSG_NXTHDR(&msg, last_cm);
+      cm->cmsg_level = SOL_SOCKET;
+      cm->cmsg_type = SCM_TXTIME;
+      cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+      memcpy(CMSG_DATA(cm), &launch_time_ns, sizeof(launch_time_ns));
+#endif
+    };
+    auto const txtime_space = send_info.txtime ? CMSG_SPACE(sizeof(uint64_t)) : 0;
+
+#if defined(SUNSHINE_BUILD_IO_URING) && defined(UDP_SEGMENT)
+    static thread_local uring::ring_t ring;
+    // The messages of a submission share one control buffer, so they can't carry their own launch times
+    if (ring.initialized && !send_info.txtime) {
+      // Same segmentation as the sendmsg() path below, but every message is built
+      // up front so the whole batch goes to the kernel in a single submission.
+      const size_t seg_max = 65536 / 1500;
+      auto msg_size = send_info.header_size + send_info.payload_size;
+      auto msg_count = (send_info.block_count + seg_max - 1) / seg_max;
+
+      // The control buffer is shared by all messages. Messages with more than one
+      // segment include the trailing UDP_SEGMENT option, others stop before it.
+      msg.msg_controllen = cmbuflen + CMSG_SPACE(sizeof(uint16_t));
+      auto cm = CMSG_NXTHDR(&msg, pktinfo_cm);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      *((uint16_t *) CMSG_DATA(cm)) = msg_size;
+
+      // Reserve up front so the iov pointers stored in each message stay valid
+      ring.iovs.clear();
+      ring.iovs.reserve(send_info.block_count * (send_info.headers ? 2 : 1) + msg_count * max_iovs_per_msg);
+      ring.msgs.clear();
+
+      for (size_t seg_index = 0; seg_index < send_info.block_count; seg_index += seg_max) {
+        auto segs_in_batch = std::min(send_info.block_count - seg_index, seg_max);
+        auto first_iov = ring.iovs.size();
+
+        if (send_info.headers) {
+          for (auto i = 0; i < segs_in_batch; i++) {
+            ring.iovs.push_back({(void *) &send_info.headers[(send_info.block_offset + seg_index + i) * send_info.header_size], send_info.header_size});
+            auto payload_desc = send_info.buffer_for_payload_offset((send_info.block_offset + seg_index + i) * send_info.payload_size);
+            ring.iovs.push_back({(void *) payload_desc.buffer, send_info.payload_size});
+          }
+        } else {
+          auto payload_offset = (send_info.block_offset + seg_index) * send_info.payload_size;
+          auto payload_length = payload_offset + (segs_in_batch * send_info.payload_size);
+          while (payload_offset < payload_length) {
+            auto payload_desc = send_info.buffer_for_payload_offset(payload_offset);
+            auto len = std::min(payload_desc.size, payload_length - payload_offset);
+            ring.iovs.push_back({(void *) payload_desc.buffer, len});
+            payload_offset += len;
+          }
+        }
+
+        auto &batch_msg = ring.msgs.emplace_back(msg);
+        batch_msg.msg_iov = &ring.iovs[first_iov];
+        batch_msg.msg_iovlen = ring.iovs.size() - first_iov;
+        batch_msg.msg_controllen = segs_in_batch > 1 ? cmbuflen + CMSG_SPACE(sizeof(uint16_t)) : cmbuflen;
+      }
+
+      auto msgs_sent = ring.send(sockfd, ring.msgs);
+      if (msgs_sent == (int) ring.msgs.size()) {
+        return true;
+      }
+
+      // If nothing was sent, GSO is likely unavailable, so let the paths below deal with it
+      if (msgs_sent > 0) {
+        BOOST_LOG(verbose) << "io_uring sendmsg() failed after "sv << msgs_sent << " messages"sv;
+        return false;
+      }
+      BOOST_LOG(verbose) << "io_uring sendmsg() failed: "sv << -msgs_sent;
+      msg.msg_controllen = sizeof(cmbuf.buf);
+    }
+#endif
+
 #ifdef UDP_SEGMENT
     {
       // UDP GSO on Linux currently only supports sending 64K or 64 segments at a time
@@ -546,8 +1007,9 @@ std::string get_local_ip_for_gateway() {
         msg.msg_iovlen = iovlen;
 
         // We should not use GSO if the data is <= one full block size
+        auto last_cm = pktinfo_cm;
         if (segs_in_batch > 1) {
-          msg.msg_controllen = cmbuflen + CMSG_SPACE(sizeof(uint16_t));
+          msg.msg_controllen = cmbuflen + CMSG_SPACE(sizeof(uint16_t)) + txtime_space;
 
           // Enable GSO to perform segmentation of our buffer for us
           auto cm = CMSG_NXTHDR(&msg, pktinfo_cm);
@@ -555,8 +1017,14 @@ std::string get_local_ip_for_gateway() {
           cm->cmsg_type = UDP_SEGMENT;
           cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
           *((uint16_t *) CMSG_DATA(cm)) = msg_size;
+          last_cm = cm;
         } else {
-          msg.msg_controllen = cmbuflen;
+          msg.msg_controllen = cmbuflen + txtime_space;
+        }
+
+        // The segments of a GSO send leave together, at the launch time of the first one
+        if (send_info.txtime) {
+          append_txtime(last_cm, seg_index);
         }
 
         // This will fail if GSO is not available, so we will fall back to non-GSO if
@@ -596,6 +1064,12 @@ std::string get_local_ip_for_gateway() {
 
     {
       // If GSO is not supported, use sendmmsg() instead.
+      // The messages share one control buffer, so the whole batch leaves at its first launch time.
+      msg.msg_controllen = cmbuflen + txtime_space;
+      if (send_info.txtime) {
+        append_txtime(pktinfo_cm, 0);
+      }
+
       struct mmsghdr msgs[send_info.block_count];
       struct iovec iovs[send_info.block_count * (send_info.headers ? 2 : 1)];
       int iov_idx = 0;
@@ -617,7 +1091,7 @@ std::string get_local_ip_for_gateway() {
         msgs[i].msg_hdr.msg_name = msg.msg_name;
         msgs[i].msg_hdr.msg_namelen = msg.msg_namelen;
         msgs[i].msg_hdr.msg_control = cmbuf.buf;
-        msgs[i].msg_hdr.msg_controllen = cmbuflen;
+        msgs[i].msg_hdr.msg_controllen = cmbuflen + txtime_space;
         msgs[i].msg_hdr.msg_flags = 0;
       }
 
@@ -789,10 +1263,12 @@ std::string get_local_ip_for_gateway() {
    * @param port The destination port for traffic sent on this socket.
    * @param data_type The type of traffic sent on this socket.
    * @param dscp_tagging Specifies whether to enable DSCP tagging on outgoing traffic.
+   * @param dscp_marked Receives the DSCP value the OS reports it marks the traffic with, 0 if it isn't marked.
    */
-  std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging) {
+  std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging, int &dscp_marked) {
     int sockfd = (int) native_socket;
     std::vector<std::tuple<int, int, int>> reset_options;
+    dscp_marked = 0;
 
     if (dscp_tagging) {
       int level;
@@ -808,21 +1284,7 @@ std::string get_local_ip_for_gateway() {
         option = IP_TOS;
       }
 
-      // The specific DSCP values here are chosen to be consistent with Windows,
-      // except that we use CS6 instead of CS7 for audio traffic.
-      int dscp = 0;
-      switch (data_type) {
-        case qos_data_type_e::video:
-          dscp = 40;
-          break;
-        case qos_data_type_e::audio:
-          dscp = 48;
-          break;
-        default:
-          BOOST_LOG(error) << "Unknown traffic type: "sv << (int) data_type;
-          break;
-      }
-
+      int dscp = qos_dscp(data_type);
       if (dscp) {
         // Shift to put the DSCP value in the correct position in the TOS field
         dscp <<= 2;
@@ -833,6 +1295,13 @@ std::string get_local_ip_for_gateway() {
         } else {
           BOOST_LOG(error) << "Failed to set TOS/TCLASS: "sv << errno;
         }
+
+        // Report what the socket carries rather than what was asked for
+        int tos = 0;
+        socklen_t tos_size = sizeof(tos);
+        if (getsockopt(sockfd, level, option, &tos, &tos_size) == 0) {
+          dscp_marked = tos >> 2;
+        }
       }
     }
 
@@ -842,7 +1311,7 @@ std::string get_local_ip_for_gateway() {
     // reset SO_PRIORITY back to 0.
     //
     // 6 is the highest priority that can be used without SYS_CAP_ADMIN.
-    int priority = data_type == qos_data_type_e::audio ? 6 : 5;
+    int priority = data_type == qos_data_type_e::video ? 5 : 6;
     if (setsockopt(sockfd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) == 0) {
       // Reset SO_PRIORITY to 0 when QoS is disabled
       reset_options.emplace_back(std::make_tuple(SOL_SOCKET, SO_PRIORITY, 0));
@@ -853,6 +1322,30 @@ std::string get_local_ip_for_gateway() {
     return std::make_unique<qos_t>(sockfd, reset_options);
   }
 
+  std::optional<int> path_mtu(const boost::asio::ip::address &address) {
+    boost::asio::ip::udp::endpoint endpoint {address, 9};
+    int fd = socket(endpoint.protocol().family(), SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0) {
+      return std::nullopt;
+    }
+    auto close_socket = util::fail_guard([fd]() {
+      close(fd);
+    });
+
+    // Connecting a UDP socket only looks up the route, nothing is sent
+    if (connect(fd, endpoint.data(), endpoint.size())) {
+      return std::nullopt;
+    }
+
+    int mtu = 0;
+    socklen_t mtu_size = sizeof(mtu);
+    if (address.is_v6() ? getsockopt(fd, IPPROTO_IPV6, IPV6_MTU, &mtu, &mtu_size) : getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &mtu_size)) {
+      return std::nullopt;
+    }
+
+    return mtu > 0 ? std::optional {mtu} : std::nullopt;
+  }
+
   std::string get_host_name() {
     try {
       return boost::asio::ip::host_name();
@@ -873,6 +1366,9 @@ std::string get_local_ip_for_gateway() {
 #ifdef SUNSHINE_BUILD_DRM
       KMS,  ///< KMS
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+      PORTAL,  ///< XDG desktop portal
+#endif
 #ifdef SUNSHINE_BUILD_X11
       X11,  ///< X11
 #endif
@@ -909,6 +1405,15 @@ std::string get_local_ip_for_gateway() {
   }
 #endif
 
+#ifdef SUNSHINE_BUILD_PORTAL
+  std::vector<std::string> portal_display_names();
+  std::shared_ptr<display_t> portal_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
+
+  bool verify_portal() {
+    return window_system == window_system_e::WAYLAND && !portal_display_names().empty();
+  }
+#endif
+
 #ifdef SUNSHINE_BUILD_X11
   std::vector<std::string> x11_display_names();
   std::shared_ptr<display_t> x11_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
@@ -935,6 +1440,11 @@ std::string get_local_ip_for_gateway() {
       return kms_display_names(hwdevice_type);
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if (sources[source::PORTAL]) {
+      return portal_display_names();
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
     if (sources[source::X11]) {
       return x11_display_names();
@@ -952,6 +1462,80 @@ std::string get_local_ip_for_gateway() {
     return true;
   }
 
+  std::string gpu_identity() {
+    // We don't track GPU state, so probe results are never reused
+    return {};
+  }
+
+  namespace {
+    std::atomic<std::uint64_t> topology_generation {0};
+
+    /**
+     * @brief Count DRM hotplug uevents of the kernel on a watcher thread.
+     * @details Connectors being plugged, unplugged or changing their modes list send `HOTPLUG=1` for the card.
+     *          Mode sets of the compositor don't send uevents, the capture backends catch those by the
+     *          framebuffer size changing.
+     */
+    void watch_drm_hotplug() {
+      int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+      if (fd < 0) {
+        BOOST_LOG(warning) << "Couldn't open the kernel uevent socket, display hotplug is only detected by capture: "sv << strerror(errno);
+        return;
+      }
+
+      sockaddr_nl addr {};
+      addr.nl_family = AF_NETLINK;
+      addr.nl_groups = 1;  // Kernel uevents, udev rebroadcasts them on another group
+      if (bind(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        BOOST_LOG(warning) << "Couldn't bind the kernel uevent socket, display hotplug is only detected by capture: "sv << strerror(errno);
+        close(fd);
+        return;
+      }
+
+      std::thread {[fd]() {
+        char buffer[8192];
+        while (true) {
+          auto len = recv(fd, buffer, sizeof(buffer) - 1, 0);
+          if (len < 0) {
+            // ENOBUFS means events were lost, which might have been a hotplug
+            if (errno == ENOBUFS) {
+              ++topology_generation;
+            } else if (errno != EINTR) {
+              BOOST_LOG(warning) << "Stopped watching kernel uevents: "sv << strerror(errno);
+              break;
+            }
+            continue;
+          }
+          buffer[len] = '\0';
+
+          // "action@devpath" followed by NUL separated KEY=value properties
+          bool drm = false;
+          bool hotplug = false;
+          for (ssize_t offset = 0; offset < len;) {
+            std::string_view entry {buffer + offset};
+            drm = drm || entry == "SUBSYSTEM=drm"sv;
+            hotplug = hotplug || entry == "HOTPLUG=1"sv;
+            offset += entry.size() + 1;
+          }
+
+          if (drm && hotplug) {
+            BOOST_LOG(debug) << "DRM hotplug event received"sv;
+            ++topology_generation;
+          }
+        }
+
+        close(fd);
+      }}.detach();
+    }
+  }  // namespace
+
+  std::uint64_t display_topology_generation() {
+    static std::once_flag watching;
+    std::call_once(watching, watch_drm_hotplug);
+
+    return topology_generation.load(std::memory_order_relaxed);
+  }
+
   std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
 #ifdef SUNSHINE_BUILD_CUDA
     if (sources[source::NVFBC] && hwdevice_type == mem_type_e::cuda) {
@@ -971,6 +1555,12 @@ std::string get_local_ip_for_gateway() {
       return kms_display(hwdevice_type, display_name, config);
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if (sources[source::PORTAL]) {
+      BOOST_LOG(info) << "Screencasting with the XDG desktop portal"sv;
+      return portal_display(hwdevice_type, display_name, config);
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
     if (sources[source::X11]) {
       BOOST_LOG(info) << "Screencasting with X11"sv;
@@ -1026,6 +1616,13 @@ std::string get_local_ip_for_gateway() {
       }
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if ((config::video.capture.empty() && sources.none()) || config::video.capture == "portal") {
+      if (verify_portal()) {
+        sources[source::PORTAL] = true;
+      }
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
     // We enumerate this capture backend regardless of other suitable sources,
     // since it may be needed as a NvFBC fallback for software encoding on X11.
@@ -1036,7 +1633,8 @@ std::string get_local_ip_for_gateway() {
     }
 #endif
 
-    if (sources.none()) {
+    // The synthetic display of capture = null doesn't need a capture method
+    if (sources.none() && config::video.capture != "null"sv) {
       BOOST_LOG(error) << "Unable to initialize capture method"sv;
       return nullptr;
     }
@@ -1063,6 +1661,76 @@ std::string get_local_ip_for_gateway() {
     return std::make_unique<linux_high_precision_timer>();
   }
 
+  /**
+   * @brief Samples AMD GPUs through the sysfs of the amdgpu driver.
+   * @details The driver doesn't report the utilization of the encoder there.
+   */
+  class amdgpu_monitor_t: public gpu_monitor_t {
+  public:
+    int init() {
+      std::error_code ec;
+      for (auto &entry : fs::directory_iterator {"/sys/class/drm", ec}) {
+        // Skip the connectors, e.g. card0-DP-1
+        auto name = entry.path().filename().string();
+        if (name.starts_with("card"sv) && name.find('-') == std::string::npos && fs::exists(entry.path() / "device/gpu_busy_percent", ec)) {
+          devices.emplace_back(entry.path() / "device");
+        }
+      }
+
+      return devices.empty() ? -1 : 0;
+    }
+
+    gpu_utilization_t sample() override {
+      gpu_utilization_t busiest;
+
+      for (auto &device : devices) {
+        gpu_utilization_t utilization;
+
+        int busy_percent;
+        if (std::ifstream {device / "gpu_busy_percent"} >> busy_percent) {
+          utilization.render = busy_percent;
+        }
+
+        // The current level is marked, e.g. "1: 1800Mhz *"
+        std::ifstream levels {device / "pp_dpm_sclk"};
+        for (std::string line; std::getline(levels, line);) {
+          auto colon = line.find(':');
+          if (colon != std::string::npos && line.ends_with('*')) {
+            utilization.clock_mhz = std::atoi(line.c_str() + colon + 1);
+            break;
+          }
+        }
+
+        if (!busiest.render || utilization.render.value_or(0) > *busiest.render) {
+          busiest = utilization;
+        }
+      }
+
+      return busiest;
+    }
+
+  private:
+    std::vector<fs::path> devices;
+  };
+
+  std::unique_ptr<gpu_monitor_t> make_gpu_monitor() {
+    if (auto monitor = nvml::make_monitor()) {
+      return monitor;
+    }
+
+    auto monitor = std::make_unique<amdgpu_monitor_t>();
+    if (monitor->init()) {
+      return nullptr;
+    }
+
+    return monitor;
+  }
+
+  bool boost_gpu_priority(bool boost) {
+    // The priority of EGL and VAAPI contexts is fixed when they are created
+    return false;
+  }
+
   std::string
   get_clipboard() {
     // Placeholder
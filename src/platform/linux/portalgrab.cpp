@@ -0,0 +1,1052 @@
+/**
+ * @file src/platform/linux/portalgrab.cpp
+ * @brief Definitions for XDG desktop portal screen capture through PipeWire.
+ */
+// standard includes
+#include <algorithm>
+#include <condition_variable>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+// lib includes
+#include <drm_fourcc.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <pipewire/pipewire.h>
+#include <spa/param/buffers.h>
+#include <spa/param/video/format-utils.h>
+#include <spa/pod/builder.h>
+
+// local includes
+#include "cuda.h"
+#include "graphics.h"
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/video.h"
+#include "vaapi.h"
+#include "wayland.h"
+
+using namespace std::literals;
+
+namespace portal {
+  constexpr auto PORTAL_NAME = "org.freedesktop.portal.Desktop";
+  constexpr auto PORTAL_PATH = "/org/freedesktop/portal/desktop";
+  constexpr auto SCREENCAST_IFACE = "org.freedesktop.portal.ScreenCast";
+  constexpr auto REQUEST_IFACE = "org.freedesktop.portal.Request";
+  constexpr auto SESSION_IFACE = "org.freedesktop.portal.Session";
+
+  // Values of the ScreenCast portal API
+  constexpr std::uint32_t SOURCE_TYPE_MONITOR = 1;
+  constexpr std::uint32_t CURSOR_MODE_EMBEDDED = 2;
+  constexpr std::uint32_t PERSIST_MODE_PERSISTENT = 2;
+
+  // The user may need some time to answer the source selection dialog
+  constexpr auto REQUEST_TIMEOUT = 120s;
+
+  // Not part of the glad EGL bindings
+  using query_dmabuf_modifiers_fn = EGLBoolean (*)(EGLDisplay dpy, EGLint format, EGLint max_modifiers, EGLuint64KHR *modifiers, EGLBoolean *external_only, EGLint *num_modifiers);
+
+  struct format_t {
+    spa_video_format spa_format;
+    std::uint32_t drm_format;
+    bool shm;  ///< Whether the RAM path can copy this format without swizzling
+  };
+
+  constexpr format_t formats[] {
+    {SPA_VIDEO_FORMAT_BGRx, DRM_FORMAT_XRGB8888, true},
+    {SPA_VIDEO_FORMAT_BGRA, DRM_FORMAT_ARGB8888, true},
+    {SPA_VIDEO_FORMAT_RGBx, DRM_FORMAT_XBGR8888, false},
+    {SPA_VIDEO_FORMAT_RGBA, DRM_FORMAT_ABGR8888, false},
+  };
+
+  static std::filesystem::path restore_token_path() {
+    return platf::appdata() / "portal_restore_token";
+  }
+
+  /**
+   * @brief A ScreenCast portal session that provides a PipeWire node of one monitor.
+   */
+  class session_t {
+  public:
+    ~session_t() {
+      if (conn && !session_handle.empty()) {
+        g_dbus_connection_call_sync(conn, PORTAL_NAME, session_handle.c_str(), SESSION_IFACE, "Close", nullptr, nullptr, G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr);
+      }
+      if (conn) {
+        g_object_unref(conn);
+      }
+      if (context) {
+        g_main_context_unref(context);
+      }
+      if (pipewire_fd >= 0) {
+        close(pipewire_fd);
+      }
+    }
+
+    /**
+     * @brief Connect to the session bus.
+     * @return 0 on success, -1 on failure.
+     */
+    int connect() {
+      context = g_main_context_new();
+
+      GError *err = nullptr;
+      conn = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &err);
+      if (!conn) {
+        BOOST_LOG(error) << "Couldn't connect to the D-Bus session bus: "sv << err->message;
+        g_error_free(err);
+        return -1;
+      }
+
+      // The unique name becomes part of the request object paths
+      sender = g_dbus_connection_get_unique_name(conn) + 1;
+      std::replace(sender.begin(), sender.end(), '.', '_');
+
+      return 0;
+    }
+
+    /**
+     * @brief Get a property of the ScreenCast portal.
+     * @param name The property name.
+     * @return The property value, or 0 if the portal isn't available.
+     */
+    std::uint32_t property(const char *name) {
+      auto reply = g_dbus_connection_call_sync(
+        conn,
+        PORTAL_NAME,
+        PORTAL_PATH,
+        "org.freedesktop.DBus.Properties",
+        "Get",
+        g_variant_new("(ss)", SCREENCAST_IFACE, name),
+        G_VARIANT_TYPE("(v)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        nullptr,
+        nullptr
+      );
+      if (!reply) {
+        return 0;
+      }
+
+      GVariant *value;
+      g_variant_get(reply, "(v)", &value);
+      auto result = g_variant_get_uint32(value);
+      g_variant_unref(value);
+      g_variant_unref(reply);
+
+      return result;
+    }
+
+    /**
+     * @brief Run the CreateSession, SelectSources and Start handshake, then open the PipeWire remote.
+     * @param cursor Whether the compositor should draw the cursor into the frames.
+     * @return 0 on success, -1 on failure.
+     */
+    int start(bool cursor) {
+      // Signals are dispatched to the context that was the thread default when subscribing
+      g_main_context_push_thread_default(context);
+      auto fg = util::fail_guard([this]() {
+        g_main_context_pop_thread_default(context);
+      });
+
+      auto results = request("CreateSession", [](GVariantBuilder *options) {
+        g_variant_builder_add(options, "{sv}", "session_handle_token", g_variant_new_string("apollo"));
+        return g_variant_new("(a{sv})", options);
+      });
+      if (!results) {
+        return -1;
+      }
+
+      const char *handle = nullptr;
+      g_variant_lookup(results, "session_handle", "&s", &handle);
+      session_handle = handle ? handle : "";
+      g_variant_unref(results);
+      if (session_handle.empty()) {
+        BOOST_LOG(error) << "Portal didn't return a ScreenCast session"sv;
+        return -1;
+      }
+
+      std::string restore_token;
+      std::ifstream {restore_token_path()} >> restore_token;
+
+      auto cursor_modes = property("AvailableCursorModes");
+      results = request("SelectSources", [&](GVariantBuilder *options) {
+        g_variant_builder_add(options, "{sv}", "types", g_variant_new_uint32(SOURCE_TYPE_MONITOR));
+        g_variant_builder_add(options, "{sv}", "multiple", g_variant_new_boolean(false));
+        if (cursor && (cursor_modes & CURSOR_MODE_EMBEDDED)) {
+          g_variant_builder_add(options, "{sv}", "cursor_mode", g_variant_new_uint32(CURSOR_MODE_EMBEDDED));
+        }
+
+        // Only version 4 and later can skip the dialog on the next session
+        if (property("version") >= 4) {
+          g_variant_builder_add(options, "{sv}", "persist_mode", g_variant_new_uint32(PERSIST_MODE_PERSISTENT));
+          if (!restore_token.empty()) {
+            g_variant_builder_add(options, "{sv}", "restore_token", g_variant_new_string(restore_token.c_str()));
+          }
+        }
+        return g_variant_new("(oa{sv})", session_handle.c_str(), options);
+      });
+      if (!results) {
+        return -1;
+      }
+      g_variant_unref(results);
+
+      results = request("Start", [&](GVariantBuilder *options) {
+        return g_variant_new("(osa{sv})", session_handle.c_str(), "", options);
+      });
+      if (!results) {
+        return -1;
+      }
+      auto results_guard = util::fail_guard([&]() {
+        g_variant_unref(results);
+      });
+
+      // Restore tokens can only be used once, the portal hands out a new one
+      const char *new_token = nullptr;
+      if (g_variant_lookup(results, "restore_token", "&s", &new_token) && new_token) {
+        std::ofstream {restore_token_path()} << new_token;
+      }
+
+      GVariant *streams = g_variant_lookup_value(results, "streams", G_VARIANT_TYPE("a(ua{sv})"));
+      if (!streams || g_variant_n_children(streams) == 0) {
+        BOOST_LOG(error) << "Portal didn't return any PipeWire stream"sv;
+        if (streams) {
+          g_variant_unref(streams);
+        }
+        return -1;
+      }
+
+      GVariant *stream_props;
+      g_variant_get_child(streams, 0, "(u@a{sv})", &node_id, &stream_props);
+      g_variant_lookup(stream_props, "size", "(ii)", &width, &height);
+      g_variant_unref(stream_props);
+      g_variant_unref(streams);
+
+      return open_pipewire_remote();
+    }
+
+    GDBusConnection *conn = nullptr;
+    std::string session_handle;
+
+    int pipewire_fd = -1;
+    std::uint32_t node_id = 0;
+
+    // Size of the monitor as reported by the portal, 0 if unknown
+    int width = 0;
+    int height = 0;
+
+  private:
+    struct response_t {
+      bool done = false;
+      std::uint32_t code = 2;
+      GVariant *results = nullptr;
+    };
+
+    static void on_response(GDBusConnection *, const char *, const char *, const char *, const char *, GVariant *parameters, gpointer user_data) {
+      auto response = (response_t *) user_data;
+
+      g_variant_get(parameters, "(u@a{sv})", &response->code, &response->results);
+      response->done = true;
+    }
+
+    /**
+     * @brief Call a ScreenCast method that answers through a Request object and wait for the answer.
+     * @param method The method name.
+     * @param make_params Builds the call parameters from the options, which already contain the handle token.
+     * @return The results, or `nullptr` if the request failed or was cancelled.
+     */
+    template<class F>
+    GVariant *request(const char *method, F &&make_params) {
+      auto token = "apollo"s + std::to_string(++token_counter);
+      auto path = "/org/freedesktop/portal/desktop/request/"s + sender + '/' + token;
+
+      response_t response;
+
+      // Subscribe before the call, the response may arrive before the call returns
+      auto subscription = g_dbus_connection_signal_subscribe(conn, PORTAL_NAME, REQUEST_IFACE, "Response", path.c_str(), nullptr, G_DBUS_SIGNAL_FLAGS_NONE, on_response, &response, nullptr);
+      auto fg = util::fail_guard([&]() {
+        g_dbus_connection_signal_unsubscribe(conn, subscription);
+      });
+
+      GVariantBuilder options;
+      g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add(&options, "{sv}", "handle_token", g_variant_new_string(token.c_str()));
+
+      GError *err = nullptr;
+      auto reply = g_dbus_connection_call_sync(conn, PORTAL_NAME, PORTAL_PATH, SCREENCAST_IFACE, method, make_params(&options), nullptr, G_DBUS_CALL_FLAGS_NONE, -1, nullptr, &err);
+      if (!reply) {
+        BOOST_LOG(error) << "ScreenCast portal call "sv << method << " failed: "sv << err->message;
+        g_error_free(err);
+        return nullptr;
+      }
+      g_variant_unref(reply);
+
+      auto deadline = std::chrono::steady_clock::now() + REQUEST_TIMEOUT;
+      while (!response.done) {
+        if (std::chrono::steady_clock::now() > deadline) {
+          BOOST_LOG(error) << "Timed out waiting for ScreenCast portal call "sv << method;
+          return nullptr;
+        }
+
+        if (!g_main_context_iteration(context, false)) {
+          std::this_thread::sleep_for(10ms);
+        }
+      }
+
+      if (response.code != 0) {
+        BOOST_LOG(error) << "ScreenCast portal call "sv << method << (response.code == 1 ? " was cancelled by the user"sv : " failed"sv);
+        if (response.results) {
+          g_variant_unref(response.results);
+        }
+        return nullptr;
+      }
+
+      return response.results;
+    }
+
+    int open_pipewire_remote() {
+      GUnixFDList *fd_list = nullptr;
+      GError *err = nullptr;
+
+      GVariantBuilder options;
+      g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+
+      auto reply = g_dbus_connection_call_with_unix_fd_list_sync(
+        conn,
+        PORTAL_NAME,
+        PORTAL_PATH,
+        SCREENCAST_IFACE,
+        "OpenPipeWireRemote",
+        g_variant_new("(oa{sv})", session_handle.c_str(), &options),
+        G_VARIANT_TYPE("(h)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        nullptr,
+        &fd_list,
+        nullptr,
+        &err
+      );
+      if (!reply) {
+        BOOST_LOG(error) << "Couldn't open the PipeWire remote: "sv << err->message;
+        g_error_free(err);
+        return -1;
+      }
+
+      gint32 index;
+      g_variant_get(reply, "(h)", &index);
+      g_variant_unref(reply);
+
+      pipewire_fd = g_unix_fd_list_get(fd_list, index, &err);
+      g_object_unref(fd_list);
+      if (pipewire_fd < 0) {
+        BOOST_LOG(error) << "Couldn't get the PipeWire file descriptor: "sv << err->message;
+        g_error_free(err);
+        return -1;
+      }
+
+      return 0;
+    }
+
+    GMainContext *context = nullptr;
+    std::string sender;
+    int token_counter = 0;
+  };
+
+  /**
+   * @brief Latest frame delivered by the PipeWire stream.
+   */
+  struct frame_t {
+    std::uint64_t sequence = 0;  ///< Incremented for every delivered frame, 0 before the first one
+    std::chrono::steady_clock::time_point timestamp;  ///< When the frame was delivered
+
+    bool dmabuf = false;
+    egl::surface_descriptor_t sd {};  ///< Duplicated DMA-BUF file descriptors, owned by this frame
+
+    std::vector<std::uint8_t> pixels;  ///< Tightly packed copy of a shared memory frame
+
+    void close_fds() {
+      for (auto &fd : sd.fds) {
+        if (fd >= 0) {
+          close(fd);
+          fd = -1;
+        }
+      }
+    }
+  };
+
+  /**
+   * @brief PipeWire video stream consumer running on its own loop thread.
+   */
+  class stream_t {
+  public:
+    ~stream_t() {
+      if (loop) {
+        pw_thread_loop_lock(loop);
+        if (stream) {
+          pw_stream_destroy(stream);
+        }
+        if (core) {
+          pw_core_disconnect(core);
+        }
+        pw_thread_loop_unlock(loop);
+
+        pw_thread_loop_stop(loop);
+        if (context) {
+          pw_context_destroy(context);
+        }
+        pw_thread_loop_destroy(loop);
+      }
+
+      latest.close_fds();
+    }
+
+    /**
+     * @brief Connect to the PipeWire node of a portal session.
+     * @param fd The PipeWire remote, ownership is taken.
+     * @param node_id The node to consume.
+     * @param modifiers Supported DMA-BUF modifiers per entry of `formats`, empty entries aren't offered as DMA-BUF.
+     * @param allow_shm Whether shared memory buffers may be negotiated.
+     * @return 0 on success, -1 on failure.
+     */
+    int init(int fd, std::uint32_t node_id, const std::vector<std::uint64_t> (&modifiers)[std::size(formats)], bool allow_shm) {
+
+      pw_init(nullptr, nullptr);
+
+      loop = pw_thread_loop_new("portal-capture", nullptr);
+      if (!loop) {
+        close(fd);
+        return -1;
+      }
+
+      context = pw_context_new(pw_thread_loop_get_loop(loop), nullptr, 0);
+      if (!context || pw_thread_loop_start(loop) < 0) {
+        close(fd);
+        BOOST_LOG(error) << "Couldn't start the PipeWire loop"sv;
+        return -1;
+      }
+
+      pw_thread_loop_lock(loop);
+      auto fg = util::fail_guard([this]() {
+        pw_thread_loop_unlock(loop);
+      });
+
+      core = pw_context_connect_fd(context, fd, nullptr, 0);
+      if (!core) {
+        BOOST_LOG(error) << "Couldn't connect to PipeWire: "sv << strerror(errno);
+        return -1;
+      }
+
+      stream = pw_stream_new(core, "Apollo", pw_properties_new(PW_KEY_MEDIA_TYPE, "Video", PW_KEY_MEDIA_CATEGORY, "Capture", PW_KEY_MEDIA_ROLE, "Screen", nullptr));
+      if (!stream) {
+        BOOST_LOG(error) << "Couldn't create a PipeWire stream"sv;
+        return -1;
+      }
+
+      static const pw_stream_events events {
+        .version = PW_VERSION_STREAM_EVENTS,
+        .state_changed = on_state_changed,
+        .param_changed = on_param_changed,
+        .process = on_process,
+      };
+      pw_stream_add_listener(stream, &stream_listener, &events, this);
+
+      std::uint8_t buffer[4096];
+      spa_pod_builder builder {};
+      spa_pod_builder_init(&builder, buffer, sizeof(buffer));
+
+      std::vector<const spa_pod *> params;
+      for (std::size_t x = 0; x < std::size(formats); ++x) {
+        if (!modifiers[x].empty()) {
+          params.emplace_back(build_format(&builder, formats[x].spa_format, modifiers[x], std::nullopt));
+        }
+      }
+      if (allow_shm) {
+        for (auto &format : formats) {
+          if (format.shm) {
+            params.emplace_back(build_format(&builder, format.spa_format, {}, std::nullopt));
+          }
+        }
+      }
+
+      auto flags = (pw_stream_flags) (PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS);
+      if (pw_stream_connect(stream, PW_DIRECTION_INPUT, node_id, flags, params.data(), params.size()) < 0) {
+        BOOST_LOG(error) << "Couldn't connect the PipeWire stream to node "sv << node_id;
+        return -1;
+      }
+
+      return 0;
+    }
+
+    /**
+     * @brief Wait until the stream has negotiated a format.
+     * @param timeout How long to wait.
+     * @return `true` if a format was negotiated.
+     */
+    bool wait_for_format(std::chrono::milliseconds timeout) {
+      std::unique_lock ul {lock};
+      return cv.wait_for(ul, timeout, [this]() {
+        return negotiated || failed;
+      }) && !failed;
+    }
+
+    /**
+     * @brief Wait for a frame newer than the given sequence.
+     * @param sequence The sequence of the last consumed frame.
+     * @param timeout How long to wait.
+     * @param frame_out Receives the frame, DMA-BUF file descriptors are moved out of the stream.
+     * @return The capture status.
+     */
+    platf::capture_e next_frame(std::uint64_t sequence, std::chrono::milliseconds timeout, frame_t &frame_out) {
+      std::unique_lock ul {lock};
+      if (!cv.wait_for(ul, timeout, [&]() {
+            return latest.sequence > sequence || failed || renegotiated;
+          })) {
+        return platf::capture_e::timeout;
+      }
+
+      if (failed) {
+        return platf::capture_e::error;
+      }
+      if (renegotiated) {
+        return platf::capture_e::reinit;
+      }
+
+      frame_out.close_fds();
+      frame_out.sequence = latest.sequence;
+      frame_out.timestamp = latest.timestamp;
+      frame_out.dmabuf = latest.dmabuf;
+      frame_out.sd = latest.sd;
+      std::fill_n(latest.sd.fds, 4, -1);
+      if (!latest.dmabuf) {
+        frame_out.pixels.swap(latest.pixels);
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    int width = 0;
+    int height = 0;
+    bool dmabuf = false;
+
+  private:
+    static const spa_pod *build_format(spa_pod_builder *builder, spa_video_format format, const std::vector<std::uint64_t> &modifiers, std::optional<std::uint64_t> fixed_modifier) {
+      spa_rectangle default_size {1920, 1080};
+      spa_rectangle min_size {1, 1};
+      spa_rectangle max_size {16384, 16384};
+      spa_fraction default_rate {0, 1};
+      spa_fraction min_rate {0, 1};
+      spa_fraction max_rate {1000, 1};
+
+      spa_pod_frame object_frame;
+      spa_pod_builder_push_object(builder, &object_frame, SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
+      spa_pod_builder_add(builder, SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video), 0);
+      spa_pod_builder_add(builder, SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw), 0);
+      spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_format, SPA_POD_Id(format), 0);
+
+      if (fixed_modifier) {
+        spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY);
+        spa_pod_builder_long(builder, *fixed_modifier);
+      } else if (!modifiers.empty()) {
+        // The producer picks one of the modifiers that both sides support
+        spa_pod_frame choice_frame;
+        spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY | SPA_POD_PROP_FLAG_DONT_FIXATE);
+        spa_pod_builder_push_choice(builder, &choice_frame, SPA_CHOICE_Enum, 0);
+        spa_pod_builder_long(builder, modifiers[0]);
+        for (auto modifier : modifiers) {
+          spa_pod_builder_long(builder, modifier);
+        }
+        spa_pod_builder_pop(builder, &choice_frame);
+      }
+
+      spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_size, SPA_POD_CHOICE_RANGE_Rectangle(&default_size, &min_size, &max_size), 0);
+      spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_framerate, SPA_POD_CHOICE_RANGE_Fraction(&default_rate, &min_rate, &max_rate), 0);
+
+      return (const spa_pod *) spa_pod_builder_pop(builder, &object_frame);
+    }
+
+    static void on_state_changed(void *data, pw_stream_state old, pw_stream_state state, const char *error) {
+      auto self = (stream_t *) data;
+
+      if (state == PW_STREAM_STATE_ERROR || (state == PW_STREAM_STATE_UNCONNECTED && old != PW_STREAM_STATE_CONNECTING)) {
+        BOOST_LOG(error) << "PipeWire stream stopped: "sv << (error ? error : "disconnected");
+
+        std::lock_guard lg {self->lock};
+        self->failed = true;
+        self->cv.notify_all();
+      }
+    }
+
+    static void on_param_changed(void *data, std::uint32_t id, const spa_pod *param) {
+      auto self = (stream_t *) data;
+
+      if (!param || id != SPA_PARAM_Format) {
+        return;
+      }
+
+      spa_video_info_raw info {};
+      if (spa_format_video_raw_parse(param, &info) < 0) {
+        return;
+      }
+
+      auto modifier_prop = spa_pod_find_prop(param, nullptr, SPA_FORMAT_VIDEO_modifier);
+      if (modifier_prop && (modifier_prop->flags & SPA_POD_PROP_FLAG_DONT_FIXATE)) {
+        // The producer left the choice to us: fixate the first modifier and renegotiate
+        std::uint32_t count, choice;
+        auto values = spa_pod_get_values(&modifier_prop->value, &count, &choice);
+        if (count == 0 || SPA_POD_TYPE(values) != SPA_TYPE_Long) {
+          return;
+        }
+
+        std::uint8_t buffer[1024];
+        spa_pod_builder builder {};
+        spa_pod_builder_init(&builder, buffer, sizeof(buffer));
+        const spa_pod *fixed = build_format(&builder, info.format, {}, ((const std::int64_t *) SPA_POD_BODY(values))[0]);
+        pw_stream_update_params(self->stream, &fixed, 1);
+        return;
+      }
+
+      auto drm_format = std::find_if(std::begin(formats), std::end(formats), [&](auto &format) {
+        return format.spa_format == info.format;
+      });
+      if (drm_format == std::end(formats)) {
+        BOOST_LOG(error) << "PipeWire negotiated an unsupported video format: "sv << info.format;
+        return;
+      }
+
+      std::lock_guard lg {self->lock};
+
+      // Existing display_t objects can't handle a new size
+      self->renegotiated = self->renegotiated || (self->negotiated && (info.size.width != self->width || info.size.height != self->height));
+
+      self->width = info.size.width;
+      self->height = info.size.height;
+      self->dmabuf = modifier_prop != nullptr;
+      self->modifier = info.modifier;
+      self->drm_format = drm_format->drm_format;
+      self->negotiated = true;
+
+      BOOST_LOG(info) << "PipeWire negotiated "sv << self->width << 'x' << self->height << (self->dmabuf ? " DMA-BUF"sv : " shared memory"sv) << " frames"sv;
+
+      std::uint8_t buffer[256];
+      spa_pod_builder builder {};
+      spa_pod_builder_init(&builder, buffer, sizeof(buffer));
+      auto data_type = self->dmabuf ? 1 << SPA_DATA_DmaBuf : (1 << SPA_DATA_MemFd) | (1 << SPA_DATA_MemPtr);
+      const spa_pod *buffers = (const spa_pod *) spa_pod_builder_add_object(&builder, SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers, SPA_PARAM_BUFFERS_dataType, SPA_POD_Int(data_type));
+      pw_stream_update_params(self->stream, &buffers, 1);
+
+      self->cv.notify_all();
+    }
+
+    static void on_process(void *data) {
+      auto self = (stream_t *) data;
+
+      // Only the newest buffer matters, give older ones back right away
+      pw_buffer *pw_buf = nullptr;
+      while (auto next = pw_stream_dequeue_buffer(self->stream)) {
+        if (pw_buf) {
+          pw_stream_queue_buffer(self->stream, pw_buf);
+        }
+        pw_buf = next;
+      }
+      if (!pw_buf) {
+        return;
+      }
+      auto fg = util::fail_guard([&]() {
+        pw_stream_queue_buffer(self->stream, pw_buf);
+      });
+
+      auto buf = pw_buf->buffer;
+      auto &plane = buf->datas[0];
+      if (plane.chunk->flags & SPA_CHUNK_FLAG_CORRUPTED) {
+        return;
+      }
+
+      std::lock_guard lg {self->lock};
+      auto &frame = self->latest;
+
+      if (plane.type == SPA_DATA_DmaBuf) {
+        frame.close_fds();
+        for (std::uint32_t x = 0; x < std::min<std::uint32_t>(buf->n_datas, 4); ++x) {
+          frame.sd.fds[x] = fcntl(buf->datas[x].fd, F_DUPFD_CLOEXEC, 0);
+          frame.sd.offsets[x] = buf->datas[x].chunk->offset;
+          frame.sd.pitches[x] = buf->datas[x].chunk->stride;
+        }
+        frame.sd.width = self->width;
+        frame.sd.height = self->height;
+        frame.sd.fourcc = self->drm_format;
+        frame.sd.modifier = self->modifier;
+        frame.dmabuf = true;
+      } else if (plane.data && plane.chunk->size) {
+        auto src = (const std::uint8_t *) SPA_PTROFF(plane.data, plane.chunk->offset, void);
+        auto row_size = self->width * 4;
+        auto stride = plane.chunk->stride ? plane.chunk->stride : row_size;
+
+        frame.pixels.resize(row_size * self->height);
+        for (int y = 0; y < self->height; ++y) {
+          std::copy_n(src + y * stride, row_size, frame.pixels.data() + y * row_size);
+        }
+        frame.dmabuf = false;
+      } else {
+        return;
+      }
+
+      ++frame.sequence;
+      frame.timestamp = std::chrono::steady_clock::now();
+      self->cv.notify_all();
+    }
+
+    pw_thread_loop *loop = nullptr;
+    pw_context *context = nullptr;
+    pw_core *core = nullptr;
+    pw_stream *stream = nullptr;
+    spa_hook stream_listener {};
+
+    // Protected by lock, written on the PipeWire loop thread
+    std::mutex lock;
+    std::condition_variable cv;
+    bool negotiated = false;
+    bool renegotiated = false;
+    bool failed = false;
+    std::uint64_t modifier = DRM_FORMAT_MOD_INVALID;
+    std::uint32_t drm_format = 0;
+    frame_t latest;
+  };
+
+  struct img_t: public platf::img_t {
+    ~img_t() override {
+      delete[] data;
+      data = nullptr;
+    }
+  };
+
+  class portal_t: public platf::display_t {
+  public:
+    /**
+     * @brief Start a portal session and connect to its stream.
+     * @param hwdevice_type The memory type of the encoder.
+     * @param config The stream configuration.
+     * @param dmabuf_only Whether only DMA-BUF frames are useful to the caller.
+     * @return 0 on success, -1 on failure.
+     */
+    int init(platf::mem_type_e hwdevice_type, const ::video::config_t &config, bool dmabuf_only) {
+      delay = std::chrono::nanoseconds {1s} / config.framerate;
+      mem_type = hwdevice_type;
+
+      if (wl_display.init()) {
+        return -1;
+      }
+
+      egl_display = egl::make_display(wl_display.get());
+      if (!egl_display) {
+        return -1;
+      }
+
+      auto ctx_opt = egl::make_ctx(egl_display.get());
+      if (!ctx_opt) {
+        return -1;
+      }
+      ctx = std::move(*ctx_opt);
+
+      if (session.connect() || session.start(true)) {
+        return -1;
+      }
+
+      std::vector<std::uint64_t> modifiers[std::size(formats)];
+      query_modifiers(modifiers);
+
+      auto fd = std::exchange(session.pipewire_fd, -1);
+      if (stream.init(fd, session.node_id, modifiers, !dmabuf_only)) {
+        return -1;
+      }
+
+      if (!stream.wait_for_format(5s)) {
+        BOOST_LOG(error) << "PipeWire stream didn't negotiate a usable format"sv;
+        return -1;
+      }
+
+      if (dmabuf_only && !stream.dmabuf) {
+        BOOST_LOG(warning) << "PipeWire stream doesn't provide DMA-BUF frames"sv;
+        return -1;
+      }
+
+      width = stream.width;
+      height = stream.height;
+      env_width = width;
+      env_height = height;
+
+      BOOST_LOG(info) << "Capturing PipeWire node "sv << session.node_id << " at "sv << width << 'x' << height;
+
+      return 0;
+    }
+
+    platf::capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+      auto next_frame = std::chrono::steady_clock::now();
+
+      sleep_overshoot_logger.reset();
+
+      while (true) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (next_frame > now) {
+          std::this_thread::sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+
+        std::shared_ptr<platf::img_t> img_out;
+        auto status = snapshot(pull_free_image_cb, img_out, 1000ms);
+        switch (status) {
+          case platf::capture_e::reinit:
+          case platf::capture_e::error:
+          case platf::capture_e::interrupted:
+            return status;
+          case platf::capture_e::timeout:
+            if (!push_captured_image_cb(std::move(img_out), false)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          case platf::capture_e::ok:
+            if (!push_captured_image_cb(std::move(img_out), true)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          default:
+            BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
+            return status;
+        }
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    virtual platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout) = 0;
+
+    int dummy_img(platf::img_t *img) override {
+      return 0;
+    }
+
+    std::optional<std::string> encoder_binding() override {
+      // The encode devices are made from the size of the display only
+      return "portal:"s + std::to_string((int) mem_type);
+    }
+
+    platf::mem_type_e mem_type;
+
+    std::chrono::nanoseconds delay;
+
+    wl::display_t wl_display;
+    egl::display_t egl_display;
+    egl::ctx_t ctx;
+
+    session_t session;
+    stream_t stream;
+
+    frame_t frame;
+
+  private:
+    /**
+     * @brief Collect the DMA-BUF modifiers EGL can import for each format.
+     * @param modifiers Receives the modifiers, in the order of `formats`.
+     */
+    void query_modifiers(std::vector<std::uint64_t> (&modifiers)[std::size(formats)]) {
+      auto query = (query_dmabuf_modifiers_fn) eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+
+      for (std::size_t x = 0; x < std::size(formats); ++x) {
+        EGLint count = 0;
+        if (query && query(egl_display.get(), formats[x].drm_format, 0, nullptr, nullptr, &count) && count > 0) {
+          std::vector<EGLuint64KHR> egl_modifiers(count);
+          std::vector<EGLBoolean> external_only(count);
+          query(egl_display.get(), formats[x].drm_format, count, egl_modifiers.data(), external_only.data(), &count);
+
+          for (EGLint y = 0; y < count; ++y) {
+            // External only images can't be sampled as regular 2D textures
+            if (!external_only[y]) {
+              modifiers[x].emplace_back(egl_modifiers[y]);
+            }
+          }
+        }
+
+        // Implicit modifiers work with every driver
+        modifiers[x].emplace_back(DRM_FORMAT_MOD_INVALID);
+      }
+    }
+  };
+
+  class portal_ram_t: public portal_t {
+  public:
+    platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout) override {
+      auto status = stream.next_frame(frame.sequence, timeout, frame);
+      if (status != platf::capture_e::ok) {
+        return status;
+      }
+
+      if (!pull_free_image_cb(img_out)) {
+        return platf::capture_e::interrupted;
+      }
+
+      img_out->frame_timestamp = frame.timestamp;
+
+      if (!frame.dmabuf) {
+        std::copy_n(frame.pixels.data(), std::min<std::size_t>(frame.pixels.size(), img_out->height * img_out->row_pitch), img_out->data);
+        return platf::capture_e::ok;
+      }
+
+      auto rgb_opt = egl::import_source(egl_display.get(), frame.sd);
+      if (!rgb_opt) {
+        return platf::capture_e::reinit;
+      }
+
+      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb_opt)->tex[0]);
+      gl::ctx.GetTextureSubImage((*rgb_opt)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+      gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+
+      return platf::capture_e::ok;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == platf::mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda) {
+        return cuda::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+    std::unique_ptr<platf::nvenc_encode_device_t> make_nvenc_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda && pix_fmt == platf::pix_fmt_e::nv12) {
+        return cuda::make_nvenc_encode_device(width, height, false);
+      }
+#endif
+
+      return nullptr;
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<img_t>();
+      img->width = width;
+      img->height = height;
+      img->pixel_pitch = 4;
+      img->row_pitch = img->pixel_pitch * width;
+      img->data = new std::uint8_t[height * img->row_pitch];
+
+      return img;
+    }
+  };
+
+  class portal_vram_t: public portal_t {
+  public:
+    platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout) override {
+      auto status = stream.next_frame(frame.sequence, timeout, frame);
+      if (status != platf::capture_e::ok) {
+        return status;
+      }
+
+      if (!pull_free_image_cb(img_out)) {
+        return platf::capture_e::interrupted;
+      }
+      auto img = (egl::img_descriptor_t *) img_out.get();
+      img->reset();
+
+      // PipeWire recycles a small set of buffers, so import every frame like wlgrab does
+      ++sequence;
+      img->sequence = sequence;
+      img->frame_timestamp = frame.timestamp;
+
+      // The image takes ownership of the file descriptors
+      img->sd = frame.sd;
+      std::fill_n(frame.sd.fds, 4, -1);
+
+      return platf::capture_e::ok;
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<egl::img_descriptor_t>();
+
+      img->width = width;
+      img->height = height;
+      img->sequence = 0;
+      img->serial = std::numeric_limits<decltype(img->serial)>::max();
+      img->data = nullptr;
+
+      // File descriptors aren't open
+      std::fill_n(img->sd.fds, 4, -1);
+
+      return img;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == platf::mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, 0, 0, true);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda) {
+        return cuda::make_avcodec_gl_encode_device(width, height, 0, 0);
+      }
+#endif
+
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      // Empty images are recognized as dummies by the zero sequence number
+      return 0;
+    }
+
+    std::uint64_t sequence {};
+  };
+}  // namespace portal
+
+namespace platf {
+  std::shared_ptr<display_t> portal_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+    if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::vaapi && hwdevice_type != platf::mem_type_e::cuda) {
+      BOOST_LOG(error) << "Could not initialize display with the given hw device type."sv;
+      return nullptr;
+    }
+
+    // The monitor is picked in the portal dialog, display_name is ignored
+    if (hwdevice_type == platf::mem_type_e::vaapi || hwdevice_type == platf::mem_type_e::cuda) {
+      auto portal = std::make_shared<portal::portal_vram_t>();
+      if (!portal->init(hwdevice_type, config, true)) {
+        return portal;
+      }
+
+      BOOST_LOG(info) << "Falling back to shared memory PipeWire capture"sv;
+    }
+
+    auto portal = std::make_shared<portal::portal_ram_t>();
+    if (portal->init(hwdevice_type, config, false)) {
+      return nullptr;
+    }
+
+    return portal;
+  }
+
+  std::vector<std::string> portal_display_names() {
+    portal::session_t session;
+    if (session.connect() || session.property("version") == 0) {
+      return {};
+    }
+
+    // A session only ever provides the monitor chosen by the user
+    return {"0"s};
+  }
+}  // namespace platf
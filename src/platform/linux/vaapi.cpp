@@ -3,16 +3,23 @@
  * @brief Definitions for VA-API hardware accelerated capture.
  */
 // standard includes
+#include <algorithm>
+#include <cmath>
 #include <fcntl.h>
+#include <filesystem>
 #include <format>
 #include <sstream>
+#include <optional>
 #include <string>
+#include <unistd.h>
+#include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavutil/pixdesc.h>
 #include <va/va.h>
 #include <va/va_drm.h>
+#include <va/va_vpp.h>
 #if !VA_CHECK_VERSION(1, 9, 0)
   // vaSyncBuffer stub allows Sunshine built against libva <2.9.0 to link against ffmpeg on libva 2.9.0 or later
   VAStatus
@@ -30,9 +37,11 @@ extern "C" {
 #include "graphics.h"
 #include "misc.h"
 #include "src/config.h"
+#include "src/gpu_placement.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/utility.h"
+#include "src/video_colorspace.h"
 #include "src/video.h"
 
 using namespace std::literals;
@@ -44,6 +53,12 @@ namespace va {
   constexpr auto EXPORT_SURFACE_WRITE_ONLY = 0x0002;
   constexpr auto EXPORT_SURFACE_SEPARATE_LAYERS = 0x0004;
 
+  // DRM formats of captured framebuffers, libdrm isn't required to build VA-API support
+  constexpr std::uint32_t DRM_FORMAT_XRGB8888 = VA_FOURCC('X', 'R', '2', '4');
+  constexpr std::uint32_t DRM_FORMAT_ARGB8888 = VA_FOURCC('A', 'R', '2', '4');
+  constexpr std::uint32_t DRM_FORMAT_XBGR8888 = VA_FOURCC('X', 'B', '2', '4');
+  constexpr std::uint32_t DRM_FORMAT_ABGR8888 = VA_FOURCC('A', 'B', '2', '4');
+
   using VADisplay = void *;
   using VAStatus = int;
   using VAGenericID = unsigned int;
@@ -292,19 +307,126 @@ namespace va {
     }
 
     int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx_buf) override {
-      this->hwframe.reset(frame);
-      this->frame = frame;
+      pool.clear();
+      pool.resize(frame_pool_size);
+      pool[0].frame.reset(frame);
+
+      for (int x = 1; x < frame_pool_size; ++x) {
+        auto &pool_frame = pool[x].frame;
+        pool_frame.reset(av_frame_alloc());
+        pool_frame->format = frame->format;
+        pool_frame->width = frame->width;
+        pool_frame->height = frame->height;
+        if (av_frame_copy_props(pool_frame.get(), frame) < 0) {
+          BOOST_LOG(error) << "Couldn't copy the properties of the VAAPI hwframe"sv;
+          return -1;
+        }
+      }
+
+      auto hw_frames_ctx = (AVHWFramesContext *) hw_frames_ctx_buf->data;
+
+      // Every surface is exported and imported into EGL once, converted frames rotate through them
+      for (auto &pool_frame : pool) {
+        if (!pool_frame.frame->buf[0]) {
+          if (av_hwframe_get_buffer(hw_frames_ctx_buf, pool_frame.frame.get(), 0)) {
+            BOOST_LOG(error) << "Couldn't get hwframe for VAAPI"sv;
+            return -1;
+          }
+        }
 
-      if (!frame->buf[0]) {
-        if (av_hwframe_get_buffer(hw_frames_ctx_buf, frame, 0)) {
-          BOOST_LOG(error) << "Couldn't get hwframe for VAAPI"sv;
+        auto nv12_opt = import_frame(pool_frame.frame.get());
+        if (!nv12_opt) {
           return -1;
         }
+
+        pool_frame.nv12 = std::move(*nv12_opt);
+      }
+
+      auto sws_opt = egl::sws_t::make(width, height, frame->width, frame->height, hw_frames_ctx->sw_format);
+      if (!sws_opt) {
+        return -1;
       }
 
+      this->sws = std::move(*sws_opt);
+
+      current_frame = 0;
+      this->frame = frame;
+
+      return 0;
+    }
+
+    /**
+     * @brief Move on to the next frame of the pool, so the encoder can still read the last one while it's overwritten.
+     * @return The target to convert into.
+     */
+    egl::nv12_t &advance_frame() {
+      auto previous = pool[current_frame].frame.get();
+      current_frame = (current_frame + 1) % pool.size();
+      auto next = pool[current_frame].frame.get();
+
+      // A keyframe may have been requested before the frame was converted
+      next->pict_type = previous->pict_type;
+      next->flags = (next->flags & ~AV_FRAME_FLAG_KEY) | (previous->flags & AV_FRAME_FLAG_KEY);
+
+      // The encode that read the surface is usually done by now, the timeout only guards against a hung driver
+      constexpr std::uint64_t sync_timeout_ns = 100'000'000;
+      VASurfaceID surface = (std::uintptr_t) next->data[3];
+#if VA_CHECK_VERSION(1, 15, 0)
+      auto status = vaSyncSurface2(va_display, surface, sync_timeout_ns);
+      if (status == VA_STATUS_ERROR_UNIMPLEMENTED) {
+        status = vaSyncSurface(va_display, surface);
+      }
+#else
+      auto status = vaSyncSurface(va_display, surface);
+#endif
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(warning) << "Couldn't sync VA surface ["sv << surface << "]: "sv << vaErrorStr(status);
+      }
+
+      this->frame = next;
+      return pool[current_frame].nv12;
+    }
+
+    void apply_colorspace() override {
+      sws.apply_colorspace(colorspace);
+    }
+
+    /**
+     * @brief A hardware frame of the pool with its surface imported into EGL.
+     */
+    struct pool_frame_t {
+      frame_t frame;
+      egl::nv12_t nv12;
+    };
+
+    static constexpr int frame_pool_size = 3;  ///< Surfaces converted frames rotate through
+
+    va::display_t::pointer va_display;
+    file_t file;
+    std::unique_ptr<platf::deinit_t> placement;  ///< Load of this encoder on the render device it was placed on
+
+    gbm::gbm_t gbm;
+    egl::display_t display;
+    egl::ctx_t ctx;
+
+    // This must be destroyed before display_t to ensure the GPU
+    // driver is still loaded when vaDestroySurfaces() is called.
+    std::vector<pool_frame_t> pool;
+    std::size_t current_frame = 0;
+
+    egl::sws_t sws;
+
+    int width, height;
+
+  private:
+    /**
+     * @brief Export the surface of a hardware frame and import it into EGL as a render target.
+     * @param frame The hardware frame.
+     * @return The render target, or an empty value on failure.
+     */
+    std::optional<egl::nv12_t> import_frame(AVFrame *frame) {
       va::DRMPRIMESurfaceDescriptor prime;
       va::VASurfaceID surface = (std::uintptr_t) frame->data[3];
-      auto hw_frames_ctx = (AVHWFramesContext *) hw_frames_ctx_buf->data;
 
       auto status = vaExportSurfaceHandle(
         this->va_display,
@@ -316,7 +438,7 @@ namespace va {
       if (status) {
         BOOST_LOG(error) << "Couldn't export va surface handle: ["sv << (int) surface << "]: "sv << vaErrorStr(status);
 
-        return -1;
+        return std::nullopt;
       }
 
       // Keep track of file descriptors
@@ -327,7 +449,7 @@ namespace va {
 
       if (prime.num_layers != 2) {
         BOOST_LOG(error) << "Invalid layer count for VA surface: expected 2, got "sv << prime.num_layers;
-        return -1;
+        return std::nullopt;
       }
 
       egl::surface_descriptor_t sds[2] = {};
@@ -352,46 +474,15 @@ namespace va {
         }
       }
 
-      auto nv12_opt = egl::import_target(display.get(), std::move(fds), sds[0], sds[1]);
-      if (!nv12_opt) {
-        return -1;
-      }
-
-      auto sws_opt = egl::sws_t::make(width, height, frame->width, frame->height, hw_frames_ctx->sw_format);
-      if (!sws_opt) {
-        return -1;
-      }
-
-      this->sws = std::move(*sws_opt);
-      this->nv12 = std::move(*nv12_opt);
-
-      return 0;
-    }
-
-    void apply_colorspace() override {
-      sws.apply_colorspace(colorspace);
+      return egl::import_target(display.get(), std::move(fds), sds[0], sds[1]);
     }
-
-    va::display_t::pointer va_display;
-    file_t file;
-
-    gbm::gbm_t gbm;
-    egl::display_t display;
-    egl::ctx_t ctx;
-
-    // This must be destroyed before display_t to ensure the GPU
-    // driver is still loaded when vaDestroySurfaces() is called.
-    frame_t hwframe;
-
-    egl::sws_t sws;
-    egl::nv12_t nv12;
-
-    int width, height;
   };
 
   class va_ram_t: public va_t {
   public:
     int convert(platf::img_t &img) override {
+      auto &nv12 = advance_frame();
+
       sws.load_ram(img);
 
       sws.convert(nv12->buf);
@@ -401,32 +492,71 @@ namespace va {
 
   class va_vram_t: public va_t {
   public:
+    ~va_vram_t() override {
+      destroy_vpp();
+    }
+
     int convert(platf::img_t &img) override {
       auto &descriptor = (egl::img_descriptor_t &) img;
+      auto &nv12 = advance_frame();
+
+      // The cursor is blended by the shaders, so frames showing it take the EGL path
+      if (vpp_context != VA_INVALID_ID && descriptor.sequence != 0 && !descriptor.data) {
+        if (!convert_vpp(descriptor)) {
+          return 0;
+        }
+
+        BOOST_LOG(warning) << "Falling back to EGL for converting captured frames"sv;
+        destroy_vpp();
+      }
 
       if (descriptor.sequence == 0) {
         // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
-        rgb = egl::create_blank(img);
+        blank = egl::create_blank(img);
+        rgb = &blank;
       } else if (descriptor.sequence > sequence) {
         sequence = descriptor.sequence;
 
-        rgb = egl::rgb_t {};
-
-        auto rgb_opt = egl::import_source(display.get(), descriptor.sd);
-
-        if (!rgb_opt) {
+        rgb = imports.import(display.get(), descriptor.sd);
+        if (!rgb) {
           return -1;
         }
-
-        rgb = std::move(*rgb_opt);
       }
 
-      sws.load_vram(descriptor, offset_x, offset_y, rgb->tex[0]);
+      sws.load_vram(descriptor, offset_x, offset_y, (*rgb)->tex[0]);
 
       sws.convert(nv12->buf);
       return 0;
     }
 
+    void rebind() override {
+      // The images of the new display are numbered from the start again
+      sequence = 0;
+      vpp_sequence = 0;
+      rgb = nullptr;
+      imports.clear();
+    }
+
+    int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx_buf) override {
+      if (va_t::set_frame(frame, hw_frames_ctx_buf)) {
+        return -1;
+      }
+
+      // The video processing context renders into the surfaces of the previous pool
+      destroy_vpp();
+
+      auto hw_frames_ctx = (AVHWFramesContext *) hw_frames_ctx_buf->data;
+      if (config::video.vaapi.direct_import) {
+        if (hw_frames_ctx->sw_format == AV_PIX_FMT_NV12) {
+          init_vpp();
+        } else {
+          BOOST_LOG(info) << "VA-API direct import is only used for 8-bit SDR streams"sv;
+        }
+      }
+
+      return 0;
+    }
+
     int init(int in_width, int in_height, file_t &&render_device, int offset_x, int offset_y) {
       if (va_t::init(in_width, in_height, std::move(render_device))) {
         return -1;
@@ -441,9 +571,215 @@ namespace va {
     }
 
     std::uint64_t sequence;
-    egl::rgb_t rgb;
+    egl::rgb_t blank;
+    egl::import_cache_t imports;
+    const egl::rgb_t *rgb = nullptr;  ///< Either the blank texture or an import
 
     int offset_x, offset_y;
+
+  private:
+    /**
+     * @brief Create a video processing context that renders into the hardware frames of the pool.
+     */
+    void init_vpp() {
+      auto status = vaCreateConfig(va_display, VAProfileNone, VAEntrypointVideoProc, nullptr, 0, &vpp_config);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(warning) << "Couldn't create VA-API video processing config: "sv << vaErrorStr(status);
+        vpp_config = VA_INVALID_ID;
+        return;
+      }
+
+      std::vector<VASurfaceID> targets;
+      for (auto &pool_frame : pool) {
+        targets.push_back((std::uintptr_t) pool_frame.frame->data[3]);
+      }
+      status = vaCreateContext(va_display, vpp_config, frame->width, frame->height, VA_PROGRESSIVE, targets.data(), targets.size(), &vpp_context);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(warning) << "Couldn't create VA-API video processing context: "sv << vaErrorStr(status);
+        vpp_context = VA_INVALID_ID;
+        destroy_vpp();
+        return;
+      }
+
+      BOOST_LOG(info) << "Converting captured frames with VA-API video processing"sv;
+    }
+
+    void destroy_vpp() {
+      if (src_surface != VA_INVALID_ID) {
+        vaDestroySurfaces(va_display, &src_surface, 1);
+        src_surface = VA_INVALID_ID;
+      }
+      if (vpp_context != VA_INVALID_ID) {
+        vaDestroyContext(va_display, vpp_context);
+        vpp_context = VA_INVALID_ID;
+      }
+      if (vpp_config != VA_INVALID_ID) {
+        vaDestroyConfig(va_display, vpp_config);
+        vpp_config = VA_INVALID_ID;
+      }
+      vpp_sequence = 0;
+    }
+
+    /**
+     * @brief Wrap the DMA-BUF of a captured frame in a VA surface.
+     * @param sd The captured framebuffer.
+     * @return `true` on success.
+     */
+    bool import_surface(const egl::surface_descriptor_t &sd) {
+      std::uint32_t va_fourcc;
+      switch (sd.fourcc) {
+        case DRM_FORMAT_XRGB8888:
+          va_fourcc = VA_FOURCC_BGRX;
+          break;
+        case DRM_FORMAT_ARGB8888:
+          va_fourcc = VA_FOURCC_BGRA;
+          break;
+        case DRM_FORMAT_XBGR8888:
+          va_fourcc = VA_FOURCC_RGBX;
+          break;
+        case DRM_FORMAT_ABGR8888:
+          va_fourcc = VA_FOURCC_RGBA;
+          break;
+        default:
+          BOOST_LOG(warning) << "Unsupported framebuffer format for VA-API import: "sv << util::view(sd.fourcc);
+          return false;
+      }
+
+      va::DRMPRIMESurfaceDescriptor prime {};
+      prime.fourcc = va_fourcc;
+      prime.width = sd.width;
+      prime.height = sd.height;
+      prime.num_layers = 1;
+      prime.layers[0].drm_format = sd.fourcc;
+
+      // Every plane is described as its own object, drivers coalesce identical buffers
+      for (int x = 0; x < 4 && sd.fds[x] >= 0; ++x) {
+        auto &object = prime.objects[x];
+        object.fd = sd.fds[x];
+        object.size = lseek(sd.fds[x], 0, SEEK_END);
+        object.drm_format_modifier = sd.modifier;
+
+        prime.layers[0].object_index[x] = x;
+        prime.layers[0].offset[x] = sd.offsets[x];
+        prime.layers[0].pitch[x] = sd.pitches[x];
+
+        ++prime.num_objects;
+        ++prime.layers[0].num_planes;
+      }
+
+      VASurfaceAttrib attribs[2] {};
+      attribs[0].type = VASurfaceAttribMemoryType;
+      attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+      attribs[0].value.type = VAGenericValueTypeInteger;
+      attribs[0].value.value.i = va::SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2;
+      attribs[1].type = VASurfaceAttribExternalBufferDescriptor;
+      attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+      attribs[1].value.type = VAGenericValueTypePointer;
+      attribs[1].value.value.p = &prime;
+
+      auto status = vaCreateSurfaces(va_display, VA_RT_FORMAT_RGB32, sd.width, sd.height, &src_surface, 1, attribs, 2);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(warning) << "Couldn't import framebuffer into a VA surface: "sv << vaErrorStr(status);
+        src_surface = VA_INVALID_ID;
+        return false;
+      }
+
+      return true;
+    }
+
+    /**
+     * @brief Scale and convert a captured frame into the hardware frame on the video engine.
+     * @param descriptor The captured frame.
+     * @return 0 on success, -1 if the EGL path must be used instead.
+     */
+    int convert_vpp(egl::img_descriptor_t &descriptor) {
+      if (descriptor.sequence > vpp_sequence) {
+        if (src_surface != VA_INVALID_ID) {
+          vaDestroySurfaces(va_display, &src_surface, 1);
+          src_surface = VA_INVALID_ID;
+        }
+
+        if (!import_surface(descriptor.sd)) {
+          return -1;
+        }
+
+        vpp_sequence = descriptor.sequence;
+      }
+
+      // Letterbox the same way as egl::sws_t
+      auto scalar = std::fminf(frame->width / (float) width, frame->height / (float) height);
+      auto out_width = (int) (width * scalar);
+      auto out_height = (int) (height * scalar);
+
+      VARectangle src_region {
+        (std::int16_t) offset_x,
+        (std::int16_t) offset_y,
+        (std::uint16_t) width,
+        (std::uint16_t) height,
+      };
+      VARectangle dst_region {
+        (std::int16_t) ((frame->width - out_width) / 2),
+        (std::int16_t) ((frame->height - out_height) / 2),
+        (std::uint16_t) out_width,
+        (std::uint16_t) out_height,
+      };
+
+      VAProcPipelineParameterBuffer params {};
+      params.surface = src_surface;
+      params.surface_region = &src_region;
+      params.output_region = &dst_region;
+      params.output_background_color = 0xFF000000;
+      params.surface_color_standard = VAProcColorStandardSRGB;
+      switch (colorspace.colorspace) {
+        case video::colorspace_e::rec601:
+          params.output_color_standard = VAProcColorStandardBT601;
+          break;
+        case video::colorspace_e::rec709:
+          params.output_color_standard = VAProcColorStandardBT709;
+          break;
+        default:
+          params.output_color_standard = VAProcColorStandardBT2020;
+          break;
+      }
+#if VA_CHECK_VERSION(1, 3, 0)
+      params.input_color_properties.color_range = VA_SOURCE_RANGE_FULL;
+      params.output_color_properties.color_range = colorspace.full_range ? VA_SOURCE_RANGE_FULL : VA_SOURCE_RANGE_REDUCED;
+#endif
+
+      VASurfaceID target = (std::uintptr_t) frame->data[3];
+
+      VABufferID params_buf;
+      auto status = vaCreateBuffer(va_display, vpp_context, VAProcPipelineParameterBufferType, sizeof(params), 1, &params, &params_buf);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(warning) << "Couldn't create VA-API video processing parameters: "sv << vaErrorStr(status);
+        return -1;
+      }
+      auto fg = util::fail_guard([&]() {
+        vaDestroyBuffer(va_display, params_buf);
+      });
+
+      status = vaBeginPicture(va_display, vpp_context, target);
+      if (status == VA_STATUS_SUCCESS) {
+        status = vaRenderPicture(va_display, vpp_context, &params_buf, 1);
+
+        // The picture must be ended even when rendering failed
+        auto end_status = vaEndPicture(va_display, vpp_context);
+        if (status == VA_STATUS_SUCCESS) {
+          status = end_status;
+        }
+      }
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(warning) << "Couldn't convert frame with VA-API video processing: "sv << vaErrorStr(status);
+        return -1;
+      }
+
+      return 0;
+    }
+
+    VAConfigID vpp_config = VA_INVALID_ID;
+    VAContextID vpp_context = VA_INVALID_ID;
+    VASurfaceID src_surface = VA_INVALID_ID;
+    std::uint64_t vpp_sequence = 0;
   };
 
   /**
@@ -625,10 +961,44 @@ namespace va {
     }
   }
 
+  /**
+   * @brief Get the render devices able to encode, the preferred one first.
+   */
+  static std::vector<std::string> encode_render_devices(const std::string &preferred) {
+    std::vector<std::string> render_devices;
+
+    std::error_code ec;
+    for (auto &entry : std::filesystem::directory_iterator {"/dev/dri", ec}) {
+      if (entry.path().filename().string().starts_with("renderD"sv)) {
+        render_devices.emplace_back(entry.path().string());
+      }
+    }
+    std::sort(std::begin(render_devices), std::end(render_devices));
+    std::stable_partition(std::begin(render_devices), std::end(render_devices), [&](const std::string &render_device) {
+      return render_device == preferred;
+    });
+
+    std::erase_if(render_devices, [](const std::string &render_device) {
+      file_t file = open(render_device.c_str(), O_RDWR);
+      return file.el < 0 || !validate(file.el);
+    });
+    return render_devices;
+  }
+
   std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, int offset_x, int offset_y, bool vram) {
-    auto render_device = config::video.adapter_name.empty() ? "/dev/dri/renderD128" : config::video.adapter_name.c_str();
+    std::string render_device = config::video.adapter_name.empty() ? "/dev/dri/renderD128" : config::video.adapter_name;
+
+    // Frames in system memory can be uploaded to any GPU, so they are encoded on the least loaded one
+    std::unique_ptr<platf::deinit_t> placement;
+    if (!vram && config::video.adapter_balancing) {
+      auto render_devices = encode_render_devices(render_device);
+      if (auto placed = gpu_placement::balancer().acquire(render_devices, (std::uint64_t) width * height)) {
+        render_device = render_devices[placed->index];
+        placement = std::move(placed->lease);
+      }
+    }
 
-    file_t file = open(render_device, O_RDWR);
+    file_t file = open(render_device.c_str(), O_RDWR);
     if (file.el < 0) {
       char string[1024];
       BOOST_LOG(error) << "Couldn't open "sv << render_device << ": " << strerror_r(errno, string, sizeof(string));
@@ -636,7 +1006,12 @@ namespace va {
       return nullptr;
     }
 
-    return make_avcodec_encode_device(width, height, std::move(file), offset_x, offset_y, vram);
+    auto encode_device = make_avcodec_encode_device(width, height, std::move(file), offset_x, offset_y, vram);
+    if (encode_device && placement) {
+      BOOST_LOG(info) << "Encoding on "sv << render_device;
+      static_cast<va_t *>(encode_device.get())->placement = std::move(placement);
+    }
+    return encode_device;
   }
 
   std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, bool vram) {
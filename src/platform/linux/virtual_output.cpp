@@ -0,0 +1,184 @@
+/**
+ * @file src/platform/linux/virtual_output.cpp
+ * @brief Definitions for virtual outputs created on the Wayland compositor for headless streaming.
+ */
+// standard includes
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <vector>
+
+// platform includes
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "misc.h"
+#include "src/logging.h"
+#include "virtual_output.h"
+
+using namespace std::literals;
+
+namespace platf::virtual_output {
+  namespace {
+    constexpr std::string_view ipc_magic = "i3-ipc"sv;
+    constexpr std::uint32_t ipc_run_command = 0;
+    constexpr std::uint32_t ipc_get_outputs = 3;
+
+    /**
+     * @brief Header of the messages of the Sway IPC, the integers are in native byte order.
+     */
+    struct ipc_header_t {
+      char magic[6];
+      std::uint32_t length;
+      std::uint32_t type;
+    } __attribute__((packed));
+
+    bool send_all(int fd, const char *data, std::size_t size) {
+      while (size > 0) {
+        auto sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+          return false;
+        }
+        data += sent;
+        size -= sent;
+      }
+      return true;
+    }
+
+    bool recv_all(int fd, char *data, std::size_t size) {
+      while (size > 0) {
+        auto received = recv(fd, data, size, 0);
+        if (received <= 0) {
+          return false;
+        }
+        data += received;
+        size -= received;
+      }
+      return true;
+    }
+
+    /**
+     * @brief Send a message to Sway and wait for its reply.
+     * @param type The message type.
+     * @param payload The payload, a command for `ipc_run_command`.
+     * @return The reply, discarded if Sway couldn't be reached.
+     */
+    nlohmann::json request(std::uint32_t type, std::string_view payload) {
+      auto socket_path = std::getenv("SWAYSOCK");
+      if (!socket_path || std::strlen(socket_path) >= sizeof(sockaddr_un::sun_path)) {
+        return nlohmann::json::value_t::discarded;
+      }
+
+      file_t fd {socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+      if (fd.el < 0) {
+        return nlohmann::json::value_t::discarded;
+      }
+
+      sockaddr_un addr {};
+      addr.sun_family = AF_UNIX;
+      std::strcpy(addr.sun_path, socket_path);
+      if (connect(fd.el, (sockaddr *) &addr, sizeof(addr))) {
+        BOOST_LOG(debug) << "Couldn't connect to the Sway IPC socket: "sv << std::strerror(errno);
+        return nlohmann::json::value_t::discarded;
+      }
+
+      ipc_header_t header;
+      std::memcpy(header.magic, ipc_magic.data(), sizeof(header.magic));
+      header.length = (std::uint32_t) payload.size();
+      header.type = type;
+      if (!send_all(fd.el, (const char *) &header, sizeof(header)) || !send_all(fd.el, payload.data(), payload.size())) {
+        return nlohmann::json::value_t::discarded;
+      }
+
+      if (!recv_all(fd.el, (char *) &header, sizeof(header)) || std::memcmp(header.magic, ipc_magic.data(), sizeof(header.magic))) {
+        return nlohmann::json::value_t::discarded;
+      }
+
+      std::string reply(header.length, '\0');
+      if (!recv_all(fd.el, reply.data(), reply.size())) {
+        return nlohmann::json::value_t::discarded;
+      }
+
+      return nlohmann::json::parse(reply, nullptr, false);
+    }
+
+    /**
+     * @brief Run a Sway command.
+     * @param command The command.
+     * @return `true` if Sway ran it successfully.
+     */
+    bool run(const std::string &command) {
+      auto reply = request(ipc_run_command, command);
+      if (!reply.is_array() || reply.empty()) {
+        BOOST_LOG(error) << "Sway didn't reply to ["sv << command << ']';
+        return false;
+      }
+
+      for (auto &result : reply) {
+        if (!result.value("success", false)) {
+          BOOST_LOG(error) << "Sway failed to run ["sv << command << "]: "sv << result.value("error", ""s);
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /**
+     * @brief Get the names of the outputs of Sway.
+     * @return The names.
+     */
+    std::vector<std::string> output_names() {
+      std::vector<std::string> names;
+
+      auto reply = request(ipc_get_outputs, {});
+      if (reply.is_array()) {
+        for (auto &output : reply) {
+          names.emplace_back(output.value("name", ""s));
+        }
+      }
+      return names;
+    }
+  }  // namespace
+
+  bool available() {
+    return request(ipc_get_outputs, {}).is_array();
+  }
+
+  std::string create(int width, int height, int fps) {
+    auto before = output_names();
+    if (!run("create_output"s)) {
+      return {};
+    }
+
+    // Sway names its headless outputs HEADLESS-<n> and doesn't say which one it created
+    std::string name;
+    for (auto &output : output_names()) {
+      if (std::find(std::begin(before), std::end(before), output) == std::end(before)) {
+        name = output;
+        break;
+      }
+    }
+    if (name.empty()) {
+      BOOST_LOG(error) << "Couldn't find the virtual output Sway created"sv;
+      return {};
+    }
+
+    if (!run(std::format("output {} mode --custom {}x{}@{:.3f}Hz", name, width, height, fps / 1000.0))) {
+      remove(name);
+      return {};
+    }
+
+    BOOST_LOG(info) << "Created virtual output "sv << name << ": "sv << width << 'x' << height << '@' << fps / 1000.0 << "Hz"sv;
+    return name;
+  }
+
+  bool remove(const std::string &name) {
+    return run("output "s + name + " unplug"s);
+  }
+}  // namespace platf::virtual_output
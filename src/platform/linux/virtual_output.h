@@ -0,0 +1,37 @@
+/**
+ * @file src/platform/linux/virtual_output.h
+ * @brief Declarations for virtual outputs created on the Wayland compositor for headless streaming.
+ */
+#pragma once
+
+// standard includes
+#include <string>
+
+/**
+ * @brief Headless outputs created through the IPC of Sway, captured with wlgrab like any other output.
+ * @details Sway always has a headless backend next to the DRM one, its outputs are rendered by the GPU
+ *          like a real connector and exported as DMA-BUFs, so no monitor or dummy plug is needed.
+ */
+namespace platf::virtual_output {
+  /**
+   * @brief Check whether virtual outputs can be created.
+   * @return `true` if the compositor is Sway and its IPC socket is reachable.
+   */
+  bool available();
+
+  /**
+   * @brief Create a virtual output at the mode of the client.
+   * @param width The width in pixels.
+   * @param height The height in pixels.
+   * @param fps The refresh rate in millihertz.
+   * @return The name of the output, e.g. `HEADLESS-1`, or an empty string on failure.
+   */
+  std::string create(int width, int height, int fps);
+
+  /**
+   * @brief Remove a virtual output created by create().
+   * @param name The name of the output.
+   * @return `true` on success.
+   */
+  bool remove(const std::string &name);
+}  // namespace platf::virtual_output
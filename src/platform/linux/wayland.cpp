@@ -42,12 +42,6 @@ namespace wl {
 
 #define CLASS_CALL(c, m) classCall<c, decltype(&c::m), &c::m>
 
-  // Define buffer params listener
-  static const struct zwp_linux_buffer_params_v1_listener params_listener = {
-    .created = dmabuf_t::buffer_params_created,
-    .failed = dmabuf_t::buffer_params_failed
-  };
-
   int display_t::init(const char *display_name) {
     if (!display_name) {
       display_name = std::getenv("WAYLAND_DISPLAY");
@@ -103,6 +97,10 @@ namespace wl {
     return true;
   }
 
+  void display_t::flush() {
+    wl_display_flush(display_internal.get());
+  }
+
   wl_registry *display_t::registry() {
     return wl_display_get_registry(display_internal.get());
   }
@@ -258,23 +256,86 @@ namespace wl {
     return true;
   }
 
-  // Cleanup GBM
-  void dmabuf_t::cleanup_gbm() {
-    if (current_bo) {
-      gbm_bo_destroy(current_bo);
-      current_bo = nullptr;
+  // Create the buffers the frames are copied into, unless they match the frames already
+  bool dmabuf_t::init_pool() {
+    auto &sd = pool.front().frame.sd;
+    if (pool.front().wl_buffer && sd.width == (int) dmabuf_info.width && sd.height == (int) dmabuf_info.height && sd.fourcc == dmabuf_info.format) {
+      return true;
+    }
+
+    cleanup_pool();
+
+    if (!init_gbm()) {
+      BOOST_LOG(error) << "Failed to initialize GBM"sv;
+      return false;
+    }
+
+    // The buffers are created once, so waiting for them synchronously costs nothing per frame
+    if (zwp_linux_dmabuf_v1_get_version(dmabuf_interface) < ZWP_LINUX_BUFFER_PARAMS_V1_CREATE_IMMED_SINCE_VERSION) {
+      BOOST_LOG(error) << "linux-dmabuf is too old to create buffers immediately"sv;
+      return false;
+    }
+
+    for (auto &buffer : pool) {
+      buffer.bo = gbm_bo_create(gbm_device, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, GBM_BO_USE_RENDERING);
+      if (!buffer.bo) {
+        BOOST_LOG(error) << "Failed to create GBM buffer"sv;
+        cleanup_pool();
+        return false;
+      }
+
+      int fd = gbm_bo_get_fd(buffer.bo);
+      if (fd < 0) {
+        BOOST_LOG(error) << "Failed to get buffer FD"sv;
+        cleanup_pool();
+        return false;
+      }
+
+      uint32_t stride = gbm_bo_get_stride(buffer.bo);
+      uint64_t modifier = gbm_bo_get_modifier(buffer.bo);
+
+      auto &frame_sd = buffer.frame.sd;
+      frame_sd.fds[0] = fd;
+      frame_sd.pitches[0] = stride;
+      frame_sd.offsets[0] = 0;
+      frame_sd.modifier = modifier;
+      frame_sd.fourcc = dmabuf_info.format;
+      frame_sd.width = dmabuf_info.width;
+      frame_sd.height = dmabuf_info.height;
+
+      auto params = zwp_linux_dmabuf_v1_create_params(dmabuf_interface);
+      zwp_linux_buffer_params_v1_add(params, fd, 0, 0, stride, modifier >> 32, modifier & 0xffffffff);
+      buffer.wl_buffer = zwp_linux_buffer_params_v1_create_immed(params, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, 0);
+      zwp_linux_buffer_params_v1_destroy(params);
     }
 
-    if (current_wl_buffer) {
-      wl_buffer_destroy(current_wl_buffer);
-      current_wl_buffer = nullptr;
+    BOOST_LOG(debug) << "Created "sv << pool.size() << " capture buffers of "sv << dmabuf_info.width << 'x' << dmabuf_info.height;
+
+    return true;
+  }
+
+  // Cleanup the buffers
+  void dmabuf_t::cleanup_pool() {
+    for (auto &buffer : pool) {
+      if (buffer.wl_buffer) {
+        wl_buffer_destroy(buffer.wl_buffer);
+        buffer.wl_buffer = nullptr;
+      }
+
+      buffer.frame.destroy();
+
+      if (buffer.bo) {
+        gbm_bo_destroy(buffer.bo);
+        buffer.bo = nullptr;
+      }
     }
+
+    current_frame = nullptr;
   }
 
   dmabuf_t::dmabuf_t():
       status {READY},
-      frames {},
-      current_frame {&frames[0]},
+      current_frame {nullptr},
       listener {
         &CLASS_CALL(dmabuf_t, buffer),
         &CLASS_CALL(dmabuf_t, flags),
@@ -293,34 +354,40 @@ namespace wl {
     wl_output *output,
     bool blend_cursor
   ) {
+    if (requested) {
+      return;
+    }
+
     this->dmabuf_interface = dmabuf_interface;
     // Reset state
     shm_info.supported = false;
     dmabuf_info.supported = false;
+    pending_damage.clear();
 
     // Create new frame
-    auto frame = zwlr_screencopy_manager_v1_capture_output(
+    requested = zwlr_screencopy_manager_v1_capture_output(
       screencopy_manager,
       blend_cursor ? 1 : 0,
       output
     );
 
     // Store frame data pointer for callbacks
-    zwlr_screencopy_frame_v1_set_user_data(frame, this);
+    zwlr_screencopy_frame_v1_set_user_data(requested, this);
 
     // Add listener
-    zwlr_screencopy_frame_v1_add_listener(frame, &listener, this);
+    zwlr_screencopy_frame_v1_add_listener(requested, &listener, this);
 
     status = WAITING;
   }
 
   dmabuf_t::~dmabuf_t() {
-    cleanup_gbm();
-
-    for (auto &frame : frames) {
-      frame.destroy();
+    if (requested) {
+      zwlr_screencopy_frame_v1_destroy(requested);
+      requested = nullptr;
     }
 
+    cleanup_pool();
+
     if (gbm_device) {
       // We should close the DRM FD, but it's owned by GBM
       gbm_device_destroy(gbm_device);
@@ -366,112 +433,36 @@ namespace wl {
     BOOST_LOG(debug) << "Frame flags: "sv << flags << (y_invert ? " (y_invert)" : "");
   }
 
-  // DMA-BUF creation helper
-  void dmabuf_t::create_and_copy_dmabuf(zwlr_screencopy_frame_v1 *frame) {
-    if (!init_gbm()) {
-      BOOST_LOG(error) << "Failed to initialize GBM"sv;
-      zwlr_screencopy_frame_v1_destroy(frame);
-      status = REINIT;
-      return;
-    }
-
-    // Create GBM buffer
-    current_bo = gbm_bo_create(gbm_device, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, GBM_BO_USE_RENDERING);
-    if (!current_bo) {
-      BOOST_LOG(error) << "Failed to create GBM buffer"sv;
-      zwlr_screencopy_frame_v1_destroy(frame);
-      status = REINIT;
-      return;
-    }
-
-    // Get buffer info
-    int fd = gbm_bo_get_fd(current_bo);
-    if (fd < 0) {
-      BOOST_LOG(error) << "Failed to get buffer FD"sv;
-      gbm_bo_destroy(current_bo);
-      current_bo = nullptr;
-      zwlr_screencopy_frame_v1_destroy(frame);
-      status = REINIT;
-      return;
-    }
-
-    uint32_t stride = gbm_bo_get_stride(current_bo);
-    uint64_t modifier = gbm_bo_get_modifier(current_bo);
-
-    // Store in surface descriptor for later use
-    auto next_frame = get_next_frame();
-    next_frame->sd.fds[0] = fd;
-    next_frame->sd.pitches[0] = stride;
-    next_frame->sd.offsets[0] = 0;
-    next_frame->sd.modifier = modifier;
-
-    // Create linux-dmabuf buffer
-    auto params = zwp_linux_dmabuf_v1_create_params(dmabuf_interface);
-    zwp_linux_buffer_params_v1_add(params, fd, 0, 0, stride, modifier >> 32, modifier & 0xffffffff);
-
-    // Add listener for buffer creation
-    zwp_linux_buffer_params_v1_add_listener(params, &params_listener, frame);
-
-    // Create Wayland buffer (async - callback will handle copy)
-    zwp_linux_buffer_params_v1_create(params, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, 0);
-  }
-
-  // Buffer done callback - time to create buffer
+  // Buffer done callback - time to copy into the next buffer of the pool
   void dmabuf_t::buffer_done(zwlr_screencopy_frame_v1 *frame) {
-    auto next_frame = get_next_frame();
-
     // Prefer DMA-BUF if supported
     if (dmabuf_info.supported && dmabuf_interface) {
-      // Store format info first
-      next_frame->sd.fourcc = dmabuf_info.format;
-      next_frame->sd.width = dmabuf_info.width;
-      next_frame->sd.height = dmabuf_info.height;
+      if (!init_pool()) {
+        zwlr_screencopy_frame_v1_destroy(frame);
+        requested = nullptr;
+        status = REINIT;
+        return;
+      }
+
+      copying = next_buffer;
+      next_buffer = (next_buffer + 1) % pool.size();
 
-      // Create and start copy
-      create_and_copy_dmabuf(frame);
+      // The compositor holds the copy back until the output changed since the last one
+      zwlr_screencopy_frame_v1_copy_with_damage(frame, pool[copying].wl_buffer);
     } else if (shm_info.supported) {
       // SHM fallback would go here
       BOOST_LOG(warning) << "SHM capture not implemented"sv;
       zwlr_screencopy_frame_v1_destroy(frame);
+      requested = nullptr;
       status = REINIT;
     } else {
       BOOST_LOG(error) << "No supported buffer types"sv;
       zwlr_screencopy_frame_v1_destroy(frame);
+      requested = nullptr;
       status = REINIT;
     }
   }
 
-  // Buffer params created callback
-  void dmabuf_t::buffer_params_created(
-    void *data,
-    struct zwp_linux_buffer_params_v1 *params,
-    struct wl_buffer *buffer
-  ) {
-    auto frame = static_cast<zwlr_screencopy_frame_v1 *>(data);
-    auto self = static_cast<dmabuf_t *>(zwlr_screencopy_frame_v1_get_user_data(frame));
-
-    // Store for cleanup
-    self->current_wl_buffer = buffer;
-
-    // Start the actual copy
-    zwlr_screencopy_frame_v1_copy(frame, buffer);
-  }
-
-  // Buffer params failed callback
-  void dmabuf_t::buffer_params_failed(
-    void *data,
-    struct zwp_linux_buffer_params_v1 *params
-  ) {
-    auto frame = static_cast<zwlr_screencopy_frame_v1 *>(data);
-    auto self = static_cast<dmabuf_t *>(zwlr_screencopy_frame_v1_get_user_data(frame));
-
-    BOOST_LOG(error) << "Failed to create buffer from params"sv;
-    self->cleanup_gbm();
-
-    zwlr_screencopy_frame_v1_destroy(frame);
-    self->status = REINIT;
-  }
-
   // Ready callback
   void dmabuf_t::ready(
     zwlr_screencopy_frame_v1 *frame,
@@ -481,19 +472,17 @@ namespace wl {
   ) {
     BOOST_LOG(debug) << "Frame ready"sv;
 
-    // Frame is ready for use, GBM buffer now contains screen content
-    current_frame->destroy();
-    current_frame = get_next_frame();
-
-    // Keep the GBM buffer alive but destroy the Wayland objects
-    if (current_wl_buffer) {
-      wl_buffer_destroy(current_wl_buffer);
-      current_wl_buffer = nullptr;
-    }
+    // Frame is ready for use, the buffer now contains screen content
+    current_frame = &pool[copying].frame;
+    current_damage = std::move(pending_damage);
+    pending_damage.clear();
 
-    cleanup_gbm();
+    // The timestamp is on the presentation clock, which is CLOCK_MONOTONIC like steady_clock
+    auto tv_sec = ((std::uint64_t) tv_sec_hi << 32) | tv_sec_lo;
+    current_timestamp = std::chrono::steady_clock::time_point {std::chrono::seconds {tv_sec} + std::chrono::nanoseconds {tv_nsec}};
 
     zwlr_screencopy_frame_v1_destroy(frame);
+    requested = nullptr;
     status = READY;
   }
 
@@ -501,12 +490,9 @@ namespace wl {
   void dmabuf_t::failed(zwlr_screencopy_frame_v1 *frame) {
     BOOST_LOG(error) << "Frame capture failed"sv;
 
-    // Clean up resources
-    cleanup_gbm();
-    auto next_frame = get_next_frame();
-    next_frame->destroy();
-
+    // The pool is recreated on reinit
     zwlr_screencopy_frame_v1_destroy(frame);
+    requested = nullptr;
     status = REINIT;
   }
 
@@ -516,7 +502,13 @@ namespace wl {
     std::uint32_t y,
     std::uint32_t width,
     std::uint32_t height
-  ) {};
+  ) {
+    auto &sd = pool[copying].frame.sd;
+
+    // Damage is in buffer coordinates, which are flipped for y-inverted frames
+    std::int32_t top = y_invert ? sd.height - (std::int32_t) (y + height) : (std::int32_t) y;
+    pending_damage.push_back({(std::int32_t) x, top, (std::int32_t) (x + width), top + (std::int32_t) height});
+  }
 
   void frame_t::destroy() {
     for (auto x = 0; x < 4; ++x) {
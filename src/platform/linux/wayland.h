@@ -6,6 +6,8 @@
 
 // standard includes
 #include <bitset>
+#include <chrono>
+#include <vector>
 
 #ifdef SUNSHINE_BUILD_WAYLAND
   #include <linux-dmabuf-unstable-v1.h>
@@ -41,6 +43,12 @@ namespace wl {
       REINIT,  ///< Reinitialize the frame
     };
 
+    /**
+     * The compositor copies the frames into a pool of buffers that are reused,
+     * one buffer per cached import so none of them is imported into EGL twice.
+     */
+    static constexpr std::size_t pool_size = egl::import_cache_t::max_imports;
+
     dmabuf_t();
     ~dmabuf_t();
 
@@ -49,9 +57,11 @@ namespace wl {
     dmabuf_t &operator=(const dmabuf_t &) = delete;
     dmabuf_t &operator=(dmabuf_t &&) = delete;
 
+    /**
+     * @brief Request the next frame, unless it is requested already.
+     * @details The compositor answers the request once the output is damaged.
+     */
     void listen(zwlr_screencopy_manager_v1 *screencopy_manager, zwp_linux_dmabuf_v1 *dmabuf_interface, wl_output *output, bool blend_cursor = false);
-    static void buffer_params_created(void *data, struct zwp_linux_buffer_params_v1 *params, struct wl_buffer *wl_buffer);
-    static void buffer_params_failed(void *data, struct zwp_linux_buffer_params_v1 *params);
     void buffer(zwlr_screencopy_frame_v1 *frame, std::uint32_t format, std::uint32_t width, std::uint32_t height, std::uint32_t stride);
     void linux_dmabuf(zwlr_screencopy_frame_v1 *frame, std::uint32_t format, std::uint32_t width, std::uint32_t height);
     void buffer_done(zwlr_screencopy_frame_v1 *frame);
@@ -60,21 +70,25 @@ namespace wl {
     void ready(zwlr_screencopy_frame_v1 *frame, std::uint32_t tv_sec_hi, std::uint32_t tv_sec_lo, std::uint32_t tv_nsec);
     void failed(zwlr_screencopy_frame_v1 *frame);
 
-    frame_t *get_next_frame() {
-      return current_frame == &frames[0] ? &frames[1] : &frames[0];
-    }
-
     status_e status;
-    std::array<frame_t, 2> frames;
-    frame_t *current_frame;
+    frame_t *current_frame;  ///< The buffer of the last frame copied, owned by the pool
+    std::vector<platf::rect_t> current_damage;  ///< Regions of the last frame that changed since the frame before it
+    std::optional<std::chrono::steady_clock::time_point> current_timestamp;  ///< When the last frame was presented
     zwlr_screencopy_frame_v1_listener listener;
 
   private:
+    struct buffer_t {
+      struct gbm_bo *bo {nullptr};
+      struct wl_buffer *wl_buffer {nullptr};
+      frame_t frame;
+    };
+
     bool init_gbm();
-    void cleanup_gbm();
-    void create_and_copy_dmabuf(zwlr_screencopy_frame_v1 *frame);
+    bool init_pool();
+    void cleanup_pool();
 
     zwp_linux_dmabuf_v1 *dmabuf_interface {nullptr};
+    zwlr_screencopy_frame_v1 *requested {nullptr};  ///< The frame request in flight
 
     struct {
       bool supported {false};
@@ -92,8 +106,10 @@ namespace wl {
     } dmabuf_info;
 
     struct gbm_device *gbm_device {nullptr};
-    struct gbm_bo *current_bo {nullptr};
-    struct wl_buffer *current_wl_buffer {nullptr};
+    std::array<buffer_t, pool_size> pool;
+    std::size_t copying {0};  ///< Buffer the requested frame is copied into
+    std::size_t next_buffer {0};  ///< Buffer the next frame is copied into
+    std::vector<platf::rect_t> pending_damage;
     bool y_invert {false};
   };
 
@@ -186,6 +202,9 @@ namespace wl {
     // Wait up to the timeout to read and dispatch new events
     bool dispatch(std::chrono::milliseconds timeout);
 
+    // Send the queued requests without waiting for events
+    void flush();
+
     // Get the registry associated with the display
     // No need to manually free the registry
     wl_registry *registry();
@@ -3,8 +3,12 @@
  * @brief Definitions for wlgrab capture.
  */
 // standard includes
+#include <cctype>
 #include <thread>
 
+// platform includes
+#include <fcntl.h>
+
 // local includes
 #include "cuda.h"
 #include "src/logging.h"
@@ -52,17 +56,33 @@ namespace wl {
 
       auto monitor = interface.monitors[0].get();
 
-      if (!display_name.empty()) {
-        auto streamedMonitor = util::from_view(display_name);
+      if (!display_name.empty() && !std::isdigit((unsigned char) display_name[0])) {
+        // Outputs are also selected by name, like the virtual outputs, whose index isn't known up front
+        for (auto &candidate : interface.monitors) {
+          candidate->listen(interface.output_manager);
+        }
+
+        display.roundtrip();
 
-        if (streamedMonitor >= 0 && streamedMonitor < interface.monitors.size()) {
-          monitor = interface.monitors[streamedMonitor].get();
+        for (auto &candidate : interface.monitors) {
+          if (candidate->name == display_name) {
+            monitor = candidate.get();
+            break;
+          }
         }
-      }
+      } else {
+        if (!display_name.empty()) {
+          auto streamedMonitor = util::from_view(display_name);
 
-      monitor->listen(interface.output_manager);
+          if (streamedMonitor >= 0 && streamedMonitor < interface.monitors.size()) {
+            monitor = interface.monitors[streamedMonitor].get();
+          }
+        }
 
-      display.roundtrip();
+        monitor->listen(interface.output_manager);
+
+        display.roundtrip();
+      }
 
       output = monitor->output;
 
@@ -89,14 +109,16 @@ namespace wl {
     inline platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
       auto to = std::chrono::steady_clock::now() + timeout;
 
-      // Dispatch events until we get a new frame or the timeout expires
+      // The last snapshot requested this frame already, unless it timed out
       dmabuf.listen(interface.screencopy_manager, interface.dmabuf_interface, output, cursor);
-      do {
+
+      // Dispatch events until we get a new frame or the timeout expires
+      while (dmabuf.status == dmabuf_t::WAITING) {
         auto remaining_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(to - std::chrono::steady_clock::now());
         if (remaining_time_ms.count() < 0 || !display.dispatch(remaining_time_ms)) {
           return platf::capture_e::timeout;
         }
-      } while (dmabuf.status == dmabuf_t::WAITING);
+      }
 
       auto current_frame = dmabuf.current_frame;
 
@@ -108,9 +130,29 @@ namespace wl {
         return platf::capture_e::reinit;
       }
 
+      // Request the next frame right away, so the compositor copies it while this one is encoded
+      dmabuf.listen(interface.screencopy_manager, interface.dmabuf_interface, output, cursor);
+      display.flush();
+
       return platf::capture_e::ok;
     }
 
+    /**
+     * @brief Describe the last frame on the image it is handed out with.
+     * @param img The image.
+     */
+    void set_frame_info(platf::img_t &img) {
+      img.frame_timestamp = dmabuf.current_timestamp;
+      img.frame_index = ++frame_index;
+      img.damage = dmabuf.current_damage;
+      img.damage_valid = true;
+    }
+
+    std::optional<std::string> encoder_binding() override {
+      // The encode devices are made from the size of the display only
+      return "wlr:"s + std::to_string((int) mem_type);
+    }
+
     platf::mem_type_e mem_type;
 
     std::chrono::nanoseconds delay;
@@ -120,6 +162,9 @@ namespace wl {
     dmabuf_t dmabuf;
 
     wl_output *output;
+
+    // See platf::img_t::frame_index
+    std::uint64_t frame_index {};
   };
 
   class wlr_ram_t: public wlr_t {
@@ -177,17 +222,19 @@ namespace wl {
 
       auto current_frame = dmabuf.current_frame;
 
-      auto rgb_opt = egl::import_source(egl_display.get(), current_frame->sd);
+      // The buffers of the pool are imported once
+      auto rgb = imports.import(egl_display.get(), current_frame->sd);
 
-      if (!rgb_opt) {
+      if (!rgb) {
         return platf::capture_e::reinit;
       }
 
       if (!pull_free_image_cb(img_out)) {
         return platf::capture_e::interrupted;
       }
+      set_frame_info(*img_out);
 
-      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb_opt)->tex[0]);
+      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb)->tex[0]);
 
       // Don't remove these lines, see https://github.com/LizardByte/Sunshine/issues/453
       int w, h;
@@ -195,7 +242,7 @@ namespace wl {
       gl::ctx.GetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
       BOOST_LOG(debug) << "width and height: w "sv << w << " h "sv << h;
 
-      gl::ctx.GetTextureSubImage((*rgb_opt)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+      gl::ctx.GetTextureSubImage((*rgb)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
       gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
 
       return platf::capture_e::ok;
@@ -237,6 +284,16 @@ namespace wl {
       return std::make_unique<platf::avcodec_encode_device_t>();
     }
 
+    std::unique_ptr<platf::nvenc_encode_device_t> make_nvenc_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda && pix_fmt == platf::pix_fmt_e::nv12) {
+        return cuda::make_nvenc_encode_device(width, height, false);
+      }
+#endif
+
+      return nullptr;
+    }
+
     std::shared_ptr<platf::img_t> alloc_img() override {
       auto img = std::make_shared<img_t>();
       img->width = width;
@@ -250,6 +307,7 @@ namespace wl {
 
     egl::display_t egl_display;
     egl::ctx_t ctx;
+    egl::import_cache_t imports;
   };
 
   class wlr_vram_t: public wlr_t {
@@ -315,11 +373,15 @@ namespace wl {
 
       ++sequence;
       img->sequence = sequence;
+      set_frame_info(*img);
 
+      // The buffer stays in the pool, so the image gets its own file descriptors for it
       img->sd = current_frame->sd;
-
-      // Prevent dmabuf from closing the file descriptors.
-      std::fill_n(current_frame->sd.fds, 4, -1);
+      for (auto &fd : img->sd.fds) {
+        if (fd >= 0) {
+          fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        }
+      }
 
       return platf::capture_e::ok;
     }
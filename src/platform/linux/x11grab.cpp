@@ -3,6 +3,7 @@
  * @brief Definitions for x11 capture.
  */
 // standard includes
+#include <algorithm>
 #include <fstream>
 #include <thread>
 
@@ -14,6 +15,7 @@
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <xcb/damage.h>
 #include <xcb/shm.h>
 #include <xcb/xfixes.h>
 
@@ -173,6 +175,24 @@ namespace platf {
     _FN(connect, xcb_connection_t *, (const char *displayname, int *screenp));
     _FN(setup_roots_iterator, xcb_screen_iterator_t, (const xcb_setup_t *R));
     _FN(generate_id, std::uint32_t, (xcb_connection_t * c));
+    _FN(poll_for_event, xcb_generic_event_t *, (xcb_connection_t * c));
+    _FN(request_check, xcb_generic_error_t *, (xcb_connection_t * c, xcb_void_cookie_t cookie));
+
+    static xcb_extension_t *damage_id;
+    static xcb_extension_t *xfixes_id;
+
+    _FN(damage_query_version, xcb_damage_query_version_cookie_t, (xcb_connection_t * c, uint32_t client_major_version, uint32_t client_minor_version));
+    _FN(damage_query_version_reply, xcb_damage_query_version_reply_t *, (xcb_connection_t * c, xcb_damage_query_version_cookie_t cookie, xcb_generic_error_t **e));
+    _FN(damage_create_checked, xcb_void_cookie_t, (xcb_connection_t * c, xcb_damage_damage_t damage, xcb_drawable_t drawable, uint8_t level));
+    _FN(damage_subtract, xcb_void_cookie_t, (xcb_connection_t * c, xcb_damage_damage_t damage, xcb_xfixes_region_t repair, xcb_xfixes_region_t parts));
+
+    _FN(xfixes_query_version, xcb_xfixes_query_version_cookie_t, (xcb_connection_t * c, uint32_t client_major_version, uint32_t client_minor_version));
+    _FN(xfixes_query_version_reply, xcb_xfixes_query_version_reply_t *, (xcb_connection_t * c, xcb_xfixes_query_version_cookie_t cookie, xcb_generic_error_t **e));
+    _FN(xfixes_create_region, xcb_void_cookie_t, (xcb_connection_t * c, xcb_xfixes_region_t region, uint32_t rectangles_len, const xcb_rectangle_t *rectangles));
+    _FN(xfixes_fetch_region, xcb_xfixes_fetch_region_cookie_t, (xcb_connection_t * c, xcb_xfixes_region_t region));
+    _FN(xfixes_fetch_region_reply, xcb_xfixes_fetch_region_reply_t *, (xcb_connection_t * c, xcb_xfixes_fetch_region_cookie_t cookie, xcb_generic_error_t **e));
+    _FN(xfixes_fetch_region_rectangles, xcb_rectangle_t *, (const xcb_xfixes_fetch_region_reply_t *R));
+    _FN(xfixes_fetch_region_rectangles_length, int, (const xcb_xfixes_fetch_region_reply_t *R));
 
     int init_shm() {
       static void *handle {nullptr};
@@ -227,6 +247,8 @@ namespace platf {
         {(dyn::apiproc *) &connect, "xcb_connect"},
         {(dyn::apiproc *) &setup_roots_iterator, "xcb_setup_roots_iterator"},
         {(dyn::apiproc *) &generate_id, "xcb_generate_id"},
+        {(dyn::apiproc *) &poll_for_event, "xcb_poll_for_event"},
+        {(dyn::apiproc *) &request_check, "xcb_request_check"},
       };
 
       if (dyn::load(handle, funcs)) {
@@ -237,6 +259,60 @@ namespace platf {
       return 0;
     }
 
+    /**
+     * @brief Load XDamage and the XFixes regions it reports damage with.
+     * @return 0 on success, -1 if the libraries aren't available.
+     */
+    int init_damage() {
+      static void *damage_handle {nullptr};
+      static void *xfixes_handle {nullptr};
+      static bool funcs_loaded = false;
+
+      if (funcs_loaded) {
+        return 0;
+      }
+
+      if (!damage_handle) {
+        damage_handle = dyn::handle({"libxcb-damage.so.0", "libxcb-damage.so"});
+        if (!damage_handle) {
+          return -1;
+        }
+      }
+
+      if (!xfixes_handle) {
+        xfixes_handle = dyn::handle({"libxcb-xfixes.so.0", "libxcb-xfixes.so"});
+        if (!xfixes_handle) {
+          return -1;
+        }
+      }
+
+      std::vector<std::tuple<dyn::apiproc *, const char *>> damage_funcs {
+        {(dyn::apiproc *) &damage_id, "xcb_damage_id"},
+        {(dyn::apiproc *) &damage_query_version, "xcb_damage_query_version"},
+        {(dyn::apiproc *) &damage_query_version_reply, "xcb_damage_query_version_reply"},
+        {(dyn::apiproc *) &damage_create_checked, "xcb_damage_create_checked"},
+        {(dyn::apiproc *) &damage_subtract, "xcb_damage_subtract"},
+      };
+
+      std::vector<std::tuple<dyn::apiproc *, const char *>> xfixes_funcs {
+        {(dyn::apiproc *) &xfixes_id, "xcb_xfixes_id"},
+        {(dyn::apiproc *) &xfixes_query_version, "xcb_xfixes_query_version"},
+        {(dyn::apiproc *) &xfixes_query_version_reply, "xcb_xfixes_query_version_reply"},
+        {(dyn::apiproc *) &xfixes_create_region, "xcb_xfixes_create_region"},
+        {(dyn::apiproc *) &xfixes_fetch_region, "xcb_xfixes_fetch_region"},
+        {(dyn::apiproc *) &xfixes_fetch_region_reply, "xcb_xfixes_fetch_region_reply"},
+        {(dyn::apiproc *) &xfixes_fetch_region_rectangles, "xcb_xfixes_fetch_region_rectangles"},
+        {(dyn::apiproc *) &xfixes_fetch_region_rectangles_length, "xcb_xfixes_fetch_region_rectangles_length"},
+      };
+
+      if (dyn::load(damage_handle, damage_funcs) || dyn::load(xfixes_handle, xfixes_funcs)) {
+        return -1;
+      }
+
+      funcs_loaded = true;
+      return 0;
+    }
+
 #undef _FN
   }  // namespace xcb
 
@@ -245,6 +321,7 @@ namespace platf {
 
   using xcb_connect_t = util::dyn_safe_ptr<xcb_connection_t, &xcb::disconnect>;
   using xcb_img_t = util::c_ptr<xcb_shm_get_image_reply_t>;
+  using xcb_region_t = util::c_ptr<xcb_xfixes_fetch_region_reply_t>;
 
   using ximg_t = util::safe_ptr<XImage, freeImage>;
   using xcursor_t = util::safe_ptr<XFixesCursorImage, freeX>;
@@ -313,13 +390,8 @@ namespace platf {
     }
   };
 
-  static void blend_cursor(Display *display, img_t &img, int offsetX, int offsetY) {
-    xcursor_t overlay {x11::fix::GetCursorImage(display)};
-
-    if (!overlay) {
-      BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
-      return;
-    }
+  static void blend_cursor(XFixesCursorImage &overlay_img, img_t &img, int offsetX, int offsetY) {
+    auto overlay = &overlay_img;
 
     overlay->x -= overlay->xhot;
     overlay->y -= overlay->yhot;
@@ -362,6 +434,17 @@ namespace platf {
     }
   }
 
+  static void blend_cursor(Display *display, img_t &img, int offsetX, int offsetY) {
+    xcursor_t overlay {x11::fix::GetCursorImage(display)};
+
+    if (!overlay) {
+      BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
+      return;
+    }
+
+    blend_cursor(*overlay, img, offsetX, offsetY);
+  }
+
   struct x11_attr_t: public display_t {
     std::chrono::nanoseconds delay;
 
@@ -577,6 +660,36 @@ namespace platf {
 
     shm_data_t data;
 
+    // XDamage of the root window, 0 if the X server doesn't report damage
+    xcb_damage_damage_t damage {};
+
+    // Region the accumulated damage is moved to on each snapshot
+    xcb_xfixes_region_t damage_region {};
+
+    /**
+     * @brief The image requests of a frame.
+     */
+    struct fetch_t {
+      std::vector<std::pair<rect_t, xcb_shm_get_image_cookie_t>> requests;
+      std::optional<std::vector<rect_t>> damaged;  ///< The fetched rectangles, nothing if the whole frame was fetched
+      std::chrono::steady_clock::time_point frame_timestamp;
+      int buffer;  ///< Transfer buffer the replies land in
+    };
+
+    // Whether the frame in the SHM segment holds the whole capture area once the requested frames arrived
+    bool frame_fetched = false;
+
+    // The frame requested ahead of the snapshot that hands it out
+    std::optional<fetch_t> in_flight;
+    int next_buffer = 0;
+
+    // Sequence number given to the next image, see platf::img_t::frame_index
+    std::uint64_t next_frame_index = 1;
+
+    // Where the cursor was drawn on the last image and which shape it had
+    std::optional<rect_t> last_cursor;
+    unsigned long last_cursor_serial = 0;
+
     task_pool_util::TaskPool::task_id_t refresh_task_id;
 
     void delayed_refresh() {
@@ -645,29 +758,247 @@ namespace platf {
       if (xattr.width != env_width || xattr.height != env_height) {
         BOOST_LOG(warning) << "X dimensions changed in SHM mode, request reinit"sv;
         return capture_e::reinit;
+      }
+
+      // Nothing is in flight yet, so the first frame has to wait for its reply
+      if (!in_flight) {
+        request_frame();
+      }
+
+      // Ask for the next frame before waiting for this one, so the X server works on it while this one is encoded
+      auto fetch = std::move(*in_flight);
+      request_frame();
+
+      auto frame = collect_frame(fetch);
+      if (!frame) {
+        return capture_e::reinit;
+      }
+
+      xcursor_t overlay;
+      if (cursor) {
+        overlay.reset(x11::fix::GetCursorImage(shm_xdisplay.get()));
+      }
+
+      std::optional<rect_t> cursor_area;
+      unsigned long cursor_serial = 0;
+      if (overlay) {
+        rect_t area {
+          std::clamp(overlay->x - overlay->xhot - offset_x, 0, width),
+          std::clamp(overlay->y - overlay->yhot - offset_y, 0, height),
+          std::clamp(overlay->x - overlay->xhot - offset_x + overlay->width, 0, width),
+          std::clamp(overlay->y - overlay->yhot - offset_y + overlay->height, 0, height),
+        };
+        if (area.left < area.right && area.top < area.bottom) {
+          cursor_area = area;
+        }
+        cursor_serial = overlay->cursor_serial;
+      }
+
+      auto &damaged = fetch.damaged;
+      if (damaged) {
+        auto same_area = [](const std::optional<rect_t> &l, const std::optional<rect_t> &r) {
+          return l.has_value() == r.has_value() && (!l || (l->left == r->left && l->top == r->top && l->right == r->right && l->bottom == r->bottom));
+        };
+
+        // The cursor is drawn by us, so XDamage doesn't see it move
+        if (!same_area(cursor_area, last_cursor) || (cursor_area && cursor_serial != last_cursor_serial)) {
+          for (auto &area : {last_cursor, cursor_area}) {
+            if (area) {
+              damaged->push_back(*area);
+            }
+          }
+        }
+
+        // Nothing changed, so there is no need for a new image
+        if (damaged->empty()) {
+          return capture_e::timeout;
+        }
+      }
+
+      if (!pull_free_image_cb(img_out)) {
+        return platf::capture_e::interrupted;
+      }
+
+      std::copy_n(frame, frame_size(), img_out->data);
+      img_out->frame_timestamp = fetch.frame_timestamp;
+      img_out->frame_index = next_frame_index++;
+      img_out->damage_valid = damaged.has_value();
+      img_out->damage = damaged ? std::move(*damaged) : std::vector<rect_t> {};
+      img_out->cursor = cursor_area;
+
+      if (overlay) {
+        blend_cursor(*overlay, *img_out, offset_x, offset_y);
+      }
+      last_cursor = cursor_area;
+      last_cursor_serial = cursor_serial;
+
+      return capture_e::ok;
+    }
+
+    /**
+     * @brief Take the damage accumulated since the last snapshot.
+     * @return The damaged rectangles of the capture area, or nothing if they couldn't be fetched.
+     */
+    std::optional<std::vector<rect_t>> fetch_damage() {
+      xcb::damage_subtract(xcb.get(), damage, XCB_NONE, damage_region);
+      xcb_region_t region {xcb::xfixes_fetch_region_reply(xcb.get(), xcb::xfixes_fetch_region(xcb.get(), damage_region), nullptr)};
+
+      // The damage notifications aren't needed, the accumulated damage is fetched every time
+      while (auto event = xcb::poll_for_event(xcb.get())) {
+        free(event);
+      }
+
+      if (!region) {
+        BOOST_LOG(warning) << "Could not fetch the damaged region, fetching the whole screen"sv;
+        return std::nullopt;
+      }
+
+      auto rects = xcb::xfixes_fetch_region_rectangles(region.get());
+      auto count = xcb::xfixes_fetch_region_rectangles_length(region.get());
+
+      std::vector<rect_t> damaged;
+      for (int x = 0; x < count; ++x) {
+        rect_t rect {
+          std::clamp(rects[x].x - offset_x, 0, width),
+          std::clamp(rects[x].y - offset_y, 0, height),
+          std::clamp(rects[x].x + rects[x].width - offset_x, 0, width),
+          std::clamp(rects[x].y + rects[x].height - offset_y, 0, height),
+        };
+
+        if (rect.left < rect.right && rect.top < rect.bottom) {
+          damaged.push_back(rect);
+        }
+      }
+
+      // Every request is a roundtrip X has to answer, and the rectangles have to fit the transfer buffer
+      std::int64_t area = 0;
+      for (auto &rect : damaged) {
+        area += (std::int64_t) (rect.right - rect.left) * (rect.bottom - rect.top);
+      }
+      if (damaged.size() > max_damage_fetches || area > (std::int64_t) width * height) {
+        auto bounds = damaged.front();
+        for (auto &rect : damaged) {
+          bounds.left = std::min(bounds.left, rect.left);
+          bounds.top = std::min(bounds.top, rect.top);
+          bounds.right = std::max(bounds.right, rect.right);
+          bounds.bottom = std::max(bounds.bottom, rect.bottom);
+        }
+        damaged = {bounds};
+      }
+
+      return damaged;
+    }
+
+    /**
+     * @brief Send the image requests for the next frame without waiting for their replies.
+     * @details The requests alternate between the two transfer buffers, so a frame can be
+     *          read from one while X writes the next one into the other.
+     */
+    void request_frame() {
+      fetch_t fetch;
+
+      // Only the damaged parts of the screen are fetched once the SHM segment holds a whole frame
+      if (damage && frame_fetched) {
+        fetch.damaged = fetch_damage();
+      } else if (damage) {
+        // Everything damaged until now is covered by the whole frame fetched below
+        xcb::damage_subtract(xcb.get(), damage, XCB_NONE, XCB_NONE);
+      }
+      fetch.frame_timestamp = std::chrono::steady_clock::now();
+      fetch.buffer = next_buffer;
+      next_buffer ^= 1;
+
+      // The rectangles land packed in the transfer buffer
+      std::uint32_t offset = buffer_offset(fetch.buffer);
+      auto request = [&](const rect_t &rect) {
+        auto rect_width = rect.right - rect.left;
+        auto rect_height = rect.bottom - rect.top;
+
+        fetch.requests.emplace_back(rect, xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x + rect.left, offset_y + rect.top, rect_width, rect_height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, offset));
+        offset += rect_width * rect_height * 4;
+      };
+
+      if (fetch.damaged) {
+        std::for_each(std::begin(*fetch.damaged), std::end(*fetch.damaged), request);
       } else {
-        auto img_cookie = xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x, offset_y, width, height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, 0);
-        auto frame_timestamp = std::chrono::steady_clock::now();
+        request({0, 0, width, height});
+        frame_fetched = true;
+      }
 
-        xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), img_cookie, nullptr)};
+      in_flight = std::move(fetch);
+    }
+
+    /**
+     * @brief Wait for the replies of a frame requested earlier.
+     * @param fetch The requests of the frame.
+     * @return The whole frame, or nullptr on failure.
+     */
+    std::uint8_t *collect_frame(const fetch_t &fetch) {
+      auto segment = (std::uint8_t *) data.data;
+
+      for (auto &[rect, cookie] : fetch.requests) {
+        xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), cookie, nullptr)};
         if (!img_reply) {
           BOOST_LOG(error) << "Could not get image reply"sv;
-          return capture_e::reinit;
+          return nullptr;
         }
+      }
 
-        if (!pull_free_image_cb(img_out)) {
-          return platf::capture_e::interrupted;
+      // Without XDamage, the transfer buffer holds the whole frame
+      if (!damage) {
+        return segment + buffer_offset(fetch.buffer);
+      }
+
+      // Otherwise the fetched rectangles are copied into the frame in front of the transfer buffers
+      auto offset = buffer_offset(fetch.buffer);
+      for (auto &[rect, cookie] : fetch.requests) {
+        auto row_size = (rect.right - rect.left) * 4;
+        for (auto y = rect.top; y < rect.bottom; ++y) {
+          std::copy_n(segment + offset, row_size, segment + (y * width + rect.left) * 4);
+          offset += row_size;
         }
+      }
 
-        std::copy_n((std::uint8_t *) data.data, frame_size(), img_out->data);
-        img_out->frame_timestamp = frame_timestamp;
+      return segment;
+    }
 
-        if (cursor) {
-          blend_cursor(shm_xdisplay.get(), *img_out, offset_x, offset_y);
-        }
+    /**
+     * @brief Get the offset of a transfer buffer in the SHM segment.
+     */
+    std::uint32_t buffer_offset(int buffer) {
+      return (damage ? frame_size() : 0) + buffer * frame_size();
+    }
 
-        return capture_e::ok;
+    /**
+     * @brief Subscribe to the damage of the root window.
+     * @details Without XDamage, the whole screen is fetched for every frame.
+     */
+    void init_damage() {
+      if (xcb::init_damage() || !xcb::get_extension_data(xcb.get(), xcb::damage_id)->present || !xcb::get_extension_data(xcb.get(), xcb::xfixes_id)->present) {
+        BOOST_LOG(info) << "XDamage is not available, fetching the whole screen for every frame"sv;
+        return;
       }
+
+      // Regions need XFixes 2.0, the server only enables the extensions once their versions were negotiated
+      util::c_ptr<xcb_xfixes_query_version_reply_t> xfixes_version {xcb::xfixes_query_version_reply(xcb.get(), xcb::xfixes_query_version(xcb.get(), XCB_XFIXES_MAJOR_VERSION, XCB_XFIXES_MINOR_VERSION), nullptr)};
+      util::c_ptr<xcb_damage_query_version_reply_t> damage_version {xcb::damage_query_version_reply(xcb.get(), xcb::damage_query_version(xcb.get(), XCB_DAMAGE_MAJOR_VERSION, XCB_DAMAGE_MINOR_VERSION), nullptr)};
+      if (!xfixes_version || xfixes_version->major_version < 2 || !damage_version) {
+        BOOST_LOG(info) << "XDamage is not supported, fetching the whole screen for every frame"sv;
+        return;
+      }
+
+      damage_region = xcb::generate_id(xcb.get());
+      xcb::xfixes_create_region(xcb.get(), damage_region, 0, nullptr);
+
+      auto id = xcb::generate_id(xcb.get());
+      util::c_ptr<xcb_generic_error_t> error {xcb::request_check(xcb.get(), xcb::damage_create_checked(xcb.get(), id, display->root, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY))};
+      if (error) {
+        BOOST_LOG(warning) << "Could not subscribe to XDamage, fetching the whole screen for every frame"sv;
+        return;
+      }
+
+      damage = id;
+      BOOST_LOG(info) << "Fetching only the damaged parts of the screen"sv;
     }
 
     std::shared_ptr<img_t> alloc_img() override {
@@ -706,7 +1037,10 @@ namespace platf {
       display = iter.data;
       seg = xcb::generate_id(xcb.get());
 
-      shm_id.id = shmget(IPC_PRIVATE, frame_size(), IPC_CREAT | 0777);
+      init_damage();
+
+      // Two transfer buffers for pipelining the requests, with XDamage behind the frame the fetched rectangles are copied into
+      shm_id.id = shmget(IPC_PRIVATE, buffer_offset(2), IPC_CREAT | 0777);
       if (shm_id.id == -1) {
         BOOST_LOG(error) << "shmget failed"sv;
         return -1;
@@ -727,6 +1061,9 @@ namespace platf {
     std::uint32_t frame_size() {
       return width * height * 4;
     }
+
+    // Damaged rectangles beyond this are fetched as their bounds
+    static constexpr std::size_t max_damage_fetches = 16;
   };
 
   std::shared_ptr<display_t> x11_display(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
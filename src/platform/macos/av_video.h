@@ -13,7 +13,38 @@ struct CaptureSession {
   NSCondition *captureStopped;
 };
 
-@interface AVVideo: NSObject <AVCaptureVideoDataOutputSampleBufferDelegate>
+typedef bool (^FrameCallbackBlock)(CMSampleBufferRef);
+
+/**
+ * @brief A source of display frames, implemented by each capture backend.
+ */
+@protocol DisplayCapture <NSObject>
+
+@property (nonatomic, assign) OSType pixelFormat;
+@property (nonatomic, assign) int frameWidth;
+@property (nonatomic, assign) int frameHeight;
+
+/**
+ * @brief Sequence number of the content of the frame being delivered, 0 if the backend doesn't track it.
+ */
+@property (nonatomic, readonly) uint64_t contentIndex;
+
+/**
+ * @brief Whether the last capture ended because the backend stopped, rather than the callback returning false.
+ */
+@property (nonatomic, readonly) BOOL interrupted;
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight;
+
+/**
+ * @brief Start delivering frames to the callback until it returns false.
+ * @return A semaphore signaled once the capture ended, or nil if it couldn't be started.
+ */
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback;
+
+@end
+
+@interface AVVideo: NSObject <AVCaptureVideoDataOutputSampleBufferDelegate, DisplayCapture>
 
 #define kMaxDisplays 32
 
@@ -23,8 +54,6 @@ struct CaptureSession {
 @property (nonatomic, assign) int frameWidth;
 @property (nonatomic, assign) int frameHeight;
 
-typedef bool (^FrameCallbackBlock)(CMSampleBufferRef);
-
 @property (nonatomic, assign) AVCaptureSession *session;
 @property (nonatomic, assign) NSMapTable<AVCaptureConnection *, AVCaptureVideoDataOutput *> *videoOutputs;
 @property (nonatomic, assign) NSMapTable<AVCaptureConnection *, FrameCallbackBlock> *captureCallbacks;
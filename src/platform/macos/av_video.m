@@ -86,6 +86,15 @@
   self.frameHeight = frameHeight;
 }
 
+- (uint64_t)contentIndex {
+  // AVCaptureScreenInput doesn't tell whether the content changed
+  return 0;
+}
+
+- (BOOL)interrupted {
+  return NO;
+}
+
 - (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback {
   @synchronized(self) {
     AVCaptureVideoDataOutput *videoOutput = [[AVCaptureVideoDataOutput alloc] init];
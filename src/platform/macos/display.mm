@@ -11,6 +11,10 @@
 #include "src/platform/macos/misc.h"
 #include "src/platform/macos/nv12_zero_device.h"
 
+#ifdef SUNSHINE_BUILD_SCREENCAPTUREKIT
+  #include "src/platform/macos/sc_video.h"
+#endif
+
 // Avoid conflict between AVFoundation and libavutil both defining AVMediaType
 #define AVMediaType AVMediaType_FFmpeg
 #include "src/video.h"
@@ -22,7 +26,7 @@ namespace platf {
   using namespace std::literals;
 
   struct av_display_t: public display_t {
-    AVVideo *av_capture {};
+    NSObject<DisplayCapture> *av_capture {};
     CGDirectDisplayID display_id {};
 
     ~av_display_t() override {
@@ -56,6 +60,7 @@ namespace platf {
         img_out->height = (int) CVPixelBufferGetHeight(new_pixel_buffer->buf);
         img_out->row_pitch = (int) CVPixelBufferGetBytesPerRow(new_pixel_buffer->buf);
         img_out->pixel_pitch = img_out->row_pitch / img_out->width;
+        img_out->frame_index = av_capture.contentIndex;
 
         old_data_retainer = nullptr;
 
@@ -68,9 +73,19 @@ namespace platf {
         return true;
       }];
 
+      if (!signal) {
+        BOOST_LOG(error) << "Couldn't start capturing the display"sv;
+        return capture_e::error;
+      }
+
       // FIXME: We should time out if an image isn't returned for a while
       dispatch_semaphore_wait(signal, DISPATCH_TIME_FOREVER);
 
+      // The stream stops by itself when the display goes away or changes
+      if (av_capture.interrupted) {
+        return capture_e::reinit;
+      }
+
       return capture_e::ok;
     }
 
@@ -130,6 +145,10 @@ namespace platf {
         return false;
       }];
 
+      if (!signal) {
+        return 1;
+      }
+
       dispatch_semaphore_wait(signal, DISPATCH_TIME_FOREVER);
 
       return 0;
@@ -143,11 +162,11 @@ namespace platf {
      * height --> the intended capture height
      */
     static void setResolution(void *display, int width, int height) {
-      [static_cast<AVVideo *>(display) setFrameWidth:width frameHeight:height];
+      [static_cast<NSObject<DisplayCapture> *>(display) setFrameWidth:width frameHeight:height];
     }
 
     static void setPixelFormat(void *display, OSType pixelFormat) {
-      static_cast<AVVideo *>(display).pixelFormat = pixelFormat;
+      static_cast<NSObject<DisplayCapture> *>(display).pixelFormat = pixelFormat;
     }
   };
 
@@ -177,7 +196,22 @@ namespace platf {
     }
     BOOST_LOG(info) << "Configuring selected display ("sv << display->display_id << ") to stream"sv;
 
-    display->av_capture = [[AVVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate];
+#ifdef SUNSHINE_BUILD_SCREENCAPTUREKIT
+    if (config::video.capture.empty() || config::video.capture == "sck"sv) {
+      if (@available(macOS 12.3, *)) {
+        display->av_capture = [[SCVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate queueDepth:config::video.capture_queue_depth];
+        if (display->av_capture) {
+          BOOST_LOG(info) << "Capturing with ScreenCaptureKit"sv;
+        } else {
+          BOOST_LOG(warning) << "The display can't be captured with ScreenCaptureKit, falling back to AVFoundation"sv;
+        }
+      }
+    }
+#endif
+
+    if (!display->av_capture) {
+      display->av_capture = [[AVVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate];
+    }
 
     if (!display->av_capture) {
       BOOST_LOG(error) << "Video setup failed."sv;
@@ -215,4 +249,14 @@ namespace platf {
     // We don't track GPU state, so we will always reenumerate. Fortunately, it is fast on macOS.
     return true;
   }
+
+  std::string gpu_identity() {
+    // We don't track GPU state, so probe results are never reused
+    return {};
+  }
+
+  std::uint64_t display_topology_generation() {
+    // We don't watch display changes, capture detects them when AVFoundation reports them
+    return 0;
+  }
 }  // namespace platf
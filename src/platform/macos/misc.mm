@@ -11,14 +11,19 @@
 // standard includes
 #include <fcntl.h>
 #include <ifaddrs.h>
+#include <thread>
 
 // platform includes
 #include <arpa/inet.h>
 #include <dlfcn.h>
 #include <Foundation/Foundation.h>
 #include <mach-o/dyld.h>
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#include <net/if.h>
 #include <net/if_dl.h>
 #include <pwd.h>
+#include <sys/event.h>
 
 // lib includes
 #include <boost/asio/ip/address.hpp>
@@ -170,6 +175,24 @@ namespace platf {
     return "00:00:00:00:00:00"s;
   }
 
+  std::uint64_t get_link_speed(const std::string_view &address) {
+    auto ifaddrs = get_ifaddrs();
+
+    for (auto pos = ifaddrs.get(); pos != nullptr; pos = pos->ifa_next) {
+      if (pos->ifa_addr && address == from_sockaddr(pos->ifa_addr)) {
+        // The link statistics are attached to the AF_LINK entry of the same interface
+        for (auto link = ifaddrs.get(); link != nullptr; link = link->ifa_next) {
+          if (link->ifa_addr && link->ifa_addr->sa_family == AF_LINK && link->ifa_data && !strcmp(link->ifa_name, pos->ifa_name)) {
+            return ((struct if_data *) link->ifa_data)->ifi_baudrate;
+          }
+        }
+        break;
+      }
+    }
+
+    return 0;
+  }
+
   // TODO: return actual IP
   std::string get_local_ip_for_gateway() {
     return "";
@@ -219,6 +242,48 @@ namespace platf {
     // Unimplemented
   }
 
+  bool set_thread_affinity(const std::vector<int> &cores) {
+    // macOS only supports affinity hints between threads, not pinning to cores
+    return false;
+  }
+
+  void set_thread_mmcss_task(const std::string &task) {
+    // MMCSS only exists on Windows
+  }
+
+  std::vector<int> numa_node_cores(int node) {
+    return {};
+  }
+
+  std::vector<std::vector<int>> cpu_cache_domains() {
+    return {};
+  }
+
+  std::vector<double> cpu_core_load(std::chrono::milliseconds interval) {
+    return {};
+  }
+
+  int gpu_numa_node() {
+    return -1;
+  }
+
+  memory_usage_t memory_usage() {
+    memory_usage_t usage;
+
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) == KERN_SUCCESS) {
+      usage.resident = info.resident_size;
+    }
+
+    return usage;
+  }
+
+  void trim_memory() {
+    // 0 asks every zone to release as much as it can
+    malloc_zone_pressure_relief(nullptr, 0);
+  }
+
   void streaming_will_start() {
     // Nothing to do
   }
@@ -276,6 +341,62 @@ namespace platf {
     return waitpid(-((pid_t) native_handle), nullptr, WNOHANG) >= 0;
   }
 
+  /**
+   * @brief Waits on a kqueue for the exit of the process or for the user event that stops it.
+   */
+  class app_exit_watcher_t: public deinit_t {
+  public:
+    app_exit_watcher_t(int kq, std::function<void()> on_exit):
+        kq(kq),
+        thread([kq, on_exit = std::move(on_exit)]() {
+          struct kevent event;
+          int count;
+          while ((count = kevent(kq, nullptr, 0, &event, 1, nullptr)) < 0 && errno == EINTR);
+
+          if (count > 0 && event.filter == EVFILT_PROC) {
+            on_exit();
+          }
+        }) {
+    }
+
+    ~app_exit_watcher_t() override {
+      struct kevent event;
+      EV_SET(&event, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, nullptr);
+      kevent(kq, &event, 1, nullptr, 0, nullptr);
+      thread.join();
+
+      close(kq);
+    }
+
+  private:
+    int kq;
+    std::thread thread;
+  };
+
+  std::unique_ptr<deinit_t> watch_app_exit(bp::child &child, bp::group *group, std::function<void()> on_exit) {
+    // A process group has no exit notification, so it keeps being polled
+    if (group) {
+      return nullptr;
+    }
+
+    int kq = kqueue();
+    if (kq < 0) {
+      return nullptr;
+    }
+
+    struct kevent events[2];
+    EV_SET(&events[0], child.id(), EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, nullptr);
+    EV_SET(&events[1], 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, nullptr);
+    if (kevent(kq, events, 2, nullptr, 0, nullptr) < 0) {
+      // ESRCH if the process already exited, polling picks that up
+      BOOST_LOG(debug) << "Couldn't watch the app for its exit: "sv << errno;
+      close(kq);
+      return nullptr;
+    }
+
+    return std::make_unique<app_exit_watcher_t>(kq, std::move(on_exit));
+  }
+
   struct sockaddr_in to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     struct sockaddr_in saddr_v4 = {};
 
@@ -301,6 +422,14 @@ namespace platf {
     return saddr_v6;
   }
 
+  bool enable_send_txtime(std::uintptr_t native_socket) {
+    return false;
+  }
+
+  std::unique_ptr<deinit_t> open_registered_io_socket(bool v6, std::uintptr_t &native_socket) {
+    return nullptr;
+  }
+
   bool send_batch(batched_send_info_t &send_info) {
     // Fall back to unbatched send calls
     return false;
@@ -442,10 +571,12 @@ namespace platf {
    * @param port The destination port for traffic sent on this socket.
    * @param data_type The type of traffic sent on this socket.
    * @param dscp_tagging Specifies whether to enable DSCP tagging on outgoing traffic.
+   * @param dscp_marked Receives the DSCP value the OS reports it marks the traffic with, 0 if it isn't marked.
    */
-  std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging) {
+  std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging, int &dscp_marked) {
     int sockfd = (int) native_socket;
     std::vector<std::tuple<int, int, int>> reset_options;
+    dscp_marked = 0;
 
     // We can use SO_NET_SERVICE_TYPE to set link-layer prioritization without DSCP tagging
     int service_type = 0;
@@ -454,6 +585,7 @@ namespace platf {
         service_type = NET_SERVICE_TYPE_VI;
         break;
       case qos_data_type_e::audio:
+      case qos_data_type_e::control:
         service_type = NET_SERVICE_TYPE_VO;
         break;
       default:
@@ -481,21 +613,7 @@ namespace platf {
         option = IP_TOS;
       }
 
-      // The specific DSCP values here are chosen to be consistent with Windows,
-      // except that we use CS6 instead of CS7 for audio traffic.
-      int dscp = 0;
-      switch (data_type) {
-        case qos_data_type_e::video:
-          dscp = 40;
-          break;
-        case qos_data_type_e::audio:
-          dscp = 48;
-          break;
-        default:
-          BOOST_LOG(error) << "Unknown traffic type: "sv << (int) data_type;
-          break;
-      }
-
+      int dscp = qos_dscp(data_type);
       if (dscp) {
         // Shift to put the DSCP value in the correct position in the TOS field
         dscp <<= 2;
@@ -506,12 +624,24 @@ namespace platf {
         } else {
           BOOST_LOG(error) << "Failed to set TOS/TCLASS: "sv << errno;
         }
+
+        // Report what the socket carries rather than what was asked for
+        int tos = 0;
+        socklen_t tos_size = sizeof(tos);
+        if (getsockopt(sockfd, level, option, &tos, &tos_size) == 0) {
+          dscp_marked = tos >> 2;
+        }
       }
     }
 
     return std::make_unique<qos_t>(sockfd, reset_options);
   }
 
+  std::optional<int> path_mtu(const boost::asio::ip::address &address) {
+    // There's no socket option for the route MTU
+    return std::nullopt;
+  }
+
   std::string get_host_name() {
     try {
       return boost::asio::ip::host_name();
@@ -536,6 +666,16 @@ namespace platf {
     return std::make_unique<macos_high_precision_timer>();
   }
 
+  std::unique_ptr<gpu_monitor_t> make_gpu_monitor() {
+    // Placeholder
+    return nullptr;
+  }
+
+  bool boost_gpu_priority(bool boost) {
+    // Placeholder
+    return false;
+  }
+
   std::string
   get_clipboard() {
     // Placeholder
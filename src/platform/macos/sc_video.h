@@ -0,0 +1,41 @@
+/**
+ * @file src/platform/macos/sc_video.h
+ * @brief Declarations for ScreenCaptureKit video capture on macOS.
+ */
+#pragma once
+
+// platform includes
+#import <ScreenCaptureKit/ScreenCaptureKit.h>
+
+// local includes
+#import "av_video.h"
+
+/**
+ * @brief Display capture through an SCStream.
+ *        Frames are IOSurface backed and only delivered when the content changed.
+ */
+API_AVAILABLE(macos(12.3))
+@interface SCVideo: NSObject <SCStreamOutput, SCStreamDelegate, DisplayCapture>
+
+@property (nonatomic, assign) CGDirectDisplayID displayID;
+@property (nonatomic, assign) CMTime minFrameDuration;
+@property (nonatomic, assign) OSType pixelFormat;
+@property (nonatomic, assign) int frameWidth;
+@property (nonatomic, assign) int frameHeight;
+@property (nonatomic, assign) int queueDepth;
+
+@property (nonatomic, retain) SCDisplay *display;
+@property (nonatomic, retain) SCStream *stream;
+
+/**
+ * @param displayID The display to capture.
+ * @param frameRate The highest rate frames are delivered at.
+ * @param queueDepth Frames the stream renders ahead, the stream stalls while all of them are held.
+ * @return The capture, or nil if the display isn't shareable, e.g. without the screen recording permission.
+ */
+- (id)initWithDisplay:(CGDirectDisplayID)displayID frameRate:(int)frameRate queueDepth:(int)queueDepth;
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight;
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback;
+
+@end
@@ -0,0 +1,207 @@
+/**
+ * @file src/platform/macos/sc_video.m
+ * @brief Definitions for ScreenCaptureKit video capture on macOS.
+ */
+// local includes
+#import "sc_video.h"
+
+@implementation SCVideo {
+  FrameCallbackBlock _captureCallback;
+  dispatch_semaphore_t _captureSignal;
+  dispatch_queue_t _sampleQueue;
+  uint64_t _contentIndex;
+  BOOL _interrupted;
+}
+
+- (id)initWithDisplay:(CGDirectDisplayID)displayID frameRate:(int)frameRate queueDepth:(int)queueDepth {
+  self = [super init];
+  if (!self) {
+    return nil;
+  }
+
+  __block SCShareableContent *content = nil;
+  dispatch_semaphore_t contentReady = dispatch_semaphore_create(0);
+  [SCShareableContent getShareableContentWithCompletionHandler:^(SCShareableContent *shareableContent, NSError *error) {
+    content = [shareableContent retain];
+    dispatch_semaphore_signal(contentReady);
+  }];
+  dispatch_semaphore_wait(contentReady, DISPATCH_TIME_FOREVER);
+  dispatch_release(contentReady);
+
+  for (SCDisplay *display in content.displays) {
+    if (display.displayID == displayID) {
+      self.display = display;
+      break;
+    }
+  }
+  [content release];
+
+  if (!self.display) {
+    [self release];
+    return nil;
+  }
+
+  CGDisplayModeRef mode = CGDisplayCopyDisplayMode(displayID);
+
+  self.displayID = displayID;
+  self.pixelFormat = kCVPixelFormatType_32BGRA;
+  self.frameWidth = (int) CGDisplayModeGetPixelWidth(mode);
+  self.frameHeight = (int) CGDisplayModeGetPixelHeight(mode);
+  self.minFrameDuration = CMTimeMake(1, frameRate);
+  self.queueDepth = queueDepth;
+
+  CFRelease(mode);
+
+  dispatch_queue_attr_t qos = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INITIATED, DISPATCH_QUEUE_PRIORITY_HIGH);
+  _sampleQueue = dispatch_queue_create("screenCaptureQueue", qos);
+
+  return self;
+}
+
+- (void)dealloc {
+  [self finishCapture];
+  if (_captureSignal) {
+    dispatch_release(_captureSignal);
+  }
+  dispatch_release(_sampleQueue);
+  [self.display release];
+  [super dealloc];
+}
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight {
+  self.frameWidth = frameWidth;
+  self.frameHeight = frameHeight;
+}
+
+- (uint64_t)contentIndex {
+  return _contentIndex;
+}
+
+- (BOOL)interrupted {
+  return _interrupted;
+}
+
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback {
+  @synchronized(self) {
+    if (_captureCallback) {
+      // A single stream delivers to a single callback
+      return nil;
+    }
+
+    SCStreamConfiguration *configuration = [[SCStreamConfiguration alloc] init];
+    configuration.width = self.frameWidth;
+    configuration.height = self.frameHeight;
+    configuration.pixelFormat = self.pixelFormat;
+    configuration.minimumFrameInterval = self.minFrameDuration;
+    configuration.queueDepth = self.queueDepth;
+    configuration.showsCursor = YES;
+
+    SCContentFilter *filter = [[SCContentFilter alloc] initWithDisplay:self.display excludingWindows:@[]];
+    SCStream *stream = [[SCStream alloc] initWithFilter:filter configuration:configuration delegate:self];
+    [filter release];
+    [configuration release];
+
+    NSError *error = nil;
+    if (![stream addStreamOutput:self type:SCStreamOutputTypeScreen sampleHandlerQueue:_sampleQueue error:&error]) {
+      NSLog(@"ScreenCaptureKit: couldn't add the stream output: %@", error);
+      [stream release];
+      return nil;
+    }
+
+    // The previous capture has ended, its caller doesn't wait on the semaphore anymore
+    if (_captureSignal) {
+      dispatch_release(_captureSignal);
+    }
+    _captureSignal = dispatch_semaphore_create(0);
+    _captureCallback = [frameCallback copy];
+    _interrupted = NO;
+    self.stream = stream;
+    [stream release];
+  }
+
+  __block BOOL started = NO;
+  dispatch_semaphore_t startDone = dispatch_semaphore_create(0);
+  [self.stream startCaptureWithCompletionHandler:^(NSError *error) {
+    if (error) {
+      NSLog(@"ScreenCaptureKit: couldn't start the stream: %@", error);
+    }
+    started = error == nil;
+    dispatch_semaphore_signal(startDone);
+  }];
+  dispatch_semaphore_wait(startDone, DISPATCH_TIME_FOREVER);
+  dispatch_release(startDone);
+
+  if (!started) {
+    [self finishCapture];
+    return nil;
+  }
+
+  return _captureSignal;
+}
+
+/**
+ * @brief Stop the stream and wake up the caller of `capture:`.
+ */
+- (void)finishCapture {
+  @synchronized(self) {
+    if (!_captureCallback) {
+      return;
+    }
+
+    [_captureCallback release];
+    _captureCallback = nil;
+
+    SCStream *stream = [self.stream retain];
+    self.stream = nil;
+    [stream stopCaptureWithCompletionHandler:^(NSError *error) {
+      [stream release];
+    }];
+
+    dispatch_semaphore_signal(_captureSignal);
+  }
+}
+
+- (void)stream:(SCStream *)stream didOutputSampleBuffer:(CMSampleBufferRef)sampleBuffer ofType:(SCStreamOutputType)type {
+  if (type != SCStreamOutputTypeScreen) {
+    return;
+  }
+
+  CFArrayRef attachmentsArray = CMSampleBufferGetSampleAttachmentsArray(sampleBuffer, false);
+  if (!attachmentsArray || CFArrayGetCount(attachmentsArray) == 0) {
+    return;
+  }
+
+  NSDictionary *attachments = (NSDictionary *) CFArrayGetValueAtIndex(attachmentsArray, 0);
+
+  // Idle frames repeat the previous content and carry no image
+  NSNumber *status = attachments[SCStreamFrameInfoStatus];
+  if (!status || status.integerValue != SCFrameStatusComplete) {
+    return;
+  }
+
+  // Without dirty rects the content is assumed to have changed
+  NSArray *dirtyRects = attachments[SCStreamFrameInfoDirtyRects];
+  if (!dirtyRects || dirtyRects.count) {
+    ++_contentIndex;
+  }
+
+  // finishCapture() waits for a running callback, the caller's state is gone once it returns
+  @synchronized(self) {
+    if (_captureCallback && !_captureCallback(sampleBuffer)) {
+      [self finishCapture];
+    }
+  }
+}
+
+- (void)stream:(SCStream *)stream didStopWithError:(NSError *)error {
+  NSLog(@"ScreenCaptureKit: stream stopped: %@", error);
+
+  @synchronized(self) {
+    if (stream == self.stream) {
+      _interrupted = YES;
+      [self finishCapture];
+    }
+  }
+}
+
+@end
@@ -0,0 +1,341 @@
+/**
+ * @file src/platform/macos/vt_encoder.cpp
+ * @brief Definitions for the native VideoToolbox encoder on macOS.
+ */
+// standard includes
+#include <limits>
+
+// local includes
+#include "src/config.h"
+#include "src/logging.h"
+#include "src/platform/macos/vt_encoder.h"
+#include "src/video.h"
+
+using namespace std::literals;
+
+namespace platf {
+
+  namespace {
+    /**
+     * @brief Frames handed to the session before `submit_frame()` waits, enough to keep the hardware busy.
+     */
+    constexpr int max_in_flight = 2;
+
+    /**
+     * @brief Set an integer property of the session.
+     * @return The status of `VTSessionSetProperty()`.
+     */
+    OSStatus set_property(VTCompressionSessionRef session, CFStringRef key, int value) {
+      auto number = CFNumberCreate(nullptr, kCFNumberIntType, &value);
+      auto status = VTSessionSetProperty(session, key, number);
+      CFRelease(number);
+
+      return status;
+    }
+  }  // namespace
+
+  vt_encoder_t::~vt_encoder_t() {
+    destroy_encoder();
+  }
+
+  bool vt_encoder_t::create_encoder(const video::config_t &client_config, const video::sunshine_colorspace_t &colorspace, int width, int height, frame_callback_t callback) {
+    destroy_encoder();
+
+    switch (client_config.videoFormat) {
+      case 0:
+        codec_type = kCMVideoCodecType_H264;
+        break;
+      case 1:
+        codec_type = kCMVideoCodecType_HEVC;
+        break;
+      default:
+        BOOST_LOG(debug) << "VideoToolbox: AV1 encoding isn't supported"sv;
+        return false;
+    }
+
+    if (colorspace.bit_depth == 10 && codec_type != kCMVideoCodecType_HEVC) {
+      BOOST_LOG(debug) << "VideoToolbox: 10-bit encoding requires HEVC"sv;
+      return false;
+    }
+
+    if (config::video.vt.vt_require_sw) {
+      // The FFmpeg encoder handles forced software encoding
+      return false;
+    }
+
+    framerate = client_config.framerate;
+    next_pts = 0;
+    this->callback = std::move(callback);
+
+    auto encoder_specification = CFDictionaryCreateMutable(nullptr, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    if (config::video.vt.vt_allow_sw) {
+      CFDictionarySetValue(encoder_specification, kVTVideoEncoderSpecification_EnableHardwareAcceleratedVideoEncoder, kCFBooleanTrue);
+    } else {
+      CFDictionarySetValue(encoder_specification, kVTVideoEncoderSpecification_RequireHardwareAcceleratedVideoEncoder, kCFBooleanTrue);
+    }
+
+    // Low-latency rate control keeps every frame close to the per-frame budget and accepts bitrate changes in-flight
+    bool low_latency = false;
+    if (__builtin_available(macOS 11.3, *)) {
+      CFDictionarySetValue(encoder_specification, kVTVideoEncoderSpecification_EnableLowLatencyRateControl, kCFBooleanTrue);
+      low_latency = true;
+    }
+
+    auto status = VTCompressionSessionCreate(nullptr, width, height, codec_type, encoder_specification, nullptr, nullptr, output_callback, this, &session);
+    if (status != noErr && low_latency) {
+      // Older encoders only support low-latency rate control for H.264
+      BOOST_LOG(debug) << "VideoToolbox: low-latency rate control isn't supported for this codec: "sv << status;
+      CFDictionaryRemoveValue(encoder_specification, kVTVideoEncoderSpecification_EnableLowLatencyRateControl);
+      low_latency = false;
+      status = VTCompressionSessionCreate(nullptr, width, height, codec_type, encoder_specification, nullptr, nullptr, output_callback, this, &session);
+    }
+    CFRelease(encoder_specification);
+
+    if (status != noErr) {
+      BOOST_LOG(debug) << "VideoToolbox: VTCompressionSessionCreate() failed: "sv << status;
+      session = nullptr;
+      return false;
+    }
+
+    VTSessionSetProperty(session, kVTCompressionPropertyKey_RealTime, config::video.vt.vt_realtime ? kCFBooleanTrue : kCFBooleanFalse);
+
+    // B-frames delay decoder output, so never use them
+    VTSessionSetProperty(session, kVTCompressionPropertyKey_AllowFrameReordering, kCFBooleanFalse);
+
+    // Use an infinite GOP length since I-frames are generated on demand
+    set_property(session, kVTCompressionPropertyKey_MaxKeyFrameInterval, std::numeric_limits<int>::max());
+    set_property(session, kVTCompressionPropertyKey_ExpectedFrameRate, framerate);
+
+    if (codec_type == kCMVideoCodecType_H264) {
+      VTSessionSetProperty(session, kVTCompressionPropertyKey_ProfileLevel, kVTProfileLevel_H264_High_AutoLevel);
+
+      // Values of config::vt::coder_e, 0 leaves the choice to the encoder
+      if (config::video.vt.vt_coder == 1) {
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_H264EntropyMode, kVTH264EntropyMode_CABAC);
+      } else if (config::video.vt.vt_coder == 2) {
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_H264EntropyMode, kVTH264EntropyMode_CAVLC);
+      }
+    } else {
+      VTSessionSetProperty(session, kVTCompressionPropertyKey_ProfileLevel, colorspace.bit_depth == 10 ? kVTProfileLevel_HEVC_Main10_AutoLevel : kVTProfileLevel_HEVC_Main_AutoLevel);
+    }
+
+    switch (colorspace.colorspace) {
+      case video::colorspace_e::rec601:
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_ColorPrimaries, kCVImageBufferColorPrimaries_SMPTE_C);
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_TransferFunction, kCVImageBufferTransferFunction_ITU_R_709_2);
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_YCbCrMatrix, kCVImageBufferYCbCrMatrix_ITU_R_601_4);
+        break;
+      case video::colorspace_e::rec709:
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_ColorPrimaries, kCVImageBufferColorPrimaries_ITU_R_709_2);
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_TransferFunction, kCVImageBufferTransferFunction_ITU_R_709_2);
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_YCbCrMatrix, kCVImageBufferYCbCrMatrix_ITU_R_709_2);
+        break;
+      case video::colorspace_e::bt2020sdr:
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_ColorPrimaries, kCVImageBufferColorPrimaries_ITU_R_2020);
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_TransferFunction, kCVImageBufferTransferFunction_ITU_R_709_2);
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_YCbCrMatrix, kCVImageBufferYCbCrMatrix_ITU_R_2020);
+        break;
+      case video::colorspace_e::bt2020:
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_ColorPrimaries, kCVImageBufferColorPrimaries_ITU_R_2020);
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_TransferFunction, kCVImageBufferTransferFunction_SMPTE_ST_2084_PQ);
+        VTSessionSetProperty(session, kVTCompressionPropertyKey_YCbCrMatrix, kCVImageBufferYCbCrMatrix_ITU_R_2020);
+        break;
+    }
+
+    if (!reconfigure_bitrate(client_config.bitrate)) {
+      BOOST_LOG(error) << "VideoToolbox: couldn't set the bitrate"sv;
+      destroy_encoder();
+      return false;
+    }
+
+    // Frames are output as soon as they are encoded, not every encoder supports limiting it
+    if (auto delay_status = set_property(session, kVTCompressionPropertyKey_MaxFrameDelayCount, 0); delay_status != noErr) {
+      BOOST_LOG(debug) << "VideoToolbox: couldn't set the maximum frame delay: "sv << delay_status;
+    }
+    if (__builtin_available(macOS 13.0, *)) {
+      VTSessionSetProperty(session, kVTCompressionPropertyKey_PrioritizeEncodingSpeedOverQuality, kCFBooleanTrue);
+    }
+
+    status = VTCompressionSessionPrepareToEncodeFrames(session);
+    if (status != noErr) {
+      BOOST_LOG(error) << "VideoToolbox: VTCompressionSessionPrepareToEncodeFrames() failed: "sv << status;
+      destroy_encoder();
+      return false;
+    }
+
+    BOOST_LOG(info) << "VideoToolbox: created encoder"sv << (low_latency ? " with low-latency rate control"sv : ""sv);
+
+    return true;
+  }
+
+  void vt_encoder_t::destroy_encoder() {
+    if (!session) {
+      return;
+    }
+
+    VTCompressionSessionCompleteFrames(session, kCMTimeInvalid);
+    VTCompressionSessionInvalidate(session);
+    CFRelease(session);
+    session = nullptr;
+
+    std::lock_guard lock(in_flight_mutex);
+    in_flight = 0;
+  }
+
+  bool vt_encoder_t::submit_frame(CVPixelBufferRef pixel_buffer, uint64_t frame_index, bool force_idr) {
+    if (!session || !pixel_buffer) {
+      return false;
+    }
+
+    {
+      std::unique_lock lock(in_flight_mutex);
+      in_flight_cv.wait(lock, [this]() {
+        return in_flight < max_in_flight;
+      });
+      ++in_flight;
+    }
+
+    CFDictionaryRef frame_properties = nullptr;
+    if (force_idr) {
+      const void *keys[] {kVTEncodeFrameOptionKey_ForceKeyFrame};
+      const void *values[] {kCFBooleanTrue};
+      frame_properties = CFDictionaryCreate(nullptr, keys, values, 1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    }
+
+    auto status = VTCompressionSessionEncodeFrame(session, pixel_buffer, CMTimeMake(next_pts++, framerate), kCMTimeInvalid, frame_properties, (void *) (uintptr_t) frame_index, nullptr);
+
+    if (frame_properties) {
+      CFRelease(frame_properties);
+    }
+
+    if (status != noErr) {
+      BOOST_LOG(error) << "VideoToolbox: VTCompressionSessionEncodeFrame() failed: "sv << status;
+
+      std::lock_guard lock(in_flight_mutex);
+      --in_flight;
+      return false;
+    }
+
+    return true;
+  }
+
+  bool vt_encoder_t::reconfigure_bitrate(int bitrate_kbps) {
+    if (!session) {
+      return false;
+    }
+
+    auto status = set_property(session, kVTCompressionPropertyKey_AverageBitRate, bitrate_kbps * 1000);
+    if (status != noErr) {
+      BOOST_LOG(warning) << "VideoToolbox: couldn't change the bitrate to "sv << bitrate_kbps << " Kbps: "sv << status;
+      return false;
+    }
+
+    return true;
+  }
+
+  void vt_encoder_t::output_callback(void *encoder_refcon, void *frame_refcon, OSStatus status, VTEncodeInfoFlags info_flags, CMSampleBufferRef sample_buffer) {
+    auto encoder = (vt_encoder_t *) encoder_refcon;
+
+    vt_encoded_frame_t frame;
+    frame.frame_index = (uint64_t) (uintptr_t) frame_refcon;
+
+    if (status != noErr) {
+      BOOST_LOG(error) << "VideoToolbox: encoding frame "sv << frame.frame_index << " failed: "sv << status;
+      encoder->callback(std::move(frame));
+    } else if ((info_flags & kVTEncodeInfo_FrameDropped) || !sample_buffer) {
+      BOOST_LOG(debug) << "VideoToolbox: frame "sv << frame.frame_index << " was dropped"sv;
+    } else {
+      auto attachments = CMSampleBufferGetSampleAttachmentsArray(sample_buffer, false);
+      frame.idr = true;
+      if (attachments && CFArrayGetCount(attachments) > 0) {
+        auto attachment = (CFDictionaryRef) CFArrayGetValueAtIndex(attachments, 0);
+        frame.idr = !CFDictionaryContainsKey(attachment, kCMSampleAttachmentKey_NotSync);
+      }
+
+      if (!encoder->append_annexb(sample_buffer, frame)) {
+        frame.data.clear();
+      }
+      encoder->callback(std::move(frame));
+    }
+
+    {
+      std::lock_guard lock(encoder->in_flight_mutex);
+      --encoder->in_flight;
+    }
+    encoder->in_flight_cv.notify_one();
+  }
+
+  bool vt_encoder_t::append_annexb(CMSampleBufferRef sample_buffer, vt_encoded_frame_t &frame) {
+    static constexpr uint8_t start_code[] {0, 0, 0, 1};
+
+    auto format = CMSampleBufferGetFormatDescription(sample_buffer);
+
+    auto get_parameter_set = [&](size_t index, const uint8_t **parameter_set, size_t *size, size_t *count, int *nal_length_size) {
+      return codec_type == kCMVideoCodecType_HEVC ?
+               CMVideoFormatDescriptionGetHEVCParameterSetAtIndex(format, index, parameter_set, size, count, nal_length_size) :
+               CMVideoFormatDescriptionGetH264ParameterSetAtIndex(format, index, parameter_set, size, count, nal_length_size);
+    };
+
+    size_t parameter_set_count = 0;
+    int nal_length_size = 0;
+    if (auto status = get_parameter_set(0, nullptr, nullptr, &parameter_set_count, &nal_length_size); status != noErr) {
+      BOOST_LOG(error) << "VideoToolbox: couldn't get the parameter sets: "sv << status;
+      return false;
+    }
+
+    auto block = CMSampleBufferGetDataBuffer(sample_buffer);
+    auto block_size = CMBlockBufferGetDataLength(block);
+
+    // Start codes take the place of the length prefixes, plus the parameter sets of a key frame
+    frame.data.reserve(block_size + (frame.idr ? 256 : 0));
+
+    if (frame.idr) {
+      // The decoder may join at any key frame, so each gets the parameter sets in band
+      for (size_t index = 0; index < parameter_set_count; ++index) {
+        const uint8_t *parameter_set;
+        size_t size;
+        if (auto status = get_parameter_set(index, &parameter_set, &size, nullptr, nullptr); status != noErr) {
+          BOOST_LOG(error) << "VideoToolbox: couldn't get parameter set "sv << index << ": "sv << status;
+          return false;
+        }
+
+        frame.data.insert(frame.data.end(), std::begin(start_code), std::end(start_code));
+        frame.data.insert(frame.data.end(), parameter_set, parameter_set + size);
+      }
+    }
+
+    size_t length = 0;
+    char *data = nullptr;
+    std::vector<uint8_t> copy;
+    if (CMBlockBufferGetDataPointer(block, 0, &length, nullptr, &data) != noErr || length != block_size) {
+      // The block isn't contiguous
+      copy.resize(block_size);
+      if (CMBlockBufferCopyDataBytes(block, 0, block_size, copy.data()) != noErr) {
+        BOOST_LOG(error) << "VideoToolbox: couldn't read the encoded frame"sv;
+        return false;
+      }
+      data = (char *) copy.data();
+    }
+
+    auto begin = (const uint8_t *) data;
+    auto end = begin + block_size;
+    while (end - begin > nal_length_size) {
+      size_t nal_size = 0;
+      for (int x = 0; x < nal_length_size; ++x) {
+        nal_size = (nal_size << 8) | *begin++;
+      }
+
+      if (nal_size > (size_t) (end - begin)) {
+        BOOST_LOG(error) << "VideoToolbox: truncated NAL unit in the encoded frame"sv;
+        return false;
+      }
+
+      frame.data.insert(frame.data.end(), std::begin(start_code), std::end(start_code));
+      frame.data.insert(frame.data.end(), begin, begin + nal_size);
+      begin += nal_size;
+    }
+
+    return true;
+  }
+
+}  // namespace platf
@@ -0,0 +1,106 @@
+/**
+ * @file src/platform/macos/vt_encoder.h
+ * @brief Declarations for the native VideoToolbox encoder on macOS.
+ */
+#pragma once
+
+// standard includes
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// platform includes
+#include <CoreVideo/CoreVideo.h>
+#include <VideoToolbox/VideoToolbox.h>
+
+// local includes
+#include "src/video_colorspace.h"
+
+namespace video {
+  struct config_t;
+}  // namespace video
+
+namespace platf {
+
+  /**
+   * @brief Encoded frame in Annex B format.
+   */
+  struct vt_encoded_frame_t {
+    std::vector<uint8_t> data;
+    uint64_t frame_index = 0;
+    bool idr = false;
+  };
+
+  /**
+   * @brief H.264 and HEVC encoder driven through a VTCompressionSession.
+   *        Unlike the FFmpeg encoder it keeps low-latency rate control on and changes the bitrate in-flight.
+   */
+  class vt_encoder_t {
+  public:
+    /**
+     * @brief Receives completed frames, or an empty frame on error.
+     */
+    using frame_callback_t = std::function<void(vt_encoded_frame_t &&)>;
+
+    vt_encoder_t() = default;
+    vt_encoder_t(const vt_encoder_t &) = delete;
+    vt_encoder_t &operator=(const vt_encoder_t &) = delete;
+    ~vt_encoder_t();
+
+    /**
+     * @brief Create the compression session.
+     * @param client_config Stream configuration requested by the client.
+     * @param colorspace YUV colorspace, the input pixel buffers must match its bit depth.
+     * @param width Width of the input pixel buffers.
+     * @param height Height of the input pixel buffers.
+     * @param callback Called with each completed frame in submission order, from a VideoToolbox thread.
+     * @return `true` on success, `false` on error or if the format is unsupported.
+     */
+    bool create_encoder(const video::config_t &client_config, const video::sunshine_colorspace_t &colorspace, int width, int height, frame_callback_t callback);
+
+    /**
+     * @brief Wait for frames in flight and destroy the compression session.
+     */
+    void destroy_encoder();
+
+    /**
+     * @brief Submit a frame, only waits if too many frames are still being encoded.
+     * @param pixel_buffer The frame, retained by the encoder until it has been encoded.
+     * @param frame_index Frame index passed on to the encoded frame.
+     * @param force_idr Whether to encode the frame as a key frame.
+     * @return `true` on success, `false` on error.
+     */
+    bool submit_frame(CVPixelBufferRef pixel_buffer, uint64_t frame_index, bool force_idr);
+
+    /**
+     * @brief Change the average bitrate, applied from the next submitted frame.
+     * @param bitrate_kbps New bitrate in Kbps.
+     * @return `true` on success, `false` if the session rejected it.
+     */
+    bool reconfigure_bitrate(int bitrate_kbps);
+
+  private:
+    static void output_callback(void *encoder_refcon, void *frame_refcon, OSStatus status, VTEncodeInfoFlags info_flags, CMSampleBufferRef sample_buffer);
+
+    /**
+     * @brief Convert an encoded sample to Annex B.
+     * @param sample_buffer The sample, length prefixed NAL units.
+     * @param frame Receives the NAL units, with the parameter sets in front on key frames.
+     * @return `true` on success, `false` on error.
+     */
+    bool append_annexb(CMSampleBufferRef sample_buffer, vt_encoded_frame_t &frame);
+
+    VTCompressionSessionRef session = nullptr;
+    CMVideoCodecType codec_type = kCMVideoCodecType_H264;
+    int framerate = 60;
+    int64_t next_pts = 0;  ///< Frames are stamped by submission, the frame index can repeat while probing.
+    frame_callback_t callback;
+
+    std::mutex in_flight_mutex;
+    std::condition_variable in_flight_cv;
+    int in_flight = 0;  ///< Frames submitted whose output callback hasn't run yet.
+  };
+
+}  // namespace platf
@@ -0,0 +1,183 @@
+/**
+ * @file src/platform/nvml.cpp
+ * @brief Definitions for sampling NVIDIA GPUs through NVML.
+ */
+// standard includes
+#include <vector>
+
+// platform includes
+#ifdef _WIN32
+  // clang-format off
+  #include <WinSock2.h>
+  #include <Windows.h>
+  // clang-format on
+#else
+  #include <dlfcn.h>
+#endif
+
+// local includes
+#include "nvml.h"
+#include "src/logging.h"
+
+using namespace std::literals;
+
+namespace platf::nvml {
+  namespace {
+    // Subset of nvml.h from the CUDA toolkit, the ABI is stable across driver versions
+    using nvmlReturn_t = int;
+    using nvmlDevice_t = struct nvmlDevice_st *;
+
+    struct nvmlUtilization_t {
+      unsigned int gpu;
+      unsigned int memory;
+    };
+
+    constexpr nvmlReturn_t NVML_SUCCESS = 0;
+    constexpr int NVML_CLOCK_GRAPHICS = 0;
+
+    struct functions_t {
+      nvmlReturn_t (*init)();
+      nvmlReturn_t (*shutdown)();
+      nvmlReturn_t (*device_get_count)(unsigned int *count);
+      nvmlReturn_t (*device_get_handle_by_index)(unsigned int index, nvmlDevice_t *device);
+      nvmlReturn_t (*device_get_utilization_rates)(nvmlDevice_t device, nvmlUtilization_t *utilization);
+      nvmlReturn_t (*device_get_encoder_utilization)(nvmlDevice_t device, unsigned int *utilization, unsigned int *sampling_period_us);
+      nvmlReturn_t (*device_get_clock_info)(nvmlDevice_t device, int type, unsigned int *clock);
+    };
+
+    class library_t {
+    public:
+      library_t() {
+#ifdef _WIN32
+        handle = LoadLibraryExA("nvml.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
+#else
+        handle = dlopen("libnvidia-ml.so.1", RTLD_LAZY | RTLD_LOCAL);
+#endif
+      }
+
+      ~library_t() {
+        if (handle) {
+#ifdef _WIN32
+          FreeLibrary(handle);
+#else
+          dlclose(handle);
+#endif
+        }
+      }
+
+      library_t(const library_t &) = delete;
+      library_t &operator=(const library_t &) = delete;
+
+      template<class T>
+      bool load(T &function, const char *name) {
+#ifdef _WIN32
+        function = (T) GetProcAddress(handle, name);
+#else
+        function = (T) dlsym(handle, name);
+#endif
+        return function != nullptr;
+      }
+
+      explicit operator bool() const {
+        return handle != nullptr;
+      }
+
+    private:
+#ifdef _WIN32
+      HMODULE handle;
+#else
+      void *handle;
+#endif
+    };
+
+    class monitor_t: public gpu_monitor_t {
+    public:
+      ~monitor_t() override {
+        if (initialized) {
+          functions.shutdown();
+        }
+      }
+
+      int init() {
+        if (!library) {
+          return -1;
+        }
+
+        if (!library.load(functions.init, "nvmlInit_v2") ||
+            !library.load(functions.shutdown, "nvmlShutdown") ||
+            !library.load(functions.device_get_count, "nvmlDeviceGetCount_v2") ||
+            !library.load(functions.device_get_handle_by_index, "nvmlDeviceGetHandleByIndex_v2") ||
+            !library.load(functions.device_get_utilization_rates, "nvmlDeviceGetUtilizationRates") ||
+            !library.load(functions.device_get_encoder_utilization, "nvmlDeviceGetEncoderUtilization") ||
+            !library.load(functions.device_get_clock_info, "nvmlDeviceGetClockInfo")) {
+          BOOST_LOG(warning) << "NVML is missing functions, the GPU utilization won't be sampled"sv;
+          return -1;
+        }
+
+        if (functions.init() != NVML_SUCCESS) {
+          BOOST_LOG(warning) << "Couldn't initialize NVML"sv;
+          return -1;
+        }
+        initialized = true;
+
+        unsigned int count = 0;
+        if (functions.device_get_count(&count) != NVML_SUCCESS) {
+          return -1;
+        }
+
+        for (unsigned int x = 0; x < count; ++x) {
+          nvmlDevice_t device;
+          if (functions.device_get_handle_by_index(x, &device) == NVML_SUCCESS) {
+            devices.emplace_back(device);
+          }
+        }
+
+        return devices.empty() ? -1 : 0;
+      }
+
+      gpu_utilization_t sample() override {
+        gpu_utilization_t busiest;
+
+        for (auto device : devices) {
+          gpu_utilization_t utilization;
+
+          unsigned int encoder, sampling_period_us;
+          if (functions.device_get_encoder_utilization(device, &encoder, &sampling_period_us) == NVML_SUCCESS) {
+            utilization.encoder = encoder;
+          }
+
+          nvmlUtilization_t rates;
+          if (functions.device_get_utilization_rates(device, &rates) == NVML_SUCCESS) {
+            utilization.render = rates.gpu;
+          }
+
+          unsigned int clock_mhz;
+          if (functions.device_get_clock_info(device, NVML_CLOCK_GRAPHICS, &clock_mhz) == NVML_SUCCESS) {
+            utilization.clock_mhz = clock_mhz;
+          }
+
+          if (!busiest.encoder || utilization.encoder.value_or(0) > *busiest.encoder) {
+            busiest = utilization;
+          }
+        }
+
+        return busiest;
+      }
+
+    private:
+      library_t library;
+      functions_t functions {};
+      bool initialized = false;
+      std::vector<nvmlDevice_t> devices;
+    };
+  }  // namespace
+
+  std::unique_ptr<gpu_monitor_t> make_monitor() {
+    auto monitor = std::make_unique<monitor_t>();
+    if (monitor->init()) {
+      return nullptr;
+    }
+
+    return monitor;
+  }
+}  // namespace platf::nvml
@@ -0,0 +1,21 @@
+/**
+ * @file src/platform/nvml.h
+ * @brief Declarations for sampling NVIDIA GPUs through NVML.
+ */
+#pragma once
+
+// standard includes
+#include <memory>
+
+// local includes
+#include "src/platform/common.h"
+
+namespace platf::nvml {
+  /**
+   * @brief Create a monitor for the NVIDIA GPUs of the system.
+   * @details NVML is loaded at runtime from the driver, nothing is needed at build time.
+   *          With several NVIDIA GPUs, the one with the busiest encoder is reported.
+   * @return The monitor, or nullptr if no NVIDIA driver is installed.
+   */
+  std::unique_ptr<gpu_monitor_t> make_monitor();
+}  // namespace platf::nvml
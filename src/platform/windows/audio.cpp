@@ -17,6 +17,7 @@
 
 // local includes
 #include "misc.h"
+#include "src/audio_convert.h"
 #include "src/config.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
@@ -218,6 +219,7 @@ namespace platf::audio {
   using collection_t = util::safe_ptr<IMMDeviceCollection, Release<IMMDeviceCollection>>;
   using audio_client_t = util::safe_ptr<IAudioClient, Release<IAudioClient>>;
   using audio_capture_t = util::safe_ptr<IAudioCaptureClient, Release<IAudioCaptureClient>>;
+  using audio_render_t = util::safe_ptr<IAudioRenderClient, Release<IAudioRenderClient>>;
   using wave_format_t = util::safe_ptr<WAVEFORMATEX, co_task_free<WAVEFORMATEX>>;
   using wstring_t = util::safe_ptr<WCHAR, co_task_free<WCHAR>>;
   using handle_t = util::safe_ptr_v2<void, BOOL, CloseHandle>;
@@ -276,24 +278,110 @@ namespace platf::audio {
     },
   };
 
-  audio_client_t make_audio_client(device_t &device, const format_t &format) {
-    audio_client_t audio_client;
-    auto status = device->Activate(
-      IID_IAudioClient,
-      CLSCTX_ALL,
-      nullptr,
-      (void **) &audio_client
-    );
+  /**
+   * @brief Conversion from the mix format of a device to the capture format, done by us instead of the audio engine.
+   */
+  struct mix_conversion_t {
+    ::audio::pcm_format_e format;
+    WORD in_channels;
+    DWORD in_channel_mask;
+    DWORD out_channel_mask;
+    DWORD sample_rate;
+  };
 
-    if (FAILED(status)) {
-      BOOST_LOG(error) << "Couldn't activate Device: [0x"sv << util::hex(status).to_string_view() << ']';
+  /**
+   * @brief Check whether the mix format of a device can be captured as-is and converted by us.
+   * @param mix The mix format.
+   * @param out_channel_mask The channel mask of the capture format.
+   * @return The conversion, or `std::nullopt` to let the audio engine convert.
+   */
+  std::optional<mix_conversion_t> mix_conversion(const WAVEFORMATEX &mix, DWORD out_channel_mask) {
+    auto tag = mix.wFormatTag;
+    DWORD channel_mask = 0;
+    if (tag == WAVE_FORMAT_EXTENSIBLE && mix.cbSize >= 22) {
+      auto &extensible = reinterpret_cast<const WAVEFORMATEXTENSIBLE &>(mix);
+      channel_mask = extensible.dwChannelMask;
+      if (extensible.SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT) {
+        tag = WAVE_FORMAT_IEEE_FLOAT;
+      } else if (extensible.SubFormat == KSDATAFORMAT_SUBTYPE_PCM) {
+        tag = WAVE_FORMAT_PCM;
+      }
+    }
+
+    if (!channel_mask) {
+      switch (mix.nChannels) {
+        case 1:
+          channel_mask = SPEAKER_FRONT_CENTER;
+          break;
+        case 2:
+          channel_mask = waveformat_mask_stereo;
+          break;
+        case 6:
+          channel_mask = waveformat_mask_surround51_with_backspeakers;
+          break;
+        case 8:
+          channel_mask = waveformat_mask_surround71;
+          break;
+        default:
+          return std::nullopt;
+      }
+    }
 
+    std::optional<::audio::pcm_format_e> format;
+    if (tag == WAVE_FORMAT_IEEE_FLOAT && mix.wBitsPerSample == 32) {
+      format = ::audio::pcm_format_e::f32;
+    } else if (tag == WAVE_FORMAT_PCM && mix.wBitsPerSample == 32) {
+      format = ::audio::pcm_format_e::s32;
+    } else if (tag == WAVE_FORMAT_PCM && mix.wBitsPerSample == 16) {
+      format = ::audio::pcm_format_e::s16;
+    }
+
+    if (!format ||
+        mix.nChannels > ::audio::remixer_t::max_in_channels ||
+        mix.nBlockAlign != mix.nChannels * mix.wBitsPerSample / 8 ||
+        (mix.nSamplesPerSec != SAMPLE_RATE && !::audio::resampler_t::is_supported(mix.nSamplesPerSec, SAMPLE_RATE))) {
+      return std::nullopt;
+    }
+
+    return mix_conversion_t {*format, mix.nChannels, channel_mask, out_channel_mask, mix.nSamplesPerSec};
+  }
+
+  /**
+   * @brief Create a loopback audio client for a capture format.
+   * @param device The device to capture.
+   * @param format The capture format.
+   * @param conversion Set when the mix format is captured and has to be converted by the caller.
+   * @return The audio client, or `nullptr` on failure.
+   */
+  audio_client_t make_audio_client(device_t &device, const format_t &format, std::optional<mix_conversion_t> &conversion) {
+    auto activate = [&device]() {
+      audio_client_t audio_client;
+      auto status = device->Activate(
+        IID_IAudioClient,
+        CLSCTX_ALL,
+        nullptr,
+        (void **) &audio_client
+      );
+
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Couldn't activate Device: [0x"sv << util::hex(status).to_string_view() << ']';
+
+        return audio_client_t {};
+      }
+
+      return audio_client;
+    };
+
+    auto audio_client = activate();
+    if (!audio_client) {
       return nullptr;
     }
 
+    HRESULT status;
     WAVEFORMATEXTENSIBLE capture_waveformat =
       create_waveformat(sample_format_e::f32, format.channel_count, format.capture_waveformat_channel_mask);
 
+    conversion.reset();
     {
       wave_format_t mixer_waveformat;
       status = audio_client->GetMixFormat(&mixer_waveformat);
@@ -311,8 +399,35 @@ namespace platf::audio {
       }
 
       BOOST_LOG(info) << "Audio mixer format is "sv << mixer_waveformat->wBitsPerSample << "-bit, "sv
-                      << mixer_waveformat->nSamplesPerSec << " Hz, "sv
-                      << ((mixer_waveformat->nSamplesPerSec != 48000) ? "will be resampled to 48000 by Windows"sv : "no resampling needed"sv);
+                      << mixer_waveformat->nChannels << " channels, "sv
+                      << mixer_waveformat->nSamplesPerSec << " Hz"sv;
+
+      // Capturing the mix format keeps the audio engine's resampler and its latency out of the way
+      conversion = mix_conversion(*mixer_waveformat, capture_waveformat.dwChannelMask);
+      if (conversion) {
+        status = audio_client->Initialize(
+          AUDCLNT_SHAREMODE_SHARED,
+          AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+          0,
+          0,
+          mixer_waveformat.get(),
+          nullptr
+        );
+
+        if (SUCCEEDED(status)) {
+          BOOST_LOG(info) << "Audio capture format is the mixer format, converted to "sv << logging::bracket(waveformat_to_pretty_string(capture_waveformat));
+          return audio_client;
+        }
+
+        BOOST_LOG(warning) << "Couldn't capture the mixer format, letting Windows convert it: [0x"sv << util::hex(status).to_string_view() << ']';
+        conversion.reset();
+
+        // A client that failed to initialize can't be reused
+        audio_client = activate();
+        if (!audio_client) {
+          return nullptr;
+        }
+      }
     }
 
     status = audio_client->Initialize(
@@ -424,26 +539,47 @@ namespace platf::audio {
     std::atomic_bool default_render_device_changed_flag;
   };
 
+  /**
+   * @brief Get the performance counter in the 100ns units of WASAPI buffer positions.
+   * @return The current performance counter value.
+   */
+  std::uint64_t qpc_100ns() {
+    static const auto frequency = []() {
+      LARGE_INTEGER frequency;
+      QueryPerformanceFrequency(&frequency);
+      return frequency.QuadPart;
+    }();
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart / frequency * 10'000'000 + counter.QuadPart % frequency * 10'000'000 / frequency;
+  }
+
   class mic_wasapi_t: public mic_t {
   public:
     capture_e sample(std::vector<float> &sample_out) override {
       auto sample_size = sample_out.size();
 
-      // Refill the sample buffer if needed
-      while (sample_buf_pos - std::begin(sample_buf) < sample_size) {
-        auto capture_result = _fill_buffer();
+      // Samples left over from the previous frame come first
+      frame_timestamp.reset();
+      if (sample_ring_size) {
+        frame_timestamp = sample_ring_timestamp;
+      }
+      auto filled = ring_read(sample_out.data(), sample_size);
+
+      // Captured packets are written straight into the frame, only the excess is kept in the ring
+      while (filled < sample_size) {
+        auto capture_result = _fill_buffer(sample_out.data(), filled, sample_size);
         if (capture_result != capture_e::ok) {
+          // Keep what was already captured for the next call
+          ring_unread(sample_out.data(), filled);
+          if (frame_timestamp) {
+            sample_ring_timestamp = *frame_timestamp;
+          }
           return capture_result;
         }
       }
 
-      // Fill the output buffer with samples
-      std::copy_n(std::begin(sample_buf), sample_size, std::begin(sample_out));
-
-      // Move any excess samples to the front of the buffer
-      std::move(&sample_buf[sample_size], sample_buf_pos, std::begin(sample_buf));
-      sample_buf_pos -= sample_size;
-
       return capture_e::ok;
     }
 
@@ -483,6 +619,7 @@ namespace platf::audio {
         return -1;
       }
 
+      std::optional<mix_conversion_t> conversion;
       for (const auto &format : formats) {
         if (format.channel_count != channels_out) {
           BOOST_LOG(debug) << "Skipping audio format ["sv << format.name << "] with channel count ["sv
@@ -491,7 +628,7 @@ namespace platf::audio {
         }
 
         BOOST_LOG(debug) << "Trying audio format ["sv << format.name << ']';
-        audio_client = make_audio_client(device, format);
+        audio_client = make_audio_client(device, format, conversion);
 
         if (audio_client) {
           BOOST_LOG(debug) << "Found audio format ["sv << format.name << ']';
@@ -505,6 +642,16 @@ namespace platf::audio {
         return -1;
       }
 
+      if (conversion) {
+        remixer.emplace(conversion->format, conversion->in_channels, conversion->in_channel_mask, channels_out, conversion->out_channel_mask);
+        if (conversion->sample_rate != sample_rate) {
+          resampler.emplace(channels_out, conversion->sample_rate, sample_rate);
+        }
+
+        BOOST_LOG(info) << "Converting captured audio with the "sv << remixer->kernel_name() << " remixer"sv
+                        << (resampler ? ", resampled from "s + std::to_string(conversion->sample_rate) + " Hz"s : ""s);
+      }
+
       REFERENCE_TIME default_latency;
       audio_client->GetDevicePeriod(&default_latency, nullptr);
       default_latency_ms = default_latency / 1000;
@@ -518,8 +665,10 @@ namespace platf::audio {
       }
 
       // *2 --> needs to fit double
-      sample_buf = util::buffer_t<float> {std::max(frames, frame_size) * 2 * channels_out};
-      sample_buf_pos = std::begin(sample_buf);
+      sample_ring = util::buffer_t<float> {std::max(frames, frame_size) * 2 * channels_out};
+      sample_ring_start = 0;
+      sample_ring_size = 0;
+      sample_period = std::chrono::nanoseconds {1s} / sample_rate;
 
       status = audio_client->GetService(IID_IAudioCaptureClient, (void **) &audio_capture);
       if (FAILED(status)) {
@@ -568,12 +717,86 @@ namespace platf::audio {
     }
 
   private:
-    capture_e _fill_buffer() {
+    /**
+     * @brief Move samples from the front of the ring into a frame.
+     * @param dest The frame.
+     * @param count The maximum number of samples to move.
+     * @return The number of samples moved.
+     */
+    std::size_t ring_read(float *dest, std::size_t count) {
+      auto capacity = sample_ring.size();
+      count = std::min(count, sample_ring_size);
+
+      auto first = std::min(count, capacity - sample_ring_start);
+      std::copy_n(std::begin(sample_ring) + sample_ring_start, first, dest);
+      std::copy_n(std::begin(sample_ring), count - first, dest + first);
+
+      sample_ring_start = (sample_ring_start + count) % capacity;
+      sample_ring_size -= count;
+      if (sample_ring_timestamp) {
+        *sample_ring_timestamp += sample_period * (count / channels);
+      }
+      return count;
+    }
+
+    /**
+     * @brief Append samples to the back of the ring.
+     * @param src The samples, or `nullptr` for silence.
+     * @param count The number of samples.
+     * @param timestamp The capture time of the first sample.
+     */
+    void ring_write(const float *src, std::size_t count, std::optional<std::chrono::steady_clock::time_point> timestamp) {
+      auto capacity = sample_ring.size();
+      if (!sample_ring_size) {
+        sample_ring_timestamp = timestamp;
+      }
+      if (count > capacity - sample_ring_size) {
+        BOOST_LOG(warning) << "Audio capture buffer overflow";
+        count = capacity - sample_ring_size;
+      }
+
+      auto end = (sample_ring_start + sample_ring_size) % capacity;
+      auto first = std::min(count, capacity - end);
+      if (src) {
+        std::copy_n(src, first, std::begin(sample_ring) + end);
+        std::copy_n(src + first, count - first, std::begin(sample_ring));
+      } else {
+        std::fill_n(std::begin(sample_ring) + end, first, 0.0f);
+        std::fill_n(std::begin(sample_ring), count - first, 0.0f);
+      }
+
+      sample_ring_size += count;
+    }
+
+    /**
+     * @brief Put samples of an incomplete frame back in front of the ring.
+     * @param src The samples, in capture order.
+     * @param count The number of samples.
+     */
+    void ring_unread(const float *src, std::size_t count) {
+      auto capacity = sample_ring.size();
+      count = std::min(count, capacity - sample_ring_size);
+
+      sample_ring_start = (sample_ring_start + capacity - count) % capacity;
+      auto first = std::min(count, capacity - sample_ring_start);
+      std::copy_n(src, first, std::begin(sample_ring) + sample_ring_start);
+      std::copy_n(src + first, count - first, std::begin(sample_ring));
+
+      sample_ring_size += count;
+    }
+
+    /**
+     * @brief Wait for captured packets and append them to a frame.
+     * @param dest The frame.
+     * @param filled The number of samples already in the frame, updated with the new samples.
+     * @param size The size of the frame, samples past it are kept in the ring.
+     * @return The capture status.
+     */
+    capture_e _fill_buffer(float *dest, std::size_t &filled, std::size_t size) {
       HRESULT status;
 
       // Total number of samples
       struct sample_aligned_t {
-        std::uint32_t uninitialized;
         float *samples;
       } sample_aligned;
 
@@ -611,12 +834,13 @@ namespace platf::audio {
         status = audio_capture->GetNextPacketSize(&packet_size)
       ) {
         DWORD buffer_flags;
+        UINT64 qpc_position;
         status = audio_capture->GetBuffer(
           (BYTE **) &sample_aligned.samples,
           &block_aligned.audio_sample_size,
           &buffer_flags,
           nullptr,
-          nullptr
+          &qpc_position
         );
 
         switch (status) {
@@ -633,20 +857,58 @@ namespace platf::audio {
           BOOST_LOG(debug) << "Audio capture signaled buffer discontinuity";
         }
 
-        sample_aligned.uninitialized = std::end(sample_buf) - sample_buf_pos;
-        auto n = std::min(sample_aligned.uninitialized, block_aligned.audio_sample_size * channels);
+        // The position is the performance counter in 100ns units when the first sample was captured
+        std::optional<std::chrono::steady_clock::time_point> timestamp;
+        if (!(buffer_flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)) {
+          auto now = std::chrono::steady_clock::now();
+          timestamp = now - std::chrono::nanoseconds {(std::int64_t) (qpc_100ns() - qpc_position) * 100};
+        }
+
+        bool silent = buffer_flags & AUDCLNT_BUFFERFLAGS_SILENT;
+        const float *samples = sample_aligned.samples;
+        std::size_t frames = block_aligned.audio_sample_size;
 
-        if (n < block_aligned.audio_sample_size * channels) {
-          BOOST_LOG(warning) << "Audio capture buffer overflow";
+        // Packets in the mixer format are converted to the capture format
+        if (remixer && !silent) {
+          converted.resize(frames * channels);
+          remixer->convert(sample_aligned.samples, frames, converted.data());
+          samples = converted.data();
         }
+        if (resampler) {
+          // Silence goes through the filter as well to keep its history continuous
+          if (silent) {
+            converted.assign(frames * channels, 0.0f);
+            samples = converted.data();
+            silent = false;
+          }
+
+          resampled.clear();
+          auto offset = resampler->process(samples, frames, resampled);
+          if (timestamp) {
+            *timestamp += offset;
+          }
+          samples = resampled.data();
+          frames = resampled.size() / channels;
+        }
+
+        std::size_t count = frames * channels;
+        auto n = std::min(count, size - filled);
 
-        if (buffer_flags & AUDCLNT_BUFFERFLAGS_SILENT) {
-          std::fill_n(sample_buf_pos, n, 0);
+        if (!filled) {
+          frame_timestamp = timestamp;
+        }
+
+        if (silent) {
+          std::fill_n(dest + filled, n, 0.0f);
         } else {
-          std::copy_n(sample_aligned.samples, n, sample_buf_pos);
+          std::copy_n(samples, n, dest + filled);
         }
+        filled += n;
 
-        sample_buf_pos += n;
+        if (timestamp) {
+          *timestamp += sample_period * (n / channels);
+        }
+        ring_write(silent ? nullptr : samples + n, count - n, timestamp);
 
         audio_capture->ReleaseBuffer(block_aligned.audio_sample_size);
       }
@@ -675,13 +937,123 @@ namespace platf::audio {
 
     REFERENCE_TIME default_latency_ms;
 
-    util::buffer_t<float> sample_buf;
-    float *sample_buf_pos;
+    util::buffer_t<float> sample_ring;  ///< Samples captured past the end of the last frame
+    std::size_t sample_ring_start;  ///< Index of the oldest sample in the ring
+    std::size_t sample_ring_size;  ///< Number of samples in the ring
+    std::optional<std::chrono::steady_clock::time_point> sample_ring_timestamp;  ///< Capture time of the oldest sample in the ring
+    std::chrono::nanoseconds sample_period;  ///< Duration of one sample of each channel
     int channels;
 
+    std::optional<::audio::remixer_t> remixer;  ///< Set when the mixer format is captured
+    std::optional<::audio::resampler_t> resampler;  ///< Set when the mixer format has another sample rate
+    std::vector<float> converted;  ///< Packet converted to the float layout of the encoder
+    std::vector<float> resampled;  ///< Packet resampled to the sample rate of the encoder
+
     HANDLE mmcss_task_handle = nullptr;
   };
 
+  /**
+   * @brief Plays the client microphone into the render endpoint of the Steam Streaming Microphone.
+   * @details Applications record it from the matching capture endpoint.
+   */
+  class virtual_mic_wasapi_t: public ::platf::virtual_mic_t {
+  public:
+    int init(device_t &device, int channels_in) {
+      auto status = device->Activate(
+        IID_IAudioClient,
+        CLSCTX_ALL,
+        nullptr,
+        (void **) &audio_client
+      );
+
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Couldn't activate the virtual microphone: [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+
+      channels = channels_in;
+      auto waveformat = create_waveformat(sample_format_e::f32, channels, channels == 1 ? SPEAKER_FRONT_CENTER : waveformat_mask_stereo);
+
+      // 40ms leaves room for a few packets of jitter, the jitter buffer keeps it mostly empty
+      status = audio_client->Initialize(
+        AUDCLNT_SHAREMODE_SHARED,
+        AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
+        40 * 10'000,
+        0,
+        (LPWAVEFORMATEX) &waveformat,
+        nullptr
+      );
+
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Couldn't initialize the virtual microphone: [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+
+      status = audio_client->GetBufferSize(&buffer_frames);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Couldn't get the buffer size of the virtual microphone: [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+
+      status = audio_client->GetService(IID_IAudioRenderClient, (void **) &audio_render);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Couldn't initialize the virtual microphone render client: [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+
+      status = audio_client->Start();
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Couldn't start the virtual microphone: [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+
+      return 0;
+    }
+
+    int write(const float *samples, std::size_t frames) override {
+      UINT32 padding;
+      auto status = audio_client->GetCurrentPadding(&padding);
+      if (status == AUDCLNT_E_DEVICE_INVALIDATED) {
+        return -1;
+      }
+      if (FAILED(status)) {
+        return 0;
+      }
+
+      auto n = std::min<std::size_t>(frames, buffer_frames - padding);
+      if (n < frames) {
+        BOOST_LOG(debug) << "Virtual microphone buffer is full, dropping "sv << frames - n << " frames"sv;
+      }
+      if (!n) {
+        return 0;
+      }
+
+      BYTE *data;
+      status = audio_render->GetBuffer(n, &data);
+      if (status == AUDCLNT_E_DEVICE_INVALIDATED) {
+        return -1;
+      }
+      if (FAILED(status)) {
+        return 0;
+      }
+
+      std::copy_n(samples, n * channels, (float *) data);
+      audio_render->ReleaseBuffer(n, 0);
+      return 0;
+    }
+
+    ~virtual_mic_wasapi_t() override {
+      if (audio_client) {
+        audio_client->Stop();
+      }
+    }
+
+    audio_client_t audio_client;
+    audio_render_t audio_render;
+    UINT32 buffer_frames;
+    int channels;
+  };
+
   class audio_control_t: public ::platf::audio_control_t {
   public:
     std::optional<sink_t> sink_info() override {
@@ -729,6 +1101,29 @@ namespace platf::audio {
       return sink;
     }
 
+    std::unique_ptr<::platf::virtual_mic_t> virtual_microphone(int channels, std::uint32_t sample_rate) override {
+      auto matched = find_device_id(match_steam_microphone());
+      if (!matched) {
+        BOOST_LOG(warning) << "Couldn't find the Steam Streaming Microphone"sv;
+        return nullptr;
+      }
+
+      device_t device;
+      auto status = device_enum->GetDevice(matched->second.c_str(), &device);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Couldn't open the Steam Streaming Microphone: [0x"sv << util::hex(status).to_string_view() << ']';
+        return nullptr;
+      }
+
+      auto mic = std::make_unique<virtual_mic_wasapi_t>();
+      if (mic->init(device, channels)) {
+        return nullptr;
+      }
+
+      BOOST_LOG(info) << "Playing the client microphone into the Steam Streaming Microphone"sv;
+      return mic;
+    }
+
     bool is_sink_available(const std::string &sink) override {
       const auto match_list = match_all_fields(from_utf8(sink));
       const auto matched = find_device_id(match_list);
@@ -896,6 +1291,12 @@ namespace platf::audio {
       };
     }
 
+    audio_control_t::match_fields_list_t match_steam_microphone() {
+      return {
+        {match_field_e::adapter_friendly_name, L"Steam Streaming Microphone"}
+      };
+    }
+
     audio_control_t::match_fields_list_t match_all_fields(const std::wstring &name) {
       return {
         {match_field_e::device_id, name},  // {0.0.0.00000000}.{29dd7668-45b2-4846-882d-950f55bf7eb8}
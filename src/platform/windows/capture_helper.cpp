@@ -0,0 +1,308 @@
+/**
+ * @file src/platform/windows/capture_helper.cpp
+ * @brief Definitions for capturing through the capture helper process, see capture_helper.h.
+ */
+// standard includes
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <vector>
+
+// local includes
+#include "capture_helper.h"
+#include "display.h"
+#include "misc.h"
+#include "src/logging.h"
+
+namespace platf::dxgi {
+  using namespace std::literals;
+
+  namespace {
+    constexpr auto startup_timeout = 5s;  ///< Duplicating the output may take a few retries while the mode settles
+    constexpr auto exit_timeout = 1s;
+  }  // namespace
+
+  int capture_helper_t::init(display_base_t *display, const std::vector<DXGI_FORMAT> &formats, DXGI_OUTDUPL_DESC &desc) {
+    auto status = display->device->QueryInterface(IID_ID3D11Device1, (void **) &device);
+    if (FAILED(status)) {
+      BOOST_LOG(warning) << "Failed to query ID3D11Device1 for the capture helper [0x"sv << util::hex(status).to_string_view() << ']';
+      return -1;
+    }
+
+    // The helper receives its objects by handle inheritance, limited to these handles below
+    SECURITY_ATTRIBUTES inheritable {sizeof(inheritable), nullptr, TRUE};
+
+    mapping.reset(CreateFileMappingW(INVALID_HANDLE_VALUE, &inheritable, PAGE_READWRITE, 0, sizeof(capture_helper::shared_t), nullptr));
+    frame_event.reset(CreateEventW(&inheritable, FALSE, FALSE, nullptr));
+    stop_event.reset(CreateEventW(&inheritable, TRUE, FALSE, nullptr));
+    if (!mapping || !frame_event || !stop_event) {
+      BOOST_LOG(error) << "Failed to create the shared objects of the capture helper: "sv << GetLastError();
+      return -1;
+    }
+
+    auto view = MapViewOfFile(mapping.get(), FILE_MAP_ALL_ACCESS, 0, 0, sizeof(capture_helper::shared_t));
+    if (!view) {
+      BOOST_LOG(error) << "Failed to map the shared memory of the capture helper: "sv << GetLastError();
+      return -1;
+    }
+    shared = new (view) capture_helper::shared_t {};
+
+    DXGI_ADAPTER_DESC1 adapter_desc;
+    display->adapter->GetDesc1(&adapter_desc);
+    DXGI_OUTPUT_DESC output_desc;
+    display->output->GetDesc(&output_desc);
+
+    shared->version = capture_helper::protocol_version;
+    shared->adapter_luid = adapter_desc.AdapterLuid;
+    std::memcpy(shared->output_name, output_desc.DeviceName, sizeof(shared->output_name));
+    shared->format_count = (std::uint32_t) std::min<std::size_t>(formats.size(), capture_helper::max_formats);
+    std::copy_n(std::begin(formats), shared->format_count, shared->formats);
+    shared->reading_slot = -1;
+
+    job.reset(CreateJobObjectW(nullptr, nullptr));
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION job_limit_info {};
+    // Don't leave the helper duplicating the output if we crash
+    job_limit_info.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    if (!job || !SetInformationJobObject(job.get(), JobObjectExtendedLimitInformation, &job_limit_info, sizeof(job_limit_info))) {
+      BOOST_LOG(error) << "Failed to create the job object of the capture helper: "sv << GetLastError();
+      return -1;
+    }
+
+    WCHAR module_path[MAX_PATH];
+    GetModuleFileNameW(nullptr, module_path, _countof(module_path));
+    auto exe = std::filesystem::path {module_path}.parent_path() / capture_helper::exe_name;
+
+    auto cmd = L'"' + exe.wstring() + L"\" "s +
+               std::to_wstring((std::uintptr_t) mapping.get()) + L' ' +
+               std::to_wstring((std::uintptr_t) frame_event.get()) + L' ' +
+               std::to_wstring((std::uintptr_t) stop_event.get());
+
+    SIZE_T size;
+    InitializeProcThreadAttributeList(nullptr, 1, 0, &size);
+    std::vector<std::uint8_t> attribute_list(size);
+    auto list = (LPPROC_THREAD_ATTRIBUTE_LIST) attribute_list.data();
+    if (!InitializeProcThreadAttributeList(list, 1, 0, &size)) {
+      BOOST_LOG(error) << "Failed to initialize the attributes of the capture helper: "sv << GetLastError();
+      return -1;
+    }
+    auto delete_list = util::fail_guard([list]() {
+      DeleteProcThreadAttributeList(list);
+    });
+
+    HANDLE inherited[] {mapping.get(), frame_event.get(), stop_event.get()};
+    UpdateProcThreadAttribute(list, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherited, sizeof(inherited), nullptr, nullptr);
+
+    STARTUPINFOEXW startup_info {};
+    startup_info.StartupInfo.cb = sizeof(startup_info);
+    startup_info.lpAttributeList = list;
+
+    // Suspended until it's in the job, so it can't outlive us even if it fails right away
+    PROCESS_INFORMATION process_info;
+    if (!CreateProcessW(exe.c_str(), cmd.data(), nullptr, nullptr, TRUE, EXTENDED_STARTUPINFO_PRESENT | CREATE_SUSPENDED | CREATE_NO_WINDOW | HIGH_PRIORITY_CLASS, nullptr, nullptr, (LPSTARTUPINFOW) &startup_info, &process_info)) {
+      BOOST_LOG(warning) << "Failed to launch the capture helper ["sv << exe.string() << "]: "sv << GetLastError();
+      return -1;
+    }
+    process.reset(process_info.hProcess);
+    handle_t thread {process_info.hThread};
+
+    if (!AssignProcessToJobObject(job.get(), process.get())) {
+      BOOST_LOG(error) << "Failed to assign the capture helper to its job: "sv << GetLastError();
+      TerminateProcess(process.get(), 1);
+      return -1;
+    }
+    ResumeThread(thread.get());
+
+    // The helper sets the frame event once the state leaves starting
+    HANDLE handles[] {frame_event.get(), process.get()};
+    auto wait = WaitForMultipleObjects(_countof(handles), handles, FALSE, std::chrono::milliseconds(startup_timeout).count());
+    auto state = shared->state.load();
+    if (wait == WAIT_TIMEOUT || state == capture_helper::state_e::starting) {
+      BOOST_LOG(warning) << "The capture helper didn't duplicate the output in time"sv;
+      return -1;
+    }
+    if (state != capture_helper::state_e::running) {
+      log_failure();
+      return -1;
+    }
+
+    desc = shared->desc;
+    BOOST_LOG(info) << "Capturing through the capture helper, pid "sv << process_info.dwProcessId;
+    return 0;
+  }
+
+  capture_e capture_helper_t::next_frame(DXGI_OUTDUPL_FRAME_INFO &frame_info, std::chrono::milliseconds timeout, resource_t::pointer *res_p) {
+    auto capture_status = release_frame();
+    if (capture_status != capture_e::ok) {
+      return capture_status;
+    }
+
+    if (shared->latest_sequence.load(std::memory_order_acquire) == consumed.sequence) {
+      HANDLE handles[] {frame_event.get(), process.get()};
+      if (WaitForMultipleObjects(_countof(handles), handles, FALSE, timeout.count()) == WAIT_TIMEOUT) {
+        return capture_e::timeout;
+      }
+    }
+
+    switch (shared->state.load()) {
+      case capture_helper::state_e::running:
+        break;
+      case capture_helper::state_e::reinit:
+        return capture_e::reinit;
+      default:
+        log_failure();
+        return capture_e::reinit;
+    }
+
+    if (WaitForSingleObject(process.get(), 0) == WAIT_OBJECT_0) {
+      DWORD exit_code = 0;
+      GetExitCodeProcess(process.get(), &exit_code);
+      BOOST_LOG(error) << "The capture helper exited unexpectedly: "sv << exit_code;
+      return capture_e::reinit;
+    }
+
+    // Woken up without a new frame
+    if (shared->latest_sequence.load(std::memory_order_acquire) == consumed.sequence) {
+      return capture_e::timeout;
+    }
+
+    if (!mutexes.back() && open_textures()) {
+      return capture_e::error;
+    }
+
+    // The helper may start writing the latest slot again before we hold its mutex,
+    // we then wait for it and read the newer frame it wrote instead
+    auto slot = shared->latest_slot.load(std::memory_order_acquire);
+    shared->reading_slot = slot;
+    auto status = mutexes[slot]->AcquireSync(0, (DWORD) timeout.count());
+    if (status != S_OK) {
+      shared->reading_slot = -1;
+      if (status == WAIT_TIMEOUT) {
+        return capture_e::timeout;
+      }
+
+      // WAIT_ABANDONED if the helper died while holding it
+      BOOST_LOG(error) << "Failed to acquire the frame of the capture helper [0x"sv << util::hex(status).to_string_view() << ']';
+      return capture_e::reinit;
+    }
+    held_slot = slot;
+
+    auto &meta = shared->slots[slot];
+    frame_info = {};
+    if (meta.present_count != consumed.present_count) {
+      frame_info.LastPresentTime.QuadPart = meta.last_present_qpc;
+      frame_info.AccumulatedFrames = (UINT) (meta.present_count - consumed.present_count);
+    }
+    if (meta.mouse_count != consumed.mouse_count) {
+      frame_info.LastMouseUpdateTime.QuadPart = meta.last_mouse_update_qpc;
+    }
+    frame_info.PointerPosition = meta.pointer_position;
+    if (meta.pointer_shape_sequence != consumed.pointer_shape_sequence) {
+      frame_info.PointerShapeBufferSize = meta.pointer_shape_size;
+    }
+
+    // The changes are relative to the previous sequence, unknown if we skipped it
+    dirty_rects_valid = meta.dirty_rects_valid && meta.sequence == consumed.sequence + 1;
+    dirty_rects.assign(meta.dirty_rects, meta.dirty_rects + std::min<std::uint32_t>(meta.dirty_rect_count, capture_helper::max_dirty_rects));
+
+    consumed = {meta.sequence, meta.present_count, meta.mouse_count, meta.pointer_shape_sequence};
+
+    status = textures[slot]->QueryInterface(IID_IDXGIResource, (void **) res_p);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to query IDXGIResource from the frame of the capture helper [0x"sv << util::hex(status).to_string_view() << ']';
+      return capture_e::error;
+    }
+
+    return capture_e::ok;
+  }
+
+  bool capture_helper_t::get_dirty_rects(std::vector<RECT> &rects) {
+    rects = dirty_rects;
+    return dirty_rects_valid;
+  }
+
+  HRESULT capture_helper_t::get_pointer_shape(UINT size, void *buffer, DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info) {
+    if (held_slot < 0) {
+      return DXGI_ERROR_INVALID_CALL;
+    }
+
+    auto &meta = shared->slots[held_slot];
+    if (size < meta.pointer_shape_size) {
+      return DXGI_ERROR_MORE_DATA;
+    }
+
+    std::memcpy(buffer, meta.pointer_shape, meta.pointer_shape_size);
+    shape_info = meta.pointer_shape_info;
+    return S_OK;
+  }
+
+  capture_e capture_helper_t::release_frame() {
+    if (held_slot < 0) {
+      return capture_e::ok;
+    }
+
+    auto status = mutexes[held_slot]->ReleaseSync(0);
+    shared->reading_slot = -1;
+    held_slot = -1;
+
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to release the frame of the capture helper [0x"sv << util::hex(status).to_string_view() << ']';
+      return capture_e::reinit;
+    }
+    return capture_e::ok;
+  }
+
+  capture_helper_t::~capture_helper_t() {
+    if (shared) {
+      release_frame();
+    }
+
+    if (process) {
+      SetEvent(stop_event.get());
+      if (WaitForSingleObject(process.get(), std::chrono::milliseconds(exit_timeout).count()) == WAIT_TIMEOUT) {
+        TerminateProcess(process.get(), 1);
+      }
+    }
+
+    if (shared) {
+      UnmapViewOfFile(shared);
+    }
+  }
+
+  int capture_helper_t::open_textures() {
+    for (int x = 0; x < capture_helper::slot_count; ++x) {
+      HANDLE handle;
+      if (!DuplicateHandle(process.get(), (HANDLE) (std::uintptr_t) shared->texture_handles[x], GetCurrentProcess(), &handle, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        BOOST_LOG(error) << "Failed to duplicate the texture handle of the capture helper: "sv << GetLastError();
+        return -1;
+      }
+      handle_t texture_handle {handle};
+
+      auto status = device->OpenSharedResource1(texture_handle.get(), IID_ID3D11Texture2D, (void **) &textures[x]);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Failed to open the texture of the capture helper [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+
+      status = textures[x]->QueryInterface(IID_IDXGIKeyedMutex, (void **) &mutexes[x]);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Failed to query IDXGIKeyedMutex from the texture of the capture helper [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+    }
+
+    return 0;
+  }
+
+  void capture_helper_t::log_failure() {
+    if (shared->state == capture_helper::state_e::failed) {
+      std::string message {shared->error_message, strnlen(shared->error_message, sizeof(shared->error_message))};
+      BOOST_LOG(error) << "The capture helper failed: "sv << message << " [0x"sv << util::hex(shared->error).to_string_view() << ']';
+    } else {
+      DWORD exit_code = 0;
+      GetExitCodeProcess(process.get(), &exit_code);
+      BOOST_LOG(error) << "The capture helper exited before duplicating the output: "sv << exit_code;
+    }
+  }
+}  // namespace platf::dxgi
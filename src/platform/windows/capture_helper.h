@@ -0,0 +1,89 @@
+/**
+ * @file src/platform/windows/capture_helper.h
+ * @brief Declarations for the shared memory protocol between Apollo and tools/capture_helper.cpp.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <cstdint>
+
+// platform includes
+#include <dxgi1_2.h>
+#include <Windows.h>
+
+/**
+ * @brief The capture helper duplicates the output in its own process and hands its frames to Apollo.
+ * @details The helper follows the input desktop across switches to the secure desktop on its own,
+ *          so Apollo keeps its D3D device, encoder and cursor textures while a UAC prompt or the
+ *          lock screen comes and goes. Frames are copied into a ring of shared textures guarded by
+ *          keyed mutexes, and the metadata of each frame is written to the slot of its texture.
+ *
+ *          Apollo writes the request before launching the helper, the helper writes everything else.
+ *          The helper never writes to the slot Apollo is reading from.
+ */
+namespace platf::dxgi::capture_helper {
+  constexpr std::uint32_t protocol_version = 1;
+  constexpr int slot_count = 3;  ///< One being read by Apollo, one being written by the helper, one ready
+  constexpr int max_dirty_rects = 64;  ///< More changed regions than this are sent as a full frame
+  constexpr int max_formats = 8;
+  constexpr std::uint32_t max_pointer_shape_size = 256 * 256 * 4;
+  constexpr std::size_t max_error_size = 128;
+
+  /**
+   * @brief Executable of the helper, in the tools directory next to Apollo.
+   */
+  constexpr const wchar_t *exe_name = L"tools\\capture-helper.exe";
+
+  enum class state_e : std::uint32_t {
+    starting,  ///< The helper hasn't duplicated the output yet
+    running,  ///< The desktop description is set, textures are published with the first frame
+    reinit,  ///< The mode of the output changed, Apollo must start over with a new helper
+    failed,  ///< The helper gave up, see `shared_t::error`
+  };
+
+  /**
+   * @brief Metadata of the frame in a texture of the ring.
+   * @details The counters are cumulative so Apollo can tell what changed since the last frame it consumed,
+   *          even when it skipped some of the frames in between.
+   */
+  struct slot_t {
+    std::uint64_t sequence;  ///< Sequence number of the frame, starting at 1
+    std::uint64_t present_count;  ///< Number of frames presented so far
+    std::int64_t last_present_qpc;  ///< QPC time of the last presented frame
+    std::uint64_t mouse_count;  ///< Number of mouse updates so far
+    std::int64_t last_mouse_update_qpc;  ///< QPC time of the last mouse update
+    DXGI_OUTDUPL_POINTER_POSITION pointer_position;
+
+    std::uint64_t pointer_shape_sequence;  ///< Incremented when the pointer shape changes
+    DXGI_OUTDUPL_POINTER_SHAPE_INFO pointer_shape_info;
+    std::uint32_t pointer_shape_size;
+    std::uint8_t pointer_shape[max_pointer_shape_size];
+
+    bool dirty_rects_valid;  ///< `false` if the whole frame must be treated as changed since the previous sequence
+    std::uint32_t dirty_rect_count;
+    RECT dirty_rects[max_dirty_rects];  ///< Dirty rects and destinations of move rects
+  };
+
+  struct shared_t {
+    // Written by Apollo
+    std::uint32_t version;
+    LUID adapter_luid;
+    wchar_t output_name[32];  ///< DXGI_OUTPUT_DESC::DeviceName
+    std::uint32_t format_count;  ///< 0 to use IDXGIOutput1::DuplicateOutput()
+    DXGI_FORMAT formats[max_formats];
+
+    // Written by the helper
+    std::atomic<state_e> state;
+    HRESULT error;
+    char error_message[max_error_size];
+    DXGI_OUTDUPL_DESC desc;  ///< Set before the state is running
+    std::uint64_t texture_handles[slot_count];  ///< NT handles in the helper process, set before the first sequence
+    std::atomic<std::uint64_t> latest_sequence;  ///< Sequence of the latest frame, 0 before the first one
+    std::atomic<std::int32_t> latest_slot;
+    slot_t slots[slot_count];  ///< Written while holding the keyed mutex of the texture of the slot
+
+    // Written by Apollo
+    std::atomic<std::int32_t> reading_slot;  ///< Slot Apollo holds the keyed mutex of, -1 for none
+  };
+}  // namespace platf::dxgi::capture_helper
@@ -4,6 +4,13 @@
  */
 #pragma once
 
+// standard includes
+#include <array>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <vector>
+
 // platform includes
 #include <d3d11.h>
 #include <d3d11_4.h>
@@ -15,6 +22,8 @@
 #include <winrt/windows.graphics.capture.h>
 
 // local includes
+#include "capture_helper.h"
+#include "src/metrics.h"
 #include "src/platform/common.h"
 #include "src/utility.h"
 #include "src/video.h"
@@ -36,7 +45,10 @@ namespace platf::dxgi {
   using dxgi1_t = util::safe_ptr<IDXGIDevice1, Release<IDXGIDevice1>>;
   using device_t = util::safe_ptr<ID3D11Device, Release<ID3D11Device>>;
   using device1_t = util::safe_ptr<ID3D11Device1, Release<ID3D11Device1>>;
+  using device3_t = util::safe_ptr<ID3D11Device3, Release<ID3D11Device3>>;
+  using device5_t = util::safe_ptr<ID3D11Device5, Release<ID3D11Device5>>;
   using device_ctx_t = util::safe_ptr<ID3D11DeviceContext, Release<ID3D11DeviceContext>>;
+  using device_ctx4_t = util::safe_ptr<ID3D11DeviceContext4, Release<ID3D11DeviceContext4>>;
   using adapter_t = util::safe_ptr<IDXGIAdapter1, Release<IDXGIAdapter1>>;
   using output_t = util::safe_ptr<IDXGIOutput, Release<IDXGIOutput>>;
   using output1_t = util::safe_ptr<IDXGIOutput1, Release<IDXGIOutput1>>;
@@ -44,16 +56,19 @@ namespace platf::dxgi {
   using output6_t = util::safe_ptr<IDXGIOutput6, Release<IDXGIOutput6>>;
   using dup_t = util::safe_ptr<IDXGIOutputDuplication, Release<IDXGIOutputDuplication>>;
   using texture2d_t = util::safe_ptr<ID3D11Texture2D, Release<ID3D11Texture2D>>;
+  using texture2d1_t = util::safe_ptr<ID3D11Texture2D1, Release<ID3D11Texture2D1>>;
   using texture1d_t = util::safe_ptr<ID3D11Texture1D, Release<ID3D11Texture1D>>;
   using resource_t = util::safe_ptr<IDXGIResource, Release<IDXGIResource>>;
   using resource1_t = util::safe_ptr<IDXGIResource1, Release<IDXGIResource1>>;
   using multithread_t = util::safe_ptr<ID3D11Multithread, Release<ID3D11Multithread>>;
   using vs_t = util::safe_ptr<ID3D11VertexShader, Release<ID3D11VertexShader>>;
   using ps_t = util::safe_ptr<ID3D11PixelShader, Release<ID3D11PixelShader>>;
+  using cs_t = util::safe_ptr<ID3D11ComputeShader, Release<ID3D11ComputeShader>>;
   using blend_t = util::safe_ptr<ID3D11BlendState, Release<ID3D11BlendState>>;
   using input_layout_t = util::safe_ptr<ID3D11InputLayout, Release<ID3D11InputLayout>>;
   using render_target_t = util::safe_ptr<ID3D11RenderTargetView, Release<ID3D11RenderTargetView>>;
   using shader_res_t = util::safe_ptr<ID3D11ShaderResourceView, Release<ID3D11ShaderResourceView>>;
+  using unordered_access_t = util::safe_ptr<ID3D11UnorderedAccessView, Release<ID3D11UnorderedAccessView>>;
   using buf_t = util::safe_ptr<ID3D11Buffer, Release<ID3D11Buffer>>;
   using raster_state_t = util::safe_ptr<ID3D11RasterizerState, Release<ID3D11RasterizerState>>;
   using sampler_state_t = util::safe_ptr<ID3D11SamplerState, Release<ID3D11SamplerState>>;
@@ -61,6 +76,9 @@ namespace platf::dxgi {
   using depth_stencil_state_t = util::safe_ptr<ID3D11DepthStencilState, Release<ID3D11DepthStencilState>>;
   using depth_stencil_view_t = util::safe_ptr<ID3D11DepthStencilView, Release<ID3D11DepthStencilView>>;
   using keyed_mutex_t = util::safe_ptr<IDXGIKeyedMutex, Release<IDXGIKeyedMutex>>;
+  using query_t = util::safe_ptr<ID3D11Query, Release<ID3D11Query>>;
+  using fence_t = util::safe_ptr<ID3D11Fence, Release<ID3D11Fence>>;
+  using handle_t = util::safe_ptr_v2<void, BOOL, CloseHandle>;
 
   namespace video {
     using device_t = util::safe_ptr<ID3D11VideoDevice, Release<ID3D11VideoDevice>>;
@@ -81,6 +99,16 @@ namespace platf::dxgi {
     bool visible;
   };
 
+  /**
+   * @brief A cursor texture and the view the cursor shader samples it through.
+   */
+  struct cursor_texture_t {
+    texture2d_t texture;
+    shader_res_t input_res;
+    LONG width;
+    LONG height;
+  };
+
   class gpu_cursor_t {
   public:
     gpu_cursor_t():
@@ -103,6 +131,24 @@ namespace platf::dxgi {
       update_viewport();
     }
 
+    /**
+     * @brief Draw the cursor with a texture that is shared with a cache.
+     * @param cursor_texture The texture, or an empty one to draw nothing.
+     */
+    void set_texture(const cursor_texture_t &cursor_texture) {
+      input_res.reset();
+      if (!cursor_texture.texture) {
+        set_texture(0, 0, nullptr);
+        return;
+      }
+
+      // The cache keeps its references, the cursor takes its own
+      cursor_texture.texture->AddRef();
+      cursor_texture.input_res->AddRef();
+      input_res.reset(cursor_texture.input_res.get());
+      set_texture(cursor_texture.width, cursor_texture.height, texture2d_t {cursor_texture.texture.get()});
+    }
+
     void update_viewport() {
       switch (display_rotation) {
         case DXGI_MODE_ROTATION_UNSPECIFIED:
@@ -257,10 +303,74 @@ namespace platf::dxgi {
 
     std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e pix_fmt) override;
 
+    /**
+     * @brief What to read back when none of the pending copies has completed yet.
+     */
+    enum class staging_fallback_e {
+      none,  ///< Report a timeout
+      shown,  ///< Read the frame that was shown last again
+      wait,  ///< Wait for the newest pending copy
+    };
+
+    /**
+     * @brief A staging texture the captured frames are copied to for the CPU to read them back.
+     */
+    struct staging_t {
+      texture2d_t texture;
+      std::optional<std::chrono::steady_clock::time_point> frame_timestamp;  ///< Capture time of the frame copied into it
+      std::uint64_t sequence;  ///< Order of the copy into it, 0 once its frame was read back or dropped
+    };
+
+    /**
+     * @brief Create the staging textures for the capture format.
+     * @details Only the first one is created and read back blocking unless `capture_staging_ring` is enabled.
+     * @return 0 on success, -1 on failure.
+     */
+    int init_staging();
+
+    /**
+     * @brief Copy a captured frame into a staging texture without waiting for the copy to complete.
+     * @param src The captured frame.
+     * @param frame_timestamp The capture time of the frame.
+     */
+    void queue_staging(ID3D11Texture2D *src, const std::optional<std::chrono::steady_clock::time_point> &frame_timestamp);
+
+    /**
+     * @brief Check whether a copied frame has not been read back yet.
+     */
+    bool staging_pending() const;
+
+    /**
+     * @brief Read back the newest copied frame whose copy has completed.
+     * @param pull_free_image_cb Pulls the image to read the frame into.
+     * @param img_out The image the frame was read into.
+     * @param fallback What to read when no pending copy has completed.
+     * @return `capture_e::ok` if a frame was read, `capture_e::timeout` if there was none to read.
+     */
+    capture_e read_staging(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, staging_fallback_e fallback);
+
     D3D11_MAPPED_SUBRESOURCE img_info;
-    texture2d_t texture;
+
+    /**
+     * Frames are read back while the copies of the following ones are in flight,
+     * so the CPU doesn't stall on the GPU for every frame.
+     */
+    std::array<staging_t, 3> staging {};
+    std::uint64_t staging_sequence = 0;  ///< Sequence of the last copy
+    bool staging_ring = false;  ///< Read back through all of the textures without waiting on the GPU
+    int staging_shown = -1;  ///< Slot of the last frame read back
   };
 
+  /**
+   * @brief How long to wait for a new frame while a copied one is still pending, so it isn't held back until the display changes again.
+   */
+  constexpr auto staging_poll_timeout = std::chrono::milliseconds {1};
+
+  /**
+   * @brief Longest wait for an encoder on another adapter to copy an image out before its transfer texture is overwritten.
+   */
+  constexpr auto release_timeout = std::chrono::milliseconds {100};
+
   /**
    * Display component for devices that use hardware encoders.
    */
@@ -278,23 +388,176 @@ namespace platf::dxgi {
     std::unique_ptr<nvenc_encode_device_t> make_nvenc_encode_device(pix_fmt_e pix_fmt) override;
 
     std::atomic<uint32_t> next_image_id;
+
+    // Set when the encoders run on another adapter than the capture, see select_encode_adapter()
+    adapter_t encode_adapter;
+    fence_t transfer_fence;  // Signaled by the capture device once an image was copied for the encoders
+    handle_t transfer_fence_handle;  // Opened by the encoder devices to wait for the copies
+
+    /**
+     * @brief Fence an encoder device on the other adapter signals once it copied an image out.
+     */
+    struct release_fence_t {
+      fence_t fence;  ///< Opened on the capture device
+      uint64_t since;  ///< Value of transfer_fence when the encoder device started, earlier images are never released
+    };
+
+    /**
+     * @brief Make the capture wait for an encoder device before it overwrites a transfer texture.
+     * @param handle The shared handle of a fence created by the encoder device.
+     * @return The fence opened on the capture device, waited on for as long as it's held, or `nullptr` on failure.
+     */
+    std::shared_ptr<release_fence_t> add_release_fence(HANDLE handle);
+
+  protected:
+    /**
+     * @brief Encode on a discrete adapter when the display is on an integrated one.
+     * @details Hybrid GPU laptops attach the display to the integrated GPU, whose encoder is slower
+     *          or missing. Images are then copied into row-major textures that the discrete adapter
+     *          can open, ordered with a fence shared across the adapters. Leaves `encode_adapter`
+     *          empty if there is no such adapter or it can't open textures of this one.
+     */
+    void select_encode_adapter();
+
+    /**
+     * @brief Check that another adapter can open the transfer textures and fence of this one.
+     * @param adapter_p The other adapter.
+     * @return `true` if it can.
+     */
+    bool can_share_with(adapter_t::pointer adapter_p);
+
+    /**
+     * @brief Copy a new output image for the encoders on the other adapter.
+     * @param img_base The output image, with its capture texture unlocked.
+     * @return `false` on failure.
+     */
+    bool share_across_adapters(img_t &img_base);
+
+    /**
+     * @brief Wait until the encoders copied the previous content out of a transfer texture.
+     * @param value The transfer value of that content.
+     */
+    void wait_for_release(uint64_t value);
+
+    device_ctx4_t transfer_ctx;  // Capture device context that signals transfer_fence
+    std::atomic<uint64_t> transfer_fence_value = 0;  // Value transfer_fence was last signaled with, read by add_release_fence()
+    std::mutex release_fences_mutex;
+    std::vector<std::weak_ptr<release_fence_t>> release_fences;  // Registered by the encoder devices
+    handle_t release_event;  // Set by the release fences in wait_for_release()
+
+    /**
+     * @brief Bring a pooled image up to date by copying only the regions that changed since it was written.
+     * @param img_base The image, with its capture texture locked.
+     * @param surface The captured frame.
+     * @param dirty_rects Regions that changed since the previous output image.
+     * @param dirty_rects_valid Whether the dirty rects describe all of the changes.
+     * @return `false` if the whole frame has to be copied instead.
+     */
+    bool copy_damaged_regions(img_t &img_base, ID3D11Texture2D *surface, const std::vector<RECT> &dirty_rects, bool dirty_rects_valid);
+
+    /**
+     * @brief Give an output image its frame index and remember the changes it carries.
+     * @param img_base The output image.
+     * @param dirty_rects Regions that changed since the previous output image.
+     * @param dirty_rects_valid Whether the dirty rects describe all of the changes.
+     */
+    void track_damage(img_t &img_base, std::vector<RECT> &&dirty_rects, bool dirty_rects_valid);
+
+    // Sequence number given to the next image with new content, see platf::img_t::frame_index
+    uint64_t next_frame_index = 1;
+
+    // Dirty rects of the most recent output images, contiguous up to next_frame_index - 1.
+    // Lets an older pooled image be brought up to date by copying only what changed since it was written.
+    std::vector<std::pair<uint64_t, std::vector<RECT>>> damage_history;
   };
 
   /**
    * Display duplicator that uses the DirectX Desktop Duplication API.
    */
+  /**
+   * @brief Our end of the capture helper process, which duplicates the output across desktop switches.
+   * @details Mirrors the calls of IDXGIOutputDuplication used by duplication_t, see capture_helper.h.
+   */
+  class capture_helper_t {
+  public:
+    /**
+     * @brief Launch the helper and wait until it duplicated the output of the display.
+     * @param display The display, its adapter and output are duplicated and its device opens the frames.
+     * @param formats The capture formats for IDXGIOutput5::DuplicateOutput1().
+     * @param desc Receives the description of the duplication.
+     * @return 0 on success.
+     */
+    int init(display_base_t *display, const std::vector<DXGI_FORMAT> &formats, DXGI_OUTDUPL_DESC &desc);
+    capture_e next_frame(DXGI_OUTDUPL_FRAME_INFO &frame_info, std::chrono::milliseconds timeout, resource_t::pointer *res_p);
+    bool get_dirty_rects(std::vector<RECT> &rects);
+    HRESULT get_pointer_shape(UINT size, void *buffer, DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info);
+    capture_e release_frame();
+
+    ~capture_helper_t();
+
+  private:
+    int open_textures();
+    void log_failure();
+
+    device1_t device;
+    handle_t mapping;
+    handle_t frame_event;
+    handle_t stop_event;
+    handle_t job;
+    handle_t process;
+    capture_helper::shared_t *shared {};
+
+    std::array<texture2d_t, capture_helper::slot_count> textures;
+    std::array<keyed_mutex_t, capture_helper::slot_count> mutexes;
+    int held_slot = -1;  ///< Slot of the frame returned by `next_frame()`, -1 once released
+
+    /**
+     * @brief Counters of the slot of the last frame returned by `next_frame()`.
+     */
+    struct {
+      std::uint64_t sequence;
+      std::uint64_t present_count;
+      std::uint64_t mouse_count;
+      std::uint64_t pointer_shape_sequence;
+    } consumed {};
+
+    std::vector<RECT> dirty_rects;
+    bool dirty_rects_valid {};
+  };
+
   class duplication_t {
   public:
     dup_t dup;
+    std::unique_ptr<capture_helper_t> helper;  ///< Set when the capture helper duplicates the output instead of `dup`
     bool has_frame {};
     std::chrono::steady_clock::time_point last_protected_content_warning_time {};
 
     int init(display_base_t *display, const ::video::config_t &config);
     capture_e next_frame(DXGI_OUTDUPL_FRAME_INFO &frame_info, std::chrono::milliseconds timeout, resource_t::pointer *res_p);
+
+    /**
+     * @brief Get the regions of the acquired frame that changed since the previous frame.
+     * @param frame_info The frame info returned by `next_frame()`.
+     * @param rects Receives the dirty rects and the destinations of the move rects.
+     * @return `false` if the changed regions are unknown and the whole frame must be treated as dirty.
+     */
+    bool get_dirty_rects(const DXGI_OUTDUPL_FRAME_INFO &frame_info, std::vector<RECT> &rects);
+
+    /**
+     * @brief Get the new pointer shape of the acquired frame, like IDXGIOutputDuplication::GetFramePointerShape().
+     * @param size The size of the buffer, at least `DXGI_OUTDUPL_FRAME_INFO::PointerShapeBufferSize`.
+     * @param buffer Receives the pointer shape.
+     * @param shape_info Receives the description of the pointer shape.
+     * @return The result of the call.
+     */
+    HRESULT get_pointer_shape(UINT size, void *buffer, DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info);
     capture_e reset(dup_t::pointer dup_p = dup_t::pointer());
     capture_e release_frame();
 
     ~duplication_t();
+
+  private:
+    std::vector<std::uint8_t> metadata_buffer;
   };
 
   /**
@@ -313,6 +576,43 @@ namespace platf::dxgi {
   /**
    * Display backend that uses DDAPI with a hardware encoder.
    */
+  /**
+   * @brief Measures the GPU time of the commands between begin() and end() with timestamp queries.
+   * @details The results are read back a few frames later without flushing or stalling the
+   *          device context. A frame is not measured while all query slots are still pending.
+   */
+  class gpu_timer_t {
+  public:
+    /**
+     * @brief Create the queries.
+     * @param device The device the measured commands are submitted to.
+     * @param histogram_name The histogram the GPU time is recorded into.
+     * @return 0 on success, the timer stays disabled otherwise.
+     */
+    int init(device_t::pointer device, std::string_view histogram_name);
+
+    void begin(device_ctx_t::pointer device_ctx);
+    void end(device_ctx_t::pointer device_ctx);
+
+  private:
+    /**
+     * @brief Record the results of the queries the GPU has finished.
+     */
+    void collect(device_ctx_t::pointer device_ctx);
+
+    struct slot_t {
+      query_t disjoint;
+      query_t begin;
+      query_t end;
+      bool pending = false;  ///< Whether the results have not been read yet
+    };
+
+    std::array<slot_t, 4> slots;
+    std::size_t next_slot = 0;
+    bool measuring = false;
+    metrics::histogram_t *histogram = nullptr;  ///< nullptr while disabled
+  };
+
   class display_ddup_vram_t: public display_vram_t {
   public:
     int init(const ::video::config_t &config, const std::string &display_name);
@@ -332,9 +632,34 @@ namespace platf::dxgi {
     gpu_cursor_t cursor_alpha;
     gpu_cursor_t cursor_xor;
 
+    /**
+     * @brief The textures built from a pointer shape.
+     */
+    struct cursor_shape_t {
+      std::size_t hash;
+      util::buffer_t<std::uint8_t> img_data;  ///< The shape, since hashes alone could collide
+      DXGI_OUTDUPL_POINTER_SHAPE_INFO shape_info;
+      cursor_texture_t alpha;
+      cursor_texture_t xor_mask;
+    };
+
+    const cursor_shape_t *cursor_shape(util::buffer_t<std::uint8_t> &&img_data, DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info);
+
+    // Shapes seen recently, most recently used first, so animated and flipping cursors don't rebuild their textures
+    std::list<cursor_shape_t> cursor_shapes;
+    static constexpr std::size_t max_cursor_shapes = 16;
+    gpu_timer_t cursor_timer;
+
     texture2d_t old_surface_delayed_destruction;
     std::chrono::steady_clock::time_point old_surface_timestamp;
     std::variant<std::monostate, texture2d_t, std::shared_ptr<platf::img_t>> last_frame_variant;
+
+    // Cursor regions blended onto the last output image
+    std::vector<RECT> blended_cursor_rects;
+
+    // Set if the changes since the last output image can be described by dirty rects.
+    // Cleared when a desktop frame is consumed without producing an output image.
+    bool last_output_tracked = false;
   };
 
   /**
@@ -349,7 +674,15 @@ namespace platf::dxgi {
     SRWLOCK frame_lock = SRWLOCK_INIT;
     CONDITION_VARIABLE frame_present_cv;
 
+    // Set if WGC reports the regions that changed between frames
+    bool dirty_regions_supported = false;
+
+    // Changes since the last consumed frame, including the frames dropped in between
+    std::vector<RECT> produced_dirty_rects, consumed_dirty_rects;
+    bool produced_dirty_rects_valid = false, consumed_dirty_rects_valid = false;
+
     void on_frame_arrived(winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool const &sender, winrt::Windows::Foundation::IInspectable const &);
+    bool read_dirty_rects(const winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame &frame, std::vector<RECT> &rects);
 
   public:
     wgc_capture_t();
@@ -357,6 +690,13 @@ namespace platf::dxgi {
 
     int init(display_base_t *display, const ::video::config_t &config);
     capture_e next_frame(std::chrono::milliseconds timeout, ID3D11Texture2D **out, uint64_t &out_time);
+
+    /**
+     * @brief Get the regions of the frame from `next_frame()` that changed since the previously returned frame.
+     * @param rects Receives the dirty rects.
+     * @return `false` if the changed regions are unknown and the whole frame must be treated as dirty.
+     */
+    bool get_dirty_rects(std::vector<RECT> &rects);
     capture_e release_frame();
     int set_cursor_visible(bool);
   };
@@ -379,6 +719,9 @@ namespace platf::dxgi {
   class display_wgc_vram_t: public display_vram_t {
     wgc_capture_t dup;
 
+    // Set if the changes since the last output image can be described by dirty rects
+    bool last_output_tracked = false;
+
   public:
     int init(const ::video::config_t &config, const std::string &display_name);
     capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) override;
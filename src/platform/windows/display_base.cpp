@@ -3,11 +3,14 @@
  * @brief Definitions for the Windows display base code.
  */
 // standard includes
+#include <atomic>
 #include <cmath>
+#include <sstream>
 #include <thread>
 
 // platform includes
 #include <initguid.h>
+#include <psapi.h>
 
 // lib includes
 #include <boost/algorithm/string/join.hpp>
@@ -50,8 +53,23 @@ namespace platf::dxgi {
     // Capture format will be determined from the first call to AcquireNextFrame()
     display->capture_format = DXGI_FORMAT_UNKNOWN;
 
+    DXGI_OUTDUPL_DESC dup_desc;
+    if (config::video.capture_helper) {
+      auto supported_formats = display->get_supported_capture_formats();
+      if (supported_formats.empty()) {
+        BOOST_LOG(warning) << "No compatible capture formats for this encoder"sv;
+        return -1;
+      }
+
+      helper = std::make_unique<capture_helper_t>();
+      if (helper->init(display, supported_formats, dup_desc)) {
+        BOOST_LOG(warning) << "Falling back to Desktop Duplication in process"sv;
+        helper.reset();
+      }
+    }
+
     // FIXME: Duplicate output on RX580 in combination with DOOM (2016) --> BSOD
-    {
+    if (!helper) {
       // IDXGIOutput5 is optional, but can provide improved performance and wide color support
       dxgi::output5_t output5 {};
       status = display->output->QueryInterface(IID_IDXGIOutput5, (void **) &output5);
@@ -108,10 +126,9 @@ namespace platf::dxgi {
           return -1;
         }
       }
-    }
 
-    DXGI_OUTDUPL_DESC dup_desc;
-    dup->GetDesc(&dup_desc);
+      dup->GetDesc(&dup_desc);
+    }
 
     BOOST_LOG(info) << "Desktop resolution ["sv << dup_desc.ModeDesc.Width << 'x' << dup_desc.ModeDesc.Height << ']';
     BOOST_LOG(info) << "Desktop format ["sv << display->dxgi_format_to_string(dup_desc.ModeDesc.Format) << ']';
@@ -125,6 +142,12 @@ namespace platf::dxgi {
   }
 
   capture_e duplication_t::next_frame(DXGI_OUTDUPL_FRAME_INFO &frame_info, std::chrono::milliseconds timeout, resource_t::pointer *res_p) {
+    if (helper) {
+      auto capture_status = helper->next_frame(frame_info, timeout, res_p);
+      has_frame = capture_status == capture_e::ok;
+      return capture_status;
+    }
+
     auto capture_status = release_frame();
     if (capture_status != capture_e::ok) {
       return capture_status;
@@ -156,6 +179,56 @@ namespace platf::dxgi {
     }
   }
 
+  bool duplication_t::get_dirty_rects(const DXGI_OUTDUPL_FRAME_INFO &frame_info, std::vector<RECT> &rects) {
+    rects.clear();
+
+    if (helper) {
+      return has_frame && helper->get_dirty_rects(rects);
+    }
+
+    // No metadata means the whole desktop must be treated as updated
+    if (!has_frame || frame_info.TotalMetadataBufferSize == 0) {
+      return false;
+    }
+
+    // Move rects and dirty rects share the metadata buffer, move rects first
+    metadata_buffer.resize(frame_info.TotalMetadataBufferSize);
+
+    UINT move_rects_size = 0;
+    auto status = dup->GetFrameMoveRects(metadata_buffer.size(), (DXGI_OUTDUPL_MOVE_RECT *) metadata_buffer.data(), &move_rects_size);
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Failed to get frame move rects [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    UINT dirty_rects_size = 0;
+    status = dup->GetFrameDirtyRects(metadata_buffer.size() - move_rects_size, (RECT *) (metadata_buffer.data() + move_rects_size), &dirty_rects_size);
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Failed to get frame dirty rects [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    // The source of a move rect is unchanged, only its destination needs to be updated
+    auto move_rects = (const DXGI_OUTDUPL_MOVE_RECT *) metadata_buffer.data();
+    for (UINT x = 0; x < move_rects_size / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++x) {
+      rects.push_back(move_rects[x].DestinationRect);
+    }
+
+    auto dirty_rects = (const RECT *) (metadata_buffer.data() + move_rects_size);
+    rects.insert(std::end(rects), dirty_rects, dirty_rects + dirty_rects_size / sizeof(RECT));
+
+    return true;
+  }
+
+  HRESULT duplication_t::get_pointer_shape(UINT size, void *buffer, DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info) {
+    if (helper) {
+      return helper->get_pointer_shape(size, buffer, shape_info);
+    }
+
+    UINT required_size;
+    return dup->GetFramePointerShape(size, buffer, &required_size, &shape_info);
+  }
+
   capture_e duplication_t::reset(dup_t::pointer dup_p) {
     auto capture_status = release_frame();
 
@@ -165,6 +238,11 @@ namespace platf::dxgi {
   }
 
   capture_e duplication_t::release_frame() {
+    if (helper) {
+      has_frame = false;
+      return helper->release_frame();
+    }
+
     if (!has_frame) {
       return capture_e::ok;
     }
@@ -217,6 +295,11 @@ namespace platf::dxgi {
     std::optional<std::chrono::steady_clock::time_point> frame_pacing_group_start;
     uint32_t frame_pacing_group_frames = 0;
 
+    // With a variable framerate, each frame is captured when it's presented, at most at the client framerate
+    const bool variable_framerate = config::video.capture_variable_framerate;
+    const auto min_frame_interval = std::chrono::nanoseconds(1s) / client_frame_rate;
+    auto next_frame = std::chrono::steady_clock::now();
+
     // Keep the display awake during capture. If the display goes to sleep during
     // capture, best case is that capture stops until it powers back on. However,
     // worst case it will trigger us to reinit DD, waking the display back up in
@@ -239,8 +322,22 @@ namespace platf::dxgi {
       platf::capture_e status = capture_e::ok;
       std::shared_ptr<img_t> img_out;
 
-      // Try to continue frame pacing group, snapshot() is called with zero timeout after waiting for client frame interval
-      if (frame_pacing_group_start) {
+      if (variable_framerate) {
+        const auto sleep_period = next_frame - std::chrono::steady_clock::now();
+        if (sleep_period > 0ns) {
+          timer->sleep_for(sleep_period);
+        }
+
+        // AcquireNextFrame() returns as soon as the next frame is presented, or the latest one if it already was
+        status = snapshot(pull_free_image_cb, img_out, 200ms, *cursor);
+        if (status == capture_e::ok && img_out) {
+          next_frame = img_out->frame_timestamp.value_or(std::chrono::steady_clock::now()) + min_frame_interval;
+        } else if (status == capture_e::timeout) {
+          // Don't starve the encoding thread of the device lock, see below
+          std::this_thread::sleep_for(10ms);
+        }
+      } else if (frame_pacing_group_start) {
+        // Try to continue frame pacing group, snapshot() is called with zero timeout after waiting for client frame interval
         const uint32_t seconds = (uint64_t) frame_pacing_group_frames * client_frame_rate_adjusted.Denominator / client_frame_rate_adjusted.Numerator;
         const uint32_t remainder = (uint64_t) frame_pacing_group_frames * client_frame_rate_adjusted.Denominator % client_frame_rate_adjusted.Numerator;
         const auto sleep_target = *frame_pacing_group_start +
@@ -274,7 +371,7 @@ namespace platf::dxgi {
       }
 
       // Start new frame pacing group if necessary, snapshot() is called with non-zero timeout
-      if (status == capture_e::timeout || (status == capture_e::ok && !frame_pacing_group_start)) {
+      if (!variable_framerate && (status == capture_e::timeout || (status == capture_e::ok && !frame_pacing_group_start))) {
         status = snapshot(pull_free_image_cb, img_out, 200ms, *cursor);
 
         if (status == capture_e::ok && img_out) {
@@ -409,6 +506,11 @@ namespace platf::dxgi {
     return false;
   }
 
+  /**
+   * @brief GPU scheduling priority class the process got at capture start, -1 if it couldn't be set.
+   */
+  std::atomic<int> base_gpu_priority {-1};
+
   /**
    * @brief Hook for NtGdiDdDDIGetCachedHybridQueryValue() from win32u.dll.
    * @param gpuPreference A pointer to the location where the preference will be written.
@@ -672,6 +774,8 @@ namespace platf::dxgi {
           BOOST_LOG(info) << "Using " << (priority == D3DKMT_SCHEDULINGPRIORITYCLASS_HIGH ? "high" : "realtime") << " GPU priority";
           if (FAILED(d3dkmt_set_process_priority(GetCurrentProcess(), priority))) {
             BOOST_LOG(warning) << "Failed to adjust GPU priority. Please run application as administrator for optimal performance.";
+          } else {
+            base_gpu_priority = priority;
           }
         } else {
           BOOST_LOG(error) << "Couldn't load D3DKMTSetProcessSchedulingPriorityClass function from gdi32.dll to adjust GPU priority";
@@ -989,6 +1093,28 @@ namespace platf::dxgi {
 }  // namespace platf::dxgi
 
 namespace platf {
+  bool boost_gpu_priority(bool boost) {
+    // Realtime is already as high as it gets
+    auto base = dxgi::base_gpu_priority.load();
+    if (base < 0 || base == D3DKMT_SCHEDULINGPRIORITYCLASS_REALTIME) {
+      return false;
+    }
+
+    HMODULE gdi32 = GetModuleHandleA("GDI32");
+    auto d3dkmt_set_process_priority = gdi32 ? (PD3DKMTSetProcessSchedulingPriorityClass) GetProcAddress(gdi32, "D3DKMTSetProcessSchedulingPriorityClass") : nullptr;
+    if (!d3dkmt_set_process_priority) {
+      return false;
+    }
+
+    auto priority = boost ? D3DKMT_SCHEDULINGPRIORITYCLASS_REALTIME : (D3DKMT_SCHEDULINGPRIORITYCLASS) base;
+    if (FAILED(d3dkmt_set_process_priority(GetCurrentProcess(), priority))) {
+      BOOST_LOG(warning) << "Failed to adjust GPU priority"sv;
+      return false;
+    }
+
+    return true;
+  }
+
   /**
    * Pick a display adapter and capture method.
    * @param hwdevice_type enables possible use of hardware encoder
@@ -1125,4 +1251,96 @@ namespace platf {
       return false;
     }
   }
+
+  std::string gpu_identity() {
+    dxgi::factory1_t factory;
+    auto status = CreateDXGIFactory1(IID_IDXGIFactory1, (void **) &factory);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to create DXGIFactory1 [0x"sv << util::hex(status).to_string_view() << ']';
+      return {};
+    }
+
+    std::stringstream identity;
+
+    dxgi::adapter_t adapter;
+    for (int x = 0; factory->EnumAdapters1(x, &adapter) != DXGI_ERROR_NOT_FOUND; ++x) {
+      DXGI_ADAPTER_DESC1 adapter_desc;
+      adapter->GetDesc1(&adapter_desc);
+
+      // The user mode driver version
+      LARGE_INTEGER driver_version {};
+      adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &driver_version);
+
+      identity
+        << to_utf8(adapter_desc.Description) << ' '
+        << util::hex(adapter_desc.VendorId).to_string_view() << ':'
+        << util::hex(adapter_desc.DeviceId).to_string_view() << ':'
+        << util::hex(adapter_desc.SubSysId).to_string_view() << ':'
+        << util::hex(adapter_desc.Revision).to_string_view() << ' '
+        << adapter_desc.AdapterLuid.HighPart << '-' << adapter_desc.AdapterLuid.LowPart << ' '
+        << driver_version.QuadPart << '\n';
+
+      dxgi::output_t::pointer output_p {};
+      for (int y = 0; adapter->EnumOutputs(y, &output_p) != DXGI_ERROR_NOT_FOUND; ++y) {
+        dxgi::output_t output {output_p};
+
+        DXGI_OUTPUT_DESC desc;
+        output->GetDesc(&desc);
+        if (desc.AttachedToDesktop) {
+          identity << "  "sv << to_utf8(desc.DeviceName) << '\n';
+        }
+      }
+    }
+
+    return identity.str();
+  }
+
+  memory_usage_t memory_usage() {
+    memory_usage_t usage;
+
+    PROCESS_MEMORY_COUNTERS counters {};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+      usage.resident = counters.WorkingSetSize;
+    }
+
+    dxgi::factory1_t factory;
+    if (FAILED(CreateDXGIFactory1(IID_IDXGIFactory1, (void **) &factory))) {
+      return usage;
+    }
+
+    // The video memory is only reported for this process, on the adapters that support it
+    std::uint64_t video = 0;
+    bool known = false;
+    dxgi::adapter_t adapter;
+    for (int x = 0; factory->EnumAdapters1(x, &adapter) != DXGI_ERROR_NOT_FOUND; ++x) {
+      util::safe_ptr<IDXGIAdapter3, dxgi::Release<IDXGIAdapter3>> adapter3;
+      if (FAILED(adapter->QueryInterface(IID_IDXGIAdapter3, (void **) &adapter3))) {
+        continue;
+      }
+
+      DXGI_QUERY_VIDEO_MEMORY_INFO info;
+      if (SUCCEEDED(adapter3->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &info))) {
+        video += info.CurrentUsage;
+        known = true;
+      }
+    }
+
+    if (known) {
+      usage.video = video;
+    }
+    return usage;
+  }
+
+  namespace {
+    std::atomic<std::uint64_t> topology_generation {0};
+  }  // namespace
+
+  void display_topology_changed() {
+    ++topology_generation;
+  }
+
+  std::uint64_t display_topology_generation() {
+    // Counted by the session monitor window, top-level windows get WM_DISPLAYCHANGE
+    return topology_generation.load(std::memory_order_relaxed);
+  }
 }  // namespace platf
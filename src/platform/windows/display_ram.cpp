@@ -2,9 +2,13 @@
  * @file src/platform/windows/display_ram.cpp
  * @brief Definitions for handling ram.
  */
+// standard includes
+#include <algorithm>
+
 // local includes
 #include "display.h"
 #include "misc.h"
+#include "src/config.h"
 #include "src/logging.h"
 
 namespace platf {
@@ -172,10 +176,29 @@ namespace platf::dxgi {
     HRESULT status;
     DXGI_OUTDUPL_FRAME_INFO frame_info;
 
+    auto read_frame = [&](staging_fallback_e fallback) {
+      auto read_status = read_staging(pull_free_image_cb, img_out, fallback);
+      if (read_status == capture_e::ok && cursor_visible && cursor.visible) {
+        blend_cursor(cursor, *(img_t *) img_out.get());
+      }
+
+      return read_status;
+    };
+
+    // Don't hold a copied frame back until the display changes again
+    if (staging_pending()) {
+      timeout = std::min(timeout, staging_poll_timeout);
+    }
+
     resource_t::pointer res_p {};
     auto capture_status = dup.next_frame(frame_info, timeout, &res_p);
     resource_t res {res_p};
 
+    // The display is idle, so waiting for the pending copy costs nothing
+    if (capture_status == capture_e::timeout) {
+      return read_frame(staging_fallback_e::wait);
+    }
+
     if (capture_status != capture_e::ok) {
       return capture_status;
     }
@@ -185,7 +208,7 @@ namespace platf::dxgi {
     const bool update_flag = mouse_update_flag || frame_update_flag;
 
     if (!update_flag) {
-      return capture_e::timeout;
+      return read_frame(staging_fallback_e::wait);
     }
 
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
@@ -199,8 +222,7 @@ namespace platf::dxgi {
 
       img_data.resize(frame_info.PointerShapeBufferSize);
 
-      UINT dummy;
-      status = dup.dup->GetFramePointerShape(img_data.size(), img_data.data(), &dummy, &cursor.shape_info);
+      status = dup.get_pointer_shape(img_data.size(), img_data.data(), cursor.shape_info);
       if (FAILED(status)) {
         BOOST_LOG(error) << "Failed to get new pointer shape [0x"sv << util::hex(status).to_string_view() << ']';
 
@@ -227,25 +249,12 @@ namespace platf::dxgi {
         D3D11_TEXTURE2D_DESC desc;
         src->GetDesc(&desc);
 
-        // If we don't know the capture format yet, grab it from this texture and create the staging texture
+        // If we don't know the capture format yet, grab it from this texture and create the staging textures
         if (capture_format == DXGI_FORMAT_UNKNOWN) {
           capture_format = desc.Format;
           BOOST_LOG(info) << "Capture format ["sv << dxgi_format_to_string(capture_format) << ']';
 
-          D3D11_TEXTURE2D_DESC t {};
-          t.Width = width;
-          t.Height = height;
-          t.MipLevels = 1;
-          t.ArraySize = 1;
-          t.SampleDesc.Count = 1;
-          t.Usage = D3D11_USAGE_STAGING;
-          t.Format = capture_format;
-          t.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-
-          auto status = device->CreateTexture2D(&t, nullptr, &texture);
-
-          if (FAILED(status)) {
-            BOOST_LOG(error) << "Failed to create staging texture [0x"sv << util::hex(status).to_string_view() << ']';
+          if (init_staging()) {
             return capture_e::error;
           }
         }
@@ -264,55 +273,39 @@ namespace platf::dxgi {
           return capture_e::reinit;
         }
 
-        // Copy from GPU to CPU
-        device_ctx->CopyResource(texture.get(), src.get());
+        // Copy from GPU to CPU, the frame is read back once the copy has completed
+        queue_staging(src.get(), frame_timestamp);
       }
     }
 
-    if (!pull_free_image_cb(img_out)) {
-      return capture_e::interrupted;
-    }
-    auto img = (img_t *) img_out.get();
-
     // If we don't know the final capture format yet, encode a dummy image
     if (capture_format == DXGI_FORMAT_UNKNOWN) {
       BOOST_LOG(debug) << "Capture format is still unknown. Encoding a blank image"sv;
 
-      if (dummy_img(img)) {
-        return capture_e::error;
+      if (!pull_free_image_cb(img_out)) {
+        return capture_e::interrupted;
       }
-    } else {
-      // Map the staging texture for CPU access (making it inaccessible for the GPU)
-      status = device_ctx->Map(texture.get(), 0, D3D11_MAP_READ, 0, &img_info);
-      if (FAILED(status)) {
-        BOOST_LOG(error) << "Failed to map texture [0x"sv << util::hex(status).to_string_view() << ']';
+      auto img = (img_t *) img_out.get();
 
+      if (dummy_img(img)) {
         return capture_e::error;
       }
 
-      // Now that we know the capture format, we can finish creating the image
-      if (complete_img(img, false)) {
-        device_ctx->Unmap(texture.get(), 0);
-        img_info.pData = nullptr;
-        return capture_e::error;
+      if (cursor_visible && cursor.visible) {
+        blend_cursor(cursor, *img);
       }
 
-      std::copy_n((std::uint8_t *) img_info.pData, height * img_info.RowPitch, (std::uint8_t *) img->data);
-
-      // Unmap the staging texture to allow GPU access again
-      device_ctx->Unmap(texture.get(), 0);
-      img_info.pData = nullptr;
-    }
-
-    if (cursor_visible && cursor.visible) {
-      blend_cursor(cursor, *img);
+      img->frame_timestamp = frame_timestamp;
+      return capture_e::ok;
     }
 
-    if (img) {
-      img->frame_timestamp = frame_timestamp;
+    // A cursor update has to be shown now, on top of the last frame if the new one isn't copied yet
+    capture_status = read_frame(mouse_update_flag ? staging_fallback_e::shown : staging_fallback_e::none);
+    if (capture_status == capture_e::ok && !frame_update_flag) {
+      img_out->frame_timestamp = frame_timestamp;
     }
 
-    return capture_e::ok;
+    return capture_status;
   }
 
   capture_e display_ddup_ram_t::release_snapshot() {
@@ -329,6 +322,153 @@ namespace platf::dxgi {
     return img;
   }
 
+  int display_ram_t::init_staging() {
+    D3D11_TEXTURE2D_DESC t {};
+    t.Width = width;
+    t.Height = height;
+    t.MipLevels = 1;
+    t.ArraySize = 1;
+    t.SampleDesc.Count = 1;
+    t.Usage = D3D11_USAGE_STAGING;
+    t.Format = capture_format;
+    t.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+    // Without the ring, every frame is copied to the first texture and read back once the copy completes
+    staging_ring = config::video.capture_staging_ring;
+    for (std::size_t x = 0; x < (staging_ring ? staging.size() : 1); ++x) {
+      auto &slot = staging[x];
+      auto status = device->CreateTexture2D(&t, nullptr, &slot.texture);
+
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Failed to create staging texture [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+
+      slot.sequence = 0;
+    }
+
+    staging_shown = -1;
+
+    return 0;
+  }
+
+  void display_ram_t::queue_staging(ID3D11Texture2D *src, const std::optional<std::chrono::steady_clock::time_point> &frame_timestamp) {
+    // Keep the frame shown last for cursor updates, and prefer dropping the oldest pending frame
+    // over waiting for it when all the other textures are in flight
+    int slot = 0;
+    if (staging_ring) {
+      slot = -1;
+      for (int x = 0; x < (int) staging.size(); ++x) {
+        if (x == staging_shown) {
+          continue;
+        }
+
+        if (slot < 0 || staging[x].sequence < staging[slot].sequence) {
+          slot = x;
+        }
+      }
+    }
+
+    auto &target = staging[slot];
+    device_ctx->CopyResource(target.texture.get(), src);
+    target.frame_timestamp = frame_timestamp;
+    target.sequence = ++staging_sequence;
+
+    // Start the copy right away rather than when the next Map() flushes the context
+    if (staging_ring) {
+      device_ctx->Flush();
+    }
+  }
+
+  bool display_ram_t::staging_pending() const {
+    return std::any_of(std::begin(staging), std::end(staging), [](const staging_t &slot) {
+      return slot.sequence != 0;
+    });
+  }
+
+  capture_e display_ram_t::read_staging(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, staging_fallback_e fallback) {
+    // Pending copies from newest to oldest
+    std::array<int, std::tuple_size_v<decltype(staging)>> pending;
+    std::size_t pending_count = 0;
+    for (int x = 0; x < (int) staging.size(); ++x) {
+      if (staging[x].sequence) {
+        pending[pending_count++] = x;
+      }
+    }
+    std::sort(std::begin(pending), std::begin(pending) + pending_count, [this](int l, int r) {
+      return staging[l].sequence > staging[r].sequence;
+    });
+
+    // The GPU completes the copies in order, so the first one that maps is the newest complete frame.
+    // Without the ring, the only copy is waited for like before.
+    const UINT map_flags = staging_ring ? D3D11_MAP_FLAG_DO_NOT_WAIT : 0;
+    int slot = -1;
+    for (std::size_t x = 0; x < pending_count; ++x) {
+      auto status = device_ctx->Map(staging[pending[x]].texture.get(), 0, D3D11_MAP_READ, map_flags, &img_info);
+      if (status == DXGI_ERROR_WAS_STILL_DRAWING) {
+        continue;
+      }
+
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Failed to map texture [0x"sv << util::hex(status).to_string_view() << ']';
+        return capture_e::error;
+      }
+
+      slot = pending[x];
+      break;
+    }
+
+    if (slot < 0) {
+      // Until a frame has been read back, there is nothing to show instead of the first one
+      if (pending_count && (fallback == staging_fallback_e::wait || staging_shown < 0)) {
+        slot = pending[0];
+      } else if (fallback == staging_fallback_e::shown && staging_shown >= 0) {
+        slot = staging_shown;
+      } else {
+        return capture_e::timeout;
+      }
+
+      // Map the staging texture for CPU access (making it inaccessible for the GPU)
+      auto status = device_ctx->Map(staging[slot].texture.get(), 0, D3D11_MAP_READ, 0, &img_info);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Failed to map texture [0x"sv << util::hex(status).to_string_view() << ']';
+        return capture_e::error;
+      }
+    }
+
+    auto &source = staging[slot];
+    auto unmap = util::fail_guard([&]() {
+      // Unmap the staging texture to allow GPU access again
+      device_ctx->Unmap(source.texture.get(), 0);
+      img_info.pData = nullptr;
+    });
+
+    if (!pull_free_image_cb(img_out)) {
+      return capture_e::interrupted;
+    }
+    auto img = (img_t *) img_out.get();
+
+    // Now that we know the capture format, we can finish creating the image
+    if (complete_img(img, false)) {
+      return capture_e::error;
+    }
+
+    std::copy_n((std::uint8_t *) img_info.pData, height * img_info.RowPitch, (std::uint8_t *) img->data);
+    img->frame_timestamp = source.frame_timestamp;
+
+    // Frames copied before this one are superseded by it
+    if (source.sequence) {
+      for (auto &older : staging) {
+        if (older.sequence <= source.sequence) {
+          older.sequence = 0;
+        }
+      }
+    }
+    staging_shown = slot;
+
+    return capture_e::ok;
+  }
+
   int display_ram_t::complete_img(platf::img_t *img, bool dummy) {
     // If this is not a dummy image, we must know the format by now
     if (!dummy && capture_format == DXGI_FORMAT_UNKNOWN) {
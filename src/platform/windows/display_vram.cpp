@@ -3,7 +3,11 @@
  * @brief Definitions for handling video ram.
  */
 // standard includes
+#include <algorithm>
 #include <cmath>
+#include <filesystem>
+#include <functional>
+#include <string_view>
 
 // platform includes
 #include <d3dcompiler.h>
@@ -22,6 +26,8 @@ extern "C" {
 #include "display.h"
 #include "misc.h"
 #include "src/config.h"
+#include "src/crypto.h"
+#include "src/file_handler.h"
 #include "src/logging.h"
 #include "src/nvenc/nvenc_config.h"
 #include "src/nvenc/nvenc_d3d11_native.h"
@@ -102,6 +108,76 @@ namespace platf::dxgi {
     return blend;
   }
 
+  int gpu_timer_t::init(device_t::pointer device, std::string_view histogram_name) {
+    D3D11_QUERY_DESC disjoint_desc {D3D11_QUERY_TIMESTAMP_DISJOINT, 0};
+    D3D11_QUERY_DESC timestamp_desc {D3D11_QUERY_TIMESTAMP, 0};
+
+    for (auto &slot : slots) {
+      if (FAILED(device->CreateQuery(&disjoint_desc, &slot.disjoint)) ||
+          FAILED(device->CreateQuery(&timestamp_desc, &slot.begin)) ||
+          FAILED(device->CreateQuery(&timestamp_desc, &slot.end))) {
+        BOOST_LOG(warning) << "Failed to create timestamp queries, GPU time won't be recorded into "sv << histogram_name;
+        return -1;
+      }
+    }
+
+    histogram = &metrics::histogram(histogram_name);
+    return 0;
+  }
+
+  void gpu_timer_t::begin(device_ctx_t::pointer device_ctx) {
+    if (!histogram) {
+      return;
+    }
+
+    collect(device_ctx);
+
+    auto &slot = slots[next_slot];
+    if (slot.pending) {
+      return;
+    }
+
+    device_ctx->Begin(slot.disjoint.get());
+    device_ctx->End(slot.begin.get());
+    measuring = true;
+  }
+
+  void gpu_timer_t::end(device_ctx_t::pointer device_ctx) {
+    if (!measuring) {
+      return;
+    }
+
+    auto &slot = slots[next_slot];
+    device_ctx->End(slot.end.get());
+    device_ctx->End(slot.disjoint.get());
+
+    slot.pending = true;
+    next_slot = (next_slot + 1) % slots.size();
+    measuring = false;
+  }
+
+  void gpu_timer_t::collect(device_ctx_t::pointer device_ctx) {
+    for (auto &slot : slots) {
+      if (!slot.pending) {
+        continue;
+      }
+
+      D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+      UINT64 begin, end;
+      if (device_ctx->GetData(slot.disjoint.get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+          device_ctx->GetData(slot.begin.get(), &begin, sizeof(begin), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+          device_ctx->GetData(slot.end.get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+        continue;
+      }
+      slot.pending = false;
+
+      // The timestamps are meaningless if the GPU clock changed in between, e.g. when it was throttled
+      if (!disjoint.Disjoint && disjoint.Frequency && end >= begin) {
+        histogram->record_us((end - begin) * 1000000 / disjoint.Frequency);
+      }
+    }
+  }
+
   blob_t convert_yuv420_packed_uv_type0_ps_hlsl;
   blob_t convert_yuv420_packed_uv_type0_ps_linear_hlsl;
   blob_t convert_yuv420_packed_uv_type0_ps_perceptual_quantizer_hlsl;
@@ -114,6 +190,12 @@ namespace platf::dxgi {
   blob_t convert_yuv420_planar_y_ps_linear_hlsl;
   blob_t convert_yuv420_planar_y_ps_perceptual_quantizer_hlsl;
   blob_t convert_yuv420_planar_y_vs_hlsl;
+  blob_t convert_yuv420_type0_cs_hlsl;
+  blob_t convert_yuv420_type0_cs_linear_hlsl;
+  blob_t convert_yuv420_type0_cs_perceptual_quantizer_hlsl;
+  blob_t convert_yuv420_type0s_cs_hlsl;
+  blob_t convert_yuv420_type0s_cs_linear_hlsl;
+  blob_t convert_yuv420_type0s_cs_perceptual_quantizer_hlsl;
   blob_t convert_yuv444_packed_ayuv_ps_hlsl;
   blob_t convert_yuv444_packed_ayuv_ps_linear_hlsl;
   blob_t convert_yuv444_packed_vs_hlsl;
@@ -137,6 +219,14 @@ namespace platf::dxgi {
     // This is the shared handle used by hwdevice_t to open capture_texture
     HANDLE encoder_texture_handle = {};
 
+    // Set if the encoders run on another adapter: a row-major copy of capture_texture that
+    // adapter can open, and the value of display_vram_t::transfer_fence once it was last copied.
+    // The copy the encoders make of this texture is queued on their own adapter, so the capture
+    // waits for their release fences to reach this value before it overwrites the texture.
+    texture2d_t transfer_texture;
+    HANDLE transfer_texture_handle = {};
+    uint64_t transfer_value = 0;
+
     // Set to true if the image corresponds to a dummy texture used prior to
     // the first successful capture of a desktop frame
     bool dummy = false;
@@ -147,6 +237,11 @@ namespace platf::dxgi {
     // Unique identifier for this image
     uint32_t id = 0;
 
+    // Regions that changed since the content with frame_index - 1, in capture texture coordinates.
+    // Only meaningful if dirty_rects_valid is set, otherwise the whole image must be treated as changed.
+    std::vector<RECT> dirty_rects;
+    bool dirty_rects_valid = false;
+
     // DXGI format of this image texture
     DXGI_FORMAT format;
 
@@ -154,6 +249,9 @@ namespace platf::dxgi {
       if (encoder_texture_handle) {
         CloseHandle(encoder_texture_handle);
       }
+      if (transfer_texture_handle) {
+        CloseHandle(transfer_texture_handle);
+      }
     };
   };
 
@@ -349,6 +447,38 @@ namespace platf::dxgi {
     return cursor_img;
   }
 
+  /**
+   * @brief Get the name a compiled shader is cached under.
+   * @details Hashes the shader, the shared includes and the compiler arguments, so a changed
+   *          shader or compiler setting never picks up a stale blob.
+   * @return The name, or an empty string if the shader can't be read.
+   */
+  std::string shader_cache_name(LPCSTR file, LPCSTR entrypoint, LPCSTR shader_model, DWORD flags) {
+    static const std::string includes = []() {
+      std::vector<std::filesystem::path> paths;
+      std::error_code ec;
+      for (auto &entry : std::filesystem::directory_iterator {SUNSHINE_SHADERS_DIR "/include", ec}) {
+        paths.push_back(entry.path());
+      }
+      std::sort(std::begin(paths), std::end(paths));
+
+      std::string contents;
+      for (auto &path : paths) {
+        contents += path.filename().string();
+        contents += file_handler::read_file(path.string().c_str());
+      }
+      return contents;
+    }();
+
+    auto source = file_handler::read_file(file);
+    if (source.empty()) {
+      return {};
+    }
+
+    auto key = includes + source + entrypoint + shader_model + std::to_string(flags);
+    return util::hex_vec(crypto::hash(key)) + ".cso";
+  }
+
   blob_t compile_shader(LPCSTR file, LPCSTR entrypoint, LPCSTR shader_model) {
     blob_t::pointer msg_p = nullptr;
     blob_t::pointer compiled_p;
@@ -359,6 +489,16 @@ namespace platf::dxgi {
     flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
 #endif
 
+    // Compiling all permutations takes a while, reuse the blobs of a previous start
+    std::filesystem::path cache_path;
+    if (auto cache_name = shader_cache_name(file, entrypoint, shader_model, flags); !cache_name.empty()) {
+      cache_path = platf::appdata() / "shader_cache" / cache_name;
+
+      if (SUCCEEDED(D3DReadFileToBlob(cache_path.c_str(), &compiled_p))) {
+        return blob_t {compiled_p};
+      }
+    }
+
     auto wFile = from_utf8(file);
     auto status = D3DCompileFromFile(wFile.c_str(), nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, entrypoint, shader_model, flags, 0, &compiled_p, &msg_p);
 
@@ -372,6 +512,16 @@ namespace platf::dxgi {
       return nullptr;
     }
 
+    if (!cache_path.empty()) {
+      std::error_code ec;
+      std::filesystem::create_directories(cache_path.parent_path(), ec);
+
+      // Another instance may be writing the same blob, a failure only costs the next start a compile
+      if (FAILED(D3DWriteBlobToFile(compiled_p, cache_path.c_str(), FALSE))) {
+        BOOST_LOG(debug) << "Couldn't cache compiled shader ["sv << file << ']';
+      }
+    }
+
     return blob_t {compiled_p};
   }
 
@@ -383,6 +533,87 @@ namespace platf::dxgi {
     return compile_shader(file, "main_vs", "vs_5_0");
   }
 
+  blob_t compile_compute_shader(LPCSTR file) {
+    return compile_shader(file, "main_cs", "cs_5_0");
+  }
+
+  /**
+   * @brief Check if a device can convert into textures of a format with a compute shader.
+   * @param device The device.
+   * @param format The format of the textures.
+   * @return `true` if the textures can be created with `D3D11_BIND_UNORDERED_ACCESS` for the conversion.
+   */
+  bool supports_compute_conversion(device_t::pointer device, DXGI_FORMAT format) {
+    if (format != DXGI_FORMAT_NV12 && format != DXGI_FORMAT_P010) {
+      return false;
+    }
+
+    if (!convert_yuv420_type0_cs_hlsl || device->GetFeatureLevel() < D3D_FEATURE_LEVEL_11_0) {
+      return false;
+    }
+
+    UINT format_support = 0;
+    if (FAILED(device->CheckFormatSupport(format, &format_support))) {
+      return false;
+    }
+
+    return format_support & D3D11_FORMAT_SUPPORT_TYPED_UNORDERED_ACCESS_VIEW;
+  }
+
+  /**
+   * @brief Create a texture that a device on another adapter can open.
+   * @param device The device that writes the texture.
+   * @param width The width of the texture.
+   * @param height The height of the texture.
+   * @param format The format of the texture.
+   * @param texture The created texture.
+   * @param handle The shared handle of the texture, closed by the caller.
+   * @return `false` on failure.
+   */
+  bool create_transfer_texture(device_t::pointer device, int width, int height, DXGI_FORMAT format, texture2d_t &texture, HANDLE &handle) {
+    // Only row-major textures without a keyed mutex can be shared with another adapter
+    device3_t device3;
+    auto status = device->QueryInterface(__uuidof(ID3D11Device3), (void **) &device3);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to query ID3D11Device3 [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    D3D11_TEXTURE2D_DESC1 t {};
+    t.Width = width;
+    t.Height = height;
+    t.MipLevels = 1;
+    t.ArraySize = 1;
+    t.SampleDesc.Count = 1;
+    t.Usage = D3D11_USAGE_DEFAULT;
+    t.Format = format;
+    t.MiscFlags = D3D11_RESOURCE_MISC_SHARED | D3D11_RESOURCE_MISC_SHARED_NTHANDLE;
+    t.TextureLayout = D3D11_TEXTURE_LAYOUT_ROW_MAJOR;
+
+    texture2d1_t texture1;
+    status = device3->CreateTexture2D1(&t, nullptr, &texture1);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to create texture shared across adapters [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+    texture.reset(texture1.release());
+
+    resource1_t resource;
+    status = texture->QueryInterface(__uuidof(IDXGIResource1), (void **) &resource);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to query IDXGIResource1 [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    status = resource->CreateSharedHandle(nullptr, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE, nullptr, &handle);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to create texture handle shared across adapters [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    return true;
+  }
+
   class d3d_base_encode_device final {
   public:
     int convert(platf::img_t &img_base) {
@@ -396,7 +627,12 @@ namespace platf::dxgi {
       }
 
       auto &img = (img_d3d_t &) img_base;
-      if (!img.blank) {
+      if (img.blank) {
+        // Nothing is drawn, so whatever the output holds no longer matches any frame
+        last_frame_index = 0;
+      } else if (img.frame_index && img.frame_index == last_frame_index) {
+        // The output already holds this content
+      } else {
         auto &img_ctx = img_ctx_map[img.id];
 
         // Open the shared capture texture with our ID3D11Device
@@ -404,14 +640,30 @@ namespace platf::dxgi {
           return -1;
         }
 
-        // Acquire encoder mutex to synchronize with capture code
-        auto status = img_ctx.encoder_mutex->AcquireSync(0, INFINITE);
-        if (status != S_OK) {
-          BOOST_LOG(error) << "Failed to acquire encoder mutex [0x"sv << util::hex(status).to_string_view() << ']';
-          return -1;
+        if (img_ctx.encoder_mutex) {
+          // Acquire encoder mutex to synchronize with capture code
+          auto status = img_ctx.encoder_mutex->AcquireSync(0, INFINITE);
+          if (status != S_OK) {
+            BOOST_LOG(error) << "Failed to acquire encoder mutex [0x"sv << util::hex(status).to_string_view() << ']';
+            return -1;
+          }
+        }
+
+        convert_timer.begin(device_ctx.get());
+
+        if (img_ctx.transfer_copy) {
+          // Row-major textures can't be sampled, so the copy from the other adapter is copied once more
+          transfer_ctx->Wait(transfer_fence.get(), img.transfer_value);
+          device_ctx->CopyResource(img_ctx.transfer_copy.get(), img_ctx.encoder_texture.get());
         }
 
-        auto draw = [&](auto &input, auto &y_or_yuv_viewports, auto &uv_viewport) {
+        // With a scissor rect, only the part of the output inside it is redrawn
+        auto draw = [&](auto &input, auto &y_or_yuv_viewports, auto &uv_viewport, const RECT *scissor = nullptr) {
+          if (convert_YUV_cs) {
+            dispatch(input.get(), img.format == DXGI_FORMAT_R16G16B16A16_FLOAT, scissor);
+            return;
+          }
+
           device_ctx->PSSetShaderResources(0, 1, &input);
 
           // Draw Y/YUV
@@ -421,6 +673,16 @@ namespace platf::dxgi {
           auto viewport_count = (format == DXGI_FORMAT_R16_UINT) ? 3 : 1;
           assert(viewport_count <= y_or_yuv_viewports.size());
           device_ctx->RSSetViewports(viewport_count, y_or_yuv_viewports.data());
+          if (scissor) {
+            // Each plane of the planar formats is drawn through its own viewport and scissor rect
+            std::array<RECT, 3> plane_scissors;
+            for (int x = 0; x < viewport_count; ++x) {
+              plane_scissors[x] = *scissor;
+              plane_scissors[x].top += x * output_height;
+              plane_scissors[x].bottom += x * output_height;
+            }
+            device_ctx->RSSetScissorRects(viewport_count, plane_scissors.data());
+          }
           device_ctx->Draw(3 * viewport_count, 0);  // vertex shader will spread vertices across viewports
 
           // Draw UV if needed
@@ -430,6 +692,11 @@ namespace platf::dxgi {
             device_ctx->VSSetShader(convert_UV_vs.get(), nullptr, 0);
             device_ctx->PSSetShader(img.format == DXGI_FORMAT_R16G16B16A16_FLOAT ? convert_UV_fp16_ps.get() : convert_UV_ps.get(), nullptr, 0);
             device_ctx->RSSetViewports(1, &uv_viewport);
+            if (scissor) {
+              // Scissor rects are aligned to even coordinates, so halving them is exact
+              RECT uv_scissor {scissor->left / 2, scissor->top / 2, scissor->right / 2, scissor->bottom / 2};
+              device_ctx->RSSetScissorRects(1, &uv_scissor);
+            }
             device_ctx->Draw(3, 0);
           }
         };
@@ -443,16 +710,40 @@ namespace platf::dxgi {
           rtvs_cleared = true;
         }
 
-        // Draw captured frame
-        draw(img_ctx.encoder_input_res, out_Y_or_YUV_viewports, out_UV_viewport);
+        // Only redraw the changed regions if the output holds the previous content
+        if (scissor_state && img.dirty_rects_valid && last_frame_index && img.frame_index == last_frame_index + 1) {
+          if (!img.dirty_rects.empty()) {
+            device_ctx->RSSetState(scissor_state.get());
+            for (auto &rect : output_rects_from_dirty_rects(img.dirty_rects)) {
+              draw(img_ctx.encoder_input_res, out_Y_or_YUV_viewports, out_UV_viewport, &rect);
+            }
+            device_ctx->RSSetState(nullptr);
+          }
+        } else {
+          // Draw captured frame
+          draw(img_ctx.encoder_input_res, out_Y_or_YUV_viewports, out_UV_viewport);
+        }
+        last_frame_index = img.frame_index;
+
+        convert_timer.end(device_ctx.get());
 
         // Release encoder mutex to allow capture code to reuse this image
-        img_ctx.encoder_mutex->ReleaseSync(0);
+        if (img_ctx.encoder_mutex) {
+          img_ctx.encoder_mutex->ReleaseSync(0);
+        }
 
         ID3D11ShaderResourceView *emptyShaderResourceView = nullptr;
         device_ctx->PSSetShaderResources(0, 1, &emptyShaderResourceView);
       }
 
+      // Images that were skipped release their transfer texture as well, the capture waits for
+      // this value before it copies into the texture again
+      if (release_fence && img.transfer_value > release_value) {
+        release_value = img.transfer_value;
+        transfer_ctx->Signal(release_fence.get(), release_value);
+        device_ctx->Flush();
+      }
+
       return 0;
     }
 
@@ -478,7 +769,11 @@ namespace platf::dxgi {
 
       device_ctx->VSSetConstantBuffers(3, 1, &color_matrix);
       device_ctx->PSSetConstantBuffers(0, 1, &color_matrix);
+      device_ctx->CSSetConstantBuffers(0, 1, &color_matrix);
       this->color_matrix = std::move(color_matrix);
+
+      // The output was converted with the old vectors
+      last_frame_index = 0;
     }
 
     int init_output(ID3D11Texture2D *frame_texture, int width, int height) {
@@ -613,6 +908,25 @@ namespace platf::dxgi {
       out_UV_viewport = {offsetX / 2, offsetY / 2, out_width_f / 2, out_height_f / 2, 0.0f, 1.0f};
       out_UV_viewport_for_clear = {0, 0, (float) out_width / 2, (float) out_height / 2, 0.0f, 1.0f};
 
+      output_width = out_width;
+      output_height = out_height;
+      last_frame_index = 0;
+
+      // Partial updates need the dirty rects to map onto the output without rotation
+      scissor_state.reset();
+      if (display->display_rotation == DXGI_MODE_ROTATION_UNSPECIFIED || display->display_rotation == DXGI_MODE_ROTATION_IDENTITY) {
+        D3D11_RASTERIZER_DESC raster_desc {};
+        raster_desc.FillMode = D3D11_FILL_SOLID;
+        raster_desc.CullMode = D3D11_CULL_BACK;
+        raster_desc.DepthClipEnable = TRUE;
+        raster_desc.ScissorEnable = TRUE;
+
+        status = device->CreateRasterizerState(&raster_desc, &scissor_state);
+        if (FAILED(status)) {
+          BOOST_LOG(warning) << "Failed to create scissor rasterizer state, dirty rects won't be used: " << util::log_hex(status);
+        }
+      }
+
       float subsample_offset_in[16 / sizeof(float)] {1.0f / (float) out_width_f, 1.0f / (float) out_height_f};  // aligned to 16-byte
       subsample_offset = make_buffer(device.get(), subsample_offset_in);
 
@@ -705,9 +1019,138 @@ namespace platf::dxgi {
         rtvs_cleared = false;
       }
 
+      init_compute(downscaling);
+
       return 0;
     }
 
+    /**
+     * @brief Set up converting both planes of NV12/P010 in a single compute dispatch.
+     * @details Leaves the compute shader unset, and with it the draw pipeline in use,
+     *          if the device or the output texture doesn't support it.
+     * @param downscaling Whether the UV plane needs the scaling filter.
+     */
+    void init_compute(bool downscaling) {
+      convert_YUV_cs.reset();
+      convert_YUV_fp16_cs.reset();
+      out_Y_uav.reset();
+      out_UV_uav.reset();
+
+      // The shader has no rotation, the draw pipeline handles rotated displays
+      if (display->display_rotation != DXGI_MODE_ROTATION_UNSPECIFIED && display->display_rotation != DXGI_MODE_ROTATION_IDENTITY) {
+        return;
+      }
+
+      D3D11_TEXTURE2D_DESC output_desc;
+      output_texture->GetDesc(&output_desc);
+      if (!(output_desc.BindFlags & D3D11_BIND_UNORDERED_ACCESS) || !supports_compute_conversion(device.get(), format)) {
+        return;
+      }
+
+      const bool hdr = format == DXGI_FORMAT_P010 && display->is_hdr();
+      auto &cs_hlsl = downscaling ? convert_yuv420_type0s_cs_hlsl : convert_yuv420_type0_cs_hlsl;
+      auto &cs_fp16_hlsl = downscaling ?
+                             (hdr ? convert_yuv420_type0s_cs_perceptual_quantizer_hlsl : convert_yuv420_type0s_cs_linear_hlsl) :
+                             (hdr ? convert_yuv420_type0_cs_perceptual_quantizer_hlsl : convert_yuv420_type0_cs_linear_hlsl);
+
+      cs_t cs;
+      cs_t fp16_cs;
+      if (FAILED(device->CreateComputeShader(cs_hlsl->GetBufferPointer(), cs_hlsl->GetBufferSize(), nullptr, &cs)) ||
+          FAILED(device->CreateComputeShader(cs_fp16_hlsl->GetBufferPointer(), cs_fp16_hlsl->GetBufferSize(), nullptr, &fp16_cs))) {
+        BOOST_LOG(warning) << "Failed to create compute shaders, falling back to the draw pipeline"sv;
+        return;
+      }
+
+      auto create_uav = [&](auto &uav, DXGI_FORMAT uav_format) -> bool {
+        D3D11_UNORDERED_ACCESS_VIEW_DESC uav_desc = {};
+        uav_desc.Format = uav_format;
+        uav_desc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+
+        auto status = device->CreateUnorderedAccessView(output_texture.get(), &uav_desc, &uav);
+        if (FAILED(status)) {
+          BOOST_LOG(warning) << "Failed to create unordered access view, falling back to the draw pipeline: " << util::log_hex(status);
+          return false;
+        }
+
+        return true;
+      };
+
+      unordered_access_t y_uav;
+      unordered_access_t uv_uav;
+      if (format == DXGI_FORMAT_NV12) {
+        if (!create_uav(y_uav, DXGI_FORMAT_R8_UNORM) || !create_uav(uv_uav, DXGI_FORMAT_R8G8_UNORM)) {
+          return;
+        }
+      } else {
+        if (!create_uav(y_uav, DXGI_FORMAT_R16_UNORM) || !create_uav(uv_uav, DXGI_FORMAT_R16G16_UNORM)) {
+          return;
+        }
+      }
+
+      D3D11_BUFFER_DESC buffer_desc {
+        sizeof(compute_params_t),
+        D3D11_USAGE_DEFAULT,
+        D3D11_BIND_CONSTANT_BUFFER
+      };
+
+      buf_t params;
+      if (FAILED(device->CreateBuffer(&buffer_desc, nullptr, &params))) {
+        BOOST_LOG(warning) << "Failed to create compute constant buffer, falling back to the draw pipeline"sv;
+        return;
+      }
+
+      const auto &viewport = out_Y_or_YUV_viewports[0];
+      compute_params = {};
+      compute_params.viewport[0] = viewport.TopLeftX;
+      compute_params.viewport[1] = viewport.TopLeftY;
+      compute_params.viewport[2] = viewport.Width;
+      compute_params.viewport[3] = viewport.Height;
+      compute_params.subsample_offset[0] = 1.0f / viewport.Width;
+      compute_params.subsample_offset[1] = 1.0f / viewport.Height;
+
+      convert_YUV_cs = std::move(cs);
+      convert_YUV_fp16_cs = std::move(fp16_cs);
+      out_Y_uav = std::move(y_uav);
+      out_UV_uav = std::move(uv_uav);
+      compute_params_buf = std::move(params);
+      device_ctx->CSSetConstantBuffers(1, 1, &compute_params_buf);
+
+      BOOST_LOG(debug) << "Converting with a single compute dispatch"sv;
+    }
+
+    /**
+     * @brief Convert into both planes of the output with the compute shader.
+     * @param input The captured image.
+     * @param fp16 Whether the captured image is scRGB.
+     * @param rect Output region to convert, aligned to even coordinates, or `nullptr` for all of it.
+     */
+    void dispatch(shader_res_t::pointer input, bool fp16, const RECT *rect) {
+      RECT full {0, 0, (output_width + 1) & ~1, (output_height + 1) & ~1};
+      if (!rect) {
+        rect = &full;
+      }
+
+      compute_params.block_offset[0] = rect->left / 2;
+      compute_params.block_offset[1] = rect->top / 2;
+      compute_params.block_count[0] = (rect->right - rect->left) / 2;
+      compute_params.block_count[1] = (rect->bottom - rect->top) / 2;
+      device_ctx->UpdateSubresource(compute_params_buf.get(), 0, nullptr, &compute_params, 0, 0);
+
+      ID3D11UnorderedAccessView *uavs[] {out_Y_uav.get(), out_UV_uav.get()};
+      device_ctx->CSSetShader(fp16 ? convert_YUV_fp16_cs.get() : convert_YUV_cs.get(), nullptr, 0);
+      device_ctx->CSSetShaderResources(0, 1, &input);
+      device_ctx->CSSetUnorderedAccessViews(0, 2, uavs, nullptr);
+
+      // 8x8 threads per group, one thread per 2x2 block
+      device_ctx->Dispatch((compute_params.block_count[0] + 7) / 8, (compute_params.block_count[1] + 7) / 8, 1);
+
+      // Unbind the output so the encoder can read it
+      ID3D11UnorderedAccessView *empty_uavs[] {nullptr, nullptr};
+      ID3D11ShaderResourceView *empty_input = nullptr;
+      device_ctx->CSSetUnorderedAccessViews(0, 2, empty_uavs, nullptr);
+      device_ctx->CSSetShaderResources(0, 1, &empty_input);
+    }
+
     int init(std::shared_ptr<platf::display_t> display, adapter_t::pointer adapter_p, pix_fmt_e pix_fmt) {
       switch (pix_fmt) {
         case pix_fmt_e::nv12:
@@ -794,11 +1237,78 @@ namespace platf::dxgi {
       }
       device_ctx->VSSetConstantBuffers(3, 1, &color_matrix);
       device_ctx->PSSetConstantBuffers(0, 1, &color_matrix);
+      device_ctx->CSSetConstantBuffers(0, 1, &color_matrix);
 
       this->display = std::dynamic_pointer_cast<display_base_t>(display);
       if (!this->display) {
         return -1;
       }
+
+      // The linear shaders convert scRGB captures of HDR displays for SDR streams, the
+      // perceptual quantizer ones used for HDR streams don't read the tone map buffer
+      if (config::video.hdr_tone_mapping && display->is_hdr()) {
+        SS_HDR_METADATA metadata {};
+        auto white = (float) config::video.hdr_tone_mapping_white;
+        auto peak = (float) config::video.hdr_tone_mapping_peak;
+        if (peak <= 0) {
+          peak = display->get_hdr_metadata(metadata) && metadata.maxDisplayLuminance ? metadata.maxDisplayLuminance : 1000.0f;
+        }
+
+        // 1.0f is defined as 80 nits in the scRGB colorspace
+        float tone_map_data[16 / sizeof(float)] {80.0f / white, peak / white};  // aligned to 16-byte
+        tone_map = make_buffer(device.get(), tone_map_data);
+        if (!tone_map) {
+          BOOST_LOG(error) << "Failed to create tone map buffer"sv;
+          return -1;
+        }
+        device_ctx->PSSetConstantBuffers(2, 1, &tone_map);
+        device_ctx->CSSetConstantBuffers(2, 1, &tone_map);
+
+        BOOST_LOG(info) << "Tone mapping HDR captures from "sv << peak << " nits to SDR white at "sv << white << " nits"sv;
+      }
+
+      // Images captured on another adapter arrive through textures ordered by a shared fence
+      if (auto display_vram = std::dynamic_pointer_cast<display_vram_t>(display); display_vram && display_vram->encode_adapter) {
+        device5_t device5;
+        status = device->QueryInterface(__uuidof(ID3D11Device5), (void **) &device5);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to query ID3D11Device5 [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
+
+        status = device5->OpenSharedFence(display_vram->transfer_fence_handle.get(), __uuidof(ID3D11Fence), (void **) &transfer_fence);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to open the fence shared by the capture adapter [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
+
+        status = device_ctx->QueryInterface(__uuidof(ID3D11DeviceContext4), (void **) &transfer_ctx);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to query ID3D11DeviceContext4 [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
+
+        // Signaled back once an image was copied out of its transfer texture, so the capture
+        // doesn't overwrite the texture while this device still reads it
+        status = device5->CreateFence(0, (D3D11_FENCE_FLAG) (D3D11_FENCE_FLAG_SHARED | D3D11_FENCE_FLAG_SHARED_CROSS_ADAPTER), __uuidof(ID3D11Fence), (void **) &release_fence);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to create release fence shared across adapters [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
+
+        HANDLE release_handle_p;
+        status = release_fence->CreateSharedHandle(nullptr, GENERIC_ALL, nullptr, &release_handle_p);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to share release fence across adapters [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
+        handle_t release_handle {release_handle_p};
+
+        release_registration = display_vram->add_release_fence(release_handle.get());
+        if (!release_registration) {
+          return -1;
+        }
+      }
       display = nullptr;
 
       blend_disable = make_blend(device.get(), false, false);
@@ -823,8 +1333,11 @@ namespace platf::dxgi {
 
       device_ctx->OMSetBlendState(blend_disable.get(), nullptr, 0xFFFFFFFFu);
       device_ctx->PSSetSamplers(0, 1, &sampler_linear);
+      device_ctx->CSSetSamplers(0, 1, &sampler_linear);
       device_ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
+      convert_timer.init(device.get(), "gpu_convert"sv);
+
       return 0;
     }
 
@@ -837,6 +1350,9 @@ namespace platf::dxgi {
       shader_res_t encoder_input_res;
       keyed_mutex_t encoder_mutex;
 
+      // Set if encoder_texture was shared by another adapter, the texture encoder_input_res views instead
+      texture2d_t transfer_copy;
+
       std::weak_ptr<const platf::img_t> img_weak;
 
       void reset() {
@@ -844,6 +1360,7 @@ namespace platf::dxgi {
         encoder_texture.reset();
         encoder_input_res.reset();
         encoder_mutex.reset();
+        transfer_copy.reset();
         img_weak.reset();
       }
     };
@@ -865,22 +1382,48 @@ namespace platf::dxgi {
         return -1;
       }
 
-      // Open a handle to the shared texture
-      status = device1->OpenSharedResource1(img.encoder_texture_handle, __uuidof(ID3D11Texture2D), (void **) &img_ctx.encoder_texture);
-      if (FAILED(status)) {
-        BOOST_LOG(error) << "Failed to open shared image texture [0x"sv << util::hex(status).to_string_view() << ']';
-        return -1;
-      }
+      if (transfer_fence) {
+        // Open the copy the capture adapter made for this one, and a texture it can be sampled from
+        status = device1->OpenSharedResource1(img.transfer_texture_handle, __uuidof(ID3D11Texture2D), (void **) &img_ctx.encoder_texture);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to open image texture shared across adapters [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
 
-      // Get the keyed mutex to synchronize with the capture code
-      status = img_ctx.encoder_texture->QueryInterface(__uuidof(IDXGIKeyedMutex), (void **) &img_ctx.encoder_mutex);
-      if (FAILED(status)) {
-        BOOST_LOG(error) << "Failed to query IDXGIKeyedMutex [0x"sv << util::hex(status).to_string_view() << ']';
-        return -1;
+        D3D11_TEXTURE2D_DESC t {};
+        t.Width = img.width;
+        t.Height = img.height;
+        t.MipLevels = 1;
+        t.ArraySize = 1;
+        t.SampleDesc.Count = 1;
+        t.Usage = D3D11_USAGE_DEFAULT;
+        t.Format = img.format;
+        t.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+        status = device->CreateTexture2D(&t, nullptr, &img_ctx.transfer_copy);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to create texture for images of another adapter [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
+      } else {
+        // Open a handle to the shared texture
+        status = device1->OpenSharedResource1(img.encoder_texture_handle, __uuidof(ID3D11Texture2D), (void **) &img_ctx.encoder_texture);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to open shared image texture [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
+
+        // Get the keyed mutex to synchronize with the capture code
+        status = img_ctx.encoder_texture->QueryInterface(__uuidof(IDXGIKeyedMutex), (void **) &img_ctx.encoder_mutex);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to query IDXGIKeyedMutex [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
       }
 
       // Create the SRV for the encoder texture
-      status = device->CreateShaderResourceView(img_ctx.encoder_texture.get(), nullptr, &img_ctx.encoder_input_res);
+      auto input_texture = img_ctx.transfer_copy ? img_ctx.transfer_copy.get() : img_ctx.encoder_texture.get();
+      status = device->CreateShaderResourceView(input_texture, nullptr, &img_ctx.encoder_input_res);
       if (FAILED(status)) {
         BOOST_LOG(error) << "Failed to create shader resource view for encoding [0x"sv << util::hex(status).to_string_view() << ']';
         return -1;
@@ -893,6 +1436,49 @@ namespace platf::dxgi {
       return 0;
     }
 
+    /**
+     * @brief Map changed regions of the capture to the output rects that must be redrawn.
+     * @param dirty_rects Changed regions in capture texture coordinates.
+     * @return Rects in output coordinates, aligned to even coordinates for the subsampled chroma.
+     */
+    const std::vector<RECT> &output_rects_from_dirty_rects(const std::vector<RECT> &dirty_rects) {
+      // Many small draws cost more than redrawing the area around all of them
+      constexpr std::size_t max_draws = 16;
+
+      const auto &viewport = out_Y_or_YUV_viewports[0];
+      auto scale_x = viewport.Width / display->width;
+      auto scale_y = viewport.Height / display->height;
+      LONG max_x = (output_width + 1) & ~1;
+      LONG max_y = (output_height + 1) & ~1;
+
+      scissor_rects.clear();
+      for (auto &rect : dirty_rects) {
+        // Grow by the footprint of the scaling and chroma filters
+        RECT out;
+        out.left = std::max<LONG>(0, ((LONG) std::floor(viewport.TopLeftX + rect.left * scale_x) - 2) & ~1);
+        out.top = std::max<LONG>(0, ((LONG) std::floor(viewport.TopLeftY + rect.top * scale_y) - 2) & ~1);
+        out.right = std::min<LONG>(max_x, ((LONG) std::ceil(viewport.TopLeftX + rect.right * scale_x) + 3) & ~1);
+        out.bottom = std::min<LONG>(max_y, ((LONG) std::ceil(viewport.TopLeftY + rect.bottom * scale_y) + 3) & ~1);
+
+        if (out.left < out.right && out.top < out.bottom) {
+          scissor_rects.push_back(out);
+        }
+      }
+
+      if (scissor_rects.size() > max_draws) {
+        auto bounds = scissor_rects.front();
+        for (auto &rect : scissor_rects) {
+          bounds.left = std::min(bounds.left, rect.left);
+          bounds.top = std::min(bounds.top, rect.top);
+          bounds.right = std::max(bounds.right, rect.right);
+          bounds.bottom = std::max(bounds.bottom, rect.bottom);
+        }
+        scissor_rects.assign(1, bounds);
+      }
+
+      return scissor_rects;
+    }
+
     shader_res_t create_black_texture_for_rtv_clear() {
       constexpr auto width = 32;
       constexpr auto height = 32;
@@ -931,6 +1517,7 @@ namespace platf::dxgi {
 
     buf_t subsample_offset;
     buf_t color_matrix;
+    buf_t tone_map;
 
     blend_t blend_disable;
     sampler_state_t sampler_linear;
@@ -939,6 +1526,16 @@ namespace platf::dxgi {
     render_target_t out_UV_rtv;
     bool rtvs_cleared = false;
 
+    // Set if the output can be partially updated from the dirty rects of the capture
+    raster_state_t scissor_state;
+    std::vector<RECT> scissor_rects;
+
+    // img_d3d_t::frame_index of the content the output holds, 0 if unknown
+    uint64_t last_frame_index = 0;
+
+    int output_width = 0;
+    int output_height = 0;
+
     // d3d_img_t::id -> encoder_img_ctx_t
     // These store the encoder textures for each img_t that passes through
     // convert(). We can't store them in the img_t itself because it is shared
@@ -955,6 +1552,27 @@ namespace platf::dxgi {
     ps_t convert_UV_ps;
     ps_t convert_UV_fp16_ps;
 
+    /**
+     * @brief Layout of compute_params_cbuffer in convert_yuv420_cs_base.hlsl.
+     */
+    struct compute_params_t {
+      float viewport[4];
+      float subsample_offset[2];
+      int32_t block_offset[2];
+      int32_t block_count[2];
+      int32_t padding[2];
+    };
+
+    static_assert(sizeof(compute_params_t) % 16 == 0, "Buffer needs to be aligned on a 16-byte alignment");
+
+    // Set if both planes are converted in a single compute dispatch instead of the draws above
+    cs_t convert_YUV_cs;
+    cs_t convert_YUV_fp16_cs;
+    unordered_access_t out_Y_uav;
+    unordered_access_t out_UV_uav;
+    buf_t compute_params_buf;
+    compute_params_t compute_params;
+
     std::array<D3D11_VIEWPORT, 3> out_Y_or_YUV_viewports, out_Y_or_YUV_viewports_for_clear;
     D3D11_VIEWPORT out_UV_viewport, out_UV_viewport_for_clear;
 
@@ -963,6 +1581,15 @@ namespace platf::dxgi {
     device_t device;
     device_ctx_t device_ctx;
 
+    // Set if the images are captured on another adapter, see display_vram_t::select_encode_adapter()
+    fence_t transfer_fence;
+    device_ctx4_t transfer_ctx;
+    fence_t release_fence;  // Signaled with the transfer value of each image once it was copied out
+    std::shared_ptr<display_vram_t::release_fence_t> release_registration;  // Keeps release_fence known to the capture
+    uint64_t release_value = 0;  // Value release_fence was last signaled with
+
+    gpu_timer_t convert_timer;
+
     texture2d_t output_texture;
   };
 
@@ -989,6 +1616,9 @@ namespace platf::dxgi {
 
         // The encoder requires textures with D3D11_BIND_RENDER_TARGET set
         d3d11_frames->BindFlags = D3D11_BIND_RENDER_TARGET;
+        if (supports_compute_conversion(base.device.get(), base.format)) {
+          d3d11_frames->BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
+        }
         d3d11_frames->MiscFlags = 0;
       }
 
@@ -1085,7 +1715,7 @@ namespace platf::dxgi {
       }
 
       auto nvenc_colorspace = nvenc::nvenc_colorspace_from_sunshine_colorspace(colorspace);
-      if (!nvenc_d3d->create_encoder(config::video.nv, client_config, nvenc_colorspace, buffer_format)) {
+      if (!nvenc_d3d->create_encoder(::video::nvenc_config_for_profile(config::video.nv, client_config), client_config, nvenc_colorspace, buffer_format)) {
         return false;
       }
 
@@ -1093,6 +1723,15 @@ namespace platf::dxgi {
       return base.init_output(nvenc_d3d->get_input_texture(), client_config.width, client_config.height) == 0;
     }
 
+    bool reconfigure_resolution(const ::video::config_t &client_config) override {
+      if (!nvenc_d3d || !nvenc_d3d->reconfigure_resolution(client_config.width, client_config.height, client_config.framerate)) {
+        return false;
+      }
+
+      // Render into the top left corner of the same texture at the new size
+      return base.init_output(nvenc_d3d->get_input_texture(), client_config.width, client_config.height) == 0;
+    }
+
     int convert(platf::img_t &img_base) override {
       return base.convert(img_base);
     }
@@ -1103,11 +1742,10 @@ namespace platf::dxgi {
     NV_ENC_BUFFER_FORMAT buffer_format = NV_ENC_BUFFER_FORMAT_UNDEFINED;
   };
 
-  bool set_cursor_texture(device_t::pointer device, gpu_cursor_t &cursor, util::buffer_t<std::uint8_t> &&cursor_img, DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info) {
+  bool make_cursor_texture(device_t::pointer device, util::buffer_t<std::uint8_t> &&cursor_img, DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info, cursor_texture_t &cursor_texture) {
     // This cursor image may not be used
     if (cursor_img.size() == 0) {
-      cursor.input_res.reset();
-      cursor.set_texture(0, 0, nullptr);
+      cursor_texture = {};
       return true;
     }
 
@@ -1128,22 +1766,354 @@ namespace platf::dxgi {
     t.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
     t.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 
-    texture2d_t texture;
-    auto status = device->CreateTexture2D(&t, &data, &texture);
+    auto status = device->CreateTexture2D(&t, &data, &cursor_texture.texture);
     if (FAILED(status)) {
       BOOST_LOG(error) << "Failed to create mouse texture [0x"sv << util::hex(status).to_string_view() << ']';
       return false;
     }
 
-    // Free resources before allocating on the next line.
-    cursor.input_res.reset();
-    status = device->CreateShaderResourceView(texture.get(), nullptr, &cursor.input_res);
+    status = device->CreateShaderResourceView(cursor_texture.texture.get(), nullptr, &cursor_texture.input_res);
     if (FAILED(status)) {
       BOOST_LOG(error) << "Failed to create cursor shader resource view [0x"sv << util::hex(status).to_string_view() << ']';
       return false;
     }
 
-    cursor.set_texture(t.Width, t.Height, std::move(texture));
+    cursor_texture.width = t.Width;
+    cursor_texture.height = t.Height;
+    return true;
+  }
+
+  /**
+   * @brief Get the cached textures of a pointer shape, building them if the shape wasn't seen recently.
+   * @return The textures, or nullptr on failure.
+   */
+  const display_ddup_vram_t::cursor_shape_t *display_ddup_vram_t::cursor_shape(util::buffer_t<std::uint8_t> &&img_data, DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info) {
+    auto hash = std::hash<std::string_view> {}(std::string_view {(const char *) std::begin(img_data), img_data.size()});
+    hash ^= std::hash<std::uint64_t> {}(((std::uint64_t) shape_info.Type << 48) ^ ((std::uint64_t) shape_info.Pitch << 32) ^ ((std::uint64_t) shape_info.Height << 16) ^ shape_info.Width);
+
+    for (auto it = std::begin(cursor_shapes); it != std::end(cursor_shapes); ++it) {
+      auto &info = it->shape_info;
+      if (it->hash == hash && info.Type == shape_info.Type && info.Width == shape_info.Width && info.Height == shape_info.Height && info.Pitch == shape_info.Pitch &&
+          it->img_data.size() == img_data.size() && std::equal(std::begin(img_data), std::end(img_data), std::begin(it->img_data))) {
+        cursor_shapes.splice(std::begin(cursor_shapes), cursor_shapes, it);
+        return &cursor_shapes.front();
+      }
+    }
+
+    cursor_shape_t shape {hash, {}, shape_info};
+    if (!make_cursor_texture(device.get(), make_cursor_alpha_image(img_data, shape_info), shape_info, shape.alpha) ||
+        !make_cursor_texture(device.get(), make_cursor_xor_image(img_data, shape_info), shape_info, shape.xor_mask)) {
+      return nullptr;
+    }
+    shape.img_data = std::move(img_data);
+
+    if (cursor_shapes.size() >= max_cursor_shapes) {
+      cursor_shapes.pop_back();
+    }
+    cursor_shapes.emplace_front(std::move(shape));
+
+    return &cursor_shapes.front();
+  }
+
+  // Cursor-only updates copy a few small boxes instead of the whole desktop
+  bool display_vram_t::copy_damaged_regions(platf::img_t &img_base, ID3D11Texture2D *surface, const std::vector<RECT> &dirty_rects, bool dirty_rects_valid) {
+    auto &d3d_img = (img_d3d_t &) img_base;
+
+    auto img_index = d3d_img.frame_index;
+    auto latest_index = next_frame_index - 1;
+    if (!dirty_rects_valid || d3d_img.blank || img_index == 0 || img_index > latest_index) {
+      return false;
+    }
+    if (img_index != latest_index && (damage_history.empty() || img_index + 1 < damage_history.front().first)) {
+      return false;
+    }
+
+    auto copy_rect = [&](const RECT &rect) {
+      D3D11_BOX box {
+        (UINT) std::clamp<LONG>(rect.left, 0, width_before_rotation),
+        (UINT) std::clamp<LONG>(rect.top, 0, height_before_rotation),
+        0,
+        (UINT) std::clamp<LONG>(rect.right, 0, width_before_rotation),
+        (UINT) std::clamp<LONG>(rect.bottom, 0, height_before_rotation),
+        1,
+      };
+      if (box.left < box.right && box.top < box.bottom) {
+        device_ctx->CopySubresourceRegion(d3d_img.capture_texture.get(), 0, box.left, box.top, 0, surface, 0, &box);
+      }
+    };
+
+    for (auto &[index, rects] : damage_history) {
+      if (index > img_index) {
+        std::for_each(std::begin(rects), std::end(rects), copy_rect);
+      }
+    }
+    std::for_each(std::begin(dirty_rects), std::end(dirty_rects), copy_rect);
+
+    return true;
+  }
+
+  void display_vram_t::track_damage(platf::img_t &img_base, std::vector<RECT> &&dirty_rects, bool dirty_rects_valid) {
+    auto &d3d_img = (img_d3d_t &) img_base;
+
+    d3d_img.dirty_rects_valid = dirty_rects_valid;
+    d3d_img.dirty_rects = dirty_rects;
+
+    d3d_img.damage_valid = dirty_rects_valid;
+    d3d_img.damage.clear();
+    for (auto &rect : dirty_rects) {
+      d3d_img.damage.push_back({rect.left, rect.top, rect.right, rect.bottom});
+    }
+
+    // A new image without visible changes holds the same content as the previous one
+    if (dirty_rects_valid && dirty_rects.empty()) {
+      d3d_img.frame_index = next_frame_index - 1;
+    } else {
+      d3d_img.frame_index = next_frame_index++;
+
+      if (!dirty_rects_valid) {
+        damage_history.clear();
+      } else {
+        if (damage_history.size() == 8) {
+          damage_history.erase(std::begin(damage_history));
+        }
+        damage_history.emplace_back(d3d_img.frame_index, std::move(dirty_rects));
+      }
+    }
+  }
+
+  void display_vram_t::select_encode_adapter() {
+    if (!config::video.cross_adapter_encode || !config::video.adapter_name.empty()) {
+      return;
+    }
+
+    // Only integrated adapters hand the encoding off
+    D3D11_FEATURE_DATA_D3D11_OPTIONS2 options {};
+    if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS2, &options, sizeof(options))) || !options.UnifiedMemoryArchitecture) {
+      return;
+    }
+
+    DXGI_ADAPTER_DESC1 capture_desc;
+    adapter->GetDesc1(&capture_desc);
+
+    adapter_t candidate;
+    DXGI_ADAPTER_DESC1 candidate_desc {};
+    adapter_t::pointer adapter_p;
+    for (int x = 0; factory->EnumAdapters1(x, &adapter_p) != DXGI_ERROR_NOT_FOUND; ++x) {
+      adapter_t adapter_tmp {adapter_p};
+
+      DXGI_ADAPTER_DESC1 adapter_desc;
+      adapter_tmp->GetDesc1(&adapter_desc);
+
+      if (adapter_desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE ||
+          (adapter_desc.AdapterLuid.LowPart == capture_desc.AdapterLuid.LowPart && adapter_desc.AdapterLuid.HighPart == capture_desc.AdapterLuid.HighPart)) {
+        continue;
+      }
+
+      if (adapter_desc.DedicatedVideoMemory > candidate_desc.DedicatedVideoMemory) {
+        candidate = std::move(adapter_tmp);
+        candidate_desc = adapter_desc;
+      }
+    }
+
+    if (!candidate) {
+      return;
+    }
+
+    device5_t device5;
+    auto status = device->QueryInterface(__uuidof(ID3D11Device5), (void **) &device5);
+    if (FAILED(status)) {
+      BOOST_LOG(warning) << "Failed to query ID3D11Device5, encoding on the capture adapter [0x"sv << util::hex(status).to_string_view() << ']';
+      return;
+    }
+
+    status = device_ctx->QueryInterface(__uuidof(ID3D11DeviceContext4), (void **) &transfer_ctx);
+    if (FAILED(status)) {
+      BOOST_LOG(warning) << "Failed to query ID3D11DeviceContext4, encoding on the capture adapter [0x"sv << util::hex(status).to_string_view() << ']';
+      return;
+    }
+
+    status = device5->CreateFence(0, (D3D11_FENCE_FLAG) (D3D11_FENCE_FLAG_SHARED | D3D11_FENCE_FLAG_SHARED_CROSS_ADAPTER), __uuidof(ID3D11Fence), (void **) &transfer_fence);
+    if (FAILED(status)) {
+      BOOST_LOG(warning) << "Failed to create fence shared across adapters, encoding on the capture adapter [0x"sv << util::hex(status).to_string_view() << ']';
+      transfer_ctx.reset();
+      return;
+    }
+
+    HANDLE fence_handle;
+    status = transfer_fence->CreateSharedHandle(nullptr, GENERIC_ALL, nullptr, &fence_handle);
+    if (FAILED(status)) {
+      BOOST_LOG(warning) << "Failed to share fence across adapters, encoding on the capture adapter [0x"sv << util::hex(status).to_string_view() << ']';
+      transfer_fence.reset();
+      transfer_ctx.reset();
+      return;
+    }
+    transfer_fence_handle.reset(fence_handle);
+
+    // Drivers aren't required to open row-major textures and fences of another adapter, try it
+    // before any encoder depends on it
+    if (!can_share_with(candidate.get())) {
+      BOOST_LOG(warning) << "Can't share textures with "sv << to_utf8(candidate_desc.Description) << ", encoding on the capture adapter"sv;
+      transfer_fence_handle.reset();
+      transfer_fence.reset();
+      transfer_ctx.reset();
+      return;
+    }
+
+    release_event.reset(CreateEventW(nullptr, FALSE, FALSE, nullptr));
+    if (!release_event) {
+      BOOST_LOG(warning) << "Failed to create release event, encoding on the capture adapter"sv;
+      transfer_fence_handle.reset();
+      transfer_fence.reset();
+      transfer_ctx.reset();
+      return;
+    }
+
+    encode_adapter = std::move(candidate);
+    BOOST_LOG(info) << "Capturing on "sv << to_utf8(capture_desc.Description) << ", encoding on "sv << to_utf8(candidate_desc.Description);
+  }
+
+  bool display_vram_t::can_share_with(adapter_t::pointer adapter_p) {
+    D3D_FEATURE_LEVEL featureLevels[] {
+      D3D_FEATURE_LEVEL_11_1,
+      D3D_FEATURE_LEVEL_11_0,
+    };
+
+    device_t other_device;
+    auto status = D3D11CreateDevice(
+      adapter_p,
+      D3D_DRIVER_TYPE_UNKNOWN,
+      nullptr,
+      D3D11_CREATE_DEVICE_FLAGS,
+      featureLevels,
+      sizeof(featureLevels) / sizeof(D3D_FEATURE_LEVEL),
+      D3D11_SDK_VERSION,
+      &other_device,
+      nullptr,
+      nullptr
+    );
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Failed to create D3D11 device on the encode adapter [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    texture2d_t texture;
+    HANDLE handle_p = nullptr;
+    auto created = create_transfer_texture(device.get(), 64, 64, DXGI_FORMAT_B8G8R8A8_UNORM, texture, handle_p);
+    handle_t handle {handle_p};
+    if (!created) {
+      return false;
+    }
+
+    device1_t other_device1;
+    status = other_device->QueryInterface(__uuidof(ID3D11Device1), (void **) &other_device1);
+    if (FAILED(status)) {
+      return false;
+    }
+
+    texture2d_t other_texture;
+    status = other_device1->OpenSharedResource1(handle.get(), __uuidof(ID3D11Texture2D), (void **) &other_texture);
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Failed to open row-major texture on the encode adapter [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    device5_t other_device5;
+    status = other_device->QueryInterface(__uuidof(ID3D11Device5), (void **) &other_device5);
+    if (FAILED(status)) {
+      return false;
+    }
+
+    fence_t other_fence;
+    status = other_device5->OpenSharedFence(transfer_fence_handle.get(), __uuidof(ID3D11Fence), (void **) &other_fence);
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Failed to open the transfer fence on the encode adapter [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    return true;
+  }
+
+  std::shared_ptr<display_vram_t::release_fence_t> display_vram_t::add_release_fence(HANDLE handle) {
+    device5_t device5;
+    auto status = device->QueryInterface(__uuidof(ID3D11Device5), (void **) &device5);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to query ID3D11Device5 [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+
+    auto release = std::make_shared<release_fence_t>();
+    status = device5->OpenSharedFence(handle, __uuidof(ID3D11Fence), (void **) &release->fence);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to open the release fence of the encode adapter [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+    release->since = transfer_fence_value;
+
+    std::lock_guard lg {release_fences_mutex};
+    release_fences.emplace_back(release);
+    return release;
+  }
+
+  void display_vram_t::wait_for_release(uint64_t value) {
+    std::vector<std::shared_ptr<release_fence_t>> fences;
+    {
+      std::lock_guard lg {release_fences_mutex};
+      std::erase_if(release_fences, [](const auto &release) {
+        return release.expired();
+      });
+      for (auto &release : release_fences) {
+        if (auto fence = release.lock()) {
+          fences.emplace_back(std::move(fence));
+        }
+      }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + release_timeout;
+    for (auto &release : fences) {
+      // The encoder device started after this content was copied, it never reads it
+      if (value <= release->since) {
+        continue;
+      }
+
+      // The event may have been set by an earlier wait that timed out, so the value is checked on each wake
+      while (release->fence->GetCompletedValue() < value) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0 || FAILED(release->fence->SetEventOnCompletion(value, release_event.get()))) {
+          // An encoder that stopped pulling images doesn't hold the capture back
+          BOOST_LOG(debug) << "Encoder didn't release the transfer texture in time"sv;
+          break;
+        }
+        WaitForSingleObject(release_event.get(), (DWORD) remaining.count());
+      }
+    }
+  }
+
+  bool display_vram_t::share_across_adapters(platf::img_t &img_base) {
+    auto &d3d_img = (img_d3d_t &) img_base;
+    if (!encode_adapter || !d3d_img.transfer_texture) {
+      return true;
+    }
+
+    // The encoders may still be copying the previous content of the texture on their adapter
+    wait_for_release(d3d_img.transfer_value);
+
+    texture_lock_helper lock_helper(d3d_img.capture_mutex.get());
+    if (!lock_helper.lock()) {
+      BOOST_LOG(error) << "Failed to lock capture texture";
+      return false;
+    }
+
+    device_ctx->CopyResource(d3d_img.transfer_texture.get(), d3d_img.capture_texture.get());
+    auto status = transfer_ctx->Signal(transfer_fence.get(), ++transfer_fence_value);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to signal fence shared across adapters [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+    d3d_img.transfer_value = transfer_fence_value;
+
+    // The other adapter can't see the commands until they're submitted
+    device_ctx->Flush();
+
     return true;
   }
 
@@ -1178,21 +2148,20 @@ namespace platf::dxgi {
 
       util::buffer_t<std::uint8_t> img_data {frame_info.PointerShapeBufferSize};
 
-      UINT dummy;
-      status = dup.dup->GetFramePointerShape(img_data.size(), std::begin(img_data), &dummy, &shape_info);
+      status = dup.get_pointer_shape(img_data.size(), std::begin(img_data), shape_info);
       if (FAILED(status)) {
         BOOST_LOG(error) << "Failed to get new pointer shape [0x"sv << util::hex(status).to_string_view() << ']';
 
         return capture_e::error;
       }
 
-      auto alpha_cursor_img = make_cursor_alpha_image(img_data, shape_info);
-      auto xor_cursor_img = make_cursor_xor_image(img_data, shape_info);
-
-      if (!set_cursor_texture(device.get(), cursor_alpha, std::move(alpha_cursor_img), shape_info) ||
-          !set_cursor_texture(device.get(), cursor_xor, std::move(xor_cursor_img), shape_info)) {
+      auto shape = cursor_shape(std::move(img_data), shape_info);
+      if (!shape) {
         return capture_e::error;
       }
+
+      cursor_alpha.set_texture(shape->alpha);
+      cursor_xor.set_texture(shape->xor_mask);
     }
 
     if (frame_info.LastMouseUpdateTime.QuadPart) {
@@ -1236,6 +2205,14 @@ namespace platf::dxgi {
       }
     }
 
+    // Regions that changed since the previous output image
+    std::vector<RECT> dirty_rects;
+    bool dirty_rects_valid = true;
+    if (src) {
+      dirty_rects_valid = dup.get_dirty_rects(frame_info, dirty_rects);
+    }
+    bool previous_output_tracked = std::exchange(last_output_tracked, false);
+
     enum class lfa {
       nothing,
       replace_surface_with_img,
@@ -1446,6 +2423,8 @@ namespace platf::dxgi {
     }
 
     auto blend_cursor = [&](img_d3d_t &d3d_img) {
+      cursor_timer.begin(device_ctx.get());
+
       device_ctx->VSSetShader(cursor_vs.get(), nullptr, 0);
       device_ctx->PSSetShader(cursor_ps.get(), nullptr, 0);
       device_ctx->OMSetRenderTargets(1, &d3d_img.capture_rt, nullptr);
@@ -1475,8 +2454,27 @@ namespace platf::dxgi {
       device_ctx->RSSetViewports(0, nullptr);
       ID3D11ShaderResourceView *emptyShaderResourceView = nullptr;
       device_ctx->PSSetShaderResources(0, 1, &emptyShaderResourceView);
+
+      cursor_timer.end(device_ctx.get());
     };
 
+    // The cursor has to be redrawn both where it was and where it is now
+    std::vector<RECT> cursor_rects;
+    if (blend_mouse_cursor_flag) {
+      for (auto cursor : {&cursor_alpha, &cursor_xor}) {
+        if (cursor->texture) {
+          auto &view = cursor->cursor_view;
+          cursor_rects.push_back({(LONG) view.TopLeftX, (LONG) view.TopLeftY, (LONG) (view.TopLeftX + view.Width), (LONG) (view.TopLeftY + view.Height)});
+        }
+      }
+    }
+    dirty_rects.insert(std::end(dirty_rects), std::begin(blended_cursor_rects), std::end(blended_cursor_rects));
+    dirty_rects.insert(std::end(dirty_rects), std::begin(cursor_rects), std::end(cursor_rects));
+
+    // Dummy images aren't based on the desktop, so the changes since them are unknown
+    const bool output_tracked = out_frame_action != ofa::dummy_fallback;
+    dirty_rects_valid = dirty_rects_valid && output_tracked && previous_output_tracked;
+
     switch (out_frame_action) {
       case ofa::forward_last_img:
         {
@@ -1510,7 +2508,9 @@ namespace platf::dxgi {
             return capture_e::error;
           }
 
-          device_ctx->CopyResource(d3d_img->capture_texture.get(), p_surface->get());
+          if (!copy_damaged_regions(*d3d_img, p_surface->get(), dirty_rects, dirty_rects_valid)) {
+            device_ctx->CopyResource(d3d_img->capture_texture.get(), p_surface->get());
+          }
           blend_cursor(*d3d_img);
           break;
         }
@@ -1549,6 +2549,28 @@ namespace platf::dxgi {
       old_surface_delayed_destruction.reset();
     }
 
+    // Forwarding the last image without touching it keeps its content and frame index
+    if (img_out && (out_frame_action != ofa::forward_last_img || last_frame_action != lfa::nothing)) {
+      auto d3d_img = (img_d3d_t *) img_out.get();
+
+      d3d_img->cursor.reset();
+      for (auto &rect : cursor_rects) {
+        auto &cursor = d3d_img->cursor;
+        cursor = cursor ? platf::rect_t {std::min<std::int32_t>(cursor->left, rect.left), std::min<std::int32_t>(cursor->top, rect.top), std::max<std::int32_t>(cursor->right, rect.right), std::max<std::int32_t>(cursor->bottom, rect.bottom)} :
+                          platf::rect_t {rect.left, rect.top, rect.right, rect.bottom};
+      }
+
+      blended_cursor_rects = std::move(cursor_rects);
+      last_output_tracked = output_tracked;
+
+      track_damage(*d3d_img, std::move(dirty_rects), dirty_rects_valid);
+      if (!share_across_adapters(*d3d_img)) {
+        return capture_e::error;
+      }
+    } else {
+      last_output_tracked = previous_output_tracked;
+    }
+
     if (img_out) {
       img_out->frame_timestamp = frame_timestamp;
     }
@@ -1565,6 +2587,8 @@ namespace platf::dxgi {
       return -1;
     }
 
+    select_encode_adapter();
+
     D3D11_SAMPLER_DESC sampler_desc {};
     sampler_desc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
     sampler_desc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
@@ -1632,6 +2656,8 @@ namespace platf::dxgi {
       return -1;
     }
 
+    cursor_timer.init(device.get(), "gpu_cursor"sv);
+
     device_ctx->OMSetBlendState(blend_disable.get(), nullptr, 0xFFFFFFFFu);
     device_ctx->PSSetSamplers(0, 1, &sampler_linear);
     device_ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
@@ -1673,17 +2699,24 @@ namespace platf::dxgi {
       return capture_e::reinit;
     }
 
+    // Regions that changed since the previous output image
+    std::vector<RECT> dirty_rects;
+    bool dirty_rects_valid = dup.get_dirty_rects(dirty_rects);
+    dirty_rects_valid = std::exchange(last_output_tracked, false) && dirty_rects_valid;
+
     std::shared_ptr<platf::img_t> img;
     if (!pull_free_image_cb(img)) {
       return capture_e::interrupted;
     }
 
     auto d3d_img = std::static_pointer_cast<img_d3d_t>(img);
-    d3d_img->blank = false;  // image is always ready for capture
     if (complete_img(d3d_img.get(), false) == 0) {
       texture_lock_helper lock_helper(d3d_img->capture_mutex.get());
       if (lock_helper.lock()) {
-        device_ctx->CopyResource(d3d_img->capture_texture.get(), src.get());
+        // The WGC surfaces belong to the capture device, so they're copied into the shared texture the encoder opens
+        if (!copy_damaged_regions(*d3d_img, src.get(), dirty_rects, dirty_rects_valid)) {
+          device_ctx->CopyResource(d3d_img->capture_texture.get(), src.get());
+        }
       } else {
         BOOST_LOG(error) << "Failed to lock capture texture";
         return capture_e::error;
@@ -1691,6 +2724,13 @@ namespace platf::dxgi {
     } else {
       return capture_e::error;
     }
+    d3d_img->blank = false;  // image is always ready for capture
+
+    track_damage(*d3d_img, std::move(dirty_rects), dirty_rects_valid);
+    if (!share_across_adapters(*d3d_img)) {
+      return capture_e::error;
+    }
+    last_output_tracked = true;
     img_out = img;
     if (img_out) {
       img_out->frame_timestamp = frame_timestamp;
@@ -1708,6 +2748,8 @@ namespace platf::dxgi {
       return -1;
     }
 
+    select_encode_adapter();
+
     return 0;
   }
 
@@ -1747,6 +2789,12 @@ namespace platf::dxgi {
       CloseHandle(img->encoder_texture_handle);
       img->encoder_texture_handle = nullptr;
     }
+    img->transfer_texture.reset();
+    if (img->transfer_texture_handle) {
+      CloseHandle(img->transfer_texture_handle);
+      img->transfer_texture_handle = nullptr;
+    }
+    img->transfer_value = 0;
 
     // Initialize format-dependent fields
     img->pixel_pitch = get_pixel_pitch();
@@ -1798,6 +2846,10 @@ namespace platf::dxgi {
       return -1;
     }
 
+    if (encode_adapter && !create_transfer_texture(device.get(), img->width, img->height, img->format, img->transfer_texture, img->transfer_texture_handle)) {
+      return -1;
+    }
+
     img->data = (std::uint8_t *) img->capture_texture.get();
 
     return 0;
@@ -1843,7 +2895,7 @@ namespace platf::dxgi {
    */
   bool display_vram_t::is_codec_supported(std::string_view name, const ::video::config_t &config) {
     DXGI_ADAPTER_DESC adapter_desc;
-    adapter->GetDesc(&adapter_desc);
+    (encode_adapter ? encode_adapter : adapter)->GetDesc(&adapter_desc);
 
     if (adapter_desc.VendorId == 0x1002) {  // AMD
       // If it's not an AMF encoder, it's not compatible with an AMD GPU
@@ -1921,7 +2973,7 @@ namespace platf::dxgi {
 
   std::unique_ptr<avcodec_encode_device_t> display_vram_t::make_avcodec_encode_device(pix_fmt_e pix_fmt) {
     auto device = std::make_unique<d3d_avcodec_encode_device_t>();
-    if (device->init(shared_from_this(), adapter.get(), pix_fmt) != 0) {
+    if (device->init(shared_from_this(), (encode_adapter ? encode_adapter : adapter).get(), pix_fmt) != 0) {
       return nullptr;
     }
     return device;
@@ -1929,14 +2981,14 @@ namespace platf::dxgi {
 
   std::unique_ptr<nvenc_encode_device_t> display_vram_t::make_nvenc_encode_device(pix_fmt_e pix_fmt) {
     auto device = std::make_unique<d3d_nvenc_encode_device_t>();
-    if (!device->init_device(shared_from_this(), adapter.get(), pix_fmt)) {
+    if (!device->init_device(shared_from_this(), (encode_adapter ? encode_adapter : adapter).get(), pix_fmt)) {
       return nullptr;
     }
     return device;
   }
 
   int init() {
-    BOOST_LOG(info) << "Compiling shaders..."sv;
+    BOOST_LOG(info) << "Loading shaders..."sv;
 
 #define compile_vertex_shader_helper(x) \
   if (!(x##_hlsl = compile_vertex_shader(SUNSHINE_SHADERS_DIR "/" #x ".hlsl"))) \
@@ -1971,7 +3023,18 @@ namespace platf::dxgi {
     compile_pixel_shader_helper(cursor_ps_normalize_white);
     compile_vertex_shader_helper(cursor_vs);
 
-    BOOST_LOG(info) << "Compiled shaders"sv;
+    // Without the compute shaders, conversion stays on the draw pipeline
+    if (!(convert_yuv420_type0_cs_hlsl = compile_compute_shader(SUNSHINE_SHADERS_DIR "/convert_yuv420_type0_cs.hlsl")) ||
+        !(convert_yuv420_type0_cs_linear_hlsl = compile_compute_shader(SUNSHINE_SHADERS_DIR "/convert_yuv420_type0_cs_linear.hlsl")) ||
+        !(convert_yuv420_type0_cs_perceptual_quantizer_hlsl = compile_compute_shader(SUNSHINE_SHADERS_DIR "/convert_yuv420_type0_cs_perceptual_quantizer.hlsl")) ||
+        !(convert_yuv420_type0s_cs_hlsl = compile_compute_shader(SUNSHINE_SHADERS_DIR "/convert_yuv420_type0s_cs.hlsl")) ||
+        !(convert_yuv420_type0s_cs_linear_hlsl = compile_compute_shader(SUNSHINE_SHADERS_DIR "/convert_yuv420_type0s_cs_linear.hlsl")) ||
+        !(convert_yuv420_type0s_cs_perceptual_quantizer_hlsl = compile_compute_shader(SUNSHINE_SHADERS_DIR "/convert_yuv420_type0s_cs_perceptual_quantizer.hlsl"))) {
+      BOOST_LOG(warning) << "Couldn't compile the compute shaders, converting with the draw pipeline"sv;
+      convert_yuv420_type0_cs_hlsl.reset();
+    }
+
+    BOOST_LOG(info) << "Loaded shaders"sv;
 
 #undef compile_vertex_shader_helper
 #undef compile_pixel_shader_helper
@@ -12,6 +12,10 @@
 #include <winrt/windows.foundation.h>
 #include <winrt/windows.foundation.metadata.h>
 #include <winrt/windows.graphics.directx.direct3d11.h>
+#ifdef SUNSHINE_BUILD_WGC_DIRTY_REGIONS
+  #include <winrt/windows.foundation.collections.h>
+  #include <winrt/windows.graphics.h>
+#endif
 
 // local includes
 #include "display.h"
@@ -121,7 +125,8 @@ namespace platf::dxgi {
     }
 
     try {
-      frame_pool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(uwp_device, static_cast<winrt::Windows::Graphics::DirectX::DirectXPixelFormat>(display->capture_format), 2, item.Size());
+      // One frame is held by the capture thread and one waits for it, so WGC can keep rendering into the third
+      frame_pool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(uwp_device, static_cast<winrt::Windows::Graphics::DirectX::DirectXPixelFormat>(display->capture_format), 3, item.Size());
       capture_session = frame_pool.CreateCaptureSession(item);
       frame_pool.FrameArrived({this, &wgc_capture_t::on_frame_arrived});
     } catch (winrt::hresult_error &e) {
@@ -148,6 +153,19 @@ namespace platf::dxgi {
     catch (winrt::hresult_error &e) {
       BOOST_LOG(warning) << "Screen capture may not be fully supported on this device for this release of Windows: failed to set MinUpdateInterval: [0x"sv << util::hex(e.code()).to_string_view() << ']';
     }
+#ifdef SUNSHINE_BUILD_WGC_DIRTY_REGIONS
+    try {
+      if (winrt::ApiInformation::IsPropertyPresent(L"Windows.Graphics.Capture.GraphicsCaptureSession", L"DirtyRegionMode") &&
+          winrt::ApiInformation::IsPropertyPresent(L"Windows.Graphics.Capture.Direct3D11CaptureFrame", L"DirtyRegions")) {
+        capture_session.DirtyRegionMode(winrt::GraphicsCaptureDirtyRegionMode::ReportAndRender);
+        dirty_regions_supported = true;
+      } else {
+        BOOST_LOG(info) << "WGC doesn't report dirty regions on this version of Windows, every frame is copied in full"sv;
+      }
+    } catch (winrt::hresult_error &e) {
+      BOOST_LOG(warning) << "Failed to enable WGC dirty regions: [0x"sv << util::hex(e.code()).to_string_view() << ']';
+    }
+#endif
     try {
       capture_session.StartCapture();
     } catch (winrt::hresult_error &e) {
@@ -171,9 +189,19 @@ namespace platf::dxgi {
       return;
     }
     if (frame != nullptr) {
+      std::vector<RECT> rects;
+      bool rects_valid = read_dirty_rects(frame, rects);
+
       AcquireSRWLockExclusive(&frame_lock);
       if (produced_frame) {
         produced_frame.Close();
+
+        // The consumer never sees the dropped frame, so its changes carry over
+        produced_dirty_rects.insert(std::end(produced_dirty_rects), std::begin(rects), std::end(rects));
+        produced_dirty_rects_valid = produced_dirty_rects_valid && rects_valid;
+      } else {
+        produced_dirty_rects = std::move(rects);
+        produced_dirty_rects_valid = rects_valid;
       }
 
       produced_frame = frame;
@@ -205,6 +233,9 @@ namespace platf::dxgi {
     if (produced_frame) {
       consumed_frame = produced_frame;
       produced_frame = nullptr;
+      consumed_dirty_rects = std::move(produced_dirty_rects);
+      consumed_dirty_rects_valid = produced_dirty_rects_valid;
+      produced_dirty_rects.clear();
     }
     ReleaseSRWLockExclusive(&frame_lock);
     if (consumed_frame == nullptr) {  // spurious wakeup
@@ -220,6 +251,35 @@ namespace platf::dxgi {
     return capture_e::ok;
   }
 
+  bool wgc_capture_t::read_dirty_rects(const winrt::Direct3D11CaptureFrame &frame, std::vector<RECT> &rects) {
+#ifdef SUNSHINE_BUILD_WGC_DIRTY_REGIONS
+    if (!dirty_regions_supported) {
+      return false;
+    }
+
+    try {
+      for (auto region : frame.DirtyRegions()) {
+        rects.push_back({region.X, region.Y, region.X + region.Width, region.Y + region.Height});
+      }
+      return true;
+    } catch (winrt::hresult_error &) {
+      rects.clear();
+      return false;
+    }
+#else
+    return false;
+#endif
+  }
+
+  bool wgc_capture_t::get_dirty_rects(std::vector<RECT> &rects) {
+    if (consumed_frame == nullptr || !consumed_dirty_rects_valid) {
+      return false;
+    }
+
+    rects.insert(std::end(rects), std::begin(consumed_dirty_rects), std::end(consumed_dirty_rects));
+    return true;
+  }
+
   capture_e wgc_capture_t::release_frame() {
     if (consumed_frame != nullptr) {
       consumed_frame.Close();
@@ -256,11 +316,22 @@ namespace platf::dxgi {
    * @param cursor_visible whether to capture the cursor
    */
   capture_e display_wgc_ram_t::snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) {
-    HRESULT status;
     texture2d_t src;
     uint64_t frame_qpc;
     dup.set_cursor_visible(cursor_visible);
+
+    // Don't hold a copied frame back until the display changes again
+    if (staging_pending()) {
+      timeout = std::min(timeout, staging_poll_timeout);
+    }
+
     auto capture_status = dup.next_frame(timeout, &src, frame_qpc);
+
+    // The display is idle, so waiting for the pending copy costs nothing
+    if (capture_status == capture_e::timeout) {
+      return read_staging(pull_free_image_cb, img_out, staging_fallback_e::wait);
+    }
+
     if (capture_status != capture_e::ok) {
       return capture_status;
     }
@@ -269,25 +340,12 @@ namespace platf::dxgi {
     D3D11_TEXTURE2D_DESC desc;
     src->GetDesc(&desc);
 
-    // Create the staging texture if it doesn't exist. It should match the source in size and format.
-    if (texture == nullptr) {
+    // Create the staging textures if they don't exist. They should match the source in size and format.
+    if (staging.front().texture == nullptr) {
       capture_format = desc.Format;
       BOOST_LOG(info) << "Capture format ["sv << dxgi_format_to_string(capture_format) << ']';
 
-      D3D11_TEXTURE2D_DESC t {};
-      t.Width = width;
-      t.Height = height;
-      t.MipLevels = 1;
-      t.ArraySize = 1;
-      t.SampleDesc.Count = 1;
-      t.Usage = D3D11_USAGE_STAGING;
-      t.Format = capture_format;
-      t.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-
-      auto status = device->CreateTexture2D(&t, nullptr, &texture);
-
-      if (FAILED(status)) {
-        BOOST_LOG(error) << "Failed to create staging texture [0x"sv << util::hex(status).to_string_view() << ']';
+      if (init_staging()) {
         return capture_e::error;
       }
     }
@@ -305,39 +363,10 @@ namespace platf::dxgi {
       return capture_e::reinit;
     }
 
-    // Copy from GPU to CPU
-    device_ctx->CopyResource(texture.get(), src.get());
-
-    if (!pull_free_image_cb(img_out)) {
-      return capture_e::interrupted;
-    }
-    auto img = (img_t *) img_out.get();
-
-    // Map the staging texture for CPU access (making it inaccessible for the GPU)
-    if (FAILED(status = device_ctx->Map(texture.get(), 0, D3D11_MAP_READ, 0, &img_info))) {
-      BOOST_LOG(error) << "Failed to map texture [0x"sv << util::hex(status).to_string_view() << ']';
+    // Copy from GPU to CPU, the frame is read back once the copy has completed
+    queue_staging(src.get(), frame_timestamp);
 
-      return capture_e::error;
-    }
-
-    // Now that we know the capture format, we can finish creating the image
-    if (complete_img(img, false)) {
-      device_ctx->Unmap(texture.get(), 0);
-      img_info.pData = nullptr;
-      return capture_e::error;
-    }
-
-    std::copy_n((std::uint8_t *) img_info.pData, height * img_info.RowPitch, (std::uint8_t *) img->data);
-
-    // Unmap the staging texture to allow GPU access again
-    device_ctx->Unmap(texture.get(), 0);
-    img_info.pData = nullptr;
-
-    if (img) {
-      img->frame_timestamp = frame_timestamp;
-    }
-
-    return capture_e::ok;
+    return read_staging(pull_free_image_cb, img_out, staging_fallback_e::none);
   }
 
   capture_e display_wgc_ram_t::release_snapshot() {
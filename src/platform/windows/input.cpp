@@ -10,6 +10,7 @@
 // standard includes
 #include <cmath>
 #include <thread>
+#include <vector>
 
 // lib includes
 #include <ViGEm/Client.h>
@@ -447,6 +448,10 @@ namespace platf {
 
     vigem_t *vigem;
 
+    // Keyboard and mouse events queued between begin_input_batch() and end_input_batch()
+    std::vector<INPUT> batch;
+    bool batching = false;
+
     decltype(CreateSyntheticPointerDevice) *fnCreateSyntheticPointerDevice;
     decltype(InjectSyntheticPointerInput) *fnInjectSyntheticPointerInput;
     decltype(DestroySyntheticPointerDevice) *fnDestroySyntheticPointerDevice;
@@ -472,18 +477,73 @@ namespace platf {
 
   /**
    * @brief Calls SendInput() and switches input desktops if required.
-   * @param i The `INPUT` struct to send.
+   * @param inputs The `INPUT` structs to send.
+   * @param count The number of elements in `inputs`.
    */
-  void send_input(INPUT &i) {
-  retry:
-    auto send = SendInput(1, &i, sizeof(INPUT));
-    if (send != 1) {
+  void send_inputs(INPUT *inputs, UINT count) {
+    UINT sent = 0;
+    while (sent < count) {
+      sent += SendInput(count - sent, inputs + sent, sizeof(INPUT));
+      if (sent == count) {
+        break;
+      }
+
+      // The desktop is only looked up once an event is refused
       auto hDesk = syncThreadDesktop();
       if (_lastKnownInputDesktop != hDesk) {
         _lastKnownInputDesktop = hDesk;
-        goto retry;
+        continue;
       }
       BOOST_LOG(error) << "Couldn't send input"sv;
+
+      // Skip the refused event and carry on with the rest of the batch
+      ++sent;
+    }
+  }
+
+  /**
+   * @brief Sends an input event, or queues it while a batch is open.
+   * @details Queued mouse movements are merged into the movement before them,
+   *          so each batch moves the mouse once per run of movements.
+   * @param input The global input context.
+   * @param i The `INPUT` struct to send.
+   */
+  void send_input(input_t &input, INPUT &i) {
+    auto raw = (input_raw_t *) input.get();
+    if (!raw->batching) {
+      send_inputs(&i, 1);
+      return;
+    }
+
+    if (!raw->batch.empty() && i.type == INPUT_MOUSE && raw->batch.back().type == INPUT_MOUSE) {
+      auto &last = raw->batch.back().mi;
+      if (i.mi.dwFlags == MOUSEEVENTF_MOVE && last.dwFlags == MOUSEEVENTF_MOVE) {
+        last.dx += i.mi.dx;
+        last.dy += i.mi.dy;
+        return;
+      }
+      if ((i.mi.dwFlags & MOUSEEVENTF_ABSOLUTE) && i.mi.dwFlags == last.dwFlags) {
+        last.dx = i.mi.dx;
+        last.dy = i.mi.dy;
+        return;
+      }
+    }
+
+    raw->batch.push_back(i);
+  }
+
+  void begin_input_batch(input_t &input) {
+    auto raw = (input_raw_t *) input.get();
+    raw->batching = true;
+  }
+
+  void end_input_batch(input_t &input) {
+    auto raw = (input_raw_t *) input.get();
+    raw->batching = false;
+
+    if (!raw->batch.empty()) {
+      send_inputs(raw->batch.data(), raw->batch.size());
+      raw->batch.clear();
     }
   }
 
@@ -528,7 +588,7 @@ namespace platf {
     mi.dx = scaled_x;
     mi.dy = scaled_y;
 
-    send_input(i);
+    send_input(input, i);
   }
 
   void move_mouse(input_t &input, int deltaX, int deltaY) {
@@ -541,7 +601,7 @@ namespace platf {
     mi.dx = deltaX;
     mi.dy = deltaY;
 
-    send_input(i);
+    send_input(input, i);
   }
 
   util::point_t get_mouse_loc(input_t &input) {
@@ -578,7 +638,7 @@ namespace platf {
       mi.mouseData = XBUTTON2;
     }
 
-    send_input(i);
+    send_input(input, i);
   }
 
   void scroll(input_t &input, int distance) {
@@ -590,7 +650,7 @@ namespace platf {
     mi.dwFlags = MOUSEEVENTF_WHEEL;
     mi.mouseData = distance;
 
-    send_input(i);
+    send_input(input, i);
   }
 
   void hscroll(input_t &input, int distance) {
@@ -602,7 +662,7 @@ namespace platf {
     mi.dwFlags = MOUSEEVENTF_HWHEEL;
     mi.mouseData = distance;
 
-    send_input(i);
+    send_input(input, i);
   }
 
   void keyboard_update(input_t &input, uint16_t modcode, bool release, uint8_t flags) {
@@ -657,7 +717,7 @@ namespace platf {
       ki.dwFlags |= KEYEVENTF_KEYUP;
     }
 
-    send_input(i);
+    send_input(input, i);
   }
 
   struct client_input_raw_t: public client_input_t {
@@ -1154,21 +1214,21 @@ namespace platf {
     }
 
     // Send all key down events
-    for (int i = 0; i < chars; i++) {
-      INPUT input {};
-      input.type = INPUT_KEYBOARD;
-      input.ki.wScan = wide[i];
-      input.ki.dwFlags = KEYEVENTF_UNICODE;
-      send_input(input);
+    for (int x = 0; x < chars; x++) {
+      INPUT i {};
+      i.type = INPUT_KEYBOARD;
+      i.ki.wScan = wide[x];
+      i.ki.dwFlags = KEYEVENTF_UNICODE;
+      send_input(input, i);
     }
 
     // Send all key up events
-    for (int i = 0; i < chars; i++) {
-      INPUT input {};
-      input.type = INPUT_KEYBOARD;
-      input.ki.wScan = wide[i];
-      input.ki.dwFlags = KEYEVENTF_UNICODE | KEYEVENTF_KEYUP;
-      send_input(input);
+    for (int x = 0; x < chars; x++) {
+      INPUT i {};
+      i.type = INPUT_KEYBOARD;
+      i.ki.wScan = wide[x];
+      i.ki.dwFlags = KEYEVENTF_UNICODE | KEYEVENTF_KEYUP;
+      send_input(input, i);
     }
   }
 
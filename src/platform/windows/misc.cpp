@@ -3,12 +3,16 @@
  * @brief Miscellaneous definitions for Windows.
  */
 // standard includes
+#include <algorithm>
+#include <cmath>
 #include <csignal>
 #include <filesystem>
 #include <iomanip>
 #include <iterator>
+#include <map>
 #include <set>
 #include <sstream>
+#include <thread>
 
 #ifndef BOOST_PROCESS_VERSION
  #define BOOST_PROCESS_VERSION 1
@@ -17,6 +21,7 @@
 // lib includes
 #include <boost/algorithm/string.hpp>
 #include <boost/asio/ip/address.hpp>
+#include <boost/asio/ip/udp.hpp>
 #include <boost/process/v1/child.hpp>
 #include <boost/process/v1/group.hpp>
 #include <boost/process/v1/environment.hpp>
@@ -34,6 +39,7 @@
 #include <WinUser.h>
 #include <wlanapi.h>
 #include <WS2tcpip.h>
+#include <mswsock.h>
 #include <WtsApi32.h>
 #include <sddl.h>
 // clang-format on
@@ -42,6 +48,10 @@
 #undef NTDDI_VERSION
 #define NTDDI_VERSION NTDDI_WIN10
 #include <Shlwapi.h>
+#include <avrt.h>
+#include <malloc.h>
+#include <pdh.h>
+#include <powrprof.h>
 
 // local includes
 #include "misc.h"
@@ -51,6 +61,7 @@
 #include "src/globals.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
+#include "src/platform/nvml.h"
 #include "src/utility.h"
 
 // UDP_SEND_MSG_SIZE was added in the Windows 10 20H1 SDK
@@ -112,11 +123,15 @@ namespace platf {
   bool enabled_mouse_keys = false;
   MOUSEKEYS previous_mouse_keys_state;
 
+  bool changed_power_scheme = false;
+  GUID previous_power_scheme;
+
   HANDLE qos_handle = nullptr;
 
   decltype(QOSCreateHandle) *fn_QOSCreateHandle = nullptr;
   decltype(QOSAddSocketToFlow) *fn_QOSAddSocketToFlow = nullptr;
   decltype(QOSRemoveSocketFromFlow) *fn_QOSRemoveSocketFromFlow = nullptr;
+  decltype(QOSSetFlow) *fn_QOSSetFlow = nullptr;
 
   HANDLE wlan_handle = nullptr;
 
@@ -193,6 +208,20 @@ namespace platf {
     return "00:00:00:00:00:00"s;
   }
 
+  std::uint64_t get_link_speed(const std::string_view &address) {
+    adapteraddrs_t info = get_adapteraddrs();
+    for (auto adapter_pos = info.get(); adapter_pos != nullptr; adapter_pos = adapter_pos->Next) {
+      for (auto addr_pos = adapter_pos->FirstUnicastAddress; addr_pos != nullptr; addr_pos = addr_pos->Next) {
+        if (address == from_sockaddr(addr_pos->Address.lpSockaddr)) {
+          // ULONG64_MAX means the speed is unknown
+          return adapter_pos->TransmitLinkSpeed == std::numeric_limits<ULONG64>::max() ? 0 : adapter_pos->TransmitLinkSpeed;
+        }
+      }
+    }
+
+    return 0;
+  }
+
   std::string get_local_ip_for_gateway() {
     PIP_ADAPTER_INFO pAdapterInfo;
     PIP_ADAPTER_INFO pAdapter = nullptr;
@@ -1105,6 +1134,140 @@ namespace platf {
     }
   }
 
+  bool set_thread_affinity(const std::vector<int> &cores) {
+    // Only processor group 0 is supported, it holds every core on systems with at most 64 of them
+    DWORD_PTR mask = 0;
+    for (auto core : cores) {
+      if (core < (int) sizeof(mask) * 8) {
+        mask |= (DWORD_PTR) 1 << core;
+      }
+    }
+
+    if (!mask || !SetThreadAffinityMask(GetCurrentThread(), mask)) {
+      auto winerr = GetLastError();
+      BOOST_LOG(warning) << "Unable to set thread affinity mask to 0x"sv << util::hex(mask).to_string_view() << ": "sv << winerr;
+      return false;
+    }
+
+    return true;
+  }
+
+  void set_thread_mmcss_task(const std::string &task) {
+    /**
+     * @brief Keeps the calling thread registered with MMCSS until it exits.
+     */
+    struct mmcss_registration_t {
+      HANDLE handle = nullptr;
+
+      ~mmcss_registration_t() {
+        if (handle) {
+          AvRevertMmThreadCharacteristics(handle);
+        }
+      }
+    };
+
+    thread_local mmcss_registration_t registration;
+    if (registration.handle) {
+      return;
+    }
+
+    DWORD task_index = 0;
+    registration.handle = AvSetMmThreadCharacteristicsW(from_utf8(task).c_str(), &task_index);
+    if (!registration.handle) {
+      auto winerr = GetLastError();
+      BOOST_LOG(warning) << "Unable to register thread with MMCSS task ["sv << task << "]: "sv << winerr;
+    }
+  }
+
+  std::vector<int> numa_node_cores(int node) {
+    GROUP_AFFINITY affinity {};
+    if (!GetNumaNodeProcessorMaskEx((USHORT) node, &affinity) || affinity.Group != 0) {
+      return {};
+    }
+
+    std::vector<int> cores;
+    for (int core = 0; core < (int) sizeof(affinity.Mask) * 8; ++core) {
+      if (affinity.Mask & ((KAFFINITY) 1 << core)) {
+        cores.emplace_back(core);
+      }
+    }
+
+    return cores;
+  }
+
+  std::vector<std::vector<int>> cpu_cache_domains() {
+    DWORD size = 0;
+    GetLogicalProcessorInformationEx(RelationCache, nullptr, &size);
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+      return {};
+    }
+
+    std::vector<std::uint8_t> buffer(size);
+    if (!GetLogicalProcessorInformationEx(RelationCache, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) buffer.data(), &size)) {
+      return {};
+    }
+
+    std::vector<std::vector<int>> domains;
+    for (DWORD offset = 0; offset < size;) {
+      auto info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) (buffer.data() + offset);
+      offset += info->Size;
+
+      auto &cache = info->Cache;
+      if (cache.Level != 3 || cache.GroupMask.Group != 0) {
+        continue;
+      }
+
+      auto &domain = domains.emplace_back();
+      for (int core = 0; core < (int) sizeof(cache.GroupMask.Mask) * 8; ++core) {
+        if (cache.GroupMask.Mask & ((KAFFINITY) 1 << core)) {
+          domain.emplace_back(core);
+        }
+      }
+    }
+
+    return domains;
+  }
+
+  std::vector<double> cpu_core_load(std::chrono::milliseconds interval) {
+    // Kernel time includes the idle time
+    auto sample = []() {
+      std::vector<SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION> times(GetActiveProcessorCount(0));
+
+      ULONG size = 0;
+      if (NtQuerySystemInformation(SystemProcessorPerformanceInformation, times.data(), (ULONG) (times.size() * sizeof(times[0])), &size) < 0) {
+        return decltype(times) {};
+      }
+      times.resize(size / sizeof(times[0]));
+
+      return times;
+    };
+
+    auto before = sample();
+    std::this_thread::sleep_for(interval);
+    auto after = sample();
+
+    std::vector<double> load(std::min(before.size(), after.size()));
+    for (std::size_t x = 0; x < load.size(); ++x) {
+      auto idle = after[x].IdleTime.QuadPart - before[x].IdleTime.QuadPart;
+      auto total = (after[x].KernelTime.QuadPart - before[x].KernelTime.QuadPart) + (after[x].UserTime.QuadPart - before[x].UserTime.QuadPart);
+      load[x] = total > 0 ? (double) (total - idle) / total : 0.0;
+    }
+
+    return load;
+  }
+
+  int gpu_numa_node() {
+    // DXGI doesn't expose the NUMA node of an adapter
+    return -1;
+  }
+
+  void trim_memory() {
+    // Coalesce the free blocks of the heaps, then let the pages that aren't touched again go
+    HeapCompact(GetProcessHeap(), 0);
+    _heapmin();
+    SetProcessWorkingSetSize(GetCurrentProcess(), (SIZE_T) -1, (SIZE_T) -1);
+  }
+
   void streaming_will_start() {
     static std::once_flag load_wlanapi_once_flag;
     std::call_once(load_wlanapi_once_flag, []() {
@@ -1150,6 +1313,26 @@ namespace platf {
     // Promote ourselves to high priority class
     SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
 
+    // The High Performance scheme doesn't park cores and boosts the processors right away
+    if (config::stream.performance_power_profile && !changed_power_scheme) {
+      GUID *active_scheme = nullptr;
+      if (PowerGetActiveScheme(nullptr, &active_scheme) == ERROR_SUCCESS) {
+        previous_power_scheme = *active_scheme;
+        LocalFree(active_scheme);
+
+        if (!IsEqualGUID(previous_power_scheme, GUID_MIN_POWER_SAVINGS)) {
+          // Hidden on systems with Modern Standby, unless it was added back
+          auto error = PowerSetActiveScheme(nullptr, &GUID_MIN_POWER_SAVINGS);
+          if (error == ERROR_SUCCESS) {
+            changed_power_scheme = true;
+            BOOST_LOG(info) << "Switched to the High Performance power scheme"sv;
+          } else {
+            BOOST_LOG(warning) << "Unable to switch to the High Performance power scheme: "sv << error;
+          }
+        }
+      }
+    }
+
     // Modify NVIDIA control panel settings again, in case they have been changed externally since sunshine launch
     if (nvprefs_instance.load()) {
       if (!nvprefs_instance.owning_undo_file()) {
@@ -1223,6 +1406,12 @@ namespace platf {
     // Demote ourselves back to normal priority class
     SetPriorityClass(GetCurrentProcess(), NORMAL_PRIORITY_CLASS);
 
+    // Restore the power scheme that was active before streaming
+    if (changed_power_scheme) {
+      changed_power_scheme = false;
+      PowerSetActiveScheme(nullptr, &previous_power_scheme);
+    }
+
     // End our 0.5ms timer request
     if (used_nt_set_timer_resolution) {
       used_nt_set_timer_resolution = false;
@@ -1378,6 +1567,103 @@ namespace platf {
     return accounting_info.ActiveProcesses != 0;
   }
 
+  /**
+   * @brief Waits for the app to exit on a separate thread, the wait ends early once `stop()` is called.
+   */
+  class app_exit_watcher_t: public deinit_t {
+  public:
+    template<class W, class S>
+    app_exit_watcher_t(W &&wait, S &&stop):
+        stop(std::forward<S>(stop)),
+        thread(std::forward<W>(wait)) {
+    }
+
+    ~app_exit_watcher_t() override {
+      stop();
+      thread.join();
+    }
+
+  private:
+    std::function<void()> stop;
+    std::thread thread;
+  };
+
+  std::unique_ptr<deinit_t> watch_app_exit(bp::child &child, bp::group *group, std::function<void()> on_exit) {
+    if (group) {
+      // The job reports once its last process exited through a completion port
+      HANDLE port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+      if (!port) {
+        BOOST_LOG(warning) << "Failed to create a completion port for the app job: "sv << GetLastError();
+        return nullptr;
+      }
+
+      JOBOBJECT_ASSOCIATE_COMPLETION_PORT port_info {};
+      port_info.CompletionKey = group->native_handle();
+      port_info.CompletionPort = port;
+      if (!SetInformationJobObject(group->native_handle(), JobObjectAssociateCompletionPortInformation, &port_info, sizeof(port_info))) {
+        BOOST_LOG(warning) << "Failed to associate the app job with a completion port: "sv << GetLastError();
+        CloseHandle(port);
+        return nullptr;
+      }
+
+      // The job may have emptied out before the port got associated
+      if (!process_group_running((std::uintptr_t) group->native_handle())) {
+        PostQueuedCompletionStatus(port, JOB_OBJECT_MSG_ACTIVE_PROCESS_ZERO, (ULONG_PTR) group->native_handle(), nullptr);
+      }
+
+      auto job = (ULONG_PTR) group->native_handle();
+      return std::make_unique<app_exit_watcher_t>(
+        [port, job, on_exit = std::move(on_exit)]() {
+          DWORD message;
+          ULONG_PTR key;
+          LPOVERLAPPED overlapped;
+          while (GetQueuedCompletionStatus(port, &message, &key, &overlapped, INFINITE)) {
+            if (key != job) {
+              // Posted by stop()
+              break;
+            }
+
+            if (message == JOB_OBJECT_MSG_ACTIVE_PROCESS_ZERO) {
+              on_exit();
+              break;
+            }
+          }
+
+          CloseHandle(port);
+        },
+        [port]() {
+          PostQueuedCompletionStatus(port, 0, 0, nullptr);
+        }
+      );
+    }
+
+    HANDLE stop_event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!stop_event) {
+      return nullptr;
+    }
+
+    HANDLE process;
+    if (!DuplicateHandle(GetCurrentProcess(), child.native_handle(), GetCurrentProcess(), &process, SYNCHRONIZE, FALSE, 0)) {
+      CloseHandle(stop_event);
+      return nullptr;
+    }
+
+    return std::make_unique<app_exit_watcher_t>(
+      [process, stop_event, on_exit = std::move(on_exit)]() {
+        HANDLE handles[] {process, stop_event};
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0) {
+          on_exit();
+        }
+
+        CloseHandle(process);
+        CloseHandle(stop_event);
+      },
+      [stop_event]() {
+        SetEvent(stop_event);
+      }
+    );
+  }
+
   SOCKADDR_IN to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     SOCKADDR_IN saddr_v4 = {};
 
@@ -1403,9 +1689,343 @@ namespace platf {
     return saddr_v6;
   }
 
+  bool enable_send_txtime(std::uintptr_t native_socket) {
+    return false;
+  }
+
+  /**
+   * @brief Fill in the source address and, for segmented batches, the datagram size of a batched send.
+   * @param msg Message whose zeroed control buffer receives the options.
+   * @param send_info The batch.
+   * @param segment_size Size of each datagram for UDP segmentation offload, 0 to send a single datagram.
+   * @return Length of the control data.
+   */
+  ULONG fill_batch_control(WSAMSG &msg, const batched_send_info_t &send_info, DWORD segment_size) {
+    ULONG cmbuflen = 0;
+
+    auto cm = WSA_CMSG_FIRSTHDR(&msg);
+    if (send_info.source_address.is_v6()) {
+      IN6_PKTINFO pktInfo;
+
+      SOCKADDR_IN6 saddr_v6 = to_sockaddr(send_info.source_address.to_v6(), 0);
+      pktInfo.ipi6_addr = saddr_v6.sin6_addr;
+      pktInfo.ipi6_ifindex = 0;
+
+      cmbuflen += WSA_CMSG_SPACE(sizeof(pktInfo));
+
+      cm->cmsg_level = IPPROTO_IPV6;
+      cm->cmsg_type = IPV6_PKTINFO;
+      cm->cmsg_len = WSA_CMSG_LEN(sizeof(pktInfo));
+      memcpy(WSA_CMSG_DATA(cm), &pktInfo, sizeof(pktInfo));
+    } else {
+      IN_PKTINFO pktInfo;
+
+      SOCKADDR_IN saddr_v4 = to_sockaddr(send_info.source_address.to_v4(), 0);
+      pktInfo.ipi_addr = saddr_v4.sin_addr;
+      pktInfo.ipi_ifindex = 0;
+
+      cmbuflen += WSA_CMSG_SPACE(sizeof(pktInfo));
+
+      cm->cmsg_level = IPPROTO_IP;
+      cm->cmsg_type = IP_PKTINFO;
+      cm->cmsg_len = WSA_CMSG_LEN(sizeof(pktInfo));
+      memcpy(WSA_CMSG_DATA(cm), &pktInfo, sizeof(pktInfo));
+    }
+
+    if (segment_size) {
+      cmbuflen += WSA_CMSG_SPACE(sizeof(DWORD));
+
+      cm = WSA_CMSG_NXTHDR(&msg, cm);
+      cm->cmsg_level = IPPROTO_UDP;
+      cm->cmsg_type = UDP_SEND_MSG_SIZE;
+      cm->cmsg_len = WSA_CMSG_LEN(sizeof(DWORD));
+      *((DWORD *) WSA_CMSG_DATA(cm)) = segment_size;
+    }
+
+    return cmbuflen;
+  }
+
+  namespace {
+    constexpr int RIO_SLOTS = 16;  ///< Batches that may be in flight at once
+    constexpr int RIO_MAX_SENDS_PER_SLOT = 64;  ///< Datagrams of a batch sent without segmentation offload
+
+    /**
+     * @brief Registered memory holding one batch and its send parameters.
+     */
+    struct rio_slot_t {
+      char data[64 * 1024];
+      SOCKADDR_INET remote;
+      alignas(8) char control[WSA_CMSG_SPACE(sizeof(DWORD)) + WSA_CMSG_SPACE(sizeof(IN6_PKTINFO))];
+    };
+
+    /**
+     * @brief Registered I/O queues and buffers of a socket.
+     */
+    struct rio_socket_t {
+      ~rio_socket_t() {
+        if (cq != RIO_INVALID_CQ) {
+          rio.RIOCloseCompletionQueue(cq);
+        }
+        if (buffer_id != RIO_INVALID_BUFFERID) {
+          rio.RIODeregisterBuffer(buffer_id);
+        }
+        if (slots) {
+          VirtualFree(slots, 0, MEM_RELEASE);
+        }
+      }
+
+      /**
+       * @brief Reap finished sends from the completion queue.
+       * @return `false` if the completion queue is corrupt.
+       */
+      bool reap() {
+        RIORESULT results[64];
+        ULONG count;
+        while ((count = rio.RIODequeueCompletion(cq, results, ARRAYSIZE(results))) > 0) {
+          if (count == RIO_CORRUPT_CQ) {
+            return false;
+          }
+
+          for (ULONG i = 0; i < count; i++) {
+            if (results[i].Status) {
+              BOOST_LOG(verbose) << "Registered I/O send failed: "sv << results[i].Status;
+            }
+            pending[results[i].RequestContext]--;
+          }
+        }
+
+        return true;
+      }
+
+      /**
+       * @brief Get the next slot, waiting for its previous sends to finish.
+       * @return The slot index, or -1 if the completion queue is corrupt.
+       */
+      int acquire_slot() {
+        auto slot = next_slot;
+        while (pending[slot]) {
+          if (!reap()) {
+            return -1;
+          }
+          if (pending[slot]) {
+            std::this_thread::yield();
+          }
+        }
+
+        next_slot = (slot + 1) % RIO_SLOTS;
+        return slot;
+      }
+
+      /**
+       * @brief Describe a part of a slot's registered memory.
+       */
+      RIO_BUF slice(const void *ptr, ULONG length) const {
+        return {buffer_id, (ULONG) ((const char *) ptr - (const char *) slots), length};
+      }
+
+      SOCKET socket = INVALID_SOCKET;
+      RIO_EXTENSION_FUNCTION_TABLE rio = {};
+      RIO_CQ cq = RIO_INVALID_CQ;
+      RIO_RQ rq = RIO_INVALID_RQ;
+      RIO_BUFFERID buffer_id = RIO_INVALID_BUFFERID;
+      rio_slot_t *slots = nullptr;
+      std::array<int, RIO_SLOTS> pending {};  ///< Sends of each slot that haven't completed yet
+      int next_slot = 0;
+      bool uso = false;  ///< Whether batches are sent as a single segmented datagram
+    };
+
+    // A request queue isn't thread-safe, so sends of all workers go through this lock
+    std::mutex rio_mutex;
+    std::map<SOCKET, rio_socket_t *> rio_sockets;
+
+    class rio_deinit_t: public deinit_t {
+    public:
+      explicit rio_deinit_t(std::unique_ptr<rio_socket_t> &&state):
+          state {std::move(state)} {
+      }
+
+      ~rio_deinit_t() override {
+        std::lock_guard lg {rio_mutex};
+        rio_sockets.erase(state->socket);
+
+        // The completion queue can only be closed once the network stack is done with the buffers
+        auto deadline = std::chrono::steady_clock::now() + 100ms;
+        while (std::any_of(state->pending.begin(), state->pending.end(), [](int pending) {
+          return pending > 0;
+        })) {
+          if (!state->reap() || std::chrono::steady_clock::now() > deadline) {
+            break;
+          }
+          std::this_thread::yield();
+        }
+      }
+
+    private:
+      std::unique_ptr<rio_socket_t> state;
+    };
+
+    /**
+     * @brief Send a batch through a slot of registered memory.
+     * @param state The socket's queues, `rio_mutex` must be held.
+     * @param send_info The batch, small enough for a slot.
+     * @return `true` if the batch was queued.
+     */
+    bool rio_send_batch(rio_socket_t &state, batched_send_info_t &send_info) {
+      auto slot_index = state.acquire_slot();
+      if (slot_index < 0) {
+        BOOST_LOG(error) << "Registered I/O completion queue is corrupt"sv;
+        return false;
+      }
+      auto &slot = state.slots[slot_index];
+
+      // Gather headers and payloads into the registered memory
+      auto block_size = send_info.header_size + send_info.payload_size;
+      for (size_t i = 0; i < send_info.block_count; i++) {
+        auto block = send_info.block_offset + i;
+        auto dest = slot.data + i * block_size;
+        if (send_info.headers) {
+          memcpy(dest, &send_info.headers[block * send_info.header_size], send_info.header_size);
+        }
+        auto payload_desc = send_info.buffer_for_payload_offset(block * send_info.payload_size);
+        memcpy(dest + send_info.header_size, payload_desc.buffer, send_info.payload_size);
+      }
+
+      if (send_info.target_address.is_v6()) {
+        slot.remote.Ipv6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
+      } else {
+        slot.remote.Ipv4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
+      }
+      auto remote = state.slice(&slot.remote, sizeof(slot.remote));
+
+      WSAMSG msg = {};
+      msg.Control.buf = slot.control;
+      msg.Control.len = sizeof(slot.control);
+
+      if (state.uso && send_info.block_count > 1) {
+        memset(slot.control, 0, sizeof(slot.control));
+        auto control = state.slice(slot.control, fill_batch_control(msg, send_info, block_size));
+        auto data = state.slice(slot.data, send_info.block_count * block_size);
+
+        if (state.rio.RIOSendEx(state.rq, &data, 1, nullptr, &remote, &control, nullptr, 0, slot_index)) {
+          state.pending[slot_index] = 1;
+          return true;
+        }
+
+        // USO isn't supported on this path, keep using registered buffers for unsegmented sends
+        BOOST_LOG(warning) << "Registered I/O segmented send failed, sending datagrams individually: "sv << WSAGetLastError();
+        state.uso = false;
+      }
+
+      memset(slot.control, 0, sizeof(slot.control));
+      auto control = state.slice(slot.control, fill_batch_control(msg, send_info, 0));
+
+      // Queue every datagram and let the last one commit the batch
+      for (size_t i = 0; i < send_info.block_count; i++) {
+        auto data = state.slice(slot.data + i * block_size, block_size);
+        DWORD flags = i + 1 < send_info.block_count ? RIO_MSG_DEFER : 0;
+
+        if (!state.rio.RIOSendEx(state.rq, &data, 1, nullptr, &remote, &control, nullptr, flags, slot_index)) {
+          BOOST_LOG(verbose) << "Registered I/O send failed: "sv << WSAGetLastError();
+          if (i == 0) {
+            return false;
+          }
+
+          // The datagrams already queued still have to go out, the rest are lost like any dropped packet
+          state.rio.RIOSendEx(state.rq, nullptr, 0, nullptr, nullptr, nullptr, nullptr, RIO_MSG_COMMIT_ONLY, 0);
+          return true;
+        }
+        state.pending[slot_index]++;
+      }
+
+      return true;
+    }
+  }  // namespace
+
+  std::unique_ptr<deinit_t> open_registered_io_socket(bool v6, std::uintptr_t &native_socket) {
+    auto sock = WSASocketW(v6 ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0, WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+    if (sock == INVALID_SOCKET) {
+      BOOST_LOG(warning) << "Couldn't create a Registered I/O socket: "sv << WSAGetLastError();
+      return nullptr;
+    }
+
+    auto close_socket = util::fail_guard([sock]() {
+      closesocket(sock);
+    });
+
+    if (v6) {
+      // Accept IPv4 clients as well, like Boost.Asio does for the IPv6 sockets it opens
+      DWORD v6only = 0;
+      setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (const char *) &v6only, sizeof(v6only));
+    }
+
+    auto state = std::make_unique<rio_socket_t>();
+    state->socket = sock;
+
+    GUID rio_id = WSAID_MULTIPLE_RIO;
+    DWORD bytes;
+    state->rio.cbSize = sizeof(state->rio);
+    if (WSAIoctl(sock, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &rio_id, sizeof(rio_id), &state->rio, sizeof(state->rio), &bytes, nullptr, nullptr)) {
+      BOOST_LOG(warning) << "Registered I/O is unavailable: "sv << WSAGetLastError();
+      return nullptr;
+    }
+
+    // Page aligned memory, so registering it locks as few pages as possible
+    state->slots = (rio_slot_t *) VirtualAlloc(nullptr, sizeof(rio_slot_t) * RIO_SLOTS, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!state->slots) {
+      BOOST_LOG(warning) << "Couldn't allocate Registered I/O buffers: "sv << GetLastError();
+      return nullptr;
+    }
+
+    state->buffer_id = state->rio.RIORegisterBuffer((PCHAR) state->slots, sizeof(rio_slot_t) * RIO_SLOTS);
+    if (state->buffer_id == RIO_INVALID_BUFFERID) {
+      BOOST_LOG(warning) << "Couldn't register Registered I/O buffers: "sv << WSAGetLastError();
+      return nullptr;
+    }
+
+    // Completions are polled by the sending thread, no notification is needed
+    constexpr DWORD max_sends = RIO_SLOTS * RIO_MAX_SENDS_PER_SLOT;
+    state->cq = state->rio.RIOCreateCompletionQueue(max_sends + 1, nullptr);
+    if (state->cq == RIO_INVALID_CQ) {
+      BOOST_LOG(warning) << "Couldn't create a Registered I/O completion queue: "sv << WSAGetLastError();
+      return nullptr;
+    }
+
+    // Receives still go through regular overlapped I/O, the request queue is only used for sends
+    state->rq = state->rio.RIOCreateRequestQueue(sock, 1, 1, max_sends, 1, state->cq, state->cq, nullptr);
+    if (state->rq == RIO_INVALID_RQ) {
+      BOOST_LOG(warning) << "Couldn't create a Registered I/O request queue: "sv << WSAGetLastError();
+      return nullptr;
+    }
+
+    // Segmented sends need USO, which was introduced in Windows 10 20H1
+    DWORD segment_size = 0;
+    int segment_size_len = sizeof(segment_size);
+    state->uso = !getsockopt(sock, IPPROTO_UDP, UDP_SEND_MSG_SIZE, (char *) &segment_size, &segment_size_len);
+
+    BOOST_LOG(info) << "Sending video through Registered I/O"sv << (state->uso ? " with UDP segmentation offload"sv : ""sv);
+
+    {
+      std::lock_guard lg {rio_mutex};
+      rio_sockets.emplace(sock, state.get());
+    }
+
+    close_socket.disable();
+    native_socket = (std::uintptr_t) sock;
+    return std::make_unique<rio_deinit_t>(std::move(state));
+  }
+
   // Use UDP segmentation offload if it is supported by the OS. If the NIC is capable, this will use
   // hardware acceleration to reduce CPU usage. Support for USO was introduced in Windows 10 20H1.
   bool send_batch(batched_send_info_t &send_info) {
+    // Batches that fit a registered slot skip the per-send page locking of WSASendMsg()
+    if (send_info.block_count * (send_info.header_size + send_info.payload_size) <= sizeof(rio_slot_t::data) &&
+        send_info.block_count <= RIO_MAX_SENDS_PER_SLOT) {
+      std::lock_guard lg {rio_mutex};
+      if (auto it = rio_sockets.find((SOCKET) send_info.native_socket); it != rio_sockets.end()) {
+        return rio_send_batch(*it->second, send_info);
+      }
+    }
+
     WSAMSG msg;
 
     // Convert the target address into a SOCKADDR
@@ -1457,50 +2077,10 @@ namespace platf {
 
     // At most, one DWORD option and one PKTINFO option
     char cmbuf[WSA_CMSG_SPACE(sizeof(DWORD)) + std::max(WSA_CMSG_SPACE(sizeof(IN6_PKTINFO)), WSA_CMSG_SPACE(sizeof(IN_PKTINFO)))] = {};
-    ULONG cmbuflen = 0;
-
     msg.Control.buf = cmbuf;
     msg.Control.len = sizeof(cmbuf);
 
-    auto cm = WSA_CMSG_FIRSTHDR(&msg);
-    if (send_info.source_address.is_v6()) {
-      IN6_PKTINFO pktInfo;
-
-      SOCKADDR_IN6 saddr_v6 = to_sockaddr(send_info.source_address.to_v6(), 0);
-      pktInfo.ipi6_addr = saddr_v6.sin6_addr;
-      pktInfo.ipi6_ifindex = 0;
-
-      cmbuflen += WSA_CMSG_SPACE(sizeof(pktInfo));
-
-      cm->cmsg_level = IPPROTO_IPV6;
-      cm->cmsg_type = IPV6_PKTINFO;
-      cm->cmsg_len = WSA_CMSG_LEN(sizeof(pktInfo));
-      memcpy(WSA_CMSG_DATA(cm), &pktInfo, sizeof(pktInfo));
-    } else {
-      IN_PKTINFO pktInfo;
-
-      SOCKADDR_IN saddr_v4 = to_sockaddr(send_info.source_address.to_v4(), 0);
-      pktInfo.ipi_addr = saddr_v4.sin_addr;
-      pktInfo.ipi_ifindex = 0;
-
-      cmbuflen += WSA_CMSG_SPACE(sizeof(pktInfo));
-
-      cm->cmsg_level = IPPROTO_IP;
-      cm->cmsg_type = IP_PKTINFO;
-      cm->cmsg_len = WSA_CMSG_LEN(sizeof(pktInfo));
-      memcpy(WSA_CMSG_DATA(cm), &pktInfo, sizeof(pktInfo));
-    }
-
-    if (send_info.block_count > 1) {
-      cmbuflen += WSA_CMSG_SPACE(sizeof(DWORD));
-
-      cm = WSA_CMSG_NXTHDR(&msg, cm);
-      cm->cmsg_level = IPPROTO_UDP;
-      cm->cmsg_type = UDP_SEND_MSG_SIZE;
-      cm->cmsg_len = WSA_CMSG_LEN(sizeof(DWORD));
-      *((DWORD *) WSA_CMSG_DATA(cm)) = send_info.header_size + send_info.payload_size;
-    }
-
+    ULONG cmbuflen = fill_batch_control(msg, send_info, send_info.block_count > 1 ? send_info.header_size + send_info.payload_size : 0);
     msg.Control.len = cmbuflen;
 
     // If USO is not supported, this will fail and the caller will fall back to unbatched sends.
@@ -1612,12 +2192,14 @@ namespace platf {
    * @param port The destination port for traffic sent on this socket.
    * @param data_type The type of traffic sent on this socket.
    * @param dscp_tagging Specifies whether to enable DSCP tagging on outgoing traffic.
+   * @param dscp_marked Receives the DSCP value the OS reports it marks the traffic with, 0 if it isn't marked.
    */
-  std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging) {
+  std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging, int &dscp_marked) {
     SOCKADDR_IN saddr_v4;
     SOCKADDR_IN6 saddr_v6;
     PSOCKADDR dest_addr;
     bool using_connect_hack = false;
+    dscp_marked = 0;
 
     // Windows doesn't support any concept of traffic priority without DSCP tagging
     if (!dscp_tagging) {
@@ -1636,6 +2218,7 @@ namespace platf {
       fn_QOSCreateHandle = (decltype(fn_QOSCreateHandle)) GetProcAddress(qwave, "QOSCreateHandle");
       fn_QOSAddSocketToFlow = (decltype(fn_QOSAddSocketToFlow)) GetProcAddress(qwave, "QOSAddSocketToFlow");
       fn_QOSRemoveSocketFromFlow = (decltype(fn_QOSRemoveSocketFromFlow)) GetProcAddress(qwave, "QOSRemoveSocketFromFlow");
+      fn_QOSSetFlow = (decltype(fn_QOSSetFlow)) GetProcAddress(qwave, "QOSSetFlow");
 
       if (!fn_QOSCreateHandle || !fn_QOSAddSocketToFlow || !fn_QOSRemoveSocketFromFlow) {
         BOOST_LOG(error) << "qwave.dll is missing exports?"sv;
@@ -1643,6 +2226,7 @@ namespace platf {
         fn_QOSCreateHandle = nullptr;
         fn_QOSAddSocketToFlow = nullptr;
         fn_QOSRemoveSocketFromFlow = nullptr;
+        fn_QOSSetFlow = nullptr;
 
         FreeLibrary(qwave);
         return;
@@ -1699,13 +2283,21 @@ namespace platf {
       dest_addr = (PSOCKADDR) &saddr_v4;
     }
 
+    // The DSCP value in the comments is the one qWAVE marks each traffic type with
     QOS_TRAFFIC_TYPE traffic_type;
+    DWORD dscp;
     switch (data_type) {
       case qos_data_type_e::audio:
-        traffic_type = QOSTrafficTypeVoice;
+        traffic_type = QOSTrafficTypeVoice;  // CS7
+        dscp = 56;
         break;
       case qos_data_type_e::video:
-        traffic_type = QOSTrafficTypeAudioVideo;
+        traffic_type = QOSTrafficTypeAudioVideo;  // CS5
+        dscp = 40;
+        break;
+      case qos_data_type_e::control:
+        traffic_type = QOSTrafficTypeControl;  // CS7
+        dscp = 56;
         break;
       default:
         BOOST_LOG(error) << "Unknown traffic type: "sv << (int) data_type;
@@ -1719,9 +2311,49 @@ namespace platf {
       return nullptr;
     }
 
+    // Other profiles override the class of the traffic type, which qWAVE only allows administrators to do
+    if (config::stream.qos_profile != config::QOS_PROFILE_DEFAULT) {
+      DWORD profile_dscp = qos_dscp(data_type);
+      if (fn_QOSSetFlow && fn_QOSSetFlow(qos_handle, flow_id, QOSSetOutgoingDSCPValue, sizeof(profile_dscp), &profile_dscp, 0, nullptr)) {
+        dscp = profile_dscp;
+      } else {
+        auto winerr = GetLastError();
+        BOOST_LOG(warning) << "QOSSetFlow() failed, keeping DSCP "sv << dscp << ": "sv << winerr;
+      }
+    }
+
+    dscp_marked = (int) dscp;
     return std::make_unique<qos_t>(flow_id);
   }
 
+  std::optional<int> path_mtu(const boost::asio::ip::address &address) {
+    // IP_MTU and IPV6_MTU of ws2ipdef.h, older SDK headers don't have them
+    constexpr int ip_mtu = 73;
+    constexpr int ipv6_mtu = 72;
+
+    boost::asio::ip::udp::endpoint endpoint {address, 9};
+    SOCKET sock = socket(endpoint.protocol().family(), SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+      return std::nullopt;
+    }
+    auto close_socket = util::fail_guard([sock]() {
+      closesocket(sock);
+    });
+
+    // Connecting a UDP socket only looks up the route, nothing is sent
+    if (connect(sock, endpoint.data(), (int) endpoint.size())) {
+      return std::nullopt;
+    }
+
+    DWORD mtu = 0;
+    int mtu_size = sizeof(mtu);
+    if (address.is_v6() ? getsockopt(sock, IPPROTO_IPV6, ipv6_mtu, (char *) &mtu, &mtu_size) : getsockopt(sock, IPPROTO_IP, ip_mtu, (char *) &mtu, &mtu_size)) {
+      return std::nullopt;
+    }
+
+    return mtu > 0 ? std::optional {(int) mtu} : std::nullopt;
+  }
+
   int64_t qpc_counter() {
     LARGE_INTEGER performance_counter;
     if (QueryPerformanceCounter(&performance_counter)) {
@@ -1856,6 +2488,93 @@ namespace platf {
     return std::make_unique<win32_high_precision_timer>();
   }
 
+  /**
+   * @brief Samples the GPU engines through the performance counters Task Manager shows, for any vendor.
+   * @details There is no clock among the counters.
+   */
+  class pdh_gpu_monitor_t: public gpu_monitor_t {
+  public:
+    ~pdh_gpu_monitor_t() override {
+      if (query) {
+        PdhCloseQuery(query);
+      }
+    }
+
+    int init() {
+      if (PdhOpenQueryW(nullptr, 0, &query) != ERROR_SUCCESS) {
+        return -1;
+      }
+
+      // One instance per process and engine, e.g. pid_1234_luid_0x00000000_0x0000D1E5_phys_0_eng_0_engtype_3D
+      if (PdhAddEnglishCounterW(query, L"\\GPU Engine(*)\\Utilization Percentage", 0, &counter) != ERROR_SUCCESS) {
+        BOOST_LOG(info) << "GPU engine performance counters are unavailable"sv;
+        return -1;
+      }
+
+      // Utilization is measured between two collections
+      PdhCollectQueryData(query);
+      return 0;
+    }
+
+    gpu_utilization_t sample() override {
+      gpu_utilization_t utilization;
+
+      if (PdhCollectQueryData(query) != ERROR_SUCCESS) {
+        return utilization;
+      }
+
+      DWORD size = 0;
+      DWORD count = 0;
+      if (PdhGetFormattedCounterArrayW(counter, PDH_FMT_DOUBLE, &size, &count, nullptr) != PDH_MORE_DATA) {
+        return utilization;
+      }
+
+      std::vector<std::uint8_t> buffer(size);
+      auto items = (PDH_FMT_COUNTERVALUE_ITEM_W *) buffer.data();
+      if (PdhGetFormattedCounterArrayW(counter, PDH_FMT_DOUBLE, &size, &count, items) != ERROR_SUCCESS) {
+        return utilization;
+      }
+
+      // Sum the processes sharing an engine, the busiest engine of a type is its utilization
+      std::map<std::wstring_view, double> engines;
+      for (DWORD x = 0; x < count; ++x) {
+        std::wstring_view name {items[x].szName};
+        auto luid = name.find(L"luid_"sv);
+        if (luid != std::wstring_view::npos && items[x].FmtValue.CStatus == PDH_CSTATUS_VALID_DATA) {
+          engines[name.substr(luid)] += items[x].FmtValue.doubleValue;
+        }
+      }
+
+      for (auto &[engine, value] : engines) {
+        auto percent = std::min((int) std::lround(value), 100);
+        if (engine.ends_with(L"engtype_3D"sv)) {
+          utilization.render = std::max(utilization.render.value_or(0), percent);
+        } else if (engine.ends_with(L"engtype_VideoEncode"sv)) {
+          utilization.encoder = std::max(utilization.encoder.value_or(0), percent);
+        }
+      }
+
+      return utilization;
+    }
+
+  private:
+    PDH_HQUERY query = nullptr;
+    PDH_HCOUNTER counter = nullptr;
+  };
+
+  std::unique_ptr<gpu_monitor_t> make_gpu_monitor() {
+    if (auto monitor = nvml::make_monitor()) {
+      return monitor;
+    }
+
+    auto monitor = std::make_unique<pdh_gpu_monitor_t>();
+    if (monitor->init()) {
+      return nullptr;
+    }
+
+    return monitor;
+  }
+
   std::string
   get_clipboard() {
     std::string currentClipboard = to_utf8(getClipboardData());
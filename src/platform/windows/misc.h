@@ -18,6 +18,11 @@ namespace platf {
 
   int64_t qpc_counter();
 
+  /**
+   * @brief Count a display topology change, called on `WM_DISPLAYCHANGE`.
+   */
+  void display_topology_changed();
+
   std::chrono::nanoseconds qpc_time_difference(int64_t performance_counter1, int64_t performance_counter2);
 
   /**
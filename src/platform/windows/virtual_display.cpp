@@ -5,6 +5,8 @@
 #include <initguid.h>
 #include <combaseapi.h>
 #include <thread>
+#include <map>
+#include <mutex>
 
 #include <wrl/client.h>
 #include <dxgi.h>
@@ -228,6 +230,19 @@ LONG changeDisplaySettings2(const wchar_t* deviceName, int width, int height, in
 
 					wprintf(L"[SUDOVDA] Current mode found: [%dx%dx%d]\n", sourceMode->width, sourceMode->height, targetInfo->refreshRate);
 
+					// The driver creates the display in the requested mode and Windows restores the saved mode
+					// for known displays, so the mode often matches already and setting it again only costs a mode settle
+					auto& currentRate = targetInfo->refreshRate;
+					if (
+						sourceMode->width == (UINT32)width &&
+						sourceMode->height == (UINT32)height &&
+						currentRate.Denominator &&
+						(uint64_t)currentRate.Numerator * 1000 == (uint64_t)refresh_rate * currentRate.Denominator
+					) {
+						wprintf(L"[SUDOVDA] Display %ls is already in the requested mode.\n", deviceName);
+						return ERROR_SUCCESS;
+					}
+
 					sourceMode->width = width;
 					sourceMode->height = height;
 
@@ -281,6 +296,15 @@ LONG changeDisplaySettings(const wchar_t* deviceName, int width, int height, int
 			altRefreshRate -= 1;
 		}
 
+		if (
+			devMode.dmPelsWidth == (DWORD)width &&
+			devMode.dmPelsHeight == (DWORD)height &&
+			(devMode.dmDisplayFrequency == targetRefreshRate || devMode.dmDisplayFrequency == altRefreshRate)
+		) {
+			// Already at the baseline, only the fine tuned refresh rate might be left to apply
+			return changeDisplaySettings2(deviceName, width, height, refresh_rate);
+		}
+
 		wprintf(L"[SUDOVDA] Applying baseline display mode [%dx%dx%d] for %ls.\n", width, height, targetRefreshRate, deviceName);
 
 		devMode.dmPelsWidth = width;
@@ -383,7 +407,45 @@ bool setPrimaryDisplay(const wchar_t* primaryDeviceName) {
 	return true;
 }
 
+struct displayIds {
+	LUID adapterId;
+	uint32_t sourceId;
+	uint32_t targetId;
+};
+
+// HDR toggling looks up the same display several times in a row during session start,
+// a cached entry is checked with a single source name query instead of querying all paths.
+std::mutex displayIdsMutex;
+std::map<std::wstring, displayIds, std::less<>> displayIdsCache;
+
+void clearDisplayIdsCache() {
+	std::lock_guard lock(displayIdsMutex);
+	displayIdsCache.clear();
+}
+
 bool findDisplayIds(const wchar_t* displayName, LUID& adapterId, uint32_t& targetId) {
+	std::lock_guard lock(displayIdsMutex);
+
+	auto cached = displayIdsCache.find(std::wstring_view(displayName));
+	if (cached != displayIdsCache.end()) {
+		DISPLAYCONFIG_SOURCE_DEVICE_NAME sourceName = {};
+		sourceName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME;
+		sourceName.header.size = sizeof(sourceName);
+		sourceName.header.adapterId = cached->second.adapterId;
+		sourceName.header.id = cached->second.sourceId;
+
+		if (
+			DisplayConfigGetDeviceInfo(&sourceName.header) == ERROR_SUCCESS &&
+			std::wstring_view(displayName) == sourceName.viewGdiDeviceName
+		) {
+			adapterId = cached->second.adapterId;
+			targetId = cached->second.targetId;
+			return true;
+		}
+
+		displayIdsCache.erase(cached);
+	}
+
 	UINT32 pathCount;
 	UINT32 modeCount;
 	if (GetDisplayConfigBufferSizes(QDC_ONLY_ACTIVE_PATHS, &pathCount, &modeCount)) {
@@ -419,6 +481,8 @@ bool findDisplayIds(const wchar_t* displayName, LUID& adapterId, uint32_t& targe
 	adapterId = path->sourceInfo.adapterId;
 	targetId = path->targetInfo.id;
 
+	displayIdsCache.insert_or_assign(std::wstring(displayName), displayIds{adapterId, path->sourceInfo.id, targetId});
+
 	return true;
 }
 
@@ -665,6 +729,9 @@ std::wstring createVirtualDisplay(
 		return std::wstring();
 	}
 
+	// Adding a display can hand out GDI names and source ids of removed ones again
+	clearDisplayIdsCache();
+
 	VIRTUAL_DISPLAY_ADD_OUT output;
 	if (!AddVirtualDisplay(SUDOVDA_DRIVER_HANDLE, width, height, fps, guid, s_client_name, s_client_uid, output)) {
 		printf("[SUDOVDA] Failed to add virtual display.\n");
@@ -693,6 +760,8 @@ bool removeVirtualDisplay(const GUID& guid) {
 		return false;
 	}
 
+	clearDisplayIdsCache();
+
 	if (RemoveVirtualDisplay(SUDOVDA_DRIVER_HANDLE, guid)) {
 		printf("[SUDOVDA] Virtual display removed successfully.\n");
 		return true;
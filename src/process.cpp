@@ -8,9 +8,12 @@
  #define BOOST_PROCESS_VERSION 1
 #endif
 // standard includes
+#include <algorithm>
 #include <filesystem>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 // lib includes
@@ -29,6 +32,7 @@
 #include "display_device.h"
 #include "file_handler.h"
 #include "logging.h"
+#include "nvhttp.h"
 #include "platform/common.h"
 #include "process.h"
 #include "httpcommon.h"
@@ -46,6 +50,10 @@
   #include <share.h>
 #endif
 
+#ifdef __linux__
+  #include "platform/linux/virtual_output.h"
+#endif
+
 #define DEFAULT_APP_IMAGE_PATH SUNSHINE_ASSETS_DIR "/box.png"
 
 namespace proc {
@@ -173,6 +181,8 @@ namespace proc {
     _app.uuid = REMOTE_INPUT_UUID;
     _app.terminate_on_pause = true;
     allow_client_commands = false;
+    encoder_profile.clear();
+    content_type.clear();
     placebo = true;
 
 #if defined SUNSHINE_TRAY && SUNSHINE_TRAY >= 1
@@ -194,6 +204,8 @@ namespace proc {
     _app_name = app.name;
     _launch_session = launch_session;
     allow_client_commands = app.allow_client_commands;
+    encoder_profile = app.encoder_profile;
+    content_type = app.content_type;
 
     uint32_t client_width = launch_session->width ? launch_session->width : 1920;
     uint32_t client_height = launch_session->height ? launch_session->height : 1080;
@@ -349,6 +361,31 @@ namespace proc {
 
 #else
 
+  #ifdef __linux__
+    if (config::video.headless_mode || launch_session->virtual_display || _app.virtual_display) {
+      launch_session->virtual_display = false;
+
+      if (platf::virtual_output::available()) {
+        int target_fps = launch_session->fps ? launch_session->fps : 60000;
+        if (target_fps < 1000) {
+          target_fps *= 1000;
+        }
+
+        auto output = platf::virtual_output::create(render_width, render_height, target_fps);
+        if (!output.empty()) {
+          launch_session->virtual_display = true;
+          this->virtual_display = true;
+          this->display_name = output;
+
+          // The capture follows the output by name, its index among the outputs isn't known
+          config::video.output_name = output;
+        }
+      } else {
+        BOOST_LOG(warning) << "Virtual outputs need Sway with SWAYSOCK set, streaming the configured output instead"sv;
+      }
+    }
+  #endif
+
     display_device::configure_display(config::video, *launch_session);
 
 #endif
@@ -436,36 +473,74 @@ namespace proc {
     _app_prep_begin = std::begin(_app.prep_cmds);
     _app_prep_it = _app_prep_begin;
 
-    for (; _app_prep_it != std::end(_app.prep_cmds); ++_app_prep_it) {
-      auto &cmd = *_app_prep_it;
-
-      // Skip empty commands
-      if (cmd.do_cmd.empty()) {
-        continue;
+    while (_app_prep_it != std::end(_app.prep_cmds)) {
+      // Consecutive parallel commands start together, the command after them waits for all of them
+      auto group_end = std::next(_app_prep_it);
+      bool parallel = _app_prep_it->parallel;
+      if (parallel) {
+        group_end = std::find_if_not(_app_prep_it, std::cend(_app.prep_cmds), [](const cmd_t &cmd) {
+          return cmd.parallel;
+        });
       }
 
-      boost::filesystem::path working_dir = _app.working_dir.empty() ?
-                                              find_working_directory(cmd.do_cmd, _env) :
-                                              boost::filesystem::path(_app.working_dir);
-      BOOST_LOG(info) << "Executing Do Cmd: ["sv << cmd.do_cmd << "] elevated: " << cmd.elevated;
-      auto child = platf::run_command(cmd.elevated, true, cmd.do_cmd, working_dir, _env, _pipe.get(), ec, nullptr);
+      struct started_t {
+        const cmd_t &cmd;
+        boost::process::v1::child child;
+        std::error_code ec;
+      };
 
-      if (ec) {
-        BOOST_LOG(error) << "Couldn't run ["sv << cmd.do_cmd << "]: System: "sv << ec.message();
-        // We don't want any prep commands failing launch of the desktop.
-        // This is to prevent the issue where users reboot their PC and need to log in with Sunshine.
-        // permission_denied is typically returned when the user impersonation fails, which can happen when user is not signed in yet.
-        if (!(_app.cmd.empty() && ec == std::errc::permission_denied)) {
-          return -1;
+      std::vector<started_t> started;
+      auto started_end = _app_prep_it;
+      bool failed = false;
+      for (auto it = _app_prep_it; it != group_end; ++it) {
+        auto &cmd = *it;
+
+        // Skip empty commands
+        if (cmd.do_cmd.empty()) {
+          continue;
         }
+
+        boost::filesystem::path working_dir = _app.working_dir.empty() ?
+                                                find_working_directory(cmd.do_cmd, _env) :
+                                                boost::filesystem::path(_app.working_dir);
+        BOOST_LOG(info) << "Executing Do Cmd: ["sv << cmd.do_cmd << "] elevated: " << cmd.elevated << (parallel ? " parallel"sv : ""sv);
+        auto child = platf::run_command(cmd.elevated, true, cmd.do_cmd, working_dir, _env, _pipe.get(), ec, nullptr);
+
+        if (ec) {
+          BOOST_LOG(error) << "Couldn't run ["sv << cmd.do_cmd << "]: System: "sv << ec.message();
+          // We don't want any prep commands failing launch of the desktop.
+          // This is to prevent the issue where users reboot their PC and need to log in with Sunshine.
+          // permission_denied is typically returned when the user impersonation fails, which can happen when user is not signed in yet.
+          if (!(_app.cmd.empty() && ec == std::errc::permission_denied)) {
+            failed = true;
+            break;
+          }
+        }
+
+        started.push_back({cmd, std::move(child), ec});
+        started_end = std::next(it);
       }
 
-      child.wait();
-      auto ret = child.exit_code();
-      if (ret != 0 && ec != std::errc::permission_denied) {
-        BOOST_LOG(error) << '[' << cmd.do_cmd << "] failed with code ["sv << ret << ']';
+      // Commands already running are waited for even if another one failed to start
+      for (auto &[cmd, child, child_ec] : started) {
+        child.wait();
+        auto ret = child.exit_code();
+        if (ret != 0 && child_ec != std::errc::permission_denied) {
+          BOOST_LOG(error) << '[' << cmd.do_cmd << "] failed with code ["sv << ret << ']';
+          failed = true;
+        }
+      }
+
+      if (failed) {
+        // A failed sequential command isn't undone. In a parallel group the others may have
+        // succeeded, so everything that was started gets undone on termination.
+        if (parallel) {
+          _app_prep_it = started_end;
+        }
         return -1;
       }
+
+      _app_prep_it = group_end;
     }
 
     _env["APOLLO_APP_STATUS"] = "RUNNING";
@@ -496,6 +571,11 @@ namespace proc {
         BOOST_LOG(warning) << "Couldn't run ["sv << _app.cmd << "]: System: "sv << ec.message();
         return -1;
       }
+
+      _app_exited = std::make_shared<std::atomic<bool>>(false);
+      _exit_watcher = platf::watch_app_exit(_process, _app.wait_all ? &_process_group : nullptr, [app_exited = _app_exited]() {
+        app_exited->store(true, std::memory_order_release);
+      });
     }
 
     _app_launch_time = std::chrono::steady_clock::now();
@@ -530,7 +610,10 @@ namespace proc {
 
       initial_hdr = VDISPLAY::getDisplayHDRByName(currentDisplayW.c_str());
 
-      if (config::video.dd.hdr_option == config::video_t::dd_t::hdr_option_e::automatic) {
+      if (config::video.dd.hdr_option == config::video_t::dd_t::hdr_option_e::automatic && !enable_hdr && config::video.hdr_tone_mapping) {
+        // SDR streams are tone mapped, turning HDR off would only reinitialize the capture
+        BOOST_LOG(info) << "Leaving HDR as it is for display " << currentDisplay << ", SDR streams are tone mapped";
+      } else if (config::video.dd.hdr_option == config::video_t::dd_t::hdr_option_e::automatic) {
         mode_changed_display = currentDisplay;
 
         // Try turn off HDR whatever
@@ -578,6 +661,9 @@ namespace proc {
 
     if (placebo) {
       return _app_id;
+    } else if (_exit_watcher && !_app_exited->load(std::memory_order_acquire)) {
+      // Nothing exited yet, no need to ask the OS
+      return _app_id;
     } else if (_app.wait_all && _process_group && platf::process_group_running((std::uintptr_t) _process_group.native_handle())) {
       // The app is still running if any process in the group is still running
       return _app_id;
@@ -711,6 +797,7 @@ namespace proc {
   void proc_t::terminate(bool immediate, bool needs_refresh) {
     std::error_code ec;
     placebo = false;
+    _exit_watcher.reset();
 
     if (!immediate) {
       terminate_process_group(_process, _process_group, _app.exit_timeout);
@@ -781,6 +868,16 @@ namespace proc {
         display_device::revert_configuration();
       }
 #else
+  #ifdef __linux__
+    if (this->virtual_display && !display_name.empty()) {
+      if (platf::virtual_output::remove(display_name)) {
+        BOOST_LOG(info) << "Virtual output removed successfully"sv;
+      } else {
+        BOOST_LOG(warning) << "Virtual output remove failed"sv;
+      }
+    }
+  #endif
+
     if (proc::proc.get_last_run_app_name().length() > 0 && has_run) {
       display_device::revert_configuration();
 #endif
@@ -808,6 +905,8 @@ namespace proc {
     _launch_session.reset();
     virtual_display = false;
     allow_client_commands = false;
+    encoder_profile.clear();
+    content_type.clear();
 
     if (_saved_input_config) {
       config::input = *_saved_input_config;
@@ -1008,6 +1107,49 @@ namespace proc {
     return ss.str();
   }
 
+  /**
+   * @brief Hash of an image file, only valid while the file keeps its size and modification time.
+   */
+  struct image_hash_t {
+    std::filesystem::file_time_type last_write_time;
+    std::uintmax_t size;
+    std::string sha256;
+  };
+
+  static std::mutex image_hash_mutex;
+  static std::unordered_map<std::string, image_hash_t> image_hash_cache;  ///< Cover images hashed by earlier refreshes, keyed by path.
+
+  /**
+   * @brief Calculate the SHA-256 of an image file, reusing the hash of an unchanged file.
+   * @param file_path Path of the image.
+   * @return The hash, or `std::nullopt` if the file couldn't be read.
+   */
+  static std::optional<std::string> image_sha256(const std::string &file_path) {
+    std::error_code ec;
+    auto last_write_time = std::filesystem::last_write_time(file_path, ec);
+    std::uintmax_t size = ec ? 0 : std::filesystem::file_size(file_path, ec);
+    if (ec) {
+      return calculate_sha256(file_path);
+    }
+
+    {
+      std::lock_guard lock(image_hash_mutex);
+      if (auto it = image_hash_cache.find(file_path); it != std::end(image_hash_cache) &&
+                                                      it->second.last_write_time == last_write_time &&
+                                                      it->second.size == size) {
+        return it->second.sha256;
+      }
+    }
+
+    auto sha256 = calculate_sha256(file_path);
+    if (sha256) {
+      std::lock_guard lock(image_hash_mutex);
+      image_hash_cache.insert_or_assign(file_path, image_hash_t {last_write_time, size, *sha256});
+    }
+
+    return sha256;
+  }
+
   uint32_t calculate_crc32(const std::string &input) {
     boost::crc_32_type result;
     result.process_bytes(input.data(), input.length());
@@ -1020,7 +1162,7 @@ namespace proc {
     to_hash.push_back(app_name);
     auto file_path = validate_app_image_path(app_image_path);
     if (file_path != DEFAULT_APP_IMAGE_PATH) {
-      auto file_hash = calculate_sha256(file_path);
+      auto file_hash = image_sha256(file_path);
       if (file_hash) {
         to_hash.push_back(file_hash.value());
       } else {
@@ -1287,6 +1429,7 @@ namespace proc {
                 std::move(undo_cmd),
                 std::move(prep_cmd.elevated)
               );
+              prep_cmds.back().parallel = prep_cmd.parallel;
             }
           }
           if (app_node.contains("prep-cmd") && app_node["prep-cmd"].is_array()) {
@@ -1299,6 +1442,7 @@ namespace proc {
                 std::move(undo_cmd),
                 std::move(elevated)
               );
+              prep_cmds.back().parallel = prep_node.value("parallel", false);
             }
           }
 
@@ -1366,6 +1510,16 @@ namespace proc {
           ctx.allow_client_commands = app_node.value("allow-client-commands", true);
           ctx.terminate_on_pause = app_node.value("terminate-on-pause", false);
           ctx.gamepad = app_node.value("gamepad", "");
+          ctx.encoder_profile = app_node.value("encoder-profile", "");
+          if (!ctx.encoder_profile.empty() && video::encoder_profile_from_view(ctx.encoder_profile) == video::encoder_profile_e::none) {
+            BOOST_LOG(warning) << "Unknown encoder profile ["sv << ctx.encoder_profile << "] of app ["sv << name << "], using the configured encoder settings"sv;
+            ctx.encoder_profile.clear();
+          }
+          ctx.content_type = app_node.value("content-type", "");
+          if (!ctx.content_type.empty() && video::content_type_from_view(ctx.content_type) == video::content_type_e::automatic) {
+            BOOST_LOG(warning) << "Unknown content type ["sv << ctx.content_type << "] of app ["sv << name << "], detecting it instead"sv;
+            ctx.content_type.clear();
+          }
 
           // Calculate a unique application id.
           auto possible_ids = calculate_app_id(name, ctx.image_path, i++);
@@ -1590,5 +1744,7 @@ namespace proc {
     if (proc_opt) {
       proc = std::move(*proc_opt);
     }
+
+    nvhttp::invalidate_cached_responses();
   }
 }  // namespace proc
@@ -13,6 +13,7 @@
 #endif
 
 // standard includes
+#include <atomic>
 #include <optional>
 #include <unordered_map>
 
@@ -74,6 +75,8 @@ namespace proc {
     std::string image_path;  ///< Application image/icon path
     std::string id;  ///< Application ID
     std::string gamepad;  ///< Gamepad configuration
+    std::string encoder_profile;  ///< Encoder tuning: empty, "competitive" or "cinematic"
+    std::string content_type;  ///< Content the app shows: empty to detect it, "desktop" or "video"
     bool elevated;  ///< Whether to run with elevated privileges
     bool auto_detach;  ///< Auto-detach if process exits quickly
     bool wait_all;  ///< Wait for all child processes
@@ -100,6 +103,8 @@ namespace proc {
     bool initial_hdr = false;  ///< Initial HDR state
     bool virtual_display = false;  ///< Whether virtual display is active
     bool allow_client_commands = false;  ///< Whether client commands are allowed
+    std::string encoder_profile;  ///< Encoder profile of the running application
+    std::string content_type;  ///< Content type of the running application
 
     /**
      * @brief Construct process manager with environment and applications.
@@ -201,6 +206,8 @@ namespace proc {
     bool placebo {};  ///< True if no command associated with _app_id but process still running
     boost::process::v1::child _process;  ///< Child process
     boost::process::v1::group _process_group;  ///< Process group
+    std::shared_ptr<std::atomic<bool>> _app_exited;  ///< Set by the exit watcher, shared so it outlives a move of proc_t
+    std::unique_ptr<platf::deinit_t> _exit_watcher;  ///< Notifies of the app exit, polled if null
     file_t _pipe;  ///< Process pipe
     std::vector<cmd_t>::const_iterator _app_prep_it;  ///< Current prep command iterator
     std::vector<cmd_t>::const_iterator _app_prep_begin;  ///< Beginning of prep commands
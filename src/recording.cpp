@@ -0,0 +1,815 @@
+/**
+ * @file src/recording.cpp
+ * @brief Definitions for recording sessions from their encoded streams.
+ */
+// standard includes
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+// local includes
+#include "audio.h"
+#include "config.h"
+#include "logging.h"
+#include "recording.h"
+#include "rtsp.h"
+#include "stream.h"
+
+using namespace std::literals;
+
+namespace recording {
+  namespace {
+    // Matroska element IDs
+    constexpr std::uint32_t ebml_id = 0x1A45DFA3;
+    constexpr std::uint32_t ebml_version_id = 0x4286;
+    constexpr std::uint32_t ebml_read_version_id = 0x42F7;
+    constexpr std::uint32_t ebml_max_id_length_id = 0x42F2;
+    constexpr std::uint32_t ebml_max_size_length_id = 0x42F3;
+    constexpr std::uint32_t doc_type_id = 0x4282;
+    constexpr std::uint32_t doc_type_version_id = 0x4287;
+    constexpr std::uint32_t doc_type_read_version_id = 0x4285;
+    constexpr std::uint32_t segment_id = 0x18538067;
+    constexpr std::uint32_t info_id = 0x1549A966;
+    constexpr std::uint32_t timestamp_scale_id = 0x2AD7B1;
+    constexpr std::uint32_t muxing_app_id = 0x4D80;
+    constexpr std::uint32_t writing_app_id = 0x5741;
+    constexpr std::uint32_t tracks_id = 0x1654AE6B;
+    constexpr std::uint32_t track_entry_id = 0xAE;
+    constexpr std::uint32_t track_number_id = 0xD7;
+    constexpr std::uint32_t track_uid_id = 0x73C5;
+    constexpr std::uint32_t track_type_id = 0x83;
+    constexpr std::uint32_t flag_lacing_id = 0x9C;
+    constexpr std::uint32_t codec_id_id = 0x86;
+    constexpr std::uint32_t codec_private_id = 0x63A2;
+    constexpr std::uint32_t default_duration_id = 0x23E383;
+    constexpr std::uint32_t seek_pre_roll_id = 0x56BB;
+    constexpr std::uint32_t video_id = 0xE0;
+    constexpr std::uint32_t pixel_width_id = 0xB0;
+    constexpr std::uint32_t pixel_height_id = 0xBA;
+    constexpr std::uint32_t audio_id = 0xE1;
+    constexpr std::uint32_t sampling_frequency_id = 0xB5;
+    constexpr std::uint32_t channels_id = 0x9F;
+    constexpr std::uint32_t cluster_id = 0x1F43B675;
+    constexpr std::uint32_t cluster_timestamp_id = 0xE7;
+    constexpr std::uint32_t simple_block_id = 0xA3;
+
+    constexpr int video_track_number = 1;
+    constexpr int audio_track_number = 2;
+
+    void put_id(std::string &out, std::uint32_t id) {
+      auto bytes = id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+      for (auto x = bytes - 1; x >= 0; --x) {
+        out += (char) (id >> (8 * x));
+      }
+    }
+
+    /**
+     * @brief Write an element size, always 8 bytes long so sizes never have to be measured twice.
+     */
+    void put_size(std::string &out, std::uint64_t size) {
+      out += (char) 0x01;
+      for (auto x = 6; x >= 0; --x) {
+        out += (char) (size >> (8 * x));
+      }
+    }
+
+    void put_element(std::string &out, std::uint32_t id, std::string_view body) {
+      put_id(out, id);
+      put_size(out, body.size());
+      out.append(body);
+    }
+
+    void put_uint(std::string &out, std::uint32_t id, std::uint64_t value) {
+      auto bytes = 1;
+      while (bytes < 8 && value >> (8 * bytes)) {
+        ++bytes;
+      }
+
+      put_id(out, id);
+      put_size(out, bytes);
+      for (auto x = bytes - 1; x >= 0; --x) {
+        out += (char) (value >> (8 * x));
+      }
+    }
+
+    void put_float(std::string &out, std::uint32_t id, double value) {
+      auto bits = std::bit_cast<std::uint64_t>(value);
+
+      put_id(out, id);
+      put_size(out, 8);
+      for (auto x = 7; x >= 0; --x) {
+        out += (char) (bits >> (8 * x));
+      }
+    }
+
+    void put_be16(std::string &out, std::size_t value) {
+      out += (char) (value >> 8);
+      out += (char) value;
+    }
+
+    void put_be32(std::string &out, std::size_t value) {
+      out += (char) (value >> 24);
+      out += (char) (value >> 16);
+      out += (char) (value >> 8);
+      out += (char) value;
+    }
+
+    void put_le16(std::string &out, std::uint32_t value) {
+      out += (char) value;
+      out += (char) (value >> 8);
+    }
+
+    void put_le32(std::string &out, std::uint32_t value) {
+      put_le16(out, value);
+      put_le16(out, value >> 16);
+    }
+
+    /**
+     * @brief Remove the emulation prevention bytes of a NAL unit.
+     */
+    std::string unescape(std::string_view nal) {
+      std::string rbsp;
+      rbsp.reserve(nal.size());
+
+      auto zeros = 0;
+      for (auto byte : nal) {
+        if (zeros >= 2 && byte == 0x03) {
+          zeros = 0;
+          continue;
+        }
+        zeros = byte == 0 ? zeros + 1 : 0;
+        rbsp += byte;
+      }
+      return rbsp;
+    }
+
+    /**
+     * @brief Split AV1 OBUs with size fields, as every encoder in use writes them.
+     */
+    std::vector<std::string_view> split_obus(std::string_view data) {
+      std::vector<std::string_view> obus;
+
+      std::size_t pos = 0;
+      while (pos < data.size()) {
+        auto header = (std::uint8_t) data[pos];
+        auto size_pos = pos + 1 + (header & 0x04 ? 1 : 0);
+
+        std::size_t size = data.size() - size_pos;
+        if (header & 0x02) {
+          size = 0;
+          for (auto x = 0; x < 8; ++x, ++size_pos) {
+            if (size_pos >= data.size()) {
+              return obus;
+            }
+            auto byte = (std::uint8_t) data[size_pos];
+            size |= (std::size_t) (byte & 0x7F) << (7 * x);
+            if (!(byte & 0x80)) {
+              ++size_pos;
+              break;
+            }
+          }
+        }
+
+        if (size_pos > data.size() || size > data.size() - size_pos) {
+          break;
+        }
+        obus.emplace_back(data.substr(pos, size_pos + size - pos));
+        pos = size_pos + size;
+      }
+
+      return obus;
+    }
+
+    int obu_type(std::string_view obu) {
+      return ((std::uint8_t) obu[0] >> 3) & 0x0F;
+    }
+
+    std::string avcc(const video_track_t &track, std::string_view keyframe) {
+      std::string_view sps, pps;
+      for (auto nal : split_nal_units(keyframe)) {
+        auto type = (std::uint8_t) nal[0] & 0x1F;
+        if (type == 7 && sps.empty()) {
+          sps = nal;
+        } else if (type == 8 && pps.empty()) {
+          pps = nal;
+        }
+      }
+      if (sps.size() < 4 || pps.empty()) {
+        return {};
+      }
+
+      std::string out;
+      out += (char) 1;
+      out.append(sps.substr(1, 3));  // profile, constraints and level
+      out += (char) 0xFF;  // 4-byte NAL unit lengths
+      out += (char) 0xE1;
+      put_be16(out, sps.size());
+      out.append(sps);
+      out += (char) 1;
+      put_be16(out, pps.size());
+      out.append(pps);
+
+      // The high profiles carry their format
+      auto profile = (std::uint8_t) sps[1];
+      if (profile == 100 || profile == 110 || profile == 122 || profile == 244) {
+        out += (char) (0xFC | (track.yuv444 ? 3 : 1));
+        out += (char) (0xF8 | (track.ten_bit ? 2 : 0));
+        out += (char) (0xF8 | (track.ten_bit ? 2 : 0));
+        out += (char) 0;
+      }
+      return out;
+    }
+
+    std::string hvcc(const video_track_t &track, std::string_view keyframe) {
+      std::string_view vps, sps, pps;
+      for (auto nal : split_nal_units(keyframe)) {
+        if (nal.size() < 2) {
+          continue;
+        }
+        auto type = ((std::uint8_t) nal[0] >> 1) & 0x3F;
+        if (type == 32 && vps.empty()) {
+          vps = nal;
+        } else if (type == 33 && sps.empty()) {
+          sps = nal;
+        } else if (type == 34 && pps.empty()) {
+          pps = nal;
+        }
+      }
+
+      // NAL unit header, then the VPS ID, the sub-layers and the general profile, tier and level
+      auto rbsp = unescape(sps);
+      if (vps.empty() || rbsp.size() < 15 || pps.empty()) {
+        return {};
+      }
+
+      auto sub_layers = (((std::uint8_t) rbsp[2] >> 1) & 0x07) + 1;
+      auto temporal_id_nested = (std::uint8_t) rbsp[2] & 0x01;
+      auto depth = track.ten_bit ? 2 : 0;
+
+      std::string out;
+      out += (char) 1;
+      out.append(rbsp, 3, 12);
+      out += (char) 0xF0;  // No minimum spatial segmentation
+      out += (char) 0x00;
+      out += (char) 0xFC;  // Unknown parallelism
+      out += (char) (0xFC | (track.yuv444 ? 3 : 1));
+      out += (char) (0xF8 | depth);
+      out += (char) (0xF8 | depth);
+      put_be16(out, 0);  // Unknown average framerate
+      out += (char) (sub_layers << 3 | temporal_id_nested << 2 | 3);  // 4-byte NAL unit lengths
+
+      out += (char) 3;
+      for (auto [type, nal] : {std::pair {32, vps}, std::pair {33, sps}, std::pair {34, pps}}) {
+        out += (char) (0x80 | type);
+        put_be16(out, 1);
+        put_be16(out, nal.size());
+        out.append(nal);
+      }
+      return out;
+    }
+
+    std::string av1c(const video_track_t &track, std::string_view keyframe) {
+      std::string_view sequence_header;
+      for (auto obu : split_obus(keyframe)) {
+        if (obu_type(obu) == 1) {
+          sequence_header = obu;
+          break;
+        }
+      }
+      if (sequence_header.empty()) {
+        return {};
+      }
+
+      // The payload follows the header, its extension and its size
+      auto header = (std::uint8_t) sequence_header[0];
+      std::size_t payload = 1 + (header & 0x04 ? 1 : 0);
+      if (header & 0x02) {
+        while (payload < sequence_header.size() && (std::uint8_t) sequence_header[payload++] & 0x80) {}
+      }
+
+      std::size_t bit = payload * 8;
+      auto read = [&](int bits) {
+        std::uint32_t value = 0;
+        for (auto x = 0; x < bits; ++x, ++bit) {
+          auto byte = bit / 8 < sequence_header.size() ? (std::uint8_t) sequence_header[bit / 8] : 0;
+          value = value << 1 | ((byte >> (7 - bit % 8)) & 1);
+        }
+        return value;
+      };
+
+      auto profile = read(3);
+      read(1);  // still_picture
+      auto level = 31u;  // Unconstrained, if the level can't be read without the timing info
+      auto tier = 0u;
+      if (read(1)) {
+        // reduced_still_picture_header
+        level = read(5);
+      } else if (!read(1)) {
+        // Without timing info, the first operating point follows
+        read(1);  // initial_display_delay_present_flag
+        read(5);  // operating_points_cnt_minus_1
+        read(12);  // operating_point_idc[0]
+        level = read(5);
+        if (level > 7) {
+          tier = read(1);
+        }
+      }
+
+      std::string out;
+      out += (char) 0x81;  // Marker and version
+      out += (char) (profile << 5 | level);
+      out += (char) (tier << 7 | (track.ten_bit ? 1 : 0) << 6 | (track.yuv444 ? 0 : 3) << 2);
+      out += (char) 0;  // No initial presentation delay
+      out.append(sequence_header);
+      return out;
+    }
+
+    std::string opus_head(const audio_track_t &track) {
+      auto family = track.streams == 1 && track.channels <= 2 ? 0 : 1;
+
+      std::string out {"OpusHead"};
+      out += (char) 1;
+      out += (char) track.channels;
+      put_le16(out, 0);  // Pre-skip
+      put_le32(out, (std::uint32_t) track.sample_rate);
+      put_le16(out, 0);  // Output gain
+      out += (char) family;
+      if (family) {
+        out += (char) track.streams;
+        out += (char) track.coupled_streams;
+        for (auto x = 0; x < track.channels; ++x) {
+          out += (char) (x < (int) track.mapping.size() ? track.mapping[x] : x);
+        }
+      }
+      return out;
+    }
+
+    /**
+     * @brief Get a name for the file that tells recordings apart.
+     */
+    std::string file_name(std::string_view device_name) {
+      std::string name;
+      for (unsigned char ch : device_name) {
+        name += std::isalnum(ch) || ch == '-' || ch == '_' ? (char) ch : '_';
+      }
+      if (name.empty()) {
+        name = "session";
+      }
+
+      auto t = std::time(nullptr);
+      auto lt = *std::localtime(&t);
+
+      std::ostringstream out;
+      out << name << '-' << std::put_time(&lt, "%Y%m%d-%H%M%S") << ".mkv";
+      return out.str();
+    }
+  }  // namespace
+
+  std::vector<std::string_view> split_nal_units(std::string_view bitstream) {
+    std::vector<std::string_view> nal_units;
+
+    auto next_start = [&](std::size_t from) {
+      auto pos = bitstream.find("\x00\x00\x01"sv, from);
+      return pos == std::string_view::npos ? bitstream.size() : pos;
+    };
+
+    auto start = next_start(0);
+    while (start < bitstream.size()) {
+      auto begin = start + 3;
+      auto end = next_start(begin);
+      start = end;
+
+      // The leading zero of a 4-byte start code and trailing zeros belong to neither
+      while (end > begin && bitstream[end - 1] == 0) {
+        --end;
+      }
+      if (end > begin) {
+        nal_units.emplace_back(bitstream.substr(begin, end - begin));
+      }
+    }
+
+    return nal_units;
+  }
+
+  std::string codec_private(const video_track_t &track, std::string_view keyframe) {
+    switch (track.video_format) {
+      case 0:
+        return avcc(track, keyframe);
+      case 1:
+        return hvcc(track, keyframe);
+      case 2:
+        return av1c(track, keyframe);
+      default:
+        return {};
+    }
+  }
+
+  mkv_writer_t::mkv_writer_t(std::ostream &out, video_track_t video, std::optional<audio_track_t> audio):
+      out {out},
+      video {video},
+      audio {std::move(audio)} {
+  }
+
+  bool mkv_writer_t::write_video(std::string_view data, bool keyframe, std::chrono::milliseconds timestamp) {
+    if (!started) {
+      if (!keyframe) {
+        return false;
+      }
+
+      auto codec_private = recording::codec_private(video, data);
+      if (codec_private.empty()) {
+        BOOST_LOG(warning) << "Recording: the keyframe has no parameter sets, waiting for the next one"sv;
+        return false;
+      }
+      write_headers(codec_private);
+      started = true;
+    }
+
+    frame.clear();
+    if (video.video_format == 2) {
+      // Temporal delimiters are implied by the blocks
+      for (auto obu : split_obus(data)) {
+        if (obu_type(obu) != 2) {
+          frame.append(obu);
+        }
+      }
+    } else {
+      for (auto nal : split_nal_units(data)) {
+        put_be32(frame, nal.size());
+        frame.append(nal);
+      }
+    }
+
+    add_block(video_track_number, frame, keyframe, timestamp);
+    return true;
+  }
+
+  void mkv_writer_t::write_audio(std::string_view packet, std::chrono::milliseconds timestamp) {
+    if (started && audio) {
+      add_block(audio_track_number, packet, true, timestamp);
+    }
+  }
+
+  void mkv_writer_t::finish() {
+    flush_cluster();
+    out.flush();
+  }
+
+  void mkv_writer_t::write_headers(std::string_view codec_private) {
+    std::string header;
+
+    std::string ebml;
+    put_uint(ebml, ebml_version_id, 1);
+    put_uint(ebml, ebml_read_version_id, 1);
+    put_uint(ebml, ebml_max_id_length_id, 4);
+    put_uint(ebml, ebml_max_size_length_id, 8);
+    put_element(ebml, doc_type_id, "matroska"sv);
+    put_uint(ebml, doc_type_version_id, 4);
+    put_uint(ebml, doc_type_read_version_id, 2);
+    put_element(header, ebml_id, ebml);
+
+    // The segment ends wherever the recording stops
+    put_id(header, segment_id);
+    header.append("\x01\xFF\xFF\xFF\xFF\xFF\xFF\xFF"sv);
+
+    std::string info;
+    put_uint(info, timestamp_scale_id, 1000000);  // Timestamps in milliseconds
+    put_element(info, muxing_app_id, "Apollo"sv);
+    put_element(info, writing_app_id, "Apollo"sv);
+    put_element(header, info_id, info);
+
+    std::string tracks;
+    {
+      std::string entry;
+      put_uint(entry, track_number_id, video_track_number);
+      put_uint(entry, track_uid_id, video_track_number);
+      put_uint(entry, track_type_id, 1);
+      put_uint(entry, flag_lacing_id, 0);
+      put_element(entry, codec_id_id, video.video_format == 0 ? "V_MPEG4/ISO/AVC"sv : video.video_format == 1 ? "V_MPEGH/ISO/HEVC"sv : "V_AV1"sv);
+      put_element(entry, codec_private_id, codec_private);
+      if (video.framerate > 0) {
+        put_uint(entry, default_duration_id, 1000000000 / video.framerate);
+      }
+
+      std::string settings;
+      put_uint(settings, pixel_width_id, video.width);
+      put_uint(settings, pixel_height_id, video.height);
+      put_element(entry, video_id, settings);
+
+      put_element(tracks, track_entry_id, entry);
+    }
+    if (audio) {
+      std::string entry;
+      put_uint(entry, track_number_id, audio_track_number);
+      put_uint(entry, track_uid_id, audio_track_number);
+      put_uint(entry, track_type_id, 2);
+      put_uint(entry, flag_lacing_id, 0);
+      put_element(entry, codec_id_id, "A_OPUS"sv);
+      put_element(entry, codec_private_id, opus_head(*audio));
+      put_uint(entry, seek_pre_roll_id, 80000000);
+
+      std::string settings;
+      put_float(settings, sampling_frequency_id, audio->sample_rate);
+      put_uint(settings, channels_id, audio->channels);
+      put_element(entry, audio_id, settings);
+
+      put_element(tracks, track_entry_id, entry);
+    }
+    put_element(header, tracks_id, tracks);
+
+    out.write(header.data(), header.size());
+  }
+
+  void mkv_writer_t::add_block(int track_number, std::string_view data, bool keyframe, std::chrono::milliseconds timestamp) {
+    auto relative = (timestamp - cluster_start).count();
+
+    // Video keyframes start a cluster, so players can seek to them
+    if (!cluster.empty() && ((keyframe && track_number == video_track_number) || relative < INT16_MIN || relative >= max_cluster_duration.count())) {
+      flush_cluster();
+    }
+    if (cluster.empty()) {
+      cluster_start = timestamp;
+      relative = 0;
+    }
+
+    put_id(cluster, simple_block_id);
+    put_size(cluster, data.size() + 4);
+    cluster += (char) (0x80 | track_number);
+    cluster += (char) (relative >> 8);
+    cluster += (char) relative;
+    cluster += (char) (keyframe ? 0x80 : 0x00);
+    cluster.append(data);
+  }
+
+  void mkv_writer_t::flush_cluster() {
+    if (cluster.empty()) {
+      return;
+    }
+
+    std::string timestamp;
+    put_uint(timestamp, cluster_timestamp_id, cluster_start.count());
+
+    std::string header;
+    put_id(header, cluster_id);
+    put_size(header, timestamp.size() + cluster.size());
+
+    out.write(header.data(), header.size());
+    out.write(timestamp.data(), timestamp.size());
+    out.write(cluster.data(), cluster.size());
+    cluster.clear();
+  }
+
+  recorder_t::recorder_t(std::filesystem::path path, video_track_t video, std::optional<audio_track_t> audio):
+      path {std::move(path)},
+      file {this->path, std::ios::binary},
+      writer {file, video, std::move(audio)} {
+    if (file.is_open()) {
+      thread = std::thread {&recorder_t::run, this};
+    }
+  }
+
+  recorder_t::~recorder_t() {
+    stop();
+  }
+
+  bool recorder_t::is_open() const {
+    return file.is_open();
+  }
+
+  void recorder_t::video(const std::vector<std::string_view> &segments, bool keyframe, std::chrono::steady_clock::time_point timestamp) {
+    std::size_t size = 0;
+    for (auto &segment : segments) {
+      size += segment.size();
+    }
+
+    std::lock_guard lg {mutex};
+    if (stopping) {
+      return;
+    }
+    if (waiting_for_keyframe && !keyframe) {
+      if (start_time) {
+        frames_dropped.fetch_add(1, std::memory_order_relaxed);
+      }
+      return;
+    }
+    if (buffered_bytes + size > max_buffered_bytes) {
+      // The frames until the next keyframe reference this one
+      waiting_for_keyframe = true;
+      frames_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    waiting_for_keyframe = false;
+    if (!start_time) {
+      start_time = timestamp;
+    }
+
+    auto &block = queue_block(true, keyframe, timestamp);
+    for (auto &segment : segments) {
+      block.data.append(segment);
+    }
+    buffered_bytes += size;
+    cv.notify_one();
+  }
+
+  void recorder_t::audio(std::string_view packet, std::chrono::steady_clock::time_point timestamp) {
+    std::lock_guard lg {mutex};
+    if (stopping || !start_time || buffered_bytes + packet.size() > max_buffered_bytes) {
+      return;
+    }
+
+    queue_block(false, true, timestamp).data.assign(packet);
+    buffered_bytes += packet.size();
+    cv.notify_one();
+  }
+
+  void recorder_t::stop() {
+    {
+      std::lock_guard lg {mutex};
+      stopping = true;
+    }
+    cv.notify_all();
+
+    if (thread.joinable()) {
+      thread.join();
+      BOOST_LOG(info) << "Recording: saved "sv << path.string() << " with "sv << frames_written.load() << " frames, "sv << frames_dropped.load() << " dropped"sv;
+    }
+  }
+
+  nlohmann::json recorder_t::status() {
+    nlohmann::json status;
+    status["file"] = path.string();
+    status["bytes_written"] = bytes_written.load(std::memory_order_relaxed);
+    status["frames_written"] = frames_written.load(std::memory_order_relaxed);
+    status["frames_dropped"] = frames_dropped.load(std::memory_order_relaxed);
+    status["failed"] = failed.load(std::memory_order_relaxed);
+
+    std::lock_guard lg {mutex};
+    status["buffered_bytes"] = buffered_bytes;
+    return status;
+  }
+
+  recorder_t::block_t &recorder_t::queue_block(bool video, bool keyframe, std::chrono::steady_clock::time_point timestamp) {
+    auto &block = blocks.emplace_back(block_t {video, keyframe, timestamp});
+    if (!spare.empty()) {
+      block.data = std::move(spare.back());
+      spare.pop_back();
+    }
+    return block;
+  }
+
+  void recorder_t::run() {
+    std::unique_lock ul {mutex};
+    while (true) {
+      cv.wait(ul, [this]() {
+        return stopping || !blocks.empty();
+      });
+      if (blocks.empty()) {
+        break;
+      }
+
+      auto block = std::move(blocks.front());
+      blocks.pop_front();
+      buffered_bytes -= block.data.size();
+      auto start = *start_time;
+      ul.unlock();
+
+      auto timestamp = std::max(0ms, std::chrono::duration_cast<std::chrono::milliseconds>(block.timestamp - start));
+      if (block.video) {
+        if (writer.write_video(block.data, block.keyframe, timestamp)) {
+          frames_written.fetch_add(1, std::memory_order_relaxed);
+        }
+      } else {
+        writer.write_audio(block.data, timestamp);
+      }
+      bytes_written.fetch_add(block.data.size(), std::memory_order_relaxed);
+
+      if (!file && !failed.exchange(true)) {
+        BOOST_LOG(error) << "Recording: couldn't write to "sv << path.string();
+      }
+
+      ul.lock();
+      block.data.clear();
+      if (spare.size() < 16) {
+        spare.emplace_back(std::move(block.data));
+      }
+    }
+    ul.unlock();
+
+    writer.finish();
+    file.close();
+  }
+
+  std::shared_ptr<recorder_t> tap_t::get() {
+    if (!attached.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+
+    std::lock_guard lg {mutex};
+    return recorder;
+  }
+
+  bool tap_t::attach(std::shared_ptr<recorder_t> recorder) {
+    std::lock_guard lg {mutex};
+    if (this->recorder) {
+      return false;
+    }
+
+    this->recorder = std::move(recorder);
+    attached.store(true, std::memory_order_release);
+    return true;
+  }
+
+  std::shared_ptr<recorder_t> tap_t::detach() {
+    std::lock_guard lg {mutex};
+    attached.store(false, std::memory_order_release);
+    return std::move(recorder);
+  }
+
+  nlohmann::json start(const std::string &uuid) {
+    auto session = rtsp_stream::find_session(uuid);
+    if (!session) {
+      return nullptr;
+    }
+
+    auto &monitor = session->config.monitor;
+    video_track_t video {
+      monitor.videoFormat,
+      monitor.width,
+      monitor.height,
+      monitor.framerate > 1000 ? monitor.framerate / 1000 : monitor.framerate,
+      monitor.chromaSamplingType == 1,
+      monitor.dynamicRange > 0,
+    };
+
+    std::optional<audio_track_t> audio_track;
+    if (session->config.audio.channels > 0) {
+      auto stream = audio::stream_config(session->config.audio);
+      audio_track = audio_track_t {
+        stream.sampleRate,
+        stream.channelCount,
+        stream.streams,
+        stream.coupledStreams,
+        {stream.mapping, stream.mapping + stream.channelCount},
+      };
+    }
+
+    std::filesystem::path directory {config::sunshine.recording_path};
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+
+    auto recorder = std::make_shared<recorder_t>(directory / file_name(session->device_name), video, std::move(audio_track));
+    if (!recorder->is_open()) {
+      BOOST_LOG(error) << "Recording: couldn't create a file in "sv << directory.string();
+      return nullptr;
+    }
+
+    auto status = recorder->status();
+    if (!session->recording.attach(std::move(recorder))) {
+      BOOST_LOG(info) << "Recording: "sv << session->device_name << " is being recorded already"sv;
+      return nullptr;
+    }
+
+    // The recording starts with a keyframe
+    session->video.idr_events->raise(true);
+
+    BOOST_LOG(info) << "Recording "sv << session->device_name << " to "sv << status["file"].get<std::string>();
+    return status;
+  }
+
+  bool stop(const std::string &uuid) {
+    auto session = rtsp_stream::find_session(uuid);
+    if (!session) {
+      return false;
+    }
+
+    auto recorder = session->recording.detach();
+    if (!recorder) {
+      return false;
+    }
+
+    recorder->stop();
+    return true;
+  }
+
+  nlohmann::json status() {
+    auto recordings = nlohmann::json::array();
+    for (auto &uuid : rtsp_stream::get_all_session_uuids()) {
+      auto session = rtsp_stream::find_session(uuid);
+      if (!session) {
+        continue;
+      }
+
+      if (auto recorder = session->recording.get()) {
+        auto status = recorder->status();
+        status["uuid"] = uuid;
+        status["device"] = session->device_name;
+        recordings.push_back(std::move(status));
+      }
+    }
+    return recordings;
+  }
+}  // namespace recording
@@ -0,0 +1,250 @@
+/**
+ * @file src/recording.h
+ * @brief Declarations for recording sessions from their encoded streams.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+namespace recording {
+  constexpr std::size_t max_buffered_bytes = 64 * 1024 * 1024;  ///< Recording data waiting to be written, more is dropped
+  constexpr std::chrono::milliseconds max_cluster_duration {5000};  ///< Clusters start at keyframes, or after this long without one
+
+  /**
+   * @brief The video track of a recording.
+   */
+  struct video_track_t {
+    int video_format;  ///< 0 for H.264, 1 for HEVC, 2 for AV1
+    int width;
+    int height;
+    int framerate;
+    bool yuv444;
+    bool ten_bit;
+  };
+
+  /**
+   * @brief The Opus track of a recording.
+   */
+  struct audio_track_t {
+    int sample_rate;
+    int channels;
+    int streams;
+    int coupled_streams;
+    std::vector<std::uint8_t> mapping;  ///< Opus channel mapping, one entry per channel
+  };
+
+  /**
+   * @brief Split an Annex B bitstream into its NAL units, without their start codes.
+   * @param bitstream The bitstream.
+   * @return Views of the NAL units in @p bitstream.
+   */
+  std::vector<std::string_view> split_nal_units(std::string_view bitstream);
+
+  /**
+   * @brief Build the codec private data of a video track from the parameter sets of a keyframe.
+   * @param track The video track.
+   * @param keyframe The first keyframe of the track, as encoded.
+   * @return `avcC`, `hvcC` or `av1C` data, empty if the keyframe lacks parameter sets.
+   */
+  std::string codec_private(const video_track_t &track, std::string_view keyframe);
+
+  /**
+   * @brief Matroska muxer of an encoded video and an Opus track.
+   * @details Written front to back without seeking, so a recording that is cut short stays playable.
+   *          The headers are written with the first keyframe, packets before it are dropped.
+   */
+  class mkv_writer_t {
+  public:
+    /**
+     * @param out Receives the file.
+     * @param video The video track.
+     * @param audio The audio track, if any.
+     */
+    mkv_writer_t(std::ostream &out, video_track_t video, std::optional<audio_track_t> audio);
+
+    /**
+     * @brief Add an encoded video frame.
+     * @param frame The frame as encoded, Annex B for H.264 and HEVC, OBUs for AV1.
+     * @param keyframe Whether the frame is an IDR frame.
+     * @param timestamp Presentation time since the start of the recording.
+     * @return `true` once the headers have been written.
+     */
+    bool write_video(std::string_view frame, bool keyframe, std::chrono::milliseconds timestamp);
+
+    /**
+     * @brief Add an Opus packet, dropped before the first keyframe.
+     * @param packet The packet.
+     * @param timestamp Presentation time since the start of the recording.
+     */
+    void write_audio(std::string_view packet, std::chrono::milliseconds timestamp);
+
+    /**
+     * @brief Write the cluster in progress.
+     */
+    void finish();
+
+  private:
+    void write_headers(std::string_view codec_private);
+    void add_block(int track_number, std::string_view data, bool keyframe, std::chrono::milliseconds timestamp);
+    void flush_cluster();
+
+    std::ostream &out;
+    video_track_t video;
+    std::optional<audio_track_t> audio;
+    bool started = false;
+    std::chrono::milliseconds cluster_start {};
+    std::string cluster;  ///< Blocks of the cluster in progress
+    std::string frame;  ///< Frame converted for the container, reused between frames
+  };
+
+  /**
+   * @brief Writes a session to a file on a background thread.
+   * @details Called from the broadcast threads, which never wait for the file.
+   *          Once too much is waiting to be written, packets are dropped until the next keyframe.
+   */
+  class recorder_t {
+  public:
+    /**
+     * @param path The file to write.
+     * @param video The video track.
+     * @param audio The audio track, if the session streams audio.
+     */
+    recorder_t(std::filesystem::path path, video_track_t video, std::optional<audio_track_t> audio);
+    ~recorder_t();
+
+    recorder_t(const recorder_t &) = delete;
+    recorder_t &operator=(const recorder_t &) = delete;
+
+    /**
+     * @brief Whether the file could be opened.
+     */
+    bool is_open() const;
+
+    /**
+     * @brief Queue a video frame.
+     * @param segments The frame as sent, in parts.
+     * @param keyframe Whether the frame is an IDR frame.
+     * @param timestamp Capture time of the frame.
+     */
+    void video(const std::vector<std::string_view> &segments, bool keyframe, std::chrono::steady_clock::time_point timestamp);
+
+    /**
+     * @brief Queue an Opus packet.
+     * @param packet The packet.
+     * @param timestamp Capture time of the first sample of the packet.
+     */
+    void audio(std::string_view packet, std::chrono::steady_clock::time_point timestamp);
+
+    /**
+     * @brief Write what was queued and close the file.
+     */
+    void stop();
+
+    /**
+     * @brief Get the file and progress of the recording.
+     */
+    nlohmann::json status();
+
+  private:
+    struct block_t {
+      bool video;
+      bool keyframe;
+      std::chrono::steady_clock::time_point timestamp;
+      std::string data;
+    };
+
+    /**
+     * @brief Queue a block, locked by the caller.
+     * @return The block, with a spare buffer to fill if there is one.
+     */
+    block_t &queue_block(bool video, bool keyframe, std::chrono::steady_clock::time_point timestamp);
+    void run();
+
+    std::filesystem::path path;
+    std::ofstream file;
+    mkv_writer_t writer;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<block_t> blocks;
+    std::vector<std::string> spare;  ///< Buffers of written blocks, handed out again so steady state doesn't allocate
+    std::size_t buffered_bytes = 0;
+    bool stopping = false;
+    bool waiting_for_keyframe = true;  ///< Video is only queued from a keyframe on, at the start and after drops
+    std::optional<std::chrono::steady_clock::time_point> start_time;  ///< Capture time of the first keyframe
+
+    std::atomic<std::uint64_t> bytes_written = 0;
+    std::atomic<std::uint64_t> frames_written = 0;
+    std::atomic<std::uint64_t> frames_dropped = 0;
+    std::atomic<bool> failed = false;
+
+    std::thread thread;
+  };
+
+  /**
+   * @brief Where the broadcast threads find the recorder of a session.
+   */
+  class tap_t {
+  public:
+    /**
+     * @brief Get the recorder, if the session is being recorded.
+     * @details Only locks while a recorder is attached.
+     */
+    std::shared_ptr<recorder_t> get();
+
+    /**
+     * @brief Start handing packets to a recorder.
+     * @return `false` if a recorder is attached already.
+     */
+    bool attach(std::shared_ptr<recorder_t> recorder);
+
+    /**
+     * @brief Stop handing packets to the recorder.
+     * @return The recorder that was attached, if any.
+     */
+    std::shared_ptr<recorder_t> detach();
+
+  private:
+    std::atomic<bool> attached = false;
+    std::mutex mutex;
+    std::shared_ptr<recorder_t> recorder;
+  };
+
+  /**
+   * @brief Start recording a session to a new file in the `recording_path` directory.
+   * @param uuid UUID of the client of the session.
+   * @return The status of the recording, null if there is no such session or it couldn't be started.
+   */
+  nlohmann::json start(const std::string &uuid);
+
+  /**
+   * @brief Stop recording a session.
+   * @param uuid UUID of the client of the session.
+   * @return `true` if the session was being recorded.
+   */
+  bool stop(const std::string &uuid);
+
+  /**
+   * @brief Get the recordings in progress.
+   * @return An array with the status of each recording.
+   */
+  nlohmann::json status();
+}  // namespace recording
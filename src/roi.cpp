@@ -0,0 +1,137 @@
+/**
+ * @file src/roi.cpp
+ * @brief Definitions for region-of-interest encoding.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "roi.h"
+
+using namespace std::literals;
+
+namespace roi {
+  namespace {
+    /**
+     * @brief Scale a rectangle from image to frame pixels and clip it to the frame.
+     * @details Rotation and letterboxing by the converter are not accounted for, the regions are a hint.
+     */
+    platf::rect_t to_frame(const platf::rect_t &rect, const platf::img_t &img, int frame_width, int frame_height) {
+      auto scale = [](std::int32_t value, int from, int to) {
+        return (std::int32_t) std::clamp<std::int64_t>((std::int64_t) value * to / from, 0, to);
+      };
+
+      return {
+        scale(rect.left, img.width, frame_width),
+        scale(rect.top, img.height, frame_height),
+        scale(rect.right, img.width, frame_width),
+        scale(rect.bottom, img.height, frame_height),
+      };
+    }
+
+    bool empty(const platf::rect_t &rect) {
+      return rect.right <= rect.left || rect.bottom <= rect.top;
+    }
+
+    /**
+     * @brief Get the rectangle of the given fraction of the frame around its center.
+     */
+    platf::rect_t center(int frame_width, int frame_height, int numerator, int denominator) {
+      auto margin_x = frame_width * (denominator - numerator) / (2 * denominator);
+      auto margin_y = frame_height * (denominator - numerator) / (2 * denominator);
+      return {margin_x, margin_y, frame_width - margin_x, frame_height - margin_y};
+    }
+  }  // namespace
+
+  mode_e mode_from_view(std::string_view mode) {
+    if (mode == "changes"sv) {
+      return mode_e::changes;
+    }
+    if (mode == "focus"sv) {
+      return mode_e::focus;
+    }
+    return mode_e::disabled;
+  }
+
+  std::vector<region_t> regions(const platf::img_t &img, int frame_width, int frame_height, mode_e mode, int strength) {
+    std::vector<region_t> regions;
+    if (mode == mode_e::disabled || img.width <= 0 || img.height <= 0) {
+      return regions;
+    }
+
+    strength = std::clamp(strength, 0, max_qp_delta);
+    auto add_frame_rect = [&](const platf::rect_t &rect, int qp_delta) {
+      if (!empty(rect) && qp_delta != 0) {
+        regions.push_back({rect, qp_delta});
+      }
+    };
+    auto add = [&](const platf::rect_t &rect, int qp_delta) {
+      add_frame_rect(to_frame(rect, img, frame_width, frame_height), qp_delta);
+    };
+
+    if (img.cursor) {
+      add(*img.cursor, -strength);
+    }
+
+    if (img.damage_valid) {
+      if (img.damage.size() > max_damage_regions) {
+        auto bounds = img.damage.front();
+        for (auto &rect : img.damage) {
+          bounds.left = std::min(bounds.left, rect.left);
+          bounds.top = std::min(bounds.top, rect.top);
+          bounds.right = std::max(bounds.right, rect.right);
+          bounds.bottom = std::max(bounds.bottom, rect.bottom);
+        }
+        add(bounds, -strength);
+      } else {
+        for (auto &rect : img.damage) {
+          add(rect, -strength);
+        }
+      }
+    }
+
+    if (mode == mode_e::focus) {
+      add_frame_rect(center(frame_width, frame_height, 1, 2), -strength);
+      add_frame_rect(center(frame_width, frame_height, 3, 4), -strength / 2);
+    }
+
+    return regions;
+  }
+
+  int block_size(int video_format) {
+    switch (video_format) {
+      case 0:
+        return 16;
+      case 1:
+        return 32;
+      default:
+        return 64;
+    }
+  }
+
+  void build_map(const std::vector<region_t> &regions, int block_size, int frame_width, int frame_height, std::vector<std::int8_t> &map) {
+    auto blocks_x = (frame_width + block_size - 1) / block_size;
+    auto blocks_y = (frame_height + block_size - 1) / block_size;
+    map.assign((std::size_t) blocks_x * blocks_y, 0);
+
+    // Paint in reverse so the first region wins where they overlap
+    for (auto it = std::rbegin(regions); it != std::rend(regions); ++it) {
+      auto &rect = it->rect;
+      if (empty(rect)) {
+        continue;
+      }
+
+      auto qp_delta = (std::int8_t) std::clamp(it->qp_delta, -max_qp_delta, max_qp_delta);
+      auto first_x = std::max(rect.left, 0) / block_size;
+      auto last_x = std::min((rect.right - 1) / block_size, blocks_x - 1);
+      auto last_y = std::min((rect.bottom - 1) / block_size, blocks_y - 1);
+      if (first_x > last_x) {
+        continue;
+      }
+      for (auto y = std::max(rect.top, 0) / block_size; y <= last_y; ++y) {
+        auto row = std::begin(map) + (std::ptrdiff_t) y * blocks_x;
+        std::fill(row + first_x, row + last_x + 1, qp_delta);
+      }
+    }
+  }
+}  // namespace roi
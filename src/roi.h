@@ -0,0 +1,73 @@
+/**
+ * @file src/roi.h
+ * @brief Declarations for region-of-interest encoding.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "platform/common.h"
+
+namespace roi {
+  constexpr int max_qp_delta = 25;  ///< Largest QP delta of a region, the range libavcodec maps its ROI offsets to
+  constexpr std::size_t max_damage_regions = 8;  ///< More changed regions are merged into their bounding box
+
+  /**
+   * @brief Which parts of the frame get more of the bitrate.
+   */
+  enum class mode_e {
+    disabled,  ///< Encode every region uniformly
+    changes,  ///< The regions that changed since the previous frame and the cursor
+    focus,  ///< Same as `changes`, plus the center of the frame
+  };
+
+  /**
+   * @brief Get the mode from the `roi_mode` option.
+   * @param mode "disabled", "changes" or "focus".
+   * @return The mode, `mode_e::disabled` if unknown.
+   */
+  mode_e mode_from_view(std::string_view mode);
+
+  /**
+   * @brief A part of the frame with its own QP delta.
+   */
+  struct region_t {
+    platf::rect_t rect;  ///< In frame pixels
+    int qp_delta;  ///< Negative for a better quality than the rest of the frame
+  };
+
+  /**
+   * @brief Get the regions of interest of a captured image.
+   * @details The changed regions and the cursor of the image are scaled to the frame. Images whose capture
+   *          backend doesn't report them only get the focus regions. Where regions overlap, the first one applies.
+   * @param img The captured image.
+   * @param frame_width Width of the encoded frame.
+   * @param frame_height Height of the encoded frame.
+   * @param mode Which regions to prioritize.
+   * @param strength QP delta given to the regions of interest, the outer focus ring gets half of it.
+   * @return The regions, in priority order.
+   */
+  std::vector<region_t> regions(const platf::img_t &img, int frame_width, int frame_height, mode_e mode, int strength);
+
+  /**
+   * @brief Get the size of the blocks NVENC takes a QP delta per.
+   * @param video_format 0 for H.264, 1 for HEVC, 2 for AV1.
+   * @return The macroblock size for H.264, the CTB size for HEVC or the superblock size for AV1.
+   */
+  int block_size(int video_format);
+
+  /**
+   * @brief Rasterize regions into a QP delta map, in raster scan order.
+   * @details Each block gets the delta of the first region overlapping it, 0 if there is none.
+   * @param regions The regions, in priority order.
+   * @param block_size Width and height of a block in pixels.
+   * @param frame_width Width of the encoded frame.
+   * @param frame_height Height of the encoded frame.
+   * @param map Receives a delta per block, reused between frames.
+   */
+  void build_map(const std::vector<region_t> &regions, int block_size, int frame_width, int frame_height, std::vector<std::int8_t> &map);
+}  // namespace roi
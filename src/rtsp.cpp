@@ -13,8 +13,10 @@ extern "C" {
 #include <algorithm>
 #include <array>
 #include <cctype>
+#include <cmath>
 #include <cstdint>
 #include <format>
+#include <optional>
 #include <set>
 #include <unordered_map>
 #include <utility>
@@ -24,6 +26,7 @@ extern "C" {
 #include <boost/bind.hpp>
 
 // local includes
+#include "admission.h"
 #include "config.h"
 #include "globals.h"
 #include "input.h"
@@ -993,6 +996,31 @@ namespace rtsp_stream {
     respond(sock, session, &option, 200, "OK", req->sequenceNumber, {});
   }
 
+  /**
+   * @brief Get the video packet size to offer a client whose path has a larger MTU than usual.
+   * @param remote The address of the client.
+   * @return The packet size, or `std::nullopt` if the client should pick its own.
+   */
+  std::optional<int> offered_packet_size(const boost::asio::ip::address &remote) {
+    auto address = net::normalize_address(remote);
+    if (!config::stream.lan_large_packets || net::from_address(address.to_string()) == net::WAN) {
+      return std::nullopt;
+    }
+
+    auto mtu = platf::path_mtu(address);
+    if (!mtu) {
+      return std::nullopt;
+    }
+
+    // Clients already pick packets that fit a standard MTU
+    auto packet_size = std::min(stream::packet_size_for_mtu(*mtu, address.is_v6()), stream::MAX_OFFERED_PACKET_SIZE);
+    if (packet_size <= stream::packet_size_for_mtu(1500, address.is_v6())) {
+      return std::nullopt;
+    }
+
+    return packet_size;
+  }
+
   void cmd_describe(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM option {};
 
@@ -1032,6 +1060,12 @@ namespace rtsp_stream {
       ss << "a=x-nv-video[0].refPicInvalidation:1"sv << std::endl;
     }
 
+    // Fewer, larger video packets where the path carries them, the client decides in its ANNOUNCE
+    if (auto packet_size = offered_packet_size(sock.remote_endpoint().address())) {
+      BOOST_LOG(info) << "Offering video packets of up to "sv << *packet_size << " bytes"sv;
+      ss << "a=x-ss-video[0].maxPacketSize:"sv << *packet_size << std::endl;
+    }
+
     if (video::active_hevc_mode != 1) {
       ss << "sprop-parameter-sets=AAAAAU"sv << std::endl;
     }
@@ -1235,6 +1269,8 @@ namespace rtsp_stream {
       config.monitor.bitrate =
         std::min(config.monitor.bitrate, static_cast<int>(CLIENT_MAX_REQUESTED_BITRATE_KBPS));
       config.monitor.slicesPerFrame = util::from_view(args.at("x-nv-video[0].videoEncoderSlicesPerFrame"sv));
+      // Any decoder can take more slices than it asked for, a decoder that asks for one may still have threads to spare
+      config.monitor.slicesPerFrame = std::max(config.monitor.slicesPerFrame, config::video.min_slices_per_frame);
       config.monitor.numRefFrames = util::from_view(args.at("x-nv-video[0].maxNumReferenceFrames"sv));
       config.monitor.encoderCscMode = util::from_view(args.at("x-nv-video[0].encoderCscMode"sv));
       config.monitor.videoFormat = util::from_view(args.at("x-nv-vqos[0].bitStreamFormat"sv));
@@ -1259,6 +1295,8 @@ namespace rtsp_stream {
       }
 
       config.monitor.input_only = session.input_only;
+      config.monitor.encoderProfile = (int) video::encoder_profile_from_view(session.encoder_profile);
+      config.monitor.contentType = (int) video::content_type_from_view(session.content_type);
 
       configuredBitrateKbps = util::from_view(args.at("x-ml-video.configuredBitrateKbps"sv));
 
@@ -1274,9 +1312,9 @@ namespace rtsp_stream {
 
       BOOST_LOG(info) << "Client Requested bitrate is [" << configuredBitrateKbps << "kbps]";
 
-      if (config::video.max_bitrate > 0) {
-        if (config::video.max_bitrate < configuredBitrateKbps) {
-          configuredBitrateKbps = config::video.max_bitrate;
+      if (auto max_bitrate = config::get_auto_bitrate_settings().max_bitrate_cap; max_bitrate > 0) {
+        if (max_bitrate < configuredBitrateKbps) {
+          configuredBitrateKbps = max_bitrate;
         }
       }
 
@@ -1294,6 +1332,14 @@ namespace rtsp_stream {
       return;
     }
 
+    // A video packet the path can't carry whole is fragmented, and lost with any of its fragments
+    {
+      auto address = net::normalize_address(sock.remote_endpoint().address());
+      if (auto mtu = platf::path_mtu(address); mtu && config.packetsize > stream::packet_size_for_mtu(*mtu, address.is_v6())) {
+        BOOST_LOG(warning) << "Client video packets of "sv << config.packetsize << " bytes may be fragmented on the path MTU of "sv << *mtu << " bytes"sv;
+      }
+    }
+
     // When using stereo audio, the audio quality is (strangely) indicated by whether the Host field
     // in the RTSP message matches a local interface's IP address. Fortunately, Moonlight always sends
     // 0.0.0.0 when it wants low quality, so it is easy to check without enumerating interfaces.
@@ -1340,8 +1386,8 @@ namespace rtsp_stream {
 
       // If the FEC percentage isn't too high, adjust the configured bitrate to ensure video
       // traffic doesn't exceed the user's selected bitrate when the FEC shards are included.
-      if (config::stream.fec_percentage <= 80) {
-        configuredBitrateKbps /= 100.f / (100 - config::stream.fec_percentage);
+      if (auto fec_percentage = config::get_auto_bitrate_settings().fec_percentage; fec_percentage <= 80) {
+        configuredBitrateKbps /= 100.f / (100 - fec_percentage);
       }
 
       // Adjust the bitrate to account for audio traffic bandwidth usage (capped at 20% reduction).
@@ -1440,12 +1486,34 @@ namespace rtsp_stream {
       return;
     }
 
+    // The sessions set up since the launch may have taken the capacity the launch was admitted with
+    std::unique_ptr<platf::deinit_t> admission;
+    if (!session.input_only) {
+      auto fps = static_cast<int>(std::round(config.monitor.encodingFramerate / 1000.0));
+      auto decision = admission::controller().evaluate({config.monitor.width, config.monitor.height, fps});
+      if (decision.verdict == admission::verdict_e::reject) {
+        respond(sock, session, &option, 503, "Service Unavailable", req->sequenceNumber, {});
+        return;
+      }
+
+      if (decision.verdict == admission::verdict_e::downgrade) {
+        config.monitor.width = decision.stream.width;
+        config.monitor.height = decision.stream.height;
+        if (decision.stream.fps != fps) {
+          config.monitor.framerate = decision.stream.fps;
+          config.monitor.encodingFramerate = decision.stream.fps * 1000;
+        }
+      }
+      admission = admission::controller().reserve(decision.stream);
+    }
+
     // Store auto bitrate flag and min/max in launch session - will be copied to stream session during alloc
     session.auto_bitrate_enabled = auto_bitrate_enabled;
     session.auto_bitrate_min_kbps = auto_bitrate_min_kbps;
     session.auto_bitrate_max_kbps = auto_bitrate_max_kbps;
     
     auto stream_session = stream::session::alloc(config, session);
+    stream_session->admission = std::move(admission);
     
     server->insert(stream_session);
 
@@ -1473,7 +1541,7 @@ namespace rtsp_stream {
   }
 
   void start() {
-    auto shutdown_event = mail::man->event<bool>(mail::shutdown);
+    auto shutdown_event = mail::man->event(mail::shutdown);
 
     server.map("OPTIONS"sv, &cmd_option);
     server.map("DESCRIBE"sv, &cmd_describe);
@@ -1490,7 +1558,7 @@ namespace rtsp_stream {
     }
 
     std::thread rtsp_thread {[&shutdown_event] {
-      auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+      auto broadcast_shutdown_event = mail::man->event(mail::broadcast_shutdown);
 
       while (!shutdown_event->peek()) {
         server.iterate();
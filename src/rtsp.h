@@ -56,6 +56,8 @@ namespace rtsp_stream {
     bool enable_sops;  ///< Whether to enable SOPS (Secure Operations)
     bool virtual_display;  ///< Whether to use virtual display
     uint32_t scale_factor;  ///< Display scale factor
+    std::string encoder_profile;  ///< Encoder profile of the application being streamed
+    std::string content_type;  ///< Content type of the application being streamed
 
     std::optional<crypto::cipher::gcm_t> rtsp_cipher;  ///< RTSP encryption cipher
     std::string rtsp_url_scheme;  ///< RTSP URL scheme (rtsp:// or rtsps://)
@@ -6,6 +6,7 @@
 // standard includes
 #include <fstream>
 #include <future>
+#include <limits>
 #include <queue>
 #include <unordered_map>
 
@@ -26,14 +27,20 @@ extern "C" {
 #include "crypto.h"
 #include "display_device.h"
 #include "globals.h"
+#include "hot_log.h"
 #include "input.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
+#include "overload.h"
+#include "pipeline_trace.h"
 #include "platform/common.h"
 #include "process.h"
 #include "stream.h"
 #include "sync.h"
 #include "system_tray.h"
+#include "thread_placement.h"
+#include "thread_pool.h"
 #include "thread_safe.h"
 #include "utility.h"
 
@@ -58,6 +65,7 @@ extern "C" {
 #define IDX_CONNECTION_STATUS 19
 #define IDX_BITRATE_STATS 20
 #define IDX_AUTO_BITRATE_STATS_V2 21
+#define IDX_RETRANSMIT_REQUEST 22
 
 static const short packetTypes[] = {
   0x0305,  // Start A
@@ -82,6 +90,7 @@ static const short packetTypes[] = {
   0x3003,  // Connection status (Apollo protocol extension)
   0x5504,  // Bitrate Stats (Sunshine protocol extension)
   0x5505,  // Auto Bitrate Stats V2 (Sunshine protocol extension)
+  0x3004,  // Video retransmission request (Apollo protocol extension)
 };
 
 namespace asio = boost::asio;
@@ -434,8 +443,35 @@ namespace stream {
    */
   int control_server_t::bind(net::af_e address_family, std::uint16_t port) {
     _host = net::host_create(address_family, _addr, port);
+    if (!_host) {
+      return -1;
+    }
+
+    // ENet can't be interrupted while it waits, so iterate waits on the sockets itself
+    // Stop at the first failure, so a half set up socket doesn't keep the poll only fallback from applying
+    boost::system::error_code ec;
+    _wake_recv.open(udp::v4(), ec);
+    if (!ec) {
+      _wake_recv.bind(udp::endpoint {asio::ip::address_v4::loopback(), 0}, ec);
+    }
+    if (!ec) {
+      _wake_recv.non_blocking(true, ec);
+    }
+    if (!ec) {
+      _wake_endpoint = _wake_recv.local_endpoint(ec);
+    }
+    if (!ec) {
+      _wake_send.open(udp::v4(), ec);
+    }
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't create the wakeup sockets of the control stream, it will only poll: "sv << ec.message();
+
+      boost::system::error_code close_ec;
+      _wake_recv.close(close_ec);
+      _wake_send.close(close_ec);
+    }
 
-    return !(bool) _host;
+    return 0;
   }
 
   /**
@@ -475,6 +511,23 @@ namespace stream {
     enet_host_flush(_host.get());
   }
 
+  /**
+   * @brief Wake the control thread up.
+   * 
+   * Sends a datagram to the wakeup socket, unless one is already pending.
+   */
+  void control_server_t::wake() {
+    if (_wake_pending.exchange(true, std::memory_order_acq_rel) || !_wake_send.is_open()) {
+      return;
+    }
+
+    std::lock_guard lg {_wake_lock};
+
+    char wakeup = 0;
+    boost::system::error_code ec;
+    _wake_send.send_to(asio::buffer(&wakeup, sizeof(wakeup)), _wake_endpoint, 0, ec);
+  }
+
 
   /**
    * @brief Encode control message with optional encryption.
@@ -539,6 +592,81 @@ namespace stream {
     return std::string_view {(char *) tagged_cipher.data(), packet_length + sizeof(control_encrypted_t) - sizeof(control_encrypted_t::seq)};
   }
 
+  /**
+   * @brief Buffers of received packets released by the sessions, reused by recvThread.
+   * @details Defined before the broadcast context, so it outlives the packets still queued there.
+   */
+  struct packet_pool_t {
+    static constexpr std::size_t max_buffers = 64;  ///< Buffers kept, more are freed
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<std::string>> buffers;
+  };
+
+  static packet_pool_t packet_pool;
+
+  void recycle_packet_t::operator()(std::string *packet) const {
+    std::unique_ptr<std::string> buffer {packet};
+
+    std::lock_guard lg {packet_pool.mutex};
+    if (packet_pool.buffers.size() < packet_pool_t::max_buffers) {
+      if (packet_pool.buffers.empty()) {
+        packet_pool.buffers.reserve(packet_pool_t::max_buffers);
+      }
+      packet_pool.buffers.emplace_back(std::move(buffer));
+    }
+  }
+
+  /**
+   * @brief Copy a received packet into a pooled buffer.
+   * @param data The packet.
+   * @return The buffer, handed back to the pool when released.
+   */
+  packet_buffer_t pooled_packet(std::string_view data) {
+    std::unique_ptr<std::string> buffer;
+    {
+      std::lock_guard lg {packet_pool.mutex};
+      if (!packet_pool.buffers.empty()) {
+        buffer = std::move(packet_pool.buffers.back());
+        packet_pool.buffers.pop_back();
+      }
+    }
+
+    if (!buffer) {
+      buffer = std::make_unique<std::string>();
+    }
+    buffer->assign(data);
+
+    return packet_buffer_t {buffer.release()};
+  }
+
+  /**
+   * @brief Enable QoS on a socket a session sends on and report whether its traffic is marked.
+   * @param native_socket The native socket handle.
+   * @param address The destination address of the session's traffic.
+   * @param port The destination port of the session's traffic.
+   * @param data_type The type of traffic.
+   * @param dscp_tagging Whether the client asked for DSCP tagging.
+   * @param dscp_marked Session gauge that receives the DSCP value the OS marks the traffic with.
+   * @return The QoS handler, which disables QoS when destroyed.
+   */
+  std::unique_ptr<platf::deinit_t> enable_session_qos(std::uintptr_t native_socket, boost::asio::ip::address address, std::uint16_t port, platf::qos_data_type_e data_type, bool dscp_tagging, std::atomic<std::uint32_t> &dscp_marked) {
+    int dscp = 0;
+    auto qos = platf::enable_socket_qos(native_socket, address, port, data_type, dscp_tagging, dscp);
+    dscp_marked.store(dscp, std::memory_order_relaxed);
+
+    auto name = data_type == platf::qos_data_type_e::video ? "Video"sv : data_type == platf::qos_data_type_e::audio ? "Audio"sv : "Control"sv;
+    if (!dscp_tagging) {
+      BOOST_LOG(debug) << name << " traffic isn't DSCP tagged, the client didn't ask for it"sv;
+    } else if (dscp) {
+      BOOST_LOG(info) << name << " traffic is marked with DSCP "sv << dscp;
+    } else {
+      BOOST_LOG(warning) << name << " traffic isn't marked, the OS didn't accept the QoS class"sv;
+    }
+
+    return qos;
+  }
+
   /**
    * @brief Start broadcast server.
    * 
@@ -623,6 +751,13 @@ namespace stream {
       // proper routing on multi-homed hosts.
       auto local_address = platf::from_sockaddr((sockaddr *) &peer->localAddress.address);
       session_p->localAddress = boost::asio::ip::make_address(local_address);
+      session_p->video.link_speed = platf::get_link_speed(local_address);
+
+      // The default profile leaves the control stream to the opportunistic tagging set up in host_create()
+      if (config::stream.qos_profile != config::QOS_PROFILE_DEFAULT) {
+        auto peer_address = boost::asio::ip::make_address(peer_addr);
+        session_p->control.qos = enable_session_qos(_host->socket, peer_address, peer_port, platf::qos_data_type_e::control, session_p->config.audioQosType != 0, session_p->stats.control_dscp);
+      }
 
       BOOST_LOG(debug) << "Control local address ["sv << local_address << ']';
       BOOST_LOG(debug) << "Control peer address ["sv << peer_addr << ':' << peer_port << ']';
@@ -667,48 +802,88 @@ namespace stream {
    * 
    * Handles incoming connections, disconnections, and control messages.
    * Updates session ping timeouts and routes messages to registered handlers.
+   * Events that arrived together are handled in one call, so a burst of input
+   * from one client doesn't wait for a pass over all sessions per message.
    * 
-   * @param timeout Maximum time to wait for events.
+   * @param timeout Maximum time to wait for the first event.
    */
   void control_server_t::iterate(std::chrono::milliseconds timeout) {
     ENetEvent event;
-    auto res = enet_host_service(_host.get(), &event, timeout.count());
+    int res;
+    if (!_wake_recv.is_open()) {
+      res = enet_host_service(_host.get(), &event, timeout.count());
+    } else {
+      res = enet_host_service(_host.get(), &event, 0);
+      if (res == 0 && !_wake_pending.load(std::memory_order_acquire)) {
+        // Wait for a control packet or a wakeup, whichever comes first
+        auto wake_socket = (ENetSocket) _wake_recv.native_handle();
+        ENetSocketSet read_set;
+        ENET_SOCKETSET_EMPTY(read_set);
+        ENET_SOCKETSET_ADD(read_set, _host->socket);
+        ENET_SOCKETSET_ADD(read_set, wake_socket);
+        enet_socketset_select(std::max(_host->socket, wake_socket), &read_set, nullptr, timeout.count());
+
+        res = enet_host_service(_host.get(), &event, 0);
+      }
 
-    if (res > 0) {
-      auto session = get_session(event.peer, event.data);
-      if (!session) {
-        BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
-        enet_peer_disconnect_now(event.peer, 0);
+      // Cleared before draining, so a wakeup sent meanwhile makes the next call return right away
+      _wake_pending.store(false, std::memory_order_release);
 
-        return;
+      char wakeup;
+      boost::system::error_code ec;
+      udp::endpoint sender;
+      while (_wake_recv.receive_from(asio::buffer(&wakeup, sizeof(wakeup)), sender, 0, ec) > 0 && !ec) {
+      }
+    }
+
+    // Bounded, so the session loop still gets to send feedback and check timeouts
+    for (int events = 1; res > 0; ++events) {
+      handle_event(event);
+      if (events == max_events_per_iteration) {
+        break;
       }
+      res = enet_host_check_events(_host.get(), &event);
+    }
+  }
+
+  /**
+   * @brief Handle one ENet event of the control server.
+   * @param event The event.
+   */
+  void control_server_t::handle_event(ENetEvent &event) {
+    auto session = get_session(event.peer, event.data);
+    if (!session) {
+      BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
+      enet_peer_disconnect_now(event.peer, 0);
 
-      session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
+      return;
+    }
 
-      switch (event.type) {
-        case ENET_EVENT_TYPE_RECEIVE:
-          {
-            net::packet_t packet {event.packet};
+    session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
 
-            auto type = *(std::uint16_t *) packet->data;
-            std::string_view payload {(char *) packet->data + sizeof(type), packet->dataLength - sizeof(type)};
+    switch (event.type) {
+      case ENET_EVENT_TYPE_RECEIVE:
+        {
+          net::packet_t packet {event.packet};
 
-            call(type, session, payload, false);
-          }
-          break;
-        case ENET_EVENT_TYPE_CONNECT:
-          BOOST_LOG(info) << "CLIENT CONNECTED"sv;
-          break;
-        case ENET_EVENT_TYPE_DISCONNECT:
-          BOOST_LOG(info) << "CLIENT DISCONNECTED"sv;
-          // No more clients to send video data to ^_^
-          if (session->state == session::state_e::RUNNING) {
-            session::stop(*session);
-          }
-          break;
-        case ENET_EVENT_TYPE_NONE:
-          break;
-      }
+          auto type = *(std::uint16_t *) packet->data;
+          std::string_view payload {(char *) packet->data + sizeof(type), packet->dataLength - sizeof(type)};
+
+          call(type, session, payload, false);
+        }
+        break;
+      case ENET_EVENT_TYPE_CONNECT:
+        BOOST_LOG(info) << "CLIENT CONNECTED"sv;
+        break;
+      case ENET_EVENT_TYPE_DISCONNECT:
+        BOOST_LOG(info) << "CLIENT DISCONNECTED"sv;
+        // No more clients to send video data to ^_^
+        if (session->state == session::state_e::RUNNING) {
+          session::stop(*session);
+        }
+        break;
+      case ENET_EVENT_TYPE_NONE:
+        break;
     }
   }
 
@@ -717,11 +892,46 @@ namespace stream {
       reed_solomon_release(rs);
     }>;
 
+    /**
+     * @brief Reusable backing storage for the padding, parity shards and headers of one FEC block.
+     * @details The buffers only ever grow, so once a slot has seen the largest block of a
+     *          stream, encoding into it performs no further heap allocations.
+     */
+    struct shard_buffers_t {
+      util::buffer_t<char> shards;
+      util::buffer_t<char> headers;
+      util::buffer_t<uint8_t *> shards_p;
+
+      std::vector<platf::buffer_descriptor_t> payload_buffers;
+
+      /**
+       * @brief Ensure the buffers are large enough for a block and reset the payload descriptors.
+       * @param shard_bytes Bytes needed for the padded data shard and the parity shards.
+       * @param header_bytes Bytes needed for the per-shard prefixes.
+       * @param nr_shards Total number of data and parity shards.
+       */
+      void prepare(size_t shard_bytes, size_t header_bytes, size_t nr_shards) {
+        if (shards.size() < shard_bytes) {
+          shards = util::buffer_t<char> {shard_bytes};
+        }
+        if (headers.size() < header_bytes) {
+          headers = util::buffer_t<char> {header_bytes};
+        }
+        if (shards_p.size() < nr_shards) {
+          shards_p = util::buffer_t<uint8_t *> {nr_shards};
+        }
+
+        payload_buffers.clear();
+      }
+    };
+
     /**
      * @brief Forward Error Correction (FEC) structure.
      * 
      * Manages FEC encoding for video packets, including data shards,
      * parity shards, and buffer management for Reed-Solomon encoding.
+     * The storage is borrowed from a shard_buffers_t slot, which must
+     * not be reused until this block has been sent.
      */
     struct fec_t {
       size_t data_shards;
@@ -730,18 +940,22 @@ namespace stream {
 
       size_t blocksize;
       size_t prefixsize;
-      util::buffer_t<char> shards;
-      util::buffer_t<char> headers;
-      util::buffer_t<uint8_t *> shards_p;
-
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
+      shard_buffers_t *buffers;
 
       char *data(size_t el) {
-        return (char *) shards_p[el];
+        return (char *) buffers->shards_p[el];
       }
 
       char *prefix(size_t el) {
-        return prefixsize ? &headers[el * prefixsize] : nullptr;
+        return prefixsize ? &buffers->headers[el * prefixsize] : nullptr;
+      }
+
+      char *headers() {
+        return buffers->headers.begin();
+      }
+
+      std::vector<platf::buffer_descriptor_t> &payload_buffers() {
+        return buffers->payload_buffers;
       }
 
       size_t size() const {
@@ -749,20 +963,81 @@ namespace stream {
       }
     };
 
-    static fec_t encode(const std::string_view &payload, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t prefixsize) {
-      auto payload_size = payload.size();
-
-      auto pad = payload_size % blocksize != 0;
-
-      auto aligned_data_shards = payload_size / blocksize;
-      auto data_shards = aligned_data_shards + (pad ? 1 : 0);
+    /**
+     * @brief Compute the number of data and parity shards for an FEC block.
+     * @details This is deterministic for a given payload size, which allows callers
+     *          to know the shard layout of every block in a frame before encoding any of them.
+     * @param payload_size Size of the FEC block payload in bytes.
+     * @param blocksize Size of each shard in bytes.
+     * @param fecpercentage Requested FEC percentage (may be increased to meet the parity minimum).
+     * @param minparityshards Minimum number of parity shards.
+     * @return Pair of data shard count and parity shard count.
+     */
+    static std::pair<size_t, size_t> shard_count(size_t payload_size, size_t blocksize, size_t &fecpercentage, size_t minparityshards) {
+      auto data_shards = (payload_size + (blocksize - 1)) / blocksize;
       auto parity_shards = (data_shards * fecpercentage + 99) / 100;
 
       // increase the FEC percentage for this frame if the parity shard minimum is not met
       if (parity_shards < minparityshards && fecpercentage != 0) {
         parity_shards = minparityshards;
         fecpercentage = (100 * parity_shards) / data_shards;
+      }
+
+      return {data_shards, parity_shards};
+    }
+
+    /**
+     * @brief Small LRU cache of prepared Reed-Solomon contexts keyed by shard geometry.
+     * @details Creating a context builds and inverts the encoding matrix, which is far more
+     *          expensive than the lookup. Steady-state P-frames only hit a handful of
+     *          geometries, so a few entries are enough. Not thread-safe; each encoding
+     *          thread must use its own cache.
+     */
+    class rs_cache_t {
+    public:
+      static constexpr size_t max_entries = 4;
+
+      /**
+       * @brief Get a context for the given geometry, creating it on a cache miss.
+       * @param data_shards Number of data shards.
+       * @param parity_shards Number of parity shards.
+       * @return The cached context, owned by the cache.
+       */
+      reed_solomon *get(int data_shards, int parity_shards) {
+        auto key = std::make_pair(data_shards, parity_shards);
+
+        auto it = std::find_if(std::begin(_entries), std::end(_entries), [&key](const auto &entry) {
+          return entry.first == key;
+        });
+
+        if (it == std::end(_entries)) {
+          if (_entries.size() == max_entries) {
+            _entries.pop_back();
+          }
+
+          _entries.emplace_back(key, rs_t {reed_solomon_new(data_shards, parity_shards)});
+          it = std::prev(std::end(_entries));
+        }
+
+        // Keep the most recently used entry at the front
+        std::rotate(std::begin(_entries), it, std::next(it));
+        return _entries.front().second.get();
+      }
+
+    private:
+      std::vector<std::pair<std::pair<int, int>, rs_t>> _entries;
+    };
+
+    static fec_t encode(const std::string_view &payload, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t prefixsize, rs_cache_t &rs_cache, shard_buffers_t &buffers) {
+      auto payload_size = payload.size();
+
+      auto pad = payload_size % blocksize != 0;
+
+      auto aligned_data_shards = payload_size / blocksize;
+      auto requested_fecpercentage = fecpercentage;
+      auto [data_shards, parity_shards] = shard_count(payload_size, blocksize, fecpercentage, minparityshards);
 
+      if (fecpercentage != requested_fecpercentage) {
         BOOST_LOG(verbose) << "Increasing FEC percentage to "sv << fecpercentage << " to meet parity shard minimum"sv << std::endl;
       }
 
@@ -771,10 +1046,12 @@ namespace stream {
       // If we need to store a zero-padded data shard, allocate that first to
       // to keep the shards in order and reduce buffer fragmentation
       auto parity_shard_offset = pad ? 1 : 0;
-      util::buffer_t<char> shards {(parity_shard_offset + parity_shards) * blocksize};
-      util::buffer_t<uint8_t *> shards_p {nr_shards};
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
-      payload_buffers.reserve(2);
+      auto shards_size = (parity_shard_offset + parity_shards) * blocksize;
+      buffers.prepare(shards_size, nr_shards * prefixsize, nr_shards);
+
+      auto &shards = buffers.shards;
+      auto &shards_p = buffers.shards_p;
+      auto &payload_buffers = buffers.payload_buffers;
 
       // Point into the payload buffer for all except the final padded data shard
       auto next = std::begin(payload);
@@ -800,7 +1077,7 @@ namespace stream {
       }
 
       // Add a payload buffer describing the shard buffer
-      payload_buffers.emplace_back(std::begin(shards), shards.size());
+      payload_buffers.emplace_back(std::begin(shards), shards_size);
 
       if (fecpercentage != 0) {
         // Point into our allocated buffer for the parity shards
@@ -809,9 +1086,9 @@ namespace stream {
         }
 
         // packets = parity_shards + data_shards
-        rs_t rs {reed_solomon_new(data_shards, parity_shards)};
+        auto rs = rs_cache.get(data_shards, parity_shards);
 
-        reed_solomon_encode(rs.get(), shards_p.begin(), nr_shards, blocksize);
+        reed_solomon_encode(rs, shards_p.begin(), nr_shards, blocksize);
       }
 
       return {
@@ -820,14 +1097,151 @@ namespace stream {
         fecpercentage,
         blocksize,
         prefixsize,
-        std::move(shards),
-        util::buffer_t<char> {nr_shards * prefixsize},
-        std::move(shards_p),
-        std::move(payload_buffers),
+        &buffers,
       };
     }
   }  // namespace fec
 
+  void retransmit_buffer_t::enable() {
+    std::lock_guard lg {mutex};
+    if (entries.empty()) {
+      entries.resize(capacity);
+    }
+    _enabled.store(true, std::memory_order_relaxed);
+  }
+
+  void retransmit_buffer_t::store(std::uint16_t sequence_number, std::string_view prefix, std::string_view packet, std::chrono::steady_clock::time_point sent) {
+    std::lock_guard lg {mutex};
+
+    // Entries keep their allocation, so steady-state stores only copy
+    auto &entry = entries[next];
+    auto reserved = entry.data.capacity();
+    entry.sequence_number = sequence_number;
+    entry.sent = sent;
+    entry.data.assign(prefix);
+    entry.data.append(packet);
+    if (entry.data.capacity() != reserved) {
+      _bytes.fetch_add(entry.data.capacity() - reserved, std::memory_order_relaxed);
+    }
+
+    next = (next + 1) % entries.size();
+    count = std::min(count + 1, entries.size());
+  }
+
+  bool retransmit_buffer_t::find(std::uint16_t sequence_number, std::chrono::steady_clock::time_point not_before, std::string &packet) {
+    std::lock_guard lg {mutex};
+    if (!count) {
+      return false;
+    }
+
+    // Sequence numbers are stored in order, so the distance from the newest entry locates the packet
+    auto newest = (next + entries.size() - 1) % entries.size();
+    std::uint16_t distance = entries[newest].sequence_number - sequence_number;
+    if (distance >= count) {
+      return false;
+    }
+
+    auto &entry = entries[(newest + entries.size() - distance) % entries.size()];
+    if (entry.sequence_number != sequence_number || entry.sent < not_before) {
+      return false;
+    }
+
+    packet = entry.data;
+    return true;
+  }
+
+  void frame_numbering_t::skip(std::int64_t frame_index) {
+    std::lock_guard lg {mutex};
+
+    skipped.insert(std::upper_bound(std::begin(skipped), std::end(skipped), frame_index), frame_index);
+    if (skipped.size() > capacity) {
+      skipped.erase(std::begin(skipped));
+      ++forgotten;
+    }
+  }
+
+  std::int64_t frame_numbering_t::to_client(std::int64_t frame_index) {
+    std::lock_guard lg {mutex};
+
+    auto earlier = std::lower_bound(std::begin(skipped), std::end(skipped), frame_index) - std::begin(skipped);
+    return frame_index - forgotten - earlier;
+  }
+
+  std::int64_t frame_numbering_t::to_encoder(std::int64_t frame_index) {
+    std::lock_guard lg {mutex};
+
+    // Every skip at or before the frame moves it one further
+    frame_index += forgotten;
+    for (auto skipped_index : skipped) {
+      if (skipped_index > frame_index) {
+        break;
+      }
+      ++frame_index;
+    }
+    return frame_index;
+  }
+
+  static auto &packets_retransmitted = metrics::counter("video_packets_retransmitted"sv);  ///< Video packets sent again on request of the client.
+  static auto &retransmit_misses = metrics::counter("video_retransmit_misses"sv);  ///< Requested video packets that were too old to retransmit.
+  static auto &video_budget_drops = metrics::counter("video_budget_drops"sv);  ///< Video backlogs cut down for exceeding the memory budget of their session.
+
+  int packet_size_for_mtu(int mtu, bool v6) {
+    auto ip_udp_headers = (v6 ? 40 : 20) + 8;
+    auto packet_size = mtu - ip_udp_headers - MAX_RTP_HEADER_SIZE - (int) sizeof(video_packet_enc_prefix_t);
+    return std::max(packet_size, 0) / 16 * 16;
+  }
+
+  /**
+   * @brief How long a sent video packet is worth retransmitting.
+   * @details A request for a lost packet arrives about one round trip after it was sent.
+   *          Past two round trips, the frame will likely be recovered by FEC or reference frame invalidation instead.
+   * @param rtt Client round trip time in milliseconds, or 0 if unknown.
+   * @param rtt_variance Client round trip time variance in milliseconds.
+   * @return The retransmission window.
+   */
+  std::chrono::milliseconds retransmit_window(std::uint32_t rtt, std::uint32_t rtt_variance) {
+    // Clients wait for reordered packets before asking, which dominates the round trip on a LAN
+    constexpr auto min_window = 20ms;
+    constexpr auto max_window = 250ms;
+
+    return std::clamp<std::chrono::milliseconds>(std::chrono::milliseconds {2 * (rtt + 2 * rtt_variance)}, min_window, max_window);
+  }
+
+  /**
+   * @brief Let more sockets bind the same port, the kernel spreads the received packets across them.
+   * @param sock The open socket, not bound yet.
+   * @return `true` on success, `false` if the platform doesn't support `SO_REUSEPORT`.
+   */
+  bool enable_reuse_port(udp::socket &sock) {
+#ifdef SO_REUSEPORT
+    boost::system::error_code ec;
+    sock.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true), ec);
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't set SO_REUSEPORT: "sv << ec.message();
+      return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Get the socket the video of a session is sent from.
+   * @param session The session, pinned to a broadcast worker.
+   * @param ctx The broadcast context.
+   * @return The socket of the session's worker.
+   */
+  udp::socket &video_socket(session_t *session, broadcast_ctx_t &ctx) {
+    auto worker = session->video.broadcast_worker;
+    if (worker <= 0 || worker > ctx.video_worker_socks.size()) {
+      return ctx.video_sock;
+    }
+
+    return ctx.video_worker_socks[worker - 1];
+  }
+
   // Global auto bitrate controller instance
   static auto_bitrate_controller_t auto_bitrate_controller;
 
@@ -901,7 +1315,7 @@ namespace stream {
     // Step 3: Add back FEC overhead based on the video bitrate (FEC applies only to video data).
     // In rtsp.cpp, when FEC <= 80%, the video bitrate is reduced by (100 - fec) / 100.
     // When FEC > 80%, no reduction is applied, so we just add the FEC overhead.
-    auto fec_percentage = config::stream.fec_percentage;
+    auto fec_percentage = session->video.fec_percentage.load(std::memory_order_relaxed);
     if (fec_percentage > 0) {
       if (fec_percentage <= 80) {
         // Reverse the reduction: multiply by 100 / (100 - fec_percentage)
@@ -1013,49 +1427,50 @@ namespace stream {
    * @param data2 The second data buffer.
    */
   /**
-   * @brief Concatenate two buffers and insert headers at slice boundaries.
+   * @brief Concatenate buffer segments and insert headers at slice boundaries.
    * 
-   * Combines data1 and data2, then inserts a header of insert_size bytes
+   * Combines all segments in order, then inserts a header of insert_size bytes
    * every slice_size bytes in the result.
    * 
    * @param insert_size Number of bytes to insert at each boundary.
    * @param slice_size Number of bytes between insertions.
-   * @param data1 First data buffer.
-   * @param data2 Second data buffer.
+   * @param segments Data buffers to concatenate.
    * @return Combined buffer with inserted headers.
    */
-  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2) {
-    auto data_size = data1.size() + data2.size();
+  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::vector<std::string_view> &segments) {
+    size_t data_size = 0;
+    for (const auto &segment : segments) {
+      data_size += segment.size();
+    }
+
     auto pad = data_size % slice_size != 0;
     auto elements = data_size / slice_size + (pad ? 1 : 0);
 
     std::vector<uint8_t> result;
     result.resize(elements * insert_size + data_size);
 
-    auto next = std::begin(data1);
-    auto end = std::end(data1);
+    auto segment = std::begin(segments);
+    size_t segment_offset = 0;
     for (auto x = 0; x < elements; ++x) {
-      void *p = &result[x * (insert_size + slice_size)];
+      auto p = (char *) &result[x * (insert_size + slice_size)] + insert_size;
 
       // For the last iteration, only copy to the end of the data
-      if (x == elements - 1) {
-        slice_size = data_size - (x * slice_size);
-      }
-
-      // Test if this slice will extend into the next buffer
-      if (next + slice_size > end) {
-        // Copy the first portion from the first buffer
-        auto copy_len = end - next;
-        std::copy(next, end, (char *) p + insert_size);
+      auto remaining = x == elements - 1 ? data_size - (x * slice_size) : slice_size;
+
+      // A slice may span any number of segments
+      while (remaining > 0) {
+        auto copy_len = std::min<size_t>(remaining, segment->size() - segment_offset);
+        if (copy_len > 0) {
+          std::memcpy(p, segment->data() + segment_offset, copy_len);
+          p += copy_len;
+          remaining -= copy_len;
+          segment_offset += copy_len;
+        }
 
-        // Copy the remaining portion from the second buffer
-        next = std::begin(data2);
-        end = std::end(data2);
-        std::copy(next, next + (slice_size - copy_len), (char *) p + copy_len + insert_size);
-        next += slice_size - copy_len;
-      } else {
-        std::copy(next, next + slice_size, (char *) p + insert_size);
-        next += slice_size;
+        if (segment_offset == segment->size()) {
+          ++segment;
+          segment_offset = 0;
+        }
       }
     }
 
@@ -1063,28 +1478,98 @@ namespace stream {
   }
 
   /**
-   * @brief Replace first occurrence of a substring in a buffer.
+   * @brief Concatenate two buffers and insert headers at slice boundaries.
+   * 
+   * Combines data1 and data2, then inserts a header of insert_size bytes
+   * every slice_size bytes in the result.
+   * 
+   * @param insert_size Number of bytes to insert at each boundary.
+   * @param slice_size Number of bytes between insertions.
+   * @param data1 First data buffer.
+   * @param data2 Second data buffer.
+   * @return Combined buffer with inserted headers.
+   */
+  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2) {
+    return concat_and_insert(insert_size, slice_size, std::vector<std::string_view> {data1, data2});
+  }
+
+  /**
+   * @brief Replace the first occurrence of a substring in a list of buffer segments.
+   * 
+   * The segment containing the match is split into views of the data before and
+   * after it with the replacement in between, so no buffer contents are copied.
+   * Matches spanning two segments are not detected.
    * 
-   * @param original The original buffer.
+   * @param segments The segments making up the buffer, updated in place.
    * @param old The substring to replace.
-   * @param _new The replacement substring.
-   * @return New buffer with the replacement applied.
+   * @param _new The replacement substring. It must outlive the segments.
+   * @param hint Expected location of old, which is verified and used instead of searching.
    */
-  std::vector<uint8_t> replace(const std::string_view &original, const std::string_view &old, const std::string_view &_new) {
-    std::vector<uint8_t> replaced;
-    replaced.reserve(original.size() + _new.size() - old.size());
+  void replace(std::vector<std::string_view> &segments, const std::string_view &old, const std::string_view &_new, const char *hint = nullptr) {
+    auto splice = [&](std::vector<std::string_view>::iterator it, size_t pos) {
+      auto prefix = it->substr(0, pos);
+      auto suffix = it->substr(pos + old.size());
+
+      *it = prefix;
+      it = segments.insert(std::next(it), _new);
+      segments.insert(std::next(it), suffix);
+    };
+
+    if (hint) {
+      for (auto it = std::begin(segments); it != std::end(segments); ++it) {
+        if (hint < it->data() || hint >= it->data() + it->size()) {
+          continue;
+        }
 
-    auto begin = std::begin(original);
-    auto end = std::end(original);
-    auto next = std::search(begin, end, std::begin(old), std::end(old));
+        auto pos = (size_t) (hint - it->data());
+        if (it->substr(pos, old.size()) == old) {
+          splice(it, pos);
+          return;
+        }
+        break;
+      }
+    }
 
-    std::copy(begin, next, std::back_inserter(replaced));
-    if (next != end) {
-      std::copy(std::begin(_new), std::end(_new), std::back_inserter(replaced));
-      std::copy(next + old.size(), end, std::back_inserter(replaced));
+    for (auto it = std::begin(segments); it != std::end(segments); ++it) {
+      auto pos = it->find(old);
+      if (pos != std::string_view::npos) {
+        splice(it, pos);
+        return;
+      }
     }
+  }
+
+  /**
+   * @brief Collapse queued gamepad feedback to the latest state of each effect.
+   * 
+   * Every feedback message carries the whole state of one effect of one gamepad, so only
+   * the latest message per effect has to reach the client. Games that update the rumble
+   * every frame would otherwise cost a control message per update.
+   * 
+   * @param msgs The queued messages in the order they were raised, coalesced in place.
+   */
+  void coalesce_feedback(std::vector<platf::gamepad_feedback_msg_t> &msgs) {
+    auto same_effect = [](const platf::gamepad_feedback_msg_t &a, const platf::gamepad_feedback_msg_t &b) {
+      if (a.type != b.type || a.id != b.id) {
+        return false;
+      }
 
-    return replaced;
+      // Each motion sensor has its own report rate
+      return a.type != platf::gamepad_feedback_e::set_motion_event_state || a.data.motion_event_state.motion_type == b.data.motion_event_state.motion_type;
+    };
+
+    auto end = std::begin(msgs);
+    for (auto &msg : msgs) {
+      auto it = std::find_if(std::begin(msgs), end, [&](auto &kept) {
+        return same_effect(kept, msg);
+      });
+      if (it == end) {
+        *end++ = msg;
+      } else {
+        *it = msg;
+      }
+    }
+    msgs.erase(end, std::end(msgs));
   }
 
   /**
@@ -1249,10 +1734,10 @@ namespace stream {
       }
 
       float loss_percentage;
-      uint32_t dummy_bitrate;
+      uint32_t current_bitrate_kbps;
       uint64_t dummy_time;
-      uint32_t dummy_count;
-      if (auto_bitrate_controller.get_stats(session, dummy_bitrate, dummy_time, dummy_count, loss_percentage)) {
+      uint32_t adjustment_count;
+      if (auto_bitrate_controller.get_stats(session, current_bitrate_kbps, dummy_time, adjustment_count, loss_percentage)) {
         int new_status;
         if (loss_percentage > 5.0) {
           new_status = 1;  // POOR
@@ -1273,22 +1758,34 @@ namespace stream {
         }
       }
 
-      auto bitrate_confirmation_events = session->mail->event<std::pair<int, bool>>(mail::bitrate_change_confirmation);
-      while (bitrate_confirmation_events->peek()) {
-        if (auto confirmation = bitrate_confirmation_events->pop(0ms)) {
-          auto_bitrate_controller.confirm_bitrate_change(session, confirmation->first, confirmation->second);
-          if (confirmation->second) {
-            BOOST_LOG(info) << "AutoBitrate: Encoder accepted bitrate change to " << confirmation->first << " Kbps";
-          } else {
-            BOOST_LOG(info) << "AutoBitrate: Encoder rejected bitrate change to " << confirmation->first << " Kbps (encoder may not support dynamic bitrate)";
-          }
+      if (auto confirmation = session->video.bitrate_target.confirmation()) {
+        auto_bitrate_controller.confirm_bitrate_change(session, confirmation->first, confirmation->second);
+        if (confirmation->second) {
+          BOOST_LOG(info) << "AutoBitrate: Encoder accepted bitrate change to " << confirmation->first << " Kbps";
+        } else {
+          BOOST_LOG(info) << "AutoBitrate: Encoder rejected bitrate change to " << confirmation->first << " Kbps (encoder may not support dynamic bitrate)";
+        }
+      }
+
+      auto &ladder_confirmation_events = session->video.ladder_change_confirmation_events;
+      while (ladder_confirmation_events->peek()) {
+        if (auto confirmation = ladder_confirmation_events->pop(0ms)) {
+          auto_bitrate_controller.confirm_ladder_change(session, *confirmation);
         }
       }
 
-      if (auto_bitrate_controller.should_adjust_bitrate(session)) {
-        int new_bitrate = auto_bitrate_controller.calculate_new_bitrate(session);
-        session->mail->event<int>(mail::bitrate_change)->raise(new_bitrate);
-        BOOST_LOG(info) << "AutoBitrate: Adjusting bitrate to " << new_bitrate << " Kbps";
+      if (auto adjustment = auto_bitrate_controller.next_adjustment(session); adjustment.bitrate_kbps) {
+        if (auto &step = adjustment.ladder_step) {
+          session->video.ladder_change_events->raise(*step);
+          BOOST_LOG(info) << "AutoBitrate: Moving to " << step->width << 'x' << step->height << 'x' << step->framerate;
+        }
+        session->video.bitrate_target.request(adjustment.bitrate_kbps);
+        session->audio.encoder_params_events->raise(auto_bitrate_controller.calculate_audio_params(session, adjustment.bitrate_kbps));
+        if (adjustment.fec_percentage >= 0) {
+          BOOST_LOG(info) << "AutoBitrate: Moving FEC to " << adjustment.fec_percentage << "%, adjusting bitrate to " << adjustment.bitrate_kbps << " Kbps";
+        } else {
+          BOOST_LOG(info) << "AutoBitrate: Adjusting bitrate to " << adjustment.bitrate_kbps << " Kbps";
+        }
       }
 
       session->bitrate_stats_send_counter++;
@@ -1328,7 +1825,7 @@ namespace stream {
       // Extract lastGoodFrame (64-bit at offset 12)
       int64_t lastGoodFrame64;
       std::memcpy(&lastGoodFrame64, &stats[3], sizeof(int64_t));
-      uint64_t lastGoodFrame = static_cast<uint64_t>(lastGoodFrame64);
+      uint64_t lastGoodFrame = static_cast<uint64_t>(session->video.numbering.to_encoder(lastGoodFrame64));
 
       BOOST_LOG(verbose)
         << "type [IDX_LOSS_STATS]"sv << std::endl
@@ -1375,6 +1872,7 @@ namespace stream {
       loss_count = util::endian::little(loss_count);
       interval_ms = util::endian::little(interval_ms);
       last_good_frame = util::endian::little(last_good_frame);
+      last_good_frame = static_cast<uint64_t>(session->video.numbering.to_encoder(static_cast<int64_t>(last_good_frame)));
       client_max_bitrate_kbps = util::endian::little(client_max_bitrate_kbps);
 
       auto ms = interval_ms ? interval_ms : AUTO_BITRATE_DEFAULT_INTERVAL_MS;
@@ -1402,18 +1900,68 @@ namespace stream {
       session->video.idr_events->raise(true);
     });
 
-    server->map(packetTypes[IDX_INVALIDATE_REF_FRAMES], [&](session_t *session, const std::string_view &payload) {
-      auto frames = (std::int64_t *) payload.data();
-      auto firstFrame = frames[0];
-      auto lastFrame = frames[1];
+    server->map(packetTypes[IDX_RETRANSMIT_REQUEST], [&](session_t *session, const std::string_view &payload) {
+      BOOST_LOG(verbose) << "type [IDX_RETRANSMIT_REQUEST]"sv;
 
-      BOOST_LOG(debug)
-        << "type [IDX_INVALIDATE_REF_FRAMES]"sv << std::endl
-        << "firstFrame [" << firstFrame << ']' << std::endl
-        << "lastFrame [" << lastFrame << ']';
+      // Packets are only kept for clients that ask for them, an empty request just turns this on
+      auto &retransmit = session->video.retransmit;
+      if (!retransmit.enabled()) {
+        BOOST_LOG(debug) << "Client requested video retransmissions, keeping recently sent packets"sv;
+        retransmit.enable();
+      }
 
-      session->video.invalidate_ref_frames_events->raise(std::make_pair(firstFrame, lastFrame));
-    });
+      // The payload is a list of little-endian RTP sequence numbers, a request is limited to a frame's worth of packets
+      constexpr std::size_t max_packets = 64;
+      auto requested = std::min(payload.size() / sizeof(std::uint16_t), max_packets);
+      if (!requested) {
+        return;
+      }
+
+      auto window = retransmit_window(session->control.rtt.load(std::memory_order_relaxed), session->control.rtt_variance.load(std::memory_order_relaxed));
+      auto not_before = std::chrono::steady_clock::now() - window;
+
+      auto peer_address = session->video.peer.address();
+      std::string packet;
+      for (std::size_t x = 0; x < requested; ++x) {
+        std::uint16_t sequence_number;
+        std::memcpy(&sequence_number, payload.data() + x * sizeof(sequence_number), sizeof(sequence_number));
+        sequence_number = util::endian::little(sequence_number);
+
+        if (!retransmit.find(sequence_number, not_before, packet)) {
+          retransmit_misses.add();
+          continue;
+        }
+
+        // Sent right away from the control thread, so it doesn't wait behind the next frame
+        auto send_info = platf::send_info_t {
+          nullptr,
+          0,
+          packet.data(),
+          packet.size(),
+          (uintptr_t) video_socket(session, *session->broadcast_ref.get()).native_handle(),
+          peer_address,
+          session->video.peer.port(),
+          session->localAddress,
+        };
+        if (platf::send(send_info)) {
+          packets_retransmitted.add();
+          session->stats.packets_retransmitted.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    });
+
+    server->map(packetTypes[IDX_INVALIDATE_REF_FRAMES], [&](session_t *session, const std::string_view &payload) {
+      auto frames = (std::int64_t *) payload.data();
+      auto firstFrame = session->video.numbering.to_encoder(frames[0]);
+      auto lastFrame = session->video.numbering.to_encoder(frames[1]);
+
+      BOOST_LOG(debug)
+        << "type [IDX_INVALIDATE_REF_FRAMES]"sv << std::endl
+        << "firstFrame [" << firstFrame << ']' << std::endl
+        << "lastFrame [" << lastFrame << ']';
+
+      session->video.invalidate_ref_frames_events->raise(std::make_pair(firstFrame, lastFrame));
+    });
 
     server->map(packetTypes[IDX_INPUT_DATA], [&](session_t *session, const std::string_view &payload) {
       BOOST_LOG(debug) << "type [IDX_INPUT_DATA]"sv;
@@ -1421,11 +1969,20 @@ namespace stream {
       auto tagged_cipher_length = util::endian::big(*(int32_t *) payload.data());
       std::string_view tagged_cipher {payload.data() + sizeof(tagged_cipher_length), (size_t) tagged_cipher_length};
 
-      std::vector<uint8_t> plaintext;
-
       auto &cipher = session->control.cipher;
       auto &iv = session->control.legacy_input_enc_iv;
-      if (cipher.decrypt(tagged_cipher, plaintext, &iv)) {
+
+      // The next IV is the end of the cipher text, which the in-place decryption overwrites
+      std::array<std::uint8_t, 16> next_iv;
+      bool chain_iv = tagged_cipher_length >= 16 + iv.size();
+      if (chain_iv) {
+        std::copy(payload.end() - 16, payload.end(), std::begin(next_iv));
+      }
+
+      // Decrypt into the received packet, input::passthrough copies the plaintext
+      auto plaintext = (std::uint8_t *) tagged_cipher.data() + crypto::cipher::tag_size;
+      auto plaintext_length = cipher.decrypt(tagged_cipher, plaintext, &iv);
+      if (plaintext_length < 0) {
         // something went wrong :(
 
         BOOST_LOG(error) << "Failed to verify tag"sv;
@@ -1434,11 +1991,11 @@ namespace stream {
         return;
       }
 
-      if (tagged_cipher_length >= 16 + iv.size()) {
-        std::copy(payload.end() - 16, payload.end(), std::begin(iv));
+      if (chain_iv) {
+        std::copy(std::begin(next_iv), std::end(next_iv), std::begin(iv));
       }
 
-      input::passthrough(session->input, std::move(plaintext), session->permission);
+      input::passthrough(session->input, std::span<const std::uint8_t> {plaintext, (std::size_t) plaintext_length}, session->permission);
     });
 
     server->map(packetTypes[IDX_EXEC_SERVER_CMD], [server](session_t *session, const std::string_view &payload) {
@@ -1549,8 +2106,10 @@ namespace stream {
         iv[0] = (std::uint8_t) seq;
       }
 
-      std::vector<uint8_t> plaintext;
-      if (cipher.decrypt(tagged_cipher, plaintext, &iv)) {
+      // Decrypt into the received packet, it outlives the handlers of the inner message
+      auto plaintext = (std::uint8_t *) header->payload() + crypto::cipher::tag_size;
+      auto plaintext_length = cipher.decrypt(tagged_cipher, plaintext, &iv);
+      if (plaintext_length < 0) {
         // something went wrong :(
 
         BOOST_LOG(error) << "Failed to verify tag"sv;
@@ -1559,8 +2118,8 @@ namespace stream {
         return;
       }
 
-      auto type = *(std::uint16_t *) plaintext.data();
-      std::string_view next_payload {(char *) plaintext.data() + 4, plaintext.size() - 4};
+      auto type = *(std::uint16_t *) plaintext;
+      std::string_view next_payload {(char *) plaintext + 4, (std::size_t) plaintext_length - 4};
 
       if (type == packetTypes[IDX_ENCRYPTED]) {
         BOOST_LOG(error) << "Bad packet type [IDX_ENCRYPTED] found"sv;
@@ -1570,21 +2129,31 @@ namespace stream {
 
       // IDX_INPUT_DATA callback will attempt to decrypt unencrypted data, therefore we need pass it directly
       if (type == packetTypes[IDX_INPUT_DATA]) {
-        plaintext.erase(std::begin(plaintext), std::begin(plaintext) + 4);
-        input::passthrough(session->input, std::move(plaintext), session->permission);
+        input::passthrough(session->input, std::span<const std::uint8_t> {(const std::uint8_t *) next_payload.data(), next_payload.size()}, session->permission);
       } else {
         server->call(type, session, next_payload, true);
       }
     });
 
     // This thread handles latency-sensitive control messages
-    platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    thread_placement::apply(config::thread_stage_e::control, platf::thread_priority_e::critical);
 
     // Check for both the full shutdown event and the shutdown event for this
     // broadcast to ensure we can inform connected clients of our graceful
     // termination when we shut down.
-    auto shutdown_event = mail::man->event<bool>(mail::shutdown);
-    auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+    auto shutdown_event = mail::man->event(mail::shutdown);
+    auto broadcast_shutdown_event = mail::man->event(mail::broadcast_shutdown);
+
+    // Reused between sessions and iterations, so draining the feedback doesn't allocate
+    std::vector<platf::gamepad_feedback_msg_t> feedback_batch;
+
+    // Lowers the framerate of the lower priority sessions while the host falls behind
+    overload::controller_t overload_controller;
+    auto video_packets = mail::man->queue(mail::video_packets);
+    auto next_overload_tick = std::chrono::steady_clock::now() + overload::tick_interval;
+    std::vector<session_t *> streaming_sessions;
+    std::vector<overload::member_t> overload_members;
+
     while (!shutdown_event->peek() && !broadcast_shutdown_event->peek()) {
       bool has_session_awaiting_peer = false;
 
@@ -1629,11 +2198,20 @@ namespace stream {
           if (!session->control.peer) {
             has_session_awaiting_peer = true;
           } else {
+            // Let the video pacer know about the current network conditions
+            session->control.rtt.store(session->control.peer->roundTripTime, std::memory_order_relaxed);
+            session->control.rtt_variance.store(session->control.peer->roundTripTimeVariance, std::memory_order_relaxed);
+            auto_bitrate_controller.process_rtt(session, session->control.peer->roundTripTime);
+
             auto &feedback_queue = session->control.feedback_queue;
+            feedback_batch.clear();
             while (feedback_queue->peek()) {
-              auto feedback_msg = feedback_queue->pop();
+              feedback_batch.push_back(*feedback_queue->pop());
+            }
 
-              send_feedback_msg(session, *feedback_msg);
+            coalesce_feedback(feedback_batch);
+            for (auto &feedback_msg : feedback_batch) {
+              send_feedback_msg(session, feedback_msg);
             }
 
             auto &hdr_queue = session->control.hdr_queue;
@@ -1646,6 +2224,30 @@ namespace stream {
 
           ++pos;
         })
+
+        if (config::video.overload_shedding && now >= next_overload_tick) {
+          next_overload_tick = now + overload::tick_interval;
+
+          streaming_sessions.clear();
+          overload_members.clear();
+          for (auto session : *server->_sessions) {
+            if (session->config.monitor.input_only || session->state.load(std::memory_order_acquire) != session::state_e::RUNNING) {
+              continue;
+            }
+
+            streaming_sessions.push_back(session);
+            overload_members.push_back({overload::priority(session->permission), session->video.shed_level, session->config.monitor.framerate});
+          }
+
+          if (auto step = overload_controller.update(overload_members, video_packets->size())) {
+            auto session = streaming_sessions[step->index];
+            BOOST_LOG(info) << "Overload: "sv << (step->level > session->video.shed_level ? "shedding"sv : "restoring"sv) << " the framerate of ["sv
+                            << session->device_name << "] to 1/"sv << (1 << step->level);
+
+            session->video.shed_level = step->level;
+            session->video.fps_divisor_events->raise(1 << step->level);
+          }
+        }
       }
 
       // Don't break until any pending sessions either expire or connect
@@ -1690,6 +2292,58 @@ namespace stream {
     server->flush();
   }
 
+  /**
+   * @brief RTP payload type of the microphone packets sent by the client.
+   */
+  constexpr std::uint8_t mic_packet_type = 98;
+
+  /**
+   * @brief Message queues of the sessions waiting for packets of one kind.
+   * @details A flat list scanned for every packet, there are only ever a few sessions and lookups must not allocate.
+   */
+  class session_index_t {
+  public:
+    /**
+     * @brief Add or remove the message queue of a session.
+     * @param session_id The session identifier.
+     * @param message_queue The queue, or nullptr to remove the session.
+     */
+    void update(const av_session_id_t &session_id, const message_queue_t &message_queue) {
+      auto it = std::find_if(std::begin(entries), std::end(entries), [&](const auto &entry) {
+        return entry.first == session_id;
+      });
+
+      if (!message_queue) {
+        if (it != std::end(entries)) {
+          entries.erase(it);
+        }
+      } else if (it == std::end(entries)) {
+        entries.emplace_back(session_id, message_queue);
+      }
+    }
+
+    /**
+     * @brief Find the message queue of a session.
+     * @param key Ping payload, peer address or endpoint of the session.
+     * @return The queue, or nullptr if no session matches.
+     */
+    template<class T>
+    const message_queue_t *find(const T &key) const {
+      using id_t = std::conditional_t<std::is_convertible_v<T, std::string_view>, std::string, T>;
+
+      for (const auto &[session_id, message_queue] : entries) {
+        if (auto id = std::get_if<id_t>(&session_id); id && *id == key) {
+          return &message_queue;
+        }
+      }
+
+      return nullptr;
+    }
+
+  private:
+    std::vector<std::pair<av_session_id_t, message_queue_t>> entries;
+  };
+
   /**
    * @brief Receive thread for UDP video and audio streams.
    * 
@@ -1699,21 +2353,29 @@ namespace stream {
    * @param ctx The broadcast context.
    */
   void recvThread(broadcast_ctx_t &ctx) {
-    std::map<av_session_id_t, message_queue_t> peer_to_video_session;
-    std::map<av_session_id_t, message_queue_t> peer_to_audio_session;
+    session_index_t peer_to_video_session;
+    session_index_t peer_to_audio_session;
+    session_index_t peer_to_mic_session;
 
     auto &video_sock = ctx.video_sock;
     auto &audio_sock = ctx.audio_sock;
 
     auto &message_queue_queue = ctx.message_queue_queue;
-    auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+    auto broadcast_shutdown_event = mail::man->event(mail::broadcast_shutdown);
 
     auto &io = ctx.io_context;
 
     udp::endpoint peer;
 
-    std::array<char, 2048> buf[2];
-    std::function<void(const boost::system::error_code, size_t)> recv_func[2];
+    // Every video socket gets its own receive, the audio socket comes last
+    std::vector<udp::socket *> socks {&video_sock};
+    for (auto &sock : ctx.video_worker_socks) {
+      socks.emplace_back(&sock);
+    }
+    socks.emplace_back(&audio_sock);
+
+    std::vector<std::array<char, 2048>> buf(socks.size());
+    std::vector<std::function<void(const boost::system::error_code, size_t)>> recv_func(socks.size());
 
     auto populate_peer_to_session = [&]() {
       while (message_queue_queue->peek()) {
@@ -1722,30 +2384,25 @@ namespace stream {
 
         switch (socket_type) {
           case socket_e::video:
-            if (message_queue) {
-              peer_to_video_session.emplace(session_id, message_queue);
-            } else {
-              peer_to_video_session.erase(session_id);
-            }
+            peer_to_video_session.update(session_id, message_queue);
             break;
           case socket_e::audio:
-            if (message_queue) {
-              peer_to_audio_session.emplace(session_id, message_queue);
-            } else {
-              peer_to_audio_session.erase(session_id);
-            }
+            peer_to_audio_session.update(session_id, message_queue);
+            break;
+          case socket_e::microphone:
+            peer_to_mic_session.update(session_id, message_queue);
             break;
         }
       }
     };
 
-    auto recv_func_init = [&](udp::socket &sock, int buf_elem, std::map<av_session_id_t, message_queue_t> &peer_to_session) {
-      recv_func[buf_elem] = [&, buf_elem](const boost::system::error_code &ec, size_t bytes) {
+    auto recv_func_init = [&](udp::socket &sock, int buf_elem, bool audio, session_index_t &peer_to_session) {
+      recv_func[buf_elem] = [&, buf_elem, audio](const boost::system::error_code &ec, size_t bytes) {
         auto fg = util::fail_guard([&]() {
           sock.async_receive_from(asio::buffer(buf[buf_elem]), peer, 0, recv_func[buf_elem]);
         });
 
-        auto type_str = buf_elem ? "AUDIO"sv : "VIDEO"sv;
+        auto type_str = audio ? "AUDIO"sv : "VIDEO"sv;
         BOOST_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
 
         populate_peer_to_session();
@@ -1760,37 +2417,358 @@ namespace stream {
           return;
         }
 
+        // Microphone packets of the client are RTP packets on the audio socket, matched by the endpoint of the session
+        auto rtp = (PRTP_PACKET) buf[buf_elem].data();
+        if (audio && bytes > sizeof(RTP_PACKET) && rtp->header == 0x80 && rtp->packetType == mic_packet_type) {
+          if (auto message_queue = peer_to_mic_session.find(peer)) {
+            (*message_queue)->raise(peer, pooled_packet({buf[buf_elem].data(), bytes}));
+          }
+          return;
+        }
+
         if (bytes == 4) {
           // For legacy PING packets, find the matching session by address.
-          auto it = peer_to_session.find(peer.address());
-          if (it != std::end(peer_to_session)) {
+          if (auto message_queue = peer_to_session.find(peer.address())) {
             BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
-            it->second->raise(peer, std::string {buf[buf_elem].data(), bytes});
+            (*message_queue)->raise(peer, pooled_packet({buf[buf_elem].data(), bytes}));
           }
         } else if (bytes >= sizeof(SS_PING)) {
           auto ping = (PSS_PING) buf[buf_elem].data();
 
           // For new PING packets that include a client identifier, search by payload.
-          auto it = peer_to_session.find(std::string {ping->payload, sizeof(ping->payload)});
-          if (it != std::end(peer_to_session)) {
+          if (auto message_queue = peer_to_session.find(std::string_view {ping->payload, sizeof(ping->payload)})) {
             BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
-            it->second->raise(peer, std::string {buf[buf_elem].data(), bytes});
+            (*message_queue)->raise(peer, pooled_packet({buf[buf_elem].data(), bytes}));
           }
         }
       };
     };
 
-    recv_func_init(video_sock, 0, peer_to_video_session);
-    recv_func_init(audio_sock, 1, peer_to_audio_session);
-
-    video_sock.async_receive_from(asio::buffer(buf[0]), peer, 0, recv_func[0]);
-    audio_sock.async_receive_from(asio::buffer(buf[1]), peer, 0, recv_func[1]);
+    for (int x = 0; x < socks.size(); ++x) {
+      bool audio = x + 1 == socks.size();
+      recv_func_init(*socks[x], x, audio, audio ? peer_to_audio_session : peer_to_video_session);
+      socks[x]->async_receive_from(asio::buffer(buf[x]), peer, 0, recv_func[x]);
+    }
 
     while (!broadcast_shutdown_event->peek()) {
       io.run();
     }
   }
 
+  /**
+   * @brief Compute how many video packets may be sent per millisecond.
+   * 
+   * Frames are sent at up to 80% of 1Gbps to keep transmission time low. A faster local
+   * link only raises that ceiling to 80% of its own speed once the client shows the path
+   * keeps up: a round trip time without queueing and a measured frame loss of at most 1%.
+   * The local link says nothing about the rest of the path. A round trip time variance
+   * that is large relative to the round trip time means packets are queueing somewhere on
+   * the path, typically at a congested Wi-Fi access point, so the rate is scaled down
+   * accordingly. The rate never drops below twice the stream bitrate so the pacer can
+   * always keep up.
+   * 
+   * @param blocksize Size of each packet in bytes.
+   * @param bitrate_kbps Video bitrate in kilobits per second.
+   * @param link_speed Link speed of the sending interface in bits per second, or 0 if unknown.
+   * @param rtt Client round trip time in milliseconds, or 0 if unknown.
+   * @param rtt_variance Client round trip time variance in milliseconds.
+   * @param loss_percentage Frame loss measured from the reports of the client, negative if it isn't measured.
+   * @return The packet budget per millisecond, at least 1.
+   */
+  size_t pacing_packets_in_1ms(size_t blocksize, int bitrate_kbps, std::uint64_t link_speed, std::uint32_t rtt, std::uint32_t rtt_variance, float loss_percentage) {
+    constexpr std::uint64_t default_rate = std::giga::num * 80 / 100;
+
+    std::uint64_t rate = (link_speed ? link_speed : std::giga::num) * 80 / 100;
+    if (rtt == 0 || rtt_variance > 1 || loss_percentage < 0 || loss_percentage > 1.0f) {
+      rate = std::min(rate, default_rate);
+    }
+
+    // ENet has a 1ms resolution, so ignore variance that is just measurement noise
+    if (rtt > 0 && rtt_variance > 1) {
+      rate = rate * rtt / (rtt + 2 * rtt_variance);
+    }
+
+    rate = std::max<std::uint64_t>(rate, (std::uint64_t) std::max(bitrate_kbps, 0) * 1000 * 2);
+
+    //                    ms     byte
+    return std::max<size_t>(1, rate / 1000 / 8 / blocksize);
+  }
+
+  /**
+   * @brief Lower the pacing rate so the packets of a frame are spread over a window of time.
+   *
+   * Reed-Solomon recovers any packets of a FEC block as long as enough of them arrive, so
+   * a burst of loss that lasts a smaller share of the window than the parity shards make up
+   * of the block is recoverable. The window never exceeds three quarters of the frame interval,
+   * so the frames still go out as fast as they are encoded.
+   *
+   * @param packets_in_1ms The pacing rate in packets per millisecond.
+   * @param shards The data and parity shards of the frame.
+   * @param spread How long the frame should take to send, 0 to send it at the pacing rate.
+   * @param framerate The framerate of the session.
+   * @return The packet budget per millisecond, at least 1.
+   */
+  size_t spread_packets_in_1ms(size_t packets_in_1ms, size_t shards, std::chrono::milliseconds spread, int framerate) {
+    auto window = std::min<std::chrono::milliseconds>(spread, std::chrono::milliseconds {750} / std::max(framerate, 1));
+    if (window.count() <= 0) {
+      return packets_in_1ms;
+    }
+
+    auto rate = (shards + window.count() - 1) / window.count();
+    return std::clamp<size_t>(rate, 1, std::max<size_t>(packets_in_1ms, 1));
+  }
+
+  using video_queue_t = std::shared_ptr<safe::queue_t<video::packet_t>>;
+
+  /**
+   * @brief Pick the queued video packet whose frame has the earliest presentation deadline.
+   * 
+   * The deadline of a frame is its capture time plus one frame interval of its session.
+   * Only the oldest queued frame of each session is considered, so frames of a single
+   * session are always sent in order. Frames without a timestamp (duplicates) are the
+   * least urgent. Ties keep FIFO order.
+   * 
+   * @param packets The queued packets.
+   * @return Index of the packet to send next.
+   */
+  size_t earliest_deadline(const std::vector<video::packet_t> &packets) {
+    // Nearly always a single session, so a linear scan beats any bookkeeping
+    size_t best = 0;
+    auto best_deadline = std::chrono::steady_clock::time_point::max();
+
+    for (size_t x = 0; x < packets.size(); ++x) {
+      auto session = packets[x]->channel_data;
+
+      auto is_session_head = std::none_of(std::begin(packets), std::begin(packets) + x, [session](const auto &packet) {
+        return packet->channel_data == session;
+      });
+      if (!is_session_head) {
+        continue;
+      }
+
+      auto &frame_timestamp = packets[x]->frame_timestamp;
+      if (!frame_timestamp) {
+        continue;
+      }
+
+      auto fps = std::max(((session_t *) session)->config.monitor.framerate, 1);
+      auto deadline = *frame_timestamp + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+      if (deadline < best_deadline) {
+        best_deadline = deadline;
+        best = x;
+      }
+    }
+
+    return best;
+  }
+
+  /**
+   * @brief Drop the video backlog of a session once it exceeds the queue bound.
+   * 
+   * Every frame queued behind @p packet references it, so the backlog is dropped up to
+   * the next queued IDR frame of the session. Without a queued IDR frame, the encoder
+   * has to stop referencing the dropped frames.
+   * 
+   * @param queued The packets still queued, locked by the caller.
+   * @param packet The packet that was just popped.
+   * @param max_queued The number of frames the session may have queued behind @p packet.
+   * @param invalidate Set to the range of dropped frames the encoder must invalidate, if any.
+   * @return `true` if @p packet must be dropped as well.
+   */
+  bool drop_stale_frames(std::vector<video::packet_t> &queued, const video::packet_t &packet, int max_queued, std::optional<std::pair<int64_t, int64_t>> &invalidate) {
+    if (packet->is_idr()) {
+      return false;
+    }
+
+    auto session = packet->channel_data;
+    auto same_session = [session](const auto &queued_packet) {
+      return queued_packet->channel_data == session;
+    };
+
+    if (std::count_if(std::begin(queued), std::end(queued), same_session) <= max_queued) {
+      return false;
+    }
+
+    auto next_idr = std::find_if(std::begin(queued), std::end(queued), [&](const auto &queued_packet) {
+      return same_session(queued_packet) && queued_packet->is_idr();
+    });
+
+    auto last_dropped = packet->frame_index();
+    auto it = std::remove_if(std::begin(queued), next_idr, [&](const auto &queued_packet) {
+      if (!same_session(queued_packet)) {
+        return false;
+      }
+
+      last_dropped = std::max(last_dropped, queued_packet->frame_index());
+      return true;
+    });
+
+    if (next_idr == std::end(queued)) {
+      invalidate = std::make_pair(packet->frame_index(), last_dropped);
+    }
+    queued.erase(it, next_idr);
+
+    return true;
+  }
+
+  /**
+   * @brief Count the frames of a session that fit in its budget for queued video.
+   * 
+   * The frames are counted from the oldest, so the bound drops the frames that are already the latest
+   * when the backlog of the session takes more memory than its budget.
+   * 
+   * @param queued The packets still queued, locked by the caller.
+   * @param packet The packet that was just popped.
+   * @param budget The bytes the queued frames of the session may take.
+   * @param bytes Receives the bytes the queued frames of the session take.
+   * @return The number of frames within the budget, the largest `int` if they all fit.
+   */
+  int frames_within_budget(const std::vector<video::packet_t> &queued, const video::packet_t &packet, std::size_t budget, std::size_t &bytes) {
+    auto session = packet->channel_data;
+
+    int frames = 0;
+    bool fits = true;
+    bytes = 0;
+    for (auto &queued_packet : queued) {
+      if (queued_packet->channel_data != session) {
+        continue;
+      }
+
+      bytes += queued_packet->data_size();
+      if (bytes > budget) {
+        fits = false;
+      } else if (fits) {
+        ++frames;
+      }
+    }
+
+    return fits ? std::numeric_limits<int>::max() : frames;
+  }
+
+  /**
+   * @brief Whether a frame may be skipped without the client having to recover.
+   * @details The client waits for the first frame after a reference frame invalidation, that one is always sent.
+   */
+  static bool skippable(const video::packet_t &packet) {
+    return packet->droppable && !packet->is_idr() && !packet->after_ref_frame_invalidation;
+  }
+
+  /**
+   * @brief Skip the frames no other frame references once the video backlog of a session exceeds the queue bound.
+   * 
+   * The oldest of them are skipped first, until the backlog is within the bound again.
+   * Frames that other frames reference are left to `drop_stale_frames()`.
+   * 
+   * @param queued The packets still queued, locked by the caller.
+   * @param packet The packet that was just popped.
+   * @param max_queued The number of frames the session may have queued behind @p packet.
+   * @param skipped Receives the indexes of the skipped frames, including @p packet.
+   * @return `true` if @p packet must be skipped.
+   */
+  bool skip_droppable_frames(std::vector<video::packet_t> &queued, const video::packet_t &packet, int max_queued, std::vector<int64_t> &skipped) {
+    auto session = packet->channel_data;
+    auto same_session = [session](const auto &queued_packet) {
+      return queued_packet->channel_data == session;
+    };
+
+    auto backlog = std::count_if(std::begin(queued), std::end(queued), same_session);
+    if (backlog <= max_queued) {
+      return false;
+    }
+
+    if (skippable(packet)) {
+      skipped.emplace_back(packet->frame_index());
+      return true;
+    }
+
+    auto it = std::remove_if(std::begin(queued), std::end(queued), [&](const auto &queued_packet) {
+      if (backlog <= max_queued || !same_session(queued_packet) || !skippable(queued_packet)) {
+        return false;
+      }
+
+      skipped.emplace_back(queued_packet->frame_index());
+      --backlog;
+      return true;
+    });
+    queued.erase(it, std::end(queued));
+
+    return false;
+  }
+
+  /**
+   * @brief Header fields that are the same for every shard of a FEC block.
+   */
+  struct video_header_template_t {
+    RTP_PACKET rtp;  ///< RTP header in network byte order, only the sequence number differs between shards
+    std::uint32_t frame_index;  ///< NV_VIDEO_PACKET frameIndex
+    std::uint32_t fec_info;  ///< NV_VIDEO_PACKET fecInfo without the shard index
+    std::uint8_t multi_fec_blocks;  ///< NV_VIDEO_PACKET multiFecBlocks
+  };
+
+  /**
+   * @brief Build the header template of a FEC block.
+   * @param timestamp RTP timestamp of the frame.
+   * @param frame_index Index of the frame.
+   * @param block_index Index of the FEC block within the frame.
+   * @param blocks Number of FEC blocks of the frame.
+   * @param data_shards Number of data shards of the block.
+   * @param percentage FEC percentage of the block.
+   * @return The template.
+   */
+  video_header_template_t make_video_header_template(std::uint32_t timestamp, std::uint32_t frame_index, int block_index, int blocks, size_t data_shards, size_t percentage) {
+    video_header_template_t header {};
+    header.rtp.header = 0x80 | FLAG_EXTENSION;
+    header.rtp.timestamp = util::endian::big<uint32_t>(timestamp);
+    header.frame_index = frame_index;
+    header.fec_info = (std::uint32_t) (data_shards << 22 | percentage << 4);
+    header.multi_fec_blocks = (block_index << 4) | ((blocks - 1) << 6);
+    return header;
+  }
+
+  /**
+   * @brief Write the header fields that are only known after FEC encoding to every shard of a block.
+   * @details Fields written before encoding (stream packet index, flags) are left alone,
+   *          for parity shards those bytes hold parity the client needs for recovery.
+   * @param shards The encoded block.
+   * @param header Template of the block.
+   * @param lowseq RTP sequence number of the first shard.
+   */
+  void fill_shard_headers(fec::fec_t &shards, const video_header_template_t &header, std::uint16_t lowseq) {
+    for (size_t x = 0; x < shards.size(); ++x) {
+      auto *inspect = (video_packet_raw_t *) shards.data(x);
+
+      inspect->rtp = header.rtp;
+      inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(lowseq + x);
+      inspect->packet.frameIndex = header.frame_index;
+      inspect->packet.multiFecBlocks = header.multi_fec_blocks;
+      inspect->packet.fecInfo = header.fec_info | (std::uint32_t) x << 12;
+    }
+  }
+
+  /**
+   * @brief Write the encryption prefix of a shard.
+   * @details We use the deterministic IV construction algorithm specified in NIST SP 800-38D
+   *          Section 8.2.1. The IV counter is our "invocation" field and the 'V' in the high
+   *          bytes is the "fixed" field. Because each client provides their own unique key,
+   *          our values in the fixed field need only uniquely identify each independent use
+   *          of the client's key with AES-GCM in our code. The counter is 64 bits long which
+   *          allows for 2^64 encrypted video packets to be sent to each client before the IV repeats.
+   * @param shards The encoded block.
+   * @param x Index of the shard in the block.
+   * @param iv_counter IV counter of the shard.
+   * @param frame_number Frame number of the shard.
+   * @return The entry that encrypts the shard in place.
+   */
+  crypto::cipher::gcm_t::in_place_entry_t prepare_shard_encryption(fec::fec_t &shards, size_t x, std::uint64_t iv_counter, std::uint32_t frame_number) {
+    auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
+    prefix->frameNumber = frame_number;
+    std::fill(std::begin(prefix->iv), std::end(prefix->iv), 0);
+    std::copy_n((std::uint8_t *) &iv_counter, sizeof(iv_counter), std::begin(prefix->iv));
+    prefix->iv[11] = 'V';  // Video stream
+
+    return {(std::uint8_t *) shards.data(x), prefix->tag, prefix->iv};
+  }
+
   /**
    * @brief Video broadcast thread.
    * 
@@ -1798,22 +2776,27 @@ namespace stream {
    * encrypts if needed, and sends them to clients with rate control.
    * 
    * @param sock The UDP socket for video transmission.
+   * @param packets The queue of video packets to send.
    */
-  void videoBroadcastThread(udp::socket &sock) {
-    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
-    auto packets = mail::man->queue<video::packet_t>(mail::video_packets);
+  void videoBroadcastThread(udp::socket &sock, video_queue_t packets) {
+    auto shutdown_event = mail::man->event(mail::broadcast_shutdown);
     auto video_epoch = std::chrono::steady_clock::now();
 
     // Video traffic is sent on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_placement::apply(config::thread_stage_e::video_send, platf::thread_priority_e::high);
 
     logging::min_max_avg_periodic_logger<double> frame_processing_latency_logger(debug, "Frame processing latency", "ms");
 
-    logging::time_delta_periodic_logger frame_send_batch_latency_logger(debug, "Network: each send_batch() latency");
-    logging::time_delta_periodic_logger frame_fec_latency_logger(debug, "Network: each FEC block latency");
-    logging::time_delta_periodic_logger frame_network_latency_logger(debug, "Network: frame's overall network latency");
+    auto &frame_processing_latency_histogram = metrics::histogram("frame_processing_latency"sv);
+    auto &fec_histogram = metrics::histogram("fec"sv);
+    auto &encrypt_histogram = metrics::histogram("encrypt"sv);
+    auto &send_batch_histogram = metrics::histogram("send_batch"sv);
+    auto &network_histogram = metrics::histogram("network"sv);
 
-    crypto::aes_t iv(12);
+    std::vector<crypto::cipher::gcm_t::in_place_entry_t> pending_encryption;
+    std::vector<std::string_view> payload_segments;
+    std::vector<std::string_view> recorded_segments;
+    pending_encryption.reserve(64);
 
     auto timer = platf::create_high_precision_timer();
     if (!timer || !*timer) {
@@ -1821,41 +2804,140 @@ namespace stream {
       return;
     }
 
+    // Let the qdisc release packets at their launch time, so a whole frame is queued without sleeping
+    const bool kernel_pacing = config::stream.txtime_send && platf::enable_send_txtime(sock.native_handle());
+
+    // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
+    constexpr auto MAX_FEC_BLOCKS = 4;
+
+    // Prepared Reed-Solomon contexts, one cache per FEC block index. A block index is
+    // only ever encoded by one thread at a time, so the caches need no locking.
+    std::array<fec::rs_cache_t, MAX_FEC_BLOCKS> rs_caches;
+
+    // Shard storage for each FEC block index, reused across frames so steady-state
+    // encoding doesn't touch the heap. Same ownership rules as the caches above.
+    std::array<fec::shard_buffers_t, MAX_FEC_BLOCKS> shard_buffers;
+
+    // Large frames (typically 4K IDR frames) are split into multiple FEC blocks.
+    // Parity for the later blocks is generated on these workers while the earlier
+    // blocks are being sent. Without spare cores, everything is encoded inline.
+    std::unique_ptr<thread_pool_util::ThreadPool> fec_pool;
+    if (auto fec_threads = std::min<int>(MAX_FEC_BLOCKS - 1, (int) std::thread::hardware_concurrency() - 1); fec_threads > 0) {
+      fec_pool = std::make_unique<thread_pool_util::ThreadPool>(fec_threads);
+      BOOST_LOG(debug) << "Using "sv << fec_threads << " worker threads for multi-block FEC encoding"sv;
+    }
+
     auto ratecontrol_next_frame_start = std::chrono::steady_clock::now();
 
-    while (auto packet = packets->pop()) {
+    std::vector<int64_t> skipped_frames;
+
+    while (auto packet = packets->pop_selected(earliest_deadline)) {
       if (shutdown_event->peek()) {
         break;
       }
 
-      frame_network_latency_logger.first_point_now();
+      auto network_start = std::chrono::steady_clock::now();
 
       auto session = (session_t *) packet->channel_data;
+
+      if (session->video.recovering) {
+        // Frames encoded before the invalidation was handled still reference the dropped frames
+        if (!packet->is_idr() && !packet->after_ref_frame_invalidation) {
+          continue;
+        }
+        session->video.recovering = false;
+      }
+
+      // Without a bound there is nothing to prune, so don't walk the queue for every frame
+      if (config::stream.video_max_queued_frames > 0 || config::stream.video_max_queued_mb > 0) {
+        auto max_frames = config::stream.video_max_queued_frames > 0 ? config::stream.video_max_queued_frames : std::numeric_limits<int>::max();
+        auto budget = config::stream.video_max_queued_mb > 0 ? (std::size_t) config::stream.video_max_queued_mb << 20 : std::numeric_limits<std::size_t>::max();
+
+        bool skip = false;
+        bool drop = false;
+        bool over_budget = false;
+        std::optional<std::pair<int64_t, int64_t>> invalidate;
+        skipped_frames.clear();
+        packets->prune([&](std::vector<video::packet_t> &queued) {
+          std::size_t bytes;
+          auto max_queued = frames_within_budget(queued, packet, budget, bytes);
+          session->stats.queued_video_bytes.store(bytes, std::memory_order_relaxed);
+
+          over_budget = max_queued < max_frames;
+          max_queued = std::min(max_queued, max_frames);
+          if (max_queued == std::numeric_limits<int>::max()) {
+            return;
+          }
+
+          skip = skip_droppable_frames(queued, packet, max_queued, skipped_frames);
+          if (!skip) {
+            drop = drop_stale_frames(queued, packet, max_queued, invalidate);
+          }
+        });
+
+        if (over_budget && (skip || drop || !skipped_frames.empty())) {
+          video_budget_drops.add();
+          session->stats.budget_drops.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        for (auto frame_index : skipped_frames) {
+          session->video.numbering.skip(frame_index);
+        }
+        if (!skipped_frames.empty()) {
+          BOOST_LOG(debug) << "Skipped "sv << skipped_frames.size() << " unreferenced video frames at "sv << skipped_frames.front();
+        }
+        if (skip) {
+          continue;
+        }
+
+        if (drop) {
+          BOOST_LOG(debug) << "Dropping late video frames starting at "sv << packet->frame_index();
+          if (invalidate) {
+            session->video.invalidate_ref_frames_events->raise(*invalidate);
+            session->video.recovering = true;
+          }
+          continue;
+        }
+      }
       auto lowseq = session->video.lowseq;
+      auto client_frame_index = session->video.numbering.to_client(packet->frame_index());
 
       std::string_view payload {(char *) packet->data(), packet->data_size()};
-      std::vector<uint8_t> payload_with_replacements;
+
+      // The frame header is the first segment, followed by views of the payload.
+      payload_segments.clear();
+      payload_segments.emplace_back();
+      payload_segments.emplace_back(payload);
 
       // Apply replacements on the packet payload before performing any other operations.
       // We need to know the final frame size to calculate the last packet size, and we
       // must avoid matching replacements against the frame header or any other non-video
-      // part of the payload.
+      // part of the payload. Replacements only splice views, the frame is copied once
+      // when packet headers are inserted below.
       if (packet->is_idr() && packet->replacements) {
         for (auto &replacement : *packet->replacements) {
-          auto frame_old = replacement.old;
-          auto frame_new = replacement._new;
-
-          payload_with_replacements = replace(payload, frame_old, frame_new);
-          payload = {(char *) payload_with_replacements.data(), payload_with_replacements.size()};
+          auto hint = replacement.offset < payload.size() ? payload.data() + replacement.offset : nullptr;
+          replace(payload_segments, replacement.old, replacement._new, hint);
         }
       }
 
+      // The recording gets the frames as the client does, without the frame header
+      if (auto recorder = session->recording.get()) {
+        recorded_segments.assign(std::begin(payload_segments) + 1, std::end(payload_segments));
+        recorder->video(recorded_segments, packet->is_idr(), packet->frame_timestamp.value_or(network_start));
+      }
+
+      size_t payload_size = 0;
+      for (const auto &segment : payload_segments) {
+        payload_size += segment.size();
+      }
+
       video_short_frame_header_t frame_header = {};
       frame_header.headerType = 0x01;  // Short header type
       frame_header.frameType = packet->is_idr()                     ? 2 :
                                packet->after_ref_frame_invalidation ? 5 :
                                                                       1;
-      frame_header.lastPayloadLen = (payload.size() + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
+      frame_header.lastPayloadLen = (payload_size + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
       if (frame_header.lastPayloadLen == 0) {
         frame_header.lastPayloadLen = session->config.packetsize - sizeof(NV_VIDEO_PACKET);
       }
@@ -1866,25 +2948,32 @@ namespace stream {
           return (uint16_t) std::clamp<decltype(duration_us)>((duration_us + 50) / 100, 0, std::numeric_limits<uint16_t>::max());
         };
 
-        uint16_t latency = duration_to_latency(std::chrono::steady_clock::now() - *packet->frame_timestamp);
+        auto now = std::chrono::steady_clock::now();
+        auto processing_latency = now - *packet->frame_timestamp;
+        frame_processing_latency_histogram.record(processing_latency);
+        if (config::input.latency_tracing) {
+          metrics::input_trace::encoded(packet->frame_index(), *packet->frame_timestamp, now);
+        }
+        session->stats.frame_latency_us.store(std::chrono::duration_cast<std::chrono::microseconds>(processing_latency).count(), std::memory_order_relaxed);
+
+        uint16_t latency = duration_to_latency(processing_latency);
         frame_header.frame_processing_latency = latency;
         frame_processing_latency_logger.collect_and_log(latency / 10.);
       } else {
         frame_header.frame_processing_latency = 0;
       }
 
-      auto fecPercentage = config::stream.fec_percentage;
+      // Losing an unreferenced frame costs the same recovery as losing any other, but it's skipped first under congestion
+      auto fecPercentage = packet->droppable ? 0 : session->video.fec_percentage.load(std::memory_order_relaxed);
 
       // Insert space for packet headers
       auto blocksize = session->config.packetsize + MAX_RTP_HEADER_SIZE;
       auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
-      auto payload_new = concat_and_insert(sizeof(video_packet_raw_t), payload_blocksize, std::string_view {(char *) &frame_header, sizeof(frame_header)}, payload);
+      payload_segments.front() = std::string_view {(char *) &frame_header, sizeof(frame_header)};
+      auto payload_new = concat_and_insert(sizeof(video_packet_raw_t), payload_blocksize, payload_segments);
 
       payload = std::string_view {(char *) payload_new.data(), payload_new.size()};
 
-      // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
-      constexpr auto MAX_FEC_BLOCKS = 4;
-
       // The max number of data shards per block is found by solving this system of equations for D:
       // D = 255 - P
       // P = D * F
@@ -1911,7 +3000,7 @@ namespace stream {
         fec_blocks_begin = std::begin(fec_blocks),
         fec_blocks_end = std::begin(fec_blocks) + fec_blocks_needed;
 
-      BOOST_LOG(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
+      HOT_LOG(verbose, "Generating {} FEC blocks", fec_blocks_needed);
 
       // Align individual FEC blocks to blocksize
       auto unaligned_size = payload.size() / fec_blocks_needed;
@@ -1935,8 +3024,14 @@ namespace stream {
       }
 
       try {
-        // Use around 80% of 1Gbps          1Gbps            percent    ms     packet      byte
-        size_t ratecontrol_packets_in_1ms = std::giga::num * 80 / 100 / 1000 / blocksize / 8;
+        size_t ratecontrol_packets_in_1ms = pacing_packets_in_1ms(
+          blocksize,
+          session->config.monitor.bitrate,
+          session->video.link_speed.load(std::memory_order_relaxed),
+          session->control.rtt.load(std::memory_order_relaxed),
+          session->control.rtt_variance.load(std::memory_order_relaxed),
+          session->stats.loss_reports.load(std::memory_order_relaxed) ? session->stats.loss_percentage.load(std::memory_order_relaxed) : -1.0f
+        );
 
         // Send less than 64K in a single batch.
         // On Windows, batches above 64K seem to bypass SO_SNDBUF regardless of its size,
@@ -1954,15 +3049,44 @@ namespace stream {
         size_t ratecontrol_frame_packets_sent = 0;
         size_t ratecontrol_group_packets_sent = 0;
 
-        auto blockIndex = 0;
-        std::for_each(fec_blocks_begin, fec_blocks_end, [&](std::string_view &current_payload) {
+        // If video encryption is enabled, we allocate space for the encryption header before each shard
+        auto prefixsize = session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0;
+
+        // The shard count of each FEC block only depends on its size, so we can compute
+        // the starting sequence number of every block before any parity is generated.
+        // This allows the packet headers of all blocks to be written up front.
+        std::array<int, MAX_FEC_BLOCKS> fec_block_lowseq;
+        auto next_lowseq = lowseq;
+        for (int x = 0; x < fec_blocks_needed; ++x) {
+          size_t block_fec_percentage = fecPercentage;
+          auto [data_shards, parity_shards] = fec::shard_count(fec_blocks[x].size(), blocksize, block_fec_percentage, session->config.minRequiredFecPackets);
+
+          fec_block_lowseq[x] = next_lowseq;
+          next_lowseq += data_shards + parity_shards;
+        }
+
+        // Spread the frame over time, so a burst of loss takes only part of each FEC block.
+        // The blocks still go out one after the other, Moonlight drops a block once packets
+        // of the next one arrive.
+        if (config::stream.fec_spread > 0) {
+          ratecontrol_packets_in_1ms = spread_packets_in_1ms(
+            ratecontrol_packets_in_1ms,
+            next_lowseq - lowseq,
+            std::chrono::milliseconds {config::stream.fec_spread},
+            session->config.monitor.framerate
+          );
+          send_batch_size = std::min(send_batch_size, ratecontrol_packets_in_1ms);
+        }
+
+        for (int blockIndex = 0; blockIndex < fec_blocks_needed; ++blockIndex) {
+          auto &current_payload = fec_blocks[blockIndex];
           auto packets = (current_payload.size() + (blocksize - 1)) / blocksize;
 
           for (int x = 0; x < packets; ++x) {
             auto *inspect = (video_packet_raw_t *) &current_payload[x * blocksize];
 
-            inspect->packet.frameIndex = packet->frame_index();
-            inspect->packet.streamPacketIndex = ((uint32_t) lowseq + x) << 8;
+            inspect->packet.frameIndex = client_frame_index;
+            inspect->packet.streamPacketIndex = ((uint32_t) fec_block_lowseq[blockIndex] + x) << 8;
 
             // Match multiFecFlags with Moonlight
             inspect->packet.multiFecFlags = 0x10;
@@ -1976,17 +3100,86 @@ namespace stream {
               inspect->packet.flags |= FLAG_EOF;
             }
           }
+        }
+
+        // RTP video timestamps use a 90 KHz clock and the frame_timestamp from when the frame was captured
+        // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
+        bool frame_is_dupe = false;
+        if (!packet->frame_timestamp) {
+          packet->frame_timestamp = ratecontrol_next_frame_start;
+          frame_is_dupe = true;
+        }
+        using rtp_tick = std::chrono::duration<uint32_t, std::ratio<1, 90000>>;
+        uint32_t timestamp = std::chrono::round<rtp_tick>(*packet->frame_timestamp - video_epoch).count();
+
+        // Each shard of the frame takes the next IV, in the order they are sent. The IVs are
+        // taken up front, so a frame that fails half way never has them used again.
+        auto frame_iv_counter = session->video.gcm_iv_counter;
+        session->video.gcm_iv_counter += next_lowseq - lowseq;
+        const crypto::aes_t *video_key = session->video.cipher ? &session->video.cipher->key : nullptr;
+
+        // Generate the parity of a later block, write its headers and encrypt it on a worker,
+        // so the broadcast thread only has to send it. Each job gets a cipher of its own,
+        // the one of the session is in use by the broadcast thread.
+        auto seal_block = [&](int x) {
+          auto shards = fec::encode(fec_blocks[x], blocksize, fecPercentage, session->config.minRequiredFecPackets, prefixsize, rs_caches[x], shard_buffers[x]);
+
+          auto header = make_video_header_template(timestamp, client_frame_index, x, fec_blocks_needed, shards.data_shards, shards.percentage);
+          fill_shard_headers(shards, header, fec_block_lowseq[x]);
+
+          if (video_key) {
+            auto iv_counter = frame_iv_counter + (fec_block_lowseq[x] - fec_block_lowseq[0]);
+
+            std::vector<crypto::cipher::gcm_t::in_place_entry_t> batch;
+            batch.reserve(shards.size());
+            for (size_t y = 0; y < shards.size(); ++y) {
+              batch.push_back(prepare_shard_encryption(shards, y, iv_counter + y, packet->frame_index()));
+            }
+
+            crypto::cipher::gcm_t cipher {*video_key, false};
+            if (cipher.encrypt_in_place(batch.data(), batch.size(), blocksize, sizeof(video_packet_enc_prefix_t::iv))) {
+              BOOST_LOG(error) << "Failed to encrypt video packets"sv;
+            }
+          }
 
-          frame_fec_latency_logger.first_point_now();
-          // If video encryption is enabled, we allocate space for the encryption header before each shard
-          auto shards = fec::encode(current_payload, blocksize, fecPercentage, session->config.minRequiredFecPackets, session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0);
-          frame_fec_latency_logger.second_point_now_and_log();
+          return shards;
+        };
+
+        // Hand all but the first FEC block to the worker pool, so sealing block N+1
+        // overlaps with sending block N. The first block is encoded inline
+        // since we need it immediately anyway.
+        std::array<std::future<fec::fec_t>, MAX_FEC_BLOCKS> fec_futures;
+        auto wait_fec_guard = util::fail_guard([&]() {
+          // The workers point into payload_new, so they must finish before it is released
+          for (auto &future : fec_futures) {
+            if (future.valid()) {
+              future.wait();
+            }
+          }
+        });
+
+        if (fec_pool) {
+          for (int x = 1; x < fec_blocks_needed; ++x) {
+            fec_futures[x] = fec_pool->push(seal_block, x);
+          }
+        }
+
+        auto blockIndex = 0;
+        std::for_each(fec_blocks_begin, fec_blocks_end, [&](std::string_view &current_payload) {
+          auto fec_start = std::chrono::steady_clock::now();
+          auto sealed = fec_futures[blockIndex].valid();
+          auto shards = sealed ?
+                          fec_futures[blockIndex].get() :
+                          fec::encode(current_payload, blocksize, fecPercentage, session->config.minRequiredFecPackets, prefixsize, rs_caches[blockIndex], shard_buffers[blockIndex]);
+          auto fec_end = std::chrono::steady_clock::now();
+          fec_histogram.record(fec_end - fec_start);
+          pipeline_trace::span("fec", fec_start, fec_end, packet->frame_index());
 
           auto peer_address = session->video.peer.address();
           auto batch_info = platf::batched_send_info_t {
-            shards.headers.begin(),
+            shards.headers(),
             shards.prefixsize,
-            shards.payload_buffers,
+            shards.payload_buffers(),
             shards.blocksize,
             0,
             0,
@@ -1998,60 +3191,44 @@ namespace stream {
 
           size_t next_shard_to_send = 0;
 
-          // RTP video timestamps use a 90 KHz clock and the frame_timestamp from when the frame was captured
-          // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
-          bool frame_is_dupe = false;
-          if (!packet->frame_timestamp) {
-            packet->frame_timestamp = ratecontrol_next_frame_start;
-            frame_is_dupe = true;
+          // set FEC info now that we know for sure what our percentage will be for this frame
+          if (!sealed) {
+            auto header = make_video_header_template(timestamp, client_frame_index, blockIndex, fec_blocks_needed, shards.data_shards, shards.percentage);
+            fill_shard_headers(shards, header, lowseq);
           }
-          using rtp_tick = std::chrono::duration<uint32_t, std::ratio<1, 90000>>;
-          uint32_t timestamp = std::chrono::round<rtp_tick>(*packet->frame_timestamp - video_epoch).count();
 
-          // set FEC info now that we know for sure what our percentage will be for this frame
           for (auto x = 0; x < shards.size(); ++x) {
-            auto *inspect = (video_packet_raw_t *) shards.data(x);
-
-            inspect->packet.fecInfo =
-              (x << 12 |
-               shards.data_shards << 22 |
-               shards.percentage << 4);
-
-            inspect->rtp.header = 0x80 | FLAG_EXTENSION;
-            inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(lowseq + x);
-            inspect->rtp.timestamp = util::endian::big<uint32_t>(timestamp);
-
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
-            inspect->packet.frameIndex = packet->frame_index();
-
-            // Encrypt this shard if video encryption is enabled
-            if (session->video.cipher) {
-              // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
-              // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
-              // high bytes is the "fixed" field. Because each client provides their own unique
-              // key, our values in the fixed field need only uniquely identify each independent
-              // use of the client's key with AES-GCM in our code.
-              //
-              // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
-              // to be sent to each client before the IV repeats.
-              std::copy_n((uint8_t *) &session->video.gcm_iv_counter, sizeof(session->video.gcm_iv_counter), std::begin(iv));
-              iv[11] = 'V';  // Video stream
-              session->video.gcm_iv_counter++;
-
-              // Encrypt the target buffer in place
-              auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
-              prefix->frameNumber = packet->frame_index();
-              std::copy(std::begin(iv), std::end(iv), prefix->iv);
-              session->video.cipher->encrypt(std::string_view {(char *) inspect, (size_t) blocksize}, prefix->tag, (uint8_t *) inspect, &iv);
+            // Encrypt this shard if video encryption is enabled and a worker hasn't already.
+            // The target buffer is encrypted in place along with the rest of its send batch.
+            if (video_key && !sealed) {
+              auto iv_counter = frame_iv_counter + (lowseq - fec_block_lowseq[0]) + x;
+              pending_encryption.push_back(prepare_shard_encryption(shards, x, iv_counter, packet->frame_index()));
             }
 
             if (x - next_shard_to_send + 1 >= send_batch_size ||
                 x + 1 == shards.size()) {
+              if (!pending_encryption.empty()) {
+                auto encrypt_start = std::chrono::steady_clock::now();
+                if (session->video.cipher->encrypt_in_place(pending_encryption.data(), pending_encryption.size(), blocksize, sizeof(video_packet_enc_prefix_t::iv))) {
+                  BOOST_LOG(error) << "Failed to encrypt video packets"sv;
+                }
+                auto encrypt_end = std::chrono::steady_clock::now();
+                encrypt_histogram.record(encrypt_end - encrypt_start);
+                pipeline_trace::span("encrypt", encrypt_start, encrypt_end, packet->frame_index());
+                pending_encryption.clear();
+              }
+
               // Do pacing within the frame.
               // Also trigger pacing before the first send_batch() of the frame
               // to account for the last send_batch() of the previous frame.
-              if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
-                  ratecontrol_frame_packets_sent == 0) {
+              if (kernel_pacing) {
+                // Every packet gets its own slot instead of leaving in 1ms groups
+                batch_info.txtime = ratecontrol_frame_start +
+                                    std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
+                                      ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+                batch_info.txtime_interval = std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) / ratecontrol_packets_in_1ms;
+              } else if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
+                         ratecontrol_frame_packets_sent == 0) {
                 auto due = ratecontrol_frame_start +
                            std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
                              ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
@@ -2068,7 +3245,7 @@ namespace stream {
               batch_info.block_offset = next_shard_to_send;
               batch_info.block_count = current_batch_size;
 
-              frame_send_batch_latency_logger.first_point_now();
+              auto send_batch_start = std::chrono::steady_clock::now();
               // Use a batched send if it's supported on this platform
               if (!platf::send_batch(batch_info)) {
                 // Batched send is not available, so send each packet individually
@@ -2088,7 +3265,17 @@ namespace stream {
                   platf::send(send_info);
                 }
               }
-              frame_send_batch_latency_logger.second_point_now_and_log();
+              auto send_batch_end = std::chrono::steady_clock::now();
+              send_batch_histogram.record(send_batch_end - send_batch_start);
+              pipeline_trace::span("send_batch", send_batch_start, send_batch_end, packet->frame_index());
+
+              // Keep the packets as sent, so the client can ask for lost ones again
+              if (session->video.retransmit.enabled()) {
+                auto sent = std::chrono::steady_clock::now();
+                for (auto y = next_shard_to_send; y <= x; y++) {
+                  session->video.retransmit.store((std::uint16_t) (lowseq + y), {shards.prefix(y), shards.prefixsize}, {shards.data(y), shards.blocksize}, sent);
+                }
+              }
 
               ratecontrol_group_packets_sent += current_batch_size;
               ratecontrol_frame_packets_sent += current_batch_size;
@@ -2101,21 +3288,27 @@ namespace stream {
                                          std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
                                            ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
 
-          frame_network_latency_logger.second_point_now_and_log();
+          network_histogram.record(std::chrono::steady_clock::now() - network_start);
+
+          session->stats.packets_sent.fetch_add(shards.size(), std::memory_order_relaxed);
+          session->stats.fec_packets_sent.fetch_add(shards.size() - shards.data_shards, std::memory_order_relaxed);
+          session->stats.bytes_sent.fetch_add(shards.size() * (shards.prefixsize + shards.blocksize), std::memory_order_relaxed);
 
-          BOOST_LOG(verbose) << "Sent Frame seq ["sv << packet->frame_index() << "] pts ["sv << timestamp
-                             << "] shards ["sv << shards.size() << "/"sv << shards.percentage << "%]"sv
-                             << (frame_is_dupe ? " Dupe" : "")
-                             << (packet->is_idr() ? " Key" : "")
-                             << (packet->after_ref_frame_invalidation ? " RFI" : "");
+          HOT_LOG(verbose, "Sent Frame seq [{}] pts [{}] shards [{}/{}%]{}{}{}", packet->frame_index(), timestamp, shards.size(), shards.percentage, frame_is_dupe ? " Dupe" : "", packet->is_idr() ? " Key" : "", packet->after_ref_frame_invalidation ? " RFI" : "");
 
           ++blockIndex;
           lowseq += shards.size();
         });
 
         session->video.lowseq = lowseq;
+        session->stats.frames_sent.fetch_add(1, std::memory_order_relaxed);
+        pipeline_trace::span("send_frame", network_start, std::chrono::steady_clock::now(), packet->frame_index());
+        if (config::input.latency_tracing) {
+          metrics::input_trace::sent(packet->frame_index(), std::chrono::steady_clock::now());
+        }
       } catch (const std::exception &e) {
         BOOST_LOG(error) << "Broadcast video failed "sv << e.what();
+        pending_encryption.clear();
         std::this_thread::sleep_for(100ms);
       }
     }
@@ -2123,6 +3316,29 @@ namespace stream {
     shutdown_event->raise(true);
   }
 
+  /**
+   * @brief Video dispatch thread.
+   * 
+   * Distributes video packets to the video broadcast workers. A session is
+   * pinned to a worker when its first frame is seen, so the frames of one
+   * session are always sent in order while a large frame or pacing delay
+   * for one client doesn't hold up the others.
+   * 
+   * @param workers The packet queues of the video broadcast workers.
+   */
+  void videoDispatchThread(std::vector<video_queue_t> workers) {
+    auto packets = mail::man->queue(mail::video_packets);
+
+    while (auto packet = packets->pop()) {
+      auto session = (session_t *) packet->channel_data;
+      workers[session->video.broadcast_worker]->raise(std::move(packet));
+    }
+
+    for (auto &worker : workers) {
+      worker->stop();
+    }
+  }
+
   /**
    * @brief Audio broadcast thread.
    * 
@@ -2132,8 +3348,13 @@ namespace stream {
    * @param sock The UDP socket for audio transmission.
    */
   void audioBroadcastThread(udp::socket &sock) {
-    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
-    auto packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
+    auto shutdown_event = mail::man->event(mail::broadcast_shutdown);
+    auto packets = mail::man->queue(mail::audio_packets);
+
+    auto &audio_latency_histogram = metrics::histogram("audio_processing_latency"sv);
+    auto &av_skew_histogram = metrics::histogram("av_skew"sv);
+    auto &audio_encrypt_histogram = metrics::histogram("audio_encrypt"sv);
+    auto &audio_fec_histogram = metrics::histogram("audio_fec"sv);
 
     audio_packet_t audio_packet;
     fec::rs_t rs {reed_solomon_new(RTPA_DATA_SHARDS, RTPA_FEC_SHARDS)};
@@ -2151,8 +3372,12 @@ namespace stream {
     audio_packet.rtp.packetType = 97;
     audio_packet.rtp.ssrc = 0;
 
+    // The parity shards of a block are sent together in a single batch
+    std::vector<platf::buffer_descriptor_t> fec_payload_buffers;
+    fec_payload_buffers.reserve(RTPA_FEC_SHARDS);
+
     // Audio traffic is sent on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_placement::apply(config::thread_stage_e::audio, platf::thread_priority_e::high);
 
     while (auto packet = packets->pop()) {
       if (shutdown_event->peek()) {
@@ -2162,6 +3387,20 @@ namespace stream {
       TUPLE_2D_REF(channel_data, packet_data, *packet);
       auto session = (session_t *) channel_data;
 
+      // Compare the host latency of audio with the one of the video frames sent alongside
+      auto audio_latency_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - std::get<2>(*packet)).count();
+      audio_latency_histogram.record_us(std::max<std::int64_t>(audio_latency_us, 0));
+      session->stats.audio_latency_us.store(std::max<std::int64_t>(audio_latency_us, 0), std::memory_order_relaxed);
+      if (auto video_latency_us = session->stats.frame_latency_us.load(std::memory_order_relaxed)) {
+        auto skew_us = audio_latency_us - (std::int64_t) video_latency_us;
+        av_skew_histogram.record_us(std::abs(skew_us));
+        session->stats.av_skew_us.store(skew_us, std::memory_order_relaxed);
+      }
+
+      if (auto recorder = session->recording.get()) {
+        recorder->audio(std::string_view {(char *) std::begin(packet_data), packet_data.size()}, std::get<2>(*packet));
+      }
+
       auto sequenceNumber = session->audio.sequenceNumber;
       auto timestamp = session->audio.timestamp;
 
@@ -2169,13 +3408,18 @@ namespace stream {
 
       auto &shards_p = session->audio.shards_p;
 
+      auto encrypt_start = std::chrono::steady_clock::now();
       auto bytes = encode_audio(session->config.encryptionFlagsEnabled & SS_ENC_AUDIO, packet_data, shards_p[sequenceNumber % RTPA_DATA_SHARDS], iv, session->audio.cipher);
+      audio_encrypt_histogram.record(std::chrono::steady_clock::now() - encrypt_start);
+
+      // The payload now lives in the FEC shard, the encoder can reuse the buffer
+      audio::release_buffer(std::move(packet_data));
       if (bytes < 0) {
         BOOST_LOG(error) << "Couldn't encode audio packet"sv;
         break;
       }
 
-      BOOST_LOG(verbose) << "Audio [seq "sv << sequenceNumber << ", pts "sv << timestamp << "] ::  send..."sv;
+      HOT_LOG(verbose, "Audio [seq {}, pts {}] ::  send...", sequenceNumber, timestamp);
 
       audio_packet.rtp.sequenceNumber = util::endian::big(sequenceNumber);
       audio_packet.rtp.timestamp = util::endian::big(timestamp);
@@ -2197,34 +3441,56 @@ namespace stream {
         };
         platf::send(send_info);
 
-        auto &fec_packet = session->audio.fec_packet;
-        // initialize the FEC header at the beginning of the FEC block
+        auto &fec_packets = session->audio.fec_packets;
+        // initialize the FEC headers at the beginning of the FEC block
         if (sequenceNumber % RTPA_DATA_SHARDS == 0) {
-          fec_packet.fecHeader.baseSequenceNumber = util::endian::big(sequenceNumber);
-          fec_packet.fecHeader.baseTimestamp = util::endian::big(timestamp);
+          for (auto &fec_packet : fec_packets) {
+            fec_packet.fecHeader.baseSequenceNumber = util::endian::big(sequenceNumber);
+            fec_packet.fecHeader.baseTimestamp = util::endian::big(timestamp);
+          }
         }
 
         // generate parity shards at the end of the FEC block
         if ((sequenceNumber + 1) % RTPA_DATA_SHARDS == 0) {
+          auto fec_start = std::chrono::steady_clock::now();
           reed_solomon_encode(rs.get(), shards_p.begin(), RTPA_TOTAL_SHARDS, bytes);
+          audio_fec_histogram.record(std::chrono::steady_clock::now() - fec_start);
 
+          fec_payload_buffers.clear();
           for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
-            fec_packet.rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
-            fec_packet.fecHeader.fecShardIndex = x;
-
-            auto send_info = platf::send_info_t {
-              (const char *) &fec_packet,
-              sizeof(fec_packet),
-              (const char *) shards_p[RTPA_DATA_SHARDS + x],
-              (size_t) bytes,
-              (uintptr_t) sock.native_handle(),
-              peer_address,
-              session->audio.peer.port(),
-              session->localAddress,
-            };
-            platf::send(send_info);
-            BOOST_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << ' ' << x << "] ::  send..."sv;
+            fec_packets[x].rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
+            fec_payload_buffers.emplace_back((const char *) shards_p[RTPA_DATA_SHARDS + x], (size_t) bytes);
+          }
+
+          auto batch_info = platf::batched_send_info_t {
+            (const char *) fec_packets.data(),
+            sizeof(audio_fec_packet_t),
+            fec_payload_buffers,
+            (size_t) bytes,
+            0,
+            RTPA_FEC_SHARDS,
+            (uintptr_t) sock.native_handle(),
+            peer_address,
+            session->audio.peer.port(),
+            session->localAddress,
+          };
+
+          if (!platf::send_batch(batch_info)) {
+            for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
+              auto send_info = platf::send_info_t {
+                (const char *) &fec_packets[x],
+                sizeof(audio_fec_packet_t),
+                (const char *) shards_p[RTPA_DATA_SHARDS + x],
+                (size_t) bytes,
+                (uintptr_t) sock.native_handle(),
+                peer_address,
+                session->audio.peer.port(),
+                session->localAddress,
+              };
+              platf::send(send_info);
+            }
           }
+          HOT_LOG(verbose, "Audio FEC [{}] ::  send...", sequenceNumber & ~(RTPA_DATA_SHARDS - 1));
         }
       } catch (const std::exception &e) {
         BOOST_LOG(error) << "Broadcast audio failed "sv << e.what();
@@ -2249,7 +3515,13 @@ namespace stream {
     }
 
     boost::system::error_code ec;
-    ctx.video_sock.open(protocol, ec);
+    std::uintptr_t native_video_sock;
+    if (config::stream.registered_io_send &&
+        (ctx.video_registered_io = platf::open_registered_io_socket(protocol == udp::v6(), native_video_sock))) {
+      ctx.video_sock.assign(protocol, native_video_sock, ec);
+    } else {
+      ctx.video_sock.open(protocol, ec);
+    }
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't open socket for Video server: "sv << ec.message();
 
@@ -2263,6 +3535,13 @@ namespace stream {
       BOOST_LOG(error) << "Failed to set video socket send buffer size (SO_SENDBUF)";
     }
 
+    // Each video worker may send from its own socket on the video port, so they don't contend for one socket lock
+    auto reuse_port = config::stream.video_reuseport && config::stream.video_send_threads > 1;
+    if (reuse_port && !enable_reuse_port(ctx.video_sock)) {
+      BOOST_LOG(warning) << "Video workers will share a single socket"sv;
+      reuse_port = false;
+    }
+
     ctx.video_sock.bind(udp::endpoint(protocol, video_port), ec);
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't bind Video server to port ["sv << video_port << "]: "sv << ec.message();
@@ -2270,6 +3549,27 @@ namespace stream {
       return -1;
     }
 
+    if (reuse_port) {
+      // The workers keep references to their sockets
+      ctx.video_worker_socks.reserve(config::stream.video_send_threads - 1);
+      for (int x = 1; x < config::stream.video_send_threads; ++x) {
+        auto &sock = ctx.video_worker_socks.emplace_back(ctx.io_context);
+        sock.open(protocol, ec);
+        if (!ec) {
+          sock.set_option(boost::asio::socket_base::send_buffer_size(1024 * 1024), ec);
+          enable_reuse_port(sock);
+          sock.bind(udp::endpoint(protocol, video_port), ec);
+        }
+        if (ec) {
+          BOOST_LOG(fatal) << "Couldn't bind Video server socket for worker "sv << x << " to port ["sv << video_port << "]: "sv << ec.message();
+
+          return -1;
+        }
+      }
+
+      BOOST_LOG(info) << "Video workers send from "sv << config::stream.video_send_threads << " sockets on port ["sv << video_port << ']';
+    }
+
     ctx.audio_sock.open(protocol, ec);
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't open socket for Audio server: "sv << ec.message();
@@ -2286,7 +3586,18 @@ namespace stream {
 
     ctx.message_queue_queue = std::make_shared<message_queue_queue_t::element_type>(30);
 
-    ctx.video_thread = std::thread {videoBroadcastThread, std::ref(ctx.video_sock)};
+    if (config::stream.video_send_threads > 1) {
+      std::vector<video_queue_t> workers;
+      for (int x = 0; x < config::stream.video_send_threads; ++x) {
+        auto &worker = workers.emplace_back(std::make_shared<safe::queue_t<video::packet_t>>());
+        auto &sock = x == 0 || ctx.video_worker_socks.empty() ? ctx.video_sock : ctx.video_worker_socks[x - 1];
+        ctx.video_worker_threads.emplace_back(videoBroadcastThread, std::ref(sock), worker);
+      }
+
+      ctx.video_thread = std::thread {videoDispatchThread, std::move(workers)};
+    } else {
+      ctx.video_thread = std::thread {videoBroadcastThread, std::ref(ctx.video_sock), mail::man->queue(mail::video_packets)};
+    }
     ctx.audio_thread = std::thread {audioBroadcastThread, std::ref(ctx.audio_sock)};
     ctx.control_thread = std::thread {controlBroadcastThread, &ctx.control_server};
 
@@ -2296,12 +3607,12 @@ namespace stream {
   }
 
   void end_broadcast(broadcast_ctx_t &ctx) {
-    auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+    auto broadcast_shutdown_event = mail::man->event(mail::broadcast_shutdown);
 
     broadcast_shutdown_event->raise(true);
 
-    auto video_packets = mail::man->queue<video::packet_t>(mail::video_packets);
-    auto audio_packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
+    auto video_packets = mail::man->queue(mail::video_packets);
+    auto audio_packets = mail::man->queue(mail::audio_packets);
 
     // Minimize delay stopping video/audio threads
     video_packets->stop();
@@ -2310,7 +3621,12 @@ namespace stream {
     ctx.message_queue_queue->stop();
     ctx.io_context.stop();
 
+    // Sends still in progress fall back to regular batched sends once the registered buffers are released
+    ctx.video_registered_io.reset();
     ctx.video_sock.close();
+    for (auto &sock : ctx.video_worker_socks) {
+      sock.close();
+    }
     ctx.audio_sock.close();
 
     video_packets.reset();
@@ -2320,6 +3636,11 @@ namespace stream {
     ctx.recv_thread.join();
     BOOST_LOG(debug) << "Waiting for main video thread to end..."sv;
     ctx.video_thread.join();
+    for (auto &worker_thread : ctx.video_worker_threads) {
+      worker_thread.join();
+    }
+    ctx.video_worker_threads.clear();
+    ctx.video_worker_socks.clear();
     BOOST_LOG(debug) << "Waiting for main audio thread to end..."sv;
     ctx.audio_thread.join();
     BOOST_LOG(debug) << "Waiting for main control thread to end..."sv;
@@ -2375,8 +3696,9 @@ namespace stream {
         break;
       }
 
-      TUPLE_2D_REF(recv_peer, msg, *msg_opt);
-      if (msg.find(expected_payload) != std::string::npos) {
+      TUPLE_2D_REF(recv_peer, packet, *msg_opt);
+      std::string_view msg {*packet};
+      if (msg.find(expected_payload) != std::string_view::npos) {
         // Match the new PING payload format
         BOOST_LOG(debug) << "Received ping [v2] from "sv << recv_peer.address() << ':' << recv_peer.port() << " ["sv << util::hex_vec(msg) << ']';
       } else if (!(session->config.mlFeatureFlags & ML_FF_SESSION_ID_V1) && msg == "PING"sv) {
@@ -2417,12 +3739,85 @@ namespace stream {
       return;
     }
 
-    // Enable local prioritization and QoS tagging on video traffic if requested by the client
+    // Pin the session to a broadcast worker before its first frame, QoS applies to the socket of the worker
+    session->video.broadcast_worker = ref->next_video_worker.fetch_add(1, std::memory_order_relaxed) % std::max(config::stream.video_send_threads, 1);
+
+    // Enable local prioritization and QoS tagging on video traffic if requested by the client,
+    // FEC and retransmitted packets share the class since they are sent on the same socket
     auto address = session->video.peer.address();
-    session->video.qos = platf::enable_socket_qos(ref->video_sock.native_handle(), address, session->video.peer.port(), platf::qos_data_type_e::video, session->config.videoQosType != 0);
+    session->video.qos = enable_session_qos(video_socket(session, *ref.get()).native_handle(), address, session->video.peer.port(), platf::qos_data_type_e::video, session->config.videoQosType != 0, session->stats.video_dscp);
 
     BOOST_LOG(debug) << "Start capturing Video"sv;
-    video::capture(session->mail, session->config.monitor, session);
+    video::capture(session->mail, session->config.monitor, session, session->video.bitrate_target);
+  }
+
+  /**
+   * @brief Play the microphone packets of the client into the virtual microphone.
+   * @details Packets are encrypted like the host audio, with the last byte of the IV set to 1
+   *          so the two directions never share an IV. The jitter buffer is drained once per
+   *          packet duration on a steady clock, independently of the arrival of packets.
+   * @param session The streaming session.
+   * @param ref Reference to the broadcast context.
+   */
+  void micThread(session_t *session, decltype(broadcast)::ptr_t ref) {
+    thread_placement::apply(config::thread_stage_e::audio, platf::thread_priority_e::high);
+
+    audio::mic_playback_t playback;
+    if (playback.init()) {
+      return;
+    }
+
+    auto messages = std::make_shared<message_queue_t::element_type>(30);
+    av_session_id_t session_id = session->audio.peer;
+    ref->message_queue_queue->raise(socket_e::microphone, session_id, messages);
+
+    auto fg = util::fail_guard([&]() {
+      messages->stop();
+      ref->message_queue_queue->raise(socket_e::microphone, session_id, nullptr);
+    });
+
+    auto encrypted = session->config.encryptionFlagsEnabled & SS_ENC_AUDIO;
+
+    crypto::aes_t iv(16);
+    iv[15] = 1;
+    std::vector<std::uint8_t> plaintext;
+
+    auto next_tick = std::chrono::steady_clock::now() + playback.packet_duration();
+    while (!session->shutdown_event->peek()) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= next_tick) {
+        if (playback.tick()) {
+          BOOST_LOG(warning) << "Virtual microphone lost, stopping microphone playback"sv;
+          return;
+        }
+
+        // Skip ahead rather than bursting when the thread fell behind
+        next_tick = std::max(next_tick + playback.packet_duration(), now);
+        continue;
+      }
+
+      auto msg_opt = messages->pop(next_tick - now);
+      if (!msg_opt) {
+        continue;
+      }
+
+      TUPLE_2D_REF(recv_peer, packet, *msg_opt);
+      auto rtp = (PRTP_PACKET) packet->data();
+      auto sequence_number = util::endian::big(rtp->sequenceNumber);
+      auto payload = std::string_view {*packet}.substr(sizeof(RTP_PACKET));
+
+      if (encrypted) {
+        *(std::uint32_t *) iv.data() = util::endian::big<std::uint32_t>(session->audio.avRiKeyId + sequence_number);
+        if (session->audio.cipher.decrypt(payload, plaintext, &iv)) {
+          BOOST_LOG(verbose) << "Dropping undecryptable microphone packet "sv << sequence_number;
+          continue;
+        }
+      } else {
+        plaintext.assign(std::begin(payload), std::end(payload));
+      }
+
+      playback.push(sequence_number, std::move(plaintext));
+    }
   }
 
   /**
@@ -2447,7 +3842,17 @@ namespace stream {
 
     // Enable local prioritization and QoS tagging on audio traffic if requested by the client
     auto address = session->audio.peer.address();
-    session->audio.qos = platf::enable_socket_qos(ref->audio_sock.native_handle(), address, session->audio.peer.port(), platf::qos_data_type_e::audio, session->config.audioQosType != 0);
+    session->audio.qos = enable_session_qos(ref->audio_sock.native_handle(), address, session->audio.peer.port(), platf::qos_data_type_e::audio, session->config.audioQosType != 0, session->stats.audio_dscp);
+
+    std::thread mic_thread;
+    if (config::audio.stream_mic) {
+      mic_thread = std::thread {micThread, session, ref};
+    }
+    auto join_mic = util::fail_guard([&]() {
+      if (mic_thread.joinable()) {
+        mic_thread.join();
+      }
+    });
 
     BOOST_LOG(debug) << "Start capturing Audio"sv;
     audio::capture(session->mail, session->config.audio, session);
@@ -2455,6 +3860,30 @@ namespace stream {
 
   namespace session {
     std::atomic_uint running_sessions;
+    std::atomic_uint idle_trim_generation;  ///< Bumped by every scheduled trim, so only the latest one runs
+
+    void schedule_idle_trim() {
+      if (config::video.idle_memory_trim <= 0s) {
+        return;
+      }
+
+      // The standby capture holds on to the display and the GPU until it ends
+      auto generation = ++idle_trim_generation;
+      task_pool.pushDelayed([generation]() {
+        if (running_sessions > 0 || generation != idle_trim_generation) {
+          return;
+        }
+
+        auto before = platf::memory_usage();
+        platf::trim_memory();
+        auto after = platf::memory_usage();
+        metrics::counter("idle_memory_trims"sv).add();
+
+        if (before.resident && after.resident) {
+          BOOST_LOG(info) << "Trimmed idle memory: resident "sv << *before.resident / 1024 / 1024 << " MiB -> "sv << *after.resident / 1024 / 1024 << " MiB"sv;
+        }
+      }, config::video.idle_memory_trim + config::video.capture_standby);
+    }
 
     state_e state(session_t &session) {
       return session.state.load(std::memory_order_relaxed);
@@ -2499,6 +3928,11 @@ namespace stream {
       }
 
       session.shutdown_event->raise(true);
+
+      // Lets the control thread remove the session without waiting for its next packet
+      if (session.broadcast_ref) {
+        session.broadcast_ref->control_server.wake();
+      }
     }
 
     void graceful_stop(session_t& session) {
@@ -2553,8 +3987,13 @@ namespace stream {
       session.videoThread.join();
       BOOST_LOG(debug) << "Waiting for audio to end..."sv;
       session.audioThread.join();
+      if (auto recorder = session.recording.detach()) {
+        recorder->stop();
+      }
       BOOST_LOG(debug) << "Waiting for control to end..."sv;
       session.controlEnd.view();
+      session.control.feedback_queue->notify(nullptr);
+      session.control.hdr_queue->notify(nullptr);
       // Reset input on session stop to avoid stuck repeated keys
       BOOST_LOG(debug) << "Resetting Input..."sv;
       input::reset(session.input);
@@ -2596,6 +4035,7 @@ namespace stream {
         }
 
         platf::streaming_will_stop();
+        schedule_idle_trim();
       }
 
       BOOST_LOG(debug) << "Session ended"sv;
@@ -2618,6 +4058,13 @@ namespace stream {
         session.broadcast_ref->control_server._sessions->push_back(&session);
       }
 
+      // Feedback and HDR changes are sent as soon as they're queued
+      auto wake_control = [control_server = &session.broadcast_ref->control_server]() {
+        control_server->wake();
+      };
+      session.control.feedback_queue->notify(wake_control);
+      session.control.hdr_queue->notify(wake_control);
+
       auto addr = boost::asio::ip::make_address(addr_string);
       session.video.peer.address(addr);
       session.video.peer.port(0);
@@ -2665,7 +4112,7 @@ namespace stream {
 
       auto mail = std::make_shared<safe::mail_raw_t>();
 
-      session->shutdown_event = mail->event<bool>(mail::shutdown);
+      session->shutdown_event = mail->event(mail::shutdown);
       session->launch_session_id = launch_session.id;
       session->device_name = launch_session.device_name;
       session->device_uuid = launch_session.unique_id;
@@ -2679,19 +4126,30 @@ namespace stream {
       session->auto_bitrate_enabled = launch_session.auto_bitrate_enabled;
       session->auto_bitrate_min_kbps = launch_session.auto_bitrate_min_kbps;
       session->auto_bitrate_max_kbps = launch_session.auto_bitrate_max_kbps;
+      session->stats.bitrate_kbps = config.monitor.bitrate;
 
       session->control.connect_data = launch_session.control_connect_data;
-      session->control.feedback_queue = mail->queue<platf::gamepad_feedback_msg_t>(mail::gamepad_feedback);
-      session->control.hdr_queue = mail->event<video::hdr_info_t>(mail::hdr);
+      session->control.feedback_queue = mail->queue(mail::gamepad_feedback);
+      session->control.hdr_queue = mail->event(mail::hdr);
       session->control.legacy_input_enc_iv = launch_session.iv;
       session->control.cipher = crypto::cipher::gcm_t {
         launch_session.gcm_key,
         false
       };
 
-      session->video.idr_events = mail->event<bool>(mail::idr);
-      session->video.invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+      session->video.idr_events = mail->event(mail::idr);
+      session->video.invalidate_ref_frames_events = mail->event(mail::invalidate_ref_frames);
+      session->video.ladder_change_events = mail->event(mail::ladder_change);
+      session->video.ladder_change_confirmation_events = mail->event(mail::ladder_change_confirmation);
+      session->video.fps_divisor_events = mail->event(mail::fps_divisor);
+      session->video.shed_level = 0;
       session->video.lowseq = 0;
+      session->video.broadcast_worker = -1;
+      session->video.recovering = false;
+      session->video.link_speed = 0;
+      session->video.fec_percentage = config::get_auto_bitrate_settings().fec_percentage;
+      session->control.rtt = 0;
+      session->control.rtt_variance = 0;
       session->video.ping_payload = launch_session.av_ping_payload;
       if (config.encryptionFlagsEnabled & SS_ENC_VIDEO) {
         BOOST_LOG(info) << "Video encryption enabled"sv;
@@ -2716,13 +4174,17 @@ namespace stream {
       session->audio.shards = std::move(shards);
       session->audio.shards_p = std::move(shards_p);
 
-      session->audio.fec_packet.rtp.header = 0x80;
-      session->audio.fec_packet.rtp.packetType = 127;
-      session->audio.fec_packet.rtp.timestamp = 0;
-      session->audio.fec_packet.rtp.ssrc = 0;
+      for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
+        auto &fec_packet = session->audio.fec_packets[x];
+        fec_packet.rtp.header = 0x80;
+        fec_packet.rtp.packetType = 127;
+        fec_packet.rtp.timestamp = 0;
+        fec_packet.rtp.ssrc = 0;
 
-      session->audio.fec_packet.fecHeader.payloadType = 97;
-      session->audio.fec_packet.fecHeader.ssrc = 0;
+        fec_packet.fecHeader.fecShardIndex = x;
+        fec_packet.fecHeader.payloadType = 97;
+        fec_packet.fecHeader.ssrc = 0;
+      }
 
       session->audio.cipher = crypto::cipher::cbc_t {
         launch_session.gcm_key,
@@ -2733,6 +4195,7 @@ namespace stream {
       session->audio.avRiKeyId = util::endian::big(*(std::uint32_t *) launch_session.iv.data());
       session->audio.sequenceNumber = 0;
       session->audio.timestamp = 0;
+      session->audio.encoder_params_events = mail->event(mail::audio_encoder_params);
 
       session->control.peer = nullptr;
       session->state.store(state_e::STOPPED, std::memory_order_relaxed);
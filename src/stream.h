@@ -5,12 +5,14 @@
 #pragma once
 
 // standard includes
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <functional>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <thread>
@@ -31,10 +33,12 @@ extern "C" {
 
 // local includes
 #include "audio.h"
+#include "auto_bitrate.h"
 #include "crypto.h"
 #include "input.h"
 #include "network.h"
 #include "platform/common.h"
+#include "recording.h"
 #include "sync.h"
 #include "thread_safe.h"
 #include "utility.h"
@@ -66,13 +70,23 @@ namespace stream {
    */
   enum class socket_e : int {
     video,  ///< Video socket
-    audio  ///< Audio socket
+    audio,  ///< Audio socket
+    microphone  ///< Microphone packets of the client, received on the audio socket
   };
 
   namespace asio = boost::asio;
   using asio::ip::udp;
-  using av_session_id_t = std::variant<asio::ip::address, std::string>;  ///< Session identifier: IP address or SS-Ping-Payload from RTSP handshake
-  using message_queue_t = std::shared_ptr<safe::queue_t<std::pair<udp::endpoint, std::string>>>;  ///< Message queue type
+  using av_session_id_t = std::variant<asio::ip::address, std::string, udp::endpoint>;  ///< Session identifier: IP address, SS-Ping-Payload from RTSP handshake or the endpoint microphone packets come from
+
+  /**
+   * @brief Returns the buffer of a received packet to the pool recvThread takes buffers from.
+   */
+  struct recycle_packet_t {
+    void operator()(std::string *packet) const;
+  };
+
+  using packet_buffer_t = std::unique_ptr<std::string, recycle_packet_t>;  ///< Received packet, its buffer is reused once released
+  using message_queue_t = std::shared_ptr<safe::queue_t<std::pair<udp::endpoint, packet_buffer_t>>>;  ///< Message queue type
   using message_queue_queue_t = std::shared_ptr<safe::queue_t<std::tuple<socket_e, av_session_id_t, message_queue_t>>>;  ///< Queue of message queues
 
   /**
@@ -101,6 +115,12 @@ namespace stream {
      */
     void iterate(std::chrono::milliseconds timeout);
 
+    /**
+     * @brief Handle one ENet event, implemented next to iterate.
+     * @param event The event.
+     */
+    void handle_event(ENetEvent &event);
+
     /**
      * @brief Call the handler for a given control stream message.
      * @param type The message type.
@@ -130,11 +150,27 @@ namespace stream {
      */
     void flush();
 
+    /**
+     * @brief Make the current or next call to iterate return without waiting for its timeout.
+     * @details Called from any thread once there is something for the control thread to send,
+     *          so it doesn't wait for the next control packet.
+     */
+    void wake();
+
+    static constexpr int max_events_per_iteration = 64;  ///< Events handled by one call to iterate
+
     std::unordered_map<std::uint16_t, std::function<void(session_t *, const std::string_view &)>> _map_type_cb;  ///< Message type to callback mapping
     sync_util::sync_t<std::vector<session_t *>> _sessions;  ///< All active sessions (including those waiting for peer connection)
     sync_util::sync_t<std::map<net::peer_t, session_t *>> _peer_to_session;  ///< ENet peer to session mapping
     ENetAddress _addr;  ///< ENet address
     net::host_t _host;  ///< ENet host
+
+    asio::io_context _wake_io;  ///< Context of the wakeup sockets
+    udp::socket _wake_recv {_wake_io};  ///< Loopback socket iterate waits on along with the ENet socket
+    udp::socket _wake_send {_wake_io};  ///< Socket wake sends its datagram from
+    udp::endpoint _wake_endpoint;  ///< Address of _wake_recv
+    std::mutex _wake_lock;  ///< Serializes the sends of wake
+    std::atomic<bool> _wake_pending {false};  ///< Set by wake until iterate took notice
   };
 
   /**
@@ -145,13 +181,17 @@ namespace stream {
 
     std::thread recv_thread;  ///< Receive thread
     std::thread video_thread;  ///< Video processing thread
+    std::vector<std::thread> video_worker_threads;  ///< Per-session video workers fed by video_thread
+    std::atomic<int> next_video_worker;  ///< Round robin counter pinning new sessions to video workers
     std::thread audio_thread;  ///< Audio processing thread
     std::thread control_thread;  ///< Control message processing thread
 
     asio::io_context io_context;  ///< ASIO I/O context
 
     udp::socket video_sock {io_context};  ///< Video UDP socket
+    std::vector<udp::socket> video_worker_socks;  ///< Sockets of the video workers after the first, bound to the video port with SO_REUSEPORT
     udp::socket audio_sock {io_context};  ///< Audio UDP socket
+    std::unique_ptr<platf::deinit_t> video_registered_io;  ///< Registered send buffers of video_sock, released before it is closed
 
     control_server_t control_server;  ///< Control server instance
   };
@@ -185,6 +225,104 @@ namespace stream {
   };
 #pragma pack(pop)
 
+  /**
+   * @brief Video packets recently sent to a client, kept so that lost packets can be sent again on request.
+   * @details Filled by the video broadcast thread and read by the control thread.
+   *          Packets are only kept once the client asked for a retransmission.
+   */
+  class retransmit_buffer_t {
+  public:
+    static constexpr std::size_t capacity = 4096;  ///< Packets kept, older ones are overwritten
+
+    /**
+     * @brief Start keeping packets.
+     */
+    void enable();
+
+    /**
+     * @brief Whether packets are being kept.
+     */
+    bool enabled() const {
+      return _enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Keep a copy of a packet that was just sent.
+     * @param sequence_number RTP sequence number of the packet.
+     * @param prefix Encryption prefix sent in front of the packet, empty if unencrypted.
+     * @param packet The packet as sent.
+     * @param sent When the packet was sent.
+     */
+    void store(std::uint16_t sequence_number, std::string_view prefix, std::string_view packet, std::chrono::steady_clock::time_point sent);
+
+    /**
+     * @brief Copy out a kept packet.
+     * @param sequence_number RTP sequence number of the packet.
+     * @param not_before Packets sent before this are too old to be worth retransmitting.
+     * @param packet Receives the prefix and packet.
+     * @return `true` if the packet was found.
+     */
+    bool find(std::uint16_t sequence_number, std::chrono::steady_clock::time_point not_before, std::string &packet);
+
+    /**
+     * @brief Get the memory the kept packets take.
+     * @return The bytes allocated for the packets, which entries keep once they are overwritten.
+     */
+    std::size_t bytes() const {
+      return _bytes.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct entry_t {
+      std::uint16_t sequence_number;
+      std::chrono::steady_clock::time_point sent;
+      std::string data;
+    };
+
+    std::atomic<bool> _enabled = false;
+    std::atomic<std::size_t> _bytes = 0;
+
+    std::mutex mutex;
+    std::vector<entry_t> entries;  ///< Ring of the last packets, in sequence number order
+    std::size_t next = 0;  ///< Entry the next packet is stored to
+    std::size_t count = 0;  ///< Entries that hold a packet
+  };
+
+  /**
+   * @brief Frame indexes as the client sees them.
+   * @details Frames no other frame references may be skipped on a congested link. The frames sent after
+   *          a skip are numbered without a gap, so the client doesn't take it for a loss. Frame indexes the
+   *          client reports are translated back for the encoder.
+   *          Skips are recorded by the video broadcast thread and translated back by the control thread.
+   */
+  class frame_numbering_t {
+  public:
+    static constexpr std::size_t capacity = 256;  ///< Skips remembered, the frames the client reports are more recent
+
+    /**
+     * @brief Record that a frame won't be sent.
+     * @param frame_index Index of the frame as encoded.
+     */
+    void skip(std::int64_t frame_index);
+
+    /**
+     * @brief Get the index the client sees for a frame that is sent.
+     * @param frame_index Index of the frame as encoded.
+     */
+    std::int64_t to_client(std::int64_t frame_index);
+
+    /**
+     * @brief Get the index of a frame as encoded from the index the client reported.
+     * @param frame_index Index of the frame as the client saw it.
+     */
+    std::int64_t to_encoder(std::int64_t frame_index);
+
+  private:
+    std::mutex mutex;
+    std::int64_t forgotten = 0;  ///< Skips that no longer fit, all of them before the remembered ones
+    std::vector<std::int64_t> skipped;  ///< Indexes of the most recently skipped frames as encoded, in ascending order
+  };
+
   /**
    * @brief Streaming session structure.
    */
@@ -215,8 +353,20 @@ namespace stream {
 
       safe::mail_raw_t::event_t<bool> idr_events;  ///< IDR frame request events
       safe::mail_raw_t::event_t<std::pair<int64_t, int64_t>> invalidate_ref_frames_events;  ///< Reference frame invalidation events
+      safe::mail_raw_t::event_t<video::ladder_step_t> ladder_change_events;  ///< Ladder steps requested by auto bitrate
+      safe::mail_raw_t::event_t<bool> ladder_change_confirmation_events;  ///< Encoder answers to the requested ladder steps
+      safe::mail_raw_t::event_t<int> fps_divisor_events;  ///< Fractions of the framerate the overload controller limits the encoder to
 
       std::unique_ptr<platf::deinit_t> qos;  ///< QoS handler
+
+      int broadcast_worker;  ///< Video broadcast worker this session is pinned to when its video starts, or -1 if not assigned yet
+      bool recovering;  ///< Late frames were dropped and the encoder hasn't sent a frame that doesn't reference them yet
+      std::atomic<std::uint64_t> link_speed;  ///< Link speed of the local interface in bits per second (0 if unknown)
+      std::atomic<int> fec_percentage;  ///< FEC percentage of the video stream, adapted by auto bitrate
+      video::bitrate_target_t bitrate_target;  ///< Bitrate auto bitrate asks the encoder for
+      retransmit_buffer_t retransmit;  ///< Recently sent packets the client may ask for again
+      frame_numbering_t numbering;  ///< Frame indexes of the client after skipped frames
+      int shed_level;  ///< Overload shedding level, the framerate is divided by 2 to its power, only touched by the control thread
     } video;
 
     struct {
@@ -231,8 +381,10 @@ namespace stream {
       util::buffer_t<char> shards;  ///< FEC shard buffer
       util::buffer_t<uint8_t *> shards_p;  ///< FEC shard pointer buffer
 
-      audio_fec_packet_t fec_packet;  ///< FEC packet structure
+      std::array<audio_fec_packet_t, RTPA_FEC_SHARDS> fec_packets;  ///< Headers of the FEC packets of a block, contiguous for batched sends
       std::unique_ptr<platf::deinit_t> qos;  ///< QoS handler
+
+      safe::mail_raw_t::event_t<audio::encoder_params_t> encoder_params_events;  ///< Encoder parameters requested by auto bitrate
     } audio;
 
     struct {
@@ -247,10 +399,41 @@ namespace stream {
       net::peer_t peer;  ///< ENet peer
       std::uint32_t seq;  ///< Control sequence number
 
+      std::unique_ptr<platf::deinit_t> qos;  ///< QoS handler, only set by QoS profiles that mark the control stream
+
+      std::atomic<std::uint32_t> rtt;  ///< Smoothed round trip time in milliseconds (0 if unknown)
+      std::atomic<std::uint32_t> rtt_variance;  ///< Round trip time variance in milliseconds
+
       platf::feedback_queue_t feedback_queue;  ///< Gamepad feedback queue
       safe::mail_raw_t::event_t<video::hdr_info_t> hdr_queue;  ///< HDR information queue
     } control;
 
+    /**
+     * @brief Counters and gauges read by the metrics exporter.
+     * @details Written by the thread that owns the value and read without taking any session locks.
+     */
+    struct {
+      std::atomic<std::uint64_t> frames_sent;  ///< Video frames sent
+      std::atomic<std::uint64_t> packets_sent;  ///< Video packets sent, including FEC packets
+      std::atomic<std::uint64_t> fec_packets_sent;  ///< Video FEC packets sent
+      std::atomic<std::uint64_t> packets_retransmitted;  ///< Video packets sent again on request of the client
+      std::atomic<std::uint64_t> bytes_sent;  ///< Video bytes sent, including packet headers
+      std::atomic<std::uint32_t> frame_latency_us;  ///< Host processing latency of the last frame sent
+      std::atomic<std::uint32_t> audio_latency_us;  ///< Host latency from capture to send of the last audio packet
+      std::atomic<std::int32_t> av_skew_us;  ///< Audio latency minus video latency when the last audio packet was sent
+      std::atomic<std::uint32_t> bitrate_kbps;  ///< Current encoder bitrate
+      std::atomic<std::uint32_t> bitrate_adjustments;  ///< Successful auto bitrate adjustments
+      std::atomic<float> loss_percentage;  ///< Frame loss reported by the client
+      std::atomic<std::uint64_t> loss_reports;  ///< Loss reports the auto bitrate controller measured loss_percentage from
+      std::atomic<std::uint32_t> video_dscp;  ///< DSCP value the OS marks video traffic with, 0 if unmarked
+      std::atomic<std::uint32_t> audio_dscp;  ///< DSCP value the OS marks audio traffic with, 0 if unmarked
+      std::atomic<std::uint32_t> control_dscp;  ///< DSCP value the OS marks control traffic with, 0 if unmarked or left to ENet
+      std::atomic<std::uint64_t> last_bitrate_adjustment_ms;  ///< Time since session start of the last successful auto bitrate adjustment, 0 if never
+      std::atomic<std::uint64_t> queued_video_bytes;  ///< Encoded video waiting to be sent when the last frame was popped, only counted while the video queue is bounded
+      std::atomic<std::uint64_t> budget_drops;  ///< Video backlogs cut down for exceeding video_max_queued_mb
+    } stats;
+
+    std::unique_ptr<platf::deinit_t> admission;  ///< Reservation of the encoder capacity the session was admitted with
     std::uint32_t launch_session_id;  ///< Associated launch session ID
     std::string device_name;  ///< Client device name
     std::string device_uuid;  ///< Client device UUID
@@ -263,16 +446,29 @@ namespace stream {
     safe::signal_t controlEnd;  ///< Control stream end signal
 
     std::atomic<session::state_e> state;  ///< Current session state
+    recording::tap_t recording;  ///< Recorder of the encoded stream, if the session is being recorded
 
     bool auto_bitrate_enabled = false;  ///< Enable auto bitrate for this session (set to true ONLY when client checkbox is checked; when false, use existing static bitrate flow)
     int auto_bitrate_min_kbps = 0;  ///< Client-requested minimum bitrate (0 = not set, use server config default)
     int auto_bitrate_max_kbps = 0;  ///< Client-requested maximum bitrate (0 = not set, use configured bitrate)
     bool auto_bitrate_v2_active = false;  ///< True once V2 telemetry is received for this session
+    auto_bitrate_state_t auto_bitrate_state;  ///< Auto bitrate controller state, only touched by the control thread
     
     int bitrate_stats_send_counter = 0;  ///< Counter for periodic stats sending
     int last_sent_connection_status = -1;  ///< Track last sent status to detect changes
   };
 
+  constexpr int MAX_OFFERED_PACKET_SIZE = 8192;  ///< Largest video packet size offered to clients on jumbo frame networks
+
+  /**
+   * @brief Get the largest video packet size whose datagrams fit in one IP packet.
+   * @details The datagrams carry the RTP header and, with video encryption, the encryption prefix on top of the packet size.
+   * @param mtu The MTU of the path.
+   * @param v6 Whether the path is IPv6.
+   * @return The packet size, a multiple of 16 bytes.
+   */
+  int packet_size_for_mtu(int mtu, bool v6);
+
   /**
    * @brief Session management functions.
    */
@@ -302,6 +498,12 @@ namespace stream {
      */
     std::string uuid(const session_t& session);
 
+    /**
+     * @brief Trim the host memory once no session has run for `idle_memory_trim` after the capture standby.
+     * @details A later call replaces the pending trim, a trim doesn't run while a session is running.
+     */
+    void schedule_idle_trim();
+
     /**
      * @brief Check if session UUID matches.
      * @param session The session.
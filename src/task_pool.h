@@ -9,9 +9,11 @@
 #include <deque>
 #include <functional>
 #include <future>
+#include <map>
 #include <mutex>
 #include <optional>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -108,8 +110,11 @@ namespace task_pool_util {
     };
 
   protected:
+    typedef std::multimap<__time_point, __task> __timer_queue;  ///< Timer tasks ordered by deadline, ties run in insertion order.
+
     std::deque<__task> _tasks;  ///< Queue of immediate tasks.
-    std::vector<std::pair<__time_point, __task>> _timer_tasks;  ///< Sorted list of scheduled timer tasks.
+    __timer_queue _timer_tasks;  ///< Scheduled timer tasks, the earliest deadline first.
+    std::unordered_map<task_id_t, __timer_queue::iterator> _timer_index;  ///< Timer task lookup for delay and cancel.
     std::mutex _task_mutex;  ///< Mutex for thread-safe task access.
 
   public:
@@ -117,12 +122,14 @@ namespace task_pool_util {
 
     TaskPool(TaskPool &&other) noexcept:
         _tasks {std::move(other._tasks)},
-        _timer_tasks {std::move(other._timer_tasks)} {
+        _timer_tasks {std::move(other._timer_tasks)},
+        _timer_index {std::move(other._timer_index)} {
     }
 
     TaskPool &operator=(TaskPool &&other) noexcept {
       std::swap(_tasks, other._tasks);
       std::swap(_timer_tasks, other._timer_tasks);
+      std::swap(_timer_index, other._timer_index);
 
       return *this;
     }
@@ -162,21 +169,15 @@ namespace task_pool_util {
     /**
      * @brief Push a delayed task to the timer queue.
      * 
-     * Adds a task with its scheduled time point to the sorted timer queue.
+     * Adds a task with its scheduled time point to the timer queue in O(log n).
      * 
      * @param task Pair of time point and task to schedule.
      */
     void pushDelayed(std::pair<__time_point, __task> &&task) {
       std::lock_guard lg(_task_mutex);
 
-      auto it = _timer_tasks.cbegin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        if (std::get<0>(*it) < task.first) {
-          break;
-        }
-      }
-
-      _timer_tasks.emplace(it, task.first, std::move(task.second));
+      task_id_t task_id = task.second.get();
+      _timer_index[task_id] = _timer_tasks.emplace(task.first, std::move(task.second));
     }
 
     /**
@@ -238,31 +239,15 @@ namespace task_pool_util {
     void delay(task_id_t task_id, std::chrono::duration<X, Y> duration) {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      auto it = _timer_tasks.begin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        const __task &task = std::get<1>(*it);
-
-        if (&*task == task_id) {
-          std::get<0>(*it) = std::chrono::steady_clock::now() + duration;
-
-          break;
-        }
-      }
-
-      if (it == _timer_tasks.cend()) {
+      auto index = _timer_index.find(task_id);
+      if (index == std::end(_timer_index)) {
         return;
       }
 
-      // smaller time goes to the back
-      auto prev = it - 1;
-      while (it > _timer_tasks.cbegin()) {
-        if (std::get<0>(*it) > std::get<0>(*prev)) {
-          std::swap(*it, *prev);
-        }
-
-        --prev;
-        --it;
-      }
+      // Reinsert under the new deadline, the node itself is reused
+      auto node = _timer_tasks.extract(index->second);
+      node.key() = std::chrono::steady_clock::now() + duration;
+      index->second = _timer_tasks.insert(std::move(node));
     }
 
     /**
@@ -276,18 +261,15 @@ namespace task_pool_util {
     bool cancel(task_id_t task_id) {
       std::lock_guard lg(_task_mutex);
 
-      auto it = _timer_tasks.begin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        const __task &task = std::get<1>(*it);
-
-        if (&*task == task_id) {
-          _timer_tasks.erase(it);
-
-          return true;
-        }
+      auto index = _timer_index.find(task_id);
+      if (index == std::end(_timer_index)) {
+        return false;
       }
 
-      return false;
+      _timer_tasks.erase(index->second);
+      _timer_index.erase(index);
+
+      return true;
     }
 
     /**
@@ -301,15 +283,15 @@ namespace task_pool_util {
     std::optional<std::pair<__time_point, __task>> pop(task_id_t task_id) {
       std::lock_guard lg(_task_mutex);
 
-      auto pos = std::find_if(std::begin(_timer_tasks), std::end(_timer_tasks), [&task_id](const auto &t) {
-        return t.second.get() == task_id;
-      });
-
-      if (pos == std::end(_timer_tasks)) {
+      auto index = _timer_index.find(task_id);
+      if (index == std::end(_timer_index)) {
         return std::nullopt;
       }
 
-      return std::move(*pos);
+      auto node = _timer_tasks.extract(index->second);
+      _timer_index.erase(index);
+
+      return std::pair {node.key(), std::move(node.mapped())};
     }
 
     /**
@@ -329,10 +311,10 @@ namespace task_pool_util {
         return task;
       }
 
-      if (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now()) {
-        __task task = std::move(std::get<1>(_timer_tasks.back()));
-        _timer_tasks.pop_back();
-        return task;
+      if (!_timer_tasks.empty() && _timer_tasks.begin()->first <= std::chrono::steady_clock::now()) {
+        auto node = _timer_tasks.extract(_timer_tasks.begin());
+        _timer_index.erase(node.mapped().get());
+        return std::move(node.mapped());
       }
 
       return std::nullopt;
@@ -346,7 +328,7 @@ namespace task_pool_util {
     bool ready() {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      return !_tasks.empty() || (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now());
+      return !_tasks.empty() || (!_timer_tasks.empty() && _timer_tasks.begin()->first <= std::chrono::steady_clock::now());
     }
 
     /**
@@ -361,7 +343,7 @@ namespace task_pool_util {
         return std::nullopt;
       }
 
-      return std::get<0>(_timer_tasks.back());
+      return _timer_tasks.begin()->first;
     }
 
   private:
@@ -0,0 +1,232 @@
+/**
+ * @file src/thread_placement.cpp
+ * @brief Definitions for placing the threads of the streaming pipeline on specific cores.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <iterator>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+
+// local includes
+#include "logging.h"
+#include "pipeline_trace.h"
+#include "thread_placement.h"
+
+using namespace std::literals;
+
+namespace thread_placement {
+  namespace {
+    constexpr std::array<std::string_view, (int) config::thread_stage_e::count> stage_names {
+      "capture"sv,
+      "encode"sv,
+      "video_send"sv,
+      "audio"sv,
+      "control"sv,
+      "input"sv,
+    };
+
+    constexpr auto auto_cores_lifetime = 30s;  ///< Games change their load, the automatic placement is redone for streams started later
+    constexpr auto load_sample_interval = 100ms;
+
+    std::mutex auto_cores_mutex;
+    std::vector<int> auto_cores_cache;
+    std::optional<std::chrono::steady_clock::time_point> auto_cores_time;
+
+    /**
+     * @brief Parse a non-negative number.
+     * @param view The number.
+     * @return The number, or -1 if it isn't one.
+     */
+    int parse_number(std::string_view view) {
+      int value = -1;
+      auto [ptr, ec] = std::from_chars(view.data(), view.data() + view.size(), value);
+      if (ec != std::errc {} || ptr != view.data() + view.size() || value < 0) {
+        return -1;
+      }
+      return value;
+    }
+
+    /**
+     * @brief Get the cores of the automatic placement, sampling the core load if the last pick is stale.
+     * @return The cores, empty to leave placement to the OS.
+     */
+    std::vector<int> auto_cores() {
+      std::lock_guard lg {auto_cores_mutex};
+
+      auto now = std::chrono::steady_clock::now();
+      if (auto_cores_time && now - *auto_cores_time < auto_cores_lifetime) {
+        return auto_cores_cache;
+      }
+
+      std::vector<int> allowed;
+      if (auto node = platf::gpu_numa_node(); node >= 0) {
+        allowed = platf::numa_node_cores(node);
+      }
+
+      auto_cores_cache = pick_auto_cores(platf::cpu_cache_domains(), platf::cpu_core_load(load_sample_interval), allowed);
+      auto_cores_time = now;
+
+      if (auto_cores_cache.empty()) {
+        BOOST_LOG(info) << "Automatic thread placement: leaving placement to the OS"sv;
+      } else {
+        std::ostringstream cores;
+        for (auto core : auto_cores_cache) {
+          cores << ' ' << core;
+        }
+        BOOST_LOG(info) << "Automatic thread placement: pipeline runs on cores"sv << cores.str();
+      }
+
+      return auto_cores_cache;
+    }
+  }  // namespace
+
+  std::string_view stage_name(config::thread_stage_e stage) {
+    return stage_names[(int) stage];
+  }
+
+  std::vector<int> parse_cpu_list(std::string_view list) {
+    std::vector<int> cores;
+
+    while (!list.empty()) {
+      auto comma = list.find(',');
+      auto range = list.substr(0, comma);
+      list = comma == std::string_view::npos ? std::string_view {} : list.substr(comma + 1);
+
+      auto dash = range.find('-');
+      auto first = parse_number(range.substr(0, dash));
+      auto last = dash == std::string_view::npos ? first : parse_number(range.substr(dash + 1));
+      if (first < 0 || last < first) {
+        return {};
+      }
+
+      for (auto core = first; core <= last; ++core) {
+        cores.emplace_back(core);
+      }
+    }
+
+    std::sort(std::begin(cores), std::end(cores));
+    cores.erase(std::unique(std::begin(cores), std::end(cores)), std::end(cores));
+
+    return cores;
+  }
+
+  std::optional<config::thread_placement_t> parse(std::string_view value) {
+    config::thread_placement_t placement;
+
+    while (!value.empty()) {
+      auto space = value.find(' ');
+      auto pair = value.substr(0, space);
+      value = space == std::string_view::npos ? std::string_view {} : value.substr(space + 1);
+      if (pair.empty()) {
+        continue;
+      }
+
+      auto equals = pair.find('=');
+      if (equals == std::string_view::npos) {
+        return std::nullopt;
+      }
+
+      auto key = pair.substr(0, equals);
+      auto val = pair.substr(equals + 1);
+      if (key == "cores"sv) {
+        placement.cores = parse_cpu_list(val);
+        if (placement.cores.empty()) {
+          return std::nullopt;
+        }
+      } else if (key == "numa"sv) {
+        placement.numa_node = parse_number(val);
+        if (placement.numa_node < 0) {
+          return std::nullopt;
+        }
+      } else if (key == "priority"sv) {
+        constexpr std::array priorities {"low"sv, "normal"sv, "high"sv, "critical"sv};
+        auto it = std::find(std::begin(priorities), std::end(priorities), val);
+        if (it == std::end(priorities)) {
+          return std::nullopt;
+        }
+        placement.priority = (int) std::distance(std::begin(priorities), it);
+      } else if (key == "mmcss"sv) {
+        placement.mmcss_task = val;
+      } else {
+        return std::nullopt;
+      }
+    }
+
+    return placement;
+  }
+
+  std::vector<int> pick_auto_cores(const std::vector<std::vector<int>> &domains, const std::vector<double> &load, const std::vector<int> &allowed) {
+    std::vector<std::vector<int>> candidates;
+    for (auto &domain : domains) {
+      auto &candidate = candidates.emplace_back();
+      std::copy_if(std::begin(domain), std::end(domain), std::back_inserter(candidate), [&](int core) {
+        return allowed.empty() || std::find(std::begin(allowed), std::end(allowed), core) != std::end(allowed);
+      });
+      if (candidate.empty()) {
+        candidates.pop_back();
+      }
+    }
+
+    // With a single cache there are no migrations to avoid, pinning would only fight the game for cores
+    if (candidates.size() <= 1) {
+      return allowed;
+    }
+
+    auto mean_load = [&](const std::vector<int> &cores) {
+      auto sum = std::accumulate(std::begin(cores), std::end(cores), 0.0, [&](double sum, int core) {
+        return sum + (core < (int) load.size() ? load[core] : 0.0);
+      });
+      return sum / cores.size();
+    };
+
+    auto best = std::begin(candidates);
+    for (auto it = std::begin(candidates); it != std::end(candidates); ++it) {
+      if (mean_load(*it) <= mean_load(*best)) {
+        best = it;
+      }
+    }
+
+    return *best;
+  }
+
+  void apply(config::thread_stage_e stage, platf::thread_priority_e priority) {
+    auto &placement = config::stream.thread_placement[(int) stage];
+
+    // Every pipeline thread passes through here when it starts, which names its track in the trace
+    pipeline_trace::name_thread(stage_name(stage));
+
+    platf::adjust_thread_priority(placement.priority ? (platf::thread_priority_e) *placement.priority : priority);
+
+    auto cores = placement.cores;
+    if (placement.numa_node >= 0) {
+      auto node_cores = platf::numa_node_cores(placement.numa_node);
+      if (cores.empty()) {
+        cores = std::move(node_cores);
+      } else {
+        std::erase_if(cores, [&](int core) {
+          return std::find(std::begin(node_cores), std::end(node_cores), core) == std::end(node_cores);
+        });
+      }
+
+      if (cores.empty()) {
+        BOOST_LOG(warning) << "No cores of NUMA node "sv << placement.numa_node << " for the "sv << stage_name(stage) << " threads"sv;
+      }
+    } else if (cores.empty() && config::stream.thread_placement_auto) {
+      cores = auto_cores();
+    }
+
+    if (!cores.empty() && !platf::set_thread_affinity(cores)) {
+      BOOST_LOG(warning) << "Unable to place the "sv << stage_name(stage) << " thread on its cores"sv;
+    }
+
+    if (!placement.mmcss_task.empty()) {
+      platf::set_thread_mmcss_task(placement.mmcss_task);
+    }
+  }
+
+}  // namespace thread_placement
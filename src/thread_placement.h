@@ -0,0 +1,58 @@
+/**
+ * @file src/thread_placement.h
+ * @brief Declarations for placing the threads of the streaming pipeline on specific cores.
+ */
+#pragma once
+
+// standard includes
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "config.h"
+#include "platform/common.h"
+
+namespace thread_placement {
+
+  /**
+   * @brief Get the configuration name of a pipeline stage.
+   * @param stage The stage.
+   * @return The name, e.g. "video_send" for the `thread_placement_video_send` option.
+   */
+  std::string_view stage_name(config::thread_stage_e stage);
+
+  /**
+   * @brief Parse a list of logical processors in the format used by Linux, e.g. "0-3,8".
+   * @param list The list.
+   * @return The logical processors in ascending order, empty if the list is invalid.
+   */
+  std::vector<int> parse_cpu_list(std::string_view list);
+
+  /**
+   * @brief Parse the placement of a stage, e.g. "cores=0-3 numa=0 priority=high mmcss=Games".
+   * @param value Space separated key=value pairs, all of them are optional.
+   * @return The placement, or an empty optional if the value is invalid.
+   */
+  std::optional<config::thread_placement_t> parse(std::string_view value);
+
+  /**
+   * @brief Pick the cores the automatic placement runs the pipeline on.
+   * @details Picks the least busy group of cores that share a last level cache, e.g. a CCD,
+   *          so pipeline threads neither migrate between caches nor compete with the game's busiest cores.
+   *          Ties go to the last group, since games and schedulers prefer the first cores.
+   * @param domains Logical processors grouped by shared last level cache.
+   * @param load Busy fraction of each logical processor.
+   * @param allowed Logical processors of the GPU's NUMA node, empty if every node is fine.
+   * @return The cores, empty to leave placement to the OS.
+   */
+  std::vector<int> pick_auto_cores(const std::vector<std::vector<int>> &domains, const std::vector<double> &load, const std::vector<int> &allowed);
+
+  /**
+   * @brief Place the calling thread as configured for its pipeline stage.
+   * @param stage The stage the thread belongs to.
+   * @param priority Priority of the thread unless the placement overrides it.
+   */
+  void apply(config::thread_stage_e stage, platf::thread_priority_e priority);
+
+}  // namespace thread_placement
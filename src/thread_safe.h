@@ -5,12 +5,20 @@
 #pragma once
 
 // standard includes
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
 // local includes
@@ -45,6 +53,20 @@ namespace safe {
       }
 
       _cv.notify_all();
+      if (_notify) {
+        _notify();
+      }
+    }
+
+    /**
+     * @brief Call a function each time the event is raised.
+     * @details Lets a thread that polls the event among other work wake up early.
+     * @param notify The function, called with the event locked, or an empty function to stop calling it.
+     */
+    void notify(std::function<void()> notify) {
+      std::lock_guard lg {_lock};
+
+      _notify = std::move(notify);
     }
 
     /**
@@ -209,6 +231,7 @@ namespace safe {
   private:
     bool _continue {true};
     status_t _status {util::false_v<status_t>};
+    std::function<void()> _notify;
 
     std::condition_variable _cv;
     std::mutex _lock;
@@ -437,6 +460,20 @@ namespace safe {
       _queue.emplace_back(std::forward<Args>(args)...);
 
       _cv.notify_all();
+      if (_notify) {
+        _notify();
+      }
+    }
+
+    /**
+     * @brief Call a function each time an element is added.
+     * @details Lets a thread that polls the queue among other work wake up early.
+     * @param notify The function, called with the queue locked, or an empty function to stop calling it.
+     */
+    void notify(std::function<void()> notify) {
+      std::lock_guard lg {_lock};
+
+      _notify = std::move(notify);
     }
 
     /**
@@ -448,6 +485,16 @@ namespace safe {
       return _continue && !_queue.empty();
     }
 
+    /**
+     * @brief Get the number of queued elements.
+     * @return The number of elements waiting to be popped.
+     */
+    std::size_t size() {
+      std::lock_guard lg {_lock};
+
+      return _queue.size();
+    }
+
     /**
      * @brief Pop element from queue with timeout.
      * 
@@ -504,6 +551,50 @@ namespace safe {
       return val;
     }
 
+    /**
+     * @brief Pop a selected element from queue.
+     * 
+     * Waits indefinitely for an element to be available, then removes and returns
+     * the element chosen by the selector instead of the oldest one.
+     * 
+     * @param select Called with the queued elements, returns the index of the element to pop.
+     * @return Element value, or false value if stopped.
+     */
+    template<class F>
+    status_t pop_selected(F &&select) {
+      std::unique_lock ul {_lock};
+
+      if (!_continue) {
+        return util::false_v<status_t>;
+      }
+
+      while (_queue.empty()) {
+        _cv.wait(ul);
+
+        if (!_continue) {
+          return util::false_v<status_t>;
+        }
+      }
+
+      auto it = std::next(std::begin(_queue), select(std::as_const(_queue)));
+      auto val = std::move(*it);
+      _queue.erase(it);
+
+      return val;
+    }
+
+    /**
+     * @brief Remove elements from the queue in place.
+     * 
+     * @param prune_f Called with the queued elements while the queue is locked, may erase any of them.
+     */
+    template<class F>
+    void prune(F &&prune_f) {
+      std::lock_guard lg {_lock};
+
+      prune_f(_queue);
+    }
+
     /**
      * @brief Get unsafe access to underlying vector.
      * 
@@ -541,6 +632,7 @@ namespace safe {
   private:
     bool _continue {true};
     std::uint32_t _max_elements;
+    std::function<void()> _notify;
 
     std::mutex _lock;
     std::condition_variable _cv;
@@ -548,6 +640,223 @@ namespace safe {
     std::vector<T> _queue;
   };
 
+  /**
+   * @brief Bounded lock-free single-producer/single-consumer queue.
+   * 
+   * Drop-in replacement for queue_t when exactly one thread raises and exactly one
+   * thread pops. Handing over an element doesn't take any lock. The consumer spins
+   * briefly before it parks on a condition variable, and the producer only takes
+   * the lock to wake a parked consumer.
+   * 
+   * Like queue_t, a full queue discards its backlog and keeps the element that overflows
+   * it: the producer stores it in a spare slot, and the consumer skips ahead to the newest
+   * element on its next pop. If the producer overflows the queue again before that pop, it
+   * replaces the newest element under the lock.
+   * 
+   * @tparam T The type of elements stored in the queue.
+   */
+  template<class T>
+  class spsc_queue_t {
+  public:
+    using status_t = util::optional_t<T>;
+
+    spsc_queue_t(std::uint32_t max_elements = 32):
+        _max_elements {std::max<std::uint32_t>(max_elements, 1)},
+        _slots {std::make_unique<std::optional<T>[]>(_max_elements + 1)} {
+    }
+
+    /**
+     * @brief Add element to queue. May only be called from the producer thread.
+     * 
+     * @param args Arguments to construct the element.
+     */
+    template<class... Args>
+    void raise(Args &&...args) {
+      if (!_continue.load(std::memory_order_relaxed)) {
+        return;
+      }
+
+      auto tail = _tail.load(std::memory_order_relaxed);
+      auto size = tail - _head.load(std::memory_order_acquire);
+      if (size > _max_elements) {
+        // The spare slot holds the newest element of an overflow the consumer hasn't seen yet.
+        // It only touches that slot after clearing _overflow under the lock.
+        std::lock_guard lg {_lock};
+        if (_overflow.load(std::memory_order_relaxed)) {
+          _slots[(tail - 1) % (_max_elements + 1)].emplace(std::forward<Args>(args)...);
+          _cv.notify_one();
+          return;
+        }
+
+        // The consumer skipped ahead in the meantime
+        size = tail - _head.load(std::memory_order_acquire);
+      }
+
+      _slots[tail % (_max_elements + 1)].emplace(std::forward<Args>(args)...);
+
+      // Pairs with the store to _parked in wait(), so either the consumer sees the
+      // new element or we see that it's parked
+      _tail.store(tail + 1, std::memory_order_seq_cst);
+      if (size >= _max_elements) {
+        _overflow.store(true, std::memory_order_release);
+      }
+      if (_parked.load(std::memory_order_seq_cst)) {
+        std::lock_guard lg {_lock};
+        _cv.notify_one();
+      }
+    }
+
+    /**
+     * @brief Check if queue has elements without blocking.
+     * 
+     * @return True if queue is running and has elements, false otherwise.
+     */
+    bool peek() {
+      return _continue && ready();
+    }
+
+    /**
+     * @brief Pop element from queue with timeout. May only be called from the consumer thread.
+     * 
+     * @param delay Maximum time to wait.
+     * @return Element value, or false value if timeout or stopped.
+     */
+    template<class Rep, class Period>
+    status_t pop(std::chrono::duration<Rep, Period> delay) {
+      if (!wait(std::chrono::steady_clock::now() + delay)) {
+        return util::false_v<status_t>;
+      }
+
+      return take();
+    }
+
+    /**
+     * @brief Pop element from queue. May only be called from the consumer thread.
+     * 
+     * @return Element value, or false value if stopped.
+     */
+    status_t pop() {
+      if (!wait(std::chrono::steady_clock::time_point::max())) {
+        return util::false_v<status_t>;
+      }
+
+      return take();
+    }
+
+    /**
+     * @brief Stop the queue.
+     * 
+     * Stops the queue and wakes the consumer.
+     * After stopping, raise() will have no effect and pop() will return false values.
+     */
+    void stop() {
+      std::lock_guard lg {_lock};
+
+      _continue = false;
+
+      _cv.notify_all();
+    }
+
+    /**
+     * @brief Check if queue is running.
+     * 
+     * @return True if queue is running (not stopped), false otherwise.
+     */
+    [[nodiscard]] bool running() const {
+      return _continue;
+    }
+
+  private:
+    /**
+     * @brief Number of times the consumer polls before it parks.
+     */
+    static constexpr int spin_count = 64;
+
+    bool ready() const {
+      return _head.load(std::memory_order_relaxed) != _tail.load(std::memory_order_seq_cst);
+    }
+
+    bool wait(std::chrono::steady_clock::time_point deadline) {
+      for (int x = 0; x < spin_count; ++x) {
+        if (!_continue) {
+          return false;
+        }
+
+        if (ready()) {
+          return true;
+        }
+
+        std::this_thread::yield();
+      }
+
+      std::unique_lock ul {_lock};
+
+      _parked.store(true, std::memory_order_seq_cst);
+      auto fg = util::fail_guard([this]() {
+        _parked.store(false, std::memory_order_relaxed);
+      });
+
+      while (!ready()) {
+        if (!_continue) {
+          return false;
+        }
+
+        if (deadline == std::chrono::steady_clock::time_point::max()) {
+          _cv.wait(ul);
+        } else if (_cv.wait_until(ul, deadline) == std::cv_status::timeout) {
+          return _continue && ready();
+        }
+      }
+
+      return _continue;
+    }
+
+    T take() {
+      auto head = _head.load(std::memory_order_relaxed);
+
+      if (_overflow.load(std::memory_order_acquire)) {
+        std::lock_guard lg {_lock};
+        _overflow.store(false, std::memory_order_relaxed);
+
+        // Discard everything but the newest element
+        auto tail = _tail.load(std::memory_order_acquire);
+        for (; tail - head > 1; ++head) {
+          _slots[head % (_max_elements + 1)].reset();
+        }
+
+        auto &slot = _slots[head % (_max_elements + 1)];
+        auto val = std::move(*slot);
+        slot.reset();
+
+        _head.store(head + 1, std::memory_order_release);
+
+        return val;
+      }
+
+      auto &slot = _slots[head % (_max_elements + 1)];
+      auto val = std::move(*slot);
+      slot.reset();
+
+      _head.store(head + 1, std::memory_order_release);
+
+      return val;
+    }
+
+    std::atomic<bool> _continue {true};
+    std::atomic<bool> _overflow {false};
+    std::atomic<bool> _parked {false};
+
+    std::uint32_t _max_elements;
+    std::unique_ptr<std::optional<T>[]> _slots;  ///< One more than _max_elements, the spare slot takes the element that overflows the queue
+
+    // Keep the producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<std::size_t> _head {0};
+    alignas(64) std::atomic<std::size_t> _tail {0};
+
+    std::mutex _lock;
+    std::condition_variable _cv;
+  };
+
   /**
    * @brief Thread-safe shared object manager.
    * 
@@ -774,6 +1083,24 @@ namespace safe {
   using signal_t = event_t<bool>;
 
   class mail_raw_t;
+
+  /**
+   * @brief Name of a mail event, typed with the values it holds.
+   * @tparam T Event value type.
+   */
+  template<class T>
+  struct event_id_t {
+    std::string_view name;  ///< Name of the event in the mail container
+  };
+
+  /**
+   * @brief Name of a mail queue, typed with the values it holds.
+   * @tparam T Queue element type.
+   */
+  template<class T>
+  struct queue_id_t {
+    std::string_view name;  ///< Name of the queue in the mail container
+  };
   
   /**
    * @brief Mail container shared pointer type.
@@ -897,6 +1224,30 @@ namespace safe {
       return post;
     }
 
+    /**
+     * @brief Get or create an event by typed ID.
+     * @details The lookup takes the lock of the container, so threads polling an event
+     *          resolve it once and keep the returned pointer.
+     * @tparam T Event value type, taken from the ID.
+     * @param id Event identifier.
+     * @return Shared pointer to event.
+     */
+    template<class T>
+    event_t<T> event(const event_id_t<T> &id) {
+      return event<T>(id.name);
+    }
+
+    /**
+     * @brief Get or create a queue by typed ID.
+     * @tparam T Queue element type, taken from the ID.
+     * @param id Queue identifier.
+     * @return Shared pointer to queue.
+     */
+    template<class T>
+    queue_t<T> queue(const queue_id_t<T> &id) {
+      return queue<T>(id.name);
+    }
+
     /**
      * @brief Clean up expired references.
      * 
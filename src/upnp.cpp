@@ -6,7 +6,10 @@
 #include <stddef.h>  // workaround for type_t error in miniupnpc 2.3.3, see https://github.com/miniupnp/miniupnp/commit/e263ab6f56c382e10fed31347ec68095d691a0e8
 
 // lib includes
+#include <algorithm>
+#include <atomic>
 #include <cstddef>   // Needed to compile size_t in Windows
+#include <optional>
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/upnpcommands.h>
 
@@ -15,6 +18,7 @@
 #include "confighttp.h"
 #include "globals.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
 #include "nvhttp.h"
 #include "rtsp.h"
@@ -41,6 +45,32 @@ namespace upnp {
     std::string description;
   };
 
+  /**
+   * @brief State of the IGD that changes when our mappings may have been dropped.
+   */
+  struct igd_state_t {
+    std::string external_addr;
+    unsigned int uptime = 0;
+  };
+
+  /**
+   * @brief IGD found by discovery, reused until it stops answering or the periodic rediscovery finds a different one.
+   */
+  struct igd_t {
+    urls_t urls;
+    IGDdatas data;
+    std::string lan_addr;
+    igd_state_t state;
+    std::chrono::steady_clock::time_point discovered;
+  };
+
+  static std::atomic<int> mapped_port_count {0};
+
+  static auto &igd_discoveries = metrics::counter("upnp_igd_discoveries"sv);  ///< SSDP discoveries of the IGD.
+  static auto &mappings_renewed = metrics::counter("upnp_mappings_renewed"sv);  ///< Port mappings added or renewed on the IGD.
+  static auto &mappings_skipped = metrics::counter("upnp_mappings_skipped"sv);  ///< Refreshes skipped because the lease wasn't expiring yet.
+  static auto &mapping_failures = metrics::counter("upnp_mapping_failures"sv);  ///< Port mappings the IGD refused.
+
   static std::string_view status_string(int status) {
     switch (status) {
       case 0:
@@ -141,7 +171,7 @@ namespace upnp {
           if (pinholeAllowed) {
             // Create pinholes for each port
             auto mapping_period = std::to_string(PORT_MAPPING_LIFETIME.count());
-            auto shutdown_event = mail::man->event<bool>(mail::shutdown);
+            auto shutdown_event = mail::man->event(mail::shutdown);
 
             for (auto it = std::begin(mappings); it != std::end(mappings) && !shutdown_event->peek(); ++it) {
               auto mapping = *it;
@@ -177,9 +207,9 @@ namespace upnp {
      * @param urls urls_t from UPNP_GetValidIGD()
      * @param lan_addr Local IP address to map to
      * @param mapping Information about port to map
-     * @return `true` on success.
+     * @return The lease granted, `0s` for a static mapping, or `std::nullopt` on failure.
      */
-    bool map_upnp_port(const IGDdatas &data, const urls_t &urls, const std::string &lan_addr, const mapping_t &mapping) {
+    std::optional<std::chrono::seconds> map_upnp_port(const IGDdatas &data, const urls_t &urls, const std::string &lan_addr, const mapping_t &mapping) {
       char intClient[16];
       char intPort[6];
       char desc[80];
@@ -212,7 +242,7 @@ namespace upnp {
             BOOST_LOG(debug) << "Static mapping entry found for "sv << mapping.port.wan;
 
             // It's a static mapping, so we're done here
-            return true;
+            return 0s;
           } else {
             BOOST_LOG(debug) << "Mapping entry found for "sv << mapping.port.wan << " ("sv << leaseDuration << " seconds remaining)"sv;
           }
@@ -230,7 +260,7 @@ namespace upnp {
           );
           if (err) {
             BOOST_LOG(error) << "Unable to delete conflicting UPnP port mapping: "sv << err;
-            return false;
+            return std::nullopt;
           }
         }
       } else {
@@ -259,6 +289,7 @@ namespace upnp {
 
       if (err != UPNPCOMMAND_SUCCESS && !indefinite) {
         // This may be an old/broken IGD that doesn't like non-static mappings.
+        indefinite = true;
         BOOST_LOG(debug) << "Trying static mapping after failure: "sv << err;
         err = UPNP_AddPortMapping(
           urls->controlURL,
@@ -275,11 +306,11 @@ namespace upnp {
 
       if (err) {
         BOOST_LOG(error) << "Failed to map "sv << mapping.port.proto << ' ' << mapping.port.lan << ": "sv << err;
-        return false;
+        return std::nullopt;
       }
 
       BOOST_LOG(debug) << "Successfully mapped "sv << mapping.port.proto << ' ' << mapping.port.lan;
-      return true;
+      return indefinite ? 0s : PORT_MAPPING_LIFETIME;
     }
 
     /**
@@ -305,69 +336,168 @@ namespace upnp {
       }
     }
 
+    /**
+     * @brief Discovers the IPv4 IGD through SSDP.
+     * @return The IGD, or `std::nullopt` if there is no valid one.
+     */
+    std::optional<igd_t> discover_igd() {
+      igd_discoveries.add();
+
+      int err = 0;
+      device_t device {upnpDiscover(2000, nullptr, nullptr, 0, IPv4, 2, &err)};
+      if (!device || err) {
+        BOOST_LOG(warning) << "Couldn't discover any IPv4 UPNP devices"sv;
+        return std::nullopt;
+      }
+
+      for (auto dev = device.get(); dev != nullptr; dev = dev->pNext) {
+        BOOST_LOG(debug) << "Found device: "sv << dev->descURL;
+      }
+
+      std::array<char, INET6_ADDRESS_STRLEN> lan_addr;
+
+      igd_t igd;
+      auto status = upnp::UPNP_GetValidIGDStatus(device, &igd.urls, &igd.data, lan_addr);
+      if (status != 1 && status != 2) {
+        BOOST_LOG(error) << status_string(status);
+        return std::nullopt;
+      }
+
+      BOOST_LOG(debug) << "Found valid IGD device: "sv << igd.urls->rootdescURL;
+
+      igd.lan_addr = lan_addr.data();
+      igd.discovered = std::chrono::steady_clock::now();
+      return igd;
+    }
+
+    /**
+     * @brief Reads the uptime and external address of the IGD, which is much cheaper than checking every mapping.
+     * @param igd The IGD to query.
+     * @param state Receives the state.
+     * @return `false` if the IGD didn't answer.
+     */
+    bool read_igd_state(const igd_t &igd, igd_state_t &state) {
+      char status[64];
+      char last_error[64];
+      auto err = UPNP_GetStatusInfo(igd.urls->controlURL, igd.data.first.servicetype, status, &state.uptime, last_error);
+      if (err != UPNPCOMMAND_SUCCESS) {
+        BOOST_LOG(debug) << "UPNP_GetStatusInfo() failed: "sv << err;
+        return false;
+      }
+
+      char external_addr[INET6_ADDRESS_STRLEN] {};
+      err = UPNP_GetExternalIPAddress(igd.urls->controlURL, igd.data.first.servicetype, external_addr);
+      if (err != UPNPCOMMAND_SUCCESS) {
+        BOOST_LOG(debug) << "UPNP_GetExternalIPAddress() failed: "sv << err;
+        return false;
+      }
+
+      state.external_addr = external_addr;
+      return true;
+    }
+
     /**
      * @brief Maintains UPnP port forwarding rules
+     * @details The IGD is only discovered again if it stops answering or every `REDISCOVERY_INTERVAL`,
+     *          and mappings are only renewed once their lease is about to expire. Everything is mapped
+     *          again when the IGD, our LAN address or its external address changed, or it restarted.
      */
     void upnp_thread_proc() {
-      auto shutdown_event = mail::man->event<bool>(mail::shutdown);
-      bool mapped = false;
-      IGDdatas data;
-      urls_t mapped_urls;
+      auto shutdown_event = mail::man->event(mail::shutdown);
+      std::optional<igd_t> igd;
+      std::vector<std::chrono::steady_clock::time_point> lease_expiry(mappings.size());
+      std::chrono::steady_clock::time_point pinholes_expiry;
       auto address_family = net::af_from_enum_string(config::sunshine.address_family);
 
       // Refresh UPnP rules every few minutes. They can be lost if the router reboots,
       // WAN IP address changes, or various other conditions.
       do {
-        int err = 0;
-        device_t device {upnpDiscover(2000, nullptr, nullptr, 0, IPv4, 2, &err)};
-        if (!device || err) {
-          BOOST_LOG(warning) << "Couldn't discover any IPv4 UPNP devices"sv;
-          mapped = false;
-          continue;
+        auto now = std::chrono::steady_clock::now();
+
+        igd_state_t state;
+        if (igd && now - igd->discovered < REDISCOVERY_INTERVAL && !read_igd_state(*igd, state)) {
+          BOOST_LOG(info) << "UPnP IGD stopped answering, discovering it again"sv;
+          igd->discovered = {};
         }
 
-        for (auto dev = device.get(); dev != nullptr; dev = dev->pNext) {
-          BOOST_LOG(debug) << "Found device: "sv << dev->descURL;
+        auto remap = false;
+        if (!igd || now - igd->discovered >= REDISCOVERY_INTERVAL) {
+          auto found = discover_igd();
+          if (!found) {
+            std::fill(std::begin(lease_expiry), std::end(lease_expiry), std::chrono::steady_clock::time_point {});
+            mapped_port_count = 0;
+            continue;
+          }
+
+          // The mappings point to our LAN address on a specific IGD
+          remap = !igd || found->lan_addr != igd->lan_addr || std::strcmp(found->urls->controlURL, igd->urls->controlURL);
+          if (!remap) {
+            found->state = std::move(igd->state);
+          }
+          igd = std::move(found);
+
+          // Without the state changes can't be detected, so only the expiring leases get renewed
+          if (!read_igd_state(*igd, state)) {
+            state = igd->state;
+          }
         }
 
-        std::array<char, INET6_ADDRESS_STRLEN> lan_addr;
+        if (!remap && (state.external_addr != igd->state.external_addr || state.uptime < igd->state.uptime)) {
+          BOOST_LOG(info) << "UPnP IGD restarted or changed its external address"sv;
+          remap = true;
+        }
+        igd->state = std::move(state);
 
-        urls_t urls;
-        auto status = upnp::UPNP_GetValidIGDStatus(device, &urls, &data, lan_addr);
-        if (status != 1 && status != 2) {
-          BOOST_LOG(error) << status_string(status);
-          mapped = false;
-          continue;
+        if (remap) {
+          std::fill(std::begin(lease_expiry), std::end(lease_expiry), std::chrono::steady_clock::time_point {});
+          pinholes_expiry = {};
         }
 
-        std::string lan_addr_str {lan_addr.data()};
+        int mapped = 0;
+        for (std::size_t x = 0; x < mappings.size() && !shutdown_event->peek(); ++x) {
+          if (lease_expiry[x] - now > RENEWAL_MARGIN) {
+            mappings_skipped.add();
+            ++mapped;
+            continue;
+          }
 
-        BOOST_LOG(debug) << "Found valid IGD device: "sv << urls->rootdescURL;
+          auto lease = map_upnp_port(igd->data, igd->urls, igd->lan_addr, mappings[x]);
+          if (!lease) {
+            mapping_failures.add();
+            lease_expiry[x] = {};
+            continue;
+          }
 
-        for (auto it = std::begin(mappings); it != std::end(mappings) && !shutdown_event->peek(); ++it) {
-          map_upnp_port(data, urls, lan_addr_str, *it);
+          mappings_renewed.add();
+          ++mapped;
+          lease_expiry[x] = *lease == 0s ? std::chrono::steady_clock::time_point::max() : now + *lease;
         }
+        mapped_port_count = mapped;
 
-        if (!mapped) {
-          BOOST_LOG(info) << "Completed UPnP port mappings to "sv << lan_addr_str << " via "sv << urls->rootdescURL;
+        if (remap) {
+          BOOST_LOG(info) << "Completed UPnP port mappings to "sv << igd->lan_addr << " via "sv << igd->urls->rootdescURL;
         }
 
         // If we are listening on IPv6 and the IGD has an IPv6 firewall enabled, try to create IPv6 firewall pinholes
-        if (address_family == net::af_e::BOTH) {
-          if (create_ipv6_pinholes() && !mapped) {
-            // Only log the first time through
-            BOOST_LOG(info) << "Successfully opened IPv6 pinholes on the IGD"sv;
+        if (address_family == net::af_e::BOTH && pinholes_expiry - now <= RENEWAL_MARGIN) {
+          auto opened_before = pinholes_expiry != std::chrono::steady_clock::time_point {};
+          if (create_ipv6_pinholes()) {
+            if (!opened_before) {
+              // Only log the first time through
+              BOOST_LOG(info) << "Successfully opened IPv6 pinholes on the IGD"sv;
+            }
+            pinholes_expiry = now + PORT_MAPPING_LIFETIME;
+          } else {
+            pinholes_expiry = {};
           }
         }
-
-        mapped = true;
-        mapped_urls = std::move(urls);
       } while (!shutdown_event->view(REFRESH_INTERVAL));
 
-      if (mapped) {
+      if (igd && mapped_port_count) {
         // Unmap ports upon termination
         BOOST_LOG(info) << "Unmapping UPNP ports..."sv;
-        unmap_all_upnp_ports(mapped_urls, data);
+        unmap_all_upnp_ports(igd->urls, igd->data);
+        mapped_port_count = 0;
       }
     }
 
@@ -375,6 +505,10 @@ namespace upnp {
     std::thread upnp_thread;
   };
 
+  int mapped_ports() {
+    return mapped_port_count;
+  }
+
   std::unique_ptr<platf::deinit_t> start() {
     if (!config::sunshine.flags[config::flag::UPNP]) {
       return nullptr;
@@ -19,6 +19,8 @@ namespace upnp {
   constexpr auto IPv6 = 1;
   constexpr auto PORT_MAPPING_LIFETIME = 3600s;
   constexpr auto REFRESH_INTERVAL = 120s;
+  constexpr auto RENEWAL_MARGIN = 2 * REFRESH_INTERVAL;  ///< Leases expiring sooner are renewed on the next refresh
+  constexpr auto REDISCOVERY_INTERVAL = 1800s;  ///< Catches a new LAN address, which the IGD state doesn't reveal
 
   using device_t = util::safe_ptr<UPNPDev, freeUPNPDevlist>;
 
@@ -40,5 +42,11 @@ namespace upnp {
    */
   int UPNP_GetValidIGDStatus(device_t &device, urls_t *urls, IGDdatas *data, std::array<char, INET6_ADDRESS_STRLEN> &lan_addr);
 
+  /**
+   * @brief Get the number of ports currently mapped on the IGD.
+   * @return The count, 0 if UPnP is disabled or no IGD was found.
+   */
+  int mapped_ports();
+
   [[nodiscard]] std::unique_ptr<platf::deinit_t> start();
 }  // namespace upnp
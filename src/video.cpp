@@ -3,9 +3,20 @@
  * @brief Definitions for video.
  */
 // standard includes
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <bitset>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <list>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <thread>
 
 // lib includes
@@ -22,14 +33,26 @@ extern "C" {
 #include "process.h"
 #include "cbs.h"
 #include "config.h"
+#include "crypto.h"
 #include "display_device.h"
+#include "file_handler.h"
 #include "globals.h"
+#include "gpu_stats.h"
 #include "input.h"
 #include "logging.h"
+#include "metrics.h"
 #include "nvenc/nvenc_base.h"
+#include "pipeline_trace.h"
 #include "platform/common.h"
+#include "roi.h"
 #include "sync.h"
+#include "thread_placement.h"
 #include "video.h"
+#include "video_convert.h"
+
+#ifdef __APPLE__
+  #include "platform/macos/vt_encoder.h"
+#endif
 
 #ifdef _WIN32
   #include "platform/windows/virtual_display.h"
@@ -202,6 +225,40 @@ namespace video {
    */
   util::Either<avcodec_buffer_t, int> vt_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
 
+  /**
+   * @brief Get the layout of a pixel format that has a dedicated BGRX conversion kernel.
+   *
+   * @param format The pixel format.
+   * @return The layout, or std::nullopt if only swscale can produce the format.
+   */
+  static std::optional<yuv_layout_e> yuv_layout_from_pix_fmt(AVPixelFormat format) {
+    switch (format) {
+      case AV_PIX_FMT_NV12:
+        return yuv_layout_e::nv12;
+      case AV_PIX_FMT_P010:
+        return yuv_layout_e::p010;
+      case AV_PIX_FMT_YUV420P:
+        return yuv_layout_e::yuv420p;
+      case AV_PIX_FMT_YUV420P10:
+        return yuv_layout_e::yuv420p10;
+      case AV_PIX_FMT_YUV444P:
+        return yuv_layout_e::yuv444p;
+      case AV_PIX_FMT_YUV444P10:
+        return yuv_layout_e::yuv444p10;
+      default:
+        return std::nullopt;
+    }
+  }
+
+  /**
+   * @brief Get the fewest threads software encoding of a session uses.
+   * @param config The stream configuration.
+   * @return The threads a benchmark measures, or `min_threads`.
+   */
+  static int min_threads(const config_t &config) {
+    return config.settings && config.settings->min_threads ? *config.settings->min_threads : config::video.min_threads;
+  }
+
   /**
    * @brief Software video encoding device using libavcodec.
    * 
@@ -219,34 +276,23 @@ namespace video {
      * @return 0 on success, -1 on failure.
      */
     int convert(platf::img_t &img) override {
-      // If we need to add aspect ratio padding, we need to scale into an intermediate output buffer
+      // With aspect ratio padding, the output frame is a window into the padded frame
       bool requires_padding = (sw_frame->width != sws_output_frame->width || sw_frame->height != sws_output_frame->height);
 
       // Setup the input frame using the caller's img_t
       sws_input_frame->data[0] = img.data;
       sws_input_frame->linesize[0] = img.row_pitch;
 
-      // Perform color conversion and scaling to the final size
-      auto status = sws_scale_frame(sws.get(), requires_padding ? sws_output_frame.get() : sw_frame.get(), sws_input_frame.get());
-      if (status < 0) {
-        char string[AV_ERROR_MAX_STRING_SIZE];
-        BOOST_LOG(error) << "Couldn't scale frame: "sv << av_make_error_string(string, AV_ERROR_MAX_STRING_SIZE, status);
-        return -1;
-      }
-
-      // If we require aspect ratio padding, copy the output frame into the final padded frame
-      if (requires_padding) {
-        auto fmt_desc = av_pix_fmt_desc_get((AVPixelFormat) sws_output_frame->format);
-        auto planes = av_pix_fmt_count_planes((AVPixelFormat) sws_output_frame->format);
-        for (int plane = 0; plane < planes; plane++) {
-          auto shift_h = plane == 0 ? 0 : fmt_desc->log2_chroma_h;
-          auto shift_w = plane == 0 ? 0 : fmt_desc->log2_chroma_w;
-          auto offset = ((offsetW >> shift_w) * fmt_desc->comp[plane].step) + (offsetH >> shift_h) * sw_frame->linesize[plane];
-
-          // Copy line-by-line to preserve leading padding for each row
-          for (int line = 0; line < sws_output_frame->height >> shift_h; line++) {
-            memcpy(sw_frame->data[plane] + offset + (line * sw_frame->linesize[plane]), sws_output_frame->data[plane] + (line * sws_output_frame->linesize[plane]), (size_t) (sws_output_frame->width >> shift_w) * fmt_desc->comp[plane].step);
-          }
+      if (bgrx_to_yuv) {
+        auto target = requires_padding ? sws_output_frame.get() : sw_frame.get();
+        bgrx_to_yuv->convert(img.data, img.row_pitch, sws_output_frame->width, sws_output_frame->height, target->data, target->linesize);
+      } else {
+        // Perform color conversion and scaling to the final size, sliced across the swscale threads
+        auto status = sws_scale_frame(sws.get(), requires_padding ? sws_output_frame.get() : sw_frame.get(), sws_input_frame.get());
+        if (status < 0) {
+          char string[AV_ERROR_MAX_STRING_SIZE];
+          BOOST_LOG(error) << "Couldn't scale frame: "sv << av_make_error_string(string, AV_ERROR_MAX_STRING_SIZE, status);
+          return -1;
         }
       }
 
@@ -299,6 +345,16 @@ namespace video {
     void apply_colorspace() override {
       auto avcodec_colorspace = avcodec_colorspace_from_sunshine_colorspace(colorspace);
       sws_setColorspaceDetails(sws.get(), sws_getCoefficients(SWS_CS_DEFAULT), 0, sws_getCoefficients(avcodec_colorspace.software_format), avcodec_colorspace.range - 1, 0, 1 << 16, 1 << 16);
+
+      // Unscaled conversions into the common formats skip swscale entirely
+      bgrx_to_yuv.reset();
+      auto format = (AVPixelFormat) sws_output_frame->format;
+      auto layout = yuv_layout_from_pix_fmt(format);
+      if (layout && sws_input_frame->width == sws_output_frame->width && sws_input_frame->height == sws_output_frame->height &&
+          bit_depth_from_yuv_layout(*layout) == colorspace.bit_depth) {
+        bgrx_to_yuv.emplace(*layout, *new_color_vectors_from_colorspace(colorspace));
+        BOOST_LOG(info) << "Using "sv << bgrx_to_yuv->kernel_name() << " kernel for BGRX to "sv << av_get_pix_fmt_name(format) << " conversion"sv;
+      }
     }
 
     /**
@@ -325,9 +381,10 @@ namespace video {
      * @param frame Output frame buffer.
      * @param format Pixel format for conversion.
      * @param hardware Whether hardware acceleration is being used.
+     * @param threads The threads swscale converts with.
      * @return 0 on success, -1 on failure.
      */
-    int init(int in_width, int in_height, AVFrame *frame, AVPixelFormat format, bool hardware) {
+    int init(int in_width, int in_height, AVFrame *frame, AVPixelFormat format, bool hardware, int threads) {
       // If the device used is hardware, yet the image resides on main memory
       if (hardware) {
         sw_frame.reset(av_frame_alloc());
@@ -364,6 +421,30 @@ namespace video {
       offsetW = (frame->width - out_width) / 2;
       offsetH = (frame->height - out_height) / 2;
 
+      if (out_width != frame->width || out_height != frame->height) {
+        // Point the output frame into the padded frame, so swscale writes the image in place
+        // instead of into an intermediate buffer that would need a second, single-threaded copy
+        auto padded_frame = sw_frame ? sw_frame.get() : this->frame;
+        auto fmt_desc = av_pix_fmt_desc_get(format);
+        auto planes = av_pix_fmt_count_planes(format);
+        for (int plane = 0; plane < planes; plane++) {
+          auto shift_h = plane == 0 ? 0 : fmt_desc->log2_chroma_h;
+          auto shift_w = plane == 0 ? 0 : fmt_desc->log2_chroma_w;
+          auto offset = ((offsetW >> shift_w) * fmt_desc->comp[plane].step) + (offsetH >> shift_h) * padded_frame->linesize[plane];
+
+          sws_output_frame->data[plane] = padded_frame->data[plane] + offset;
+          sws_output_frame->linesize[plane] = padded_frame->linesize[plane];
+        }
+
+        // Referencing the padded frame's buffers keeps swscale from allocating its own
+        for (int x = 0; x < AV_NUM_DATA_POINTERS && padded_frame->buf[x]; x++) {
+          sws_output_frame->buf[x] = av_buffer_ref(padded_frame->buf[x]);
+          if (!sws_output_frame->buf[x]) {
+            return -1;
+          }
+        }
+      }
+
       sws.reset(sws_alloc_context());
       if (!sws) {
         return -1;
@@ -377,7 +458,7 @@ namespace video {
       av_dict_set_int(&options, "dsth", sws_output_frame->height, 0);
       av_dict_set_int(&options, "dst_format", sws_output_frame->format, 0);
       av_dict_set_int(&options, "sws_flags", SWS_LANCZOS | SWS_ACCURATE_RND, 0);
-      av_dict_set_int(&options, "threads", config::video.min_threads, 0);
+      av_dict_set_int(&options, "threads", threads, 0);
 
       auto status = av_opt_set_dict(sws.get(), &options);
       av_dict_free(&options);
@@ -403,6 +484,7 @@ namespace video {
     avcodec_frame_t sws_input_frame;  ///< Input frame for libswscale conversion.
     avcodec_frame_t sws_output_frame;  ///< Output frame for libswscale conversion.
     sws_t sws;  ///< Libswscale context for image scaling and format conversion.
+    std::optional<bgrx_to_yuv_t> bgrx_to_yuv;  ///< Dedicated converter used instead of sws when no scaling is needed.
 
     int offsetW;  ///< Horizontal offset of input image to output frame in pixels (for aspect ratio padding).
     int offsetH;  ///< Vertical offset of input image to output frame in pixels (for aspect ratio padding).
@@ -429,6 +511,287 @@ namespace video {
     ASYNC_TEARDOWN = 1 << 11,  ///< Encoder supports async teardown on a different thread
   };
 
+  /**
+   * @brief An encoder whose packets are also sent to other sessions with the same config.
+   */
+  struct shared_encode_t {
+    /**
+     * @brief A session receiving the packets of another session's encoder.
+     */
+    struct subscriber_t {
+      void *channel_data;
+      int64_t next_frame_index;  ///< Frame index the session expects next
+      std::optional<int64_t> frame_index_offset;  ///< Set once the first IDR frame was delivered
+    };
+
+    config_t config;
+    void *owner_channel_data;
+    safe::mail_raw_t::event_t<bool> owner_idr_events;
+    std::atomic<bool> running {true};
+
+    std::mutex lock;
+    std::vector<subscriber_t> subscribers;
+
+    // Last display state sent to the owner, replayed to the subscribers
+    std::optional<input::touch_port_t> touch_port;
+    std::optional<hdr_info_raw_t> hdr_info;
+    std::uint64_t display_state_version = 0;
+  };
+
+  void packet_deleter_t::operator()(packet_raw_t *packet) const {
+    // Keep the pool alive while it takes the packet back, the packet may hold the last reference
+    if (auto pool = std::move(packet->pool)) {
+      pool->recycle(packet);
+    } else {
+      delete packet;
+    }
+  }
+
+  std::unique_ptr<packet_raw_avcodec, packet_deleter_t> packet_pool_t::avcodec() {
+    std::unique_ptr<packet_raw_avcodec> packet;
+    {
+      std::lock_guard lg {mutex};
+      if (!avcodec_packets.empty()) {
+        packet = std::move(avcodec_packets.back());
+        avcodec_packets.pop_back();
+      }
+    }
+
+    if (!packet) {
+      packet = std::make_unique<packet_raw_avcodec>();
+    }
+    packet->pool = shared_from_this();
+
+    return std::unique_ptr<packet_raw_avcodec, packet_deleter_t> {packet.release()};
+  }
+
+  std::unique_ptr<packet_raw_generic, packet_deleter_t> packet_pool_t::generic(std::vector<uint8_t> &&frame_data, int64_t frame_index, bool idr) {
+    std::unique_ptr<packet_raw_generic> packet;
+    {
+      std::lock_guard lg {mutex};
+      peak_size = std::max(peak_size, frame_data.size());
+      if (!generic_packets.empty()) {
+        packet = std::move(generic_packets.back());
+        generic_packets.pop_back();
+      }
+    }
+
+    if (packet) {
+      packet->frame_data = std::move(frame_data);
+      packet->index = frame_index;
+      packet->idr = idr;
+    } else {
+      packet = std::make_unique<packet_raw_generic>(std::move(frame_data), frame_index, idr);
+    }
+    packet->pool = shared_from_this();
+
+    return std::unique_ptr<packet_raw_generic, packet_deleter_t> {packet.release()};
+  }
+
+  std::vector<uint8_t> packet_pool_t::buffer() {
+    std::vector<uint8_t> buffer;
+    std::size_t reserve;
+    {
+      std::lock_guard lg {mutex};
+      buffers_used = true;
+      if (!buffers.empty()) {
+        buffer = std::move(buffers.back());
+        buffers.pop_back();
+      }
+      reserve = peak_size;
+    }
+
+    // Leave some room for the next frame to be a bit larger than the largest one so far
+    if (buffer.capacity() < reserve) {
+      buffer.reserve(reserve + reserve / 4);
+    }
+
+    return buffer;
+  }
+
+  void packet_pool_t::recycle(packet_raw_t *packet) {
+    std::unique_ptr<packet_raw_t> owned {packet};
+
+    packet->replacements = nullptr;
+    packet->channel_data = nullptr;
+    packet->after_ref_frame_invalidation = false;
+    packet->temporal_layer = 0;
+    packet->droppable = false;
+    packet->frame_timestamp.reset();
+
+    if (auto avcodec_packet = dynamic_cast<packet_raw_avcodec *>(packet)) {
+      av_packet_unref(avcodec_packet->av_packet);
+
+      std::lock_guard lg {mutex};
+      if (avcodec_packets.size() < max_packets) {
+        owned.release();
+        avcodec_packets.emplace_back(avcodec_packet);
+      }
+    } else if (auto generic_packet = dynamic_cast<packet_raw_generic *>(packet)) {
+      auto frame_data = std::move(generic_packet->frame_data);
+      frame_data.clear();
+
+      std::lock_guard lg {mutex};
+      // Only encoders that write into buffer() get their buffers back
+      if (buffers_used && buffers.size() < max_packets && frame_data.capacity()) {
+        buffers.emplace_back(std::move(frame_data));
+      }
+      if (generic_packets.size() < max_packets) {
+        owned.release();
+        generic_packets.emplace_back(generic_packet);
+      }
+    }
+  }
+
+  static std::mutex shared_encodes_lock;
+  static std::vector<std::shared_ptr<shared_encode_t>> shared_encodes;
+  static std::atomic<bool> any_shared_encode;
+
+  /**
+   * @brief Find the shared encoder a session should subscribe to.
+   * @details With `encode_sharing_layers` above 1, encoders whose configs only differ in bitrate
+   *          are layers of one stream. Until all layers run, a session with a new bitrate starts
+   *          a layer of its own. After that it gets the layer with the highest bitrate that doesn't
+   *          exceed its own, or the lowest layer if they all do.
+   *          Must be called with shared_encodes_lock held.
+   * @param config The config of the session.
+   * @return The encoder, or nullptr if the session should run one of its own.
+   */
+  static std::shared_ptr<shared_encode_t> find_shared_encode(const config_t &config) {
+    std::shared_ptr<shared_encode_t> best;
+    int layers = 0;
+    for (auto &shared_encode : shared_encodes) {
+      if (!shared_encode->running) {
+        continue;
+      }
+      if (shared_encode->config == config) {
+        return shared_encode;
+      }
+
+      auto layer_config = shared_encode->config;
+      layer_config.bitrate = config.bitrate;
+      if (layer_config != config) {
+        continue;
+      }
+      ++layers;
+
+      auto fits = shared_encode->config.bitrate <= config.bitrate;
+      auto best_fits = best && best->config.bitrate <= config.bitrate;
+      if (!best ||
+          (fits && (!best_fits || shared_encode->config.bitrate > best->config.bitrate)) ||
+          (!fits && !best_fits && shared_encode->config.bitrate < best->config.bitrate)) {
+        best = shared_encode;
+      }
+    }
+
+    if (layers < config::video.encode_sharing_layers) {
+      return nullptr;
+    }
+    return best;
+  }
+
+  /**
+   * @brief Send an encoded packet to its session and to the sessions sharing its encoder.
+   * @param packets Output queue for encoded packets.
+   * @param packet The packet, its channel data identifies the encoding session.
+   */
+  static void raise_packet(const safe::mail_raw_t::queue_t<packet_t> &packets, packet_t &&packet) {
+    if (!any_shared_encode.load(std::memory_order_relaxed)) {
+      packets->raise(std::move(packet));
+      return;
+    }
+
+    std::shared_ptr<shared_encode_t> shared;
+    {
+      std::lock_guard lg {shared_encodes_lock};
+      auto it = std::find_if(std::begin(shared_encodes), std::end(shared_encodes), [&](auto &shared_encode) {
+        return shared_encode->owner_channel_data == packet->channel_data;
+      });
+      if (it != std::end(shared_encodes)) {
+        shared = *it;
+      }
+    }
+
+    if (!shared) {
+      packets->raise(std::move(packet));
+      return;
+    }
+
+    std::lock_guard lg {shared->lock};
+    if (shared->subscribers.empty()) {
+      packets->raise(std::move(packet));
+      return;
+    }
+
+    std::shared_ptr<packet_raw_t> source = std::move(packet);
+    auto idr = source->is_idr();
+    auto frame_index = source->frame_index();
+
+    packets->raise(std::make_unique<packet_raw_shared_t>(source, source->channel_data, 0));
+    for (auto &subscriber : shared->subscribers) {
+      // A session can only start decoding at an IDR frame
+      if (!subscriber.frame_index_offset) {
+        if (!idr) {
+          continue;
+        }
+        subscriber.frame_index_offset = frame_index - subscriber.next_frame_index;
+      }
+
+      subscriber.next_frame_index = frame_index - *subscriber.frame_index_offset + 1;
+      packets->raise(std::make_unique<packet_raw_shared_t>(source, subscriber.channel_data, *subscriber.frame_index_offset));
+    }
+  }
+
+  /**
+   * @brief Check whether the libavcodec wrapper of an encoder applies rate control changes mid-stream.
+   *
+   * These wrappers compare the rate control fields of the codec context against the running
+   * encoder on every frame and reconfigure it in place, without emitting an IDR frame.
+   *
+   * @param codec_name Name of the libavcodec encoder.
+   * @return True if changing bit_rate, rc_max_rate and rc_buffer_size takes effect on the next frame.
+   */
+  static bool avcodec_supports_dynamic_bitrate(std::string_view codec_name) {
+    static constexpr std::array codecs {
+      "libx264"sv,
+      "h264_qsv"sv,
+      "hevc_qsv"sv,
+      "av1_qsv"sv,
+      "h264_nvenc"sv,
+      "hevc_nvenc"sv,
+      "av1_nvenc"sv,
+    };
+
+    return std::find(std::begin(codecs), std::end(codecs), codec_name) != std::end(codecs);
+  }
+
+  /**
+   * @brief Replace the regions of interest that libavcodec encoders read from the side data of a frame.
+   *
+   * The QP deltas map to offsets of -1 to 1, which libx264 scales to 25 QP steps. Encoders whose
+   * libavcodec wrapper doesn't support the side data encode the frame as usual.
+   *
+   * @param frame The frame to encode next.
+   * @param regions The regions, the first one applies where they overlap.
+   */
+  static void set_regions_of_interest(AVFrame *frame, const std::vector<roi::region_t> &regions) {
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+    if (regions.empty()) {
+      return;
+    }
+
+    auto side_data = av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, regions.size() * sizeof(AVRegionOfInterest));
+    if (!side_data) {
+      return;
+    }
+
+    auto rois = (AVRegionOfInterest *) side_data->data;
+    for (std::size_t x = 0; x < regions.size(); ++x) {
+      auto &rect = regions[x].rect;
+      rois[x] = {sizeof(AVRegionOfInterest), rect.top, rect.bottom, rect.left, rect.right, av_make_q(regions[x].qp_delta, roi::max_qp_delta)};
+    }
+  }
+
   /**
    * @brief Video encoding session using libavcodec.
    * 
@@ -490,6 +853,8 @@ namespace video {
       vps = std::move(other.vps);
 
       inject = other.inject;
+      roi_mode = other.roi_mode;
+      roi_strength = other.roi_strength;
 
       return *this;
     }
@@ -504,7 +869,23 @@ namespace video {
       if (!device) {
         return -1;
       }
-      return device->convert(img);
+
+      if (auto ret = device->convert(img)) {
+        return ret;
+      }
+
+      // Some devices convert into the next frame of a pool, the regions go on the one converted into
+      if (roi_mode != roi::mode_e::disabled && device->frame) {
+        auto &frame = device->frame;
+        set_regions_of_interest(frame, roi::regions(img, frame->width, frame->height, roi_mode, roi_strength));
+      }
+      return 0;
+    }
+
+    void rebind() override {
+      if (device) {
+        device->rebind();
+      }
     }
 
     /**
@@ -546,6 +927,39 @@ namespace video {
       request_idr_frame();
     }
 
+    /**
+     * @brief Reconfigure bitrate during active session.
+     *
+     * Only supported by encoders whose libavcodec wrapper picks up rate control changes between frames.
+     * The target-to-max rate offset and the VBV duration chosen at session creation are preserved.
+     *
+     * @param new_bitrate_kbps New bitrate in Kbps.
+     * @return True if the new bitrate applies from the next frame, false otherwise.
+     */
+    bool reconfigure_bitrate(int new_bitrate_kbps) override {
+      if (!avcodec_ctx || !avcodec_ctx->codec || !avcodec_supports_dynamic_bitrate(avcodec_ctx->codec->name)) {
+        return false;
+      }
+
+      auto &ctx = avcodec_ctx;
+      auto old_max_rate = ctx->rc_max_rate;
+      if (old_max_rate <= 0) {
+        return false;
+      }
+
+      auto bitrate = (int64_t) new_bitrate_kbps * 1000;
+      ctx->bit_rate = bitrate - (old_max_rate - ctx->bit_rate);
+      if (ctx->rc_min_rate > 0) {
+        ctx->rc_min_rate = bitrate;
+      }
+      if (ctx->rc_buffer_size > 0) {
+        ctx->rc_buffer_size = (int) (ctx->rc_buffer_size * bitrate / old_max_rate);
+      }
+      ctx->rc_max_rate = bitrate;
+
+      return true;
+    }
+
     avcodec_ctx_t avcodec_ctx;
     std::unique_ptr<platf::avcodec_encode_device_t> device;
 
@@ -556,6 +970,9 @@ namespace video {
 
     // inject sps/vps data into idr pictures
     int inject;
+
+    roi::mode_e roi_mode = roi::mode_e::disabled;
+    int roi_strength = 0;
   };
 
   /**
@@ -585,9 +1002,36 @@ namespace video {
       if (!device) {
         return -1;
       }
+
+      if (roi_mode != roi::mode_e::disabled) {
+        roi::build_map(roi::regions(img, frame_width, frame_height, roi_mode, roi_strength), roi::block_size(video_format), frame_width, frame_height, qp_delta_map);
+      }
       return device->convert(img);
     }
 
+    void rebind() override {
+      if (device) {
+        device->rebind();
+      }
+    }
+
+    /**
+     * @brief Encode the regions of interest of each converted image at a better quality.
+     *
+     * The encoder must have been created with `nvenc::nvenc_config::qp_delta_map` set.
+     *
+     * @param mode Which regions to prioritize.
+     * @param strength QP delta given to the regions.
+     * @param client_config The stream configuration.
+     */
+    void set_roi(roi::mode_e mode, int strength, const config_t &client_config) {
+      roi_mode = mode;
+      roi_strength = strength;
+      frame_width = client_config.width;
+      frame_height = client_config.height;
+      video_format = client_config.videoFormat;
+    }
+
     /**
      * @brief Request an IDR (key) frame.
      * 
@@ -636,7 +1080,61 @@ namespace video {
         return {};
       }
 
-      auto result = device->nvenc->encode_frame(frame_index, force_idr);
+      auto result = device->nvenc->encode_frame(frame_index, force_idr, qp_delta_map);
+      force_idr = false;
+      return result;
+    }
+
+    /**
+     * @brief Switch to pipelined encoding if the encoder supports it.
+     *
+     * Completed frames are raised to the packet queue from the encoder's retrieval thread.
+     *
+     * @param packets Output queue for encoded packets.
+     * @param channel_data Channel-specific data pointer.
+     * @return True if frames must be passed to submit_frame(), false to keep using encode_frame().
+     */
+    bool pipelined(safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data) {
+      if (!pipeline_checked) {
+        pipeline_checked = true;
+
+        if (device && device->nvenc) {
+          // Encoded frames are written into buffers of packets the broadcast thread has released
+          device->nvenc->set_buffer_source([pool = packet_pool]() {
+            return pool->buffer();
+          });
+
+          pipeline_started = device->nvenc->start_pipeline([this, packets, channel_data](nvenc::nvenc_encoded_frame &&encoded_frame) {
+            if (encoded_frame.data.empty()) {
+              BOOST_LOG(error) << "NvENC returned empty packet";
+              return;
+            }
+
+            auto packet = packet_pool->generic(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
+            packet->channel_data = channel_data;
+            packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
+            packet->temporal_layer = (int) encoded_frame.temporal_layer;
+            packet->droppable = encoded_frame.droppable;
+            packet->frame_timestamp = frame_timestamps[encoded_frame.frame_index % frame_timestamps.size()];
+            raise_packet(packets, std::move(packet));
+          });
+        }
+      }
+
+      return pipeline_started;
+    }
+
+    /**
+     * @brief Submit a video frame to the encoding pipeline.
+     *
+     * @param frame_index Index of the frame to encode.
+     * @param frame_timestamp Optional frame timestamp, attached to the packet once encoded.
+     * @return True on success, false on failure.
+     */
+    bool submit_frame(uint64_t frame_index, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+      frame_timestamps[frame_index % frame_timestamps.size()] = frame_timestamp;
+
+      auto result = device->nvenc->submit_frame(frame_index, force_idr, qp_delta_map);
       force_idr = false;
       return result;
     }
@@ -654,10 +1152,147 @@ namespace video {
       return device->nvenc->reconfigure_bitrate(new_bitrate_kbps);
     }
 
+    bool reconfigure_resolution(const config_t &config) override {
+      if (!device || !device->reconfigure_resolution(config)) {
+        return false;
+      }
+
+      frame_width = config.width;
+      frame_height = config.height;
+      return true;
+    }
+
   private:
+    // Declared before the device, since destroying the encoder drains frames still in flight
+    std::array<std::optional<std::chrono::steady_clock::time_point>, 16> frame_timestamps;  ///< Capture timestamps of in-flight frames.
     std::unique_ptr<platf::nvenc_encode_device_t> device;  ///< NVENC encode device.
     bool force_idr = false;  ///< Flag to force next frame as IDR.
+    bool pipeline_checked = false;  ///< Whether pipelined encoding has been attempted.
+    bool pipeline_started = false;  ///< Whether frames are encoded through the pipeline.
+    roi::mode_e roi_mode = roi::mode_e::disabled;  ///< Which regions get a lower QP.
+    int roi_strength = 0;  ///< QP delta of the regions of interest.
+    int frame_width = 0;  ///< Width of the encoded frames.
+    int frame_height = 0;  ///< Height of the encoded frames.
+    int video_format = 0;  ///< 0 for H.264, 1 for HEVC, 2 for AV1.
+    std::vector<int8_t> qp_delta_map;  ///< QP delta per block of the next frame, empty without regions of interest.
+  };
+
+#ifdef __APPLE__
+  /**
+   * @brief Video encoding session driving a VTCompressionSession directly.
+   *
+   * Encoded frames are raised to the packet queue from the VideoToolbox output thread.
+   */
+  class vt_encode_session_t: public encode_session_t {
+  public:
+    /**
+     * @brief Construct VideoToolbox encoding session.
+     *
+     * @param encode_device Encode device placing the captured CVPixelBuffer in `frame->data[3]` (moved).
+     */
+    vt_encode_session_t(std::unique_ptr<platf::avcodec_encode_device_t> encode_device):
+        device(std::move(encode_device)) {
+    }
+
+    /**
+     * @brief Create the compression session.
+     *
+     * @param config Video encoding configuration.
+     * @param width Frame width.
+     * @param height Frame height.
+     * @return True on success, false on failure.
+     */
+    bool init(const config_t &config, int width, int height) {
+      return encoder.create_encoder(config, device->colorspace, width, height, [this](platf::vt_encoded_frame_t &&encoded_frame) {
+        if (encoded_frame.data.empty()) {
+          BOOST_LOG(error) << "VideoToolbox returned empty packet";
+          return;
+        }
+
+        std::lock_guard lock(output_mutex);
+        if (!packets) {
+          return;
+        }
+
+        auto packet = packet_pool->generic(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
+        packet->channel_data = channel_data;
+        packet->frame_timestamp = frame_timestamps[encoded_frame.frame_index % frame_timestamps.size()];
+        raise_packet(packets, std::move(packet));
+      });
+    }
+
+    int convert(platf::img_t &img) override {
+      return device->convert(img);
+    }
+
+    void rebind() override {
+      device->rebind();
+    }
+
+    void request_idr_frame() override {
+      force_idr = true;
+    }
+
+    void request_normal_frame() override {
+      force_idr = false;
+    }
+
+    /**
+     * @brief Invalidate reference frames.
+     *
+     * VideoToolbox can't invalidate reference frames, so the next frame is an IDR frame.
+     */
+    void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) override {
+      force_idr = true;
+    }
+
+    /**
+     * @brief Submit the last converted frame to the encoder.
+     *
+     * @param frame_index Index of the frame to encode.
+     * @param packets Output queue for encoded packets.
+     * @param channel_data Channel-specific data pointer.
+     * @param frame_timestamp Optional frame timestamp, attached to the packet once encoded.
+     * @return True on success, false on failure.
+     */
+    bool submit_frame(uint64_t frame_index, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+      {
+        std::lock_guard lock(output_mutex);
+        this->packets = packets;
+        this->channel_data = channel_data;
+        frame_timestamps[frame_index % frame_timestamps.size()] = frame_timestamp;
+      }
+
+      auto result = encoder.submit_frame((CVPixelBufferRef) device->frame->data[3], frame_index, force_idr);
+      force_idr = false;
+      return result;
+    }
+
+    /**
+     * @brief Reconfigure bitrate during active session.
+     *
+     * Low-latency rate control applies the new average bitrate from the next frame on.
+     *
+     * @param new_bitrate_kbps New bitrate in Kbps.
+     * @return True if reconfiguration succeeded, false otherwise.
+     */
+    bool reconfigure_bitrate(int new_bitrate_kbps) override {
+      return encoder.reconfigure_bitrate(new_bitrate_kbps);
+    }
+
+  private:
+    std::unique_ptr<platf::avcodec_encode_device_t> device;  ///< Capture device providing the CVPixelBuffers.
+    bool force_idr = false;  ///< Flag to force next frame as IDR.
+
+    std::mutex output_mutex;  ///< Guards the output target, read by the VideoToolbox output thread.
+    safe::mail_raw_t::queue_t<packet_t> packets;  ///< Output queue for encoded packets, set by the first submitted frame.
+    void *channel_data = nullptr;  ///< Channel-specific data pointer.
+    std::array<std::optional<std::chrono::steady_clock::time_point>, 16> frame_timestamps;  ///< Capture timestamps of in-flight frames.
+
+    // Declared last, since destroying the encoder drains frames still in flight
+    platf::vt_encoder_t encoder;  ///< VideoToolbox compression session.
   };
+#endif
 
   /**
    * @brief Synchronous encoding session context.
@@ -695,6 +1330,29 @@ namespace video {
    */
   using encode_session_ctx_queue_t = safe::queue_t<sync_session_ctx_t>;
 
+  /**
+   * @brief Two-slot image ring between the capture thread and the encoding loop of the sync path.
+   *
+   * One image is owned by the encoding loop while it converts and encodes it, the other one is
+   * filled by the capture backend. A captured image waiting to be encoded is replaced if the
+   * capture backend needs the slot again, so the encoding loop always gets the newest frame.
+   */
+  struct sync_frame_handoff_t {
+    std::mutex lock;
+    std::condition_variable cv;
+
+    std::array<std::shared_ptr<platf::img_t>, 2> imgs;  ///< The two images of the ring.
+    std::shared_ptr<platf::img_t> encoding;  ///< Image owned by the encoding loop.
+    std::shared_ptr<platf::img_t> captured;  ///< Newest captured image not yet taken by the encoding loop.
+
+    bool pending = false;  ///< Whether the capture backend pushed since the encoding loop last woke up.
+    bool frame_captured = false;  ///< Whether any of the pushes carried a new frame.
+
+    bool stopped = false;  ///< Set by the encoding loop to make the capture backend return.
+    bool capture_done = false;  ///< Set when the capture backend returned.
+    platf::capture_e capture_status = platf::capture_e::ok;  ///< Status the capture backend returned with.
+  };
+
   /**
    * @brief Encoding error enumeration type alias.
    * 
@@ -789,6 +1447,26 @@ namespace video {
    */
   auto capture_thread_sync = safe::make_shared<capture_thread_sync_ctx_t>(start_capture_sync, end_capture_sync);
 
+  /**
+   * @brief Uniformly spaced AV1 tile rows for the slices per frame the client asks for.
+   * @details libavcodec's AV1 encoders ignore the slice count, the slices are spread over powers of two
+   *          of tile rows and columns, with the larger half on the rows like NVENC does.
+   * @param config The stream configuration.
+   * @return The tile rows, as an encoder option.
+   */
+  std::string av1_tile_rows(const config_t &config) {
+    return std::to_string(1 << (int) std::ceil(std::log2(std::max(1, config.slicesPerFrame)) / 2));
+  }
+
+  /**
+   * @brief Uniformly spaced AV1 tile columns for the slices per frame the client asks for.
+   * @param config The stream configuration.
+   * @return The tile columns, as an encoder option.
+   */
+  std::string av1_tile_cols(const config_t &config) {
+    return std::to_string(1 << (int) std::floor(std::log2(std::max(1, config.slicesPerFrame)) / 2));
+  }
+
 #ifdef _WIN32
   encoder_t nvenc {
     "nvenc"sv,
@@ -936,7 +1614,67 @@ namespace video {
   };
 #endif
 
+#if defined(__linux__) && defined(SUNSHINE_BUILD_CUDA)
+  /**
+   * @brief NVENC driven directly through the native API, converting into its CUDA input surface.
+   *
+   * Tried before the FFmpeg NVENC encoder, which takes over when the capture method has no native path.
+   */
+  encoder_t nvenc_native {
+    "nvenc"sv,
+    std::make_unique<encoder_platform_formats_nvenc>(
+      platf::mem_type_e::cuda,
+      platf::pix_fmt_e::nv12,
+      platf::pix_fmt_e::unknown,
+      platf::pix_fmt_e::unknown,
+      platf::pix_fmt_e::unknown
+    ),
+    {
+      {},  // Common options
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "av1_nvenc"s,
+    },
+    {
+      {},  // Common options
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "hevc_nvenc"s,
+    },
+    {
+      {},  // Common options
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "h264_nvenc"s,
+    },
+    PARALLEL_ENCODING | REF_FRAMES_INVALIDATION  // flags
+  };
+#endif
+
 #ifdef _WIN32
+  /**
+   * @brief Largest keyframe for encoders that neither support RFI nor limit frames to a VBV buffer.
+   * @details Without RFI the client recovers from every loss with an IDR frame. An unbounded one takes
+   *          several frame intervals to send and stalls the stream, so it's held to a few average frames
+   *          and the following P-frames restore the quality.
+   * @param config The stream configuration.
+   * @return The limit in bytes, as an encoder option.
+   */
+  std::string keyframe_size_limit(const config_t &config) {
+    constexpr int max_keyframe_frames = 4;
+
+    return std::to_string(config.bitrate * 1000 / 8 / std::max(1, config.framerate) * max_keyframe_frames);
+  }
+
   encoder_t quicksync {
     "quicksync"sv,
     std::make_unique<encoder_platform_formats_avcodec>(
@@ -957,6 +1695,8 @@ namespace video {
         {"async_depth"s, 1},
         {"low_delay_brc"s, 1},
         {"low_power"s, 1},
+        {"tile_rows"s, av1_tile_rows},
+        {"tile_cols"s, av1_tile_cols},
       },
       {
         // SDR-specific options
@@ -987,6 +1727,7 @@ namespace video {
         {"low_power"s, 1},
         {"recovery_point_sei"s, 0},
         {"pic_timing_sei"s, 0},
+        {"max_frame_size_i"s, keyframe_size_limit},
       },
       {
         // SDR-specific options
@@ -1025,6 +1766,7 @@ namespace video {
         {"vcm"s, 1},
         {"pic_timing_sei"s, 0},
         {"max_dec_frame_buffering"s, 1},
+        {"max_frame_size_i"s, keyframe_size_limit},
       },
       {
         // SDR-specific options
@@ -1170,12 +1912,30 @@ namespace video {
       nullptr
     ),
     {
-      // libsvtav1 takes different presets than libx264/libx265.
+      // libsvtav1 takes different presets than libx264/libx265, limited to the real-time ones.
       // We set an infinite GOP length, use a low delay prediction structure,
       // force I frames to be key frames, and set max bitrate to default to work
-      // around a FFmpeg bug with CBR mode.
+      // around a FFmpeg bug with CBR mode. Scene change detection and overlay frames
+      // only add latency when every frame is sent as soon as it's encoded.
+      // The encoder threads follow min_threads through the slice count, the tiles
+      // split the frame so that they have independent work at high resolutions.
       {
-        {"svtav1-params"s, "keyint=-1:pred-struct=1:force-key-frames=1:mbr=0"s},
+        {"svtav1-params"s, [](const config_t &cfg) {
+           // The slices the client asks for become tiles it can decode in parallel
+           auto threads = std::max(min_threads(cfg), cfg.slicesPerFrame);
+           auto tile_columns = 0;
+           while (tile_columns < 2 && (2 << tile_columns) <= threads && (cfg.width >> (tile_columns + 1)) >= 960) {
+             ++tile_columns;
+           }
+           auto tile_rows = tile_columns == 2 && threads >= 8 && cfg.height >= 2160 ? 1 : 0;
+
+           // Screen content mode adds the palette and intra block copy tools, which suit text and flat UI
+           auto screen_content = cfg.contentType == (int) content_type_e::desktop ? 1 : 0;
+
+           return "keyint=-1:pred-struct=1:force-key-frames=1:mbr=0:scd=0:enable-overlays=0:fast-decode=1"s +
+                  ":tile-columns="s + std::to_string(tile_columns) + ":tile-rows="s + std::to_string(tile_rows) +
+                  ":scm="s + std::to_string(screen_content);
+         }},
         {"preset"s, &config::video.sw.svtav1_preset},
       },
       {},  // SDR-specific options
@@ -1184,10 +1944,9 @@ namespace video {
       {},  // YUV444 HDR-specific options
       {},  // Fallback options
 
-#ifdef ENABLE_BROKEN_AV1_ENCODER
-           // Due to bugs preventing on-demand IDR frames from working and very poor
-           // real-time encoding performance, we do not enable libsvtav1 by default.
-           // It is only suitable for testing AV1 until the IDR frame issue is fixed.
+#if LIBAVCODEC_VERSION_MAJOR >= 60 || defined(ENABLE_BROKEN_AV1_ENCODER)
+      // Since FFmpeg 6.0, libsvtav1 turns the I frames we request into key frames,
+      // which on-demand IDR frames rely on. Older versions are only suitable for testing.
       "libsvtav1"s,
 #else
       {},
@@ -1198,9 +1957,13 @@ namespace video {
       // kicked to the 2nd packet in the frame, breaking Moonlight's parsing logic.
       // It also looks like gop_size isn't passed on to x265, so we have to set
       // 'keyint=-1' in the parameters ourselves.
+      // With sw_low_latency, like x264 below, the threads work within a frame
+      // instead of holding back frames, whatever the preset and tune.
       {
         {"forced-idr"s, 1},
-        {"x265-params"s, "info=0:keyint=-1"s},
+        {"x265-params"s, [](const config_t &) {
+           return config::video.sw.sw_low_latency ? "info=0:keyint=-1:frame-threads=1:rc-lookahead=0"s : "info=0:keyint=-1"s;
+         }},
         {"preset"s, &config::video.sw.sw_preset},
         {"tune"s, &config::video.sw.sw_tune},
       },
@@ -1213,9 +1976,16 @@ namespace video {
     },
     {
       // Common options
+      // The packet of a frame leaves once every slice of it is encoded, so with
+      // sw_low_latency the slices are encoded in parallel and no frames are held back
+      // for lookahead, even when sw_tune isn't zerolatency. These are applied after the
+      // preset and tune.
       {
         {"preset"s, &config::video.sw.sw_preset},
         {"tune"s, &config::video.sw.sw_tune},
+        {"x264-params"s, [](const config_t &) {
+           return config::video.sw.sw_low_latency ? "sliced-threads=1:rc-lookahead=0:sync-lookahead=0"s : ""s;
+         }},
       },
       {},  // SDR-specific options
       {},  // HDR-specific options
@@ -1245,6 +2015,8 @@ namespace video {
       {
         {"async_depth"s, 1},
         {"idr_interval"s, std::numeric_limits<int>::max()},
+        {"tile_rows"s, av1_tile_rows},
+        {"tile_cols"s, av1_tile_cols},
       },
       {},  // SDR-specific options
       {},  // HDR-specific options
@@ -1287,6 +2059,47 @@ namespace video {
 #endif
 
 #ifdef __APPLE__
+  /**
+   * @brief VideoToolbox driven directly through a VTCompressionSession with low-latency rate control.
+   *
+   * Tried before the FFmpeg VideoToolbox encoder, which takes over for AV1 and forced software encoding.
+   */
+  encoder_t videotoolbox_native {
+    "videotoolbox"sv,
+    std::make_unique<encoder_platform_formats_vt>(
+      platf::pix_fmt_e::nv12,
+      platf::pix_fmt_e::p010
+    ),
+    {
+      {},  // Common options
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "av1_videotoolbox"s,
+    },
+    {
+      {},  // Common options
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "hevc_videotoolbox"s,
+    },
+    {
+      {},  // Common options
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "h264_videotoolbox"s,
+    },
+    DEFAULT
+  };
+
   encoder_t videotoolbox {
     "videotoolbox"sv,
     std::make_unique<encoder_platform_formats_avcodec>(
@@ -1355,6 +2168,9 @@ namespace video {
 #endif
 
   static const std::vector<encoder_t *> encoders {
+#if defined(__linux__) && defined(SUNSHINE_BUILD_CUDA)
+    &nvenc_native,
+#endif
 #ifndef __APPLE__
     &nvenc,
 #endif
@@ -1366,21 +2182,303 @@ namespace video {
     &vaapi,
 #endif
 #ifdef __APPLE__
+    &videotoolbox_native,
     &videotoolbox,
 #endif
     &software
   };
 
-  static encoder_t *chosen_encoder;  ///< Currently selected encoder.
-  int active_hevc_mode;  ///< Active HEVC encoding mode (0 = disabled, 1 = enabled).
-  int active_av1_mode;  ///< Active AV1 encoding mode (0 = disabled, 1 = enabled).
-  bool last_encoder_probe_supported_ref_frames_invalidation = false;  ///< Whether last encoder probe detected reference frame invalidation support.
-  std::array<bool, 3> last_encoder_probe_supported_yuv444_for_codec = {  ///< YUV444 support per codec (H.264, HEVC, AV1).
-    true,
-    true,
-    true
+  static encoder_t *chosen_encoder;  ///< Currently selected encoder.
+  int active_hevc_mode;  ///< Active HEVC encoding mode (0 = disabled, 1 = enabled).
+  int active_av1_mode;  ///< Active AV1 encoding mode (0 = disabled, 1 = enabled).
+  bool last_encoder_probe_supported_ref_frames_invalidation = false;  ///< Whether last encoder probe detected reference frame invalidation support.
+  std::array<bool, 3> last_encoder_probe_supported_yuv444_for_codec = {  ///< YUV444 support per codec (H.264, HEVC, AV1).
+    true,
+    true,
+    true
+  };
+
+  /**
+   * @brief Reference that keeps the asynchronous capture thread, and its display, running between streams.
+   * @details Held for `config::video.capture_standby` after the last stream ends, so the next stream
+   *          joins the running capture instead of setting up the display again.
+   */
+  struct capture_standby_t {
+    std::mutex mutex;
+    safe::shared_t<capture_thread_async_ctx_t>::ptr_t ref;  ///< Empty when not on standby
+    int framerate;  ///< Framerate of the stream that started the capture
+    int encodingFramerate;  ///< Display framerate of the stream that started the capture
+    int dynamicRange;  ///< Color depth of the stream that started the capture
+    std::uint64_t generation = 0;  ///< Changed on every hold, so an older release doesn't end a newer standby
+  } capture_standby;
+
+  /**
+   * @brief Stop keeping the capture running for the next stream.
+   * @details The capture thread stops once no stream uses it either.
+   */
+  void release_capture_standby() {
+    safe::shared_t<capture_thread_async_ctx_t>::ptr_t ref;
+    {
+      std::lock_guard lg {capture_standby.mutex};
+      ++capture_standby.generation;
+      ref = std::move(capture_standby.ref);
+    }
+
+    // Ending the capture thread waits for it, so don't hold the lock
+  }
+
+  /**
+   * @brief Release the standby capture if it can't serve a stream.
+   * @param config The video configuration of the stream.
+   */
+  void release_mismatched_capture_standby(const config_t &config) {
+    {
+      std::lock_guard lg {capture_standby.mutex};
+      if (!capture_standby.ref) {
+        return;
+      }
+      if (capture_standby.ref->encoder_p == chosen_encoder &&
+          capture_standby.framerate == config.framerate &&
+          capture_standby.encodingFramerate == config.encodingFramerate &&
+          capture_standby.dynamicRange == config.dynamicRange) {
+        BOOST_LOG(info) << "Joining the capture on standby"sv;
+        return;
+      }
+    }
+
+    BOOST_LOG(info) << "Capture on standby doesn't match the stream, starting a new one"sv;
+    release_capture_standby();
+  }
+
+  /**
+   * @brief Keep the capture running for a while without a stream.
+   * @param ref Reference to the capture thread.
+   * @param config The video configuration the capture was started with.
+   * @param duration How long to keep the capture running.
+   */
+  void hold_capture_standby(safe::shared_t<capture_thread_async_ctx_t>::ptr_t &ref, const config_t &config, std::chrono::seconds duration) {
+    if (duration <= 0s || !ref->capture_ctx_queue->running()) {
+      return;
+    }
+
+    std::uint64_t generation;
+    {
+      std::lock_guard lg {capture_standby.mutex};
+      generation = ++capture_standby.generation;
+      capture_standby.ref = ref;
+      capture_standby.framerate = config.framerate;
+      capture_standby.encodingFramerate = config.encodingFramerate;
+      capture_standby.dynamicRange = config.dynamicRange;
+    }
+
+    task_pool.pushDelayed([generation]() {
+      safe::shared_t<capture_thread_async_ctx_t>::ptr_t ref;
+      {
+        std::lock_guard lg {capture_standby.mutex};
+        if (capture_standby.generation != generation) {
+          return;
+        }
+        ref = std::move(capture_standby.ref);
+      }
+
+      BOOST_LOG(debug) << "Capture standby ended"sv;
+    }, duration);
+  }
+
+  void prewarm_capture(const config_t &config) {
+    // Clients usually announce the stream within a few seconds of the launch
+    constexpr auto prewarm_duration = 20s;
+
+    if (!chosen_encoder || !(chosen_encoder->flags & PARALLEL_ENCODING) || config.input_only) {
+      return;
+    }
+
+    release_mismatched_capture_standby(config);
+
+    auto ref = capture_thread_async.ref();
+    if (!ref) {
+      return;
+    }
+
+    // The capture thread sets up the display for its first context. This one is already
+    // stopped, so it's dropped with the first frame and the capture keeps running without it.
+    auto images = std::make_shared<img_event_t::element_type>();
+    images->stop();
+    ref->capture_ctx_queue->raise(capture_ctx_t {images, config});
+
+    BOOST_LOG(info) << "Preparing the capture for the upcoming stream"sv;
+    hold_capture_standby(ref, config, prewarm_duration);
+  }
+
+  static std::atomic_int synthetic_dirty_percent {100};
+
+  /**
+   * @brief Image of the synthetic display, in system memory.
+   */
+  struct synthetic_img_t: public platf::img_t {
+    std::vector<std::uint8_t> buffer;
+  };
+
+  /**
+   * @brief Display generating a test pattern at the requested framerate, selected with `capture = null`.
+   * @details A band of the frame is redrawn with moving, textured bars every frame and the rest is left
+   *          untouched, which gives the encoder game-like motion without a real display or GPU.
+   *          The images are in system memory, so only software encoding can be used with it.
+   */
+  class synthetic_display_t: public platf::display_t {
+  public:
+    synthetic_display_t(const config_t &config):
+        _delay {std::chrono::nanoseconds {1s} / std::max(config.framerate, 1)},
+        _dirty_percent {std::clamp(synthetic_dirty_percent.load(), 0, 100)} {
+      width = env_width = config.width;
+      height = env_height = config.height;
+
+      // Static gradient behind the moving band
+      _canvas.resize((std::size_t) width * height * 4);
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          auto pixel = &_canvas[((std::size_t) y * width + x) * 4];
+          pixel[0] = (std::uint8_t) (x * 255 / width);
+          pixel[1] = (std::uint8_t) (y * 255 / height);
+          pixel[2] = 0x40;
+          pixel[3] = 0xFF;
+        }
+      }
+    }
+
+    platf::capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+      auto next_frame = std::chrono::steady_clock::now();
+
+      while (true) {
+        std::this_thread::sleep_until(next_frame);
+        next_frame += _delay;
+
+        // Without dirty rows, only the first frame has new content
+        std::shared_ptr<platf::img_t> img_out;
+        if (!_dirty_percent && _frame_index) {
+          if (!push_captured_image_cb(std::move(img_out), false)) {
+            return platf::capture_e::ok;
+          }
+          continue;
+        }
+
+        if (!pull_free_image_cb(img_out)) {
+          return platf::capture_e::interrupted;
+        }
+
+        next_frame(*img_out);
+
+        if (!push_captured_image_cb(std::move(img_out), true)) {
+          return platf::capture_e::ok;
+        }
+      }
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<synthetic_img_t>();
+      img->width = width;
+      img->height = height;
+      img->pixel_pitch = 4;
+      img->row_pitch = img->pixel_pitch * width;
+      img->buffer.resize((std::size_t) img->row_pitch * height);
+      img->data = img->buffer.data();
+
+      return img;
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      std::fill_n(img->data, (std::size_t) img->row_pitch * img->height, 0);
+      return 0;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+    /**
+     * @brief Draw the next frame of the pattern into an image, without pacing.
+     * @param img An image allocated by `alloc_img()`.
+     */
+    void next_frame(platf::img_t &img) {
+      draw_band();
+
+      std::copy(std::begin(_canvas), std::end(_canvas), img.data);
+      img.frame_timestamp = std::chrono::steady_clock::now();
+      img.frame_index = ++_frame_index;
+    }
+
+  private:
+    /**
+     * @brief Redraw the band of the canvas that changes in the next frame.
+     */
+    void draw_band() {
+      auto band_rows = std::max(height * _dirty_percent / 100, 1);
+      auto first_row = (int) ((_frame_index * band_rows / 4) % height);
+      auto shift = (int) (_frame_index * 8);
+
+      for (int row = 0; row < band_rows; ++row) {
+        auto y = (first_row + row) % height;
+        auto line = &_canvas[(std::size_t) y * width * 4];
+
+        for (int x = 0; x < width; ++x) {
+          // Noise gives the bars texture, so the encoder can't collapse them into flat blocks
+          _noise ^= _noise << 13;
+          _noise ^= _noise >> 17;
+          _noise ^= _noise << 5;
+
+          auto bar = ((x + y + shift) / 64) % 2 ? 0xC0 : 0x30;
+          auto value = (std::uint8_t) (bar + (_noise & 0x1F));
+          line[x * 4 + 0] = value;
+          line[x * 4 + 1] = (std::uint8_t) (value ^ 0x55);
+          line[x * 4 + 2] = (std::uint8_t) (255 - value);
+        }
+      }
+    }
+
+    std::chrono::nanoseconds _delay;
+    int _dirty_percent;
+    std::vector<std::uint8_t> _canvas;
+    std::uint64_t _frame_index = 0;
+    std::uint32_t _noise = 0x9E3779B9;
   };
 
+  void set_synthetic_dirty_percent(int percent) {
+    synthetic_dirty_percent = percent;
+  }
+
+  /**
+   * @brief Open a display of the configured capture method.
+   * @param type Memory type for display operations.
+   * @param display_name Name of the display to open.
+   * @param config Video configuration.
+   * @return The display, or `nullptr` on failure.
+   */
+  std::shared_ptr<platf::display_t> open_display(platf::mem_type_e type, const std::string &display_name, const config_t &config) {
+    if (config::video.capture == "null"sv) {
+      if (type != platf::mem_type_e::system) {
+        return nullptr;
+      }
+
+      BOOST_LOG(info) << "Screencasting a synthetic test pattern"sv;
+      return std::make_shared<synthetic_display_t>(config);
+    }
+
+    return platf::display(type, display_name, config);
+  }
+
+  /**
+   * @brief Get the names of the displays of the configured capture method.
+   * @param type Memory type for display operations.
+   * @return The display names.
+   */
+  std::vector<std::string> enumerate_displays(platf::mem_type_e type) {
+    if (config::video.capture == "null"sv) {
+      return {"null"s};
+    }
+
+    return platf::display_names(type);
+  }
+
   /**
    * @brief Reset and reinitialize display device.
    * 
@@ -1396,7 +2494,7 @@ namespace video {
     // We try this twice, in case we still get an error on reinitialization
     for (int x = 0; x < 2; ++x) {
       disp.reset();
-      disp = platf::display(type, display_name, config);
+      disp = open_display(type, display_name, config);
       if (disp) {
         break;
       }
@@ -1425,7 +2523,7 @@ namespace video {
 
     // Refresh the display names
     auto old_display_names = std::move(display_names);
-    display_names = platf::display_names(dev_type);
+    display_names = enumerate_displays(dev_type);
 
     // If we now have no displays, let's put the old display array back and fail
     if (display_names.empty() && !old_display_names.empty()) {
@@ -1509,7 +2607,7 @@ namespace video {
       }
     });
 
-    auto switch_display_event = mail::man->event<int>(mail::switch_display);
+    auto switch_display_event = mail::man->event(mail::switch_display);
 
     // Wait for the initial capture context or a request to stop the queue
     auto initial_capture_ctx = capture_ctx_queue->pop();
@@ -1522,13 +2620,13 @@ namespace video {
     int display_p = -1;
     std::shared_ptr<platf::display_t> disp;
     if (!proc::proc.display_name.empty()) {
-      disp = platf::display(encoder.platform_formats->dev_type, proc::proc.display_name, capture_ctxs.front().config);
+      disp = open_display(encoder.platform_formats->dev_type, proc::proc.display_name, capture_ctxs.front().config);
     }
     if (!disp) {
       // Get all the monitor names now, rather than at boot, to
       // get the most up-to-date list available monitors
       refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
-      disp = platf::display(encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
+      disp = open_display(encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
       if (disp) {
         proc::proc.display_name = display_names[display_p];
       } else {
@@ -1538,6 +2636,9 @@ namespace video {
 
     display_wp = disp;
 
+    // Changes up to here are part of the display we just opened
+    auto topology_generation = platf::display_topology_generation();
+
     constexpr auto capture_buffer_size = 12;
     std::list<std::shared_ptr<platf::img_t>> imgs(capture_buffer_size);
 
@@ -1636,12 +2737,16 @@ namespace video {
     };
 
     // Capture takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    thread_placement::apply(config::thread_stage_e::capture, platf::thread_priority_e::critical);
 
     while (capture_ctx_queue->running()) {
       bool artificial_reinit = false;
 
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        if (frame_captured && img->frame_timestamp) {
+          pipeline_trace::span("capture", *img->frame_timestamp, std::chrono::steady_clock::now());
+        }
+
         KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
           if (!capture_ctx->images->running()) {
             capture_ctx = capture_ctxs.erase(capture_ctx);
@@ -1669,6 +2774,13 @@ namespace video {
           return false;
         }
 
+        // Rebuild the capture as soon as the platform reports a change, rather than when the backend fails on it
+        if (platf::display_topology_generation() != topology_generation) {
+          BOOST_LOG(info) << "Display topology changed, reinitializing capture"sv;
+          artificial_reinit = true;
+          return false;
+        }
+
         return true;
       };
 
@@ -1739,6 +2851,7 @@ namespace video {
             }
 
             display_wp = disp;
+            topology_generation = platf::display_topology_generation();
 
             reinit_event.reset();
             continue;
@@ -1787,8 +2900,8 @@ namespace video {
     }
 
     while (ret >= 0) {
-      auto packet = std::make_unique<packet_raw_avcodec>();
-      auto av_packet = packet.get()->av_packet;
+      auto packet = session.packet_pool->avcodec();
+      auto av_packet = packet->av_packet;
 
       ret = avcodec_receive_packet(ctx.get(), av_packet);
       if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
@@ -1806,6 +2919,10 @@ namespace video {
       }
 
       if (session.inject) {
+        // Encoders emit the parameter sets at the same position in every IDR frame, so
+        // remember where they were found to let the broadcast thread skip the search.
+        std::string_view payload {(char *) av_packet->data, (size_t) av_packet->size};
+
         if (session.inject == 1) {
           auto h264 = cbs::make_sps_h264(ctx.get(), av_packet);
 
@@ -1816,17 +2933,21 @@ namespace video {
           sps = std::move(hevc.sps);
           vps = std::move(hevc.vps);
 
+          std::string_view vps_old((char *) std::begin(vps.old), vps.old.size());
           session.replacements.emplace_back(
-            std::string_view((char *) std::begin(vps.old), vps.old.size()),
-            std::string_view((char *) std::begin(vps._new), vps._new.size())
+            vps_old,
+            std::string_view((char *) std::begin(vps._new), vps._new.size()),
+            payload.find(vps_old)
           );
         }
 
         session.inject = 0;
 
+        std::string_view sps_old((char *) std::begin(sps.old), sps.old.size());
         session.replacements.emplace_back(
-          std::string_view((char *) std::begin(sps.old), sps.old.size()),
-          std::string_view((char *) std::begin(sps._new), sps._new.size())
+          sps_old,
+          std::string_view((char *) std::begin(sps._new), sps._new.size()),
+          payload.find(sps_old)
         );
       }
 
@@ -1836,7 +2957,7 @@ namespace video {
 
       packet->replacements = &session.replacements;
       packet->channel_data = channel_data;
-      packets->raise(std::move(packet));
+      raise_packet(packets, std::move(packet));
     }
 
     return 0;
@@ -1856,6 +2977,14 @@ namespace video {
    * @return 0 on success, negative error code on failure.
    */
   int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+    if (session.pipelined(packets, channel_data)) {
+      if (!session.submit_frame(frame_nr, frame_timestamp)) {
+        BOOST_LOG(error) << "NvENC failed to submit frame";
+        return -1;
+      }
+      return 0;
+    }
+
     auto encoded_frame = session.encode_frame(frame_nr);
     if (encoded_frame.data.empty()) {
       BOOST_LOG(error) << "NvENC returned empty packet";
@@ -1866,11 +2995,13 @@ namespace video {
       BOOST_LOG(error) << "NvENC frame index mismatch " << frame_nr << " " << encoded_frame.frame_index;
     }
 
-    auto packet = std::make_unique<packet_raw_generic>(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
+    auto packet = session.packet_pool->generic(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
     packet->channel_data = channel_data;
     packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
+    packet->temporal_layer = (int) encoded_frame.temporal_layer;
+    packet->droppable = encoded_frame.droppable;
     packet->frame_timestamp = frame_timestamp;
-    packets->raise(std::move(packet));
+    raise_packet(packets, std::move(packet));
 
     return 0;
   }
@@ -1894,10 +3025,210 @@ namespace video {
     } else if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(&session)) {
       return encode_nvenc(frame_nr, *nvenc_session, packets, channel_data, frame_timestamp);
     }
+#ifdef __APPLE__
+    else if (auto vt_session = dynamic_cast<vt_encode_session_t *>(&session)) {
+      if (!vt_session->submit_frame(frame_nr, packets, channel_data, frame_timestamp)) {
+        BOOST_LOG(error) << "VideoToolbox failed to submit frame";
+        return -1;
+      }
+      return 0;
+    }
+#endif
 
     return -1;
   }
 
+  encoder_profile_e encoder_profile_from_view(std::string_view profile) {
+    if (profile == "competitive"sv) {
+      return encoder_profile_e::competitive;
+    }
+    if (profile == "cinematic"sv) {
+      return encoder_profile_e::cinematic;
+    }
+    return encoder_profile_e::none;
+  }
+
+  content_type_e content_type_from_view(std::string_view content_type) {
+    if (content_type == "desktop"sv) {
+      return content_type_e::desktop;
+    }
+    if (content_type == "video"sv) {
+      return content_type_e::video;
+    }
+    return content_type_e::automatic;
+  }
+
+  bool supports_screen_content(std::string_view encoder_name, const config_t &config) {
+    return config.videoFormat == 2 && (encoder_name == "amdvce"sv || encoder_name == "software"sv);
+  }
+
+  std::optional<content_type_e> content_detector_t::add(const platf::img_t &img, std::chrono::steady_clock::time_point now) {
+    if (!window_start) {
+      window_start = now;
+    }
+
+    // An image holding the content of the previous one changed nothing
+    bool repeated = img.frame_index && img.frame_index == last_frame_index;
+    last_frame_index = img.frame_index;
+    if (!repeated) {
+      ++images;
+
+      bool busy = true;
+      if (img.damage_valid && img.width > 0 && img.height > 0) {
+        std::int64_t changed = 0;
+        for (auto &rect : img.damage) {
+          changed += (std::int64_t) std::max(0, rect.right - rect.left) * std::max(0, rect.bottom - rect.top);
+        }
+        busy = changed >= busy_area * img.width * img.height;
+      }
+      busy_images += busy ? 1 : 0;
+    }
+
+    if (now - *window_start < window) {
+      return std::nullopt;
+    }
+
+    auto previous = content_type;
+    if (images > 0) {
+      auto share = (double) busy_images / images;
+      if (share < desktop_share) {
+        content_type = content_type_e::desktop;
+      } else if (share > video_share) {
+        content_type = content_type_e::video;
+      }
+    }
+
+    window_start = now;
+    images = 0;
+    busy_images = 0;
+
+    if (content_type == previous) {
+      return std::nullopt;
+    }
+    return content_type;
+  }
+
+  nvenc::nvenc_config nvenc_config_for_profile(nvenc::nvenc_config config, const config_t &client_config) {
+    switch ((encoder_profile_e) client_config.encoderProfile) {
+      case encoder_profile_e::competitive:
+        config.quality_preset = 1;
+        config.two_pass = nvenc::nvenc_two_pass::disabled;
+        config.intra_refresh = true;
+        break;
+      case encoder_profile_e::cinematic:
+        config.quality_preset = 5;
+        config.two_pass = nvenc::nvenc_two_pass::quarter_resolution;
+        config.adaptive_quantization = true;
+        break;
+      default:
+        break;
+    }
+
+    if (auto settings = client_config.settings) {
+      if (settings->nvenc_preset) {
+        config.quality_preset = *settings->nvenc_preset;
+      }
+      if (settings->nvenc_two_pass) {
+        config.two_pass = *settings->nvenc_two_pass;
+      }
+    }
+
+    // The encoder only takes QP delta maps if it's created for them
+    config.qp_delta_map = roi::mode_from_view(::config::video.roi_mode) != roi::mode_e::disabled;
+    return config;
+  }
+
+  /**
+   * @brief Get the libavcodec options an encoder profile adds on top of the encoder's own.
+   * @param encoder The encoder.
+   * @param config The stream configuration.
+   * @return The options, applied after all others.
+   */
+  static std::vector<encoder_t::option_t> profile_options(const encoder_t &encoder, const config_t &config) {
+    auto profile = (encoder_profile_e) config.encoderProfile;
+    if (profile == encoder_profile_e::none) {
+      return {};
+    }
+
+    auto competitive = profile == encoder_profile_e::competitive;
+    if (encoder.name == "nvenc"sv) {
+      return {
+        {"preset"s, competitive ? "p1"s : "p5"s},
+        {"multipass"s, competitive ? "disabled"s : "qres"s},
+        {"aq"s, competitive ? 0 : 1},
+      };
+    }
+    if (encoder.name == "quicksync"sv) {
+      return {
+        {"preset"s, competitive ? "veryfast"s : "slow"s},
+      };
+    }
+    if (encoder.name == "amdvce"sv) {
+      return {
+        {"quality"s, competitive ? "speed"s : "quality"s},
+      };
+    }
+    return {};
+  }
+
+  /**
+   * @brief Get the libavcodec options of the settings a benchmark measures.
+   * @param encoder The encoder.
+   * @param config The stream configuration.
+   * @return The options, applied after the encoder's own and those of the encoder profile.
+   */
+  static std::vector<encoder_t::option_t> settings_options(const encoder_t &encoder, const config_t &config) {
+    if (!config.settings) {
+      return {};
+    }
+    auto &settings = *config.settings;
+
+    std::vector<encoder_t::option_t> options;
+    if (encoder.name == "software"sv && settings.sw_preset) {
+      if (encoder.codec_from_config(config).name == "libsvtav1"sv) {
+        options.emplace_back("preset"s, config::sw::svtav1_preset_from_view(*settings.sw_preset));
+      } else {
+        options.emplace_back("preset"s, *settings.sw_preset);
+      }
+    }
+#if !defined(_WIN32) && !defined(__APPLE__)
+    if (encoder.name == "nvenc"sv) {
+      // The same values config::update_nv_legacy() derives
+      if (settings.nvenc_preset) {
+        options.emplace_back("preset"s, *settings.nvenc_preset + 11);
+      }
+      if (settings.nvenc_two_pass) {
+        auto two_pass = *settings.nvenc_two_pass;
+        options.emplace_back("multipass"s, two_pass == nvenc::nvenc_two_pass::quarter_resolution ? NV_ENC_TWO_PASS_QUARTER_RESOLUTION :
+                                           two_pass == nvenc::nvenc_two_pass::full_resolution    ? NV_ENC_TWO_PASS_FULL_RESOLUTION :
+                                                                                                   NV_ENC_MULTI_PASS_DISABLED);
+      }
+    }
+#endif
+    return options;
+  }
+
+  /**
+   * @brief Get the libavcodec options that turn on the screen content tools for desktop content.
+   * @details libsvtav1 gets its screen content mode with the rest of its parameters.
+   * @param encoder The encoder.
+   * @param config The stream configuration.
+   * @return The options, applied after all others.
+   */
+  static std::vector<encoder_t::option_t> content_options(const encoder_t &encoder, const config_t &config) {
+    if (config.contentType != (int) content_type_e::desktop || !supports_screen_content(encoder.name, config)) {
+      return {};
+    }
+
+    if (encoder.name == "amdvce"sv) {
+      return {
+        {"screen_content_tools"s, 1},
+        {"palette_mode"s, 1},
+      };
+    }
+    return {};
+  }
+
   /**
    * @brief Create AVCodec encoding session.
    * 
@@ -2088,7 +3419,7 @@ namespace video {
         // Clients will request for the fewest slices per frame to get the
         // most efficient encode, but we may want to provide more slices than
         // requested to ensure we have enough parallelism for good performance.
-        ctx->slices = std::max(config.slicesPerFrame, config::video.min_threads);
+        ctx->slices = std::max(config.slicesPerFrame, min_threads(config));
       }
 
       if (encoder.flags & SINGLE_SLICE_ONLY) {
@@ -2149,6 +3480,15 @@ namespace video {
           handle_option(option);
         }
       }
+      for (auto &option : profile_options(encoder, config)) {
+        handle_option(option);
+      }
+      for (auto &option : settings_options(encoder, config)) {
+        handle_option(option);
+      }
+      for (auto &option : content_options(encoder, config)) {
+        handle_option(option);
+      }
 
       auto bitrate = config.bitrate * 1000;
       ctx->rc_max_rate = bitrate;
@@ -2257,7 +3597,7 @@ namespace video {
     if (!encode_device->data) {
       auto software_encode_device = std::make_unique<avcodec_software_encode_device_t>();
 
-      if (software_encode_device->init(width, height, frame.get(), sw_fmt, hardware)) {
+      if (software_encode_device->init(width, height, frame.get(), sw_fmt, hardware, min_threads(config))) {
         return nullptr;
       }
       software_encode_device->colorspace = colorspace;
@@ -2280,6 +3620,8 @@ namespace video {
       // 0 ==> don't inject, 1 ==> inject for h264, 2 ==> inject for hevc
       config.videoFormat <= 1 ? (1 - (int) video_format[encoder_t::VUI_PARAMETERS]) * (1 + config.videoFormat) : 0
     );
+    session->roi_mode = roi::mode_from_view(::config::video.roi_mode);
+    session->roi_strength = ::config::video.roi_strength;
 
     return session;
   }
@@ -2299,8 +3641,40 @@ namespace video {
       return nullptr;
     }
 
-    return std::make_unique<nvenc_encode_session_t>(std::move(encode_device));
+    auto session = std::make_unique<nvenc_encode_session_t>(std::move(encode_device));
+    if (auto mode = roi::mode_from_view(config::video.roi_mode); mode != roi::mode_e::disabled) {
+      session->set_roi(mode, config::video.roi_strength, client_config);
+    }
+    return session;
+  }
+
+#ifdef __APPLE__
+  /**
+   * @brief Create native VideoToolbox encoding session.
+   *
+   * @param client_config Video encoding configuration.
+   * @param width Frame width.
+   * @param height Frame height.
+   * @param encode_device Encode device (moved).
+   * @return Unique pointer to VideoToolbox session, or nullptr on failure.
+   */
+  std::unique_ptr<vt_encode_session_t> make_vt_encode_session(const config_t &client_config, int width, int height, std::unique_ptr<platf::avcodec_encode_device_t> encode_device) {
+    // The device only fills data[3] of the frame, which also sets the capture resolution
+    auto frame = av_frame_alloc();
+    frame->width = width;
+    frame->height = height;
+    if (encode_device->set_frame(frame, nullptr)) {
+      return nullptr;
+    }
+
+    auto session = std::make_unique<vt_encode_session_t>(std::move(encode_device));
+    if (!session->init(client_config, width, height)) {
+      return nullptr;
+    }
+
+    return session;
   }
+#endif
 
   /**
    * @brief Create encoding session (polymorphic factory).
@@ -2317,6 +3691,14 @@ namespace video {
    * @return Unique pointer to encoding session, or nullptr on failure.
    */
   std::unique_ptr<encode_session_t> make_encode_session(platf::display_t *disp, const encoder_t &encoder, const config_t &config, int width, int height, std::unique_ptr<platf::encode_device_t> encode_device) {
+#ifdef __APPLE__
+    // The native encoder shares the avcodec encode device that captures into CVPixelBuffers
+    if (dynamic_cast<const encoder_platform_formats_vt *>(encoder.platform_formats.get())) {
+      auto avcodec_encode_device = boost::dynamic_pointer_cast<platf::avcodec_encode_device_t>(std::move(encode_device));
+      return avcodec_encode_device ? make_vt_encode_session(config, width, height, std::move(avcodec_encode_device)) : nullptr;
+    }
+#endif
+
     if (dynamic_cast<platf::avcodec_encode_device_t *>(encode_device.get())) {
       auto avcodec_encode_device = boost::dynamic_pointer_cast<platf::avcodec_encode_device_t>(std::move(encode_device));
       return make_avcodec_encode_session(disp, encoder, config, width, height, std::move(avcodec_encode_device));
@@ -2328,6 +3710,60 @@ namespace video {
     return nullptr;
   }
 
+  std::unique_ptr<platf::encode_device_t> make_encode_device(platf::display_t &disp, const encoder_t &encoder, const config_t &config);
+
+  /**
+   * @brief Hash the pixels of an image in system memory.
+   * @param img The image, `img.data` must be set.
+   * @return A 64-bit hash of the visible pixels, padding bytes are ignored.
+   */
+  static std::uint64_t hash_image(const platf::img_t &img) {
+    constexpr std::uint64_t prime = 0x100000001b3;
+
+    // Independent lanes keep the multiplies from serializing
+    std::uint64_t lanes[4] {0xcbf29ce484222325, 0x84222325cbf29ce4, 0x9e3779b97f4a7c15, 0x7f4a7c159e3779b9};
+
+    auto row_size = (std::size_t) img.width * img.pixel_pitch;
+    for (int y = 0; y < img.height; ++y) {
+      auto row = img.data + (std::size_t) y * img.row_pitch;
+
+      std::size_t x = 0;
+      for (; x + sizeof(lanes) <= row_size; x += sizeof(lanes)) {
+        std::uint64_t words[4];
+        std::memcpy(words, row + x, sizeof(words));
+        for (int lane = 0; lane < 4; ++lane) {
+          lanes[lane] = (lanes[lane] ^ words[lane]) * prime;
+        }
+      }
+      for (; x < row_size; ++x) {
+        lanes[0] = (lanes[0] ^ row[x]) * prime;
+      }
+    }
+
+    return lanes[0] ^ std::rotl(lanes[1], 16) ^ std::rotl(lanes[2], 32) ^ std::rotl(lanes[3], 48);
+  }
+
+  /**
+   * @brief An encoder kept across a capture reinitialization, to be rebound to the new display.
+   */
+  struct kept_encoder_t {
+    std::unique_ptr<encode_session_t> session;
+    config_t config;  ///< Config of the session, including the bitrate and ladder changes it went through
+    std::string binding;  ///< Binding of the display the session was made for, see `platf::display_t::encoder_binding()`
+    int width;
+    int height;
+    bool hdr;
+
+    /**
+     * @brief Check if the session can encode the images of a display.
+     * @param disp The display.
+     * @return `true` if the display has the same binding, size and dynamic range.
+     */
+    bool fits(platf::display_t &disp) const {
+      return session && disp.encoder_binding() == binding && disp.width == width && disp.height == height && disp.is_hdr() == hdr;
+    }
+  };
+
   /**
    * @brief Main encoding loop for asynchronous capture.
    * 
@@ -2339,10 +3775,12 @@ namespace video {
    * @param images Event channel for captured images.
    * @param config Video encoding configuration.
    * @param disp Display device.
-   * @param encode_device Encode device.
+   * @param encode_device Encode device, unused when a kept encoder is rebound.
    * @param reinit_event Signal event for reinitialization requests.
    * @param encoder Encoder configuration.
    * @param channel_data Channel-specific data pointer.
+   * @param bitrate_target Bitrate requested by the control thread.
+   * @param kept Encoder to use instead of a new one, and where the encoder is kept when only the capture has to be rebuilt.
    */
   void encode_run(
     int &frame_nr,  // Store progress of the frame number
@@ -2353,9 +3791,17 @@ namespace video {
     std::unique_ptr<platf::encode_device_t> encode_device,
     safe::signal_t &reinit_event,
     const encoder_t &encoder,
-    void *channel_data
+    void *channel_data,
+    bitrate_target_t &bitrate_target,
+    kept_encoder_t &kept
   ) {
-    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
+    std::unique_ptr<encode_session_t> session;
+    if (kept.session) {
+      session = std::move(kept.session);
+      session->rebind();
+    } else {
+      session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
+    }
     if (!session) {
       return;
     }
@@ -2367,7 +3813,7 @@ namespace video {
     // hang occurs, this thread may probably never exit, but it will allow
     // streaming to continue without requiring a full restart of Sunshine.
     auto fail_guard = util::fail_guard([&encoder, &session] {
-      if (encoder.flags & ASYNC_TEARDOWN) {
+      if (session && encoder.flags & ASYNC_TEARDOWN) {
         std::thread encoder_teardown_thread {[session = std::move(session)]() mutable {
           BOOST_LOG(info) << "Starting async encoder teardown";
           session.reset();
@@ -2377,21 +3823,53 @@ namespace video {
       }
     });
 
-    // set max frame time based on client-requested target framerate.
-    double minimum_fps_target = (config::video.minimum_fps_target > 0.0) ? config::video.minimum_fps_target * 1000 : std::max(config.encodingFramerate / 5, 10000);
-    auto max_frametime = std::chrono::nanoseconds(1000ms) * 1000 / minimum_fps_target;
-    auto encode_frame_threshold = std::chrono::nanoseconds(1000ms) * 1000 / config.encodingFramerate;
-    auto frame_variation_threshold = encode_frame_threshold / 4;
-    auto min_frame_diff = encode_frame_threshold - frame_variation_threshold;
-    BOOST_LOG(info) << "Minimum FPS target set to ~"sv << (minimum_fps_target / 2000) << "fps ("sv << max_frametime * 2 << ")"sv;
-    BOOST_LOG(info) << "Encoding Frame threshold: "sv << encode_frame_threshold;
-
-    auto shutdown_event = mail->event<bool>(mail::shutdown);
-    auto packets = mail::man->queue<packet_t>(mail::video_packets);
-    auto idr_events = mail->event<bool>(mail::idr);
-    auto invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
-    auto bitrate_change_events = mail->event<int>(mail::bitrate_change);
-    auto bitrate_change_confirmation_events = mail->event<std::pair<int, bool>>(mail::bitrate_change_confirmation);
+    // When the capture is reinitialized, the encoder outlives the display if its devices don't
+    // depend on it. It's rebound to the new display if that ends up with the same geometry.
+    auto keep_guard = util::fail_guard([&]() {
+      if (!reinit_event.peek() || !images->running()) {
+        return;
+      }
+
+      if (auto binding = disp->encoder_binding()) {
+        kept = kept_encoder_t {std::move(session), config, std::move(*binding), disp->width, disp->height, disp->is_hdr()};
+      }
+    });
+
+    double minimum_fps_target;
+    std::chrono::duration<double, std::nano> max_frametime;
+    std::chrono::nanoseconds encode_frame_threshold;
+    std::chrono::nanoseconds frame_variation_threshold;
+
+    // set max frame time based on client-requested target framerate, again when the resolution ladder changes it
+    auto set_frame_pacing = [&]() {
+      minimum_fps_target = (config::video.minimum_fps_target > 0.0) ? config::video.minimum_fps_target * 1000 : std::max(config.encodingFramerate / 5, 10000);
+      max_frametime = std::chrono::nanoseconds(1000ms) * 1000 / minimum_fps_target;
+      encode_frame_threshold = std::chrono::nanoseconds(1000ms) * 1000 / config.encodingFramerate;
+      frame_variation_threshold = encode_frame_threshold / 4;
+      BOOST_LOG(info) << "Minimum FPS target set to ~"sv << (minimum_fps_target / 2000) << "fps ("sv << max_frametime * 2 << ")"sv;
+      BOOST_LOG(info) << "Encoding Frame threshold: "sv << encode_frame_threshold;
+    };
+    set_frame_pacing();
+
+    // Once the content stayed unchanged for static_settle_time, unchanged frames are only encoded as keepalives
+    const bool skip_static_content = config::video.static_content_fps > 0.0;
+    const auto static_settle_time = 1s;
+    const auto static_frametime = skip_static_content ? std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(1.0 / config::video.static_content_fps)) : max_frametime;
+    if (skip_static_content) {
+      BOOST_LOG(info) << "Static content keepalive interval: "sv << static_frametime;
+    }
+
+    auto shutdown_event = mail->event(mail::shutdown);
+    auto packets = mail::man->queue(mail::video_packets);
+    auto idr_events = mail->event(mail::idr);
+    auto invalidate_ref_frames_events = mail->event(mail::invalidate_ref_frames);
+    auto ladder_change_events = mail->event(mail::ladder_change);
+    auto ladder_change_confirmation_events = mail->event(mail::ladder_change_confirmation);
+    auto fps_divisor_events = mail->event(mail::fps_divisor);
+
+    // Captured frames are dropped down to this fraction of the framerate while the host is overloaded
+    int fps_divisor = 1;
+    std::chrono::steady_clock::time_point last_kept_timestamp;
 
     {
       // Load a dummy image into the AVFrame to ensure we have something to encode
@@ -2424,32 +3902,149 @@ namespace video {
 
     std::chrono::steady_clock::time_point encode_frame_timestamp;
 
-    while (true) {
-      // Check for bitrate change requests
-      if (bitrate_change_events->peek()) {
-        if (auto new_bitrate = bitrate_change_events->pop(0ms)) {
-          bool reconfigured = false;
-
-          // Try to reconfigure based on encoder type
-          if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t*>(session.get())) {
-            reconfigured = nvenc_session->reconfigure_bitrate(*new_bitrate);
-          }
-          // Future: Add support for other encoders (AMD, QuickSync, etc.)
-          // else if (auto amd_session = dynamic_cast<amdvce_encode_session_t*>(session.get())) {
-          //   reconfigured = amd_session->reconfigure_bitrate(*new_bitrate);
-          // }
+    // Weak, so the capture pool can still reuse the image. Only needed to seed a replacement session.
+    std::weak_ptr<platf::img_t> last_img;
+
+    // Identity of the last converted content, used to detect static content
+    std::uint64_t last_frame_index = 0;
+    std::optional<std::uint64_t> last_img_hash;
+    std::optional<std::chrono::steady_clock::time_point> unchanged_since;
+    auto last_encode_time = std::chrono::steady_clock::now();
+
+    // Returns true if the image is known to hold the same content as the last converted one
+    auto is_unchanged = [&](const platf::img_t &img) {
+      if (img.frame_index) {
+        bool unchanged = img.frame_index == last_frame_index;
+        last_frame_index = img.frame_index;
+        last_img_hash.reset();
+        return unchanged;
+      }
+
+      last_frame_index = 0;
+      if (!img.data) {
+        last_img_hash.reset();
+        return false;
+      }
+
+      auto hash = hash_image(img);
+      bool unchanged = last_img_hash == hash;
+      last_img_hash = hash;
+      return unchanged;
+    };
+
+    // Rebuild the encoder with a new config while the display and the capture thread keep running,
+    // the convert stage scales the captured images to the new resolution
+    // Convert the last image again for a session with a new geometry, it's encoded again if no other image comes
+    auto convert_last_img = [&](encode_session_t &target) {
+      if (auto img = last_img.lock()) {
+        return target.convert(*img) == 0;
+      }
+
+      auto dummy_img = disp->alloc_img();
+      return dummy_img && !disp->dummy_img(dummy_img.get()) && !target.convert(*dummy_img);
+    };
+
+    // Frames left until the bitrate is back up after a capped first frame
+    constexpr int startup_ramp_frames = 4;
+    int startup_ramp = 0;
+
+    auto swap_session = [&](const config_t &new_config) {
+      auto new_session = make_encode_session(disp.get(), encoder, new_config, disp->width, disp->height, make_encode_device(*disp, encoder, new_config));
+      if (!new_session || !convert_last_img(*new_session)) {
+        return false;
+      }
+
+      // The new session already runs at the full bitrate
+      startup_ramp = 0;
 
+      // The old session goes through the same teardown path as at the end of the stream
+      std::swap(session, new_session);
+      if (encoder.flags & ASYNC_TEARDOWN) {
+        std::thread {[new_session = std::move(new_session)]() mutable {
+          new_session.reset();
+        }}.detach();
+      }
+
+      session->request_idr_frame();
+      return true;
+    };
+
+    // An automatic content type starts out as video, the encoder is rebuilt whenever the detector settles on another
+    const bool detect_content = config.contentType == (int) content_type_e::automatic && supports_screen_content(encoder.name, config);
+    content_detector_t content_detector;
+
+    auto &capture_histogram = metrics::histogram("capture"sv);
+    auto &convert_histogram = metrics::histogram("convert"sv);
+    auto &encode_histogram = metrics::histogram("encode"sv);
+
+    // Cap the size of the first IDR frame of the stream, so it reaches the client sooner
+    auto first_frame_bitrate = config::video.first_frame_bitrate;
+    if (frame_nr == 1 && first_frame_bitrate > 0 && first_frame_bitrate < 100) {
+      if (session->reconfigure_bitrate(std::max(1, config.bitrate * first_frame_bitrate / 100))) {
+        BOOST_LOG(debug) << "Video: Encoding the first frame at "sv << first_frame_bitrate << "% of the bitrate"sv;
+        startup_ramp = startup_ramp_frames;
+      }
+    }
+
+    while (true) {
+      // Check for bitrate change requests, a single atomic load when there is none
+      if (auto new_bitrate = bitrate_target.take()) {
+        // The requested bitrate replaces the ramp
+        startup_ramp = 0;
+
+        bool reconfigured = session->reconfigure_bitrate(*new_bitrate);
+        if (reconfigured) {
+          BOOST_LOG(info) << "Video: Encoder accepted bitrate change to " << *new_bitrate << " Kbps";
+        } else {
+          // Fall back to a new encoder session, which still avoids a full capture restart
+          auto new_config = config;
+          new_config.bitrate = *new_bitrate;
+          reconfigured = swap_session(new_config);
           if (reconfigured) {
-            config.bitrate = *new_bitrate;
-            BOOST_LOG(info) << "Video: Encoder accepted bitrate change to " << *new_bitrate << " Kbps";
+            BOOST_LOG(info) << "Video: Recreated encoder for bitrate change to " << *new_bitrate << " Kbps";
           } else {
-            BOOST_LOG(info) << "Video: Encoder rejected bitrate change to " 
-                            << *new_bitrate << " Kbps (encoder may not support dynamic bitrate)";
+            BOOST_LOG(info) << "Video: Encoder rejected bitrate change to " << *new_bitrate << " Kbps";
           }
+        }
+
+        if (reconfigured) {
+          config.bitrate = *new_bitrate;
+        }
+
+        // Let the control thread update its state only after the encoder has applied the change
+        bitrate_target.complete(*new_bitrate, reconfigured);
+      }
+
+      if (auto step = ladder_change_events->pop(0ms)) {
+        auto new_config = config;
+        new_config.width = step->width;
+        new_config.height = step->height;
+        new_config.framerate = step->framerate;
+        new_config.encodingFramerate = step->encodingFramerate;
+
+        // Resize the encoder in place when it can, keeping its surfaces and the capture pipeline
+        bool resized = session->reconfigure_resolution(new_config) && convert_last_img(*session);
+        if (resized) {
+          session->request_idr_frame();
+        }
+
+        bool reconfigured = resized || swap_session(new_config);
+        if (reconfigured) {
+          BOOST_LOG(info) << "Video: "sv << (resized ? "Resized"sv : "Switched"sv) << " encoder to "sv << step->width << 'x' << step->height << 'x' << step->framerate;
+          config = new_config;
+          set_frame_pacing();
+        } else {
+          BOOST_LOG(info) << "Video: Couldn't switch encoder to "sv << step->width << 'x' << step->height << 'x' << step->framerate;
+        }
+        ladder_change_confirmation_events->raise(reconfigured);
+      }
 
-          // Send confirmation back to control thread so it can update its state
-          // only after the encoder has successfully applied the change
-          bitrate_change_confirmation_events->raise(std::make_pair(*new_bitrate, reconfigured));
+      if (auto divisor = fps_divisor_events->pop(0ms)) {
+        fps_divisor = std::max(*divisor, 1);
+        if (fps_divisor > 1) {
+          BOOST_LOG(info) << "Video: Host is overloaded, encoding at 1/"sv << fps_divisor << " of the framerate"sv;
+        } else {
+          BOOST_LOG(info) << "Video: Encoding at the full framerate again"sv;
         }
       }
 
@@ -2483,12 +4078,18 @@ namespace video {
 
       std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
 
+      const bool static_content = skip_static_content && unchanged_since && std::chrono::steady_clock::now() - *unchanged_since >= static_settle_time;
+
       // Encode at a minimum FPS to avoid image quality issues with static content
       if (!requested_idr_frame || images->peek()) {
-        if (auto img = images->pop(max_frametime)) {
+        if (auto img = images->pop(static_content ? static_frametime : max_frametime)) {
+          last_img = img;
           frame_timestamp = img->frame_timestamp;
           if (!frame_timestamp) {
             frame_timestamp = std::chrono::steady_clock::now();
+          } else {
+            // Time from capture until the encoder picks up the image
+            capture_histogram.record(std::chrono::steady_clock::now() - *frame_timestamp);
           }
 
           auto current_timestamp = *frame_timestamp;
@@ -2499,12 +4100,53 @@ namespace video {
             continue;
           }
 
+          // Shed the frames in between while the host is overloaded
+          if (fps_divisor > 1 && !requested_idr_frame && current_timestamp - last_kept_timestamp < encode_frame_threshold * fps_divisor - frame_variation_threshold) {
+            continue;
+          }
+          last_kept_timestamp = current_timestamp;
+
+          if (detect_content) {
+            if (auto content_type = content_detector.add(*img, current_timestamp)) {
+              auto new_config = config;
+              new_config.contentType = (int) *content_type;
+
+              auto desktop = *content_type == content_type_e::desktop;
+              if (swap_session(new_config)) {
+                BOOST_LOG(info) << "Video: Detected "sv << (desktop ? "desktop content, encoding with"sv : "video, encoding without"sv) << " screen content tools"sv;
+                config = new_config;
+              } else {
+                BOOST_LOG(info) << "Video: Detected "sv << (desktop ? "desktop content"sv : "video"sv) << ", but couldn't rebuild the encoder"sv;
+              }
+            }
+          }
+
+          if (skip_static_content) {
+            if (!is_unchanged(*img)) {
+              unchanged_since.reset();
+            } else {
+              if (!unchanged_since) {
+                unchanged_since = std::chrono::steady_clock::now();
+              }
+
+              // Skip repeated frames of static content until the next keepalive is due
+              if (static_content && !requested_idr_frame && std::chrono::steady_clock::now() - last_encode_time < static_frametime) {
+                continue;
+              }
+            }
+          }
+
+          auto convert_start = std::chrono::steady_clock::now();
           if (session->convert(*img)) {
             BOOST_LOG(error) << "Could not convert image"sv;
             break;
           }
+          auto convert_end = std::chrono::steady_clock::now();
+          convert_histogram.record(convert_end - convert_start);
+          pipeline_trace::span("convert", convert_start, convert_end, frame_nr);
 
-          if (time_diff < frame_variation_threshold) {
+          // Frames on time are timestamped on the frame grid, unless they keep the time they were presented at
+          if (time_diff < frame_variation_threshold && !config::video.capture_variable_framerate) {
             *frame_timestamp = encode_frame_timestamp;
           } else {
             encode_frame_timestamp = current_timestamp;
@@ -2513,15 +4155,32 @@ namespace video {
           encode_frame_timestamp += encode_frame_threshold;
         } else if (!images->running()) {
           break;
+        } else if (skip_static_content && !unchanged_since) {
+          // Nothing was captured, so the content is unchanged
+          unchanged_since = std::chrono::steady_clock::now();
         }
       }
 
-      if (encode(frame_nr++, *session, packets, channel_data, frame_timestamp)) {
+      auto encode_start = std::chrono::steady_clock::now();
+      if (encode(frame_nr, *session, packets, channel_data, frame_timestamp)) {
         BOOST_LOG(error) << "Could not encode video packet"sv;
         break;
       }
+      auto encode_end = std::chrono::steady_clock::now();
+      encode_histogram.record(encode_end - encode_start);
+      pipeline_trace::span("encode", encode_start, encode_end, frame_nr++);
+      last_encode_time = encode_start;
 
       session->request_normal_frame();
+
+      // Ramp the bitrate back up in even steps, the P-frames refine the image of the capped IDR frame
+      if (startup_ramp > 0) {
+        --startup_ramp;
+        auto percent = first_frame_bitrate + (100 - first_frame_bitrate) * (startup_ramp_frames - startup_ramp) / startup_ramp_frames;
+        if (!session->reconfigure_bitrate(std::max(1, config.bitrate * percent / 100))) {
+          startup_ramp = 0;
+        }
+      }
     }
   }
 
@@ -2618,6 +4277,8 @@ namespace video {
       result = disp.make_avcodec_encode_device(pix_fmt);
     } else if (dynamic_cast<const encoder_platform_formats_nvenc *>(encoder.platform_formats.get())) {
       result = disp.make_nvenc_encode_device(pix_fmt);
+    } else if (dynamic_cast<const encoder_platform_formats_vt *>(encoder.platform_formats.get())) {
+      result = disp.make_avcodec_encode_device(pix_fmt);
     }
 
     if (result) {
@@ -2689,7 +4350,7 @@ namespace video {
 
     std::shared_ptr<platf::display_t> disp;
 
-    auto switch_display_event = mail::man->event<int>(mail::switch_display);
+    auto switch_display_event = mail::man->event(mail::switch_display);
 
     if (synced_session_ctxs.empty()) {
       auto ctx = encode_session_ctx_queue.pop();
@@ -2720,11 +4381,17 @@ namespace video {
       return encode_e::error;
     }
 
-    auto img = disp->alloc_img();
-    if (!img || disp->dummy_img(img.get())) {
+    auto topology_generation = platf::display_topology_generation();
+
+    sync_frame_handoff_t handoff;
+    handoff.imgs = {disp->alloc_img(), disp->alloc_img()};
+    if (!handoff.imgs[0] || !handoff.imgs[1] || disp->dummy_img(handoff.imgs[0].get())) {
       return encode_e::error;
     }
 
+    // The encoding loop starts with the dummy image, the capture backend fills the other slot
+    auto img = handoff.encoding = handoff.imgs[0];
+
     std::vector<sync_session_t> synced_sessions;
     for (auto &ctx : synced_session_ctxs) {
       auto synced_session = make_synced_session(disp.get(), encoder, *img, *ctx);
@@ -2735,99 +4402,179 @@ namespace video {
       synced_sessions.emplace_back(std::move(*synced_session));
     }
 
+    auto &convert_histogram = metrics::histogram("convert"sv);
+    auto &encode_histogram = metrics::histogram("encode"sv);
+
     auto ec = platf::capture_e::ok;
-    while (encode_session_ctx_queue.running()) {
-      auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
-        while (encode_session_ctx_queue.peek()) {
-          auto encode_session_ctx = encode_session_ctx_queue.pop();
-          if (!encode_session_ctx) {
-            return false;
-          }
+    auto encode_frame = [&](bool frame_captured) -> bool {
+      while (encode_session_ctx_queue.peek()) {
+        auto encode_session_ctx = encode_session_ctx_queue.pop();
+        if (!encode_session_ctx) {
+          return false;
+        }
+
+        synced_session_ctxs.emplace_back(std::make_unique<sync_session_ctx_t>(std::move(*encode_session_ctx)));
 
-          synced_session_ctxs.emplace_back(std::make_unique<sync_session_ctx_t>(std::move(*encode_session_ctx)));
+        auto encode_session = make_synced_session(disp.get(), encoder, *img, *synced_session_ctxs.back());
+        if (!encode_session) {
+          ec = platf::capture_e::error;
+          return false;
+        }
+
+        synced_sessions.emplace_back(std::move(*encode_session));
+      }
 
-          auto encode_session = make_synced_session(disp.get(), encoder, *img, *synced_session_ctxs.back());
-          if (!encode_session) {
-            ec = platf::capture_e::error;
+      KITTY_WHILE_LOOP(auto pos = std::begin(synced_sessions), pos != std::end(synced_sessions), {
+        auto ctx = pos->ctx;
+        if (ctx->shutdown_event->peek()) {
+          // Let waiting thread know it can delete shutdown_event
+          ctx->join_event->raise(true);
+
+          pos = synced_sessions.erase(pos);
+          synced_session_ctxs.erase(std::find_if(std::begin(synced_session_ctxs), std::end(synced_session_ctxs), [&ctx_p = ctx](auto &ctx) {
+            return ctx.get() == ctx_p;
+          }));
+
+          if (synced_sessions.empty()) {
             return false;
           }
 
-          synced_sessions.emplace_back(std::move(*encode_session));
+          continue;
         }
 
-        KITTY_WHILE_LOOP(auto pos = std::begin(synced_sessions), pos != std::end(synced_sessions), {
-          auto ctx = pos->ctx;
-          if (ctx->shutdown_event->peek()) {
-            // Let waiting thread know it can delete shutdown_event
-            ctx->join_event->raise(true);
+        if (ctx->idr_events->peek()) {
+          pos->session->request_idr_frame();
+          ctx->idr_events->pop();
+        }
 
-            pos = synced_sessions.erase(pos);
-            synced_session_ctxs.erase(std::find_if(std::begin(synced_session_ctxs), std::end(synced_session_ctxs), [&ctx_p = ctx](auto &ctx) {
-              return ctx.get() == ctx_p;
-            }));
+        auto convert_start = std::chrono::steady_clock::now();
+        if (frame_captured && pos->session->convert(*img)) {
+          BOOST_LOG(error) << "Could not convert image"sv;
+          ctx->shutdown_event->raise(true);
 
-            if (synced_sessions.empty()) {
-              return false;
-            }
+          continue;
+        }
+        if (frame_captured) {
+          auto convert_end = std::chrono::steady_clock::now();
+          convert_histogram.record(convert_end - convert_start);
+          pipeline_trace::span("convert", convert_start, convert_end, ctx->frame_nr);
+        }
 
-            continue;
-          }
+        std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+        if (img) {
+          frame_timestamp = img->frame_timestamp;
+        }
 
-          if (ctx->idr_events->peek()) {
-            pos->session->request_idr_frame();
-            ctx->idr_events->pop();
-          }
+        auto encode_start = std::chrono::steady_clock::now();
+        if (encode(ctx->frame_nr, *pos->session, ctx->packets, ctx->channel_data, frame_timestamp)) {
+          BOOST_LOG(error) << "Could not encode video packet"sv;
+          ctx->shutdown_event->raise(true);
 
-          if (frame_captured && pos->session->convert(*img)) {
-            BOOST_LOG(error) << "Could not convert image"sv;
-            ctx->shutdown_event->raise(true);
+          continue;
+        }
+        auto encode_end = std::chrono::steady_clock::now();
+        encode_histogram.record(encode_end - encode_start);
+        pipeline_trace::span("encode", encode_start, encode_end, ctx->frame_nr++);
 
-            continue;
-          }
+        pos->session->request_normal_frame();
 
-          std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
-          if (img) {
-            frame_timestamp = img->frame_timestamp;
-          }
+        ++pos;
+      })
 
-          if (encode(ctx->frame_nr++, *pos->session, ctx->packets, ctx->channel_data, frame_timestamp)) {
-            BOOST_LOG(error) << "Could not encode video packet"sv;
-            ctx->shutdown_event->raise(true);
+      if (switch_display_event->peek()) {
+        ec = platf::capture_e::reinit;
+        return false;
+      }
 
-            continue;
-          }
+      if (platf::display_topology_generation() != topology_generation) {
+        BOOST_LOG(info) << "Display topology changed, reinitializing capture"sv;
+        ec = platf::capture_e::reinit;
+        return false;
+      }
 
-          pos->session->request_normal_frame();
+      return true;
+    };
 
-          ++pos;
-        })
+    // Capture runs on its own thread so the next frame is captured while this one is encoded
+    std::thread capture_thread {[&]() {
+      auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        if (frame_captured && img->frame_timestamp) {
+          pipeline_trace::span("capture", *img->frame_timestamp, std::chrono::steady_clock::now());
+        }
 
-        if (switch_display_event->peek()) {
-          ec = platf::capture_e::reinit;
-          return false;
+        std::lock_guard lg {handoff.lock};
+        if (frame_captured) {
+          handoff.captured = std::move(img);
+          handoff.frame_captured = true;
         }
+        handoff.pending = true;
+        handoff.cv.notify_one();
 
-        return true;
+        return !handoff.stopped;
       };
 
-      auto pull_free_image_callback = [&img](std::shared_ptr<platf::img_t> &img_out) -> bool {
-        img_out = img;
+      auto pull_free_image_callback = [&](std::shared_ptr<platf::img_t> &img_out) -> bool {
+        std::lock_guard lg {handoff.lock};
+        if (handoff.stopped) {
+          return false;
+        }
+
+        img_out = handoff.imgs[0] == handoff.encoding ? handoff.imgs[1] : handoff.imgs[0];
+        if (img_out == handoff.captured) {
+          // The encoding loop is behind, drop the frame it hasn't picked up yet
+          handoff.captured.reset();
+          handoff.frame_captured = false;
+        }
         img_out->frame_timestamp.reset();
         return true;
       };
 
+      thread_placement::apply(config::thread_stage_e::capture, platf::thread_priority_e::high);
+
       auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, &display_cursor);
-      switch (status) {
-        case platf::capture_e::reinit:
-        case platf::capture_e::error:
-        case platf::capture_e::ok:
-        case platf::capture_e::timeout:
-        case platf::capture_e::interrupted:
-          return ec != platf::capture_e::ok ? ec : status;
+
+      std::lock_guard lg {handoff.lock};
+      handoff.capture_status = status;
+      handoff.capture_done = true;
+      handoff.cv.notify_one();
+    }};
+
+    while (encode_session_ctx_queue.running()) {
+      bool frame_captured;
+      {
+        std::unique_lock ul {handoff.lock};
+
+        // Wake up periodically to notice a stopped session queue while no frames arrive
+        if (!handoff.cv.wait_for(ul, 100ms, [&]() {
+              return handoff.pending || handoff.capture_done;
+            })) {
+          continue;
+        }
+        if (!handoff.pending) {
+          break;
+        }
+
+        handoff.pending = false;
+        frame_captured = std::exchange(handoff.frame_captured, false);
+        if (frame_captured) {
+          // The previously encoded image becomes the capture backend's free slot
+          handoff.encoding = std::move(handoff.captured);
+          img = handoff.encoding;
+        }
+      }
+
+      if (!encode_frame(frame_captured)) {
+        break;
       }
     }
 
-    return encode_e::ok;
+    {
+      std::lock_guard lg {handoff.lock};
+      handoff.stopped = true;
+    }
+    capture_thread.join();
+
+    return ec != platf::capture_e::ok ? ec : handoff.capture_status;
   }
 
   /**
@@ -2856,8 +4603,8 @@ namespace video {
       }
     });
 
-    // Encoding and capture takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    // Encoding takes place on this thread, capture runs on a helper thread started by encode_run_sync()
+    thread_placement::apply(config::thread_stage_e::encode, platf::thread_priority_e::high);
 
     std::vector<std::string> display_names;
     int display_p = -1;
@@ -2872,13 +4619,19 @@ namespace video {
    * @param mail Mail system for communication.
    * @param config Video encoding configuration (may be modified).
    * @param channel_data Channel-specific data pointer.
+   * @param bitrate_target Bitrate requested by the control thread.
+   * @param first_frame_nr Frame number of the first encoded frame.
+   * @param shared Set if other sessions may receive the packets of this encoder.
    */
   void capture_async(
     safe::mail_t mail,
     config_t &config,
-    void *channel_data
+    void *channel_data,
+    bitrate_target_t &bitrate_target,
+    int first_frame_nr = 1,
+    shared_encode_t *shared = nullptr
   ) {
-    auto shutdown_event = mail->event<bool>(mail::shutdown);
+    auto shutdown_event = mail->event(mail::shutdown);
 
     auto images = std::make_shared<img_event_t::element_type>();
     auto lg = util::fail_guard([&]() {
@@ -2886,24 +4639,34 @@ namespace video {
       shutdown_event->raise(true);
     });
 
+    release_mismatched_capture_standby(config);
+
     auto ref = capture_thread_async.ref();
     if (!ref) {
       return;
     }
 
+    // Keep the display for the next stream, unless the capture failed
+    auto standby = util::fail_guard([&]() {
+      hold_capture_standby(ref, config, config::video.capture_standby);
+    });
+
     ref->capture_ctx_queue->raise(capture_ctx_t {images, config});
 
     if (!ref->capture_ctx_queue->running()) {
       return;
     }
 
-    int frame_nr = 1;
+    int frame_nr = first_frame_nr;
 
-    auto touch_port_event = mail->event<input::touch_port_t>(mail::touch_port);
-    auto hdr_event = mail->event<hdr_info_t>(mail::hdr);
+    auto touch_port_event = mail->event(mail::touch_port);
+    auto hdr_event = mail->event(mail::hdr);
 
     // Encoding takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_placement::apply(config::thread_stage_e::encode, platf::thread_priority_e::high);
+
+    // Set while the capture is reinitialized, if the encoder can be rebound to the new display
+    kept_encoder_t kept;
 
     while (!shutdown_event->peek() && images->running()) {
       // Wait for the main capture event when the display is being reinitialized
@@ -2924,39 +4687,227 @@ namespace video {
 
       auto &encoder = *chosen_encoder;
 
-      auto encode_device = make_encode_device(*display, encoder, config);
-      if (!encode_device) {
-        return;
+      std::unique_ptr<platf::encode_device_t> encode_device;
+      sunshine_colorspace_t colorspace;
+      if (kept.fits(*display)) {
+        BOOST_LOG(info) << "Capture reinitialized with the same geometry, keeping the encoder"sv;
+        colorspace = colorspace_from_client_config(kept.config, display->is_hdr());
+      } else {
+        if (kept.session && encoder.flags & ASYNC_TEARDOWN) {
+          std::thread {[session = std::move(kept.session)]() mutable {
+            session.reset();
+          }}.detach();
+        }
+        kept = {};
+
+        encode_device = make_encode_device(*display, encoder, config);
+        if (!encode_device) {
+          return;
+        }
+        colorspace = encode_device->colorspace;
       }
 
       // absolute mouse coordinates require that the dimensions of the screen are known
-      touch_port_event->raise(make_port(display.get(), config));
+      auto touch_port = make_port(display.get(), config);
+      touch_port_event->raise(touch_port);
 
       // Update client with our current HDR display state
       hdr_info_t hdr_info = std::make_unique<hdr_info_raw_t>(false);
-      if (colorspace_is_hdr(encode_device->colorspace)) {
+      if (colorspace_is_hdr(colorspace)) {
         if (display->get_hdr_metadata(hdr_info->metadata)) {
           hdr_info->enabled = true;
         } else {
           BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
         }
       }
+
+      if (shared) {
+        std::lock_guard lg {shared->lock};
+        shared->touch_port = touch_port;
+        shared->hdr_info = *hdr_info;
+        ++shared->display_state_version;
+      }
       hdr_event->raise(std::move(hdr_info));
 
       encode_run(
         frame_nr,
         mail,
         images,
-        config,
+        kept.session ? kept.config : config,
         display,
         std::move(encode_device),
         ref->reinit_event,
         *ref->encoder_p,
-        channel_data
+        channel_data,
+        bitrate_target,
+        kept
       );
     }
   }
 
+  /**
+   * @brief Receive the packets of another session's encoder until that encoder stops.
+   *
+   * Requests from the client that need the encoder are forwarded to the owning session.
+   * Reference frame invalidation becomes an IDR request because the sessions number
+   * frames differently. Bitrate changes are declined, unless another layer fits the new
+   * bitrate better, then the session unsubscribes to move to it.
+   *
+   * @param mail Mail system for communication.
+   * @param config Video encoding configuration, its bitrate is updated when moving to another layer.
+   * @param channel_data Channel-specific data pointer.
+   * @param bitrate_target Bitrate requested by the control thread.
+   * @param shared The encoder to subscribe to.
+   * @param next_frame_index Frame index the client expects next, updated when unsubscribing.
+   * @return True if the session should move to another layer for the bitrate in `config`.
+   */
+  bool capture_subscribed(safe::mail_t mail, config_t &config, void *channel_data, bitrate_target_t &bitrate_target, shared_encode_t &shared, int &next_frame_index) {
+    auto shutdown_event = mail->event(mail::shutdown);
+    auto idr_events = mail->event(mail::idr);
+    auto invalidate_ref_frames_events = mail->event(mail::invalidate_ref_frames);
+    auto ladder_change_events = mail->event(mail::ladder_change);
+    auto ladder_change_confirmation_events = mail->event(mail::ladder_change_confirmation);
+    auto touch_port_event = mail->event(mail::touch_port);
+    auto hdr_event = mail->event(mail::hdr);
+
+    {
+      std::lock_guard lg {shared.lock};
+      shared.subscribers.push_back({channel_data, next_frame_index, std::nullopt});
+    }
+    auto fg = util::fail_guard([&]() {
+      std::lock_guard lg {shared.lock};
+      auto it = std::find_if(std::begin(shared.subscribers), std::end(shared.subscribers), [&](auto &subscriber) {
+        return subscriber.channel_data == channel_data;
+      });
+      if (it != std::end(shared.subscribers)) {
+        next_frame_index = (int) it->next_frame_index;
+        shared.subscribers.erase(it);
+      }
+    });
+
+    // The new session can't decode anything before the next IDR frame
+    shared.owner_idr_events->raise(true);
+
+    std::uint64_t display_state_version = 0;
+    while (!shutdown_event->peek() && shared.running) {
+      {
+        std::lock_guard lg {shared.lock};
+        if (display_state_version != shared.display_state_version) {
+          display_state_version = shared.display_state_version;
+          if (shared.touch_port) {
+            touch_port_event->raise(*shared.touch_port);
+          }
+          if (shared.hdr_info) {
+            hdr_event->raise(std::make_unique<hdr_info_raw_t>(*shared.hdr_info));
+          }
+        }
+      }
+
+      if (auto new_bitrate = bitrate_target.take()) {
+        if (config::video.encode_sharing_layers > 1) {
+          auto layer_config = config;
+          layer_config.bitrate = *new_bitrate;
+
+          std::shared_ptr<shared_encode_t> layer;
+          {
+            std::lock_guard lg {shared_encodes_lock};
+            layer = find_shared_encode(layer_config);
+          }
+
+          // capture_shared() confirms the bitrate once the session is on its new layer
+          if (layer.get() != &shared) {
+            config.bitrate = *new_bitrate;
+            return true;
+          }
+        }
+        bitrate_target.complete(*new_bitrate, false);
+      }
+      if (ladder_change_events->pop(0ms)) {
+        ladder_change_confirmation_events->raise(false);
+      }
+
+      bool requested_idr_frame = false;
+      while (invalidate_ref_frames_events->peek()) {
+        invalidate_ref_frames_events->pop();
+        requested_idr_frame = true;
+      }
+
+      if (idr_events->pop(requested_idr_frame ? 0ms : 20ms) || requested_idr_frame) {
+        shared.owner_idr_events->raise(true);
+      }
+    }
+
+    return false;
+  }
+
+  /**
+   * @brief Run asynchronous capture, sharing the encoder with sessions that use the same config.
+   *
+   * The first session with a config runs the encoder, later ones subscribe to it. If the
+   * owning session ends, its subscribers continue with an encoder of their own. With
+   * `encode_sharing_layers`, sessions that only differ in bitrate subscribe to a layer
+   * and move between layers as their bitrate changes.
+   *
+   * @param mail Mail system for communication.
+   * @param config Video encoding configuration.
+   * @param channel_data Channel-specific data pointer.
+   * @param bitrate_target Bitrate requested by the control thread.
+   */
+  void capture_shared(safe::mail_t mail, config_t &config, void *channel_data, bitrate_target_t &bitrate_target) {
+    auto shutdown_event = mail->event(mail::shutdown);
+
+    int next_frame_index = 1;
+    bool switching_layer = false;
+    while (!shutdown_event->peek()) {
+      std::shared_ptr<shared_encode_t> shared;
+      bool owner = false;
+      {
+        std::lock_guard lg {shared_encodes_lock};
+        shared = find_shared_encode(config);
+        if (!shared) {
+          shared = std::make_shared<shared_encode_t>();
+          shared->config = config;
+          shared->owner_channel_data = channel_data;
+          shared->owner_idr_events = mail->event(mail::idr);
+          shared_encodes.push_back(shared);
+          any_shared_encode = true;
+          owner = true;
+        }
+      }
+
+      if (switching_layer) {
+        // The bitrate the session runs at now is the one of its layer
+        bitrate_target.complete(shared->config.bitrate, true);
+        switching_layer = false;
+      }
+
+      if (!owner) {
+        if (shared->config == config) {
+          BOOST_LOG(info) << "Sharing the video encoder of another session with the same config"sv;
+        } else {
+          BOOST_LOG(info) << "Sharing the "sv << shared->config.bitrate << " Kbps layer of another session's video encoder"sv;
+        }
+        switching_layer = capture_subscribed(mail, config, channel_data, bitrate_target, *shared, next_frame_index);
+        continue;
+      }
+
+      auto fg = util::fail_guard([&]() {
+        shared->running = false;
+
+        std::lock_guard lg {shared_encodes_lock};
+        std::erase(shared_encodes, shared);
+        any_shared_encode = !shared_encodes.empty();
+      });
+
+      // Frames sent as a subscriber already used the lower frame numbers
+      if (next_frame_index > 1) {
+        mail->event(mail::idr)->raise(true);
+      }
+      capture_async(mail, config, channel_data, bitrate_target, next_frame_index, shared.get());
+      return;
+    }
+  }
+
   /**
    * @brief Start video capture (dispatches to async or sync mode).
    * 
@@ -2966,27 +4917,34 @@ namespace video {
    * @param mail Mail system for communication.
    * @param config Video encoding configuration.
    * @param channel_data Channel-specific data pointer.
+   * @param bitrate_target Bitrate requested by the control thread, only applied by asynchronous capture.
    */
   void capture(
     safe::mail_t mail,
     config_t config,
-    void *channel_data
+    void *channel_data,
+    bitrate_target_t &bitrate_target
   ) {
-    auto idr_events = mail->event<bool>(mail::idr);
+    auto idr_events = mail->event(mail::idr);
+
+    // Tell GPU contention apart from slow encoding while the stream runs
+    auto gpu_stats_guard = config.input_only ? nullptr : gpu_stats::start();
 
     idr_events->raise(true);
-    if (chosen_encoder->flags & PARALLEL_ENCODING) {
-      capture_async(std::move(mail), config, channel_data);
+    if ((chosen_encoder->flags & PARALLEL_ENCODING) && config::video.encode_sharing && !config.input_only) {
+      capture_shared(std::move(mail), config, channel_data, bitrate_target);
+    } else if (chosen_encoder->flags & PARALLEL_ENCODING) {
+      capture_async(std::move(mail), config, channel_data, bitrate_target);
     } else {
       safe::signal_t join_event;
       auto ref = capture_thread_sync.ref();
       ref->encode_session_ctx_queue.raise(sync_session_ctx_t {
         &join_event,
-        mail->event<bool>(mail::shutdown),
-        mail::man->queue<packet_t>(mail::video_packets),
+        mail->event(mail::shutdown),
+        mail::man->queue(mail::video_packets),
         std::move(idr_events),
-        mail->event<hdr_info_t>(mail::hdr),
-        mail->event<input::touch_port_t>(mail::touch_port),
+        mail->event(mail::hdr),
+        mail->event(mail::touch_port),
         config,
         1,
         channel_data,
@@ -3037,7 +4995,7 @@ namespace video {
 
     session->request_idr_frame();
 
-    auto packets = mail::man->queue<packet_t>(mail::video_packets);
+    auto packets = mail::man->queue(mail::video_packets);
     while (!packets->peek()) {
       if (encode(1, *session, packets, nullptr, {})) {
         return -1;
@@ -3259,6 +5217,120 @@ namespace video {
     return true;
   }
 
+  /**
+   * @brief Capabilities of the encoders chosen by earlier probes, saved across restarts.
+   * @details They are only reused while the version, the configuration and the GPUs, drivers and
+   *          outputs from `platf::gpu_identity()` stay the same. Failed encoders aren't saved, as they
+   *          may only have failed because the display wasn't ready yet.
+   */
+  struct probe_cache_t {
+    std::string key;  ///< Hash of what the encoders were probed on, empty if results can't be reused
+    std::map<std::string, std::array<unsigned long long, 3>, std::less<>> capabilities;  ///< H.264, HEVC and AV1 capabilities by encoder name
+  } probe_cache;
+
+  /**
+   * @brief Get the path of the saved probe results.
+   * @return The path.
+   */
+  std::filesystem::path probe_cache_path() {
+    return platf::appdata() / "encoder_cache.json";
+  }
+
+  /**
+   * @brief Make sure the probe cache matches the current GPUs and configuration, loading it from disk if needed.
+   */
+  void refresh_probe_cache() {
+    auto gpus = platf::gpu_identity();
+    if (gpus.empty()) {
+      probe_cache = {};
+      return;
+    }
+
+    std::string identity = PROJECT_VERSION;
+    identity += '\n';
+    identity += gpus;
+    identity += display_device::map_output_name(config::video.output_name);
+    identity += '\n';
+    identity += config::sunshine.flags.to_string();
+    identity += '\n';
+    identity += file_handler::read_file(config::sunshine.config_file.c_str());
+
+    auto key = util::hex_vec(crypto::hash(identity));
+    if (key == probe_cache.key) {
+      return;
+    }
+
+    probe_cache = {key, {}};
+    try {
+      std::ifstream in {probe_cache_path()};
+      if (!in) {
+        return;
+      }
+
+      auto tree = nlohmann::json::parse(in);
+      if (tree.value("key", "") != key) {
+        BOOST_LOG(info) << "GPUs, drivers or configuration changed, probing encoders again"sv;
+        return;
+      }
+
+      for (auto &[name, caps] : tree.at("encoders").items()) {
+        probe_cache.capabilities[name] = {caps.at(0).get<unsigned long long>(), caps.at(1).get<unsigned long long>(), caps.at(2).get<unsigned long long>()};
+      }
+    } catch (const std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't read "sv << probe_cache_path().string() << ": "sv << e.what();
+      probe_cache.capabilities.clear();
+    }
+  }
+
+  /**
+   * @brief Save the capabilities of a working encoder for the next probes.
+   * @param encoder The encoder.
+   */
+  void save_probe_result(const encoder_t &encoder) {
+    std::array<unsigned long long, 3> caps {
+      encoder.h264.capabilities.to_ullong(),
+      encoder.hevc.capabilities.to_ullong(),
+      encoder.av1.capabilities.to_ullong(),
+    };
+
+    auto it = probe_cache.capabilities.find(encoder.name);
+    if (probe_cache.key.empty() || (it != std::end(probe_cache.capabilities) && it->second == caps)) {
+      return;
+    }
+    probe_cache.capabilities.insert_or_assign(std::string {encoder.name}, caps);
+
+    nlohmann::json encoders = nlohmann::json::object();
+    for (auto &[name, saved] : probe_cache.capabilities) {
+      encoders[name] = saved;
+    }
+
+    nlohmann::json tree;
+    tree["key"] = probe_cache.key;
+    tree["encoders"] = std::move(encoders);
+    if (file_handler::replace_file(probe_cache_path().string().c_str(), tree.dump(2))) {
+      BOOST_LOG(warning) << "Couldn't save the encoder capabilities to "sv << probe_cache_path().string();
+    }
+  }
+
+  /**
+   * @brief Validate an encoder, unless an earlier probe on the same GPUs already did.
+   * @param encoder Encoder to validate (capabilities updated in-place).
+   * @param expect_failure Whether failure is expected (for logging).
+   * @return True if encoder passes validation, false otherwise.
+   */
+  bool probe_encoder(encoder_t &encoder, bool expect_failure) {
+    auto it = probe_cache.capabilities.find(encoder.name);
+    if (it == std::end(probe_cache.capabilities)) {
+      return validate_encoder(encoder, expect_failure);
+    }
+
+    BOOST_LOG(info) << "Using the saved capabilities of encoder ["sv << encoder.name << ']';
+    encoder.h264.capabilities = decltype(encoder.h264.capabilities) {it->second[0]};
+    encoder.hevc.capabilities = decltype(encoder.hevc.capabilities) {it->second[1]};
+    encoder.av1.capabilities = decltype(encoder.av1.capabilities) {it->second[2]};
+    return true;
+  }
+
   int probe_encoders() {
     if (!allow_encoder_probing()) {
       // Error already logged
@@ -3272,6 +5344,11 @@ namespace video {
       return 0;
     }
 
+    // Probing needs the display and may pick another encoder
+    release_capture_standby();
+
+    refresh_probe_cache();
+
     // Restart encoder selection
     auto previous_encoder = chosen_encoder;
     chosen_encoder = nullptr;
@@ -3305,11 +5382,21 @@ namespace video {
 
         if (encoder->name == config::video.encoder) {
           // Remove the encoder from the list entirely if it fails validation
-          if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+          if (!probe_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
             pos = encoder_list.erase(pos);
             break;
           }
 
+          // Another implementation of the same encoder may meet the codec requirements, e.g. the FFmpeg NVENC encoder on Linux
+          auto missing_codec_requirement = (active_hevc_mode == 3 && !encoder->hevc[encoder_t::DYNAMIC_RANGE]) ||
+                                           (active_av1_mode == 3 && !encoder->av1[encoder_t::DYNAMIC_RANGE]);
+          if (missing_codec_requirement && std::any_of(std::next(pos), std::end(encoder_list), [&](auto other) {
+                return other->name == encoder->name;
+              })) {
+            pos++;
+            continue;
+          }
+
           // We will return an encoder here even if it fails one of the codec requirements specified by the user
           adjust_encoder_constraints(encoder);
 
@@ -3333,7 +5420,7 @@ namespace video {
         auto encoder = *pos;
 
         // Remove the encoder from the list entirely if it fails validation
-        if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+        if (!probe_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
           pos = encoder_list.erase(pos);
           continue;
         }
@@ -3370,7 +5457,7 @@ namespace video {
         // If we've used a previous encoder and it's not this one, we expect this encoder to
         // fail to validate. It will use a slightly different order of checks to more quickly
         // eliminate failing encoders.
-        if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+        if (!probe_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
           pos = encoder_list.erase(pos);
           continue;
         }
@@ -3400,6 +5487,11 @@ namespace video {
 
     auto &encoder = *chosen_encoder;
 
+    // The encoder of last resort is probed again every time, so there's nothing to gain
+    if (!(encoder.flags & ALWAYS_REPROBE)) {
+      save_probe_result(encoder);
+    }
+
     last_encoder_probe_supported_ref_frames_invalidation = (encoder.flags & REF_FRAMES_INVALIDATION);
     last_encoder_probe_supported_yuv444_for_codec[0] = encoder.h264[encoder_t::PASSED] &&
                                                        encoder.h264[encoder_t::YUV444];
@@ -3449,6 +5541,94 @@ namespace video {
     return 0;
   }
 
+  std::string_view chosen_encoder_name() {
+    return chosen_encoder ? chosen_encoder->name : std::string_view {};
+  }
+
+  std::optional<encoder_benchmark_t> benchmark_encoder(const config_t &client_config, const encoder_settings_t &settings, int frames, std::chrono::steady_clock::duration max_duration) {
+    if (!chosen_encoder || frames <= 0) {
+      return std::nullopt;
+    }
+    const auto &encoder = *chosen_encoder;
+
+    auto config = client_config;
+    config.settings = &settings;
+
+    // A static image would make software encoding look far faster than it is, so it encodes the moving test pattern
+    std::shared_ptr<platf::display_t> disp;
+    auto dev_type = encoder.platform_formats->dev_type;
+    if (dev_type == platf::mem_type_e::system) {
+      disp = std::make_shared<synthetic_display_t>(config);
+    } else {
+      reset_display(disp, dev_type, display_device::map_output_name(config::video.output_name), config);
+    }
+    if (!disp) {
+      return std::nullopt;
+    }
+
+    auto encode_device = make_encode_device(*disp, encoder, config);
+    if (!encode_device) {
+      return std::nullopt;
+    }
+
+    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
+    if (!session) {
+      return std::nullopt;
+    }
+
+    auto img = disp->alloc_img();
+    if (!img || disp->dummy_img(img.get())) {
+      return std::nullopt;
+    }
+    auto synthetic = std::dynamic_pointer_cast<synthetic_display_t>(disp);
+
+    // The first frames include the encoder spinning up
+    constexpr int warmup_frames = 10;
+
+    session->request_idr_frame();
+
+    auto packets = mail::man->queue(mail::video_packets);
+    std::vector<std::chrono::steady_clock::duration> latencies;
+    std::chrono::steady_clock::time_point start;
+    for (int x = 0; x < warmup_frames + frames; ++x) {
+      if (synthetic) {
+        synthetic->next_frame(*img);
+      }
+
+      auto begin = std::chrono::steady_clock::now();
+      if (x == warmup_frames) {
+        start = begin;
+      } else if (x > warmup_frames && begin - start > max_duration) {
+        break;
+      }
+
+      if (session->convert(*img) || encode(x + 1, *session, packets, nullptr, {})) {
+        return std::nullopt;
+      }
+      while (packets->peek()) {
+        packets->pop();
+      }
+
+      if (x >= warmup_frames) {
+        latencies.push_back(std::chrono::steady_clock::now() - begin);
+      }
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto percentile = [&latencies](double quantile) {
+      auto nth = std::begin(latencies) + (std::size_t) (quantile * (latencies.size() - 1));
+      std::nth_element(std::begin(latencies), nth, std::end(latencies));
+      return std::chrono::duration_cast<std::chrono::microseconds>(*nth);
+    };
+
+    encoder_benchmark_t result;
+    result.frames = (int) latencies.size();
+    result.fps = elapsed > 0 ? latencies.size() / elapsed : 0;
+    result.latency_p50 = percentile(0.5);
+    result.latency_p99 = percentile(0.99);
+    return result;
+  }
+
   // Linux only declaration
   typedef int (*vaapi_init_avcodec_hardware_input_buffer_fn)(platf::avcodec_encode_device_t *encode_device, AVBufferRef **hw_device_buf);
 
@@ -4,8 +4,21 @@
  */
 #pragma once
 
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
 // local includes
 #include "input.h"
+#include "nvenc/nvenc_config.h"
 #include "platform/common.h"
 #include "thread_safe.h"
 #include "video_colorspace.h"
@@ -19,6 +32,36 @@ struct AVPacket;
 
 namespace video {
 
+  /**
+   * @brief Encoder tuning an application can ask for on top of the configured encoder settings.
+   */
+  enum class encoder_profile_e : int {
+    none,  ///< Use the encoder settings as configured
+    competitive,  ///< Lowest latency: fastest preset, single pass and intra refresh
+    cinematic,  ///< Image quality: slower preset, quarter resolution two pass and adaptive quantization
+  };
+
+  /**
+   * @brief Content an application shows, which decides whether the encoder uses screen content coding tools.
+   */
+  enum class content_type_e : int {
+    automatic,  ///< Detect it from how much of the captured images changes
+    desktop,  ///< Text and flat UI, encoded with screen content tools where the encoder has them
+    video,  ///< Games and natural video, encoded without them
+  };
+
+  /**
+   * @brief Encoder settings a benchmark measures instead of the configured ones.
+   * @details Empty fields keep the configured value. Streams never get these, so what they encode
+   *          with only changes through the config.
+   */
+  struct encoder_settings_t {
+    std::optional<std::string> sw_preset;  ///< Like `sw_preset`
+    std::optional<int> min_threads;  ///< Like `min_threads`
+    std::optional<int> nvenc_preset;  ///< Like `nvenc_preset`, 1 to 7
+    std::optional<nvenc::nvenc_two_pass> nvenc_two_pass;  ///< Like `nvenc_twopass`
+  };
+
   /**
    * @brief Encoding configuration requested by remote client.
    * @warning DO NOT CHANGE ORDER OR ADD FIELDS IN THE MIDDLE!
@@ -38,6 +81,80 @@ namespace video {
     int enableIntraRefresh;  ///< Intra refresh: 0=disabled, 1=enabled
     int encodingFramerate;  ///< Requested display framerate
     bool input_only;  ///< Whether this is an input-only session
+    int encoderProfile;  ///< Encoder tuning of the launched application, see encoder_profile_e
+    int contentType;  ///< Content of the launched application, see content_type_e
+    const encoder_settings_t *settings = nullptr;  ///< Settings measured instead of the configured ones, only set by benchmark_encoder()
+
+    bool operator==(const config_t &) const = default;
+  };
+
+  /**
+   * @brief Output format the encoder switches to when auto bitrate walks the resolution ladder.
+   */
+  struct ladder_step_t {
+    int width;  ///< Encoded width in pixels
+    int height;  ///< Encoded height in pixels
+    int framerate;  ///< Framerate used in the individual frame bitrate budget calculation
+    int encodingFramerate;  ///< Framerate the encoder paces frames at
+  };
+
+  /**
+   * @brief Bitrate the control thread wants the encoder at, shared without a lock.
+   * @details The target and the result each pack a generation and a bitrate into one atomic,
+   *          so the encode loop can check for a change before every frame without taking a mutex.
+   *          Like a mail event, a newer request replaces one the encoder hasn't picked up yet.
+   */
+  class bitrate_target_t {
+  public:
+    /**
+     * @brief Ask the encoder for a new bitrate, called by the control thread.
+     * @param kbps The bitrate in Kbps.
+     */
+    void request(int kbps) {
+      auto generation = (_target.load(std::memory_order_relaxed) >> 32) + 1;
+      _target.store(generation << 32 | static_cast<std::uint32_t>(kbps), std::memory_order_release);
+    }
+
+    /**
+     * @brief Take the latest request, called by the encode loop.
+     * @return The bitrate in Kbps, or an empty value if nothing changed since the last call.
+     */
+    std::optional<int> take() {
+      auto target = _target.load(std::memory_order_acquire);
+      if (target >> 32 == _taken) {
+        return std::nullopt;
+      }
+      _taken = target >> 32;
+      return static_cast<int>(target & 0xFFFFFFFF);
+    }
+
+    /**
+     * @brief Report the outcome of the last request taken, called by the encode loop.
+     * @param kbps The bitrate in Kbps.
+     * @param accepted Whether the encoder runs at the bitrate now.
+     */
+    void complete(int kbps, bool accepted) {
+      _result.store(_taken << 32 | (accepted ? 0x80000000 : 0) | (static_cast<std::uint32_t>(kbps) & 0x7FFFFFFF), std::memory_order_release);
+    }
+
+    /**
+     * @brief Get the outcome of a request, called by the control thread.
+     * @return The bitrate and whether the encoder accepted it, or an empty value if no request completed since the last call.
+     */
+    std::optional<std::pair<int, bool>> confirmation() {
+      auto result = _result.load(std::memory_order_acquire);
+      if (result >> 32 == _confirmed) {
+        return std::nullopt;
+      }
+      _confirmed = result >> 32;
+      return std::make_pair(static_cast<int>(result & 0x7FFFFFFF), (result & 0x80000000) != 0);
+    }
+
+  private:
+    std::atomic<std::uint64_t> _target {0};  ///< Generation of the request in the upper half, bitrate in the lower half
+    std::atomic<std::uint64_t> _result {0};  ///< Generation of the request in the upper half, accepted flag and bitrate in the lower half
+    std::uint64_t _taken = 0;  ///< Generation of the last request taken, only touched by the encode loop
+    std::uint64_t _confirmed = 0;  ///< Generation of the last result seen, only touched by the control thread
   };
 
   /**
@@ -169,6 +286,28 @@ namespace video {
     }
   };
 
+  /**
+   * @brief Native VideoToolbox encoder platform formats structure.
+   *        Frames are captured into CVPixelBuffers by the avcodec encode device and handed to the encoder directly.
+   */
+  struct encoder_platform_formats_vt: encoder_platform_formats_t {
+    /**
+     * @brief Construct native VideoToolbox encoder platform formats.
+     * @param pix_fmt_8bit 8-bit pixel format.
+     * @param pix_fmt_10bit 10-bit pixel format.
+     */
+    encoder_platform_formats_vt(
+      const platf::pix_fmt_e &pix_fmt_8bit,
+      const platf::pix_fmt_e &pix_fmt_10bit
+    ) {
+      encoder_platform_formats_t::dev_type = platf::mem_type_e::videotoolbox;
+      encoder_platform_formats_t::pix_fmt_8bit = pix_fmt_8bit;
+      encoder_platform_formats_t::pix_fmt_10bit = pix_fmt_10bit;
+      encoder_platform_formats_t::pix_fmt_yuv444_8bit = platf::pix_fmt_e::unknown;
+      encoder_platform_formats_t::pix_fmt_yuv444_10bit = platf::pix_fmt_e::unknown;
+    }
+  };
+
   /**
    * @brief Encoder structure containing codec configurations and capabilities.
    */
@@ -283,30 +422,6 @@ namespace video {
     uint32_t flags;
   };
 
-  /**
-   * @brief Base class for video encoding sessions.
-   * 
-   * Provides the interface for video encoding operations including frame conversion,
-   * IDR frame requests, and reference frame invalidation.
-   */
-  struct encode_session_t {
-    virtual ~encode_session_t() = default;
-
-    virtual int convert(platf::img_t &img) = 0;
-
-    virtual void request_idr_frame() = 0;
-
-    virtual void request_normal_frame() = 0;
-
-    virtual void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) = 0;
-
-    // Reconfigure bitrate during active session
-    virtual bool reconfigure_bitrate(int new_bitrate_kbps) {
-      // Default implementation: not supported
-      return false;
-    }
-  };
-
   // encoders
   extern encoder_t software;
 
@@ -327,6 +442,8 @@ namespace video {
   extern encoder_t videotoolbox;
 #endif
 
+  class packet_pool_t;
+
   /**
    * @brief Base class for raw video packet data.
    * 
@@ -354,12 +471,14 @@ namespace video {
     struct replace_t {
       std::string_view old;
       std::string_view _new;
+      std::size_t offset = std::string_view::npos;  ///< Expected offset of old in the payload, or npos if unknown
 
       KITTY_DEFAULT_CONSTR_MOVE(replace_t)
 
-      replace_t(std::string_view old, std::string_view _new) noexcept:
+      replace_t(std::string_view old, std::string_view _new, std::size_t offset = std::string_view::npos) noexcept:
           old {std::move(old)},
-          _new {std::move(_new)} {
+          _new {std::move(_new)},
+          offset {offset} {
       }
     };
 
@@ -374,7 +493,27 @@ namespace video {
 
     void *channel_data = nullptr;
     bool after_ref_frame_invalidation = false;
+    int temporal_layer = 0;  ///< Temporal layer of the frame, 0 for the base layer and for encoders without layers
+    bool droppable = false;  ///< No other frame references this one, it may be skipped without the client having to recover
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+
+    std::shared_ptr<packet_pool_t> pool;  ///< Pool the packet is handed back to once released, deleted if not set
+  };
+
+  /**
+   * @brief Deleter of video packets, hands packets back to their pool.
+   */
+  struct packet_deleter_t {
+    packet_deleter_t() = default;
+
+    /**
+     * @brief Allow packets created with std::make_unique(), they don't belong to a pool.
+     */
+    template<class T>
+    packet_deleter_t(std::default_delete<T>) {
+    }
+
+    void operator()(packet_raw_t *packet) const;
   };
 
   /**
@@ -444,7 +583,139 @@ namespace video {
     bool idr;
   };
 
-  using packet_t = std::unique_ptr<packet_raw_t>;
+  /**
+   * @brief Video packet that refers to the packet of another session.
+   *
+   * Used when several sessions share one encoder. Each session gets its own frame
+   * numbering and channel data, while the encoded data is shared.
+   */
+  struct packet_raw_shared_t: packet_raw_t {
+    /**
+     * @brief Create a packet for one of the sessions sharing an encoder.
+     * @param source The packet produced by the encoder.
+     * @param channel_data The channel data of the receiving session.
+     * @param frame_index_offset Subtracted from the frame index of the source packet.
+     */
+    packet_raw_shared_t(std::shared_ptr<packet_raw_t> source, void *channel_data, int64_t frame_index_offset):
+        source {std::move(source)},
+        frame_index_offset {frame_index_offset} {
+      this->replacements = this->source->replacements;
+      this->channel_data = channel_data;
+      this->after_ref_frame_invalidation = this->source->after_ref_frame_invalidation;
+      this->temporal_layer = this->source->temporal_layer;
+      this->droppable = this->source->droppable;
+      this->frame_timestamp = this->source->frame_timestamp;
+    }
+
+    bool is_idr() override {
+      return source->is_idr();
+    }
+
+    int64_t frame_index() override {
+      return source->frame_index() - frame_index_offset;
+    }
+
+    uint8_t *data() override {
+      return source->data();
+    }
+
+    size_t data_size() override {
+      return source->data_size();
+    }
+
+    std::shared_ptr<packet_raw_t> source;
+    int64_t frame_index_offset;
+  };
+
+  using packet_t = std::unique_ptr<packet_raw_t, packet_deleter_t>;
+
+  /**
+   * @brief Pool of the packets of one encode session.
+   *
+   * Packets and their AVPackets or byte buffers are reused once the broadcast thread
+   * has sent them, so handing an encoded frame to the broadcast thread doesn't allocate.
+   * Packets keep their pool alive, it may outlive the encode session.
+   */
+  class packet_pool_t: public std::enable_shared_from_this<packet_pool_t> {
+  public:
+    static constexpr std::size_t max_packets = 16;  ///< Packets of each type kept for reuse, more only exist while frames queue up
+
+    /**
+     * @brief Get a packet for libavcodec to receive an encoded frame into.
+     * @return The packet, with an empty AVPacket.
+     */
+    std::unique_ptr<packet_raw_avcodec, packet_deleter_t> avcodec();
+
+    /**
+     * @brief Get a packet holding an encoded frame.
+     * @param frame_data The encoded frame, preferably in a buffer from buffer().
+     * @param frame_index Index of the frame.
+     * @param idr Whether the frame is an IDR frame.
+     * @return The packet.
+     */
+    std::unique_ptr<packet_raw_generic, packet_deleter_t> generic(std::vector<uint8_t> &&frame_data, int64_t frame_index, bool idr);
+
+    /**
+     * @brief Get an empty byte buffer for an encoder to write a frame into.
+     * @return The buffer, with room for the largest frame of the session so far.
+     */
+    std::vector<uint8_t> buffer();
+
+    /**
+     * @brief Take back a released packet, called by packet_deleter_t.
+     * @param packet The packet.
+     */
+    void recycle(packet_raw_t *packet);
+
+  private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<packet_raw_avcodec>> avcodec_packets;
+    std::vector<std::unique_ptr<packet_raw_generic>> generic_packets;
+    std::vector<std::vector<uint8_t>> buffers;
+    std::size_t peak_size = 0;  ///< Size of the largest frame handed out by generic()
+    bool buffers_used = false;  ///< Whether the encoder takes its buffers from buffer()
+  };
+
+  /**
+   * @brief Base class for video encoding sessions.
+   * 
+   * Provides the interface for video encoding operations including frame conversion,
+   * IDR frame requests, and reference frame invalidation.
+   */
+  struct encode_session_t {
+    virtual ~encode_session_t() = default;
+
+    std::shared_ptr<packet_pool_t> packet_pool = std::make_shared<packet_pool_t>();  ///< Packets raised by this session
+
+    virtual int convert(platf::img_t &img) = 0;
+
+    /**
+     * @brief Prepare the encode device for the images of another display, see `platf::encode_device_t::rebind()`.
+     */
+    virtual void rebind() = 0;
+
+    virtual void request_idr_frame() = 0;
+
+    virtual void request_normal_frame() = 0;
+
+    virtual void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) = 0;
+
+    // Reconfigure bitrate during active session
+    virtual bool reconfigure_bitrate(int new_bitrate_kbps) {
+      // Default implementation: not supported
+      return false;
+    }
+
+    /**
+     * @brief Change the frame size and framerate without recreating the encoder.
+     * @details The next frame is an IDR frame. The encode device and its surfaces are kept.
+     * @param config The stream configuration with the new size and framerate.
+     * @return `true` on success, `false` if a new session is needed.
+     */
+    virtual bool reconfigure_resolution(const config_t &config) {
+      return false;
+    }
+  };
 
   /**
    * @brief HDR information structure.
@@ -473,7 +744,8 @@ namespace video {
   void capture(
     safe::mail_t mail,
     config_t config,
-    void *channel_data
+    void *channel_data,
+    bitrate_target_t &bitrate_target
   );
 
   bool validate_encoder(encoder_t &encoder, bool expect_failure);
@@ -493,4 +765,118 @@ namespace video {
    * @warning This is only safe to call when there is no client actively streaming.
    */
   int probe_encoders();
+
+  /**
+   * @brief Throughput and latency of the chosen encoder, measured by `benchmark_encoder()`.
+   */
+  struct encoder_benchmark_t {
+    int frames;  ///< Frames measured
+    double fps;  ///< Frames converted and encoded per second, back to back
+    std::chrono::microseconds latency_p50;  ///< Median time from the conversion of a frame to its encoded packet
+    std::chrono::microseconds latency_p99;  ///< 99th percentile of the same
+  };
+
+  /**
+   * @brief Get the name of the encoder selected by `probe_encoders()`.
+   * @return The name, e.g. "nvenc" or "software", empty if no encoder works.
+   */
+  std::string_view chosen_encoder_name();
+
+  /**
+   * @brief Convert and encode frames back to back with the chosen encoder.
+   * @details Like encoder validation, GPU encoders convert a dummy image of the configured display.
+   *          Software encoding gets the moving test pattern of the synthetic display instead.
+   *          The packets go to the global video packet queue and are dropped.
+   *          The settings only apply to this encoder, the configured ones are left alone.
+   * @param config The stream configuration to encode at.
+   * @param settings The encoder settings to measure, empty fields keep the configured ones.
+   * @param frames The number of frames to measure, after a short warmup.
+   * @param max_duration Stop measuring early when the frames take longer than this.
+   * @return The measurement, or `std::nullopt` if the encoder couldn't be set up at this configuration.
+   * @warning This is only safe to call when there is no client actively streaming.
+   */
+  std::optional<encoder_benchmark_t> benchmark_encoder(const config_t &config, const encoder_settings_t &settings, int frames, std::chrono::steady_clock::duration max_duration);
+
+  /**
+   * @brief Start capturing for a stream that was launched but hasn't been set up yet.
+   * @details The capture is kept on standby for a short while. If the stream asks for the
+   *          same framerate and color depth, it joins the capture instead of setting up the display.
+   * @param config The video configuration the stream is expected to negotiate.
+   */
+  void prewarm_capture(const config_t &config);
+
+  /**
+   * @brief Set how much of each frame the synthetic display of `capture = null` redraws.
+   * @param percent Share of the rows redrawn per frame, 0 for a static image. Applies to displays opened from now on.
+   */
+  void set_synthetic_dirty_percent(int percent);
+
+  /**
+   * @brief Parse the encoder profile of an application.
+   * @param profile "competitive", "cinematic" or empty.
+   * @return The profile, or `encoder_profile_e::none` if it's empty or unknown.
+   */
+  encoder_profile_e encoder_profile_from_view(std::string_view profile);
+
+  /**
+   * @brief Parse the content type of an application.
+   * @param content_type "desktop", "video" or empty.
+   * @return The content type, or `content_type_e::automatic` if it's empty or unknown.
+   */
+  content_type_e content_type_from_view(std::string_view content_type);
+
+  /**
+   * @brief Check whether an encoder has screen content coding tools for the codec of a stream.
+   * @details Only AV1 qualifies: its palette and intra block copy tools are part of the main profile
+   *          every decoder supports. HEVC screen content coding is a separate profile clients can't decode.
+   * @param encoder_name The name of the encoder, e.g. "amdvce" or "software".
+   * @param config The stream configuration.
+   * @return `true` if the encoder has them.
+   */
+  bool supports_screen_content(std::string_view encoder_name, const config_t &config);
+
+  /**
+   * @brief Tell desktop content from video by how much of each captured image changed.
+   * @details The images are judged in windows. Desktop content mostly changes in small regions, like a
+   *          caret or a menu, while games and video change most of every image. Mixed windows keep the
+   *          current content type, so it doesn't flip back and forth.
+   */
+  class content_detector_t {
+  public:
+    static constexpr std::chrono::seconds window {10};  ///< Length of a window
+    static constexpr double busy_area = 0.25;  ///< Share of an image that must change for it to count as busy
+    static constexpr double desktop_share = 0.1;  ///< Windows with fewer busy images than this share are desktop content
+    static constexpr double video_share = 0.3;  ///< Windows with more busy images than this share are video
+
+    /**
+     * @brief Account for a captured image.
+     * @param img The image. Without damage information, any new content counts as busy.
+     * @param now The time the image was captured.
+     * @return The new content type at the end of a window that changed it, `std::nullopt` otherwise.
+     */
+    std::optional<content_type_e> add(const platf::img_t &img, std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Get the content type the detector settled on.
+     * @return `content_type_e::video` until a window says otherwise.
+     */
+    content_type_e current() const {
+      return content_type;
+    }
+
+  private:
+    content_type_e content_type = content_type_e::video;
+    std::optional<std::chrono::steady_clock::time_point> window_start;
+    int images = 0;
+    int busy_images = 0;
+    std::uint64_t last_frame_index = 0;
+  };
+
+  /**
+   * @brief Apply the encoder profile of a stream, the settings of a benchmark and region-of-interest encoding to the NVENC settings.
+   * @param config The configured NVENC settings.
+   * @param client_config The stream configuration.
+   * @return The settings the stream is encoded with.
+   */
+  nvenc::nvenc_config nvenc_config_for_profile(nvenc::nvenc_config config, const config_t &client_config);
 }  // namespace video
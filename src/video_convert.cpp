@@ -0,0 +1,484 @@
+/**
+ * @file src/video_convert.cpp
+ * @brief Definitions for the SIMD BGRX to YUV conversion kernels.
+ */
+// this include
+#include "video_convert.h"
+
+// standard includes
+#include <algorithm>
+#include <type_traits>
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  #define VIDEO_CONVERT_AVX2
+  #include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  #define VIDEO_CONVERT_NEON
+  #include <arm_neon.h>
+#endif
+
+namespace video {
+  using params_t = bgrx_to_yuv_t::params_t;
+
+  namespace {
+    template<class T>
+    inline void store_sample(T *dst, float value, const params_t &params) {
+      auto sample = std::clamp((int) value, 0, params.max_value);
+      if constexpr (std::is_same_v<T, std::uint16_t>) {
+        *dst = (std::uint16_t) (sample << params.shift);
+      } else {
+        *dst = (std::uint8_t) sample;
+      }
+    }
+
+    inline float dot(const float (&vec)[4], float r, float g, float b) {
+      return vec[0] * r + vec[1] * g + vec[2] * b + vec[3];
+    }
+
+    // The scalar row kernels start at an arbitrary pixel so the vector kernels can hand them their tails
+
+    template<class T>
+    void luma_row_scalar(const std::uint8_t *src, int begin, int width, T *dst, const params_t &params) {
+      for (int x = begin; x < width; ++x) {
+        auto px = src + x * 4;
+        store_sample(dst + x, dot(params.y, px[2], px[1], px[0]), params);
+      }
+    }
+
+    template<class T, bool interleaved>
+    void chroma420_row_scalar(const std::uint8_t *src0, const std::uint8_t *src1, int begin, int width, T *u, T *v, const params_t &params) {
+      auto chroma_width = (width + 1) / 2;
+      for (int x = begin; x < chroma_width; ++x) {
+        auto left = x * 2 * 4;
+        auto right = std::min(x * 2 + 1, width - 1) * 4;
+
+        float b = src0[left + 0] + src0[right + 0] + src1[left + 0] + src1[right + 0];
+        float g = src0[left + 1] + src0[right + 1] + src1[left + 1] + src1[right + 1];
+        float r = src0[left + 2] + src0[right + 2] + src1[left + 2] + src1[right + 2];
+
+        if constexpr (interleaved) {
+          store_sample(u + x * 2, dot(params.u_sum4, r, g, b), params);
+          store_sample(u + x * 2 + 1, dot(params.v_sum4, r, g, b), params);
+        } else {
+          store_sample(u + x, dot(params.u_sum4, r, g, b), params);
+          store_sample(v + x, dot(params.v_sum4, r, g, b), params);
+        }
+      }
+    }
+
+    template<class T>
+    void chroma444_row_scalar(const std::uint8_t *src, int begin, int width, T *u, T *v, const params_t &params) {
+      for (int x = begin; x < width; ++x) {
+        auto px = src + x * 4;
+        store_sample(u + x, dot(params.u, px[2], px[1], px[0]), params);
+        store_sample(v + x, dot(params.v, px[2], px[1], px[0]), params);
+      }
+    }
+
+    template<class T>
+    void luma_row_ref(const std::uint8_t *src, int width, void *dst, const params_t &params) {
+      luma_row_scalar(src, 0, width, (T *) dst, params);
+    }
+
+    template<class T, bool interleaved>
+    void chroma420_row_ref(const std::uint8_t *src0, const std::uint8_t *src1, int width, void *u, void *v, const params_t &params) {
+      chroma420_row_scalar<T, interleaved>(src0, src1, 0, width, (T *) u, (T *) v, params);
+    }
+
+    template<class T>
+    void chroma444_row_ref(const std::uint8_t *src, int width, void *u, void *v, const params_t &params) {
+      chroma444_row_scalar(src, 0, width, (T *) u, (T *) v, params);
+    }
+
+#ifdef VIDEO_CONVERT_AVX2
+  #define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+    struct avx2_vec_t {
+      __m256 r, g, b, offset;
+    };
+
+    AVX2_TARGET inline avx2_vec_t load_vec_avx2(const float (&vec)[4]) {
+      return {_mm256_set1_ps(vec[0]), _mm256_set1_ps(vec[1]), _mm256_set1_ps(vec[2]), _mm256_set1_ps(vec[3])};
+    }
+
+    template<int shift>
+    AVX2_TARGET inline __m256i channel_avx2(__m256i px) {
+      return _mm256_and_si256(_mm256_srli_epi32(px, shift), _mm256_set1_epi32(0xFF));
+    }
+
+    AVX2_TARGET inline __m256 dot_avx2(const avx2_vec_t &vec, __m256 r, __m256 g, __m256 b) {
+      return _mm256_fmadd_ps(r, vec.r, _mm256_fmadd_ps(g, vec.g, _mm256_fmadd_ps(b, vec.b, vec.offset)));
+    }
+
+    // Truncate, clamp and narrow 8 samples to 16 bits, in order
+    AVX2_TARGET inline __m128i pack_avx2(__m256 value, __m256i max_value, __m128i shift) {
+      auto sample = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(value), _mm256_setzero_si256()), max_value);
+      auto packed = _mm_packus_epi32(_mm256_castsi256_si128(sample), _mm256_extracti128_si256(sample, 1));
+      return _mm_sll_epi16(packed, shift);
+    }
+
+    // Sums of the eight 2x2 blocks of 16 pixels from two rows, in pixel order
+    template<int shift>
+    AVX2_TARGET inline __m256 block_sum_avx2(__m256i a0, __m256i a1, __m256i b0, __m256i b1) {
+      auto sum0 = _mm256_add_epi32(channel_avx2<shift>(a0), channel_avx2<shift>(b0));
+      auto sum1 = _mm256_add_epi32(channel_avx2<shift>(a1), channel_avx2<shift>(b1));
+
+      // hadd works within 128-bit lanes, the permute restores the pixel order
+      return _mm256_cvtepi32_ps(_mm256_permute4x64_epi64(_mm256_hadd_epi32(sum0, sum1), 0xD8));
+    }
+
+    template<class T>
+    AVX2_TARGET inline void store_avx2(T *dst, __m128i packed) {
+      if constexpr (std::is_same_v<T, std::uint16_t>) {
+        _mm_storeu_si128((__m128i *) dst, packed);
+      } else {
+        _mm_storel_epi64((__m128i *) dst, _mm_packus_epi16(packed, packed));
+      }
+    }
+
+    template<class T>
+    AVX2_TARGET void luma_row_avx2(const std::uint8_t *src, int width, void *dst_p, const params_t &params) {
+      auto dst = (T *) dst_p;
+      auto vec = load_vec_avx2(params.y);
+      auto max_value = _mm256_set1_epi32(params.max_value);
+      auto shift = _mm_cvtsi32_si128(params.shift);
+
+      int x = 0;
+      for (; x + 8 <= width; x += 8) {
+        auto px = _mm256_loadu_si256((const __m256i *) (src + x * 4));
+        auto b = _mm256_cvtepi32_ps(channel_avx2<0>(px));
+        auto g = _mm256_cvtepi32_ps(channel_avx2<8>(px));
+        auto r = _mm256_cvtepi32_ps(channel_avx2<16>(px));
+        store_avx2(dst + x, pack_avx2(dot_avx2(vec, r, g, b), max_value, shift));
+      }
+
+      luma_row_scalar(src, x, width, dst, params);
+    }
+
+    template<class T, bool interleaved>
+    AVX2_TARGET void chroma420_row_avx2(const std::uint8_t *src0, const std::uint8_t *src1, int width, void *u_p, void *v_p, const params_t &params) {
+      auto u = (T *) u_p;
+      auto v = (T *) v_p;
+      auto u_vec = load_vec_avx2(params.u_sum4);
+      auto v_vec = load_vec_avx2(params.v_sum4);
+      auto max_value = _mm256_set1_epi32(params.max_value);
+      auto shift = _mm_cvtsi32_si128(params.shift);
+
+      int x = 0;
+      for (; (x + 8) * 2 <= width; x += 8) {
+        auto a0 = _mm256_loadu_si256((const __m256i *) (src0 + x * 8));
+        auto a1 = _mm256_loadu_si256((const __m256i *) (src0 + x * 8 + 32));
+        auto b0 = _mm256_loadu_si256((const __m256i *) (src1 + x * 8));
+        auto b1 = _mm256_loadu_si256((const __m256i *) (src1 + x * 8 + 32));
+
+        auto b = block_sum_avx2<0>(a0, a1, b0, b1);
+        auto g = block_sum_avx2<8>(a0, a1, b0, b1);
+        auto r = block_sum_avx2<16>(a0, a1, b0, b1);
+
+        auto u_packed = pack_avx2(dot_avx2(u_vec, r, g, b), max_value, shift);
+        auto v_packed = pack_avx2(dot_avx2(v_vec, r, g, b), max_value, shift);
+
+        if constexpr (interleaved) {
+          auto lo = _mm_unpacklo_epi16(u_packed, v_packed);
+          auto hi = _mm_unpackhi_epi16(u_packed, v_packed);
+          if constexpr (std::is_same_v<T, std::uint16_t>) {
+            _mm_storeu_si128((__m128i *) (u + x * 2), lo);
+            _mm_storeu_si128((__m128i *) (u + x * 2 + 8), hi);
+          } else {
+            _mm_storeu_si128((__m128i *) (u + x * 2), _mm_packus_epi16(lo, hi));
+          }
+        } else {
+          store_avx2(u + x, u_packed);
+          store_avx2(v + x, v_packed);
+        }
+      }
+
+      chroma420_row_scalar<T, interleaved>(src0, src1, x, width, u, v, params);
+    }
+
+    template<class T>
+    AVX2_TARGET void chroma444_row_avx2(const std::uint8_t *src, int width, void *u_p, void *v_p, const params_t &params) {
+      auto u = (T *) u_p;
+      auto v = (T *) v_p;
+      auto u_vec = load_vec_avx2(params.u);
+      auto v_vec = load_vec_avx2(params.v);
+      auto max_value = _mm256_set1_epi32(params.max_value);
+      auto shift = _mm_cvtsi32_si128(params.shift);
+
+      int x = 0;
+      for (; x + 8 <= width; x += 8) {
+        auto px = _mm256_loadu_si256((const __m256i *) (src + x * 4));
+        auto b = _mm256_cvtepi32_ps(channel_avx2<0>(px));
+        auto g = _mm256_cvtepi32_ps(channel_avx2<8>(px));
+        auto r = _mm256_cvtepi32_ps(channel_avx2<16>(px));
+        store_avx2(u + x, pack_avx2(dot_avx2(u_vec, r, g, b), max_value, shift));
+        store_avx2(v + x, pack_avx2(dot_avx2(v_vec, r, g, b), max_value, shift));
+      }
+
+      chroma444_row_scalar(src, x, width, u, v, params);
+    }
+#endif
+
+#ifdef VIDEO_CONVERT_NEON
+    struct neon_vec_t {
+      float32x4_t r, g, b, offset;
+    };
+
+    inline neon_vec_t load_vec_neon(const float (&vec)[4]) {
+      return {vdupq_n_f32(vec[0]), vdupq_n_f32(vec[1]), vdupq_n_f32(vec[2]), vdupq_n_f32(vec[3])};
+    }
+
+    inline float32x4_t dot_neon(const neon_vec_t &vec, float32x4_t r, float32x4_t g, float32x4_t b) {
+      return vfmaq_f32(vfmaq_f32(vfmaq_f32(vec.offset, b, vec.b), g, vec.g), r, vec.r);
+    }
+
+    inline float32x4_t low_f32(uint16x8_t value) {
+      return vcvtq_f32_u32(vmovl_u16(vget_low_u16(value)));
+    }
+
+    inline float32x4_t high_f32(uint16x8_t value) {
+      return vcvtq_f32_u32(vmovl_u16(vget_high_u16(value)));
+    }
+
+    // Truncate, clamp and narrow 8 samples to 16 bits, negative values saturate to 0
+    inline uint16x8_t pack_neon(float32x4_t lo, float32x4_t hi, uint32x4_t max_value, int16x8_t shift) {
+      auto lo_sample = vmovn_u32(vminq_u32(vcvtq_u32_f32(lo), max_value));
+      auto hi_sample = vmovn_u32(vminq_u32(vcvtq_u32_f32(hi), max_value));
+      return vshlq_u16(vcombine_u16(lo_sample, hi_sample), shift);
+    }
+
+    template<class T>
+    inline void store_neon(T *dst, uint16x8_t packed) {
+      if constexpr (std::is_same_v<T, std::uint16_t>) {
+        vst1q_u16(dst, packed);
+      } else {
+        vst1_u8(dst, vmovn_u16(packed));
+      }
+    }
+
+    template<class T>
+    void luma_row_neon(const std::uint8_t *src, int width, void *dst_p, const params_t &params) {
+      auto dst = (T *) dst_p;
+      auto vec = load_vec_neon(params.y);
+      auto max_value = vdupq_n_u32(params.max_value);
+      auto shift = vdupq_n_s16(params.shift);
+
+      int x = 0;
+      for (; x + 8 <= width; x += 8) {
+        auto px = vld4_u8(src + x * 4);
+        auto b = vmovl_u8(px.val[0]);
+        auto g = vmovl_u8(px.val[1]);
+        auto r = vmovl_u8(px.val[2]);
+        auto lo = dot_neon(vec, low_f32(r), low_f32(g), low_f32(b));
+        auto hi = dot_neon(vec, high_f32(r), high_f32(g), high_f32(b));
+        store_neon(dst + x, pack_neon(lo, hi, max_value, shift));
+      }
+
+      luma_row_scalar(src, x, width, dst, params);
+    }
+
+    template<class T, bool interleaved>
+    void chroma420_row_neon(const std::uint8_t *src0, const std::uint8_t *src1, int width, void *u_p, void *v_p, const params_t &params) {
+      auto u = (T *) u_p;
+      auto v = (T *) v_p;
+      auto u_vec = load_vec_neon(params.u_sum4);
+      auto v_vec = load_vec_neon(params.v_sum4);
+      auto max_value = vdupq_n_u32(params.max_value);
+      auto shift = vdupq_n_s16(params.shift);
+
+      int x = 0;
+      for (; (x + 8) * 2 <= width; x += 8) {
+        auto a = vld4q_u8(src0 + x * 8);
+        auto c = vld4q_u8(src1 + x * 8);
+
+        // Pairwise widening adds give the horizontal sums, then add the second row
+        auto b = vaddq_u16(vpaddlq_u8(a.val[0]), vpaddlq_u8(c.val[0]));
+        auto g = vaddq_u16(vpaddlq_u8(a.val[1]), vpaddlq_u8(c.val[1]));
+        auto r = vaddq_u16(vpaddlq_u8(a.val[2]), vpaddlq_u8(c.val[2]));
+
+        auto u_packed = pack_neon(dot_neon(u_vec, low_f32(r), low_f32(g), low_f32(b)), dot_neon(u_vec, high_f32(r), high_f32(g), high_f32(b)), max_value, shift);
+        auto v_packed = pack_neon(dot_neon(v_vec, low_f32(r), low_f32(g), low_f32(b)), dot_neon(v_vec, high_f32(r), high_f32(g), high_f32(b)), max_value, shift);
+
+        if constexpr (interleaved) {
+          if constexpr (std::is_same_v<T, std::uint16_t>) {
+            vst2q_u16(u + x * 2, (uint16x8x2_t {u_packed, v_packed}));
+          } else {
+            vst2_u8(u + x * 2, (uint8x8x2_t {vmovn_u16(u_packed), vmovn_u16(v_packed)}));
+          }
+        } else {
+          store_neon(u + x, u_packed);
+          store_neon(v + x, v_packed);
+        }
+      }
+
+      chroma420_row_scalar<T, interleaved>(src0, src1, x, width, u, v, params);
+    }
+
+    template<class T>
+    void chroma444_row_neon(const std::uint8_t *src, int width, void *u_p, void *v_p, const params_t &params) {
+      auto u = (T *) u_p;
+      auto v = (T *) v_p;
+      auto u_vec = load_vec_neon(params.u);
+      auto v_vec = load_vec_neon(params.v);
+      auto max_value = vdupq_n_u32(params.max_value);
+      auto shift = vdupq_n_s16(params.shift);
+
+      int x = 0;
+      for (; x + 8 <= width; x += 8) {
+        auto px = vld4_u8(src + x * 4);
+        auto b = vmovl_u8(px.val[0]);
+        auto g = vmovl_u8(px.val[1]);
+        auto r = vmovl_u8(px.val[2]);
+        store_neon(u + x, pack_neon(dot_neon(u_vec, low_f32(r), low_f32(g), low_f32(b)), dot_neon(u_vec, high_f32(r), high_f32(g), high_f32(b)), max_value, shift));
+        store_neon(v + x, pack_neon(dot_neon(v_vec, low_f32(r), low_f32(g), low_f32(b)), dot_neon(v_vec, high_f32(r), high_f32(g), high_f32(b)), max_value, shift));
+      }
+
+      chroma444_row_scalar(src, x, width, u, v, params);
+    }
+#endif
+
+    /**
+     * @brief Row kernels of one instruction set for every layout.
+     */
+    struct kernel_set_t {
+      const char *name;
+      bgrx_to_yuv_t::luma_row_t luma8, luma16;
+      bgrx_to_yuv_t::chroma420_row_t chroma420_planar8, chroma420_planar16, chroma420_interleaved8, chroma420_interleaved16;
+      bgrx_to_yuv_t::chroma444_row_t chroma444_8, chroma444_16;
+    };
+
+    constexpr kernel_set_t scalar_kernels {
+      "scalar",
+      luma_row_ref<std::uint8_t>,
+      luma_row_ref<std::uint16_t>,
+      chroma420_row_ref<std::uint8_t, false>,
+      chroma420_row_ref<std::uint16_t, false>,
+      chroma420_row_ref<std::uint8_t, true>,
+      chroma420_row_ref<std::uint16_t, true>,
+      chroma444_row_ref<std::uint8_t>,
+      chroma444_row_ref<std::uint16_t>,
+    };
+
+#ifdef VIDEO_CONVERT_AVX2
+    constexpr kernel_set_t avx2_kernels {
+      "avx2",
+      luma_row_avx2<std::uint8_t>,
+      luma_row_avx2<std::uint16_t>,
+      chroma420_row_avx2<std::uint8_t, false>,
+      chroma420_row_avx2<std::uint16_t, false>,
+      chroma420_row_avx2<std::uint8_t, true>,
+      chroma420_row_avx2<std::uint16_t, true>,
+      chroma444_row_avx2<std::uint8_t>,
+      chroma444_row_avx2<std::uint16_t>,
+    };
+#endif
+
+#ifdef VIDEO_CONVERT_NEON
+    constexpr kernel_set_t neon_kernels {
+      "neon",
+      luma_row_neon<std::uint8_t>,
+      luma_row_neon<std::uint16_t>,
+      chroma420_row_neon<std::uint8_t, false>,
+      chroma420_row_neon<std::uint16_t, false>,
+      chroma420_row_neon<std::uint8_t, true>,
+      chroma420_row_neon<std::uint16_t, true>,
+      chroma444_row_neon<std::uint8_t>,
+      chroma444_row_neon<std::uint16_t>,
+    };
+#endif
+
+    const kernel_set_t &best_kernels(bool allow_simd) {
+      if (allow_simd) {
+#if defined(VIDEO_CONVERT_AVX2)
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+          return avx2_kernels;
+        }
+#elif defined(VIDEO_CONVERT_NEON)
+        return neon_kernels;
+#endif
+      }
+
+      return scalar_kernels;
+    }
+  }  // namespace
+
+  unsigned bit_depth_from_yuv_layout(yuv_layout_e layout) {
+    switch (layout) {
+      case yuv_layout_e::p010:
+      case yuv_layout_e::yuv420p10:
+      case yuv_layout_e::yuv444p10:
+        return 10;
+      default:
+        return 8;
+    }
+  }
+
+  bgrx_to_yuv_t::bgrx_to_yuv_t(yuv_layout_e layout, const color_t &color_vectors, bool allow_simd):
+      _layout {layout} {
+    // The color vectors expect UNORM inputs, the kernels feed them 0-255
+    for (int x = 0; x < 3; ++x) {
+      _params.y[x] = color_vectors.color_vec_y[x] / 255.0f;
+      _params.u[x] = color_vectors.color_vec_u[x] / 255.0f;
+      _params.v[x] = color_vectors.color_vec_v[x] / 255.0f;
+      _params.u_sum4[x] = _params.u[x] / 4.0f;
+      _params.v_sum4[x] = _params.v[x] / 4.0f;
+    }
+    _params.y[3] = color_vectors.color_vec_y[3];
+    _params.u[3] = _params.u_sum4[3] = color_vectors.color_vec_u[3];
+    _params.v[3] = _params.v_sum4[3] = color_vectors.color_vec_v[3];
+
+    auto bit_depth = bit_depth_from_yuv_layout(layout);
+    _params.max_value = (1 << bit_depth) - 1;
+    _params.shift = layout == yuv_layout_e::p010 ? 16 - bit_depth : 0;
+
+    auto &kernels = best_kernels(allow_simd);
+    _kernel_name = kernels.name;
+
+    switch (layout) {
+      case yuv_layout_e::nv12:
+        _luma_row = kernels.luma8;
+        _chroma420_row = kernels.chroma420_interleaved8;
+        break;
+      case yuv_layout_e::p010:
+        _luma_row = kernels.luma16;
+        _chroma420_row = kernels.chroma420_interleaved16;
+        break;
+      case yuv_layout_e::yuv420p:
+        _luma_row = kernels.luma8;
+        _chroma420_row = kernels.chroma420_planar8;
+        break;
+      case yuv_layout_e::yuv420p10:
+        _luma_row = kernels.luma16;
+        _chroma420_row = kernels.chroma420_planar16;
+        break;
+      case yuv_layout_e::yuv444p:
+        _luma_row = kernels.luma8;
+        _chroma444_row = kernels.chroma444_8;
+        break;
+      case yuv_layout_e::yuv444p10:
+        _luma_row = kernels.luma16;
+        _chroma444_row = kernels.chroma444_16;
+        break;
+    }
+  }
+
+  void bgrx_to_yuv_t::convert(const std::uint8_t *src, int src_pitch, int width, int height, std::uint8_t *const dst[3], const int dst_pitch[3]) const {
+    for (int y = 0; y < height; ++y) {
+      auto row = src + (std::ptrdiff_t) y * src_pitch;
+      _luma_row(row, width, dst[0] + (std::ptrdiff_t) y * dst_pitch[0], _params);
+
+      if (_chroma444_row) {
+        _chroma444_row(row, width, dst[1] + (std::ptrdiff_t) y * dst_pitch[1], dst[2] + (std::ptrdiff_t) y * dst_pitch[2], _params);
+      } else if (y % 2 == 0) {
+        auto next_row = y + 1 < height ? row + src_pitch : row;
+        auto chroma_y = (std::ptrdiff_t) y / 2;
+        auto v = _layout == yuv_layout_e::nv12 || _layout == yuv_layout_e::p010 ? nullptr : dst[2] + chroma_y * dst_pitch[2];
+        _chroma420_row(row, next_row, width, dst[1] + chroma_y * dst_pitch[1], v, _params);
+      }
+    }
+  }
+
+  const char *bgrx_to_yuv_t::kernel_name() const {
+    return _kernel_name;
+  }
+}  // namespace video
@@ -0,0 +1,93 @@
+/**
+ * @file src/video_convert.h
+ * @brief Declarations for the SIMD BGRX to YUV conversion kernels.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+
+// local includes
+#include "video_colorspace.h"
+
+namespace video {
+
+  /**
+   * @brief YUV layouts with a specialized BGRX conversion kernel.
+   */
+  enum class yuv_layout_e {
+    nv12,  ///< 4:2:0, Y plane and interleaved UV plane, 8-bit
+    p010,  ///< 4:2:0, Y plane and interleaved UV plane, 10-bit in the high bits of 16-bit samples
+    yuv420p,  ///< 4:2:0, three planes, 8-bit
+    yuv420p10,  ///< 4:2:0, three planes, 10-bit in the low bits of 16-bit samples
+    yuv444p,  ///< 4:4:4, three planes, 8-bit
+    yuv444p10,  ///< 4:4:4, three planes, 10-bit in the low bits of 16-bit samples
+  };
+
+  /**
+   * @brief Get the bit depth a layout stores.
+   * @param layout The YUV layout.
+   * @return 8 or 10.
+   */
+  unsigned bit_depth_from_yuv_layout(yuv_layout_e layout);
+
+  /**
+   * @brief Unscaled BGRX to YUV converter that uses the best SIMD kernel the CPU supports.
+   * @details Chroma is subsampled with a 2x2 box filter for the 4:2:0 layouts. Odd frame sizes
+   *          repeat the last column and row. The color vectors must come from
+   *          `new_color_vectors_from_colorspace()` for the bit depth of the layout.
+   */
+  class bgrx_to_yuv_t {
+  public:
+    /**
+     * @brief Create a converter.
+     * @param layout The destination layout.
+     * @param color_vectors RGB to YUV vectors producing integer output.
+     * @param allow_simd Whether vector kernels may be used, `false` forces the scalar reference.
+     */
+    bgrx_to_yuv_t(yuv_layout_e layout, const color_t &color_vectors, bool allow_simd = true);
+
+    /**
+     * @brief Convert a frame.
+     * @param src First pixel of the BGRX image.
+     * @param src_pitch Bytes between the starts of two image rows.
+     * @param width Width of the image and the destination in pixels.
+     * @param height Height of the image and the destination in pixels.
+     * @param dst Destination planes. Only the first two are used for the interleaved layouts.
+     * @param dst_pitch Bytes between the starts of two rows of each destination plane.
+     */
+    void convert(const std::uint8_t *src, int src_pitch, int width, int height, std::uint8_t *const dst[3], const int dst_pitch[3]) const;
+
+    /**
+     * @brief Get the name of the selected kernel.
+     * @return "avx2", "neon" or "scalar".
+     */
+    const char *kernel_name() const;
+
+    /**
+     * @brief Conversion coefficients, pre-scaled for 8-bit inputs.
+     */
+    struct params_t {
+      float y[4];  ///< R, G and B multipliers and the offset for luma
+      float u[4];  ///< R, G and B multipliers and the offset for one pixel of Cb
+      float v[4];  ///< R, G and B multipliers and the offset for one pixel of Cr
+      float u_sum4[4];  ///< Cb multipliers for the sum of a 2x2 block
+      float v_sum4[4];  ///< Cr multipliers for the sum of a 2x2 block
+      int max_value;  ///< Largest sample value
+      int shift;  ///< Left shift applied to stored 16-bit samples
+    };
+
+    using luma_row_t = void (*)(const std::uint8_t *src, int width, void *dst, const params_t &params);
+    using chroma420_row_t = void (*)(const std::uint8_t *src0, const std::uint8_t *src1, int width, void *u, void *v, const params_t &params);
+    using chroma444_row_t = void (*)(const std::uint8_t *src, int width, void *u, void *v, const params_t &params);
+
+  private:
+    yuv_layout_e _layout;
+    params_t _params;
+    const char *_kernel_name;
+
+    luma_row_t _luma_row;
+    chroma420_row_t _chroma420_row = nullptr;
+    chroma444_row_t _chroma444_row = nullptr;
+  };
+}  // namespace video
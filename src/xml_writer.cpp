@@ -0,0 +1,142 @@
+/**
+ * @file src/xml_writer.cpp
+ * @brief Definitions for writing the XML responses of the GameStream protocol.
+ */
+// local includes
+#include "xml_writer.h"
+
+using namespace std::literals;
+
+namespace xml {
+  namespace {
+    /**
+     * @brief Entity of every character that needs one, the same ones property_tree escapes.
+     */
+    constexpr auto entities = []() {
+      std::array<std::string_view, 256> entities {};
+      entities['&'] = "&amp;"sv;
+      entities['<'] = "&lt;"sv;
+      entities['>'] = "&gt;"sv;
+      entities['"'] = "&quot;"sv;
+      entities['\''] = "&apos;"sv;
+      return entities;
+    }();
+
+    void append_element(std::string &out, std::string_view name, std::string_view content) {
+      out += '<';
+      out += name;
+      if (content.empty()) {
+        out += "/>"sv;
+        return;
+      }
+
+      out += '>';
+      out += content;
+      out += "</"sv;
+      out += name;
+      out += '>';
+    }
+  }  // namespace
+
+  void append_escaped(std::string &out, std::string_view text) {
+    std::size_t run = 0;
+    for (std::size_t x = 0; x < text.size(); ++x) {
+      auto &entity = entities[(unsigned char) text[x]];
+      if (entity.empty()) {
+        continue;
+      }
+
+      out.append(text.data() + run, x - run);
+      out += entity;
+      run = x + 1;
+    }
+    out.append(text.data() + run, text.size() - run);
+  }
+
+  void element_t::add(std::string_view name, const value_t &value) {
+    std::string content;
+    append_escaped(content, value.text());
+    append_element(_content, name, content);
+  }
+
+  void response_t::attribute(std::string_view name, const value_t &value) {
+    std::string escaped;
+    append_escaped(escaped, value.text());
+    set(_attributes, name, escaped);
+  }
+
+  void response_t::put(std::string_view name, const value_t &value) {
+    std::string escaped;
+    append_escaped(escaped, value.text());
+    set(_elements, name, escaped);
+  }
+
+  void response_t::add(std::string_view name, const value_t &value) {
+    std::string escaped;
+    append_escaped(escaped, value.text());
+    _elements.emplace_back(name, std::move(escaped));
+  }
+
+  void response_t::add(std::string_view name, const element_t &children) {
+    _elements.emplace_back(name, children.str());
+  }
+
+  std::optional<std::string_view> response_t::get(std::string_view name) const {
+    return find(_elements, name);
+  }
+
+  std::optional<std::string_view> response_t::get_attribute(std::string_view name) const {
+    return find(_attributes, name);
+  }
+
+  std::string_view response_t::str() const {
+    thread_local std::string buffer;
+    buffer.clear();
+
+    buffer += "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"sv;
+    if (_attributes.empty() && _elements.empty()) {
+      return buffer;
+    }
+
+    buffer += "<root"sv;
+    for (auto &[name, value] : _attributes) {
+      buffer += ' ';
+      buffer += name;
+      buffer += "=\""sv;
+      buffer += value;
+      buffer += '"';
+    }
+
+    if (_elements.empty()) {
+      buffer += "/>"sv;
+      return buffer;
+    }
+
+    buffer += '>';
+    for (auto &[name, content] : _elements) {
+      append_element(buffer, name, content);
+    }
+    buffer += "</root>"sv;
+
+    return buffer;
+  }
+
+  void response_t::set(std::vector<field_t> &fields, std::string_view name, std::string_view value) {
+    for (auto &field : fields) {
+      if (field.first == name) {
+        field.second = value;
+        return;
+      }
+    }
+    fields.emplace_back(name, value);
+  }
+
+  std::optional<std::string_view> response_t::find(const std::vector<field_t> &fields, std::string_view name) {
+    for (auto &field : fields) {
+      if (field.first == name) {
+        return field.second;
+      }
+    }
+    return std::nullopt;
+  }
+}  // namespace xml
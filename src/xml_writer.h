@@ -0,0 +1,162 @@
+/**
+ * @file src/xml_writer.h
+ * @brief Declarations for writing the XML responses of the GameStream protocol.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <charconv>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Minimal XML writer for the `<root>` documents sent to Moonlight.
+ * @details The output matches `boost::property_tree::write_xml()` for the same fields, without
+ *          allocating a tree node per field or going through a stream to format numbers.
+ */
+namespace xml {
+  /**
+   * @brief The text of an attribute or an element, formatted without allocating.
+   */
+  class value_t {
+  public:
+    value_t(std::string_view text):
+        _text {text} {
+    }
+
+    value_t(const std::string &text):
+        _text {text} {
+    }
+
+    value_t(const char *text):
+        _text {text} {
+    }
+
+    value_t(bool value):
+        _text {value ? "true" : "false"} {
+    }
+
+    template<class T>
+      requires std::is_integral_v<T>
+    value_t(T value) {
+      auto [ptr, ec] = std::to_chars(_buffer.data(), _buffer.data() + _buffer.size(), value);
+      _text = {_buffer.data(), (std::size_t) (ptr - _buffer.data())};
+    }
+
+    value_t(const value_t &) = delete;
+    value_t &operator=(const value_t &) = delete;
+
+    /**
+     * @brief Get the unescaped text.
+     * @return The text.
+     */
+    std::string_view text() const {
+      return _text;
+    }
+
+  private:
+    std::array<char, 24> _buffer;
+    std::string_view _text;
+  };
+
+  /**
+   * @brief Append text with the XML special characters escaped.
+   * @param out The string to append to.
+   * @param text The text.
+   */
+  void append_escaped(std::string &out, std::string_view text);
+
+  /**
+   * @brief Child elements written as they are added, e.g. an `<App>` of the app list.
+   */
+  class element_t {
+  public:
+    /**
+     * @brief Append a child element.
+     * @param name The name of the element.
+     * @param value The text of the element.
+     */
+    void add(std::string_view name, const value_t &value);
+
+    /**
+     * @brief Get the serialized child elements.
+     * @return The XML.
+     */
+    std::string_view str() const {
+      return _content;
+    }
+
+  private:
+    std::string _content;
+  };
+
+  /**
+   * @brief A response document: a `<root>` element with attributes and child elements.
+   * @details Setting an attribute or an element again replaces its value in place, so error paths
+   *          can overwrite the status and fields set before them.
+   */
+  class response_t {
+  public:
+    /**
+     * @brief Set an attribute of the root element, e.g. `status_code`.
+     * @param name The name of the attribute.
+     * @param value The value.
+     */
+    void attribute(std::string_view name, const value_t &value);
+
+    /**
+     * @brief Set a child element of the root element.
+     * @param name The name of the element.
+     * @param value The text of the element.
+     */
+    void put(std::string_view name, const value_t &value);
+
+    /**
+     * @brief Append a child element, even if one with the same name exists.
+     * @param name The name of the element.
+     * @param value The text of the element.
+     */
+    void add(std::string_view name, const value_t &value);
+
+    /**
+     * @brief Append a child element that has children of its own.
+     * @param name The name of the element.
+     * @param children The children.
+     */
+    void add(std::string_view name, const element_t &children);
+
+    /**
+     * @brief Get the escaped text of a child element.
+     * @param name The name of the element.
+     * @return The text, or an empty value if there is no such element.
+     */
+    std::optional<std::string_view> get(std::string_view name) const;
+
+    /**
+     * @brief Get the escaped value of an attribute.
+     * @param name The name of the attribute.
+     * @return The value, or an empty value if there is no such attribute.
+     */
+    std::optional<std::string_view> get_attribute(std::string_view name) const;
+
+    /**
+     * @brief Serialize the document.
+     * @return The XML, valid until the next call on the same thread.
+     */
+    std::string_view str() const;
+
+  private:
+    using field_t = std::pair<std::string, std::string>;  ///< Name and escaped content
+
+    static void set(std::vector<field_t> &fields, std::string_view name, std::string_view value);
+    static std::optional<std::string_view> find(const std::vector<field_t> &fields, std::string_view name);
+
+    std::vector<field_t> _attributes;
+    std::vector<field_t> _elements;
+  };
+}  // namespace xml
@@ -0,0 +1,5 @@
+#include "include/convert_linear_base.hlsl"
+
+#define LEFT_SUBSAMPLING
+
+#include "include/convert_yuv420_cs_base.hlsl"
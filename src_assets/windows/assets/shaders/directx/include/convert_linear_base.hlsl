@@ -1,6 +1,15 @@
 #include "include/common.hlsl"
 
+cbuffer tone_map_cbuffer : register(b2) {
+    float white_scale; // 1 / scRGB value of SDR white, 0 to clip instead of tone mapping
+    float peak_white; // Brightest highlight relative to SDR white, mapped to SDR white
+};
+
 float3 CONVERT_FUNCTION(float3 input)
 {
+    if (white_scale > 0) {
+        input = ToneMapToSDR(input * white_scale, peak_white);
+    }
+
     return ApplySRGBCurve(saturate(input));
 }
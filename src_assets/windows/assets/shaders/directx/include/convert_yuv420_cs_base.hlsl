@@ -0,0 +1,77 @@
+Texture2D image : register(t0);
+SamplerState def_sampler : register(s0);
+
+RWTexture2D<float> output_y : register(u0);
+RWTexture2D<float2> output_uv : register(u1);
+
+cbuffer color_matrix_cbuffer : register(b0) {
+    float4 color_vec_y;
+    float4 color_vec_u;
+    float4 color_vec_v;
+    float2 range_y;
+    float2 range_uv;
+};
+
+cbuffer compute_params_cbuffer : register(b1) {
+    float4 viewport; // x, y, width, height of the image in the Y plane
+    float2 subsample_offset;
+    int2 block_offset; // first 2x2 block of the Y plane to convert
+    int2 block_count;
+};
+
+// Each thread converts a 2x2 block of the Y plane and the UV sample it shares,
+// so the source is only read once for both planes
+[numthreads(8, 8, 1)]
+void main_cs(uint3 thread_id : SV_DispatchThreadID)
+{
+    if (any(thread_id.xy >= (uint2) block_count)) {
+        return;
+    }
+
+    int2 block = block_offset + (int2) thread_id.xy;
+    int2 y_pos = block * 2;
+
+    // Pixels outside of the viewport keep the black bars they were cleared to
+    [unroll]
+    for (int i = 0; i < 4; ++i) {
+        int2 pos = y_pos + int2(i & 1, i >> 1);
+        float2 tex_coord = ((float2) pos + 0.5 - viewport.xy) / viewport.zw;
+        if (all(tex_coord >= 0 && tex_coord < 1)) {
+            float3 rgb = CONVERT_FUNCTION(image.SampleLevel(def_sampler, tex_coord, 0).rgb);
+            float y = dot(color_vec_y.xyz, rgb) + color_vec_y.w;
+            output_y[pos] = y * range_y.x + range_y.y;
+        }
+    }
+
+    float2 tex_coord = ((float2) block + 0.5 - viewport.xy / 2) / (viewport.zw / 2);
+    if (any(tex_coord < 0 || tex_coord >= 1)) {
+        return;
+    }
+
+    // Sampled at the same positions as the UV pixel shaders
+#if defined(LEFT_SUBSAMPLING)
+    float3 rgb_left = image.SampleLevel(def_sampler, float2(tex_coord.x - subsample_offset.x, tex_coord.y), 0).rgb;
+    float3 rgb_right = image.SampleLevel(def_sampler, tex_coord, 0).rgb;
+    float3 rgb = CONVERT_FUNCTION((rgb_left + rgb_right) * 0.5);
+#elif defined(LEFT_SUBSAMPLING_SCALE)
+    float2 halfsample_offset = subsample_offset / 2;
+    float3 right_center_left = float3(tex_coord.x + halfsample_offset.x,
+                                      tex_coord.x - halfsample_offset.x,
+                                      tex_coord.x - 3 * halfsample_offset.x);
+    float2 top_bottom = float2(tex_coord.y - halfsample_offset.y,
+                               tex_coord.y + halfsample_offset.y);
+    float3 rgb = image.SampleLevel(def_sampler, float2(right_center_left.y, top_bottom.x), 0).rgb; // top-center
+    rgb += image.SampleLevel(def_sampler, float2(right_center_left.y, top_bottom.y), 0).rgb; // bottom-center
+    rgb *= 2;
+    rgb += image.SampleLevel(def_sampler, float2(right_center_left.x, top_bottom.x), 0).rgb; // top-right
+    rgb += image.SampleLevel(def_sampler, float2(right_center_left.z, top_bottom.x), 0).rgb; // top-left
+    rgb += image.SampleLevel(def_sampler, float2(right_center_left.x, top_bottom.y), 0).rgb; // bottom-right
+    rgb += image.SampleLevel(def_sampler, float2(right_center_left.z, top_bottom.y), 0).rgb; // bottom-left
+    rgb = CONVERT_FUNCTION(rgb * (1./8));
+#endif
+
+    float u = dot(color_vec_u.xyz, rgb) + color_vec_u.w;
+    float v = dot(color_vec_v.xyz, rgb) + color_vec_v.w;
+
+    output_uv[block] = float2(u * range_uv.x + range_uv.y, v * range_uv.x + range_uv.y);
+}
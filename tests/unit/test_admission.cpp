@@ -0,0 +1,54 @@
+/**
+ * @file tests/unit/test_admission.cpp
+ * @brief Test src/admission.*.
+ */
+#include "../tests_common.h"
+
+#include <src/admission.h>
+#include <src/calibration.h>
+
+namespace {
+  constexpr admission::stream_t stream_4k_60 {3840, 2160, 60};
+  constexpr admission::stream_t stream_1080p_60 {1920, 1080, 60};
+
+  // Room for exactly two 4K60 sessions after the headroom
+  const double capacity = 2 * stream_4k_60.pixel_rate() * calibration::headroom;
+}  // namespace
+
+TEST(AdmissionTests, AdmitsSessionsThatFit) {
+  auto decision = admission::decide(stream_4k_60, stream_4k_60.pixel_rate(), capacity, false);
+  EXPECT_EQ(decision.verdict, admission::verdict_e::admit);
+  EXPECT_EQ(decision.stream.width, 3840);
+  EXPECT_TRUE(decision.reason.empty());
+
+  // The first session, and any session with an unknown capacity, always fits
+  EXPECT_EQ(admission::decide(stream_4k_60, 0, capacity, false).verdict, admission::verdict_e::admit);
+  EXPECT_EQ(admission::decide(stream_4k_60, 10 * capacity, 0, false).verdict, admission::verdict_e::admit);
+}
+
+TEST(AdmissionTests, RejectsSessionsThatDontFit) {
+  auto decision = admission::decide(stream_4k_60, 2 * stream_4k_60.pixel_rate(), capacity, false);
+  EXPECT_EQ(decision.verdict, admission::verdict_e::reject);
+  EXPECT_FALSE(decision.reason.empty());
+}
+
+TEST(AdmissionTests, DowngradesTheResolutionBeforeTheFramerate) {
+  // Room for more than a 1080p60 session is left, but not for a 1440p60 one
+  auto load = 2 * stream_4k_60.pixel_rate() - 1.5 * stream_1080p_60.pixel_rate();
+  auto decision = admission::decide(stream_4k_60, load, capacity, true);
+  EXPECT_EQ(decision.verdict, admission::verdict_e::downgrade);
+  EXPECT_EQ(decision.stream.width, 1920);
+  EXPECT_EQ(decision.stream.height, 1080);
+  EXPECT_EQ(decision.stream.fps, 60);
+
+  // Less than 720p60 is left, so the framerate goes down too
+  load = 2 * stream_4k_60.pixel_rate() - 1280 * 720 * 40.0;
+  decision = admission::decide(stream_4k_60, load, capacity, true);
+  EXPECT_EQ(decision.verdict, admission::verdict_e::downgrade);
+  EXPECT_EQ(decision.stream.height, 720);
+  EXPECT_EQ(decision.stream.fps, 30);
+
+  // Nothing is left at all
+  decision = admission::decide(stream_4k_60, 2 * stream_4k_60.pixel_rate(), capacity, true);
+  EXPECT_EQ(decision.verdict, admission::verdict_e::reject);
+}
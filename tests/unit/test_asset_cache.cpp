@@ -0,0 +1,125 @@
+/**
+ * @file tests/unit/test_asset_cache.cpp
+ * @brief Test src/asset_cache.*.
+ */
+#include "../tests_common.h"
+
+#include <filesystem>
+#include <fstream>
+#include <src/asset_cache.h>
+#include <zlib.h>
+
+using asset_cache::encoding_e;
+
+namespace {
+  std::string gunzip(const std::string &compressed) {
+    z_stream stream {};
+    inflateInit2(&stream, 15 + 16);
+
+    std::string out(1024 * 1024, '\0');
+    stream.next_in = (Bytef *) compressed.data();
+    stream.avail_in = (uInt) compressed.size();
+    stream.next_out = (Bytef *) out.data();
+    stream.avail_out = (uInt) out.size();
+    EXPECT_EQ(inflate(&stream, Z_FINISH), Z_STREAM_END);
+    out.resize(stream.total_out);
+
+    inflateEnd(&stream);
+    return out;
+  }
+}  // namespace
+
+TEST(AssetCacheTests, NegotiatesTheSmallestAcceptedEncoding) {
+  asset_cache::asset_t asset;
+  asset.identity = std::string(100, 'a');
+  asset.gzip = std::string(20, 'g');
+
+  EXPECT_EQ(asset_cache::negotiate("gzip, deflate, br", asset), encoding_e::gzip);
+  EXPECT_EQ(asset_cache::negotiate("GZIP;q=0.5", asset), encoding_e::gzip);
+  EXPECT_EQ(asset_cache::negotiate("gzip;q=0", asset), encoding_e::identity);
+  EXPECT_EQ(asset_cache::negotiate("*", asset), encoding_e::gzip);
+  EXPECT_EQ(asset_cache::negotiate("", asset), encoding_e::identity);
+
+  asset.brotli = std::string(10, 'b');
+  EXPECT_EQ(asset_cache::negotiate("gzip, deflate, br", asset), encoding_e::brotli);
+  EXPECT_EQ(asset_cache::negotiate("gzip", asset), encoding_e::gzip);
+}
+
+TEST(AssetCacheTests, MatchesEntityTagsOfEveryEncoding) {
+  asset_cache::asset_t asset;
+  asset.etag = "\"abc\"";
+  asset.identity = "content";
+  asset.gzip = "gz";
+
+  EXPECT_EQ(asset.etag_for(encoding_e::gzip), "\"abc-gzip\"");
+  EXPECT_TRUE(asset_cache::not_modified("\"abc\"", asset));
+  EXPECT_TRUE(asset_cache::not_modified("\"other\", W/\"abc-gzip\"", asset));
+  EXPECT_TRUE(asset_cache::not_modified("*", asset));
+  EXPECT_FALSE(asset_cache::not_modified("\"abc-br\"", asset));
+  EXPECT_FALSE(asset_cache::not_modified("\"abcd\"", asset));
+}
+
+TEST(AssetCacheTests, LoadsAndCompressesADirectory) {
+  auto dir = platf::appdata() / "tests" / "asset_cache";
+  std::filesystem::create_directories(dir / "assets");
+
+  std::string page;
+  for (int x = 0; x < 1000; ++x) {
+    page += "<p>compressible</p>\n";
+  }
+  std::ofstream {dir / "index.html", std::ios::binary} << page;
+  std::ofstream {dir / "assets" / "tiny.js", std::ios::binary} << "x";
+
+  asset_cache::cache_t cache;
+  EXPECT_EQ(cache.load(dir), 2u);
+
+  auto index = cache.find("index.html");
+  ASSERT_NE(index, nullptr);
+  EXPECT_EQ(index->identity, page);
+  ASSERT_FALSE(index->gzip.empty());
+  EXPECT_LT(index->gzip.size(), page.size() / 10);
+  EXPECT_EQ(gunzip(index->gzip), page);
+  EXPECT_EQ(index->etag.size(), 34u);
+
+  // Compressing a single byte only adds headers
+  auto tiny = cache.find("assets/tiny.js");
+  ASSERT_NE(tiny, nullptr);
+  EXPECT_TRUE(tiny->gzip.empty());
+  EXPECT_EQ(asset_cache::negotiate("gzip, br", *tiny), encoding_e::identity);
+  EXPECT_NE(tiny->etag, index->etag);
+
+  EXPECT_EQ(cache.find("missing.html"), nullptr);
+
+  std::filesystem::remove_all(dir);
+}
+
+TEST(AssetCacheTests, FileCacheReloadsChangedFiles) {
+  auto dir = platf::appdata() / "tests" / "file_cache";
+  std::filesystem::create_directories(dir);
+  std::ofstream {dir / "a.png", std::ios::binary} << std::string(40, 'a');
+  std::ofstream {dir / "b.png", std::ios::binary} << std::string(40, 'b');
+
+  asset_cache::file_cache_t cache {100};
+  auto a = cache.get(dir / "a.png");
+  ASSERT_NE(a, nullptr);
+  EXPECT_EQ(a->identity, std::string(40, 'a'));
+  EXPECT_EQ(cache.get(dir / "a.png"), a);
+
+  std::ofstream {dir / "a.png", std::ios::binary} << std::string(50, 'A');
+  auto changed = cache.get(dir / "a.png");
+  ASSERT_NE(changed, nullptr);
+  EXPECT_EQ(changed->identity, std::string(50, 'A'));
+  EXPECT_NE(changed->etag, a->etag);
+
+  // 50 + 40 fit, a third file pushes out the least recently used one
+  auto b = cache.get(dir / "b.png");
+  EXPECT_EQ(cache.get(dir / "a.png"), changed);
+  std::ofstream {dir / "c.png", std::ios::binary} << std::string(40, 'c');
+  ASSERT_NE(cache.get(dir / "c.png"), nullptr);
+  EXPECT_EQ(cache.get(dir / "a.png"), changed);
+  EXPECT_NE(cache.get(dir / "b.png"), b);
+
+  EXPECT_EQ(cache.get(dir / "missing.png"), nullptr);
+
+  std::filesystem::remove_all(dir);
+}
@@ -44,14 +44,14 @@ TEST_P(AudioTest, TestEncode) {
   std::thread timer([&] {
     // Terminate the audio capture after 100 ms
     std::this_thread::sleep_for(100ms);
-    const auto shutdown_event = m_mail->event<bool>(mail::shutdown);
-    const auto audio_packets = m_mail->queue<packet_t>(mail::audio_packets);
+    const auto shutdown_event = m_mail->event(mail::shutdown);
+    const auto audio_packets = m_mail->queue(mail::audio_packets);
     shutdown_event->raise(true);
     audio_packets->stop();
   });
   std::thread capture([&] {
-    const auto packets = m_mail->queue<packet_t>(mail::audio_packets);
-    const auto shutdown_event = m_mail->event<bool>(mail::shutdown);
+    const auto packets = m_mail->queue(mail::audio_packets);
+    const auto shutdown_event = m_mail->event(mail::shutdown);
     while (const auto packet = packets->pop()) {
       if (shutdown_event->peek()) {
         break;
@@ -66,3 +66,100 @@ TEST_P(AudioTest, TestEncode) {
   timer.join();
   capture.join();
 }
+
+namespace {
+  constexpr auto packet_duration = 20ms;
+
+  /**
+   * @brief Push packets to a jitter buffer at a steady pace, tagged with their sequence number.
+   */
+  void push_packets(jitter_buffer_t &jitter, std::uint16_t first, int count, std::chrono::steady_clock::time_point &arrival) {
+    for (int x = 0; x < count; ++x) {
+      std::uint16_t sequence_number = first + x;
+      jitter.push(sequence_number, {(std::uint8_t) sequence_number}, arrival);
+      arrival += packet_duration;
+    }
+  }
+}  // namespace
+
+TEST(JitterBufferTests, PlaysInOrderAcrossWraparound) {
+  jitter_buffer_t jitter {packet_duration};
+  auto arrival = std::chrono::steady_clock::now();
+
+  std::uint16_t sequence_number = 65534;
+  for (std::uint8_t expected : {254, 255, 0, 1}) {
+    push_packets(jitter, sequence_number++, 1, arrival);
+    EXPECT_EQ(jitter.target_depth(), 1);
+
+    auto slot = jitter.pop();
+    ASSERT_EQ(slot.type, jitter_buffer_t::slot_e::packet);
+    EXPECT_EQ(slot.payload, std::vector<std::uint8_t> {expected});
+  }
+}
+
+TEST(JitterBufferTests, LostPacketIsRecoveredFromTheNextOne) {
+  jitter_buffer_t jitter {packet_duration};
+  auto arrival = std::chrono::steady_clock::now();
+
+  push_packets(jitter, 10, 1, arrival);
+  arrival += packet_duration;
+  push_packets(jitter, 12, 1, arrival);
+
+  EXPECT_EQ(jitter.pop().type, jitter_buffer_t::slot_e::packet);
+
+  // Packet 11 never arrived, packet 12 carries it as FEC
+  auto slot = jitter.pop();
+  EXPECT_EQ(slot.type, jitter_buffer_t::slot_e::conceal);
+  EXPECT_EQ(slot.payload, std::vector<std::uint8_t> {12});
+
+  slot = jitter.pop();
+  EXPECT_EQ(slot.type, jitter_buffer_t::slot_e::packet);
+  EXPECT_EQ(slot.payload, std::vector<std::uint8_t> {12});
+
+  // Late packets are dropped
+  jitter.push(11, {11}, arrival);
+  EXPECT_EQ(jitter.depth(), 0u);
+}
+
+TEST(JitterBufferTests, UnderrunDeepensTheBuffer) {
+  jitter_buffer_t jitter {packet_duration};
+  auto arrival = std::chrono::steady_clock::now();
+
+  push_packets(jitter, 0, 1, arrival);
+  EXPECT_EQ(jitter.pop().type, jitter_buffer_t::slot_e::packet);
+
+  auto slot = jitter.pop();
+  EXPECT_EQ(slot.type, jitter_buffer_t::slot_e::conceal);
+  EXPECT_TRUE(slot.payload.empty());
+  EXPECT_EQ(jitter.target_depth(), 2);
+
+  // Playback resumes once the deeper target is buffered
+  push_packets(jitter, 1, 1, arrival);
+  EXPECT_EQ(jitter.pop().type, jitter_buffer_t::slot_e::idle);
+  push_packets(jitter, 2, 1, arrival);
+  EXPECT_EQ(jitter.pop().type, jitter_buffer_t::slot_e::packet);
+}
+
+TEST(JitterBufferTests, JitterRaisesTheTargetAndBacklogIsTrimmed) {
+  jitter_buffer_t jitter {packet_duration};
+  auto arrival = std::chrono::steady_clock::now();
+
+  // Packets arrive in bursts of two
+  for (std::uint16_t x = 0; x < 64; ++x) {
+    jitter.push(x, {(std::uint8_t) x}, arrival + (x / 2) * 2 * packet_duration);
+    if (x % 2) {
+      jitter.pop();
+      jitter.pop();
+    }
+  }
+  EXPECT_GT(jitter.target_depth(), 1);
+  EXPECT_LE(jitter.target_depth(), jitter_buffer_t::max_depth);
+
+  // A backlog beyond the target is dropped rather than played late
+  jitter_buffer_t smooth {packet_duration};
+  push_packets(smooth, 0, 6, arrival);
+  auto slot = smooth.pop();
+  ASSERT_EQ(slot.type, jitter_buffer_t::slot_e::packet);
+  EXPECT_EQ(slot.payload, std::vector<std::uint8_t> {4});
+  EXPECT_EQ(smooth.depth(), 1u);
+}
@@ -0,0 +1,145 @@
+/**
+ * @file tests/unit/test_audio_convert.cpp
+ * @brief Test src/audio_convert.*.
+ */
+#include "../tests_common.h"
+
+#include <cmath>
+#include <numbers>
+#include <random>
+#include <src/audio_convert.h>
+#include <vector>
+
+using audio::pcm_format_e;
+using audio::remixer_t;
+using audio::resampler_t;
+namespace speaker = audio::speaker;
+
+namespace {
+  constexpr float minus_3db = 0.70710678f;
+
+  std::vector<float> sine(int rate, double frequency, std::size_t frames) {
+    std::vector<float> samples(frames);
+    for (std::size_t x = 0; x < frames; ++x) {
+      samples[x] = (float) (0.5 * std::sin(2.0 * std::numbers::pi * frequency * x / rate));
+    }
+    return samples;
+  }
+}  // namespace
+
+TEST(RemixerTests, MatchingLayoutIsCopied) {
+  remixer_t remixer {pcm_format_e::f32, 8, speaker::surround71, 8, speaker::surround71};
+  EXPECT_STREQ(remixer.kernel_name(), "copy");
+
+  std::vector<float> in(8 * 3);
+  for (std::size_t x = 0; x < in.size(); ++x) {
+    in[x] = (float) x;
+  }
+  std::vector<float> out(in.size());
+  remixer.convert(in.data(), 3, out.data());
+  EXPECT_EQ(in, out);
+}
+
+TEST(RemixerTests, SurroundToStereoDownmix) {
+  remixer_t remixer {pcm_format_e::f32, 8, speaker::surround71, 2, speaker::stereo};
+
+  // FL FR FC LFE BL BR SL SR
+  EXPECT_FLOAT_EQ(remixer.gain(0, 0), 1.0f);
+  EXPECT_FLOAT_EQ(remixer.gain(1, 0), 0.0f);
+  EXPECT_FLOAT_EQ(remixer.gain(0, 2), minus_3db);
+  EXPECT_FLOAT_EQ(remixer.gain(1, 2), minus_3db);
+  EXPECT_FLOAT_EQ(remixer.gain(0, 3), 0.0f);
+  EXPECT_FLOAT_EQ(remixer.gain(0, 4), minus_3db);
+  EXPECT_FLOAT_EQ(remixer.gain(1, 5), minus_3db);
+  EXPECT_FLOAT_EQ(remixer.gain(0, 6), minus_3db);
+  EXPECT_FLOAT_EQ(remixer.gain(1, 7), minus_3db);
+}
+
+TEST(RemixerTests, SideSpeakersFoldIntoBackSpeakers) {
+  constexpr auto surround51_side = speaker::stereo | speaker::front_center | speaker::low_frequency | speaker::side_left | speaker::side_right;
+  remixer_t remixer {pcm_format_e::f32, 6, surround51_side, 6, speaker::surround51};
+
+  // The side speakers take the place of the back speakers, so the channels line up
+  EXPECT_FLOAT_EQ(remixer.gain(3, 3), 1.0f);
+  EXPECT_FLOAT_EQ(remixer.gain(4, 4), 1.0f);
+  EXPECT_FLOAT_EQ(remixer.gain(5, 5), 1.0f);
+}
+
+TEST(RemixerTests, IntegerSamplesAreNormalized) {
+  remixer_t remixer {pcm_format_e::s16, 2, speaker::stereo, 2, speaker::stereo};
+
+  std::int16_t in[] {-32768, 16384};
+  float out[2];
+  remixer.convert(in, 1, out);
+  EXPECT_FLOAT_EQ(out[0], -1.0f);
+  EXPECT_FLOAT_EQ(out[1], 0.5f);
+}
+
+TEST(RemixerTests, VectorKernelMatchesScalarReference) {
+  constexpr std::size_t frames = 37;
+  std::vector<std::int32_t> in(frames * 12);
+  std::mt19937 rng {1234};
+  for (auto &sample : in) {
+    sample = (std::int32_t) rng();
+  }
+
+  // 7.1.4 to each of the encoder layouts, with room to catch writes past the end
+  constexpr auto surround714 = speaker::surround71 | speaker::top_front_left | speaker::top_front_right | speaker::top_back_left | speaker::top_back_right;
+  for (auto [channels, mask] : {std::pair {2, speaker::stereo}, {6, speaker::surround51}, {8, speaker::surround71}}) {
+    remixer_t simd {pcm_format_e::s32, 12, surround714, channels, mask};
+    remixer_t scalar {pcm_format_e::s32, 12, surround714, channels, mask, false};
+    EXPECT_STREQ(scalar.kernel_name(), "scalar");
+
+    std::vector<float> simd_out(frames * channels + 8, -2.0f);
+    std::vector<float> scalar_out(frames * channels + 8, -2.0f);
+    simd.convert(in.data(), frames, simd_out.data());
+    scalar.convert(in.data(), frames, scalar_out.data());
+
+    for (std::size_t x = 0; x < simd_out.size(); ++x) {
+      EXPECT_NEAR(simd_out[x], scalar_out[x], 1e-5f) << simd.kernel_name() << ' ' << channels << " channels, sample " << x;
+    }
+  }
+}
+
+TEST(ResamplerTests, RejectsUnreasonableRatios) {
+  EXPECT_TRUE(resampler_t::is_supported(44100, 48000));
+  EXPECT_TRUE(resampler_t::is_supported(192000, 48000));
+  EXPECT_FALSE(resampler_t::is_supported(47999, 48000));
+  EXPECT_FALSE(resampler_t::is_supported(0, 48000));
+}
+
+TEST(ResamplerTests, PreservesToneAndRate) {
+  constexpr int in_rate = 44100;
+  constexpr int out_rate = 48000;
+  constexpr double frequency = 1000.0;
+  auto in = sine(in_rate, frequency, in_rate);
+
+  // Feed uneven packet sizes like a capture device would
+  resampler_t resampler {1, in_rate, out_rate};
+  std::vector<float> out;
+  for (std::size_t x = 0; x < in.size(); x += 441) {
+    resampler.process(in.data() + x, std::min<std::size_t>(441, in.size() - x), out);
+  }
+  EXPECT_NEAR((double) out.size(), out_rate, 2.0);
+
+  // Compare against the ideal tone, delayed by the filter
+  auto delay = std::chrono::duration<double>(resampler.delay()).count();
+  double error = 0.0;
+  for (std::size_t x = out_rate / 10; x < out.size() - out_rate / 10; ++x) {
+    auto expected = 0.5 * std::sin(2.0 * std::numbers::pi * frequency * ((double) x / out_rate - delay));
+    error = std::max(error, std::abs(out[x] - expected));
+  }
+  EXPECT_LT(error, 1e-3);
+}
+
+TEST(ResamplerTests, TimestampsFollowTheFilterDelay) {
+  resampler_t resampler {2, 96000, 48000};
+  std::vector<float> in(2 * 960, 0.0f);
+  std::vector<float> out;
+
+  EXPECT_EQ(resampler.process(in.data(), 960, out), -resampler.delay());
+  EXPECT_EQ(out.size(), 2u * 480);
+
+  // Every output frame consumed exactly two input frames, so the next packet lines up again
+  EXPECT_EQ(resampler.process(in.data(), 960, out), -resampler.delay());
+}
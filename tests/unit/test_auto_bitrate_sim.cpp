@@ -0,0 +1,405 @@
+/**
+ * @file tests/unit/test_auto_bitrate_sim.cpp
+ * @brief Simulate src/auto_bitrate.* against network traces.
+ * @details The controller runs on a simulated clock against a link with a bottleneck queue and
+ *          an encoder that applies every change next_adjustment() asks for right away. Every trace
+ *          and controller config reports the throughput, the loss, the number of adjustments and
+ *          how long the bitrate took to settle after each change of the link. Set AUTO_BITRATE_TRACE
+ *          to a Mahimahi trace to replay a recorded link as well.
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <src/auto_bitrate.h>
+#include <src/config.h>
+#include <src/stream.h>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto step = 100ms;  ///< Resolution of the network model
+  constexpr auto report_interval = 500ms;  ///< Interval of the client's loss reports
+  constexpr auto queue_time = 200ms;  ///< Time the bottleneck buffers at its capacity before dropping
+  constexpr int initial_kbps = 40000;
+
+  /**
+   * @brief A stretch of a trace with a constant link.
+   */
+  struct segment_t {
+    std::chrono::milliseconds duration;
+    int capacity_kbps;
+    int base_rtt_ms;
+    double random_loss_pct;  ///< Packet loss independent of the load
+  };
+
+  struct trace_t {
+    std::string name;
+    std::vector<segment_t> segments;
+  };
+
+  struct controller_config_t {
+    std::string name;
+    int mode;
+    bool adaptive_fec;
+  };
+
+  struct result_t {
+    double throughput_kbps = 0.0;  ///< Video bits that made it through, including FEC
+    double loss_pct = 0.0;  ///< Frame loss the client saw
+    std::uint32_t adjustments = 0;
+    std::chrono::milliseconds convergence {};  ///< Longest time the bitrate took to settle in a segment
+    double final_send_kbps = 0.0;  ///< Sending rate averaged over the last quarter of the last segment
+  };
+
+  const std::vector<controller_config_t> controller_configs {
+    {"loss", 0, false},
+    {"delay", 1, false},
+    {"loss_fec", 0, true},
+    {"delay_fec", 1, true},
+  };
+
+  /**
+   * @brief Load a Mahimahi trace, one line per 1500 byte delivery opportunity in milliseconds.
+   * @param path The path of the trace.
+   * @return The trace in segments of one second, or an empty value if it can't be read.
+   */
+  std::optional<trace_t> load_mahimahi(const std::string &path) {
+    std::ifstream in {path};
+    std::vector<int> opportunities_per_second;
+    for (std::int64_t ms; in >> ms;) {
+      auto second = static_cast<std::size_t>(ms / 1000);
+      if (second >= opportunities_per_second.size()) {
+        opportunities_per_second.resize(second + 1);
+      }
+      ++opportunities_per_second[second];
+    }
+    if (opportunities_per_second.empty()) {
+      return std::nullopt;
+    }
+
+    trace_t trace {"mahimahi"};
+    for (auto opportunities : opportunities_per_second) {
+      trace.segments.push_back({1s, std::max(1, opportunities * 1500 * 8 / 1000), 20, 0.0});
+    }
+    return trace;
+  }
+
+  std::vector<trace_t> traces() {
+    std::vector<trace_t> traces {
+      {"wired", {{60s, 100000, 2, 0.0}}},
+      {"capacity_drop", {{20s, 60000, 10, 0.0}, {40s, 15000, 10, 0.0}, {40s, 35000, 10, 0.0}}},
+      {"lossy_wifi", {{60s, 45000, 5, 2.0}}},
+      {"hotel", {{20s, 12000, 40, 0.5}, {20s, 6000, 40, 0.5}, {20s, 10000, 40, 0.5}, {20s, 4000, 40, 0.5}, {20s, 8000, 40, 0.5}}},
+    };
+
+    if (auto path = std::getenv("AUTO_BITRATE_TRACE")) {
+      if (auto trace = load_mahimahi(path)) {
+        traces.push_back(std::move(*trace));
+      } else {
+        BOOST_LOG(warning) << "Couldn't read the trace "sv << path;
+      }
+    }
+    return traces;
+  }
+
+  /**
+   * @brief Time until the bitrate stayed within 20% of where it ended up.
+   * @param samples The bitrate at every step of a segment.
+   * @return The time.
+   */
+  std::chrono::milliseconds settle_time(const std::vector<int> &samples) {
+    if (samples.empty()) {
+      return 0ms;
+    }
+
+    auto settled = samples.back();
+    std::size_t last_outside = 0;
+    for (std::size_t x = 0; x < samples.size(); ++x) {
+      if (std::abs(samples[x] - settled) > settled / 5) {
+        last_outside = x + 1;
+      }
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(step * last_outside);
+  }
+
+  /**
+   * @brief Apply what the control thread requests after a loss report, with an encoder that accepts every change.
+   */
+  void control_tick(stream::auto_bitrate_controller_t &controller, stream::session_t *session, int &encoder_kbps) {
+    auto adjustment = controller.next_adjustment(session);
+    if (adjustment.ladder_step) {
+      controller.confirm_ladder_change(session, true);
+    }
+    if (adjustment.bitrate_kbps) {
+      encoder_kbps = adjustment.bitrate_kbps;
+      controller.confirm_bitrate_change(session, adjustment.bitrate_kbps, true);
+    }
+  }
+
+  std::shared_ptr<stream::session_t> make_session(int bitrate_kbps) {
+    auto session = std::make_shared<stream::session_t>();
+    session->auto_bitrate_enabled = true;
+    session->config.monitor.width = 1920;
+    session->config.monitor.height = 1080;
+    session->config.monitor.framerate = 60;
+    session->config.monitor.encodingFramerate = 60000;
+    session->config.monitor.bitrate = bitrate_kbps;
+    session->video.fec_percentage = config::stream.fec_percentage;
+    session->stats.bitrate_kbps = bitrate_kbps;
+    return session;
+  }
+
+  result_t simulate(const trace_t &trace) {
+    // steady_clock's epoch is used as "never" by the controller
+    auto now = std::chrono::steady_clock::time_point {} + 1h;
+    stream::auto_bitrate_controller_t controller {[&now]() {
+      return now;
+    }};
+
+    auto session = make_session(initial_kbps);
+
+    result_t result;
+    int encoder_kbps = initial_kbps;
+    double queue_kbit = 0.0;
+    double sent_kbit = 0.0;
+    double delivered_kbit = 0.0;
+    double lost_kbit = 0.0;
+    double report_sent_kbit = 0.0;
+    double report_lost_kbit = 0.0;
+    std::uint64_t frame = 1;
+    auto last_report = now;
+
+    for (std::size_t x = 0; x < trace.segments.size(); ++x) {
+      auto &segment = trace.segments[x];
+      std::vector<int> samples;
+      double tail_kbit = 0.0;
+      auto steps = segment.duration / step;
+
+      for (decltype(steps) s = 0; s < steps; ++s) {
+        now += step;
+
+        // Parity comes on top of the video bitrate
+        auto fec = std::min(session->video.fec_percentage.load(), 80);
+        auto send_kbit = encoder_kbps * 100.0 / (100 - fec) * std::chrono::duration<double>(step).count();
+        auto capacity_kbit = segment.capacity_kbps * std::chrono::duration<double>(step).count();
+
+        // Whatever doesn't fit the bottleneck's buffer is dropped
+        queue_kbit = std::max(0.0, queue_kbit + send_kbit - capacity_kbit);
+        auto buffer_kbit = segment.capacity_kbps * std::chrono::duration<double>(queue_time).count();
+        auto dropped_kbit = std::max(0.0, queue_kbit - buffer_kbit);
+        queue_kbit -= dropped_kbit;
+
+        // FEC recovers random loss up to about a quarter of its share
+        auto residual_pct = std::max(0.0, segment.random_loss_pct - fec / 4.0);
+        auto step_lost_kbit = std::min(send_kbit, dropped_kbit + (send_kbit - dropped_kbit) * residual_pct / 100.0);
+
+        sent_kbit += send_kbit;
+        lost_kbit += step_lost_kbit;
+        delivered_kbit += send_kbit - step_lost_kbit;
+        report_sent_kbit += send_kbit;
+        report_lost_kbit += step_lost_kbit;
+        if (s >= steps * 3 / 4) {
+          tail_kbit += send_kbit;
+        }
+
+        auto rtt_ms = segment.base_rtt_ms + static_cast<int>(queue_kbit / segment.capacity_kbps * 1000.0);
+        controller.process_rtt(session.get(), static_cast<std::uint32_t>(rtt_ms));
+
+        if (now - last_report >= report_interval) {
+          frame += 60 * report_interval / 1s;
+          auto loss_pct = report_sent_kbit > 0.0 ? report_lost_kbit / report_sent_kbit * 100.0 : 0.0;
+          controller.process_loss_stats_direct(session.get(), loss_pct, frame, report_interval);
+          control_tick(controller, session.get(), encoder_kbps);
+
+          last_report = now;
+          report_sent_kbit = 0.0;
+          report_lost_kbit = 0.0;
+        }
+
+        samples.push_back(encoder_kbps);
+      }
+
+      result.convergence = std::max(result.convergence, settle_time(samples));
+      if (x + 1 == trace.segments.size()) {
+        auto tail_steps = steps - steps * 3 / 4;
+        result.final_send_kbps = tail_kbit / (std::chrono::duration<double>(step).count() * tail_steps);
+      }
+    }
+
+    std::chrono::duration<double> total {};
+    for (auto &segment : trace.segments) {
+      total += segment.duration;
+    }
+    result.throughput_kbps = delivered_kbit / total.count();
+    result.loss_pct = sent_kbit > 0.0 ? lost_kbit / sent_kbit * 100.0 : 0.0;
+    result.adjustments = session->stats.bitrate_adjustments.load();
+    return result;
+  }
+}  // namespace
+
+struct AutoBitrateSimTest: testing::TestWithParam<controller_config_t> {
+  void SetUp() override {
+    saved_video = config::video;
+    saved_fec = config::stream.fec_percentage;
+
+    config::video.auto_bitrate_mode = GetParam().mode;
+    config::video.auto_bitrate_adaptive_fec = GetParam().adaptive_fec;
+    config::stream.fec_percentage = 20;
+    config::publish_auto_bitrate_settings();
+  }
+
+  void TearDown() override {
+    config::video = saved_video;
+    config::stream.fec_percentage = saved_fec;
+    config::publish_auto_bitrate_settings();
+  }
+
+  config::video_t saved_video;
+  int saved_fec;
+};
+
+INSTANTIATE_TEST_SUITE_P(
+  ControllerConfigs,
+  AutoBitrateSimTest,
+  testing::ValuesIn(controller_configs),
+  [](const auto &info) {
+    return info.param.name;
+  }
+);
+
+TEST_P(AutoBitrateSimTest, ReplayTraces) {
+  for (auto &trace : traces()) {
+    auto result = simulate(trace);
+
+    auto name = trace.name + '_' + GetParam().name;
+    BOOST_LOG(tests) << name << ": throughput "sv << static_cast<int>(result.throughput_kbps) << " Kbps, loss "sv
+                     << result.loss_pct << "%, "sv << result.adjustments << " adjustments, settled within "sv
+                     << result.convergence.count() << "ms, final rate "sv << static_cast<int>(result.final_send_kbps) << " Kbps"sv;
+    RecordProperty(name + "_throughput_kbps", std::to_string(static_cast<int>(result.throughput_kbps)));
+    RecordProperty(name + "_loss_pct", std::to_string(result.loss_pct));
+    RecordProperty(name + "_adjustments", std::to_string(result.adjustments));
+    RecordProperty(name + "_convergence_ms", std::to_string(result.convergence.count()));
+
+    // The link has room for the configured bitrate, so nothing may be lost and the total, which
+    // adaptive FEC only moves between video and parity, has to stay at the configured bitrate plus 20%
+    if (trace.name == "wired") {
+      EXPECT_EQ(result.loss_pct, 0.0) << name;
+      EXPECT_NEAR(result.throughput_kbps, initial_kbps * 100.0 / 80, 1.0) << name;
+      EXPECT_NEAR(result.final_send_kbps, initial_kbps * 100.0 / 80, 1.0) << name;
+    }
+
+    // Whatever the knobs, the controller has to follow the link down instead of flooding it
+    if (trace.name != "mahimahi") {
+      auto final_capacity = trace.segments.back().capacity_kbps;
+      EXPECT_LT(result.final_send_kbps, final_capacity * 1.2) << name;
+      EXPECT_GT(result.throughput_kbps, 0.0) << name;
+    }
+  }
+}
+
+struct AutoBitrateAdjustmentTest: AutoBitrateSimTest {
+  void SetUp() override {
+    AutoBitrateSimTest::SetUp();
+    session = make_session(20000);
+  }
+
+  /**
+   * @brief Report a loss and move the clock past it.
+   */
+  void report(double loss_pct, std::chrono::milliseconds elapsed) {
+    frame += 60 * elapsed / 1s;
+    controller.process_loss_stats_direct(session.get(), loss_pct, frame, elapsed);
+    now += elapsed;
+  }
+
+  /**
+   * @brief Let the encoder accept the adjustment, and return the bitrate it asked for.
+   */
+  int apply(const stream::auto_bitrate_adjustment_t &adjustment) {
+    if (adjustment.bitrate_kbps) {
+      controller.confirm_bitrate_change(session.get(), adjustment.bitrate_kbps, true);
+    }
+    return adjustment.bitrate_kbps;
+  }
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::time_point {} + 1h;
+  stream::auto_bitrate_controller_t controller {[this]() {
+    return now;
+  }};
+  std::shared_ptr<stream::session_t> session;
+  std::uint64_t frame = 1;
+};
+
+INSTANTIATE_TEST_SUITE_P(
+  LossMode,
+  AutoBitrateAdjustmentTest,
+  testing::Values(controller_configs[0], controller_configs[2]),
+  [](const auto &info) {
+    return info.param.name;
+  }
+);
+
+TEST_P(AutoBitrateAdjustmentTest, CutsTheBitrateBySeverityOfTheLoss) {
+  // The first report starts the adjustment interval
+  report(12.0, 3s);
+  report(12.0, 0ms);
+  auto adjustment = controller.next_adjustment(session.get());
+  EXPECT_EQ(adjustment.fec_percentage, -1);
+  EXPECT_FALSE(adjustment.ladder_step);
+  EXPECT_EQ(apply(adjustment), 15000);  // Severe, -25%
+
+  // Nothing changes within the adjustment interval
+  report(12.0, 1s);
+  EXPECT_EQ(controller.next_adjustment(session.get()).bitrate_kbps, 0);
+
+  report(7.0, 2s);
+  EXPECT_NEAR(apply(controller.next_adjustment(session.get())), 13200, 1);  // Moderate, -12%
+
+  report(2.0, 3s);
+  EXPECT_NEAR(apply(controller.next_adjustment(session.get())), 12540, 1);  // Mild, -5%
+  EXPECT_EQ(session->video.fec_percentage.load(), 20);
+  EXPECT_EQ(session->stats.bitrate_adjustments.load(), 3u);
+}
+
+TEST_P(AutoBitrateAdjustmentTest, RaisesTheBitrateOnlyAfterStableReports) {
+  report(12.0, 3s);
+  report(12.0, 0ms);
+  ASSERT_EQ(apply(controller.next_adjustment(session.get())), 15000);
+
+  // Without loss, the bitrate goes up once the link was good for good_stability_ms
+  report(0.0, 3s);
+  EXPECT_EQ(controller.next_adjustment(session.get()).bitrate_kbps, 0);
+  report(0.0, 2s);
+  EXPECT_NEAR(apply(controller.next_adjustment(session.get())), 15750, 1);  // +5%
+}
+
+TEST_P(AutoBitrateAdjustmentTest, RebalancesTheBitrateAgainstAdaptiveFec) {
+  // Light loss in every report is what parity recovers
+  for (int x = 0; x < 8; ++x) {
+    report(2.0, 500ms);
+  }
+  auto adjustment = controller.next_adjustment(session.get());
+
+  if (!GetParam().adaptive_fec) {
+    // The bitrate controller handles it alone
+    EXPECT_EQ(adjustment.fec_percentage, -1);
+    EXPECT_NEAR(adjustment.bitrate_kbps, 19000, 1);  // Mild, -5%
+    return;
+  }
+
+  // Parity goes up by a step, the video bitrate gives way so that the total stays the same
+  EXPECT_EQ(adjustment.fec_percentage, 25);
+  EXPECT_EQ(adjustment.bitrate_kbps, 18750);
+  EXPECT_EQ(adjustment.bitrate_kbps * 100 / (100 - adjustment.fec_percentage), 20000 * 100 / 80);
+
+  // The FEC percentage only changes once the encoder runs at the matching bitrate
+  EXPECT_EQ(session->video.fec_percentage.load(), 20);
+  apply(adjustment);
+  EXPECT_EQ(session->video.fec_percentage.load(), 25);
+}
@@ -0,0 +1,55 @@
+/**
+ * @file tests/unit/test_calibration.cpp
+ * @brief Test src/calibration.*.
+ */
+#include "../tests_common.h"
+
+#include <src/calibration.h>
+
+namespace {
+  calibration::trial_t make_trial(std::vector<double> fps) {
+    calibration::trial_t trial;
+    for (auto value : fps) {
+      trial.measurements.push_back({{1920, 1080}, value, 1.0, 2.0});
+    }
+    return trial;
+  }
+}  // namespace
+
+TEST(CalibrationTests, OrdersCandidatesFromBestQuality) {
+  auto software = calibration::candidates("software", 8);
+  ASSERT_EQ(software.size(), 6u * 3u);
+  EXPECT_EQ(software.front().vars.at("sw_preset"), "medium");
+  EXPECT_EQ(software.front().vars.at("min_threads"), "2");
+  EXPECT_EQ(software[2].vars.at("min_threads"), "8");
+  EXPECT_EQ(software.back().vars.at("sw_preset"), "ultrafast");
+
+  auto single_thread = calibration::candidates("software", 1);
+  ASSERT_EQ(single_thread.size(), 6u);
+  EXPECT_EQ(single_thread.front().vars.at("min_threads"), "1");
+
+  auto nvenc = calibration::candidates("nvenc", 8);
+  ASSERT_EQ(nvenc.size(), 7u * 3u);
+  EXPECT_EQ(nvenc.front().vars.at("nvenc_preset"), "7");
+  EXPECT_EQ(nvenc.front().vars.at("nvenc_twopass"), "full_res");
+  EXPECT_EQ(nvenc.back().vars.at("nvenc_preset"), "1");
+  EXPECT_EQ(nvenc.back().vars.at("nvenc_twopass"), "disabled");
+
+  EXPECT_TRUE(calibration::candidates("vaapi", 8).empty());
+}
+
+TEST(CalibrationTests, RecommendsTheFirstTrialWithHeadroom) {
+  // 70 fps is short of 60 fps with 25% headroom
+  std::vector trials {make_trial({}), make_trial({70, 120}), make_trial({80, 90}), make_trial({200})};
+  EXPECT_FALSE(calibration::meets_target(trials[0], 60));
+  EXPECT_FALSE(calibration::meets_target(trials[1], 60));
+  EXPECT_TRUE(calibration::meets_target(trials[2], 60));
+  EXPECT_EQ(calibration::recommend(trials, 60), 2u);
+}
+
+TEST(CalibrationTests, FallsBackToTheFastestTrial) {
+  std::vector trials {make_trial({30, 100}), make_trial({50, 55}), make_trial({})};
+  EXPECT_EQ(calibration::recommend(trials, 60), 1u);
+
+  EXPECT_EQ(calibration::recommend({make_trial({})}, 60), std::nullopt);
+}
@@ -0,0 +1,43 @@
+/**
+ * @file tests/unit/test_clipboard.cpp
+ * @brief Test src/clipboard.*.
+ */
+#include "../tests_common.h"
+
+#include <random>
+#include <src/clipboard.h>
+
+TEST(ClipboardTests, CompressesLargeText) {
+  std::string text;
+  while (text.size() < 256 * 1024) {
+    text += "The quick brown fox jumps over the lazy dog. ";
+  }
+
+  auto compressed = clipboard::compress(text);
+  ASSERT_TRUE(compressed);
+  EXPECT_LT(compressed->size(), text.size() / 2);
+  EXPECT_EQ(clipboard::decompress(*compressed), text);
+
+  // Not worth it
+  EXPECT_FALSE(clipboard::compress("short"));
+}
+
+TEST(ClipboardTests, SendsIncompressibleContentAsItIs) {
+  std::mt19937 rng {42};
+  std::string noise(256 * 1024, '\0');
+  for (auto &ch : noise) {
+    ch = (char) rng();
+  }
+
+  EXPECT_FALSE(clipboard::compress(noise));
+}
+
+TEST(ClipboardTests, RejectsContentLargerThanTheLimit) {
+  std::string zeros(1024 * 1024, '\0');
+  auto compressed = clipboard::compress(zeros);
+  ASSERT_TRUE(compressed);
+
+  EXPECT_FALSE(clipboard::decompress(*compressed, zeros.size() - 1));
+  EXPECT_EQ(clipboard::decompress(*compressed, zeros.size()), zeros);
+  EXPECT_FALSE(clipboard::decompress("not compressed"));
+}
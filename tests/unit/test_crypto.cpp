@@ -0,0 +1,64 @@
+/**
+ * @file tests/unit/test_crypto.cpp
+ * @brief Test src/crypto.*.
+ */
+#include "../tests_common.h"
+
+#include <src/crypto.h>
+
+namespace {
+  crypto::p_named_cert_t named_cert(const std::string &name, const std::string &cert) {
+    auto named_cert_p = std::make_shared<crypto::named_cert_t>();
+    named_cert_p->name = name;
+    named_cert_p->cert = cert;
+    return named_cert_p;
+  }
+}  // namespace
+
+TEST(CryptoTests, CertChainFindsThePairedCertificate) {
+  crypto::cert_chain_t chain;
+  std::vector<crypto::creds_t> creds;
+  for (int x = 0; x < 3; ++x) {
+    creds.emplace_back(crypto::gen_creds("Moonlight "s + std::to_string(x), 2048));
+    auto named_cert_p = named_cert("client "s + std::to_string(x), creds.back().x509);
+    chain.add(named_cert_p);
+  }
+
+  for (int x = 0; x < 3; ++x) {
+    crypto::p_named_cert_t found;
+    EXPECT_EQ(chain.verify(crypto::x509(creds[x].x509).get(), found), nullptr);
+    ASSERT_NE(found, nullptr);
+    EXPECT_EQ(found->name, "client "s + std::to_string(x));
+  }
+
+  crypto::p_named_cert_t found;
+  auto unknown = crypto::gen_creds("Unknown"sv, 2048);
+  EXPECT_NE(chain.verify(crypto::x509(unknown.x509).get(), found), nullptr);
+  EXPECT_EQ(found, nullptr);
+
+  chain.clear();
+  EXPECT_NE(chain.verify(crypto::x509(creds[0].x509).get(), found), nullptr);
+}
+
+TEST(CryptoTests, GcmDecryptsInPlace) {
+  crypto::aes_t key(16, 0x42);
+  crypto::cipher::gcm_t encrypter {key, false};
+  crypto::cipher::gcm_t decrypter {key, false};
+
+  auto plaintext = "\x06\x02\x10\x00input packet payload"sv;
+  crypto::aes_t iv(12, 0x01);
+  std::vector<std::uint8_t> tagged_cipher(crypto::cipher::tag_size + plaintext.size());
+  ASSERT_EQ(encrypter.encrypt(plaintext, tagged_cipher.data(), &iv), plaintext.size());
+
+  std::vector<std::uint8_t> expected;
+  ASSERT_EQ(decrypter.decrypt({(char *) tagged_cipher.data(), tagged_cipher.size()}, expected, &iv), 0);
+  EXPECT_EQ(std::string_view((char *) expected.data(), expected.size()), plaintext);
+
+  auto in_place = tagged_cipher.data() + crypto::cipher::tag_size;
+  ASSERT_EQ(decrypter.decrypt({(char *) tagged_cipher.data(), tagged_cipher.size()}, in_place, &iv), plaintext.size());
+  EXPECT_EQ(std::string_view((char *) in_place, plaintext.size()), plaintext);
+
+  // The plaintext no longer matches the tag
+  EXPECT_EQ(decrypter.decrypt({(char *) tagged_cipher.data(), tagged_cipher.size()}, in_place, &iv), -1);
+  EXPECT_EQ(decrypter.decrypt({(char *) tagged_cipher.data(), 4}, in_place, &iv), -1);
+}
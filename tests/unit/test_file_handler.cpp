@@ -90,6 +90,16 @@ TEST_P(FileHandlerTests, ReadFileTest) {
   EXPECT_EQ(file_handler::read_file(fileName.c_str()), content);
 }
 
+TEST(FileHandlerTests, ReplaceFileTest) {
+  const std::string fileName = "replace_file_test.txt";
+  EXPECT_EQ(file_handler::write_file(fileName.c_str(), "old contents"), 0);
+  EXPECT_EQ(file_handler::replace_file(fileName.c_str(), "new"), 0);
+  EXPECT_EQ(file_handler::read_file(fileName.c_str()), "new");
+  EXPECT_FALSE(std::filesystem::exists(fileName + ".tmp"));
+
+  EXPECT_EQ(file_handler::replace_file("non-existing-dir/file.txt", "contents"), -1);
+}
+
 TEST(FileHandlerTests, ReadMissingFileTest) {
   // read missing file
   EXPECT_EQ(file_handler::read_file("non-existing-file.txt"), "");
@@ -0,0 +1,29 @@
+/**
+ * @file tests/unit/test_fleet.cpp
+ * @brief Test src/fleet.*.
+ */
+#include "../tests_common.h"
+
+#include <nlohmann/json.hpp>
+#include <src/config.h>
+#include <src/fleet.h>
+
+TEST(FleetTests, ReportsTheLoad) {
+  config::nvhttp.sunshine_name = "host";
+
+  auto report = nlohmann::json::parse(fleet::report({2, 40, 0.25, true}));
+  EXPECT_EQ(report["hostname"], "host");
+  EXPECT_EQ(report["sessions"], 2);
+  EXPECT_EQ(report["encoder_utilization"], 40);
+  EXPECT_DOUBLE_EQ(report["headroom"].get<double>(), 0.25);
+  EXPECT_EQ(report["virtual_display"], true);
+  EXPECT_TRUE(report["ports"]["https"].is_number());
+}
+
+TEST(FleetTests, ReportsUnknownLoadAsNull) {
+  auto report = nlohmann::json::parse(fleet::report({0, std::nullopt, std::nullopt, false}));
+  EXPECT_EQ(report["sessions"], 0);
+  EXPECT_TRUE(report["encoder_utilization"].is_null());
+  EXPECT_TRUE(report["headroom"].is_null());
+  EXPECT_EQ(report["virtual_display"], false);
+}
@@ -0,0 +1,48 @@
+/**
+ * @file tests/unit/test_gpu_placement.cpp
+ * @brief Test src/gpu_placement.*.
+ */
+#include "../tests_common.h"
+
+#include <src/gpu_placement.h>
+
+namespace {
+  const std::vector<std::string> adapters {"/dev/dri/renderD128", "/dev/dri/renderD129"};
+  constexpr std::uint64_t pixels_1080p = 1920 * 1080;
+  constexpr std::uint64_t pixels_4k = 3840 * 2160;
+}  // namespace
+
+TEST(GpuPlacementTests, PlacesEncodersOnTheLeastLoadedAdapter) {
+  gpu_placement::balancer_t balancer;
+
+  // Equal loads go to the preferred adapter
+  auto first = balancer.acquire(adapters, pixels_4k);
+  ASSERT_TRUE(first);
+  EXPECT_EQ(first->index, 0u);
+
+  auto second = balancer.acquire(adapters, pixels_1080p);
+  ASSERT_TRUE(second);
+  EXPECT_EQ(second->index, 1u);
+
+  auto third = balancer.acquire(adapters, pixels_1080p);
+  ASSERT_TRUE(third);
+  EXPECT_EQ(third->index, 1u);
+  EXPECT_EQ(balancer.load(adapters[1]), 2 * pixels_1080p);
+
+  EXPECT_FALSE(balancer.acquire({}, pixels_1080p));
+}
+
+TEST(GpuPlacementTests, ReleasesTheLoadWithTheEncoder) {
+  gpu_placement::balancer_t balancer;
+
+  auto first = balancer.acquire(adapters, pixels_4k);
+  ASSERT_TRUE(first);
+  EXPECT_EQ(balancer.load(adapters[0]), pixels_4k);
+
+  first.reset();
+  EXPECT_EQ(balancer.load(adapters[0]), 0u);
+
+  auto second = balancer.acquire(adapters, pixels_1080p);
+  ASSERT_TRUE(second);
+  EXPECT_EQ(second->index, 0u);
+}
@@ -0,0 +1,39 @@
+/**
+ * @file tests/unit/test_gpu_stats.cpp
+ * @brief Test src/gpu_stats.*.
+ */
+#include "../tests_common.h"
+
+#include <src/gpu_stats.h>
+
+TEST(GpuStatsTests, ContentionNeedsAStreakOfSaturatedSamples) {
+  gpu_stats::contention_detector_t detector;
+
+  // A spike is not enough
+  EXPECT_FALSE(detector.update(99));
+  EXPECT_FALSE(detector.update(50));
+
+  for (int x = 1; x < gpu_stats::contention_samples; ++x) {
+    EXPECT_FALSE(detector.update(gpu_stats::contention_enter_percent));
+  }
+  EXPECT_TRUE(detector.update(gpu_stats::contention_enter_percent));
+  EXPECT_TRUE(detector.contended());
+}
+
+TEST(GpuStatsTests, ContentionEndsBelowTheExitThreshold) {
+  gpu_stats::contention_detector_t detector;
+  for (int x = 0; x < gpu_stats::contention_samples; ++x) {
+    detector.update(100);
+  }
+  ASSERT_TRUE(detector.contended());
+
+  // Between the thresholds the state is kept
+  for (int x = 0; x < gpu_stats::contention_samples * 2; ++x) {
+    EXPECT_TRUE(detector.update(gpu_stats::contention_exit_percent));
+  }
+
+  for (int x = 1; x < gpu_stats::contention_samples; ++x) {
+    EXPECT_TRUE(detector.update(gpu_stats::contention_exit_percent - 1));
+  }
+  EXPECT_FALSE(detector.update(gpu_stats::contention_exit_percent - 1));
+}
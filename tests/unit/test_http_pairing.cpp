@@ -81,27 +81,27 @@ struct PairingTest: testing::TestWithParam<std::tuple<pairing_input, pairing_out
 TEST_P(PairingTest, Run) {
   auto [input, expected] = GetParam();
 
-  boost::property_tree::ptree tree;
+  xml::response_t tree;
 
   setup(PRIVATE_KEY, PUBLIC_CERT);
 
   // phase 1
   getservercert(*input.session, tree, input.pin);
-  ASSERT_EQ(tree.get<int>("root.paired") == 1, expected.phase_1_success);
+  ASSERT_EQ(tree.get("paired") == "1", expected.phase_1_success);
   if (!expected.phase_1_success) {
     return;
   }
 
   // phase 2
   clientchallenge(*input.session, tree, input.client_challenge);
-  ASSERT_EQ(tree.get<int>("root.paired") == 1, expected.phase_2_success);
+  ASSERT_EQ(tree.get("paired") == "1", expected.phase_2_success);
   if (!expected.phase_2_success) {
     return;
   }
 
   // phase 3
   serverchallengeresp(*input.session, tree, input.server_challenge_resp);
-  ASSERT_EQ(tree.get<int>("root.paired") == 1, expected.phase_3_success);
+  ASSERT_EQ(tree.get("paired") == "1", expected.phase_3_success);
   if (!expected.phase_3_success) {
     return;
   }
@@ -111,7 +111,7 @@ TEST_P(PairingTest, Run) {
   auto input_client_cert = input.session->client.cert;  // Will be moved
   auto add_cert = std::make_shared<safe::queue_t<crypto::x509_t>>(30);
   clientpairingsecret(*input.session, add_cert, tree, input.client_pairing_secret);
-  ASSERT_EQ(tree.get<int>("root.paired") == 1, expected.phase_4_success);
+  ASSERT_EQ(tree.get("paired") == "1", expected.phase_4_success);
 
   // Check that we actually added the input client certificate to `add_cert`
   if (expected.phase_4_success) {
@@ -240,28 +240,28 @@ INSTANTIATE_TEST_SUITE_P(
 );
 
 TEST(PairingTest, OutOfOrderCalls) {
-  boost::property_tree::ptree tree;
+  xml::response_t tree;
 
   setup(PRIVATE_KEY, PUBLIC_CERT);
 
   pair_session_t sess {};
 
   clientchallenge(sess, tree, "test");
-  ASSERT_FALSE(tree.get<int>("root.paired") == 1);
+  ASSERT_FALSE(tree.get("paired") == "1");
 
   serverchallengeresp(sess, tree, "test");
-  ASSERT_FALSE(tree.get<int>("root.paired") == 1);
+  ASSERT_FALSE(tree.get("paired") == "1");
 
   auto add_cert = std::make_shared<safe::queue_t<crypto::x509_t>>(30);
   clientpairingsecret(sess, add_cert, tree, "test");
-  ASSERT_FALSE(tree.get<int>("root.paired") == 1);
+  ASSERT_FALSE(tree.get("paired") == "1");
 
   // This should work, it's the first time we call it
   sess.async_insert_pin.salt = "ff5dc6eda99339a8a0793e216c4257c4";
   getservercert(sess, tree, "test");
-  ASSERT_TRUE(tree.get<int>("root.paired") == 1);
+  ASSERT_TRUE(tree.get("paired") == "1");
 
   // Calling it again should fail
   getservercert(sess, tree, "test");
-  ASSERT_FALSE(tree.get<int>("root.paired") == 1);
+  ASSERT_FALSE(tree.get("paired") == "1");
 }
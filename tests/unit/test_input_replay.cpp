@@ -0,0 +1,283 @@
+/**
+ * @file tests/unit/test_input_replay.cpp
+ * @brief Replay input captures through src/input.* against the null input backend.
+ * @details The synthetic captures are queued within one coalescing delay, so the input
+ *          thread batches all of them at once and what reaches the backend is exact.
+ *          benchmarks/bench_input.cpp measures the throughput and latency of the same replays.
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <src/config.h>
+#include <src/input.h>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <moonlight-common-c/src/Input.h>
+#include <moonlight-common-c/src/Limelight.h>
+}
+
+#include <boost/endian/conversion.hpp>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Control stream input payloads in the order they were received.
+   */
+  using capture_t = std::vector<std::vector<std::uint8_t>>;
+
+  template<class T>
+  void add_packet(capture_t &capture, std::uint32_t magic, T packet) {
+    packet.header.size = util::endian::big<std::uint32_t>(sizeof(T) - sizeof(packet.header.size));
+    packet.header.magic = util::endian::little(magic);
+
+    auto data = (const std::uint8_t *) &packet;
+    capture.emplace_back(data, data + sizeof(T));
+  }
+
+  void to_netfloat(netfloat &f, float value) {
+    boost::endian::endian_store<float, sizeof(float), boost::endian::order::little>(f, value);
+  }
+
+  capture_t mouse_capture(int count) {
+    capture_t capture;
+    for (int x = 0; x < count; ++x) {
+      if (x % 50 == 0) {
+        NV_MOUSE_BUTTON_PACKET button {};
+        button.button = BUTTON_LEFT;
+        add_packet(capture, x % 100 ? MOUSE_BUTTON_UP_EVENT_MAGIC_GEN5 : MOUSE_BUTTON_DOWN_EVENT_MAGIC_GEN5, button);
+      } else if (x % 25 == 0) {
+        NV_SCROLL_PACKET scroll {};
+        scroll.scrollAmt1 = util::endian::big<std::int16_t>(120);
+        scroll.scrollAmt2 = scroll.scrollAmt1;
+        add_packet(capture, SCROLL_MAGIC_GEN5, scroll);
+      } else {
+        NV_REL_MOUSE_MOVE_PACKET move {};
+        move.deltaX = util::endian::big<std::int16_t>(x % 7 - 3);
+        move.deltaY = util::endian::big<std::int16_t>(x % 5 - 2);
+        add_packet(capture, MOUSE_MOVE_REL_MAGIC_GEN5, move);
+      }
+    }
+    return capture;
+  }
+
+  capture_t keyboard_capture(int count) {
+    capture_t capture;
+    for (int x = 0; x < count; ++x) {
+      NV_KEYBOARD_PACKET key {};
+      key.keyCode = 0x41 + (x / 2) % 26;
+      add_packet(capture, x % 2 ? KEY_UP_EVENT_MAGIC : KEY_DOWN_EVENT_MAGIC, key);
+    }
+    return capture;
+  }
+
+  capture_t controller_capture(int count) {
+    constexpr int controllers = 4;
+
+    capture_t capture;
+    for (int x = 0; x < count; ++x) {
+      NV_MULTI_CONTROLLER_PACKET state {};
+      state.controllerNumber = x % controllers;
+      state.activeGamepadMask = (1 << controllers) - 1;
+      state.buttonFlags = (x / controllers) % 16 == 0 ? A_FLAG : 0;
+      state.leftStickX = (short) ((x * 997) % 65536 - 32768);
+      state.rightTrigger = (unsigned char) x;
+      add_packet(capture, MULTI_CONTROLLER_MAGIC_GEN5, state);
+    }
+    return capture;
+  }
+
+  capture_t touch_capture(int count) {
+    capture_t capture;
+    for (int x = 0; x < count; ++x) {
+      SS_TOUCH_PACKET touch {};
+      touch.eventType = x % 32 == 0 ? LI_TOUCH_EVENT_DOWN : x % 32 == 31 ? LI_TOUCH_EVENT_UP : LI_TOUCH_EVENT_MOVE;
+      touch.rotation = util::endian::little<std::uint16_t>(LI_ROT_UNKNOWN);
+      touch.pointerId = util::endian::little<std::uint32_t>(x / 32);
+      to_netfloat(touch.x, (x % 32) / 32.0f);
+      to_netfloat(touch.y, 0.5f);
+      to_netfloat(touch.pressureOrDistance, 1.0f);
+      add_packet(capture, SS_TOUCH_MAGIC, touch);
+    }
+    return capture;
+  }
+
+  capture_t pen_capture(int count) {
+    capture_t capture;
+    for (int x = 0; x < count; ++x) {
+      SS_PEN_PACKET pen {};
+      pen.eventType = x % 16 == 0 ? LI_TOUCH_EVENT_HOVER : LI_TOUCH_EVENT_MOVE;
+      pen.toolType = LI_TOOL_TYPE_PEN;
+      pen.rotation = util::endian::little<std::uint16_t>(LI_ROT_UNKNOWN);
+      pen.tilt = LI_TILT_UNKNOWN;
+      to_netfloat(pen.x, 0.5f);
+      to_netfloat(pen.y, (x % 64) / 64.0f);
+      to_netfloat(pen.pressureOrDistance, 0.5f);
+      add_packet(capture, SS_PEN_MAGIC, pen);
+    }
+    return capture;
+  }
+}  // namespace
+
+struct InputReplayTest: testing::Test {
+  void SetUp() override {
+    saved_input_config = config::input;
+    config::input.coalesce_delay = 100ms;
+    config::input.motion_report_rate = 0;
+    config::input.mouse_smoothing_rate = 0;
+    input::use_null_backend(true);
+
+    mail = std::make_shared<safe::mail_raw_t>();
+    session_input = input::alloc(mail);
+
+    input::touch_port_t touch_port {};
+    touch_port.width = touch_port.env_width = 1920;
+    touch_port.height = touch_port.env_height = 1080;
+    touch_port.scalar_inv = 1.0f;
+    mail->event(mail::touch_port)->raise(touch_port);
+  }
+
+  void TearDown() override {
+    session_input.reset();
+    input::use_null_backend(false);
+    config::input = saved_input_config;
+  }
+
+  /**
+   * @brief Replay a capture and wait until the input thread injected all of it.
+   * @return What the replay injected, the latest touch, pen and gamepad states included.
+   */
+  input::null_backend_stats_t replay(const std::string &name, const capture_t &capture) {
+    auto before = input::null_backend_stats();
+
+    for (auto &record : capture) {
+      auto payload = record;
+      input::passthrough(session_input, std::move(payload), crypto::PERM::_all_inputs);
+    }
+
+    // Wait for the input thread to go idle
+    auto calls = input::null_backend_stats().calls;
+    for (auto deadline = std::chrono::steady_clock::now() + 5s; std::chrono::steady_clock::now() < deadline;) {
+      std::this_thread::sleep_for(20ms);
+      auto count = input::null_backend_stats().calls;
+      if (count == calls && count > before.calls) {
+        break;
+      }
+      calls = count;
+    }
+
+    auto stats = input::null_backend_stats();
+    stats.calls -= before.calls;
+    stats.mouse_moves -= before.mouse_moves;
+    stats.mouse_x -= before.mouse_x;
+    stats.mouse_y -= before.mouse_y;
+    stats.mouse_buttons -= before.mouse_buttons;
+    stats.scroll_distance -= before.scroll_distance;
+    stats.key_presses -= before.key_presses;
+    stats.key_releases -= before.key_releases;
+    stats.gamepad_updates -= before.gamepad_updates;
+    stats.touch_updates -= before.touch_updates;
+    stats.pen_updates -= before.pen_updates;
+
+    EXPECT_GT(stats.calls, 0) << name;
+    EXPECT_LE(stats.calls, capture.size()) << name;
+    return stats;
+  }
+
+  config::input_t saved_input_config;
+  safe::mail_t mail;
+  std::shared_ptr<input::input_t> session_input;
+};
+
+TEST_F(InputReplayTest, Mouse) {
+  constexpr int count = 100;
+
+  int expected_x = 0;
+  int expected_y = 0;
+  for (int x = 0; x < count; ++x) {
+    if (x % 25) {
+      expected_x += x % 7 - 3;
+      expected_y += x % 5 - 2;
+    }
+  }
+
+  // Every run of moves between two buttons or scrolls is batched into a single move
+  auto stats = replay("mouse", mouse_capture(count));
+  EXPECT_EQ(stats.mouse_moves, 4u);
+  EXPECT_EQ(stats.mouse_x, expected_x);
+  EXPECT_EQ(stats.mouse_y, expected_y);
+  EXPECT_EQ(stats.mouse_buttons, 2u);
+  EXPECT_EQ(stats.scroll_distance, 2 * 120);
+}
+
+TEST_F(InputReplayTest, RelativeMovesAreBatched) {
+  capture_t capture;
+  for (int x = 0; x < 10; ++x) {
+    NV_REL_MOUSE_MOVE_PACKET move {};
+    move.deltaX = util::endian::big<std::int16_t>(3);
+    move.deltaY = util::endian::big<std::int16_t>(-2);
+    add_packet(capture, MOUSE_MOVE_REL_MAGIC_GEN5, move);
+  }
+
+  auto stats = replay("relative moves", capture);
+  EXPECT_EQ(stats.mouse_moves, 1u);
+  EXPECT_EQ(stats.mouse_x, 30);
+  EXPECT_EQ(stats.mouse_y, -20);
+}
+
+TEST_F(InputReplayTest, RelativeMovesOverflowingAreNotBatched) {
+  capture_t capture;
+  for (int x = 0; x < 3; ++x) {
+    NV_REL_MOUSE_MOVE_PACKET move {};
+    move.deltaX = util::endian::big<std::int16_t>(20000);
+    move.deltaY = util::endian::big<std::int16_t>(-20000);
+    add_packet(capture, MOUSE_MOVE_REL_MAGIC_GEN5, move);
+  }
+
+  // The sum of two moves doesn't fit into the 16-bit deltas of a packet
+  auto stats = replay("overflowing relative moves", capture);
+  EXPECT_EQ(stats.mouse_moves, 3u);
+  EXPECT_EQ(stats.mouse_x, 60000);
+  EXPECT_EQ(stats.mouse_y, -60000);
+}
+
+TEST_F(InputReplayTest, Keyboard) {
+  auto stats = replay("keyboard", keyboard_capture(20));
+  EXPECT_EQ(stats.key_presses, 10u);
+  EXPECT_EQ(stats.key_releases, 10u);
+  EXPECT_EQ(stats.calls, 20u);
+}
+
+TEST_F(InputReplayTest, MultiController) {
+  constexpr int count = 128;
+
+  // Each controller presses A twice, the states between two presses are batched into the latest one
+  auto stats = replay("controller", controller_capture(count));
+  EXPECT_EQ(stats.gamepad_updates, 16u);
+  for (int controller = 0; controller < 4; ++controller) {
+    auto x = count - 4 + controller;
+    platf::gamepad_state_t expected {0, 0, (std::uint8_t) x, (std::int16_t) ((x * 997) % 65536 - 32768), 0, 0, 0};
+    EXPECT_EQ(std::count(std::begin(stats.gamepads), std::end(stats.gamepads), expected), 1) << "controller " << controller;
+  }
+}
+
+TEST_F(InputReplayTest, Touch) {
+  // Two pointers going down, moving and going up, their moves are batched into the latest one
+  auto stats = replay("touch", touch_capture(64));
+  EXPECT_EQ(stats.touch_updates, 6u);
+  EXPECT_EQ(stats.last_touch.eventType, LI_TOUCH_EVENT_UP);
+  EXPECT_EQ(stats.last_touch.pointerId, 1u);
+  EXPECT_FLOAT_EQ(stats.last_touch.x, 31 / 32.0f);
+  EXPECT_FLOAT_EQ(stats.last_touch.y, 0.5f);
+}
+
+TEST_F(InputReplayTest, Pen) {
+  // Two hovers, each followed by moves batched into the latest one
+  auto stats = replay("pen", pen_capture(32));
+  EXPECT_EQ(stats.pen_updates, 4u);
+  EXPECT_EQ(stats.last_pen.eventType, LI_TOUCH_EVENT_MOVE);
+  EXPECT_FLOAT_EQ(stats.last_pen.x, 0.5f);
+  EXPECT_FLOAT_EQ(stats.last_pen.y, 31 / 64.0f);
+}
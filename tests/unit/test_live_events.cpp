@@ -0,0 +1,102 @@
+/**
+ * @file tests/unit/test_live_events.cpp
+ * @brief Test src/live_events.*.
+ */
+#include "../tests_common.h"
+
+#include <src/live_events.h>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Keeps the events instead of sending them, the sends complete when the test says so.
+   */
+  class sink_t: public live_events::sink_t {
+  public:
+    void send(std::string &&events, std::function<void(bool)> &&done) override {
+      sent.emplace_back(std::move(events));
+      pending = std::move(done);
+    }
+
+    void complete(bool ok = true) {
+      auto done = std::move(pending);
+      pending = nullptr;
+      done(ok);
+    }
+
+    std::vector<std::string> sent;
+    std::function<void(bool)> pending;
+  };
+}  // namespace
+
+TEST(LiveEventsTests, SendsOnlyTheSectionsThatChanged) {
+  live_events::hub_t hub;
+  auto sink = std::make_shared<sink_t>();
+  ASSERT_TRUE(hub.subscribe(sink, 1s));
+
+  auto now = std::chrono::steady_clock::now();
+  hub.publish("sessions", "[]");
+  hub.publish("metrics", "{\"a\":1}");
+  hub.flush(now);
+  ASSERT_EQ(sink->sent.size(), 1u);
+  EXPECT_EQ(sink->sent[0], "event: metrics\ndata: {\"a\":1}\n\nevent: sessions\ndata: []\n\n");
+  sink->complete();
+
+  // The same content again is no change
+  now += 1s;
+  hub.publish("sessions", "[]");
+  hub.publish("metrics", "{\"a\":2}");
+  hub.flush(now);
+  ASSERT_EQ(sink->sent.size(), 2u);
+  EXPECT_EQ(sink->sent[1], "event: metrics\ndata: {\"a\":2}\n\n");
+}
+
+TEST(LiveEventsTests, LimitsTheRateOfEachSubscriber) {
+  live_events::hub_t hub;
+  auto slow = std::make_shared<sink_t>();
+  auto fast = std::make_shared<sink_t>();
+  ASSERT_TRUE(hub.subscribe(slow, 5s));
+  ASSERT_TRUE(hub.subscribe(fast, 1s));
+
+  auto now = std::chrono::steady_clock::now();
+  for (int x = 0; x < 5; ++x) {
+    hub.publish("metrics", std::to_string(x));
+    hub.flush(now);
+    if (slow->pending) {
+      slow->complete();
+    }
+    fast->complete();
+    now += 1s;
+  }
+
+  EXPECT_EQ(slow->sent.size(), 1u);
+  EXPECT_EQ(fast->sent.size(), 5u);
+
+  // Nothing is sent while the last send is pending
+  hub.publish("metrics", "5");
+  hub.flush(now);
+  hub.publish("metrics", "6");
+  hub.flush(now + 1s);
+  EXPECT_EQ(fast->sent.size(), 6u);
+}
+
+TEST(LiveEventsTests, DropsClosedSubscribers) {
+  live_events::hub_t hub;
+  for (std::size_t x = 0; x < live_events::max_subscribers; ++x) {
+    ASSERT_TRUE(hub.subscribe(std::make_shared<sink_t>(), 1s));
+  }
+
+  auto sink = std::make_shared<sink_t>();
+  EXPECT_FALSE(hub.subscribe(sink, 1s));
+
+  live_events::hub_t single;
+  ASSERT_TRUE(single.subscribe(sink, 1s));
+  single.publish("metrics", "{}");
+  single.flush(std::chrono::steady_clock::now());
+  sink->complete(false);
+  EXPECT_EQ(single.subscribers(), 1u);
+
+  single.flush(std::chrono::steady_clock::now());
+  EXPECT_EQ(single.subscribers(), 0u);
+}
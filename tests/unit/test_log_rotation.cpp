@@ -0,0 +1,112 @@
+/**
+ * @file tests/unit/test_log_rotation.cpp
+ * @brief Test src/log_rotation.*.
+ */
+#include "../tests_common.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <src/clipboard.h>
+#include <src/log_rotation.h>
+
+using namespace std::literals;
+
+namespace {
+  std::string read_file(const std::filesystem::path &path) {
+    std::ifstream file {path, std::ios::binary};
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+  }
+
+  /**
+   * @brief A directory of its own for the log of a test.
+   */
+  struct LogRotationTest: testing::Test {
+    void SetUp() override {
+      dir = platf::appdata() / "tests" / "log_rotation";
+      std::filesystem::remove_all(dir);
+      std::filesystem::create_directories(dir);
+      log_file = dir / "rotated.log";
+    }
+
+    void TearDown() override {
+      std::error_code ec;
+      std::filesystem::remove_all(dir, ec);
+    }
+
+    std::filesystem::path dir;
+    std::filesystem::path log_file;
+  };
+}  // namespace
+
+TEST_F(LogRotationTest, RotatesBySizeAndCompressesSegments) {
+  log_rotation::backend_t backend {log_file, {1000, 0s, 1024 * 1024}};
+  for (int x = 0; x < 100; ++x) {
+    backend.consume({}, "Info: entry " + std::to_string(x) + std::string(40, '-'));
+  }
+  backend.wait_compressed();
+
+  EXPECT_LE(std::filesystem::file_size(log_file), 1000u);
+  EXPECT_GE(backend.generation(), 4u);
+
+  auto segments = backend.segments();
+  ASSERT_EQ(segments.size(), backend.generation());
+  for (auto &segment : segments) {
+    EXPECT_TRUE(segment.compressed);
+    EXPECT_TRUE(segment.name.ends_with(".log.gz"));
+    EXPECT_EQ(std::filesystem::file_size(dir / segment.name), segment.size);
+    EXPECT_LE(segment.begin, segment.end);
+  }
+
+  // The oldest segment holds the first entries, the log file the last ones
+  auto oldest = clipboard::decompress(read_file(dir / segments.front().name));
+  ASSERT_TRUE(oldest);
+  EXPECT_TRUE(oldest->starts_with("Info: entry 0-"));
+  EXPECT_NE(read_file(log_file).find("Info: entry 99-"), std::string::npos);
+}
+
+TEST_F(LogRotationTest, RemovesTheOldestSegmentsBeyondTheKeptSize) {
+  log_rotation::backend_t backend {log_file, {100, 0s, 1}};
+  for (int x = 0; x < 10; ++x) {
+    backend.consume({}, std::string(80, 'a' + x));
+  }
+  backend.wait_compressed();
+
+  // Every segment is larger than the kept size
+  EXPECT_TRUE(backend.segments().empty());
+  for (auto &entry : std::filesystem::directory_iterator {dir}) {
+    EXPECT_FALSE(entry.path().filename().string().ends_with(".gz")) << entry.path();
+  }
+}
+
+TEST_F(LogRotationTest, KeepsTheIndexAndThePreviousLogAcrossRuns) {
+  {
+    log_rotation::backend_t backend {log_file, {100, 0s, 1024 * 1024}};
+    backend.consume({}, "[2024-01-01 12:00:00.000]: Info: first run" + std::string(80, '-'));
+    backend.consume({}, "[2024-01-01 12:00:01.000]: Info: still the first run");
+    backend.wait_compressed();
+    ASSERT_EQ(backend.segments().size(), 1u);
+  }
+
+  log_rotation::backend_t backend {log_file, {100, 0s, 1024 * 1024}};
+  backend.wait_compressed();
+
+  auto segments = backend.segments();
+  ASSERT_EQ(segments.size(), 2u);
+  EXPECT_EQ(std::filesystem::file_size(log_file), 0u);
+
+  // The log of the previous run is named after its first entry
+  EXPECT_TRUE(segments.back().name.starts_with(log_rotation::segment_name(log_file, segments.back().begin)));
+  auto previous = clipboard::decompress(read_file(dir / segments.back().name));
+  ASSERT_TRUE(previous);
+  EXPECT_EQ(*previous, "[2024-01-01 12:00:01.000]: Info: still the first run\n");
+}
+
+TEST_F(LogRotationTest, NamesSegmentsAfterTheLogFile) {
+  auto name = log_rotation::segment_name("/var/log/sunshine.log", std::chrono::system_clock::now());
+  EXPECT_TRUE(name.starts_with("sunshine-"));
+  EXPECT_TRUE(name.ends_with(".log"));
+  EXPECT_EQ(name.size(), "sunshine-20240101-120000.log"sv.size());
+}
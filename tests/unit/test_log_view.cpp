@@ -0,0 +1,100 @@
+/**
+ * @file tests/unit/test_log_view.cpp
+ * @brief Test src/log_view.*.
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <src/log_view.h>
+
+namespace {
+  std::string entry(int x, std::string_view level) {
+    auto seconds = std::to_string(x % 60);
+    return "[2024-01-01 00:00:" + std::string(2 - seconds.size(), '0') + seconds + ".000]: " + std::string {level} + ": entry " + std::to_string(x) + '\n';
+  }
+}  // namespace
+
+TEST(LogViewTests, ParsesLevels) {
+  EXPECT_EQ(log_view::parse_level("[2024-01-01 12:34:56.789]: Warning: something\n"), 3);
+  EXPECT_EQ(log_view::parse_level("[2024-01-01 12:34:56.789]: Verbose: something"), 0);
+  EXPECT_EQ(log_view::parse_level("  continuation of the entry\n"), std::nullopt);
+  EXPECT_EQ(log_view::parse_level("[2024-01-01 12:34:56]: Info: no milliseconds"), std::nullopt);
+
+  EXPECT_EQ(log_view::level_from_string("error"), 4);
+  EXPECT_EQ(log_view::level_from_string("Fatal"), 5);
+  EXPECT_EQ(log_view::level_from_string("2"), 2);
+  EXPECT_EQ(log_view::level_from_string("loud"), std::nullopt);
+}
+
+TEST(LogViewTests, ParsesRanges) {
+  auto range = log_view::parse_range("bytes=10-19", 100);
+  ASSERT_TRUE(range);
+  EXPECT_EQ(range->begin, 10u);
+  EXPECT_EQ(range->end, 20u);
+
+  range = log_view::parse_range("bytes=90-", 100);
+  ASSERT_TRUE(range);
+  EXPECT_EQ(range->end, 100u);
+
+  range = log_view::parse_range("bytes=-500", 100);
+  ASSERT_TRUE(range);
+  EXPECT_EQ(range->begin, 0u);
+
+  EXPECT_FALSE(log_view::parse_range("bytes=100-", 100));
+  EXPECT_FALSE(log_view::parse_range("bytes=0-1,5-9", 100));
+  EXPECT_FALSE(log_view::parse_range("lines=0-1", 100));
+}
+
+TEST(LogViewTests, FilterKeepsContinuationLinesWithTheirEntry) {
+  log_view::level_filter_t filter {3};
+
+  auto kept = filter(entry(0, "Info") + "  info details\n" + entry(1, "Error") + "  error details\n");
+  EXPECT_EQ(kept, entry(1, "Error") + "  error details\n");
+
+  // The entry of the previous call continues
+  EXPECT_EQ(filter("  more error details\n"), "  more error details\n");
+}
+
+TEST(LogViewTests, TailReadsBackwardsAcrossChunks) {
+  auto path = platf::appdata() / "tests" / "log_view.log";
+  std::filesystem::create_directories(path.parent_path());
+
+  std::string contents;
+  {
+    std::ofstream file {path, std::ios::binary};
+    for (int x = 0; x < 10000; ++x) {
+      auto line = entry(x, x % 100 == 0 ? "Error" : "Info");
+      if (x % 100 == 0) {
+        // A long entry spanning more than a chunk
+        line += std::string(x % 1000 == 0 ? log_view::chunk_size + 100 : 10, '-') + '\n';
+      }
+      file << line;
+      contents += line;
+    }
+  }
+
+  log_view::file_view_t view {path.string()};
+  ASSERT_TRUE(view.is_open());
+  ASSERT_EQ(view.size(), contents.size());
+
+  auto tail = view.tail(3, 0, view.size());
+  EXPECT_EQ(tail, entry(9997, "Info") + entry(9998, "Info") + entry(9999, "Info"));
+
+  // The errors, with their continuation lines, are found far back in the file
+  auto errors = view.tail(4, 4, view.size());
+  EXPECT_EQ(errors, entry(9800, "Error") + std::string(10, '-') + '\n' + entry(9900, "Error") + std::string(10, '-') + '\n');
+
+  errors = view.tail(1000, 4, view.size());
+  EXPECT_EQ(std::count(std::begin(errors), std::end(errors), '\n'), 200);
+  EXPECT_TRUE(errors.starts_with(entry(0, "Error")));
+
+  // Follow mode only returns complete lines
+  EXPECT_EQ(view.lines_end(contents.size() - 1), contents.size() - entry(9999, "Info").size());
+  EXPECT_EQ(view.lines_end(10), 0u);
+  EXPECT_EQ(view.read_lines(0, 10), "");
+  EXPECT_EQ(view.read_lines(0, contents.size()), contents);
+
+  std::filesystem::remove(path);
+}
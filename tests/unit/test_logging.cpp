@@ -6,7 +6,9 @@
 #include "../tests_log_checker.h"
 
 #include <format>
+#include <fstream>
 #include <random>
+#include <src/hot_log.h>
 #include <src/logging.h>
 
 namespace {
@@ -45,3 +47,35 @@ TEST_P(LogLevelsTest, PutMessage) {
 
   ASSERT_TRUE(log_checker::line_contains(log_file, test_message));
 }
+
+TEST(HotLogTest, PutMessage) {
+  std::random_device rand_dev;
+  std::mt19937_64 rand_gen(rand_dev());
+  auto id = rand_gen();
+
+  HOT_LOG(info, "Hot message [{}] {:.2f} {} {}", id, 1.5, true, "literal");
+
+  ASSERT_TRUE(log_checker::line_contains(log_file, std::format("Hot message [{}] 1.50 true literal", id)));
+}
+
+TEST(HotLogTest, CountsDroppedMessages) {
+  constexpr auto count = logging::hot::ring_size * 4;
+  auto dropped_before = logging::hot::dropped_total();
+
+  // Flood the ring faster than the hot log thread drains it
+  for (std::size_t x = 0; x < count; ++x) {
+    HOT_LOG(verbose, "Flood message {}", x);
+  }
+  logging::log_flush();
+
+  std::ifstream input(log_file);
+  std::size_t logged = 0;
+  for (std::string line; std::getline(input, line);) {
+    if (line.find("Flood message ") != std::string::npos) {
+      ++logged;
+    }
+  }
+
+  EXPECT_GT(logged, 0);
+  EXPECT_EQ(logged + (logging::hot::dropped_total() - dropped_before), count);
+}
@@ -0,0 +1,86 @@
+/**
+ * @file tests/unit/test_metrics.cpp
+ * @brief Test src/metrics.*.
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <src/metrics.h>
+#include <thread>
+
+using metrics::histogram_t;
+
+TEST(MetricsTests, BucketBoundsContainTheirValues) {
+  for (std::uint64_t value : {0ull, 1ull, 15ull, 16ull, 17ull, 31ull, 32ull, 33ull, 1000ull, 16667ull, 1000000ull}) {
+    auto index = histogram_t::bucket_index(value);
+    ASSERT_LT(index, histogram_t::bucket_count);
+    EXPECT_GE(histogram_t::bucket_upper_bound(index), value);
+    if (index > 0) {
+      EXPECT_LT(histogram_t::bucket_upper_bound(index - 1), value);
+    }
+  }
+}
+
+TEST(MetricsTests, LargeValuesAreClamped) {
+  EXPECT_EQ(histogram_t::bucket_index(std::numeric_limits<std::uint64_t>::max()), histogram_t::bucket_count - 1);
+}
+
+TEST(MetricsTests, PercentilesMergeThreadShards) {
+  auto &histogram = metrics::histogram("test_percentiles");
+  EXPECT_EQ(&histogram, &metrics::histogram("test_percentiles"));
+
+  // 90 fast samples on one thread, 10 slow ones on another that exits before the snapshot
+  for (int x = 0; x < 90; ++x) {
+    histogram.record(std::chrono::microseconds {100});
+  }
+  std::thread {[&histogram]() {
+    for (int x = 0; x < 10; ++x) {
+      histogram.record(std::chrono::milliseconds {10});
+    }
+  }}.join();
+
+  auto snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.count, 100);
+  EXPECT_EQ(snapshot.sum_us, 90 * 100 + 10 * 10000);
+  EXPECT_EQ(snapshot.percentile(0.5), histogram_t::bucket_upper_bound(histogram_t::bucket_index(100)));
+  EXPECT_EQ(snapshot.percentile(0.99), histogram_t::bucket_upper_bound(histogram_t::bucket_index(10000)));
+}
+
+TEST(MetricsTests, CountersAreRegisteredOnce) {
+  auto &counter = metrics::counter("test_counter");
+  EXPECT_EQ(&counter, &metrics::counter("test_counter"));
+
+  std::thread {[&counter]() {
+    counter.add(5);
+  }}.join();
+  counter.add();
+
+  EXPECT_EQ(counter.value(), 6);
+  auto counters = metrics::counters();
+  EXPECT_NE(std::find(counters.begin(), counters.end(), &counter), counters.end());
+}
+
+TEST(MetricsTests, InputTraceFollowsTheFirstFrameAfterInjection) {
+  using namespace std::chrono;
+
+  auto base = steady_clock::now();
+  auto count = [](const char *name) {
+    return metrics::histogram(name).snapshot().count;
+  };
+  auto encoded_before = count("input_to_encode");
+  auto sent_before = count("input_to_send");
+
+  metrics::input_trace::injected(base, base + 1ms);
+
+  // Captured before the injection, so it can't contain the input
+  metrics::input_trace::encoded(1, base, base + 2ms);
+  EXPECT_EQ(count("input_to_encode"), encoded_before);
+
+  metrics::input_trace::encoded(2, base + 5ms, base + 10ms);
+  EXPECT_EQ(count("input_to_encode"), encoded_before + 1);
+
+  metrics::input_trace::sent(1, base + 11ms);
+  EXPECT_EQ(count("input_to_send"), sent_before);
+  metrics::input_trace::sent(2, base + 12ms);
+  EXPECT_EQ(count("input_to_send"), sent_before + 1);
+}
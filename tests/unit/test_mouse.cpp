@@ -121,3 +121,20 @@ TEST_P(MouseHIDTest, AbsMoveInputTest) {
   EXPECT_EQ(new_loc.x, mouse_pos.x);
   EXPECT_EQ(new_loc.y, mouse_pos.y);
 }
+
+TEST(ContactAreaTests, ScalesAxesByRotation) {
+  // Unrotated, the major axis lies along X and the minor axis along Y
+  auto area = input::scale_client_contact_area({100.0f, 50.0f}, 0, {2.0f, 3.0f});
+  EXPECT_NEAR(area.first, 200.0f, 1e-3f);
+  EXPECT_NEAR(area.second, 150.0f, 1e-3f);
+
+  // Rotated by 90 degrees the axes swap
+  area = input::scale_client_contact_area({100.0f, 50.0f}, 90, {2.0f, 3.0f});
+  EXPECT_NEAR(area.first, 300.0f, 1e-3f);
+  EXPECT_NEAR(area.second, 100.0f, 1e-3f);
+
+  // Without a minor axis the contact is circular
+  area = input::scale_client_contact_area({100.0f, 0.0f}, 0xFFFF /* LI_ROT_UNKNOWN */, {1.0f, 1.0f});
+  EXPECT_NEAR(area.first, 100.0f, 1e-3f);
+  EXPECT_NEAR(area.second, 100.0f, 1e-3f);
+}
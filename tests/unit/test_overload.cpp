@@ -0,0 +1,78 @@
+/**
+ * @file tests/unit/test_overload.cpp
+ * @brief Test src/overload.*.
+ */
+#include "../tests_common.h"
+
+#include <src/overload.h>
+
+TEST(OverloadTests, RanksClientsByPermission) {
+  EXPECT_EQ(overload::priority(crypto::PERM::_all), 2);
+  EXPECT_EQ(overload::priority(static_cast<crypto::PERM>(static_cast<std::uint32_t>(crypto::PERM::_default) | static_cast<std::uint32_t>(crypto::PERM::input_controller))), 1);
+  EXPECT_EQ(overload::priority(crypto::PERM::_default), 0);
+}
+
+TEST(OverloadTests, ShedsTheLowestPriorityFirst) {
+  std::vector<overload::member_t> members {
+    {2, 0, 60},
+    {1, 0, 60},
+    {0, 0, 60},
+    {0, 1, 60},
+  };
+
+  // The least shed spectator goes first
+  auto step = overload::shed(members);
+  ASSERT_TRUE(step);
+  EXPECT_EQ(step->index, 2u);
+  EXPECT_EQ(step->level, 1);
+
+  members[2].level = overload::max_level;
+  members[3].level = overload::max_level;
+  step = overload::shed(members);
+  ASSERT_TRUE(step);
+  EXPECT_EQ(step->index, 1u);
+
+  // The owner is never shed
+  members[1].level = overload::max_level;
+  EXPECT_FALSE(overload::shed(members));
+}
+
+TEST(OverloadTests, RestoresTheHighestPriorityFirst) {
+  std::vector<overload::member_t> members {
+    {2, 0, 60},
+    {1, 1, 60},
+    {0, 2, 60},
+  };
+
+  auto step = overload::restore(members);
+  ASSERT_TRUE(step);
+  EXPECT_EQ(step->index, 1u);
+  EXPECT_EQ(step->level, 0);
+
+  members[1].level = 0;
+  step = overload::restore(members);
+  ASSERT_TRUE(step);
+  EXPECT_EQ(step->index, 2u);
+  EXPECT_EQ(step->level, 1);
+
+  members[2].level = 0;
+  EXPECT_FALSE(overload::restore(members));
+}
+
+TEST(OverloadTests, ShedsOnlyAfterFallingBehindForTicksInARow) {
+  overload::controller_t controller;
+  std::vector<overload::member_t> members {
+    {2, 0, 60},
+    {0, 0, 60},
+  };
+
+  // A backlog of encoded frames waiting to be sent
+  auto backlog = overload::packet_backlog_per_session * members.size();
+  for (int x = 1; x < overload::overloaded_ticks; ++x) {
+    EXPECT_FALSE(controller.update(members, backlog));
+  }
+
+  auto step = controller.update(members, backlog);
+  ASSERT_TRUE(step);
+  EXPECT_EQ(step->index, 1u);
+}
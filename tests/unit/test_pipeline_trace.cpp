@@ -0,0 +1,88 @@
+/**
+ * @file tests/unit/test_pipeline_trace.cpp
+ * @brief Test src/pipeline_trace.*.
+ */
+#include "../tests_common.h"
+
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <src/config.h>
+#include <src/pipeline_trace.h>
+#include <thread>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Find the complete events of a span name recorded on a thread.
+   */
+  std::vector<nlohmann::json> find_spans(const nlohmann::json &trace, const std::string &thread_name, const std::string &name) {
+    std::optional<std::uint64_t> tid;
+    for (auto &event : trace["traceEvents"]) {
+      if (event["ph"] == "M" && event["args"]["name"] == thread_name) {
+        tid = event["tid"].get<std::uint64_t>();
+      }
+    }
+
+    std::vector<nlohmann::json> spans;
+    for (auto &event : trace["traceEvents"]) {
+      if (event["ph"] == "X" && tid && event["tid"] == *tid && event["name"] == name) {
+        spans.push_back(event);
+      }
+    }
+    return spans;
+  }
+}  // namespace
+
+TEST(PipelineTraceTests, RecordsSpansOnlyWhenEnabled) {
+  auto start = std::chrono::steady_clock::now();
+
+  config::stream.pipeline_trace = false;
+  std::thread {[start]() {
+    pipeline_trace::name_thread("test_disabled");
+    pipeline_trace::span("test_span", start, start + 1ms, 7);
+  }}.join();
+
+  config::stream.pipeline_trace = true;
+  std::thread {[start]() {
+    pipeline_trace::name_thread("test_enabled");
+    pipeline_trace::span("test_span", start, start + 2ms, 7);
+    pipeline_trace::span("test_span", start + 3ms, start + 4ms);
+  }}.join();
+  config::stream.pipeline_trace = false;
+
+  auto trace = nlohmann::json::parse(pipeline_trace::chrome_json());
+  EXPECT_TRUE(find_spans(trace, "test_disabled", "test_span").empty());
+
+  auto spans = find_spans(trace, "test_enabled", "test_span");
+  ASSERT_EQ(spans.size(), 2u);
+  EXPECT_DOUBLE_EQ(spans[0]["dur"].get<double>(), 2000.0);
+  EXPECT_EQ(spans[0]["args"]["frame"], 7);
+  EXPECT_DOUBLE_EQ(spans[1]["ts"].get<double>() - spans[0]["ts"].get<double>(), 3000.0);
+  EXPECT_FALSE(spans[1].contains("args"));
+
+  // A Trace message starts with its first packet, field 1 of type length-delimited
+  auto perfetto = pipeline_trace::perfetto_proto();
+  ASSERT_FALSE(perfetto.empty());
+  EXPECT_EQ(perfetto[0], 0x0a);
+  EXPECT_NE(perfetto.find("test_enabled"), std::string::npos);
+}
+
+TEST(PipelineTraceTests, KeepsTheLatestSpans) {
+  auto start = std::chrono::steady_clock::now();
+
+  config::stream.pipeline_trace = true;
+  std::thread {[start]() {
+    pipeline_trace::name_thread("test_ring");
+    for (std::size_t x = 0; x < pipeline_trace::events_per_thread + 10; ++x) {
+      pipeline_trace::span("test_span", start + std::chrono::microseconds {x}, start + std::chrono::microseconds {x + 1}, (std::int64_t) x);
+    }
+  }}.join();
+  config::stream.pipeline_trace = false;
+
+  auto spans = find_spans(nlohmann::json::parse(pipeline_trace::chrome_json()), "test_ring", "test_span");
+  ASSERT_FALSE(spans.empty());
+  EXPECT_LE(spans.size(), pipeline_trace::events_per_thread);
+  EXPECT_EQ(spans.back()["args"]["frame"], pipeline_trace::events_per_thread + 9);
+  EXPECT_GE(spans.front()["args"]["frame"].get<std::size_t>(), 10u);
+}
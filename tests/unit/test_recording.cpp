@@ -0,0 +1,68 @@
+/**
+ * @file tests/unit/test_recording.cpp
+ * @brief Test src/recording.*.
+ */
+#include "../tests_common.h"
+
+#include <src/recording.h>
+
+#include <sstream>
+
+using namespace std::literals;
+
+namespace {
+  // 4-byte start codes before the parameter sets, a 3-byte one before the slice
+  const auto h264_keyframe = "\x00\x00\x00\x01\x67\x64\x00\x28\xAC"
+                             "\x00\x00\x00\x01\x68\xEE\x3C\x80"
+                             "\x00\x00\x01\x65\x88\x84\x00"s;
+  const auto h264_frame = "\x00\x00\x00\x01\x41\x9A\x02"s;
+
+  recording::video_track_t h264_track {0, 1920, 1080, 60, false, false};
+}  // namespace
+
+TEST(RecordingTests, SplitsNalUnits) {
+  auto nal_units = recording::split_nal_units(h264_keyframe);
+  ASSERT_EQ(nal_units.size(), 3u);
+  EXPECT_EQ(nal_units[0], "\x67\x64\x00\x28\xAC"sv);
+  EXPECT_EQ(nal_units[1], "\x68\xEE\x3C\x80"sv);
+
+  // Trailing zeros are left out
+  EXPECT_EQ(nal_units[2], "\x65\x88\x84"sv);
+
+  EXPECT_TRUE(recording::split_nal_units("\x41\x9A"sv).empty());
+}
+
+TEST(RecordingTests, BuildsAvcConfigurationFromTheKeyframe) {
+  auto avcc = recording::codec_private(h264_track, h264_keyframe);
+  EXPECT_EQ(avcc, "\x01\x64\x00\x28\xFF\xE1"
+                  "\x00\x05\x67\x64\x00\x28\xAC"
+                  "\x01\x00\x04\x68\xEE\x3C\x80"
+                  "\xFD\xF8\xF8\x00"s);
+
+  EXPECT_TRUE(recording::codec_private(h264_track, h264_frame).empty());
+}
+
+TEST(RecordingTests, StartsTheFileWithAKeyframe) {
+  std::ostringstream out;
+  recording::mkv_writer_t writer {out, h264_track, recording::audio_track_t {48000, 2, 1, 1, {0, 1}}};
+
+  EXPECT_FALSE(writer.write_video(h264_frame, false, 0ms));
+  writer.write_audio("\xFC\x00"sv, 0ms);
+  EXPECT_TRUE(out.str().empty());
+
+  EXPECT_TRUE(writer.write_video(h264_keyframe, true, 16ms));
+  writer.write_audio("\xFC\x00"sv, 20ms);
+  EXPECT_TRUE(writer.write_video(h264_frame, false, 33ms));
+  writer.finish();
+
+  auto file = out.str();
+  EXPECT_EQ(file.substr(0, 4), "\x1A\x45\xDF\xA3"s);
+  EXPECT_NE(file.find("V_MPEG4/ISO/AVC"), std::string::npos);
+  EXPECT_NE(file.find("A_OPUS"), std::string::npos);
+  EXPECT_NE(file.find("OpusHead"), std::string::npos);
+
+  // Frames are stored with length prefixes instead of start codes
+  EXPECT_NE(file.find("\x00\x00\x00\x03\x65\x88\x84"s), std::string::npos);
+  EXPECT_NE(file.find("\x00\x00\x00\x03\x41\x9A\x02"s), std::string::npos);
+  EXPECT_NE(file.find("\x1F\x43\xB6\x75"s), std::string::npos);
+}
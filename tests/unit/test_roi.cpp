@@ -0,0 +1,82 @@
+/**
+ * @file tests/unit/test_roi.cpp
+ * @brief Test src/roi.*.
+ */
+#include "../tests_common.h"
+
+#include <src/roi.h>
+
+namespace {
+  struct test_img_t: platf::img_t {
+    test_img_t(int width, int height) {
+      this->width = width;
+      this->height = height;
+    }
+  };
+}  // namespace
+
+TEST(RoiTests, ParsesTheMode) {
+  EXPECT_EQ(roi::mode_from_view("changes"), roi::mode_e::changes);
+  EXPECT_EQ(roi::mode_from_view("focus"), roi::mode_e::focus);
+  EXPECT_EQ(roi::mode_from_view("disabled"), roi::mode_e::disabled);
+  EXPECT_EQ(roi::mode_from_view("other"), roi::mode_e::disabled);
+}
+
+TEST(RoiTests, ScalesTheChangesAndTheCursorToTheFrame) {
+  test_img_t img {3840, 2160};
+  img.cursor = platf::rect_t {100, 100, 164, 164};
+  img.damage = {{0, 0, 3840, 200}, {3800, 2100, 4000, 2200}};
+
+  // Unknown changes are left out
+  auto regions = roi::regions(img, 1920, 1080, roi::mode_e::changes, 6);
+  ASSERT_EQ(regions.size(), 1u);
+  EXPECT_EQ(regions[0].rect.left, 50);
+  EXPECT_EQ(regions[0].rect.bottom, 82);
+  EXPECT_EQ(regions[0].qp_delta, -6);
+
+  img.damage_valid = true;
+  regions = roi::regions(img, 1920, 1080, roi::mode_e::changes, 6);
+  ASSERT_EQ(regions.size(), 3u);
+  EXPECT_EQ(regions[1].rect.right, 1920);
+  EXPECT_EQ(regions[1].rect.bottom, 100);
+  EXPECT_EQ(regions[2].rect.right, 1920);
+  EXPECT_EQ(regions[2].rect.bottom, 1080);
+
+  EXPECT_TRUE(roi::regions(img, 1920, 1080, roi::mode_e::disabled, 6).empty());
+}
+
+TEST(RoiTests, MergesManyChangesIntoTheirBounds) {
+  test_img_t img {1920, 1080};
+  img.damage_valid = true;
+  for (int x = 0; x <= (int) roi::max_damage_regions; ++x) {
+    img.damage.push_back({x * 100, x * 50, x * 100 + 10, x * 50 + 10});
+  }
+
+  auto regions = roi::regions(img, 1920, 1080, roi::mode_e::changes, 4);
+  ASSERT_EQ(regions.size(), 1u);
+  EXPECT_EQ(regions[0].rect.left, 0);
+  EXPECT_EQ(regions[0].rect.top, 0);
+  EXPECT_EQ(regions[0].rect.right, (int) roi::max_damage_regions * 100 + 10);
+  EXPECT_EQ(regions[0].rect.bottom, (int) roi::max_damage_regions * 50 + 10);
+}
+
+TEST(RoiTests, BuildsAMapWhereTheFirstRegionWins) {
+  test_img_t img {1920, 1080};
+  img.cursor = platf::rect_t {0, 0, 16, 16};
+
+  std::vector<std::int8_t> map;
+  roi::build_map(roi::regions(img, 1920, 1080, roi::mode_e::focus, 8), 64, 1920, 1080, map);
+
+  // 30x17 superblocks, the last row is partial
+  ASSERT_EQ(map.size(), 30u * 17u);
+  EXPECT_EQ(map[0], -8);
+  EXPECT_EQ(map[1], 0);
+  EXPECT_EQ(map[8 * 30 + 15], -8);
+  EXPECT_EQ(map[2 * 30 + 5], -4);
+  EXPECT_EQ(map[16 * 30 + 29], 0);
+
+  // Deltas beyond the range of the encoders are clamped
+  roi::build_map({{{0, 0, 1920, 1080}, -100}}, 16, 1920, 1080, map);
+  ASSERT_EQ(map.size(), 120u * 68u);
+  EXPECT_EQ(map.back(), -roi::max_qp_delta);
+}
@@ -5,11 +5,24 @@
 
 #include <cstdint>
 #include <functional>
+#include <limits>
+#include <optional>
+#include <src/stream.h>
+#include <src/video.h>
 #include <string>
 #include <vector>
 
 namespace stream {
   std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2);
+  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::vector<std::string_view> &segments);
+  size_t pacing_packets_in_1ms(size_t blocksize, int bitrate_kbps, std::uint64_t link_speed, std::uint32_t rtt, std::uint32_t rtt_variance, float loss_percentage);
+  size_t spread_packets_in_1ms(size_t packets_in_1ms, size_t shards, std::chrono::milliseconds spread, int framerate);
+  void replace(std::vector<std::string_view> &segments, const std::string_view &old, const std::string_view &_new, const char *hint = nullptr);
+  bool drop_stale_frames(std::vector<video::packet_t> &queued, const video::packet_t &packet, int max_queued, std::optional<std::pair<int64_t, int64_t>> &invalidate);
+  bool skip_droppable_frames(std::vector<video::packet_t> &queued, const video::packet_t &packet, int max_queued, std::vector<int64_t> &skipped);
+  int frames_within_budget(const std::vector<video::packet_t> &queued, const video::packet_t &packet, std::size_t budget, std::size_t &bytes);
+  void coalesce_feedback(std::vector<platf::gamepad_feedback_msg_t> &msgs);
+  std::chrono::milliseconds retransmit_window(std::uint32_t rtt, std::uint32_t rtt_variance);
 }
 
 #include "../tests_common.h"
@@ -37,3 +50,298 @@ TEST(ConcatAndInsertTests, ConcatSmallStrideTest) {
   auto expected = std::vector<uint8_t> {0, 'a', 0, 'b', 0, 'c', 0, 'd', 0, 'e'};
   ASSERT_EQ(res, expected);
 }
+
+TEST(ConcatAndInsertTests, ConcatSegmentsTest) {
+  std::vector<std::string_view> segments {"ab", "", "c", "def"};
+  auto res = stream::concat_and_insert(1, 4, segments);
+  auto expected = std::vector<uint8_t> {0, 'a', 'b', 'c', 'd', 0, 'e', 'f'};
+  ASSERT_EQ(res, expected);
+}
+
+TEST(ReplaceTests, ReplaceSplicesSegmentsTest) {
+  std::string_view original = "xxSPSyy";
+  std::vector<std::string_view> segments {"hdr", original};
+  stream::replace(segments, "SPS", "NEWSPS");
+
+  auto expected = std::vector<std::string_view> {"hdr", "xx", "NEWSPS", "yy"};
+  ASSERT_EQ(segments, expected);
+
+  // The unchanged parts must still point into the original buffer
+  ASSERT_EQ(segments[1].data(), original.data());
+  ASSERT_EQ(segments[3].data(), original.data() + 5);
+}
+
+TEST(ReplaceTests, ReplaceNoMatchTest) {
+  std::vector<std::string_view> segments {"abc"};
+  stream::replace(segments, "xyz", "123");
+  ASSERT_EQ(segments, std::vector<std::string_view> {"abc"});
+}
+
+TEST(ReplaceTests, ReplaceUsesHintTest) {
+  std::string_view original = "SPSxxSPS";
+  std::vector<std::string_view> segments {original};
+  stream::replace(segments, "SPS", "N", original.data() + 5);
+
+  auto expected = std::vector<std::string_view> {"SPSxx", "N", ""};
+  ASSERT_EQ(segments, expected);
+}
+
+TEST(ReplaceTests, ReplaceStaleHintFallsBackTest) {
+  std::string_view original = "xxSPSyy";
+  std::vector<std::string_view> segments {original};
+  stream::replace(segments, "SPS", "N", original.data() + 1);
+
+  auto expected = std::vector<std::string_view> {"xx", "N", "yy"};
+  ASSERT_EQ(segments, expected);
+}
+
+TEST(PacingTests, DefaultsToGigabitTest) {
+  // 80% of 1Gbps in 1000 byte packets
+  ASSERT_EQ(stream::pacing_packets_in_1ms(1000, 20000, 0, 0, 0, -1.0f), 100);
+}
+
+TEST(PacingTests, ScalesWithLinkSpeedTest) {
+  ASSERT_EQ(stream::pacing_packets_in_1ms(1000, 20000, 10'000'000'000, 1, 0, 0.0f), 1000);
+}
+
+TEST(PacingTests, CapsFasterLinksWithoutFeedbackTest) {
+  // Without a measured loss, with loss or with queueing, a faster link stays at 80% of 1Gbps
+  ASSERT_EQ(stream::pacing_packets_in_1ms(1000, 20000, 10'000'000'000, 1, 0, -1.0f), 100);
+  ASSERT_EQ(stream::pacing_packets_in_1ms(1000, 20000, 10'000'000'000, 1, 0, 5.0f), 100);
+  ASSERT_EQ(stream::pacing_packets_in_1ms(1000, 20000, 10'000'000'000, 0, 0, 0.0f), 100);
+  ASSERT_EQ(stream::pacing_packets_in_1ms(1000, 20000, 10'000'000'000, 10, 2, 0.0f), 71);
+}
+
+TEST(PacingTests, BacksOffOnJitterTest) {
+  // RTT variance equal to the RTT cuts the capped rate to a third
+  ASSERT_EQ(stream::pacing_packets_in_1ms(1000, 20000, 3'000'000'000, 10, 10, 0.0f), 33);
+}
+
+TEST(PacingTests, KeepsUpWithBitrateTest) {
+  // Never pace below twice the stream bitrate
+  ASSERT_EQ(stream::pacing_packets_in_1ms(1000, 500000, 1'000'000'000, 10, 100, 0.0f), 125);
+  ASSERT_EQ(stream::pacing_packets_in_1ms(100000, 0, 0, 0, 0, -1.0f), 1);
+}
+
+TEST(PacingTests, SpreadsTheFrameOverTheWindowTest) {
+  // 100 shards over 4ms
+  ASSERT_EQ(stream::spread_packets_in_1ms(100, 100, std::chrono::milliseconds {4}, 60), 25);
+  ASSERT_EQ(stream::spread_packets_in_1ms(100, 101, std::chrono::milliseconds {4}, 60), 26);
+  ASSERT_EQ(stream::spread_packets_in_1ms(100, 1, std::chrono::milliseconds {4}, 60), 1);
+}
+
+TEST(PacingTests, SpreadStaysWithinTheFrameIntervalTest) {
+  // 3/4 of the 8.3ms interval at 120 FPS leaves 6ms
+  ASSERT_EQ(stream::spread_packets_in_1ms(100, 120, std::chrono::milliseconds {20}, 120), 20);
+  // Never faster than the pacing rate, and off without a window
+  ASSERT_EQ(stream::spread_packets_in_1ms(10, 100, std::chrono::milliseconds {4}, 60), 10);
+  ASSERT_EQ(stream::spread_packets_in_1ms(100, 100, std::chrono::milliseconds {0}, 60), 100);
+  ASSERT_EQ(stream::spread_packets_in_1ms(100, 100, std::chrono::milliseconds {4}, 1000), 100);
+}
+
+namespace {
+  video::packet_t make_frame(int session, int64_t frame_index, bool idr = false, bool droppable = false) {
+    auto packet = std::make_unique<video::packet_raw_generic>(std::vector<uint8_t> {}, frame_index, idr);
+    packet->channel_data = (void *) (std::intptr_t) session;
+    packet->droppable = droppable;
+    return packet;
+  }
+}  // namespace
+
+TEST(DropStaleFramesTests, KeepsBacklogWithinBoundTest) {
+  std::vector<video::packet_t> queued;
+  queued.emplace_back(make_frame(1, 2));
+  queued.emplace_back(make_frame(1, 3));
+
+  std::optional<std::pair<int64_t, int64_t>> invalidate;
+  ASSERT_FALSE(stream::drop_stale_frames(queued, make_frame(1, 1), 2, invalidate));
+  ASSERT_EQ(queued.size(), 2);
+  ASSERT_FALSE(invalidate);
+}
+
+TEST(DropStaleFramesTests, DropsSessionBacklogAndInvalidatesTest) {
+  std::vector<video::packet_t> queued;
+  queued.emplace_back(make_frame(1, 2));
+  queued.emplace_back(make_frame(2, 7));
+  queued.emplace_back(make_frame(1, 3));
+  queued.emplace_back(make_frame(1, 4));
+
+  std::optional<std::pair<int64_t, int64_t>> invalidate;
+  ASSERT_TRUE(stream::drop_stale_frames(queued, make_frame(1, 1), 2, invalidate));
+  ASSERT_EQ(queued.size(), 1);
+  ASSERT_EQ(queued[0]->frame_index(), 7);
+  ASSERT_EQ(invalidate, std::make_pair<int64_t, int64_t>(1, 4));
+}
+
+TEST(DropStaleFramesTests, DropsUpToQueuedIdrTest) {
+  std::vector<video::packet_t> queued;
+  queued.emplace_back(make_frame(1, 2));
+  queued.emplace_back(make_frame(1, 3, true));
+  queued.emplace_back(make_frame(1, 4));
+
+  std::optional<std::pair<int64_t, int64_t>> invalidate;
+  ASSERT_TRUE(stream::drop_stale_frames(queued, make_frame(1, 1), 1, invalidate));
+  ASSERT_EQ(queued.size(), 2);
+  ASSERT_TRUE(queued[0]->is_idr());
+  ASSERT_FALSE(invalidate);
+}
+
+TEST(SkipDroppableFramesTests, SkipsOldestUnreferencedFramesTest) {
+  std::vector<video::packet_t> queued;
+  queued.emplace_back(make_frame(1, 2, false, true));
+  queued.emplace_back(make_frame(2, 7, false, true));
+  queued.emplace_back(make_frame(1, 3));
+  queued.emplace_back(make_frame(1, 4, false, true));
+  queued.emplace_back(make_frame(1, 5));
+
+  std::vector<int64_t> skipped;
+  ASSERT_FALSE(stream::skip_droppable_frames(queued, make_frame(1, 1), 3, skipped));
+  ASSERT_EQ(skipped, std::vector<int64_t> {2});
+  ASSERT_EQ(queued.size(), 4);
+  ASSERT_EQ(queued[0]->frame_index(), 7);
+
+  // The popped frame goes first
+  skipped.clear();
+  ASSERT_TRUE(stream::skip_droppable_frames(queued, make_frame(1, 1, false, true), 1, skipped));
+  ASSERT_EQ(skipped, std::vector<int64_t> {1});
+  ASSERT_EQ(queued.size(), 4);
+}
+
+TEST(SkipDroppableFramesTests, KeepsRecoveryFramesTest) {
+  std::vector<video::packet_t> queued;
+  queued.emplace_back(make_frame(1, 2, false, true));
+
+  auto recovery = make_frame(1, 1, false, true);
+  recovery->after_ref_frame_invalidation = true;
+
+  std::vector<int64_t> skipped;
+  ASSERT_FALSE(stream::skip_droppable_frames(queued, recovery, 0, skipped));
+  ASSERT_EQ(skipped, std::vector<int64_t> {2});
+  ASSERT_TRUE(queued.empty());
+}
+
+TEST(FramesWithinBudgetTests, CountsTheOldestFramesThatFitTest) {
+  auto make_sized_frame = [](int session, int64_t frame_index, std::size_t size) {
+    auto packet = std::make_unique<video::packet_raw_generic>(std::vector<uint8_t>(size), frame_index, false);
+    packet->channel_data = (void *) (std::intptr_t) session;
+    return video::packet_t {std::move(packet)};
+  };
+
+  std::vector<video::packet_t> queued;
+  queued.emplace_back(make_sized_frame(1, 2, 100));
+  queued.emplace_back(make_sized_frame(2, 7, 1000));
+  queued.emplace_back(make_sized_frame(1, 3, 100));
+  queued.emplace_back(make_sized_frame(1, 4, 100));
+
+  std::size_t bytes;
+  ASSERT_EQ(stream::frames_within_budget(queued, make_sized_frame(1, 1, 0), 300, bytes), std::numeric_limits<int>::max());
+  ASSERT_EQ(bytes, 300);
+
+  ASSERT_EQ(stream::frames_within_budget(queued, make_sized_frame(1, 1, 0), 250, bytes), 2);
+  ASSERT_EQ(bytes, 300);
+
+  ASSERT_EQ(stream::frames_within_budget(queued, make_sized_frame(2, 6, 0), 500, bytes), 0);
+  ASSERT_EQ(bytes, 1000);
+}
+
+TEST(FrameNumberingTests, NumbersSkippedFramesAwayTest) {
+  stream::frame_numbering_t numbering;
+  EXPECT_EQ(numbering.to_client(5), 5);
+
+  // Skips can be recorded out of order when queued frames are skipped
+  numbering.skip(8);
+  numbering.skip(6);
+  EXPECT_EQ(numbering.to_client(5), 5);
+  EXPECT_EQ(numbering.to_client(7), 6);
+  EXPECT_EQ(numbering.to_client(9), 7);
+
+  EXPECT_EQ(numbering.to_encoder(5), 5);
+  EXPECT_EQ(numbering.to_encoder(6), 7);
+  EXPECT_EQ(numbering.to_encoder(7), 9);
+  EXPECT_EQ(numbering.to_encoder(8), 10);
+}
+
+TEST(FrameNumberingTests, ForgetsOldSkipsTest) {
+  stream::frame_numbering_t numbering;
+  for (std::int64_t x = 0; x <= (std::int64_t) stream::frame_numbering_t::capacity; ++x) {
+    numbering.skip(x * 2 + 1);
+  }
+
+  auto last = (std::int64_t) stream::frame_numbering_t::capacity * 2 + 2;
+  EXPECT_EQ(numbering.to_client(last), last / 2);
+  EXPECT_EQ(numbering.to_encoder(last / 2), last);
+}
+
+TEST(CoalesceFeedbackTests, KeepsLatestStatePerEffectTest) {
+  using msg_t = platf::gamepad_feedback_msg_t;
+  std::vector<msg_t> msgs {
+    msg_t::make_rumble(0, 1, 1),
+    msg_t::make_rumble(1, 2, 2),
+    msg_t::make_motion_event_state(0, 1, 100),
+    msg_t::make_rumble(0, 3, 3),
+    msg_t::make_motion_event_state(0, 2, 200),
+    msg_t::make_rumble_triggers(0, 4, 4),
+    msg_t::make_rumble(0, 0, 0),
+    msg_t::make_motion_event_state(0, 1, 0),
+  };
+  stream::coalesce_feedback(msgs);
+
+  ASSERT_EQ(msgs.size(), 5);
+  EXPECT_EQ(msgs[0].type, platf::gamepad_feedback_e::rumble);
+  EXPECT_EQ(msgs[0].id, 0);
+  EXPECT_EQ(msgs[0].data.rumble.lowfreq, 0);
+  EXPECT_EQ(msgs[1].id, 1);
+  EXPECT_EQ(msgs[1].data.rumble.lowfreq, 2);
+  EXPECT_EQ(msgs[2].data.motion_event_state.motion_type, 1);
+  EXPECT_EQ(msgs[2].data.motion_event_state.report_rate, 0);
+  EXPECT_EQ(msgs[3].data.motion_event_state.motion_type, 2);
+  EXPECT_EQ(msgs[3].data.motion_event_state.report_rate, 200);
+  EXPECT_EQ(msgs[4].type, platf::gamepad_feedback_e::rumble_triggers);
+}
+
+TEST(RetransmitBufferTests, FindsStoredPacketsTest) {
+  stream::retransmit_buffer_t buffer;
+  buffer.enable();
+
+  auto now = std::chrono::steady_clock::now();
+  for (std::uint16_t seq = 65534; seq != 4; ++seq) {
+    buffer.store(seq, "p", std::to_string(seq), now);
+  }
+
+  std::string packet;
+  ASSERT_TRUE(buffer.find(65535, now, packet));
+  EXPECT_EQ(packet, "p65535");
+  ASSERT_TRUE(buffer.find(3, now, packet));
+  EXPECT_EQ(packet, "p3");
+  EXPECT_FALSE(buffer.find(4, now, packet));
+  EXPECT_FALSE(buffer.find(65533, now, packet));
+  EXPECT_FALSE(buffer.find(0, now + 1ms, packet));
+}
+
+TEST(RetransmitBufferTests, OverwritesOldestPacketsTest) {
+  stream::retransmit_buffer_t buffer;
+  buffer.enable();
+
+  auto now = std::chrono::steady_clock::now();
+  for (std::size_t seq = 0; seq < stream::retransmit_buffer_t::capacity + 1; ++seq) {
+    buffer.store((std::uint16_t) seq, {}, "x", now);
+  }
+
+  std::string packet;
+  EXPECT_FALSE(buffer.find(0, now, packet));
+  EXPECT_TRUE(buffer.find(1, now, packet));
+  EXPECT_TRUE(buffer.find((std::uint16_t) stream::retransmit_buffer_t::capacity, now, packet));
+}
+
+TEST(RetransmitWindowTests, ClampsToRoundTripsTest) {
+  EXPECT_EQ(stream::retransmit_window(0, 0), 20ms);
+  EXPECT_EQ(stream::retransmit_window(20, 5), 60ms);
+  EXPECT_EQ(stream::retransmit_window(500, 50), 250ms);
+}
+
+TEST(PacketSizeForMtuTests, FitsDatagramsInOnePacketTest) {
+  EXPECT_EQ(stream::packet_size_for_mtu(1500, false), 1424);
+  EXPECT_EQ(stream::packet_size_for_mtu(1500, true), 1392);
+  EXPECT_EQ(stream::packet_size_for_mtu(9000, false), 8912);
+  EXPECT_EQ(stream::packet_size_for_mtu(40, false), 0);
+}
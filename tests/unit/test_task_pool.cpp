@@ -0,0 +1,75 @@
+/**
+ * @file tests/unit/test_task_pool.cpp
+ * @brief Test src/task_pool.*.
+ */
+#include "../tests_common.h"
+
+#include <src/task_pool.h>
+#include <thread>
+
+using namespace std::literals;
+
+namespace {
+  void run_ready(task_pool_util::TaskPool &pool) {
+    while (auto task = pool.pop()) {
+      (*task)->run();
+    }
+  }
+}  // namespace
+
+TEST(TaskPoolTests, RunsDelayedTasksInDeadlineOrder) {
+  task_pool_util::TaskPool pool;
+
+  std::vector<int> order;
+  pool.pushDelayed([&]() {
+    order.push_back(2);
+  },
+                   20ms);
+  pool.pushDelayed([&]() {
+    order.push_back(0);
+  },
+                   0ms);
+  pool.pushDelayed([&]() {
+    order.push_back(1);
+  },
+                   0ms);
+
+  run_ready(pool);
+  EXPECT_EQ(order, (std::vector<int> {0, 1}));
+  ASSERT_TRUE(pool.next());
+
+  std::this_thread::sleep_until(*pool.next());
+  run_ready(pool);
+  EXPECT_EQ(order, (std::vector<int> {0, 1, 2}));
+  EXPECT_FALSE(pool.next());
+}
+
+TEST(TaskPoolTests, CancelAndDelay) {
+  task_pool_util::TaskPool pool;
+
+  bool cancelled_ran = false;
+  bool delayed_ran = false;
+  auto cancelled = pool.pushDelayed([&]() {
+    cancelled_ran = true;
+  },
+                                    0ms);
+  auto delayed = pool.pushDelayed([&]() {
+    delayed_ran = true;
+  },
+                                  0ms);
+
+  EXPECT_TRUE(pool.cancel(cancelled.task_id));
+  EXPECT_FALSE(pool.cancel(cancelled.task_id));
+  pool.delay(delayed.task_id, 1h);
+
+  run_ready(pool);
+  EXPECT_FALSE(cancelled_ran);
+  EXPECT_FALSE(delayed_ran);
+  EXPECT_FALSE(pool.ready());
+
+  auto popped = pool.pop(delayed.task_id);
+  ASSERT_TRUE(popped);
+  popped->second->run();
+  EXPECT_TRUE(delayed_ran);
+  EXPECT_FALSE(pool.next());
+}
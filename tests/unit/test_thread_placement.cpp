@@ -0,0 +1,54 @@
+/**
+ * @file tests/unit/test_thread_placement.cpp
+ * @brief Test src/thread_placement.*.
+ */
+#include "../tests_common.h"
+
+#include <src/thread_placement.h>
+
+TEST(ThreadPlacementTests, ParsesCpuLists) {
+  EXPECT_EQ(thread_placement::parse_cpu_list("0-3,8"), (std::vector<int> {0, 1, 2, 3, 8}));
+  EXPECT_EQ(thread_placement::parse_cpu_list("8,2-3,3"), (std::vector<int> {2, 3, 8}));
+  EXPECT_EQ(thread_placement::parse_cpu_list("5"), (std::vector<int> {5}));
+
+  EXPECT_TRUE(thread_placement::parse_cpu_list("").empty());
+  EXPECT_TRUE(thread_placement::parse_cpu_list("3-1").empty());
+  EXPECT_TRUE(thread_placement::parse_cpu_list("0,,1").empty());
+  EXPECT_TRUE(thread_placement::parse_cpu_list("a-b").empty());
+}
+
+TEST(ThreadPlacementTests, ParsesPlacements) {
+  auto placement = thread_placement::parse("cores=0-1 numa=1 priority=critical mmcss=Games");
+  ASSERT_TRUE(placement);
+  EXPECT_EQ(placement->cores, (std::vector<int> {0, 1}));
+  EXPECT_EQ(placement->numa_node, 1);
+  EXPECT_EQ(placement->priority, (int) platf::thread_priority_e::critical);
+  EXPECT_EQ(placement->mmcss_task, "Games");
+
+  placement = thread_placement::parse("numa=0");
+  ASSERT_TRUE(placement);
+  EXPECT_TRUE(placement->cores.empty());
+  EXPECT_FALSE(placement->priority);
+
+  EXPECT_FALSE(thread_placement::parse("cores="));
+  EXPECT_FALSE(thread_placement::parse("priority=realtime"));
+  EXPECT_FALSE(thread_placement::parse("affinity=0"));
+  EXPECT_FALSE(thread_placement::parse("cores"));
+}
+
+TEST(ThreadPlacementTests, PicksLeastBusyCache) {
+  std::vector<std::vector<int>> domains {{0, 1, 2, 3}, {4, 5, 6, 7}};
+  std::vector<double> load {0.1, 0.1, 0.1, 0.1, 0.9, 0.9, 0.9, 0.9};
+
+  EXPECT_EQ(thread_placement::pick_auto_cores(domains, load, {}), domains[0]);
+
+  // Ties go to the last cache
+  EXPECT_EQ(thread_placement::pick_auto_cores(domains, std::vector<double>(8, 0.5), {}), domains[1]);
+
+  // Only the cores of the GPU's NUMA node are considered
+  EXPECT_EQ(thread_placement::pick_auto_cores(domains, load, {2, 3, 4, 5}), (std::vector<int> {2, 3}));
+
+  // A single cache is left to the OS, or to the NUMA node
+  EXPECT_TRUE(thread_placement::pick_auto_cores({{0, 1, 2, 3}}, load, {}).empty());
+  EXPECT_EQ(thread_placement::pick_auto_cores(domains, load, {4, 5}), (std::vector<int> {4, 5}));
+}
@@ -0,0 +1,88 @@
+/**
+ * @file tests/unit/test_thread_safe.cpp
+ * @brief Test src/thread_safe.*.
+ */
+#include "../tests_common.h"
+
+#include <src/thread_safe.h>
+#include <thread>
+
+using namespace std::literals;
+
+TEST(SpscQueueTests, DeliversInOrder) {
+  safe::spsc_queue_t<int> queue {8};
+
+  std::vector<int> received;
+  std::thread consumer {[&]() {
+    while (auto value = queue.pop()) {
+      received.push_back(*value);
+    }
+  }};
+
+  for (int x = 0; x < 1000; ++x) {
+    // Stay below the queue bound so that nothing is discarded
+    while (queue.peek()) {
+      std::this_thread::yield();
+    }
+    queue.raise(x);
+  }
+  while (queue.peek()) {
+    std::this_thread::yield();
+  }
+
+  queue.stop();
+  consumer.join();
+
+  ASSERT_EQ(received.size(), 1000);
+  for (int x = 0; x < 1000; ++x) {
+    EXPECT_EQ(received[x], x);
+  }
+}
+
+TEST(SpscQueueTests, OverflowKeepsNewest) {
+  safe::spsc_queue_t<int> queue {4};
+
+  for (int x = 0; x < 6; ++x) {
+    queue.raise(x);
+  }
+
+  auto value = queue.pop(0ms);
+  ASSERT_TRUE(value);
+  EXPECT_EQ(*value, 5);
+  EXPECT_FALSE(queue.peek());
+
+  // Raising after the overflow appends again
+  queue.raise(6);
+  queue.raise(7);
+  EXPECT_EQ(*queue.pop(0ms), 6);
+  EXPECT_EQ(*queue.pop(0ms), 7);
+}
+
+TEST(SpscQueueTests, BoundIsMaxElements) {
+  safe::spsc_queue_t<int> queue {3};
+
+  for (int x = 0; x < 3; ++x) {
+    queue.raise(x);
+  }
+  for (int x = 0; x < 3; ++x) {
+    EXPECT_EQ(*queue.pop(0ms), x);
+  }
+
+  // Like queue_t, the element that overflows the queue is kept and the backlog is discarded
+  for (int x = 0; x < 4; ++x) {
+    queue.raise(x);
+  }
+  EXPECT_EQ(*queue.pop(0ms), 3);
+  EXPECT_FALSE(queue.peek());
+}
+
+TEST(SpscQueueTests, PopTimesOutAndStops) {
+  safe::spsc_queue_t<int> queue;
+
+  EXPECT_FALSE(queue.pop(1ms));
+
+  queue.raise(1);
+  queue.stop();
+  EXPECT_FALSE(queue.running());
+  EXPECT_FALSE(queue.pop());
+}
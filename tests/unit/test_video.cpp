@@ -72,3 +72,95 @@ TEST(PacketRawTests, ReplacementsDefaultNullptr) {
   test_packet_t packet;
   ASSERT_EQ(packet.replacements, nullptr);
 }
+
+TEST(PacketPoolTests, ReusesReleasedPacketsAndBuffers) {
+  auto pool = std::make_shared<video::packet_pool_t>();
+
+  auto buffer = pool->buffer();
+  buffer.assign(1000, 0);
+  auto packet = pool->generic(std::move(buffer), 1, true);
+  auto *first = packet.get();
+  packet->channel_data = first;
+  packet.reset();
+
+  auto reused = pool->buffer();
+  ASSERT_TRUE(reused.empty());
+  ASSERT_GE(reused.capacity(), 1000u);
+
+  auto next = pool->generic(std::move(reused), 2, false);
+  ASSERT_EQ(next.get(), first);
+  ASSERT_EQ(next->frame_index(), 2);
+  ASSERT_FALSE(next->is_idr());
+  ASSERT_EQ(next->channel_data, nullptr);
+}
+
+TEST(PacketPoolTests, PacketsOutliveTheirPool) {
+  auto pool = std::make_shared<video::packet_pool_t>();
+  video::packet_t packet = pool->generic(std::vector<uint8_t>(16), 1, false);
+  pool.reset();
+
+  ASSERT_EQ(packet->data_size(), 16u);
+  packet.reset();
+}
+
+namespace {
+  struct content_img_t: platf::img_t {
+    content_img_t(std::uint64_t frame_index, std::vector<platf::rect_t> damage) {
+      width = 1920;
+      height = 1080;
+      this->frame_index = frame_index;
+      this->damage = std::move(damage);
+      damage_valid = true;
+    }
+  };
+}  // namespace
+
+TEST(ContentDetectorTests, SettlesOnTheContentOfEachWindow) {
+  using namespace std::literals;
+
+  video::content_detector_t detector;
+  auto window_start = std::chrono::steady_clock::now();
+  std::uint64_t frame_index = 0;
+
+  // A caret and a menu change small regions, repeated images don't count
+  for (int x = 0; x < 100; ++x) {
+    auto now = window_start + x * 50ms;
+    EXPECT_EQ(detector.add(content_img_t {++frame_index, {{0, 0, 200, 200}}}, now), std::nullopt);
+    EXPECT_EQ(detector.add(content_img_t {frame_index, {}}, now), std::nullopt);
+  }
+  window_start += video::content_detector_t::window;
+  EXPECT_EQ(detector.add(content_img_t {++frame_index, {{0, 0, 1920, 1080}}}, window_start), video::content_type_e::desktop);
+  EXPECT_EQ(detector.current(), video::content_type_e::desktop);
+
+  // A mixed window keeps the content type
+  for (int x = 0; x < 100; ++x) {
+    auto busy = x % 5 == 0;
+    EXPECT_EQ(detector.add(content_img_t {++frame_index, {{0, 0, 1920, busy ? 1080 : 10}}}, window_start + x * 50ms), std::nullopt);
+  }
+  window_start += video::content_detector_t::window;
+  EXPECT_EQ(detector.add(content_img_t {++frame_index, {}}, window_start), std::nullopt);
+
+  // Images without damage information count as busy
+  for (int x = 0; x <= 100; ++x) {
+    content_img_t img {++frame_index, {}};
+    img.damage_valid = false;
+    auto content_type = detector.add(img, window_start + x * 100ms);
+    EXPECT_EQ(content_type, x == 100 ? std::optional {video::content_type_e::video} : std::nullopt);
+  }
+  EXPECT_EQ(detector.current(), video::content_type_e::video);
+}
+
+TEST(ContentDetectorTests, UsesScreenContentToolsOnlyForAv1) {
+  video::config_t config {};
+  config.videoFormat = 2;
+  EXPECT_TRUE(video::supports_screen_content("amdvce", config));
+  EXPECT_TRUE(video::supports_screen_content("software", config));
+  EXPECT_FALSE(video::supports_screen_content("nvenc", config));
+
+  config.videoFormat = 1;
+  EXPECT_FALSE(video::supports_screen_content("amdvce", config));
+
+  EXPECT_EQ(video::content_type_from_view("desktop"), video::content_type_e::desktop);
+  EXPECT_EQ(video::content_type_from_view("video"), video::content_type_e::video);
+  EXPECT_EQ(video::content_type_from_view(""), video::content_type_e::automatic);
+}
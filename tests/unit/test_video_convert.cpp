@@ -0,0 +1,147 @@
+/**
+ * @file tests/unit/test_video_convert.cpp
+ * @brief Test src/video_convert.*.
+ */
+#include "../tests_common.h"
+
+#include <cstdlib>
+#include <random>
+#include <src/video_convert.h>
+#include <vector>
+
+using video::bgrx_to_yuv_t;
+using video::yuv_layout_e;
+
+namespace {
+  struct yuv_frame_t {
+    std::vector<std::uint8_t> planes[3];
+    std::uint8_t *data[3] {};
+    int pitch[3] {};
+  };
+
+  yuv_frame_t alloc_yuv(yuv_layout_e layout, int width, int height) {
+    auto sample_size = video::bit_depth_from_yuv_layout(layout) > 8 ? 2 : 1;
+    auto chroma_width = (width + 1) / 2;
+    auto chroma_height = (height + 1) / 2;
+
+    int widths[3], heights[3];
+    switch (layout) {
+      case yuv_layout_e::nv12:
+      case yuv_layout_e::p010:
+        widths[1] = chroma_width * 2;
+        heights[1] = chroma_height;
+        widths[2] = heights[2] = 0;
+        break;
+      case yuv_layout_e::yuv420p:
+      case yuv_layout_e::yuv420p10:
+        widths[1] = widths[2] = chroma_width;
+        heights[1] = heights[2] = chroma_height;
+        break;
+      default:
+        widths[1] = widths[2] = width;
+        heights[1] = heights[2] = height;
+        break;
+    }
+    widths[0] = width;
+    heights[0] = height;
+
+    yuv_frame_t frame;
+    for (int x = 0; x < 3; ++x) {
+      // Pad the rows to catch writes past the plane width
+      frame.pitch[x] = widths[x] * sample_size + 64;
+      frame.planes[x].assign((std::size_t) frame.pitch[x] * heights[x], 0xCD);
+      frame.data[x] = frame.planes[x].data();
+    }
+
+    return frame;
+  }
+
+  int max_difference(const yuv_frame_t &a, const yuv_frame_t &b, bool wide) {
+    int difference = 0;
+    for (int x = 0; x < 3; ++x) {
+      if (wide) {
+        auto a_samples = (const std::uint16_t *) a.planes[x].data();
+        auto b_samples = (const std::uint16_t *) b.planes[x].data();
+        for (std::size_t i = 0; i < a.planes[x].size() / 2; ++i) {
+          difference = std::max(difference, std::abs(a_samples[i] - b_samples[i]));
+        }
+      } else {
+        for (std::size_t i = 0; i < a.planes[x].size(); ++i) {
+          difference = std::max(difference, std::abs(a.planes[x][i] - b.planes[x][i]));
+        }
+      }
+    }
+    return difference;
+  }
+}  // namespace
+
+class BgrxToYuvTest: public testing::TestWithParam<yuv_layout_e> {};
+
+TEST_P(BgrxToYuvTest, VectorKernelMatchesScalarReference) {
+  auto layout = GetParam();
+  auto bit_depth = video::bit_depth_from_yuv_layout(layout);
+  auto color_vectors = video::new_color_vectors_from_colorspace({video::colorspace_e::rec709, false, bit_depth});
+
+  // Odd sizes exercise the scalar tails and the repeated last row and column
+  constexpr int width = 37;
+  constexpr int height = 7;
+  std::vector<std::uint8_t> image(width * height * 4);
+  std::mt19937 rng {1234};
+  for (auto &byte : image) {
+    byte = rng();
+  }
+
+  bgrx_to_yuv_t simd {layout, *color_vectors};
+  bgrx_to_yuv_t scalar {layout, *color_vectors, false};
+  EXPECT_STREQ(scalar.kernel_name(), "scalar");
+
+  auto simd_frame = alloc_yuv(layout, width, height);
+  auto scalar_frame = alloc_yuv(layout, width, height);
+  simd.convert(image.data(), width * 4, width, height, simd_frame.data, simd_frame.pitch);
+  scalar.convert(image.data(), width * 4, width, height, scalar_frame.data, scalar_frame.pitch);
+
+  // FMA rounding may flip the last bit
+  auto sample_size = bit_depth > 8 ? 2 : 1;
+  auto shift = layout == yuv_layout_e::p010 ? 6 : 0;
+  EXPECT_LE(max_difference(simd_frame, scalar_frame, sample_size == 2), 1 << shift) << simd.kernel_name();
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  Layouts,
+  BgrxToYuvTest,
+  testing::Values(yuv_layout_e::nv12, yuv_layout_e::p010, yuv_layout_e::yuv420p, yuv_layout_e::yuv420p10, yuv_layout_e::yuv444p, yuv_layout_e::yuv444p10)
+);
+
+TEST(BgrxToYuvTests, LimitedRangeExtremes) {
+  auto color_vectors = video::new_color_vectors_from_colorspace({video::colorspace_e::rec709, false, 8});
+  bgrx_to_yuv_t converter {yuv_layout_e::nv12, *color_vectors};
+
+  // Top half white, bottom half black
+  constexpr int width = 16;
+  constexpr int height = 4;
+  std::vector<std::uint8_t> image(width * height * 4, 0);
+  std::fill(image.begin(), image.begin() + width * 2 * 4, 0xFF);
+
+  auto frame = alloc_yuv(yuv_layout_e::nv12, width, height);
+  converter.convert(image.data(), width * 4, width, height, frame.data, frame.pitch);
+
+  EXPECT_EQ(frame.data[0][0], 235);
+  EXPECT_EQ(frame.data[0][3 * frame.pitch[0]], 16);
+  EXPECT_EQ(frame.data[1][0], 128);
+  EXPECT_EQ(frame.data[1][1], 128);
+}
+
+TEST(BgrxToYuvTests, P010StoresHighBits) {
+  auto color_vectors = video::new_color_vectors_from_colorspace({video::colorspace_e::bt2020, true, 10});
+  bgrx_to_yuv_t converter {yuv_layout_e::p010, *color_vectors};
+
+  constexpr int width = 16;
+  constexpr int height = 2;
+  std::vector<std::uint8_t> image(width * height * 4, 0xFF);
+
+  auto frame = alloc_yuv(yuv_layout_e::p010, width, height);
+  converter.convert(image.data(), width * 4, width, height, frame.data, frame.pitch);
+
+  EXPECT_EQ(((std::uint16_t *) frame.data[0])[0], 1023 << 6);
+  EXPECT_EQ(((std::uint16_t *) frame.data[1])[0], 512 << 6);
+}
@@ -0,0 +1,79 @@
+/**
+ * @file tests/unit/test_xml_writer.cpp
+ * @brief Test src/xml_writer.*.
+ */
+#include "../tests_common.h"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+#include <sstream>
+#include <src/xml_writer.h>
+
+namespace pt = boost::property_tree;
+
+namespace {
+  std::string write_ptree(const pt::ptree &tree) {
+    std::ostringstream data;
+    pt::write_xml(data, tree);
+    return data.str();
+  }
+}  // namespace
+
+TEST(XmlWriterTests, MatchesPropertyTreeOutput) {
+  pt::ptree tree;
+  xml::response_t response;
+
+  tree.put("root.paired", 1);
+  response.put("paired", 1);
+  tree.put("root.hostname", "<Tom & Jerry's \"PC\">");
+  response.put("hostname", "<Tom & Jerry's \"PC\">");
+  tree.put("root.currentgameuuid", "");
+  response.put("currentgameuuid", "");
+  tree.put("root.VirtualDisplayCapable", true);
+  response.put("VirtualDisplayCapable", true);
+  tree.put("root.ServerCodecModeSupport", 0xFFFFFFFFu);
+  response.put("ServerCodecModeSupport", 0xFFFFFFFFu);
+  tree.put("root.<xmlattr>.status_code", 200);
+  response.attribute("status_code", 200);
+
+  // Later values replace earlier ones in place
+  tree.put("root.paired", 0);
+  response.put("paired", 0);
+  tree.put("root.<xmlattr>.status_code", -1);
+  response.attribute("status_code", -1);
+  tree.put("root.<xmlattr>.status_message", "a>b");
+  response.attribute("status_message", "a>b");
+
+  // Repeated and nested elements
+  for (auto name : {"first", "second"}) {
+    pt::ptree cmd;
+    cmd.put_value(name);
+    tree.get_child("root").push_back(std::make_pair("ServerCommand", cmd));
+    response.add("ServerCommand", name);
+
+    pt::ptree app_node;
+    app_node.put("AppTitle", name);
+    app_node.put("UUID", "");
+    tree.get_child("root").push_back(std::make_pair("App", app_node));
+
+    xml::element_t app;
+    app.add("AppTitle", name);
+    app.add("UUID", "");
+    response.add("App", app);
+  }
+
+  EXPECT_EQ(response.str(), write_ptree(tree));
+  EXPECT_EQ(response.get("paired"), "0");
+  EXPECT_EQ(response.get_attribute("status_code"), "-1");
+  EXPECT_FALSE(response.get("missing"));
+}
+
+TEST(XmlWriterTests, EmptyDocuments) {
+  pt::ptree tree;
+  xml::response_t response;
+  EXPECT_EQ(response.str(), write_ptree(tree));
+
+  tree.put("root.<xmlattr>.status_code", 404);
+  response.attribute("status_code", 404);
+  EXPECT_EQ(response.str(), write_ptree(tree));
+}
@@ -0,0 +1,407 @@
+/**
+ * @file tools/capture_helper.cpp
+ * @brief Duplicates an output on the input desktop and hands its frames to Apollo, see src/platform/windows/capture_helper.h.
+ */
+#define WINVER 0x0A00
+
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <cwchar>
+#include <optional>
+#include <string>
+#include <vector>
+
+// platform includes
+#include <d3d11_1.h>
+#include <dxgi1_5.h>
+#include <Windows.h>
+
+// local includes
+#include "src/platform/windows/capture_helper.h"
+#include "src/utility.h"
+
+using namespace std::literals;
+namespace helper = platf::dxgi::capture_helper;
+
+namespace {
+  template<class T>
+  void Release(T *dxgi) {
+    dxgi->Release();
+  }
+
+  using factory1_t = util::safe_ptr<IDXGIFactory1, Release<IDXGIFactory1>>;
+  using adapter_t = util::safe_ptr<IDXGIAdapter1, Release<IDXGIAdapter1>>;
+  using output_t = util::safe_ptr<IDXGIOutput, Release<IDXGIOutput>>;
+  using output1_t = util::safe_ptr<IDXGIOutput1, Release<IDXGIOutput1>>;
+  using output5_t = util::safe_ptr<IDXGIOutput5, Release<IDXGIOutput5>>;
+  using device_t = util::safe_ptr<ID3D11Device, Release<ID3D11Device>>;
+  using device_ctx_t = util::safe_ptr<ID3D11DeviceContext, Release<ID3D11DeviceContext>>;
+  using dup_t = util::safe_ptr<IDXGIOutputDuplication, Release<IDXGIOutputDuplication>>;
+  using texture2d_t = util::safe_ptr<ID3D11Texture2D, Release<ID3D11Texture2D>>;
+  using resource_t = util::safe_ptr<IDXGIResource, Release<IDXGIResource>>;
+  using resource1_t = util::safe_ptr<IDXGIResource1, Release<IDXGIResource1>>;
+  using keyed_mutex_t = util::safe_ptr<IDXGIKeyedMutex, Release<IDXGIKeyedMutex>>;
+
+  constexpr auto startup_timeout = 4s;  ///< Less than Apollo waits for us, so it sees why we failed
+  constexpr UINT acquire_timeout_ms = 100;  ///< How often the stop event is checked
+
+  helper::shared_t *shared;
+  HANDLE frame_event;
+  HANDLE stop_event;
+  helper::slot_t current;  ///< What every slot must carry, a slot is only written while it's free
+
+  bool stopping(DWORD timeout_ms = 0) {
+    return WaitForSingleObject(stop_event, timeout_ms) == WAIT_OBJECT_0;
+  }
+
+  int fail(HRESULT status, const char *what) {
+    shared->error = status;
+    strncpy_s(shared->error_message, what, _TRUNCATE);
+    shared->state = helper::state_e::failed;
+    SetEvent(frame_event);
+    return 1;
+  }
+
+  /**
+   * @brief Switch to the input desktop, which becomes the secure desktop for UAC prompts and the lock screen.
+   */
+  void sync_thread_desktop() {
+    auto desktop = OpenInputDesktop(DF_ALLOWOTHERACCOUNTHOOK, FALSE, GENERIC_ALL);
+    if (desktop) {
+      SetThreadDesktop(desktop);
+      CloseDesktop(desktop);
+    }
+  }
+
+  /**
+   * @brief Duplicate the output, retrying while the desktop switches.
+   * @param output The output.
+   * @param device The device.
+   * @param deadline When to give up, or `nullopt` to retry until Apollo stops us.
+   * @param status Receives the result of the last attempt.
+   * @return The duplication, empty on failure.
+   */
+  dup_t duplicate(IDXGIOutput *output, ID3D11Device *device, std::optional<std::chrono::steady_clock::time_point> deadline, HRESULT &status) {
+    output5_t output5;
+    output1_t output1;
+    if (shared->format_count == 0 || FAILED(output->QueryInterface(IID_IDXGIOutput5, (void **) &output5))) {
+      status = output->QueryInterface(IID_IDXGIOutput1, (void **) &output1);
+      if (FAILED(status)) {
+        return {};
+      }
+    }
+
+    while (true) {
+      sync_thread_desktop();
+
+      dup_t dup;
+      if (output5) {
+        status = output5->DuplicateOutput1(device, 0, shared->format_count, shared->formats, &dup);
+      } else {
+        status = output1->DuplicateOutput(device, &dup);
+      }
+      if (SUCCEEDED(status)) {
+        return dup;
+      }
+
+      if ((deadline && std::chrono::steady_clock::now() > *deadline) || stopping(200)) {
+        return {};
+      }
+    }
+  }
+
+  /**
+   * @brief Get the dirty rects and the destinations of the move rects of the acquired frame.
+   * @param dup The duplication.
+   * @param frame_info The frame info.
+   * @param metadata Buffer for the metadata.
+   * @param slot Receives the rects.
+   * @return `false` if the changed regions are unknown or too many.
+   */
+  bool get_dirty_rects(IDXGIOutputDuplication *dup, const DXGI_OUTDUPL_FRAME_INFO &frame_info, std::vector<std::uint8_t> &metadata, helper::slot_t &slot) {
+    slot.dirty_rect_count = 0;
+    if (frame_info.TotalMetadataBufferSize == 0) {
+      return false;
+    }
+    metadata.resize(frame_info.TotalMetadataBufferSize);
+
+    UINT move_rects_size = 0;
+    if (FAILED(dup->GetFrameMoveRects(metadata.size(), (DXGI_OUTDUPL_MOVE_RECT *) metadata.data(), &move_rects_size))) {
+      return false;
+    }
+
+    UINT dirty_rects_size = 0;
+    if (FAILED(dup->GetFrameDirtyRects(metadata.size() - move_rects_size, (RECT *) (metadata.data() + move_rects_size), &dirty_rects_size))) {
+      return false;
+    }
+
+    auto move_rect_count = move_rects_size / sizeof(DXGI_OUTDUPL_MOVE_RECT);
+    auto dirty_rect_count = dirty_rects_size / sizeof(RECT);
+    if (move_rect_count + dirty_rect_count > helper::max_dirty_rects) {
+      return false;
+    }
+
+    auto move_rects = (const DXGI_OUTDUPL_MOVE_RECT *) metadata.data();
+    for (UINT x = 0; x < move_rect_count; ++x) {
+      slot.dirty_rects[slot.dirty_rect_count++] = move_rects[x].DestinationRect;
+    }
+    std::copy_n((const RECT *) (metadata.data() + move_rects_size), dirty_rect_count, slot.dirty_rects + slot.dirty_rect_count);
+    slot.dirty_rect_count += dirty_rect_count;
+
+    return true;
+  }
+
+  bool same_texture(const D3D11_TEXTURE2D_DESC &a, const D3D11_TEXTURE2D_DESC &b) {
+    return a.Width == b.Width && a.Height == b.Height && a.Format == b.Format;
+  }
+
+  bool same_mode(const DXGI_OUTDUPL_DESC &a, const DXGI_OUTDUPL_DESC &b) {
+    return a.ModeDesc.Width == b.ModeDesc.Width && a.ModeDesc.Height == b.ModeDesc.Height &&
+           a.ModeDesc.Format == b.ModeDesc.Format && a.Rotation == b.Rotation;
+  }
+
+  int run() {
+    if (shared->version != helper::protocol_version) {
+      return fail(E_INVALIDARG, "Protocol version mismatch");
+    }
+
+    // DuplicateOutput1() requires per monitor DPI awareness
+    SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
+
+    factory1_t factory;
+    auto status = CreateDXGIFactory1(IID_IDXGIFactory1, (void **) &factory);
+    if (FAILED(status)) {
+      return fail(status, "CreateDXGIFactory1");
+    }
+
+    adapter_t adapter;
+    output_t output;
+    adapter_t::pointer adapter_p;
+    for (UINT x = 0; !output && factory->EnumAdapters1(x, &adapter_p) != DXGI_ERROR_NOT_FOUND; ++x) {
+      adapter_t candidate {adapter_p};
+
+      DXGI_ADAPTER_DESC1 adapter_desc;
+      candidate->GetDesc1(&adapter_desc);
+      if (adapter_desc.AdapterLuid.LowPart != shared->adapter_luid.LowPart || adapter_desc.AdapterLuid.HighPart != shared->adapter_luid.HighPart) {
+        continue;
+      }
+
+      output_t::pointer output_p;
+      for (UINT y = 0; candidate->EnumOutputs(y, &output_p) != DXGI_ERROR_NOT_FOUND; ++y) {
+        output_t candidate_output {output_p};
+
+        DXGI_OUTPUT_DESC output_desc;
+        candidate_output->GetDesc(&output_desc);
+        if (!wcsncmp(output_desc.DeviceName, shared->output_name, _countof(shared->output_name))) {
+          output = std::move(candidate_output);
+          adapter = std::move(candidate);
+          break;
+        }
+      }
+    }
+    if (!output) {
+      return fail(DXGI_ERROR_NOT_FOUND, "Output not found");
+    }
+
+    D3D_FEATURE_LEVEL feature_levels[] {D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0};
+    device_t device;
+    device_ctx_t device_ctx;
+    status = D3D11CreateDevice(adapter.get(), D3D_DRIVER_TYPE_UNKNOWN, nullptr, 0, feature_levels, _countof(feature_levels), D3D11_SDK_VERSION, &device, nullptr, &device_ctx);
+    if (FAILED(status)) {
+      return fail(status, "D3D11CreateDevice");
+    }
+
+    auto dup = duplicate(output.get(), device.get(), std::chrono::steady_clock::now() + startup_timeout, status);
+    if (!dup) {
+      return stopping() ? 0 : fail(status, "DuplicateOutput");
+    }
+
+    dup->GetDesc(&shared->desc);
+    shared->state = helper::state_e::running;
+    SetEvent(frame_event);
+
+    texture2d_t textures[helper::slot_count];
+    keyed_mutex_t mutexes[helper::slot_count];
+    D3D11_TEXTURE2D_DESC texture_desc {};
+
+    std::vector<std::uint8_t> pointer_shape;
+    std::vector<std::uint8_t> metadata;
+    bool resynced = true;  ///< The first frame of a duplication isn't relative to the previous one
+    int next_slot = 0;
+
+    while (!stopping()) {
+      DXGI_OUTDUPL_FRAME_INFO frame_info;
+      resource_t::pointer res_p {};
+      status = dup->AcquireNextFrame(acquire_timeout_ms, &frame_info, &res_p);
+      resource_t res {res_p};
+
+      if (status == DXGI_ERROR_WAIT_TIMEOUT) {
+        continue;
+      }
+
+      if (status == DXGI_ERROR_ACCESS_LOST || status == DXGI_ERROR_ACCESS_DENIED || status == WAIT_ABANDONED) {
+        // The desktop switched or the mode changed, the textures Apollo holds stay valid meanwhile
+        auto desc = shared->desc;
+        dup.reset();
+        dup = duplicate(output.get(), device.get(), std::nullopt, status);
+        if (!dup) {
+          return stopping() ? 0 : fail(status, "DuplicateOutput");
+        }
+
+        DXGI_OUTDUPL_DESC new_desc;
+        dup->GetDesc(&new_desc);
+        if (!same_mode(desc, new_desc)) {
+          shared->state = helper::state_e::reinit;
+          SetEvent(frame_event);
+          return 0;
+        }
+
+        resynced = true;
+        continue;
+      }
+
+      if (FAILED(status)) {
+        return fail(status, "AcquireNextFrame");
+      }
+      auto release_frame = util::fail_guard([&dup]() {
+        dup->ReleaseFrame();
+      });
+
+      const bool presented = frame_info.LastPresentTime.QuadPart != 0;
+      const bool mouse_moved = frame_info.LastMouseUpdateTime.QuadPart != 0;
+      if (!presented && !mouse_moved && frame_info.PointerShapeBufferSize == 0) {
+        continue;
+      }
+
+      if (frame_info.PointerShapeBufferSize > 0 && frame_info.PointerShapeBufferSize <= helper::max_pointer_shape_size) {
+        pointer_shape.resize(frame_info.PointerShapeBufferSize);
+
+        UINT required_size;
+        if (SUCCEEDED(dup->GetFramePointerShape(pointer_shape.size(), pointer_shape.data(), &required_size, &current.pointer_shape_info))) {
+          current.pointer_shape_size = (std::uint32_t) pointer_shape.size();
+          ++current.pointer_shape_sequence;
+        }
+      }
+
+      if (mouse_moved) {
+        current.pointer_position = frame_info.PointerPosition;
+        current.last_mouse_update_qpc = frame_info.LastMouseUpdateTime.QuadPart;
+        ++current.mouse_count;
+      }
+
+      if (presented) {
+        current.dirty_rects_valid = get_dirty_rects(dup.get(), frame_info, metadata, current) && !resynced;
+        current.last_present_qpc = frame_info.LastPresentTime.QuadPart;
+        ++current.present_count;
+        resynced = false;
+      } else {
+        // Nothing changed in the image since the previous sequence
+        current.dirty_rect_count = 0;
+        current.dirty_rects_valid = !resynced;
+      }
+
+      texture2d_t desktop;
+      status = res->QueryInterface(IID_ID3D11Texture2D, (void **) &desktop);
+      if (FAILED(status)) {
+        return fail(status, "QueryInterface(ID3D11Texture2D)");
+      }
+
+      D3D11_TEXTURE2D_DESC desktop_desc;
+      desktop->GetDesc(&desktop_desc);
+      if (!textures[0]) {
+        texture_desc = desktop_desc;
+        texture_desc.Usage = D3D11_USAGE_DEFAULT;
+        texture_desc.BindFlags = 0;
+        texture_desc.CPUAccessFlags = 0;
+        texture_desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED_NTHANDLE | D3D11_RESOURCE_MISC_SHARED_KEYEDMUTEX;
+
+        for (int x = 0; x < helper::slot_count; ++x) {
+          status = device->CreateTexture2D(&texture_desc, nullptr, &textures[x]);
+          if (FAILED(status)) {
+            return fail(status, "CreateTexture2D");
+          }
+
+          resource1_t resource;
+          status = textures[x]->QueryInterface(IID_IDXGIResource1, (void **) &resource);
+          if (FAILED(status)) {
+            return fail(status, "QueryInterface(IDXGIResource1)");
+          }
+
+          // Apollo duplicates the handle into its process, it's closed when we exit
+          HANDLE handle;
+          status = resource->CreateSharedHandle(nullptr, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE, nullptr, &handle);
+          if (FAILED(status)) {
+            return fail(status, "CreateSharedHandle");
+          }
+          shared->texture_handles[x] = (std::uintptr_t) handle;
+
+          status = textures[x]->QueryInterface(IID_IDXGIKeyedMutex, (void **) &mutexes[x]);
+          if (FAILED(status)) {
+            return fail(status, "QueryInterface(IDXGIKeyedMutex)");
+          }
+        }
+      } else if (!same_texture(texture_desc, desktop_desc)) {
+        shared->state = helper::state_e::reinit;
+        SetEvent(frame_event);
+        return 0;
+      }
+
+      // Never the slot Apollo reads from, nor the latest one it may be about to read
+      int slot;
+      do {
+        slot = next_slot;
+        next_slot = (next_slot + 1) % helper::slot_count;
+      } while ((slot == shared->reading_slot || slot == shared->latest_slot) && shared->latest_sequence != 0);
+
+      status = mutexes[slot]->AcquireSync(0, INFINITE);
+      if (status != S_OK) {
+        return fail(status, "AcquireSync");
+      }
+
+      device_ctx->CopyResource(textures[slot].get(), desktop.get());
+
+      auto &meta = shared->slots[slot];
+      if (meta.pointer_shape_sequence != current.pointer_shape_sequence) {
+        std::memcpy(meta.pointer_shape, pointer_shape.data(), current.pointer_shape_size);
+      }
+      current.sequence = shared->latest_sequence + 1;
+      std::memcpy(&meta, &current, offsetof(helper::slot_t, pointer_shape));
+      meta.dirty_rects_valid = current.dirty_rects_valid;
+      meta.dirty_rect_count = current.dirty_rect_count;
+      std::copy_n(current.dirty_rects, current.dirty_rect_count, meta.dirty_rects);
+
+      mutexes[slot]->ReleaseSync(0);
+
+      shared->latest_slot.store(slot, std::memory_order_release);
+      shared->latest_sequence.store(current.sequence, std::memory_order_release);
+      SetEvent(frame_event);
+    }
+
+    return 0;
+  }
+}  // namespace
+
+/**
+ * @brief Capture until Apollo sets the stop event.
+ * @details Launched by Apollo as `capture-helper.exe <mapping> <frame event> <stop event>`, the arguments
+ *          being the values of inherited handles.
+ */
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    return 2;
+  }
+
+  auto mapping = (HANDLE) (std::uintptr_t) std::stoull(argv[1]);
+  frame_event = (HANDLE) (std::uintptr_t) std::stoull(argv[2]);
+  stop_event = (HANDLE) (std::uintptr_t) std::stoull(argv[3]);
+
+  shared = (helper::shared_t *) MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(helper::shared_t));
+  if (!shared) {
+    return 3;
+  }
+
+  return run();
+}